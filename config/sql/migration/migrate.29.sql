@@ -0,0 +1,10 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+ALTER TABLE meta ADD COLUMN encoding INTEGER NOT NULL DEFAULT 0;
+ALTER TABLE delegations ADD COLUMN encoding INTEGER NOT NULL DEFAULT 0;
+
+DELETE FROM version;
+INSERT INTO version VALUES(29);
+
+RELEASE MIGRATION;
@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+-- The schema version is also kept in user_version in the database header, so
+-- that the version table need not be read on startup. It is only set by the
+-- code, after the migrations ran.
+
+DELETE FROM version;
+INSERT INTO version VALUES(31);
+
+RELEASE MIGRATION;
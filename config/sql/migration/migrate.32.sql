@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE device_data_documents(data_type TEXT PRIMARY KEY, document TEXT NOT NULL, deltas INTEGER NOT NULL DEFAULT 0);
+
+DELETE FROM version;
+INSERT INTO version VALUES(32);
+
+RELEASE MIGRATION;
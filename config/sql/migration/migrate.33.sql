@@ -0,0 +1,9 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+CREATE TABLE network_cache(name TEXT PRIMARY KEY, value BLOB NOT NULL, expires INTEGER NOT NULL);
+
+DELETE FROM version;
+INSERT INTO version VALUES(33);
+
+RELEASE MIGRATION;
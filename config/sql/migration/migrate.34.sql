@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT MIGRATION;
+
+-- The fingerprints of the imported files were kept with the hashes of the device data reports.
+CREATE TABLE import_fingerprints(path TEXT PRIMARY KEY, fingerprint TEXT NOT NULL);
+DELETE FROM device_data WHERE data_type LIKE 'import:%';
+
+DELETE FROM version;
+INSERT INTO version VALUES(34);
+
+RELEASE MIGRATION;
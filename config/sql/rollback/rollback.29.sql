@@ -0,0 +1,23 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+-- Compressed metadata can't be read by older versions; it is fetched again.
+DELETE FROM meta WHERE encoding != 0;
+DELETE FROM delegations WHERE encoding != 0;
+
+CREATE TABLE meta_migrate(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, UNIQUE(repo, meta_type, version));
+INSERT INTO meta_migrate(meta, repo, meta_type, version) SELECT meta.meta, meta.repo, meta.meta_type, meta.version FROM meta;
+
+DROP TABLE meta;
+ALTER TABLE meta_migrate RENAME TO meta;
+
+CREATE TABLE delegations_migrate(meta BLOB NOT NULL, role_name TEXT NOT NULL, UNIQUE(role_name));
+INSERT INTO delegations_migrate(meta, role_name) SELECT delegations.meta, delegations.role_name FROM delegations;
+
+DROP TABLE delegations;
+ALTER TABLE delegations_migrate RENAME TO delegations;
+
+DELETE FROM version;
+INSERT INTO version VALUES(28);
+
+RELEASE ROLLBACK_MIGRATION;
@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+DROP INDEX installed_versions_ecu;
+DROP INDEX installed_versions_current;
+DROP INDEX installed_versions_pending;
+
+DELETE FROM version;
+INSERT INTO version VALUES(29);
+
+RELEASE ROLLBACK_MIGRATION;
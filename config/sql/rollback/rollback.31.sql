@@ -0,0 +1,11 @@
+-- Don't modify this! Create a new migration instead--see docs/ota-client-guide/modules/ROOT/pages/schema-migrations.adoc
+SAVEPOINT ROLLBACK_MIGRATION;
+
+-- Older versions don't know about user_version, and could leave it behind
+-- after migrating the schema.
+PRAGMA user_version = 0;
+
+DELETE FROM version;
+INSERT INTO version VALUES(30);
+
+RELEASE ROLLBACK_MIGRATION;
@@ -1,16 +1,19 @@
 CREATE TABLE version(version INTEGER);
-INSERT INTO version(rowid,version) VALUES(1,25);
+INSERT INTO version(rowid,version) VALUES(1,34);
 CREATE TABLE device_info(unique_mark INTEGER PRIMARY KEY CHECK (unique_mark = 0), device_id TEXT, is_registered INTEGER NOT NULL DEFAULT 0 CHECK (is_registered IN (0,1)));
 CREATE TABLE ecus(id INTEGER PRIMARY KEY, serial TEXT UNIQUE, hardware_id TEXT NOT NULL, is_primary INTEGER NOT NULL DEFAULT 0 CHECK (is_primary IN (0,1)));
 CREATE TABLE secondary_ecus(serial TEXT PRIMARY KEY, sec_type TEXT, public_key_type TEXT, public_key TEXT, extra TEXT, manifest TEXT);
 CREATE TABLE misconfigured_ecus(serial TEXT UNIQUE, hardware_id TEXT NOT NULL, state INTEGER NOT NULL CHECK (state IN (0,1)));
 CREATE TABLE installed_versions(id INTEGER PRIMARY KEY, ecu_serial TEXT NOT NULL, sha256 TEXT NOT NULL, name TEXT NOT NULL, hashes TEXT NOT NULL, length INTEGER NOT NULL DEFAULT 0, correlation_id TEXT NOT NULL DEFAULT '', is_current INTEGER NOT NULL CHECK (is_current IN (0,1)) DEFAULT 0, is_pending INTEGER NOT NULL CHECK (is_pending IN (0,1)) DEFAULT 0, was_installed INTEGER NOT NULL CHECK (was_installed IN (0,1)) DEFAULT 0, custom_meta TEXT NOT NULL DEFAULT "");
+CREATE INDEX installed_versions_ecu ON installed_versions(ecu_serial);
+CREATE INDEX installed_versions_current ON installed_versions(ecu_serial) WHERE is_current = 1;
+CREATE INDEX installed_versions_pending ON installed_versions(ecu_serial, sha256) WHERE is_pending = 1;
 CREATE TABLE primary_keys(unique_mark INTEGER PRIMARY KEY CHECK (unique_mark = 0), private TEXT, public TEXT);
 CREATE TABLE tls_creds(ca_cert BLOB, ca_cert_format TEXT,
                        client_cert BLOB, client_cert_format TEXT,
                        client_pkey BLOB, client_pkey_format TEXT);
-CREATE TABLE meta(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, UNIQUE(repo, meta_type, version));
-CREATE TABLE target_images(targetname TEXT PRIMARY KEY, real_size INTEGER NOT NULL DEFAULT 0, sha256 TEXT NOT NULL DEFAULT "", sha512 TEXT NOT NULL DEFAULT "", filename TEXT NOT NULL);
+CREATE TABLE meta(meta BLOB NOT NULL, repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, version INTEGER NOT NULL, encoding INTEGER NOT NULL DEFAULT 0, UNIQUE(repo, meta_type, version));
+CREATE TABLE target_images(targetname TEXT PRIMARY KEY, real_size INTEGER NOT NULL DEFAULT 0, sha256 TEXT NOT NULL DEFAULT "", sha512 TEXT NOT NULL DEFAULT "", filename TEXT NOT NULL, last_used INTEGER NOT NULL DEFAULT 0);
 CREATE TABLE repo_types(repo INTEGER NOT NULL, repo_string TEXT NOT NULL);
 CREATE TABLE meta_types(meta INTEGER NOT NULL, meta_string TEXT NOT NULL);
 INSERT INTO meta_types(rowid,meta,meta_string) VALUES(1,0,'root');
@@ -23,7 +26,12 @@ CREATE TABLE device_installation_result(unique_mark INTEGER PRIMARY KEY CHECK (u
 CREATE TABLE ecu_installation_results(ecu_serial TEXT NOT NULL PRIMARY KEY, success INTEGER NOT NULL DEFAULT 0, result_code TEXT NOT NULL DEFAULT "", description TEXT NOT NULL DEFAULT "");
 CREATE TABLE need_reboot(unique_mark INTEGER PRIMARY KEY CHECK (unique_mark = 0), flag INTEGER NOT NULL DEFAULT 0);
 CREATE TABLE rollback_migrations(version_from INT PRIMARY KEY, migration TEXT NOT NULL);
-CREATE TABLE delegations(meta BLOB NOT NULL, role_name TEXT NOT NULL, UNIQUE(role_name));
+CREATE TABLE delegations(meta BLOB NOT NULL, role_name TEXT NOT NULL, encoding INTEGER NOT NULL DEFAULT 0, UNIQUE(role_name));
 CREATE TABLE ecu_report_counter(ecu_serial TEXT NOT NULL PRIMARY KEY, counter INTEGER NOT NULL DEFAULT 0);
 CREATE TABLE report_events(id INTEGER PRIMARY KEY, json_string TEXT NOT NULL);
 CREATE TABLE device_data(data_type TEXT PRIMARY KEY, hash TEXT NOT NULL);
+CREATE TABLE device_data_documents(data_type TEXT PRIMARY KEY, document TEXT NOT NULL, deltas INTEGER NOT NULL DEFAULT 0);
+CREATE TABLE meta_validators(repo INTEGER NOT NULL, meta_type INTEGER NOT NULL, etag TEXT NOT NULL DEFAULT "", last_modified TEXT NOT NULL DEFAULT "", UNIQUE(repo, meta_type));
+CREATE TABLE verified_signatures(digest TEXT NOT NULL PRIMARY KEY);
+CREATE TABLE network_cache(name TEXT PRIMARY KEY, value BLOB NOT NULL, expires INTEGER NOT NULL);
+CREATE TABLE import_fingerprints(path TEXT PRIMARY KEY, fingerprint TEXT NOT NULL);
@@ -10,6 +10,7 @@ using Campaign = campaign::Campaign;
 using Updates = std::vector<Uptane::Target>;
 using Target = Uptane::Target;
 using StorageTargetHandle = std::ifstream;
+struct Aktualizr_Request;
 
 extern "C" {
 #else
@@ -18,6 +19,7 @@ typedef struct Campaign Campaign;
 typedef struct Updates Updates;
 typedef struct Target Target;
 typedef struct StorageTargetHandle StorageTargetHandle;
+typedef struct Aktualizr_Request Aktualizr_Request;
 #endif
 
 Aktualizr *Aktualizr_create_from_cfg(Config *cfg);
@@ -46,6 +48,33 @@ int Aktualizr_download_target(Aktualizr *a, Target *t);
 
 int Aktualizr_install_target(Aktualizr *a, Target *t);
 
+/*
+ * Asynchronous variants of Aktualizr_updates_check, Aktualizr_download_target
+ * and Aktualizr_install_target, which return at once. The request completes
+ * on a libaktualizr thread: the callback, if any, is then called on that
+ * thread, and the file descriptor of the request becomes readable, for the
+ * request to be driven from an event loop. A NULL return means the request
+ * could not be started.
+ */
+typedef void (*Aktualizr_request_callback)(Aktualizr_Request *r, void *user_data);
+
+Aktualizr_Request *Aktualizr_updates_check_async(Aktualizr *a, Aktualizr_request_callback cb, void *user_data);
+Aktualizr_Request *Aktualizr_download_target_async(Aktualizr *a, Target *t, Aktualizr_request_callback cb,
+                                                   void *user_data);
+Aktualizr_Request *Aktualizr_install_target_async(Aktualizr *a, Target *t, Aktualizr_request_callback cb,
+                                                  void *user_data);
+/* Readable once the request has completed, and from then on; closed by Aktualizr_request_free */
+int Aktualizr_request_fd(Aktualizr_Request *r);
+/* 1 once the request has completed, 0 before */
+int Aktualizr_request_done(Aktualizr_Request *r);
+/* Waits for the request to complete, then 0 on success, -1 on failure */
+int Aktualizr_request_result(Aktualizr_Request *r);
+/* Waits for an updates check to complete, then its updates as Aktualizr_updates_check returns them, to be freed
+ * with Aktualizr_updates_free. NULL after the first call. */
+Updates *Aktualizr_request_updates(Aktualizr_Request *r);
+/* Waits for the request to complete; not to be called from its callback */
+void Aktualizr_request_free(Aktualizr_Request *r);
+
 int Aktualizr_send_manifest(Aktualizr *a, const char *manifest);
 int Aktualizr_send_device_data(Aktualizr *a);
 
@@ -53,6 +82,22 @@ StorageTargetHandle *Aktualizr_open_stored_target(Aktualizr *a, const Target *t)
 size_t Aktualizr_read_stored_target(StorageTargetHandle *handle, uint8_t* buf, size_t size);
 int Aktualizr_close_stored_target(StorageTargetHandle *handle);
 
+/*
+ * Zero-copy access to a verified stored target. The file descriptor is
+ * read-only and closed by the caller with close(). The mapping is released
+ * with Aktualizr_unmap_stored_target. Both keep giving the verified data until
+ * then, even if the target is deleted in the meantime; data is NULL for an
+ * empty target.
+ */
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} Stored_Target_Mapping_C;
+
+int Aktualizr_open_stored_target_fd(Aktualizr *a, const Target *t);
+int Aktualizr_map_stored_target(Aktualizr *a, const Target *t, Stored_Target_Mapping_C *mapping);
+int Aktualizr_unmap_stored_target(Stored_Target_Mapping_C *mapping);
+
 typedef enum {
   kSuccess = 0,
   kAlreadyPaused,
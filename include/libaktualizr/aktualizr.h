@@ -1,17 +1,24 @@
 #ifndef AKTUALIZR_H_
 #define AKTUALIZR_H_
 
+#include <atomic>
+#include <chrono>
 #include <future>
 #include <memory>
+#include <mutex>
 
 #include <boost/signals2.hpp>
 
 #include "libaktualizr/config.h"
 #include "libaktualizr/events.h"
+#include "libaktualizr/packagemanagerinterface.h"
 #include "libaktualizr/secondaryinterface.h"
 
 class SotaUptaneClient;
+class DeviceDataScheduler;
 class INvStorage;
+class AllocationReporter;
+class MetricsExporter;
 
 namespace api {
 class CommandQueue;
@@ -86,6 +93,8 @@ class Aktualizr {
    * Check for campaigns.
    * Campaigns are a concept outside of Uptane, and allow for user approval of
    * updates before the contents of the update are known.
+   * Once the device is provisioned, runs beside a download or installation in
+   * progress. Joins a campaign check that is still queued.
    * @return std::future object with data about available campaigns.
    *
    * @throw std::bad_alloc (memory allocation failure)
@@ -112,6 +121,8 @@ class Aktualizr {
   /**
    * Send local device data to the server.
    * This includes network status, installed packages, hardware etc.
+   * Once the device is provisioned, runs beside a download or installation in
+   * progress. Joins a call that is still queued.
    * @return Empty std::future object
    *
    * @throw SQLException
@@ -127,7 +138,7 @@ class Aktualizr {
    * Fetch Uptane metadata and check for updates.
    * This collects a client manifest, PUTs it to the director, updates the
    * Uptane metadata (including root and targets), and then checks the metadata
-   * for target updates.
+   * for target updates. Joins an update check that is still queued.
    * @return Information about available updates.
    *
    * @throw SQLException
@@ -140,6 +151,23 @@ class Aktualizr {
    */
   std::future<result::UpdateCheck> CheckUpdates();
 
+  /**
+   * Check for updates in an offline bundle, such as one on a USB drive, rather
+   * than on the server. The metadata of the bundle is verified and stored as if
+   * it came from the server, and the targets of the updates are then taken from
+   * the bundle by Download(), which is why the file has to stay in place until
+   * they are downloaded. Nothing is sent to the server. See
+   * Uptane::OfflineBundle for the format.
+   * @param bundle Path of the bundle
+   * @return Information about available updates.
+   *
+   * @throw SQLException
+   * @throw std::bad_alloc (memory allocation failure)
+   * @throw std::system_error (failure to lock a mutex)
+   * @throw SotaUptaneClient::NotProvisionedYet (called before provisioning complete)
+   */
+  std::future<result::UpdateCheck> CheckUpdatesFromBundle(const boost::filesystem::path& bundle);
+
   /**
    * Download targets.
    * @param updates Vector of targets to download as provided by CheckUpdates.
@@ -205,6 +233,35 @@ class Aktualizr {
    */
   std::ifstream OpenStoredTarget(const Uptane::Target& target);
 
+  /**
+   * Get a file descriptor of a target downloaded in Download call, verified as
+   * OpenStoredTarget does, to read or map the binary without copying it
+   * through a stream. The caller owns the descriptor and closes it. Aktualizr
+   * never rewrites a stored target in place, so the data read through the
+   * descriptor stays the verified one until it is closed, even if the target
+   * is deleted or evicted in the meantime.
+   * @param target Target object matching the desired target in the storage.
+   * @return A read-only file descriptor of the stored binary.
+   *
+   * @throw SQLException
+   * @throw std::runtime_error (target not found, not verified or not readable)
+   */
+  int OpenStoredTargetFd(const Uptane::Target& target);
+
+  /**
+   * Have Download() stream the binary targets of a type, the targetFormat of
+   * their custom metadata, to the application instead of storing them, e.g.
+   * for data installed by the application itself. consumer is asked for a
+   * stream for each target of the type that is only for the Primary; the
+   * stream gets the data as it arrives and, at the end, whether all of it
+   * matched the metadata. Such targets are not stored, so they can't be read
+   * with OpenStoredTarget or given to Install(). Without data() in the
+   * stream, the target is stored as usual.
+   * @param type type of the targets
+   * @param consumer gives the stream of a target; empty to store the targets of the type again
+   */
+  void SetTargetConsumer(const std::string& type, TargetConsumer consumer);
+
   /**
    * Install targets.
    * @param updates Vector of targets to install as provided by CheckUpdates or
@@ -338,6 +395,28 @@ class Aktualizr {
    */
   void SetCustomHardwareInfo(Json::Value hwinfo);
 
+  /**
+   * Tell the cost of the current network link, with network.link_aware set,
+   * e.g. from a connection manager of the application. The downloads follow
+   * the policy of the link: see network.metered_policy and
+   * network.roaming_policy. The link state file, if set, overrides it
+   * whenever it is written.
+   * @param link the type of the link
+   */
+  void SetLinkType(LinkType link);
+
+  /**
+   * The metrics of the process: the latency of the HTTP requests by endpoint,
+   * the bytes downloaded and hashed, the latency of the SQLite statements and
+   * of the requests to the Secondaries, and the depth of the command queue.
+   *
+   * @return an object with a member per metric, with its type, help text and
+   *         series. A series has its labels and the value of a counter or a
+   *         gauge, or the count, sum, p50, p90, p99 and max of a histogram,
+   *         in seconds for the durations.
+   */
+  static Json::Value GetMetrics();
+
   // The type proxy is needed in doxygen 1.8.16 because of this bug
   // https://github.com/doxygen/doxygen/issues/7236
   using SigHandler = std::function<void(std::shared_ptr<event::BaseEvent>)>;
@@ -360,15 +439,43 @@ class Aktualizr {
   std::shared_ptr<SotaUptaneClient> uptane_client_;
 
  private:
+  // The steps of UptaneCycle(), which reports their I/O
+  bool runUptaneCycle();
+  // Wait with the lock of exit_cond_ held until the next update check of
+  // RunForever(), checking for new Director Targets metadata in between if
+  // heartbeat is set, and reporting the device data when it is due if
+  // device_data is given. Returns false on shutdown.
+  bool waitForUptaneCycle(std::unique_lock<std::mutex>& lock, std::chrono::milliseconds delay,
+                          std::chrono::milliseconds heartbeat, DeviceDataScheduler* device_data);
+  // Report the device data that is due
+  void reportDeviceData(DeviceDataScheduler& device_data);
+  // Time until the verified Uptane metadata expires, 0 if it doesn't or already has
+  std::chrono::milliseconds metadataExpiryDelay();
+
   struct {
     std::mutex m;
     std::condition_variable cv;
     bool flag = false;
+    // Set when the server announced new updates
+    bool wake = false;
+    // Set while RunForever() runs
+    bool running = false;
   } exit_cond_;
 
   std::shared_ptr<INvStorage> storage_;
+  std::shared_ptr<HttpInterface> http_;
   std::shared_ptr<event::Channel> sig_;
   std::unique_ptr<api::CommandQueue> api_queue_;
+  std::unique_ptr<MetricsExporter> metrics_exporter_;
+  std::unique_ptr<AllocationReporter> allocation_reporter_;
+  // Whether the last UptaneCycle() failed to check for or download updates
+  bool cycle_failed_{false};
+  // Whether a campaign was accepted and its update hasn't been found yet
+  std::atomic<bool> campaign_pending_{false};
+  // Whether an update is waiting for a link it can be downloaded on
+  std::atomic<bool> download_deferred_{false};
+  // The subscription to the changes of the network link, if link-aware
+  int link_listener_{-1};
 };
 
 #endif  // AKTUALIZR_H_
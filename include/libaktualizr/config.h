@@ -17,6 +17,10 @@
 
 struct LoggerConfig {
   int loglevel{2};
+  // "console", or "journald" to send the records straight to the systemd journal
+  std::string output{"console"};
+  // Write the records on a thread of their own, dropping them when it falls behind
+  bool async{false};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -48,6 +52,52 @@ struct TlsConfig {
   void writeToStream(std::ostream& out_stream) const;
 };
 
+/** Cost of the network link, for NetworkConfig::link_aware */
+enum class LinkType { kUnknown = 0, kUnmetered, kMetered, kRoaming };
+
+/**
+ * @brief The NetworkConfig struct
+ * Tuning of the HTTP transport shared by all server connections.
+ */
+struct NetworkConfig {
+  // Attach all HttpClient instances to a process-wide curl share handle, so
+  // that they can reuse connections, TLS sessions and DNS results.
+  bool share_connections{false};
+  // Ask for compressed responses to metadata requests and gzip request bodies
+  // of at least compression_threshold bytes.
+  bool compression{false};
+  uint64_t compression_threshold{1024};
+  // Adapt the download rate to a share of the estimated link capacity, backing
+  // off when the round-trip time or error rate rises. bandwidth_ceiling (in
+  // bytes per second, 0 for none) caps the rate in any case.
+  bool bandwidth_shaping{false};
+  double bandwidth_share{0.5};
+  uint64_t bandwidth_ceiling{0};
+  // Run the transfers of all HttpClient instances on a single thread, through
+  // a process-wide curl multi handle, instead of on the calling threads.
+  bool event_loop{false};
+  // Keep the TLS sessions and the DNS results in storage, so that the first
+  // requests after a restart resume a session. The DNS results are used for
+  // dns_cache_ttl_sec after they were seen.
+  bool persist_sessions{false};
+  uint64_t dns_cache_ttl_sec{300};
+  // Follow the cost of the network link, given with Aktualizr::SetLinkType()
+  // or read from link_state_file: the downloads on metered and roaming links
+  // run at "full" speed, "throttled" to throttled_rate bytes per second, or
+  // not at all with "metadata_only"
+  bool link_aware{false};
+  boost::filesystem::path link_state_file;
+  std::string metered_policy{"throttled"};
+  std::string roaming_policy{"metadata_only"};
+  uint64_t throttled_rate{64 * 1024};
+  // Append all the HTTP requests and responses of Aktualizr to this file, for
+  // HttpReplay; empty for none
+  boost::filesystem::path record_file;
+
+  void updateFromPropertyTree(const boost::property_tree::ptree& pt);
+  void writeToStream(std::ostream& out_stream) const;
+};
+
 struct ProvisionConfig {
   std::string server;
   std::string p12_password;
@@ -65,13 +115,116 @@ struct ProvisionConfig {
 
 struct UptaneConfig {
   uint64_t polling_sec{10U};
+  // Random spread of the polling interval, in percent of it
+  uint64_t polling_jitter_percent{0U};
+  // Longest polling interval after failed update checks; 0 disables the backoff
+  uint64_t polling_max_backoff_sec{0U};
+  // Polling interval while a campaign is pending; 0 uses polling_sec
+  uint64_t polling_pending_sec{0U};
+  // Interval between the checks for new Director Targets metadata alone,
+  // which start a full update check if it changed; 0 disables them
+  uint64_t polling_heartbeat_sec{0U};
+  // Long-poll URL on which the server announces new updates; empty to only poll
+  std::string notification_url;
+  // Size of the queue through which the events are delivered on their own
+  // thread; 0 delivers them on the thread that sends them
+  uint64_t event_queue_size{0U};
+  // Report the device data after the first update check of RunForever, so
+  // that an installation finalized at boot is reported first
+  bool defer_device_data{false};
   std::string director_server;
   std::string repo_server;
+  // Mirrors of director_server and repo_server, as "url,url" with an optional
+  // weight after each URL, e.g. "https://mirror.example.com 2"
+  std::string director_mirrors;
+  std::string repo_mirrors;
   CryptoSource key_source{CryptoSource::kFile};
   KeyType key_type{KeyType::kRSA2048};
   bool force_install_completion{false};
   boost::filesystem::path secondary_config_file;
   uint64_t secondary_preinstall_wait_sec{600U};
+  uint64_t max_parallel_downloads{1U};
+  // Minimum time between two reports of the progress of all the downloads or
+  // installations together; 0 disables them
+  uint64_t transfer_progress_interval_ms{0U};
+  // Maximum number of Secondaries sent their firmware at the same time; 0 means no limit
+  uint64_t max_parallel_secondary_transfers{0U};
+  // The same per Secondary type, as "type:limit,type:limit"
+  std::string secondary_transfer_limits;
+  // "director" to send the firmware in the order of the Director, or "largest_first"
+  std::string secondary_transfer_order{"director"};
+  // ECU serials or hardware IDs, separated by commas, sent their firmware before the others
+  std::string critical_ecus;
+  // Secondaries installed only after others, as "ecu:dependency,ecu:dependency"
+  // with ECU serials or hardware IDs; the others are installed as soon as they are sent their firmware
+  std::string secondary_install_dependencies;
+  // Send the images to the Secondaries that support it while they are downloaded
+  bool secondary_cut_through{false};
+  // Send an image needed by several Secondaries to all of them at the same time, from one read of the stored file
+  bool secondary_fan_out{false};
+  // Time to wait for the manifests of the Secondaries; 0 waits as long as they take
+  uint64_t secondary_manifest_timeout_sec{0U};
+  // Minimum time between two uploads of an unchanged manifest; 0 uploads it every time
+  uint64_t unchanged_manifest_interval_sec{0U};
+  // Number of successful signature verifications remembered; 0 disables
+  uint64_t signature_cache_size{1024U};
+  bool persist_signature_cache{false};
+  // Share the verified Image repo Targets metadata with the other clients of
+  // the process that trust the same Image repo Root
+  bool share_image_metadata{false};
+  // Minimum time between checks for a new Root version; 0 checks on every update
+  uint64_t root_probe_interval_sec{0U};
+  // Fetch the changed metadata of each repository in one request
+  bool metadata_bundle{false};
+  // Fetch the Image repo metadata while the Director metadata is updated,
+  // before knowing whether there is an update that needs it
+  bool prefetch_image_meta{false};
+  // Largest metadata file or bundle accepted from the servers, to bound the
+  // memory used for it; 0 uses the defaults for each role
+  uint64_t max_metadata_size_kb{0U};
+  // Memory the client is expected to stay within; when set, the memory
+  // high-water mark of each update check, download, installation and device
+  // data report is logged, with a warning when it exceeds this. 0 disables
+  uint64_t memory_budget_kb{0U};
+  // File to which a trace of the phases of each update check, download,
+  // installation and manifest upload is appended as OpenTelemetry JSON; empty
+  // disables the tracing
+  boost::filesystem::path trace_file;
+  // Add the durations of the traced phases of an update to its installation report
+  bool trace_in_report{false};
+  // Time for which the list of campaigns is taken from the cache rather than
+  // requested again on a campaign check; 0 requests it on every check
+  uint64_t campaign_cache_ttl_sec{0U};
+  // Largest request for sending report events to the server, which they are
+  // sent in as many requests as it takes; 0 sends them all in one request
+  uint64_t report_events_max_request_kb{1024U};
+  // Download the binary targets of an update in the background as soon as an
+  // update check finds it, before Download() is called, with at most
+  // prefetch_bandwidth_share of the estimated link capacity
+  bool prefetch{false};
+  double prefetch_bandwidth_share{0.2};
+  // Scheduling of the background work, e.g. downloads, hashing, OSTree
+  // checkouts, transfers to the Secondaries and storage maintenance, until an
+  // installation is started: a nice level (0 leaves it), an I/O class,
+  // "best-effort" or "idle" (empty leaves it), and a cgroup directory the
+  // threads are moved to (empty leaves them)
+  int background_nice{0};
+  std::string background_io_class;
+  boost::filesystem::path background_cgroup;
+  // System pressure (PSI), in %, from which the hashing, verification,
+  // transfers to the Secondaries, storage maintenance and OSTree checkouts are
+  // slowed down, and from which they are paused for at most admission_max_pause_sec;
+  // 0 disables each
+  double admission_slow_pressure{0};
+  double admission_pause_pressure{0};
+  uint64_t admission_max_pause_sec{60U};
+  // Time budgets of UptaneCycle() and of its update check, download and
+  // installation, after which the work in progress is cancelled and left to
+  // the next cycle; 0 disables each
+  uint64_t cycle_budget_sec{0U};
+  uint64_t check_budget_sec{0U};
+  uint64_t download_budget_sec{0U};
+  uint64_t install_budget_sec{0U};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -94,11 +247,59 @@ struct PackageConfig {
   std::string os;
   boost::filesystem::path sysroot;
   std::string ostree_server;
+  // Use of the static deltas of the OSTree server: "prefer", "only" or "never"
+  std::string ostree_static_deltas{"prefer"};
+  // Retries of a failed OSTree request on a network error
+  uint64_t ostree_network_retries{5U};
+  // Comma-separated paths of local OSTree repos looked up before fetching objects
+  std::string ostree_localcache_repos;
+  // Archive repo that the commits of OSTree Secondaries are pulled into, served
+  // to them on ostree_mirror_url; empty disables the mirror.
+  boost::filesystem::path ostree_mirror_path;
+  std::string ostree_mirror_url;
+  // Check out a downloaded commit in the background, before it is installed
+  bool ostree_prestage{false};
   boost::filesystem::path images_path{"/var/sota/images"};
+  // Disk budget in bytes for the files in images_path, least recently used
+  // files are removed to stay within it; 0 means unlimited.
+  uint64_t images_cache_size{0U};
+  // Remove the files in images_path that no ECU has installed or is about to
+  // install, but the images_gc_keep most recently used ones
+  bool images_gc{false};
+  uint64_t images_gc_keep{2U};
   boost::filesystem::path packages_file{"/usr/package.manifest"};
+  // Number of byte ranges a large binary Target is split into and fetched in parallel
+  uint64_t download_segments{1U};
+  // Number of 64 KiB buffers queued between the network and the thread that
+  // writes and hashes a binary Target; 0 writes from the network thread.
+  uint64_t download_buffers{0U};
+  // Number of bytes of a binary Target downloaded between saves of the hash
+  // state, which a resumed download continues from; 0 disables them. The
+  // saves need the slower libsodium hashers, as the state of OpenSSL's EVP
+  // can't be saved.
+  uint64_t hash_checkpoint_interval{0U};
+  // Requests in flight when the binary Targets are written and read again
+  // through io_uring, where the kernel supports it; 0 uses the iostreams.
+  uint64_t io_uring_queue_depth{0U};
+  // Base URL of a cache on the local network, e.g. another device with
+  // peer_server_port, that binary Targets are downloaded from before the
+  // servers; empty for none
+  std::string peer_cache_url;
+  // Port on which the stored binary Targets are served to peers; 0 to not serve them
+  uint64_t peer_server_port{0U};
 
   // Options for simulation
   bool fake_need_reboot{false};
+  // Durations of the steps of the fake package manager, as TimeDistribution
+  // descriptions in seconds: a part for each step and a part for each MiB of
+  // the Target. Empty for none.
+  std::string fake_fetch_time;
+  std::string fake_fetch_time_per_mib;
+  std::string fake_install_time;
+  std::string fake_install_time_per_mib;
+  std::string fake_finalize_time;
+  // Seed of the random durations; 0 for a different one each time
+  uint64_t fake_time_seed{0U};
   BootedType booted{BootedType::kBooted};
 
   // for specialized configuration
@@ -122,6 +323,20 @@ struct StorageConfig {
 
   // SQLite storage
   utils::BasedPath sqldb_path{"sql.db"};  // based on `/var/sota`
+  // Store non-Root metadata compressed
+  bool compress_metadata{false};
+  // Use SQLite write-ahead logging, and only sync critical writes right away
+  bool write_ahead_log{false};
+  // Database of its own for report events and device data, based on `path` (empty to keep them in sqldb_path)
+  utils::BasedPath sqldb_events_path{""};
+  // Most report events kept while they can't be sent, the oldest are dropped (0 for no limit)
+  uint64_t report_events_max_count{0U};
+  // Most bytes of report events kept while they can't be sent (0 for no limit)
+  uint64_t report_events_max_size{0U};
+  // Most entries of the installation log kept per ECU besides the current and pending ones (0 for no limit)
+  uint64_t installation_log_max_count{0U};
+  // Memory storage: seconds between snapshots of the database to sqldb_path, which is loaded on startup (0 for none)
+  uint64_t memory_snapshot_interval{0U};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -146,6 +361,24 @@ struct ImportConfig {
 struct TelemetryConfig {
   bool report_network{true};
   bool report_config{true};
+  // Report the changes of the installed packages as a JSON Patch when the server accepts it
+  bool report_packages_delta{false};
+  // Delta reports of the installed packages before they are reported in full again
+  uint64_t packages_full_report_interval{20U};
+  // Seconds after which each kind of device data is reported again if it has
+  // changed, 0 for only on the occasions it always is
+  uint64_t report_hardware_interval_sec{0U};
+  uint64_t report_packages_interval_sec{0U};
+  uint64_t report_network_interval_sec{0U};
+  // File to which the metrics of the client are regularly written, in the Prometheus text format
+  boost::filesystem::path metrics_file;
+  uint64_t metrics_interval_sec{60U};
+  // TCP port of the loopback interface on which the metrics are served (0 disables)
+  uint16_t metrics_port{0};
+  // Send an UptaneCycleIo event with the I/O of each update cycle
+  bool report_cycle_io{false};
+  // Seconds between the reports of the heap usage of each subsystem, 0 for none (needs ALLOCATION_ACCOUNTING)
+  uint64_t heap_report_interval_sec{0U};
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
 };
@@ -158,6 +391,7 @@ struct BootloaderConfig {
   boost::filesystem::path reboot_sentinel_dir{"/var/run/aktualizr-session"};
   boost::filesystem::path reboot_sentinel_name{"need_reboot"};
   std::string reboot_command{"/sbin/reboot"};
+  boost::filesystem::path uboot_env_config{"/etc/fw_env.config"};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -223,6 +457,7 @@ class Config : public BaseConfig {
   LoggerConfig logger;
   P11Config p11;
   TlsConfig tls;
+  NetworkConfig network;
   ProvisionConfig provision;
   UptaneConfig uptane;
   PackageConfig pacman;
@@ -2,6 +2,7 @@
 #define EVENTS_H_
 /** \file */
 
+#include <chrono>
 #include <memory>
 #include <string>
 
@@ -90,6 +91,35 @@ class DownloadProgressReport : public BaseEvent {
   static const unsigned int ProgressCompletedValue{100};
 };
 
+/**
+ * The progress of all the downloads, or of all the installations on
+ * Secondaries, going on together, given at most once per
+ * uptane.transfer_progress_interval_ms.
+ */
+class TransferProgressReport : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"TransferProgressReport"};
+
+  TransferProgressReport(std::string description_in, uint64_t transferred_bytes_in, uint64_t total_bytes_in,
+                         size_t active_transfers_in, double bytes_per_second_in, double eta_seconds_in)
+      : description{std::move(description_in)},
+        transferred_bytes{transferred_bytes_in},
+        total_bytes{total_bytes_in},
+        active_transfers{active_transfers_in},
+        bytes_per_second{bytes_per_second_in},
+        eta_seconds{eta_seconds_in} {
+    variant = TypeName;
+  }
+
+  std::string description;
+  uint64_t transferred_bytes;
+  uint64_t total_bytes;
+  size_t active_transfers;
+  double bytes_per_second;
+  // Negative while unknown
+  double eta_seconds;
+};
+
 /**
  * A target has been downloaded.
  */
@@ -193,6 +223,39 @@ class CampaignPostponeComplete : public BaseEvent {
   CampaignPostponeComplete() { variant = TypeName; }
 };
 
+/**
+ * RunForever() has scheduled the next update check.
+ */
+class PollScheduled : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"PollScheduled"};
+
+  PollScheduled(std::chrono::system_clock::time_point next_poll_in, std::chrono::milliseconds delay_in)
+      : next_poll{next_poll_in}, delay{delay_in} {
+    variant = TypeName;
+  }
+
+  std::chrono::system_clock::time_point next_poll;
+  std::chrono::milliseconds delay;
+};
+
+/**
+ * The storage, HTTP and target file I/O of an UptaneCycle(), for debugging,
+ * if telemetry.report_cycle_io is set:
+ * "storage" with the "calls", "seconds", "read_bytes" and "written_bytes" of
+ * SQLite, "http" with the "requests", "seconds", "downloaded_bytes" and
+ * "uploaded_bytes", and "files" with the "operations", "read_bytes" and
+ * "written_bytes" of the files of the targets.
+ */
+class UptaneCycleIo : public BaseEvent {
+ public:
+  static constexpr const char* TypeName{"UptaneCycleIo"};
+
+  explicit UptaneCycleIo(Json::Value io_in) : io{std::move(io_in)} { variant = TypeName; }
+
+  Json::Value io;
+};
+
 using Channel = boost::signals2::signal<void(std::shared_ptr<event::BaseEvent>)>;
 
 }  // namespace event
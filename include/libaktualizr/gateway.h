@@ -0,0 +1,89 @@
+#ifndef GATEWAY_H_
+#define GATEWAY_H_
+
+#include <future>
+#include <memory>
+#include <set>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/aktualizr.h"
+#include "libaktualizr/config.h"
+
+/**
+ * Serves many device identities from one process, such as the devices behind
+ * a fleet gateway or in a hardware-in-the-loop farm, instead of running one
+ * aktualizr process for each of them.
+ *
+ * Each device is an Aktualizr instance of its own, with its own
+ * configuration, storage, keys and credentials. What is process-wide is
+ * shared by all of them: the thread pools, the HTTP connections, TLS sessions
+ * and DNS results, the signature verifications and the verified Image repo
+ * Targets metadata, which is the same for all the devices of a fleet.
+ */
+class Gateway {
+ public:
+  Gateway() = default;
+  Gateway(const Gateway&) = delete;
+  Gateway(Gateway&&) = delete;
+  Gateway& operator=(const Gateway&) = delete;
+  Gateway& operator=(Gateway&&) = delete;
+  /** Shuts the devices down. */
+  ~Gateway();
+
+  /**
+   * The configuration of a device, changed to share the process-wide
+   * resources with the other devices: connections, and the verified Image
+   * repo metadata. The signature verifications are not kept in storage, as
+   * that of a single device would hold them for all.
+   */
+  static Config deviceConfig(Config config);
+
+  /**
+   * Add a device, with its configuration changed by deviceConfig().
+   * @throw std::invalid_argument if its database or images directory is that
+   *        of another device
+   * @throw the exceptions of the Aktualizr constructor
+   */
+  Aktualizr& AddDevice(const Config& config);
+  /**
+   * Add a device created by the caller, such as with another HTTP client, with
+   * the configuration given by deviceConfig().
+   * @throw std::invalid_argument as above
+   */
+  Aktualizr& AddDevice(std::unique_ptr<Aktualizr> device, const Config& config);
+
+  size_t Size() const { return devices_.size(); }
+  Aktualizr& Device(size_t index) { return *devices_.at(index); }
+
+  /**
+   * Initialize all the devices. A device that fails to initialize is logged
+   * and removed, so that the others can still be served.
+   * @return the number of devices initialized
+   */
+  size_t Initialize();
+
+  /**
+   * Run all the devices until Shutdown is called.
+   * @return a future that is ready when all of them have stopped, with the
+   *         first exception that one of them stopped with
+   */
+  std::future<void> RunForever();
+
+  /** Abort the current command of all the devices, see Aktualizr::Abort(). */
+  void Abort();
+  /** Shut all the devices down, see Aktualizr::Shutdown(). */
+  void Shutdown();
+
+ private:
+  // Paths of the database and images directory of a device
+  static std::vector<boost::filesystem::path> storagePaths(const Config& config);
+  void checkStorage(const std::vector<boost::filesystem::path>& paths) const;
+
+  std::vector<std::unique_ptr<Aktualizr>> devices_;
+  std::vector<std::vector<boost::filesystem::path>> storage_paths_;
+  std::set<boost::filesystem::path> used_storage_;
+};
+
+#endif  // GATEWAY_H_
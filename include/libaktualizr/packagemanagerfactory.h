@@ -21,7 +21,12 @@ class PackageManagerFactory {
 
 // macro to auto-register a package manager
 // note that static library users will have to call `registerPackageManager` manually
+// With BUILD_MINIMAL, the package managers of libaktualizr are made without
+// being registered.
 
+#ifdef BUILD_MINIMAL
+#define AUTO_REGISTER_PACKAGE_MANAGER(name, clsname) static_assert(true, "")
+#else
 #define AUTO_REGISTER_PACKAGE_MANAGER(name, clsname)                                                         \
   class clsname##_PkgMRegister_ {                                                                            \
    public:                                                                                                   \
@@ -34,5 +39,6 @@ class PackageManagerFactory {
     }                                                                                                        \
   };                                                                                                         \
   static clsname##_PkgMRegister_ clsname##_register_
+#endif
 
 #endif  // PACKAGEMANAGERFACTORY_H_
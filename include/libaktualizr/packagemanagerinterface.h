@@ -1,9 +1,15 @@
 #ifndef PACKAGEMANAGERINTERFACE_H_
 #define PACKAGEMANAGERINTERFACE_H_
 
+#include <chrono>
 #include <fstream>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "libaktualizr/config.h"
 
@@ -11,6 +17,7 @@ class Bootloader;
 class HttpInterface;
 class KeyManager;
 class INvStorage;
+class ProgressAggregator;
 
 namespace api {
 class FlowControlToken;
@@ -21,6 +28,22 @@ class Fetcher;
 }
 
 using FetcherProgressCb = std::function<void(const Uptane::Target&, const std::string&, unsigned int)>;
+// Receives the data of a target as it is downloaded
+using DownloadTee = std::function<void(const char* data, size_t size)>;
+
+/**
+ * Takes the data of a target managed by the application, instead of a file in
+ * the images directory: data() gets each piece in order as it is downloaded,
+ * before it is verified, and returns false to abort the download. done() is
+ * called last, once, with whether all the data matched the length and hashes
+ * of the target; the data is only to be used if it did.
+ */
+struct TargetStream {
+  std::function<bool(const char* data, size_t size)> data;
+  std::function<void(bool verified)> done;
+};
+// Gives the stream of a target, or one without data() to store the target as usual
+using TargetConsumer = std::function<TargetStream(const Uptane::Target& target)>;
 
 /**
  * Status of downloaded target.
@@ -62,17 +85,130 @@ class PackageManagerInterface {
   virtual bool fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const KeyManager& keys,
                            const FetcherProgressCb& progress_cb, const api::FlowControlToken* token);
   virtual TargetStatus verifyTarget(const Uptane::Target& target) const;
+  /**
+   * Store a target from data at hand, such as a mapped offline bundle, rather
+   * than downloading it. The data is verified against the metadata on the way,
+   * as for a download, and the target is only stored if it matches.
+   */
+  virtual bool importTarget(const Uptane::Target& target, const char* data, uint64_t size,
+                            const FetcherProgressCb& progress_cb, const api::FlowControlToken* token);
+  /**
+   * Fetch a Target of a Secondary into a local mirror that the Secondary can
+   * fetch it from in turn, if the package manager supports one.
+   * @return false if the Target was not mirrored; the Secondary then fetches it from the server
+   */
+  virtual bool mirrorTarget(const Uptane::Target& target, const KeyManager& keys, const FetcherProgressCb& progress_cb,
+                            const api::FlowControlToken* token) {
+    (void)target;
+    (void)keys;
+    (void)progress_cb;
+    (void)token;
+    return false;
+  }
   virtual bool checkAvailableDiskSpace(uint64_t required_bytes) const;
+  /** Check that there is room for what is left to download of all the targets at once. */
+  virtual bool checkDiskSpaceForTargets(const std::vector<Uptane::Target>& targets) const;
   virtual boost::optional<std::pair<uintmax_t, std::string>> checkTargetFile(const Uptane::Target& target) const;
   virtual std::ofstream createTargetFile(const Uptane::Target& target);
   virtual std::ofstream appendTargetFile(const Uptane::Target& target);
   virtual std::ifstream openTargetFile(const Uptane::Target& target) const;
+  /** The file of a target opened read-only, for the caller to close. */
+  virtual int openTargetFd(const Uptane::Target& target) const;
   virtual void removeTargetFile(const Uptane::Target& target);
   virtual std::vector<Uptane::Target> getTargetFiles();
+  /**
+   * A target that is completely stored and whose content has the given
+   * SHA-256 hash, in hex, for serving it to peers. The Target only has that
+   * hash and the actual length of the file. The file is only hashed again if
+   * it has changed since it was stored or last checked.
+   */
+  boost::optional<Uptane::Target> findStoredTarget(const std::string& sha256) const;
+  /**
+   * With images_gc, remove the stored target files that no ECU has installed
+   * or is about to install, but the images_gc_keep most recently used ones
+   * and those of wanted. The most recently used ones go too, least recently
+   * used first, while the files take more than images_cache_size or the disk
+   * lacks the space to download wanted.
+   */
+  void collectTargetFiles(const std::vector<Uptane::Target>& wanted = {});
+  /**
+   * Give the data of a target to tee while it is downloaded as a single
+   * stream, in order and before it is verified. Data that is downloaded again
+   * is only given once, and nothing more is given if a download continues
+   * after what tee received, e.g. one started before a restart. A new
+   * download with a tee is not segmented; the segmented download of an
+   * earlier attempt, delta downloads and chunks downloaded again are not
+   * given to tee.
+   */
+  void setDownloadTee(const Uptane::Target& target, DownloadTee tee);
+  void clearDownloadTee(const Uptane::Target& target);
+  /**
+   * Download a target into stream rather than a file, as a single stream
+   * that goes on from where it stopped after a pause or a network failure,
+   * so that stream gets every byte once. Nothing is stored.
+   * @return whether the data was complete and matched the target, as given to stream.done()
+   */
+  bool streamTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher, const TargetStream& stream,
+                    const FetcherProgressCb& progress_cb, const api::FlowControlToken* token);
+  /**
+   * Report the progress of the downloads to aggregator too. To be set before
+   * downloading.
+   */
+  void setProgressAggregator(std::shared_ptr<ProgressAggregator> aggregator);
 
  protected:
+  // Target files are named after their content, so that Targets with the same
+  // content share a file.
+  static std::string targetFileName(const Uptane::Target& target);
+
   PackageConfig config;
   std::shared_ptr<INvStorage> storage_;
   std::shared_ptr<HttpInterface> http_;
+
+ private:
+  // Downloads are written to a staging file, renamed to the file of the
+  // target once its content was verified.
+  std::ofstream createStagingFile(const Uptane::Target& target);
+  void commitTargetFile(const Uptane::Target& target);
+  bool reuseTargetFile(const Uptane::Target& target);
+  bool fetchDelta(const Uptane::Target& target, const std::string& repo_server, const FetcherProgressCb& progress_cb,
+                  const api::FlowControlToken* token);
+  void evictTargetFiles(const std::string& keep, uint64_t required);
+  // Remove a file of images_path and its Targets, unless it is being downloaded or installed
+  bool removeUnusedFile(const std::string& filename);
+  // Files of the current and pending Targets of all the ECUs
+  std::set<std::string> installedTargetFiles() const;
+  // Free bytes on the disk of images_path, the maximum if unknown
+  uint64_t availableDiskSpace() const;
+  // URL of the target in the peer cache, empty if there is none or it doesn't have it.
+  std::string peerCacheUrl(const Uptane::Target& target);
+  std::shared_ptr<std::mutex> targetFileMutex(const std::string& filename);
+  std::function<void(const char*, size_t, uint64_t)> downloadTee(const Uptane::Target& target);
+  // As verifyTarget(), but trusting an earlier check of the file if its size,
+  // modification time and inode are still the same. Only for the checks that
+  // are repeated and advisory, such as whether to download a target again,
+  // never for the one before installing it.
+  TargetStatus checkStoredTarget(const Uptane::Target& target) const;
+  TargetStatus verifyTargetFile(const Uptane::Target& target, bool trust_verified) const;
+  void recordVerifiedFile(const std::string& path, const std::vector<Hash>& hashes) const;
+  bool isVerifiedFile(const Uptane::Target& target, const std::string& path) const;
+
+  // Held while a file is being downloaded, so that parallel downloads of the
+  // same content don't write the same file.
+  std::mutex target_files_mutex_;
+  std::map<std::string, std::weak_ptr<std::mutex>> target_file_locks_;
+  // The files whose hashes were verified since startup, with the fingerprint
+  // of the file at the time, for checkStoredTarget().
+  mutable std::mutex verified_files_mutex_;
+  mutable std::map<std::string, std::pair<std::string, std::vector<Hash>>> verified_files_;
+  std::mutex download_tees_mutex_;
+  // Given the data and its offset in the file
+  std::map<std::string, std::function<void(const char*, size_t, uint64_t)>> download_tees_;
+  std::shared_ptr<ProgressAggregator> progress_aggregator_;
+  // Held by a garbage collection of the target files
+  std::mutex gc_mutex_;
+  // The peer cache is skipped until then after it could not be reached.
+  std::mutex peer_cache_mutex_;
+  std::chrono::steady_clock::time_point peer_cache_retry_;
 };
 #endif  // PACKAGEMANAGERINTERFACE_H_
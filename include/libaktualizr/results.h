@@ -2,6 +2,7 @@
 #define RESULTS_H_
 /** \file */
 
+#include <chrono>
 #include <string>
 #include <vector>
 
@@ -103,6 +104,15 @@ class Download {
   std::vector<Uptane::Target> updates;
   DownloadStatus status{DownloadStatus::kNothingToDownload};
   std::string message;
+  /* Total size of the successfully downloaded targets. */
+  uint64_t downloaded_bytes{0};
+  /* Wall-clock time spent downloading all the targets. */
+  std::chrono::milliseconds duration{0};
+  /* Aggregate throughput of all (possibly parallel) downloads, in bytes per second. */
+  double throughput() const {
+    return duration.count() > 0 ? static_cast<double>(downloaded_bytes) * 1000. / static_cast<double>(duration.count())
+                                : 0.;
+  }
 };
 
 /**
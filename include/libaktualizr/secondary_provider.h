@@ -1,6 +1,8 @@
 #ifndef UPTANE_SECONDARY_PROVIDER_H
 #define UPTANE_SECONDARY_PROVIDER_H
 
+#include <memory>
+#include <mutex>
 #include <string>
 
 #include "libaktualizr/config.h"
@@ -10,16 +12,31 @@
 class INvStorage;
 
 class SecondaryProviderBuilder;
+class UringFileReader;
 
 class SecondaryProvider {
  public:
   friend class SecondaryProviderBuilder;
 
+  /**
+   * The Director and Image repo metadata to send to the Secondaries, loaded
+   * once and shared by all of them for as long as the stored metadata stays
+   * the same. nullptr if some of it is missing.
+   */
+  std::shared_ptr<const Uptane::MetaBundle> getMetaBundle() const;
   bool getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
   bool getDirectorMetadata(Uptane::MetaBundle* meta_bundle) const;
   bool getImageRepoMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const;
   std::string getTreehubCredentials() const;
   std::ifstream getTargetFileHandle(const Uptane::Target& target) const;
+  // Path of the stored image of target, empty if there is none
+  std::string getTargetFilePath(const Uptane::Target& target) const;
+  /**
+   * Reader of the stored image of target from offset on, through io_uring.
+   * nullptr unless pacman.io_uring_queue_depth enables it and the kernel
+   * supports it.
+   */
+  std::unique_ptr<UringFileReader> getTargetFileReader(const Uptane::Target& target, uint64_t offset) const;
 
  private:
   SecondaryProvider(Config& config_in, std::shared_ptr<const INvStorage> storage_in,
@@ -30,6 +47,11 @@ class SecondaryProvider {
   Config& config_;
   std::shared_ptr<const INvStorage> storage_;
   std::shared_ptr<const PackageManagerInterface> package_manager_;
+  mutable std::mutex bundle_mutex_;
+  mutable std::shared_ptr<const Uptane::MetaBundle> bundle_;
+  // The MetaRevision of the storage bundle_ was loaded at
+  mutable uint64_t bundle_storage_{0};
+  mutable uint64_t bundle_generation_{0};
 };
 
 #endif  // UPTANE_SECONDARY_PROVIDER_H
@@ -1,7 +1,11 @@
 #ifndef UPTANE_SECONDARYINTERFACE_H
 #define UPTANE_SECONDARYINTERFACE_H
 
+#include <cstdint>
+#include <functional>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "libaktualizr/secondary_provider.h"
 #include "libaktualizr/types.h"
@@ -26,6 +30,24 @@ class SecondaryInterface {
   // return 0 during initialization and -1 for error.
   virtual int32_t getRootVersion(bool director) const = 0;
   virtual data::InstallationResult putRoot(const std::string& root, bool director) = 0;
+  /**
+   * Send the Roots the Secondary is missing, in order of version, stopping at
+   * the first one it rejects. Secondaries that can take them all at once
+   * should override this; by default each is sent with putRoot().
+   * @param stored set to the number of Roots the Secondary stored
+   */
+  virtual data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director,
+                                                size_t* stored) {
+    *stored = 0;
+    for (const auto& root : roots) {
+      auto result = putRoot(root, director);
+      if (!result.isSuccess()) {
+        return result;
+      }
+      ++*stored;
+    }
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
 
   /**
    * Send firmware to a device. This operation should be both idempotent and
@@ -37,16 +59,41 @@ class SecondaryInterface {
    */
   virtual data::InstallationResult sendFirmware(const Uptane::Target& target,
                                                 const api::FlowControlToken* flow_control) = 0;
+
+  using FirmwareStream = std::function<bool(const uint8_t* data, size_t size)>;
+  /**
+   * Start sending firmware while the Primary is still downloading it. The
+   * returned function is given the data of the image in order and returns
+   * false once the Secondary stopped accepting it. sendFirmware() is still
+   * called afterwards and only has to send what the stream did not, and
+   * install() verifies the image as usual.
+   * @return an empty function if the Secondary can't receive firmware this way
+   */
+  virtual FirmwareStream streamFirmware(const Uptane::Target& target) {
+    (void)target;
+    return FirmwareStream();
+  }
   /**
    * Commit to installing an update.
    */
   virtual data::InstallationResult install(const Uptane::Target& target, const api::FlowControlToken* flow_control) = 0;
 
+  /**
+   * Given the progress of sendFirmware() by the Secondaries that report it,
+   * e.g. the OSTree pull of an IP Secondary: what is being done and the
+   * percentage of it done so far.
+   */
+  using ProgressCb =
+      std::function<void(const Uptane::Target& target, const std::string& description, unsigned int progress)>;
+  void setProgressCallback(ProgressCb progress_cb) { progress_cb_ = std::move(progress_cb); }
+
  protected:
   SecondaryInterface(const SecondaryInterface&) = default;
   SecondaryInterface(SecondaryInterface&&) = default;
   SecondaryInterface& operator=(const SecondaryInterface&) = default;
   SecondaryInterface& operator=(SecondaryInterface&&) = default;
+
+  ProgressCb progress_cb_;
 };
 
 #endif  // UPTANE_SECONDARYINTERFACE_H
@@ -3,8 +3,15 @@
 /** \file */
 
 #include <algorithm>
+#include <array>
+#include <cstdint>
+#include <map>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem/path.hpp>
 
@@ -15,7 +22,7 @@
 enum class ProvisionMode { kSharedCred = 0, kDeviceCred, kSharedCredReuse, kDefault };
 std::ostream &operator<<(std::ostream &os, ProvisionMode mode);
 
-enum class StorageType { kFileSystem = 0, kSqlite };
+enum class StorageType { kFileSystem = 0, kSqlite, kMemory };
 std::ostream &operator<<(std::ostream &os, StorageType stype);
 
 enum class BootedType { kBooted = 0, kStaged };
@@ -141,6 +148,17 @@ class PublicKey {
    * Verify a signature using this public key
    */
   bool VerifySignature(const std::string &signature, const std::string &message) const;
+  /** A signature of a message, to check with VerifySignatures() */
+  struct SignedMessage {
+    const PublicKey *key;
+    std::string signature;
+    const std::string *message;
+  };
+  /**
+   * Verify a set of signatures, possibly by different keys. The result tells
+   * for each of them, in the same order, whether it is valid.
+   */
+  static std::vector<bool> VerifySignatures(const std::vector<SignedMessage> &batch);
   /**
    * Uptane Json representation of this public key.  Used in root.json
    * and during provisioning.
@@ -156,8 +174,15 @@ class PublicKey {
   // std::string can be implicitly converted to a Json::Value. Make sure that
   // the Json::Value constructor is not called accidentally.
   PublicKey(std::string);  // NOLINT(google-explicit-constructor, hicpp-explicit-conversions)
+  // The key parsed on its first verification, for all the following ones
+  struct Parsed;
+  static std::shared_ptr<Parsed> newParsed();
+  const Parsed &parsed() const;
+
   std::string value_;
   KeyType type_{KeyType::kUnknown};
+  // Shared by the copies, which have the same value
+  std::shared_ptr<Parsed> parsed_{newParsed()};
 };
 
 /**
@@ -165,12 +190,19 @@ class PublicKey {
  * File hashes/checksums in Uptane include the length of the object,
  * in order to defeat infinite download attacks.
  */
+/**
+ * A hash of a given type. The digest is kept in binary and only converted to
+ * hex for HashString(). Values that aren't hex, which only come from tests or
+ * broken metadata, are kept as they are, in upper case.
+ */
 class Hash {
  public:
   // order corresponds algorithm priority
   enum class Type { kSha256, kSha512, kUnknownAlgorithm };
 
   static Hash generate(Type type, const std::string &data);
+  /** From the binary digest */
+  static Hash fromDigest(Type type, const std::string &digest);
   Hash(const std::string &type, const std::string &hash);
   Hash(Type type, const std::string &hash);
 
@@ -180,15 +212,26 @@ class Hash {
   static std::string TypeString(Type type);
   std::string TypeString() const;
   Type type() const;
-  std::string HashString() const { return hash_; }
+  /** Upper case hex */
+  std::string HashString() const;
   friend std::ostream &operator<<(std::ostream &os, const Hash &h);
 
   static std::string encodeVector(const std::vector<Hash> &hashes);
   static std::vector<Hash> decodeVector(std::string hashes_str);
 
  private:
+  // Of SHA-512
+  static constexpr size_t kMaxDigestSize = 64;
+
+  static Type typeFromString(const char *type, size_t size);
+  Hash(Type type, const char *hash, size_t size);
+  void setHash(const char *hash, size_t size);
+
   Type type_;
-  std::string hash_;
+  std::array<uint8_t, kMaxDigestSize> digest_{};
+  uint8_t digest_size_{0};
+  // The hash when it isn't the hex of a digest
+  std::string text_;
 };
 
 std::ostream &operator<<(std::ostream &os, const Hash &h);
@@ -205,6 +248,10 @@ class TimeStamp {
   bool IsExpiredAt(const TimeStamp &now) const;
   bool IsValid() const;
   std::string ToString() const { return time_; }
+  /** Seconds since the epoch, parsed once on construction; 0 if invalid */
+  int64_t ToEpoch() const { return epoch_; }
+  /** The earlier of two timestamps, ignoring an invalid one */
+  static TimeStamp Earliest(const TimeStamp &a, const TimeStamp &b);
   bool operator<(const TimeStamp &other) const;
   bool operator>(const TimeStamp &other) const;
   friend std::ostream &operator<<(std::ostream &os, const TimeStamp &t);
@@ -221,7 +268,10 @@ class TimeStamp {
   };
 
  private:
+  TimeStamp(std::string rfc3339, int64_t epoch) : time_{std::move(rfc3339)}, epoch_{epoch} {}
+
   std::string time_;
+  int64_t epoch_{0};
 };
 
 std::ostream &operator<<(std::ostream &os, const TimeStamp &t);
@@ -328,6 +378,13 @@ struct InstalledImageInfo {
   std::string hash;
 };
 
+/**
+ * The one copy of an identifier shared by all the HardwareIdentifier and
+ * EcuSerial objects equal to it, kept until the process exits, so that these
+ * are copied and compared by address.
+ */
+const std::string *internIdentifier(const std::string &value);
+
 class HardwareIdentifier {
  public:
   // https://github.com/uptane/ota-tuf/blob/master/libtuf/src/main/scala/com/advancedtelematic/libtuf/data/TufDataType.scala#L23
@@ -335,26 +392,27 @@ class HardwareIdentifier {
   static const int kMaxLength = 200;
 
   static HardwareIdentifier Unknown() { return HardwareIdentifier("Unknown"); }
-  explicit HardwareIdentifier(const std::string &hwid) : hwid_(hwid) {
+  explicit HardwareIdentifier(const std::string &hwid) {
     /* if (hwid.length() < kMinLength) {
       throw std::out_of_range("Hardware Identifier too short");
     } */
     if (kMaxLength < hwid.length()) {
       throw std::out_of_range("Hardware Identifier too long");
     }
+    hwid_ = internIdentifier(hwid);
   }
 
-  std::string ToString() const { return hwid_; }
+  const std::string &ToString() const { return *hwid_; }
 
   bool operator==(const HardwareIdentifier &rhs) const { return hwid_ == rhs.hwid_; }
   bool operator!=(const HardwareIdentifier &rhs) const { return !(*this == rhs); }
 
-  bool operator<(const HardwareIdentifier &rhs) const { return hwid_ < rhs.hwid_; }
+  bool operator<(const HardwareIdentifier &rhs) const { return hwid_ != rhs.hwid_ && *hwid_ < *rhs.hwid_; }
   friend std::ostream &operator<<(std::ostream &os, const HardwareIdentifier &hwid);
   friend struct std::hash<Uptane::HardwareIdentifier>;
 
  private:
-  std::string hwid_;
+  const std::string *hwid_;
 };
 
 std::ostream &operator<<(std::ostream &os, const HardwareIdentifier &hwid);
@@ -366,26 +424,29 @@ class EcuSerial {
   static const int kMaxLength = 64;
 
   static EcuSerial Unknown() { return EcuSerial("Unknown"); }
-  explicit EcuSerial(const std::string &ecu_serial) : ecu_serial_(ecu_serial) {
+  explicit EcuSerial(const std::string &ecu_serial) {
     if (ecu_serial.length() < kMinLength) {
       throw std::out_of_range("ECU serial identifier is too short");
     }
     if (kMaxLength < ecu_serial.length()) {
       throw std::out_of_range("ECU serial identifier is too long");
     }
+    ecu_serial_ = internIdentifier(ecu_serial);
   }
 
-  std::string ToString() const { return ecu_serial_; }
+  const std::string &ToString() const { return *ecu_serial_; }
 
   bool operator==(const EcuSerial &rhs) const { return ecu_serial_ == rhs.ecu_serial_; }
   bool operator!=(const EcuSerial &rhs) const { return !(*this == rhs); }
 
-  bool operator<(const EcuSerial &rhs) const { return ecu_serial_ < rhs.ecu_serial_; }
+  bool operator<(const EcuSerial &rhs) const {
+    return ecu_serial_ != rhs.ecu_serial_ && *ecu_serial_ < *rhs.ecu_serial_;
+  }
   friend std::ostream &operator<<(std::ostream &os, const EcuSerial &ecu_serial);
   friend struct std::hash<Uptane::EcuSerial>;
 
  private:
-  std::string ecu_serial_;
+  const std::string *ecu_serial_;
 };
 
 std::ostream &operator<<(std::ostream &os, const EcuSerial &ecu_serial);
@@ -394,38 +455,50 @@ using EcuMap = std::map<EcuSerial, HardwareIdentifier>;
 
 using CorrelationId = std::string;
 
+/**
+ * A Target is a handle to its data, shared by its copies, so that it is cheap
+ * to copy; the data is only copied when a shared Target is changed.
+ */
 class Target {
  public:
   // From Uptane metadata
   Target(std::string filename, const Json::Value &content);
+  // From Uptane metadata, with the custom object of content kept as its JSON
+  // text custom_json, only parsed again if custom_data() is called: most of
+  // the targets of the Image repo are never installed on this device.
+  Target(std::string filename, const Json::Value &content, std::string custom_json);
   // Internal use only. Only used for reading installed_versions list and by
   // various tests.
   Target(std::string filename, EcuMap ecus, std::vector<Hash> hashes, uint64_t length, std::string type = "UNKNOWN");
+  // Moves are copies, so that a Target moved from is still valid
+  Target(const Target &) = default;
+  Target &operator=(const Target &) = default;
+  ~Target() = default;
 
   static Target Unknown();
 
-  const EcuMap &ecus() const { return ecus_; }
-  std::string filename() const { return filename_; }
+  const EcuMap &ecus() const { return data_->ecus; }
+  const std::string &filename() const { return data_->filename; }
   std::string sha256Hash() const;
   std::string sha512Hash() const;
-  const std::vector<Hash> &hashes() const { return hashes_; }
-  const std::vector<HardwareIdentifier> &hardwareIds() const { return hwids_; }
+  const std::vector<Hash> &hashes() const { return data_->hashes; }
+  const std::vector<HardwareIdentifier> &hardwareIds() const { return data_->hwids; }
   std::string custom_version() const;
-  Json::Value custom_data() const { return custom_; }
+  const Json::Value &custom_data() const { return data_->custom.get(); }
   void updateCustom(const Json::Value &custom);
-  uint64_t length() const { return length_; }
-  bool IsValid() const { return valid; }
-  std::string uri() const { return uri_; }
-  void setUri(std::string uri) { uri_ = std::move(uri); }
+  uint64_t length() const { return data_->length; }
+  bool IsValid() const { return data_->valid; }
+  const std::string &uri() const { return data_->uri; }
+  void setUri(std::string uri) { mutableData().uri = std::move(uri); }
   bool MatchHash(const Hash &hash) const;
 
-  void InsertEcu(const std::pair<EcuSerial, HardwareIdentifier> &pair) { ecus_.insert(pair); }
+  void InsertEcu(const std::pair<EcuSerial, HardwareIdentifier> &pair) { mutableData().ecus.insert(pair); }
 
   bool IsForEcu(const EcuSerial &ecuIdentifier) const {
-    return (std::find_if(ecus_.cbegin(), ecus_.cend(),
+    return (std::find_if(data_->ecus.cbegin(), data_->ecus.cend(),
                          [&ecuIdentifier](const std::pair<EcuSerial, HardwareIdentifier> &pair) {
                            return pair.first == ecuIdentifier;
-                         }) != ecus_.cend());
+                         }) != data_->ecus.cend());
   }
 
   /**
@@ -435,7 +508,7 @@ class Target {
    * root commit object.
    */
   bool IsOstree() const;
-  std::string type() const { return type_; }
+  const std::string &type() const { return data_->type; }
 
   // Comparison is usually not meaningful. Use MatchTarget instead.
   bool operator==(const Target &t2) = delete;
@@ -445,15 +518,43 @@ class Target {
   InstalledImageInfo getTargetImageInfo() const { return {filename(), length(), sha256Hash()}; }
 
  private:
-  bool valid{true};
-  std::string filename_;
-  std::string type_;
-  EcuMap ecus_;  // Director only
-  std::vector<Hash> hashes_;
-  std::vector<HardwareIdentifier> hwids_;  // Image repo only
-  Json::Value custom_;
-  uint64_t length_{0};
-  std::string uri_;
+  // The custom object, kept as JSON text until it is first needed
+  class LazyCustom {
+   public:
+    LazyCustom() = default;
+    explicit LazyCustom(std::string json) : json_{std::move(json)} {}
+    explicit LazyCustom(const Json::Value &value) : parsed_{std::make_shared<const Json::Value>(value)} {}
+    LazyCustom(const LazyCustom &other);
+    LazyCustom &operator=(const LazyCustom &other);
+    ~LazyCustom() = default;
+
+    // Safe to call from several threads at once
+    const Json::Value &get() const;
+
+   private:
+    std::string json_;
+    // Set once, atomically
+    mutable std::shared_ptr<const Json::Value> parsed_;
+  };
+
+  struct Data {
+    bool valid{true};
+    std::string filename;
+    std::string type;
+    EcuMap ecus;  // Director only
+    std::vector<Hash> hashes;
+    std::vector<HardwareIdentifier> hwids;  // Image repo only
+    LazyCustom custom;
+    uint64_t length{0};
+    std::string uri;
+  };
+
+  // The data of this Target alone, copied first if it is shared
+  Data &mutableData();
+  // Take the fields the targets are matched on, and the type and URI, from the custom object
+  void extractCustom(const Json::Value &custom);
+
+  std::shared_ptr<const Data> data_;
 
   std::string hashString(Hash::Type type) const;
 };
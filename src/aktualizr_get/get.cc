@@ -1,15 +1,233 @@
 #include "get.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <map>
+#include <mutex>
+
+#include <boost/filesystem.hpp>
+
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
+#include "logging/logging.h"
 #include "storage/invstorage.h"
 
-std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
+namespace {
+// Size of the byte ranges fetched in parallel
+constexpr uint64_t kRangeSize = 4 * 1024 * 1024;
+// Beginning of an error response kept for the error message
+constexpr size_t kErrorBodyLimit = 64 * 1024;
+
+std::shared_ptr<INvStorage> openStorage(const Config &config) {
+  // A provisioned device has nothing left to import, and aktualizr may be
+  // running: just read the credentials.
+  if (config.storage.type == StorageType::kSqlite &&
+      boost::filesystem::exists(config.storage.sqldb_path.get(config.storage.path))) {
+    try {
+      auto storage = INvStorage::newStorage(config.storage, true);
+      std::string ca;
+      std::string cert;
+      std::string pkey;
+      if (storage->loadTlsCreds(&ca, &cert, &pkey)) {
+        return storage;
+      }
+    } catch (const std::exception &e) {
+      LOG_DEBUG << "Could not read the credentials from the storage: " << e.what();
+    }
+  }
   auto storage = INvStorage::newStorage(config.storage);
   storage->importData(config.import);
+  return storage;
+}
 
-  auto client = std_::make_unique<HttpClient>(&headers);
+std::unique_ptr<HttpClient> makeClient(Config &config, const std::vector<std::string> &headers) {
+  auto storage = openStorage(config);
+  auto client = std_::make_unique<HttpClient>(config.network, &headers);
   KeyManager keys(storage, config.keymanagerConfig());
   keys.copyCertsToCurl(*client);
+  return client;
+}
+
+bool writeAll(int fd, const char *data, size_t size, const off_t *offset) {
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t res = offset != nullptr
+                            ? pwrite(fd, data + written, size - written, *offset + static_cast<off_t>(written))
+                            : write(fd, data + written, size - written);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    written += static_cast<size_t>(res);
+  }
+  return true;
+}
+
+// The whole resource in a single request, written in order
+struct StreamArg {
+  int fd{-1};
+  CurlHandler handle;
+  uint64_t written{0};
+  std::string error_body;
+  int error{0};
+};
+
+size_t streamWrite(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *arg = static_cast<StreamArg *>(userp);
+  const size_t n = size * nmemb;
+  long http_code = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(arg->handle.get(), CURLINFO_RESPONSE_CODE, &http_code);
+  if (http_code != 200) {
+    arg->error_body.append(contents, std::min(n, kErrorBodyLimit - std::min(kErrorBodyLimit, arg->error_body.size())));
+    return n;
+  }
+  if (!writeAll(arg->fd, contents, n, nullptr)) {
+    arg->error = errno;
+    return 0;
+  }
+  arg->written += n;
+  return n;
+}
+
+uint64_t getStream(HttpClient &client, const std::string &url, int fd) {
+  StreamArg arg;
+  arg.fd = fd;
+  auto resp = client.downloadAsync(url, streamWrite, nullptr, &arg, 0, &arg.handle).get();
+  if (arg.error != 0) {
+    throw std::runtime_error("Unable to write " + url + ": " + std::strerror(arg.error));
+  }
+  if (resp.curl_code != CURLE_OK || resp.http_status_code != 200) {
+    throw std::runtime_error("Unable to get " + url + ": HTTP_" + std::to_string(resp.http_status_code) + " " +
+                             resp.error_message + "\n" + arg.error_body);
+  }
+  return arg.written;
+}
+
+// One byte range, written at its place in the file
+struct RangeArg {
+  int fd;
+  off_t offset;
+  // Bytes accepted, 0 for any: the first range may get the whole resource
+  uint64_t limit;
+  uint64_t received{0};
+  int error{0};
+};
+
+size_t rangeWrite(char *contents, size_t size, size_t nmemb, void *userp) {
+  auto *arg = static_cast<RangeArg *>(userp);
+  const size_t n = size * nmemb;
+  if (arg->limit != 0 && arg->received + n > arg->limit) {
+    // The whole resource instead of the range
+    return 0;
+  }
+  const off_t offset = arg->offset + static_cast<off_t>(arg->received);
+  if (!writeAll(arg->fd, contents, n, &offset)) {
+    arg->error = errno;
+    return 0;
+  }
+  arg->received += n;
+  return n;
+}
+
+HttpResponse getRange(HttpClient &client, const std::string &url, RangeArg *arg, uint64_t from) {
+  auto resp = client.downloadRange(url, rangeWrite, nullptr, arg, static_cast<curl_off_t>(from),
+                                   static_cast<curl_off_t>(from + kRangeSize - 1));
+  if (arg->error != 0) {
+    throw std::runtime_error("Unable to write " + url + ": " + std::strerror(arg->error));
+  }
+  return resp;
+}
+
+uint64_t getRanges(HttpClient &client, const std::string &url, int fd, off_t base, unsigned int ranges) {
+  // The first range tells whether the server honours ranges, and the
+  // response is the whole resource when it doesn't. The length is only known
+  // once a range comes back short, or past the end.
+  RangeArg first{fd, base, 0};
+  auto resp = getRange(client, url, &first, 0);
+  if (resp.curl_code == CURLE_OK && resp.http_status_code == 416) {
+    // Empty
+    if (ftruncate(fd, base) != 0) {
+      throw std::runtime_error("Unable to write " + url + ": " + std::strerror(errno));
+    }
+    return 0;
+  }
+  if (resp.curl_code != CURLE_OK || (resp.http_status_code != 200 && resp.http_status_code != 206)) {
+    throw std::runtime_error("Unable to get " + url + ": HTTP_" + std::to_string(resp.http_status_code) + " " +
+                             resp.error_message);
+  }
+  if (resp.http_status_code == 200 || first.received < kRangeSize) {
+    return first.received;
+  }
+
+  std::atomic<uint64_t> next_range{1};
+  std::atomic<uint64_t> end{std::numeric_limits<uint64_t>::max()};
+  std::mutex mutex;
+  std::map<uint64_t, uint64_t> received;  // range start -> bytes
+  std::string error;
+  auto worker = [&]() {
+    HttpClient range_client(client);
+    for (uint64_t from = kRangeSize * next_range++; from < end; from = kRangeSize * next_range++) {
+      RangeArg arg{fd, base + static_cast<off_t>(from), kRangeSize};
+      std::string failure;
+      try {
+        auto range_resp = getRange(range_client, url, &arg, from);
+        if (range_resp.curl_code == CURLE_OK && range_resp.http_status_code == 416) {
+          arg.received = 0;
+        } else if (range_resp.curl_code != CURLE_OK || range_resp.http_status_code != 206) {
+          failure = "HTTP_" + std::to_string(range_resp.http_status_code) + " " + range_resp.error_message;
+        }
+      } catch (const std::exception &e) {
+        failure = e.what();
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!failure.empty()) {
+        error = failure;
+        end = 0;
+        return;
+      }
+      received[from] = arg.received;
+      if (arg.received < kRangeSize && from + arg.received < end) {
+        end = from + arg.received;
+      }
+    }
+  };
+  std::vector<std::future<void>> workers;
+  for (unsigned int i = 0; i < ranges; ++i) {
+    workers.push_back(std::async(std::launch::async, worker));
+  }
+  for (auto &w : workers) {
+    w.get();
+  }
+  if (!error.empty()) {
+    throw std::runtime_error("Unable to get " + url + ": " + error);
+  }
+
+  // Every range before the end must be complete
+  for (uint64_t from = kRangeSize; from < end; from += kRangeSize) {
+    const auto range = received.find(from);
+    if (range == received.end() || range->second < std::min(kRangeSize, end - from)) {
+      throw std::runtime_error("Unable to get " + url + ": incomplete range at " + std::to_string(from));
+    }
+  }
+  if (ftruncate(fd, base + static_cast<off_t>(end.load())) != 0) {
+    throw std::runtime_error("Unable to write " + url + ": " + std::strerror(errno));
+  }
+  return end;
+}
+}  // namespace
+
+std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers) {
+  auto client = makeClient(config, headers);
   auto resp = client->get(url, HttpInterface::kNoLimit, nullptr);
   if (resp.http_status_code != 200) {
     throw std::runtime_error("Unable to get " + url + ": HTTP_" + std::to_string(resp.http_status_code) + "\n" +
@@ -17,3 +235,16 @@ std::string aktualizrGet(Config &config, const std::string &url, const std::vect
   }
   return resp.body;
 }
+
+uint64_t aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers, int fd,
+                      unsigned int ranges) {
+  auto client = makeClient(config, headers);
+  struct stat st {};
+  const int flags = fcntl(fd, F_GETFL);
+  const off_t base = lseek(fd, 0, SEEK_CUR);
+  if (ranges > 1 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && flags >= 0 && (flags & O_APPEND) == 0 &&
+      base >= 0) {
+    return getRanges(*client, url, fd, base, ranges);
+  }
+  return getStream(*client, url, fd);
+}
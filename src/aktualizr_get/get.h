@@ -1,8 +1,24 @@
 #ifndef AKTUALIZR_GET_HELPERS
 #define AKTUALIZR_GET_HELPERS
 
+#include <cstdint>
+
 #include "libaktualizr/config.h"
 
 std::string aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers);
 
+/**
+ * Write the resource at url to fd as it arrives, rather than holding it in
+ * memory. When fd is a regular file not opened for appending, the resource
+ * is fetched as up to `ranges` byte ranges at once, as long as the server
+ * honours range requests.
+ *
+ * The credentials are read from the storage without importing anything nor
+ * locking it when it already has them.
+ *
+ * @return the number of bytes written
+ */
+uint64_t aktualizrGet(Config &config, const std::string &url, const std::vector<std::string> &headers, int fd,
+                      unsigned int ranges = 1);
+
 #endif  // AKTUALIZR_GET_HELPERS
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
 #include <boost/process.hpp>
 
 #include "get.h"
@@ -17,6 +21,39 @@ TEST(aktualizr_get, good) {
   EXPECT_EQ("{\"path\": \"/path/1/2/3\"}", body);
 }
 
+/* The response is written to the file as it arrives. */
+TEST(aktualizr_get, stream) {
+  Config config;
+  TemporaryDirectory dir;
+  config.storage.path = dir.Path();
+
+  const auto path = dir / "out";
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  ASSERT_GE(fd, 0);
+  std::vector<std::string> headers;
+  EXPECT_EQ(aktualizrGet(config, server + "/path/1/2/3", headers, fd), 22);
+  close(fd);
+  EXPECT_EQ("{\"path\": \"/path/1/2/3\"}", Utils::readFile(path));
+}
+
+/* A large resource is fetched as several ranges at once. */
+TEST(aktualizr_get, ranges) {
+  Config config;
+  TemporaryDirectory dir;
+  config.storage.path = dir.Path();
+
+  const auto path = dir / "out";
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  ASSERT_GE(fd, 0);
+  std::vector<std::string> headers;
+  const uint64_t size = 100 * (1 << 20);
+  EXPECT_EQ(aktualizrGet(config, server + "/large_file", headers, fd, 4), size);
+  close(fd);
+  EXPECT_EQ(boost::filesystem::file_size(path), size);
+  const std::string content = Utils::readFile(path);
+  EXPECT_EQ(content.find_first_not_of('@'), std::string::npos);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
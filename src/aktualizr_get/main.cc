@@ -1,4 +1,6 @@
+#include <fcntl.h>
 #include <unistd.h>
+#include <cstring>
 #include <iostream>
 
 #include <boost/filesystem.hpp>
@@ -34,7 +36,9 @@ bpo::variables_map parse_options(int argc, char **argv) {
       ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory, by default /var/sota")
       ("header,H", bpo::value<std::vector<std::string> >()->composing(), "Additional headers to pass")
       ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
-      ("url,u", bpo::value<std::string>(), "url to get, mandatory");
+      ("url,u", bpo::value<std::string>(), "url to get, mandatory")
+      ("output,o", bpo::value<boost::filesystem::path>(), "file to write the response to, by default the standard output")
+      ("ranges", bpo::value<unsigned int>()->default_value(1), "byte ranges to fetch at once, when writing to a regular file and the server supports range requests");
   // clang-format on
 
   bpo::variables_map vm;
@@ -70,8 +74,28 @@ int main(int argc, char *argv[]) {
     if (commandline_map.count("header") == 1) {
       headers = commandline_map["header"].as<std::vector<std::string>>();
     }
-    std::string body = aktualizrGet(config, commandline_map["url"].as<std::string>(), headers);
-    std::cout << body;
+    int fd = STDOUT_FILENO;
+    boost::filesystem::path output;
+    if (commandline_map.count("output") != 0) {
+      output = commandline_map["output"].as<boost::filesystem::path>();
+      fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+      if (fd < 0) {
+        throw std::runtime_error("Unable to open " + output.string() + ": " + std::strerror(errno));
+      }
+    }
+    try {
+      aktualizrGet(config, commandline_map["url"].as<std::string>(), headers, fd,
+                   commandline_map["ranges"].as<unsigned int>());
+    } catch (...) {
+      if (!output.empty()) {
+        close(fd);
+        boost::filesystem::remove(output);
+      }
+      throw;
+    }
+    if (!output.empty() && close(fd) != 0) {
+      throw std::runtime_error("Unable to write " + output.string() + ": " + std::strerror(errno));
+    }
 
     r = EXIT_SUCCESS;
   } catch (const std::exception &ex) {
@@ -737,6 +737,51 @@ TEST_F(AktualizrInfoTest, PrintMetadataWarning) {
   }
 }
 
+/**
+ * Verifies the JSON output
+ *
+ * Check actions:
+ *  - [x] Print the summary as a JSON object
+ *  - [x] Print the requested metadata as stored, in a single JSON object
+ */
+TEST_F(AktualizrInfoTest, PrintJson) {
+  const Uptane::EcuSerial secondary_ecu_serial{"c6998d3e-2a68-4ac2-817e-4ea6ef87d21f"};
+  const Uptane::HardwareIdentifier secondary_hw_id{"secondary-hdwr-af250269-bd6f-4148-9426-4101df7f613a"};
+  Json::Value director_root;
+  director_root["signed"]["version"] = 1;
+  Json::Value image_targets;
+  image_targets["signed"]["targets"]["file"]["length"] = 3;
+
+  db_storage_->storeEcuSerials({{primary_ecu_serial, primary_hw_id}, {secondary_ecu_serial, secondary_hw_id}});
+  db_storage_->storeEcuRegistered();
+  db_storage_->storeRoot(Utils::jsonToStr(director_root), Uptane::RepositoryType::Director(), Uptane::Version(1));
+  db_storage_->storeNonRoot(Utils::jsonToStr(image_targets), Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+
+  aktualizr_info_process_.run({"--json"});
+  const Json::Value summary = Utils::parseJSON(aktualizr_info_output);
+  EXPECT_EQ(summary["device_id"].asString(), device_id);
+  EXPECT_EQ(summary["ecu_type"].asString(), "Primary");
+  EXPECT_EQ(summary["ecu_serial"].asString(), primary_ecu_serial.ToString());
+  EXPECT_EQ(summary["ecu_hardware_id"].asString(), primary_hw_id.ToString());
+  ASSERT_EQ(summary["secondaries"].size(), 1U);
+  EXPECT_EQ(summary["secondaries"][0]["serial"].asString(), secondary_ecu_serial.ToString());
+  EXPECT_EQ(summary["secondaries"][0]["hardware_id"].asString(), secondary_hw_id.ToString());
+  EXPECT_TRUE(summary["secondaries"][0]["installed"].isNull());
+  EXPECT_TRUE(summary["provisioned"].asBool());
+  EXPECT_TRUE(summary["fetched_metadata"].asBool());
+  EXPECT_TRUE(summary["current_version"].isNull());
+
+  aktualizr_info_process_.run({"--json", "--director-root", "--image-targets", "--image-snapshot", "--ecu-keyid"});
+  const Json::Value metadata = Utils::parseJSON(aktualizr_info_output);
+  EXPECT_EQ(metadata["director_root"], director_root);
+  EXPECT_EQ(metadata["image_targets"], image_targets);
+  EXPECT_TRUE(metadata.isMember("image_snapshot"));
+  EXPECT_TRUE(metadata["image_snapshot"].isNull());
+  EXPECT_TRUE(metadata.isMember("ecu_keyid"));
+  EXPECT_TRUE(metadata["ecu_keyid"].isNull());
+  EXPECT_FALSE(metadata.isMember("device_id"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
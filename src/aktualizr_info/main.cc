@@ -3,6 +3,7 @@
 #include <vector>
 
 #include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
 #include <boost/program_options.hpp>
 
 #include "libaktualizr/packagemanagerfactory.h"
@@ -11,20 +12,72 @@
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "storage/sql_utils.h"
+#include "storage/sqlstorage.h"
 #include "utilities/aktualizr_version.h"
 
 namespace bpo = boost::program_options;
 
-static int loadAndPrintDelegations(const std::shared_ptr<INvStorage> &storage) {
+/**
+ * The output of aktualizr-info. As text, each part is printed as it always
+ * was. As JSON, the parts are the members of a single object, each written
+ * out as soon as it is loaded, with the metadata as stored rather than parsed
+ * and serialized again. A part that can't be loaded is null.
+ */
+class InfoWriter {
+ public:
+  explicit InfoWriter(bool json) : json_(json) {}
+  ~InfoWriter() {
+    if (json_) {
+      std::cout << (started_ ? "}" : "{}") << std::endl;
+    }
+  }
+  InfoWriter(const InfoWriter &) = delete;
+  InfoWriter(InfoWriter &&) = delete;
+  InfoWriter &operator=(const InfoWriter &) = delete;
+  InfoWriter &operator=(InfoWriter &&) = delete;
+
+  bool json() const { return json_; }
+  /** A member whose value is JSON text already */
+  void raw(const std::string &key, const std::string &text) {
+    member(key);
+    std::cout << (text.empty() ? "null" : text) << std::flush;
+  }
+  void value(const std::string &key, const Json::Value &value) {
+    member(key);
+    std::cout << Utils::jsonToCanonicalStr(value) << std::flush;
+  }
+
+ private:
+  void member(const std::string &key) {
+    std::cout << (started_ ? "," : "{") << Utils::jsonToCanonicalStr(Json::Value(key)) << ":";
+    started_ = true;
+  }
+
+  bool json_;
+  bool started_{false};
+};
+
+static int loadAndPrintDelegations(const std::shared_ptr<INvStorage> &storage, InfoWriter &out) {
   std::vector<std::pair<Uptane::Role, std::string> > delegations;
   bool delegations_fetch_res = storage->loadAllDelegations(delegations);
 
   if (!delegations_fetch_res) {
-    std::cout << "Failed to load delegations" << std::endl;
+    if (out.json()) {
+      out.value("delegations", Json::nullValue);
+    } else {
+      std::cout << "Failed to load delegations" << std::endl;
+    }
     return EXIT_FAILURE;
   }
 
-  if (!delegations.empty()) {
+  if (out.json()) {
+    std::string members;
+    for (const auto &delegation : delegations) {
+      members += (members.empty() ? "" : ",") + Utils::jsonToCanonicalStr(Json::Value(delegation.first.ToString())) +
+                 ":" + (delegation.second.empty() ? "null" : delegation.second);
+    }
+    out.raw("delegations", "{" + members + "}");
+  } else if (!delegations.empty()) {
     for (const auto &delegation : delegations) {
       std::cout << delegation.first << ": " << delegation.second << std::endl;
     }
@@ -34,6 +87,29 @@ static int loadAndPrintDelegations(const std::shared_ptr<INvStorage> &storage) {
   return EXIT_SUCCESS;
 }
 
+static Json::Value targetJson(const Uptane::Target &target) {
+  Json::Value json;
+  json["hash"] = target.sha256Hash();
+  json["filename"] = target.filename();
+  return json;
+}
+
+/**
+ * Open the storage without migrating or creating anything: aktualizr-info
+ * only reads what aktualizr wrote.
+ */
+static std::shared_ptr<INvStorage> openStorage(const StorageConfig &config, bool readonly) {
+  if (!readonly || config.type != StorageType::kSqlite) {
+    return INvStorage::newStorage(config, readonly);
+  }
+  const boost::filesystem::path db_path = config.sqldb_path.get(config.path);
+  if (!boost::filesystem::exists(db_path)) {
+    throw StorageException("No storage at " + db_path.string() +
+                           ", use --allow-migrate to migrate a filesystem storage or create it");
+  }
+  return std::make_shared<SQLStorage>(config, true);
+}
+
 void checkInfoOptions(const bpo::options_description &description, const bpo::variables_map &vm) {
   if (vm.count("help") != 0) {
     std::cout << description << '\n';
@@ -73,6 +149,7 @@ int main(int argc, char **argv) {
     ("director-root",  "Outputs root.json from Director repo, by default the latest")
     ("director-targets",  "Outputs targets.json from Director repo")
     ("root-version",  bpo::value<int>(), "Use with --image-root or --director-root to specify the version to output")
+    ("json", "Outputs a single JSON object with a member for each requested part, written as it is loaded")
     ("allow-migrate", "Opens database in read/write mode to make possible to migrate database if needed")
     ("wait-until-provisioned", "Outputs metadata when device already provisioned");
   // Support old names and variations due to common typos.
@@ -121,15 +198,16 @@ int main(int argc, char **argv) {
 
     std::shared_ptr<INvStorage> storage;
     bool cmd_trigger = false;
-    std::string device_id;
 
-    bool registered = false;
-    bool has_metadata = false;
+    // The queries shared by several parts of the output are run once, and
+    // only if one of them is requested.
+    boost::optional<bool> registered;
+    boost::optional<bool> has_metadata;
     std::string director_root;
     if (wait_provisioning) {
-      while (!registered || !has_metadata) {
+      while (!registered || !has_metadata || !*registered || !*has_metadata) {
         try {
-          storage = INvStorage::newStorage(config.storage, readonly);
+          storage = openStorage(config.storage, readonly);
 
           registered = storage->loadEcuRegistered();
           has_metadata = storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director());
@@ -140,120 +218,195 @@ int main(int argc, char **argv) {
         sleep(1);
       }
     } else {
-      storage = INvStorage::newStorage(config.storage, readonly);
+      storage = openStorage(config.storage, readonly);
     }
 
-    bool deviceid_loaded = false;
-    if (storage->loadDeviceId(&device_id)) {
-      deviceid_loaded = true;
-      // Early return if only printing device ID.
-      if (vm.count("name-only") != 0U) {
+    InfoWriter out(vm.count("json") != 0U);
+
+    std::string device_id;
+    const bool deviceid_loaded = storage->loadDeviceId(&device_id);
+    // Early return if only printing device ID.
+    if (deviceid_loaded && vm.count("name-only") != 0U) {
+      if (out.json()) {
+        out.value("device_id", device_id);
+      } else {
         std::cout << device_id << std::endl;
-        return EXIT_SUCCESS;
       }
+      return EXIT_SUCCESS;
     }
 
-    registered = registered || storage->loadEcuRegistered();
-    std::string temp;
-    has_metadata = has_metadata || storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director()) ||
-                   storage->loadLatestRoot(&temp, Uptane::RepositoryType::Image());
+    auto metadata_loaded = [&]() {
+      if (!has_metadata) {
+        std::string temp;
+        has_metadata = storage->loadLatestRoot(&director_root, Uptane::RepositoryType::Director()) ||
+                       storage->loadLatestRoot(&temp, Uptane::RepositoryType::Image());
+      }
+      return *has_metadata;
+    };
 
-    bool tlscred_loaded = false;
-    {
+    // TLS credentials
+    if (vm.count("tls-creds") != 0U) {
       std::string ca;
       std::string cert;
       std::string pkey;
-
       storage->loadTlsCreds(&ca, &cert, &pkey);
-      if (!ca.empty() || !cert.empty() || !pkey.empty()) {
-        tlscred_loaded = true;
-      }
-      // TLS credentials
-      if (vm.count("tls-creds") != 0U) {
+      if (out.json()) {
+        Json::Value creds;
+        creds["ca"] = ca;
+        creds["cert"] = cert;
+        creds["pkey"] = pkey;
+        out.value("tls_creds", creds);
+      } else {
         std::cout << "Root CA certificate:" << std::endl << ca << std::endl;
         std::cout << "Client certificate:" << std::endl << cert << std::endl;
         std::cout << "Client private key:" << std::endl << pkey << std::endl;
-        cmd_trigger = true;
       }
+      cmd_trigger = true;
     }
 
     if (vm.count("tls-root-ca") != 0U) {
       std::string ca;
       storage->loadTlsCa(&ca);
-      std::cout << ca << std::endl;
+      if (out.json()) {
+        out.value("tls_root_ca", ca);
+      } else {
+        std::cout << ca << std::endl;
+      }
       cmd_trigger = true;
     }
 
     if (vm.count("tls-cert") != 0U) {
       std::string cert;
       storage->loadTlsCert(&cert);
-      std::cout << cert << std::endl;
+      if (out.json()) {
+        out.value("tls_cert", cert);
+      } else {
+        std::cout << cert << std::endl;
+      }
       cmd_trigger = true;
     }
 
     if (vm.count("tls-prv-key") != 0U) {
       std::string key;
       storage->loadTlsPkey(&key);
-      std::cout << key << std::endl;
+      if (out.json()) {
+        out.value("tls_prv_key", key);
+      } else {
+        std::cout << key << std::endl;
+      }
       cmd_trigger = true;
     }
 
     // ECU credentials
-    bool ecukeys_loaded = false;
+    boost::optional<bool> ecukeys_loaded;
     std::string priv;
     std::string pub;
-    storage->loadPrimaryKeys(&pub, &priv);
-    if (!pub.empty() && !priv.empty()) {
-      ecukeys_loaded = true;
-    }
+    auto load_ecu_keys = [&]() {
+      if (!ecukeys_loaded) {
+        storage->loadPrimaryKeys(&pub, &priv);
+        ecukeys_loaded = !pub.empty() && !priv.empty();
+      }
+      return *ecukeys_loaded;
+    };
+    const std::string msg_ecu_keys_fail = "Failed to load Primary ECU keys!";
 
     if (vm.count("ecu-keys") != 0U) {
-      if (!ecukeys_loaded) {
-        std::cout << "Failed to load Primary ECU keys!" << std::endl;
+      if (!load_ecu_keys()) {
+        if (out.json()) {
+          out.value("ecu_keys", Json::nullValue);
+        } else {
+          std::cout << msg_ecu_keys_fail << std::endl;
+        }
       } else {
         // TODO: probably won't work with p11.
         PublicKey pubkey(pub, config.uptane.key_type);
-        std::cout << "Public key ID: " << pubkey.KeyId() << std::endl;
-        std::cout << "Public key:" << std::endl << pub << std::endl;
-        std::cout << "Private key:" << std::endl << priv << std::endl;
+        if (out.json()) {
+          Json::Value keys;
+          keys["keyid"] = pubkey.KeyId();
+          keys["public"] = pub;
+          keys["private"] = priv;
+          out.value("ecu_keys", keys);
+        } else {
+          std::cout << "Public key ID: " << pubkey.KeyId() << std::endl;
+          std::cout << "Public key:" << std::endl << pub << std::endl;
+          std::cout << "Private key:" << std::endl << priv << std::endl;
+        }
         cmd_trigger = true;
       }
     }
 
     if (vm.count("ecu-keyid") != 0U) {
-      if (!ecukeys_loaded) {
-        std::cout << "Failed to load Primary ECU keys!" << std::endl;
+      if (!load_ecu_keys()) {
+        if (out.json()) {
+          out.value("ecu_keyid", Json::nullValue);
+        } else {
+          std::cout << msg_ecu_keys_fail << std::endl;
+        }
       } else {
         // TODO: probably won't work with p11.
         PublicKey pubkey(pub, config.uptane.key_type);
-        std::cout << pubkey.KeyId() << std::endl;
+        if (out.json()) {
+          out.value("ecu_keyid", pubkey.KeyId());
+        } else {
+          std::cout << pubkey.KeyId() << std::endl;
+        }
         cmd_trigger = true;
       }
     }
 
     if (vm.count("ecu-pub-key") != 0U) {
-      if (!ecukeys_loaded) {
-        std::cout << "Failed to load Primary ECU keys!" << std::endl;
+      if (!load_ecu_keys()) {
+        if (out.json()) {
+          out.value("ecu_pub_key", Json::nullValue);
+        } else {
+          std::cout << msg_ecu_keys_fail << std::endl;
+        }
       } else {
-        std::cout << pub << std::endl;
+        if (out.json()) {
+          out.value("ecu_pub_key", pub);
+        } else {
+          std::cout << pub << std::endl;
+        }
         cmd_trigger = true;
       }
     }
 
     if (vm.count("ecu-prv-key") != 0U) {
-      if (!ecukeys_loaded) {
-        std::cout << "Failed to load Primary ECU keys!" << std::endl;
+      if (!load_ecu_keys()) {
+        if (out.json()) {
+          out.value("ecu_prv_key", Json::nullValue);
+        } else {
+          std::cout << msg_ecu_keys_fail << std::endl;
+        }
       } else {
-        std::cout << priv << std::endl;
+        if (out.json()) {
+          out.value("ecu_prv_key", priv);
+        } else {
+          std::cout << priv << std::endl;
+        }
         cmd_trigger = true;
       }
     }
 
     // An arguments which depend on metadata.
     std::string msg_metadata_fail = "Metadata is not available";
-    if (vm.count("image-root") != 0U || vm.count("images-root") != 0U) {
-      if (!has_metadata) {
+    auto print_metadata = [&](const std::string &key, const std::string &metadata) {
+      if (out.json()) {
+        out.raw(key, metadata);
+      } else {
+        std::cout << metadata << std::endl;
+      }
+    };
+    auto print_metadata_fail = [&](const std::string &key) {
+      if (out.json()) {
+        out.value(key, Json::nullValue);
+      } else {
         std::cout << msg_metadata_fail << std::endl;
+      }
+    };
+    if (vm.count("image-root") != 0U || vm.count("images-root") != 0U) {
+      if (!metadata_loaded()) {
+        print_metadata_fail("image_root");
       } else {
         std::string images_root;
         if (vm.count("root-version") != 0U) {
@@ -262,74 +415,74 @@ int main(int argc, char **argv) {
         } else {
           storage->loadLatestRoot(&images_root, Uptane::RepositoryType::Image());
         }
-        std::cout << images_root << std::endl;
+        print_metadata("image_root", images_root);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("image-targets") != 0U || vm.count("image-target") != 0U || vm.count("images-targets") != 0U ||
         vm.count("images-target") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("image_targets");
       } else {
         std::string images_targets;
         storage->loadNonRoot(&images_targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
-        std::cout << images_targets << std::endl;
+        print_metadata("image_targets", images_targets);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("delegation") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("delegations");
       } else {
-        loadAndPrintDelegations(storage);
+        loadAndPrintDelegations(storage, out);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("director-root") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("director_root");
       } else {
         if (vm.count("root-version") != 0U) {
           storage->loadRoot(&director_root, Uptane::RepositoryType::Director(),
                             Uptane::Version(vm["root-version"].as<int>()));
-        }  // else: already loaded above.
-        std::cout << director_root << std::endl;
+        }  // else: already loaded with the metadata check.
+        print_metadata("director_root", director_root);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("director-targets") != 0U || vm.count("director-target") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("director_targets");
       } else {
         std::string director_targets;
         storage->loadNonRoot(&director_targets, Uptane::RepositoryType::Director(), Uptane::Role::Targets());
-        std::cout << director_targets << std::endl;
+        print_metadata("director_targets", director_targets);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("image-snapshot") != 0U || vm.count("images-snapshot") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("image_snapshot");
       } else {
         std::string snapshot;
         storage->loadNonRoot(&snapshot, Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
-        std::cout << snapshot << std::endl;
+        print_metadata("image_snapshot", snapshot);
       }
       cmd_trigger = true;
     }
 
     if (vm.count("image-timestamp") != 0U || vm.count("images-timestamp") != 0U) {
-      if (!has_metadata) {
-        std::cout << msg_metadata_fail << std::endl;
+      if (!metadata_loaded()) {
+        print_metadata_fail("image_timestamp");
       } else {
         std::string timestamp;
         storage->loadNonRoot(&timestamp, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
-        std::cout << timestamp << std::endl;
+        print_metadata("image_timestamp", timestamp);
       }
       cmd_trigger = true;
     }
@@ -338,13 +491,23 @@ int main(int argc, char **argv) {
       return EXIT_SUCCESS;
     }
 
-    if (!deviceid_loaded && !tlscred_loaded && ecukeys_loaded) {
+    bool tlscred_loaded = false;
+    {
+      std::string ca;
+      std::string cert;
+      std::string pkey;
+      storage->loadTlsCreds(&ca, &cert, &pkey);
+      tlscred_loaded = !ca.empty() || !cert.empty() || !pkey.empty();
+    }
+    if (!deviceid_loaded && !tlscred_loaded && load_ecu_keys()) {
       secondary_db = true;
     }
 
     // Print general information if user does not provide any argument.
     if (!secondary_db) {
-      if (!deviceid_loaded) {
+      if (out.json()) {
+        out.value("device_id", deviceid_loaded ? Json::Value(device_id) : Json::Value());
+      } else if (!deviceid_loaded) {
         std::cout << "Couldn't load device ID" << std::endl;
       } else {
         std::cout << "Device ID: " << device_id << std::endl;
@@ -353,7 +516,12 @@ int main(int argc, char **argv) {
 
     std::string ecu_name = secondary_db ? "Secondary" : "Primary";
     EcuSerials serials;
-    if (!storage->loadEcuSerials(&serials)) {
+    const bool serials_loaded = storage->loadEcuSerials(&serials);
+    if (out.json()) {
+      out.value("ecu_type", ecu_name);
+      out.value("ecu_serial", serials.empty() ? Json::Value() : Json::Value(serials[0].first.ToString()));
+      out.value("ecu_hardware_id", serials.empty() ? Json::Value() : Json::Value(serials[0].second.ToString()));
+    } else if (!serials_loaded) {
       std::cout << "Couldn't load ECU serials" << std::endl;
     } else if (serials.empty()) {
       std::cout << ecu_name << " serial is not found" << std::endl;
@@ -366,18 +534,26 @@ int main(int argc, char **argv) {
       std::vector<SecondaryInfo> info;
       if (vm.count("secondary-keys") != 0U) {
         storage->loadSecondariesInfo(&info);
-        if (info.empty()) {
+        if (info.empty() && !out.json()) {
           std::cout << "Failed to load Secondary info!" << std::endl;
         }
       }
 
       auto it = serials.begin() + 1;
-      std::cout << "Secondaries:\n";
+      if (!out.json()) {
+        std::cout << "Secondaries:\n";
+      }
+      Json::Value secondaries(Json::arrayValue);
       int secondary_number = 1;
       for (; it != serials.end(); ++it) {
         const Uptane::EcuSerial serial = it->first;
-        std::cout << secondary_number++ << ") serial ID: " << serial << std::endl;
-        std::cout << "   hardware ID: " << it->second << std::endl;
+        Json::Value secondary;
+        secondary["serial"] = serial.ToString();
+        secondary["hardware_id"] = it->second.ToString();
+        if (!out.json()) {
+          std::cout << secondary_number++ << ") serial ID: " << serial << std::endl;
+          std::cout << "   hardware ID: " << it->second << std::endl;
+        }
 
         boost::optional<Uptane::Target> current_version;
         boost::optional<Uptane::Target> pending_version;
@@ -386,7 +562,13 @@ int main(int argc, char **argv) {
         auto load_installed_version_res =
             storage->loadInstalledVersions(serial.ToString(), &current_version, &pending_version, &correlation_id);
 
-        if (!load_installed_version_res || (!current_version && !pending_version)) {
+        if (out.json()) {
+          secondary["installed"] = !!current_version ? targetJson(*current_version) : Json::Value();
+          secondary["pending"] = !!pending_version ? targetJson(*pending_version) : Json::Value();
+          if (!correlation_id.empty()) {
+            secondary["correlation_id"] = correlation_id;
+          }
+        } else if (!load_installed_version_res || (!current_version && !pending_version)) {
           std::cout << "   no details about installed nor pending images\n";
         } else {
           if (!!current_version) {
@@ -406,21 +588,38 @@ int main(int argc, char **argv) {
         if (vm.count("secondary-keys") != 0U) {
           auto f = std::find_if(info.cbegin(), info.cend(),
                                 [&serial](const SecondaryInfo &i) { return serial == i.serial; });
-          if (f == info.cend()) {
+          if (out.json()) {
+            secondary["public_key_id"] = f == info.cend() ? Json::Value() : Json::Value(f->pub_key.KeyId());
+            secondary["public_key"] = f == info.cend() ? Json::Value() : Json::Value(f->pub_key.Value());
+          } else if (f == info.cend()) {
             std::cout << "   Failed to find matching Secondary info!" << std::endl;
           } else {
             std::cout << "   public key ID: " << f->pub_key.KeyId() << std::endl;
             std::cout << "   public key:" << std::endl << f->pub_key.Value() << std::endl;
           }
         }
+        secondaries.append(secondary);
+      }
+      if (out.json()) {
+        out.value("secondaries", secondaries);
       }
-    } else if (vm.count("secondary-keys") != 0U) {
+    } else if (vm.count("secondary-keys") != 0U && !out.json()) {
       std::cout << "Failed to load Secondary data!" << std::endl;
     }
 
     std::vector<MisconfiguredEcu> misconfigured_ecus;
     storage->loadMisconfiguredEcus(&misconfigured_ecus);
-    if (!misconfigured_ecus.empty()) {
+    if (out.json()) {
+      Json::Value misconfigured(Json::arrayValue);
+      for (const auto &ecu : misconfigured_ecus) {
+        Json::Value misconfigured_ecu;
+        misconfigured_ecu["serial"] = ecu.serial.ToString();
+        misconfigured_ecu["hardware_id"] = ecu.hardware_id.ToString();
+        misconfigured_ecu["state"] = ecu.state == EcuState::kOld ? "removed" : "unregistered";
+        misconfigured.append(misconfigured_ecu);
+      }
+      out.value("misconfigured_ecus", misconfigured);
+    } else if (!misconfigured_ecus.empty()) {
       std::cout << "Removed or unregistered ECUs (deprecated):" << std::endl;
       std::vector<MisconfiguredEcu>::const_iterator it;
       for (it = misconfigured_ecus.begin(); it != misconfigured_ecus.end(); ++it) {
@@ -429,26 +628,39 @@ int main(int argc, char **argv) {
       }
     }
 
-    if (!secondary_db) {
-      std::cout << "Provisioned on server: " << (registered ? "yes" : "no") << std::endl;
+    if (!registered || !*registered) {
+      registered = storage->loadEcuRegistered();
+    }
+    if (out.json()) {
+      if (!secondary_db) {
+        out.value("provisioned", *registered);
+      }
+      out.value("fetched_metadata", metadata_loaded());
+    } else {
+      if (!secondary_db) {
+        std::cout << "Provisioned on server: " << (*registered ? "yes" : "no") << std::endl;
+      }
+      std::cout << "Fetched metadata: " << (metadata_loaded() ? "yes" : "no") << std::endl;
     }
-    std::cout << "Fetched metadata: " << (has_metadata ? "yes" : "no") << std::endl;
 
     auto pacman = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, nullptr);
 
     Uptane::Target current_target = pacman->getCurrent();
 
-    if (current_target.IsValid()) {
+    if (out.json()) {
+      out.value("current_version", current_target.IsValid() ? Json::Value(current_target.sha256Hash()) : Json::Value());
+    } else if (current_target.IsValid()) {
       std::cout << "Current " << ecu_name << " ECU running version: " << current_target.sha256Hash() << std::endl;
     } else {
       std::cout << "No currently running version on " << ecu_name << " ECU" << std::endl;
     }
 
-    std::vector<Uptane::Target> installed_versions;
     boost::optional<Uptane::Target> pending;
     storage->loadPrimaryInstalledVersions(nullptr, &pending);
 
-    if (!!pending) {
+    if (out.json()) {
+      out.value("pending_version", !!pending ? Json::Value(pending->sha256Hash()) : Json::Value());
+    } else if (!!pending) {
       std::cout << "Pending " << ecu_name << " ECU version: " << pending->sha256Hash() << std::endl;
     }
   } catch (const bpo::error &o) {
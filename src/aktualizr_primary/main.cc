@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 
 #include <boost/filesystem.hpp>
@@ -7,6 +8,7 @@
 
 #include "libaktualizr/aktualizr.h"
 #include "libaktualizr/config.h"
+#include "libaktualizr/gateway.h"
 #include "logging/logging.h"
 #include "primary/aktualizr_helpers.h"
 #include "secondary.h"
@@ -45,7 +47,8 @@ bpo::variables_map parseOptions(int argc, char **argv) {
       ("primary-ecu-hardware-id", bpo::value<std::string>(), "hardware ID of Primary ECU")
       ("secondary-config-file", bpo::value<boost::filesystem::path>(), "Secondary ECUs configuration file")
       ("campaign-id", bpo::value<std::string>(), "ID of the campaign to act on")
-      ("hwinfo-file", bpo::value<boost::filesystem::path>(), "custom hardware information JSON file");
+      ("hwinfo-file", bpo::value<boost::filesystem::path>(), "custom hardware information JSON file")
+      ("gateway-dir", bpo::value<boost::filesystem::path>(), "directory with a configuration directory for each device to serve from this process, applied after the --config ones (full run mode only)");
   // clang-format on
 
   // consider the first positional argument as the aktualizr run mode
@@ -88,7 +91,8 @@ bpo::variables_map parseOptions(int argc, char **argv) {
 }
 
 void processEvent(const std::shared_ptr<event::BaseEvent> &event) {
-  if (event->isTypeOf<event::DownloadProgressReport>() || event->variant == "UpdateCheckComplete") {
+  if (event->isTypeOf<event::DownloadProgressReport>() || event->isTypeOf<event::TransferProgressReport>() ||
+      event->variant == "UpdateCheckComplete") {
     // Do nothing; libaktualizr already logs it.
   } else if (event->variant == "AllDownloadsComplete") {
     const auto *downloads_complete = dynamic_cast<event::AllDownloadsComplete *>(event.get());
@@ -101,6 +105,59 @@ void processEvent(const std::shared_ptr<event::BaseEvent> &event) {
   }
 }
 
+// Serve a device for each configuration directory in gateway_dir, all in the
+// full run mode.
+int runGateway(const bpo::variables_map &commandline_map) {
+  const auto gateway_dir = commandline_map["gateway-dir"].as<boost::filesystem::path>();
+  std::vector<boost::filesystem::path> device_dirs;
+  for (const auto &entry : boost::filesystem::directory_iterator(gateway_dir)) {
+    if (boost::filesystem::is_directory(entry.path())) {
+      device_dirs.push_back(entry.path());
+    }
+  }
+  std::sort(device_dirs.begin(), device_dirs.end());
+
+  Gateway gateway;
+  for (const auto &device_dir : device_dirs) {
+    std::vector<boost::filesystem::path> config_dirs;
+    if (commandline_map.count("config") != 0) {
+      config_dirs = commandline_map["config"].as<std::vector<boost::filesystem::path>>();
+    }
+    config_dirs.push_back(device_dir);
+    try {
+      const Config config(config_dirs);
+      Aktualizr &aktualizr = gateway.AddDevice(config);
+      if (!config.uptane.secondary_config_file.empty()) {
+        Primary::initSecondaries(aktualizr, config.uptane.secondary_config_file);
+      }
+      aktualizr.SetSignalHandler(std::bind(targets_autoclean_cb, std::ref(aktualizr), std::placeholders::_1));
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Failed to set up the device of " << device_dir << ", leaving it out: " << e.what();
+    }
+  }
+  if (gateway.Initialize() == 0) {
+    LOG_ERROR << "No device to serve in " << gateway_dir;
+    return EXIT_FAILURE;
+  }
+
+  SigHandler::get().start([&gateway]() {
+    gateway.Abort();
+    gateway.Shutdown();
+  });
+  SigHandler::signal(SIGHUP);
+  SigHandler::signal(SIGINT);
+  SigHandler::signal(SIGTERM);
+
+  try {
+    gateway.RunForever().get();
+  } catch (const std::exception &ex) {
+    LOG_ERROR << "Gateway::RunForever exiting:" << ex.what();
+    return EXIT_FAILURE;
+  }
+  LOG_DEBUG << "Aktualizr gateway exiting...";
+  return EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[]) {
   logger_init();
   logger_set_threshold(boost::log::trivial::info);
@@ -116,6 +173,9 @@ int main(int argc, char *argv[]) {
       LOG_WARNING << "\033[31mAktualizr is currently running as non-root and may not work as expected! Aktualizr "
                      "should be run as root for proper functionality.\033[0m\n";
     }
+    if (commandline_map.count("gateway-dir") != 0) {
+      return runGateway(commandline_map);
+    }
     Config config(commandline_map);
     LOG_DEBUG << "Current directory: " << boost::filesystem::current_path().string();
 
@@ -6,12 +6,15 @@
 #include <boost/filesystem.hpp>
 
 #include <algorithm>
+#include <chrono>
+#include <future>
 #include <unordered_map>
 
 #include "ipuptanesecondary.h"
 #include "logging/logging.h"
 #include "secondary.h"
 #include "secondary_config.h"
+#include "utilities/executor.h"
 #include "utilities/utils.h"
 
 namespace Primary {
@@ -68,6 +71,15 @@ void initSecondaries(Aktualizr& aktualizr, const boost::filesystem::path& config
   }
 }
 
+// Apply the options of the configuration that are not needed to connect.
+static void configureIPSecondary(const IPSecondaryConfig& cfg, const SecondaryInterface::Ptr& secondary) {
+  auto ip_secondary = std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(secondary);
+  if (ip_secondary != nullptr) {
+    ip_secondary->setUploadCompression(cfg.compression);
+    ip_secondary->setLinkOptions(cfg.link);
+  }
+}
+
 class SecondaryWaiter {
  public:
   SecondaryWaiter(Aktualizr& aktualizr, uint16_t wait_port, int timeout_s, Secondaries& secondaries)
@@ -77,9 +89,8 @@ class SecondaryWaiter {
         timer_{io_context_},
         connected_secondaries_{secondaries} {}
 
-  void addSecondary(const std::string& ip, uint16_t port, VerificationType verification_type) {
-    secondaries_to_wait_for_.insert({key(ip, port), verification_type});
-  }
+  // cfg has to outlive the waiter.
+  void addSecondary(const IPSecondaryConfig& cfg) { secondaries_to_wait_for_.insert({key(cfg.ip, cfg.port), &cfg}); }
 
   void wait() {
     if (secondaries_to_wait_for_.empty()) {
@@ -120,14 +131,16 @@ class SecondaryWaiter {
 
       LOG_INFO << "Accepted connection from a Secondary: (" << sec_ip << ":" << sec_port << ")";
       try {
-        auto secondary = Uptane::IpUptaneSecondary::create(sec_ip, sec_port, it->second, con_socket_.native_handle());
+        auto secondary = Uptane::IpUptaneSecondary::create(sec_ip, sec_port, it->second->verification_type,
+                                                           con_socket_.native_handle());
         if (secondary) {
+          configureIPSecondary(*it->second, secondary);
           connected_secondaries_.push_back(secondary);
           // set ip/port in the db so that we can match everything later
           Json::Value d;
           d["ip"] = sec_ip;
           d["port"] = sec_port;
-          d["verification_type"] = Uptane::VerificationTypeToString(it->second);
+          d["verification_type"] = Uptane::VerificationTypeToString(it->second->verification_type);
           aktualizr_.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
         }
       } catch (const std::exception& exc) {
@@ -159,7 +172,7 @@ class SecondaryWaiter {
   boost::asio::deadline_timer timer_;
 
   Secondaries& connected_secondaries_;
-  std::unordered_map<std::string, VerificationType> secondaries_to_wait_for_;
+  std::unordered_map<std::string, const IPSecondaryConfig*> secondaries_to_wait_for_;
 };
 
 // Four options for each Secondary:
@@ -168,13 +181,24 @@ class SecondaryWaiter {
 // cause re-registration.
 // 3. Same as 2 but cannot connect: abort.
 // 4. Secondary is stored but not configured: it must have been removed. Skip it. This will cause re-registration.
+//
+// All the Secondaries are contacted at the same time, each with its own connection timeout, so that the slow or
+// unreachable ones only hold up the start-up once.
 static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktualizr& aktualizr) {
+  struct Connection {
+    const IPSecondaryConfig& cfg;
+    // Null if the Secondary is new
+    const SecondaryInfo* info;
+    std::future<SecondaryInterface::Ptr> secondary;
+  };
+
   Secondaries result;
   SecondaryWaiter sec_waiter{aktualizr, config.secondaries_wait_port, config.secondaries_timeout_s, result};
   auto secondaries_info = aktualizr.GetSecondaries();
+  const std::chrono::milliseconds timeout{std::chrono::seconds{config.secondaries_connect_timeout_s}};
+  std::vector<Connection> connections;
 
   for (const auto& cfg : config.secondaries_cfg) {
-    SecondaryInterface::Ptr secondary;
     const SecondaryInfo* info = nullptr;
 
     // Try to match the configured Secondaries to stored Secondaries.
@@ -197,37 +221,55 @@ static Secondaries createIPSecondaries(const IPSecondariesConfig& config, Aktual
       d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
       aktualizr.SetSecondaryData(info->serial, Utils::jsonToCanonicalStr(d));
       LOG_INFO << "Migrated a single IP Secondary to new storage format.";
-    } else if (f == secondaries_info.cend()) {
-      // Secondary was not found in storage; it must be new.
-      secondary = Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port, cfg.verification_type);
-      if (secondary == nullptr) {
-        LOG_DEBUG << "Could not connect to IP Secondary at " << cfg.ip << ":" << cfg.port
-                  << "; now trying to wait for it.";
-        sec_waiter.addSecondary(cfg.ip, cfg.port, cfg.verification_type);
-      } else {
-        result.push_back(secondary);
-        // set ip/port in the db so that we can match everything later
-        Json::Value d;
-        d["ip"] = cfg.ip;
-        d["port"] = cfg.port;
-        d["verification_type"] = Uptane::VerificationTypeToString(cfg.verification_type);
-        aktualizr.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
-      }
-      continue;
-    } else {
+    } else if (f != secondaries_info.cend()) {
       // The configured Secondary was found in storage.
       info = &(*f);
     }
 
-    if (secondary == nullptr) {
-      secondary = Uptane::IpUptaneSecondary::connectAndCheck(cfg.ip, cfg.port, cfg.verification_type, info->serial,
-                                                             info->hw_id, info->pub_key);
+    // The tasks take copies, as they are not waited for once a Secondary fails.
+    if (info == nullptr) {
+      // Secondary was not found in storage; it must be new.
+      connections.push_back({cfg, nullptr, Executor::io().submit([cfg, timeout]() {
+                               return Uptane::IpUptaneSecondary::connectAndCreate(cfg.ip, cfg.port,
+                                                                                  cfg.verification_type, timeout);
+                             })});
+    } else {
+      connections.push_back({cfg, info, Executor::io().submit([cfg, expected = *info, timeout]() {
+                               return Uptane::IpUptaneSecondary::connectAndCheck(
+                                   cfg.ip, cfg.port, cfg.verification_type, expected.serial, expected.hw_id,
+                                   expected.pub_key, timeout);
+                             })});
+    }
+  }
+
+  // The results are taken in the order of the configuration, which is the
+  // order in which the Secondaries are added. The storage is only used from
+  // this thread.
+  for (auto& c : connections) {
+    SecondaryInterface::Ptr secondary = c.secondary.get();
+    if (c.info == nullptr) {
+      if (secondary == nullptr && Utils::isUnixSocketAddress(c.cfg.ip)) {
+        // Only the Secondaries on TCP can connect to the Primary.
+        throw std::runtime_error("Unable to connect to IP Secondary at " + c.cfg.ip);
+      }
       if (secondary == nullptr) {
-        throw std::runtime_error("Unable to connect to or verify IP Secondary at " + cfg.ip + ":" +
-                                 std::to_string(cfg.port));
+        LOG_DEBUG << "Could not connect to IP Secondary at " << c.cfg.ip << ":" << c.cfg.port
+                  << "; now trying to wait for it.";
+        sec_waiter.addSecondary(c.cfg);
+        continue;
       }
+      // set ip/port in the db so that we can match everything later
+      Json::Value d;
+      d["ip"] = c.cfg.ip;
+      d["port"] = c.cfg.port;
+      d["verification_type"] = Uptane::VerificationTypeToString(c.cfg.verification_type);
+      aktualizr.SetSecondaryData(secondary->getSerial(), Utils::jsonToCanonicalStr(d));
+    } else if (secondary == nullptr) {
+      throw std::runtime_error("Unable to connect to or verify IP Secondary at " + c.cfg.ip + ":" +
+                               std::to_string(c.cfg.port));
     }
 
+    configureIPSecondary(c.cfg, secondary);
     result.push_back(secondary);
   }
 
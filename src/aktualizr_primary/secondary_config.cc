@@ -80,6 +80,10 @@ SecondaryConfigParser::Configs JsonConfigParser::parse() {
 }
 
 static std::pair<std::string, uint16_t> getIPAndPort(const std::string& addr) {
+  // The path of a Unix domain socket, for Secondaries on the same host
+  if (Utils::isUnixSocketAddress(addr)) {
+    return std::make_pair(addr, 0);
+  }
   auto del_pos = addr.find_first_of(':');
   if (del_pos == std::string::npos) {
     throw std::invalid_argument("Incorrect address string, couldn't find port delimeter: " + addr);
@@ -93,7 +97,9 @@ static std::pair<std::string, uint16_t> getIPAndPort(const std::string& addr) {
 void JsonConfigParser::createIPSecondariesCfg(Configs& configs, const Json::Value& json_ip_sec_cfg) {
   auto resultant_cfg = std::make_shared<IPSecondariesConfig>(
       static_cast<uint16_t>(json_ip_sec_cfg[IPSecondariesConfig::PortField].asUInt()),
-      json_ip_sec_cfg[IPSecondariesConfig::TimeoutField].asInt());
+      json_ip_sec_cfg[IPSecondariesConfig::TimeoutField].asInt(),
+      json_ip_sec_cfg.get(IPSecondariesConfig::ConnectTimeoutField, IPSecondariesConfig::DefaultConnectTimeout)
+          .asInt());
   auto secondaries = json_ip_sec_cfg[IPSecondariesConfig::SecondariesField];
 
   LOG_INFO << "Found IP secondaries config: " << *resultant_cfg;
@@ -105,7 +111,21 @@ void JsonConfigParser::createIPSecondariesCfg(Configs& configs, const Json::Valu
     if (secondary.isMember(IPSecondaryConfig::VerificationField)) {
       vtype = Uptane::VerificationTypeFromString(secondary[IPSecondaryConfig::VerificationField].asString());
     }
-    IPSecondaryConfig sec_cfg{addr.first, addr.second, vtype};
+    Uptane::SecondaryLinkOptions link;
+    link.connect_timeout = std::chrono::milliseconds(
+        secondary.get(IPSecondaryConfig::ConnectTimeoutField, Json::Int64(link.connect_timeout.count())).asInt64());
+    link.io_timeout = std::chrono::milliseconds(
+        secondary.get(IPSecondaryConfig::IoTimeoutField, Json::Int64(link.io_timeout.count())).asInt64());
+    link.keepalive_idle = std::chrono::seconds(
+        secondary.get(IPSecondaryConfig::KeepaliveIdleField, Json::Int64(link.keepalive_idle.count())).asInt64());
+    link.keepalive_interval = std::chrono::seconds(
+        secondary.get(IPSecondaryConfig::KeepaliveIntervalField, Json::Int64(link.keepalive_interval.count()))
+            .asInt64());
+    link.keepalive_count = secondary.get(IPSecondaryConfig::KeepaliveCountField, link.keepalive_count).asInt();
+    link.user_timeout = std::chrono::milliseconds(
+        secondary.get(IPSecondaryConfig::UserTimeoutField, Json::Int64(link.user_timeout.count())).asInt64());
+    IPSecondaryConfig sec_cfg{addr.first, addr.second, vtype,
+                              secondary.get(IPSecondaryConfig::CompressionField, false).asBool(), link};
 
     LOG_INFO << "   found IP secondary config: " << sec_cfg;
     resultant_cfg->secondaries_cfg.push_back(sec_cfg);
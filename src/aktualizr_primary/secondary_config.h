@@ -7,6 +7,7 @@
 #include <json/json.h>
 #include <boost/filesystem/path.hpp>
 
+#include "ipuptanesecondary.h"
 #include "libaktualizr/types.h"
 #include "primary/secondary_config.h"
 #include "virtualsecondary.h"
@@ -17,18 +18,38 @@ class IPSecondaryConfig {
  public:
   static constexpr const char* const AddrField{"addr"};
   static constexpr const char* const VerificationField{"verification_type"};
-
-  IPSecondaryConfig(std::string addr_ip, uint16_t addr_port, VerificationType verification_type_in)
-      : ip(std::move(addr_ip)), port(addr_port), verification_type(verification_type_in) {}
+  static constexpr const char* const CompressionField{"compression"};
+  static constexpr const char* const ConnectTimeoutField{"connect_timeout_ms"};
+  static constexpr const char* const IoTimeoutField{"io_timeout_ms"};
+  static constexpr const char* const KeepaliveIdleField{"keepalive_idle_s"};
+  static constexpr const char* const KeepaliveIntervalField{"keepalive_interval_s"};
+  static constexpr const char* const KeepaliveCountField{"keepalive_count"};
+  static constexpr const char* const UserTimeoutField{"user_timeout_ms"};
+
+  IPSecondaryConfig(std::string addr_ip, uint16_t addr_port, VerificationType verification_type_in,
+                    bool compression_in = false, Uptane::SecondaryLinkOptions link_in = {})
+      : ip(std::move(addr_ip)),
+        port(addr_port),
+        verification_type(verification_type_in),
+        compression(compression_in),
+        link(link_in) {}
 
   friend std::ostream& operator<<(std::ostream& os, const IPSecondaryConfig& cfg) {
-    os << "(addr: " << cfg.ip << ":" << cfg.port << " verification_type: " << cfg.verification_type << ")";
+    os << "(addr: " << cfg.ip << ":" << cfg.port << " verification_type: " << cfg.verification_type
+       << " compression: " << cfg.compression << " connect_timeout_ms: " << cfg.link.connect_timeout.count()
+       << " io_timeout_ms: " << cfg.link.io_timeout.count() << " keepalive_idle_s: " << cfg.link.keepalive_idle.count()
+       << " keepalive_interval_s: " << cfg.link.keepalive_interval.count()
+       << " keepalive_count: " << cfg.link.keepalive_count << " user_timeout_ms: " << cfg.link.user_timeout.count()
+       << ")";
     return os;
   }
 
   const std::string ip;
   const uint16_t port;
   const VerificationType verification_type;
+  // Compress the image uploads, for Secondaries on slow links
+  const bool compression;
+  const Uptane::SecondaryLinkOptions link;
 };
 
 class IPSecondariesConfig : public SecondaryConfig {
@@ -36,18 +57,26 @@ class IPSecondariesConfig : public SecondaryConfig {
   static constexpr const char* const Type{"IP"};
   static constexpr const char* const PortField{"secondaries_wait_port"};
   static constexpr const char* const TimeoutField{"secondaries_wait_timeout"};
+  static constexpr const char* const ConnectTimeoutField{"secondaries_connect_timeout"};
   static constexpr const char* const SecondariesField{"secondaries"};
+  static constexpr int DefaultConnectTimeout{10};
 
-  IPSecondariesConfig(const uint16_t wait_port, const int timeout_s)
-      : SecondaryConfig(Type), secondaries_wait_port{wait_port}, secondaries_timeout_s{timeout_s} {}
+  IPSecondariesConfig(const uint16_t wait_port, const int timeout_s,
+                      const int connect_timeout_s = DefaultConnectTimeout)
+      : SecondaryConfig(Type),
+        secondaries_wait_port{wait_port},
+        secondaries_timeout_s{timeout_s},
+        secondaries_connect_timeout_s{connect_timeout_s} {}
 
   friend std::ostream& operator<<(std::ostream& os, const IPSecondariesConfig& cfg) {
-    os << "(wait_port: " << cfg.secondaries_wait_port << " timeout_s: " << cfg.secondaries_timeout_s << ")";
+    os << "(wait_port: " << cfg.secondaries_wait_port << " timeout_s: " << cfg.secondaries_timeout_s
+       << " connect_timeout_s: " << cfg.secondaries_connect_timeout_s << ")";
     return os;
   }
 
   const uint16_t secondaries_wait_port;
   const int secondaries_timeout_s;
+  const int secondaries_connect_timeout_s;
   std::vector<IPSecondaryConfig> secondaries_cfg;
 };
 
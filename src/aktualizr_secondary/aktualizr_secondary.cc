@@ -1,7 +1,9 @@
 #include "aktualizr_secondary.h"
 
 #include <sys/types.h>
+#include <algorithm>
 #include <memory>
+#include <mutex>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/optional.hpp>
@@ -27,13 +29,18 @@ PublicKey AktualizrSecondary::publicKey() const { return keys_->UptanePublicKey(
 
 Uptane::Manifest AktualizrSecondary::getManifest() const {
   Uptane::InstalledImageInfo installed_image_info;
-  Uptane::Manifest manifest;
-
-  if (getInstalledImageInfo(installed_image_info)) {
-    manifest = manifest_issuer_->assembleAndSignManifest(installed_image_info);
+  if (!getInstalledImageInfo(installed_image_info)) {
+    return Uptane::Manifest();
   }
 
-  return manifest;
+  // Signing is slow on small ECUs, sign again only if the content has changed.
+  const Uptane::Manifest unsigned_manifest = manifest_issuer_->assembleManifest(installed_image_info);
+  std::lock_guard<std::mutex> guard(manifest_mutex_);
+  if (signed_manifest_.empty() || unsigned_manifest != unsigned_manifest_) {
+    signed_manifest_ = manifest_issuer_->sign(unsigned_manifest);
+    unsigned_manifest_ = unsigned_manifest;
+  }
+  return signed_manifest_;
 }
 
 data::InstallationResult AktualizrSecondary::putMetadata(const Uptane::SecondaryMetadata& metadata) {
@@ -77,6 +84,25 @@ data::InstallationResult AktualizrSecondary::verifyMetadata(const Uptane::Second
   //    We trust the time that the given system/ECU provides.
   TimeStamp now(TimeStamp::Now());
 
+  // The Primary sends the same metadata again on retries and to confirm an
+  // installation. Only check that the metadata verified last time has not
+  // expired, which doesn't verify its signatures again while it is unchanged
+  // in storage.
+  const std::string digest = metadata.digest();
+  if (!verified_metadata_digest_.empty() && digest == verified_metadata_digest_) {
+    try {
+      if (config_.uptane.verification_type == VerificationType::kFull) {
+        director_repo_.checkMetaOffline(*storage_);
+      }
+      image_repo_.checkMetaOffline(*storage_);
+      LOG_DEBUG << "Metadata unchanged since the last verification.";
+      return findTargets();
+    } catch (const std::exception& e) {
+      LOG_INFO << "Verifying the metadata again: " << e.what();
+    }
+  }
+  verified_metadata_digest_.clear();
+
   if (config_.uptane.verification_type == VerificationType::kFull) {
     // 2. Download and check the Root metadata file from the Director repository.
     // 3. NOT SUPPORTED: Download and check the Timestamp metadata file from the Director repository.
@@ -102,6 +128,7 @@ data::InstallationResult AktualizrSecondary::verifyMetadata(const Uptane::Second
     return data::InstallationResult(data::ResultCode::Numeric::kVerificationFailed,
                                     std::string("Failed to update Image repo metadata: ") + e.what());
   }
+  verified_metadata_digest_ = digest;
 
   data::InstallationResult result = findTargets();
   if (result.isSuccess()) {
@@ -241,21 +268,28 @@ void AktualizrSecondary::uptaneInitialize() {
 }
 
 void AktualizrSecondary::registerHandlers() {
+  // The read-only requests are served along each other.
   registerHandler(AKIpUptaneMes_PR_getInfoReq,
-                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getInfoHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_versionReq,
-                  std::bind(&AktualizrSecondary::versionHdlr, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::versionHdlr, std::placeholders::_1, std::placeholders::_2), true);
 
   registerHandler(AKIpUptaneMes_PR_manifestReq,
-                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getManifestHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_rootVerReq,
-                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2));
+                  std::bind(&AktualizrSecondary::getRootVerHdlr, this, std::placeholders::_1, std::placeholders::_2),
+                  true);
 
   registerHandler(AKIpUptaneMes_PR_putRootReq,
                   std::bind(&AktualizrSecondary::putRootHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
+  registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                  std::bind(&AktualizrSecondary::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+
   registerHandler(AKIpUptaneMes_PR_putMetaReq2,
                   std::bind(&AktualizrSecondary::putMetaHdlr, this, std::placeholders::_1, std::placeholders::_2));
 
@@ -279,19 +313,25 @@ MsgHandler::ReturnCode AktualizrSecondary::getInfoHdlr(Asn1Message& in_msg, Asn1
 }
 
 MsgHandler::ReturnCode AktualizrSecondary::versionHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
-  const uint32_t version = 2;
+  const uint32_t version = 6;
+  // v3 only adds the windowed image uploads to v2, v4 their raw data, v5
+  // the Root chains and v6 the background OSTree downloads.
+  const uint32_t oldest_compatible_version = 2;
   auto version_req = in_msg.versionReq();
   const auto primary_version = static_cast<uint32_t>(version_req->version);
-  if (primary_version < version) {
+  if (primary_version < oldest_compatible_version) {
     LOG_ERROR << "Primary protocol version is " << primary_version << " but Secondary version is " << version
               << "! Communication will most likely fail!";
+  } else if (primary_version < version) {
+    LOG_INFO << "Primary protocol version is " << primary_version << ", using it instead of " << version;
   } else if (primary_version > version) {
     LOG_INFO << "Primary protocol version is " << primary_version << " but Secondary version is " << version
              << ". Please consider upgrading the Secondary.";
   }
 
+  // Primaries that only know v2 take any later version for theirs.
   auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
-  m->version = version;
+  m->version = std::min(primary_version, version);
 
   return ReturnCode::kOk;
 }
@@ -308,9 +348,10 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getManifestHdlr(Asn1Message&
   auto manifest_resp = out_msg.manifestResp();
   manifest_resp->manifest.present = manifest_PR_json;
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
-  SetString(&manifest_resp->manifest.choice.json, Utils::jsonToStr(getManifest()));
+  const Uptane::Manifest manifest = getManifest();
+  SetString(&manifest_resp->manifest.choice.json, Utils::jsonToStr(manifest));
 
-  LOG_TRACE << "Manifest: \n" << getManifest();
+  LOG_TRACE << "Manifest: \n" << manifest;
   return ReturnCode::kOk;
 }
 
@@ -343,15 +384,46 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::getRootVerHdlr(Asn1Message& i
 AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
   LOG_INFO << "Received a put Root request message; verifying contents...";
   auto pr = in_msg.putRootReq();
+  const data::InstallationResult result = putRoot(pr->repotype, ToString(pr->json));
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
+
+AktualizrSecondary::ReturnCode AktualizrSecondary::putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto pr = in_msg.putRootChainReq();
+  LOG_INFO << "Received a put Root chain request message with " << pr->roots.list.count
+           << " Roots; verifying contents...";
+  data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
+  int stored = 0;
+  // Each Root is verified with the one before it, so stop at the first rejected
+  for (; stored < pr->roots.list.count; ++stored) {
+    result = putRoot(pr->repotype, ToString(*pr->roots.list.array[stored]));
+    if (!result.isSuccess()) {
+      break;
+    }
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+  m->stored = stored;
+
+  return ReturnCode::kOk;
+}
+
+data::InstallationResult AktualizrSecondary::putRoot(AKRepoType_t repotype, const std::string& json) {
   Uptane::RepositoryType repo_type{};
-  if (pr->repotype == AKRepoType_director) {
+  if (repotype == AKRepoType_director) {
     repo_type = Uptane::RepositoryType::Director();
-  } else if (pr->repotype == AKRepoType_image) {
+  } else if (repotype == AKRepoType_image) {
     repo_type = Uptane::RepositoryType::Image();
   } else {
   }
 
-  const std::string json = ToString(pr->json);
   LOG_DEBUG << "Received " << repo_type << " repo Root metadata:\n" << json;
   data::InstallationResult result(data::ResultCode::Numeric::kOk, "");
 
@@ -383,17 +455,13 @@ AktualizrSecondary::ReturnCode AktualizrSecondary::putRootHdlr(Asn1Message& in_m
                                         std::string("Failed to update Image repo Root metadata: ") + e.what());
     }
   } else {
-    LOG_WARNING << "Received Root version request with invalid repo type: " << pr->repotype;
+    LOG_WARNING << "Received Root version request with invalid repo type: " << repotype;
     result = data::InstallationResult(
         data::ResultCode::Numeric::kInternalError,
-        "Received Root version request with invalid repo type: " + std::to_string(pr->repotype));
+        "Received Root version request with invalid repo type: " + std::to_string(repotype));
   }
 
-  auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
-  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
-  SetString(&m->description, result.description);
-
-  return ReturnCode::kOk;
+  return result;
 }
 
 void AktualizrSecondary::copyMetadata(Uptane::MetaBundle& meta_bundle, const Uptane::RepositoryType repo,
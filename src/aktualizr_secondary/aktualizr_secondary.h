@@ -1,6 +1,8 @@
 #ifndef AKTUALIZR_SECONDARY_H
 #define AKTUALIZR_SECONDARY_H
 
+#include <mutex>
+
 #include "aktualizr_secondary_config.h"
 #include "msg_handler.h"
 #include "uptane/directorrepository.h"
@@ -61,8 +63,11 @@ class AktualizrSecondary : public MsgDispatcher {
   ReturnCode getManifestHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode getRootVerHdlr(Asn1Message& in_msg, Asn1Message& out_msg) const;
   ReturnCode putRootHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
   ReturnCode putMetaHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
   ReturnCode installHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  // Verify and store a Root received from the Primary
+  data::InstallationResult putRoot(AKRepoType_t repotype, const std::string& json);
 
   Uptane::HardwareIdentifier hardware_id_{Uptane::HardwareIdentifier::Unknown()};
   Uptane::EcuSerial ecu_serial_{Uptane::EcuSerial::Unknown()};
@@ -72,9 +77,15 @@ class AktualizrSecondary : public MsgDispatcher {
   std::shared_ptr<KeyManager> keys_;
 
   Uptane::ManifestIssuer::Ptr manifest_issuer_;
+  // The last signed manifest and the content it was signed for
+  mutable std::mutex manifest_mutex_;
+  mutable Uptane::Manifest unsigned_manifest_;
+  mutable Uptane::Manifest signed_manifest_;
 
   Uptane::DirectorRepository director_repo_;
   Uptane::ImageRepository image_repo_;
+  // Digest of the metadata last verified in full, see Uptane::SecondaryMetadata::digest()
+  std::string verified_metadata_digest_;
   Uptane::Target pending_target_{Uptane::Target::Unknown()};
 };
 
@@ -15,12 +15,14 @@ inline void CopyFromConfig(VerificationType& dest, const std::string& option_nam
 
 void AktualizrSecondaryNetConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(port, "port", pt);
+  CopyFromConfig(unix_socket, "unix_socket", pt);
   CopyFromConfig(primary_ip, "primary_ip", pt);
   CopyFromConfig(primary_port, "primary_port", pt);
 }
 
 void AktualizrSecondaryNetConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, port, "port");
+  writeOption(out_stream, unix_socket, "unix_socket");
   writeOption(out_stream, primary_ip, "primary_ip");
   writeOption(out_stream, primary_port, "primary_port");
 }
@@ -32,6 +34,8 @@ void AktualizrSecondaryUptaneConfig::updateFromPropertyTree(const boost::propert
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(force_install_completion, "force_install_completion", pt);
   CopyFromConfig(verification_type, "verification_type", pt);
+  CopyFromConfig(image_direct_io, "image_direct_io", pt);
+  CopyFromConfig(image_io_uring_queue_depth, "image_io_uring_queue_depth", pt);
 }
 
 void AktualizrSecondaryUptaneConfig::writeToStream(std::ostream& out_stream) const {
@@ -41,6 +45,8 @@ void AktualizrSecondaryUptaneConfig::writeToStream(std::ostream& out_stream) con
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, force_install_completion, "force_install_completion");
   writeOption(out_stream, verification_type, "verification_type");
+  writeOption(out_stream, image_direct_io, "image_direct_io");
+  writeOption(out_stream, image_io_uring_queue_depth, "image_io_uring_queue_depth");
 }
 
 AktualizrSecondaryConfig::AktualizrSecondaryConfig(const boost::program_options::variables_map& cmd) {
@@ -75,6 +81,7 @@ KeyManagerConfig AktualizrSecondaryConfig::keymanagerConfig() const {
 
 void AktualizrSecondaryConfig::postUpdateValues() {
   logger_set_threshold(logger);
+  logger_set_output(logger);
   LOG_TRACE << "Final configuration that will be used: \n" << (*this);
 }
 
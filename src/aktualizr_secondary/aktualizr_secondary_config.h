@@ -17,6 +17,8 @@
 
 struct AktualizrSecondaryNetConfig {
   in_port_t port{9030};
+  // Listen on this Unix domain socket instead of port, for a Primary on the same host
+  boost::filesystem::path unix_socket;
   std::string primary_ip;
   in_port_t primary_port{9030};
 
@@ -31,6 +33,10 @@ struct AktualizrSecondaryUptaneConfig {
   KeyType key_type{KeyType::kRSA2048};
   bool force_install_completion{false};
   VerificationType verification_type{VerificationType::kFull};
+  // Write the received images with O_DIRECT
+  bool image_direct_io{false};
+  // Requests in flight when writing the received images through io_uring; 0 uses pwrite()
+  uint64_t image_io_uring_queue_depth{0};
 
   void updateFromPropertyTree(const boost::property_tree::ptree& pt);
   void writeToStream(std::ostream& out_stream) const;
@@ -1,10 +1,19 @@
 #include "aktualizr_secondary_file.h"
 
+#include <algorithm>
+
 #include "storage/invstorage.h"
 #include "update_agent_file.h"
+#include "utilities/deflate_stream.h"
+#include "utilities/utils.h"
 
 const std::string AktualizrSecondaryFile::FileUpdateDefaultFile{"firmware.txt"};
 
+// Largest chunk of image data and number of unacknowledged chunks accepted in
+// the windowed uploads
+static constexpr long kMaxUploadChunkSize = 1024L * 1024;
+static constexpr long kMaxUploadWindow = 16;
+
 AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& config)
     : AktualizrSecondaryFile(config, INvStorage::newStorage(config.storage)) {}
 
@@ -14,6 +23,13 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
     : AktualizrSecondary(config, std::move(storage)), update_agent_{std::move(update_agent)} {
   registerHandler(AKIpUptaneMes_PR_uploadDataReq, std::bind(&AktualizrSecondaryFile::uploadDataHdlr, this,
                                                             std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_uploadParamsReq, std::bind(&AktualizrSecondaryFile::uploadParamsHdlr, this,
+                                                              std::placeholders::_1, std::placeholders::_2));
+  registerHandler(AKIpUptaneMes_PR_uploadChunkReq, std::bind(&AktualizrSecondaryFile::uploadChunkHdlr, this,
+                                                             std::placeholders::_1, std::placeholders::_2));
+  registerRawHandler(AKIpUptaneMes_PR_uploadRawReq,
+                     std::bind(&AktualizrSecondaryFile::uploadRawHdlr, this, std::placeholders::_1,
+                               std::placeholders::_2, std::placeholders::_3, std::placeholders::_4));
   if (!update_agent_) {
     std::string current_target_name;
 
@@ -28,10 +44,14 @@ AktualizrSecondaryFile::AktualizrSecondaryFile(const AktualizrSecondaryConfig& c
       current_target_name = "unknown";
     }
 
-    update_agent_ = std::make_shared<FileUpdateAgent>(config.storage.path / FileUpdateDefaultFile, current_target_name);
+    update_agent_ = std::make_shared<FileUpdateAgent>(config.storage.path / FileUpdateDefaultFile, current_target_name,
+                                                      config.uptane.image_direct_io,
+                                                      static_cast<unsigned>(config.uptane.image_io_uring_queue_depth));
   }
 }
 
+AktualizrSecondaryFile::~AktualizrSecondaryFile() = default;
+
 void AktualizrSecondaryFile::initialize() { initPendingTargetIfAny(); }
 
 data::InstallationResult AktualizrSecondaryFile::receiveData(const uint8_t* data, size_t size) {
@@ -83,3 +103,82 @@ MsgHandler::ReturnCode AktualizrSecondaryFile::uploadDataHdlr(Asn1Message& in_ms
 
   return ReturnCode::kOk;
 }
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadParamsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.uploadParamsReq();
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadParamsResp).uploadParamsResp();
+  m->chunkSize = std::max(1L, std::min(req->chunkSize, kMaxUploadChunkSize));
+  m->window = std::max(1L, std::min(req->window, kMaxUploadWindow));
+  if (req->discard != nullptr && *req->discard != 0) {
+    LOG_INFO << "Dropping the image data received so far, as asked by the Primary";
+    update_agent_->discardData();
+  }
+  // Goes on after the data received before the connection dropped or the
+  // Secondary restarted, if it is part of the pending target.
+  const Uptane::Target& target = getPendingTarget();
+  const uint64_t offset = target.IsValid() ? update_agent_->resumeData(target) : update_agent_->receivedDataSize();
+  m->offset = static_cast<long>(offset);
+  if (m->offset > 0) {
+    m->receivedHash = Asn1Allocation<OCTET_STRING_t>();
+    SetString(m->receivedHash, update_agent_->receivedDataHash());
+  }
+  // A new stream for every upload, the Primary starts one for each.
+  inflater_.reset();
+  if (req->compression != nullptr && *req->compression == AKCompression_deflate) {
+    inflater_ = std_::make_unique<InflateStream>();
+    m->compression = Asn1Allocation<AKCompression_t>();
+    *m->compression = AKCompression_deflate;
+  }
+  LOG_INFO << "Receiving the image in chunks of " << m->chunkSize << " bytes, " << m->window
+           << " at a time, from offset " << m->offset << (inflater_ != nullptr ? ", compressed" : "");
+
+  return ReturnCode::kOk;
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadChunkHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.uploadChunkReq();
+  if (req->data.size < 0) {
+    LOG_ERROR << "The received data buffer size is negative: " << req->data.size;
+    return ReturnCode::kUnkownMsg;
+  }
+  return receiveChunk(req->offset, req->data.buf, static_cast<size_t>(req->data.size), inflater_ != nullptr, out_msg);
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::uploadRawHdlr(Asn1Message& in_msg, const uint8_t* data, size_t size,
+                                                             Asn1Message& out_msg) {
+  return receiveChunk(in_msg.uploadRawReq()->offset, data, size, false, out_msg);
+}
+
+MsgHandler::ReturnCode AktualizrSecondaryFile::receiveChunk(long offset, const uint8_t* data, size_t size,
+                                                            bool compressed, Asn1Message& out_msg) {
+  const uint64_t expected = update_agent_->receivedDataSize();
+
+  data::InstallationResult result;
+  if (offset < 0 || static_cast<uint64_t>(offset) != expected) {
+    LOG_ERROR << "Received image data at offset " << offset << " instead of " << expected;
+    result = data::InstallationResult(
+        data::ResultCode::Numeric::kDownloadFailed,
+        "Received image data at offset " + std::to_string(offset) + " instead of " + std::to_string(expected));
+  } else if (compressed) {
+    // The image hash is computed over the decompressed data, as it is written.
+    result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+    const bool decompressed = inflater_->decompress(data, size, [this, &result](const uint8_t* piece, size_t len) {
+      result = receiveData(piece, len);
+      return result.isSuccess();
+    });
+    if (!decompressed && result.isSuccess()) {
+      LOG_ERROR << "Received corrupt compressed image data at offset " << offset;
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Corrupt compressed image data at offset " + std::to_string(offset));
+    }
+  } else {
+    result = receiveData(data, size);
+  }
+
+  auto m = out_msg.present(AKIpUptaneMes_PR_uploadChunkResp).uploadChunkResp();
+  m->offset = static_cast<long>(update_agent_->receivedDataSize());
+  m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+  SetString(&m->description, result.description);
+
+  return ReturnCode::kOk;
+}
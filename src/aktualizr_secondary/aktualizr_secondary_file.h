@@ -6,6 +6,7 @@
 #include "aktualizr_secondary.h"
 
 class FileUpdateAgent;
+class InflateStream;
 
 class AktualizrSecondaryFile : public AktualizrSecondary {
  public:
@@ -14,6 +15,11 @@ class AktualizrSecondaryFile : public AktualizrSecondary {
   explicit AktualizrSecondaryFile(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryFile(const AktualizrSecondaryConfig& config, std::shared_ptr<INvStorage> storage,
                          std::shared_ptr<FileUpdateAgent> update_agent = nullptr);
+  ~AktualizrSecondaryFile() override;
+  AktualizrSecondaryFile(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile(AktualizrSecondaryFile&&) = delete;
+  AktualizrSecondaryFile& operator=(const AktualizrSecondaryFile&) = delete;
+  AktualizrSecondaryFile& operator=(AktualizrSecondaryFile&&) = delete;
 
   void initialize() override;
   data::InstallationResult receiveData(const uint8_t* data, size_t size);
@@ -26,9 +32,15 @@ class AktualizrSecondaryFile : public AktualizrSecondary {
   void completeInstall() override;
 
   ReturnCode uploadDataHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadParamsHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadChunkHdlr(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode uploadRawHdlr(Asn1Message& in_msg, const uint8_t* data, size_t size, Asn1Message& out_msg);
+  ReturnCode receiveChunk(long offset, const uint8_t* data, size_t size, bool compressed, Asn1Message& out_msg);
 
  private:
   std::shared_ptr<FileUpdateAgent> update_agent_;
+  // Decompresses the chunks of the current upload if the Primary compresses them
+  std::unique_ptr<InflateStream> inflater_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_FILE_H
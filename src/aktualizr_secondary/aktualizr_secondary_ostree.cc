@@ -10,6 +10,11 @@ AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfi
     : AktualizrSecondary(config, storage) {
   registerHandler(AKIpUptaneMes_PR_downloadOstreeRevReq, std::bind(&AktualizrSecondaryOstree::downloadOstreeRev, this,
                                                                    std::placeholders::_1, std::placeholders::_2));
+  // Answered while the background download and the other requests go on
+  registerHandler(AKIpUptaneMes_PR_downloadOstreeStatusReq,
+                  std::bind(&AktualizrSecondaryOstree::downloadOstreeStatus, this, std::placeholders::_1,
+                            std::placeholders::_2),
+                  true);
 
   std::shared_ptr<OstreeManager> pack_man =
       std::make_shared<OstreeManager>(config.pacman, config.bootloader, AktualizrSecondary::storage(), nullptr);
@@ -17,6 +22,8 @@ AktualizrSecondaryOstree::AktualizrSecondaryOstree(const AktualizrSecondaryConfi
       std::make_shared<OstreeUpdateAgent>(config.pacman.sysroot, keyMngr(), pack_man, config.uptane.ecu_hardware_id);
 }
 
+AktualizrSecondaryOstree::~AktualizrSecondaryOstree() { waitForDownload(); }
+
 void AktualizrSecondaryOstree::initialize() {
   initPendingTargetIfAny();
 
@@ -57,9 +64,36 @@ void AktualizrSecondaryOstree::initialize() {
   }
 }
 
+static void setDownloadStatus(Asn1Message& out_msg, const AktualizrSecondaryOstree::DownloadStatus& status) {
+  auto m = out_msg.present(AKIpUptaneMes_PR_downloadOstreeStatusResp).downloadOstreeStatusResp();
+  switch (status.state) {
+    case AktualizrSecondaryOstree::DownloadStatus::State::kRunning:
+      m->state = AKOstreeDownloadState_running;
+      break;
+    case AktualizrSecondaryOstree::DownloadStatus::State::kFinished:
+      m->state = AKOstreeDownloadState_finished;
+      break;
+    default:
+      m->state = AKOstreeDownloadState_idle;
+  }
+  m->fetchedObjects = static_cast<long>(status.fetched_objects);
+  m->requestedObjects = static_cast<long>(status.requested_objects);
+  m->fetchedBytes = static_cast<long>(status.fetched_bytes);
+  m->result = static_cast<AKInstallationResultCode_t>(status.result.result_code.num_code);
+  SetString(&m->description, status.result.description);
+}
+
 MsgHandler::ReturnCode AktualizrSecondaryOstree::downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg) {
+  auto req = in_msg.downloadOstreeRevReq();
+  if (req->async != nullptr && *req->async != 0) {
+    LOG_INFO << "Received an asynchronous OSTree download request; starting download...";
+    setDownloadStatus(out_msg, startOstreeDownload(ToString(req->tlsCred)));
+    return ReturnCode::kOk;
+  }
+
   LOG_INFO << "Received an OSTree download request; attempting download...";
-  auto result = downloadOstreeUpdate(ToString(in_msg.downloadOstreeRevReq()->tlsCred));
+  waitForDownload();
+  auto result = downloadOstreeUpdate(ToString(req->tlsCred));
 
   auto m = out_msg.present(AKIpUptaneMes_PR_downloadOstreeRevResp).downloadOstreeRevResp();
   m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
@@ -78,6 +112,67 @@ data::InstallationResult AktualizrSecondaryOstree::downloadOstreeUpdate(const st
   return update_agent_->downloadTargetRev(getPendingTarget(), packed_tls_creds);
 }
 
+MsgHandler::ReturnCode AktualizrSecondaryOstree::downloadOstreeStatus(Asn1Message& in_msg, Asn1Message& out_msg) {
+  (void)in_msg;
+  setDownloadStatus(out_msg, downloadStatus());
+  return ReturnCode::kOk;
+}
+
+AktualizrSecondaryOstree::DownloadStatus AktualizrSecondaryOstree::startOstreeDownload(
+    const std::string& packed_tls_creds) {
+  std::lock_guard<std::mutex> guard(download_mutex_);
+  if (download_status_.state == DownloadStatus::State::kRunning) {
+    LOG_INFO << "An OSTree download is already running";
+    return download_status_;
+  }
+  if (download_thread_.joinable()) {
+    download_thread_.join();
+  }
+  download_status_ = DownloadStatus();
+  download_status_.state = DownloadStatus::State::kRunning;
+  // The pending target may change while the download runs
+  const Uptane::Target target = getPendingTarget();
+  download_thread_ = std::thread([this, target, packed_tls_creds]() {
+    data::InstallationResult result;
+    if (!target.IsValid()) {
+      LOG_ERROR << "Aborting image download; no valid target found.";
+      result = data::InstallationResult(data::ResultCode::Numeric::kGeneralError,
+                                        "Aborting image download; no valid target found.");
+    } else {
+      try {
+        result = update_agent_->downloadTargetRev(target, packed_tls_creds, [this](const OstreePullStatus& status) {
+          std::lock_guard<std::mutex> status_guard(download_mutex_);
+          download_status_.fetched_bytes = status.fetched_bytes;
+          download_status_.fetched_objects = status.fetched_objects;
+          download_status_.requested_objects = status.requested_objects;
+        });
+      } catch (const std::exception& e) {
+        result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, e.what());
+      }
+    }
+    std::lock_guard<std::mutex> status_guard(download_mutex_);
+    download_status_.state = DownloadStatus::State::kFinished;
+    download_status_.result = std::move(result);
+  });
+  return download_status_;
+}
+
+AktualizrSecondaryOstree::DownloadStatus AktualizrSecondaryOstree::downloadStatus() const {
+  std::lock_guard<std::mutex> guard(download_mutex_);
+  return download_status_;
+}
+
+void AktualizrSecondaryOstree::waitForDownload() {
+  std::thread running;
+  {
+    std::lock_guard<std::mutex> guard(download_mutex_);
+    running = std::move(download_thread_);
+  }
+  if (running.joinable()) {
+    running.join();
+  }
+}
+
 bool AktualizrSecondaryOstree::isTargetSupported(const Uptane::Target& target) const {
   return update_agent_->isTargetSupported(target);
 }
@@ -91,6 +186,7 @@ bool AktualizrSecondaryOstree::getInstalledImageInfo(Uptane::InstalledImageInfo&
 }
 
 data::InstallationResult AktualizrSecondaryOstree::installPendingTarget(const Uptane::Target& target) {
+  waitForDownload();
   return update_agent_->install(target);
 }
 
@@ -1,6 +1,9 @@
 #ifndef AKTUALIZR_SECONDARY_OSTREE_H
 #define AKTUALIZR_SECONDARY_OSTREE_H
 
+#include <mutex>
+#include <thread>
+
 #include "aktualizr_secondary.h"
 #include "storage/invstorage.h"
 
@@ -10,10 +13,29 @@ class AktualizrSecondaryOstree : public AktualizrSecondary {
  public:
   explicit AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config);
   AktualizrSecondaryOstree(const AktualizrSecondaryConfig& config, const std::shared_ptr<INvStorage>& storage);
+  ~AktualizrSecondaryOstree() override;
+  AktualizrSecondaryOstree(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree(AktualizrSecondaryOstree&&) = delete;
+  AktualizrSecondaryOstree& operator=(const AktualizrSecondaryOstree&) = delete;
+  AktualizrSecondaryOstree& operator=(AktualizrSecondaryOstree&&) = delete;
 
   void initialize() override;
   data::InstallationResult downloadOstreeUpdate(const std::string& packed_tls_creds);
 
+  struct DownloadStatus {
+    enum class State { kIdle, kRunning, kFinished };
+    State state{State::kIdle};
+    uint64_t fetched_bytes{0};
+    uint32_t fetched_objects{0};
+    uint32_t requested_objects{0};
+    // Of the last finished download
+    data::InstallationResult result;
+  };
+  // Start downloading the pending target in the background, unless a download
+  // is running already; its progress is given by downloadStatus().
+  DownloadStatus startOstreeDownload(const std::string& packed_tls_creds);
+  DownloadStatus downloadStatus() const;
+
  protected:
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
   bool isTargetSupported(const Uptane::Target& target) const override;
@@ -25,8 +47,15 @@ class AktualizrSecondaryOstree : public AktualizrSecondary {
   bool hasPendingUpdate() { return storage()->hasPendingInstall(); }
 
   ReturnCode downloadOstreeRev(Asn1Message& in_msg, Asn1Message& out_msg);
+  ReturnCode downloadOstreeStatus(Asn1Message& in_msg, Asn1Message& out_msg);
+  // Wait for the background download, if there is one
+  void waitForDownload();
 
   std::shared_ptr<OstreeUpdateAgent> update_agent_;
+
+  mutable std::mutex download_mutex_;
+  std::thread download_thread_;
+  DownloadStatus download_status_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_OSTREE_H
@@ -254,9 +254,14 @@ class SecondaryOstreeTest : public ::testing::TestWithParam<VerificationType> {
 
   Uptane::MetaBundle currentMetadata() const { return uptane_repo_.getCurrentMetadata(); }
 
-  std::string getCredsToSend() const {
-    std::map<std::string, std::string> creds_map = {
-        {"ca.pem", ""}, {"client.pem", ""}, {"pkey.pem", ""}, {"server.url", treehub_->url()}};
+  std::string getCredsToSend(const std::string& server_url = "", const std::string& mirror_url = "") const {
+    std::map<std::string, std::string> creds_map = {{"ca.pem", ""},
+                                                    {"client.pem", ""},
+                                                    {"pkey.pem", ""},
+                                                    {"server.url", server_url.empty() ? treehub_->url() : server_url}};
+    if (!mirror_url.empty()) {
+      creds_map["mirror.url"] = mirror_url;
+    }
 
     std::stringstream creads_strstream;
     Utils::writeArchive(creds_map, creads_strstream);
@@ -301,6 +306,29 @@ TEST_P(SecondaryOstreeTest, fullUptaneVerificationInvalidSerial) {
   EXPECT_EQ(secondary_->putMetadata(addTarget("", "", "invalid-serial-id")).isSuccess(), expected_result);
 }
 
+/* Download the commit from the mirror of the Primary when it sends one. */
+TEST_P(SecondaryOstreeTest, downloadFromMirror) {
+  // Without the commit yet
+  OstreeRootfs sysroot(ostree_rootfs_template_);
+  AktualizrSecondaryWrapper secondary(sysroot, *treehub_, GetParam());
+  const std::string unreachable_url = "http://127.0.0.1:" + TestUtils::getFreePort();
+
+  EXPECT_TRUE(
+      secondary->putMetadata(addTarget(treehubCurRev(), secondary.hardwareID(), secondary.serial())).isSuccess());
+  EXPECT_TRUE(secondary->downloadOstreeUpdate(getCredsToSend(unreachable_url, treehub_->url())).isSuccess());
+}
+
+/* Download the commit from the server when the mirror of the Primary fails. */
+TEST_P(SecondaryOstreeTest, downloadMirrorFallback) {
+  OstreeRootfs sysroot(ostree_rootfs_template_);
+  AktualizrSecondaryWrapper secondary(sysroot, *treehub_, GetParam());
+  const std::string unreachable_url = "http://127.0.0.1:" + TestUtils::getFreePort();
+
+  EXPECT_TRUE(
+      secondary->putMetadata(addTarget(treehubCurRev(), secondary.hardwareID(), secondary.serial())).isSuccess());
+  EXPECT_TRUE(secondary->downloadOstreeUpdate(getCredsToSend("", unreachable_url)).isSuccess());
+}
+
 TEST_P(SecondaryOstreeTest, verifyUpdatePositive) {
   // check the version reported in the manifest just after an initial boot
   Uptane::Manifest manifest = secondary_->getManifest();
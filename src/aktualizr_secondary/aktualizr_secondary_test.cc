@@ -384,6 +384,22 @@ TEST_P(SecondaryTestVerification, VerificationPositive) {
 INSTANTIATE_TEST_SUITE_P(SecondaryTestVerificationType, SecondaryTestVerification,
                          ::testing::Values(VerificationType::kFull, VerificationType::kTuf));
 
+/* The manifest is signed again only when its content changes. */
+TEST_F(SecondaryTest, ManifestSignedOnChange) {
+  // RSA-PSS signatures are randomized, so that an unchanged one comes from the cache
+  const auto manifest = secondary_->getManifest();
+  EXPECT_EQ(secondary_->getManifest(), manifest);
+
+  ASSERT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
+  ASSERT_EQ(sendImageFile(), data::ResultCode::Numeric::kOk);
+  ASSERT_TRUE(secondary_->install().isSuccess());
+
+  const auto updated = secondary_->getManifest();
+  EXPECT_NE(updated, manifest);
+  EXPECT_EQ(updated.filepath(), default_target_);
+  EXPECT_EQ(secondary_->getManifest(), updated);
+}
+
 TEST_F(SecondaryTest, TwoImagesAndOneTarget) {
   // two images for the same ECU, just one of them is added as a target and signed
   // default image and corresponding target has been already added, just add another image
@@ -414,6 +430,21 @@ TEST_F(SecondaryTest, IncorrectTargetQuantity) {
   }
 }
 
+/* The same metadata sent again is accepted without verifying it in full, changed metadata is verified again. */
+TEST_F(SecondaryTest, ResendMetadata) {
+  const auto metadata = uptane_repo_.getCurrentMetadata();
+  ASSERT_TRUE(secondary_->putMetadata(metadata).isSuccess());
+  EXPECT_TRUE(secondary_->putMetadata(metadata).isSuccess());
+  EXPECT_EQ(secondary_->getPendingTarget().filename(), default_target_);
+
+  // two targets for the same ECU
+  auto changed = uptane_repo_.addImageFile("second_target", secondary_->hwID().ToString(),
+                                           secondary_->serial().ToString());
+  EXPECT_FALSE(secondary_->putMetadata(changed).isSuccess());
+  // The first metadata is now older than the stored one.
+  EXPECT_FALSE(secondary_->putMetadata(metadata).isSuccess());
+}
+
 TEST_F(SecondaryTest, DirectorRootVersionIncremented) {
   uptane_repo_.refreshRoot(Uptane::RepositoryType::Director());
   EXPECT_TRUE(secondary_->putMetadata(uptane_repo_.getCurrentMetadata()).isSuccess());
@@ -523,6 +554,58 @@ INSTANTIATE_TEST_SUITE_P(SecondaryTestTufVersions, SecondaryTestTuf,
                                            std::make_pair(std::vector<std::string>{"invalid1", "invalid2"},
                                                           boost::none)));
 
+static Uptane::Target imageTarget(const std::string& name, const std::string& content) {
+  Json::Value target_json;
+  target_json["custom"]["targetFormat"] = "BINARY";
+  target_json["hashes"]["sha256"] = Hash::generate(Hash::Type::kSha256, content).HashString();
+  target_json["length"] = Json::UInt64(content.size());
+  return Uptane::Target(name, target_json);
+}
+
+static data::InstallationResult receive(FileUpdateAgent& agent, const Uptane::Target& target,
+                                        const std::string& data) {
+  return agent.receiveData(target, reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+/* An upload interrupted by a restart of the Secondary goes on from the data
+ * received so far, whose hash is reported. */
+TEST(FileUpdateAgent, ResumeAfterRestart) {
+  TemporaryDirectory dir;
+  const std::string content(10000, 'x');
+  const std::string other(10000, 'y');
+  const auto target = imageTarget("image", content);
+  {
+    FileUpdateAgent agent(dir / "firmware.txt", "");
+    EXPECT_EQ(agent.resumeData(target), 0);
+    EXPECT_TRUE(receive(agent, target, content.substr(0, 4000)).isSuccess());
+    EXPECT_EQ(agent.receivedDataHash(), Hash::generate(Hash::Type::kSha256, content.substr(0, 4000)).HashString());
+  }
+
+  FileUpdateAgent agent(dir / "firmware.txt", "");
+  EXPECT_EQ(agent.resumeData(target), 4000);
+  EXPECT_EQ(agent.receivedDataHash(), Hash::generate(Hash::Type::kSha256, content.substr(0, 4000)).HashString());
+  EXPECT_TRUE(receive(agent, target, content.substr(4000)).isSuccess());
+  EXPECT_TRUE(agent.install(target).isSuccess());
+  EXPECT_EQ(Utils::readFile(dir / "firmware.txt"), content);
+
+  // The partial image of another target is dropped.
+  EXPECT_TRUE(receive(agent, imageTarget("other", other), other.substr(0, 100)).isSuccess());
+  EXPECT_EQ(agent.resumeData(target), 0);
+  EXPECT_EQ(agent.receivedDataHash(), "");
+}
+
+/* A broken image is dropped, so that it is received again from the start. */
+TEST(FileUpdateAgent, DiscardBrokenImage) {
+  TemporaryDirectory dir;
+  const std::string content(1000, 'x');
+  const auto target = imageTarget("image", content);
+  FileUpdateAgent agent(dir / "firmware.txt", "");
+  EXPECT_TRUE(receive(agent, target, std::string(1000, 'z')).isSuccess());
+  EXPECT_FALSE(agent.install(target).isSuccess());
+  EXPECT_EQ(agent.receivedDataSize(), 0);
+  EXPECT_EQ(agent.resumeData(target), 0);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,239 @@
+#include "image_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "logging/logging.h"
+
+// Alignment of the direct writes, that of the logical blocks of any storage
+static constexpr size_t kAlignment = 4096;
+// Size of each of the two buffers, a multiple of kAlignment
+static constexpr size_t kBufferSize = 1024 * 1024;
+
+// Write all of size bytes at offset, through short writes.
+static bool pwriteAll(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    const ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      if (written == 0) {
+        errno = EIO;
+      }
+      return false;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    data += written;
+    size -= static_cast<size_t>(written);
+    offset += static_cast<uint64_t>(written);
+  }
+  return true;
+}
+
+ImageWriter::ImageWriter(const boost::filesystem::path& path, uint64_t offset, bool direct_io, Written written,
+                         unsigned io_queue_depth)
+    : written_{std::move(written)} {
+  for (auto& buffer : buffers_) {
+    void* data = nullptr;
+    if (posix_memalign(&data, kAlignment, kBufferSize) != 0) {
+      throw std::bad_alloc();
+    }
+    buffer.data.reset(static_cast<uint8_t*>(data));
+  }
+  filling_->offset = offset;
+  if (io_queue_depth > 0) {
+    ring_ = IoUring::create(io_queue_depth);
+    if (ring_ != nullptr) {
+      std::vector<iovec> registered;
+      for (const auto& buffer : buffers_) {
+        registered.push_back({buffer.data.get(), kBufferSize});
+      }
+      ring_->registerBuffers(registered);
+    }
+  }
+
+  // Also read from, for the start of a partial block
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+  if (fd_ < 0) {
+    fail("Failed to open " + path.string() + ": " + std::strerror(errno));
+    return;
+  }
+  if (direct_io) {
+    direct_fd_ = open(path.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+    if (direct_fd_ < 0) {
+      LOG_INFO << "Direct I/O is not supported for " << path << ": " << std::strerror(errno);
+    }
+  }
+  if (direct_fd_ >= 0) {
+    // Start at the block the offset is in, with the data already there.
+    const auto kept = static_cast<size_t>(offset % kAlignment);
+    filling_->offset = offset - kept;
+    if (pread(fd_, filling_->data.get(), kept, static_cast<off_t>(filling_->offset)) != static_cast<ssize_t>(kept)) {
+      fail("Failed to read the start of the last block of " + path.string());
+      return;
+    }
+    filling_->size = filling_->kept = kept;
+  }
+  thread_ = std::thread([this]() { run(); });
+}
+
+ImageWriter::~ImageWriter() {
+  if (thread_.joinable()) {
+    flush();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+  }
+  if (direct_fd_ >= 0) {
+    close(direct_fd_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool ImageWriter::write(const uint8_t* data, size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (failed_) {
+      return false;
+    }
+  }
+  while (size > 0) {
+    const size_t copied = std::min(size, kBufferSize - filling_->size);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    std::copy_n(data, copied, filling_->data.get() + filling_->size);
+    filling_->size += copied;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    data += copied;
+    size -= copied;
+    if (filling_->size == kBufferSize && !handOver()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ImageWriter::flush() {
+  Buffer* last = filling_;
+  const size_t size = last->size;
+  if (size > last->kept && !handOver()) {
+    return false;
+  }
+  if (!wait()) {
+    return false;
+  }
+  if (direct_fd_ >= 0 && filling_ != last) {
+    // The partial block at the end is written again once it is full.
+    const size_t tail = size % kAlignment;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    std::copy_n(last->data.get() + size - tail, tail, filling_->data.get());
+    filling_->offset -= tail;
+    filling_->size = filling_->kept = tail;
+  }
+  return true;
+}
+
+bool ImageWriter::sync() {
+  if (!flush()) {
+    return false;
+  }
+  if (fdatasync(fd_) != 0) {
+    fail(std::string("Failed to sync the image: ") + std::strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+std::string ImageWriter::error() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return error_;
+}
+
+void ImageWriter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return pending_ != nullptr || stop_; });
+    if (pending_ == nullptr) {
+      return;
+    }
+    if (!failed_) {
+      const Buffer* buffer = pending_;
+      lock.unlock();
+      std::string error;
+      const bool written = writeBuffer(*buffer, &error);
+      lock.lock();
+      if (!written) {
+        failed_ = true;
+        error_ = error;
+      }
+    }
+    pending_ = nullptr;
+    cv_.notify_all();
+  }
+}
+
+bool ImageWriter::writeBuffer(const Buffer& buffer, std::string* error) {
+  size_t direct_size = direct_fd_ >= 0 ? buffer.size - buffer.size % kAlignment : 0;
+  if (direct_size > 0 && !writeAll(direct_fd_, buffer.data.get(), direct_size, buffer.offset)) {
+    if (errno != EINVAL) {
+      *error = std::string("Failed to write the image: ") + std::strerror(errno);
+      return false;
+    }
+    // The file system accepted O_DIRECT but not the writes.
+    LOG_INFO << "Direct I/O failed, writing the image through the page cache";
+    close(direct_fd_);
+    direct_fd_ = -1;
+    direct_size = 0;
+  }
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  if (!writeAll(fd_, buffer.data.get() + direct_size, buffer.size - direct_size, buffer.offset + direct_size)) {
+    *error = std::string("Failed to write the image: ") + std::strerror(errno);
+    return false;
+  }
+  if (written_) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    written_(buffer.data.get() + buffer.kept, buffer.size - buffer.kept, buffer.offset + buffer.size);
+  }
+  return true;
+}
+
+bool ImageWriter::writeAll(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+  return ring_ != nullptr ? ring_->writeAll(fd, data, size, offset) : pwriteAll(fd, data, size, offset);
+}
+
+bool ImageWriter::handOver() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return pending_ == nullptr; });
+  if (failed_) {
+    return false;
+  }
+  pending_ = filling_;
+  cv_.notify_all();
+  // The writer thread is done with the other one.
+  Buffer* next = filling_ == &buffers_[0] ? &buffers_[1] : &buffers_[0];
+  next->offset = filling_->offset + filling_->size;
+  next->size = next->kept = 0;
+  filling_ = next;
+  return true;
+}
+
+bool ImageWriter::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this]() { return pending_ == nullptr; });
+  return !failed_;
+}
+
+void ImageWriter::fail(const std::string& error) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  failed_ = true;
+  error_ = error;
+}
@@ -0,0 +1,100 @@
+#ifndef AKTUALIZR_SECONDARY_IMAGE_WRITER_H_
+#define AKTUALIZR_SECONDARY_IMAGE_WRITER_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "utilities/io_uring.h"
+
+/**
+ * Writes an image to a file or a block device on a thread of its own, so that
+ * the image data received is acknowledged without waiting for the storage.
+ *
+ * The data is gathered in one of two buffers while the other one is written.
+ * With direct I/O, the buffers are written past the page cache, in whole
+ * aligned blocks, and only a last partial block goes through it. With an
+ * io_uring queue depth, the blocks of a buffer are written that many at a
+ * time. Nothing is synced to the storage before sync().
+ */
+class ImageWriter {
+ public:
+  /** Called on the writer thread with the data just written, and the offset after it. */
+  using Written = std::function<void(const uint8_t* data, size_t size, uint64_t end)>;
+
+  /**
+   * @param path the file to write to, created if needed, or a block device
+   * @param offset where the data goes, after what is kept
+   * @param direct_io write with O_DIRECT where the file system supports it
+   * @param written told about each piece of data once it is written
+   * @param io_queue_depth writes in flight through io_uring, where the kernel supports it; 0 uses pwrite()
+   */
+  ImageWriter(const boost::filesystem::path& path, uint64_t offset, bool direct_io, Written written,
+              unsigned io_queue_depth = 0);
+  /** Writes the data added so far, but doesn't sync it. */
+  ~ImageWriter();
+  ImageWriter(const ImageWriter&) = delete;
+  ImageWriter(ImageWriter&&) = delete;
+  ImageWriter& operator=(const ImageWriter&) = delete;
+  ImageWriter& operator=(ImageWriter&&) = delete;
+
+  /**
+   * Add data to write. Only waits for the storage when both buffers are full.
+   * @return false if the writing has failed, see error()
+   */
+  bool write(const uint8_t* data, size_t size);
+  /** Write the data added so far, and wait for it. */
+  bool flush();
+  /** Write the data added so far, and sync it to the storage. */
+  bool sync();
+  /** The offset after the data added so far */
+  uint64_t offset() const { return filling_->offset + filling_->size; }
+  bool directIo() const { return direct_fd_ >= 0; }
+  std::string error() const;
+
+ private:
+  struct Buffer {
+    std::unique_ptr<uint8_t, decltype(&free)> data{nullptr, &free};
+    uint64_t offset{0};
+    size_t size{0};
+    // Data at the front that was given to written_ before, written again to keep the writes aligned
+    size_t kept{0};
+  };
+
+  void run();
+  bool writeBuffer(const Buffer& buffer, std::string* error);
+  bool writeAll(int fd, const uint8_t* data, size_t size, uint64_t offset);
+  // Give the filling buffer to the writer thread, and go on with the other one.
+  bool handOver();
+  // Wait for the writer thread to be done.
+  bool wait();
+  void fail(const std::string& error);
+
+  const Written written_;
+  int fd_{-1};
+  int direct_fd_{-1};
+  std::array<Buffer, 2> buffers_;
+  Buffer* filling_{&buffers_[0]};
+  // Only used by the writer thread, and gone before the buffers
+  std::unique_ptr<IoUring> ring_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  // Guarded by mutex_
+  Buffer* pending_{nullptr};
+  bool stop_{false};
+  bool failed_{false};
+  std::string error_;
+  std::thread thread_;
+};
+
+#endif  // AKTUALIZR_SECONDARY_IMAGE_WRITER_H_
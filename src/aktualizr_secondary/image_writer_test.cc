@@ -0,0 +1,78 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <random>
+#include <string>
+#include <tuple>
+
+#include "image_writer.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+// Direct I/O, and the io_uring queue depth
+class ImageWriterTest : public ::testing::TestWithParam<std::tuple<bool, unsigned>> {};
+
+/* The image is written in order, also from an offset that is not aligned and
+ * across flushes, and each piece of data is told about once written. */
+TEST_P(ImageWriterTest, Write) {
+  TemporaryDirectory dir;
+  const auto path = dir / "image";
+  std::mt19937 random(1);
+  std::string image(3 * 1024 * 1024 + 12345, '\0');
+  for (auto& c : image) {
+    c = static_cast<char>(random());
+  }
+  const size_t resumed = 5000;
+  Utils::writeFile(path, image.substr(0, resumed));
+
+  std::string written;
+  uint64_t written_end = resumed;
+  {
+    ImageWriter writer(
+        path, resumed, std::get<0>(GetParam()),
+        [&](const uint8_t* data, size_t size, uint64_t end) {
+          written.append(reinterpret_cast<const char*>(data), size);
+          EXPECT_EQ(end, written_end + size);
+          written_end = end;
+        },
+        std::get<1>(GetParam()));
+    std::uniform_int_distribution<size_t> piece(1, 100000);
+    size_t offset = resumed;
+    for (int i = 0; offset < image.size(); ++i) {
+      const size_t size = std::min(piece(random), image.size() - offset);
+      ASSERT_TRUE(writer.write(reinterpret_cast<const uint8_t*>(image.data()) + offset, size));
+      offset += size;
+      EXPECT_EQ(writer.offset(), offset);
+      if (i % 10 == 0) {
+        ASSERT_TRUE(writer.flush());
+        EXPECT_EQ(written_end, offset);
+      }
+    }
+    EXPECT_TRUE(writer.sync());
+    LOG_INFO << "Direct I/O: " << writer.directIo();
+  }
+  EXPECT_EQ(written, image.substr(resumed));
+  EXPECT_EQ(Utils::readFile(path), image);
+}
+
+INSTANTIATE_TEST_SUITE_P(ImageWriterDirectIo, ImageWriterTest,
+                         ::testing::Combine(::testing::Bool(), ::testing::Values(0U, 4U)));
+
+/* A file that can't be opened fails the writes. */
+TEST(ImageWriter, OpenFailure) {
+  TemporaryDirectory dir;
+  ImageWriter writer(dir / "missing" / "image", 0, false, nullptr);
+  const std::array<uint8_t, 3> data{1, 2, 3};
+  EXPECT_FALSE(writer.write(data.data(), data.size()));
+  EXPECT_FALSE(writer.sync());
+  EXPECT_NE(writer.error(), "");
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::info);
+  return RUN_ALL_TESTS();
+}
+#endif
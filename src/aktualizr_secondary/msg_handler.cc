@@ -1,11 +1,20 @@
 #include "msg_handler.h"
 
+#include <mutex>
+
 #include "logging/logging.h"
 
-void MsgDispatcher::clearHandlers() { handler_map_.clear(); }
+void MsgDispatcher::clearHandlers() {
+  handler_map_.clear();
+  raw_handler_map_.clear();
+}
+
+void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, bool read_only) {
+  handler_map_[msg_id] = Entry{std::move(handler), read_only};
+}
 
-void MsgDispatcher::registerHandler(AKIpUptaneMes_PR msg_id, Handler handler) {
-  handler_map_[msg_id] = std::move(handler);
+void MsgDispatcher::registerRawHandler(AKIpUptaneMes_PR msg_id, RawHandler handler) {
+  raw_handler_map_[msg_id] = std::move(handler);
 }
 
 MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) {
@@ -14,7 +23,14 @@ MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg,
     return MsgHandler::kUnkownMsg;
   }
   LOG_TRACE << "Found a handler for the request, processing it...";
-  auto handle_status_code = find_res_it->second(*in_msg, *out_msg);
+  ReturnCode handle_status_code;
+  if (find_res_it->second.read_only) {
+    std::shared_lock<std::shared_timed_mutex> lock(state_mutex_);
+    handle_status_code = find_res_it->second.handler(*in_msg, *out_msg);
+  } else {
+    std::unique_lock<std::shared_timed_mutex> lock(state_mutex_);
+    handle_status_code = find_res_it->second.handler(*in_msg, *out_msg);
+  }
   LOG_TRACE << "Request handler returned a response: " << out_msg->toStr();
 
   // Track the last message to help cut down on repetitive logging. Ignore the
@@ -24,3 +40,18 @@ MsgHandler::ReturnCode MsgDispatcher::handleMsg(const Asn1Message::Ptr& in_msg,
   }
   return handle_status_code;
 }
+
+MsgHandler::ReturnCode MsgDispatcher::handleRawMsg(const Asn1Message::Ptr& in_msg, const uint8_t* data, size_t size,
+                                                   Asn1Message::Ptr& out_msg) {
+  auto find_res_it = raw_handler_map_.find(in_msg->present());
+  if (find_res_it == raw_handler_map_.end()) {
+    return MsgHandler::kUnkownMsg;
+  }
+  ReturnCode handle_status_code;
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(state_mutex_);
+    handle_status_code = find_res_it->second(*in_msg, data, size, *out_msg);
+  }
+  last_msg_ = in_msg->present();
+  return handle_status_code;
+}
@@ -1,7 +1,9 @@
 #ifndef MSG_HANDLER_H
 #define MSG_HANDLER_H
 
+#include <atomic>
 #include <memory>
+#include <shared_mutex>
 #include <unordered_map>
 
 #include "AKIpUptaneMes.h"
@@ -19,22 +21,47 @@ class MsgHandler {
   MsgHandler& operator=(MsgHandler&&) = delete;
 
   virtual ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) = 0;
+  // For the requests followed by raw data on the connection, such as uploadRawReq
+  virtual ReturnCode handleRawMsg(const Asn1Message::Ptr& in_msg, const uint8_t* data, size_t size,
+                                  Asn1Message::Ptr& out_msg) {
+    (void)in_msg;
+    (void)data;
+    (void)size;
+    (void)out_msg;
+    return kUnkownMsg;
+  }
 };
 
+/**
+ * Forwards the messages to the handlers registered for them. Messages can be
+ * handled from several threads: the handlers run one at a time, except the
+ * ones registered as read-only, which can run along each other.
+ */
 class MsgDispatcher : public MsgHandler {
  public:
   using Handler = std::function<ReturnCode(Asn1Message&, Asn1Message&)>;
+  using RawHandler = std::function<ReturnCode(Asn1Message&, const uint8_t*, size_t, Asn1Message&)>;
 
-  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler);
+  // Handlers are registered before messages are handled.
+  void registerHandler(AKIpUptaneMes_PR msg_id, Handler handler, bool read_only = false);
+  void registerRawHandler(AKIpUptaneMes_PR msg_id, RawHandler handler);
   ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override;
+  ReturnCode handleRawMsg(const Asn1Message::Ptr& in_msg, const uint8_t* data, size_t size,
+                          Asn1Message::Ptr& out_msg) override;
 
  protected:
   void clearHandlers();
 
-  unsigned int last_msg_ = 0;
+  std::atomic<unsigned int> last_msg_{0};
 
  private:
-  std::unordered_map<unsigned int, Handler> handler_map_;
+  struct Entry {
+    Handler handler;
+    bool read_only;
+  };
+  std::unordered_map<unsigned int, Entry> handler_map_;
+  std::unordered_map<unsigned int, RawHandler> raw_handler_map_;
+  std::shared_timed_mutex state_mutex_;
 };
 
 #endif  // MSG_HANDLER_H
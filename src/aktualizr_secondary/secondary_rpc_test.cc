@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <atomic>
 #include <thread>
 
 #include <gtest/gtest.h>
+#include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <boost/filesystem.hpp>
 
@@ -14,8 +17,9 @@
 #include "secondary_tcp_server.h"
 #include "storage/invstorage.h"
 #include "test_utils.h"
+#include "utilities/deflate_stream.h"
 
-enum class HandlerVersion { kV1, kV2, kV2Failure };
+enum class HandlerVersion { kV1, kV2, kV2Failure, kV3, kV4, kV5, kV6 };
 
 /* This class allows us to divert messages from the regular handlers in
  * AktualizrSecondary to our own test functions. This lets us test only what was
@@ -58,6 +62,24 @@ class SecondaryMock : public MsgDispatcher {
       registerV1Handlers();
     } else if (handler_version_ == HandlerVersion::kV2) {
       registerV2Handlers();
+    } else if (handler_version_ == HandlerVersion::kV3) {
+      registerV2Handlers();
+      registerV3Handlers();
+    } else if (handler_version_ == HandlerVersion::kV4) {
+      registerV2Handlers();
+      registerV3Handlers();
+      registerV4Handlers();
+    } else if (handler_version_ == HandlerVersion::kV5) {
+      registerV2Handlers();
+      registerV3Handlers();
+      registerV4Handlers();
+      registerV5Handlers();
+    } else if (handler_version_ == HandlerVersion::kV6) {
+      registerV2Handlers();
+      registerV3Handlers();
+      registerV4Handlers();
+      registerV5Handlers();
+      registerV6Handlers();
     } else {
       registerV2FailureHandlers();
     }
@@ -66,8 +88,33 @@ class SecondaryMock : public MsgDispatcher {
   void resetImageHash() const { hasher_->reset(); }
   Hash getReceivedImageHash() const { return hasher_->getHash(); }
   size_t getReceivedImageSize() const { return boost::filesystem::file_size(image_filepath_); }
+  // Lower than what the Primary proposes, to check that it follows the Secondary
+  static constexpr long kV3ChunkSize = 4096;
+  static constexpr long kV3Window = 3;
 
   const std::string& getReceivedTlsCreds() const { return tls_creds_; }
+  int rawChunks() const { return raw_chunks_; }
+  int chunks() const { return chunks_; }
+  int compressedChunks() const { return compressed_chunks_; }
+  int uploadParamsRequests() const { return upload_params_requests_; }
+  long lastUploadOffset() const { return last_upload_offset_; }
+  int discards() const { return discards_; }
+  // The connection is closed instead of handling the chunk that comes after
+  // that many more.
+  void dropConnectionAfter(int chunks) { drop_after_chunks_ = chunks; }
+  // Tell the Primary the hash of the data received so far, as aktualizr-secondary does.
+  void reportReceivedHash() { report_received_hash_ = true; }
+  // Image data left by an earlier upload
+  void leaveImageData(const std::string& data) {
+    receiveImageData(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+  }
+  // Requests with Root metadata and the Roots they held
+  int rootRequests() const { return root_requests_; }
+  const std::vector<std::string>& receivedRoots() const { return received_roots_; }
+  int ostreeStatusRequests() const { return ostree_status_requests_; }
+  // Objects of the OSTree downloads of v6, fetched one status request after the other
+  static constexpr long kV6OstreeObjects = 4;
+  static constexpr long kV6OstreeObjectSize = 1000;
 
   // Used by both protocol versions:
   void registerBaseHandlers() {
@@ -111,6 +158,37 @@ class SecondaryMock : public MsgDispatcher {
                     std::bind(&SecondaryMock::putRootHdlr, this, std::placeholders::_1, std::placeholders::_2));
   }
 
+  // Used by protocol v3 on top of the v2 handlers:
+  void registerV3Handlers() {
+    registerHandler(AKIpUptaneMes_PR_uploadParamsReq,
+                    std::bind(&SecondaryMock::uploadParamsHdlr, this, std::placeholders::_1, std::placeholders::_2));
+    registerHandler(AKIpUptaneMes_PR_uploadChunkReq,
+                    std::bind(&SecondaryMock::uploadChunkHdlr, this, std::placeholders::_1, std::placeholders::_2));
+  }
+
+  // Used by protocol v4 on top of the v3 handlers:
+  void registerV4Handlers() {
+    registerRawHandler(AKIpUptaneMes_PR_uploadRawReq,
+                       std::bind(&SecondaryMock::uploadRawHdlr, this, std::placeholders::_1, std::placeholders::_2,
+                                 std::placeholders::_3, std::placeholders::_4));
+  }
+
+  // Used by protocol v5 on top of the v4 handlers:
+  void registerV5Handlers() {
+    registerHandler(AKIpUptaneMes_PR_putRootChainReq,
+                    std::bind(&SecondaryMock::putRootChainHdlr, this, std::placeholders::_1, std::placeholders::_2));
+  }
+
+  // Used by protocol v6 on top of the v5 handlers:
+  void registerV6Handlers() {
+    registerHandler(AKIpUptaneMes_PR_downloadOstreeRevReq, std::bind(&SecondaryMock::downloadOstreeRevAsync, this,
+                                                                     std::placeholders::_1, std::placeholders::_2));
+    registerHandler(
+        AKIpUptaneMes_PR_downloadOstreeStatusReq,
+        std::bind(&SecondaryMock::downloadOstreeStatusHdlr, this, std::placeholders::_1, std::placeholders::_2),
+        true);
+  }
+
   // Procotol v2 handlers that fail in predictable ways.
   void registerV2FailureHandlers() {
     registerHandler(AKIpUptaneMes_PR_putMetaReq2,
@@ -148,6 +226,14 @@ class SecondaryMock : public MsgDispatcher {
     auto m = out_msg.present(AKIpUptaneMes_PR_versionResp).versionResp();
     if (handler_version_ == HandlerVersion::kV1) {
       m->version = 1;
+    } else if (handler_version_ == HandlerVersion::kV3) {
+      m->version = 3;
+    } else if (handler_version_ == HandlerVersion::kV4) {
+      m->version = 4;
+    } else if (handler_version_ == HandlerVersion::kV5) {
+      m->version = 5;
+    } else if (handler_version_ == HandlerVersion::kV6) {
+      m->version = 6;
     } else {
       m->version = 2;
     }
@@ -308,6 +394,81 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode uploadParamsHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto req = in_msg.uploadParamsReq();
+    ++upload_params_requests_;
+    if (req->discard != nullptr && *req->discard != 0) {
+      ++discards_;
+      boost::filesystem::remove(image_filepath_);
+      hasher_->reset();
+    }
+    auto m = out_msg.present(AKIpUptaneMes_PR_uploadParamsResp).uploadParamsResp();
+    m->chunkSize = std::min(req->chunkSize, kV3ChunkSize);
+    m->window = std::min(req->window, kV3Window);
+    m->offset = static_cast<long>(receivedImageOffset());
+    last_upload_offset_ = m->offset;
+    if (report_received_hash_ && m->offset > 0) {
+      m->receivedHash = Asn1Allocation<OCTET_STRING_t>();
+      SetString(m->receivedHash,
+                Hash::generate(Hash::Type::kSha256, Utils::readFile(image_filepath_)).HashString());
+    }
+    inflater_.reset();
+    if (req->compression != nullptr && *req->compression == AKCompression_deflate) {
+      inflater_ = std_::make_unique<InflateStream>();
+      m->compression = Asn1Allocation<AKCompression_t>();
+      *m->compression = AKCompression_deflate;
+    }
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode uploadChunkHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto req = in_msg.uploadChunkReq();
+    if (req->data.size < 0) {
+      return ReturnCode::kUnkownMsg;
+    }
+    if (inflater_ == nullptr) {
+      return receiveChunk(req->offset, req->data.buf, static_cast<size_t>(req->data.size), out_msg);
+    }
+    ++compressed_chunks_;
+    std::string chunk;
+    if (!inflater_->decompress(req->data.buf, static_cast<size_t>(req->data.size),
+                               [&chunk](const uint8_t* data, size_t size) {
+                                 chunk.append(reinterpret_cast<const char*>(data), size);
+                                 return true;
+                               })) {
+      return ReturnCode::kUnkownMsg;
+    }
+    return receiveChunk(req->offset, reinterpret_cast<const uint8_t*>(chunk.data()), chunk.size(), out_msg);
+  }
+
+  MsgHandler::ReturnCode uploadRawHdlr(Asn1Message& in_msg, const uint8_t* data, size_t size, Asn1Message& out_msg) {
+    ++raw_chunks_;
+    return receiveChunk(in_msg.uploadRawReq()->offset, data, size, out_msg);
+  }
+
+  MsgHandler::ReturnCode receiveChunk(long offset, const uint8_t* data, size_t size, Asn1Message& out_msg) {
+    if (drop_after_chunks_ >= 0 && drop_after_chunks_-- == 0) {
+      return ReturnCode::kUnkownMsg;
+    }
+    data::InstallationResult result;
+    if (size > static_cast<size_t>(kV3ChunkSize)) {
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Invalid chunk size");
+    } else if (static_cast<uint64_t>(offset) != receivedImageOffset()) {
+      result = data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Unexpected chunk offset");
+    } else {
+      result = receiveImageData(data, size);
+      ++chunks_;
+    }
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_uploadChunkResp).uploadChunkResp();
+    m->offset = static_cast<long>(receivedImageOffset());
+    m->result = static_cast<AKInstallationResultCode_t>(result.result_code.num_code);
+    SetString(&m->description, result.description);
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode uploadDataFailureHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -334,6 +495,36 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  void setOstreeStatus(Asn1Message& out_msg) {
+    auto m = out_msg.present(AKIpUptaneMes_PR_downloadOstreeStatusResp).downloadOstreeStatusResp();
+    const long fetched = ostree_fetched_objects_;
+    m->state = fetched < kV6OstreeObjects ? AKOstreeDownloadState_running : AKOstreeDownloadState_finished;
+    m->fetchedObjects = fetched;
+    m->requestedObjects = kV6OstreeObjects;
+    m->fetchedBytes = fetched * kV6OstreeObjectSize;
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+  }
+
+  MsgHandler::ReturnCode downloadOstreeRevAsync(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto req = in_msg.downloadOstreeRevReq();
+    EXPECT_TRUE(req->async != nullptr && *req->async != 0);
+    tls_creds_ = ToString(req->tlsCred);
+    ostree_fetched_objects_ = 0;
+    setOstreeStatus(out_msg);
+
+    return ReturnCode::kOk;
+  }
+
+  MsgHandler::ReturnCode downloadOstreeStatusHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    (void)in_msg;
+    ++ostree_status_requests_;
+    ++ostree_fetched_objects_;
+    setOstreeStatus(out_msg);
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode downloadOstreeRevFailure(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -373,6 +564,8 @@ class SecondaryMock : public MsgDispatcher {
     } else if (pr->repotype == AKRepoType_image) {
       meta_bundle_.emplace(std::make_pair(Uptane::RepositoryType::Image(), Uptane::Role::Root()), ToString(pr->json));
     }
+    ++root_requests_;
+    received_roots_.push_back(ToString(pr->json));
 
     auto m = out_msg.present(AKIpUptaneMes_PR_putRootResp).putRootResp();
     m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
@@ -381,6 +574,21 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  MsgHandler::ReturnCode putRootChainHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
+    auto pr = in_msg.putRootChainReq();
+    ++root_requests_;
+    for (int i = 0; i < pr->roots.list.count; ++i) {
+      received_roots_.push_back(ToString(*pr->roots.list.array[i]));
+    }
+
+    auto m = out_msg.present(AKIpUptaneMes_PR_putRootChainResp).putRootChainResp();
+    m->result = static_cast<AKInstallationResultCode_t>(data::ResultCode::Numeric::kOk);
+    SetString(&m->description, "");
+    m->stored = pr->roots.list.count;
+
+    return ReturnCode::kOk;
+  }
+
   MsgHandler::ReturnCode putRootFailureHdlr(Asn1Message& in_msg, Asn1Message& out_msg) {
     (void)in_msg;
 
@@ -391,6 +599,12 @@ class SecondaryMock : public MsgDispatcher {
     return ReturnCode::kOk;
   }
 
+  uint64_t receivedImageOffset() const {
+    boost::system::error_code ec;
+    const auto size = boost::filesystem::file_size(image_filepath_, ec);
+    return ec ? 0 : size;
+  }
+
   data::InstallationResult putMetadata2(const Uptane::MetaBundle& meta_bundle) {
     meta_bundle_ = meta_bundle;
     return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -436,6 +650,19 @@ class SecondaryMock : public MsgDispatcher {
   std::string received_firmware_data_;
   VerificationType vtype_;
   HandlerVersion handler_version_;
+  std::atomic<int> raw_chunks_{0};
+  std::atomic<int> chunks_{0};
+  std::unique_ptr<InflateStream> inflater_;
+  std::atomic<int> compressed_chunks_{0};
+  std::atomic<int> root_requests_{0};
+  std::vector<std::string> received_roots_;
+  std::atomic<long> ostree_fetched_objects_{0};
+  std::atomic<int> ostree_status_requests_{0};
+  std::atomic<int> upload_params_requests_{0};
+  std::atomic<long> last_upload_offset_{0};
+  std::atomic<int> discards_{0};
+  std::atomic<int> drop_after_chunks_{-1};
+  std::atomic<bool> report_received_hash_{false};
 };
 
 class TargetFile {
@@ -508,19 +735,22 @@ class SecondaryRpcCommon : public ::testing::Test {
   const std::string image_targets_ = "image-targets";
 
  protected:
-  SecondaryRpcCommon(size_t image_size, HandlerVersion handler_version, VerificationType vtype)
+  // Listens on unix_socket if it is not empty
+  SecondaryRpcCommon(size_t image_size, HandlerVersion handler_version, VerificationType vtype,
+                     const boost::filesystem::path& unix_socket = "")
       : secondary_{Uptane::EcuSerial("serial"),
                    Uptane::HardwareIdentifier("hardware-id"),
                    PublicKey("pub-key", KeyType::kED25519),
                    Uptane::Manifest(),
                    vtype,
                    handler_version},
-        secondary_server_{secondary_, "", 0},
+        secondary_server_{secondary_, "", 0, 0, false, unix_socket},
         secondary_server_thread_{std::bind(&SecondaryRpcCommon::runSecondaryServer, this)},
         image_file_{"mytarget_image.img", image_size},
         vtype_{vtype} {
     secondary_server_.wait_until_running();
-    ip_secondary_ = Uptane::IpUptaneSecondary::connectAndCreate("localhost", secondary_server_.port(), vtype);
+    ip_secondary_ = Uptane::IpUptaneSecondary::connectAndCreate(
+        unix_socket.empty() ? "localhost" : kUnixSocketPrefix + unix_socket.string(), secondary_server_.port(), vtype);
 
     config_.pacman.ostree_server = server_;
     config_.pacman.type = PACKAGE_MANAGER_NONE;
@@ -600,6 +830,12 @@ class SecondaryRpcCommon : public ::testing::Test {
       EXPECT_TRUE(result.isSuccess());
       EXPECT_EQ(image_file_.hash(), secondary_.getReceivedImageHash());
     }
+    if (compressed_uploads_) {
+      EXPECT_GT(secondary_.compressedChunks(), 0);
+      EXPECT_EQ(secondary_.rawChunks(), 0);
+    } else if (handler_version == HandlerVersion::kV4 || handler_version == HandlerVersion::kV5) {
+      EXPECT_GT(secondary_.rawChunks(), 0);
+    }
   }
 
   void installOstreeRev() {
@@ -704,6 +940,8 @@ class SecondaryRpcCommon : public ::testing::Test {
   std::shared_ptr<PackageManagerInterface> package_manager_;
   std::string latest_director_root_{director_root_};
   std::string latest_image_root_{image_root_};
+  // Whether the uploads are expected to be compressed
+  bool compressed_uploads_{false};
 };
 
 class SecondaryRpcTest : public SecondaryRpcCommon,
@@ -747,7 +985,57 @@ INSTANTIATE_TEST_SUITE_P(SecondaryRpcTestCases, SecondaryRpcTest,
                                            std::make_tuple(1024 - 1, HandlerVersion::kV1, VerificationType::kFull),
                                            std::make_tuple(1024 + 1, HandlerVersion::kV1, VerificationType::kFull),
                                            std::make_tuple(1024 * 10 + 1, HandlerVersion::kV1, VerificationType::kFull),
-                                           std::make_tuple(1024, HandlerVersion::kV2Failure, VerificationType::kFull)));
+                                           std::make_tuple(1024, HandlerVersion::kV2Failure, VerificationType::kFull),
+                                           std::make_tuple(1, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(4096, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(4096 * 10 + 1, HandlerVersion::kV3, VerificationType::kTuf),
+                                           std::make_tuple(40961, HandlerVersion::kV3, VerificationType::kFull),
+                                           std::make_tuple(1, HandlerVersion::kV4, VerificationType::kFull),
+                                           std::make_tuple(4096 * 10 + 1, HandlerVersion::kV4, VerificationType::kTuf),
+                                           std::make_tuple(40961, HandlerVersion::kV4, VerificationType::kFull),
+                                           std::make_tuple(40961, HandlerVersion::kV5, VerificationType::kFull)));
+
+class SecondaryRpcRootChain : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcRootChain() : SecondaryRpcCommon(1024, GetParam(), VerificationType::kFull) {}
+};
+
+/* The Roots missing on a Secondary are all sent in one request from v5, and
+ * one after the other before. */
+TEST_P(SecondaryRpcRootChain, PutRootChain) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  const std::vector<std::string> roots{"image-root-v2", "image-root-v3", "image-root-v4"};
+  size_t stored = 0;
+  EXPECT_TRUE(ip_secondary_->putRootChain(roots, false, &stored).isSuccess());
+  EXPECT_EQ(stored, roots.size());
+  EXPECT_EQ(secondary_.receivedRoots(), roots);
+  EXPECT_EQ(secondary_.rootRequests(), GetParam() == HandlerVersion::kV5 ? 1 : 3);
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcRootChainCases, SecondaryRpcRootChain,
+                         ::testing::Values(HandlerVersion::kV4, HandlerVersion::kV5));
+
+class SecondaryRpcOstreeAsync : public SecondaryRpcCommon {
+ protected:
+  SecondaryRpcOstreeAsync() : SecondaryRpcCommon(1024, HandlerVersion::kV6, VerificationType::kFull) {}
+};
+
+/* From v6, the Secondary pulls the OSTree commit in the background, and the
+ * Primary polls it until it is done, passing on its progress. */
+TEST_F(SecondaryRpcOstreeAsync, DownloadWithProgress) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  std::vector<unsigned int> progress;
+  ip_secondary_->setProgressCallback(
+      [&progress](const Uptane::Target& target, const std::string& description, unsigned int percent) {
+        (void)target;
+        (void)description;
+        progress.push_back(percent);
+      });
+
+  installOstreeRev();
+  EXPECT_EQ(secondary_.ostreeStatusRequests(), SecondaryMock::kV6OstreeObjects);
+  EXPECT_EQ(progress, std::vector<unsigned int>({25, 50, 75}));
+}
 
 class SecondaryRpcUpgrade : public SecondaryRpcCommon {
  protected:
@@ -775,6 +1063,156 @@ TEST_F(SecondaryRpcUpgrade, VersionUpgrade) {
   installOstreeRev();
 }
 
+class SecondaryRpcWindowed : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcWindowed() : SecondaryRpcCommon(4096 * 10 + 1, GetParam(), VerificationType::kFull) {}
+};
+
+/* The Primary asks for large chunks, but keeps to the smaller chunk size the
+ * Secondary answers with, and each chunk is accepted in turn. */
+TEST_P(SecondaryRpcWindowed, NegotiatedChunkSize) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(secondary_.uploadParamsRequests(), 1);
+  EXPECT_EQ(secondary_.chunks(), 11);
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcWindowedCases, SecondaryRpcWindowed,
+                         ::testing::Values(HandlerVersion::kV3, HandlerVersion::kV4));
+
+class SecondaryRpcCompression : public SecondaryRpcCommon,
+                                public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcCompression() : SecondaryRpcCommon(4096 * 10 + 1, GetParam(), VerificationType::kFull) {}
+};
+
+/* The image uploaded compressed, instead of the raw data of v4, arrives
+ * decompressed and whole. */
+TEST_P(SecondaryRpcCompression, CompressedUpload) {
+  auto ip_secondary = std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(ip_secondary_);
+  ASSERT_TRUE(ip_secondary != nullptr) << "Failed to create IP Secondary";
+  ip_secondary->setUploadCompression(true);
+  compressed_uploads_ = true;
+
+  sendAndInstallBinaryImage();
+}
+
+/* A compressed upload that is cut off goes on with a fresh compression
+ * stream from where the Secondary has got to. */
+TEST_P(SecondaryRpcCompression, DroppedConnection) {
+  auto ip_secondary = std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(ip_secondary_);
+  ASSERT_TRUE(ip_secondary != nullptr) << "Failed to create IP Secondary";
+  ip_secondary->setUploadCompression(true);
+  compressed_uploads_ = true;
+  const int chunks_before_drop = 3;
+  secondary_.dropConnectionAfter(chunks_before_drop);
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(secondary_.uploadParamsRequests(), 2);
+  EXPECT_EQ(secondary_.lastUploadOffset(), chunks_before_drop * SecondaryMock::kV3ChunkSize);
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcCompressionCases, SecondaryRpcCompression,
+                         ::testing::Values(HandlerVersion::kV3, HandlerVersion::kV4));
+
+class SecondaryRpcResume : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcResume() : SecondaryRpcCommon(4096 * 10 + 1, GetParam(), VerificationType::kFull) {}
+};
+
+/* When the connection drops in the middle of an upload, the Primary connects
+ * again and goes on from where the Secondary has got to, rather than sending
+ * the whole image again. */
+TEST_P(SecondaryRpcResume, DroppedConnection) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  const int chunks_before_drop = 4;
+  secondary_.dropConnectionAfter(chunks_before_drop);
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(secondary_.uploadParamsRequests(), 2);
+  EXPECT_EQ(secondary_.lastUploadOffset(), chunks_before_drop * SecondaryMock::kV3ChunkSize);
+  EXPECT_EQ(secondary_.getReceivedImageSize(), image_file_.size());
+}
+
+/* Data received before that isn't the beginning of the image is dropped, and
+ * the whole image is sent again. */
+TEST_P(SecondaryRpcResume, ForeignData) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  secondary_.reportReceivedHash();
+  secondary_.leaveImageData("data of another image");
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(secondary_.discards(), 1);
+  EXPECT_EQ(secondary_.uploadParamsRequests(), 2);
+  EXPECT_EQ(secondary_.lastUploadOffset(), 0);
+  EXPECT_EQ(secondary_.getReceivedImageSize(), image_file_.size());
+}
+
+/* Data received before that is the beginning of the image is kept. */
+TEST_P(SecondaryRpcResume, MatchingData) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  secondary_.reportReceivedHash();
+  const std::string received = Utils::readFile(image_file_.path()).substr(0, 5000);
+  secondary_.leaveImageData(received);
+
+  sendAndInstallBinaryImage();
+  EXPECT_EQ(secondary_.discards(), 0);
+  EXPECT_EQ(secondary_.uploadParamsRequests(), 1);
+  EXPECT_EQ(secondary_.lastUploadOffset(), received.size());
+  EXPECT_EQ(secondary_.getReceivedImageSize(), image_file_.size());
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcResumeCases, SecondaryRpcResume,
+                         ::testing::Values(HandlerVersion::kV3, HandlerVersion::kV4));
+
+class SecondaryRpcStream : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcStream() : SecondaryRpcCommon(4096 * 10 + 1, GetParam(), VerificationType::kFull) {}
+};
+
+/* An image streamed in pieces, as when it is sent to several Secondaries from
+ * one read, is complete and only has to be installed. */
+TEST_P(SecondaryRpcStream, StreamedUpload) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  Uptane::Target target = image_file_.createTarget(package_manager_);
+  auto stream = ip_secondary_->streamFirmware(target);
+  ASSERT_TRUE(stream);
+  const std::string content = Utils::readFile(image_file_.path());
+  for (size_t sent = 0; sent < content.size(); sent += 10000) {
+    ASSERT_TRUE(stream(reinterpret_cast<const uint8_t*>(content.data()) + sent,
+                       std::min<size_t>(10000, content.size() - sent)));
+  }
+  EXPECT_TRUE(ip_secondary_->sendFirmware(target, nullptr).isSuccess());
+  EXPECT_TRUE(ip_secondary_->install(target, nullptr).isSuccess());
+  EXPECT_EQ(image_file_.hash(), secondary_.getReceivedImageHash());
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcStreamCases, SecondaryRpcStream,
+                         ::testing::Values(HandlerVersion::kV2, HandlerVersion::kV3));
+
+class SecondaryRpcUnixSocket : public SecondaryRpcCommon, public ::testing::WithParamInterface<HandlerVersion> {
+ protected:
+  SecondaryRpcUnixSocket()
+      : SecondaryRpcCommon(4096 * 10 + 1, GetParam(), VerificationType::kFull,
+                           boost::filesystem::temp_directory_path() /
+                               boost::filesystem::unique_path("aktualizr-secondary-%%%%-%%%%.sock")) {}
+};
+
+/* A Secondary on the same host can be reached on a Unix domain socket, also
+ * with the raw image data of v4 sent with sendfile(). */
+TEST_P(SecondaryRpcUnixSocket, AllRpcCalls) {
+  ASSERT_TRUE(ip_secondary_ != nullptr) << "Failed to create IP Secondary";
+  EXPECT_EQ(ip_secondary_->getSerial(), secondary_.serial());
+  EXPECT_EQ(ip_secondary_->getManifest(), secondary_.manifest());
+
+  sendAndInstallBinaryImage();
+  installOstreeRev();
+}
+
+INSTANTIATE_TEST_SUITE_P(SecondaryRpcUnixSocketCases, SecondaryRpcUnixSocket,
+                         ::testing::Values(HandlerVersion::kV2, HandlerVersion::kV4));
+
 TEST(SecondaryTcpServer, TestIpSecondaryIfSecondaryIsNotRunning) {
   in_port_t secondary_port = TestUtils::getFreePortAsInt();
   SecondaryInterface::Ptr ip_secondary;
@@ -832,7 +1270,11 @@ class SecondaryRpcTestPositive : public ::testing::Test, public MsgHandler {
 
   // Override default implementation with a stub that always returns success.
   ReturnCode handleMsg(const Asn1Message::Ptr& in_msg, Asn1Message::Ptr& out_msg) override {
-    (void)in_msg;
+    if (in_msg->present() == AKIpUptaneMes_PR_getInfoReq) {
+      // An empty response is enough for IpUptaneSecondary::ping()
+      out_msg->present(AKIpUptaneMes_PR_getInfoResp);
+      return ReturnCode::kOk;
+    }
     out_msg->present(AKIpUptaneMes_PR_installResp).installResp()->result = AKInstallationResultCode_ok;
     return ReturnCode::kOk;
   }
@@ -857,16 +1299,105 @@ class SecondaryRpcTestPositive : public ::testing::Test, public MsgHandler {
   std::thread secondary_server_thread_;
 };
 
-/* This test fails because the Secondary TCP server implementation is a
- * single-threaded, synchronous and blocking hence it cannot accept any new
- * connections until the current one is closed. Therefore, if a client/Primary
- * does not close its socket for some reason then Secondary becomes
- * "unavailable" */
-// TEST_F(SecondaryRpcTestPositive, primaryNotClosingSocket) {
-//  ConnectionSocket con_sock{"127.0.0.1", secondary_server_.port()};
-//  con_sock.connect();
-//  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
-//}
+/* The Secondary TCP server serves several connections at the same time, so a
+ * client/Primary that keeps its socket open doesn't make the Secondary
+ * "unavailable". */
+TEST_F(SecondaryRpcTestPositive, primaryNotClosingSocket) {
+  ConnectionSocket con_sock{"127.0.0.1", secondary_server_.port()};
+  con_sock.connect();
+  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
+}
+
+/* The IP Secondary keeps its connection open across the requests, while
+ * other connections are served. */
+TEST_F(SecondaryRpcTestPositive, PersistentConnection) {
+  Uptane::IpUptaneSecondary ip_secondary("127.0.0.1", secondary_server_.port(), VerificationType::kFull,
+                                         Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("hwid"),
+                                         PublicKey("key", KeyType::kED25519));
+  EXPECT_TRUE(ip_secondary.ping());
+  EXPECT_TRUE(ip_secondary.ping());
+  ASSERT_EQ(sendInstallMsg(), AKIpUptaneMes_PR_installResp);
+  EXPECT_TRUE(ip_secondary.ping());
+}
+
+// The socket of this process connected to the port on the loopback.
+static int socketTo(uint16_t port) {
+  for (boost::filesystem::directory_iterator it("/proc/self/fd"), end; it != end; ++it) {
+    const int fd = std::stoi(it->path().filename().string());
+    sockaddr_in peer{};
+    socklen_t len = sizeof(peer);
+    if (getpeername(fd, reinterpret_cast<sockaddr*>(&peer), &len) == 0 && peer.sin_family == AF_INET &&
+        ntohs(peer.sin_port) == port) {
+      return fd;
+    }
+  }
+  return -1;
+}
+
+static int intOption(int fd, int level, int option) {
+  int value = -1;
+  socklen_t len = sizeof(value);
+  EXPECT_EQ(getsockopt(fd, level, option, &value, &len), 0);
+  return value;
+}
+
+/* The connection to an IP Secondary gets the keepalive and the timeouts of
+ * its link options, on by default. */
+TEST_F(SecondaryRpcTestPositive, LinkOptions) {
+  {
+    Uptane::IpUptaneSecondary ip_secondary("127.0.0.1", secondary_server_.port(), VerificationType::kFull,
+                                           Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("hwid"),
+                                           PublicKey("key", KeyType::kED25519));
+    ASSERT_TRUE(ip_secondary.ping());
+    const int fd = socketTo(secondary_server_.port());
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(intOption(fd, SOL_SOCKET, SO_KEEPALIVE), 1);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPIDLE), 10);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPINTVL), 5);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPCNT), 3);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_USER_TIMEOUT), 30000);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_NODELAY), 1);
+  }
+  {
+    Uptane::IpUptaneSecondary ip_secondary("127.0.0.1", secondary_server_.port(), VerificationType::kFull,
+                                           Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("hwid"),
+                                           PublicKey("key", KeyType::kED25519));
+    Uptane::SecondaryLinkOptions options;
+    options.io_timeout = std::chrono::milliseconds(2500);
+    options.keepalive_idle = std::chrono::seconds(20);
+    options.keepalive_interval = std::chrono::seconds(7);
+    options.keepalive_count = 4;
+    options.user_timeout = std::chrono::milliseconds(1234);
+    ip_secondary.setLinkOptions(options);
+    ASSERT_TRUE(ip_secondary.ping());
+    const int fd = socketTo(secondary_server_.port());
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(intOption(fd, SOL_SOCKET, SO_KEEPALIVE), 1);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPIDLE), 20);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPINTVL), 7);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_KEEPCNT), 4);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_USER_TIMEOUT), 1234);
+    timeval tv{};
+    socklen_t len = sizeof(tv);
+    ASSERT_EQ(getsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, &len), 0);
+    EXPECT_EQ(tv.tv_sec, 2);
+    EXPECT_EQ(tv.tv_usec, 500000);
+  }
+  {
+    Uptane::IpUptaneSecondary ip_secondary("127.0.0.1", secondary_server_.port(), VerificationType::kFull,
+                                           Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("hwid"),
+                                           PublicKey("key", KeyType::kED25519));
+    Uptane::SecondaryLinkOptions options;
+    options.keepalive_idle = std::chrono::seconds(0);
+    options.user_timeout = std::chrono::milliseconds(0);
+    ip_secondary.setLinkOptions(options);
+    ASSERT_TRUE(ip_secondary.ping());
+    const int fd = socketTo(secondary_server_.port());
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(intOption(fd, SOL_SOCKET, SO_KEEPALIVE), 0);
+    EXPECT_EQ(intOption(fd, IPPROTO_TCP, TCP_USER_TIMEOUT), 0);
+  }
+}
 
 TEST_F(SecondaryRpcTestPositive, primaryConnectAndDisconnect) {
   ConnectionSocket{"127.0.0.1", secondary_server_.port()}.connect();
@@ -1,6 +1,15 @@
 #include "secondary_tcp_server.h"
 
 #include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <list>
+#include <memory>
+#include <vector>
 
 #include "AKInstallationResultCode.h"
 #include "AKIpUptaneMes.h"
@@ -10,17 +19,23 @@
 #include "utilities/dequeue_buffer.h"
 
 SecondaryTcpServer::SecondaryTcpServer(MsgHandler &msg_handler, const std::string &primary_ip, in_port_t primary_port,
-                                       in_port_t port, bool reboot_after_install)
+                                       in_port_t port, bool reboot_after_install,
+                                       const boost::filesystem::path &unix_socket)
     : msg_handler_(msg_handler),
-      listen_socket_(port),
+      listen_socket_(unix_socket.empty() ? std_::make_unique<ListenSocket>(port)
+                                         : std_::make_unique<ListenSocket>(unix_socket)),
       keep_running_(true),
       reboot_after_install_(reboot_after_install),
+      wake_fd_(eventfd(0, EFD_CLOEXEC)),
       is_running_(false) {
+  if (wake_fd_ < 0) {
+    throw std::system_error(errno, std::system_category(), "eventfd");
+  }
   if (primary_ip.empty()) {
     return;
   }
 
-  ConnectionSocket conn_socket(primary_ip, primary_port, listen_socket_.port());
+  ConnectionSocket conn_socket(primary_ip, primary_port, listen_socket_->port());
   if (conn_socket.connect() == 0) {
     LOG_INFO << "Connected to Primary, sending info about this Secondary.";
     HandleOneConnection(*conn_socket);
@@ -29,11 +44,42 @@ SecondaryTcpServer::SecondaryTcpServer(MsgHandler &msg_handler, const std::strin
   }
 }
 
+SecondaryTcpServer::~SecondaryTcpServer() { ::close(wake_fd_); }
+
+// Connections beyond this close the oldest one, which is likely left over by
+// a previous instance of the Primary.
+static constexpr size_t kMaxConnections = 4;
+
+// Detect the connections of Primaries that went away without closing them.
+static void setKeepAlive(int socket) {
+  int enable = 1;
+  int idle_s = 60;
+  int interval_s = 10;
+  int count = 3;
+  setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
+  setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle_s, sizeof(int));
+  setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval_s, sizeof(int));
+  setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(int));
+}
+
 void SecondaryTcpServer::run() {
-  if (listen(*listen_socket_, SOMAXCONN) < 0) {
+  if (listen(**listen_socket_, SOMAXCONN) < 0) {
     throw std::system_error(errno, std::system_category(), "listen");
   }
-  LOG_INFO << "Secondary TCP server listening on " << listen_socket_.ToString();
+  LOG_INFO << "Secondary TCP server listening on " << listen_socket_->ToString();
+
+  Socket epoll_fd(epoll_create1(EPOLL_CLOEXEC));
+  if (*epoll_fd < 0) {
+    throw std::system_error(errno, std::system_category(), "epoll_create1");
+  }
+  for (int fd : {**listen_socket_, wake_fd_}) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(*epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+      throw std::system_error(errno, std::system_category(), "epoll_ctl");
+    }
+  }
 
   {
     std::unique_lock<std::mutex> lock(running_condition_mutex_);
@@ -41,37 +87,95 @@ void SecondaryTcpServer::run() {
     running_condition_.notify_all();
   }
 
+  // Each connection is served on a thread of its own, as the requests can
+  // block for long, e.g. while installing, and their responses go in order.
+  std::list<std::unique_ptr<Connection>> connections;
   bool first_connection = true;
 
   while (keep_running_.load()) {
-    sockaddr_storage peer_sa{};
-    socklen_t peer_sa_size = sizeof(sockaddr_storage);
-
-    LOG_DEBUG << "Waiting for connection from Primary...";
-    int con_fd = accept(*listen_socket_, reinterpret_cast<sockaddr *>(&peer_sa), &peer_sa_size);
-    if (con_fd == -1) {
-      // Accept can fail if a client closes connection/client socket before a TCP handshake completes or
-      // a network connection goes down in the middle of a TCP handshake procedure. At first glance it looks like
-      // we can just continue listening/accepting new connections in such cases instead of exiting from the server loop
-      // which leads to exiting of the overall daemon process.
-      // But, accept() failure, potentially can be caused by some incorrect state of the listening socket
-      // which means that it will keep returning error, so, exiting from the daemon process and letting
-      // systemd to restart it looks like the most reliable solution that covers all edge cases.
-      LOG_INFO << "Socket accept failed, aborting.";
+    LOG_TRACE << "Waiting for connection from Primary...";
+    std::array<epoll_event, 2> events{};
+    const int count = epoll_wait(*epoll_fd, events.data(), static_cast<int>(events.size()), -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR << "Failed to wait for connections: " << strerror(errno);
       break;
     }
 
-    if (first_connection) {
-      LOG_INFO << "Primary connected.";
-      first_connection = false;
-    } else {
-      LOG_DEBUG << "Primary reconnected.";
+    for (int i = 0; i < count; ++i) {
+      if (events.at(static_cast<size_t>(i)).data.fd == wake_fd_) {
+        uint64_t value;
+        if (read(wake_fd_, &value, sizeof(value)) < 0) {
+          LOG_DEBUG << "Failed to read the wake-up event: " << strerror(errno);
+        }
+      }
     }
-    auto continue_running = HandleOneConnection(*Socket(con_fd));
-    if (!continue_running) {
-      keep_running_.store(false);
+    connections.remove_if([](const std::unique_ptr<Connection> &connection) {
+      if (!connection->done) {
+        return false;
+      }
+      connection->thread.join();
+      LOG_DEBUG << "Primary disconnected.";
+      return true;
+    });
+    if (!keep_running_.load()) {
+      break;
     }
-    LOG_DEBUG << "Primary disconnected.";
+
+    for (int i = 0; i < count; ++i) {
+      if (events.at(static_cast<size_t>(i)).data.fd != **listen_socket_) {
+        continue;
+      }
+      sockaddr_storage peer_sa{};
+      socklen_t peer_sa_size = sizeof(sockaddr_storage);
+      int con_fd = accept(**listen_socket_, reinterpret_cast<sockaddr *>(&peer_sa), &peer_sa_size);
+      if (con_fd == -1) {
+        // Accept can fail if a client closes connection/client socket before a TCP handshake completes or
+        // a network connection goes down in the middle of a TCP handshake procedure. At first glance it looks like
+        // we can just continue listening/accepting new connections in such cases instead of exiting from the server
+        // loop which leads to exiting of the overall daemon process.
+        // But, accept() failure, potentially can be caused by some incorrect state of the listening socket
+        // which means that it will keep returning error, so, exiting from the daemon process and letting
+        // systemd to restart it looks like the most reliable solution that covers all edge cases.
+        LOG_INFO << "Socket accept failed, aborting.";
+        keep_running_.store(false);
+        break;
+      }
+
+      if (first_connection) {
+        LOG_INFO << "Primary connected.";
+        first_connection = false;
+      } else {
+        LOG_DEBUG << "Primary reconnected.";
+      }
+      if (peer_sa.ss_family != AF_UNIX) {
+        setKeepAlive(con_fd);
+      }
+      if (connections.size() >= kMaxConnections) {
+        LOG_INFO << "Too many connections from Primary, closing the oldest one";
+        // Its thread ends and is joined like the others.
+        shutdown(*connections.front()->socket, SHUT_RDWR);
+      }
+      auto connection = std_::make_unique<Connection>(con_fd);
+      Connection *c = connection.get();
+      connection->thread = std::thread([this, c]() {
+        if (!HandleOneConnection(*c->socket)) {
+          keep_running_.store(false);
+        }
+        c->done = true;
+        wake();
+      });
+      connections.push_back(std::move(connection));
+    }
+  }
+
+  for (auto &connection : connections) {
+    shutdown(*connection->socket, SHUT_RDWR);
+  }
+  for (auto &connection : connections) {
+    connection->thread.join();
   }
 
   {
@@ -86,43 +190,97 @@ void SecondaryTcpServer::run() {
 void SecondaryTcpServer::stop() {
   LOG_DEBUG << "Stopping Secondary TCP server...";
   keep_running_.store(false);
-  // unblock accept
-  ConnectionSocket("localhost", listen_socket_.port()).connect();
+  wake();
+}
+
+void SecondaryTcpServer::wake() const {
+  const uint64_t value = 1;
+  if (write(wake_fd_, &value, sizeof(value)) < 0) {
+    LOG_ERROR << "Failed to wake the Secondary TCP server up: " << strerror(errno);
+  }
 }
 
-in_port_t SecondaryTcpServer::port() const { return listen_socket_.port(); }
+in_port_t SecondaryTcpServer::port() const { return listen_socket_->port(); }
 SecondaryTcpServer::ExitReason SecondaryTcpServer::exit_reason() const { return exit_reason_; }
 
-static bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg);
+static bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg, std::string *encoded);
+
+// Largest raw data accepted after a request
+static constexpr long kMaxRawDataSize = 16L * 1024 * 1024;
+
+// The raw data following a request: in place if it has all been received
+// along with the request already, or else read straight from the connection
+// into data rather than out of a decoded OCTET STRING.
+// Sets *in_place to the number of bytes to consume from buffer after use.
+static const uint8_t *receiveRawData(int socket, DequeueBuffer *buffer, long length, std::vector<uint8_t> *data,
+                                     size_t *in_place) {
+  *in_place = 0;
+  if (length < 0 || length > kMaxRawDataSize) {
+    LOG_ERROR << "Invalid size of the raw data from Primary: " << length;
+    return nullptr;
+  }
+  const auto size = static_cast<size_t>(length);
+  if (buffer->Size() >= size) {
+    *in_place = size;
+    return reinterpret_cast<const uint8_t *>(buffer->Head());
+  }
+  data->resize(size);
+  const size_t buffered = buffer->Size();
+  std::copy_n(buffer->Head(), buffered, data->begin());
+  buffer->Consume(buffered);
+  size_t received = buffered;
+  while (received < data->size()) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const ssize_t res = recv(socket, data->data() + received, data->size() - received, MSG_WAITALL);
+    if (res <= 0) {
+      LOG_ERROR << "Failed to read the raw data from Primary: " << (res < 0 ? strerror(errno) : "connection closed");
+      return nullptr;
+    }
+    received += static_cast<size_t>(res);
+  }
+  return data->data();
+}
 
 bool SecondaryTcpServer::HandleOneConnection(int socket) {
-  // Outside the message loop, because one recv() may have parts of 2 messages
-  // Note that one recv() call returning 2+ messages doesn't work at the
-  // moment. This shouldn't be a problem until we have messages that aren't
-  // strictly request/response
+  // Outside the message loop, because one recv() may have parts of 2 messages,
+  // or several whole ones when the Primary sends them without waiting for the
+  // responses, as in the windowed uploads.
   DequeueBuffer buffer;
+  // Reused for the raw data of the requests, and for encoding the responses
+  std::vector<uint8_t> raw_data;
+  std::string encoded;
   bool keep_running_server = true;
   bool keep_running_current_session = true;
+  // The responses are written in one go
+  int no_delay = 1;
+  setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
 
   while (keep_running_current_session) {  // Keep reading until we get an error
     // Read an incoming message
-    AKIpUptaneMes_t *m = nullptr;
+    Asn1Message::Ptr request_msg = Asn1Message::Empty();
     asn_dec_rval_t res{};
     asn_codec_ctx_s context{};
-    ssize_t received;
+    ssize_t received = 1;
 
-    do {
-      received = recv(socket, buffer.Tail(), buffer.TailSpace(), 0);
+    res.code = RC_WMORE;
+    if (buffer.Size() > 0) {
+      res = Asn1Decode(request_msg.get(), &context, &buffer);
+    }
+    while (res.code == RC_WMORE && received > 0) {
+      const size_t space = buffer.TailSpace();
+      if (space == 0) {
+        LOG_ERROR << "Message from Primary is larger than " << buffer.MaxSize() << " bytes";
+        res.code = RC_FAIL;
+        break;
+      }
+      received = recv(socket, buffer.Tail(), space, 0);
       if (received < 0) {
         LOG_ERROR << "Failed to read data from a server socket: " << strerror(errno);
         break;
       }
       buffer.HaveEnqueued(static_cast<size_t>(received));
-      res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void **>(&m), buffer.Head(), buffer.Size());
-      buffer.Consume(res.consumed);
-    } while (res.code == RC_WMORE && received > 0);
-    // Note that ber_decode allocates *m even on failure, so this must always be done
-    Asn1Message::Ptr request_msg = Asn1Message::FromRaw(&m);
+      res = Asn1Decode(request_msg.get(), &context, &buffer);
+    }
 
     if (received == 0) {
       LOG_TRACE << "Primary has closed a connection socket";
@@ -141,19 +299,31 @@ bool SecondaryTcpServer::HandleOneConnection(int socket) {
 
     LOG_DEBUG << "Received a request from Primary: " << request_msg->toStr();
     Asn1Message::Ptr response_msg = Asn1Message::Empty();
-    MsgHandler::ReturnCode handle_status_code = msg_handler_.handleMsg(request_msg, response_msg);
+    MsgHandler::ReturnCode handle_status_code;
+    if (request_msg->present() == AKIpUptaneMes_PR_uploadRawReq) {
+      const long length = request_msg->uploadRawReq()->length;
+      size_t in_place = 0;
+      const uint8_t *data = receiveRawData(socket, &buffer, length, &raw_data, &in_place);
+      if (data == nullptr) {
+        break;
+      }
+      handle_status_code = msg_handler_.handleRawMsg(request_msg, data, static_cast<size_t>(length), response_msg);
+      buffer.Consume(in_place);
+    } else {
+      handle_status_code = msg_handler_.handleMsg(request_msg, response_msg);
+    }
 
     switch (handle_status_code) {
       case MsgHandler::ReturnCode::kRebootRequired: {
         exit_reason_ = ExitReason::kRebootNeeded;
-        keep_running_current_session = sendResponseMessage(socket, response_msg);
+        keep_running_current_session = sendResponseMessage(socket, response_msg, &encoded);
         if (reboot_after_install_) {
           keep_running_server = keep_running_current_session = false;
         }
         break;
       }
       case MsgHandler::ReturnCode::kOk: {
-        keep_running_current_session = sendResponseMessage(socket, response_msg);
+        keep_running_current_session = sendResponseMessage(socket, response_msg, &encoded);
         break;
       }
       case MsgHandler::ReturnCode::kUnkownMsg:
@@ -177,19 +347,13 @@ void SecondaryTcpServer::wait_until_running(int timeout) {
   running_condition_.wait_for(lock, std::chrono::seconds(timeout), [&] { return is_running_; });
 }
 
-bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg) {
+bool sendResponseMessage(int socket_fd, const Asn1Message::Ptr &resp_msg, std::string *encoded) {
   LOG_DEBUG << "Encoding and sending response message";
 
-  int optval = 0;
-  setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
-  asn_enc_rval_t encode_result = der_encode(&asn_DEF_AKIpUptaneMes, &resp_msg->msg_, Asn1SocketWriteCallback,
-                                            reinterpret_cast<void *>(&socket_fd));
-  if (encode_result.encoded == -1) {
-    LOG_ERROR << "Failed to encode a response message";
+  if (!Asn1Send(resp_msg, socket_fd, encoded)) {
+    LOG_ERROR << "Failed to send a response message";
     return false;  // write error
   }
-  optval = 1;
-  setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int));
 
   return true;
 }
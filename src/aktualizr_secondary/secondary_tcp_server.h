@@ -3,7 +3,9 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <thread>
 
 #include "utilities/utils.h"
 
@@ -11,7 +13,7 @@ class MsgHandler;
 
 /**
  * Listens on a socket, decodes calls (ASN.1) and forwards them to an Uptane Secondary
- * implementation
+ * implementation. Several connections are served at the same time.
  */
 class SecondaryTcpServer {
  public:
@@ -21,9 +23,13 @@ class SecondaryTcpServer {
     kUnkown,
   };
 
+  /**
+   * Listens on port, or on the Unix domain socket at unix_socket if it is
+   * not empty.
+   */
   SecondaryTcpServer(MsgHandler& msg_handler, const std::string& primary_ip, in_port_t primary_port, in_port_t port = 0,
-                     bool reboot_after_install = false);
-  ~SecondaryTcpServer() = default;
+                     bool reboot_after_install = false, const boost::filesystem::path& unix_socket = "");
+  ~SecondaryTcpServer();
   SecondaryTcpServer(const SecondaryTcpServer&) = delete;
   SecondaryTcpServer(SecondaryTcpServer&&) = delete;
   SecondaryTcpServer& operator=(const SecondaryTcpServer&) = delete;
@@ -41,13 +47,23 @@ class SecondaryTcpServer {
   ExitReason exit_reason() const;
 
  private:
+  struct Connection {
+    explicit Connection(int fd) : socket(fd) {}
+    Socket socket;
+    std::thread thread;
+    std::atomic<bool> done{false};
+  };
+
   bool HandleOneConnection(int socket);
+  // Make run() check keep_running_ and the connections
+  void wake() const;
 
   MsgHandler& msg_handler_;
-  ListenSocket listen_socket_;
+  std::unique_ptr<ListenSocket> listen_socket_;
   std::atomic<bool> keep_running_;
   bool reboot_after_install_;
-  ExitReason exit_reason_{ExitReason::kNotApplicable};
+  std::atomic<ExitReason> exit_reason_{ExitReason::kNotApplicable};
+  const int wake_fd_;
 
   bool is_running_;
   std::mutex running_condition_mutex_;
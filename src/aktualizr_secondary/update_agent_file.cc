@@ -1,23 +1,25 @@
 #include "update_agent_file.h"
 
+#include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 
+#include <array>
 #include <fstream>
+#include <iterator>
 #include "crypto/crypto.h"
 #include "logging/logging.h"
-#include "uptane/manifest.h"
+#include "utilities/utils.h"
+
+// How much image data is received between two saves of the hash state
+static constexpr uint64_t kCheckpointInterval = 4UL * 1024 * 1024;
 
 // TODO(OTA-4939): Unify this with the check in
 // SotaUptaneClient::getNewTargets() and make it more generic.
 bool FileUpdateAgent::isTargetSupported(const Uptane::Target& target) const { return target.type() != "OSTREE"; }
 
 bool FileUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const {
-  if (boost::filesystem::exists(target_filepath_)) {
-    auto file_content = Utils::readFile(target_filepath_);
-
+  if (installed_image_hash_.get(target_filepath_, &installed_image_info.hash, &installed_image_info.len)) {
     installed_image_info.name = current_target_name_;
-    installed_image_info.len = file_content.size();
-    installed_image_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(file_content);
   } else {
     // mimic the Primary's fake package manager behavior
     auto unknown_target = Uptane::Target::Unknown();
@@ -30,6 +32,19 @@ bool FileUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& installe
 }
 
 data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target) {
+  // The only sync of the new image, before it replaces the current one
+  if (writer_ != nullptr) {
+    const bool synced = writer_->sync();
+    const std::string error = writer_->error();
+    writer_.reset();
+    if (!synced) {
+      LOG_ERROR << "Failed to store the new target image: " << error;
+      discardData();
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Failed to store the new target image: " + error);
+    }
+  }
+
   if (!boost::filesystem::exists(new_target_filepath_)) {
     LOG_ERROR << "The target image has not been received";
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
@@ -40,20 +55,28 @@ data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target)
   if (received_target_image_size != target.length()) {
     LOG_ERROR << "Received image size does not match the size specified in Target metadata: "
               << received_target_image_size << " != " << target.length();
-    boost::filesystem::remove(new_target_filepath_);
+    discardData();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "Received image size does not match the size specified in Target metadata: " +
                                         std::to_string(received_target_image_size) +
                                         " != " + std::to_string(target.length()));
   }
 
-  if (!target.MatchHash(new_target_hasher_->getHash())) {
-    LOG_ERROR << "The received image's hash does not match the hash specified in Target metadata: "
-              << new_target_hasher_->getHash() << " != " << getTargetHash(target).HashString();
+  if (resumeData(target) != received_target_image_size) {
+    LOG_ERROR << "The hash state of the received image has been lost";
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "The hash state of the received image has been lost");
+  }
+
+  const Hash received_hash = new_target_hasher_->getHash();
+  if (!target.MatchHash(received_hash)) {
+    LOG_ERROR << "The received image's hash does not match the hash specified in Target metadata: " << received_hash
+              << " != " << getTargetHash(target).HashString();
+    // Otherwise the next upload would go on after the broken data.
+    discardData();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The received image's hash does not match the hash specified in Target metadata: " +
-                                        new_target_hasher_->getHash().HashString() +
-                                        " != " + getTargetHash(target).HashString());
+                                        received_hash.HashString() + " != " + getTargetHash(target).HashString());
   }
 
   boost::filesystem::rename(new_target_filepath_, target_filepath_);
@@ -68,8 +91,13 @@ data::InstallationResult FileUpdateAgent::install(const Uptane::Target& target)
                                     "The target image has not been installed");
   }
 
+  // Verified as it was received, so it needn't be read to report it.
+  const Hash target_hash = getTargetHash(target);
+  if (target_hash.type() == Hash::Type::kSha256) {
+    installed_image_hash_.set(target_filepath_, target_hash.HashString(), received_target_image_size);
+  }
   current_target_name_ = target.filename();
-  new_target_hasher_.reset();
+  discardData();
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
 }
 
@@ -82,62 +110,166 @@ data::InstallationResult FileUpdateAgent::applyPendingInstall(const Uptane::Targ
 }
 
 data::InstallationResult FileUpdateAgent::receiveData(const Uptane::Target& target, const uint8_t* data, size_t size) {
-  std::ofstream target_file(new_target_filepath_.c_str(),
-                            std::ofstream::out | std::ofstream::binary | std::ofstream::app);
-
-  if (!target_file.good()) {
-    LOG_ERROR << "Failed to open a new target image file";
-    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "Failed to open a new target image file");
-  }
+  // Data left by an earlier upload, of another image or before a restart
+  const uint64_t current_new_image_size = resumeData(target);
 
-  auto current_new_image_size = target_file.tellp();
-  if (-1 == current_new_image_size) {
-    LOG_ERROR << "Failed to obtain a size of the new target image that is being uploaded";
-    target_file.close();
-    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "Failed to obtain a size of the new target image that is being uploaded");
-  }
-
-  if (static_cast<uint64_t>(current_new_image_size) >= target.length()) {
+  if (current_new_image_size >= target.length()) {
     LOG_ERROR << "The size of the received image data exceeds the expected Target image size: "
               << current_new_image_size << " != " << target.length();
-    target_file.close();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
                                     "The size of the received image data exceeds the expected Target image size: " +
                                         std::to_string(current_new_image_size) +
                                         " != " + std::to_string(target.length()));
   }
 
-  if (current_new_image_size == 0) {
-    new_target_hasher_ = MultiPartHasher::create(getTargetHash(target).type());
+  if (writer_ == nullptr) {
+    if (current_new_image_size == 0) {
+      // Only the state of the libsodium hashers can be saved for the checkpoints.
+      new_target_hasher_ = MultiPartHasher::create(getTargetHash(target).type(), MultiPartHasher::Backend::kSodium);
+      new_target_hash_ = getTargetHash(target).HashString();
+      new_target_hash_type_ = getTargetHash(target).type();
+      // Ties the new image file to its target from the start.
+      saveCheckpoint(0);
+    }
+    writer_ = std_::make_unique<ImageWriter>(
+        new_target_filepath_, current_new_image_size, direct_io_,
+        [this](const uint8_t* written, size_t written_size, uint64_t end) { dataWritten(written, written_size, end); },
+        io_queue_depth_);
   }
-
-  target_file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
-  auto written_data_size = target_file.tellp() - current_new_image_size;
-
-  if (written_data_size < 0 || static_cast<size_t>(written_data_size) != size) {
-    LOG_ERROR << "The size of data written is not equal to the received data size: " << written_data_size
-              << " != " << size;
-    target_file.close();
+  if (!writer_->write(data, size)) {
+    const std::string error = writer_->error();
+    LOG_ERROR << "Failed to store the new target image data: " << error;
+    // What was written and hashed is not known any more.
+    discardData();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
-                                    "The size of data written is not equal to the received data size: " +
-                                        std::to_string(written_data_size) + " != " + std::to_string(size));
+                                    "Failed to store the new target image data: " + error);
   }
 
-  target_file.close();
-
-  auto total_size = current_new_image_size + written_data_size;
+  const uint64_t total_size = writer_->offset();
   LOG_DEBUG << "Received and stored data of a new target image."
                " Received in this request (bytes): "
             << size << "; total received so far: " << total_size << "; expected total: " << target.length();
-  if (static_cast<uint64_t>(total_size) == target.length()) {
+  if (total_size == target.length()) {
     LOG_INFO << "Successfully received and stored new target image of " << total_size << " bytes.";
   }
 
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+void FileUpdateAgent::dataWritten(const uint8_t* data, size_t size, uint64_t end) {
+  // Hashed once written, so that the checkpoints never get ahead of the file.
   new_target_hasher_->update(data, size);
+  if (end - checkpoint_size_ >= kCheckpointInterval) {
+    saveCheckpoint(end);
+  }
+}
 
-  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+uint64_t FileUpdateAgent::receivedDataSize() const {
+  if (writer_ != nullptr) {
+    return writer_->offset();
+  }
+  boost::system::error_code ec;
+  const auto size = boost::filesystem::file_size(new_target_filepath_, ec);
+  return ec ? 0 : size;
+}
+
+uint64_t FileUpdateAgent::resumeData(const Uptane::Target& target) {
+  if (new_target_hasher_ != nullptr && new_target_hash_ == getTargetHash(target).HashString()) {
+    return receivedDataSize();
+  }
+  writer_.reset();
+  const uint64_t size = receivedDataSize();
+  if (size == 0) {
+    discardData();
+    return 0;
+  }
+  if (size <= target.length() && restoreHasher(target, size)) {
+    LOG_INFO << "Resuming the upload of " << target.filename() << " after " << size << " bytes";
+    return size;
+  }
+  LOG_INFO << "Dropping " << size << " bytes of image data that don't belong to " << target.filename();
+  discardData();
+  return 0;
+}
+
+std::string FileUpdateAgent::receivedDataHash() const {
+  if (new_target_hasher_ == nullptr) {
+    return "";
+  }
+  // All the data is hashed once written.
+  if (writer_ != nullptr && !writer_->flush()) {
+    return "";
+  }
+  // Finish a copy, the hashing goes on.
+  auto copy = MultiPartHasher::create(new_target_hash_type_, MultiPartHasher::Backend::kSodium);
+  if (!copy->setState(new_target_hasher_->getState())) {
+    return "";
+  }
+  return copy->getHash().HashString();
+}
+
+void FileUpdateAgent::discardData() {
+  writer_.reset();
+  boost::system::error_code ec;
+  boost::filesystem::remove(new_target_filepath_, ec);
+  boost::filesystem::remove(checkpoint_filepath_, ec);
+  new_target_hasher_.reset();
+  new_target_hash_.clear();
+  new_target_hash_type_ = Hash::Type::kUnknownAlgorithm;
+  checkpoint_size_ = 0;
+}
+
+// Continue from the saved hash state, and hash what was written after it.
+bool FileUpdateAgent::restoreHasher(const Uptane::Target& target, uint64_t size) {
+  const Hash target_hash = getTargetHash(target);
+  uint64_t length = 0;
+  std::string state;
+  try {
+    const Json::Value checkpoint = Utils::parseJSONFile(checkpoint_filepath_);
+    if (checkpoint["target"].asString() != target_hash.HashString()) {
+      return false;
+    }
+    length = checkpoint["length"].asUInt64();
+    boost::algorithm::unhex(checkpoint["state"].asString(), std::back_inserter(state));
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Unable to read the hash state of the received image: " << e.what();
+    return false;
+  }
+  auto hasher = MultiPartHasher::create(target_hash.type(), MultiPartHasher::Backend::kSodium);
+  if (length > size || !hasher->setState(state)) {
+    return false;
+  }
+
+  std::ifstream file(new_target_filepath_.c_str(), std::ios::binary);
+  file.seekg(static_cast<std::streamoff>(length));
+  std::array<uint8_t, 64 * 1024> buf{};
+  uint64_t hashed = length;
+  while (hashed < size) {
+    file.read(reinterpret_cast<char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+    if (file.gcount() <= 0) {
+      return false;
+    }
+    hasher->update(buf.data(), static_cast<uint64_t>(file.gcount()));
+    hashed += static_cast<uint64_t>(file.gcount());
+  }
+  new_target_hasher_ = hasher;
+  new_target_hash_ = target_hash.HashString();
+  new_target_hash_type_ = target_hash.type();
+  checkpoint_size_ = length;
+  return true;
+}
+
+void FileUpdateAgent::saveCheckpoint(uint64_t size) {
+  Json::Value checkpoint;
+  checkpoint["target"] = new_target_hash_;
+  checkpoint["length"] = Json::UInt64(size);
+  checkpoint["state"] = boost::algorithm::hex(new_target_hasher_->getState());
+  try {
+    Utils::writeFile(checkpoint_filepath_, Utils::jsonToCanonicalStr(checkpoint));
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Unable to save the hash state of the received image: " << e.what();
+  }
+  checkpoint_size_ = size;
 }
 
 Hash FileUpdateAgent::getTargetHash(const Uptane::Target& target) {
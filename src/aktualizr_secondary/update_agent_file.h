@@ -1,19 +1,38 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
 
+#include <memory>
+
+#include "image_writer.h"
 #include "update_agent.h"
+#include "uptane/image_hash_cache.h"
 
 class FileUpdateAgent : public UpdateAgent {
  public:
-  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name)
+  FileUpdateAgent(boost::filesystem::path target_filepath, std::string target_name, bool direct_io = false,
+                  unsigned io_queue_depth = 0)
       : target_filepath_{std::move(target_filepath)},
         new_target_filepath_{target_filepath_.string() + ".newtarget"},
-        current_target_name_{std::move(target_name)} {}
+        checkpoint_filepath_{new_target_filepath_.string() + ".hashstate"},
+        current_target_name_{std::move(target_name)},
+        direct_io_{direct_io},
+        io_queue_depth_{io_queue_depth} {}
 
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
 
   virtual data::InstallationResult receiveData(const Uptane::Target& target, const uint8_t* data, size_t size);
+  // Size of the image data received so far for the new target
+  virtual uint64_t receivedDataSize() const;
+  // Prepare to go on receiving the image of target, also after a restart,
+  // and return the size of the data received so far. The data of another
+  // image, or whose hash state can't be restored, is dropped.
+  virtual uint64_t resumeData(const Uptane::Target& target);
+  // Hex digest of the image data received so far, of the type of the target
+  // hash, empty if there is none
+  virtual std::string receivedDataHash() const;
+  // Drop the image data received so far
+  virtual void discardData();
   data::InstallationResult install(const Uptane::Target& target) override;
 
   void completeInstall() override;
@@ -21,11 +40,28 @@ class FileUpdateAgent : public UpdateAgent {
 
  private:
   static Hash getTargetHash(const Uptane::Target& target);
+  bool restoreHasher(const Uptane::Target& target, uint64_t size);
+  void saveCheckpoint(uint64_t size);
+  // On the writer thread, for the data it has written
+  void dataWritten(const uint8_t* data, size_t size, uint64_t end);
 
   const boost::filesystem::path target_filepath_;
   const boost::filesystem::path new_target_filepath_;
+  // Hash state of the new image, saved every so often to resume after a restart
+  const boost::filesystem::path checkpoint_filepath_;
   std::string current_target_name_;
+  // Hash of the installed image, read again only when the file changed
+  Uptane::ImageHashCache installed_image_hash_;
   std::shared_ptr<MultiPartHasher> new_target_hasher_;
+  // Hash of the target the new image data belongs to
+  std::string new_target_hash_;
+  Hash::Type new_target_hash_type_{Hash::Type::kUnknownAlgorithm};
+  uint64_t checkpoint_size_{0};
+  const bool direct_io_;
+  const unsigned io_queue_depth_;
+  // Writes the new image, hashes it and saves the checkpoints while it is received.
+  // Last, so that it is gone before what it uses.
+  std::unique_ptr<ImageWriter> writer_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_FILE_H
@@ -1,14 +1,17 @@
 #include "update_agent_ostree.h"
 
+#include <sstream>
+
 #include <boost/algorithm/string/trim.hpp>
 
 #include "logging/logging.h"
 #include "package_manager/ostreemanager.h"
+#include "utilities/utils.h"
 
 // TODO: consider moving this and SecondaryProvider::getTreehubCredentials to
 // encapsulate them in one shared place if possible.
 static void extractCredentialsArchive(const std::string& archive, std::string* ca, std::string* cert, std::string* pkey,
-                                      std::string* treehub_server);
+                                      std::string* treehub_server, std::string* mirror_url);
 
 // TODO(OTA-4939): Unify this with the check in
 // SotaUptaneClient::getNewTargets() and make it more generic.
@@ -39,19 +42,26 @@ bool OstreeUpdateAgent::getInstalledImageInfo(Uptane::InstalledImageInfo& instal
   return result;
 }
 
-data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Target& target,
-                                                              const std::string& treehub_tls_creds) {
+data::InstallationResult OstreeUpdateAgent::downloadTargetRev(
+    const Uptane::Target& target, const std::string& treehub_tls_creds,
+    const std::function<void(const OstreePullStatus&)>& status_cb) {
   std::string treehub_server;
+  std::string mirror_url;
 
   try {
-    std::string ca;
-    std::string cert;
-    std::string pkey;
-    std::string server_url;
-    extractCredentialsArchive(treehub_tls_creds, &ca, &cert, &pkey, &server_url);
-    keyMngr_->loadKeys(&pkey, &cert, &ca);
-    boost::trim(server_url);
-    treehub_server = server_url;
+    // The Primary sends the same credentials with each download
+    if (treehub_tls_creds != creds_archive_) {
+      Credentials creds;
+      extractCredentialsArchive(treehub_tls_creds, &creds.ca, &creds.cert, &creds.pkey, &creds.server_url,
+                                &creds.mirror_url);
+      boost::trim(creds.server_url);
+      boost::trim(creds.mirror_url);
+      creds_ = std::move(creds);
+      creds_archive_ = treehub_tls_creds;
+    }
+    keyMngr_->loadKeys(&creds_.pkey, &creds_.cert, &creds_.ca);
+    treehub_server = creds_.server_url;
+    mirror_url = creds_.mirror_url;
   } catch (std::runtime_error& exc) {
     LOG_ERROR << exc.what();
     return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
@@ -59,12 +69,27 @@ data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Targ
   }
 
   data::InstallationResult result;
+  if (!mirror_url.empty()) {
+    // The Primary has pulled the commit already, over the vehicle LAN.
+    Uptane::Target mirrored = target;
+    mirrored.setUri(mirror_url);
+    result = OstreeManager::pull(sysrootPath_, mirror_url, *keyMngr_, mirrored, nullptr, nullptr, nullptr, boost::none,
+                                 OstreePullOptions(), status_cb);
+    if (result.success) {
+      LOG_INFO << "The target commit has been downloaded from the mirror of the Primary: " << target.sha256Hash();
+      ostreePackMan_->prestage(target);
+      return result;
+    }
+    LOG_WARNING << "Failed to download the target commit from the mirror of the Primary, trying " << treehub_server;
+  }
+
   const int max_tries = 3;
   int tries = 0;
   std::chrono::milliseconds wait(500);
 
   for (; tries < max_tries; tries++) {
-    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target);
+    result = OstreeManager::pull(sysrootPath_, treehub_server, *keyMngr_, target, nullptr, nullptr, nullptr,
+                                 boost::none, OstreePullOptions(), status_cb);
     if (result.success) {
       break;
     } else if (tries < max_tries - 1) {
@@ -91,6 +116,9 @@ data::InstallationResult OstreeUpdateAgent::downloadTargetRev(const Uptane::Targ
     }
   }
 
+  if (result.success) {
+    ostreePackMan_->prestage(target);
+  }
   return result;
 }
 
@@ -105,21 +133,23 @@ data::InstallationResult OstreeUpdateAgent::applyPendingInstall(const Uptane::Ta
 }
 
 void extractCredentialsArchive(const std::string& archive, std::string* ca, std::string* cert, std::string* pkey,
-                               std::string* treehub_server) {
-  {
-    std::stringstream as(archive);
-    *ca = Utils::readFileFromArchive(as, "ca.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *cert = Utils::readFileFromArchive(as, "client.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *pkey = Utils::readFileFromArchive(as, "pkey.pem");
-  }
-  {
-    std::stringstream as(archive);
-    *treehub_server = Utils::readFileFromArchive(as, "server.url", true);
+                               std::string* treehub_server, std::string* mirror_url) {
+  std::stringstream as(archive);
+  auto files = Utils::readFilesFromArchive(as, {"ca.pem", "client.pem", "pkey.pem", "server.url", "mirror.url"});
+  const auto take = [&files](const std::string& filename, std::string* out) {
+    auto found = files.find(filename);
+    if (found == files.end()) {
+      throw std::runtime_error("could not extract " + filename + " from archive");
+    }
+    *out = std::move(found->second);
+  };
+  take("ca.pem", ca);
+  take("client.pem", cert);
+  take("pkey.pem", pkey);
+  take("server.url", treehub_server);
+  // Only sent by a Primary with a mirror
+  mirror_url->clear();
+  if (files.count("mirror.url") != 0) {
+    take("mirror.url", mirror_url);
   }
 }
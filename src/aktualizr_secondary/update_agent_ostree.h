@@ -1,10 +1,13 @@
 #ifndef AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 #define AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
 
+#include <functional>
+
 #include "update_agent.h"
 
 class OstreeManager;
 class KeyManager;
+struct OstreePullStatus;
 
 class OstreeUpdateAgent : public UpdateAgent {
  public:
@@ -18,7 +21,9 @@ class OstreeUpdateAgent : public UpdateAgent {
   bool isTargetSupported(const Uptane::Target& target) const override;
   bool getInstalledImageInfo(Uptane::InstalledImageInfo& installed_image_info) const override;
 
-  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds);
+  // status_cb is given the progress of the pull now and then
+  data::InstallationResult downloadTargetRev(const Uptane::Target& target, const std::string& treehub_tls_creds,
+                                             const std::function<void(const OstreePullStatus&)>& status_cb = nullptr);
 
   data::InstallationResult install(const Uptane::Target& target) override;
 
@@ -31,6 +36,17 @@ class OstreeUpdateAgent : public UpdateAgent {
   std::shared_ptr<KeyManager> keyMngr_;
   std::shared_ptr<OstreeManager> ostreePackMan_;
   const ::std::string targetname_prefix_;
+
+  struct Credentials {
+    std::string ca;
+    std::string cert;
+    std::string pkey;
+    std::string server_url;
+    std::string mirror_url;
+  };
+  // The last Treehub credentials archive and what was extracted from it
+  std::string creds_archive_;
+  Credentials creds_;
 };
 
 #endif  // AKTUALIZR_SECONDARY_UPDATE_AGENT_OSTREE_H
@@ -0,0 +1,86 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "asn1/asn1_message.h"
+#include "benchmark_data.h"
+#include "der_encoder.h"
+#include "utilities/dequeue_buffer.h"
+
+namespace {
+
+// An uploadDataReq with `size` bytes of firmware, as sent to IP Secondaries
+Asn1Message::Ptr uploadDataReq(size_t size) {
+  const std::string data = benchmarkData(size);
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_uploadDataReq);
+  SetString(&req->uploadDataReq()->data, data);
+  return req;
+}
+
+void BM_Asn1Encode(benchmark::State &state) {
+  const Asn1Message::Ptr req = uploadDataReq(static_cast<size_t>(state.range(0)));
+  // Reused, as for the messages of a connection
+  std::string encoded;
+  for (auto _ : state) {
+    encoded.clear();
+    const asn_enc_rval_t res = der_encode(&asn_DEF_AKIpUptaneMes, &req->msg_, Asn1StringAppendCallback, &encoded);
+    if (res.encoded == -1) {
+      state.SkipWithError("The message could not be encoded");
+      break;
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Asn1Encode)->Arg(1024)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
+// Decoded as Asn1Receive() does, as the parts that fit in the buffer arrive
+void BM_Asn1Decode(benchmark::State &state) {
+  const Asn1Message::Ptr req = uploadDataReq(static_cast<size_t>(state.range(0)));
+  std::string encoded;
+  der_encode(&asn_DEF_AKIpUptaneMes, &req->msg_, Asn1StringAppendCallback, &encoded);
+  DequeueBuffer buffer;
+  for (auto _ : state) {
+    Asn1Message::Ptr msg = Asn1Message::Empty();
+    asn_codec_ctx_t context{};
+    asn_dec_rval_t res{};
+    res.code = RC_WMORE;
+    size_t pos = 0;
+    while (res.code == RC_WMORE && pos < encoded.size()) {
+      const size_t part = std::min(buffer.TailSpace(), encoded.size() - pos);
+      std::memcpy(buffer.Tail(), &encoded[pos], part);
+      buffer.HaveEnqueued(part);
+      pos += part;
+      res = Asn1Decode(msg.get(), &context, &buffer);
+    }
+    if (res.code != RC_OK || msg->present() != AKIpUptaneMes_PR_uploadDataReq) {
+      state.SkipWithError("The message could not be decoded");
+      break;
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * encoded.size()));
+}
+BENCHMARK(BM_Asn1Decode)->Arg(1024)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
+// The data of a connection going through the buffer, taken `range` bytes at a time
+void BM_DequeueBuffer(benchmark::State &state) {
+  const auto consumed = static_cast<size_t>(state.range(0));
+  const std::string data = benchmarkData(1 << 20);
+  DequeueBuffer buffer;
+  for (auto _ : state) {
+    size_t pos = 0;
+    while (pos < data.size() || buffer.Size() > 0) {
+      const size_t part = std::min(buffer.TailSpace(), data.size() - pos);
+      std::memcpy(buffer.Tail(), &data[pos], part);
+      buffer.HaveEnqueued(part);
+      pos += part;
+      benchmark::DoNotOptimize(buffer.Head());
+      buffer.Consume(std::min(consumed, buffer.Size()));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(data.size()));
+}
+BENCHMARK(BM_DequeueBuffer)->Arg(16)->Arg(1024)->Arg(4096)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
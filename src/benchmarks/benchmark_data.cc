@@ -0,0 +1,35 @@
+#include "benchmark_data.h"
+
+Json::Value targetsMetadata(int64_t targets) {
+  Json::Value json;
+  json["signatures"][0]["keyid"] = std::string(64, 'e');
+  json["signatures"][0]["method"] = "ed25519";
+  json["signatures"][0]["sig"] = std::string(88, 's');
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  Json::Value &list = json["signed"]["targets"];
+  for (int64_t i = 0; i < targets; ++i) {
+    Json::Value &target = list["firmware-" + std::to_string(i) + ".bin"];
+    target["length"] = 1048576 + i;
+    target["hashes"]["sha256"] = std::string(64, 'a');
+    target["hashes"]["sha512"] = std::string(128, 'b');
+    target["custom"]["hardwareIds"][0] = "hardware-" + std::to_string(i % 100);
+    target["custom"]["targetFormat"] = "BINARY";
+    target["custom"]["version"] = std::to_string(i);
+  }
+  return json;
+}
+
+std::string benchmarkData(size_t size) {
+  std::string data(size, '\0');
+  // xorshift64
+  uint64_t x = 0x9E3779B97F4A7C15ULL;
+  for (auto &c : data) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    c = static_cast<char>(x & 0xFFU);
+  }
+  return data;
+}
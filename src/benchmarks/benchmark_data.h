@@ -0,0 +1,18 @@
+#ifndef BENCHMARKS_BENCHMARK_DATA_H_
+#define BENCHMARKS_BENCHMARK_DATA_H_
+
+#include <cstdint>
+#include <string>
+
+#include <json/json.h>
+
+/**
+ * Targets metadata with `targets` images spread over a hundred hardware IDs,
+ * laid out as the Image repository serves it.
+ */
+Json::Value targetsMetadata(int64_t targets);
+
+// Deterministic, incompressible data, so the results do not depend on a seed
+std::string benchmarkData(size_t size);
+
+#endif  // BENCHMARKS_BENCHMARK_DATA_H_
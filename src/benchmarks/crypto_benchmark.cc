@@ -0,0 +1,116 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+
+#include <boost/algorithm/hex.hpp>
+
+#include "benchmark_data.h"
+#include "crypto/crypto.h"
+
+namespace {
+
+void BM_SHA256Hasher(benchmark::State &state, MultiPartHasher::Backend backend) {
+  const std::string data = benchmarkData(static_cast<size_t>(state.range(0)));
+  const auto *part = reinterpret_cast<const unsigned char *>(data.data());
+  for (auto _ : state) {
+    auto hasher = MultiPartHasher::create(Hash::Type::kSha256, backend);
+    // In the parts that the downloads hand over
+    for (size_t pos = 0; pos < data.size(); pos += 16384) {
+      hasher->update(part + pos, std::min<size_t>(16384, data.size() - pos));
+    }
+    benchmark::DoNotOptimize(hasher->getHexDigest());
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_SHA256Hasher, openssl, MultiPartHasher::Backend::kOpenSsl)
+    ->Arg(4096)
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SHA256Hasher, sodium, MultiPartHasher::Backend::kSodium)
+    ->Arg(4096)
+    ->Arg(1 << 20)
+    ->Arg(16 << 20)
+    ->Unit(benchmark::kMicrosecond);
+
+void BM_RSAPSSVerify(benchmark::State &state, KeyType key_type) {
+  std::string public_key;
+  std::string private_key;
+  if (!Crypto::generateKeyPair(key_type, &public_key, &private_key)) {
+    state.SkipWithError("The key could not be generated");
+    return;
+  }
+  const std::string message = benchmarkData(static_cast<size_t>(state.range(0)));
+  const std::string signature = Crypto::RSAPSSSign(nullptr, private_key, message);
+  for (auto _ : state) {
+    if (!Crypto::RSAPSSVerify(public_key, signature, message)) {
+      state.SkipWithError("The signature is not valid");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_RSAPSSVerify, rsa2048, KeyType::kRSA2048)->Arg(1024)->Arg(65536)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_RSAPSSVerify, rsa4096, KeyType::kRSA4096)->Arg(1024)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
+// The share of BM_RSAPSSVerify that PublicKey saves by parsing its key once
+void BM_RSAPublicKeyParse(benchmark::State &state, KeyType key_type) {
+  std::string public_key;
+  std::string private_key;
+  if (!Crypto::generateKeyPair(key_type, &public_key, &private_key)) {
+    state.SkipWithError("The key could not be generated");
+    return;
+  }
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Crypto::parseRSAPublicKey(public_key));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_RSAPublicKeyParse, rsa2048, KeyType::kRSA2048)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_RSAPublicKeyParse, rsa4096, KeyType::kRSA4096)->Unit(benchmark::kMicrosecond);
+
+void BM_PublicKeyVerify(benchmark::State &state, KeyType key_type) {
+  std::string public_key;
+  std::string private_key;
+  if (!Crypto::generateKeyPair(key_type, &public_key, &private_key)) {
+    state.SkipWithError("The key could not be generated");
+    return;
+  }
+  const PublicKey key(public_key, key_type);
+  const std::string message = benchmarkData(static_cast<size_t>(state.range(0)));
+  const std::string signature =
+      Utils::toBase64(key_type == KeyType::kED25519 ? Crypto::ED25519Sign(boost::algorithm::unhex(private_key), message)
+                                                    : Crypto::RSAPSSSign(nullptr, private_key, message));
+  for (auto _ : state) {
+    if (!key.VerifySignature(signature, message)) {
+      state.SkipWithError("The signature is not valid");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_PublicKeyVerify, rsa2048, KeyType::kRSA2048)->Arg(1024)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_PublicKeyVerify, rsa4096, KeyType::kRSA4096)->Arg(1024)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_PublicKeyVerify, ed25519, KeyType::kED25519)->Arg(1024)->Unit(benchmark::kMicrosecond);
+
+void BM_ED25519Verify(benchmark::State &state) {
+  std::string public_key;
+  std::string private_key;
+  if (!Crypto::generateEDKeyPair(&public_key, &private_key)) {
+    state.SkipWithError("The key could not be generated");
+    return;
+  }
+  public_key = boost::algorithm::unhex(public_key);
+  const std::string message = benchmarkData(static_cast<size_t>(state.range(0)));
+  const std::string signature = Crypto::ED25519Sign(boost::algorithm::unhex(private_key), message);
+  for (auto _ : state) {
+    if (!Crypto::ED25519Verify(public_key, signature, message)) {
+      state.SkipWithError("The signature is not valid");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ED25519Verify)->Arg(1024)->Arg(65536)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
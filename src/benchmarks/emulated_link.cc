@@ -0,0 +1,171 @@
+#include "emulated_link.h"
+
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+
+namespace {
+
+void nameThread() { pthread_setname_np(pthread_self(), "link"); }
+
+void setNoDelay(int fd) {
+  const int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int connectTo(in_port_t port) {
+  const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  sockaddr_in sa{};
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, reinterpret_cast<const sockaddr *>(&sa), sizeof(sa)) == -1) {
+    const int err = errno;
+    close(fd);
+    throw std::system_error(err, std::system_category(), "connect");
+  }
+  setNoDelay(fd);
+  return fd;
+}
+
+}  // namespace
+
+EmulatedLink::Direction::Direction(EmulatedLink &link, int from, int to, uint64_t seed)
+    : link_{link}, from_{from}, to_{to}, random_{seed} {
+  receiver_ = std::thread([this]() { receive(); });
+  deliverer_ = std::thread([this]() { deliver(); });
+}
+
+EmulatedLink::Direction::~Direction() {
+  receiver_.join();
+  deliverer_.join();
+}
+
+void EmulatedLink::Direction::receive() {
+  nameThread();
+  const LinkParameters &params = link_.params_;
+  std::bernoulli_distribution lost(params.loss);
+  std::vector<char> buf(65536);
+  Clock::time_point sent = Clock::now();
+  Clock::time_point last_arrival = sent;
+  for (;;) {
+    const ssize_t received = recv(from_, buf.data(), buf.size(), 0);
+    if (received <= 0) {
+      break;
+    }
+    for (size_t pos = 0; pos < static_cast<size_t>(received); pos += params.segment_size) {
+      const size_t size = std::min(params.segment_size, static_cast<size_t>(received) - pos);
+      sent = std::max(sent, Clock::now());
+      if (params.bandwidth > 0) {
+        sent += std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(size) * 8 / params.bandwidth));
+      }
+      Clock::time_point arrival = sent + params.rtt / 2;
+      if (params.loss > 0 && lost(random_)) {
+        arrival += params.retransmit_timeout + params.rtt;
+        ++link_.lost_;
+      }
+      last_arrival = std::max(last_arrival, arrival);
+      std::lock_guard<std::mutex> lock(mutex_);
+      in_flight_.emplace_back(last_arrival, std::string(&buf[pos], size));
+      in_flight_bytes_ += size;
+    }
+    cv_.notify_one();
+    // Busy sending what was received so far
+    std::this_thread::sleep_until(sent);
+    std::unique_lock<std::mutex> lock(mutex_);
+    delivered_cv_.wait(lock, [this, &params]() { return in_flight_bytes_ <= params.window || end_; });
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  end_ = true;
+  cv_.notify_one();
+}
+
+void EmulatedLink::Direction::deliver() {
+  nameThread();
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    cv_.wait(lock, [this]() { return end_ || !in_flight_.empty(); });
+    if (in_flight_.empty()) {
+      break;
+    }
+    const Clock::time_point arrival = in_flight_.front().first;
+    std::string data = std::move(in_flight_.front().second);
+    in_flight_.pop_front();
+    in_flight_bytes_ -= data.size();
+    lock.unlock();
+    std::this_thread::sleep_until(arrival);
+    size_t pos = 0;
+    while (pos < data.size()) {
+      const ssize_t written = send(to_, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+      if (written <= 0) {
+        break;
+      }
+      pos += static_cast<size_t>(written);
+    }
+    link_.bytes_ += pos;
+    delivered_cv_.notify_one();
+    lock.lock();
+  }
+  // Pass on the end of the stream
+  shutdown(to_, SHUT_WR);
+}
+
+EmulatedLink::Connection::Connection(EmulatedLink &link, int client, int server)
+    : client_socket{client},
+      server_socket{server},
+      upstream{link, client, server, 2 * static_cast<uint64_t>(client)},
+      downstream{link, server, client, 2 * static_cast<uint64_t>(client) + 1} {}
+
+EmulatedLink::Connection::~Connection() {
+  shutdown(*client_socket, SHUT_RDWR);
+  shutdown(*server_socket, SHUT_RDWR);
+}
+
+EmulatedLink::EmulatedLink(in_port_t target_port, const LinkParameters &params)
+    : target_port_{target_port}, params_{params}, listen_socket_{0} {
+  if (listen(*listen_socket_, SOMAXCONN) == -1) {
+    throw std::system_error(errno, std::system_category(), "listen");
+  }
+  acceptor_ = std::thread([this]() { acceptConnections(); });
+}
+
+EmulatedLink::~EmulatedLink() {
+  stop_ = true;
+  // Wakes up accept()
+  shutdown(*listen_socket_, SHUT_RDWR);
+  acceptor_.join();
+  std::lock_guard<std::mutex> lock(mutex_);
+  connections_.clear();
+}
+
+void EmulatedLink::acceptConnections() {
+  nameThread();
+  while (!stop_) {
+    const int client = accept4(*listen_socket_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (client == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      break;
+    }
+    setNoDelay(client);
+    int server;
+    try {
+      server = connectTo(target_port_);
+    } catch (const std::system_error &) {
+      close(client);
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    connections_.push_back(std_::make_unique<Connection>(*this, client, server));
+  }
+}
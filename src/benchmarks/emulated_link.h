@@ -0,0 +1,121 @@
+#ifndef BENCHMARKS_EMULATED_LINK_H_
+#define BENCHMARKS_EMULATED_LINK_H_
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utilities/utils.h"
+
+struct LinkParameters {
+  // Bits per second each way, 0 for no limit
+  double bandwidth{100e6};
+  // Round-trip time, half of it each way
+  std::chrono::microseconds rtt{std::chrono::milliseconds(1)};
+  // Probability that a segment is lost and has to be retransmitted
+  double loss{0};
+  // Time after which a lost segment is sent again. The RPCs of the Secondaries
+  // leave too few segments in flight for fast retransmits, so that it is
+  // Linux's minimum retransmission timeout.
+  std::chrono::microseconds retransmit_timeout{std::chrono::milliseconds(200)};
+  size_t segment_size{1448};
+  // Bytes on the link at most, as the TCP window lets in flight
+  size_t window{256 * 1024};
+};
+
+/**
+ * A TCP proxy that forwards the connections made to it to a local port, as if
+ * over a link with the given bandwidth, latency and loss.
+ *
+ * The data of each direction is cut into segments that are sent one after the
+ * other at the bandwidth of the link, and delivered half a round-trip time
+ * later, or a retransmission timeout and a round-trip time later still if they
+ * are lost; delivery stays in order, so a lost segment holds up the ones
+ * behind it. Reading stops while the link is busy or while a window of data is
+ * in flight, so that the sender is held back as on a real link. Congestion
+ * control is not emulated.
+ *
+ * Its threads are named "link", to tell their CPU time apart.
+ */
+class EmulatedLink {
+ public:
+  EmulatedLink(in_port_t target_port, const LinkParameters &params);
+  ~EmulatedLink();
+  EmulatedLink(const EmulatedLink &) = delete;
+  EmulatedLink(EmulatedLink &&) = delete;
+  EmulatedLink &operator=(const EmulatedLink &) = delete;
+  EmulatedLink &operator=(EmulatedLink &&) = delete;
+
+  in_port_t port() const { return listen_socket_.port(); }
+  uint64_t bytesForwarded() const { return bytes_.load(); }
+  uint64_t segmentsLost() const { return lost_.load(); }
+
+ private:
+  // One way of a connection
+  class Direction {
+   public:
+    Direction(EmulatedLink &link, int from, int to, uint64_t seed);
+    ~Direction();
+    Direction(const Direction &) = delete;
+    Direction(Direction &&) = delete;
+    Direction &operator=(const Direction &) = delete;
+    Direction &operator=(Direction &&) = delete;
+
+   private:
+    using Clock = std::chrono::steady_clock;
+    void receive();
+    void deliver();
+
+    EmulatedLink &link_;
+    int from_;
+    int to_;
+    std::mt19937_64 random_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::condition_variable delivered_cv_;
+    // The segments on the link, with the time they arrive
+    std::deque<std::pair<Clock::time_point, std::string>> in_flight_;
+    size_t in_flight_bytes_{0};
+    bool end_{false};
+    std::thread receiver_;
+    std::thread deliverer_;
+  };
+
+  struct Connection {
+    Connection(EmulatedLink &link, int client, int server);
+    ~Connection();
+    Connection(const Connection &) = delete;
+    Connection(Connection &&) = delete;
+    Connection &operator=(const Connection &) = delete;
+    Connection &operator=(Connection &&) = delete;
+
+    Socket client_socket;
+    Socket server_socket;
+    Direction upstream;
+    Direction downstream;
+  };
+
+  void acceptConnections();
+
+  const in_port_t target_port_;
+  const LinkParameters params_;
+  ListenSocket listen_socket_;
+  std::atomic<bool> stop_{false};
+  std::atomic<uint64_t> bytes_{0};
+  std::atomic<uint64_t> lost_{0};
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+  std::thread acceptor_;
+};
+
+#endif  // BENCHMARKS_EMULATED_LINK_H_
@@ -0,0 +1,90 @@
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/archive/iterators/base64_from_binary.hpp>
+#include <boost/archive/iterators/binary_from_base64.hpp>
+#include <boost/archive/iterators/remove_whitespace.hpp>
+#include <boost/archive/iterators/transform_width.hpp>
+
+#include "utilities/encoding.h"
+
+namespace {
+
+// The Boost codecs that Utils used before
+using base64_text = boost::archive::iterators::base64_from_binary<
+    boost::archive::iterators::transform_width<std::string::const_iterator, 6, 8>>;
+using base64_to_bin = boost::archive::iterators::transform_width<
+    boost::archive::iterators::binary_from_base64<
+        boost::archive::iterators::remove_whitespace<std::string::const_iterator>>,
+    8, 6>;
+
+std::string boostToBase64(const std::string &data) {
+  std::string b64sig(base64_text(data.begin()), base64_text(data.end()));
+  b64sig.append((3 - data.length() % 3) % 3, '=');
+  return b64sig;
+}
+
+std::string boostFromBase64(std::string base64) {
+  const auto paddingChars = std::count(base64.begin(), base64.end(), '=');
+  std::replace(base64.begin(), base64.end(), '=', 'A');
+  std::string result(base64_to_bin(base64.begin()), base64_to_bin(base64.end()));
+  result.erase(result.end() - paddingChars, result.end());
+  return result;
+}
+
+std::string randomData(int64_t size) {
+  std::mt19937 generator(1);
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string data(static_cast<size_t>(size), '\0');
+  for (auto &c : data) {
+    c = static_cast<char>(byte(generator));
+  }
+  return data;
+}
+
+template <std::string (*Encode)(const std::string &)>
+void BM_Encode(benchmark::State &state) {
+  const std::string data = randomData(state.range(0));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Encode(data));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+template <std::string (*Encode)(const std::string &), std::string (*Decode)(const std::string &)>
+void BM_Decode(benchmark::State &state) {
+  const std::string encoded = Encode(randomData(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Decode(encoded));
+  }
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+std::string boostFromBase64Ref(const std::string &base64) { return boostFromBase64(base64); }
+std::string boostToHex(const std::string &data) { return boost::algorithm::hex(data); }
+std::string boostFromHex(const std::string &hex) { return boost::algorithm::unhex(hex); }
+std::string toHex(const std::string &data) { return encoding::toHex(data); }
+std::string scalarToHex(const std::string &data) { return encoding::scalar::toHex(data); }
+
+// From the size of a key ID to the size of a small image
+#define ENCODING_BENCHMARK(...) \
+  BENCHMARK_TEMPLATE(__VA_ARGS__)->RangeMultiplier(16)->Range(32, 1 << 20)->Unit(benchmark::kMicrosecond)
+
+ENCODING_BENCHMARK(BM_Encode, boostToBase64);
+ENCODING_BENCHMARK(BM_Encode, encoding::scalar::toBase64);
+ENCODING_BENCHMARK(BM_Encode, encoding::toBase64);
+ENCODING_BENCHMARK(BM_Decode, encoding::toBase64, boostFromBase64Ref);
+ENCODING_BENCHMARK(BM_Decode, encoding::toBase64, encoding::scalar::fromBase64);
+ENCODING_BENCHMARK(BM_Decode, encoding::toBase64, encoding::fromBase64);
+ENCODING_BENCHMARK(BM_Encode, boostToHex);
+ENCODING_BENCHMARK(BM_Encode, scalarToHex);
+ENCODING_BENCHMARK(BM_Encode, toHex);
+ENCODING_BENCHMARK(BM_Decode, toHex, boostFromHex);
+ENCODING_BENCHMARK(BM_Decode, toHex, encoding::scalar::fromHex);
+ENCODING_BENCHMARK(BM_Decode, toHex, encoding::fromHex);
+
+}  // namespace
@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+
+#include <boost/algorithm/hex.hpp>
+
+#include "benchmark_data.h"
+#include "crypto/crypto.h"
+#include "uptane/parsed_targets.h"
+#include "uptane/signature_cache.h"
+#include "uptane/tuf.h"
+#include "utilities/utils.h"
+
+namespace {
+
+void BM_JsonToCanonicalStr(benchmark::State &state) {
+  const Json::Value json = targetsMetadata(state.range(0));
+  size_t size = 0;
+  for (auto _ : state) {
+    const std::string canonical = Utils::jsonToCanonicalStr(json);
+    size = canonical.size();
+    benchmark::DoNotOptimize(canonical.data());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * size));
+}
+BENCHMARK(BM_JsonToCanonicalStr)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+void BM_ParseJSON(benchmark::State &state) {
+  const std::string raw = Utils::jsonToCanonicalStr(targetsMetadata(state.range(0)));
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(Utils::parseJSON(raw));
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * raw.size()));
+}
+BENCHMARK(BM_ParseJSON)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+// Targets metadata as the Primary gets it: parsed as a whole, then turned into Targets
+void BM_TargetsFromJson(benchmark::State &state) {
+  const std::string raw = Utils::jsonToCanonicalStr(targetsMetadata(state.range(0)));
+  for (auto _ : state) {
+    const Uptane::Targets targets(Utils::parseJSON(raw));
+    benchmark::DoNotOptimize(targets.targets.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_TargetsFromJson)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+// The same, one target at a time
+void BM_ParsedTargets(benchmark::State &state) {
+  const std::string raw = Utils::jsonToCanonicalStr(targetsMetadata(state.range(0)));
+  for (auto _ : state) {
+    Uptane::ParsedTargets parsed;
+    if (!Uptane::ParsedTargets::parse(raw, &parsed)) {
+      state.SkipWithError("The targets metadata could not be parsed");
+      break;
+    }
+    benchmark::DoNotOptimize(parsed.targets.data());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParsedTargets)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+// Signed Targets metadata parsed and verified against the Root, as the Primary
+// checks the Image repository
+void BM_VerifyTargets(benchmark::State &state) {
+  std::string public_key;
+  std::string private_key;
+  if (!Crypto::generateEDKeyPair(&public_key, &private_key)) {
+    state.SkipWithError("The key could not be generated");
+    return;
+  }
+  const PublicKey key(public_key, KeyType::kED25519);
+  Json::Value root_json;
+  root_json["signed"]["_type"] = "Root";
+  root_json["signed"]["version"] = 1;
+  root_json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  root_json["signed"]["keys"][key.KeyId()] = key.ToUptane();
+  root_json["signed"]["roles"]["targets"]["keyids"][0] = key.KeyId();
+  root_json["signed"]["roles"]["targets"]["threshold"] = 1;
+  const auto root = std::make_shared<Uptane::Root>(Uptane::RepositoryType::Image(), root_json);
+
+  Json::Value targets_json = targetsMetadata(state.range(0));
+  targets_json["signatures"][0]["keyid"] = key.KeyId();
+  targets_json["signatures"][0]["sig"] = Utils::toBase64(
+      Crypto::ED25519Sign(boost::algorithm::unhex(private_key), Utils::jsonToCanonicalStr(targets_json["signed"])));
+  const std::string raw = Utils::jsonToCanonicalStr(targets_json);
+
+  // Measure the verification, not the cache of its results
+  Uptane::SignatureCache::instance().setCapacity(0);
+  for (auto _ : state) {
+    Uptane::ParsedTargets parsed;
+    if (!Uptane::ParsedTargets::parse(raw, &parsed)) {
+      state.SkipWithError("The targets metadata could not be parsed");
+      break;
+    }
+    const Uptane::Targets targets(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), std::move(parsed), root);
+    benchmark::DoNotOptimize(targets.targets.data());
+  }
+  Uptane::SignatureCache::instance().setCapacity(Uptane::SignatureCache::kDefaultCapacity);
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_VerifyTargets)->RangeMultiplier(10)->Range(10, 10000)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
@@ -0,0 +1,29 @@
+#include <benchmark/benchmark.h>
+
+#include "logging/logging.h"
+#include "utilities/aktualizr_version.h"
+
+/*
+ * Micro-benchmarks of the code that the Uptane cycle spends its time in.
+ *
+ * The results are compared between releases and devices by writing them with
+ * --benchmark_out=FILE --benchmark_out_format=json. Each benchmark keeps its
+ * name, arguments and time unit across releases; the context of the run
+ * tells the version of aktualizr and the format of the results, which is
+ * only changed along with its number.
+ */
+
+int main(int argc, char **argv) {
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+    return 1;
+  }
+  benchmark::AddCustomContext("aktualizr_version", aktualizr_version());
+  benchmark::AddCustomContext("aktualizr_benchmarks_format", "1");
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
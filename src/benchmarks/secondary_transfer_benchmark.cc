@@ -0,0 +1,374 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "aktualizr_secondary_file.h"
+#include "benchmark_data.h"
+#include "emulated_link.h"
+#include "ipuptanesecondary.h"
+#include "libaktualizr/config.h"
+#include "libaktualizr/packagemanagerfactory.h"
+#include "libaktualizr/packagemanagerinterface.h"
+#include "logging/logging.h"
+#include "primary/secondary_provider_builder.h"
+#include "secondary_tcp_server.h"
+#include "storage/invstorage.h"
+#include "uptane/tuf.h"
+#include "uptane_repo.h"
+#include "utilities/utils.h"
+
+/*
+ * Time the transfer of the metadata and of the image of an update from the
+ * Primary to an IP Secondary, over an emulated link with the bandwidth, round
+ * trip time and packet loss of an in-vehicle network.
+ *
+ * The Secondary is a file Secondary that runs in the same process, behind the
+ * link, and verifies the metadata as it would on a vehicle. Each iteration
+ * sends a new image, so that no upload resumes the one before it. The
+ * throughput of sendFirmware(), the latency of putMetadata() and the CPU time
+ * that the Primary, the Secondary and the link spent per byte of the image are
+ * printed, and written as JSON to the --report file.
+ */
+
+namespace po = boost::program_options;
+
+namespace {
+
+enum Side { kPrimary = 0, kSecondary, kLink, kSides };
+const std::array<const char *, kSides> kSideNames{"primary", "secondary", "link"};
+
+// Seconds of CPU time spent by the threads of each side
+using CpuTimes = std::array<double, kSides>;
+
+double threadCpuSeconds(const boost::filesystem::path &task) {
+  // The run time in nanoseconds, when the kernel keeps scheduler statistics
+  std::ifstream schedstat((task / "schedstat").string());
+  uint64_t run_ns;
+  if (schedstat >> run_ns) {
+    return static_cast<double>(run_ns) / 1e9;
+  }
+  // Otherwise the user and system times in clock ticks, the 14th and 15th
+  // fields, after the name in parentheses
+  std::ifstream stat_file((task / "stat").string());
+  const std::string stat((std::istreambuf_iterator<char>(stat_file)), std::istreambuf_iterator<char>());
+  const auto end_of_name = stat.rfind(')');
+  if (end_of_name == std::string::npos) {
+    return 0;
+  }
+  std::istringstream fields(stat.substr(end_of_name + 2));
+  std::string field;
+  for (int i = 3; i < 14 && fields >> field; ++i) {
+  }
+  uint64_t utime = 0;
+  uint64_t stime = 0;
+  fields >> utime >> stime;
+  return static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+}
+
+/* The CPU time of the threads of the process alive now, by the side they are
+ * named after. Threads of the Secondary's server inherit its name; the others
+ * work for the Primary. */
+CpuTimes sampleCpu() {
+  CpuTimes times{};
+  for (const auto &task : boost::filesystem::directory_iterator("/proc/self/task")) {
+    const std::string comm = Utils::readFile(task.path() / "comm", true);
+    Side side = kPrimary;
+    if (comm == kSideNames[kSecondary]) {
+      side = kSecondary;
+    } else if (comm == kSideNames[kLink]) {
+      side = kLink;
+    }
+    times[side] += threadCpuSeconds(task.path());
+  }
+  return times;
+}
+
+// Nearest-rank percentile of sorted values
+double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const auto rank = static_cast<size_t>(std::ceil(p / 100 * static_cast<double>(sorted.size())));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+Json::Value summary(std::vector<double> values) {
+  std::sort(values.begin(), values.end());
+  Json::Value result;
+  result["count"] = static_cast<Json::UInt64>(values.size());
+  result["p50"] = percentile(values, 50);
+  result["p95"] = percentile(values, 95);
+  result["max"] = values.empty() ? 0 : values.back();
+  return result;
+}
+
+class Benchmark {
+ public:
+  Benchmark(const LinkParameters &link_params, bool compress) {
+    secondary_->initialize();
+    server_thread_ = std::thread([this]() {
+      pthread_setname_np(pthread_self(), kSideNames[kSecondary]);
+      server_.run();
+    });
+    server_.wait_until_running();
+    link_ = std::make_unique<EmulatedLink>(server_.port(), link_params);
+
+    repo_.generateRepo(KeyType::kED25519);
+
+    config_.pacman.type = PACKAGE_MANAGER_NONE;
+    config_.pacman.images_path = primary_dir_.Path() / "images";
+    config_.storage.path = primary_dir_.Path();
+    storage_ = INvStorage::newStorage(config_.storage);
+    storage_->storeRoot(Utils::readFile(director_dir_ / "root.json"), Uptane::RepositoryType::Director(),
+                        Uptane::Version(1));
+    storage_->storeRoot(Utils::readFile(image_dir_ / "root.json"), Uptane::RepositoryType::Image(),
+                        Uptane::Version(1));
+    package_manager_ = PackageManagerFactory::makePackageManager(config_.pacman, config_.bootloader, storage_, nullptr);
+
+    secondary_interface_ = Uptane::IpUptaneSecondary::connectAndCreate("127.0.0.1", link_->port(),
+                                                                       VerificationType::kFull);
+    if (secondary_interface_ == nullptr) {
+      throw std::runtime_error("Failed to connect to the Secondary");
+    }
+    std::dynamic_pointer_cast<Uptane::IpUptaneSecondary>(secondary_interface_)->setUploadCompression(compress);
+    secondary_interface_->init(SecondaryProviderBuilder::Build(config_, storage_, package_manager_));
+  }
+
+  ~Benchmark() {
+    secondary_interface_.reset();
+    link_.reset();
+    server_.stop();
+    server_thread_.join();
+  }
+  Benchmark(const Benchmark &) = delete;
+  Benchmark(Benchmark &&) = delete;
+  Benchmark &operator=(const Benchmark &) = delete;
+  Benchmark &operator=(Benchmark &&) = delete;
+
+  /* A new update of the Secondary, with an image of the given size, signed
+   * and stored on the Primary as if it had been downloaded. */
+  Uptane::Target addUpdate(size_t image_size) {
+    const std::string name = "firmware-" + std::to_string(updates_++) + ".bin";
+    const boost::filesystem::path image = repo_dir_ / name;
+    Utils::writeFile(image, benchmarkData(image_size));
+    const std::string hwid = secondary_->hwID().ToString();
+    repo_.addImage(image, name, hwid);
+    repo_.addTarget(name, hwid, secondary_->serial().ToString());
+    repo_.signTargets();
+
+    const std::string director_targets = Utils::readFile(director_dir_ / "targets.json");
+    storage_->storeNonRoot(director_targets, Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+    storage_->storeNonRoot(Utils::readFile(image_dir_ / "timestamp.json"), Uptane::RepositoryType::Image(),
+                           Uptane::Role::Timestamp());
+    storage_->storeNonRoot(Utils::readFile(image_dir_ / "snapshot.json"), Uptane::RepositoryType::Image(),
+                           Uptane::Role::Snapshot());
+    storage_->storeNonRoot(Utils::readFile(image_dir_ / "targets.json"), Uptane::RepositoryType::Image(),
+                           Uptane::Role::Targets());
+
+    const auto targets = Uptane::Targets(Utils::parseJSON(director_targets))
+                             .getTargets(secondary_->serial(), secondary_->hwID());
+    if (targets.size() != 1) {
+      throw std::runtime_error("Expected one target for the Secondary, got " + std::to_string(targets.size()));
+    }
+    auto file = package_manager_->createTargetFile(targets[0]);
+    const std::string content = Utils::readFile(image);
+    file.write(content.data(), static_cast<std::streamsize>(content.size()));
+    file.close();
+    return targets[0];
+  }
+
+  SecondaryInterface &secondary() { return *secondary_interface_; }
+  const EmulatedLink &link() const { return *link_; }
+
+ private:
+  static std::shared_ptr<AktualizrSecondaryFile> makeSecondary(const boost::filesystem::path &storage_dir) {
+    AktualizrSecondaryConfig config;
+    config.pacman.type = PACKAGE_MANAGER_NONE;
+    config.uptane.verification_type = VerificationType::kFull;
+    config.uptane.key_type = KeyType::kED25519;
+    config.storage.path = storage_dir;
+    return std::make_shared<AktualizrSecondaryFile>(config);
+  }
+
+  TemporaryDirectory secondary_dir_;
+  std::shared_ptr<AktualizrSecondaryFile> secondary_{makeSecondary(secondary_dir_.Path())};
+  SecondaryTcpServer server_{*secondary_, "", 0};
+  std::thread server_thread_;
+  std::unique_ptr<EmulatedLink> link_;
+
+  TemporaryDirectory repo_dir_;
+  boost::filesystem::path director_dir_{repo_dir_ / "repo/director"};
+  boost::filesystem::path image_dir_{repo_dir_ / "repo/repo"};
+  UptaneRepo repo_{repo_dir_.Path(), "", ""};
+  unsigned int updates_{0};
+
+  TemporaryDirectory primary_dir_;
+  Config config_;
+  std::shared_ptr<INvStorage> storage_;
+  std::shared_ptr<PackageManagerInterface> package_manager_;
+  SecondaryInterface::Ptr secondary_interface_;
+};
+
+// Seconds taken and CPU time spent by one call
+struct Sample {
+  double seconds{0};
+  CpuTimes cpu{};
+};
+
+template <typename F>
+Sample measure(F &&call) {
+  const CpuTimes cpu_start = sampleCpu();
+  const auto start = std::chrono::steady_clock::now();
+  call();
+  Sample sample;
+  sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  const CpuTimes cpu_end = sampleCpu();
+  for (size_t side = 0; side < kSides; ++side) {
+    // Threads that ended during the call take their CPU time with them
+    sample.cpu[side] = std::max(0., cpu_end[side] - cpu_start[side]);
+  }
+  return sample;
+}
+
+Json::Value report(const LinkParameters &link_params, size_t image_size, const std::vector<Sample> &metadata,
+                   const std::vector<Sample> &firmware, uint64_t segments_lost) {
+  Json::Value result;
+  result["link"]["bandwidth_mbit"] = link_params.bandwidth / 1e6;
+  result["link"]["rtt_ms"] = std::chrono::duration<double, std::milli>(link_params.rtt).count();
+  result["link"]["loss"] = link_params.loss;
+  result["link"]["segments_lost"] = static_cast<Json::UInt64>(segments_lost);
+  result["image_size"] = static_cast<Json::UInt64>(image_size);
+
+  std::vector<double> latencies;
+  for (const auto &sample : metadata) {
+    latencies.push_back(sample.seconds * 1e3);
+  }
+  result["put_metadata_ms"] = summary(latencies);
+
+  std::vector<double> throughputs;
+  CpuTimes cpu{};
+  double bytes = 0;
+  for (const auto &sample : firmware) {
+    throughputs.push_back(static_cast<double>(image_size) / sample.seconds / 1e6);
+    for (size_t side = 0; side < kSides; ++side) {
+      cpu[side] += sample.cpu[side];
+    }
+    bytes += static_cast<double>(image_size);
+  }
+  result["send_firmware_mb_per_s"] = summary(throughputs);
+  for (size_t side = 0; side < kSides; ++side) {
+    result["send_firmware_cpu_ns_per_byte"][kSideNames[side]] = bytes > 0 ? cpu[side] * 1e9 / bytes : 0;
+  }
+  return result;
+}
+
+void printReport(const Json::Value &result) {
+  const Json::Value &link = result["link"];
+  std::cout << "Link: " << link["bandwidth_mbit"].asDouble() << " Mbit/s, " << link["rtt_ms"].asDouble()
+            << " ms RTT, " << link["loss"].asDouble() * 100 << "% loss (" << link["segments_lost"].asUInt64()
+            << " segments lost)\n";
+  std::cout << std::fixed << std::setprecision(2);
+  const Json::Value &metadata = result["put_metadata_ms"];
+  std::cout << "putMetadata: " << metadata["p50"].asDouble() << " ms p50, " << metadata["p95"].asDouble()
+            << " ms p95, " << metadata["max"].asDouble() << " ms max\n";
+  const Json::Value &firmware = result["send_firmware_mb_per_s"];
+  std::cout << "sendFirmware of " << result["image_size"].asUInt64() << " bytes: " << firmware["p50"].asDouble()
+            << " MB/s p50, " << firmware["p95"].asDouble() << " MB/s p95\n";
+  std::cout << "CPU time per byte:";
+  for (const char *side : kSideNames) {
+    std::cout << " " << result["send_firmware_cpu_ns_per_byte"][side].asDouble() << " ns " << side;
+  }
+  std::cout << "\n" << std::defaultfloat;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  po::options_description desc("aktualizr-secondary-transfer-benchmark command line options");
+  // clang-format off
+  desc.add_options()
+    ("help,h", "print usage")
+    ("bandwidth-mbit", po::value<double>()->default_value(100), "bandwidth of the link in Mbit/s, 0 for unlimited")
+    ("rtt-ms", po::value<double>()->default_value(1), "round trip time of the link in milliseconds")
+    ("loss", po::value<double>()->default_value(0), "probability that a segment is lost")
+    ("retransmit-ms", po::value<double>()->default_value(200), "delay of the retransmission of a lost segment")
+    ("image-size", po::value<size_t>()->default_value(16U << 20U), "size of the image in bytes")
+    ("iterations,n", po::value<unsigned int>()->default_value(3), "number of updates sent")
+    ("compress", "propose to compress the upload")
+    ("loglevel", po::value<int>()->default_value(3), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
+    ("report", po::value<boost::filesystem::path>(), "write the results to this file, as JSON");
+  // clang-format on
+
+  po::variables_map vm;
+  try {
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cerr << e.what() << "\n" << desc;
+    return EXIT_FAILURE;
+  }
+  if (vm.count("help") != 0) {
+    std::cout << desc;
+    return EXIT_SUCCESS;
+  }
+
+  logger_init();
+  logger_set_threshold(static_cast<boost::log::trivial::severity_level>(vm["loglevel"].as<int>()));
+  pthread_setname_np(pthread_self(), kSideNames[kPrimary]);
+
+  LinkParameters link_params;
+  link_params.bandwidth = vm["bandwidth-mbit"].as<double>() * 1e6;
+  link_params.rtt = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::duration<double, std::milli>(vm["rtt-ms"].as<double>()));
+  link_params.loss = vm["loss"].as<double>();
+  link_params.retransmit_timeout = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::duration<double, std::milli>(vm["retransmit-ms"].as<double>()));
+  const auto image_size = vm["image-size"].as<size_t>();
+
+  try {
+    Benchmark benchmark(link_params, vm.count("compress") != 0);
+    std::vector<Sample> metadata;
+    std::vector<Sample> firmware;
+    for (unsigned int i = 0; i < vm["iterations"].as<unsigned int>(); ++i) {
+      const Uptane::Target target = benchmark.addUpdate(image_size);
+      data::InstallationResult result;
+      metadata.push_back(measure([&]() { result = benchmark.secondary().putMetadata(target); }));
+      if (!result.isSuccess()) {
+        throw std::runtime_error("putMetadata failed: " + result.description);
+      }
+      firmware.push_back(measure([&]() { result = benchmark.secondary().sendFirmware(target, nullptr); }));
+      if (!result.isSuccess()) {
+        throw std::runtime_error("sendFirmware failed: " + result.description);
+      }
+      result = benchmark.secondary().install(target, nullptr);
+      if (!result.isSuccess()) {
+        throw std::runtime_error("install failed: " + result.description);
+      }
+    }
+
+    const Json::Value result =
+        report(link_params, image_size, metadata, firmware, benchmark.link().segmentsLost());
+    printReport(result);
+    if (vm.count("report") != 0) {
+      Utils::writeFile(vm["report"].as<boost::filesystem::path>(), Utils::jsonToStr(result) + "\n");
+    }
+  } catch (const std::exception &e) {
+    LOG_ERROR << e.what();
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
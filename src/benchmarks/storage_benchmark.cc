@@ -0,0 +1,100 @@
+#include <benchmark/benchmark.h>
+
+#include "benchmark_data.h"
+#include "libaktualizr/config.h"
+#include "storage/invstorage.h"
+#include "utilities/utils.h"
+
+/*
+ * The storage is created under TMPDIR, so point it at a directory on the
+ * device's own storage to measure that instead of tmpfs.
+ */
+
+namespace {
+
+Uptane::Target ecuTarget(int64_t version) {
+  const Uptane::EcuMap ecus{{Uptane::EcuSerial("ecu"), Uptane::HardwareIdentifier("hardware")}};
+  return Uptane::Target("firmware-" + std::to_string(version) + ".bin", ecus,
+                        {Hash(Hash::Type::kSha256, std::string(64, 'a'))}, 1048576, "");
+}
+
+class StorageFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State &state) override {
+    (void)state;
+    temp_dir_ = std_::make_unique<TemporaryDirectory>();
+    StorageConfig config;
+    config.path = temp_dir_->Path();
+    storage_ = INvStorage::newStorage(config);
+  }
+
+  void TearDown(const benchmark::State &state) override {
+    (void)state;
+    storage_.reset();
+    temp_dir_.reset();
+  }
+
+ protected:
+  std::unique_ptr<TemporaryDirectory> temp_dir_;
+  std::shared_ptr<INvStorage> storage_;
+};
+
+BENCHMARK_DEFINE_F(StorageFixture, StoreTargets)(benchmark::State &state) {
+  const std::string metadata = Utils::jsonToCanonicalStr(targetsMetadata(state.range(0)));
+  for (auto _ : state) {
+    storage_->storeNonRoot(metadata, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * metadata.size()));
+}
+BENCHMARK_REGISTER_F(StorageFixture, StoreTargets)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000)
+    ->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_DEFINE_F(StorageFixture, LoadTargets)(benchmark::State &state) {
+  const std::string metadata = Utils::jsonToCanonicalStr(targetsMetadata(state.range(0)));
+  storage_->storeNonRoot(metadata, Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  std::string loaded;
+  for (auto _ : state) {
+    if (!storage_->loadNonRoot(&loaded, Uptane::RepositoryType::Image(), Uptane::Role::Targets())) {
+      state.SkipWithError("The metadata could not be loaded");
+      break;
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * metadata.size()));
+}
+BENCHMARK_REGISTER_F(StorageFixture, LoadTargets)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000)
+    ->Unit(benchmark::kMicrosecond);
+
+// One installation on an ECU, with `range` versions already in its history
+BENCHMARK_DEFINE_F(StorageFixture, SaveInstalledVersion)(benchmark::State &state) {
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    storage_->saveInstalledVersion("ecu", ecuTarget(i), InstalledVersionUpdateMode::kCurrent, "");
+  }
+  const Uptane::Target next = ecuTarget(state.range(0));
+  for (auto _ : state) {
+    storage_->saveInstalledVersion("ecu", next, InstalledVersionUpdateMode::kPending, "");
+    storage_->saveInstalledVersion("ecu", next, InstalledVersionUpdateMode::kCurrent, "");
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(StorageFixture, SaveInstalledVersion)->Arg(1)->Arg(100)->Unit(benchmark::kMicrosecond);
+
+BENCHMARK_DEFINE_F(StorageFixture, LoadInstalledVersions)(benchmark::State &state) {
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    storage_->saveInstalledVersion("ecu", ecuTarget(i), InstalledVersionUpdateMode::kCurrent, "");
+  }
+  boost::optional<Uptane::Target> current;
+  for (auto _ : state) {
+    if (!storage_->loadInstalledVersions("ecu", &current, nullptr)) {
+      state.SkipWithError("The installed versions could not be loaded");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_REGISTER_F(StorageFixture, LoadInstalledVersions)->Arg(1)->Arg(100)->Unit(benchmark::kMicrosecond);
+
+}  // namespace
@@ -316,6 +316,55 @@ TEST_F(AktualizrCertProviderTest, DeviceCertParams) {
   ASSERT_EQ(openssl.lastStdOut(), str(boost::format("%1%: OK\n") % device_cred_path.certFileFullPath.string()));
 }
 
+/**
+ * Verifies provisioning of a list of devices in batch mode
+ *
+ * Checks actions:
+ *
+ * - [x] Generate the credentials of each device of the list
+ * - [x] Write them to a subdirectory of the local directory per device
+ * - [x] Report the throughput of the station
+ */
+
+TEST_F(AktualizrCertProviderTest, Batch) {
+  const std::vector<std::string> device_ids = {"device-1", "device-2", "device-3"};
+  const boost::filesystem::path batch_file = tmp_dir_ / "devices.txt";
+  Utils::writeFile(batch_file,
+                   std::string("# devices of the line\ndevice-1\n\ndevice-2  # the second one\ndevice-3\n"));
+  const boost::filesystem::path local_dir = tmp_dir_ / "out";
+
+  DeviceCredGenerator::ArgSet args;
+
+  args.fleetCA = test_args_.fleet_ca_cert;
+  args.fleetCAKey = test_args_.fleet_ca_private_key;
+  args.localDir = local_dir.string();
+  args.rsaBits = "1024";
+  args.batch = batch_file.string();
+  args.jobs = "2";
+  args.station = "eol-1";
+
+  device_cred_gen_.run(args);
+  ASSERT_EQ(device_cred_gen_.lastExitCode(), 0) << device_cred_gen_.lastStdErr();
+  EXPECT_NE(device_cred_gen_.lastStdOut().find("Station eol-1: provisioned 3 of 3 devices"), std::string::npos)
+      << device_cred_gen_.lastStdOut();
+
+  for (const auto& device_id : device_ids) {
+    DeviceCredGenerator::OutputPath device_cred_path((local_dir / device_id).string());
+    ASSERT_TRUE(boost::filesystem::exists(device_cred_path.privateKeyFileFullPath))
+        << device_cred_path.privateKeyFileFullPath;
+    ASSERT_TRUE(boost::filesystem::exists(device_cred_path.certFileFullPath)) << device_cred_path.certFileFullPath;
+
+    Cert cert(device_cred_path.certFileFullPath.string());
+    EXPECT_EQ(cert.getSubjectItemValue(NID_commonName), device_id);
+  }
+
+  // A device listed twice is rejected before anything is generated.
+  Utils::writeFile(batch_file, std::string("device-4\ndevice-4\n"));
+  device_cred_gen_.run(args);
+  EXPECT_EQ(device_cred_gen_.lastExitCode(), 1);
+  EXPECT_FALSE(boost::filesystem::exists(local_dir / "device-4"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -51,6 +51,9 @@ class DeviceCredGenerator : public Process {
     Param commonName{"--certificate-cn", this};
     Param rsaBits{"--bits", this};
     Param credentialFile{"--credentials", this};
+    Param batch{"--batch", this};
+    Param jobs{"--jobs", this};
+    Param station{"--station", this};
 
     Option provideRootCA{"--root-ca", this};
     Option provideServerURL{"--server-url", this};
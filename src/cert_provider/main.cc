@@ -1,7 +1,19 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <fstream>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -14,6 +26,7 @@
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
 #include "utilities/aktualizr_version.h"
+#include "utilities/executor.h"
 #include "utilities/utils.h"
 
 namespace bpo = boost::program_options;
@@ -51,7 +64,10 @@ bpo::variables_map parseOptions(int argc, char** argv) {
       ("server-url,u", "provide server URL file")
       ("local,l", bpo::value<boost::filesystem::path>(), "local directory to write credentials to")
       ("config,g", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory from which to get file names")
-      ("skip-checks,s", "skip strict host key checking for ssh/scp commands");
+      ("skip-checks,s", "skip strict host key checking for ssh/scp commands")
+      ("batch,b", bpo::value<boost::filesystem::path>(), "file with the devices to provision, one per line as: device-id [[user@]host [port]] (conflicts with --certificate-cn and --target)")
+      ("jobs,j", bpo::value<int>(), "number of device credentials to generate at once in batch mode (default: number of CPUs)")
+      ("station", bpo::value<std::string>(), "name of the station to report the batch throughput for (default: host name)");
   // clang-format on
 
   bpo::variables_map vm;
@@ -88,8 +104,17 @@ bpo::variables_map parseOptions(int argc, char** argv) {
 
 class SSHRunner {
  public:
-  SSHRunner(std::string target, const bool skip_checks, const int port = 22)
-      : target_(std::move(target)), skip_checks_(skip_checks), port_(port) {}
+  /**
+   * With a control_path, the commands to one target share a single connection,
+   * opened by the first of them and kept until closeMaster().
+   */
+  SSHRunner(std::string target, const bool skip_checks, const int port = 22, std::string control_path = "",
+            const bool verbose = true)
+      : target_(std::move(target)),
+        skip_checks_(skip_checks),
+        port_(port),
+        control_path_(std::move(control_path)),
+        verbose_(verbose) {}
 
   void runCmd(const std::string& cmd) const {
     std::ostringstream prefix;
@@ -98,13 +123,12 @@ class SSHRunner {
     if (port_ != 22) {
       prefix << "-p " << port_ << " ";
     }
-    if (skip_checks_) {
-      prefix << "-o StrictHostKeyChecking=no ";
-    }
-    prefix << target_ << " ";
+    prefix << options() << target_ << " ";
 
     std::string fullCmd = prefix.str() + cmd;
-    std::cout << "Running " << fullCmd << std::endl;
+    if (verbose_) {
+      std::cout << "Running " << fullCmd << std::endl;
+    }
 
     int ret = system(fullCmd.c_str());
     if (ret != 0) {
@@ -112,33 +136,73 @@ class SSHRunner {
     }
   }
 
-  void transferFile(const boost::filesystem::path& inFile, const boost::filesystem::path& targetPath) {
-    // create parent directory
-    runCmd("mkdir -p " + targetPath.parent_path().string());
+  /** Copy each file to its path on the target, creating the directories at once first. */
+  void transferFiles(const std::vector<std::pair<boost::filesystem::path, boost::filesystem::path>>& files) const {
+    // create parent directories
+    std::set<std::string> dirs;
+    for (const auto& file : files) {
+      dirs.insert(file.second.parent_path().string());
+    }
+    std::string mkdir = "mkdir -p";
+    for (const auto& dir : dirs) {
+      mkdir += " " + dir;
+    }
+    runCmd(mkdir);
+
+    for (const auto& file : files) {
+      std::ostringstream prefix;
 
-    std::ostringstream prefix;
+      prefix << "scp ";
+      if (port_ != 22) {
+        prefix << "-P " << port_ << " ";
+      }
+      prefix << options();
+
+      std::string fullCmd = prefix.str() + file.first.string() + " " + target_ + ":" + file.second.string();
+      if (verbose_) {
+        std::cout << "Running " << fullCmd << std::endl;
+      }
 
-    prefix << "scp ";
+      int ret = system(fullCmd.c_str());
+      if (ret != 0) {
+        throw std::runtime_error("Error copying file on " + target_ + ": " + std::to_string(ret));
+      }
+    }
+  }
+
+  /** Close the shared connection, if any. */
+  void closeMaster() const {
+    if (control_path_.empty()) {
+      return;
+    }
+    std::ostringstream cmd;
+    cmd << "ssh ";
     if (port_ != 22) {
-      prefix << "-P " << port_ << " ";
+      cmd << "-p " << port_ << " ";
     }
-    if (skip_checks_) {
-      prefix << "-o StrictHostKeyChecking=no ";
+    cmd << options() << "-O exit " << target_ << " >/dev/null 2>&1";
+    if (system(cmd.str().c_str()) != 0) {
+      LOG_DEBUG << "No shared connection to close for " << target_;
     }
+  }
 
-    std::string fullCmd = prefix.str() + inFile.string() + " " + target_ + ":" + targetPath.string();
-    std::cout << "Running " << fullCmd << std::endl;
-
-    int ret = system(fullCmd.c_str());
-    if (ret != 0) {
-      throw std::runtime_error("Error copying file on " + target_ + ": " + std::to_string(ret));
+ private:
+  std::string options() const {
+    std::string opts;
+    if (skip_checks_) {
+      opts += "-o StrictHostKeyChecking=no ";
     }
+    if (!control_path_.empty()) {
+      opts += "-o ControlMaster=auto -o ControlPath=" + control_path_ + " -o ControlPersist=60 ";
+    }
+    return opts;
   }
 
- private:
   std::string target_;
   bool skip_checks_;
   int port_;
+  std::string control_path_;
+  bool verbose_;
 };
 
 void copyLocal(const boost::filesystem::path& src, const boost::filesystem::path& dest) {
@@ -151,6 +215,295 @@ void copyLocal(const boost::filesystem::path& src, const boost::filesystem::path
   boost::filesystem::copy_file(src, dest);
 }
 
+struct Credentials {
+  std::string pkey;
+  std::string cert;
+  std::string ca;
+};
+
+// Parameters of the device certificates signed with the fleet CA
+struct CertParams {
+  boost::filesystem::path fleet_ca_path;
+  boost::filesystem::path fleet_ca_key_path;
+  int rsa_bits{2048};
+  int cert_days{365};
+  std::string c;
+  std::string st;
+  std::string o;
+};
+
+// The files to write, relative to the local directory or on the target
+struct OutputFiles {
+  boost::filesystem::path directory{"/var/sota/import"};
+  utils::BasedPath pkey_file{"pkey.pem"};
+  utils::BasedPath cert_file{"client.pem"};
+  utils::BasedPath ca_file{"root.crt"};
+  utils::BasedPath url_file{"gateway.url"};
+  bool provide_ca{false};
+  bool provide_url{false};
+};
+
+// The credentials of one device in temporary files, ready to be copied
+class CredentialFiles {
+ public:
+  CredentialFiles(const OutputFiles& files, const Credentials& creds, const std::string& server_url)
+      : files_(files),
+        pkey_(files.pkey_file.get("").filename().string()),
+        cert_(files.cert_file.get("").filename().string()),
+        ca_(files.ca_file.get("").filename().string()),
+        url_(files.url_file.get("").filename().string()) {
+    pkey_.PutContents(creds.pkey);
+    cert_.PutContents(creds.cert);
+    if (files.provide_ca) {
+      ca_.PutContents(creds.ca);
+    }
+    if (files.provide_url) {
+      url_.PutContents(server_url);
+    }
+  }
+
+  void writeLocal(const boost::filesystem::path& local_dir, const bool verbose) const {
+    auto pkey_file_path = local_dir / files_.pkey_file.get(files_.directory);
+    if (verbose) {
+      std::cout << "Writing the generated client private key to " << pkey_file_path << " ...\n";
+    }
+    copyLocal(pkey_.PathString(), pkey_file_path);
+
+    auto cert_file_path = local_dir / files_.cert_file.get(files_.directory);
+    if (verbose) {
+      std::cout << "Writing the generated and signed client certificate to " << cert_file_path << " ...\n";
+    }
+    copyLocal(cert_.PathString(), cert_file_path);
+
+    if (files_.provide_ca) {
+      auto root_ca_file = local_dir / files_.ca_file.get(files_.directory);
+      if (verbose) {
+        std::cout << "Writing the server root CA to " << root_ca_file << " ...\n";
+      }
+      copyLocal(ca_.PathString(), root_ca_file);
+    }
+    if (files_.provide_url) {
+      auto gtw_url_file = local_dir / files_.url_file.get(files_.directory);
+      if (verbose) {
+        std::cout << "Writing the gateway URL to " << gtw_url_file << " ...\n";
+      }
+      copyLocal(url_.PathString(), gtw_url_file);
+    }
+  }
+
+  void copyToTarget(const SSHRunner& ssh) const {
+    std::vector<std::pair<boost::filesystem::path, boost::filesystem::path>> transfers = {
+        {pkey_.Path(), files_.pkey_file.get(files_.directory)}, {cert_.Path(), files_.cert_file.get(files_.directory)}};
+    if (files_.provide_ca) {
+      transfers.emplace_back(ca_.Path(), files_.ca_file.get(files_.directory));
+    }
+    if (files_.provide_url) {
+      transfers.emplace_back(url_.Path(), files_.url_file.get(files_.directory));
+    }
+    ssh.transferFiles(transfers);
+  }
+
+ private:
+  const OutputFiles& files_;
+  TemporaryFile pkey_;
+  TemporaryFile cert_;
+  TemporaryFile ca_;
+  TemporaryFile url_;
+};
+
+// Register the device with the shared credentials and get its own from the server
+Credentials provisionSharedCred(const Bootstrap& boot, const std::string& server_url, const std::string& device_id) {
+  HttpClient http;
+  Json::Value data;
+  data["deviceId"] = device_id;
+  data["ttl"] = 36000;
+
+  http.setCerts(boot.getCa(), CryptoSource::kFile, boot.getCert(), CryptoSource::kFile, boot.getPkey(),
+                CryptoSource::kFile);
+  HttpResponse response = http.post(server_url + "/devices", data);
+  if (!response.isOk()) {
+    Json::Value resp_code = response.getJson()["code"];
+    if (resp_code.isString() && resp_code.asString() == "device_already_registered") {
+      throw std::runtime_error("Device ID " + device_id + " is occupied.");
+    }
+    throw std::runtime_error("Provisioning failed, response: " + response.body);
+  }
+
+  Credentials creds;
+  StructGuard<BIO> device_p12(BIO_new_mem_buf(response.body.c_str(), static_cast<int>(response.body.size())),
+                              BIO_vfree);
+  if (!Crypto::parseP12(device_p12.get(), "", &creds.pkey, &creds.cert, &creds.ca)) {
+    throw std::runtime_error("Unable to parse p12 file received from server.");
+  }
+  return creds;
+}
+
+// Generate a key for the device and a certificate signed with the fleet CA
+Credentials generateFleetCred(const CertParams& params, const std::string& device_id) {
+  StructGuard<X509> certificate =
+      Crypto::generateCert(params.rsa_bits, params.cert_days, params.c, params.st, params.o, device_id);
+  Crypto::signCert(params.fleet_ca_path.native(), params.fleet_ca_key_path.native(), certificate.get());
+  Credentials creds;
+  Crypto::serializeCert(&creds.pkey, &creds.cert, certificate.get());
+  return creds;
+}
+
+// Read server root CA from server_ca.pem in archive if found (to support
+// community edition use case). Otherwise, default to the old version of
+// expecting it to be in the p12.
+std::string readServerCa(const boost::filesystem::path& credentials_path) {
+  std::string ca = Bootstrap::readServerCa(credentials_path);
+  if (ca.empty()) {
+    Bootstrap boot(credentials_path, "");
+    ca = boot.getCa();
+    std::cout << "Server root CA read from autoprov_credentials.p12 in zipped archive.\n";
+  } else {
+    std::cout << "Server root CA read from server_ca.pem in zipped archive.\n";
+  }
+  return ca;
+}
+
+struct BatchDevice {
+  std::string device_id;
+  // [user@]host, or empty to only write the credentials locally
+  std::string target;
+  int port;
+};
+
+std::vector<BatchDevice> readBatch(const boost::filesystem::path& batch_path, const int default_port) {
+  std::ifstream batch(batch_path.string());
+  if (!batch) {
+    throw std::runtime_error("Unable to read the device list " + batch_path.string());
+  }
+
+  std::vector<BatchDevice> devices;
+  std::set<std::string> device_ids;
+  std::string line;
+  for (int line_no = 1; std::getline(batch, line); ++line_no) {
+    std::istringstream fields(line.substr(0, line.find('#')));
+    BatchDevice device{"", "", default_port};
+    if (!(fields >> device.device_id)) {
+      continue;
+    }
+    const std::string where = batch_path.string() + ":" + std::to_string(line_no);
+    fields >> device.target;
+    std::string port;
+    if (fields >> port) {
+      try {
+        device.port = std::stoi(port);
+      } catch (const std::exception&) {
+        throw std::runtime_error(where + ": invalid port " + port);
+      }
+    }
+    std::string extra;
+    if (fields >> extra) {
+      throw std::runtime_error(where + ": unexpected " + extra);
+    }
+    if (!device_ids.insert(device.device_id).second) {
+      throw std::runtime_error(where + ": duplicate device ID " + device.device_id);
+    }
+    devices.push_back(std::move(device));
+  }
+  return devices;
+}
+
+/**
+ * Provision the devices of the list, generating (or requesting) their
+ * credentials on a pool of jobs threads while the ones already generated are
+ * written and copied. Copies to the same target are made one after the other
+ * over a single SSH connection.
+ * @return the number of devices provisioned
+ */
+size_t provisionBatch(const std::vector<BatchDevice>& devices, const OutputFiles& files, const std::string& server_url,
+                      const std::string& ca, const Bootstrap* boot, const CertParams& cert_params,
+                      const boost::filesystem::path& local_dir, const bool skip_checks, const size_t jobs) {
+  using clock = std::chrono::steady_clock;
+  struct Generated {
+    Credentials creds;
+    double seconds;
+  };
+
+  TemporaryDirectory control_dir("ssh");
+  const std::string control_path = (control_dir / "%C").string();
+  std::map<std::string, std::mutex> target_mutexes;
+  for (const auto& device : devices) {
+    if (!device.target.empty()) {
+      target_mutexes[device.target + ":" + std::to_string(device.port)];
+    }
+  }
+
+  std::mutex output_mutex;
+  size_t provisioned = 0;
+  auto report = [&output_mutex, &provisioned](const BatchDevice& device, const bool ok, const std::string& result) {
+    std::lock_guard<std::mutex> guard(output_mutex);
+    std::cout << device.device_id << ": " << (ok ? "ok" : "failed") << " " << result << std::endl;
+    if (ok) {
+      ++provisioned;
+    }
+  };
+
+  {
+    ThreadPool copy_pool("cert-copy", Executor::kIoThreads);
+    ThreadPool generate_pool("cert-generate", jobs);
+    std::vector<std::future<Generated>> generated;
+    generated.reserve(devices.size());
+    for (const auto& device : devices) {
+      generated.push_back(generate_pool.submit([&device, &cert_params, &server_url, &ca, boot]() {
+        const auto start = clock::now();
+        Generated result;
+        if (boot != nullptr) {
+          result.creds = provisionSharedCred(*boot, server_url, device.device_id);
+        } else {
+          result.creds = generateFleetCred(cert_params, device.device_id);
+          result.creds.ca = ca;
+        }
+        result.seconds = std::chrono::duration<double>(clock::now() - start).count();
+        return result;
+      }));
+    }
+
+    // Generated in order, so this waits for each device about when it is ready.
+    for (size_t i = 0; i < devices.size(); ++i) {
+      const BatchDevice& device = devices[i];
+      auto result = std::make_shared<Generated>();
+      try {
+        *result = generated[i].get();
+      } catch (const std::exception& exc) {
+        report(device, false, exc.what());
+        continue;
+      }
+      copy_pool.submit([&, result]() {
+        const auto start = clock::now();
+        try {
+          CredentialFiles cred_files(files, result->creds, server_url);
+          if (!local_dir.empty()) {
+            cred_files.writeLocal(local_dir / device.device_id, false);
+          }
+          if (!device.target.empty()) {
+            std::lock_guard<std::mutex> guard(target_mutexes.at(device.target + ":" + std::to_string(device.port)));
+            cred_files.copyToTarget(SSHRunner{device.target, skip_checks, device.port, control_path, false});
+          }
+        } catch (const std::exception& exc) {
+          report(device, false, exc.what());
+          return;
+        }
+        std::ostringstream timings;
+        timings << std::fixed << std::setprecision(2) << "(credentials " << result->seconds << " s, copy "
+                << std::chrono::duration<double>(clock::now() - start).count() << " s)";
+        report(device, true, timings.str());
+      });
+    }
+    // The pools wait for their tasks when they are destroyed.
+  }
+
+  for (const auto& device : devices) {
+    if (!device.target.empty()) {
+      SSHRunner{device.target, skip_checks, device.port, control_path, false}.closeMaster();
+    }
+  }
+  return provisioned;
+}
+
 int main(int argc, char* argv[]) {
   int exit_code = EXIT_FAILURE;
 
@@ -168,8 +521,9 @@ int main(int argc, char* argv[]) {
     if (commandline_map.count("port") != 0) {
       port = (commandline_map["port"].as<int>());
     }
-    const bool provide_ca = commandline_map.count("root-ca") != 0;
-    const bool provide_url = commandline_map.count("server-url") != 0;
+    OutputFiles files;
+    files.provide_ca = commandline_map.count("root-ca") != 0;
+    files.provide_url = commandline_map.count("server-url") != 0;
     boost::filesystem::path local_dir;
     if (commandline_map.count("local") != 0) {
       local_dir = commandline_map["local"].as<boost::filesystem::path>();
@@ -179,18 +533,21 @@ int main(int argc, char* argv[]) {
       config_path = commandline_map["config"].as<std::vector<boost::filesystem::path>>();
     }
     const bool skip_checks = commandline_map.count("skip-checks") != 0;
+    boost::filesystem::path batch_path;
+    if (commandline_map.count("batch") != 0) {
+      batch_path = commandline_map["batch"].as<boost::filesystem::path>();
+    }
 
-    boost::filesystem::path fleet_ca_path = "";
+    CertParams cert_params;
     if (commandline_map.count("fleet-ca") != 0) {
-      fleet_ca_path = commandline_map["fleet-ca"].as<boost::filesystem::path>();
+      cert_params.fleet_ca_path = commandline_map["fleet-ca"].as<boost::filesystem::path>();
     }
 
-    boost::filesystem::path fleet_ca_key_path = "";
     if (commandline_map.count("fleet-ca-key") != 0) {
-      fleet_ca_key_path = commandline_map["fleet-ca-key"].as<boost::filesystem::path>();
+      cert_params.fleet_ca_key_path = commandline_map["fleet-ca-key"].as<boost::filesystem::path>();
     }
 
-    if (fleet_ca_path.empty() != fleet_ca_key_path.empty()) {
+    if (cert_params.fleet_ca_path.empty() != cert_params.fleet_ca_key_path.empty()) {
       std::cerr << "fleet-ca and fleet-ca-key options should be used together" << std::endl;
       return EXIT_FAILURE;
     }
@@ -200,18 +557,23 @@ int main(int argc, char* argv[]) {
       return EXIT_FAILURE;
     }
 
+    if (!batch_path.empty() && (!target.empty() || commandline_map.count("certificate-cn") != 0)) {
+      std::cerr << "Batch (--batch) option cannot be used together with --target or --certificate-cn" << std::endl;
+      return EXIT_FAILURE;
+    }
+
     boost::filesystem::path credentials_path = "";
     if (commandline_map.count("credentials") != 0) {
       credentials_path = commandline_map["credentials"].as<boost::filesystem::path>();
     }
 
-    if (local_dir.empty() && target.empty()) {
+    if (local_dir.empty() && target.empty() && batch_path.empty()) {
       std::cerr << "Please provide a local directory and/or target to output the generated files to" << std::endl;
       return EXIT_FAILURE;
     }
 
     std::string serverUrl;
-    if ((fleet_ca_path.empty() || provide_ca || provide_url) && credentials_path.empty()) {
+    if ((cert_params.fleet_ca_path.empty() || files.provide_ca || files.provide_url) && credentials_path.empty()) {
       std::cerr
           << "Error: missing -c/--credentials parameters which is mandatory if the fleet CA is not specified or an "
              "output of the root CA or a gateway URL is requested"
@@ -221,8 +583,24 @@ int main(int argc, char* argv[]) {
       serverUrl = Bootstrap::readServerUrl(credentials_path);
     }
 
+    std::vector<BatchDevice> batch;
     std::string device_id;
-    if (commandline_map.count("certificate-cn") != 0) {
+    if (!batch_path.empty()) {
+      batch = readBatch(batch_path, port);
+      if (batch.empty()) {
+        std::cerr << "No devices in the device list " << batch_path << std::endl;
+        return EXIT_FAILURE;
+      }
+      if (local_dir.empty()) {
+        for (const auto& device : batch) {
+          if (device.target.empty()) {
+            std::cerr << "Please provide a local directory and/or target to output the generated files of "
+                      << device.device_id << " to" << std::endl;
+            return EXIT_FAILURE;
+          }
+        }
+      }
+    } else if (commandline_map.count("certificate-cn") != 0) {
       device_id = (commandline_map["certificate-cn"].as<std::string>());
       if (device_id.empty()) {
         std::cerr << "Common name (device ID, --certificate-cn) can't be empty" << std::endl;
@@ -233,176 +611,140 @@ int main(int argc, char* argv[]) {
       std::cout << "Random device ID is " << device_id << "\n";
     }
 
-    boost::filesystem::path directory = "/var/sota/import";
-    utils::BasedPath pkey_file = utils::BasedPath("pkey.pem");
-    utils::BasedPath cert_file = utils::BasedPath("client.pem");
-    utils::BasedPath ca_file = utils::BasedPath("root.crt");
-    utils::BasedPath url_file = utils::BasedPath("gateway.url");
     if (!config_path.empty()) {
       Config config(config_path);
 
       // try first import base path and then storage path
       if (!config.import.base_path.empty()) {
-        directory = config.import.base_path;
+        files.directory = config.import.base_path;
       } else if (!config.storage.path.empty()) {
-        directory = config.storage.path;
+        files.directory = config.storage.path;
       }
 
       if (!config.import.tls_pkey_path.empty()) {
-        pkey_file = config.import.tls_pkey_path;
+        files.pkey_file = config.import.tls_pkey_path;
       } else {
-        pkey_file = config.storage.tls_pkey_path;
+        files.pkey_file = config.storage.tls_pkey_path;
       }
 
       if (!config.import.tls_clientcert_path.empty()) {
-        cert_file = config.import.tls_clientcert_path;
+        files.cert_file = config.import.tls_clientcert_path;
       } else {
-        cert_file = config.storage.tls_clientcert_path;
+        files.cert_file = config.storage.tls_clientcert_path;
       }
-      if (provide_ca) {
+      if (files.provide_ca) {
         if (!config.import.tls_cacert_path.empty()) {
-          ca_file = config.import.tls_cacert_path;
+          files.ca_file = config.import.tls_cacert_path;
         } else {
-          ca_file = config.storage.tls_cacert_path;
+          files.ca_file = config.storage.tls_cacert_path;
         }
       }
-      if (provide_url && !config.tls.server_url_path.empty()) {
-        url_file = config.tls.server_url_path;
+      if (files.provide_url && !config.tls.server_url_path.empty()) {
+        files.url_file = config.tls.server_url_path;
       }
     }
 
     if (!commandline_map["directory"].empty()) {
-      directory = commandline_map["directory"].as<boost::filesystem::path>();
+      files.directory = commandline_map["directory"].as<boost::filesystem::path>();
     }
 
-    TemporaryFile tmp_pkey_file(pkey_file.get("").filename().string());
-    TemporaryFile tmp_cert_file(cert_file.get("").filename().string());
-    TemporaryFile tmp_ca_file(ca_file.get("").filename().string());
-    TemporaryFile tmp_url_file(url_file.get("").filename().string());
-
-    std::string pkey;
-    std::string cert;
-    std::string ca;
-
-    if (fleet_ca_path.empty()) {  // no fleet CA => provision with shared credentials
-      Bootstrap boot(credentials_path, "");
-      HttpClient http;
-      Json::Value data;
-      data["deviceId"] = device_id;
-      data["ttl"] = 36000;
-
-      std::cout << "Provisioning against server...\n";
-      http.setCerts(boot.getCa(), CryptoSource::kFile, boot.getCert(), CryptoSource::kFile, boot.getPkey(),
-                    CryptoSource::kFile);
-      HttpResponse response = http.post(serverUrl + "/devices", data);
-      if (!response.isOk()) {
-        Json::Value resp_code = response.getJson()["code"];
-        if (resp_code.isString() && resp_code.asString() == "device_already_registered") {
-          std::cout << "Device ID" << device_id << "is occupied.\n";
-          return EXIT_FAILURE;
-        }
-        std::cout << "Provisioning failed, response: " << response.body << "\n";
-        return EXIT_FAILURE;
-      }
-      std::cout << "...success\n";
-
-      StructGuard<BIO> device_p12(BIO_new_mem_buf(response.body.c_str(), static_cast<int>(response.body.size())),
-                                  BIO_vfree);
-      if (!Crypto::parseP12(device_p12.get(), "", &pkey, &cert, &ca)) {
-        std::cout << "Unable to parse p12 file received from server.\n";
-        return EXIT_FAILURE;
-      }
-    } else {  // fleet CA set => generate and sign a new certificate
-      int rsa_bits = 2048;
+    if (!cert_params.fleet_ca_path.empty()) {
       if (commandline_map.count("bits") != 0) {
-        rsa_bits = (commandline_map["bits"].as<int>());
+        cert_params.rsa_bits = (commandline_map["bits"].as<int>());
       }
 
-      int cert_days = 365;
       if (commandline_map.count("days") != 0) {
-        cert_days = (commandline_map["days"].as<int>());
+        cert_params.cert_days = (commandline_map["days"].as<int>());
       }
 
-      std::string newcert_c;
       if (commandline_map.count("certificate-c") != 0) {
-        newcert_c = (commandline_map["certificate-c"].as<std::string>());
-        if (newcert_c.length() != 2) {
+        cert_params.c = (commandline_map["certificate-c"].as<std::string>());
+        if (cert_params.c.length() != 2) {
           std::cerr << "Country code (--certificate-c) should be 2 characters long" << std::endl;
           return EXIT_FAILURE;
         }
       }
 
-      std::string newcert_st;
       if (commandline_map.count("certificate-st") != 0) {
-        newcert_st = (commandline_map["certificate-st"].as<std::string>());
-        if (newcert_st.empty()) {
+        cert_params.st = (commandline_map["certificate-st"].as<std::string>());
+        if (cert_params.st.empty()) {
           std::cerr << "State name (--certificate-st) can't be empty" << std::endl;
           return EXIT_FAILURE;
         }
       }
 
-      std::string newcert_o;
       if (commandline_map.count("certificate-o") != 0) {
-        newcert_o = (commandline_map["certificate-o"].as<std::string>());
-        if (newcert_o.empty()) {
+        cert_params.o = (commandline_map["certificate-o"].as<std::string>());
+        if (cert_params.o.empty()) {
           std::cerr << "Organization name (--certificate-o) can't be empty" << std::endl;
           return EXIT_FAILURE;
         }
       }
+    }
 
-      StructGuard<X509> certificate =
-          Crypto::generateCert(rsa_bits, cert_days, newcert_c, newcert_st, newcert_o, device_id);
-      Crypto::signCert(fleet_ca_path.native(), fleet_ca_key_path.native(), certificate.get());
-      Crypto::serializeCert(&pkey, &cert, certificate.get());
-
-      if (provide_ca) {
-        // Read server root CA from server_ca.pem in archive if found (to support
-        // community edition use case). Otherwise, default to the old version of
-        // expecting it to be in the p12.
-        ca = Bootstrap::readServerCa(credentials_path);
-        if (ca.empty()) {
-          Bootstrap boot(credentials_path, "");
-          ca = boot.getCa();
-          std::cout << "Server root CA read from autoprov_credentials.p12 in zipped archive.\n";
-        } else {
-          std::cout << "Server root CA read from server_ca.pem in zipped archive.\n";
+    if (!batch.empty()) {
+      size_t jobs = std::max(std::thread::hardware_concurrency(), 1U);
+      if (commandline_map.count("jobs") != 0) {
+        const int jobs_option = commandline_map["jobs"].as<int>();
+        if (jobs_option <= 0) {
+          std::cerr << "Number of jobs (--jobs) should be positive" << std::endl;
+          return EXIT_FAILURE;
         }
+        jobs = static_cast<size_t>(jobs_option);
+      }
+      std::string station = Utils::getHostname();
+      if (commandline_map.count("station") != 0) {
+        station = commandline_map["station"].as<std::string>();
       }
-    }
-
-    tmp_pkey_file.PutContents(pkey);
-    tmp_cert_file.PutContents(cert);
-    if (provide_ca) {
-      tmp_ca_file.PutContents(ca);
-    }
-    if (provide_url) {
-      tmp_url_file.PutContents(serverUrl);
-    }
 
-    if (!local_dir.empty()) {
-      auto pkey_file_path = local_dir / pkey_file.get(directory);
-      std::cout << "Writing the generated client private key to " << pkey_file_path << " ...\n";
-      copyLocal(tmp_pkey_file.PathString(), pkey_file_path);
+      // Loaded once for all the devices
+      std::unique_ptr<Bootstrap> boot;
+      std::string ca;
+      if (cert_params.fleet_ca_path.empty()) {
+        boot = std_::make_unique<Bootstrap>(credentials_path, "");
+      } else if (files.provide_ca) {
+        ca = readServerCa(credentials_path);
+      }
 
-      auto cert_file_path = local_dir / cert_file.get(directory);
-      std::cout << "Writing the generated and signed client certificate to " << cert_file_path << " ...\n";
-      copyLocal(tmp_cert_file.PathString(), cert_file_path);
+      std::cout << "Provisioning " << batch.size() << " devices with " << jobs << " jobs...\n";
+      const auto start = std::chrono::steady_clock::now();
+      const size_t provisioned = provisionBatch(batch, files, serverUrl, ca, boot.get(), cert_params, local_dir,
+                                                skip_checks, jobs);
+      const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      std::cout << std::fixed << std::setprecision(2) << "Station " << station << ": provisioned " << provisioned
+                << " of " << batch.size() << " devices in " << seconds << " s ("
+                << (seconds > 0 ? static_cast<double>(provisioned) * 60 / seconds : 0.) << " devices per minute)"
+                << std::endl;
+      return provisioned == batch.size() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-      if (provide_ca) {
-        auto root_ca_file = local_dir / ca_file.get(directory);
-        std::cout << "Writing the server root CA to " << root_ca_file << " ...\n";
-        copyLocal(tmp_ca_file.PathString(), root_ca_file);
+    Credentials creds;
+    if (cert_params.fleet_ca_path.empty()) {  // no fleet CA => provision with shared credentials
+      Bootstrap boot(credentials_path, "");
+      std::cout << "Provisioning against server...\n";
+      try {
+        creds = provisionSharedCred(boot, serverUrl, device_id);
+      } catch (const std::runtime_error& exc) {
+        std::cout << exc.what() << "\n";
+        return EXIT_FAILURE;
       }
-      if (provide_url) {
-        auto gtw_url_file = local_dir / url_file.get(directory);
-        std::cout << "Writing the gateway URL to " << gtw_url_file << " ...\n";
-        copyLocal(tmp_url_file.PathString(), gtw_url_file);
+      std::cout << "...success\n";
+    } else {  // fleet CA set => generate and sign a new certificate
+      creds = generateFleetCred(cert_params, device_id);
+      if (files.provide_ca) {
+        creds.ca = readServerCa(credentials_path);
       }
+    }
+
+    CredentialFiles cred_files(files, creds, serverUrl);
+
+    if (!local_dir.empty()) {
+      cred_files.writeLocal(local_dir, true);
       std::cout << "...success\n";
     }
 
     if (!target.empty()) {
-      std::cout << "Copying client certificate and keys to " << target << ":" << directory;
+      std::cout << "Copying client certificate and keys to " << target << ":" << files.directory;
       if (port != 0) {
         std::cout << " on port " << port;
       }
@@ -411,17 +753,7 @@ int main(int argc, char* argv[]) {
       SSHRunner ssh{target, skip_checks, port};
 
       try {
-        ssh.transferFile(tmp_pkey_file.Path(), pkey_file.get(directory));
-
-        ssh.transferFile(tmp_cert_file.Path(), cert_file.get(directory));
-
-        if (provide_ca) {
-          ssh.transferFile(tmp_ca_file.Path(), ca_file.get(directory));
-        }
-        if (provide_url) {
-          ssh.transferFile(tmp_url_file.Path(), url_file.get(directory));
-        }
-
+        cred_files.copyToTarget(ssh);
         std::cout << "...success\n";
       } catch (const std::runtime_error& exc) {
         std::cout << exc.what() << std::endl;
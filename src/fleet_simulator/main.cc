@@ -0,0 +1,118 @@
+#include <unistd.h>
+#include <iostream>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "simulator.h"
+#include "utilities/aktualizr_version.h"
+#include "utilities/sig_handler.h"
+#include "utilities/utils.h"
+
+namespace bpo = boost::program_options;
+
+void check_info_options(const bpo::options_description &description, const bpo::variables_map &vm) {
+  if (vm.count("help") != 0) {
+    std::cout << description << '\n';
+    exit(EXIT_SUCCESS);
+  }
+  if (vm.count("version") != 0) {
+    std::cout << "Current aktualizr-fleet-simulator version is: " << aktualizr_version() << "\n";
+    exit(EXIT_SUCCESS);
+  }
+}
+
+bpo::variables_map parse_options(int argc, char **argv) {
+  bpo::options_description description(
+      "Simulates a fleet of devices against the servers, with a libaktualizr client for each, and reports the request "
+      "rates and latencies.\nDurations are given as S, fixed:S, uniform:MIN:MAX or exponential:MEAN, in seconds. The "
+      "fake_*_time options of [pacman] in the configuration model how long the downloads and installations take.");
+  // clang-format off
+  description.add_options()
+      ("help,h", "print usage")
+      ("version,v", "Current aktualizr-fleet-simulator version")
+      ("config,c", bpo::value<std::vector<boost::filesystem::path> >()->composing(), "configuration file or directory that all the devices start from")
+      ("loglevel", bpo::value<int>(), "set log level 0-5 (trace, debug, info, warning, error, fatal)")
+      ("devices,n", bpo::value<uint64_t>()->default_value(100), "number of devices")
+      ("arrival", bpo::value<std::string>()->default_value("0"), "time between two devices coming online")
+      ("polling", bpo::value<std::string>()->default_value("10"), "time between two update cycles of a device")
+      ("duration", bpo::value<uint64_t>()->default_value(60), "length of the simulation, in seconds")
+      ("workers", bpo::value<unsigned>()->default_value(64), "threads running the update cycles")
+      ("no-install", "only check for updates, without downloading and installing them")
+      ("device-prefix", bpo::value<std::string>()->default_value("sim-"), "device IDs and ECU serials are this followed by the index of the device")
+      ("seed", bpo::value<uint64_t>()->default_value(0), "seed of the random times")
+      ("work-dir", bpo::value<boost::filesystem::path>(), "directory for the downloaded images, by default a temporary one")
+      ("report-interval", bpo::value<uint64_t>()->default_value(10), "time between two reports while running, in seconds; 0 only reports at the end")
+      ("json", "print the final report as JSON");
+  // clang-format on
+
+  bpo::variables_map vm;
+  try {
+    bpo::basic_parsed_options<char> parsed_options = bpo::command_line_parser(argc, argv).options(description).run();
+    bpo::store(parsed_options, vm);
+    check_info_options(description, vm);
+    bpo::notify(vm);
+  } catch (const bpo::error &ex) {
+    std::cout << ex.what() << std::endl;
+    std::cout << description;
+    exit(EXIT_FAILURE);
+  }
+
+  return vm;
+}
+
+int main(int argc, char *argv[]) {
+  logger_init(isatty(1) == 1);
+  // Thousands of clients log a lot, so only their warnings by default.
+  logger_set_threshold(boost::log::trivial::warning);
+
+  bpo::variables_map commandline_map = parse_options(argc, argv);
+
+  try {
+    Config config(commandline_map);
+    if (commandline_map.count("loglevel") == 0) {
+      logger_set_threshold(boost::log::trivial::warning);
+    }
+
+    SimulatorOptions options;
+    options.devices = commandline_map["devices"].as<uint64_t>();
+    options.arrival = TimeDistribution::parse(commandline_map["arrival"].as<std::string>());
+    options.polling = TimeDistribution::parse(commandline_map["polling"].as<std::string>());
+    options.duration = std::chrono::seconds(commandline_map["duration"].as<uint64_t>());
+    options.workers = commandline_map["workers"].as<unsigned>();
+    options.install = commandline_map.count("no-install") == 0;
+    options.device_prefix = commandline_map["device-prefix"].as<std::string>();
+    options.seed = commandline_map["seed"].as<uint64_t>();
+    std::unique_ptr<TemporaryDirectory> temp_dir;
+    if (commandline_map.count("work-dir") != 0) {
+      options.work_dir = commandline_map["work-dir"].as<boost::filesystem::path>();
+    } else {
+      temp_dir = std_::make_unique<TemporaryDirectory>("fleet-simulator");
+      options.work_dir = temp_dir->Path();
+    }
+
+    FleetSimulator simulator(config, options);
+    SigHandler::get().start([&simulator]() { simulator.stop(); });
+    SigHandler::signal(SIGINT);
+    SigHandler::signal(SIGTERM);
+
+    const auto report_interval = commandline_map["report-interval"].as<uint64_t>();
+    std::function<void(const FleetSimulator::Report &)> progress;
+    if (report_interval > 0) {
+      progress = [](const FleetSimulator::Report &report) { std::cerr << report.toString() << std::endl; };
+    }
+    const FleetSimulator::Report report =
+        simulator.run(progress, std::chrono::seconds(std::max<uint64_t>(report_interval, 1)));
+    if (commandline_map.count("json") != 0) {
+      std::cout << Utils::jsonToStr(report.toJson()) << std::endl;
+    } else {
+      std::cout << report.toString();
+    }
+    return report.devices_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  } catch (const std::exception &ex) {
+    LOG_ERROR << ex.what();
+    return EXIT_FAILURE;
+  }
+}
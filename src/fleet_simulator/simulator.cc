@@ -0,0 +1,293 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include "http/httpclient.h"
+#include "libaktualizr/gateway.h"
+#include "logging/logging.h"
+#include "primary/sotauptaneclient.h"
+#include "storage/invstorage.h"
+
+static const std::array<const char *, 5> kOpNames{"provision", "check", "download", "install", "manifest"};
+
+struct FleetSimulator::Device {
+  explicit Device(Config config_in) : config{std::move(config_in)} {}
+
+  Config config;
+  std::shared_ptr<INvStorage> storage;
+  std::unique_ptr<SotaUptaneClient> client;
+};
+
+FleetSimulator::FleetSimulator(Config config, SimulatorOptions options, HttpFactory http_factory)
+    : config_{std::move(config)},
+      options_{std::move(options)},
+      http_factory_{std::move(http_factory)},
+      generator_{options_.seed} {
+  if (!http_factory_) {
+    http_factory_ = [](const Config &device_config) { return std::make_shared<HttpClient>(device_config.network); };
+  }
+}
+
+FleetSimulator::~FleetSimulator() { stop(); }
+
+Config FleetSimulator::deviceConfig(uint64_t index) const {
+  Config config = Gateway::deviceConfig(config_);
+  const std::string id = options_.device_prefix + std::to_string(index);
+  config.network.event_loop = true;
+  config.provision.device_id = id;
+  config.provision.primary_ecu_serial = id;
+  config.storage.type = StorageType::kMemory;
+  config.storage.memory_snapshot_interval = 0;
+  config.storage.path = options_.work_dir / id;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = config.storage.path / "images";
+  // Reproducible install times, different for each device
+  config.pacman.fake_time_seed = options_.seed * options_.devices + index + 1;
+  config.bootloader.reboot_sentinel_dir = config.storage.path;
+  config.uptane.secondary_config_file.clear();
+  config.telemetry.metrics_file.clear();
+  config.telemetry.metrics_port = 0;
+  return config;
+}
+
+void FleetSimulator::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  stop_cv_.notify_all();
+}
+
+FleetSimulator::Report FleetSimulator::run(const std::function<void(const Report &)> &progress,
+                                           std::chrono::seconds progress_interval) {
+  start_ = std::chrono::steady_clock::now();
+  const Json::Value metrics = Metrics::instance().json();
+  for (const auto &series : metrics["aktualizr_http_request_duration_seconds"]["series"]) {
+    endpoint_baseline_[series["labels"]["endpoint"].asString()] = series["count"].asUInt64();
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = false;
+    auto arrival = start_;
+    for (uint64_t i = 0; i < options_.devices; ++i) {
+      devices_.push_back(std_::make_unique<Device>(deviceConfig(i)));
+      events_.emplace(arrival, i);
+      arrival += options_.arrival.sample(generator_);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(options_.workers, 1U); ++i) {
+    workers.emplace_back([this]() { work(); });
+  }
+  const auto end = start_ + options_.duration;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto next_progress = start_ + progress_interval;
+    while (!stopping_ && std::chrono::steady_clock::now() < end) {
+      stop_cv_.wait_until(lock, progress ? std::min(end, next_progress) : end, [this]() { return stopping_; });
+      if (progress && std::chrono::steady_clock::now() >= next_progress) {
+        lock.unlock();
+        progress(report());
+        lock.lock();
+        next_progress += progress_interval;
+      }
+    }
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  Report result = report();
+  // The clients have threads of their own, which are stopped here rather
+  // than when the simulator goes away.
+  devices_.clear();
+  events_ = decltype(events_)();
+  return result;
+}
+
+void FleetSimulator::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (stopping_) {
+      return;
+    }
+    if (events_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+    const Event next = events_.top();
+    if (next.first > std::chrono::steady_clock::now()) {
+      cv_.wait_until(lock, next.first);
+      continue;
+    }
+    events_.pop();
+    lock.unlock();
+    const bool active = cycle(*devices_[next.second]);
+    lock.lock();
+    if (active) {
+      events_.emplace(std::chrono::steady_clock::now() + options_.polling.sample(generator_), next.second);
+      cv_.notify_one();
+    }
+  }
+}
+
+template <typename F>
+auto FleetSimulator::timed(Op op, F operation) -> decltype(operation()) {
+  const MetricTimer timer(latencies_[static_cast<size_t>(op)]);
+  return operation();
+}
+
+bool FleetSimulator::cycle(Device &device) {
+  if (!device.client) {
+    try {
+      timed(kProvision, [this, &device]() {
+        device.storage = INvStorage::newStorage(device.config.storage);
+        device.storage->importData(device.config.import);
+        device.client = std_::make_unique<SotaUptaneClient>(device.config, device.storage,
+                                                            http_factory_(device.config), nullptr, nullptr);
+        device.client->initialize();
+        device.client->sendDeviceData();
+      });
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Device " << device.config.provision.device_id << " failed to come online: " << e.what();
+      failed(kProvision);
+      devices_failed_.fetch_add(1);
+      device.client.reset();
+      device.storage.reset();
+      return false;
+    }
+    devices_online_.fetch_add(1);
+  }
+
+  cycles_.fetch_add(1);
+  try {
+    const result::UpdateCheck check = timed(kCheck, [&device]() { return device.client->fetchMeta(); });
+    if (check.status == result::UpdateStatus::kError) {
+      failed(kCheck);
+      return true;
+    }
+    if (!options_.install || check.updates.empty()) {
+      return true;
+    }
+    const result::Download download =
+        timed(kDownload, [&device, &check]() { return device.client->downloadImages(check.updates); });
+    if (download.status != result::DownloadStatus::kSuccess || download.updates.empty()) {
+      failed(kDownload);
+      return true;
+    }
+    const result::Install install =
+        timed(kInstall, [&device, &download]() { return device.client->uptaneInstall(download.updates); });
+    if (!install.dev_report.isSuccess()) {
+      failed(kInstall);
+    } else {
+      updates_installed_.fetch_add(1);
+    }
+    if (device.client->isInstallCompletionRequired()) {
+      // As if the device rebooted to apply the update
+      device.client->completeInstall();
+    }
+    if (!timed(kManifest, [&device]() { return device.client->putManifest(); })) {
+      failed(kManifest);
+    }
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Update cycle of " << device.config.provision.device_id << " failed: " << e.what();
+    failed(kCheck);
+  }
+  return true;
+}
+
+FleetSimulator::Report FleetSimulator::report() const {
+  Report result;
+  result.elapsed_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  result.devices_online = devices_online_.load();
+  result.devices_failed = devices_failed_.load();
+  result.cycles = cycles_.load();
+  result.updates_installed = updates_installed_.load();
+  const double elapsed = std::max(result.elapsed_sec, 1e-3);
+  for (int op = 0; op < kOpCount; ++op) {
+    const MetricHistogram &h = latencies_[static_cast<size_t>(op)];
+    Operation o;
+    o.name = kOpNames[static_cast<size_t>(op)];
+    o.count = h.count();
+    o.failures = failures_[static_cast<size_t>(op)].load();
+    o.rate = static_cast<double>(o.count) / elapsed;
+    o.p50_ms = static_cast<double>(h.quantile(0.5)) / 1000;
+    o.p90_ms = static_cast<double>(h.quantile(0.9)) / 1000;
+    o.p99_ms = static_cast<double>(h.quantile(0.99)) / 1000;
+    o.max_ms = static_cast<double>(h.quantile(1.0)) / 1000;
+    result.operations.push_back(o);
+  }
+  // The quantiles of the endpoints are over the life of the process
+  const Json::Value metrics = Metrics::instance().json();
+  for (const auto &series : metrics["aktualizr_http_request_duration_seconds"]["series"]) {
+    Operation o;
+    o.name = series["labels"]["endpoint"].asString();
+    const auto baseline = endpoint_baseline_.find(o.name);
+    o.count = series["count"].asUInt64() - (baseline == endpoint_baseline_.end() ? 0 : baseline->second);
+    o.rate = static_cast<double>(o.count) / elapsed;
+    o.p50_ms = series["p50"].asDouble() * 1000;
+    o.p90_ms = series["p90"].asDouble() * 1000;
+    o.p99_ms = series["p99"].asDouble() * 1000;
+    o.max_ms = series["max"].asDouble() * 1000;
+    result.endpoints.push_back(o);
+  }
+  std::sort(result.endpoints.begin(), result.endpoints.end(),
+            [](const Operation &a, const Operation &b) { return a.count > b.count; });
+  return result;
+}
+
+static Json::Value operationJson(const FleetSimulator::Operation &o) {
+  Json::Value json;
+  json["count"] = Json::UInt64(o.count);
+  json["failures"] = Json::UInt64(o.failures);
+  json["rate"] = o.rate;
+  json["p50_ms"] = o.p50_ms;
+  json["p90_ms"] = o.p90_ms;
+  json["p99_ms"] = o.p99_ms;
+  json["max_ms"] = o.max_ms;
+  return json;
+}
+
+Json::Value FleetSimulator::Report::toJson() const {
+  Json::Value json;
+  json["elapsed_sec"] = elapsed_sec;
+  json["devices_online"] = Json::UInt64(devices_online);
+  json["devices_failed"] = Json::UInt64(devices_failed);
+  json["cycles"] = Json::UInt64(cycles);
+  json["updates_installed"] = Json::UInt64(updates_installed);
+  for (const auto &o : operations) {
+    json["operations"][o.name] = operationJson(o);
+  }
+  for (const auto &o : endpoints) {
+    json["endpoints"][o.name] = operationJson(o);
+  }
+  return json;
+}
+
+std::string FleetSimulator::Report::toString() const {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  out << elapsed_sec << " s: " << devices_online << " devices online, " << devices_failed << " failed, " << cycles
+      << " update cycles, " << updates_installed << " updates installed\n";
+  const auto table = [&out](const std::string &title, const std::vector<Operation> &rows) {
+    out << std::left << std::setw(28) << title << std::right << std::setw(10) << "count" << std::setw(10) << "failed"
+        << std::setw(10) << "per s" << std::setw(10) << "p50 ms" << std::setw(10) << "p90 ms" << std::setw(10)
+        << "p99 ms" << std::setw(10) << "max ms" << "\n";
+    for (const auto &o : rows) {
+      out << std::left << std::setw(28) << o.name << std::right << std::setw(10) << o.count << std::setw(10)
+          << o.failures << std::setw(10) << o.rate << std::setw(10) << o.p50_ms << std::setw(10) << o.p90_ms
+          << std::setw(10) << o.p99_ms << std::setw(10) << o.max_ms << "\n";
+    }
+  };
+  table("operation", operations);
+  if (!endpoints.empty()) {
+    table("endpoint", endpoints);
+  }
+  return out.str();
+}
@@ -0,0 +1,151 @@
+#ifndef FLEET_SIMULATOR_H_
+#define FLEET_SIMULATOR_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include "json/json.h"
+
+#include "http/httpinterface.h"
+#include "libaktualizr/config.h"
+#include "utilities/metrics.h"
+#include "utilities/time_distribution.h"
+
+class SotaUptaneClient;
+
+struct SimulatorOptions {
+  uint64_t devices{100};
+  // Time between two devices coming online, the first one at the start
+  TimeDistribution arrival{TimeDistribution::parse("0")};
+  // Time between two update cycles of a device
+  TimeDistribution polling{TimeDistribution::parse("10")};
+  std::chrono::seconds duration{60};
+  // Threads running the update cycles of all the devices
+  unsigned workers{64};
+  // Download and install the updates found, with the fake package manager
+  bool install{true};
+  // Device IDs and Primary ECU serials are this followed by the index of the device
+  std::string device_prefix{"sim-"};
+  uint64_t seed{0};
+  // Where the images that the devices download are written
+  boost::filesystem::path work_dir;
+};
+
+/**
+ * Simulates a fleet of devices against the servers, for load tests: each
+ * device is a SotaUptaneClient of its own, with its own identity and keys, but
+ * in-memory storage and the fake package manager. The devices come online and
+ * run their update cycles at random times, as given by the options, on a few
+ * worker threads, and all of them share the same HTTP connections, curl event
+ * loop and verified Image repo metadata.
+ */
+class FleetSimulator {
+ public:
+  using HttpFactory = std::function<std::shared_ptr<HttpInterface>(const Config &config)>;
+
+  /** Count, rate and latency of an operation */
+  struct Operation {
+    std::string name;
+    uint64_t count{0};
+    uint64_t failures{0};
+    double rate{0};
+    double p50_ms{0};
+    double p90_ms{0};
+    double p99_ms{0};
+    double max_ms{0};
+  };
+
+  struct Report {
+    double elapsed_sec{0};
+    uint64_t devices_online{0};
+    uint64_t devices_failed{0};
+    uint64_t cycles{0};
+    uint64_t updates_installed{0};
+    // The operations of the update cycles, as the devices see them
+    std::vector<Operation> operations;
+    // The HTTP requests by server endpoint, as timed by curl; empty with another HTTP client
+    std::vector<Operation> endpoints;
+
+    Json::Value toJson() const;
+    std::string toString() const;
+  };
+
+  /**
+   * @param config the configuration that all the devices start from, such as
+   *        the servers and provisioning credentials
+   * @param http_factory the HTTP client of a device, by default an HttpClient
+   */
+  FleetSimulator(Config config, SimulatorOptions options, HttpFactory http_factory = nullptr);
+  ~FleetSimulator();
+  FleetSimulator(const FleetSimulator &) = delete;
+  FleetSimulator(FleetSimulator &&) = delete;
+  FleetSimulator &operator=(const FleetSimulator &) = delete;
+  FleetSimulator &operator=(FleetSimulator &&) = delete;
+
+  /** The configuration of the device at index */
+  Config deviceConfig(uint64_t index) const;
+
+  /**
+   * Run the fleet for the duration of the options, or until stop(). The
+   * update cycles running then are finished.
+   * @param progress called with the report so far every progress_interval
+   */
+  Report run(const std::function<void(const Report &)> &progress = nullptr,
+             std::chrono::seconds progress_interval = std::chrono::seconds(10));
+  void stop();
+  /** The report so far; safe to call while run() is going on. */
+  Report report() const;
+
+ private:
+  enum Op { kProvision, kCheck, kDownload, kInstall, kManifest, kOpCount };
+
+  struct Device;
+  using Event = std::pair<std::chrono::steady_clock::time_point, uint64_t>;
+
+  void work();
+  // Run the next update cycle of a device; return false if it is out of the fleet
+  bool cycle(Device &device);
+  template <typename F>
+  auto timed(Op op, F operation) -> decltype(operation());
+  void failed(Op op) { failures_[static_cast<size_t>(op)].fetch_add(1); }
+
+  Config config_;
+  SimulatorOptions options_;
+  HttpFactory http_factory_;
+
+  std::vector<std::unique_ptr<Device>> devices_;
+  mutable std::mutex mutex_;
+  // Wakes the workers up
+  std::condition_variable cv_;
+  // Wakes run() up
+  std::condition_variable stop_cv_;
+  // Earliest first
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events_;
+  std::mt19937_64 generator_;
+  bool stopping_{false};
+
+  std::chrono::steady_clock::time_point start_;
+  std::atomic<uint64_t> devices_online_{0};
+  std::atomic<uint64_t> devices_failed_{0};
+  std::atomic<uint64_t> cycles_{0};
+  std::atomic<uint64_t> updates_installed_{0};
+  std::array<MetricHistogram, kOpCount> latencies_;
+  std::array<std::atomic<uint64_t>, kOpCount> failures_{};
+  // Requests by endpoint when the run started
+  std::map<std::string, uint64_t> endpoint_baseline_;
+};
+
+#endif  // FLEET_SIMULATOR_H_
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+
+#include "httpfake.h"
+#include "metafake.h"
+#include "simulator.h"
+#include "uptane_test_common.h"
+#include "utilities/utils.h"
+
+boost::filesystem::path fake_meta_dir;
+
+/* Each device gets an identity and in-memory storage of its own. */
+TEST(FleetSimulator, DeviceConfig) {
+  TemporaryDirectory temp_dir;
+  SimulatorOptions options;
+  options.work_dir = temp_dir.Path();
+  const FleetSimulator simulator(Config(), options);
+  const Config first = simulator.deviceConfig(0);
+  const Config second = simulator.deviceConfig(1);
+  EXPECT_EQ(first.provision.device_id, "sim-0");
+  EXPECT_EQ(second.provision.primary_ecu_serial, "sim-1");
+  EXPECT_EQ(first.storage.type, StorageType::kMemory);
+  EXPECT_NE(first.pacman.images_path, second.pacman.images_path);
+  EXPECT_NE(first.pacman.fake_time_seed, second.pacman.fake_time_seed);
+  EXPECT_TRUE(first.network.share_connections);
+  EXPECT_TRUE(first.uptane.share_image_metadata);
+}
+
+/* The devices come online and run their update cycles until the end of the simulation. */
+TEST(FleetSimulator, Run) {
+  TemporaryDirectory temp_dir;
+  SimulatorOptions options;
+  options.devices = 4;
+  options.arrival = TimeDistribution::parse("0.05");
+  options.polling = TimeDistribution::parse("uniform:0.1:0.2");
+  options.duration = std::chrono::seconds(3);
+  options.workers = 2;
+  options.work_dir = temp_dir.Path();
+  const Config config = UptaneTestCommon::makeTestConfig(temp_dir, "https://tlsserver.com");
+  FleetSimulator simulator(config, options, [](const Config &device_config) {
+    boost::filesystem::create_directories(device_config.storage.path);
+    return std::make_shared<HttpFake>(device_config.storage.path, "noupdates", fake_meta_dir);
+  });
+
+  size_t progress_reports = 0;
+  const FleetSimulator::Report report =
+      simulator.run([&progress_reports](const FleetSimulator::Report &) { ++progress_reports; },
+                    std::chrono::seconds(1));
+  EXPECT_GE(progress_reports, 2);
+  EXPECT_EQ(report.devices_online, 4);
+  EXPECT_EQ(report.devices_failed, 0);
+  EXPECT_GE(report.cycles, 8);
+  EXPECT_EQ(report.updates_installed, 0);
+  ASSERT_EQ(report.operations.size(), 5);
+  EXPECT_EQ(report.operations[0].name, "provision");
+  EXPECT_EQ(report.operations[0].count, 4);
+  EXPECT_EQ(report.operations[1].name, "check");
+  EXPECT_EQ(report.operations[1].count, report.cycles);
+  EXPECT_EQ(report.operations[1].failures, 0);
+  EXPECT_GT(report.operations[1].p50_ms, 0);
+  EXPECT_LE(report.operations[1].p50_ms, report.operations[1].max_ms);
+  EXPECT_EQ(report.toJson()["operations"]["check"]["count"].asUInt64(), report.cycles);
+  EXPECT_NE(report.toString().find("check"), std::string::npos);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  TemporaryDirectory tmp_dir;
+  fake_meta_dir = tmp_dir.Path();
+  CreateFakeRepoMetaData(fake_meta_dir);
+
+  return RUN_ALL_TESTS();
+}
+#endif
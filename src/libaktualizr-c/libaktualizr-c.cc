@@ -1,5 +1,14 @@
 #include "libaktualizr-c.h"
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <thread>
 
 #include "libaktualizr/events.h"
 #include "utilities/utils.h"
@@ -175,6 +184,136 @@ int Aktualizr_install_target(Aktualizr *a, Target *t) {
   return 0;
 }
 
+// The futures of libaktualizr are awaited on a thread of the request, which
+// then signals the completion to the caller.
+struct Aktualizr_Request {
+  Aktualizr_Request(Aktualizr_request_callback cb_in, void *user_data_in)
+      : fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)), cb(cb_in), user_data(user_data_in) {}
+  ~Aktualizr_Request() {
+    if (waiter.joinable()) {
+      waiter.join();
+    }
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+  Aktualizr_Request(const Aktualizr_Request &) = delete;
+  Aktualizr_Request(Aktualizr_Request &&) = delete;
+  Aktualizr_Request &operator=(const Aktualizr_Request &) = delete;
+  Aktualizr_Request &operator=(Aktualizr_Request &&) = delete;
+
+  void complete(int res, std::unique_ptr<Updates> u) {
+    {
+      std::lock_guard<std::mutex> lock(m);
+      result = res;
+      updates = std::move(u);
+      done = true;
+    }
+    cv.notify_all();
+    const uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+      std::cerr << "Aktualizr_Request error: could not signal the completion" << std::endl;
+    }
+    if (cb != nullptr) {
+      (*cb)(this, user_data);
+    }
+  }
+
+  void wait() {
+    std::unique_lock<std::mutex> lock(m);
+    cv.wait(lock, [this] { return done; });
+  }
+
+  const int fd;
+  const Aktualizr_request_callback cb;
+  void *const user_data;
+  std::mutex m;
+  std::condition_variable cv;
+  bool done{false};
+  int result{-1};
+  std::unique_ptr<Updates> updates;
+  std::thread waiter;
+};
+
+template <class R, class F, class G>
+static Aktualizr_Request *start_request(const char *name, Aktualizr_request_callback cb, void *user_data, F &&call,
+                                        G &&to_updates) {
+  try {
+    auto request = std_::make_unique<Aktualizr_Request>(cb, user_data);
+    if (request->fd < 0) {
+      std::cerr << name << " failed: could not create an eventfd" << std::endl;
+      return nullptr;
+    }
+    std::future<R> future = call();
+    Aktualizr_Request *r = request.get();
+    r->waiter = std::thread([r, name, to_updates, future = std::move(future)]() mutable {
+      try {
+        R res = future.get();
+        r->complete(0, to_updates(res));
+      } catch (const std::exception &e) {
+        std::cerr << name << " exception: " << e.what() << std::endl;
+        r->complete(-1, nullptr);
+      }
+    });
+    return request.release();
+  } catch (const std::exception &e) {
+    std::cerr << name << " exception: " << e.what() << std::endl;
+    return nullptr;
+  }
+}
+
+Aktualizr_Request *Aktualizr_updates_check_async(Aktualizr *a, Aktualizr_request_callback cb, void *user_data) {
+  return start_request<result::UpdateCheck>(
+      "Aktualizr_updates_check_async", cb, user_data, [a]() { return a->CheckUpdates(); },
+      [](result::UpdateCheck &r) {
+        return !r.updates.empty() ? std_::make_unique<Updates>(std::move(r.updates)) : nullptr;
+      });
+}
+
+Aktualizr_Request *Aktualizr_download_target_async(Aktualizr *a, Target *t, Aktualizr_request_callback cb,
+                                                   void *user_data) {
+  if (t == nullptr) {
+    std::cerr << "Aktualizr_download_target_async failed: invalid input" << std::endl;
+    return nullptr;
+  }
+  return start_request<result::Download>(
+      "Aktualizr_download_target_async", cb, user_data,
+      [a, t]() { return a->Download(std::vector<Uptane::Target>({*t})); },
+      [](result::Download &) { return std::unique_ptr<Updates>(); });
+}
+
+Aktualizr_Request *Aktualizr_install_target_async(Aktualizr *a, Target *t, Aktualizr_request_callback cb,
+                                                  void *user_data) {
+  if (t == nullptr) {
+    std::cerr << "Aktualizr_install_target_async failed: invalid input" << std::endl;
+    return nullptr;
+  }
+  return start_request<result::Install>(
+      "Aktualizr_install_target_async", cb, user_data,
+      [a, t]() { return a->Install(std::vector<Uptane::Target>({*t})); },
+      [](result::Install &) { return std::unique_ptr<Updates>(); });
+}
+
+int Aktualizr_request_fd(Aktualizr_Request *r) { return r->fd; }
+
+int Aktualizr_request_done(Aktualizr_Request *r) {
+  std::lock_guard<std::mutex> lock(r->m);
+  return r->done ? 1 : 0;
+}
+
+int Aktualizr_request_result(Aktualizr_Request *r) {
+  r->wait();
+  return r->result;
+}
+
+Updates *Aktualizr_request_updates(Aktualizr_Request *r) {
+  r->wait();
+  std::lock_guard<std::mutex> lock(r->m);
+  return r->updates.release();
+}
+
+void Aktualizr_request_free(Aktualizr_Request *r) { delete r; }
+
 int Aktualizr_send_manifest(Aktualizr *a, const char *manifest) {
   try {
     Json::Value custom = Utils::parseJSON(manifest);
@@ -233,6 +372,59 @@ int Aktualizr_close_stored_target(StorageTargetHandle *handle) {
   }
 }
 
+int Aktualizr_open_stored_target_fd(Aktualizr *a, const Target *t) {
+  if (t == nullptr) {
+    std::cerr << "Aktualizr_open_stored_target_fd failed: invalid input" << std::endl;
+    return -1;
+  }
+
+  try {
+    return a->OpenStoredTargetFd(*t);
+  } catch (const std::exception &e) {
+    std::cerr << "Aktualizr_open_stored_target_fd exception: " << e.what() << std::endl;
+    return -1;
+  }
+}
+
+int Aktualizr_map_stored_target(Aktualizr *a, const Target *t, Stored_Target_Mapping_C *mapping) {
+  if (mapping == nullptr) {
+    std::cerr << "Aktualizr_map_stored_target failed: invalid input" << std::endl;
+    return -1;
+  }
+  const int fd = Aktualizr_open_stored_target_fd(a, t);
+  if (fd < 0) {
+    return -1;
+  }
+  mapping->data = nullptr;
+  mapping->size = static_cast<size_t>(t->length());
+  if (mapping->size != 0) {
+    void *data = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      std::cerr << "Aktualizr_map_stored_target failed: " << std::strerror(errno) << std::endl;
+      close(fd);
+      return -1;
+    }
+    mapping->data = static_cast<const uint8_t *>(data);
+  }
+  // The mapping holds the file
+  close(fd);
+  return 0;
+}
+
+int Aktualizr_unmap_stored_target(Stored_Target_Mapping_C *mapping) {
+  if (mapping == nullptr) {
+    std::cerr << "Aktualizr_unmap_stored_target failed: no input mapping" << std::endl;
+    return -1;
+  }
+  if (mapping->data != nullptr && munmap(const_cast<uint8_t *>(mapping->data), mapping->size) != 0) {
+    std::cerr << "Aktualizr_unmap_stored_target failed: " << std::strerror(errno) << std::endl;
+    return -1;
+  }
+  mapping->data = nullptr;
+  mapping->size = 0;
+  return 0;
+}
+
 static Pause_Status_C get_Pause_Status_C(result::PauseStatus in) {
   switch (in) {
     case result::PauseStatus::kSuccess: {
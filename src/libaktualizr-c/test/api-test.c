@@ -1,3 +1,4 @@
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,8 +35,16 @@ static void signal_handler(const char *event_name) {
   }
 }
 
+static void request_callback(Aktualizr_Request *r, void *user_data) {
+  if (Aktualizr_request_done(r)) {
+    ++*(int *)user_data;
+  }
+}
+
 int main(int argc, char **argv) {
   Aktualizr *a;
+  Aktualizr_Request *r;
+  int callback_count = 0;
   Campaign *c;
   Updates *u;
   Target *t;
@@ -90,6 +99,24 @@ int main(int argc, char **argv) {
   }
   Aktualizr_campaign_free(c);
 
+  r = Aktualizr_updates_check_async(a, &request_callback, &callback_count);
+  if (r == NULL) {
+    printf("Aktualizr_updates_check_async returned NULL\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  struct pollfd pfd = {Aktualizr_request_fd(r), POLLIN, 0};
+  if (poll(&pfd, 1, 60000) != 1 || !Aktualizr_request_done(r) || Aktualizr_request_result(r) != 0) {
+    printf("Aktualizr_updates_check_async failed\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  u = Aktualizr_request_updates(r);
+  Aktualizr_request_free(r);
+  if (u == NULL || callback_count != 1) {
+    printf("Aktualizr_updates_check_async returned no updates or did not call back\n");
+    CLEANUP_AND_RETURN_FAILED;
+  }
+  Aktualizr_updates_free(u);
+
   u = Aktualizr_updates_check(a);
   if (u == NULL) {
     printf("Aktualizr_updates_check returned NULL\n");
@@ -139,6 +166,13 @@ int main(int argc, char **argv) {
       CLEANUP_AND_RETURN_FAILED;
     }
 
+    r = Aktualizr_download_target_async(a, t, NULL, NULL);
+    if (r == NULL || Aktualizr_request_result(r) != 0) {
+      printf("Aktualizr_download_target_async failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    Aktualizr_request_free(r);
+
     printf("Installing...\n");
     err = Aktualizr_install_target(a, t);
     if (err) {
@@ -172,6 +206,18 @@ int main(int argc, char **argv) {
     if (size == bufSize) {
       printf(" ... (end of content skipped)");
     }
+
+    Stored_Target_Mapping_C mapping;
+    err = Aktualizr_map_stored_target(a, t, &mapping);
+    if (err || mapping.size < size || memcmp(mapping.data, buf, size) != 0) {
+      printf("Aktualizr_map_stored_target failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
+    err = Aktualizr_unmap_stored_target(&mapping);
+    if (err) {
+      printf("Aktualizr_unmap_stored_target failed\n");
+      CLEANUP_AND_RETURN_FAILED;
+    }
     free(buf);
     buf = NULL;
 
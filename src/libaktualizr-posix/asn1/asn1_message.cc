@@ -6,6 +6,7 @@
 #include "asn1_message.h"
 #include "logging/logging.h"
 #include "utilities/dequeue_buffer.h"
+#include "utilities/metrics.h"
 #include "utilities/utils.h"
 
 #ifndef MSG_NOSIGNAL
@@ -14,7 +15,7 @@
 
 int Asn1StringAppendCallback(const void* buffer, size_t size, void* priv) {
   auto* out_str = static_cast<std::string*>(priv);
-  out_str->append(std::string(static_cast<const char*>(buffer), size));
+  out_str->append(static_cast<const char*>(buffer), size);
   return 0;
 }
 
@@ -52,43 +53,96 @@ void SetString(OCTET_STRING_t* dest, const std::string& str) {
   OCTET_STRING_fromBuf(dest, str.c_str(), static_cast<int>(str.size()));
 }
 
-Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
-  der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1SocketWriteCallback, &con_fd);
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd, std::string* encoded) {
+  // Encoded first, as der_encode() writes the message in many small pieces
+  encoded->clear();
+  const asn_enc_rval_t res = der_encode(&asn_DEF_AKIpUptaneMes, &tx->msg_, Asn1StringAppendCallback, encoded);
+  if (res.encoded == -1) {
+    LOG_ERROR << "Failed to encode a message";
+    return false;
+  }
+  return Asn1SocketWriteCallback(encoded->data(), encoded->size(), &con_fd) == 0;
+}
 
-  // Bounce TCP_NODELAY to flush the TCP send buffer
-  int no_delay = 1;
-  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
-  no_delay = 0;
-  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd) {
+  std::string encoded;
+  return Asn1Send(tx, con_fd, &encoded);
+}
+
+asn_dec_rval_t Asn1Decode(Asn1Message* msg, asn_codec_ctx_t* context, DequeueBuffer* buffer) {
+  // Straight into the message, instead of a structure of its own that is then moved to it
+  void* m = &msg->msg_;
+  const asn_dec_rval_t res = ber_decode(context, &asn_DEF_AKIpUptaneMes, &m, buffer->Head(), buffer->Size());
+  buffer->Consume(res.consumed);
+  return res;
+}
 
-  AKIpUptaneMes_t* m = nullptr;
-  asn_dec_rval_t res;
+Asn1Message::Ptr Asn1Receive(int con_fd, DequeueBuffer* buffer) {
+  Asn1Message::Ptr msg = Asn1Message::Empty();
+  asn_dec_rval_t res{};
+  res.code = RC_WMORE;
   asn_codec_ctx_s context{};
-  DequeueBuffer buffer;
-  ssize_t received;
-  do {
-    res.code = RC_FAIL;
-    received = recv(con_fd, buffer.Tail(), buffer.TailSpace(), 0);
-    if (received < 0) {
-      LOG_ERROR << "Failed to read data from a connection socket: " << strerror(errno);
+  // A message may already have been received along with the previous one.
+  if (buffer->Size() > 0) {
+    res = Asn1Decode(msg.get(), &context, buffer);
+  }
+  while (res.code == RC_WMORE) {
+    const size_t space = buffer->TailSpace();
+    if (space == 0) {
+      LOG_ERROR << "Message on a connection socket is larger than " << buffer->MaxSize() << " bytes";
+      res.code = RC_FAIL;
+      break;
+    }
+    const ssize_t received = recv(con_fd, buffer->Tail(), space, 0);
+    if (received <= 0) {
+      if (received < 0) {
+        LOG_ERROR << "Failed to read data from a connection socket: " << strerror(errno);
+      }
+      res.code = RC_FAIL;
       break;
     }
-    LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string(buffer.Tail(), static_cast<size_t>(received)));
-    buffer.HaveEnqueued(static_cast<size_t>(received));
-    res = ber_decode(&context, &asn_DEF_AKIpUptaneMes, reinterpret_cast<void**>(&m), buffer.Head(), buffer.Size());
-    buffer.Consume(res.consumed);
-  } while (res.code == RC_WMORE && received > 0);
-  // Note that ber_decode allocates *m even on failure, so this must always be done
-  Asn1Message::Ptr msg = Asn1Message::FromRaw(&m);
+    LOG_TRACE << "Asn1Rpc read " << Utils::toBase64(std::string(buffer->Tail(), static_cast<size_t>(received)));
+    buffer->HaveEnqueued(static_cast<size_t>(received));
+    res = Asn1Decode(msg.get(), &context, buffer);
+  }
 
   if (res.code != RC_OK) {
     LOG_DEBUG << "Asn1Rpc decoding failed";
-    msg->present(AKIpUptaneMes_PR_NOTHING);
+    // What was decoded is freed with the message
+    return Asn1Message::Empty();
   }
 
   return msg;
 }
 
+Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, int con_fd) {
+  // Nothing else is sent before the response, so don't wait to fill a segment.
+  int no_delay = 1;
+  setsockopt(con_fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+
+  std::string request = tx->toStr();
+  const std::string prefix = "AKIpUptaneMes_PR_";
+  if (request.compare(0, prefix.size(), prefix) == 0) {
+    request.erase(0, prefix.size());
+  }
+  Asn1Message::Ptr rx;
+  {
+    const MetricTimer timer(Metrics::instance().histogram("aktualizr_secondary_rpc_duration_seconds",
+                                                          "Duration of the requests to the Secondaries",
+                                                          {{"request", request}}));
+    Asn1Send(tx, con_fd);
+    DequeueBuffer buffer;
+    rx = Asn1Receive(con_fd, &buffer);
+  }
+  if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+    Metrics::instance()
+        .counter("aktualizr_secondary_rpc_failures_total", "Requests to the Secondaries without a response",
+                 {{"request", request}})
+        .add();
+  }
+  return rx;
+}
+
 Asn1Message::Ptr Asn1Rpc(const Asn1Message::Ptr& tx, const std::pair<std::string, uint16_t>& addr) {
   ConnectionSocket connection(addr.first, addr.second);
 
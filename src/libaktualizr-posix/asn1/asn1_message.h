@@ -2,12 +2,15 @@
 #define ASN1_MESSAGE_H_
 
 #include <atomic>
+#include <string>
 
 #include <boost/intrusive_ptr.hpp>
 
 #include "AKIpUptaneMes.h"
 #include "AKTlsConfig.h"
 
+class DequeueBuffer;
+
 class Asn1Message;
 
 template <typename T>
@@ -105,6 +108,18 @@ class Asn1Message {
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootReqMes_t, putRootReq);
   ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootRespMes_t, putRootResp);
 
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadParamsReqMes_t, uploadParamsReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadParamsRespMes_t, uploadParamsResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadChunkReqMes_t, uploadChunkReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadChunkRespMes_t, uploadChunkResp);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKUploadRawReqMes_t, uploadRawReq);
+
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainReqMes_t, putRootChainReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKPutRootChainRespMes_t, putRootChainResp);
+
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKDownloadOstreeStatusReqMes_t, downloadOstreeStatusReq);
+  ASN1_MESSAGE_DEFINE_ACCESSOR(AKDownloadOstreeStatusRespMes_t, downloadOstreeStatusResp);
+
 #define ASN1_MESSAGE_DEFINE_STR_NAME(MessageID) \
   case MessageID:                               \
     return #MessageID;
@@ -138,6 +153,18 @@ class Asn1Message {
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_rootVerResp);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootReq);
         ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootResp);
+
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadParamsReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadParamsResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadChunkReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadChunkResp);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_uploadRawReq);
+
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_putRootChainResp);
+
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_downloadOstreeStatusReq);
+        ASN1_MESSAGE_DEFINE_STR_NAME(AKIpUptaneMes_PR_downloadOstreeStatusResp);
     }
     return "Unknown";
   };
@@ -181,6 +208,34 @@ std::string ToString(const OCTET_STRING_t& octet_str);
 
 void SetString(OCTET_STRING_t* dest, const std::string& str);
 
+/**
+ * Send a message on a connection, in one go. The connection should have
+ * TCP_NODELAY set if the message is to be sent right away.
+ * @return false if it could not be sent
+ */
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd);
+/**
+ * Send a message, encoded into a buffer kept by the caller for the messages
+ * of a connection. Once it has grown to the largest of them, no more memory
+ * is allocated for the encoding.
+ */
+bool Asn1Send(const Asn1Message::Ptr& tx, int con_fd, std::string* encoded);
+
+/**
+ * Decode a message from the data at the head of buffer into the empty
+ * message msg, and consume the decoded data. With RC_WMORE, the decoding goes
+ * on with the same context and msg once more data has been enqueued.
+ */
+asn_dec_rval_t Asn1Decode(Asn1Message* msg, asn_codec_ctx_t* context, DequeueBuffer* buffer);
+
+/**
+ * Receive a message on a connection. The data received after the message is
+ * kept in buffer for the next call, so that several messages can be in
+ * flight on the connection.
+ * @return the message, with nothing present if none could be received
+ */
+Asn1Message::Ptr Asn1Receive(int con_fd, DequeueBuffer* buffer);
+
 /**
  * Open a TCP connection to client; send a message and wait for a
  * response.
@@ -4,14 +4,19 @@
 
 #include <gtest/gtest.h>
 
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <thread>
 
 #include "libaktualizr/config.h"
 
 #include "asn1-cerstream.h"
 #include "asn1_message.h"
 #include "der_encoder.h"
+#include "utilities/dequeue_buffer.h"
 #include "utilities/utils.h"
 
 asn1::Serializer& operator<<(asn1::Serializer& ser, CryptoSource cs) {
@@ -269,6 +274,77 @@ TEST(asn1_common, Asn1MessageFromRawNull) {
   Asn1Message::FromRaw(&m);
 }
 
+/* Messages sent one after the other are received in order, also when they
+ * are received together. */
+TEST(asn1_common, Asn1SendReceive) {
+  int fds[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  const std::string data(10000, 'x');
+  std::string encoded;
+  for (long offset = 0; offset < 3 * 10000; offset += 10000) {
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_uploadChunkReq);
+    auto m = req->uploadChunkReq();
+    m->offset = offset;
+    SetString(&m->data, data);
+    // With an encoding buffer of its own, or one reused from the previous message
+    EXPECT_TRUE(offset == 0 ? Asn1Send(req, fds[0]) : Asn1Send(req, fds[0], &encoded));
+  }
+
+  DequeueBuffer buffer;
+  for (long offset = 0; offset < 3 * 10000; offset += 10000) {
+    Asn1Message::Ptr msg = Asn1Receive(fds[1], &buffer);
+    ASSERT_EQ(msg->present(), AKIpUptaneMes_PR_uploadChunkReq);
+    EXPECT_EQ(msg->uploadChunkReq()->offset, offset);
+    EXPECT_EQ(ToString(msg->uploadChunkReq()->data), data);
+  }
+  close(fds[0]);
+  EXPECT_EQ(Asn1Receive(fds[1], &buffer)->present(), AKIpUptaneMes_PR_NOTHING);
+  close(fds[1]);
+}
+
+/*
+ * uploadDataReq messages per second, with 1 KiB of data as in the uploads to
+ * the IP Secondaries, encoded, sent, received and decoded on a connection;
+ * run with --gtest_also_run_disabled_tests.
+ */
+TEST(asn1_common, DISABLED_UploadDataThroughput) {
+  const std::string data(1024, 'x');
+  const int messages = 100000;
+
+  const auto measure = [&](const std::string& name, bool reuse_encoded) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    int received = 0;
+    std::thread receiver([&]() {
+      DequeueBuffer buffer;
+      while (Asn1Receive(fds[1], &buffer)->present() == AKIpUptaneMes_PR_uploadDataReq) {
+        ++received;
+      }
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+    std::string encoded;
+    for (int i = 0; i < messages; ++i) {
+      Asn1Message::Ptr req(Asn1Message::Empty());
+      req->present(AKIpUptaneMes_PR_uploadDataReq);
+      SetString(&req->uploadDataReq()->data, data);
+      EXPECT_TRUE(reuse_encoded ? Asn1Send(req, fds[0], &encoded) : Asn1Send(req, fds[0]));
+    }
+    close(fds[0]);
+    receiver.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    close(fds[1]);
+
+    EXPECT_EQ(received, messages);
+    const auto per_second = static_cast<int64_t>(messages / elapsed.count());
+    RecordProperty(name + "_per_s", std::to_string(per_second));
+    std::cout << name << ": " << per_second << " messages/s\n";
+  };
+  measure("upload_data_new_buffer", false);
+  measure("upload_data_reused_buffer", true);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
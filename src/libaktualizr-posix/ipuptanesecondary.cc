@@ -3,27 +3,37 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 
+#include <algorithm>
 #include <array>
+#include <deque>
 #include <fstream>
+#include <limits>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "asn1/asn1_message.h"
+#include "crypto/crypto.h"
 #include "der_encoder.h"
 #include "libaktualizr/secondary_provider.h"
 #include "logging/logging.h"
+#include "secondary_connection.h"
 #include "uptane/tuf.h"
+#include "utilities/deflate_stream.h"
 #include "utilities/flow_control.h"
+#include "utilities/io_uring.h"
 #include "utilities/utils.h"
 
 namespace Uptane {
 
 SecondaryInterface::Ptr IpUptaneSecondary::connectAndCreate(const std::string& address, unsigned short port,
-                                                            VerificationType verification_type) {
+                                                            VerificationType verification_type,
+                                                            std::chrono::milliseconds timeout) {
   LOG_INFO << "Connecting to and getting info about IP Secondary: " << address << ":" << port << "...";
 
   ConnectionSocket con_sock{address, port};
 
-  if (con_sock.connect() == 0) {
+  if ((timeout.count() > 0 ? con_sock.connect(timeout) : con_sock.connect()) == 0) {
     LOG_INFO << "Connected to IP Secondary: "
              << "(" << address << ":" << port << ")";
   } else {
@@ -63,12 +73,13 @@ SecondaryInterface::Ptr IpUptaneSecondary::create(const std::string& address, un
 
 SecondaryInterface::Ptr IpUptaneSecondary::connectAndCheck(const std::string& address, unsigned short port,
                                                            VerificationType verification_type, EcuSerial serial,
-                                                           HardwareIdentifier hw_id, PublicKey pub_key) {
+                                                           HardwareIdentifier hw_id, PublicKey pub_key,
+                                                           std::chrono::milliseconds timeout) {
   // try to connect:
   // - if it succeeds compare with what we expect
   // - otherwise, keep using what we know
   try {
-    auto sec = IpUptaneSecondary::connectAndCreate(address, port, verification_type);
+    auto sec = IpUptaneSecondary::connectAndCreate(address, port, verification_type, timeout);
     if (sec != nullptr) {
       auto s = sec->getSerial();
       if (s != serial && serial != EcuSerial::Unknown()) {
@@ -106,7 +117,12 @@ IpUptaneSecondary::IpUptaneSecondary(const std::string& address, unsigned short
       verification_type_{verification_type},
       serial_{std::move(serial)},
       hw_id_{std::move(hw_id)},
-      pub_key_{std::move(pub_key)} {}
+      pub_key_{std::move(pub_key)},
+      connection_{std_::make_unique<SecondaryConnection>(addr_)} {}
+
+IpUptaneSecondary::~IpUptaneSecondary() = default;
+
+void IpUptaneSecondary::setLinkOptions(const SecondaryLinkOptions& options) { connection_->setOptions(options); }
 
 /* Determine the best protocol version to use for this Secondary. This did not
  * exist for v1 and thus only works for v2 and beyond. It would be great if we
@@ -115,12 +131,12 @@ IpUptaneSecondary::IpUptaneSecondary(const std::string& address, unsigned short
  * installation. */
 void IpUptaneSecondary::getSecondaryVersion() const {
   LOG_DEBUG << "Negotiating the protocol version with Secondary " << getSerial();
-  const uint32_t latest_version = 2;
+  const uint32_t latest_version = 6;
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_versionReq);
   auto m = req->versionReq();
   m->version = latest_version;
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_versionResp) {
     // Bad response probably means v1, but make sure the Secondary is actually
@@ -148,23 +164,25 @@ void IpUptaneSecondary::getSecondaryVersion() const {
 }
 
 data::InstallationResult IpUptaneSecondary::putMetadata(const Target& target) {
-  Uptane::MetaBundle meta_bundle;
-  bool load_result;
-  if (verification_type_ == VerificationType::kTuf) {
-    load_result = secondary_provider_->getImageRepoMetadata(&meta_bundle, target);
-  } else {
-    load_result = secondary_provider_->getMetadata(&meta_bundle, target);
+  // Shared by all the Secondaries; only the Image repo metadata is needed with TUF verification.
+  std::shared_ptr<const Uptane::MetaBundle> shared_bundle = secondary_provider_->getMetaBundle();
+  if (!shared_bundle && verification_type_ == VerificationType::kTuf) {
+    auto image_bundle = std::make_shared<Uptane::MetaBundle>();
+    if (secondary_provider_->getImageRepoMetadata(image_bundle.get(), target)) {
+      shared_bundle = std::move(image_bundle);
+    }
   }
-  if (!load_result) {
+  if (!shared_bundle) {
     return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
                                     "Unable to load stored metadata from Primary");
   }
+  const Uptane::MetaBundle& meta_bundle = *shared_bundle;
 
   getSecondaryVersion();
 
   LOG_INFO << "Sending Uptane metadata to the Secondary";
   data::InstallationResult put_result;
-  if (protocol_version == 2) {
+  if (protocol_version >= 2) {
     put_result = putMetadata_v2(meta_bundle);
   } else if (protocol_version == 1) {
     put_result = putMetadata_v1(meta_bundle);
@@ -207,7 +225,7 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v1(const Uptane::MetaBun
   SetString(&m->image.choice.json.targets,
             getMetaFromBundle(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_putMetaResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
@@ -256,7 +274,7 @@ data::InstallationResult IpUptaneSecondary::putMetadata_v2(const Uptane::MetaBun
   // NOLINTNEXTLINE(cppcoreguidelines-pro-type-union-access)
   addMetadata(meta_bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets(), m->imageRepo.choice.collection);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_putMetaResp2) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive metadata.";
@@ -283,7 +301,7 @@ int32_t IpUptaneSecondary::getRootVersion(bool director) const {
     m->repotype = AKRepoType_image;
   }
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_rootVerResp) {
     // v1 (and v2 until this was added) Secondaries won't understand this.
     // Return 0 to indicate that this is unsupported. Sending intermediate Roots
@@ -313,7 +331,7 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   }
   SetString(&m->json, root);
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
   if (resp->present() != AKIpUptaneMes_PR_putRootResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive Root metadata.";
     return data::InstallationResult(
@@ -325,6 +343,43 @@ data::InstallationResult IpUptaneSecondary::putRoot(const std::string& root, boo
   return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
 }
 
+data::InstallationResult IpUptaneSecondary::putRootChain(const std::vector<std::string>& roots, bool director,
+                                                         size_t* stored) {
+  if (director && verification_type_ == VerificationType::kTuf) {
+    *stored = roots.size();
+    return data::InstallationResult(data::ResultCode::Numeric::kOk,
+                                    "Secondary " + getSerial().ToString() +
+                                        " uses TUF verification and thus does not require Director Root metadata.");
+  }
+  getSecondaryVersion();
+  if (protocol_version < 5 || roots.size() <= 1) {
+    return SecondaryInterface::putRootChain(roots, director, stored);
+  }
+
+  *stored = 0;
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_putRootChainReq);
+  auto m = req->putRootChainReq();
+  m->repotype = director ? AKRepoType_director : AKRepoType_image;
+  for (const auto& root : roots) {
+    auto* root_json = Asn1Allocation<OCTET_STRING_t>();
+    SetString(root_json, root);
+    ASN_SEQUENCE_ADD(&m->roots, root_json);
+  }
+
+  auto resp = connection_->rpc(req);
+  if (resp->present() != AKIpUptaneMes_PR_putRootChainResp) {
+    LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive Root metadata.";
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kInternalError,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive Root metadata.");
+  }
+
+  auto r = resp->putRootChainResp();
+  *stored = static_cast<size_t>(r->stored);
+  return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+}
+
 Manifest IpUptaneSecondary::getManifest() const {
   getSecondaryVersion();
 
@@ -332,7 +387,7 @@ Manifest IpUptaneSecondary::getManifest() const {
   Asn1Message::Ptr req(Asn1Message::Empty());
 
   req->present(AKIpUptaneMes_PR_manifestReq);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_manifestResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a manifest request.";
@@ -354,21 +409,21 @@ bool IpUptaneSecondary::ping() const {
 
   auto m = req->getInfoReq();
 
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   return resp->present() == AKIpUptaneMes_PR_getInfoResp;
 }
 
 data::InstallationResult IpUptaneSecondary::sendFirmware(const Uptane::Target& target,
                                                          const api::FlowControlToken* flow_control) {
+  // The uploads also stop between their chunks.
+  // TODO: Add an abort message to the IPUptane protocol
   if (flow_control != nullptr && flow_control->hasAborted()) {
-    // TODO: Add an abort message to the IPUptane protocol and allow aborts
-    // during firmware transfer
     return data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled, "");
   }
 
-  if (protocol_version == 2) {
-    return sendFirmware_v2(target);
+  if (protocol_version >= 2) {
+    return sendFirmware_v2(target, flow_control);
   }
   if (protocol_version == 1) {
     return sendFirmware_v1(target);
@@ -397,7 +452,7 @@ data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target
 
   auto m = req->sendFirmwareReq();
   SetString(&m->firmware, data_to_send);
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_sendFirmwareResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware.";
@@ -413,12 +468,13 @@ data::InstallationResult IpUptaneSecondary::sendFirmware_v1(const Uptane::Target
   return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "");
 }
 
-data::InstallationResult IpUptaneSecondary::sendFirmware_v2(const Uptane::Target& target) {
+data::InstallationResult IpUptaneSecondary::sendFirmware_v2(const Uptane::Target& target,
+                                                            const api::FlowControlToken* flow_control) {
   LOG_INFO << "Instructing Secondary " << getSerial() << " to receive target " << target.filename();
   if (target.IsOstree()) {
     return downloadOstreeRev(target);
   } else {
-    return uploadFirmware(target);
+    return uploadFirmware(target, flow_control);
   }
 }
 
@@ -431,7 +487,7 @@ data::InstallationResult IpUptaneSecondary::install(const Uptane::Target& target
   }
 
   data::InstallationResult install_result;
-  if (protocol_version == 2) {
+  if (protocol_version >= 2) {
     install_result = install_v2(target);
   } else if (protocol_version == 1) {
     install_result = install_v1(target);
@@ -454,7 +510,7 @@ data::InstallationResult IpUptaneSecondary::install_v1(const Uptane::Target& tar
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
   // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp) {
@@ -475,6 +531,53 @@ data::InstallationResult IpUptaneSecondary::install_v2(const Uptane::Target& tar
   return invokeInstallOnSecondary(target);
 }
 
+// Interval between the requests for the status of an OSTree download
+static constexpr std::chrono::milliseconds kOstreeStatusPollInterval{500};
+
+// Follow the background download of an OSTree Secondary until it is finished,
+// from the response to the request that started it.
+static data::InstallationResult pollOstreeDownload(SecondaryConnection& connection, const EcuSerial& serial,
+                                                   const Uptane::Target& target, Asn1Message::Ptr resp,
+                                                   const SecondaryInterface::ProgressCb& progress_cb) {
+  unsigned int last_progress = 0;
+  uint32_t last_fetched = 0;
+  while (true) {
+    if (resp->present() != AKIpUptaneMes_PR_downloadOstreeStatusResp) {
+      LOG_ERROR << "Secondary " << serial << " failed to respond to a request for its OSTree download status.";
+      return data::InstallationResult(
+          data::ResultCode::Numeric::kUnknown,
+          "Secondary " + serial.ToString() + " failed to respond to a request for its OSTree download status.");
+    }
+    auto r = resp->downloadOstreeStatusResp();
+    if (r->state == AKOstreeDownloadState_finished) {
+      return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+    }
+    if (r->state != AKOstreeDownloadState_running) {
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Secondary " + serial.ToString() + " is not downloading the OSTree commit");
+    }
+
+    const auto fetched = static_cast<uint32_t>(r->fetchedObjects);
+    const auto requested = static_cast<uint32_t>(r->requestedObjects);
+    if (requested > 0 && fetched != last_fetched) {
+      last_fetched = fetched;
+      const auto progress = static_cast<unsigned int>((static_cast<uint64_t>(fetched) * 100) / requested);
+      LOG_DEBUG << "Secondary " << serial << " has fetched " << fetched << " of " << requested << " objects ("
+                << r->fetchedBytes << " bytes)";
+      // 100 is for the end of the download
+      if (progress != last_progress && progress < 100 && progress_cb) {
+        last_progress = progress;
+        progress_cb(target, "Receiving objects", progress);
+      }
+    }
+
+    std::this_thread::sleep_for(kOstreeStatusPollInterval);
+    Asn1Message::Ptr req(Asn1Message::Empty());
+    req->present(AKIpUptaneMes_PR_downloadOstreeStatusReq);
+    resp = connection.rpc(req);
+  }
+}
+
 data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Target& target) {
   LOG_INFO << "Instructing Secondary " << getSerial() << " to download OSTree commit " << target.sha256Hash();
   const std::string tls_creds = secondary_provider_->getTreehubCredentials();
@@ -483,7 +586,13 @@ data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Targ
 
   auto m = req->downloadOstreeRevReq();
   SetString(&m->tlsCred, tls_creds);
-  auto resp = Asn1Rpc(req, getAddr());
+  // From v6, the Secondary pulls in the background and reports its progress.
+  if (protocol_version >= 6) {
+    m->async = Asn1Allocation<BOOLEAN_t>();
+    *m->async = 1;
+    return pollOstreeDownload(*connection_, getSerial(), target, connection_->rpc(req), progress_cb_);
+  }
+  auto resp = connection_->rpc(req);
 
   if (resp->present() != AKIpUptaneMes_PR_downloadOstreeRevResp) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to download an OSTree commit.";
@@ -496,7 +605,152 @@ data::InstallationResult IpUptaneSecondary::downloadOstreeRev(const Uptane::Targ
   return data::InstallationResult(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
 }
 
-data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target& target) {
+// Size of the image data sent in one request
+static constexpr size_t kUploadChunkSize = 1024;
+
+// Read size bytes, fewer only at the end of the file
+static std::streamsize readFully(UringFileReader& reader, uint8_t* data, size_t size) {
+  size_t done = 0;
+  while (done < size) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    const ssize_t read = reader.read(data + done, size - done);
+    if (read <= 0) {
+      break;
+    }
+    done += static_cast<size_t>(read);
+  }
+  return static_cast<std::streamsize>(done);
+}
+// Chunk size and number of unacknowledged chunks proposed for the windowed
+// uploads of protocol v3
+static constexpr long kWindowedUploadChunkSize = 512L * 1024;
+static constexpr long kWindowedUploadWindow = 8;
+// Attempts of a windowed upload when the connection drops, each going on from
+// what the Secondary has received
+static constexpr int kWindowedUploadAttempts = 3;
+static constexpr std::chrono::seconds kWindowedUploadRetryDelay{2};
+
+// The offsets of the chunks are ASN.1 INTEGERs, a long, which only has 32 bits
+// on 32-bit systems: the end of the image has to fit.
+static bool fitsOffset(uint64_t end) { return end <= static_cast<uint64_t>(std::numeric_limits<long>::max()); }
+
+static data::InstallationResult offsetTooLarge(const EcuSerial& serial, uint64_t size) {
+  return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                  "The image of " + std::to_string(size) + " bytes is too large for the chunks of " +
+                                      "the upload protocol to Secondary " + serial.ToString() + " on this system");
+}
+
+static Asn1Message::Ptr requestUploadParams(SecondaryConnection& connection, bool compression, bool discard) {
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_uploadParamsReq);
+  auto m = req->uploadParamsReq();
+  m->chunkSize = kWindowedUploadChunkSize;
+  m->window = kWindowedUploadWindow;
+  if (compression) {
+    m->compression = Asn1Allocation<AKCompression_t>();
+    *m->compression = AKCompression_deflate;
+  }
+  if (discard) {
+    m->discard = Asn1Allocation<BOOLEAN_t>();
+    *m->discard = 1;
+  }
+  return connection.rpc(req);
+}
+
+IpUptaneSecondary::FirmwareStream IpUptaneSecondary::streamFirmware(const Uptane::Target& target) {
+  if (target.IsOstree()) {
+    return FirmwareStream();
+  }
+  // The Secondary only accepts the image of the target of its metadata.
+  if (!putMetadata(target).isSuccess() || protocol_version < 2) {
+    return FirmwareStream();
+  }
+  {
+    std::lock_guard<std::mutex> guard(streamed_mutex_);
+    streamed_ = {target.filename(), 0};
+  }
+  // From v3, the data goes in chunks whose offsets are checked, as large as
+  // the Secondary accepts.
+  if (protocol_version >= 3) {
+    if (!fitsOffset(target.length())) {
+      return FirmwareStream();
+    }
+    auto params_resp = requestUploadParams(*connection_, false, false);
+    if (params_resp->present() != AKIpUptaneMes_PR_uploadParamsResp) {
+      return FirmwareStream();
+    }
+    auto params = params_resp->uploadParamsResp();
+    // Data received before has to be checked, uploadFirmware() does it.
+    if (params->offset != 0) {
+      return FirmwareStream();
+    }
+    const auto chunk_size = static_cast<size_t>(std::max(1L, std::min(params->chunkSize, kWindowedUploadChunkSize)));
+    LOG_INFO << "Streaming the target image (" << target.filename() << ") to the Secondary (" << getSerial()
+             << ") in chunks of " << chunk_size << " bytes";
+    return [this, chunk_size](const uint8_t* data, size_t size) {
+      for (size_t sent = 0; sent < size;) {
+        const size_t chunk = std::min(size - sent, chunk_size);
+        uint64_t offset;
+        {
+          std::lock_guard<std::mutex> guard(streamed_mutex_);
+          offset = streamed_.second;
+        }
+        const auto result = uploadFirmwareChunk(offset, data + sent, chunk);
+        if (!result.isSuccess()) {
+          LOG_WARNING << "Secondary " << getSerial() << " stopped accepting the streamed image: " << result.description;
+          return false;
+        }
+        sent += chunk;
+        std::lock_guard<std::mutex> guard(streamed_mutex_);
+        streamed_.second += chunk;
+      }
+      return true;
+    };
+  }
+  LOG_INFO << "Streaming the target image (" << target.filename() << ") "
+           << "to the Secondary (" << getSerial() << ")";
+  return [this](const uint8_t* data, size_t size) {
+    for (size_t sent = 0; sent < size;) {
+      const size_t chunk = std::min(size - sent, kUploadChunkSize);
+      const auto result = uploadFirmwareData(data + sent, chunk);
+      if (!result.isSuccess()) {
+        LOG_WARNING << "Secondary " << getSerial() << " stopped accepting the streamed image: " << result.description;
+        return false;
+      }
+      sent += chunk;
+      std::lock_guard<std::mutex> guard(streamed_mutex_);
+      streamed_.second += chunk;
+    }
+    return true;
+  };
+}
+
+data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target& target,
+                                                           const api::FlowControlToken* flow_control) {
+  if (protocol_version >= 3) {
+    bool supported = true;
+    for (int attempt = 1;; ++attempt) {
+      bool dropped = false;
+      auto result = uploadFirmwareWindowed(target, &supported, &dropped, flow_control);
+      if (!supported) {
+        break;
+      }
+      if (!dropped || attempt == kWindowedUploadAttempts) {
+        return result;
+      }
+      LOG_WARNING << "Lost the connection to Secondary " << getSerial() << " during the upload: "
+                  << result.description << "; resuming it";
+      if (flow_control != nullptr) {
+        if (!flow_control->sleepFor(kWindowedUploadRetryDelay * attempt)) {
+          return data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled, "");
+        }
+      } else {
+        std::this_thread::sleep_for(kWindowedUploadRetryDelay * attempt);
+      }
+    }
+    LOG_INFO << "Secondary " << getSerial() << " doesn't accept windowed uploads, falling back to protocol v2";
+  }
+
   LOG_INFO << "Uploading the target image (" << target.filename() << ") "
            << "to the Secondary (" << getSerial() << ")";
 
@@ -505,15 +759,41 @@ data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target&
   auto image_reader = secondary_provider_->getTargetFileHandle(target);
 
   uint64_t image_size = target.length();
-  const size_t size = 1024;
   size_t total_send_data = 0;
-  std::array<uint8_t, size> buf{};
+  {
+    std::lock_guard<std::mutex> guard(streamed_mutex_);
+    if (streamed_.first == target.filename()) {
+      total_send_data = static_cast<size_t>(streamed_.second);
+    }
+    streamed_ = {};
+  }
+  if (total_send_data > 0) {
+    LOG_INFO << total_send_data << " bytes of the image were streamed during the download, sending the rest";
+    image_reader.seekg(static_cast<std::streamoff>(total_send_data));
+  }
+  std::array<uint8_t, kUploadChunkSize> buf{};
   auto upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  // Reads ahead of the small chunks, if enabled
+  const auto uring_reader = secondary_provider_->getTargetFileReader(target, total_send_data);
 
   while (total_send_data < image_size && upload_data_result.isSuccess()) {
-    image_reader.read(reinterpret_cast<char*>(buf.data()), buf.size());
-    upload_data_result = uploadFirmwareData(buf.data(), static_cast<size_t>(image_reader.gcount()));
-    total_send_data += static_cast<size_t>(image_reader.gcount());
+    // The Secondary can't resume a v2 upload, it starts over next time
+    if (flow_control != nullptr && flow_control->hasAborted()) {
+      upload_data_result = data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled, "");
+      break;
+    }
+    std::streamsize read = 0;
+    if (uring_reader != nullptr) {
+      read = readFully(*uring_reader, buf.data(), buf.size());
+      if (read == 0) {
+        break;
+      }
+    } else {
+      image_reader.read(reinterpret_cast<char*>(buf.data()), buf.size());
+      read = image_reader.gcount();
+    }
+    upload_data_result = uploadFirmwareData(buf.data(), static_cast<size_t>(read));
+    total_send_data += static_cast<size_t>(read);
   }
   if (upload_data_result.isSuccess() && total_send_data == image_size) {
     upload_result = data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -526,13 +806,257 @@ data::InstallationResult IpUptaneSecondary::uploadFirmware(const Uptane::Target&
   return upload_result;
 }
 
+/* Upload the image over one connection in chunks whose offsets are checked
+ * by the Secondary, sending up to a window of them before waiting for their
+ * responses. The Secondary picks the chunk size and window out of the ones
+ * proposed, and tells where to go on from, which covers what was streamed
+ * during the download and what it received before the connection dropped.
+ * That data is checked against the hash of what it should be. */
+data::InstallationResult IpUptaneSecondary::uploadFirmwareWindowed(const Uptane::Target& target, bool* supported,
+                                                                   bool* dropped,
+                                                                   const api::FlowControlToken* flow_control) {
+  uint64_t streamed = 0;
+  {
+    std::lock_guard<std::mutex> guard(streamed_mutex_);
+    if (streamed_.first == target.filename()) {
+      streamed = streamed_.second;
+    }
+  }
+  auto params_resp = requestUploadParams(*connection_, upload_compression_, false);
+  if (params_resp->present() == AKIpUptaneMes_PR_NOTHING) {
+    *dropped = true;
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Secondary " + getSerial().ToString() + " failed to respond to an upload request");
+  }
+  if (params_resp->present() != AKIpUptaneMes_PR_uploadParamsResp) {
+    *supported = false;
+    return data::InstallationResult();
+  }
+  // What was streamed to it just before doesn't need to be checked.
+  if (params_resp->uploadParamsResp()->offset > 0 &&
+      static_cast<uint64_t>(params_resp->uploadParamsResp()->offset) != streamed &&
+      !matchesReceivedData(target, static_cast<uint64_t>(params_resp->uploadParamsResp()->offset),
+                           params_resp->uploadParamsResp()->receivedHash)) {
+    LOG_WARNING << "The " << params_resp->uploadParamsResp()->offset << " bytes received by Secondary "
+                << getSerial() << " are not part of " << target.filename() << ", sending the whole image";
+    params_resp = requestUploadParams(*connection_, upload_compression_, true);
+    if (params_resp->present() != AKIpUptaneMes_PR_uploadParamsResp) {
+      *dropped = params_resp->present() == AKIpUptaneMes_PR_NOTHING;
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Secondary " + getSerial().ToString() + " failed to restart the upload");
+    }
+  }
+  auto params = params_resp->uploadParamsResp();
+  const auto chunk_size = static_cast<uint64_t>(std::max(1L, std::min(params->chunkSize, kWindowedUploadChunkSize)));
+  const auto window = static_cast<size_t>(std::max(1L, std::min(params->window, kWindowedUploadWindow)));
+  const uint64_t image_size = target.length();
+  if (!fitsOffset(image_size)) {
+    return offsetTooLarge(getSerial(), image_size);
+  }
+  // Only a Secondary that knows about the compression answers with it.
+  std::unique_ptr<DeflateStream> deflater;
+  if (upload_compression_ && params->compression != nullptr && *params->compression == AKCompression_deflate) {
+    deflater = std_::make_unique<DeflateStream>();
+  }
+  if (params->offset < 0 || static_cast<uint64_t>(params->offset) > image_size) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Secondary " + getSerial().ToString() + " has received " +
+                                        std::to_string(params->offset) + " bytes of an image of " +
+                                        std::to_string(image_size));
+  }
+  auto sent = static_cast<uint64_t>(params->offset);
+  {
+    std::lock_guard<std::mutex> guard(streamed_mutex_);
+    streamed_ = {};
+  }
+  LOG_INFO << "Uploading the target image (" << target.filename() << ") to the Secondary (" << getSerial()
+           << ") from offset " << sent << " in chunks of " << chunk_size << " bytes, " << window << " at a time"
+           << (deflater != nullptr ? ", compressed" : "");
+  const uint64_t start_offset = sent;
+  uint64_t sent_on_wire = 0;
+
+  std::lock_guard<std::mutex> connection_guard(connection_->mutex());
+  if (!connection_->open()) {
+    *dropped = true;
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Failed to connect to Secondary " + getSerial().ToString());
+  }
+  // From v4, the image data goes from the stored file to the connection
+  // without being copied, after a request telling its offset and length.
+  // Compressed chunks have to go through memory anyway.
+  StructGuardInt<FILE> raw_file(nullptr, fclose);
+  if (protocol_version >= 4 && deflater == nullptr) {
+    const std::string path = secondary_provider_->getTargetFilePath(target);
+    if (!path.empty()) {
+      raw_file.reset(fopen(path.c_str(), "rb"));
+    }
+  }
+  std::ifstream image_reader;
+  std::unique_ptr<UringFileReader> uring_reader;
+  std::vector<char> chunk;
+  if (raw_file == nullptr) {
+    uring_reader = secondary_provider_->getTargetFileReader(target, sent);
+    if (uring_reader == nullptr) {
+      image_reader = secondary_provider_->getTargetFileHandle(target);
+      image_reader.seekg(static_cast<std::streamoff>(sent));
+    }
+    chunk.resize(static_cast<size_t>(chunk_size));
+  }
+  // End offsets of the chunks that are not acknowledged yet
+  std::deque<uint64_t> in_flight;
+  // Once cancelled or out of time, no more chunks are sent, and those on the
+  // way are acknowledged so that the next upload goes on from the last one.
+  bool cancelled = false;
+
+  while (sent < image_size || !in_flight.empty()) {
+    cancelled = cancelled || (flow_control != nullptr && flow_control->hasAborted());
+    while (!cancelled && sent < image_size && in_flight.size() < window) {
+      const auto size = static_cast<size_t>(std::min(chunk_size, image_size - sent));
+      Asn1Message::Ptr req(Asn1Message::Empty());
+      bool sent_chunk;
+      if (raw_file != nullptr) {
+        req->present(AKIpUptaneMes_PR_uploadRawReq);
+        auto m = req->uploadRawReq();
+        m->offset = static_cast<long>(sent);
+        m->length = static_cast<long>(size);
+        sent_chunk = connection_->send(req) && connection_->sendFile(fileno(raw_file.get()), sent, size);
+        sent_on_wire += size;
+      } else {
+        std::streamsize read = 0;
+        if (uring_reader != nullptr) {
+          read = readFully(*uring_reader, reinterpret_cast<uint8_t*>(chunk.data()), size);
+        } else {
+          image_reader.read(chunk.data(), static_cast<std::streamsize>(size));
+          read = image_reader.gcount();
+        }
+        if (read != static_cast<std::streamsize>(size)) {
+          return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                          "Failed to read the image of " + target.filename());
+        }
+        req->present(AKIpUptaneMes_PR_uploadChunkReq);
+        auto m = req->uploadChunkReq();
+        m->offset = static_cast<long>(sent);
+        if (deflater != nullptr) {
+          std::string compressed;
+          try {
+            compressed = deflater->compress(reinterpret_cast<const uint8_t*>(chunk.data()), size);
+          } catch (const std::exception& e) {
+            return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                            std::string("Failed to compress the image: ") + e.what());
+          }
+          OCTET_STRING_fromBuf(&m->data, compressed.data(), static_cast<int>(compressed.size()));
+          sent_on_wire += compressed.size();
+        } else {
+          OCTET_STRING_fromBuf(&m->data, chunk.data(), static_cast<int>(size));
+          sent_on_wire += size;
+        }
+        sent_chunk = connection_->send(req);
+      }
+      if (!sent_chunk) {
+        *dropped = true;
+        return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                        "Failed to send image data to Secondary " + getSerial().ToString());
+      }
+      sent += size;
+      in_flight.push_back(sent);
+    }
+    if (in_flight.empty()) {
+      break;
+    }
+
+    auto resp = connection_->receive();
+    if (resp->present() != AKIpUptaneMes_PR_uploadChunkResp) {
+      *dropped = resp->present() == AKIpUptaneMes_PR_NOTHING;
+      LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware data.";
+      return data::InstallationResult(
+          data::ResultCode::Numeric::kUnknown,
+          "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+    }
+    auto r = resp->uploadChunkResp();
+    data::InstallationResult result(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+    if (!result.isSuccess()) {
+      return result;
+    }
+    if (r->offset < 0 || static_cast<uint64_t>(r->offset) != in_flight.front()) {
+      return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                      "Secondary " + getSerial().ToString() + " has received " +
+                                          std::to_string(r->offset) + " bytes instead of " +
+                                          std::to_string(in_flight.front()));
+    }
+    in_flight.pop_front();
+  }
+  if (sent < image_size) {
+    LOG_INFO << "Stopped the upload to the Secondary (" << getSerial() << ") after " << sent << " bytes of "
+             << image_size << ", the next one goes on from there";
+    return data::InstallationResult(data::ResultCode::Numeric::kOperationCancelled, "");
+  }
+  if (deflater != nullptr && sent_on_wire > 0) {
+    LOG_INFO << "Sent " << (image_size - start_offset) << " bytes of the image to the Secondary (" << getSerial()
+             << ") as " << sent_on_wire << " compressed bytes, a ratio of "
+             << static_cast<double>(image_size - start_offset) / static_cast<double>(sent_on_wire);
+  }
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+}
+
+bool IpUptaneSecondary::matchesReceivedData(const Uptane::Target& target, uint64_t size,
+                                            const OCTET_STRING_t* received_hash) const {
+  // Older Secondaries don't tell, their data is used as it is.
+  if (received_hash == nullptr) {
+    return true;
+  }
+  if (target.hashes().empty() || size > target.length()) {
+    return false;
+  }
+  const Hash::Type type = target.hashes()[0].type();
+  auto hasher = MultiPartHasher::create(type);
+  auto image_reader = secondary_provider_->getTargetFileHandle(target);
+  std::array<uint8_t, 64 * 1024> buf{};
+  for (uint64_t hashed = 0; hashed < size;) {
+    image_reader.read(reinterpret_cast<char*>(buf.data()),
+                      static_cast<std::streamsize>(std::min<uint64_t>(buf.size(), size - hashed)));
+    if (image_reader.gcount() <= 0) {
+      return false;
+    }
+    hasher->update(buf.data(), static_cast<uint64_t>(image_reader.gcount()));
+    hashed += static_cast<uint64_t>(image_reader.gcount());
+  }
+  return hasher->getHash() == Hash(type, ToString(*received_hash));
+}
+
+data::InstallationResult IpUptaneSecondary::uploadFirmwareChunk(uint64_t offset, const uint8_t* data, size_t size) {
+  if (!fitsOffset(offset + size)) {
+    return offsetTooLarge(getSerial(), offset + size);
+  }
+  Asn1Message::Ptr req(Asn1Message::Empty());
+  req->present(AKIpUptaneMes_PR_uploadChunkReq);
+  auto m = req->uploadChunkReq();
+  m->offset = static_cast<long>(offset);
+  OCTET_STRING_fromBuf(&m->data, reinterpret_cast<const char*>(data), static_cast<int>(size));
+  auto resp = connection_->rpc(req);
+
+  if (resp->present() != AKIpUptaneMes_PR_uploadChunkResp) {
+    return data::InstallationResult(
+        data::ResultCode::Numeric::kUnknown,
+        "Secondary " + getSerial().ToString() + " failed to respond to a request to receive firmware data.");
+  }
+  auto r = resp->uploadChunkResp();
+  data::InstallationResult result(static_cast<data::ResultCode::Numeric>(r->result), ToString(r->description));
+  if (result.isSuccess() && static_cast<uint64_t>(r->offset) != offset + size) {
+    return data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                    "Secondary " + getSerial().ToString() + " has received " +
+                                        std::to_string(r->offset) + " bytes instead of " +
+                                        std::to_string(offset + size));
+  }
+  return result;
+}
+
 data::InstallationResult IpUptaneSecondary::uploadFirmwareData(const uint8_t* data, size_t size) {
   Asn1Message::Ptr req(Asn1Message::Empty());
   req->present(AKIpUptaneMes_PR_uploadDataReq);
 
   auto m = req->uploadDataReq();
   OCTET_STRING_fromBuf(&m->data, reinterpret_cast<const char*>(data), static_cast<int>(size));
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   if (resp->present() == AKIpUptaneMes_PR_NOTHING) {
     LOG_ERROR << "Secondary " << getSerial() << " failed to respond to a request to receive firmware data.";
@@ -559,7 +1083,7 @@ data::InstallationResult IpUptaneSecondary::invokeInstallOnSecondary(const Uptan
   auto req_mes = req->installReq();
   SetString(&req_mes->hash, target.filename());
   // send request and receive response, a request-response type of RPC
-  auto resp = Asn1Rpc(req, getAddr());
+  auto resp = connection_->rpc(req);
 
   // invalid type of an response message
   if (resp->present() != AKIpUptaneMes_PR_installResp2) {
@@ -1,27 +1,64 @@
 #ifndef UPTANE_IPUPTANESECONDARY_H_
 #define UPTANE_IPUPTANESECONDARY_H_
 
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
 #include "libaktualizr/secondaryinterface.h"
 #include "libaktualizr/types.h"
 
 struct AKMetaCollection;
 using AKMetaCollection_t = struct AKMetaCollection;
+struct OCTET_STRING;
+using OCTET_STRING_t = struct OCTET_STRING;
 
 namespace Uptane {
 
+class SecondaryConnection;
+
+/**
+ * TCP settings of the connection to a Secondary, to notice quickly that it
+ * went away instead of waiting for the system's timeouts of several minutes.
+ * They don't apply to Unix domain sockets.
+ */
+struct SecondaryLinkOptions {
+  // Zero waits as long as the system does.
+  std::chrono::milliseconds connect_timeout{0};
+  // For each send and receive; zero for none, as an installation can take long.
+  std::chrono::milliseconds io_timeout{0};
+  // Probe an idle connection after keepalive_idle, every keepalive_interval,
+  // and give up after keepalive_count probes; a zero keepalive_idle disables it.
+  std::chrono::seconds keepalive_idle{10};
+  std::chrono::seconds keepalive_interval{5};
+  int keepalive_count{3};
+  // Give up when sent data stays unacknowledged that long; zero for the system's default.
+  std::chrono::milliseconds user_timeout{30000};
+};
+
 class IpUptaneSecondary : public SecondaryInterface {
  public:
-  static SecondaryInterface::Ptr connectAndCreate(const std::string& address, unsigned short port,
-                                                  VerificationType verification_type);
+  // A zero timeout waits as long as the system does for the connection.
+  static SecondaryInterface::Ptr connectAndCreate(
+      const std::string& address, unsigned short port, VerificationType verification_type,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
   static SecondaryInterface::Ptr create(const std::string& address, unsigned short port,
                                         VerificationType verification_type, int con_fd);
 
-  static SecondaryInterface::Ptr connectAndCheck(const std::string& address, unsigned short port,
-                                                 VerificationType verification_type, EcuSerial serial,
-                                                 HardwareIdentifier hw_id, PublicKey pub_key);
+  static SecondaryInterface::Ptr connectAndCheck(
+      const std::string& address, unsigned short port, VerificationType verification_type, EcuSerial serial,
+      HardwareIdentifier hw_id, PublicKey pub_key,
+      std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
 
   explicit IpUptaneSecondary(const std::string& address, unsigned short port, VerificationType verification_type,
                              EcuSerial serial, HardwareIdentifier hw_id, PublicKey pub_key);
+  ~IpUptaneSecondary() override;
+  IpUptaneSecondary(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary(IpUptaneSecondary&&) = delete;
+  IpUptaneSecondary& operator=(const IpUptaneSecondary&) = delete;
+  IpUptaneSecondary& operator=(IpUptaneSecondary&&) = delete;
 
   std::string Type() const override { return "IP"; }
   EcuSerial getSerial() const override { return serial_; };
@@ -34,26 +71,42 @@ class IpUptaneSecondary : public SecondaryInterface {
   data::InstallationResult putMetadata(const Target& target) override;
   int32_t getRootVersion(bool director) const override;
   data::InstallationResult putRoot(const std::string& root, bool director) override;
+  data::InstallationResult putRootChain(const std::vector<std::string>& roots, bool director,
+                                        size_t* stored) override;
   Manifest getManifest() const override;
   bool ping() const override;
   data::InstallationResult sendFirmware(const Uptane::Target& target,
                                         const api::FlowControlToken* flow_control) override;
   data::InstallationResult install(const Uptane::Target& target, const api::FlowControlToken* flow_control) override;
+  FirmwareStream streamFirmware(const Uptane::Target& target) override;
+
+  // Propose to compress the windowed uploads, which the Secondary may refuse.
+  void setUploadCompression(bool enabled) { upload_compression_ = enabled; }
+  // Used from the next connection to the Secondary on.
+  void setLinkOptions(const SecondaryLinkOptions& options);
 
  private:
-  const std::pair<std::string, uint16_t>& getAddr() const { return addr_; }
   void getSecondaryVersion() const;
   data::InstallationResult putMetadata_v1(const Uptane::MetaBundle& meta_bundle);
   data::InstallationResult putMetadata_v2(const Uptane::MetaBundle& meta_bundle);
   data::InstallationResult sendFirmware_v1(const Uptane::Target& target);
-  data::InstallationResult sendFirmware_v2(const Uptane::Target& target);
+  data::InstallationResult sendFirmware_v2(const Uptane::Target& target, const api::FlowControlToken* flow_control);
   data::InstallationResult install_v1(const Uptane::Target& target);
   data::InstallationResult install_v2(const Uptane::Target& target);
   static void addMetadata(const Uptane::MetaBundle& meta_bundle, Uptane::RepositoryType repo, const Uptane::Role& role,
                           AKMetaCollection_t& collection);
   data::InstallationResult invokeInstallOnSecondary(const Uptane::Target& target);
   data::InstallationResult downloadOstreeRev(const Uptane::Target& target);
-  data::InstallationResult uploadFirmware(const Uptane::Target& target);
+  data::InstallationResult uploadFirmware(const Uptane::Target& target, const api::FlowControlToken* flow_control);
+  // Sets supported to false, without uploading anything, if the Secondary
+  // doesn't support it, and dropped to true if the connection was lost.
+  // Stops with kOperationCancelled when flow_control is aborted or its
+  // deadline passes.
+  data::InstallationResult uploadFirmwareWindowed(const Uptane::Target& target, bool* supported, bool* dropped,
+                                                  const api::FlowControlToken* flow_control);
+  // Whether the image data received by the Secondary is the start of the image
+  bool matchesReceivedData(const Uptane::Target& target, uint64_t size, const OCTET_STRING_t* received_hash) const;
+  data::InstallationResult uploadFirmwareChunk(uint64_t offset, const uint8_t* data, size_t size);
   data::InstallationResult uploadFirmwareData(const uint8_t* data, size_t size);
 
   std::shared_ptr<SecondaryProvider> secondary_provider_;
@@ -63,6 +116,13 @@ class IpUptaneSecondary : public SecondaryInterface {
   const HardwareIdentifier hw_id_;
   const PublicKey pub_key_;
   mutable uint32_t protocol_version{0};
+  // Kept open between the requests
+  std::unique_ptr<SecondaryConnection> connection_;
+  bool upload_compression_{false};
+  // Target whose image is being streamed and how much of it the Secondary has
+  // accepted, so that uploadFirmware() can send the rest.
+  std::mutex streamed_mutex_;
+  std::pair<std::string, uint64_t> streamed_;
 };
 
 }  // namespace Uptane
@@ -0,0 +1,217 @@
+#include "secondary_connection.h"
+
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+
+#include <csignal>
+#include <cstring>
+
+#include "logging/logging.h"
+#include "utilities/allocation_accounting.h"
+#include "utilities/metrics.h"
+
+namespace Uptane {
+
+static Metrics::Labels linkLabels(const std::pair<std::string, uint16_t>& addr) {
+  return {{"secondary", Utils::isUnixSocketAddress(addr.first) ? addr.first
+                                                               : addr.first + ":" + std::to_string(addr.second)}};
+}
+
+SecondaryConnection::SecondaryConnection(std::pair<std::string, uint16_t> addr)
+    : addr_{std::move(addr)},
+      tcp_{!Utils::isUnixSocketAddress(addr_.first)},
+      rtt_{Metrics::instance().gauge("aktualizr_secondary_link_rtt_microseconds",
+                                     "Smoothed round-trip time of the connection to the Secondary",
+                                     linkLabels(addr_))},
+      rtt_variance_{Metrics::instance().gauge("aktualizr_secondary_link_rtt_variance_microseconds",
+                                              "Variance of the round-trip time of the connection to the Secondary",
+                                              linkLabels(addr_))},
+      retransmits_total_{Metrics::instance().counter("aktualizr_secondary_link_retransmits_total",
+                                                     "TCP segments retransmitted to the Secondary",
+                                                     linkLabels(addr_))} {}
+
+void SecondaryConnection::setOptions(const SecondaryLinkOptions& options) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  options_ = options;
+}
+
+Asn1Message::Ptr SecondaryConnection::rpc(const Asn1Message::Ptr& tx) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const AllocationAccounting::Scope accounting(AllocationTag::kSecondary);
+  const bool reused = socket_ != nullptr;
+  if (open() && send(tx)) {
+    auto rx = receive();
+    if (rx->present() != AKIpUptaneMes_PR_NOTHING || !reused) {
+      updateStats();
+      return rx;
+    }
+  } else if (!reused) {
+    return Asn1Message::Empty();
+  }
+  // The Secondary may have closed the connection after open() checked it.
+  LOG_DEBUG << "Connection to the Secondary (" << addr_.first << ":" << addr_.second << ") lost, reconnecting";
+  if (open() && send(tx)) {
+    auto rx = receive();
+    updateStats();
+    return rx;
+  }
+  return Asn1Message::Empty();
+}
+
+bool SecondaryConnection::open() {
+  if (socket_ != nullptr) {
+    // Nothing is expected between the responses, so the connection is readable
+    // only if the Secondary has closed it or it is broken.
+    pollfd fd{**socket_, POLLIN, 0};
+    if (buffer_.Size() == 0 && poll(&fd, 1, 0) == 0) {
+      return true;
+    }
+    close();
+  }
+
+  auto socket = std_::make_unique<ConnectionSocket>(addr_.first, addr_.second);
+  const int res =
+      options_.connect_timeout.count() > 0 ? socket->connect(options_.connect_timeout) : socket->connect();
+  if (res < 0) {
+    LOG_ERROR << "Failed to connect to the Secondary (" << addr_.first << ":" << addr_.second
+              << "): " << std::strerror(errno);
+    return false;
+  }
+  applyOptions(**socket);
+  socket_ = std::move(socket);
+  retransmits_ = 0;
+  return true;
+}
+
+static void setTimeout(int fd, int option, std::chrono::milliseconds timeout) {
+  timeval tv{};
+  tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+  tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+  setsockopt(fd, SOL_SOCKET, option, &tv, sizeof(tv));
+}
+
+void SecondaryConnection::applyOptions(int fd) const {
+  // Also replaces the timeouts set by connect() with a timeout.
+  setTimeout(fd, SO_RCVTIMEO, options_.io_timeout);
+  setTimeout(fd, SO_SNDTIMEO, options_.io_timeout);
+  if (!tcp_) {
+    return;
+  }
+  // The messages are written in one go, and the responses are waited for.
+  int no_delay = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(int));
+  if (options_.keepalive_idle.count() > 0) {
+    int enable = 1;
+    auto idle_s = static_cast<int>(options_.keepalive_idle.count());
+    auto interval_s = static_cast<int>(options_.keepalive_interval.count());
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle_s, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval_s, sizeof(int));
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &options_.keepalive_count, sizeof(int));
+  }
+  if (options_.user_timeout.count() > 0) {
+    auto user_timeout_ms = static_cast<unsigned int>(options_.user_timeout.count());
+    setsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout_ms, sizeof(user_timeout_ms));
+  }
+}
+
+void SecondaryConnection::updateStats() {
+  if (!tcp_ || socket_ == nullptr) {
+    return;
+  }
+  tcp_info info{};
+  socklen_t len = sizeof(info);
+  if (getsockopt(**socket_, IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return;
+  }
+  rtt_.set(info.tcpi_rtt);
+  rtt_variance_.set(info.tcpi_rttvar);
+  if (info.tcpi_total_retrans > retransmits_) {
+    retransmits_total_.add(info.tcpi_total_retrans - retransmits_);
+    retransmits_ = info.tcpi_total_retrans;
+  }
+}
+
+bool SecondaryConnection::send(const Asn1Message::Ptr& tx) {
+  if (socket_ == nullptr) {
+    return false;
+  }
+  if (!Asn1Send(tx, **socket_, &encoded_)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+namespace {
+
+// Unlike send(), sendfile() has no MSG_NOSIGNAL, so SIGPIPE is held back while
+// it runs, and discarded, lest a Secondary closing the connection kills us.
+class SigpipeBlocker {
+ public:
+  SigpipeBlocker() {
+    sigemptyset(&sigpipe_);
+    sigaddset(&sigpipe_, SIGPIPE);
+    sigset_t pending;
+    sigemptyset(&pending);
+    sigpending(&pending);
+    was_pending_ = sigismember(&pending, SIGPIPE) == 1;
+    pthread_sigmask(SIG_BLOCK, &sigpipe_, &old_mask_);
+  }
+  ~SigpipeBlocker() {
+    if (!was_pending_) {
+      const timespec no_wait{0, 0};
+      sigtimedwait(&sigpipe_, nullptr, &no_wait);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask_, nullptr);
+  }
+  SigpipeBlocker(const SigpipeBlocker&) = delete;
+  SigpipeBlocker(SigpipeBlocker&&) = delete;
+  SigpipeBlocker& operator=(const SigpipeBlocker&) = delete;
+  SigpipeBlocker& operator=(SigpipeBlocker&&) = delete;
+
+ private:
+  sigset_t sigpipe_{};
+  sigset_t old_mask_{};
+  bool was_pending_{false};
+};
+
+}  // namespace
+
+bool SecondaryConnection::sendFile(int fd, uint64_t offset, size_t length) {
+  if (socket_ == nullptr) {
+    return false;
+  }
+  SigpipeBlocker sigpipe_blocker;
+  auto file_offset = static_cast<off_t>(offset);
+  while (length > 0) {
+    const ssize_t sent = sendfile(**socket_, fd, &file_offset, length);
+    if (sent <= 0) {
+      LOG_ERROR << "Failed to send image data to the Secondary: " << (sent < 0 ? std::strerror(errno) : "end of file");
+      close();
+      return false;
+    }
+    length -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+Asn1Message::Ptr SecondaryConnection::receive() {
+  if (socket_ == nullptr) {
+    return Asn1Message::Empty();
+  }
+  auto rx = Asn1Receive(**socket_, &buffer_);
+  if (rx->present() == AKIpUptaneMes_PR_NOTHING) {
+    close();
+  }
+  return rx;
+}
+
+void SecondaryConnection::close() {
+  socket_.reset();
+  buffer_ = DequeueBuffer();
+}
+
+}  // namespace Uptane
@@ -0,0 +1,81 @@
+#ifndef UPTANE_SECONDARY_CONNECTION_H_
+#define UPTANE_SECONDARY_CONNECTION_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "asn1/asn1_message.h"
+#include "ipuptanesecondary.h"
+#include "utilities/dequeue_buffer.h"
+#include "utilities/utils.h"
+
+class MetricCounter;
+class MetricGauge;
+
+namespace Uptane {
+
+/**
+ * A TCP connection to an IP Secondary, kept open across the requests sent to
+ * it instead of connecting for each of them.
+ *
+ * Before a request, the connection is checked and opened again if the
+ * Secondary has closed it, e.g. because it restarted after an
+ * installation. Several requests can be sent before reading their responses,
+ * which are received in order.
+ *
+ * The round-trip time and the retransmissions of the TCP connection are
+ * exported as metrics after each request, labelled with the address.
+ */
+class SecondaryConnection {
+ public:
+  explicit SecondaryConnection(std::pair<std::string, uint16_t> addr);
+
+  // Used from the next time the connection is opened on.
+  void setOptions(const SecondaryLinkOptions& options);
+
+  /**
+   * Send a request and wait for its response. If the connection was reused
+   * and fails, it is opened again and the request sent once more.
+   * @return the response, with nothing present on failure
+   */
+  Asn1Message::Ptr rpc(const Asn1Message::Ptr& tx);
+
+  /**
+   * Held around open(), send() and receive(), to keep the requests of other
+   * threads out of a series of pipelined ones.
+   */
+  std::mutex& mutex() { return mutex_; }
+  // The following need mutex() and are closed by any failure.
+  /** @return false if the connection is closed and couldn't be opened again */
+  bool open();
+  bool send(const Asn1Message::Ptr& tx);
+  // Send length bytes of the file fd from offset, without copying them
+  bool sendFile(int fd, uint64_t offset, size_t length);
+  Asn1Message::Ptr receive();
+
+ private:
+  void close();
+  void applyOptions(int fd) const;
+  void updateStats();
+
+  const std::pair<std::string, uint16_t> addr_;
+  const bool tcp_;
+  std::mutex mutex_;
+  SecondaryLinkOptions options_;
+  std::unique_ptr<ConnectionSocket> socket_;
+  // Retransmissions on the current connection already counted
+  uint32_t retransmits_{0};
+  MetricGauge& rtt_;
+  MetricGauge& rtt_variance_;
+  MetricCounter& retransmits_total_;
+  // Data received after the last response
+  DequeueBuffer buffer_;
+  // Reused for encoding the requests
+  std::string encoded_;
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_SECONDARY_CONNECTION_H_
@@ -7,7 +7,9 @@
 
 #include <boost/filesystem/operations.hpp>
 
+#include "bootloader/uboot_env.h"
 #include "storage/invstorage.h"
+#include "utilities/command.h"
 #include "utilities/exceptions.h"
 #include "utilities/utils.h"
 
@@ -24,23 +26,47 @@ Bootloader::Bootloader(BootloaderConfig config, INvStorage& storage) : config_(s
   reboot_detect_supported_ = true;
 }
 
+void Bootloader::setUbootEnv(const std::vector<UbootVariable>& vars) const {
+  if (!config_.uboot_env_config.empty()) {
+    try {
+      UbootEnv env(config_.uboot_env_config);
+      for (const auto& var : vars) {
+        env.set(var.name, var.value);
+      }
+      env.write();
+      return;
+    } catch (const UbootEnvWriteError& e) {
+      // fw_setenv would go on from an environment that is half written
+      LOG_ERROR << e.what();
+      for (const auto& var : vars) {
+        LOG_WARNING << var.warning;
+      }
+      return;
+    } catch (const std::exception& e) {
+      LOG_DEBUG << "Falling back to fw_setenv: " << e.what();
+    }
+  }
+
+  CommandOptions options;
+  options.timeout = std::chrono::seconds(30);
+  for (const auto& var : vars) {
+    const CommandResult result = runCommand({"fw_setenv", var.name, var.value}, nullptr, options);
+    if (!result.ok()) {
+      LOG_WARNING << var.warning;
+    }
+  }
+}
+
 void Bootloader::setBootOK() const {
-  std::string sink;
   switch (config_.rollback_mode) {
     case RollbackMode::kBootloaderNone:
       break;
     case RollbackMode::kUbootGeneric:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
+      setUbootEnv({{"bootcount", "0", "Failed resetting bootcount"}});
       break;
     case RollbackMode::kUbootMasked:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv upgrade_available 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting upgrade_available for u-boot";
-      }
+      setUbootEnv({{"bootcount", "0", "Failed resetting bootcount"},
+                   {"upgrade_available", "0", "Failed resetting upgrade_available for u-boot"}});
       break;
     default:
       throw NotImplementedException();
@@ -48,28 +74,17 @@ void Bootloader::setBootOK() const {
 }
 
 void Bootloader::updateNotify() const {
-  std::string sink;
   switch (config_.rollback_mode) {
     case RollbackMode::kBootloaderNone:
       break;
     case RollbackMode::kUbootGeneric:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv rollback 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting rollback flag";
-      }
+      setUbootEnv({{"bootcount", "0", "Failed resetting bootcount"},
+                   {"rollback", "0", "Failed resetting rollback flag"}});
       break;
     case RollbackMode::kUbootMasked:
-      if (Utils::shell("fw_setenv bootcount 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting bootcount";
-      }
-      if (Utils::shell("fw_setenv upgrade_available 1", &sink) != 0) {
-        LOG_WARNING << "Failed setting upgrade_available for u-boot";
-      }
-      if (Utils::shell("fw_setenv rollback 0", &sink) != 0) {
-        LOG_WARNING << "Failed resetting rollback flag";
-      }
+      setUbootEnv({{"bootcount", "0", "Failed resetting bootcount"},
+                   {"upgrade_available", "1", "Failed setting upgrade_available for u-boot"},
+                   {"rollback", "0", "Failed resetting rollback flag"}});
       break;
     default:
       throw NotImplementedException();
@@ -1,6 +1,9 @@
 #ifndef BOOTLOADER_H_
 #define BOOTLOADER_H_
 
+#include <string>
+#include <vector>
+
 #include "libaktualizr/config.h"
 
 class INvStorage;
@@ -35,6 +38,18 @@ class Bootloader {
   const BootloaderConfig config_;
 
  private:
+  struct UbootVariable {
+    std::string name;
+    std::string value;
+    // Logged when it fails to be set
+    std::string warning;
+  };
+
+  // In a single write of the environment if it can be accessed natively,
+  // with fw_setenv otherwise. A native write that failed halfway is not
+  // retried with fw_setenv.
+  void setUbootEnv(const std::vector<UbootVariable>& vars) const;
+
   // TODO Fix this
   // NOLINTNEXTLINE(cppcoreguidelines-avoid-const-or-ref-data-members)
   INvStorage& storage_;
@@ -38,6 +38,7 @@ void BootloaderConfig::updateFromPropertyTree(const boost::property_tree::ptree&
   CopyFromConfig(reboot_sentinel_dir, "reboot_sentinel_dir", pt);
   CopyFromConfig(reboot_sentinel_name, "reboot_sentinel_name", pt);
   CopyFromConfig(reboot_command, "reboot_command", pt);
+  CopyFromConfig(uboot_env_config, "uboot_env_config", pt);
 }
 
 void BootloaderConfig::writeToStream(std::ostream& out_stream) const {
@@ -45,4 +46,5 @@ void BootloaderConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, reboot_sentinel_dir, "reboot_sentinel_dir");
   writeOption(out_stream, reboot_sentinel_name, "reboot_sentinel_name");
   writeOption(out_stream, reboot_command, "reboot_command");
+  writeOption(out_stream, uboot_env_config, "uboot_env_config");
 }
@@ -2,8 +2,17 @@
 
 #include "bootloader.h"
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <cstdlib>
+#include <cstring>
+
 #include <boost/filesystem.hpp>
 
+#include "bootloader/uboot_env.h"
 #include "storage/invstorage.h"
 #include "utilities/utils.h"
 
@@ -39,6 +48,158 @@ TEST(bootloader, detectReboot) {
   ASSERT_FALSE(bootloader.rebootDetected());
 }
 
+static const size_t kEnvSize = 0x400;
+
+// A redundant copy of an environment as U-Boot writes it
+static std::string envCopy(const std::vector<std::string> &vars, uint8_t flags) {
+  std::string data;
+  for (const auto &var : vars) {
+    data += var + '\0';
+  }
+  data.resize(kEnvSize - 5, '\0');
+  const auto data_crc =
+      static_cast<uint32_t>(crc32(0L, reinterpret_cast<const Bytef *>(data.data()), static_cast<uInt>(data.size())));
+  std::string copy(5, '\0');
+  std::memcpy(&copy[0], &data_crc, sizeof(data_crc));
+  copy[4] = static_cast<char>(flags);
+  return copy + data;
+}
+
+/* The newest copy of the environment with a valid CRC is read, and a write goes to the other one. */
+TEST(bootloader, ubootEnv) {
+  TemporaryDirectory temp_dir;
+  const auto device = temp_dir / "env";
+  const auto config = temp_dir / "fw_env.config";
+  Utils::writeFile(config, "# device offset size\n" + device.string() + " 0x0 0x400\n" + device.string() +
+                               " 0x400 0x400\n");
+
+  // The counter wraps around
+  Utils::writeFile(device, envCopy({"bootcmd=run x", "bootcount=2"}, 255) +
+                               envCopy({"bootcmd=run y", "bootcount=3"}, 0));
+  {
+    UbootEnv env(config);
+    EXPECT_EQ(env.get("bootcmd").value(), "run y");
+    EXPECT_EQ(env.get("bootcount").value(), "3");
+    EXPECT_FALSE(env.get("rollback"));
+  }
+
+  // A corrupted copy is ignored, even if its counter is higher
+  std::string contents = envCopy({"bootcmd=run x", "bootcount=2"}, 1) +
+                         envCopy({"bootcmd=run y", "bootcount=3"}, 2);
+  contents[kEnvSize + 10] ^= 1;
+  Utils::writeFile(device, contents);
+  UbootEnv env(config);
+  EXPECT_EQ(env.get("bootcmd").value(), "run x");
+
+  env.set("bootcount", "0");
+  env.set("rollback", "0");
+  env.write();
+  const std::string written = Utils::readFile(device);
+  EXPECT_EQ(written.substr(0, kEnvSize), contents.substr(0, kEnvSize));
+  EXPECT_EQ(written.substr(kEnvSize), envCopy({"bootcmd=run x", "bootcount=0", "rollback=0"}, 2));
+
+  // Nothing is written if nothing changed
+  boost::filesystem::remove(device);
+  env.set("rollback", "0");
+  env.write();
+  EXPECT_FALSE(boost::filesystem::exists(device));
+
+  Utils::writeFile(config, std::string("/dev/mtd0 0x0 0x400\n"));
+  EXPECT_THROW(UbootEnv{config}, std::runtime_error);
+}
+
+/* The environment is locked against fw_printenv and fw_setenv while it is in use. */
+TEST(bootloader, ubootEnvLock) {
+  TemporaryDirectory temp_dir;
+  const auto device = temp_dir / "env";
+  const auto config = temp_dir / "fw_env.config";
+  const auto lock_file = temp_dir / "fw_printenv.lock";
+  Utils::writeFile(config, device.string() + " 0x0 0x400\n" + device.string() + " 0x400 0x400\n");
+  Utils::writeFile(device, envCopy({"bootcount=2"}, 1) + envCopy({}, 0));
+
+  const int fd = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  ASSERT_GE(fd, 0);
+  {
+    UbootEnv env(config, lock_file);
+    EXPECT_EQ(env.get("bootcount").value(), "2");
+    EXPECT_NE(flock(fd, LOCK_EX | LOCK_NB), 0);
+  }
+  EXPECT_EQ(flock(fd, LOCK_EX | LOCK_NB), 0);
+  close(fd);
+}
+
+/* fw_setenv is only run if nothing has been written to the environment. */
+TEST(bootloader, ubootEnvFallback) {
+  TemporaryDirectory temp_dir;
+  StorageConfig storage_config;
+  storage_config.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(storage_config);
+
+  // Records that it was run
+  const auto bin_dir = temp_dir / "bin";
+  const auto fw_setenv_run = temp_dir / "fw_setenv_run";
+  boost::filesystem::create_directory(bin_dir);
+  Utils::writeFile(bin_dir / "fw_setenv", "#!/bin/sh\ntouch " + fw_setenv_run.string() + "\n");
+  boost::filesystem::permissions(bin_dir / "fw_setenv", boost::filesystem::owner_all);
+  const std::string path = getenv("PATH");
+  setenv("PATH", (bin_dir.string() + ":" + path).c_str(), 1);
+
+  BootloaderConfig boot_config;
+  boot_config.rollback_mode = RollbackMode::kUbootGeneric;
+  boot_config.reboot_sentinel_dir = temp_dir.Path();
+  boot_config.uboot_env_config = temp_dir / "fw_env.config";
+  Bootloader bootloader(boot_config, *storage);
+
+  // An environment that can't be read
+  const auto device = temp_dir / "env";
+  Utils::writeFile(device, std::string(2 * kEnvSize, '\0'));
+  Utils::writeFile(boot_config.uboot_env_config,
+                   device.string() + " 0 1024\n" + device.string() + " " + std::to_string(kEnvSize) + " 1024\n");
+  bootloader.updateNotify();
+  EXPECT_TRUE(boost::filesystem::exists(fw_setenv_run));
+
+  // An environment whose write fails once it has started
+  boost::filesystem::remove(fw_setenv_run);
+  Utils::writeFile(device, envCopy({"bootcount=1"}, 0));
+  Utils::writeFile(boot_config.uboot_env_config, device.string() + " 0 1024\n/dev/full 0 1024\n");
+  bootloader.updateNotify();
+  EXPECT_FALSE(boost::filesystem::exists(fw_setenv_run));
+
+  setenv("PATH", path.c_str(), 1);
+}
+
+/* The variables of a rollback mode are set in the environment at once. */
+TEST(bootloader, updateNotifyUbootEnv) {
+  TemporaryDirectory temp_dir;
+  StorageConfig storage_config;
+  storage_config.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(storage_config);
+
+  const auto device = temp_dir / "env";
+  Utils::writeFile(device, envCopy({"bootcount=1", "upgrade_available=0"}, 7) + envCopy({}, 6));
+  BootloaderConfig boot_config;
+  boot_config.rollback_mode = RollbackMode::kUbootMasked;
+  boot_config.reboot_sentinel_dir = temp_dir.Path();
+  boot_config.uboot_env_config = temp_dir / "fw_env.config";
+  Utils::writeFile(boot_config.uboot_env_config,
+                   device.string() + " 0 1024\n" + device.string() + " " + std::to_string(kEnvSize) + " 1024\n");
+  Bootloader bootloader(boot_config, *storage);
+
+  bootloader.updateNotify();
+  {
+    UbootEnv env(boot_config.uboot_env_config);
+    EXPECT_EQ(env.get("bootcount").value(), "0");
+    EXPECT_EQ(env.get("upgrade_available").value(), "1");
+    EXPECT_EQ(env.get("rollback").value(), "0");
+  }
+  EXPECT_EQ(Utils::readFile(device).substr(kEnvSize),
+            envCopy({"bootcount=0", "upgrade_available=1", "rollback=0"}, 8));
+
+  bootloader.setBootOK();
+  UbootEnv env(boot_config.uboot_env_config);
+  EXPECT_EQ(env.get("upgrade_available").value(), "0");
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
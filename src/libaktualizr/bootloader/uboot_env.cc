@@ -0,0 +1,221 @@
+#include "bootloader/uboot_env.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+#include "utilities/utils.h"
+
+static uint64_t parseNumber(const std::string &s) {
+  // Offsets from the end of the device are not supported
+  if (s.empty() || s[0] == '-') {
+    throw std::runtime_error("Invalid number in fw_env config: " + s);
+  }
+  try {
+    size_t end = 0;
+    const uint64_t value = std::stoull(s, &end, 0);
+    if (end != s.size()) {
+      throw std::runtime_error("Invalid number in fw_env config: " + s);
+    }
+    return value;
+  } catch (const std::logic_error &) {
+    throw std::runtime_error("Invalid number in fw_env config: " + s);
+  }
+}
+
+static uint32_t crc(const std::string &data) {
+  return static_cast<uint32_t>(
+      crc32(0L, reinterpret_cast<const Bytef *>(data.data()), static_cast<uInt>(data.size())));
+}
+
+UbootEnv::UbootEnv(const boost::filesystem::path &config, const boost::filesystem::path &lock_file) {
+  std::istringstream lines(Utils::readFile(config));
+  std::string line;
+  while (std::getline(lines, line)) {
+    boost::algorithm::trim(line);
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string offset;
+    std::string size;
+    Copy copy;
+    if (!(fields >> copy.device >> offset >> size)) {
+      throw std::runtime_error("Invalid line in " + config.string() + ": " + line);
+    }
+    if (boost::algorithm::starts_with(copy.device, "/dev/mtd") ||
+        boost::algorithm::starts_with(copy.device, "/dev/ubi")) {
+      throw std::runtime_error("MTD and UBI devices are not supported: " + copy.device);
+    }
+    copy.offset = parseNumber(offset);
+    copy.size = parseNumber(size);
+    copies_.push_back(copy);
+  }
+  if (copies_.empty() || copies_.size() > 2 || (redundant() && copies_[0].size != copies_[1].size) ||
+      copies_[0].size <= headerSize() + 1) {
+    throw std::runtime_error("Invalid environment copies in " + config.string());
+  }
+
+  lock_fd_ = open(lock_file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (lock_fd_ < 0) {
+    throw std::runtime_error("Can't open " + lock_file.string() + ": " + std::strerror(errno));
+  }
+  int locked = -1;
+  do {
+    locked = flock(lock_fd_, LOCK_EX);
+  } while (locked != 0 && errno == EINTR);
+  if (locked != 0) {
+    const std::string error = std::strerror(errno);
+    close(lock_fd_);
+    throw std::runtime_error("Can't lock " + lock_file.string() + ": " + error);
+  }
+
+  std::string data;
+  uint8_t flags = 0;
+  bool valid = readCopy(copies_[0], &data, &flags);
+  if (redundant()) {
+    std::string data1;
+    uint8_t flags1 = 0;
+    const bool valid1 = readCopy(copies_[1], &data1, &flags1);
+    // The counter of the newer copy is one more than the other one, modulo 256
+    const bool newer1 = !valid || (valid1 && static_cast<uint8_t>(flags1 - flags) < 128 && flags1 != flags);
+    if (valid1 && newer1) {
+      active_ = 1;
+      flags = flags1;
+      data = std::move(data1);
+      valid = true;
+    }
+  }
+  if (!valid) {
+    close(lock_fd_);
+    throw std::runtime_error("No U-Boot environment with a valid CRC");
+  }
+  flags_ = flags;
+
+  size_t pos = 0;
+  while (pos < data.size() && data[pos] != '\0') {
+    size_t end = data.find('\0', pos);
+    if (end == std::string::npos) {
+      end = data.size();
+    }
+    const std::string var = data.substr(pos, end - pos);
+    const size_t eq = var.find('=');
+    if (eq != std::string::npos) {
+      vars_.emplace_back(var.substr(0, eq), var.substr(eq + 1));
+    }
+    pos = end + 1;
+  }
+}
+
+UbootEnv::~UbootEnv() { close(lock_fd_); }
+
+bool UbootEnv::readCopy(const Copy &copy, std::string *data, uint8_t *flags) const {
+  const int fd = open(copy.device.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  std::string buf(copy.size, '\0');
+  size_t read_bytes = 0;
+  while (read_bytes < buf.size()) {
+    const ssize_t n =
+        pread(fd, &buf[read_bytes], buf.size() - read_bytes, static_cast<off_t>(copy.offset + read_bytes));
+    if (n <= 0) {
+      break;
+    }
+    read_bytes += static_cast<size_t>(n);
+  }
+  close(fd);
+  if (read_bytes != buf.size()) {
+    return false;
+  }
+  uint32_t stored_crc = 0;
+  std::memcpy(&stored_crc, buf.data(), sizeof(stored_crc));
+  *flags = redundant() ? static_cast<uint8_t>(buf[4]) : 0;
+  *data = buf.substr(headerSize());
+  return crc(*data) == stored_crc;
+}
+
+boost::optional<std::string> UbootEnv::get(const std::string &name) const {
+  const auto it = std::find_if(vars_.begin(), vars_.end(), [&name](const auto &v) { return v.first == name; });
+  if (it == vars_.end()) {
+    return boost::none;
+  }
+  return it->second;
+}
+
+void UbootEnv::set(const std::string &name, const std::string &value) {
+  if (name.empty() || name.find('=') != std::string::npos) {
+    throw std::runtime_error("Invalid U-Boot variable name: " + name);
+  }
+  const auto it = std::find_if(vars_.begin(), vars_.end(), [&name](const auto &v) { return v.first == name; });
+  if (value.empty()) {
+    if (it != vars_.end()) {
+      vars_.erase(it);
+      changed_ = true;
+    }
+  } else if (it == vars_.end()) {
+    vars_.emplace_back(name, value);
+    changed_ = true;
+  } else if (it->second != value) {
+    it->second = value;
+    changed_ = true;
+  }
+}
+
+void UbootEnv::write() {
+  if (!changed_) {
+    return;
+  }
+  const size_t target = redundant() ? 1 - active_ : 0;
+  const Copy &copy = copies_[target];
+
+  std::string data;
+  for (const auto &v : vars_) {
+    data += v.first + "=" + v.second + '\0';
+  }
+  data += '\0';
+  if (data.size() > copy.size - headerSize()) {
+    throw std::runtime_error("U-Boot environment too large");
+  }
+  data.resize(copy.size - headerSize(), '\0');
+
+  const uint8_t flags = static_cast<uint8_t>(flags_ + 1);
+  const uint32_t data_crc = crc(data);
+  std::string buf(headerSize(), '\0');
+  std::memcpy(&buf[0], &data_crc, sizeof(data_crc));
+  if (redundant()) {
+    buf[4] = static_cast<char>(flags);
+  }
+  buf += data;
+
+  const int fd = open(copy.device.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open " + copy.device + ": " + std::strerror(errno));
+  }
+  size_t written = 0;
+  while (written < buf.size()) {
+    const ssize_t n = pwrite(fd, &buf[written], buf.size() - written, static_cast<off_t>(copy.offset + written));
+    if (n <= 0) {
+      break;
+    }
+    written += static_cast<size_t>(n);
+  }
+  const bool synced = written == buf.size() && fsync(fd) == 0;
+  const std::string error = std::strerror(errno);
+  close(fd);
+  if (!synced) {
+    throw UbootEnvWriteError("Can't write the U-Boot environment to " + copy.device + ": " + error);
+  }
+  active_ = target;
+  flags_ = flags;
+  changed_ = false;
+}
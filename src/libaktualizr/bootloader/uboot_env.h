@@ -0,0 +1,77 @@
+#ifndef BOOTLOADER_UBOOT_ENV_H_
+#define BOOTLOADER_UBOOT_ENV_H_
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/optional.hpp>
+
+/**
+ * The U-Boot environment, read and written the way fw_printenv and
+ * fw_setenv do it, without running them.
+ *
+ * The copies of the environment are those of the fw_env config: one line per
+ * copy, with the device, the offset and the size of the environment. With two
+ * copies, the one with a valid CRC and the highest flag counter is used, and a
+ * write goes to the other one with the counter incremented, so that an
+ * interrupted write leaves the previous environment in place.
+ *
+ * Only files and block devices, such as an eMMC or an SD card, are handled:
+ * MTD and UBI devices have to be erased before they are written, and are left
+ * to fw_setenv. The constructor throws std::runtime_error for these, for an
+ * invalid config, or if no copy of the environment has a valid CRC.
+ *
+ * The lock file of fw_printenv and fw_setenv is held from the construction on,
+ * so that they don't change the environment in between.
+ */
+class UbootEnv {
+ public:
+  explicit UbootEnv(const boost::filesystem::path &config = "/etc/fw_env.config",
+                    const boost::filesystem::path &lock_file = "/var/lock/fw_printenv.lock");
+  ~UbootEnv();
+  UbootEnv(const UbootEnv &) = delete;
+  UbootEnv(UbootEnv &&) = delete;
+  UbootEnv &operator=(const UbootEnv &) = delete;
+  UbootEnv &operator=(UbootEnv &&) = delete;
+
+  boost::optional<std::string> get(const std::string &name) const;
+  /** An empty value removes the variable, like fw_setenv. */
+  void set(const std::string &name, const std::string &value);
+  /**
+   * Write all the variables that were set at once, if any were changed.
+   * Throws UbootEnvWriteError if the write failed after it started, and
+   * std::runtime_error if nothing was written.
+   */
+  void write();
+
+ private:
+  struct Copy {
+    std::string device;
+    uint64_t offset{0};
+    uint64_t size{0};
+  };
+
+  bool redundant() const { return copies_.size() == 2; }
+  size_t headerSize() const { return redundant() ? 5 : 4; }
+  bool readCopy(const Copy &copy, std::string *data, uint8_t *flags) const;
+
+  int lock_fd_{-1};
+  std::vector<Copy> copies_;
+  size_t active_{0};
+  uint8_t flags_{0};
+  // In the order of the environment, which is kept
+  std::vector<std::pair<std::string, std::string>> vars_;
+  bool changed_{false};
+};
+
+/** The copy of the environment being written may have been left corrupted. */
+class UbootEnvWriteError : public std::runtime_error {
+ public:
+  using std::runtime_error::runtime_error;
+};
+
+#endif  // BOOTLOADER_UBOOT_ENV_H_
@@ -1,25 +1,110 @@
 #include "bootstrap.h"
 
+#include <algorithm>
+#include <ctime>
 #include <fstream>
+#include <map>
+#include <mutex>
+#include <set>
 #include <sstream>
 
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+
 #include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "utilities/utils.h"
 
+namespace {
+
+const char* const kP12File = "autoprov_credentials.p12";
+const char* const kServerUrlFile = "autoprov.url";
+const char* const kServerCaFile = "server_ca.pem";
+
+/**
+ * The server URL and CA of the provisioning archives read so far, by path, so
+ * that the archive isn't decompressed again for each of them. The archive is
+ * read again if it has changed, e.g. when the credentials have been removed
+ * from it after provisioning.
+ */
+class ArchiveCache {
+ public:
+  struct Entry {
+    std::time_t mtime{0};
+    uintmax_t size{0};
+    std::map<std::string, std::string> files;
+  };
+
+  static ArchiveCache& instance() {
+    static ArchiveCache cache;
+    return cache;
+  }
+
+  // Read the files of the archive in one pass, and keep the public ones
+  std::map<std::string, std::string> read(const boost::filesystem::path& provision_path,
+                                          const std::set<std::string>& filenames) {
+    Entry entry;
+    entry.mtime = boost::filesystem::last_write_time(provision_path);
+    entry.size = boost::filesystem::file_size(provision_path);
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      const auto found = entries_.find(provision_path.string());
+      if (found != entries_.end() && found->second.mtime == entry.mtime && found->second.size == entry.size &&
+          std::all_of(filenames.begin(), filenames.end(), [&found](const std::string& filename) {
+            return filename != kP12File && found->second.files.count(filename) != 0;
+          })) {
+        return found->second.files;
+      }
+    }
+
+    std::ifstream as(provision_path.c_str(), std::ios::in | std::ios::binary);
+    if (as.fail()) {
+      LOG_ERROR << "Unable to open provided provisioning archive " << provision_path << ": " << std::strerror(errno);
+      throw std::runtime_error("Unable to parse bootstrap credentials");
+    }
+    std::set<std::string> to_read = filenames;
+    to_read.insert(kServerUrlFile);
+    to_read.insert(kServerCaFile);
+    auto files = Utils::readFilesFromArchive(as, to_read);
+    for (const auto& file : files) {
+      if (file.first != kP12File) {
+        entry.files.insert(file);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries_[provision_path.string()] = std::move(entry);
+    return files;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::map<std::string, Entry> entries_;
+};
+
+std::string readArchiveFile(const boost::filesystem::path& provision_path, const std::string& filename) {
+  auto files = ArchiveCache::instance().read(provision_path, {filename});
+  const auto found = files.find(filename);
+  if (found == files.end()) {
+    throw std::runtime_error("could not extract " + filename + " from archive");
+  }
+  return found->second;
+}
+
+}  // namespace
+
 Bootstrap::Bootstrap(const boost::filesystem::path& provision_path, const std::string& provision_password) {
   if (provision_path.empty()) {
     LOG_ERROR << "Provision path is empty!";
     throw std::runtime_error("Unable to parse bootstrap (shared) credentials");
   }
 
-  std::ifstream as(provision_path.c_str(), std::ios::in | std::ios::binary);
-  if (as.fail()) {
-    LOG_ERROR << "Unable to open provided provisioning archive " << provision_path << ": " << std::strerror(errno);
+  std::string p12_str;
+  try {
+    p12_str = readArchiveFile(provision_path, kP12File);
+  } catch (const boost::filesystem::filesystem_error& e) {
+    LOG_ERROR << "Unable to open provided provisioning archive " << provision_path << ": " << e.what();
     throw std::runtime_error("Unable to parse bootstrap (shared) credentials");
   }
-
-  std::string p12_str = Utils::readFileFromArchive(as, "autoprov_credentials.p12");
   if (p12_str.empty()) {
     throw std::runtime_error("Unable to parse bootstrap (shared) credentials");
   }
@@ -44,13 +129,9 @@ void Bootstrap::readTlsP12(const std::string& p12_str, const std::string& provis
 std::string Bootstrap::readServerUrl(const boost::filesystem::path& provision_path) {
   std::string url;
   try {
-    std::ifstream as(provision_path.c_str(), std::ios::in | std::ios::binary);
-    if (as.fail()) {
-      LOG_ERROR << "Unable to open provided provisioning archive " << provision_path << ": " << std::strerror(errno);
-      throw std::runtime_error("Unable to parse bootstrap credentials");
-    }
-    url = Utils::readFileFromArchive(as, "autoprov.url", true);
-  } catch (std::runtime_error& exc) {
+    url = readArchiveFile(provision_path, kServerUrlFile);
+    boost::trim_if(url, boost::is_any_of(" \t\r\n"));
+  } catch (const std::exception& exc) {
     LOG_ERROR << "Unable to read server URL from archive: " << exc.what();
     url = "";
   }
@@ -61,13 +142,8 @@ std::string Bootstrap::readServerUrl(const boost::filesystem::path& provision_pa
 std::string Bootstrap::readServerCa(const boost::filesystem::path& provision_path) {
   std::string server_ca;
   try {
-    std::ifstream as(provision_path.c_str(), std::ios::in | std::ios::binary);
-    if (as.fail()) {
-      LOG_ERROR << "Unable to open provided provisioning archive " << provision_path << ": " << std::strerror(errno);
-      throw std::runtime_error("Unable to parse bootstrap credentials");
-    }
-    server_ca = Utils::readFileFromArchive(as, "server_ca.pem");
-  } catch (std::runtime_error& exc) {
+    server_ca = readArchiveFile(provision_path, kServerCaFile);
+  } catch (const std::exception& exc) {
     LOG_ERROR << "Unable to read server CA certificate from archive: " << exc.what();
     return "";
   }
@@ -0,0 +1,47 @@
+#include "campaign/campaign_cache.h"
+
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+
+namespace campaign {
+
+std::vector<Campaign> CampaignCache::fetch(HttpInterface &http_client, const std::string &tls_server) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (valid_ && fresh_ && now_() - fetched_ < ttl_) {
+    LOG_TRACE << "Campaigns taken from the cache";
+    return campaigns_;
+  }
+
+  // Without a cached list, there's nothing to validate
+  const std::string etag = valid_ ? etag_ : "";
+  const std::string last_modified = valid_ ? last_modified_ : "";
+  HttpResponse response = http_client.getConditional(tls_server + "/campaigner/campaigns", kMaxCampaignsMetaSize,
+                                                     nullptr, etag, last_modified);
+  if (valid_ && response.notModified()) {
+    LOG_TRACE << "Campaigns not modified on the server";
+    fresh_ = true;
+    fetched_ = now_();
+    return campaigns_;
+  }
+  if (!response.isOk()) {
+    LOG_ERROR << "Failed to fetch list of available campaigns";
+    return {};
+  }
+
+  auto json = response.getJson();
+  LOG_TRACE << "Campaign: " << json;
+  campaigns_ = Campaign::campaignsFromJson(json);
+  etag_ = response.etag;
+  last_modified_ = response.last_modified;
+  valid_ = true;
+  fresh_ = true;
+  fetched_ = now_();
+  return campaigns_;
+}
+
+void CampaignCache::invalidate() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  fresh_ = false;
+}
+
+}  // namespace campaign
@@ -0,0 +1,54 @@
+#ifndef CAMPAIGN_CAMPAIGN_CACHE_H_
+#define CAMPAIGN_CAMPAIGN_CACHE_H_
+
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libaktualizr/campaign.h"
+
+namespace campaign {
+
+/**
+ * Last list of campaigns fetched from the server, so that checking for
+ * campaigns again, as a UI does whenever it shows them, doesn't fetch and
+ * parse the whole list every time.
+ *
+ * Within the TTL of the last fetch, the cached list is returned without a
+ * request. After it, or after invalidate(), the list is requested again
+ * with the validators the server sent with it, and kept if the server
+ * answers that it didn't change.
+ */
+class CampaignCache {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  explicit CampaignCache(std::chrono::seconds ttl, std::function<clock::time_point()> now = &clock::now)
+      : ttl_{ttl}, now_{std::move(now)} {}
+
+  /**
+   * The available campaigns, empty if they couldn't be fetched, as
+   * Campaign::fetchAvailableCampaigns().
+   */
+  std::vector<Campaign> fetch(HttpInterface &http_client, const std::string &tls_server);
+  // Request the list again on the next fetch, typically as a campaign was acted upon.
+  void invalidate();
+
+ private:
+  const std::chrono::seconds ttl_;
+  const std::function<clock::time_point()> now_;
+  std::mutex mutex_;
+  bool valid_{false};
+  bool fresh_{false};
+  clock::time_point fetched_;
+  std::string etag_;
+  std::string last_modified_;
+  std::vector<Campaign> campaigns_;
+};
+
+}  // namespace campaign
+
+#endif  // CAMPAIGN_CAMPAIGN_CACHE_H_
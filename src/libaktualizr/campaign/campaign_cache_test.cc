@@ -0,0 +1,131 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem/path.hpp>
+
+#include "campaign/campaign_cache.h"
+#include "crypto/crypto.h"
+#include "httpfake.h"
+#include "utilities/utils.h"
+
+boost::filesystem::path test_data_dir;
+
+using std::chrono::seconds;
+
+class HttpFakeCampaigns : public HttpFake {
+ public:
+  explicit HttpFakeCampaigns(const boost::filesystem::path &test_dir_in) : HttpFake(test_dir_in) {}
+
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                              const std::string &etag, const std::string &last_modified) override {
+    (void)maxsize;
+    (void)flow_control;
+    (void)last_modified;
+    EXPECT_EQ(url, tls_server + "/campaigner/campaigns");
+    ++requests;
+    if (!available) {
+      return HttpResponse("", 503, CURLE_OK, "");
+    }
+    const std::string current_etag = "\"" + Crypto::sha256digestHex(body) + "\"";
+    if (etag == current_etag) {
+      ++not_modified;
+      return HttpResponse("", 304, CURLE_OK, "");
+    }
+    HttpResponse response(body, 200, CURLE_OK, "");
+    response.etag = current_etag;
+    return response;
+  }
+
+  std::string body{Utils::readFile(test_data_dir / "campaigns_sample.json")};
+  bool available{true};
+  unsigned int requests{0};
+  unsigned int not_modified{0};
+};
+
+class CampaignCacheTest : public ::testing::Test {
+ protected:
+  CampaignCacheTest() : cache_{seconds(10), [this]() { return now_; }} {}
+
+  TemporaryDirectory temp_dir_;
+  HttpFakeCampaigns http_{temp_dir_.Path()};
+  campaign::CampaignCache::clock::time_point now_{campaign::CampaignCache::clock::now()};
+  campaign::CampaignCache cache_;
+};
+
+/* Within the TTL, the campaigns are not requested again. */
+TEST_F(CampaignCacheTest, Ttl) {
+  auto campaigns = cache_.fetch(http_, http_.tls_server);
+  ASSERT_EQ(campaigns.size(), 1);
+  EXPECT_EQ(campaigns[0].name, "campaign1");
+  EXPECT_EQ(http_.requests, 1);
+
+  now_ += seconds(9);
+  campaigns = cache_.fetch(http_, http_.tls_server);
+  ASSERT_EQ(campaigns.size(), 1);
+  EXPECT_EQ(campaigns[0].id, "c2eb7e8d-8aa0-429d-883f-5ed8fdb2a493");
+  EXPECT_EQ(http_.requests, 1);
+
+  // Unchanged on the server after the TTL
+  now_ += seconds(1);
+  campaigns = cache_.fetch(http_, http_.tls_server);
+  ASSERT_EQ(campaigns.size(), 1);
+  EXPECT_EQ(http_.requests, 2);
+  EXPECT_EQ(http_.not_modified, 1);
+
+  // The TTL starts again from the validation
+  now_ += seconds(5);
+  cache_.fetch(http_, http_.tls_server);
+  EXPECT_EQ(http_.requests, 2);
+}
+
+/* After an invalidation, the campaigns are requested again, and a changed list replaces the cached one. */
+TEST_F(CampaignCacheTest, Invalidate) {
+  cache_.fetch(http_, http_.tls_server);
+  cache_.invalidate();
+  EXPECT_EQ(cache_.fetch(http_, http_.tls_server).size(), 1);
+  EXPECT_EQ(http_.requests, 2);
+  EXPECT_EQ(http_.not_modified, 1);
+
+  http_.body = R"({"campaigns": []})";
+  cache_.invalidate();
+  EXPECT_EQ(cache_.fetch(http_, http_.tls_server).size(), 0);
+  EXPECT_EQ(http_.requests, 3);
+  EXPECT_EQ(http_.not_modified, 1);
+}
+
+/* A failed request returns no campaigns, and doesn't lose the cached ones for the next validation. */
+TEST_F(CampaignCacheTest, Failure) {
+  cache_.fetch(http_, http_.tls_server);
+  cache_.invalidate();
+  http_.available = false;
+  EXPECT_EQ(cache_.fetch(http_, http_.tls_server).size(), 0);
+
+  http_.available = true;
+  EXPECT_EQ(cache_.fetch(http_, http_.tls_server).size(), 1);
+  EXPECT_EQ(http_.not_modified, 1);
+  EXPECT_EQ(http_.requests, 3);
+}
+
+/* With no TTL, the campaigns are validated on every fetch. */
+TEST(CampaignCache, NoTtl) {
+  TemporaryDirectory temp_dir;
+  HttpFakeCampaigns http(temp_dir.Path());
+  campaign::CampaignCache cache(seconds(0));
+  cache.fetch(http, http.tls_server);
+  EXPECT_EQ(cache.fetch(http, http.tls_server).size(), 1);
+  EXPECT_EQ(http.requests, 2);
+  EXPECT_EQ(http.not_modified, 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+
+  if (argc != 2) {
+    std::cerr << "Error: " << argv[0] << " requires the path to the test data as an input argument.\n";
+    return EXIT_FAILURE;
+  }
+  test_data_dir = argv[1];
+
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -87,24 +87,112 @@ void ProvisionConfig::writeToStream(std::ostream& out_stream) const {
 
 void UptaneConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(polling_sec, "polling_sec", pt);
+  CopyFromConfig(polling_jitter_percent, "polling_jitter_percent", pt);
+  CopyFromConfig(polling_max_backoff_sec, "polling_max_backoff_sec", pt);
+  CopyFromConfig(polling_pending_sec, "polling_pending_sec", pt);
+  CopyFromConfig(polling_heartbeat_sec, "polling_heartbeat_sec", pt);
+  CopyFromConfig(notification_url, "notification_url", pt);
+  CopyFromConfig(event_queue_size, "event_queue_size", pt);
+  CopyFromConfig(defer_device_data, "defer_device_data", pt);
   CopyFromConfig(director_server, "director_server", pt);
   CopyFromConfig(repo_server, "repo_server", pt);
+  CopyFromConfig(director_mirrors, "director_mirrors", pt);
+  CopyFromConfig(repo_mirrors, "repo_mirrors", pt);
   CopyFromConfig(key_source, "key_source", pt);
   CopyFromConfig(key_type, "key_type", pt);
   CopyFromConfig(force_install_completion, "force_install_completion", pt);
   CopyFromConfig(secondary_config_file, "secondary_config_file", pt);
   CopyFromConfig(secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec", pt);
+  CopyFromConfig(max_parallel_downloads, "max_parallel_downloads", pt);
+  CopyFromConfig(transfer_progress_interval_ms, "transfer_progress_interval_ms", pt);
+  CopyFromConfig(max_parallel_secondary_transfers, "max_parallel_secondary_transfers", pt);
+  CopyFromConfig(secondary_transfer_limits, "secondary_transfer_limits", pt);
+  CopyFromConfig(secondary_transfer_order, "secondary_transfer_order", pt);
+  CopyFromConfig(critical_ecus, "critical_ecus", pt);
+  CopyFromConfig(secondary_install_dependencies, "secondary_install_dependencies", pt);
+  CopyFromConfig(secondary_cut_through, "secondary_cut_through", pt);
+  CopyFromConfig(secondary_fan_out, "secondary_fan_out", pt);
+  CopyFromConfig(secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec", pt);
+  CopyFromConfig(unchanged_manifest_interval_sec, "unchanged_manifest_interval_sec", pt);
+  CopyFromConfig(signature_cache_size, "signature_cache_size", pt);
+  CopyFromConfig(persist_signature_cache, "persist_signature_cache", pt);
+  CopyFromConfig(share_image_metadata, "share_image_metadata", pt);
+  CopyFromConfig(root_probe_interval_sec, "root_probe_interval_sec", pt);
+  CopyFromConfig(metadata_bundle, "metadata_bundle", pt);
+  CopyFromConfig(prefetch_image_meta, "prefetch_image_meta", pt);
+  CopyFromConfig(max_metadata_size_kb, "max_metadata_size_kb", pt);
+  CopyFromConfig(memory_budget_kb, "memory_budget_kb", pt);
+  CopyFromConfig(trace_file, "trace_file", pt);
+  CopyFromConfig(trace_in_report, "trace_in_report", pt);
+  CopyFromConfig(campaign_cache_ttl_sec, "campaign_cache_ttl_sec", pt);
+  CopyFromConfig(report_events_max_request_kb, "report_events_max_request_kb", pt);
+  CopyFromConfig(prefetch, "prefetch", pt);
+  CopyFromConfig(prefetch_bandwidth_share, "prefetch_bandwidth_share", pt);
+  CopyFromConfig(background_nice, "background_nice", pt);
+  CopyFromConfig(background_io_class, "background_io_class", pt);
+  CopyFromConfig(background_cgroup, "background_cgroup", pt);
+  CopyFromConfig(admission_slow_pressure, "admission_slow_pressure", pt);
+  CopyFromConfig(admission_pause_pressure, "admission_pause_pressure", pt);
+  CopyFromConfig(admission_max_pause_sec, "admission_max_pause_sec", pt);
+  CopyFromConfig(cycle_budget_sec, "cycle_budget_sec", pt);
+  CopyFromConfig(check_budget_sec, "check_budget_sec", pt);
+  CopyFromConfig(download_budget_sec, "download_budget_sec", pt);
+  CopyFromConfig(install_budget_sec, "install_budget_sec", pt);
 }
 
 void UptaneConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, polling_sec, "polling_sec");
+  writeOption(out_stream, polling_jitter_percent, "polling_jitter_percent");
+  writeOption(out_stream, polling_max_backoff_sec, "polling_max_backoff_sec");
+  writeOption(out_stream, polling_pending_sec, "polling_pending_sec");
+  writeOption(out_stream, polling_heartbeat_sec, "polling_heartbeat_sec");
+  writeOption(out_stream, notification_url, "notification_url");
+  writeOption(out_stream, event_queue_size, "event_queue_size");
+  writeOption(out_stream, defer_device_data, "defer_device_data");
   writeOption(out_stream, director_server, "director_server");
   writeOption(out_stream, repo_server, "repo_server");
+  writeOption(out_stream, director_mirrors, "director_mirrors");
+  writeOption(out_stream, repo_mirrors, "repo_mirrors");
   writeOption(out_stream, key_source, "key_source");
   writeOption(out_stream, key_type, "key_type");
   writeOption(out_stream, force_install_completion, "force_install_completion");
   writeOption(out_stream, secondary_config_file, "secondary_config_file");
   writeOption(out_stream, secondary_preinstall_wait_sec, "secondary_preinstall_wait_sec");
+  writeOption(out_stream, max_parallel_downloads, "max_parallel_downloads");
+  writeOption(out_stream, transfer_progress_interval_ms, "transfer_progress_interval_ms");
+  writeOption(out_stream, max_parallel_secondary_transfers, "max_parallel_secondary_transfers");
+  writeOption(out_stream, secondary_transfer_limits, "secondary_transfer_limits");
+  writeOption(out_stream, secondary_transfer_order, "secondary_transfer_order");
+  writeOption(out_stream, critical_ecus, "critical_ecus");
+  writeOption(out_stream, secondary_install_dependencies, "secondary_install_dependencies");
+  writeOption(out_stream, secondary_cut_through, "secondary_cut_through");
+  writeOption(out_stream, secondary_fan_out, "secondary_fan_out");
+  writeOption(out_stream, secondary_manifest_timeout_sec, "secondary_manifest_timeout_sec");
+  writeOption(out_stream, unchanged_manifest_interval_sec, "unchanged_manifest_interval_sec");
+  writeOption(out_stream, signature_cache_size, "signature_cache_size");
+  writeOption(out_stream, persist_signature_cache, "persist_signature_cache");
+  writeOption(out_stream, share_image_metadata, "share_image_metadata");
+  writeOption(out_stream, root_probe_interval_sec, "root_probe_interval_sec");
+  writeOption(out_stream, metadata_bundle, "metadata_bundle");
+  writeOption(out_stream, prefetch_image_meta, "prefetch_image_meta");
+  writeOption(out_stream, max_metadata_size_kb, "max_metadata_size_kb");
+  writeOption(out_stream, memory_budget_kb, "memory_budget_kb");
+  writeOption(out_stream, trace_file, "trace_file");
+  writeOption(out_stream, trace_in_report, "trace_in_report");
+  writeOption(out_stream, campaign_cache_ttl_sec, "campaign_cache_ttl_sec");
+  writeOption(out_stream, report_events_max_request_kb, "report_events_max_request_kb");
+  writeOption(out_stream, prefetch, "prefetch");
+  writeOption(out_stream, prefetch_bandwidth_share, "prefetch_bandwidth_share");
+  writeOption(out_stream, background_nice, "background_nice");
+  writeOption(out_stream, background_io_class, "background_io_class");
+  writeOption(out_stream, background_cgroup, "background_cgroup");
+  writeOption(out_stream, admission_slow_pressure, "admission_slow_pressure");
+  writeOption(out_stream, admission_pause_pressure, "admission_pause_pressure");
+  writeOption(out_stream, admission_max_pause_sec, "admission_max_pause_sec");
+  writeOption(out_stream, cycle_budget_sec, "cycle_budget_sec");
+  writeOption(out_stream, check_budget_sec, "check_budget_sec");
+  writeOption(out_stream, download_budget_sec, "download_budget_sec");
+  writeOption(out_stream, install_budget_sec, "install_budget_sec");
 }
 
 /**
@@ -156,6 +244,7 @@ KeyManagerConfig Config::keymanagerConfig() const {
 
 void Config::postUpdateValues() {
   logger_set_threshold(logger);
+  logger_set_output(logger);
 
   if (provision.mode == ProvisionMode::kDefault) {
     provision.mode = provision.provision_path.empty() ? ProvisionMode::kDeviceCred : ProvisionMode::kSharedCred;
@@ -225,6 +314,7 @@ void Config::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   }
   CopySubtreeFromConfig(p11, "p11", pt);
   CopySubtreeFromConfig(tls, "tls", pt);
+  CopySubtreeFromConfig(network, "network", pt);
   CopySubtreeFromConfig(provision, "provision", pt);
   CopySubtreeFromConfig(uptane, "uptane", pt);
   CopySubtreeFromConfig(pacman, "pacman", pt);
@@ -265,6 +355,7 @@ void Config::writeToStream(std::ostream& sink) const {
   WriteSectionToStream(logger, "logger", sink);
   WriteSectionToStream(p11, "p11", sink);
   WriteSectionToStream(tls, "tls", sink);
+  WriteSectionToStream(network, "network", sink);
   WriteSectionToStream(provision, "provision", sink);
   WriteSectionToStream(uptane, "uptane", sink);
   WriteSectionToStream(pacman, "pacman", sink);
@@ -1,14 +1,23 @@
 #include "crypto.h"
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
 #include <random>
 #include <string>
+#include <thread>
+#include <tuple>
 
 #include <openssl/pkcs12.h>
 #include <openssl/rsa.h>
 #include <sodium.h>
-#include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/scoped_array.hpp>
@@ -16,6 +25,8 @@
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "openssl_compat.h"
+#include "utilities/executor.h"
+#include "utilities/metrics.h"
 #include "utilities/utils.h"
 
 #if !AKTUALIZR_OPENSSL_PRE_3
@@ -77,19 +88,105 @@ PublicKey::PublicKey(const std::string &value, KeyType type) : value_(value), ty
   }
 }
 
+struct PublicKey::Parsed {
+  std::once_flag once;
+  StructGuard<RSA> rsa{nullptr, RSA_free};
+  // Binary
+  std::string ed25519;
+};
+
+std::shared_ptr<PublicKey::Parsed> PublicKey::newParsed() { return std::make_shared<Parsed>(); }
+
+// Parsing a PEM key takes about as long as verifying a signature with it, and
+// the same keys verify the signatures of every role of both repositories.
+const PublicKey::Parsed &PublicKey::parsed() const {
+  std::call_once(parsed_->once, [this] {
+    if (type_ == KeyType::kED25519) {
+      parsed_->ed25519 = Utils::fromHex(value_);
+    } else if (Crypto::IsRsaKeyType(type_)) {
+      parsed_->rsa = Crypto::parseRSAPublicKey(value_);
+    }
+  });
+  return *parsed_;
+}
+
 bool PublicKey::VerifySignature(const std::string &signature, const std::string &message) const {
   switch (type_) {
     case KeyType::kED25519:
-      return Crypto::ED25519Verify(boost::algorithm::unhex(value_), Utils::fromBase64(signature), message);
+      return Crypto::ED25519Verify(parsed().ed25519, Utils::fromBase64(signature), message);
     case KeyType::kRSA2048:
     case KeyType::kRSA3072:
-    case KeyType::kRSA4096:
-      return Crypto::RSAPSSVerify(value_, Utils::fromBase64(signature), message);
+    case KeyType::kRSA4096: {
+      RSA *rsa = parsed().rsa.get();
+      return rsa != nullptr && Crypto::RSAPSSVerify(rsa, Utils::fromBase64(signature), message);
+    }
     default:
       return false;
   }
 }
 
+// Threads used to verify a batch of signatures
+static const size_t kMaxVerifyThreads = 4;
+
+// Run check(i) for every i below count on a few threads and return the results.
+static std::vector<bool> verifyEach(size_t count, const std::function<bool(size_t)> &check) {
+  // Not a vector<bool>, whose elements can't be written from several threads
+  std::vector<char> valid(count, 0);
+  std::atomic<size_t> next{0};
+  auto verify_worker = [&]() {
+    for (size_t i = next++; i < count; i = next++) {
+      valid[i] = check(i) ? 1 : 0;
+    }
+  };
+  const size_t num_workers =
+      std::min({count, kMaxVerifyThreads, static_cast<size_t>(std::max(std::thread::hardware_concurrency(), 1U))});
+  std::vector<std::future<void>> workers;
+  for (size_t i = 1; i < num_workers; ++i) {
+    workers.push_back(Executor::cpu().submit(verify_worker));
+  }
+  verify_worker();
+  for (auto &worker : workers) {
+    worker.get();
+  }
+  return std::vector<bool>(valid.begin(), valid.end());
+}
+
+std::vector<bool> PublicKey::VerifySignatures(const std::vector<SignedMessage> &batch) {
+  std::vector<bool> valid(batch.size(), false);
+  std::vector<Crypto::ED25519SignedMessage> ed25519;
+  std::vector<size_t> ed25519_index;
+  std::vector<size_t> rsa_index;
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const SignedMessage &item = batch[i];
+    switch (item.key->Type()) {
+      case KeyType::kED25519:
+        ed25519.push_back({item.key->parsed().ed25519, Utils::fromBase64(item.signature), item.message});
+        ed25519_index.push_back(i);
+        break;
+      case KeyType::kRSA2048:
+      case KeyType::kRSA3072:
+      case KeyType::kRSA4096:
+        rsa_index.push_back(i);
+        break;
+      default:
+        break;
+    }
+  }
+
+  const std::vector<bool> ed25519_valid = Crypto::ED25519VerifyBatch(ed25519);
+  for (size_t j = 0; j < ed25519_index.size(); ++j) {
+    valid[ed25519_index[j]] = ed25519_valid[j];
+  }
+  const std::vector<bool> rsa_valid = verifyEach(rsa_index.size(), [&](size_t j) {
+    const SignedMessage &item = batch[rsa_index[j]];
+    return item.key->VerifySignature(item.signature, *item.message);
+  });
+  for (size_t j = 0; j < rsa_index.size(); ++j) {
+    valid[rsa_index[j]] = rsa_valid[j];
+  }
+  return valid;
+}
+
 bool PublicKey::operator==(const PublicKey &rhs) const { return value_ == rhs.value_ && type_ == rhs.type_; }
 Json::Value PublicKey::ToUptane() const {
   Json::Value res;
@@ -116,9 +213,7 @@ std::string PublicKey::KeyId() const {
   std::string key_content = value_;
   // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
   boost::algorithm::trim_right_if(key_content, boost::algorithm::is_any_of("\n"));
-  std::string keyid = boost::algorithm::hex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))));
-  std::transform(keyid.begin(), keyid.end(), keyid.begin(), ::tolower);
-  return keyid;
+  return Utils::toHex(Crypto::sha256digest(Utils::jsonToCanonicalStr(Json::Value(key_content))), true);
 }
 
 std::string Crypto::sha256digest(const std::string &text) {
@@ -128,7 +223,7 @@ std::string Crypto::sha256digest(const std::string &text) {
 }
 
 std::string Crypto::sha256digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha256digest(text)));
+  return Utils::toHex(sha256digest(text), true);
 }
 
 std::string Crypto::sha512digest(const std::string &text) {
@@ -138,12 +233,34 @@ std::string Crypto::sha512digest(const std::string &text) {
 }
 
 std::string Crypto::sha512digestHex(const std::string &text) {
-  return boost::algorithm::to_lower_copy(boost::algorithm::hex(sha512digest(text)));
+  return Utils::toHex(sha512digest(text), true);
+}
+
+static std::string rsaPssSign(RSA *rsa, const std::string &message) {
+  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa));
+  boost::scoped_array<unsigned char> EM(new unsigned char[sign_size]);
+  boost::scoped_array<unsigned char> pSignature(new unsigned char[sign_size]);
+
+  std::string digest = Crypto::sha256digest(message);
+  int status = RSA_padding_add_PKCS1_PSS(rsa, EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
+                                         EVP_sha256(), -1 /* maximum salt length*/);
+  if (status == 0) {
+    LOG_ERROR << "RSA_padding_add_PKCS1_PSS failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
+
+  /* perform digital signature */
+  status = RSA_private_encrypt(RSA_size(rsa), EM.get(), pSignature.get(), rsa, RSA_NO_PADDING);
+  if (status == -1) {
+    LOG_ERROR << "RSA_private_encrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return std::string();
+  }
+  std::string retval = std::string(reinterpret_cast<char *>(pSignature.get()), sign_size);
+  return retval;
 }
 
 std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message) {
   StructGuard<EVP_PKEY> key(nullptr, EVP_PKEY_free);
-  StructGuard<RSA> rsa(nullptr, RSA_free);
   if (engine != nullptr) {
     // TODO(OTA-2138): this call leaks memory somehow...
     key.reset(ENGINE_load_private_key(engine, private_key.c_str(), nullptr, nullptr));
@@ -152,57 +269,49 @@ std::string Crypto::RSAPSSSign(ENGINE *engine, const std::string &private_key, c
       LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
       return std::string();
     }
-
-    rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    if (rsa == nullptr) {
-      LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return std::string();
-    }
   } else {
-    StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(private_key.c_str()), static_cast<int>(private_key.size())),
-                         BIO_vfree);
-    key.reset(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr));
-    if (key != nullptr) {
-      rsa.reset(EVP_PKEY_get1_RSA(key.get()));
-    }
-
-    if (rsa == nullptr) {
-      LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    key = parsePrivateKey(private_key);
+    if (key == nullptr) {
       return std::string();
     }
-
-#if AKTUALIZR_OPENSSL_PRE_11
-    RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
-#else
-    RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
-#endif
   }
+  return RSAPSSSign(key.get(), message);
+}
 
-  const auto sign_size = static_cast<unsigned int>(RSA_size(rsa.get()));
-  boost::scoped_array<unsigned char> EM(new unsigned char[sign_size]);
-  boost::scoped_array<unsigned char> pSignature(new unsigned char[sign_size]);
+StructGuard<EVP_PKEY> Crypto::parsePrivateKey(const std::string &private_key) {
+  StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(private_key.c_str()), static_cast<int>(private_key.size())),
+                       BIO_vfree);
+  StructGuard<EVP_PKEY> key(PEM_read_bio_PrivateKey(bio.get(), nullptr, nullptr, nullptr), EVP_PKEY_free);
+  StructGuard<RSA> rsa(nullptr, RSA_free);
+  if (key != nullptr) {
+    rsa.reset(EVP_PKEY_get1_RSA(key.get()));
+  }
 
-  std::string digest = Crypto::sha256digest(message);
-  int status = RSA_padding_add_PKCS1_PSS(rsa.get(), EM.get(), reinterpret_cast<const unsigned char *>(digest.c_str()),
-                                         EVP_sha256(), -1 /* maximum salt length*/);
-  if (status == 0) {
-    LOG_ERROR << "RSA_padding_add_PKCS1_PSS failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-    return std::string();
+  if (rsa == nullptr) {
+    LOG_ERROR << "PEM_read_bio_PrivateKey failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return {nullptr, EVP_PKEY_free};
   }
 
-  /* perform digital signature */
-  status = RSA_private_encrypt(RSA_size(rsa.get()), EM.get(), pSignature.get(), rsa.get(), RSA_NO_PADDING);
-  if (status == -1) {
-    LOG_ERROR << "RSA_private_encrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+#if AKTUALIZR_OPENSSL_PRE_11
+  RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
+#else
+  RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
+#endif
+  return key;
+}
+
+std::string Crypto::RSAPSSSign(EVP_PKEY *key, const std::string &message) {
+  StructGuard<RSA> rsa(EVP_PKEY_get1_RSA(key), RSA_free);
+  if (rsa == nullptr) {
+    LOG_ERROR << "EVP_PKEY_get1_RSA failed with error " << ERR_error_string(ERR_get_error(), nullptr);
     return std::string();
   }
-  std::string retval = std::string(reinterpret_cast<char *>(pSignature.get()), sign_size);
-  return retval;
+  return rsaPssSign(rsa.get(), message);
 }
 
 std::string Crypto::Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message) {
   if (key_type == KeyType::kED25519) {
-    return Crypto::ED25519Sign(boost::algorithm::unhex(private_key), message);
+    return Crypto::ED25519Sign(Utils::fromHex(private_key), message);
   }
   return Crypto::RSAPSSSign(engine, private_key, message);
 }
@@ -215,32 +324,39 @@ std::string Crypto::ED25519Sign(const std::string &private_key, const std::strin
 }
 
 bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message) {
+  const StructGuard<RSA> rsa = parseRSAPublicKey(public_key);
+  return rsa != nullptr && RSAPSSVerify(rsa.get(), signature, message);
+}
+
+StructGuard<RSA> Crypto::parseRSAPublicKey(const std::string &public_key) {
   StructGuard<RSA> rsa(nullptr, RSA_free);
   StructGuard<BIO> bio(BIO_new_mem_buf(const_cast<char *>(public_key.c_str()), static_cast<int>(public_key.size())),
                        BIO_vfree);
-  {
-    RSA *r = nullptr;
-    if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
-      LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
-      return false;
-    }
-    rsa.reset(r);
+  RSA *r = nullptr;
+  if (PEM_read_bio_RSA_PUBKEY(bio.get(), &r, nullptr, nullptr) == nullptr) {
+    LOG_ERROR << "PEM_read_bio_RSA_PUBKEY failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return rsa;
   }
+  rsa.reset(r);
 
 #if AKTUALIZR_OPENSSL_PRE_11
   RSA_set_method(rsa.get(), RSA_PKCS1_SSLeay());
 #else
   RSA_set_method(rsa.get(), RSA_PKCS1_OpenSSL());
 #endif
+  return rsa;
+}
 
-  const auto size = static_cast<unsigned int>(RSA_size(rsa.get()));
+// The public key operations don't change the key, which several threads can use at once.
+bool Crypto::RSAPSSVerify(RSA *rsa, const std::string &signature, const std::string &message) {
+  const auto size = static_cast<unsigned int>(RSA_size(rsa));
   boost::scoped_array<unsigned char> pDecrypted(new unsigned char[size]);
   /* now we will verify the signature
     Start by a RAW decrypt of the signature
   */
   int status =
       RSA_public_decrypt(static_cast<int>(signature.size()), reinterpret_cast<const unsigned char *>(signature.c_str()),
-                         pDecrypted.get(), rsa.get(), RSA_NO_PADDING);
+                         pDecrypted.get(), rsa, RSA_NO_PADDING);
   if (status == -1) {
     LOG_ERROR << "RSA_public_decrypt failed with error " << ERR_error_string(ERR_get_error(), nullptr);
     return false;
@@ -249,7 +365,7 @@ bool Crypto::RSAPSSVerify(const std::string &public_key, const std::string &sign
   std::string digest = Crypto::sha256digest(message);
 
   /* verify the data */
-  status = RSA_verify_PKCS1_PSS(rsa.get(), reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
+  status = RSA_verify_PKCS1_PSS(rsa, reinterpret_cast<const unsigned char *>(digest.c_str()), EVP_sha256(),
                                 pDecrypted.get(), -2 /* salt length recovered from signature*/);
 
   return status == 1;
@@ -263,6 +379,34 @@ bool Crypto::ED25519Verify(const std::string &public_key, const std::string &sig
                                      reinterpret_cast<const unsigned char *>(public_key.c_str())) == 0;
 }
 
+std::vector<bool> Crypto::ED25519VerifyBatch(const std::vector<ED25519SignedMessage> &batch) {
+  // libsodium has no batch verification of Ed25519 signatures. A signature
+  // that appears several times in the batch, e.g. the same metadata verified
+  // for several secondaries, is verified once, and the others are verified
+  // one by one on a few threads, which also tells which ones are bad.
+  std::map<std::tuple<const std::string &, const std::string &, const std::string &>, size_t> seen;
+  std::vector<size_t> unique;
+  std::vector<size_t> same(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    const ED25519SignedMessage &item = batch[i];
+    const auto inserted = seen.emplace(std::tie(item.public_key, item.signature, *item.message), unique.size());
+    if (inserted.second) {
+      unique.push_back(i);
+    }
+    same[i] = inserted.first->second;
+  }
+
+  const std::vector<bool> unique_valid = verifyEach(unique.size(), [&](size_t j) {
+    const ED25519SignedMessage &item = batch[unique[j]];
+    return ED25519Verify(item.public_key, item.signature, *item.message);
+  });
+  std::vector<bool> valid(batch.size());
+  for (size_t i = 0; i < batch.size(); ++i) {
+    valid[i] = unique_valid[same[i]];
+  }
+  return valid;
+}
+
 bool Crypto::parseP12(BIO *p12_bio, const std::string &p12_password, std::string *out_pkey, std::string *out_cert,
                       std::string *out_ca) {
 #if AKTUALIZR_OPENSSL_PRE_11
@@ -456,9 +600,9 @@ bool Crypto::generateEDKeyPair(std::string *public_key, std::string *private_key
   std::array<unsigned char, crypto_sign_PUBLICKEYBYTES> pk{};
   std::array<unsigned char, crypto_sign_SECRETKEYBYTES> sk{};
   crypto_sign_keypair(pk.data(), sk.data());
-  *public_key = boost::algorithm::hex(std::string(reinterpret_cast<char *>(pk.data()), crypto_sign_PUBLICKEYBYTES));
+  *public_key = Utils::toHex(std::string(reinterpret_cast<char *>(pk.data()), crypto_sign_PUBLICKEYBYTES));
   // std::transform(public_key->begin(), public_key->end(), public_key->begin(), ::tolower);
-  *private_key = boost::algorithm::hex(std::string(reinterpret_cast<char *>(sk.data()), crypto_sign_SECRETKEYBYTES));
+  *private_key = Utils::toHex(std::string(reinterpret_cast<char *>(sk.data()), crypto_sign_SECRETKEYBYTES));
   // std::transform(private_key->begin(), private_key->end(), private_key->begin(), ::tolower);
   return true;
 }
@@ -682,12 +826,40 @@ void Crypto::serializeCert(std::string *pkey, std::string *cert, X509 *const cer
   *cert = std::string(cert_buf, static_cast<size_t>(cert_len));
 }
 
-MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
+namespace {
+// The throughput is the rate of the bytes over the one of the sum of the durations
+struct HashMetrics {
+  explicit HashMetrics(const std::string &algorithm)
+      : bytes{Metrics::instance().counter("aktualizr_hash_bytes_total", "Bytes hashed", {{"algorithm", algorithm}})},
+        duration{Metrics::instance().histogram("aktualizr_hash_duration_seconds", "Duration of the hashing of a part",
+                                               {{"algorithm", algorithm}})} {}
+  MetricCounter &bytes;
+  MetricHistogram &duration;
+};
+
+HashMetrics &sha256Metrics() {
+  static HashMetrics metrics("sha256");
+  return metrics;
+}
+
+HashMetrics &sha512Metrics() {
+  static HashMetrics metrics("sha512");
+  return metrics;
+}
+}  // namespace
+
+MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type, Backend backend) {
   switch (hash_type) {
     case Hash::Type::kSha256: {
+      if (backend == Backend::kOpenSsl) {
+        return std::make_shared<OpenSslHasher>(hash_type);
+      }
       return std::make_shared<MultiPartSHA256Hasher>();
     }
     case Hash::Type::kSha512: {
+      if (backend == Backend::kOpenSsl) {
+        return std::make_shared<OpenSslHasher>(hash_type);
+      }
       return std::make_shared<MultiPartSHA512Hasher>();
     }
     default: {
@@ -697,51 +869,237 @@ MultiPartHasher::Ptr MultiPartHasher::create(Hash::Type hash_type) {
   }
 }
 
+void MultiPartSHA512Hasher::update(const unsigned char *part, uint64_t size) {
+  sha512Metrics().bytes.add(size);
+  const MetricTimer timer(sha512Metrics().duration);
+  crypto_hash_sha512_update(&state_, part, size);
+}
+
+void MultiPartSHA256Hasher::update(const unsigned char *part, uint64_t size) {
+  sha256Metrics().bytes.add(size);
+  const MetricTimer timer(sha256Metrics().duration);
+  crypto_hash_sha256_update(&state_, part, size);
+}
+
 std::string MultiPartSHA512Hasher::getHexDigest() {
   std::array<unsigned char, crypto_hash_sha512_BYTES> sha512_hash{};
   crypto_hash_sha512_final(&state_, sha512_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES));
+  return Utils::toHex(std::string(reinterpret_cast<char *>(sha512_hash.data()), crypto_hash_sha512_BYTES));
 }
 
 std::string MultiPartSHA256Hasher::getHexDigest() {
   std::array<unsigned char, crypto_hash_sha256_BYTES> sha256_hash{};
   crypto_hash_sha256_final(&state_, sha256_hash.data());
-  return boost::algorithm::hex(std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES));
+  return Utils::toHex(std::string(reinterpret_cast<char *>(sha256_hash.data()), crypto_hash_sha256_BYTES));
 }
 
-Hash Hash::generate(Type type, const std::string &data) {
-  std::string hash;
+bool MultiPartSHA512Hasher::setState(const std::string &state) {
+  if (state.size() != sizeof(state_)) {
+    return false;
+  }
+  std::memcpy(&state_, state.data(), sizeof(state_));
+  return true;
+}
 
-  switch (type) {
-    case Type::kSha256: {
-      hash = boost::algorithm::hex(Crypto::sha256digest(data));
-      break;
+bool MultiPartSHA256Hasher::setState(const std::string &state) {
+  if (state.size() != sizeof(state_)) {
+    return false;
+  }
+  std::memcpy(&state_, state.data(), sizeof(state_));
+  return true;
+}
+
+namespace {
+const EVP_MD *evpDigest(Hash::Type hash_type) {
+  return hash_type == Hash::Type::kSha512 ? EVP_sha512() : EVP_sha256();
+}
+
+HashMetrics &hashMetrics(Hash::Type hash_type) {
+  return hash_type == Hash::Type::kSha512 ? sha512Metrics() : sha256Metrics();
+}
+}  // namespace
+
+#if AKTUALIZR_OPENSSL_PRE_11
+OpenSslHasher::OpenSslHasher(Hash::Type hash_type)
+    : hash_type_{hash_type}, ctx_{EVP_MD_CTX_create(), EVP_MD_CTX_destroy} {
+#else
+OpenSslHasher::OpenSslHasher(Hash::Type hash_type)
+    : hash_type_{hash_type}, ctx_{EVP_MD_CTX_new(), EVP_MD_CTX_free} {
+#endif
+  if (ctx_ == nullptr) {
+    throw std::bad_alloc();
+  }
+  reset();
+}
+
+void OpenSslHasher::update(const unsigned char *part, uint64_t size) {
+  HashMetrics &metrics = hashMetrics(hash_type_);
+  metrics.bytes.add(size);
+  const MetricTimer timer(metrics.duration);
+  if (EVP_DigestUpdate(ctx_.get(), part, static_cast<size_t>(size)) != 1) {
+    throw std::runtime_error("EVP_DigestUpdate failed");
+  }
+}
+
+void OpenSslHasher::reset() {
+  if (EVP_DigestInit_ex(ctx_.get(), evpDigest(hash_type_), nullptr) != 1) {
+    throw std::runtime_error("EVP_DigestInit_ex failed");
+  }
+}
+
+std::string OpenSslHasher::getHexDigest() {
+  std::array<unsigned char, EVP_MAX_MD_SIZE> digest{};
+  unsigned int size = 0;
+  if (EVP_DigestFinal_ex(ctx_.get(), digest.data(), &size) != 1) {
+    throw std::runtime_error("EVP_DigestFinal_ex failed");
+  }
+  return Utils::toHex(std::string(reinterpret_cast<char *>(digest.data()), size));
+}
+
+MultiPartCompositeHasher::MultiPartCompositeHasher(const std::vector<Hash> &hashes, Backend backend) {
+  for (const auto &hash : hashes) {
+    const bool known = std::any_of(hashers_.begin(), hashers_.end(),
+                                   [&hash](const std::pair<Hash::Type, Ptr> &h) { return h.first == hash.type(); });
+    if (!known && (hash.type() == Hash::Type::kSha256 || hash.type() == Hash::Type::kSha512)) {
+      hashers_.emplace_back(hash.type(), create(hash.type(), backend));
     }
-    case Type::kSha512: {
-      hash = boost::algorithm::hex(Crypto::sha512digest(data));
-      break;
+  }
+}
+
+void MultiPartCompositeHasher::update(const unsigned char *part, uint64_t size) {
+  for (auto &hasher : hashers_) {
+    hasher.second->update(part, size);
+  }
+}
+
+void MultiPartCompositeHasher::reset() {
+  for (auto &hasher : hashers_) {
+    hasher.second->reset();
+  }
+}
+
+Hash MultiPartCompositeHasher::getHash() {
+  if (hashers_.empty()) {
+    throw std::runtime_error("No supported hash algorithm");
+  }
+  return hashers_[0].second->getHash();
+}
+
+std::vector<Hash> MultiPartCompositeHasher::getHashes() {
+  std::vector<Hash> hashes;
+  hashes.reserve(hashers_.size());
+  for (auto &hasher : hashers_) {
+    hashes.push_back(hasher.second->getHash());
+  }
+  return hashes;
+}
+
+// The states of the hashers one after the other, they have fixed sizes.
+// Empty if any of them can't be saved.
+std::string MultiPartCompositeHasher::getState() const {
+  std::string state;
+  for (const auto &hasher : hashers_) {
+    const std::string part = hasher.second->getState();
+    if (part.empty()) {
+      return "";
     }
-    default: {
+    state += part;
+  }
+  return state;
+}
+
+bool MultiPartCompositeHasher::setState(const std::string &state) {
+  size_t size = 0;
+  for (const auto &hasher : hashers_) {
+    size += hasher.second->getState().size();
+  }
+  if (state.empty() || state.size() != size) {
+    return false;
+  }
+  size_t offset = 0;
+  for (auto &hasher : hashers_) {
+    const size_t part = hasher.second->getState().size();
+    hasher.second->setState(state.substr(offset, part));
+    offset += part;
+  }
+  return true;
+}
+
+Hash Hash::generate(Type type, const std::string &data) {
+  switch (type) {
+    case Type::kSha256:
+      return fromDigest(type, Crypto::sha256digest(data));
+    case Type::kSha512:
+      return fromDigest(type, Crypto::sha512digest(data));
+    default:
       throw std::invalid_argument("Unsupported hash type");
-    }
   }
+}
 
-  return Hash(type, hash);
+Hash Hash::fromDigest(Type type, const std::string &digest) {
+  if (digest.size() > kMaxDigestSize) {
+    return Hash(type, Utils::toHex(digest));
+  }
+  Hash hash(type, nullptr, 0);
+  std::memcpy(hash.digest_.data(), digest.data(), digest.size());
+  hash.digest_size_ = static_cast<uint8_t>(digest.size());
+  return hash;
 }
 
-Hash::Hash(const std::string &type, const std::string &hash) : hash_(boost::algorithm::to_upper_copy(hash)) {
-  if (type == "sha512") {
-    type_ = Hash::Type::kSha512;
-  } else if (type == "sha256") {
-    type_ = Hash::Type::kSha256;
+Hash::Type Hash::typeFromString(const char *type, size_t size) {
+  if (size == 6 && std::memcmp(type, "sha512", 6) == 0) {
+    return Hash::Type::kSha512;
+  } else if (size == 6 && std::memcmp(type, "sha256", 6) == 0) {
+    return Hash::Type::kSha256;
   } else {
-    type_ = Hash::Type::kUnknownAlgorithm;
+    return Hash::Type::kUnknownAlgorithm;
   }
 }
 
-Hash::Hash(Type type, const std::string &hash) : type_(type), hash_(boost::algorithm::to_upper_copy(hash)) {}
+Hash::Hash(const std::string &type, const std::string &hash) : type_(typeFromString(type.data(), type.size())) {
+  setHash(hash.data(), hash.size());
+}
+
+Hash::Hash(Type type, const std::string &hash) : type_(type) { setHash(hash.data(), hash.size()); }
+
+Hash::Hash(Type type, const char *hash, size_t size) : type_(type) { setHash(hash, size); }
+
+void Hash::setHash(const char *hash, size_t size) {
+  auto nibble = [](char c) -> int {
+    if (c >= '0' && c <= '9') {
+      return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      return c - 'A' + 10;
+    }
+    return -1;
+  };
+
+  digest_size_ = 0;
+  text_.clear();
+  if (size % 2 == 0 && size / 2 <= kMaxDigestSize) {
+    size_t i = 0;
+    for (; i < size; i += 2) {
+      const int high = nibble(hash[i]);
+      const int low = nibble(hash[i + 1]);
+      if (high < 0 || low < 0) {
+        break;
+      }
+      digest_[i / 2] = static_cast<uint8_t>((high << 4) | low);
+    }
+    if (i == size) {
+      digest_size_ = static_cast<uint8_t>(size / 2);
+      return;
+    }
+  }
+  text_ = boost::algorithm::to_upper_copy(std::string(hash, size));
+}
 
-bool Hash::operator==(const Hash &other) const { return type_ == other.type_ && hash_ == other.hash_; }
+bool Hash::operator==(const Hash &other) const {
+  return type_ == other.type_ && digest_size_ == other.digest_size_ &&
+         std::memcmp(digest_.data(), other.digest_.data(), digest_size_) == 0 && text_ == other.text_;
+}
 
 std::string Hash::TypeString(Type type) {
   switch (type) {
@@ -758,8 +1116,21 @@ std::string Hash::TypeString() const { return TypeString(type_); }
 
 Hash::Type Hash::type() const { return type_; }
 
+std::string Hash::HashString() const {
+  if (digest_size_ == 0) {
+    return text_;
+  }
+  static const char digits[] = "0123456789ABCDEF";
+  std::string hex(2 * static_cast<size_t>(digest_size_), '0');
+  for (size_t i = 0; i < digest_size_; ++i) {
+    hex[2 * i] = digits[digest_[i] >> 4];
+    hex[2 * i + 1] = digits[digest_[i] & 0xF];
+  }
+  return hex;
+}
+
 std::ostream &operator<<(std::ostream &os, const Hash &h) {
-  os << "Hash: " << h.hash_;
+  os << "Hash: " << h.HashString();
   return os;
 }
 
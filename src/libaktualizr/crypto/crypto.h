@@ -10,6 +10,8 @@
 #include <cstdint>    // for uint64_t
 #include <memory>     // for shared_ptr
 #include <string>     // for string
+#include <utility>    // for pair
+#include <vector>     // for vector
 
 #include "libaktualizr/types.h"  // for Hash, KeyType, Hash::Type
 #include "utilities/utils.h"     // for StructGuard
@@ -33,13 +35,23 @@ class MultiPartHasher {
   MultiPartHasher &operator=(const MultiPartHasher &) = delete;
   MultiPartHasher &operator=(MultiPartHasher &&) = delete;
 
+  // Implementations of the hash functions. OpenSSL selects the code for the
+  // CPU at runtime, using the SHA instructions of x86 and ARMv8 if available;
+  // libsodium only has portable code, but its state can be saved.
+  enum class Backend { kSodium, kOpenSsl };
+
   using Ptr = std::shared_ptr<MultiPartHasher>;
-  static Ptr create(Hash::Type hash_type);
+  static Ptr create(Hash::Type hash_type, Backend backend = Backend::kOpenSsl);
 
   virtual void update(const unsigned char *part, uint64_t size) = 0;
   virtual void reset() = 0;
   virtual std::string getHexDigest() = 0;
   virtual Hash getHash() = 0;
+  // The intermediate state, to continue hashing later on with setState(). It
+  // is only meant to be restored on the same system, and is empty where the
+  // backend can't save it.
+  virtual std::string getState() const = 0;
+  virtual bool setState(const std::string &state) = 0;
 };
 
 class MultiPartSHA512Hasher : public MultiPartHasher {
@@ -50,10 +62,14 @@ class MultiPartSHA512Hasher : public MultiPartHasher {
   MultiPartSHA512Hasher(MultiPartSHA512Hasher &&) = delete;
   MultiPartSHA512Hasher &operator=(const MultiPartSHA512Hasher &) = delete;
   MultiPartSHA512Hasher &operator=(MultiPartSHA512Hasher &&) = delete;
-  void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha512_update(&state_, part, size); }
+  void update(const unsigned char *part, uint64_t size) override;
   void reset() override { crypto_hash_sha512_init(&state_); }
   std::string getHexDigest() override;
   Hash getHash() override { return Hash(Hash::Type::kSha512, getHexDigest()); }
+  std::string getState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool setState(const std::string &state) override;
 
  private:
   crypto_hash_sha512_state state_{};
@@ -67,16 +83,69 @@ class MultiPartSHA256Hasher : public MultiPartHasher {
   MultiPartSHA256Hasher(MultiPartSHA256Hasher &&) = delete;
   MultiPartSHA256Hasher &operator=(const MultiPartSHA256Hasher &) = delete;
   MultiPartSHA256Hasher &operator=(MultiPartSHA256Hasher &&) = delete;
-  void update(const unsigned char *part, uint64_t size) override { crypto_hash_sha256_update(&state_, part, size); }
+  void update(const unsigned char *part, uint64_t size) override;
   void reset() override { crypto_hash_sha256_init(&state_); }
   std::string getHexDigest() override;
 
   Hash getHash() override { return Hash(Hash::Type::kSha256, getHexDigest()); }
+  std::string getState() const override {
+    return std::string(reinterpret_cast<const char *>(&state_), sizeof(state_));
+  }
+  bool setState(const std::string &state) override;
 
  private:
   crypto_hash_sha256_state state_{};
 };
 
+// Through the EVP interface of OpenSSL, which keeps its state opaque: it
+// can't be saved, so getState() is empty and setState() always fails.
+class OpenSslHasher : public MultiPartHasher {
+ public:
+  explicit OpenSslHasher(Hash::Type hash_type);
+  ~OpenSslHasher() override = default;
+  OpenSslHasher(const OpenSslHasher &) = delete;
+  OpenSslHasher(OpenSslHasher &&) = delete;
+  OpenSslHasher &operator=(const OpenSslHasher &) = delete;
+  OpenSslHasher &operator=(OpenSslHasher &&) = delete;
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
+  std::string getHexDigest() override;
+  Hash getHash() override { return Hash(hash_type_, getHexDigest()); }
+  std::string getState() const override { return ""; }
+  bool setState(const std::string &state) override {
+    (void)state;
+    return false;
+  }
+
+ private:
+  const Hash::Type hash_type_;
+  StructGuard<EVP_MD_CTX> ctx_;
+};
+
+// Computes all the hashes of a list in a single pass over the data, hashes of
+// unsupported types are left out. getHash() and getHexDigest() give the first
+// one; only one of them or getHashes() can be called.
+class MultiPartCompositeHasher : public MultiPartHasher {
+ public:
+  explicit MultiPartCompositeHasher(const std::vector<Hash> &hashes, Backend backend = Backend::kOpenSsl);
+  ~MultiPartCompositeHasher() override = default;
+  MultiPartCompositeHasher(const MultiPartCompositeHasher &) = delete;
+  MultiPartCompositeHasher(MultiPartCompositeHasher &&) = delete;
+  MultiPartCompositeHasher &operator=(const MultiPartCompositeHasher &) = delete;
+  MultiPartCompositeHasher &operator=(MultiPartCompositeHasher &&) = delete;
+  void update(const unsigned char *part, uint64_t size) override;
+  void reset() override;
+  std::string getHexDigest() override { return getHash().HashString(); }
+  Hash getHash() override;
+  std::vector<Hash> getHashes();
+  std::string getState() const override;
+  bool setState(const std::string &state) override;
+  bool empty() const { return hashers_.empty(); }
+
+ private:
+  std::vector<std::pair<Hash::Type, Ptr>> hashers_;
+};
+
 class Crypto {
  public:
   static std::string sha256digest(const std::string &text);
@@ -86,6 +155,9 @@ class Crypto {
   /** A lower case, hexadecimal version of sha512digest */
   static std::string sha512digestHex(const std::string &text);
   static std::string RSAPSSSign(ENGINE *engine, const std::string &private_key, const std::string &message);
+  static std::string RSAPSSSign(EVP_PKEY *key, const std::string &message);
+  /** Parse an RSA private key in PEM format, to sign several messages with it */
+  static StructGuard<EVP_PKEY> parsePrivateKey(const std::string &private_key);
   static std::string Sign(KeyType key_type, ENGINE *engine, const std::string &private_key, const std::string &message);
   static std::string ED25519Sign(const std::string &private_key, const std::string &message);
   static bool parseP12(BIO *p12_bio, const std::string &p12_password, std::string *out_pkey, std::string *out_cert,
@@ -98,7 +170,21 @@ class Crypto {
   static bool generateKeyPair(KeyType key_type, std::string *public_key, std::string *private_key);
 
   static bool RSAPSSVerify(const std::string &public_key, const std::string &signature, const std::string &message);
+  /** The RSA key of a PEM public key, to verify several signatures with; null if it can't be parsed */
+  static StructGuard<RSA> parseRSAPublicKey(const std::string &public_key);
+  static bool RSAPSSVerify(RSA *rsa, const std::string &signature, const std::string &message);
   static bool ED25519Verify(const std::string &public_key, const std::string &signature, const std::string &message);
+  /** An Ed25519 signature to check with ED25519VerifyBatch(). The key and signature are binary. */
+  struct ED25519SignedMessage {
+    std::string public_key;
+    std::string signature;
+    const std::string *message;
+  };
+  /**
+   * Verify a set of Ed25519 signatures. The result tells for each of them, in
+   * the same order, whether it is valid.
+   */
+  static std::vector<bool> ED25519VerifyBatch(const std::vector<ED25519SignedMessage> &batch);
 
   static bool IsRsaKeyType(KeyType type);
   static KeyType IdentifyRSAKeyType(const std::string &public_key_pem);
@@ -1,9 +1,12 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <json/json.h>
 #include <boost/algorithm/hex.hpp>
@@ -94,6 +97,49 @@ TEST_F(P11Crypto, SignVerifyRsaP11) {
   EXPECT_TRUE(signe_is_ok);
 }
 
+/* Sign with a key that stays open on the token. */
+TEST_F(P11Crypto, SignCachedKeyP11) {
+  const std::string uptane_key_id{"03"};
+
+  std::string text = "This is text for sign";
+  std::string key_content;
+  ASSERT_TRUE((*p11_)->readUptanePublicKey(uptane_key_id, &key_content));
+  PublicKey pkey(key_content, KeyType::kRSA2048);
+  const std::string private_key = (*p11_)->getItemFullId(uptane_key_id);
+  const auto key = (*p11_)->getPrivateKey(private_key);
+  ASSERT_NE(key, nullptr);
+  EXPECT_EQ((*p11_)->getPrivateKey(private_key), key);
+  EXPECT_TRUE(pkey.VerifySignature(Utils::toBase64(Crypto::RSAPSSSign(key.get(), text)), text));
+
+  (*p11_)->releasePrivateKey(private_key);
+  const auto reopened = (*p11_)->getPrivateKey(private_key);
+  ASSERT_NE(reopened, nullptr);
+  EXPECT_TRUE(pkey.VerifySignature(Utils::toBase64(Crypto::RSAPSSSign(reopened.get(), text)), text));
+}
+
+/*
+ * Signatures per second via PKCS#11, opening the key for each signature or
+ * once; run with --gtest_also_run_disabled_tests.
+ */
+TEST_F(P11Crypto, DISABLED_SignThroughputP11) {
+  const std::string private_key = (*p11_)->getItemFullId("03");
+  const std::string text = "This is text for sign";
+  const int signatures = 50;
+
+  const auto measure = [&](const std::string &name, const std::function<std::string()> &sign) {
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < signatures; ++i) {
+      ASSERT_FALSE(sign().empty());
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    const auto per_second = static_cast<int64_t>(signatures / elapsed.count());
+    RecordProperty(name + "_per_s", std::to_string(per_second));
+    std::cout << name << ": " << per_second << " signatures/s\n";
+  };
+  measure("sign_open_key", [&]() { return Crypto::RSAPSSSign((*p11_)->getEngine(), private_key, text); });
+  measure("sign_cached_key", [&]() { return Crypto::RSAPSSSign((*p11_)->getPrivateKey(private_key).get(), text); });
+}
+
 /* Generate RSA keypairs via PKCS#11. */
 TEST_F(P11Crypto, GenerateRsaKeypairP11) {
   const std::string uptane_key_id{"05"};
@@ -156,6 +202,56 @@ TEST(crypto, VerifyEd25519) {
   EXPECT_FALSE(signe_is_ok);
 }
 
+/* A batch of signatures tells which ones are valid, also for repeated and RSA ones. */
+TEST(crypto, VerifyBatch) {
+  const std::string text = Utils::jsonToCanonicalStr(Utils::parseJSONFile("tests/test_data/ed25519_signed.json"));
+  const std::string signature =
+      "lS1GII6MS2FAPuSzBPHOZbE0wLIRpFhlbaCSgNOJLT1h+69OjaN/YQq16uzoXX3rev/Dhw0Raa4v9xocE8GmBA==";
+  const std::string signature_bad =
+      "33lS1GII6MS2FAPuSzBPHOZbE0wLIRpFhlbaCSgNOJLT1h+69OjaN/YQq16uzoXX3rev/Dhw0Raa4v9xocE8GmBA==";
+  const PublicKey ed_key("cb07563157805c279ec90ccb057f2c3ea6e89200e1e67f8ae66185987ded9b1c", KeyType::kED25519);
+  const std::string other_text = text + " ";
+
+  const std::string rsa_text = "This is text for sign";
+  const PublicKey rsa_key(fs::path("tests/test_data/public.key"));
+  const std::string rsa_signature =
+      Utils::toBase64(Crypto::RSAPSSSign(nullptr, Utils::readFile("tests/test_data/priv.key"), rsa_text));
+  const PublicKey unknown_key("somekey", KeyType::kUnknown);
+
+  const std::vector<PublicKey::SignedMessage> batch{
+      {&ed_key, signature, &text},          {&ed_key, signature_bad, &text}, {&ed_key, signature, &other_text},
+      {&rsa_key, rsa_signature, &rsa_text}, {&ed_key, signature, &text},     {&rsa_key, rsa_signature, &text},
+      {&unknown_key, signature, &text}};
+  EXPECT_EQ(PublicKey::VerifySignatures(batch), std::vector<bool>({true, false, false, true, true, false, false}));
+  EXPECT_TRUE(PublicKey::VerifySignatures({}).empty());
+
+  const std::vector<Crypto::ED25519SignedMessage> ed_batch{
+      {boost::algorithm::unhex(ed_key.Value()), Utils::fromBase64(signature), &text},
+      {boost::algorithm::unhex(ed_key.Value()), "short", &text}};
+  EXPECT_EQ(Crypto::ED25519VerifyBatch(ed_batch), std::vector<bool>({true, false}));
+}
+
+/* The key parsed for the first verification is kept for the following ones, also by the copies. */
+TEST(crypto, VerifyParsedOnce) {
+  const std::string text = "This is text for sign";
+  const std::string signature =
+      Utils::toBase64(Crypto::RSAPSSSign(nullptr, Utils::readFile("tests/test_data/priv.key"), text));
+  PublicKey key(fs::path("tests/test_data/public.key"));
+  EXPECT_TRUE(key.VerifySignature(signature, text));
+  EXPECT_TRUE(key.VerifySignature(signature, text));
+  EXPECT_FALSE(key.VerifySignature(signature, text + " "));
+  const PublicKey copy = key;
+  EXPECT_TRUE(copy.VerifySignature(signature, text));
+
+  // An assigned key verifies with its own value
+  key = PublicKey("cb07563157805c279ec90ccb057f2c3ea6e89200e1e67f8ae66185987ded9b1c", KeyType::kED25519);
+  EXPECT_FALSE(key.VerifySignature(signature, text));
+  EXPECT_TRUE(copy.VerifySignature(signature, text));
+
+  const PublicKey bad("-----BEGIN PUBLIC KEY-----\nbad\n-----END PUBLIC KEY-----\n", KeyType::kUnknown);
+  EXPECT_FALSE(bad.VerifySignature(signature, text));
+}
+
 TEST(crypto, BadKeytype) {
   PublicKey pkey("somekey", KeyType::kUnknown);
   EXPECT_EQ(pkey.Type(), KeyType::kUnknown);
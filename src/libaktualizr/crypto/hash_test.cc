@@ -1,8 +1,20 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
 #include "crypto.h"
 #include "logging/logging.h"
 
+static const std::vector<std::pair<std::string, MultiPartHasher::Backend>> backends = {
+    {"sodium", MultiPartHasher::Backend::kSodium}, {"openssl", MultiPartHasher::Backend::kOpenSsl}};
+
 TEST(Hash, EncodeDecode) {
   std::vector<Hash> hashes = {{Hash::Type::kSha256, "abcd"}, {Hash::Type::kSha512, "defg"}};
 
@@ -26,6 +38,134 @@ TEST(Hash, DecodeBad) {
   EXPECT_EQ(Hash::decodeVector(bad4), std::vector<Hash>{});
 }
 
+/* The digest is kept in binary, but reads and writes as the upper case hex it
+ * always did, whatever the case it was given in. */
+TEST(Hash, BinaryDigest) {
+  const std::string data = "some data";
+  const std::string hex = Crypto::sha256digestHex(data);
+  const Hash from_hex(Hash::Type::kSha256, hex);
+  const Hash generated = Hash::generate(Hash::Type::kSha256, data);
+  EXPECT_EQ(from_hex, generated);
+  EXPECT_EQ(Hash::fromDigest(Hash::Type::kSha256, Crypto::sha256digest(data)), generated);
+  EXPECT_EQ(generated.HashString(), boost::algorithm::to_upper_copy(hex));
+  EXPECT_EQ(Hash::encodeVector({generated}), "sha256:" + boost::algorithm::to_upper_copy(hex));
+  EXPECT_NE(Hash(Hash::Type::kSha512, hex), generated);
+  EXPECT_NE(Hash(Hash::Type::kSha256, hex.substr(2)), generated);
+
+  // Not hex
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "xyz").HashString(), "XYZ");
+  EXPECT_EQ(Hash(Hash::Type::kSha256, "abc").HashString(), "ABC");
+  EXPECT_NE(Hash(Hash::Type::kSha256, "abc"), Hash(Hash::Type::kSha256, "abc0"));
+}
+
+/* Hashing continues from a saved state; the OpenSSL hashers can't save it. */
+TEST(Hash, MultiPartState) {
+  const std::string head = "first part, ";
+  const std::string tail = "second part";
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    auto hasher = MultiPartHasher::create(type, MultiPartHasher::Backend::kSodium);
+    hasher->update(reinterpret_cast<const unsigned char*>(head.data()), head.size());
+    const std::string state = hasher->getState();
+    hasher->update(reinterpret_cast<const unsigned char*>(tail.data()), tail.size());
+
+    auto resumed = MultiPartHasher::create(type, MultiPartHasher::Backend::kSodium);
+    EXPECT_FALSE(resumed->setState("short"));
+    ASSERT_TRUE(resumed->setState(state));
+    resumed->update(reinterpret_cast<const unsigned char*>(tail.data()), tail.size());
+    const Hash hash = resumed->getHash();
+    EXPECT_EQ(hash, hasher->getHash());
+    EXPECT_EQ(hash, Hash::generate(type, head + tail));
+
+    auto openssl = MultiPartHasher::create(type, MultiPartHasher::Backend::kOpenSsl);
+    openssl->update(reinterpret_cast<const unsigned char*>(head.data()), head.size());
+    EXPECT_TRUE(openssl->getState().empty());
+    EXPECT_FALSE(openssl->setState(state));
+    openssl->update(reinterpret_cast<const unsigned char*>(tail.data()), tail.size());
+    EXPECT_EQ(openssl->getHash(), hash);
+  }
+}
+
+/* All backends compute the same hashes, whatever the size of the parts. */
+TEST(Hash, MultiPartBackends) {
+  std::string data;
+  for (int i = 0; i < 100000; ++i) {
+    data += static_cast<char>(i * 7);
+  }
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    const Hash expected = Hash::generate(type, data);
+    for (const auto& backend : backends) {
+      for (const size_t part : std::vector<size_t>{1, 63, 64, 4096, 100000}) {
+        auto hasher = MultiPartHasher::create(type, backend.second);
+        for (size_t offset = 0; offset < data.size(); offset += part) {
+          const size_t size = std::min(part, data.size() - offset);
+          hasher->update(reinterpret_cast<const unsigned char*>(data.data()) + offset, size);
+        }
+        EXPECT_EQ(hasher->getHash(), expected) << backend.first << " in parts of " << part;
+      }
+      auto hasher = MultiPartHasher::create(type, backend.second);
+      hasher->update(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+      hasher->reset();
+      EXPECT_EQ(hasher->getHash(), Hash::generate(type, "")) << backend.first;
+    }
+  }
+}
+
+/* All the supported hashes of a list are computed at once. */
+TEST(Hash, MultiPartComposite) {
+  const std::string data = "some data to hash";
+  const std::vector<Hash> hashes = {Hash::generate(Hash::Type::kSha512, data), Hash("md5", "00"),
+                                    Hash::generate(Hash::Type::kSha256, data),
+                                    Hash(Hash::Type::kSha256, "other sha256")};
+  MultiPartCompositeHasher hasher(hashes, MultiPartHasher::Backend::kSodium);
+  ASSERT_FALSE(hasher.empty());
+  hasher.update(reinterpret_cast<const unsigned char*>(data.data()), 4);
+  const std::string state = hasher.getState();
+  hasher.update(reinterpret_cast<const unsigned char*>(data.data()) + 4, data.size() - 4);
+  EXPECT_EQ(hasher.getHashes(), (std::vector<Hash>{hashes[0], hashes[2]}));
+
+  MultiPartCompositeHasher resumed(hashes, MultiPartHasher::Backend::kSodium);
+  EXPECT_FALSE(resumed.setState(state.substr(1)));
+  ASSERT_TRUE(resumed.setState(state));
+  resumed.update(reinterpret_cast<const unsigned char*>(data.data()) + 4, data.size() - 4);
+  EXPECT_EQ(resumed.getHash(), hashes[0]);
+
+  MultiPartCompositeHasher openssl(hashes);
+  openssl.update(reinterpret_cast<const unsigned char*>(data.data()), data.size());
+  EXPECT_TRUE(openssl.getState().empty());
+  EXPECT_FALSE(openssl.setState(state));
+  EXPECT_FALSE(openssl.setState(""));
+  EXPECT_EQ(openssl.getHashes(), (std::vector<Hash>{hashes[0], hashes[2]}));
+
+  MultiPartCompositeHasher unsupported({Hash("md5", "00")});
+  EXPECT_TRUE(unsupported.empty());
+  EXPECT_THROW(unsupported.getHash(), std::runtime_error);
+}
+
+/*
+ * Throughput of each backend, hashing in parts as large as those written by
+ * the downloads; run with --gtest_also_run_disabled_tests. The results are
+ * printed and recorded as test properties in MB/s.
+ */
+TEST(Hash, DISABLED_MultiPartThroughput) {
+  const std::string part(64 * 1024, 'x');
+  const int parts = 4096;  // 256 MiB
+  for (const auto type : {Hash::Type::kSha256, Hash::Type::kSha512}) {
+    for (const auto& backend : backends) {
+      auto hasher = MultiPartHasher::create(type, backend.second);
+      const auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < parts; ++i) {
+        hasher->update(reinterpret_cast<const unsigned char*>(part.data()), part.size());
+      }
+      hasher->getHexDigest();
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      const auto mb_per_s = static_cast<int64_t>(static_cast<double>(part.size()) * parts / 1e6 / elapsed.count());
+      const std::string name = Hash::TypeString(type) + "_" + backend.first;
+      RecordProperty(name + "_mb_per_s", std::to_string(mb_per_s));
+      std::cout << name << ": " << mb_per_s << " MB/s\n";
+    }
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -1,8 +1,12 @@
 #include "keymanager.h"
 
+#include <mutex>
 #include <stdexcept>
+#include <tuple>
 #include <utility>
 
+#include <openssl/crypto.h>
+#include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/scoped_array.hpp>
 
@@ -12,6 +16,7 @@
 #include "libaktualizr/types.h"
 #include "p11engine.h"
 #include "storage/invstorage.h"
+#include "utilities/executor.h"
 
 // by using constexpr the compiler can optimize out method calls when the
 // feature is disabled. We won't then need to link with the actual p11 engine
@@ -34,6 +39,17 @@ KeyManager::KeyManager(std::shared_ptr<INvStorage> backend, KeyManagerConfig con
   }
 }
 
+KeyManager::~KeyManager() { releaseUptaneKey(); }
+
+void KeyManager::releaseUptaneKey() {
+  std::lock_guard<std::mutex> guard(uptane_key_mutex_);
+  // OpenSSL clears the RSA key material when the key is freed.
+  uptane_rsa_key_.reset();
+  OPENSSL_cleanse(&uptane_ed25519_key_[0], uptane_ed25519_key_.size());
+  uptane_ed25519_key_.clear();
+  uptane_keyid_.clear();
+}
+
 void KeyManager::loadKeys(const std::string *pkey_content, const std::string *cert_content,
                           const std::string *ca_content) {
   if (config_.tls_pkey_source == CryptoSource::kFile) {
@@ -264,22 +280,42 @@ void KeyManager::copyCertsToCurl(HttpInterface &http) const {
 }
 
 Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
-  ENGINE *crypto_engine = nullptr;
-  std::string private_key;
+  const std::string message = Utils::jsonToCanonicalStr(in_data);
+  std::string b64sig;
   if (config_.uptane_key_source == CryptoSource::kPkcs11) {
     if (!built_with_p11) {
       throw std::runtime_error("Aktualizr was built without PKCS#11");
     }
-    crypto_engine = (*p11_)->getEngine();
-    private_key = config_.p11.uptane_key_id;
-  }
-
-  std::string b64sig;
-  if (config_.uptane_key_source == CryptoSource::kFile) {
-    backend_->loadPrimaryPrivate(&private_key);
+    // The key stays open between signatures. If the token was reset in the
+    // meantime, signing fails: open the key again, which logs in anew.
+    for (int attempt = 0; attempt < 2 && b64sig.empty(); ++attempt) {
+      const auto key = (*p11_)->getPrivateKey(config_.p11.uptane_key_id);
+      if (key == nullptr) {
+        break;
+      }
+      b64sig = Utils::toBase64(Crypto::RSAPSSSign(key.get(), message));
+      if (b64sig.empty()) {
+        (*p11_)->releasePrivateKey(config_.p11.uptane_key_id);
+      }
+    }
+  } else {
+    std::lock_guard<std::mutex> guard(uptane_key_mutex_);
+    if (uptane_rsa_key_ == nullptr && uptane_ed25519_key_.empty()) {
+      std::string private_key;
+      backend_->loadPrimaryPrivate(&private_key);
+      if (config_.uptane_key_type == KeyType::kED25519) {
+        uptane_ed25519_key_ = boost::algorithm::unhex(private_key);
+      } else {
+        uptane_rsa_key_ = Crypto::parsePrivateKey(private_key);
+      }
+      OPENSSL_cleanse(&private_key[0], private_key.size());
+    }
+    if (!uptane_ed25519_key_.empty()) {
+      b64sig = Utils::toBase64(Crypto::ED25519Sign(uptane_ed25519_key_, message));
+    } else if (uptane_rsa_key_ != nullptr) {
+      b64sig = Utils::toBase64(Crypto::RSAPSSSign(uptane_rsa_key_.get(), message));
+    }
   }
-  b64sig = Utils::toBase64(
-      Crypto::Sign(config_.uptane_key_type, crypto_engine, private_key, Utils::jsonToCanonicalStr(in_data)));
 
   Json::Value signature;
   switch (config_.uptane_key_type) {
@@ -297,21 +333,50 @@ Json::Value KeyManager::signTuf(const Json::Value &in_data) const {
   signature["sig"] = b64sig;
 
   Json::Value out_data;
-  signature["keyid"] = UptanePublicKey().KeyId();
+  {
+    std::lock_guard<std::mutex> guard(uptane_key_mutex_);
+    if (uptane_keyid_.empty()) {
+      uptane_keyid_ = UptanePublicKey().KeyId();
+    }
+    signature["keyid"] = uptane_keyid_;
+  }
   out_data["signed"] = in_data;
   out_data["signatures"] = Json::Value(Json::arrayValue);
   out_data["signatures"].append(signature);
   return out_data;
 }
 
+void KeyManager::startUptaneKeyGeneration() {
+  if (config_.uptane_key_source != CryptoSource::kFile || pending_uptane_keys_.valid() ||
+      backend_->loadPrimaryKeys(nullptr, nullptr)) {
+    return;
+  }
+  const KeyType key_type = config_.uptane_key_type;
+  pending_uptane_keys_ = Executor::cpu().submit([key_type]() {
+    std::string public_key;
+    std::string private_key;
+    if (!Crypto::generateKeyPair(key_type, &public_key, &private_key)) {
+      return std::pair<std::string, std::string>();
+    }
+    return std::make_pair(public_key, private_key);
+  });
+}
+
 std::string KeyManager::generateUptaneKeyPair() {
   std::string primary_public;
 
   if (config_.uptane_key_source == CryptoSource::kFile) {
     std::string primary_private;
     if (!backend_->loadPrimaryKeys(&primary_public, &primary_private)) {
-      bool result_ = Crypto::generateKeyPair(config_.uptane_key_type, &primary_public, &primary_private);
+      bool result_;
+      if (pending_uptane_keys_.valid()) {
+        std::tie(primary_public, primary_private) = pending_uptane_keys_.get();
+        result_ = !primary_public.empty();
+      } else {
+        result_ = Crypto::generateKeyPair(config_.uptane_key_type, &primary_public, &primary_private);
+      }
       if (result_) {
+        releaseUptaneKey();
         backend_->storePrimaryKeys(primary_public, primary_private);
       }
     }
@@ -1,9 +1,13 @@
 #ifndef KEYMANAGER_H_
 #define KEYMANAGER_H_
 
+#include <future>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <utility>
 
+#include <openssl/ossl_typ.h>
 #include "json/json.h"
 
 #include "libaktualizr/config.h"  // for KeyManagerConfig
@@ -21,6 +25,9 @@ class KeyManager {
   void copyCertsToCurl(HttpInterface &http) const;
   KeyManager(std::shared_ptr<INvStorage> backend, KeyManagerConfig config,
              const std::shared_ptr<P11EngineGuard> &p11 = nullptr);
+  ~KeyManager();
+  KeyManager(const KeyManager &) = delete;
+  KeyManager &operator=(const KeyManager &) = delete;
   void loadKeys(const std::string *pkey_content = nullptr, const std::string *cert_content = nullptr,
                 const std::string *ca_content = nullptr);
   std::string getPkeyFile() const;
@@ -32,6 +39,11 @@ class KeyManager {
   std::string getCN() const;
   void getCertInfo(std::string *subject, std::string *issuer, std::string *not_before, std::string *not_after) const;
   bool isOk() const { return (!getPkey().empty() && !getCert().empty() && !getCa().empty()); }
+  /**
+   * Start generating the Uptane key pair in the background if it is not in
+   * storage yet, so that generateUptaneKeyPair() only waits for what is left.
+   */
+  void startUptaneKeyGeneration();
   std::string generateUptaneKeyPair();
   KeyType getUptaneKeyType() const { return config_.uptane_key_type; }
   Json::Value signTuf(const Json::Value &in_data) const;
@@ -39,9 +51,19 @@ class KeyManager {
   PublicKey UptanePublicKey() const;
 
  private:
+  void releaseUptaneKey();
+
   std::shared_ptr<INvStorage> backend_;
   const KeyManagerConfig config_;
   std::shared_ptr<P11EngineGuard> p11_;
+  // Public and private key from startUptaneKeyGeneration(), empty on failure
+  std::future<std::pair<std::string, std::string>> pending_uptane_keys_;
+  // Uptane private key from storage and key ID, loaded on first use. The
+  // Ed25519 key is binary and wiped on destruction.
+  mutable std::mutex uptane_key_mutex_;
+  mutable std::shared_ptr<EVP_PKEY> uptane_rsa_key_;
+  mutable std::string uptane_ed25519_key_;
+  mutable std::string uptane_keyid_;
   std::unique_ptr<TemporaryFile> tmp_pkey_file;
   std::unique_ptr<TemporaryFile> tmp_cert_file;
   std::unique_ptr<TemporaryFile> tmp_ca_file;
@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <memory>
+#include <string>
 
 #include <boost/filesystem.hpp>
 #include "json/json.h"
@@ -39,6 +40,28 @@ TEST(KeyManager, SignTuf) {
   EXPECT_EQ(signed_json["signatures"][0]["method"].asString(), "rsassa-pss");
 }
 
+/* The Uptane private key is read from storage and parsed only once. */
+TEST(KeyManager, SignTufCachedKey) {
+  Config config;
+  config.uptane.key_type = KeyType::kRSA2048;
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  storage->storePrimaryKeys(Utils::readFile("tests/test_data/public.key"), Utils::readFile("tests/test_data/priv.key"));
+  KeyManager keys(storage, config.keymanagerConfig());
+  const PublicKey public_key = keys.UptanePublicKey();
+
+  Json::Value tosign_json;
+  tosign_json["mykey"] = "value";
+  const Json::Value first = keys.signTuf(tosign_json);
+  storage->clearPrimaryKeys();
+  const Json::Value second = keys.signTuf(tosign_json);
+  for (const auto &signed_json : {first, second}) {
+    EXPECT_TRUE(public_key.VerifySignature(signed_json["signatures"][0]["sig"].asString(),
+                                           Utils::jsonToCanonicalStr(tosign_json)));
+  }
+}
+
 /* Sign TUF metadata with ED25519. */
 TEST(KeyManager, SignED25519Tuf) {
   std::string private_key =
@@ -65,6 +88,29 @@ TEST(KeyManager, SignED25519Tuf) {
   EXPECT_EQ(signed_json["signatures"][0]["method"].asString(), "ed25519");
 }
 
+/* The Uptane key pair generated in the background is stored, and keys already stored are kept. */
+TEST(KeyManager, BackgroundKeyGeneration) {
+  Config config;
+  config.uptane.key_type = KeyType::kRSA2048;
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+
+  keys.startUptaneKeyGeneration();
+  const std::string public_key = keys.generateUptaneKeyPair();
+  EXPECT_FALSE(public_key.empty());
+  std::string stored_public;
+  std::string stored_private;
+  EXPECT_TRUE(storage->loadPrimaryKeys(&stored_public, &stored_private));
+  EXPECT_EQ(stored_public, public_key);
+  EXPECT_EQ(keys.UptanePublicKey().Type(), KeyType::kRSA2048);
+
+  KeyManager other_keys(storage, config.keymanagerConfig());
+  other_keys.startUptaneKeyGeneration();
+  EXPECT_EQ(other_keys.generateUptaneKeyPair(), public_key);
+}
+
 TEST(KeyManager, InitFileEmpty) {
   Config config;
   TemporaryDirectory temp_dir;
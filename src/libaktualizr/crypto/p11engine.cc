@@ -130,6 +130,8 @@ P11Engine::P11Engine(boost::filesystem::path module_path, std::string pass)
 }
 
 P11Engine::~P11Engine() {
+  // The keys belong to the engine
+  keys_.clear();
   if (ssl_engine_ != nullptr) {
     ENGINE_finish(ssl_engine_);
     ENGINE_free(ssl_engine_);
@@ -174,6 +176,27 @@ PKCS11_SLOT* P11Engine::findTokenSlot() const {
   return slot;
 }
 
+std::shared_ptr<EVP_PKEY> P11Engine::getPrivateKey(const std::string& id) {
+  std::lock_guard<std::mutex> guard(keys_mutex_);
+  auto it = keys_.find(id);
+  if (it != keys_.end()) {
+    return it->second;
+  }
+  // Logs in to the token if needed
+  std::shared_ptr<EVP_PKEY> key(ENGINE_load_private_key(ssl_engine_, id.c_str(), nullptr, nullptr), EVP_PKEY_free);
+  if (key == nullptr) {
+    LOG_ERROR << "ENGINE_load_private_key failed with error " << ERR_error_string(ERR_get_error(), nullptr);
+    return nullptr;
+  }
+  keys_[id] = key;
+  return key;
+}
+
+void P11Engine::releasePrivateKey(const std::string& id) {
+  std::lock_guard<std::mutex> guard(keys_mutex_);
+  keys_.erase(id);
+}
+
 bool P11Engine::readUptanePublicKey(const std::string& uptane_key_id, std::string* key_out) {
   if (module_path_.empty()) {
     LOG_WARNING << "P11Engine has no module_path_";
@@ -1,7 +1,10 @@
 #ifndef P11ENGINE_H_
 #define P11ENGINE_H_
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include "libaktualizr/config.h"
 
@@ -58,6 +61,13 @@ class P11Engine {
   bool readUptanePublicKey(const std::string &uptane_key_id, std::string *key_out);
   bool readTlsCert(const std::string &id, std::string *cert_out) const;
   bool generateUptaneKeyPair(const std::string &uptane_key_id);
+  /**
+   * Private key loaded through the engine. Opening a key on the token takes
+   * about as long as a signature, so it is kept open for later use.
+   */
+  std::shared_ptr<EVP_PKEY> getPrivateKey(const std::string &id);
+  /** Close a key returned by getPrivateKey(), e.g. when the token was reset. */
+  void releasePrivateKey(const std::string &id);
 
  private:
   const boost::filesystem::path module_path_;
@@ -66,6 +76,8 @@ class P11Engine {
   std::string uri_prefix_;
   P11ContextWrapper ctx_;
   P11SlotsWrapper wslots_;
+  std::mutex keys_mutex_;
+  std::map<std::string, std::shared_ptr<EVP_PKEY>> keys_;
 
   static boost::filesystem::path findPkcsLibrary();
   PKCS11_slot_st *findTokenSlot() const;
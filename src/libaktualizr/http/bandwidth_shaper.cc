@@ -0,0 +1,125 @@
+#include "http/bandwidth_shaper.h"
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "logging/logging.h"
+
+constexpr BandwidthShaper::clock::duration BandwidthShaper::kWindow;
+constexpr BandwidthShaper::clock::duration BandwidthShaper::kBurst;
+constexpr BandwidthShaper::clock::duration BandwidthShaper::kRttSlack;
+
+BandwidthShaper::BandwidthShaper(const NetworkConfig &config)
+    : share_{std::min(std::max(config.bandwidth_share, 0.01), 1.0)}, ceiling_{config.bandwidth_ceiling} {}
+
+void BandwidthShaper::throttle(size_t bytes, curl_socket_t socket) {
+  const clock::duration rtt = socketRtt(socket);
+  clock::duration delay{0};
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const auto now = clock::now();
+    record(now, bytes, rtt);
+    const uint64_t rate = rateLocked();
+    if (rate > 0) {
+      // Token bucket: allow short bursts, then space the data out at the rate.
+      next_send_ = std::max(next_send_, now - kBurst) +
+                   std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(
+                       static_cast<double>(bytes) / static_cast<double>(rate)));
+      if (next_send_ > now) {
+        delay = next_send_ - now;
+      }
+    }
+  }
+  if (delay > clock::duration(0)) {
+    std::this_thread::sleep_for(delay);
+  }
+}
+
+void BandwidthShaper::transferFailed() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  window_failed_ = true;
+}
+
+uint64_t BandwidthShaper::rate() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return rateLocked();
+}
+
+uint64_t BandwidthShaper::capacity() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return capacity_;
+}
+
+void BandwidthShaper::record(clock::time_point now, size_t bytes, clock::duration rtt) {
+  if (rtt > clock::duration(0)) {
+    min_rtt_ = std::min(min_rtt_, rtt);
+    last_rtt_ = rtt;
+  }
+  window_bytes_ += bytes;
+  if (now - window_start_ >= kWindow) {
+    closeWindow(now);
+  }
+}
+
+void BandwidthShaper::closeWindow(clock::time_point now) {
+  const double seconds = std::chrono::duration<double>(now - window_start_).count();
+  const auto throughput = static_cast<uint64_t>(static_cast<double>(window_bytes_) / seconds);
+  const bool congested =
+      window_failed_ ||
+      (last_rtt_ > clock::duration(0) &&
+       last_rtt_ > std::chrono::duration_cast<clock::duration>(min_rtt_ * kRttFactor) + kRttSlack);
+
+  if (!congested) {
+    if (throughput > capacity_) {
+      capacity_ = throughput;
+    } else if (controller_.MaxConcurrency() == kSteps && throughput * 10 >= rateLocked() * 9) {
+      // Running at the limit on a quiet link: there may be more bandwidth.
+      capacity_ += capacity_ / 20;
+    }
+    if (ceiling_ > 0) {
+      capacity_ = std::min(capacity_, static_cast<uint64_t>(static_cast<double>(ceiling_) / share_));
+    }
+  }
+  const int prev_steps = controller_.MaxConcurrency();
+  controller_.RequestCompleted(window_start_, now, !congested);
+  if (controller_.MaxConcurrency() != prev_steps) {
+    LOG_DEBUG << "Download rate limit is now " << rateLocked() << " bytes/s (estimated capacity " << capacity_
+              << " bytes/s)";
+  }
+
+  window_bytes_ = 0;
+  window_failed_ = false;
+  // Strictly after `now`, so that the controller takes the next window into account.
+  window_start_ = now + clock::duration(1);
+}
+
+uint64_t BandwidthShaper::rateLocked() const {
+  uint64_t limit = static_cast<uint64_t>(static_cast<double>(capacity_) * share_);
+  if (ceiling_ > 0 && (limit == 0 || limit > ceiling_)) {
+    limit = ceiling_;
+  }
+  if (limit == 0) {
+    // Nothing measured yet: run freely for a first estimate.
+    return 0;
+  }
+  return std::max(kMinRate, limit * static_cast<uint64_t>(controller_.MaxConcurrency()) / kSteps);
+}
+
+BandwidthShaper::clock::duration BandwidthShaper::socketRtt(curl_socket_t socket) {
+#ifdef TCP_INFO
+  if (socket != CURL_SOCKET_BAD) {
+    struct tcp_info info {};
+    socklen_t len = sizeof(info);
+    if (getsockopt(socket, IPPROTO_TCP, TCP_INFO, &info, &len) == 0) {
+      return std::chrono::microseconds(info.tcpi_rtt);
+    }
+  }
+#else
+  (void)socket;
+#endif
+  return clock::duration(0);
+}
@@ -0,0 +1,75 @@
+#ifndef HTTP_BANDWIDTH_SHAPER_H_
+#define HTTP_BANDWIDTH_SHAPER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+#include <curl/curl.h>
+#include "gtest/gtest_prod.h"
+
+#include "libaktualizr/config.h"
+#include "utilities/rate_controller.h"
+
+/**
+ * Adaptive limit of the aggregate download rate of an HttpClient and its
+ * copies.
+ *
+ * The link capacity is estimated from the fastest download rate seen over one
+ * second while the link was not congested. Downloads are limited to a share of
+ * that capacity, scaled by a RateController: every second without congestion
+ * the rate grows by one step towards the ceiling, while a rising round-trip
+ * time or a failed transfer halves it. When the rate sits at the ceiling and
+ * the link stays quiet, the capacity estimate is slowly raised to probe for
+ * more bandwidth.
+ */
+class BandwidthShaper {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  explicit BandwidthShaper(const NetworkConfig &config);
+
+  /**
+   * Account for data received on a socket, and block for as long as is needed
+   * to keep the rate within the current limit.
+   */
+  void throttle(size_t bytes, curl_socket_t socket);
+  /** Treat a failed transfer as a sign of congestion. */
+  void transferFailed();
+  /** Current rate limit in bytes per second, 0 if not limited yet. */
+  uint64_t rate() const;
+  /** Estimated link capacity in bytes per second, 0 if unknown yet. */
+  uint64_t capacity() const;
+
+  static constexpr int kSteps = 10;
+  // Never go below this rate, so that curl's low speed limit doesn't abort transfers
+  static constexpr uint64_t kMinRate = 16 * 1024;
+
+ private:
+  FRIEND_TEST(BandwidthShaper, Adapts);
+
+  void record(clock::time_point now, size_t bytes, clock::duration rtt);
+  void closeWindow(clock::time_point now);
+  uint64_t rateLocked() const;
+  static clock::duration socketRtt(curl_socket_t socket);
+
+  static constexpr clock::duration kWindow = std::chrono::seconds(1);
+  static constexpr clock::duration kBurst = std::chrono::milliseconds(100);
+  // A round-trip time this much above the lowest one seen means congestion
+  static constexpr double kRttFactor = 2.0;
+  static constexpr clock::duration kRttSlack = std::chrono::milliseconds(20);
+
+  double share_;
+  uint64_t ceiling_;
+  mutable std::mutex mutex_;
+  RateController controller_{kSteps};
+  uint64_t capacity_{0};
+  clock::duration min_rtt_{clock::duration::max()};
+  clock::duration last_rtt_{0};
+  bool window_failed_{false};
+  uint64_t window_bytes_{0};
+  clock::time_point window_start_{clock::now()};
+  clock::time_point next_send_{};
+};
+
+#endif  // HTTP_BANDWIDTH_SHAPER_H_
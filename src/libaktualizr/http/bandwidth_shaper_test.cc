@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include "http/bandwidth_shaper.h"
+#include "logging/logging.h"
+
+/* The rate grows on a quiet link and backs off when the round-trip time rises. */
+TEST(BandwidthShaper, Adapts) {
+  NetworkConfig config;
+  config.bandwidth_shaping = true;
+  config.bandwidth_share = 0.5;
+  BandwidthShaper shaper(config);
+  EXPECT_EQ(shaper.rate(), 0);
+
+  const auto rtt = std::chrono::milliseconds(50);
+  auto now = BandwidthShaper::clock::now();
+  auto next_window = [&shaper, &now](uint64_t bytes, BandwidthShaper::clock::duration sample_rtt) {
+    now = std::max(now, shaper.window_start_) + std::chrono::seconds(1);
+    shaper.record(now, static_cast<size_t>(bytes), sample_rtt);
+  };
+
+  // The first window measures the capacity: 1 MB/s.
+  next_window(1000000, rtt);
+  EXPECT_NEAR(static_cast<double>(shaper.capacity()), 1000000, 1000);
+  const uint64_t first_rate = shaper.rate();
+  EXPECT_GT(first_rate, 0);
+  EXPECT_LE(first_rate, 500000);
+
+  // The rate grows up to half the capacity.
+  for (int i = 0; i < 2 * BandwidthShaper::kSteps; ++i) {
+    next_window(shaper.rate(), rtt);
+  }
+  EXPECT_GE(shaper.rate(), 500000);
+  // Without any sign of congestion, the link is probed for more capacity.
+  EXPECT_GT(shaper.capacity(), 1000000);
+  const uint64_t top_rate = shaper.rate();
+
+  // A sharp rise of the round-trip time halves the rate.
+  next_window(shaper.rate(), 4 * rtt);
+  EXPECT_LT(shaper.rate(), top_rate * 6 / 10);
+
+  // So does a failed transfer.
+  const uint64_t congested_rate = shaper.rate();
+  shaper.transferFailed();
+  next_window(shaper.rate(), rtt);
+  EXPECT_LT(shaper.rate(), congested_rate);
+  EXPECT_GE(shaper.rate(), BandwidthShaper::kMinRate);
+}
+
+/* The ceiling applies even before the capacity is known. */
+TEST(BandwidthShaper, Ceiling) {
+  NetworkConfig config;
+  config.bandwidth_shaping = true;
+  config.bandwidth_ceiling = 200000;
+  BandwidthShaper shaper(config);
+  EXPECT_GT(shaper.rate(), 0);
+  EXPECT_LE(shaper.rate(), 200000);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
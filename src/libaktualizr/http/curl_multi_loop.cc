@@ -0,0 +1,179 @@
+#include "http/curl_multi_loop.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "utilities/allocation_accounting.h"
+#include "utilities/flow_control.h"
+
+// How long the loop waits without transfers before it checks on itself anyway
+static constexpr int kIdleWaitMs = 60 * 1000;
+
+CurlMultiLoop::CurlMultiLoop() : multi_{curl_multi_init()} {
+  if (multi_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl multi handle");
+  }
+  if (pipe2(wake_pipe_.data(), O_NONBLOCK | O_CLOEXEC) != 0) {
+    curl_multi_cleanup(multi_);
+    throw std::runtime_error(std::string("Could not create the pipe of the curl event loop: ") + std::strerror(errno));
+  }
+  // Concurrent requests to a server that speaks HTTP/2 are streams of one
+  // connection.
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+  thread_ = std::thread([this]() { run(); });
+}
+
+CurlMultiLoop::~CurlMultiLoop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake();
+  thread_.join();
+  curl_multi_cleanup(multi_);
+  close(wake_pipe_[0]);
+  close(wake_pipe_[1]);
+}
+
+std::shared_ptr<CurlMultiLoop> CurlMultiLoop::global() {
+  static std::shared_ptr<CurlMultiLoop> instance = std::make_shared<CurlMultiLoop>();
+  return instance;
+}
+
+void CurlMultiLoop::submit(CURL *handle, const api::FlowControlToken *token, Callback done) {
+  // A pause or abort is applied right away rather than on the next poll.
+  const int listener = token != nullptr ? token->addListener([this]() { wake(); }) : -1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!stopping_) {
+      submitted_.emplace_back(handle, Transfer{token, std::move(done), false, listener});
+      ++transfers_;
+      done = nullptr;
+    }
+  }
+  if (done) {
+    // The loop is stopping
+    if (token != nullptr) {
+      token->removeListener(listener);
+    }
+    done(CURLE_ABORTED_BY_CALLBACK);
+    return;
+  }
+  wake();
+}
+
+std::future<CURLcode> CurlMultiLoop::perform(CURL *handle, const api::FlowControlToken *token) {
+  auto promise = std::make_shared<std::promise<CURLcode>>();
+  auto future = promise->get_future();
+  submit(handle, token, [promise](CURLcode result) { promise->set_value(result); });
+  return future;
+}
+
+size_t CurlMultiLoop::transfers() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return transfers_;
+}
+
+void CurlMultiLoop::wake() {
+  const char byte = 0;
+  // A full pipe wakes the loop all the same
+  if (write(wake_pipe_[1], &byte, 1) < 0 && errno != EAGAIN) {
+    LOG_ERROR << "Could not wake the curl event loop: " << std::strerror(errno);
+  }
+}
+
+void CurlMultiLoop::update(std::vector<std::pair<Transfer, CURLcode>> *finished) {
+  std::vector<std::pair<CURL *, Transfer>> submitted;
+  bool stopping = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    submitted.swap(submitted_);
+    stopping = stopping_;
+  }
+  for (auto &transfer : submitted) {
+    const CURLMcode code = curl_multi_add_handle(multi_, transfer.first);
+    if (code != CURLM_OK) {
+      LOG_ERROR << "Could not start a transfer: " << curl_multi_strerror(code);
+      finished->emplace_back(std::move(transfer.second), CURLE_FAILED_INIT);
+      continue;
+    }
+    active_.emplace(transfer.first, std::move(transfer.second));
+  }
+
+  for (auto it = active_.begin(); it != active_.end();) {
+    const api::FlowControlToken *token = it->second.token;
+    if (stopping || (token != nullptr && token->hasAborted() && !token->isPaused())) {
+      curl_multi_remove_handle(multi_, it->first);
+      finished->emplace_back(std::move(it->second), CURLE_ABORTED_BY_CALLBACK);
+      it = active_.erase(it);
+      continue;
+    }
+    if (token != nullptr) {
+      const bool paused = token->isPaused();
+      if (paused != it->second.paused) {
+        curl_easy_pause(it->first, paused ? CURLPAUSE_ALL : CURLPAUSE_CONT);
+        it->second.paused = paused;
+      }
+    }
+    ++it;
+  }
+}
+
+void CurlMultiLoop::run() {
+  const AllocationAccounting::Scope accounting(AllocationTag::kNetwork);
+  std::vector<std::pair<Transfer, CURLcode>> finished;
+  for (;;) {
+    update(&finished);
+
+    int running = 0;
+    curl_multi_perform(multi_, &running);
+    int queued = 0;
+    while (CURLMsg *msg = curl_multi_info_read(multi_, &queued)) {
+      if (msg->msg != CURLMSG_DONE) {
+        continue;
+      }
+      // The message is gone once the handle is removed
+      CURL *handle = msg->easy_handle;
+      const CURLcode result = msg->data.result;
+      curl_multi_remove_handle(multi_, handle);
+      auto it = active_.find(handle);
+      if (it != active_.end()) {
+        finished.emplace_back(std::move(it->second), result);
+        active_.erase(it);
+      }
+    }
+
+    // Outside of the lock, the callbacks may submit more transfers.
+    for (auto &transfer : finished) {
+      if (transfer.first.token != nullptr) {
+        transfer.first.token->removeListener(transfer.first.listener);
+      }
+      transfer.first.done(transfer.second);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      transfers_ -= finished.size();
+      if (stopping_ && transfers_ == 0) {
+        break;
+      }
+    }
+    finished.clear();
+
+    curl_waitfd wake_fd{};
+    wake_fd.fd = wake_pipe_[0];
+    wake_fd.events = CURL_WAIT_POLLIN;
+    const int timeout = active_.empty() ? kIdleWaitMs : static_cast<int>(kPollInterval.count());
+    const CURLMcode code = curl_multi_wait(multi_, &wake_fd, 1, timeout, nullptr);
+    if (code != CURLM_OK) {
+      LOG_ERROR << "curl event loop failed to wait: " << curl_multi_strerror(code);
+      std::this_thread::sleep_for(kPollInterval);
+    }
+    std::array<char, 64> drain{};
+    while (read(wake_pipe_[0], drain.data(), drain.size()) > 0) {
+    }
+  }
+}
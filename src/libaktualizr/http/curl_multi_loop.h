@@ -0,0 +1,87 @@
+#ifndef HTTP_CURL_MULTI_LOOP_H_
+#define HTTP_CURL_MULTI_LOOP_H_
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <curl/curl.h>
+
+namespace api {
+class FlowControlToken;
+}
+
+/**
+ * An event loop that runs transfers of curl easy handles on a single thread,
+ * through a curl multi handle. The transfers in progress at the same time
+ * share that thread and the connection cache of the multi handle (or of the
+ * share handle the easy handles are attached to).
+ *
+ * A transfer given a FlowControlToken is paused while the token is paused and
+ * stopped with CURLE_ABORTED_BY_CALLBACK once it is aborted or past its
+ * deadline. The loop is woken up by the changes of the token, and notices
+ * the deadline within kPollInterval.
+ *
+ * The curl callbacks of the handles run on the thread of the loop, so they
+ * must not block.
+ */
+class CurlMultiLoop {
+ public:
+  using Callback = std::function<void(CURLcode)>;
+  // Longest time before the loop notices the deadline of a token
+  static constexpr std::chrono::milliseconds kPollInterval{100};
+
+  CurlMultiLoop();
+  /** Stops the transfers in progress with CURLE_ABORTED_BY_CALLBACK. */
+  ~CurlMultiLoop();
+  CurlMultiLoop(const CurlMultiLoop &) = delete;
+  CurlMultiLoop(CurlMultiLoop &&) = delete;
+  CurlMultiLoop &operator=(const CurlMultiLoop &) = delete;
+  CurlMultiLoop &operator=(CurlMultiLoop &&) = delete;
+
+  static std::shared_ptr<CurlMultiLoop> global();
+
+  /**
+   * Start the transfer of handle; done() is called with its result on the
+   * thread of the loop. The handle and the token must outlive the transfer.
+   */
+  void submit(CURL *handle, const api::FlowControlToken *token, Callback done);
+  /** Start the transfer of handle; the future has its result. */
+  std::future<CURLcode> perform(CURL *handle, const api::FlowControlToken *token = nullptr);
+
+  /** Number of the transfers submitted and not finished yet. */
+  size_t transfers() const;
+
+ private:
+  struct Transfer {
+    const api::FlowControlToken *token;
+    Callback done;
+    bool paused;
+    // Of the token, which wakes the loop up
+    int listener;
+  };
+
+  void run();
+  void wake();
+  // Add the submitted transfers and apply the state of the tokens. Returns
+  // the transfers to finish with an error, removed from the multi handle.
+  void update(std::vector<std::pair<Transfer, CURLcode>> *finished);
+
+  CURLM *multi_;
+  std::array<int, 2> wake_pipe_{{-1, -1}};
+  mutable std::mutex mutex_;
+  std::vector<std::pair<CURL *, Transfer>> submitted_;
+  size_t transfers_{0};
+  bool stopping_{false};
+  // Only used by the thread of the loop
+  std::map<CURL *, Transfer> active_;
+  std::thread thread_;
+};
+
+#endif  // HTTP_CURL_MULTI_LOOP_H_
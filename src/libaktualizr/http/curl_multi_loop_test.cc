@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/curl_multi_loop.h"
+#include "logging/logging.h"
+#include "utilities/flow_control.h"
+#include "utilities/utils.h"
+
+static size_t writeString(char *contents, size_t size, size_t nmemb, void *userp) {
+  static_cast<std::string *>(userp)->append(contents, size * nmemb);
+  return size * nmemb;
+}
+
+// A server that accepts connections and never answers
+class SilentServer {
+ public:
+  SilentServer() : fd_{socket(AF_INET, SOCK_STREAM, 0)} {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    bind(fd_, reinterpret_cast<sockaddr *>(&addr), len);
+    listen(fd_, 16);
+    getsockname(fd_, reinterpret_cast<sockaddr *>(&addr), &len);
+    url_ = "http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/";
+  }
+  ~SilentServer() { close(fd_); }
+  SilentServer(const SilentServer &) = delete;
+  SilentServer(SilentServer &&) = delete;
+  SilentServer &operator=(const SilentServer &) = delete;
+  SilentServer &operator=(SilentServer &&) = delete;
+
+  const std::string &url() const { return url_; }
+
+ private:
+  int fd_;
+  std::string url_;
+};
+
+static CURL *makeHandle(const std::string &url, std::string *out) {
+  CURL *handle = curl_easy_init();
+  curl_easy_setopt(handle, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, writeString);
+  curl_easy_setopt(handle, CURLOPT_WRITEDATA, out);
+  return handle;
+}
+
+/* Concurrent transfers all complete on the loop, by future or by callback. */
+TEST(CurlMultiLoop, Transfers) {
+  TemporaryDirectory temp_dir;
+  CurlMultiLoop loop;
+  const int count = 10;
+  std::vector<std::string> outs(count);
+  std::vector<CURL *> handles;
+  std::vector<std::future<CURLcode>> futures;
+  for (int i = 0; i < count; ++i) {
+    const auto path = temp_dir / ("file" + std::to_string(i));
+    Utils::writeFile(path, std::string(static_cast<size_t>(1000 * i), static_cast<char>('a' + i)));
+    handles.push_back(makeHandle("file://" + path.string(), &outs[static_cast<size_t>(i)]));
+    futures.push_back(loop.perform(handles.back()));
+  }
+  std::string callback_out;
+  CURL *callback_handle = makeHandle("file://" + (temp_dir / "file1").string(), &callback_out);
+  std::promise<CURLcode> callback_result;
+  loop.submit(callback_handle, nullptr, [&callback_result](CURLcode result) { callback_result.set_value(result); });
+
+  for (int i = 0; i < count; ++i) {
+    EXPECT_EQ(futures[static_cast<size_t>(i)].get(), CURLE_OK);
+    EXPECT_EQ(outs[static_cast<size_t>(i)], std::string(static_cast<size_t>(1000 * i), static_cast<char>('a' + i)));
+    curl_easy_cleanup(handles[static_cast<size_t>(i)]);
+  }
+  EXPECT_EQ(callback_result.get_future().get(), CURLE_OK);
+  EXPECT_EQ(callback_out, outs[1]);
+  curl_easy_cleanup(callback_handle);
+  EXPECT_EQ(loop.transfers(), 0);
+}
+
+/* A transfer stops as soon as its token is aborted, without holding up the others. */
+TEST(CurlMultiLoop, Abort) {
+  SilentServer server;
+  CurlMultiLoop loop;
+  std::string out;
+  CURL *stalled = makeHandle(server.url(), &out);
+  api::FlowControlToken token;
+  auto stalled_result = loop.perform(stalled, &token);
+
+  TemporaryDirectory temp_dir;
+  Utils::writeFile(temp_dir / "file", std::string("data"));
+  std::string other_out;
+  CURL *other = makeHandle("file://" + (temp_dir / "file").string(), &other_out);
+  EXPECT_EQ(loop.perform(other).get(), CURLE_OK);
+  EXPECT_EQ(other_out, "data");
+  EXPECT_EQ(stalled_result.wait_for(std::chrono::milliseconds(200)), std::future_status::timeout);
+
+  token.setAbort();
+  ASSERT_EQ(stalled_result.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+  EXPECT_EQ(stalled_result.get(), CURLE_ABORTED_BY_CALLBACK);
+
+  // Aborted before it started
+  EXPECT_EQ(loop.perform(stalled, &token).get(), CURLE_ABORTED_BY_CALLBACK);
+  curl_easy_cleanup(stalled);
+  curl_easy_cleanup(other);
+}
+
+/* A paused transfer is held, not stopped, and stopped right away once aborted. */
+TEST(CurlMultiLoop, Pause) {
+  SilentServer server;
+  CurlMultiLoop loop;
+  std::string out;
+  CURL *stalled = makeHandle(server.url(), &out);
+  api::FlowControlToken token;
+  auto result = loop.perform(stalled, &token);
+  token.setPause(true);
+  EXPECT_EQ(result.wait_for(std::chrono::milliseconds(300)), std::future_status::timeout);
+
+  token.setAbort();
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(2)), std::future_status::ready);
+  EXPECT_EQ(result.get(), CURLE_ABORTED_BY_CALLBACK);
+  curl_easy_cleanup(stalled);
+}
+
+/* The transfers in progress are stopped when the loop is destroyed. */
+TEST(CurlMultiLoop, Destroy) {
+  SilentServer server;
+  std::string out;
+  CURL *stalled = makeHandle(server.url(), &out);
+  std::future<CURLcode> result;
+  {
+    CurlMultiLoop loop;
+    result = loop.perform(stalled);
+  }
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+  EXPECT_EQ(result.get(), CURLE_ABORTED_BY_CALLBACK);
+  curl_easy_cleanup(stalled);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
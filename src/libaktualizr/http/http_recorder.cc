@@ -0,0 +1,198 @@
+#include "http/http_recorder.h"
+
+#include <future>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+
+// Hands the body of a response on to the caller's sink and keeps a copy
+class TeeSink : public HttpSink {
+ public:
+  TeeSink(HttpSink *sink, std::string *copy) : sink_{sink}, copy_{copy} {}
+  void expectSize(uint64_t size) override { sink_->expectSize(size); }
+  bool write(const char *data, size_t size) override {
+    copy_->append(data, size);
+    return sink_->write(data, size);
+  }
+
+ private:
+  HttpSink *sink_;
+  std::string *copy_;
+};
+
+}  // namespace
+
+HttpRecorder::HttpRecorder(std::shared_ptr<HttpInterface> http, const boost::filesystem::path &file,
+                           Redactor redactor)
+    : http_{std::move(http)}, redactor_{std::move(redactor)}, file_{file.string(), std::ios::app | std::ios::binary} {
+  if (!file_) {
+    throw std::runtime_error("Could not open " + file.string() + " to record the HTTP traffic");
+  }
+}
+
+HttpResponse HttpRecorder::get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->get(url, maxsize, flow_control);
+  record("GET", url, Json::Value(Json::objectValue), start, response, response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::getConditional(const std::string &url, int64_t maxsize,
+                                          const api::FlowControlToken *flow_control, const std::string &etag,
+                                          const std::string &last_modified) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->getConditional(url, maxsize, flow_control, etag, last_modified);
+  Json::Value request(Json::objectValue);
+  request["etag"] = etag;
+  request["last_modified"] = last_modified;
+  record("GET", url, request, start, response, response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::getToSink(const std::string &url, int64_t maxsize,
+                                     const api::FlowControlToken *flow_control, HttpSink *sink) {
+  std::string body;
+  TeeSink tee(sink, &body);
+  const auto start = Clock::now();
+  HttpResponse response = http_->get(url, maxsize, flow_control, &tee);
+  record("GET", url, Json::Value(Json::objectValue), start, response, body);
+  return response;
+}
+
+HttpResponse HttpRecorder::post(const std::string &url, const std::string &content_type, const std::string &data) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->post(url, content_type, data);
+  record("POST", url, requestJson(content_type, data), start, response, response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::post(const std::string &url, const Json::Value &data) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->post(url, data);
+  record("POST", url, requestJson("application/json", Utils::jsonToCanonicalStr(data)), start, response,
+         response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::put(const std::string &url, const std::string &content_type, const std::string &data) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->put(url, content_type, data);
+  record("PUT", url, requestJson(content_type, data), start, response, response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::put(const std::string &url, const Json::Value &data) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->put(url, data);
+  record("PUT", url, requestJson("application/json", Utils::jsonToCanonicalStr(data)), start, response,
+         response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::patch(const std::string &url, const std::string &content_type, const std::string &data) {
+  const auto start = Clock::now();
+  HttpResponse response = http_->patch(url, content_type, data);
+  record("PATCH", url, requestJson(content_type, data), start, response, response.body);
+  return response;
+}
+
+HttpResponse HttpRecorder::download(const std::string &url, curl_write_callback write_cb,
+                                    curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) {
+  DownloadCapture capture{write_cb, progress_cb, userp, {}};
+  const auto start = Clock::now();
+  HttpResponse response = http_->download(url, captureWrite, progress_cb != nullptr ? captureProgress : nullptr,
+                                          &capture, from);
+  Json::Value request(Json::objectValue);
+  request["from"] = static_cast<Json::Int64>(from);
+  record("GET", url, request, start, response, capture.body);
+  return response;
+}
+
+std::future<HttpResponse> HttpRecorder::downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                                      curl_xferinfo_callback progress_cb, void *userp,
+                                                      curl_off_t from, CurlHandler *easyp) {
+  auto capture = std::make_shared<DownloadCapture>(DownloadCapture{write_cb, progress_cb, userp, {}});
+  const auto start = Clock::now();
+  auto response = http_->downloadAsync(url, captureWrite, progress_cb != nullptr ? captureProgress : nullptr,
+                                       capture.get(), from, easyp);
+  return std::async(std::launch::async, [this, url, from, start, capture, response = std::move(response)]() mutable {
+    HttpResponse result = response.get();
+    Json::Value request(Json::objectValue);
+    request["from"] = static_cast<Json::Int64>(from);
+    record("GET", url, request, start, result, capture->body);
+    return result;
+  });
+}
+
+HttpResponse HttpRecorder::downloadRange(const std::string &url, curl_write_callback write_cb,
+                                         curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                         curl_off_t to) {
+  DownloadCapture capture{write_cb, progress_cb, userp, {}};
+  const auto start = Clock::now();
+  HttpResponse response = http_->downloadRange(
+      url, captureWrite, progress_cb != nullptr ? captureProgress : nullptr, &capture, from, to);
+  Json::Value request(Json::objectValue);
+  request["from"] = static_cast<Json::Int64>(from);
+  request["to"] = static_cast<Json::Int64>(to);
+  record("GET", url, request, start, response, capture.body);
+  return response;
+}
+
+void HttpRecorder::setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
+                            CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) {
+  http_->setCerts(ca, ca_source, cert, cert_source, pkey, pkey_source);
+}
+
+std::chrono::milliseconds HttpRecorder::retryAfter() const { return http_->retryAfter(); }
+
+size_t HttpRecorder::captureWrite(char *data, size_t size, size_t nmemb, void *capture) {
+  auto *arg = static_cast<DownloadCapture *>(capture);
+  const size_t written = arg->write_cb(data, size, nmemb, arg->userp);
+  // Data the callback didn't take, or paused on, is not received yet
+  if (written == size * nmemb) {
+    arg->body.append(data, written);
+  }
+  return written;
+}
+
+int HttpRecorder::captureProgress(void *capture, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                  curl_off_t ulnow) {
+  auto *arg = static_cast<DownloadCapture *>(capture);
+  return arg->progress_cb(arg->userp, dltotal, dlnow, ultotal, ulnow);
+}
+
+Json::Value HttpRecorder::requestJson(const std::string &content_type, const std::string &body) {
+  Json::Value request(Json::objectValue);
+  request["content_type"] = content_type;
+  request["body"] = Utils::toBase64(body);
+  return request;
+}
+
+void HttpRecorder::record(const std::string &method, const std::string &url, Json::Value request,
+                          Clock::time_point start, const HttpResponse &response, const std::string &body) {
+  const auto end = Clock::now();
+  Json::Value exchange;
+  exchange["method"] = method;
+  exchange["url"] = url;
+  exchange["start_us"] =
+      static_cast<Json::Int64>(std::chrono::duration_cast<std::chrono::microseconds>(start - created_).count());
+  exchange["duration_us"] =
+      static_cast<Json::Int64>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+  exchange["request"] = std::move(request);
+  Json::Value &resp = exchange["response"];
+  resp["status"] = static_cast<Json::Int64>(response.http_status_code);
+  resp["curl_code"] = static_cast<int>(response.curl_code);
+  resp["error"] = response.error_message;
+  resp["etag"] = response.etag;
+  resp["last_modified"] = response.last_modified;
+  resp["body"] = Utils::toBase64(body);
+  if (redactor_) {
+    redactor_(exchange);
+  }
+
+  const std::string line = Utils::jsonToCanonicalStr(exchange) + "\n";
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_ << line;
+  file_.flush();
+}
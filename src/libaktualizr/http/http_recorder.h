@@ -0,0 +1,96 @@
+#ifndef HTTP_HTTP_RECORDER_H_
+#define HTTP_HTTP_RECORDER_H_
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include "json/json.h"
+
+#include "http/httpinterface.h"
+
+/**
+ * Passes all the requests on to another HttpInterface and writes each
+ * exchange to a file, for HttpReplay to play it back.
+ *
+ * The file has one JSON object per line, in the order the requests
+ * completed:
+ *
+ *     {"method": "GET", "url": "...", "start_us": 1200, "duration_us": 35000,
+ *      "request": {"content_type": "...", "body": "<base64>", "etag": "...", "last_modified": "...",
+ *                  "from": 0, "to": 1023},
+ *      "response": {"status": 200, "curl_code": 0, "error": "", "etag": "...", "last_modified": "...",
+ *                   "body": "<base64>"}}
+ *
+ * start_us counts from the creation of the recorder. The request fields are
+ * only there when they apply: from and to for the downloads, the validators
+ * for the conditional requests. The bodies are the whole bodies, including
+ * those of the downloaded Targets and of the provisioning response with the
+ * device credentials: the redactor can change or remove anything before an
+ * exchange is written.
+ */
+class HttpRecorder : public HttpInterface {
+ public:
+  using Redactor = std::function<void(Json::Value &exchange)>;
+
+  /**
+   * Append the exchanges of http to file.
+   * @throw std::runtime_error if the file can't be opened
+   */
+  HttpRecorder(std::shared_ptr<HttpInterface> http, const boost::filesystem::path &file, Redactor redactor = nullptr);
+
+  using HttpInterface::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                              const std::string &etag, const std::string &last_modified) override;
+  HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse post(const std::string &url, const Json::Value &data) override;
+  HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse put(const std::string &url, const Json::Value &data) override;
+  HttpResponse patch(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                          CurlHandler *easyp) override;
+  HttpResponse downloadRange(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                             void *userp, curl_off_t from, curl_off_t to) override;
+  void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
+                const std::string &pkey, CryptoSource pkey_source) override;
+  std::chrono::milliseconds retryAfter() const override;
+
+ protected:
+  HttpResponse getToSink(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                         HttpSink *sink) override;
+
+ private:
+  using Clock = std::chrono::steady_clock;
+
+  // The data passed to the callbacks of a download, and its body as received
+  struct DownloadCapture {
+    curl_write_callback write_cb{nullptr};
+    curl_xferinfo_callback progress_cb{nullptr};
+    void *userp{nullptr};
+    std::string body;
+  };
+
+  static size_t captureWrite(char *data, size_t size, size_t nmemb, void *capture);
+  static int captureProgress(void *capture, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                             curl_off_t ulnow);
+
+  static Json::Value requestJson(const std::string &content_type, const std::string &body);
+  void record(const std::string &method, const std::string &url, Json::Value request, Clock::time_point start,
+              const HttpResponse &response, const std::string &body);
+
+  std::shared_ptr<HttpInterface> http_;
+  Redactor redactor_;
+  const Clock::time_point created_{Clock::now()};
+  std::mutex mutex_;
+  std::ofstream file_;
+};
+
+#endif  // HTTP_HTTP_RECORDER_H_
@@ -0,0 +1,191 @@
+#include "http/http_replay.h"
+
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include "logging/logging.h"
+
+HttpReplay::HttpReplay(const boost::filesystem::path &file, Timing timing) : timing_{timing} {
+  std::ifstream stream(file.string(), std::ios::binary);
+  if (!stream) {
+    throw std::runtime_error("Could not open the recorded HTTP traffic in " + file.string());
+  }
+  std::string line;
+  size_t number = 0;
+  while (std::getline(stream, line)) {
+    ++number;
+    if (line.empty()) {
+      continue;
+    }
+    Json::Value exchange = Utils::parseJSON(line);
+    if (!exchange.isObject() || !exchange["method"].isString() || !exchange["url"].isString() ||
+        !exchange["response"].isObject()) {
+      throw std::runtime_error("Invalid recorded exchange on line " + std::to_string(number) + " of " + file.string());
+    }
+    const std::string key = exchange["method"].asString() + " " + exchange["url"].asString();
+    exchanges_[key].push_back(std::move(exchange));
+  }
+}
+
+size_t HttpReplay::pending() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t count = 0;
+  for (const auto &queue : exchanges_) {
+    count += queue.second.size();
+  }
+  return count;
+}
+
+HttpResponse HttpReplay::get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) {
+  (void)maxsize;
+  return respond("GET", url, flow_control);
+}
+
+HttpResponse HttpReplay::getConditional(const std::string &url, int64_t maxsize,
+                                        const api::FlowControlToken *flow_control, const std::string &etag,
+                                        const std::string &last_modified) {
+  (void)maxsize;
+  (void)etag;
+  (void)last_modified;
+  return respond("GET", url, flow_control);
+}
+
+HttpResponse HttpReplay::post(const std::string &url, const std::string &content_type, const std::string &data) {
+  (void)content_type;
+  (void)data;
+  return respond("POST", url, nullptr);
+}
+
+HttpResponse HttpReplay::post(const std::string &url, const Json::Value &data) {
+  (void)data;
+  return respond("POST", url, nullptr);
+}
+
+HttpResponse HttpReplay::put(const std::string &url, const std::string &content_type, const std::string &data) {
+  (void)content_type;
+  (void)data;
+  return respond("PUT", url, nullptr);
+}
+
+HttpResponse HttpReplay::put(const std::string &url, const Json::Value &data) {
+  (void)data;
+  return respond("PUT", url, nullptr);
+}
+
+HttpResponse HttpReplay::patch(const std::string &url, const std::string &content_type, const std::string &data) {
+  (void)content_type;
+  (void)data;
+  return respond("PATCH", url, nullptr);
+}
+
+HttpResponse HttpReplay::download(const std::string &url, curl_write_callback write_cb,
+                                  curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) {
+  return replayDownload(url, write_cb, progress_cb, userp, from);
+}
+
+std::future<HttpResponse> HttpReplay::downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                                    curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                                    CurlHandler *easyp) {
+  (void)easyp;
+  return std::async(std::launch::async, [this, url, write_cb, progress_cb, userp, from]() {
+    return replayDownload(url, write_cb, progress_cb, userp, from);
+  });
+}
+
+HttpResponse HttpReplay::downloadRange(const std::string &url, curl_write_callback write_cb,
+                                       curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                       curl_off_t to) {
+  (void)to;
+  return replayDownload(url, write_cb, progress_cb, userp, from);
+}
+
+void HttpReplay::setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
+                          CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) {
+  (void)ca;
+  (void)ca_source;
+  (void)cert;
+  (void)cert_source;
+  (void)pkey;
+  (void)pkey_source;
+}
+
+bool HttpReplay::take(const std::string &method, const std::string &url, Json::Value *exchange) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = exchanges_.find(method + " " + url);
+  if (found == exchanges_.end() || found->second.empty()) {
+    LOG_WARNING << "No recorded response left for " << method << " " << url;
+    return false;
+  }
+  *exchange = std::move(found->second.front());
+  found->second.pop_front();
+  return true;
+}
+
+HttpResponse HttpReplay::respond(const std::string &method, const std::string &url,
+                                 const api::FlowControlToken *flow_control) {
+  Json::Value exchange;
+  if (!take(method, url, &exchange)) {
+    return HttpResponse("", 0, CURLE_COULDNT_CONNECT, "No recorded response");
+  }
+  const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(duration(exchange));
+  if (flow_control != nullptr) {
+    flow_control->sleepFor(wait);
+    if (flow_control->hasAborted()) {
+      return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Aborted");
+    }
+  } else {
+    std::this_thread::sleep_for(wait);
+  }
+  return recordedResponse(exchange, Utils::fromBase64(exchange["response"]["body"].asString()));
+}
+
+HttpResponse HttpReplay::replayDownload(const std::string &url, curl_write_callback write_cb,
+                                        curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) {
+  Json::Value exchange;
+  if (!take("GET", url, &exchange)) {
+    return HttpResponse("", 0, CURLE_COULDNT_CONNECT, "No recorded response");
+  }
+  std::string body = Utils::fromBase64(exchange["response"]["body"].asString());
+  // A download resumed further than when recorded starts further in the body
+  const curl_off_t recorded_from = exchange["request"]["from"].asInt64();
+  const size_t offset = std::min(body.size(), static_cast<size_t>(std::max<curl_off_t>(0, from - recorded_from)));
+
+  const size_t chunks = (body.size() - offset + kChunkSize - 1) / kChunkSize;
+  const auto wait = duration(exchange) / std::max<size_t>(chunks, 1);
+  if (chunks == 0) {
+    std::this_thread::sleep_for(wait);
+  }
+  const auto total = static_cast<curl_off_t>(body.size() - offset);
+  for (size_t pos = offset; pos < body.size(); pos += kChunkSize) {
+    std::this_thread::sleep_for(wait);
+    const size_t size = std::min(kChunkSize, body.size() - pos);
+    if (write_cb(&body[pos], 1, size, userp) != size) {
+      return HttpResponse("", 0, CURLE_WRITE_ERROR, "Failed writing received data");
+    }
+    const auto done = static_cast<curl_off_t>(pos + size - offset);
+    if (progress_cb != nullptr && progress_cb(userp, total, done, 0, 0) != 0) {
+      return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Callback aborted");
+    }
+  }
+  return recordedResponse(exchange, "");
+}
+
+HttpResponse HttpReplay::recordedResponse(const Json::Value &exchange, std::string body) {
+  const Json::Value &recorded = exchange["response"];
+  HttpResponse response(std::move(body), static_cast<long>(recorded["status"].asInt64()),  // NOLINT(google-runtime-int)
+                        static_cast<CURLcode>(recorded["curl_code"].asInt()), recorded["error"].asString());
+  response.etag = recorded["etag"].asString();
+  response.last_modified = recorded["last_modified"].asString();
+  return response;
+}
+
+std::chrono::microseconds HttpReplay::duration(const Json::Value &exchange) const {
+  if (timing_ == Timing::kNone) {
+    return std::chrono::microseconds(0);
+  }
+  return std::chrono::microseconds(exchange["duration_us"].asInt64());
+}
@@ -0,0 +1,71 @@
+#ifndef HTTP_HTTP_REPLAY_H_
+#define HTTP_HTTP_REPLAY_H_
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include "json/json.h"
+
+#include "http/httpinterface.h"
+
+/**
+ * Answers the requests with the exchanges written by HttpRecorder, to run a
+ * client against recorded traffic without a server, e.g. under a profiler.
+ *
+ * Each request gets the next recorded exchange with the same method and URL,
+ * whatever its body. A request that has none left fails as if the server
+ * could not be reached. With Timing::kRecorded, each response takes as long
+ * as it did when recorded, a download delivering its body evenly over that
+ * time; with Timing::kNone, the responses come back at once.
+ */
+class HttpReplay : public HttpInterface {
+ public:
+  enum class Timing { kRecorded, kNone };
+
+  /** @throw std::runtime_error if the file can't be read or parsed */
+  explicit HttpReplay(const boost::filesystem::path &file, Timing timing = Timing::kRecorded);
+
+  /** Number of the recorded exchanges not replayed yet */
+  size_t pending() const;
+
+  using HttpInterface::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                              const std::string &etag, const std::string &last_modified) override;
+  HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse post(const std::string &url, const Json::Value &data) override;
+  HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse put(const std::string &url, const Json::Value &data) override;
+  HttpResponse patch(const std::string &url, const std::string &content_type, const std::string &data) override;
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override;
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                          CurlHandler *easyp) override;
+  HttpResponse downloadRange(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                             void *userp, curl_off_t from, curl_off_t to) override;
+  void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
+                const std::string &pkey, CryptoSource pkey_source) override;
+
+ private:
+  // Size of the parts a download body is written in
+  static constexpr size_t kChunkSize = 64 * 1024;
+
+  bool take(const std::string &method, const std::string &url, Json::Value *exchange);
+  HttpResponse respond(const std::string &method, const std::string &url, const api::FlowControlToken *flow_control);
+  HttpResponse replayDownload(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                              void *userp, curl_off_t from);
+  static HttpResponse recordedResponse(const Json::Value &exchange, std::string body);
+  std::chrono::microseconds duration(const Json::Value &exchange) const;
+
+  Timing timing_;
+  mutable std::mutex mutex_;
+  // Keyed by the method and the URL
+  std::map<std::string, std::deque<Json::Value>> exchanges_;
+};
+
+#endif  // HTTP_HTTP_REPLAY_H_
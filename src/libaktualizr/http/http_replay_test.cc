@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "http/http_recorder.h"
+#include "http/http_replay.h"
+#include "utilities/utils.h"
+
+namespace {
+
+// Answers every request the same, the GETs after a while
+class CannedHttp : public HttpInterface {
+ public:
+  using HttpInterface::get;
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    (void)maxsize;
+    (void)flow_control;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    HttpResponse response("body of " + url, 200, CURLE_OK, "");
+    response.etag = "\"1\"";
+    return response;
+  }
+  HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override {
+    (void)url;
+    (void)content_type;
+    (void)data;
+    return HttpResponse("created", 201, CURLE_OK, "");
+  }
+  HttpResponse post(const std::string &url, const Json::Value &data) override {
+    return post(url, "application/json", Utils::jsonToCanonicalStr(data));
+  }
+  HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override {
+    (void)url;
+    (void)content_type;
+    (void)data;
+    return HttpResponse("", 500, CURLE_OK, "");
+  }
+  HttpResponse put(const std::string &url, const Json::Value &data) override {
+    return put(url, "application/json", Utils::jsonToCanonicalStr(data));
+  }
+  HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    std::string body = content.substr(static_cast<size_t>(from));
+    write_cb(&body[0], 1, body.size(), userp);
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+  std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
+                                          CurlHandler *easyp) override {
+    (void)easyp;
+    std::promise<HttpResponse> promise;
+    promise.set_value(download(url, write_cb, progress_cb, userp, from));
+    return promise.get_future();
+  }
+  void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
+                const std::string &pkey, CryptoSource pkey_source) override {
+    (void)ca;
+    (void)ca_source;
+    (void)cert;
+    (void)cert_source;
+    (void)pkey;
+    (void)pkey_source;
+  }
+
+  const std::string content{"0123456789"};
+};
+
+size_t appendToString(char *data, size_t size, size_t nmemb, void *userp) {
+  static_cast<std::string *>(userp)->append(data, size * nmemb);
+  return size * nmemb;
+}
+
+}  // namespace
+
+/* The recorded traffic is played back in the order it was recorded, for each
+ * method and URL, and the redacted parts are left out. */
+TEST(HttpReplay, RecordAndReplay) {
+  TemporaryDirectory temp_dir;
+  const auto file = temp_dir / "traffic.jsonl";
+  {
+    HttpRecorder recorder(std::make_shared<CannedHttp>(), file, [](Json::Value &exchange) {
+      if (exchange["method"] == "POST") {
+        exchange["request"]["body"] = "";
+      }
+      // As if the requests were slow, which a replay without timing ignores
+      exchange["duration_us"] = Json::Int64(60000000);
+    });
+    EXPECT_EQ(recorder.get("https://server/a", HttpInterface::kNoLimit).body, "body of https://server/a");
+    EXPECT_EQ(recorder.post("https://server/devices", "text/plain", "secret").http_status_code, 201);
+    EXPECT_EQ(recorder.put("https://server/manifest", Json::Value()).http_status_code, 500);
+    std::string downloaded;
+    EXPECT_TRUE(recorder.download("https://server/t", appendToString, nullptr, &downloaded, 2).isOk());
+    EXPECT_EQ(downloaded, "23456789");
+    EXPECT_EQ(recorder.get("https://server/b", HttpInterface::kNoLimit).body, "body of https://server/b");
+  }
+  EXPECT_EQ(Utils::readFile(file).find(Utils::toBase64("secret")), std::string::npos);
+
+  HttpReplay replay(file, HttpReplay::Timing::kNone);
+  EXPECT_EQ(replay.pending(), 5);
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_EQ(replay.get("https://server/b", HttpInterface::kNoLimit).body, "body of https://server/b");
+  const HttpResponse response = replay.getConditional("https://server/a", HttpInterface::kNoLimit, nullptr, "", "");
+  EXPECT_EQ(response.body, "body of https://server/a");
+  EXPECT_EQ(response.etag, "\"1\"");
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(30));
+  EXPECT_EQ(replay.post("https://server/devices", "text/plain", "other").body, "created");
+  EXPECT_EQ(replay.put("https://server/manifest", "application/json", "{}").http_status_code, 500);
+  // Resumed further than when recorded
+  std::string downloaded;
+  EXPECT_TRUE(replay.download("https://server/t", appendToString, nullptr, &downloaded, 4).isOk());
+  EXPECT_EQ(downloaded, "456789");
+  EXPECT_EQ(replay.pending(), 0);
+
+  EXPECT_EQ(replay.get("https://server/a", HttpInterface::kNoLimit).curl_code, CURLE_COULDNT_CONNECT);
+}
+
+/* The responses take the time they took when recorded. */
+TEST(HttpReplay, RecordedTiming) {
+  TemporaryDirectory temp_dir;
+  const auto file = temp_dir / "traffic.jsonl";
+  {
+    HttpRecorder recorder(std::make_shared<CannedHttp>(), file);
+    recorder.get("https://server/a", HttpInterface::kNoLimit);
+  }
+
+  HttpReplay replay(file);
+  const auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(replay.get("https://server/a", HttpInterface::kNoLimit).isOk());
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,37 +1,100 @@
 #include "httpclient.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <sstream>
 
+#include <boost/algorithm/string.hpp>
+#include <zlib.h>
+
+#include "http/curl_multi_loop.h"
+#include "utilities/allocation_accounting.h"
+#include "utilities/executor.h"
+#include "utilities/metrics.h"
 #include "utilities/utils.h"
 
 struct WriteStringArg {
-  std::string out;
+  HttpSink* sink{nullptr};
   int64_t limit{0};
+  uint64_t written{0};
+  CURL* handle{nullptr};
+  // If set, takes the body of a server error instead of the sink
+  std::string* error_body{nullptr};
 };
 
+// The latency of a transfer by endpoint, the first two segments of the path of
+// the URL, which leaves out the names of the targets and the like.
+static void recordTransferMetrics(CURL* handle) {
+  static MetricCounter& downloaded =
+      Metrics::instance().counter("aktualizr_http_downloaded_bytes_total", "Bytes received from the servers");
+  static MetricCounter& uploaded =
+      Metrics::instance().counter("aktualizr_http_uploaded_bytes_total", "Bytes sent to the servers");
+  char* url = nullptr;
+  double total_time = 0;
+  if (curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == nullptr ||
+      curl_easy_getinfo(handle, CURLINFO_TOTAL_TIME, &total_time) != CURLE_OK) {
+    return;
+  }
+  std::string endpoint(url);
+  const auto host = endpoint.find("://");
+  const auto path = endpoint.find('/', host == std::string::npos ? 0 : host + 3);
+  endpoint = path == std::string::npos ? "/" : endpoint.substr(path, endpoint.find_first_of("?#", path) - path);
+  const auto second = endpoint.find('/', 1);
+  if (second != std::string::npos) {
+    endpoint.erase(std::min(endpoint.find('/', second + 1), endpoint.size()));
+  }
+  Metrics::instance()
+      .histogram("aktualizr_http_request_duration_seconds", "Duration of the HTTP requests", {{"endpoint", endpoint}})
+      .record(static_cast<uint64_t>(total_time * 1e6));
+  curl_off_t size = 0;
+  if (curl_easy_getinfo(handle, CURLINFO_SIZE_DOWNLOAD_T, &size) == CURLE_OK && size > 0) {
+    downloaded.add(static_cast<uint64_t>(size));
+  }
+  if (curl_easy_getinfo(handle, CURLINFO_SIZE_UPLOAD_T, &size) == CURLE_OK && size > 0) {
+    uploaded.add(static_cast<uint64_t>(size));
+  }
+}
+
 /*****************************************************************************/
 /**
  * \par Description:
- *    A writeback handler for the curl library. It handles writing response
- *    data from curl into a string.
+ *    A writeback handler for the curl library. It hands the response data
+ *    from curl to a sink, announcing the size of the body from the
+ *    Content-Length header first.
  *    https://curl.haxx.se/libcurl/c/CURLOPT_WRITEFUNCTION.html
  *
  */
 static size_t writeString(void* contents, size_t size, size_t nmemb, void* userp) {
   assert(contents);
   assert(userp);
-  // append the writeback data to the provided string
   auto* arg = static_cast<WriteStringArg*>(userp);
+  const size_t bytes = size * nmemb;
   if (arg->limit > 0) {
-    if (arg->out.length() + size * nmemb > static_cast<uint64_t>(arg->limit)) {
+    if (arg->written + bytes > static_cast<uint64_t>(arg->limit)) {
       return 0;
     }
   }
-  (static_cast<WriteStringArg*>(userp))->out.append(static_cast<char*>(contents), size * nmemb);
+  if (arg->error_body != nullptr) {
+    long http_code = 0;  // NOLINT(google-runtime-int)
+    if (curl_easy_getinfo(arg->handle, CURLINFO_RESPONSE_CODE, &http_code) == CURLE_OK && http_code >= 500) {
+      arg->error_body->append(static_cast<const char*>(contents), bytes);
+      return bytes;
+    }
+  }
+  if (arg->written == 0) {
+    curl_off_t length = -1;
+    if (curl_easy_getinfo(arg->handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK && length > 0) {
+      arg->sink->expectSize(static_cast<uint64_t>(length));
+    }
+  }
+  if (!arg->sink->write(static_cast<const char*>(contents), bytes)) {
+    return 0;
+  }
+  arg->written += bytes;
 
   // return size of written data
-  return size * nmemb;
+  return bytes;
 }
 
 static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
@@ -58,6 +121,216 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   return 0;
 }
 
+/**
+ * \par Description:
+ *    A header callback for the curl library. It picks the cache validators
+ *    (ETag and Last-Modified) out of the response headers.
+ *    https://curl.haxx.se/libcurl/c/CURLOPT_HEADERFUNCTION.html
+ */
+static size_t validatorsHeader(char* buffer, size_t size, size_t nitems, void* userp) {
+  assert(userp);
+  auto* response = static_cast<HttpResponse*>(userp);
+  const std::string line(buffer, size * nitems);
+  const auto colon = line.find(':');
+  if (colon != std::string::npos) {
+    const std::string name = boost::algorithm::to_lower_copy(line.substr(0, colon));
+    const std::string value = boost::algorithm::trim_copy(line.substr(colon + 1));
+    if (name == "etag") {
+      response->etag = value;
+    } else if (name == "last-modified") {
+      response->last_modified = value;
+    }
+  }
+  return size * nitems;
+}
+
+/**
+ * \par Description:
+ *    Compress a request body in the gzip format.
+ * \return false if zlib failed
+ */
+static bool gzipCompress(const std::string& in, std::string* out) {
+  z_stream stream{};
+  // 15 window bits, +16 for the gzip header and trailer
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  out->resize(deflateBound(&stream, static_cast<uLong>(in.size())));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  stream.avail_in = static_cast<uInt>(in.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  stream.avail_out = static_cast<uInt>(out->size());
+  const int res = deflate(&stream, Z_FINISH);
+  out->resize(stream.total_out);
+  deflateEnd(&stream);
+  return res == Z_STREAM_END;
+}
+
+struct ShapedWriteArg {
+  curl_write_callback write_cb{nullptr};
+  void* userp{nullptr};
+  BandwidthShaper* shaper{nullptr};
+  CURL* handle{nullptr};
+  // The mode of the link the download started on
+  LinkPolicy* link{nullptr};
+  LinkPolicy::Mode mode{LinkPolicy::Mode::kFull};
+  curl_xferinfo_callback progress_cb{nullptr};
+  void* progress_userp{nullptr};
+};
+
+/**
+ * \par Description:
+ *    A progress handler that interrupts a download when the mode of the link
+ *    changes, so that it goes on in the new mode, and otherwise passes on to
+ *    the caller's handler.
+ */
+static int linkProgress(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  auto* arg = static_cast<ShapedWriteArg*>(clientp);
+  if (arg->link->mode() != arg->mode) {
+    return 1;
+  }
+  return arg->progress_cb != nullptr ? arg->progress_cb(arg->progress_userp, dltotal, dlnow, ultotal, ulnow) : 0;
+}
+
+// A download that would start on a metadata-only link, without connecting
+static bool heldBack(const ShapedWriteArg& shaped, HttpResponse* response) {
+  if (shaped.link == nullptr || shaped.mode != LinkPolicy::Mode::kMetadataOnly) {
+    return false;
+  }
+  *response = HttpResponse("", 0, CURLE_COULDNT_CONNECT, "Downloads are held back on this network link");
+  return true;
+}
+
+/**
+ * \par Description:
+ *    A writeback handler that passes the data on to the caller's handler and
+ *    then holds the transfer back as needed by the bandwidth shaper.
+ */
+static size_t shapedWrite(char* contents, size_t size, size_t nmemb, void* userp) {
+  assert(userp);
+  auto* arg = static_cast<ShapedWriteArg*>(userp);
+  const size_t written = arg->write_cb(contents, size, nmemb, arg->userp);
+  if (written == size * nmemb) {
+    curl_socket_t socket = CURL_SOCKET_BAD;
+    curl_easy_getinfo(arg->handle, CURLINFO_ACTIVESOCKET, &socket);
+    arg->shaper->throttle(written, socket);
+  }
+  return written;
+}
+
+CurlShare::CurlShare() : share_{curl_share_init()} {
+  if (share_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl share handle");
+  }
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, CurlShare::lock);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, CurlShare::unlock);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+}
+
+CurlShare::~CurlShare() { curl_share_cleanup(share_); }
+
+std::shared_ptr<CurlShare> CurlShare::global() {
+  static std::shared_ptr<CurlShare> instance = std::make_shared<CurlShare>();
+  return instance;
+}
+
+void CurlShare::attach(CURL* handle) { curlEasySetoptWrapper(handle, CURLOPT_SHARE, share_); }
+
+namespace {
+// Keeps the connections of the transfers made on one thread open for the next ones
+class ThreadConnections {
+ public:
+  ThreadConnections() : multi_{curl_multi_init()} {}
+  ~ThreadConnections() {
+    if (multi_ != nullptr) {
+      curl_multi_cleanup(multi_);
+    }
+  }
+  ThreadConnections(const ThreadConnections&) = delete;
+  ThreadConnections(ThreadConnections&&) = delete;
+  ThreadConnections& operator=(const ThreadConnections&) = delete;
+  ThreadConnections& operator=(ThreadConnections&&) = delete;
+
+  CURLM* get() const { return multi_; }
+
+ private:
+  CURLM* multi_;
+};
+}  // namespace
+
+CURLcode CurlShare::perform(CURL* handle) {
+  thread_local ThreadConnections connections;
+  CURLM* multi = connections.get();
+  // Also covers a transfer started from a callback of another one
+  if (multi == nullptr || curl_multi_add_handle(multi, handle) != CURLM_OK) {
+    return curl_easy_perform(handle);
+  }
+
+  CURLcode result = CURLE_FAILED_INIT;
+  int running = 1;
+  while (running > 0) {
+    CURLMcode code = curl_multi_perform(multi, &running);
+    if (code == CURLM_OK && running > 0) {
+      code = curl_multi_wait(multi, nullptr, 0, 1000, nullptr);
+    }
+    if (code != CURLM_OK) {
+      LOG_ERROR << "curl transfer failed: " << curl_multi_strerror(code);
+      break;
+    }
+  }
+  int queued = 0;
+  while (CURLMsg* msg = curl_multi_info_read(multi, &queued)) {
+    if (msg->msg == CURLMSG_DONE && msg->easy_handle == handle) {
+      result = msg->data.result;
+    }
+  }
+  curl_multi_remove_handle(multi, handle);
+  return result;
+}
+
+void CurlShare::recordTransfer(CURL* handle) {
+  long num_connects = 0;  // NOLINT(google-runtime-int)
+  if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &num_connects) == CURLE_OK && num_connects == 0) {
+    ++handshakes_avoided_;
+  }
+}
+
+void CurlShare::lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userptr) {
+  (void)handle;
+  (void)access;
+  static_cast<CurlShare*>(userptr)->locks_.at(static_cast<size_t>(data)).lock();
+}
+
+void CurlShare::unlock(CURL* handle, curl_lock_data data, void* userptr) {
+  (void)handle;
+  static_cast<CurlShare*>(userptr)->locks_.at(static_cast<size_t>(data)).unlock();
+}
+
+HttpClient::HttpClient(const NetworkConfig& config, const std::vector<std::string>* extra_headers)
+    : HttpClient(extra_headers) {
+  if (config.share_connections) {
+    share_ = CurlShare::global();
+    share_->attach(curl);
+  }
+  compression_ = config.compression;
+  compression_threshold_ = config.compression_threshold;
+  if (config.bandwidth_shaping) {
+    shaper_ = std::make_shared<BandwidthShaper>(config);
+  }
+  if (config.event_loop) {
+    loop_ = CurlMultiLoop::global();
+  }
+  if (config.persist_sessions) {
+    network_cache_ = NetworkCache::global();
+    network_cache_->attach(curl);
+  }
+  if (config.link_aware) {
+    link_policy_ = LinkPolicy::global();
+  }
+}
+
 HttpClient::HttpClient(const std::vector<std::string>* extra_headers) {
   curl = curl_easy_init();
   if (curl == nullptr) {
@@ -95,9 +368,24 @@ HttpClient::HttpClient(const std::string& socket) : HttpClient() {
 }
 
 HttpClient::HttpClient(const HttpClient& curl_in)
-    : HttpInterface(curl_in), pkcs11_key(curl_in.pkcs11_key), pkcs11_cert(curl_in.pkcs11_key) {
+    : HttpInterface(curl_in),
+      share_(curl_in.share_),
+      compression_(curl_in.compression_),
+      compression_threshold_(curl_in.compression_threshold_),
+      bytes_saved_(curl_in.bytes_saved_),
+      retry_until_(curl_in.retry_until_),
+      shaper_(curl_in.shaper_),
+      loop_(curl_in.loop_),
+      network_cache_(curl_in.network_cache_),
+      link_policy_(curl_in.link_policy_),
+      tls_(curl_in.tls_),
+      pkcs11_key(curl_in.pkcs11_key),
+      pkcs11_cert(curl_in.pkcs11_key) {
   curl = curl_easy_duphandle(curl_in.curl);
   headers = curl_slist_dup(curl_in.headers);
+  if (share_) {
+    share_->attach(curl);
+  }
 }
 
 const CurlGlobalInitWrapper HttpClient::manageCurlGlobalInit_{};
@@ -107,49 +395,175 @@ HttpClient::~HttpClient() {
   curl_easy_cleanup(curl);
 }
 
+/**
+ * TLS credentials as applied to a curl handle. On libcurl builds that can't
+ * take them from memory, they are written to temporary files, which have to
+ * live as long as any handle refers to them.
+ */
+struct TlsCredentials {
+  TlsCredentials(std::string ca_in, std::string cert_in, CryptoSource cert_source_in, std::string pkey_in,
+                 CryptoSource pkey_source_in)
+      : ca(std::move(ca_in)),
+        cert(std::move(cert_in)),
+        cert_source(cert_source_in),
+        pkey(std::move(pkey_in)),
+        pkey_source(pkey_source_in) {}
+
+  bool matches(const std::string& ca_in, const std::string& cert_in, CryptoSource cert_source_in,
+               const std::string& pkey_in, CryptoSource pkey_source_in) const {
+    return cert_source == cert_source_in && pkey_source == pkey_source_in && ca == ca_in && cert == cert_in &&
+           pkey == pkey_in;
+  }
+
+  // Path of a temporary file with the given contents, written on first use
+  std::string file(std::unique_ptr<TemporaryFile>& tmp_file, const std::string& name, const std::string& contents) {
+    std::lock_guard<std::mutex> guard(files_mutex);
+    if (!tmp_file) {
+      std::unique_ptr<TemporaryFile> new_file = std_::make_unique<TemporaryFile>(name);
+      new_file->PutContents(contents);
+      tmp_file = std::move(new_file);
+    }
+    return tmp_file->Path().string();
+  }
+
+  const std::string ca;
+  const std::string cert;
+  const CryptoSource cert_source;
+  const std::string pkey;
+  const CryptoSource pkey_source;
+
+  std::mutex files_mutex;
+  std::unique_ptr<TemporaryFile> ca_file;
+  std::unique_ptr<TemporaryFile> cert_file;
+  std::unique_ptr<TemporaryFile> pkey_file;
+};
+
+#if LIBCURL_VERSION_NUM >= 0x074700
+// Returns false if this curl build can't take the option from memory, e.g.
+// because its TLS backend doesn't support it.
+static bool setBlob(CURL* curl_handle, CURLoption option, const std::string& data) {
+  struct curl_blob blob {};
+  blob.data = const_cast<char*>(data.data());
+  blob.len = data.size();
+  blob.flags = CURL_BLOB_COPY;
+  return curl_easy_setopt(curl_handle, option, &blob) == CURLE_OK;
+}
+
+static void clearBlob(CURL* curl_handle, CURLoption option) {
+  curlEasySetoptWrapper(curl_handle, option, static_cast<struct curl_blob*>(nullptr));
+}
+#endif
+
 void HttpClient::setCerts(const std::string& ca, CryptoSource ca_source, const std::string& cert,
                           CryptoSource cert_source, const std::string& pkey, CryptoSource pkey_source) {
+  if (ca_source == CryptoSource::kPkcs11) {
+    throw std::runtime_error("Accessing CA certificate on PKCS11 devices isn't currently supported");
+  }
+  if (tls_ && tls_->matches(ca, cert, cert_source, pkey, pkey_source)) {
+    // Already applied to this handle
+    return;
+  }
+
+  // Clients are often set up one after the other with the same credentials:
+  // reuse the last ones, along with their files if any.
+  static std::mutex cache_mutex;
+  static std::weak_ptr<TlsCredentials> cache;
+  std::shared_ptr<TlsCredentials> creds;
+  {
+    std::lock_guard<std::mutex> guard(cache_mutex);
+    creds = cache.lock();
+    if (!creds || !creds->matches(ca, cert, cert_source, pkey, pkey_source)) {
+      creds = std::make_shared<TlsCredentials>(ca, cert, cert_source, pkey, pkey_source);
+      cache = creds;
+    }
+  }
+
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYPEER, 1);
   curlEasySetoptWrapper(curl, CURLOPT_SSL_VERIFYHOST, 2);
   curlEasySetoptWrapper(curl, CURLOPT_USE_SSL, CURLUSESSL_ALL);
 
-  if (ca_source == CryptoSource::kPkcs11) {
-    throw std::runtime_error("Accessing CA certificate on PKCS11 devices isn't currently supported");
+  bool in_memory = false;
+#if LIBCURL_VERSION_NUM >= 0x074d00
+  in_memory = setBlob(curl, CURLOPT_CAINFO_BLOB, creds->ca);
+#endif
+  if (in_memory) {
+    // Trust only the given CA, as when it is given as a file
+    curlEasySetoptWrapper(curl, CURLOPT_CAINFO, static_cast<const char*>(nullptr));
+  } else {
+    curlEasySetoptWrapper(curl, CURLOPT_CAINFO, creds->file(creds->ca_file, "tls-ca", creds->ca).c_str());
   }
-  std::unique_ptr<TemporaryFile> tmp_ca_file = std_::make_unique<TemporaryFile>("tls-ca");
-  tmp_ca_file->PutContents(ca);
-  curlEasySetoptWrapper(curl, CURLOPT_CAINFO, tmp_ca_file->Path().c_str());
-  tls_ca_file = std::move_if_noexcept(tmp_ca_file);
 
+  in_memory = false;
   if (cert_source == CryptoSource::kPkcs11) {
+#if LIBCURL_VERSION_NUM >= 0x074700
+    clearBlob(curl, CURLOPT_SSLCERT_BLOB);
+#endif
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, cert.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "ENG");
   } else {  // cert_source == CryptoSource::kFile
-    std::unique_ptr<TemporaryFile> tmp_cert_file = std_::make_unique<TemporaryFile>("tls-cert");
-    tmp_cert_file->PutContents(cert);
-    curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, tmp_cert_file->Path().c_str());
+#if LIBCURL_VERSION_NUM >= 0x074700
+    in_memory = setBlob(curl, CURLOPT_SSLCERT_BLOB, creds->cert);
+#endif
+    if (!in_memory) {
+      curlEasySetoptWrapper(curl, CURLOPT_SSLCERT, creds->file(creds->cert_file, "tls-cert", creds->cert).c_str());
+    }
     curlEasySetoptWrapper(curl, CURLOPT_SSLCERTTYPE, "PEM");
-    tls_cert_file = std::move_if_noexcept(tmp_cert_file);
   }
   pkcs11_cert = (cert_source == CryptoSource::kPkcs11);
 
+  in_memory = false;
   if (pkey_source == CryptoSource::kPkcs11) {
+#if LIBCURL_VERSION_NUM >= 0x074700
+    clearBlob(curl, CURLOPT_SSLKEY_BLOB);
+#endif
     curlEasySetoptWrapper(curl, CURLOPT_SSLENGINE, "pkcs11");
     curlEasySetoptWrapper(curl, CURLOPT_SSLENGINE_DEFAULT, 1L);
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, pkey.c_str());
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "ENG");
   } else {  // pkey_source == CryptoSource::kFile
-    std::unique_ptr<TemporaryFile> tmp_pkey_file = std_::make_unique<TemporaryFile>("tls-pkey");
-    tmp_pkey_file->PutContents(pkey);
-    curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, tmp_pkey_file->Path().c_str());
+#if LIBCURL_VERSION_NUM >= 0x074700
+    in_memory = setBlob(curl, CURLOPT_SSLKEY_BLOB, creds->pkey);
+#endif
+    if (!in_memory) {
+      curlEasySetoptWrapper(curl, CURLOPT_SSLKEY, creds->file(creds->pkey_file, "tls-pkey", creds->pkey).c_str());
+    }
     curlEasySetoptWrapper(curl, CURLOPT_SSLKEYTYPE, "PEM");
-    tls_pkey_file = std::move_if_noexcept(tmp_pkey_file);
   }
   pkcs11_key = (pkey_source == CryptoSource::kPkcs11);
+
+  tls_ = std::move(creds);
+}
+
+CURL* HttpClient::dupHandle() const {
+  // The template handle must not be accessed concurrently, but transfers
+  // (e.g. parallel downloads) may be started from several threads.
+  static std::mutex dup_mutex;
+  CURL* handle;
+  {
+    std::lock_guard<std::mutex> guard(dup_mutex);
+    handle = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  }
+  if (share_) {
+    share_->attach(handle);
+  }
+  if (network_cache_) {
+    network_cache_->prepare(handle);
+  }
+  return handle;
 }
 
 HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control) {
-  CURL* curl_get = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  return getInto(url, maxsize, flow_control, nullptr);
+}
+
+HttpResponse HttpClient::getToSink(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control,
+                                   HttpSink* sink) {
+  return getInto(url, maxsize, flow_control, sink);
+}
+
+HttpResponse HttpClient::getInto(const std::string& url, int64_t maxsize, const api::FlowControlToken* flow_control,
+                                 HttpSink* sink) {
+  CURL* curl_get = dupHandle();
 
   curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, headers);
 
@@ -162,6 +576,10 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   curlEasySetoptWrapper(curl_get, CURLOPT_POSTFIELDS, "");
   curlEasySetoptWrapper(curl_get, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_get, CURLOPT_HTTPGET, 1L);
+  if (compression_) {
+    // Empty string: all encodings supported by the curl build
+    curlEasySetoptWrapper(curl_get, CURLOPT_ACCEPT_ENCODING, "");
+  }
   if (flow_control != nullptr) {
     // Handle cancellation
     curlEasySetoptWrapper(curl_get, CURLOPT_NOPROGRESS, 0);
@@ -170,19 +588,62 @@ HttpResponse HttpClient::get(const std::string& url, int64_t maxsize, const api:
   }
 
   LOG_DEBUG << "GET " << url;
-  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize);
+  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize, flow_control, sink);
   curl_easy_cleanup(curl_get);
   return response;
 }
 
+HttpResponse HttpClient::getConditional(const std::string& url, int64_t maxsize,
+                                        const api::FlowControlToken* flow_control, const std::string& etag,
+                                        const std::string& last_modified) {
+  CURL* curl_get = dupHandle();
+
+  curl_slist* req_headers = curl_slist_dup(headers);
+  if (!etag.empty()) {
+    req_headers = curl_slist_append(req_headers, ("If-None-Match: " + etag).c_str());
+  }
+  if (!last_modified.empty()) {
+    req_headers = curl_slist_append(req_headers, ("If-Modified-Since: " + last_modified).c_str());
+  }
+  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPHEADER, req_headers);
+
+  if (pkcs11_cert) {
+    curlEasySetoptWrapper(curl_get, CURLOPT_SSLCERTTYPE, "ENG");
+  }
+
+  curlEasySetoptWrapper(curl_get, CURLOPT_POSTFIELDS, "");
+  curlEasySetoptWrapper(curl_get, CURLOPT_URL, url.c_str());
+  curlEasySetoptWrapper(curl_get, CURLOPT_HTTPGET, 1L);
+  if (compression_) {
+    curlEasySetoptWrapper(curl_get, CURLOPT_ACCEPT_ENCODING, "");
+  }
+  if (flow_control != nullptr) {
+    curlEasySetoptWrapper(curl_get, CURLOPT_NOPROGRESS, 0);
+    curlEasySetoptWrapper(curl_get, CURLOPT_XFERINFOFUNCTION, ProgressHandler);
+    curlEasySetoptWrapper(curl_get, CURLOPT_XFERINFODATA, flow_control);
+  }
+  HttpResponse validators;
+  curlEasySetoptWrapper(curl_get, CURLOPT_HEADERFUNCTION, validatorsHeader);
+  curlEasySetoptWrapper(curl_get, CURLOPT_HEADERDATA, static_cast<void*>(&validators));
+
+  LOG_DEBUG << "GET " << url << (etag.empty() && last_modified.empty() ? "" : " (conditional)");
+  HttpResponse response = perform(curl_get, RETRY_TIMES, maxsize, flow_control);
+  curl_easy_cleanup(curl_get);
+  curl_slist_free_all(req_headers);
+  response.etag = validators.etag;
+  response.last_modified = validators.last_modified;
+  return response;
+}
+
 HttpResponse HttpClient::post(const std::string& url, const std::string& content_type, const std::string& data) {
-  CURL* curl_post = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  CURL* curl_post = dupHandle();
   curl_slist* req_headers = curl_slist_dup(headers);
   req_headers = curl_slist_append(req_headers, (std::string("Content-Type: ") + content_type).c_str());
+  std::string compressed;
+  req_headers = setBody(curl_post, req_headers, data, &compressed);
   curlEasySetoptWrapper(curl_post, CURLOPT_HTTPHEADER, req_headers);
   curlEasySetoptWrapper(curl_post, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_post, CURLOPT_POST, 1);
-  curlEasySetoptWrapper(curl_post, CURLOPT_POSTFIELDS, data.c_str());
   auto result = perform(curl_post, RETRY_TIMES, HttpInterface::kPostRespLimit);
   curl_easy_cleanup(curl_post);
   curl_slist_free_all(req_headers);
@@ -196,15 +657,25 @@ HttpResponse HttpClient::post(const std::string& url, const Json::Value& data) {
 }
 
 HttpResponse HttpClient::put(const std::string& url, const std::string& content_type, const std::string& data) {
-  CURL* curl_put = Utils::curlDupHandleWrapper(curl, pkcs11_key);
+  return sendBody("PUT", url, content_type, data);
+}
+
+HttpResponse HttpClient::patch(const std::string& url, const std::string& content_type, const std::string& data) {
+  return sendBody("PATCH", url, content_type, data);
+}
+
+HttpResponse HttpClient::sendBody(const char* method, const std::string& url, const std::string& content_type,
+                                  const std::string& data) {
+  CURL* curl_send = dupHandle();
   curl_slist* req_headers = curl_slist_dup(headers);
   req_headers = curl_slist_append(req_headers, (std::string("Content-Type: ") + content_type).c_str());
-  curlEasySetoptWrapper(curl_put, CURLOPT_HTTPHEADER, req_headers);
-  curlEasySetoptWrapper(curl_put, CURLOPT_URL, url.c_str());
-  curlEasySetoptWrapper(curl_put, CURLOPT_POSTFIELDS, data.c_str());
-  curlEasySetoptWrapper(curl_put, CURLOPT_CUSTOMREQUEST, "PUT");
-  HttpResponse result = perform(curl_put, RETRY_TIMES, HttpInterface::kPutRespLimit);
-  curl_easy_cleanup(curl_put);
+  std::string compressed;
+  req_headers = setBody(curl_send, req_headers, data, &compressed);
+  curlEasySetoptWrapper(curl_send, CURLOPT_HTTPHEADER, req_headers);
+  curlEasySetoptWrapper(curl_send, CURLOPT_URL, url.c_str());
+  curlEasySetoptWrapper(curl_send, CURLOPT_CUSTOMREQUEST, method);
+  HttpResponse result = perform(curl_send, RETRY_TIMES, HttpInterface::kPutRespLimit);
+  curl_easy_cleanup(curl_send);
   curl_slist_free_all(req_headers);
   return result;
 }
@@ -215,8 +686,29 @@ HttpResponse HttpClient::put(const std::string& url, const Json::Value& data) {
   return put(url, "application/json", data_str);
 }
 
+curl_slist* HttpClient::setBody(CURL* curl_handler, curl_slist* req_headers, const std::string& data,
+                                std::string* compressed) {
+  if (compression_ && data.size() >= compression_threshold_ && gzipCompress(data, compressed) &&
+      compressed->size() < data.size()) {
+    *bytes_saved_ += data.size() - compressed->size();
+    curlEasySetoptWrapper(curl_handler, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(compressed->size()));
+    curlEasySetoptWrapper(curl_handler, CURLOPT_POSTFIELDS, compressed->data());
+    return curl_slist_append(req_headers, "Content-Encoding: gzip");
+  }
+  curlEasySetoptWrapper(curl_handler, CURLOPT_POSTFIELDS, data.c_str());
+  return req_headers;
+}
+
+std::chrono::milliseconds HttpClient::retryAfter() const {
+  const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch());
+  return std::max(std::chrono::milliseconds(*retry_until_) - now, std::chrono::milliseconds::zero());
+}
+
 // NOLINTNEXTLINE(misc-no-recursion)
-HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t size_limit) {
+HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t size_limit,
+                                 const api::FlowControlToken* flow_control, HttpSink* sink) {
+  const AllocationAccounting::Scope accounting(AllocationTag::kNetwork);
   if (size_limit >= 0) {
     // it will only take effect if the server declares the size in advance,
     //    writeString callback takes care of the other case
@@ -225,22 +717,59 @@ HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t si
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_handler, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
 
+  std::string body;
+  StringSink body_sink(&body);
   WriteStringArg response_arg;
+  response_arg.sink = (sink != nullptr) ? sink : &body_sink;
   response_arg.limit = size_limit;
+  response_arg.handle = curl_handler;
+  // Nothing reaches the sink of a request that is retried.
+  if (sink != nullptr) {
+    response_arg.error_body = &body;
+  }
   curlEasySetoptWrapper(curl_handler, CURLOPT_WRITEDATA, static_cast<void*>(&response_arg));
-  CURLcode result = curl_easy_perform(curl_handler);
+  CURLcode result = loop_    ? loop_->perform(curl_handler, flow_control).get()
+                    : share_ ? CurlShare::perform(curl_handler)
+                             : curl_easy_perform(curl_handler);
+  recordTransferMetrics(curl_handler);
   long http_code;  // NOLINT(google-runtime-int)
   curl_easy_getinfo(curl_handler, CURLINFO_RESPONSE_CODE, &http_code);
-  HttpResponse response(response_arg.out, http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
+  if (share_ && result == CURLE_OK) {
+    share_->recordTransfer(curl_handler);
+  }
+  if (network_cache_) {
+    network_cache_->recordTransfer(curl_handler, result);
+  }
+#if LIBCURL_VERSION_NUM >= 0x074200
+  curl_off_t retry_after = 0;
+  if (result == CURLE_OK && curl_easy_getinfo(curl_handler, CURLINFO_RETRY_AFTER, &retry_after) == CURLE_OK &&
+      retry_after > 0) {
+    LOG_DEBUG << "The server asked to wait " << retry_after << " s before the next request";
+    const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(retry_after);
+    *retry_until_ = std::chrono::duration_cast<std::chrono::milliseconds>(until.time_since_epoch()).count();
+  }
+#endif
+  if (compression_ && result == CURLE_OK) {
+    // The download counter is the size on the wire, before decoding.
+    curl_off_t wire_size = 0;
+    if (curl_easy_getinfo(curl_handler, CURLINFO_SIZE_DOWNLOAD_T, &wire_size) == CURLE_OK &&
+        response_arg.written > static_cast<uint64_t>(wire_size)) {
+      *bytes_saved_ += response_arg.written - static_cast<uint64_t>(wire_size);
+    }
+  }
+  HttpResponse response(std::move(body), http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
   if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
     std::ostringstream error_message;
     error_message << "curl error " << response.curl_code << " (http code " << response.http_status_code
                   << "): " << response.error_message;
     LOG_ERROR << error_message.str();
-    if (retry_times != 0) {
+    // An abort is no failure to retry, and a sink can't take the body again
+    // or may have refused it
+    if (retry_times != 0 && response.curl_code != CURLE_ABORTED_BY_CALLBACK &&
+        (sink == nullptr || (response_arg.written == 0 && response.curl_code != CURLE_WRITE_ERROR))) {
       sleep(1);
       // NOLINTNEXTLINE(misc-no-recursion)
-      response = perform(curl_handler, --retry_times, size_limit);
+      response = perform(curl_handler, --retry_times, size_limit, flow_control, sink);
     }
   }
   LOG_TRACE << "response http code: " << response.http_status_code;
@@ -250,48 +779,138 @@ HttpResponse HttpClient::perform(CURL* curl_handler, int retry_times, int64_t si
 
 HttpResponse HttpClient::download(const std::string& url, curl_write_callback write_cb,
                                   curl_xferinfo_callback progress_cb, void* userp, curl_off_t from) {
-  return downloadAsync(url, write_cb, progress_cb, userp, from, nullptr).get();
+  // On the calling thread, which would only wait for another one
+  ShapedWriteArg shaped;
+  CurlHandler curlp = CurlHandler(prepareDownload(url, write_cb, progress_cb, userp, &shaped), curl_easy_cleanup);
+  HttpResponse held_back;
+  if (heldBack(shaped, &held_back)) {
+    return held_back;
+  }
+  curlEasySetoptWrapper(curlp.get(), CURLOPT_RESUME_FROM_LARGE, from);
+  return performDownload(curlp.get(), share_.get(), network_cache_.get(), shaper_.get(), loop_.get());
 }
 
-std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
-                                                    curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
-                                                    CurlHandler* easyp) {
-  CURL* curl_download = Utils::curlDupHandleWrapper(curl, pkcs11_key);
-
-  CurlHandler curlp = CurlHandler(curl_download, curl_easy_cleanup);
+HttpResponse HttpClient::performDownload(CURL* curl, CurlShare* share, NetworkCache* cache, BandwidthShaper* shaper,
+                                         CurlMultiLoop* loop) {
+  const AllocationAccounting::Scope accounting(AllocationTag::kNetwork);
+  // The shaper sleeps in the write callback, which would hold up all the
+  // transfers of the loop.
+  const CURLcode result = (loop != nullptr && shaper == nullptr) ? loop->perform(curl).get()
+                          : share != nullptr                      ? CurlShare::perform(curl)
+                                                                  : curl_easy_perform(curl);
+  return downloadResponse(curl, result, share, cache, shaper);
+}
 
-  if (easyp != nullptr) {
-    *easyp = curlp;
+HttpResponse HttpClient::downloadResponse(CURL* curl, CURLcode result, CurlShare* share, NetworkCache* cache,
+                                          BandwidthShaper* shaper) {
+  recordTransferMetrics(curl);
+  long http_code;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_code);
+  if (share != nullptr && result == CURLE_OK) {
+    share->recordTransfer(curl);
   }
+  if (cache != nullptr) {
+    cache->recordTransfer(curl, result);
+  }
+  if (shaper != nullptr && result != CURLE_OK && result != CURLE_ABORTED_BY_CALLBACK) {
+    shaper->transferFailed();
+  }
+  return HttpResponse("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
+}
+
+CURL* HttpClient::prepareDownload(const std::string& url, curl_write_callback write_cb,
+                                  curl_xferinfo_callback progress_cb, void* userp, ShapedWriteArg* shaped) const {
+  CURL* curl_download = dupHandle();
 
   curlEasySetoptWrapper(curl_download, CURLOPT_HTTPHEADER, headers);
   curlEasySetoptWrapper(curl_download, CURLOPT_URL, url.c_str());
   curlEasySetoptWrapper(curl_download, CURLOPT_HTTPGET, 1L);
-  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, write_cb);
-  curlEasySetoptWrapper(curl_download, CURLOPT_WRITEDATA, userp);
+  if (shaper_) {
+    shaped->write_cb = write_cb;
+    shaped->userp = userp;
+    shaped->shaper = shaper_.get();
+    shaped->handle = curl_download;
+    curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, shapedWrite);
+    curlEasySetoptWrapper(curl_download, CURLOPT_WRITEDATA, static_cast<void*>(shaped));
+  } else {
+    curlEasySetoptWrapper(curl_download, CURLOPT_WRITEFUNCTION, write_cb);
+    curlEasySetoptWrapper(curl_download, CURLOPT_WRITEDATA, userp);
+  }
   if (progress_cb != nullptr) {
     curlEasySetoptWrapper(curl_download, CURLOPT_NOPROGRESS, 0);
     curlEasySetoptWrapper(curl_download, CURLOPT_XFERINFOFUNCTION, progress_cb);
     curlEasySetoptWrapper(curl_download, CURLOPT_XFERINFODATA, userp);
   }
+  if (link_policy_) {
+    shaped->link = link_policy_.get();
+    shaped->mode = link_policy_->mode();
+    shaped->progress_cb = progress_cb;
+    shaped->progress_userp = userp;
+    curlEasySetoptWrapper(curl_download, CURLOPT_NOPROGRESS, 0);
+    curlEasySetoptWrapper(curl_download, CURLOPT_XFERINFOFUNCTION, linkProgress);
+    curlEasySetoptWrapper(curl_download, CURLOPT_XFERINFODATA, static_cast<void*>(shaped));
+    if (shaped->mode == LinkPolicy::Mode::kThrottled) {
+      curlEasySetoptWrapper(curl_download, CURLOPT_MAX_RECV_SPEED_LARGE,
+                            static_cast<curl_off_t>(link_policy_->throttledRate()));
+    }
+  }
   curlEasySetoptWrapper(curl_download, CURLOPT_TIMEOUT, 0);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_TIME, speed_limit_time_interval_);
   curlEasySetoptWrapper(curl_download, CURLOPT_LOW_SPEED_LIMIT, speed_limit_bytes_per_sec_);
+  return curl_download;
+}
+
+HttpResponse HttpClient::downloadRange(const std::string& url, curl_write_callback write_cb,
+                                       curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                       curl_off_t to) {
+  ShapedWriteArg shaped;
+  CurlHandler curlp = CurlHandler(prepareDownload(url, write_cb, progress_cb, userp, &shaped), curl_easy_cleanup);
+  HttpResponse held_back;
+  if (heldBack(shaped, &held_back)) {
+    return held_back;
+  }
+  const std::string range = std::to_string(from) + "-" + std::to_string(to);
+  curlEasySetoptWrapper(curlp.get(), CURLOPT_RANGE, range.c_str());
+
+  LOG_DEBUG << "GET " << url << " range " << range;
+  return performDownload(curlp.get(), share_.get(), network_cache_.get(), shaper_.get(), loop_.get());
+}
+
+std::future<HttpResponse> HttpClient::downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                                    curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                                    CurlHandler* easyp) {
+  auto shaped = std::make_shared<ShapedWriteArg>();
+  CURL* curl_download = prepareDownload(url, write_cb, progress_cb, userp, shaped.get());
+
+  CurlHandler curlp = CurlHandler(curl_download, curl_easy_cleanup);
+
+  if (easyp != nullptr) {
+    *easyp = curlp;
+  }
+  HttpResponse held_back;
+  if (heldBack(*shaped, &held_back)) {
+    std::promise<HttpResponse> promise;
+    promise.set_value(held_back);
+    return promise.get_future();
+  }
+
   curlEasySetoptWrapper(curl_download, CURLOPT_RESUME_FROM_LARGE, from);
 
-  std::promise<HttpResponse> resp_promise;
-  auto resp_future = resp_promise.get_future();
-  std::thread(
-      [curlp](std::promise<HttpResponse> promise) {
-        CURLcode result = curl_easy_perform(curlp.get());
-        long http_code;  // NOLINT(google-runtime-int)
-        curl_easy_getinfo(curlp.get(), CURLINFO_RESPONSE_CODE, &http_code);
-        HttpResponse response("", http_code, result, (result != CURLE_OK) ? curl_easy_strerror(result) : "");
-        promise.set_value(response);
-      },
-      std::move(resp_promise))
-      .detach();
-  return resp_future;
+  if (loop_ && !shaper_) {
+    // No thread waits for the transfer; shaped is kept for the progress handler
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    auto future = promise->get_future();
+    loop_->submit(curl_download, nullptr,
+                  [promise, curlp, share = share_, cache = network_cache_, shaped](CURLcode result) {
+                    promise->set_value(downloadResponse(curlp.get(), result, share.get(), cache.get(), nullptr));
+                  });
+    return future;
+  }
+
+  // Doesn't refer to the client, which may be gone by the end of the download
+  return Executor::io().submit([curlp, share = share_, cache = network_cache_, shaper = shaper_, shaped]() {
+    return performDownload(curlp.get(), share.get(), cache.get(), shaper.get(), nullptr);
+  });
 }
 
 bool HttpClient::updateHeader(const std::string& name, const std::string& value) {
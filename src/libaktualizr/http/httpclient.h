@@ -1,14 +1,21 @@
 #ifndef HTTPCLIENT_H_
 #define HTTPCLIENT_H_
 
+#include <array>
+#include <atomic>
 #include <future>
 #include <memory>
+#include <mutex>
 
 #include <curl/curl.h>
 #include "gtest/gtest_prod.h"
 #include "json/json.h"
 
+#include "http/bandwidth_shaper.h"
+#include "http/link_policy.h"
+#include "http/network_cache.h"
 #include "httpinterface.h"
+#include "libaktualizr/config.h"
 
 /**
  * Helper class to manage curl_global_init/curl_global_cleanup calls
@@ -23,43 +30,134 @@ class CurlGlobalInitWrapper {
   CurlGlobalInitWrapper &operator=(CurlGlobalInitWrapper &&) = delete;
 };
 
+/**
+ * Process-wide curl share handle. Easy handles attached to it share a common
+ * TLS session cache and DNS cache. Connections are not shared between
+ * threads, as curl does not support using one connection cache from several
+ * threads at once: perform() runs a transfer on a multi handle owned by the
+ * calling thread, so that a transfer made by one HttpClient instance (or any
+ * of its copies) can reuse a connection established by another one on the
+ * same thread instead of doing a new TLS handshake.
+ */
+class CurlShare {
+ public:
+  CurlShare();
+  ~CurlShare();
+  CurlShare(const CurlShare &) = delete;
+  CurlShare(CurlShare &&) = delete;
+  CurlShare &operator=(const CurlShare &) = delete;
+  CurlShare &operator=(CurlShare &&) = delete;
+
+  static std::shared_ptr<CurlShare> global();
+
+  void attach(CURL *handle);
+  // Blocking transfer, reusing the connections of the calling thread
+  static CURLcode perform(CURL *handle);
+  // Inspect a finished transfer and count it if it reused an existing connection
+  void recordTransfer(CURL *handle);
+  uint64_t handshakesAvoided() const { return handshakes_avoided_; }
+
+ private:
+  static void lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr);
+  static void unlock(CURL *handle, curl_lock_data data, void *userptr);
+
+  CURLSH *share_;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> locks_;
+  std::atomic<uint64_t> handshakes_avoided_{0};
+};
+
+class CurlMultiLoop;
+struct ShapedWriteArg;
+struct TlsCredentials;
+
 class HttpClient : public HttpInterface {
  public:
   explicit HttpClient(const std::vector<std::string> *extra_headers = nullptr);
+  explicit HttpClient(const NetworkConfig &config, const std::vector<std::string> *extra_headers = nullptr);
   explicit HttpClient(const std::string &socket);
   HttpClient(const HttpClient &curl_in);  // non-default!
   ~HttpClient() override;
   HttpClient(HttpClient &&) = default;
   HttpClient &operator=(const HttpClient &) = delete;
   HttpClient &operator=(HttpClient &&) = default;
+  using HttpInterface::get;
   HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override;
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                              const std::string &etag, const std::string &last_modified) override;
   HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) override;
   HttpResponse post(const std::string &url, const Json::Value &data) override;
   HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) override;
   HttpResponse put(const std::string &url, const Json::Value &data) override;
+  HttpResponse patch(const std::string &url, const std::string &content_type, const std::string &data) override;
 
   HttpResponse download(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
                         void *userp, curl_off_t from) override;
   std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                           curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                           CurlHandler *easyp) override;
+  HttpResponse downloadRange(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                             void *userp, curl_off_t from, curl_off_t to) override;
   void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert, CryptoSource cert_source,
                 const std::string &pkey, CryptoSource pkey_source) override;
   bool updateHeader(const std::string &name, const std::string &value);
   void timeout(int64_t ms);
+  std::chrono::milliseconds retryAfter() const override;
+  // Number of transfers that reused a shared connection instead of opening a new one
+  uint64_t handshakesAvoided() const { return share_ ? share_->handshakesAvoided() : 0; }
+  // Bytes not sent or received thanks to compressed request and response bodies
+  uint64_t bytesSaved() const { return *bytes_saved_; }
+  // Adaptive download rate limit, if bandwidth shaping is enabled
+  const BandwidthShaper *bandwidthShaper() const { return shaper_.get(); }
+
+ protected:
+  HttpResponse getToSink(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                         HttpSink *sink) override;
 
  private:
   FRIEND_TEST(HttpClient, DownloadSpeedLimit);
+  FRIEND_TEST(HttpClient, CredentialsCache);
 
   static const CurlGlobalInitWrapper manageCurlGlobalInit_;
   CURL *curl;
   curl_slist *headers;
-  HttpResponse perform(CURL *curl_handler, int retry_times, int64_t size_limit);
+  std::shared_ptr<CurlShare> share_;
+  bool compression_{false};
+  uint64_t compression_threshold_{0};
+  // Shared with copies of this client
+  std::shared_ptr<std::atomic<uint64_t>> bytes_saved_{std::make_shared<std::atomic<uint64_t>>(0)};
+  // Time on the steady clock, in ms, before which the server asked not to be
+  // sent requests; shared with copies of this client
+  std::shared_ptr<std::atomic<int64_t>> retry_until_{std::make_shared<std::atomic<int64_t>>(0)};
+  // Shared with copies of this client, so that the limit applies to all their downloads
+  std::shared_ptr<BandwidthShaper> shaper_;
+  // Runs the transfers instead of the calling threads, if enabled
+  std::shared_ptr<CurlMultiLoop> loop_;
+  // Keeps the TLS sessions and DNS results across restarts, if enabled
+  std::shared_ptr<NetworkCache> network_cache_;
+  // Holds the downloads back on costly links, if enabled
+  std::shared_ptr<LinkPolicy> link_policy_;
+  CURL *dupHandle() const;
+  curl_slist *setBody(CURL *curl_handler, curl_slist *req_headers, const std::string &data, std::string *compressed);
+  // Send data with a PUT or PATCH request
+  HttpResponse sendBody(const char *method, const std::string &url, const std::string &content_type,
+                        const std::string &data);
+  CURL *prepareDownload(const std::string &url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void *userp, ShapedWriteArg *shaped) const;
+  // Run a download prepared by prepareDownload(), on the loop if given, else
+  // on the calling thread
+  static HttpResponse performDownload(CURL *curl, CurlShare *share, NetworkCache *cache, BandwidthShaper *shaper,
+                                      CurlMultiLoop *loop);
+  static HttpResponse downloadResponse(CURL *curl, CURLcode result, CurlShare *share, NetworkCache *cache,
+                                       BandwidthShaper *shaper);
+  // Into the body of the response, unless given a sink
+  HttpResponse perform(CURL *curl_handler, int retry_times, int64_t size_limit,
+                       const api::FlowControlToken *flow_control = nullptr, HttpSink *sink = nullptr);
+  HttpResponse getInto(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                       HttpSink *sink);
   static curl_slist *curl_slist_dup(curl_slist *sl);
 
-  std::unique_ptr<TemporaryFile> tls_ca_file;
-  std::unique_ptr<TemporaryFile> tls_cert_file;
-  std::unique_ptr<TemporaryFile> tls_pkey_file;
+  // Shared with copies of this client and, while in use, with other clients given the same credentials
+  std::shared_ptr<TlsCredentials> tls_;
   static const int RETRY_TIMES = 2;
   static const long kSpeedLimitTimeInterval = 60L;   // NOLINT(google-runtime-int)
   static const long kSpeedLimitBytesPerSec = 5000L;  // NOLINT(google-runtime-int)
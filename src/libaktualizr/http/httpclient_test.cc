@@ -9,6 +9,7 @@
 #include <cstdlib>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "json/json.h"
 #include "logging/logging.h"
@@ -66,6 +67,67 @@ TEST(HttpClient, DownloadSpeedLimit) {
   EXPECT_EQ(resp.curl_code, CURLE_OPERATION_TIMEDOUT);
 }
 
+class CountingSink : public HttpSink {
+ public:
+  void expectSize(uint64_t size) override { expected = size; }
+  bool write(const char* data, size_t size) override {
+    (void)data;
+    written += size;
+    return written <= refuse_after;
+  }
+
+  uint64_t expected{0};
+  uint64_t written{0};
+  uint64_t refuse_after{UINT64_MAX};
+};
+
+/* The body of a response goes to a sink given by the caller, announced by its size. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, GetToSink) {
+  const uint64_t large_size = 100U << 20U;
+  HttpClient http;
+  CountingSink sink;
+  HttpResponse resp = http.get(server + "/large_file", HttpInterface::kNoLimit, nullptr, &sink);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_TRUE(resp.body.empty());
+  EXPECT_EQ(sink.expected, large_size);
+  EXPECT_EQ(sink.written, large_size);
+
+  // The size limit applies as to the body
+  CountingSink limited;
+  resp = http.get(server + "/large_file", 1024, nullptr, &limited);
+  EXPECT_EQ(resp.curl_code, CURLE_FILESIZE_EXCEEDED);
+  EXPECT_EQ(limited.written, 0);
+
+  // A sink stops the transfer by refusing data
+  CountingSink refusing;
+  refusing.refuse_after = 1;
+  resp = http.get(server + "/large_file", HttpInterface::kNoLimit, nullptr, &refusing);
+  EXPECT_EQ(resp.curl_code, CURLE_WRITE_ERROR);
+  EXPECT_LT(refusing.written, large_size);
+
+  std::string body;
+  StringSink string_sink(&body);
+  const std::string path = "/path/1/2/3";
+  resp = http.get(server + path, HttpInterface::kNoLimit, nullptr, &string_sink);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(Utils::parseJSON(body)["path"].asString(), path);
+}
+
+/* A request into a sink is retried after a server error, whose body doesn't
+ * reach the sink. The test server fails the first request for a path. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, GetToSinkRetried) {
+  HttpClient http;
+  std::string body;
+  StringSink string_sink(&body);
+  const std::string path = "/sink/retried";
+  HttpResponse resp = http.get(server + path, HttpInterface::kNoLimit, nullptr, &string_sink);
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_TRUE(resp.body.empty());
+  EXPECT_EQ(body, "{\"path\": \"" + path + "\"}");
+}
+
 // NOLINTNEXTLINE(*non-const*)
 TEST(HttpClient, Cancellation) {
   HttpClient http;
@@ -153,6 +215,179 @@ TEST(HttpClient, UpdateHeader) {
   EXPECT_EQ(response["status"].asString(), "good");
 }
 
+// Connections the server accepted so far, counting the one of this request
+static int serverConnections() {
+  HttpClient http;
+  return http.get(server + "/connections", HttpInterface::kNoLimit, nullptr).getJson()["connections"].asInt();
+}
+
+/* Clients built with share_connections use a common curl share handle, and
+ * with it the same connection. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, SharedConnections) {
+  NetworkConfig config;
+  config.share_connections = true;
+  HttpClient http(config);
+  HttpClient http_copy(http);
+  HttpClient http_other(config);
+  HttpClient http_unshared;
+
+  const uint64_t avoided = http.handshakesAvoided();
+  const int connections = serverConnections();
+  std::string path = "/keep_alive/1/2/3";
+  for (HttpClient* client : {&http, &http_copy, &http_other, &http_unshared}) {
+    Json::Value response = client->get(server + path, HttpInterface::kNoLimit, nullptr).getJson();
+    EXPECT_EQ(response["path"].asString(), path);
+  }
+
+  // One for the shared clients, one for the unshared one and one to count them
+  EXPECT_EQ(serverConnections() - connections, 3);
+  EXPECT_EQ(http.handshakesAvoided() - avoided, 2);
+  // The counter belongs to the process-wide share, not to a single client.
+  EXPECT_EQ(http.handshakesAvoided(), http_copy.handshakesAvoided());
+  EXPECT_EQ(http.handshakesAvoided(), http_other.handshakesAvoided());
+  EXPECT_EQ(http_unshared.handshakesAvoided(), 0);
+}
+
+/* Shared clients used from several threads at once each keep their own
+ * connections, and still reuse them for the later requests of their thread. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, SharedConnectionsConcurrent) {
+  NetworkConfig config;
+  config.share_connections = true;
+  HttpClient http(config);
+  const int threads = 4;
+  const int requests = 5;
+
+  const uint64_t avoided = http.handshakesAvoided();
+  const int connections = serverConnections();
+  std::atomic<int> failures{0};
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back([&http, &failures, i]() {
+      HttpClient client(http);
+      const std::string path = "/keep_alive/" + std::to_string(i);
+      for (int j = 0; j < requests; ++j) {
+        if (client.get(server + path, HttpInterface::kNoLimit, nullptr).getJson()["path"].asString() != path) {
+          ++failures;
+        }
+      }
+    });
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+
+  EXPECT_EQ(failures, 0);
+  // One per thread and one to count them
+  EXPECT_EQ(serverConnections() - connections, threads + 1);
+  EXPECT_EQ(http.handshakesAvoided() - avoided, threads * (requests - 1));
+}
+
+/* Request and response bodies are compressed when enabled. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, Compression) {
+  NetworkConfig config;
+  config.compression = true;
+  HttpClient http(config);
+
+  auto resp = http.get(server + "/compressed", HttpInterface::kNoLimit, nullptr);
+  EXPECT_EQ(resp.getJson()["data"].asString(), std::string(10000, '@'));
+  const uint64_t saved_get = http.bytesSaved();
+  EXPECT_GT(saved_get, 0);
+
+  std::string path = "/path/1/2/3";
+  Json::Value data;
+  for (int i = 0; i < 100; ++i) {
+    data["events"][i]["key"] = "val";
+  }
+  Json::Value response = http.post(server + path, data).getJson();
+  EXPECT_EQ(response["path"].asString(), path);
+  EXPECT_EQ(response["data"]["events"][99]["key"].asString(), "val");
+  EXPECT_GT(http.bytesSaved(), saved_get);
+
+  // Small bodies are sent as they are.
+  const uint64_t saved_post = http.bytesSaved();
+  Json::Value small;
+  small["key"] = "val";
+  response = http.put(server + path, small).getJson();
+  EXPECT_EQ(response["data"]["key"].asString(), "val");
+  EXPECT_EQ(http.bytesSaved(), saved_post);
+
+  HttpClient http_plain;
+  resp = http_plain.get(server + "/compressed", HttpInterface::kNoLimit, nullptr);
+  EXPECT_EQ(resp.getJson()["data"].asString(), std::string(10000, '@'));
+  EXPECT_EQ(http_plain.bytesSaved(), 0);
+}
+
+/* Concurrent requests and downloads run on the event loop when enabled. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, EventLoop) {
+  NetworkConfig config;
+  config.event_loop = true;
+  HttpClient http(config);
+
+  api::FlowControlToken token;
+  std::thread slow([&http, &token]() {
+    HttpResponse resp = http.get(server + "/slow_file", HttpInterface::kNoLimit, &token);
+    EXPECT_EQ(resp.curl_code, CURLE_ABORTED_BY_CALLBACK);
+  });
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&http, i]() {
+      HttpClient http_copy(http);
+      const std::string path = "/path/" + std::to_string(i);
+      Json::Value response = http_copy.get(server + path, HttpInterface::kNoLimit, nullptr).getJson();
+      EXPECT_EQ(response["path"].asString(), path);
+      Json::Value data;
+      data["key"] = i;
+      response = http_copy.post(server + path, data).getJson();
+      EXPECT_EQ(response["data"]["key"].asInt(), i);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::string body;
+  auto write = [](char* contents, size_t size, size_t nmemb, void* userp) {
+    static_cast<std::string*>(userp)->append(contents, size * nmemb);
+    return size * nmemb;
+  };
+  // Downloads aren't retried, the server must not fail it.
+  HttpResponse resp = http.downloadAsync(server + "/download/file", write, nullptr, &body, 0, nullptr).get();
+  EXPECT_TRUE(resp.isOk());
+  EXPECT_EQ(body, "content");
+
+  const auto start = std::chrono::steady_clock::now();
+  token.setAbort();
+  slow.join();
+  // Well before the 5 s the server takes to send the file
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(4));
+}
+
+/* Re-applying the same TLS credentials doesn't set them up again. */
+// NOLINTNEXTLINE(*non-const*)
+TEST(HttpClient, CredentialsCache) {
+  HttpClient http;
+  http.setCerts("ca", CryptoSource::kFile, "cert", CryptoSource::kFile, "pkey", CryptoSource::kFile);
+  const auto creds = http.tls_;
+  ASSERT_NE(creds, nullptr);
+  http.setCerts("ca", CryptoSource::kFile, "cert", CryptoSource::kFile, "pkey", CryptoSource::kFile);
+  EXPECT_EQ(http.tls_, creds);
+
+  HttpClient http_copy(http);
+  EXPECT_EQ(http_copy.tls_, creds);
+  HttpClient http_other;
+  http_other.setCerts("ca", CryptoSource::kFile, "cert", CryptoSource::kFile, "pkey", CryptoSource::kFile);
+  EXPECT_EQ(http_other.tls_, creds);
+
+  http_other.setCerts("ca", CryptoSource::kFile, "cert", CryptoSource::kFile, "pkey2", CryptoSource::kFile);
+  EXPECT_NE(http_other.tls_, creds);
+  EXPECT_EQ(http.tls_, creds);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -1,6 +1,8 @@
 #ifndef HTTPINTERFACE_H_
 #define HTTPINTERFACE_H_
 
+#include <algorithm>
+#include <chrono>
 #include <future>
 #include <string>
 #include <utility>
@@ -27,8 +29,12 @@ struct HttpResponse {
   long http_status_code{0};  // NOLINT(google-runtime-int)
   CURLcode curl_code{CURLE_OK};
   std::string error_message;
+  // Cache validators sent by the server, only filled in by getConditional()
+  std::string etag;
+  std::string last_modified;
   bool isOk() const { return (curl_code == CURLE_OK && http_status_code >= 200 && http_status_code < 400); }
   bool wasInterrupted() const { return curl_code == CURLE_ABORTED_BY_CALLBACK; };
+  bool notModified() const { return curl_code == CURLE_OK && http_status_code == 304; }
   std::string getStatusStr() const {
     return std::to_string(curl_code) + " " + error_message + " HTTP " + std::to_string(http_status_code);
   }
@@ -36,29 +42,139 @@ struct HttpResponse {
   Json::Value getJson() const { return Utils::parseJSON(body); }
 };
 
+/**
+ * Destination of the body of a response, for the callers that process it as
+ * it arrives, e.g. into a hasher or a file, instead of from
+ * HttpResponse::body.
+ */
+class HttpSink {
+ public:
+  HttpSink() = default;
+  virtual ~HttpSink() = default;
+  HttpSink(const HttpSink &) = delete;
+  HttpSink(HttpSink &&) = delete;
+  HttpSink &operator=(const HttpSink &) = delete;
+  HttpSink &operator=(HttpSink &&) = delete;
+
+  /** Called before the first write with the size of the body, if the server sent it. */
+  virtual void expectSize(uint64_t size) { (void)size; }
+  /** Take the next part of the body; false fails the transfer with CURLE_WRITE_ERROR. */
+  virtual bool write(const char *data, size_t size) = 0;
+};
+
+/**
+ * Appends the body to a string, reserved for the whole body up front.
+ */
+class StringSink : public HttpSink {
+ public:
+  // Most reserved for a body, whatever size the server announces
+  static constexpr uint64_t kMaxReserve = 16 * 1024 * 1024;
+
+  explicit StringSink(std::string *out) : out_{out} {}
+  void expectSize(uint64_t size) override { out_->reserve(out_->size() + std::min(size, kMaxReserve)); }
+  bool write(const char *data, size_t size) override {
+    out_->append(data, size);
+    return true;
+  }
+
+ private:
+  std::string *out_;
+};
+
 class HttpInterface {
  public:
   HttpInterface() = default;
   virtual ~HttpInterface() = default;
   virtual HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) = 0;
   HttpResponse get(const std::string &url, int64_t maxsize) { return get(url, maxsize, nullptr); }
+  /** GET a resource into sink; the body of the response only has that of a server error. */
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                   HttpSink *sink) {
+    return getToSink(url, maxsize, flow_control, sink);
+  }
+  /**
+   * GET a resource unless it still matches the given cache validators, as
+   * sent by the server with an earlier response. An unchanged resource is
+   * reported with the HTTP status 304 and an empty body.
+   *
+   * Implementations that don't support conditional requests perform a plain
+   * GET.
+   */
+  virtual HttpResponse getConditional(const std::string &url, int64_t maxsize,
+                                      const api::FlowControlToken *flow_control, const std::string &etag,
+                                      const std::string &last_modified) {
+    (void)etag;
+    (void)last_modified;
+    return get(url, maxsize, flow_control);
+  }
   virtual HttpResponse post(const std::string &url, const std::string &content_type, const std::string &data) = 0;
   virtual HttpResponse post(const std::string &url, const Json::Value &data) = 0;
   virtual HttpResponse put(const std::string &url, const std::string &content_type, const std::string &data) = 0;
   virtual HttpResponse put(const std::string &url, const Json::Value &data) = 0;
+  /**
+   * PATCH a resource, e.g. with a JSON Patch.
+   *
+   * Implementations that can't issue PATCH requests return CURLE_NOT_BUILT_IN.
+   */
+  virtual HttpResponse patch(const std::string &url, const std::string &content_type, const std::string &data) {
+    (void)url;
+    (void)content_type;
+    (void)data;
+    return HttpResponse("", 0, CURLE_NOT_BUILT_IN, "PATCH requests are not supported");
+  }
 
   virtual HttpResponse download(const std::string &url, curl_write_callback write_cb,
                                 curl_xferinfo_callback progress_cb, void *userp, curl_off_t from) = 0;
   virtual std::future<HttpResponse> downloadAsync(const std::string &url, curl_write_callback write_cb,
                                                   curl_xferinfo_callback progress_cb, void *userp, curl_off_t from,
                                                   CurlHandler *easyp) = 0;
+  /**
+   * Download the inclusive byte range [from, to] of a resource. A successful
+   * response has the HTTP status 206.
+   *
+   * Implementations that can't issue range requests return CURLE_NOT_BUILT_IN.
+   */
+  virtual HttpResponse downloadRange(const std::string &url, curl_write_callback write_cb,
+                                     curl_xferinfo_callback progress_cb, void *userp, curl_off_t from, curl_off_t to) {
+    (void)url;
+    (void)write_cb;
+    (void)progress_cb;
+    (void)userp;
+    (void)from;
+    (void)to;
+    return HttpResponse("", 0, CURLE_NOT_BUILT_IN, "Range requests are not supported");
+  }
   virtual void setCerts(const std::string &ca, CryptoSource ca_source, const std::string &cert,
                         CryptoSource cert_source, const std::string &pkey, CryptoSource pkey_source) = 0;
+  /**
+   * Time left before the server accepts requests again, as it asked with the
+   * Retry-After header of a response.
+   *
+   * Implementations that don't read the response headers return zero.
+   */
+  virtual std::chrono::milliseconds retryAfter() const { return std::chrono::milliseconds::zero(); }
   static constexpr int64_t kNoLimit = 0;  // no limit the size of downloaded data
   static constexpr int64_t kPostRespLimit = 64L * 1024;
   static constexpr int64_t kPutRespLimit = 64L * 1024;
 
  protected:
+  /**
+   * Implementations that can't stream the body hand it to the sink at once
+   * when the transfer is done.
+   */
+  virtual HttpResponse getToSink(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                                 HttpSink *sink) {
+    HttpResponse response = get(url, maxsize, flow_control);
+    if (!response.body.empty()) {
+      sink->expectSize(response.body.size());
+      if (!sink->write(response.body.data(), response.body.size())) {
+        response.curl_code = CURLE_WRITE_ERROR;
+      }
+      response.body.clear();
+    }
+    return response;
+  }
+
   HttpInterface(const HttpInterface &) = default;
   HttpInterface(HttpInterface &&) = default;
   HttpInterface &operator=(const HttpInterface &) = default;
@@ -0,0 +1,151 @@
+#include "http/link_policy.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+static const std::chrono::seconds kLinkFileInterval{1};
+
+LinkPolicy::~LinkPolicy() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  watcher_cv_.notify_all();
+  if (watcher_.joinable()) {
+    watcher_.join();
+  }
+}
+
+std::shared_ptr<LinkPolicy> LinkPolicy::global() {
+  static std::shared_ptr<LinkPolicy> instance = std::make_shared<LinkPolicy>();
+  return instance;
+}
+
+LinkPolicy::Mode LinkPolicy::parseMode(const std::string &mode) {
+  if (mode == "full") {
+    return Mode::kFull;
+  }
+  if (mode == "throttled") {
+    return Mode::kThrottled;
+  }
+  if (mode == "metadata_only") {
+    return Mode::kMetadataOnly;
+  }
+  LOG_WARNING << "Unknown link policy " << mode << ", downloading at full speed";
+  return Mode::kFull;
+}
+
+LinkType LinkPolicy::parseLink(const std::string &state) {
+  const std::string s = boost::algorithm::to_lower_copy(boost::algorithm::trim_copy(state));
+  if (s == "unmetered" || boost::algorithm::starts_with(s, "no")) {
+    return LinkType::kUnmetered;
+  }
+  if (s == "metered" || boost::algorithm::starts_with(s, "yes")) {
+    return LinkType::kMetered;
+  }
+  if (s == "roaming") {
+    return LinkType::kRoaming;
+  }
+  return LinkType::kUnknown;
+}
+
+void LinkPolicy::configure(const NetworkConfig &config) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  watcher_cv_.notify_all();
+  if (watcher_.joinable()) {
+    watcher_.join();
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    modes_.at(static_cast<size_t>(LinkType::kMetered)) = parseMode(config.metered_policy);
+    modes_.at(static_cast<size_t>(LinkType::kRoaming)) = parseMode(config.roaming_policy);
+    throttled_rate_ = config.throttled_rate;
+    link_file_ = config.link_state_file;
+    stop_ = false;
+  }
+  if (!config.link_state_file.empty()) {
+    readLinkFile();
+    watcher_ = std::thread(&LinkPolicy::watch, this);
+  }
+}
+
+void LinkPolicy::setLink(LinkType link) {
+  Mode before;
+  Mode after;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    before = modeLocked();
+    link_ = link;
+    after = modeLocked();
+  }
+  if (before == after) {
+    return;
+  }
+  LOG_INFO << "The network link changed, downloads are now "
+           << (after == Mode::kFull ? "at full speed" : (after == Mode::kThrottled ? "throttled" : "held back"));
+  std::lock_guard<std::mutex> guard(listeners_mutex_);
+  for (const auto &l : listeners_) {
+    l.second(after);
+  }
+}
+
+LinkType LinkPolicy::link() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return link_;
+}
+
+LinkPolicy::Mode LinkPolicy::mode() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const Mode m = modeLocked();
+  // A throttled download without a rate isn't throttled
+  return (m == Mode::kThrottled && throttled_rate_ == 0) ? Mode::kFull : m;
+}
+
+uint64_t LinkPolicy::throttledRate() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return throttled_rate_;
+}
+
+int LinkPolicy::subscribe(Listener listener) {
+  std::lock_guard<std::mutex> guard(listeners_mutex_);
+  const int id = next_listener_++;
+  listeners_[id] = std::move(listener);
+  return id;
+}
+
+void LinkPolicy::unsubscribe(int id) {
+  std::lock_guard<std::mutex> guard(listeners_mutex_);
+  listeners_.erase(id);
+}
+
+void LinkPolicy::readLinkFile() {
+  boost::filesystem::path path;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    path = link_file_;
+  }
+  boost::system::error_code ec;
+  // Until the file is written, the link is the one set last
+  if (path.empty() || !boost::filesystem::is_regular_file(path, ec)) {
+    return;
+  }
+  try {
+    setLink(parseLink(Utils::readFile(path)));
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Could not read the link state from " << path << ": " << e.what();
+  }
+}
+
+void LinkPolicy::watch() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!watcher_cv_.wait_for(lock, kLinkFileInterval, [this] { return stop_; })) {
+    lock.unlock();
+    readLinkFile();
+    lock.lock();
+  }
+}
@@ -0,0 +1,88 @@
+#ifndef HTTP_LINK_POLICY_H_
+#define HTTP_LINK_POLICY_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+
+/**
+ * What the downloads may cost on the current network link.
+ *
+ * The link type is given by the application with setLink(), or read from a
+ * file that a NetworkManager dispatcher script or a ConnMan hook writes, which
+ * is checked every second. The file holds "unmetered", "metered" or "roaming",
+ * or the output of `nmcli -g GENERAL.METERED`; anything else is an unknown
+ * link.
+ *
+ * Each link type has a mode: downloads at full speed, downloads throttled to a
+ * rate, or metadata only. Unknown and unmetered links are at full speed.
+ *
+ * The downloads of HttpClient keep the mode of the link they started on, and
+ * are interrupted when it changes, so that they go on from where they stopped
+ * in the new mode. On a metadata-only link, they fail without connecting.
+ * Listeners hear about the changes of mode, on the thread that made them.
+ */
+class LinkPolicy {
+ public:
+  enum class Mode { kFull, kThrottled, kMetadataOnly };
+  using Listener = std::function<void(Mode)>;
+
+  LinkPolicy() = default;
+  ~LinkPolicy();
+  LinkPolicy(const LinkPolicy &) = delete;
+  LinkPolicy(LinkPolicy &&) = delete;
+  LinkPolicy &operator=(const LinkPolicy &) = delete;
+  LinkPolicy &operator=(LinkPolicy &&) = delete;
+
+  static std::shared_ptr<LinkPolicy> global();
+  /** "full", "throttled" or "metadata_only"; anything else is full with a warning. */
+  static Mode parseMode(const std::string &mode);
+  static LinkType parseLink(const std::string &state);
+
+  /** Take the modes of config, and start watching its link state file, if any. */
+  void configure(const NetworkConfig &config);
+  void setLink(LinkType link);
+  LinkType link() const;
+  Mode mode() const;
+  /** Bytes per second of each throttled download */
+  uint64_t throttledRate() const;
+
+  int subscribe(Listener listener);
+  void unsubscribe(int id);
+
+  /** Read the link state file, as the watcher does. */
+  void readLinkFile();
+
+ private:
+  void watch();
+  // Under mutex_
+  Mode modeLocked() const { return modes_.at(static_cast<size_t>(link_)); }
+
+  mutable std::mutex mutex_;
+  // By LinkType
+  std::array<Mode, 4> modes_{Mode::kFull, Mode::kFull, Mode::kFull, Mode::kFull};
+  LinkType link_{LinkType::kUnknown};
+  uint64_t throttled_rate_{0};
+  // Held while the listeners are called, so that they are not called after
+  // they unsubscribed
+  std::mutex listeners_mutex_;
+  std::map<int, Listener> listeners_;
+  int next_listener_{0};
+
+  boost::filesystem::path link_file_;
+  std::thread watcher_;
+  std::condition_variable watcher_cv_;
+  bool stop_{false};
+};
+
+#endif  // HTTP_LINK_POLICY_H_
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "http/link_policy.h"
+#include "utilities/utils.h"
+
+TEST(LinkPolicy, ParseLink) {
+  EXPECT_EQ(LinkPolicy::parseLink("unmetered\n"), LinkType::kUnmetered);
+  EXPECT_EQ(LinkPolicy::parseLink("metered"), LinkType::kMetered);
+  EXPECT_EQ(LinkPolicy::parseLink("Roaming"), LinkType::kRoaming);
+  // nmcli -g GENERAL.METERED
+  EXPECT_EQ(LinkPolicy::parseLink("yes (guessed)\n"), LinkType::kMetered);
+  EXPECT_EQ(LinkPolicy::parseLink("no"), LinkType::kUnmetered);
+  EXPECT_EQ(LinkPolicy::parseLink("unknown"), LinkType::kUnknown);
+}
+
+/* Each link type has its mode, and the listeners hear about the changes of mode only. */
+TEST(LinkPolicy, Modes) {
+  NetworkConfig config;
+  config.metered_policy = "throttled";
+  config.roaming_policy = "metadata_only";
+  config.throttled_rate = 1000;
+  LinkPolicy policy;
+  policy.configure(config);
+  std::vector<LinkPolicy::Mode> changes;
+  const int id = policy.subscribe([&changes](LinkPolicy::Mode mode) { changes.push_back(mode); });
+
+  EXPECT_EQ(policy.mode(), LinkPolicy::Mode::kFull);
+  policy.setLink(LinkType::kUnmetered);
+  policy.setLink(LinkType::kMetered);
+  EXPECT_EQ(policy.mode(), LinkPolicy::Mode::kThrottled);
+  EXPECT_EQ(policy.throttledRate(), 1000U);
+  policy.setLink(LinkType::kRoaming);
+  policy.setLink(LinkType::kUnknown);
+  const std::vector<LinkPolicy::Mode> expected{LinkPolicy::Mode::kThrottled, LinkPolicy::Mode::kMetadataOnly,
+                                               LinkPolicy::Mode::kFull};
+  EXPECT_EQ(changes, expected);
+
+  policy.unsubscribe(id);
+  policy.setLink(LinkType::kRoaming);
+  EXPECT_EQ(changes.size(), 3U);
+}
+
+/* The link state file overrides the link that was set, once it is written. */
+TEST(LinkPolicy, LinkStateFile) {
+  TemporaryDirectory temp_dir;
+  NetworkConfig config;
+  config.link_state_file = temp_dir / "link";
+  LinkPolicy policy;
+  policy.configure(config);
+  policy.setLink(LinkType::kMetered);
+  policy.readLinkFile();
+  EXPECT_EQ(policy.link(), LinkType::kMetered);
+
+  Utils::writeFile(config.link_state_file, std::string("roaming\n"));
+  policy.readLinkFile();
+  EXPECT_EQ(policy.link(), LinkType::kRoaming);
+  EXPECT_EQ(policy.mode(), LinkPolicy::Mode::kMetadataOnly);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
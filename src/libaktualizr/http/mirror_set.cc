@@ -0,0 +1,194 @@
+#include "http/mirror_set.h"
+
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <memory>
+#include <numeric>
+#include <tuple>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+#include "utilities/executor.h"
+#include "utilities/flow_control.h"
+
+// Weight of a new measurement in the moving averages
+static constexpr double kSmoothing = 0.3;
+// Longest time before a race notices that the caller aborted
+static constexpr std::chrono::milliseconds kAbortPollInterval{100};
+
+MirrorSet::MirrorSet(const std::string &primary, const std::string &mirrors) {
+  mirrors_.push_back(Mirror{primary});
+  std::vector<std::string> entries;
+  boost::split(entries, mirrors, boost::is_any_of(","));
+  for (auto &entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    Mirror mirror;
+    const auto space = entry.find_first_of(" \t");
+    mirror.url = entry.substr(0, space);
+    if (space != std::string::npos) {
+      try {
+        mirror.weight = std::stod(entry.substr(space));
+      } catch (const std::exception &) {
+        mirror.weight = 0.;
+      }
+      if (!(mirror.weight > 0.)) {
+        LOG_WARNING << "Ignoring the malformed weight of mirror " << entry;
+        mirror.weight = 1.;
+      }
+    }
+    mirrors_.push_back(std::move(mirror));
+  }
+}
+
+std::vector<size_t> MirrorSet::ranked() const {
+  std::vector<size_t> order(mirrors_.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Failures, then whether it is not measured yet, then the expected time or
+  // the opposite of the weight
+  auto key = [this](size_t index) {
+    const Mirror &mirror = mirrors_[index];
+    const bool measured = mirror.latency_sec > 0. || mirror.bytes_per_sec > 0.;
+    double cost = -mirror.weight;
+    if (measured) {
+      cost = mirror.latency_sec;
+      if (mirror.bytes_per_sec > 0.) {
+        cost += static_cast<double>(kReferenceSize) / mirror.bytes_per_sec;
+      }
+      cost /= mirror.weight;
+    }
+    return std::make_tuple(mirror.failures, !measured, cost, index);
+  };
+  std::sort(order.begin(), order.end(), [&key](size_t a, size_t b) { return key(a) < key(b); });
+  return order;
+}
+
+void MirrorSet::recordSuccess(size_t index, uint64_t bytes, clock::duration elapsed) {
+  const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1e-6);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Mirror &mirror = mirrors_[index];
+  mirror.failures = 0;
+  double &average = (bytes >= kMinThroughputSample) ? mirror.bytes_per_sec : mirror.latency_sec;
+  const double sample = (bytes >= kMinThroughputSample) ? static_cast<double>(bytes) / seconds : seconds;
+  average = (average > 0.) ? average * (1. - kSmoothing) + sample * kSmoothing : sample;
+}
+
+void MirrorSet::recordFailure(size_t index) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++mirrors_[index].failures;
+}
+
+bool MirrorSet::answered(const HttpResponse &response) {
+  if (response.isOk()) {
+    return true;
+  }
+  // The mirror has it wrong or is overloaded, another one may not
+  const long code = response.http_status_code;  // NOLINT(google-runtime-int)
+  return response.curl_code == CURLE_OK && code >= 400 && code < 500 && code != 408 && code != 429;
+}
+
+void MirrorSet::record(size_t index, const HttpResponse &response, clock::duration elapsed) {
+  if (answered(response)) {
+    recordSuccess(index, response.body.size(), elapsed);
+  } else if (!response.wasInterrupted()) {
+    recordFailure(index);
+  }
+}
+
+HttpResponse MirrorSet::timed(const Request &request, size_t index, const api::FlowControlToken *flow_control) {
+  const auto start = clock::now();
+  HttpResponse response = request(url(index), flow_control);
+  record(index, response, clock::now() - start);
+  return response;
+}
+
+HttpResponse MirrorSet::race(const Request &request, size_t first, size_t second,
+                             const api::FlowControlToken *flow_control) {
+  struct Race {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::array<api::FlowControlToken, 2> tokens;
+    std::array<HttpResponse, 2> responses;
+    std::array<clock::duration, 2> elapsed;
+    std::array<bool, 2> done{{false, false}};
+  };
+  auto state = std::make_shared<Race>();
+  const std::array<size_t, 2> indices{{first, second}};
+  for (size_t i = 0; i < indices.size(); ++i) {
+    // Not the io pool, which could run them one after the other
+    Executor::blocking().submit([state, request, i, base = url(indices[i])]() {
+      const auto start = clock::now();
+      HttpResponse response = request(base, &state->tokens[i]);
+      std::lock_guard<std::mutex> lock(state->mutex);
+      state->responses[i] = std::move(response);
+      state->elapsed[i] = clock::now() - start;
+      state->done[i] = true;
+      state->cv.notify_all();
+    });
+  }
+
+  std::unique_lock<std::mutex> lock(state->mutex);
+  size_t winner = indices.size();
+  for (;;) {
+    for (size_t i = 0; i < indices.size(); ++i) {
+      if (state->done[i] && answered(state->responses[i])) {
+        winner = i;
+        break;
+      }
+    }
+    if (winner < indices.size() || (state->done[0] && state->done[1])) {
+      break;
+    }
+    if (flow_control != nullptr && flow_control->hasAborted()) {
+      // The racers finish on their own
+      state->tokens[0].setAbort();
+      state->tokens[1].setAbort();
+      return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Aborted");
+    }
+    state->cv.wait_for(lock, kAbortPollInterval);
+  }
+  for (size_t i = 0; i < indices.size(); ++i) {
+    if (state->done[i]) {
+      record(indices[i], state->responses[i], state->elapsed[i]);
+    } else {
+      state->tokens[i].setAbort();
+    }
+  }
+  if (winner < indices.size()) {
+    LOG_DEBUG << "Mirror " << url(indices[winner]) << " answered first";
+    return state->responses[winner];
+  }
+  return state->responses[0];
+}
+
+HttpResponse MirrorSet::fetch(const Request &request, const api::FlowControlToken *flow_control) {
+  const std::vector<size_t> order = ranked();
+  bool first_request = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    first_request = !raced_;
+    raced_ = true;
+  }
+  HttpResponse response;
+  size_t next = 0;
+  if (first_request && order.size() >= 2) {
+    response = race(request, order[0], order[1], flow_control);
+    next = 2;
+  } else {
+    response = timed(request, order[0], flow_control);
+    next = 1;
+  }
+  for (; next < order.size(); ++next) {
+    if (answered(response) || (flow_control != nullptr && flow_control->hasAborted())) {
+      break;
+    }
+    LOG_WARNING << "Request failed: " << response.getStatusStr() << ", trying mirror " << url(order[next]);
+    response = timed(request, order[next], flow_control);
+  }
+  return response;
+}
@@ -0,0 +1,93 @@
+#ifndef HTTP_MIRROR_SET_H_
+#define HTTP_MIRROR_SET_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "http/httpinterface.h"
+
+namespace api {
+class FlowControlToken;
+}
+
+/**
+ * The base URLs that serve the same content, a server and its mirrors, and
+ * how well each of them did so far. Requests go to the best of them first and
+ * move on to the next one when a mirror fails.
+ *
+ * The mirrors are ranked by the time they are expected to take for a
+ * response of kReferenceSize, from the latency and the throughput measured on
+ * their responses, divided by their weight. The ones that failed last come
+ * after the others, and the ones not measured yet after the measured ones, by
+ * weight and then in the order given.
+ */
+class MirrorSet {
+ public:
+  using clock = std::chrono::steady_clock;
+  // Make a request to the given base URL
+  using Request = std::function<HttpResponse(const std::string &base, const api::FlowControlToken *flow_control)>;
+
+  // Size of the responses the mirrors are compared for
+  static constexpr uint64_t kReferenceSize{1024 * 1024};
+  // Smallest response the throughput is measured on, the others measure the latency
+  static constexpr uint64_t kMinThroughputSample{64 * 1024};
+
+  /**
+   * @param primary The server, tried first while nothing is measured
+   * @param mirrors Its mirrors as "url,url", each optionally followed by a
+   *                weight as in "https://mirror.example.com 2"; the default
+   *                weight, and the one of the server, is 1
+   */
+  explicit MirrorSet(const std::string &primary, const std::string &mirrors = "");
+
+  size_t size() const { return mirrors_.size(); }
+  const std::string &url(size_t index) const { return mirrors_[index].url; }
+  /** Indices of the mirrors, best first. */
+  std::vector<size_t> ranked() const;
+
+  /** A response of the given size was received from the mirror in elapsed. */
+  void recordSuccess(size_t index, uint64_t bytes, clock::duration elapsed);
+  /** The mirror failed to respond, or stalled. */
+  void recordFailure(size_t index);
+
+  /**
+   * Whether the response is the answer of the server, as opposed to a failure
+   * of the mirror that another mirror may not have.
+   */
+  static bool answered(const HttpResponse &response);
+
+  /**
+   * Make the request to the mirrors, best first, until one of them answers or
+   * the caller aborts. The first request made while nothing is measured goes
+   * to the two best mirrors at the same time, and the answer of the faster
+   * one is taken while the other is aborted.
+   *
+   * The request is copied to the threads of the race, which it may outlive:
+   * it must only refer to what it owns.
+   */
+  HttpResponse fetch(const Request &request, const api::FlowControlToken *flow_control);
+
+ private:
+  struct Mirror {
+    std::string url;
+    double weight{1.};
+    // Moving averages; 0 until measured
+    double latency_sec{0.};
+    double bytes_per_sec{0.};
+    unsigned int failures{0};
+  };
+
+  HttpResponse race(const Request &request, size_t first, size_t second, const api::FlowControlToken *flow_control);
+  HttpResponse timed(const Request &request, size_t index, const api::FlowControlToken *flow_control);
+  void record(size_t index, const HttpResponse &response, clock::duration elapsed);
+
+  std::vector<Mirror> mirrors_;
+  mutable std::mutex mutex_;
+  bool raced_{false};
+};
+
+#endif  // HTTP_MIRROR_SET_H_
@@ -0,0 +1,160 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http/mirror_set.h"
+#include "logging/logging.h"
+#include "utilities/flow_control.h"
+
+static HttpResponse ok(const std::string& body) { return HttpResponse(body, 200, CURLE_OK, ""); }
+
+static HttpResponse unreachable() {
+  return HttpResponse("", 0, CURLE_COULDNT_CONNECT, "Couldn't connect to server");
+}
+
+/* Mirrors are ranked by weight until measured, then by their measurements, with the failed ones last. */
+TEST(MirrorSet, Ranking) {
+  MirrorSet mirrors("https://server", "https://a, https://b 3,,https://c 0.5, https://d bad");
+  ASSERT_EQ(mirrors.size(), 5);
+  EXPECT_EQ(mirrors.url(1), "https://a");
+  EXPECT_EQ(mirrors.url(2), "https://b");
+  EXPECT_EQ(mirrors.url(4), "https://d");
+  EXPECT_EQ(mirrors.ranked(), (std::vector<size_t>{2, 0, 1, 4, 3}));
+
+  mirrors.recordSuccess(3, 0, std::chrono::milliseconds(100));
+  mirrors.recordSuccess(1, 0, std::chrono::milliseconds(10));
+  EXPECT_EQ(mirrors.ranked(), (std::vector<size_t>{1, 3, 2, 0, 4}));
+
+  // The weight scales the measurements.
+  mirrors.recordSuccess(2, 0, std::chrono::milliseconds(20));
+  EXPECT_EQ(mirrors.ranked(), (std::vector<size_t>{2, 1, 3, 0, 4}));
+
+  // The throughput of large responses counts as well as the latency.
+  mirrors.recordSuccess(0, 10 * MirrorSet::kReferenceSize, std::chrono::milliseconds(10));
+  EXPECT_EQ(mirrors.ranked()[0], 0);
+
+  mirrors.recordFailure(0);
+  mirrors.recordFailure(1);
+  mirrors.recordFailure(1);
+  EXPECT_EQ(mirrors.ranked(), (std::vector<size_t>{2, 3, 4, 0, 1}));
+  mirrors.recordSuccess(1, 0, std::chrono::milliseconds(10));
+  EXPECT_EQ(mirrors.ranked(), (std::vector<size_t>{2, 1, 3, 4, 0}));
+}
+
+/* A request moves on to the next mirror on network and server errors, but not on an answer of the server. */
+TEST(MirrorSet, Failover) {
+  MirrorSet mirrors("https://server", "https://a, https://b");
+  std::vector<std::string> tried;
+  std::mutex tried_mutex;
+  auto request = [&tried, &tried_mutex](const std::string& base, const api::FlowControlToken* token) {
+    (void)token;
+    {
+      std::lock_guard<std::mutex> lock(tried_mutex);
+      tried.push_back(base);
+    }
+    if (base == "https://server") {
+      return unreachable();
+    }
+    if (base == "https://a") {
+      return HttpResponse("", 503, CURLE_OK, "");
+    }
+    return ok(base);
+  };
+  // Raced on the server and the first mirror, then on to the next one
+  HttpResponse response = mirrors.fetch(request, nullptr);
+  EXPECT_TRUE(response.isOk());
+  EXPECT_EQ(response.body, "https://b");
+  EXPECT_EQ(tried.size(), 3);
+  EXPECT_EQ(mirrors.ranked()[0], 2);
+
+  tried.clear();
+  response = mirrors.fetch(request, nullptr);
+  EXPECT_EQ(response.body, "https://b");
+  EXPECT_EQ(tried, std::vector<std::string>{"https://b"});
+
+  MirrorSet missing("https://server", "https://a");
+  auto not_found = [](const std::string& base, const api::FlowControlToken* token) {
+    (void)base;
+    (void)token;
+    return HttpResponse("", 404, CURLE_OK, "");
+  };
+  response = missing.fetch(not_found, nullptr);
+  EXPECT_EQ(response.http_status_code, 404);
+  EXPECT_TRUE(MirrorSet::answered(response));
+  EXPECT_FALSE(MirrorSet::answered(unreachable()));
+}
+
+// Answers after delay, unless aborted before
+static HttpResponse slowResponse(const std::string& base, const api::FlowControlToken* token,
+                                 std::chrono::milliseconds delay) {
+  const auto end = std::chrono::steady_clock::now() + delay;
+  while (std::chrono::steady_clock::now() < end) {
+    if (token != nullptr && token->hasAborted()) {
+      return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Aborted");
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return ok(base);
+}
+
+/* The first request goes to the two best mirrors, the faster answer is taken and the other request aborted. */
+TEST(MirrorSet, Race) {
+  MirrorSet mirrors("https://slow", "https://fast, https://unused");
+  auto slow_aborted = std::make_shared<std::atomic<bool>>(false);
+  auto request = [slow_aborted](const std::string& base, const api::FlowControlToken* token) {
+    if (base == "https://unused") {
+      ADD_FAILURE() << "Request to the third mirror";
+    }
+    if (base == "https://slow") {
+      HttpResponse response = slowResponse(base, token, std::chrono::minutes(1));
+      *slow_aborted = response.wasInterrupted();
+      return response;
+    }
+    return slowResponse(base, token, std::chrono::milliseconds(50));
+  };
+  const auto start = std::chrono::steady_clock::now();
+  HttpResponse response = mirrors.fetch(request, nullptr);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(30));
+  EXPECT_EQ(response.body, "https://fast");
+  EXPECT_EQ(mirrors.ranked()[0], 1);
+  for (int i = 0; i < 100 && !*slow_aborted; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  }
+  EXPECT_TRUE(*slow_aborted);
+
+  // Only the first request is raced.
+  response = mirrors.fetch(request, nullptr);
+  EXPECT_EQ(response.body, "https://fast");
+}
+
+/* Aborting the caller stops a race at once. */
+TEST(MirrorSet, RaceAbort) {
+  MirrorSet mirrors("https://a", "https://b");
+  api::FlowControlToken token;
+  std::thread aborter([&token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    token.setAbort();
+  });
+  HttpResponse response = mirrors.fetch(
+      [](const std::string& base, const api::FlowControlToken* racer) {
+        return slowResponse(base, racer, std::chrono::seconds(5));
+      },
+      &token);
+  aborter.join();
+  EXPECT_TRUE(response.wasInterrupted());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
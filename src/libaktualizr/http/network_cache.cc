@@ -0,0 +1,303 @@
+#include "http/network_cache.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <ctime>
+
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+// How long libcurl keeps a DNS result by default, and thus one given with CURLOPT_RESOLVE
+static const int64_t kCurlDnsCacheSec = 60;
+
+static int64_t now() { return static_cast<int64_t>(std::time(nullptr)); }
+
+static int ctxIndex() {
+  static const int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+  return index;
+}
+
+// The new session callback of libcurl, which keeps its own sessions
+using NewSessionCallback = int (*)(SSL *, SSL_SESSION *);
+static std::atomic<NewSessionCallback> curl_new_session{nullptr};
+
+static NetworkCache *cacheOf(const SSL *ssl) {
+  return static_cast<NetworkCache *>(SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ctxIndex()));
+}
+
+static std::string sessionKey(const SSL *ssl) {
+  const char *name = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+  if (name == nullptr) {
+    return "";
+  }
+  std::string key(name);
+  X509 *cert = SSL_get_certificate(ssl);
+  std::array<unsigned char, EVP_MAX_MD_SIZE> md{};
+  unsigned int md_len = 0;
+  if (cert != nullptr && X509_digest(cert, EVP_sha256(), md.data(), &md_len) == 1) {
+    key += " " + boost::algorithm::hex(std::string(reinterpret_cast<const char *>(md.data()), md_len));
+  }
+  return key;
+}
+
+static int newSession(SSL *ssl, SSL_SESSION *sess) {
+  NetworkCache *cache = cacheOf(ssl);
+  const std::string key = sessionKey(ssl);
+  if (cache != nullptr && !key.empty() && SSL_SESSION_is_resumable(sess) == 1) {
+    const int len = i2d_SSL_SESSION(sess, nullptr);
+    if (len > 0) {
+      std::string der(static_cast<size_t>(len), '\0');
+      auto *p = reinterpret_cast<unsigned char *>(&der[0]);
+      i2d_SSL_SESSION(sess, &p);
+      const auto expires =
+          static_cast<int64_t>(SSL_SESSION_get_time(sess)) + static_cast<int64_t>(SSL_SESSION_get_timeout(sess));
+      cache->storeSession(key, der, expires);
+    }
+  }
+  const NewSessionCallback curl_cb = curl_new_session;
+  return curl_cb != nullptr ? curl_cb(ssl, sess) : 0;
+}
+
+// Before the ClientHello is sent, resume the stored session unless libcurl
+// has one of its own.
+static void sslInfo(const SSL *ssl, int where, int ret) {
+  (void)ret;
+  if ((where & SSL_CB_HANDSHAKE_START) == 0 || SSL_get_session(ssl) != nullptr) {
+    return;
+  }
+  NetworkCache *cache = cacheOf(ssl);
+  const std::string key = sessionKey(ssl);
+  std::string der;
+  if (cache == nullptr || key.empty() || !cache->session(key, &der)) {
+    return;
+  }
+  const auto *p = reinterpret_cast<const unsigned char *>(der.data());
+  SSL_SESSION *sess = d2i_SSL_SESSION(nullptr, &p, static_cast<long>(der.size()));  // NOLINT(google-runtime-int)
+  if (sess != nullptr) {
+    SSL_set_session(const_cast<SSL *>(ssl), sess);
+    SSL_SESSION_free(sess);
+  }
+}
+
+static bool opensslBackend() {
+  static const bool openssl = [] {
+    const curl_version_info_data *info = curl_version_info(CURLVERSION_NOW);
+    return info != nullptr && info->ssl_version != nullptr &&
+           boost::algorithm::starts_with(info->ssl_version, "OpenSSL");
+  }();
+  return openssl;
+}
+
+// Host and port of the URL of a transfer, unless the host is an address
+static bool hostPort(CURL *handle, std::string *host, std::string *port) {
+  char *url = nullptr;
+  if (curl_easy_getinfo(handle, CURLINFO_EFFECTIVE_URL, &url) != CURLE_OK || url == nullptr) {
+    return false;
+  }
+  CURLU *u = curl_url();
+  char *h = nullptr;
+  char *p = nullptr;
+  const bool ok = curl_url_set(u, CURLUPART_URL, url, 0) == CURLUE_OK &&
+                  curl_url_get(u, CURLUPART_HOST, &h, 0) == CURLUE_OK &&
+                  curl_url_get(u, CURLUPART_PORT, &p, CURLU_DEFAULT_PORT) == CURLUE_OK;
+  if (ok) {
+    *host = h;
+    *port = p;
+  }
+  curl_free(h);
+  curl_free(p);
+  curl_url_cleanup(u);
+  std::array<unsigned char, sizeof(struct in_addr)> addr{};
+  return ok && !host->empty() && (*host)[0] != '[' && inet_pton(AF_INET, host->c_str(), addr.data()) != 1;
+}
+
+NetworkCache::~NetworkCache() {
+  curl_slist_free_all(resolve_);
+  for (curl_slist *list : old_resolve_) {
+    curl_slist_free_all(list);
+  }
+}
+
+std::shared_ptr<NetworkCache> NetworkCache::global() {
+  static std::shared_ptr<NetworkCache> instance = std::make_shared<NetworkCache>();
+  return instance;
+}
+
+void NetworkCache::restore(const std::string &name, const std::string &value, int64_t expires) {
+  if (expires <= now()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (boost::algorithm::starts_with(name, "tls:")) {
+    sessions_[name.substr(4)] = Entry{value, expires};
+  } else if (boost::algorithm::starts_with(name, "dns:")) {
+    const std::string host_port = name.substr(4);
+    hosts_[host_port] = Entry{value, expires};
+    restored_.insert(host_port);
+    resolve_stale_ = true;
+  }
+}
+
+void NetworkCache::persistTo(Store store, std::chrono::seconds dns_ttl) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  store_ = std::move(store);
+  dns_ttl_ = dns_ttl;
+}
+
+void NetworkCache::attach(CURL *handle) {
+  if (!opensslBackend()) {
+    return;
+  }
+  if (curl_easy_setopt(handle, CURLOPT_SSL_CTX_FUNCTION, sslContext) != CURLE_OK ||
+      curl_easy_setopt(handle, CURLOPT_SSL_CTX_DATA, this) != CURLE_OK) {
+    LOG_DEBUG << "TLS sessions can't be kept with this libcurl";
+  }
+}
+
+CURLcode NetworkCache::sslContext(CURL *handle, void *ssl_ctx, void *userptr) {
+  (void)handle;
+  auto *ctx = static_cast<SSL_CTX *>(ssl_ctx);
+  SSL_CTX_set_ex_data(ctx, ctxIndex(), userptr);
+  SSL_CTX_set_session_cache_mode(ctx, SSL_CTX_get_session_cache_mode(ctx) | SSL_SESS_CACHE_CLIENT);
+  const NewSessionCallback current = SSL_CTX_sess_get_new_cb(ctx);
+  if (current != newSession) {
+    curl_new_session = current;
+    SSL_CTX_sess_set_new_cb(ctx, newSession);
+  }
+  SSL_CTX_set_info_callback(ctx, sslInfo);
+  return CURLE_OK;
+}
+
+void NetworkCache::prepare(CURL *handle) {
+#if LIBCURL_VERSION_NUM >= 0x074b00
+  std::lock_guard<std::mutex> guard(mutex_);
+  curlEasySetoptWrapper(handle, CURLOPT_RESOLVE, resolveList());
+#else
+  // Without the expiring entries of libcurl 7.75, a stale address would be used for good
+  (void)handle;
+#endif
+}
+
+curl_slist *NetworkCache::resolveList() {
+  const int64_t t = now();
+  if (!resolve_stale_ && (resolve_until_ == 0 || t < resolve_until_)) {
+    return resolve_;
+  }
+  if (resolve_ != nullptr) {
+    old_resolve_.push_back(resolve_);
+    resolve_ = nullptr;
+  }
+  resolve_until_ = 0;
+  auto until = [this](int64_t expires) {
+    resolve_until_ = resolve_until_ == 0 ? expires : std::min(resolve_until_, expires);
+  };
+  for (const auto &host_port : restored_) {
+    const auto it = hosts_.find(host_port);
+    if (it != hosts_.end() && it->second.expires > t) {
+      const std::string &value = it->second.value;
+      const std::string address = value.find(':') != std::string::npos ? "[" + value + "]" : value;
+      resolve_ = curl_slist_append(resolve_, ("+" + host_port + ":" + address).c_str());
+      until(it->second.expires);
+    }
+  }
+  for (auto it = failed_.begin(); it != failed_.end();) {
+    if (it->second <= t) {
+      it = failed_.erase(it);
+    } else {
+      resolve_ = curl_slist_append(resolve_, ("-" + it->first).c_str());
+      until(it->second);
+      ++it;
+    }
+  }
+  resolve_stale_ = false;
+  return resolve_;
+}
+
+std::vector<std::string> NetworkCache::resolveEntries() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  std::vector<std::string> entries;
+  for (const curl_slist *item = resolveList(); item != nullptr; item = item->next) {
+    entries.emplace_back(item->data);
+  }
+  return entries;
+}
+
+void NetworkCache::recordTransfer(CURL *handle, CURLcode result) {
+  std::string host;
+  std::string port;
+  const bool named = hostPort(handle, &host, &port);
+  const std::string host_port = host + ":" + port;
+  char *ip = nullptr;
+  long num_connects = 0;  // NOLINT(google-runtime-int)
+  if (!named || result != CURLE_OK || curl_easy_getinfo(handle, CURLINFO_PRIMARY_IP, &ip) != CURLE_OK ||
+      curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &num_connects) != CURLE_OK) {
+    ip = nullptr;
+  }
+#if LIBCURL_VERSION_NUM >= 0x080700
+  long used_proxy = 0;  // NOLINT(google-runtime-int)
+  if (curl_easy_getinfo(handle, CURLINFO_USED_PROXY, &used_proxy) == CURLE_OK && used_proxy != 0) {
+    // The address is the one of the proxy
+    ip = nullptr;
+  }
+#endif
+
+  Store store;
+  std::vector<std::pair<std::string, Entry>> pending;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const int64_t t = now();
+    if (named && restored_.erase(host_port) != 0) {
+      resolve_stale_ = true;
+      if (result == CURLE_COULDNT_CONNECT || result == CURLE_OPERATION_TIMEDOUT) {
+        failed_[host_port] = t + kCurlDnsCacheSec;
+        hosts_.erase(host_port);
+      }
+    }
+    if (ip != nullptr && *ip != '\0' && num_connects > 0 && store_) {
+      Entry &entry = hosts_[host_port];
+      // Written again when the address changes or half of its time is gone
+      if (entry.value != ip || entry.expires - t < dns_ttl_.count() / 2) {
+        entry = Entry{ip, t + dns_ttl_.count()};
+        pending_.emplace_back("dns:" + host_port, entry);
+      }
+    }
+    if (store_) {
+      store = store_;
+      pending.swap(pending_);
+    }
+  }
+  for (const auto &p : pending) {
+    try {
+      store(p.first, p.second.value, p.second.expires);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Failed to store " << p.first << ": " << e.what();
+    }
+  }
+}
+
+bool NetworkCache::session(const std::string &key, std::string *der) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  const auto it = sessions_.find(key);
+  if (it == sessions_.end() || it->second.expires <= now()) {
+    return false;
+  }
+  *der = it->second.value;
+  return true;
+}
+
+void NetworkCache::storeSession(const std::string &key, const std::string &der, int64_t expires) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  sessions_[key] = Entry{der, expires};
+  if (store_) {
+    pending_.emplace_back("tls:" + key, sessions_[key]);
+  }
+}
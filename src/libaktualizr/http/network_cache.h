@@ -0,0 +1,96 @@
+#ifndef HTTP_NETWORK_CACHE_H_
+#define HTTP_NETWORK_CACHE_H_
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <curl/curl.h>
+
+/**
+ * TLS sessions and DNS results that outlive the process, so that the first
+ * requests after a restart resume a TLS session instead of doing a full
+ * handshake, and don't wait for the DNS.
+ *
+ * The sessions are taken from and given to OpenSSL through the SSL_CTX of the
+ * connections, when libcurl uses OpenSSL. They are keyed by the server name
+ * and the client certificate, so that a new certificate never resumes a session
+ * of the previous one. libcurl still keeps its own sessions.
+ *
+ * The DNS results are the addresses that libcurl connected to. Those restored
+ * from storage are given to libcurl as CURLOPT_RESOLVE entries that expire with
+ * its DNS cache, until the first transfer to their host. An address that fails
+ * to connect is removed from the DNS cache of libcurl.
+ *
+ * New entries are handed to a store function after each transfer, with their
+ * expiry time in seconds since the epoch.
+ */
+class NetworkCache {
+ public:
+  using Store = std::function<void(const std::string &name, const std::string &value, int64_t expires)>;
+
+  NetworkCache() = default;
+  ~NetworkCache();
+  NetworkCache(const NetworkCache &) = delete;
+  NetworkCache(NetworkCache &&) = delete;
+  NetworkCache &operator=(const NetworkCache &) = delete;
+  NetworkCache &operator=(NetworkCache &&) = delete;
+
+  static std::shared_ptr<NetworkCache> global();
+
+  /** Add an entry loaded from storage; ignored if unknown or expired. */
+  void restore(const std::string &name, const std::string &value, int64_t expires);
+  /** Hand the new entries to store, DNS results kept for dns_ttl. */
+  void persistTo(Store store, std::chrono::seconds dns_ttl);
+
+  /** Resume and record the TLS sessions of the connections of a handle and its copies. */
+  void attach(CURL *handle);
+  /** Apply the restored DNS results to a transfer about to start. */
+  void prepare(CURL *handle);
+  /** Record the address a finished transfer connected to, and store the new entries. */
+  void recordTransfer(CURL *handle, CURLcode result);
+
+  // Used by the OpenSSL callbacks, and the tests. The key is the server name
+  // and the SHA-256 of the client certificate.
+  bool session(const std::string &key, std::string *der) const;
+  void storeSession(const std::string &key, const std::string &der, int64_t expires);
+  // The CURLOPT_RESOLVE entries given to the next transfers
+  std::vector<std::string> resolveEntries();
+
+ private:
+  struct Entry {
+    std::string value;
+    int64_t expires{0};
+  };
+
+  static CURLcode sslContext(CURL *handle, void *ssl_ctx, void *userptr);
+  // Under mutex_
+  curl_slist *resolveList();
+
+  mutable std::mutex mutex_;
+  Store store_;
+  std::chrono::seconds dns_ttl_{0};
+  std::map<std::string, Entry> sessions_;
+  // host:port -> address, as connected to
+  std::map<std::string, Entry> hosts_;
+  // Restored from storage, and not yet connected to
+  std::set<std::string> restored_;
+  // Restored addresses that failed, to remove from the DNS cache of libcurl
+  std::map<std::string, int64_t> failed_;
+  std::vector<std::pair<std::string, Entry>> pending_;
+  // The CURLOPT_RESOLVE list of the transfers, rebuilt when it changes; the
+  // previous ones may still be in use by running transfers
+  curl_slist *resolve_{nullptr};
+  bool resolve_stale_{true};
+  // When an entry of resolve_ expires
+  int64_t resolve_until_{0};
+  std::vector<curl_slist *> old_resolve_;
+};
+
+#endif  // HTTP_NETWORK_CACHE_H_
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "http/network_cache.h"
+#include "utilities/utils.h"
+
+static int64_t now() { return static_cast<int64_t>(std::time(nullptr)); }
+
+/* Only the entries that have not expired are restored, and the addresses expire with the DNS cache of libcurl. */
+TEST(NetworkCache, Restore) {
+  NetworkCache cache;
+  cache.restore("dns:example.com:443", "192.0.2.1", now() + 100);
+  cache.restore("dns:example.net:8443", "2001:db8::1", now() + 100);
+  cache.restore("dns:example.org:443", "192.0.2.3", now() - 1);
+  cache.restore("tls:example.com ABCD", "session", now() + 100);
+  cache.restore("tls:example.org ABCD", "expired", now() - 1);
+  cache.restore("unknown", "value", now() + 100);
+
+#if LIBCURL_VERSION_NUM >= 0x074b00
+  const std::vector<std::string> expected{"+example.com:443:192.0.2.1", "+example.net:8443:[2001:db8::1]"};
+  EXPECT_EQ(cache.resolveEntries(), expected);
+#endif
+  std::string der;
+  EXPECT_TRUE(cache.session("example.com ABCD", &der));
+  EXPECT_EQ(der, "session");
+  EXPECT_FALSE(cache.session("example.org ABCD", &der));
+  EXPECT_FALSE(cache.session("example.com EF01", &der));
+}
+
+/* New sessions are stored after the next transfer, and a restored address that fails is removed from libcurl. */
+TEST(NetworkCache, RecordTransfer) {
+  NetworkCache cache;
+  std::map<std::string, std::string> stored;
+  cache.persistTo([&stored](const std::string &name, const std::string &value,
+                            int64_t expires) { stored[name] = value + (expires > now() ? "" : " expired"); },
+                  std::chrono::seconds(300));
+  cache.restore("dns:localhost:1", "127.0.0.1", now() + 100);
+  cache.storeSession("example.com ABCD", "session", now() + 100);
+  EXPECT_TRUE(stored.empty());
+
+  // Nothing listens on port 1
+  CURL *handle = curl_easy_init();
+  ASSERT_NE(handle, nullptr);
+  curlEasySetoptWrapper(handle, CURLOPT_URL, "http://localhost:1/");
+  cache.prepare(handle);
+  const CURLcode result = curl_easy_perform(handle);
+  EXPECT_EQ(result, CURLE_COULDNT_CONNECT);
+  cache.recordTransfer(handle, result);
+  curl_easy_cleanup(handle);
+
+  const std::map<std::string, std::string> expected{{"tls:example.com ABCD", "session"}};
+  EXPECT_EQ(stored, expected);
+#if LIBCURL_VERSION_NUM >= 0x074b00
+  EXPECT_EQ(cache.resolveEntries(), std::vector<std::string>{"-localhost:1"});
+#endif
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
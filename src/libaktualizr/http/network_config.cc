@@ -0,0 +1,39 @@
+#include "libaktualizr/config.h"
+
+#include "utilities/config_utils.h"
+
+void NetworkConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
+  CopyFromConfig(share_connections, "share_connections", pt);
+  CopyFromConfig(compression, "compression", pt);
+  CopyFromConfig(compression_threshold, "compression_threshold", pt);
+  CopyFromConfig(bandwidth_shaping, "bandwidth_shaping", pt);
+  CopyFromConfig(bandwidth_share, "bandwidth_share", pt);
+  CopyFromConfig(bandwidth_ceiling, "bandwidth_ceiling", pt);
+  CopyFromConfig(event_loop, "event_loop", pt);
+  CopyFromConfig(persist_sessions, "persist_sessions", pt);
+  CopyFromConfig(dns_cache_ttl_sec, "dns_cache_ttl_sec", pt);
+  CopyFromConfig(link_aware, "link_aware", pt);
+  CopyFromConfig(link_state_file, "link_state_file", pt);
+  CopyFromConfig(metered_policy, "metered_policy", pt);
+  CopyFromConfig(roaming_policy, "roaming_policy", pt);
+  CopyFromConfig(throttled_rate, "throttled_rate", pt);
+  CopyFromConfig(record_file, "record_file", pt);
+}
+
+void NetworkConfig::writeToStream(std::ostream& out_stream) const {
+  writeOption(out_stream, share_connections, "share_connections");
+  writeOption(out_stream, compression, "compression");
+  writeOption(out_stream, compression_threshold, "compression_threshold");
+  writeOption(out_stream, bandwidth_shaping, "bandwidth_shaping");
+  writeOption(out_stream, bandwidth_share, "bandwidth_share");
+  writeOption(out_stream, bandwidth_ceiling, "bandwidth_ceiling");
+  writeOption(out_stream, event_loop, "event_loop");
+  writeOption(out_stream, persist_sessions, "persist_sessions");
+  writeOption(out_stream, dns_cache_ttl_sec, "dns_cache_ttl_sec");
+  writeOption(out_stream, link_aware, "link_aware");
+  writeOption(out_stream, link_state_file, "link_state_file");
+  writeOption(out_stream, metered_policy, "metered_policy");
+  writeOption(out_stream, roaming_policy, "roaming_policy");
+  writeOption(out_stream, throttled_rate, "throttled_rate");
+  writeOption(out_stream, record_file, "record_file");
+}
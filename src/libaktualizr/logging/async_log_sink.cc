@@ -0,0 +1,229 @@
+#include "async_log_sink.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <boost/log/attributes/value_extraction.hpp>
+
+#include "utilities/allocation_accounting.h"
+
+bool StreamLogOutput::write(boost::log::trivial::severity_level severity, const std::string &text) {
+  (void)severity;
+  stream_ << text << '\n';
+  return stream_.good();
+}
+
+JournalLogOutput::JournalLogOutput(const std::string &socket_path)
+    : identifier_{program_invocation_short_name} {
+  sockaddr_un sa{};
+  if (socket_path.size() >= sizeof(sa.sun_path)) {
+    throw std::invalid_argument("Invalid journal socket path: " + socket_path);
+  }
+  fd_ = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (fd_ == -1) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  sa.sun_family = AF_UNIX;
+  std::memcpy(&sa.sun_path[0], socket_path.c_str(), socket_path.size() + 1);
+  if (connect(fd_, reinterpret_cast<const sockaddr *>(&sa), sizeof(sa)) == -1) {
+    const int err = errno;
+    close(fd_);
+    throw std::system_error(err, std::system_category(), "connect to " + socket_path);
+  }
+}
+
+JournalLogOutput::~JournalLogOutput() { close(fd_); }
+
+std::string JournalLogOutput::entry(boost::log::trivial::severity_level severity, const std::string &text,
+                                    const std::string &identifier) {
+  // The priorities of syslog
+  static const int priorities[] = {7, 7, 6, 4, 3, 2};
+  const auto level = static_cast<size_t>(severity);
+  std::string entry;
+  entry += "PRIORITY=" + std::to_string(level < 6 ? priorities[level] : 6) + "\n";
+  entry += "SYSLOG_IDENTIFIER=" + identifier + "\n";
+  entry += std::string("AKTUALIZR_SEVERITY=") + boost::log::trivial::to_string(severity) + "\n";
+  entry += "TID=" + std::to_string(syscall(SYS_gettid)) + "\n";
+  // The binary form, which the message can have line breaks in: the name, a
+  // line break, the size as a little-endian 64-bit integer and the data.
+  entry += "MESSAGE\n";
+  uint64_t size = text.size();
+  for (int i = 0; i < 8; ++i) {
+    entry += static_cast<char>(size & 0xFFU);
+    size >>= 8U;
+  }
+  entry += text;
+  entry += '\n';
+  return entry;
+}
+
+bool JournalLogOutput::write(boost::log::trivial::severity_level severity, const std::string &text) {
+  const std::string datagram = entry(severity, text, identifier_);
+  return send(fd_, datagram.data(), datagram.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(datagram.size());
+}
+
+AsyncLogBackend::AsyncLogBackend(std::unique_ptr<LogOutput> output, size_t capacity) : output_{std::move(output)} {
+  if (capacity == 0) {
+    return;
+  }
+  size_t size = 1;
+  while (size < capacity) {
+    size <<= 1U;
+  }
+  slots_ = std::vector<Slot>(size);
+  for (size_t i = 0; i < size; ++i) {
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  mask_ = size - 1;
+  wake_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd_ == -1) {
+    throw std::system_error(errno, std::system_category(), "eventfd");
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+AsyncLogBackend::~AsyncLogBackend() {
+  stop();
+  if (wake_fd_ != -1) {
+    close(wake_fd_);
+  }
+}
+
+bool AsyncLogBackend::push(boost::log::trivial::severity_level severity, const std::string &text) {
+  size_t position = head_.load(std::memory_order_relaxed);
+  Slot *slot;
+  for (;;) {
+    slot = &slots_[position & mask_];
+    const size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    if (sequence == position) {
+      if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (sequence < position) {
+      // Not taken by the consumer yet since the last round: full
+      return false;
+    } else {
+      position = head_.load(std::memory_order_relaxed);
+    }
+  }
+  slot->severity = severity;
+  slot->text = text;
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool AsyncLogBackend::pop(Slot *entry) {
+  Slot &slot = slots_[tail_ & mask_];
+  if (slot.sequence.load(std::memory_order_acquire) != tail_ + 1) {
+    return false;
+  }
+  entry->severity = slot.severity;
+  entry->text.swap(slot.text);
+  // Free for the producer of the next round
+  slot.sequence.store(tail_ + mask_ + 1, std::memory_order_release);
+  ++tail_;
+  return true;
+}
+
+bool AsyncLogBackend::drain() {
+  bool wrote = false;
+  if (!slots_.empty()) {
+    Slot entry;
+    while (pop(&entry)) {
+      output_->write(entry.severity, entry.text);
+      wrote = true;
+    }
+  }
+  const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reported_dropped_) {
+    output_->write(boost::log::trivial::warning,
+                   std::to_string(dropped - reported_dropped_) + " log messages were dropped: the queue was full");
+    reported_dropped_ = dropped;
+    wrote = true;
+  }
+  if (wrote) {
+    output_->flush();
+  }
+  return wrote;
+}
+
+void AsyncLogBackend::run() {
+  const AllocationAccounting::Scope accounting(AllocationTag::kLogging);
+  while (!stop_.load()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (drain()) {
+        continue;
+      }
+    }
+    sleeping_.store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool empty;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      empty = slots_[tail_ & mask_].sequence.load(std::memory_order_acquire) != tail_ + 1;
+    }
+    if (empty && !stop_.load()) {
+      pollfd pfd{wake_fd_, POLLIN, 0};
+      if (poll(&pfd, 1, -1) > 0) {
+        uint64_t count;
+        if (read(wake_fd_, &count, sizeof(count)) != sizeof(count)) {
+          // Reset by a concurrent wake-up
+        }
+      }
+    }
+    sleeping_.store(false);
+  }
+}
+
+void AsyncLogBackend::consume(const boost::log::record_view &rec, const string_type &text) {
+  const AllocationAccounting::Scope accounting(AllocationTag::kLogging);
+  const auto value = boost::log::extract<boost::log::trivial::severity_level>("Severity", rec);
+  const auto severity = value ? value.get() : boost::log::trivial::info;
+  if (slots_.empty() || severity >= boost::log::trivial::error || stop_.load(std::memory_order_relaxed)) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    drain();
+    if (!output_->write(severity, text)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    output_->flush();
+    return;
+  }
+  if (!push(severity, text)) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)) {
+    const uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+      // The counter is already at its maximum, the writer is awake anyway
+    }
+  }
+}
+
+void AsyncLogBackend::flush() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  drain();
+}
+
+void AsyncLogBackend::stop() {
+  if (thread_.joinable()) {
+    stop_.store(true);
+    const uint64_t one = 1;
+    if (write(wake_fd_, &one, sizeof(one)) != sizeof(one)) {
+      // The counter is already at its maximum, the writer wakes up anyway
+    }
+    thread_.join();
+  }
+  flush();
+}
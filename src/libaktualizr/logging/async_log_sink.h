@@ -0,0 +1,127 @@
+#ifndef LOGGING_ASYNC_LOG_SINK_H_
+#define LOGGING_ASYNC_LOG_SINK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/log/sinks/basic_sink_backend.hpp>
+#include <boost/log/trivial.hpp>
+
+/** Where the log records end up. */
+class LogOutput {
+ public:
+  LogOutput() = default;
+  virtual ~LogOutput() = default;
+  LogOutput(const LogOutput &) = delete;
+  LogOutput(LogOutput &&) = delete;
+  LogOutput &operator=(const LogOutput &) = delete;
+  LogOutput &operator=(LogOutput &&) = delete;
+
+  // False if the record could not be written
+  virtual bool write(boost::log::trivial::severity_level severity, const std::string &text) = 0;
+  virtual void flush() {}
+};
+
+class StreamLogOutput : public LogOutput {
+ public:
+  explicit StreamLogOutput(std::ostream &stream) : stream_{stream} {}
+  bool write(boost::log::trivial::severity_level severity, const std::string &text) override;
+  void flush() override { stream_.flush(); }
+
+ private:
+  std::ostream &stream_;
+};
+
+/**
+ * Sends the records straight to the systemd journal, with their priority and
+ * severity as fields of their own, using its native datagram protocol.
+ */
+class JournalLogOutput : public LogOutput {
+ public:
+  explicit JournalLogOutput(const std::string &socket_path = "/run/systemd/journal/socket");
+  ~JournalLogOutput() override;
+  JournalLogOutput(const JournalLogOutput &) = delete;
+  JournalLogOutput(JournalLogOutput &&) = delete;
+  JournalLogOutput &operator=(const JournalLogOutput &) = delete;
+  JournalLogOutput &operator=(JournalLogOutput &&) = delete;
+
+  bool write(boost::log::trivial::severity_level severity, const std::string &text) override;
+  // A journal datagram for a record
+  static std::string entry(boost::log::trivial::severity_level severity, const std::string &text,
+                           const std::string &identifier);
+
+ private:
+  int fd_{-1};
+  std::string identifier_;
+};
+
+/**
+ * A Boost.Log sink backend that leaves the writing of the records to a thread
+ * of its own, so that logging costs the threads that log no more than the
+ * formatting of the message: the records go through a bounded lock-free
+ * queue, and those that find it full are dropped and counted. The writer
+ * thread takes all the queued records at once and flushes after each batch,
+ * and sleeps on an eventfd when there are none.
+ *
+ * Errors and fatal errors are written on the thread that logs them, after the
+ * queued records, so that none is lost when the process ends right after.
+ *
+ * With a capacity of 0, all the records are written on the thread that logs
+ * them.
+ */
+class AsyncLogBackend
+    : public boost::log::sinks::basic_formatted_sink_backend<char, boost::log::sinks::concurrent_feeding> {
+ public:
+  AsyncLogBackend(std::unique_ptr<LogOutput> output, size_t capacity);
+  ~AsyncLogBackend();
+  AsyncLogBackend(const AsyncLogBackend &) = delete;
+  AsyncLogBackend(AsyncLogBackend &&) = delete;
+  AsyncLogBackend &operator=(const AsyncLogBackend &) = delete;
+  AsyncLogBackend &operator=(AsyncLogBackend &&) = delete;
+
+  void consume(const boost::log::record_view &rec, const string_type &text);
+  /** Write all the queued records. */
+  void flush();
+  /** Write all the queued records and stop the writer thread. */
+  void stop();
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence{0};
+    boost::log::trivial::severity_level severity{boost::log::trivial::info};
+    std::string text;
+  };
+
+  bool push(boost::log::trivial::severity_level severity, const std::string &text);
+  bool pop(Slot *entry);
+  // Write the queued records, with the mutex held; false if there were none
+  bool drain();
+  void run();
+
+  std::unique_ptr<LogOutput> output_;
+  // A bounded multi-producer queue, after Dmitry Vyukov's: each slot tells by
+  // its sequence number whether it is free for the producer at that position
+  // or filled for the consumer.
+  std::vector<Slot> slots_;
+  size_t mask_{0};
+  std::atomic<size_t> head_{0};
+  size_t tail_{0};
+
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_dropped_{0};
+  std::atomic<bool> sleeping_{false};
+  std::atomic<bool> stop_{false};
+  int wake_fd_{-1};
+  // Serializes the writes to the output
+  std::mutex mutex_;
+  std::thread thread_;
+};
+
+#endif  // LOGGING_ASYNC_LOG_SINK_H_
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include <boost/log/core/core.hpp>
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/unlocked_frontend.hpp>
+
+#include "logging/async_log_sink.h"
+#include "logging/logging.h"
+
+namespace {
+class TestOutput : public LogOutput {
+ public:
+  bool write(boost::log::trivial::severity_level severity, const std::string &text) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (blocking) {
+      blocked = true;
+      cv.notify_all();
+      cv.wait(lock, [this] { return !blocking; });
+    }
+    records.emplace_back(severity, text);
+    return true;
+  }
+  void flush() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    ++flushes;
+  }
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool blocking{false};
+  bool blocked{false};
+  std::vector<std::pair<boost::log::trivial::severity_level, std::string>> records;
+  int flushes{0};
+};
+
+using Sink = boost::log::sinks::unlocked_sink<AsyncLogBackend>;
+
+boost::shared_ptr<Sink> addSink(TestOutput *output, size_t capacity) {
+  boost::log::core::get()->remove_all_sinks();
+  auto backend = boost::make_shared<AsyncLogBackend>(std::unique_ptr<LogOutput>(output), capacity);
+  auto sink = boost::make_shared<Sink>(backend);
+  sink->set_formatter(boost::log::expressions::stream << boost::log::expressions::smessage);
+  boost::log::core::get()->add_sink(sink);
+  return sink;
+}
+}  // namespace
+
+/* The records of each thread are all written, in order. */
+TEST(AsyncLogSink, Order) {
+  auto *output = new TestOutput();
+  auto sink = addSink(output, 64);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < 200; ++i) {
+        LOG_INFO << t << " " << i;
+        if (i % 50 == 0) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  // Logging outpaces the writer, drops are allowed but not reordering
+  sink->locked_backend()->stop();
+  std::array<int, 4> next{};
+  size_t written = 0;
+  for (const auto &record : output->records) {
+    if (record.second.find("dropped") != std::string::npos) {
+      continue;
+    }
+    const int t = std::stoi(record.second);
+    const int i = std::stoi(record.second.substr(record.second.find(' ') + 1));
+    EXPECT_GE(i, next[static_cast<size_t>(t)]);
+    next[static_cast<size_t>(t)] = i + 1;
+    ++written;
+  }
+  EXPECT_EQ(written + sink->locked_backend()->dropped(), 800);
+  boost::log::core::get()->remove_all_sinks();
+}
+
+/* The records that find the queue full are dropped and counted, and the
+ * errors are written right away, after the queued records. */
+TEST(AsyncLogSink, Drops) {
+  auto *output = new TestOutput();
+  auto sink = addSink(output, 4);
+  {
+    std::unique_lock<std::mutex> lock(output->mutex);
+    output->blocking = true;
+  }
+  LOG_INFO << "first";
+  {
+    std::unique_lock<std::mutex> lock(output->mutex);
+    output->cv.wait(lock, [output] { return output->blocked; });
+  }
+  for (int i = 0; i < 19; ++i) {
+    LOG_DEBUG << "queued " << i;
+  }
+  EXPECT_EQ(sink->locked_backend()->dropped(), 15);
+  {
+    std::lock_guard<std::mutex> lock(output->mutex);
+    output->blocking = false;
+  }
+  output->cv.notify_all();
+
+  LOG_ERROR << "error";
+  {
+    std::lock_guard<std::mutex> lock(output->mutex);
+    ASSERT_EQ(output->records.size(), 7);
+    EXPECT_EQ(output->records[0].second, "first");
+    EXPECT_EQ(output->records[4].second, "queued 3");
+    EXPECT_EQ(output->records[4].first, boost::log::trivial::debug);
+    EXPECT_EQ(output->records[5].second, "15 log messages were dropped: the queue was full");
+    EXPECT_EQ(output->records[6].second, "error");
+    EXPECT_EQ(output->records[6].first, boost::log::trivial::error);
+  }
+  sink->locked_backend()->stop();
+  EXPECT_GT(output->flushes, 0);
+  boost::log::core::get()->remove_all_sinks();
+}
+
+/* Without a queue, every record is written on the thread that logs it. */
+TEST(AsyncLogSink, Synchronous) {
+  auto *output = new TestOutput();
+  auto sink = addSink(output, 0);
+  LOG_INFO << "now";
+  {
+    std::lock_guard<std::mutex> lock(output->mutex);
+    ASSERT_EQ(output->records.size(), 1);
+    EXPECT_EQ(output->records[0].second, "now");
+  }
+  boost::log::core::get()->remove_all_sinks();
+}
+
+TEST(AsyncLogSink, JournalEntry) {
+  const std::string entry = JournalLogOutput::entry(boost::log::trivial::warning, "two\nlines", "aktualizr");
+  EXPECT_EQ(entry.rfind("PRIORITY=4\nSYSLOG_IDENTIFIER=aktualizr\nAKTUALIZR_SEVERITY=warning\nTID=", 0), 0);
+  const std::string message = std::string("MESSAGE\n") + '\x09' + std::string(7, '\0') + "two\nlines\n";
+  ASSERT_GT(entry.size(), message.size());
+  EXPECT_EQ(entry.substr(entry.size() - message.size()), message);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
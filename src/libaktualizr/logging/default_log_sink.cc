@@ -1,6 +1,8 @@
 #include <iomanip>
 #include <iostream>
 
+#include <boost/log/expressions.hpp>
+#include <boost/log/sinks/basic_sink_frontend.hpp>
 #include <boost/log/trivial.hpp>
 #include <boost/log/utility/setup/console.hpp>
 
@@ -40,3 +42,11 @@ void logger_init_sink(bool use_colors = false) {
     sink->set_formatter(&color_fmt);
   }
 }
+
+void logger_format_sink(boost::log::sinks::basic_formatting_sink_frontend<char>& sink, bool use_colors) {
+  if (use_colors) {
+    sink.set_formatter(&color_fmt);
+  } else {
+    sink.set_formatter(boost::log::expressions::stream << boost::log::expressions::smessage);
+  }
+}
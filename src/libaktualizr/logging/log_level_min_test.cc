@@ -0,0 +1,28 @@
+#include <gtest/gtest.h>
+
+// What a build with -DLOG_LEVEL_MIN=info gives
+#undef AKTUALIZR_LOG_LEVEL_MIN
+#define AKTUALIZR_LOG_LEVEL_MIN 2
+#include "logging/logging.h"
+
+/* The statements below the lowest level are not run, nor are their operands
+ * evaluated, whatever the threshold at runtime. */
+TEST(LogLevelMin, Discarded) {
+  logger_set_threshold(boost::log::trivial::trace);
+  int evaluated = 0;
+  auto operand = [&evaluated]() { return ++evaluated; };
+  LOG_TRACE << operand();
+  LOG_DEBUG << operand();
+  EXPECT_EQ(evaluated, 0);
+  LOG_INFO << operand();
+  LOG_WARNING << operand();
+  EXPECT_EQ(evaluated, 2);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
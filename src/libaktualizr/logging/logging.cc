@@ -1,20 +1,61 @@
 #include "logging.h"
 
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <mutex>
+
 #include <boost/log/core/core.hpp>
 #include <boost/log/expressions.hpp>
+#include <boost/log/sinks/unlocked_frontend.hpp>
 
 #include "libaktualizr/config.h"
+#include "logging/async_log_sink.h"
 
 using boost::log::trivial::severity_level;
 
 static severity_level gLoggingThreshold;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static bool gUseColors;                   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
 extern void logger_init_sink(bool use_colors = false);
+extern void logger_format_sink(boost::log::sinks::basic_formatting_sink_frontend<char>& sink, bool use_colors);
+
+namespace {
+// Records the writer thread holds at most before it drops new ones
+constexpr size_t kAsyncLogCapacity = 8192;
+
+struct LogSinks {
+  std::mutex mutex;
+  bool journal{false};
+  bool async{false};
+  boost::shared_ptr<boost::log::sinks::unlocked_sink<AsyncLogBackend>> sink;
+};
+
+LogSinks& logSinks() {
+  static LogSinks sinks;
+  return sinks;
+}
 
-int64_t get_curlopt_verbose() { return gLoggingThreshold <= boost::log::trivial::trace ? 1L : 0L; }
+// Write what is still queued when the program exits, before the sinks go away.
+void stopLogSink() {
+  auto& sinks = logSinks();
+  std::lock_guard<std::mutex> lock(sinks.mutex);
+  if (sinks.sink) {
+    boost::log::core::get()->remove_sink(sinks.sink);
+    sinks.sink->locked_backend()->stop();
+    sinks.sink.reset();
+  }
+}
+}  // namespace
+
+int64_t get_curlopt_verbose() {
+  // Like the trace statements, when they are not built in
+  return AKTUALIZR_LOG_LEVEL_MIN == 0 && gLoggingThreshold <= boost::log::trivial::trace ? 1L : 0L;
+}
 
 void logger_init(bool use_colors) {
   gLoggingThreshold = boost::log::trivial::info;
+  gUseColors = use_colors;
 
   logger_init_sink(use_colors);
 
@@ -39,6 +80,54 @@ void logger_set_threshold(const LoggerConfig& lconfig) {
   logger_set_threshold(static_cast<boost::log::trivial::severity_level>(loglevel));
 }
 
+void logger_set_output(const LoggerConfig& lconfig) {
+  std::unique_ptr<LogOutput> output;
+  if (lconfig.output == "journald") {
+    try {
+      output = std::make_unique<JournalLogOutput>();
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Could not log to the journal, logging to the console instead: " << e.what();
+    }
+  } else if (lconfig.output != "console") {
+    LOG_WARNING << "Invalid log output: " << lconfig.output;
+  }
+  const bool journal = output != nullptr;
+
+  auto& sinks = logSinks();
+  std::lock_guard<std::mutex> lock(sinks.mutex);
+  if (journal == sinks.journal && lconfig.async == sinks.async) {
+    return;
+  }
+  boost::log::core::get()->remove_all_sinks();
+  if (sinks.sink) {
+    sinks.sink->locked_backend()->stop();
+    sinks.sink.reset();
+  }
+  sinks.journal = journal;
+  sinks.async = lconfig.async;
+  if (!journal && !lconfig.async) {
+    logger_init_sink(gUseColors);
+    return;
+  }
+
+  if (!journal) {
+    output = std::make_unique<StreamLogOutput>(getenv("LOG_STDERR") == nullptr ? std::cout : std::cerr);
+  }
+  auto backend = boost::make_shared<AsyncLogBackend>(std::move(output), lconfig.async ? kAsyncLogCapacity : 0);
+  sinks.sink = boost::make_shared<boost::log::sinks::unlocked_sink<AsyncLogBackend>>(backend);
+  // The journal has the severity in a field of its own
+  logger_format_sink(*sinks.sink, gUseColors && !journal);
+  boost::log::core::get()->add_sink(sinks.sink);
+  static const bool registered = std::atexit(stopLogSink) == 0;
+  (void)registered;
+}
+
+uint64_t logger_dropped_messages() {
+  auto& sinks = logSinks();
+  std::lock_guard<std::mutex> lock(sinks.mutex);
+  return sinks.sink ? sinks.sink->locked_backend()->dropped() : 0;
+}
+
 void logger_set_enable(bool enabled) { boost::log::core::get()->set_logging_enabled(enabled); }
 
 int loggerGetSeverity() { return static_cast<int>(gLoggingThreshold); }
@@ -6,24 +6,54 @@
 
 struct LoggerConfig;
 
+// The lowest level of the log statements that are compiled in, 0-5 (trace,
+// debug, info, warning, error, fatal), set with the LOG_LEVEL_MIN CMake option
+#ifndef AKTUALIZR_LOG_LEVEL_MIN
+#define AKTUALIZR_LOG_LEVEL_MIN 0
+#endif
+
+// A log statement that is still compiled, so that it stays valid, but can't
+// run: nothing is left of it in the binary, its string literals included.
+#define LOG_DISCARDED(lvl) while (false) BOOST_LOG_TRIVIAL(lvl)
+
 /** Log an unrecoverable error */
 #define LOG_FATAL BOOST_LOG_TRIVIAL(fatal)
 
 /** Log that something has definitely gone wrong */
+#if AKTUALIZR_LOG_LEVEL_MIN > 4
+#define LOG_ERROR LOG_DISCARDED(error)
+#else
 #define LOG_ERROR BOOST_LOG_TRIVIAL(error)
+#endif
 
 /** Warn about behaviour that is probably bad, but hasn't yet caused the system
  * to operate out of spec. */
+#if AKTUALIZR_LOG_LEVEL_MIN > 3
+#define LOG_WARNING LOG_DISCARDED(warning)
+#else
 #define LOG_WARNING BOOST_LOG_TRIVIAL(warning)
+#endif
 
 /** Report a user-visible message about operation */
+#if AKTUALIZR_LOG_LEVEL_MIN > 2
+#define LOG_INFO LOG_DISCARDED(info)
+#else
 #define LOG_INFO BOOST_LOG_TRIVIAL(info)
+#endif
 
 /** Report a message for developer debugging */
+#if AKTUALIZR_LOG_LEVEL_MIN > 1
+#define LOG_DEBUG LOG_DISCARDED(debug)
+#else
 #define LOG_DEBUG BOOST_LOG_TRIVIAL(debug)
+#endif
 
 /** Report very-verbose debugging information */
+#if AKTUALIZR_LOG_LEVEL_MIN > 0
+#define LOG_TRACE LOG_DISCARDED(trace)
+#else
 #define LOG_TRACE BOOST_LOG_TRIVIAL(trace)
+#endif
 
 // Use like:
 // curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, get_curlopt_verbose());
@@ -35,6 +65,12 @@ void logger_set_threshold(boost::log::trivial::severity_level threshold);
 
 void logger_set_threshold(const LoggerConfig& lconfig);
 
+// Switch to the output and the asynchronous writing of the configuration
+void logger_set_output(const LoggerConfig& lconfig);
+
+// Records dropped by the asynchronous writer because its queue was full
+uint64_t logger_dropped_messages();
+
 void logger_set_enable(bool enabled);
 
 int loggerGetSeverity();
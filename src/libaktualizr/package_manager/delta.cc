@@ -0,0 +1,201 @@
+#include "package_manager/delta.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <fstream>
+#include <stdexcept>
+
+#include <bzlib.h>
+#include <boost/algorithm/string.hpp>
+
+std::vector<TargetDelta> TargetDelta::fromTarget(const Uptane::Target &target) {
+  std::vector<TargetDelta> deltas;
+  const Json::Value custom = target.custom_data();
+  if (!custom.isObject() || !custom["deltas"].isArray()) {
+    return deltas;
+  }
+  for (const auto &d : custom["deltas"]) {
+    if (!d.isObject() || d["format"].asString() != "bsdiff" || !d["from"].isString()) {
+      continue;
+    }
+    TargetDelta delta;
+    delta.from = boost::algorithm::to_lower_copy(d["from"].asString());
+    // Names the file of the base image, so nothing but a hash may get through
+    auto is_hex = [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) != 0; };
+    if (delta.from.size() != 64 || !std::all_of(delta.from.begin(), delta.from.end(), is_hex)) {
+      continue;
+    }
+    delta.patch = Uptane::Target(target.filename() + "." + delta.from + ".bsdiff", d);
+    delta.uri = d["uri"].asString();
+    if (delta.patch.hashes().empty() || delta.patch.length() == 0) {
+      continue;
+    }
+    deltas.push_back(std::move(delta));
+  }
+  return deltas;
+}
+
+namespace {
+
+constexpr size_t kChunkSize = 64 * 1024;
+
+// Integers in bsdiff patches are stored as 8 bytes little-endian sign and
+// magnitude.
+int64_t offtin(const unsigned char *buf) {
+  int64_t y = buf[7] & 0x7F;
+  for (int i = 6; i >= 0; --i) {
+    y = y * 256 + buf[i];
+  }
+  return ((buf[7] & 0x80) != 0) ? -y : y;
+}
+
+/**
+ * One of the bzip2-compressed blocks of a bsdiff patch.
+ */
+class Bz2Block {
+ public:
+  Bz2Block(const boost::filesystem::path &file, uint64_t offset, uint64_t length)
+      : in_{file.string(), std::ios::binary}, remaining_{length} {
+    if (!in_.good() || !in_.seekg(static_cast<std::streamoff>(offset))) {
+      throw std::runtime_error("Can't read patch " + file.string());
+    }
+    if (BZ2_bzDecompressInit(&strm_, 0, 0) != BZ_OK) {
+      throw std::runtime_error("Can't initialize bzip2 decompression");
+    }
+  }
+  ~Bz2Block() { BZ2_bzDecompressEnd(&strm_); }
+  Bz2Block(const Bz2Block &) = delete;
+  Bz2Block(Bz2Block &&) = delete;
+  Bz2Block &operator=(const Bz2Block &) = delete;
+  Bz2Block &operator=(Bz2Block &&) = delete;
+
+  // Read exactly `size` bytes, at most kChunkSize.
+  void read(char *out, size_t size) {
+    strm_.next_out = out;
+    strm_.avail_out = static_cast<unsigned int>(size);
+    while (strm_.avail_out > 0) {
+      if (end_) {
+        throw std::runtime_error("Truncated patch");
+      }
+      if (strm_.avail_in == 0 && remaining_ > 0) {
+        const auto len = static_cast<size_t>(std::min<uint64_t>(remaining_, buf_.size()));
+        in_.read(buf_.data(), static_cast<std::streamsize>(len));
+        if (static_cast<size_t>(in_.gcount()) != len) {
+          throw std::runtime_error("Truncated patch");
+        }
+        strm_.next_in = buf_.data();
+        strm_.avail_in = static_cast<unsigned int>(len);
+        remaining_ -= len;
+      }
+      const unsigned int avail_out = strm_.avail_out;
+      const int res = BZ2_bzDecompress(&strm_);
+      if (res == BZ_STREAM_END) {
+        end_ = true;
+      } else if (res != BZ_OK) {
+        throw std::runtime_error("Corrupted patch");
+      } else if (strm_.avail_in == 0 && remaining_ == 0 && strm_.avail_out == avail_out) {
+        throw std::runtime_error("Truncated patch");
+      }
+    }
+  }
+
+ private:
+  std::ifstream in_;
+  uint64_t remaining_;
+  bz_stream strm_{};
+  bool end_{false};
+  std::array<char, kChunkSize> buf_{};
+};
+
+}  // namespace
+
+void applyBsdiff(const boost::filesystem::path &old_file, const boost::filesystem::path &patch_file,
+                 const uint64_t new_size, const std::function<void(const char *data, size_t size)> &sink) {
+  static constexpr size_t kHeaderSize = 32;
+  const uint64_t patch_size = boost::filesystem::file_size(patch_file);
+  std::array<unsigned char, kHeaderSize> header{};
+  {
+    std::ifstream in(patch_file.string(), std::ios::binary);
+    in.read(reinterpret_cast<char *>(header.data()), header.size());
+    if (static_cast<size_t>(in.gcount()) != header.size() ||
+        std::string(reinterpret_cast<const char *>(header.data()), 8) != "BSDIFF40") {
+      throw std::runtime_error("Not a bsdiff patch: " + patch_file.string());
+    }
+  }
+  const int64_t ctrl_len = offtin(&header[8]);
+  const int64_t diff_len = offtin(&header[16]);
+  const int64_t header_new_size = offtin(&header[24]);
+  if (ctrl_len < 0 || diff_len < 0 || kHeaderSize + static_cast<uint64_t>(ctrl_len) + static_cast<uint64_t>(diff_len) >
+                                           patch_size) {
+    throw std::runtime_error("Corrupted patch header");
+  }
+  if (header_new_size < 0 || static_cast<uint64_t>(header_new_size) != new_size) {
+    throw std::runtime_error("Patch produces " + std::to_string(header_new_size) + " bytes instead of " +
+                             std::to_string(new_size));
+  }
+
+  const uint64_t diff_offset = kHeaderSize + static_cast<uint64_t>(ctrl_len);
+  const uint64_t extra_offset = diff_offset + static_cast<uint64_t>(diff_len);
+  Bz2Block ctrl(patch_file, kHeaderSize, static_cast<uint64_t>(ctrl_len));
+  Bz2Block diff(patch_file, diff_offset, static_cast<uint64_t>(diff_len));
+  Bz2Block extra(patch_file, extra_offset, patch_size - extra_offset);
+
+  std::ifstream old_in(old_file.string(), std::ios::binary);
+  if (!old_in.good()) {
+    throw std::runtime_error("Can't open base image " + old_file.string());
+  }
+  const auto old_size = static_cast<int64_t>(boost::filesystem::file_size(old_file));
+
+  std::vector<char> buf(kChunkSize);
+  std::vector<char> old_buf(kChunkSize);
+  int64_t old_pos = 0;
+  uint64_t new_pos = 0;
+  while (new_pos < new_size) {
+    // Copy x bytes of the base image with the diff added, then y bytes of
+    // extra data, then move z bytes in the base image.
+    std::array<unsigned char, 24> triple{};
+    ctrl.read(reinterpret_cast<char *>(triple.data()), triple.size());
+    const int64_t x = offtin(&triple[0]);
+    const int64_t y = offtin(&triple[8]);
+    const int64_t z = offtin(&triple[16]);
+    if (x < 0 || y < 0 || static_cast<uint64_t>(x) > new_size - new_pos ||
+        static_cast<uint64_t>(y) > new_size - new_pos - static_cast<uint64_t>(x)) {
+      throw std::runtime_error("Corrupted patch");
+    }
+
+    for (int64_t left = x; left > 0;) {
+      const auto len = static_cast<size_t>(std::min<int64_t>(left, kChunkSize));
+      diff.read(buf.data(), len);
+      // Parts outside of the base image are taken from the diff as they are.
+      const int64_t from = std::max<int64_t>(old_pos, 0);
+      const int64_t to = std::min<int64_t>(old_pos + static_cast<int64_t>(len), old_size);
+      if (from < to) {
+        old_in.seekg(from);
+        old_in.read(old_buf.data(), to - from);
+        if (old_in.gcount() != to - from) {
+          throw std::runtime_error("Can't read base image " + old_file.string());
+        }
+        for (int64_t i = from; i < to; ++i) {
+          auto &c = buf[static_cast<size_t>(i - old_pos)];
+          c = static_cast<char>(static_cast<unsigned char>(c) +
+                                static_cast<unsigned char>(old_buf[static_cast<size_t>(i - from)]));
+        }
+      }
+      sink(buf.data(), len);
+      old_pos += static_cast<int64_t>(len);
+      new_pos += len;
+      left -= static_cast<int64_t>(len);
+    }
+
+    for (int64_t left = y; left > 0;) {
+      const auto len = static_cast<size_t>(std::min<int64_t>(left, kChunkSize));
+      extra.read(buf.data(), len);
+      sink(buf.data(), len);
+      new_pos += len;
+      left -= static_cast<int64_t>(len);
+    }
+
+    old_pos += z;
+  }
+}
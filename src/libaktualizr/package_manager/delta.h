@@ -0,0 +1,54 @@
+#ifndef PACKAGE_MANAGER_DELTA_H_
+#define PACKAGE_MANAGER_DELTA_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/types.h"
+
+/**
+ * A binary diff that turns a base image into a Target, as listed in the
+ * custom metadata of the Target:
+ *
+ *     "custom": {
+ *       "deltas": [{
+ *         "format": "bsdiff",
+ *         "from": "<sha256 of the base image>",
+ *         "length": <length of the patch>,
+ *         "hashes": {"sha256": "<sha256 of the patch>"},
+ *         "uri": "<optional URL of the patch>"
+ *       }]
+ *     }
+ *
+ * The patch itself is verified against the hashes from the signed metadata
+ * before it is applied, and the result against the hashes of the Target.
+ */
+struct TargetDelta {
+  // sha256 of the base image, 64 lower case hex digits
+  std::string from;
+  // Name, hashes and length of the patch
+  Uptane::Target patch{Uptane::Target::Unknown()};
+  // Empty to use the default location next to the Target
+  std::string uri;
+
+  /** Supported deltas of a Target, in order of preference. */
+  static std::vector<TargetDelta> fromTarget(const Uptane::Target &target);
+};
+
+/**
+ * Apply a patch in the BSDIFF40 format of bsdiff 4.x.
+ *
+ * The base image is read as needed and the new image is handed to `sink` in
+ * chunks of up to 64 KiB, so neither of them is ever held in memory.
+ *
+ * @param new_size expected size of the new image
+ * @throw std::runtime_error if the patch is malformed or doesn't produce
+ * new_size bytes.
+ */
+void applyBsdiff(const boost::filesystem::path &old_file, const boost::filesystem::path &patch_file,
+                 uint64_t new_size, const std::function<void(const char *data, size_t size)> &sink);
+
+#endif  // PACKAGE_MANAGER_DELTA_H_
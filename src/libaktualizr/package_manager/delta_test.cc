@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "package_manager/delta.h"
+#include "utilities/utils.h"
+
+static const boost::filesystem::path base_file = "tests/test_data/delta/base.bin";
+static const boost::filesystem::path target_file = "tests/test_data/delta/target.bin";
+static const boost::filesystem::path patch_file = "tests/test_data/delta/target.bsdiff";
+
+static std::string apply(const boost::filesystem::path &patch, uint64_t size) {
+  std::string out;
+  applyBsdiff(base_file, patch, size, [&out](const char *data, size_t len) {
+    EXPECT_LE(len, 64 * 1024);
+    out.append(data, len);
+  });
+  return out;
+}
+
+/* A patch rebuilds the new image from the base image. */
+TEST(Delta, Apply) {
+  const std::string expected = Utils::readFile(target_file);
+  EXPECT_EQ(apply(patch_file, expected.size()), expected);
+}
+
+/* Malformed patches and unexpected sizes are rejected. */
+TEST(Delta, Invalid) {
+  const uint64_t size = boost::filesystem::file_size(target_file);
+  EXPECT_THROW(apply(patch_file, size + 1), std::runtime_error);
+  EXPECT_THROW(apply(base_file, size), std::runtime_error);
+
+  TemporaryFile truncated("patch");
+  const std::string patch = Utils::readFile(patch_file);
+  truncated.PutContents(patch.substr(0, patch.size() / 2));
+  EXPECT_THROW(apply(truncated.Path(), size), std::runtime_error);
+}
+
+/* Only bsdiff deltas with a base image and a verifiable patch are used. */
+TEST(Delta, FromTarget) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "8741f9d257aaef303943e8423db44fe55e221a0c37b12814db2df790e66aa0fc";
+  target_json["length"] = 144260;
+  Json::Value delta;
+  delta["format"] = "bsdiff";
+  delta["from"] = "B6F35D1C3DF59E3B04FAC9124E7761E3298D11A1E4A6D86BD26BB50CF3C9FA20";
+  delta["hashes"]["sha256"] = "0dad83e7423dc9c0d569635131aea1d17e4ae62327fd1ff155ef07e0e850f195";
+  delta["length"] = 249;
+  target_json["custom"]["deltas"].append(delta);
+  delta["format"] = "zchunk";
+  target_json["custom"]["deltas"].append(delta);
+  delta["format"] = "bsdiff";
+  delta.removeMember("hashes");
+  target_json["custom"]["deltas"].append(delta);
+  // The base image has to be named by its hash.
+  delta["hashes"]["sha256"] = "0dad83e7423dc9c0d569635131aea1d17e4ae62327fd1ff155ef07e0e850f195";
+  for (const auto &from : {"../../etc/shadow", "/etc/shadow", "b6f35d1c3df59e3b04fac9124e7761e3", ""}) {
+    delta["from"] = from;
+    target_json["custom"]["deltas"].append(delta);
+  }
+  // As long as a hash, but not one
+  delta["from"] = "../../../../../../../../../../../../../../../../../../etc/shadow";
+  target_json["custom"]["deltas"].append(delta);
+
+  const auto deltas = TargetDelta::fromTarget(Uptane::Target("target.bin", target_json));
+  ASSERT_EQ(deltas.size(), 1);
+  EXPECT_EQ(deltas[0].from, "b6f35d1c3df59e3b04fac9124e7761e3298d11a1e4a6d86bd26bb50cf3c9fa20");
+  EXPECT_EQ(deltas[0].patch.length(), 249);
+  EXPECT_EQ(deltas[0].patch.sha256Hash(), "0dad83e7423dc9c0d569635131aea1d17e4ae62327fd1ff155ef07e0e850f195");
+  EXPECT_TRUE(deltas[0].uri.empty());
+
+  EXPECT_TRUE(TargetDelta::fromTarget(Uptane::Target("target.bin", Json::Value())).empty());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,14 +1,18 @@
 #include <gtest/gtest.h>
 
 #include <sys/statvfs.h>
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <iostream>
 #include <string>
 #include <thread>
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/process.hpp>
 
+#include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
 #include "httpfake.h"
@@ -121,6 +125,67 @@ TEST(Fetcher, PauseOstree) {
   Uptane::Target target("pause", target_json);
   test_pause(target, PACKAGE_MANAGER_OSTREE);
 }
+
+static bool initOstreeSysroot(const boost::filesystem::path& path) {
+  if (system((std::string("ostree admin init-fs ") + path.string()).c_str()) != 0) {
+    return false;
+  }
+  return system((std::string("ostree config --repo=") + path.string() +
+                 std::string("/ostree/repo set core.mode bare-user-only"))
+                    .c_str()) == 0;
+}
+
+/* Pull the OSTree Target into a sysroot of its own, without any of its objects yet. */
+static bool fetchOstree(const api::FlowControlToken* token) {
+  TemporaryDirectory temp_dir;
+  Config ostree_config = config;
+  ostree_config.storage.path = temp_dir.Path();
+  ostree_config.pacman.images_path = temp_dir.Path() / "images";
+  ostree_config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  ostree_config.pacman.sysroot = temp_dir.Path() / "sysroot";
+  ostree_config.pacman.ostree_server = treehub_server;
+  if (!initOstreeSysroot(ostree_config.pacman.sysroot)) {
+    return false;
+  }
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(ostree_config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman =
+      PackageManagerFactory::makePackageManager(ostree_config.pacman, ostree_config.bootloader, storage, http);
+  KeyManager keys(storage, ostree_config.keymanagerConfig());
+  Uptane::Fetcher fetcher(ostree_config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "b9ac1e45f9227df8ee191b6e51e09417bd36c6ebbeff999431e3073ac50f0563";
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  target_json["length"] = 0;
+  Uptane::Target target("pause", target_json);
+  return pacman->fetchTarget(target, fetcher, keys, nullptr, token);
+}
+
+/* Pause an OSTree pull before it reports any progress, and resume it. */
+TEST(Fetcher, PauseOstreeBeforeProgress) {
+  api::FlowControlToken token;
+  EXPECT_TRUE(token.setPause(true));
+  auto result = std::async(std::launch::async, fetchOstree, &token);
+
+  EXPECT_EQ(result.wait_for(std::chrono::seconds(3)), std::future_status::timeout);
+  EXPECT_TRUE(token.setPause(false));
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(download_timeout)), std::future_status::ready);
+  EXPECT_TRUE(result.get());
+}
+
+/* Abort a paused OSTree pull without waiting for its requests. */
+TEST(Fetcher, AbortPausedOstree) {
+  api::FlowControlToken token;
+  EXPECT_TRUE(token.setPause(true));
+  auto result = std::async(std::launch::async, fetchOstree, &token);
+
+  EXPECT_EQ(result.wait_for(std::chrono::seconds(2)), std::future_status::timeout);
+  EXPECT_TRUE(token.setAbort());
+  ASSERT_EQ(result.wait_for(std::chrono::seconds(10)), std::future_status::ready);
+  EXPECT_FALSE(result.get());
+}
 #endif  // BUILD_OSTREE
 
 TEST(Fetcher, PauseBinary) {
@@ -132,6 +197,98 @@ TEST(Fetcher, PauseBinary) {
   test_pause(target);
 }
 
+// Counts the byte ranges requested
+class HttpRangeCounter : public HttpClient {
+ public:
+  HttpResponse downloadRange(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                             void* userp, curl_off_t from, curl_off_t to) override {
+    ++ranges;
+    return HttpClient::downloadRange(url, write_cb, progress_cb, userp, from, to);
+  }
+
+  std::atomic<int> ranges{0};
+};
+
+/* Download a large binary target as several parallel byte ranges. */
+TEST(Fetcher, DownloadSegmented) {
+  TemporaryDirectory temp_dir;
+  // A copy, for the other tests to download in one stream
+  Config segmented_config = config;
+  segmented_config.storage.path = temp_dir.Path();
+  segmented_config.pacman.images_path = temp_dir.Path() / "images";
+  segmented_config.pacman.download_segments = 4;
+  segmented_config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(segmented_config.storage, false));
+  auto http = std::make_shared<HttpRangeCounter>();
+  auto pacman =
+      std::make_shared<PackageManagerFake>(segmented_config.pacman, segmented_config.bootloader, storage, http);
+  KeyManager keys(storage, segmented_config.keymanagerConfig());
+  Uptane::Fetcher fetcher(segmented_config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100 * (1 << 20);
+  Uptane::Target target("large_file", target_json);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  const auto file = pacman->checkTargetFile(target);
+  ASSERT_TRUE(file);
+  EXPECT_FALSE(boost::filesystem::exists(file->second + ".segments"));
+  // Each range once
+  EXPECT_EQ(http->ranges, 4);
+}
+
+/* Abort a segmented download and resume it from the saved range state. */
+TEST(Fetcher, DownloadSegmentedResume) {
+  TemporaryDirectory temp_dir;
+  // A copy, for the other tests to download in one stream
+  Config segmented_config = config;
+  segmented_config.storage.path = temp_dir.Path();
+  segmented_config.pacman.images_path = temp_dir.Path() / "images";
+  segmented_config.pacman.download_segments = 4;
+  segmented_config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(segmented_config.storage, false));
+  auto http = std::make_shared<HttpClient>();
+  auto pacman =
+      std::make_shared<PackageManagerFake>(segmented_config.pacman, segmented_config.bootloader, storage, http);
+  KeyManager keys(storage, segmented_config.keymanagerConfig());
+  Uptane::Fetcher fetcher(segmented_config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100 * (1 << 20);
+  Uptane::Target target("large_file", target_json);
+
+  {
+    api::FlowControlToken token;
+    auto abort_cb = [&token](const Uptane::Target&, const std::string&, unsigned int progress) {
+      if (progress >= 30) {
+        token.setAbort();
+      }
+    };
+    EXPECT_FALSE(pacman->fetchTarget(target, fetcher, keys, abort_cb, &token));
+  }
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kIncomplete);
+  const auto file = pacman->checkTargetFile(target);
+  ASSERT_TRUE(file);
+  EXPECT_TRUE(boost::filesystem::exists(file->second + ".segments"));
+
+  unsigned int first_progress = 0;
+  auto resume_cb = [&first_progress](const Uptane::Target&, const std::string&, unsigned int progress) {
+    if (first_progress == 0) {
+      first_progress = progress;
+    }
+  };
+  api::FlowControlToken token;
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, resume_cb, &token));
+  EXPECT_GE(first_progress, 30);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  EXPECT_FALSE(boost::filesystem::exists(file->second + ".segments"));
+}
+
 class HttpCustomUri : public HttpFake {
  public:
   HttpCustomUri(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
@@ -322,6 +479,47 @@ TEST(Fetcher, NotEnoughDiskSpace) {
   EXPECT_EQ(http->counter, 1);
 }
 
+// Leaves the disk space to fallocate() to check.
+class PackageManagerNoSpaceCheck : public PackageManagerFake {
+ public:
+  using PackageManagerFake::PackageManagerFake;
+  bool checkAvailableDiskSpace(uint64_t required_bytes) const override {
+    (void)required_bytes;
+    return true;
+  }
+};
+
+/* A download that there is no room to preallocate is not started, and leaves
+ * neither its staging file nor the space it got reserved. */
+TEST(Fetcher, FailedPreallocation) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpZeroLength>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerNoSpaceCheck>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  struct statvfs stvfsbuf {};
+  ASSERT_EQ(statvfs(temp_dir.Path().c_str(), &stvfsbuf), 0);
+  const uint64_t available_bytes = (stvfsbuf.f_bsize * stvfsbuf.f_bavail);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9";
+  target_json["length"] = available_bytes * 2;
+  Uptane::Target target("fake_file", target_json);
+  EXPECT_FALSE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 0);
+  EXPECT_TRUE(!boost::filesystem::exists(config.pacman.images_path) ||
+              boost::filesystem::is_empty(config.pacman.images_path));
+  // Some of it may have been taken by others in the meantime.
+  ASSERT_EQ(statvfs(temp_dir.Path().c_str(), &stvfsbuf), 0);
+  EXPECT_GT(stvfsbuf.f_bsize * stvfsbuf.f_bavail, available_bytes / 2);
+}
+
 /* Abort downloading an OSTree target with the fake/binary package manager. */
 TEST(Fetcher, DownloadOstreeFail) {
   TemporaryDirectory temp_dir;
@@ -356,6 +554,314 @@ TEST(Fetcher, DownloadOstreeFail) {
   EXPECT_EQ(http->counter, 1);
 }
 
+class HttpTargetName : public HttpFake {
+ public:
+  HttpTargetName(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)progress_cb;
+    (void)from;
+
+    // The content is the last character of the target name.
+    std::string content = url.substr(url.size() - 1);
+    write_cb(&content[0], 1, 1, userp);
+    counter++;
+    return HttpResponse(content, 200, CURLE_OK, "");
+  }
+
+  int counter = 0;
+};
+
+static Uptane::Target oneByteTarget(const std::string& name, const std::string& sha256) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = sha256;
+  target_json["length"] = 1;
+  target_json["custom"]["targetFormat"] = "binary";
+  return Uptane::Target(name, target_json);
+}
+
+static const std::string sha256_a = "ca978112ca1bbdcafac231b39a23dc4da786eff8147c4e72b9807785afee48bb";
+static const std::string sha256_b = "3e23e8160039594a33894f6564e1b1348bbd7a0088d42c4acb73eeaed59c009d";
+static const std::string sha256_c = "2e7d2c03a9507ae265ecf5b5356885a53393a2029d241394997265a1a25aefc6";
+static const std::string sha256_d = "18ac3e7343f016890c510e93f935261169d9e3f565436429830faf0934f4f8e4";
+
+/* A target with the same content as an already downloaded one is not
+ * downloaded again, and the file is kept as long as a target refers to it. */
+TEST(Fetcher, ReuseSameContent) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpTargetName>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  const auto target = oneByteTarget("file_a", sha256_a);
+  const auto renamed = oneByteTarget("renamed_file_a", sha256_a);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(renamed, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 1);
+  EXPECT_EQ(pacman->verifyTarget(renamed), TargetStatus::kGood);
+  EXPECT_EQ(pacman->checkTargetFile(target)->second, pacman->checkTargetFile(renamed)->second);
+
+  const auto path = pacman->checkTargetFile(target)->second;
+  pacman->removeTargetFile(target);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kNotFound);
+  EXPECT_EQ(pacman->verifyTarget(renamed), TargetStatus::kGood);
+  pacman->removeTargetFile(renamed);
+  EXPECT_FALSE(boost::filesystem::exists(path));
+}
+
+/* The least recently used files are removed to stay within the images cache
+ * size. */
+TEST(Fetcher, EvictLeastRecentlyUsed) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = server;
+  PackageConfig pconfig = config.pacman;
+  pconfig.images_path = temp_dir.Path() / "images";
+  pconfig.images_cache_size = 2;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpTargetName>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(pconfig, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  const auto target_a = oneByteTarget("file_a", sha256_a);
+  const auto target_b = oneByteTarget("file_b", sha256_b);
+  const auto target_c = oneByteTarget("file_c", sha256_c);
+  EXPECT_TRUE(pacman->fetchTarget(target_a, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(target_b, fetcher, keys, progress_cb, nullptr));
+  // Already there: only marks it as used.
+  EXPECT_TRUE(pacman->fetchTarget(target_a, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target_b), TargetStatus::kGood);
+
+  EXPECT_TRUE(pacman->fetchTarget(target_c, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 3);
+  EXPECT_EQ(pacman->verifyTarget(target_a), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(target_b), TargetStatus::kNotFound);
+  EXPECT_EQ(pacman->verifyTarget(target_c), TargetStatus::kGood);
+}
+
+/* The images of the installed and pending Targets are never evicted. */
+TEST(Fetcher, EvictKeepsInstalled) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = server;
+  PackageConfig pconfig = config.pacman;
+  pconfig.images_path = temp_dir.Path() / "images";
+  pconfig.images_cache_size = 2;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpTargetName>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(pconfig, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  const auto target_a = oneByteTarget("file_a", sha256_a);
+  const auto target_b = oneByteTarget("file_b", sha256_b);
+  const auto target_c = oneByteTarget("file_c", sha256_c);
+  EXPECT_TRUE(pacman->fetchTarget(target_a, fetcher, keys, progress_cb, nullptr));
+  EXPECT_TRUE(pacman->fetchTarget(target_b, fetcher, keys, progress_cb, nullptr));
+  storage->savePrimaryInstalledVersion(target_a, InstalledVersionUpdateMode::kCurrent, "");
+  storage->savePrimaryInstalledVersion(target_b, InstalledVersionUpdateMode::kPending, "");
+
+  // Over the cache size, with nothing that may be removed
+  EXPECT_TRUE(pacman->fetchTarget(target_c, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->counter, 3);
+  EXPECT_EQ(pacman->verifyTarget(target_a), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(target_b), TargetStatus::kGood);
+  EXPECT_EQ(pacman->verifyTarget(target_c), TargetStatus::kGood);
+
+  // Once b is installed, a is no longer needed.
+  storage->savePrimaryInstalledVersion(target_b, InstalledVersionUpdateMode::kCurrent, "");
+  const auto target_d = oneByteTarget("file_d", sha256_d);
+  EXPECT_TRUE(pacman->fetchTarget(target_d, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(pacman->verifyTarget(target_a), TargetStatus::kNotFound);
+  EXPECT_EQ(pacman->verifyTarget(target_b), TargetStatus::kGood);
+}
+
+class HttpDelta : public HttpFake {
+ public:
+  HttpDelta(const boost::filesystem::path& test_dir_in) : HttpFake(test_dir_in) {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)progress_cb;
+    (void)from;
+
+    std::string content;
+    if (boost::algorithm::ends_with(url, ".bsdiff")) {
+      EXPECT_EQ(url, server + "/targets/target.bin." + sha256_base + ".bsdiff");
+      content = Utils::readFile("tests/test_data/delta/target.bsdiff");
+      patch_counter++;
+    } else {
+      EXPECT_EQ(url, server + "/targets/target.bin");
+      content = Utils::readFile("tests/test_data/delta/target.bin");
+      counter++;
+    }
+    write_cb(&content[0], 1, content.size(), userp);
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+
+  static const std::string sha256_base;
+  int counter = 0;
+  int patch_counter = 0;
+};
+
+const std::string HttpDelta::sha256_base = "b6f35d1c3df59e3b04fac9124e7761e3298d11a1e4a6d86bd26bb50cf3c9fa20";
+
+/* A Target with a delta against a local image is built from a patch, and
+ * downloaded in full if the patch is not usable. */
+TEST(Fetcher, DownloadDelta) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpDelta>(temp_dir.Path());
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  boost::filesystem::create_directories(config.pacman.images_path);
+  boost::filesystem::copy_file("tests/test_data/delta/base.bin",
+                               config.pacman.images_path / boost::algorithm::to_upper_copy(HttpDelta::sha256_base));
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "8741f9d257aaef303943e8423db44fe55e221a0c37b12814db2df790e66aa0fc";
+  target_json["length"] = 144260;
+  target_json["custom"]["targetFormat"] = "binary";
+  Json::Value delta;
+  delta["format"] = "bsdiff";
+  delta["from"] = HttpDelta::sha256_base;
+  delta["hashes"]["sha256"] = "0dad83e7423dc9c0d569635131aea1d17e4ae62327fd1ff155ef07e0e850f195";
+  delta["length"] = 249;
+  target_json["custom"]["deltas"].append(delta);
+  Uptane::Target target("target.bin", target_json);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->patch_counter, 1);
+  EXPECT_EQ(http->counter, 0);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+  pacman->removeTargetFile(target);
+
+  // A patch that doesn't match the metadata is not applied.
+  target_json["custom"]["deltas"][0]["hashes"]["sha256"] =
+      "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+  Uptane::Target bad_patch_target("target.bin", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(bad_patch_target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->patch_counter, 2);
+  EXPECT_EQ(http->counter, 1);
+  EXPECT_EQ(pacman->verifyTarget(bad_patch_target), TargetStatus::kGood);
+  pacman->removeTargetFile(bad_patch_target);
+
+  // A base image that is not named by its hash is never looked for.
+  boost::filesystem::copy_file("tests/test_data/delta/base.bin", temp_dir.Path() / "base.bin");
+  target_json["custom"]["deltas"][0]["from"] = "../base.bin";
+  target_json["custom"]["deltas"][0]["hashes"]["sha256"] =
+      "0dad83e7423dc9c0d569635131aea1d17e4ae62327fd1ff155ef07e0e850f195";
+  Uptane::Target escaping_target("target.bin", target_json);
+  EXPECT_TRUE(pacman->fetchTarget(escaping_target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->patch_counter, 2);
+  EXPECT_EQ(http->counter, 2);
+  EXPECT_EQ(pacman->verifyTarget(escaping_target), TargetStatus::kGood);
+}
+
+class HttpChunks : public HttpFake {
+ public:
+  HttpChunks(const boost::filesystem::path& test_dir_in, std::string content_in)
+      : HttpFake(test_dir_in), content{std::move(content_in)} {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    // A proxy mangles a byte of the first download
+    std::string data = content.substr(static_cast<size_t>(from));
+    if (downloads++ == 0) {
+      data[corrupt_at] ^= 1;
+    }
+    write_cb(&data[0], 1, data.size(), userp);
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+  HttpResponse downloadRange(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                             void* userp, curl_off_t from, curl_off_t to) override {
+    (void)url;
+    (void)progress_cb;
+    ranges.emplace_back(from, to);
+    std::string data = content.substr(static_cast<size_t>(from), static_cast<size_t>(to - from + 1));
+    write_cb(&data[0], 1, data.size(), userp);
+    return HttpResponse("", 206, CURLE_OK, "");
+  }
+
+  const std::string content;
+  size_t corrupt_at = 0;
+  int downloads = 0;
+  std::vector<std::pair<curl_off_t, curl_off_t>> ranges;
+};
+
+/* With the chunk hashes of a Target, only the chunks that don't match are
+ * downloaded again, both right after a download and for a stored file. */
+TEST(Fetcher, RepairChunks) {
+  TemporaryDirectory temp_dir;
+  config.storage.path = temp_dir.Path();
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.uptane.repo_server = server;
+
+  std::string content(10000, '\0');
+  for (size_t i = 0; i < content.size(); ++i) {
+    content[i] = static_cast<char>(i % 253);
+  }
+  std::shared_ptr<INvStorage> storage(new SQLStorage(config.storage, false));
+  auto http = std::make_shared<HttpChunks>(temp_dir.Path(), content);
+  http->corrupt_at = 4321;
+  auto pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  Uptane::Fetcher fetcher(config, http);
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Crypto::sha256digestHex(content);
+  target_json["length"] = Json::UInt64(content.size());
+  target_json["custom"]["chunks"]["size"] = 1000;
+  for (size_t offset = 0; offset < content.size(); offset += 1000) {
+    target_json["custom"]["chunks"]["sha256"].append(Crypto::sha256digestHex(content.substr(offset, 1000)));
+  }
+  Uptane::Target target("chunked_file", target_json);
+
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->downloads, 1);
+  ASSERT_EQ(http->ranges.size(), 1);
+  EXPECT_EQ(http->ranges[0].first, 4000);
+  EXPECT_EQ(http->ranges[0].second, 4999);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+
+  // The stored file gets corrupted.
+  const auto file = pacman->checkTargetFile(target);
+  ASSERT_TRUE(file);
+  std::string stored = Utils::readFile(file->second);
+  stored[9999] ^= 1;
+  Utils::writeFile(file->second, stored);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kHashMismatch);
+  EXPECT_TRUE(pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->downloads, 1);
+  ASSERT_EQ(http->ranges.size(), 2);
+  EXPECT_EQ(http->ranges[1].first, 9000);
+  EXPECT_EQ(http->ranges[1].second, 9999);
+  EXPECT_EQ(pacman->verifyTarget(target), TargetStatus::kGood);
+
+  // Without chunk hashes, the download fails.
+  target_json["custom"].removeMember("chunks");
+  Uptane::Target plain_target("plain_file", target_json);
+  http->downloads = 0;
+  pacman->removeTargetFile(target);
+  EXPECT_FALSE(pacman->fetchTarget(plain_target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(http->ranges.size(), 2);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -375,14 +881,7 @@ int main(int argc, char** argv) {
                                               std::string("-d"), treehub_dir.PathString(), std::string("-s0.5"),
                                               std::string("--create"));
   TemporaryDirectory temp_dir;
-  int r = system((std::string("ostree admin init-fs ") + temp_dir.PathString()).c_str());
-  if (r != 0) {
-    return -1;
-  }
-  r = system((std::string("ostree config --repo=") + temp_dir.PathString() +
-              std::string("/ostree/repo set core.mode bare-user-only"))
-                 .c_str());
-  if (r != 0) {
+  if (!initOstreeSysroot(temp_dir.Path())) {
     return -1;
   }
   sysroot = temp_dir.Path().string();
@@ -1,8 +1,16 @@
 #include "ostreemanager.h"
 
+#include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <fstream>
+#include <future>
+#include <mutex>
+#include <thread>
 
 #include <gio/gio.h>
 #include <json/json.h>
@@ -18,16 +26,105 @@
 #include "bootloader/bootloader.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/executor.h"
+#include "utilities/load_admission.h"
 #include "utilities/utils.h"
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 AUTO_REGISTER_PACKAGE_MANAGER(PACKAGE_MANAGER_OSTREE, OstreeManager);
 
+// How often a pull checks whether it is past its deadline
+static constexpr std::chrono::milliseconds kPullFlowControlInterval{100};
+
+/**
+ * Cancels a pull as soon as its flow control token is paused or aborted,
+ * rather than when the pull next reports progress.
+ */
+class PullWatcher {
+ public:
+  PullWatcher(const api::FlowControlToken *token, GCancellable *cancellable) : token_{token} {
+    if (token != nullptr) {
+      listener_ = token->addListener([this]() {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          changed_ = true;
+        }
+        cv_.notify_all();
+      });
+      watching_ = Executor::blocking().submit([this, token, cancellable]() { run(token, cancellable); });
+    }
+  }
+  ~PullWatcher() {
+    if (token_ != nullptr) {
+      token_->removeListener(listener_);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      done_ = true;
+    }
+    cv_.notify_all();
+    if (watching_.valid()) {
+      watching_.wait();
+    }
+  }
+  PullWatcher(const PullWatcher &) = delete;
+  PullWatcher(PullWatcher &&) = delete;
+  PullWatcher &operator=(const PullWatcher &) = delete;
+  PullWatcher &operator=(PullWatcher &&) = delete;
+
+ private:
+  void run(const api::FlowControlToken *token, GCancellable *cancellable) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cv_.wait_for(lock, kPullFlowControlInterval, [this]() { return done_ || changed_; });
+      if (done_) {
+        return;
+      }
+      changed_ = false;
+      if (!token->canContinue(false)) {
+        g_cancellable_cancel(cancellable);
+        return;
+      }
+    }
+  }
+
+  const api::FlowControlToken *token_;
+  int listener_{-1};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool done_{false};
+  // The token was paused, resumed or aborted
+  bool changed_{false};
+  std::future<void> watching_;
+};
+
+// Log the rate, the outstanding requests and the time left of a pull.
+static void log_pull_rate(OstreeAsyncProgress *progress, guint fetched, guint requested, guint percent) {
+  const guint64 bytes = ostree_async_progress_get_uint64(progress, "bytes-transferred");
+  const guint64 start_time = ostree_async_progress_get_uint64(progress, "start-time");
+  const gint64 now = g_get_monotonic_time();
+  if (start_time == 0 || now <= static_cast<gint64>(start_time)) {
+    return;
+  }
+  const double elapsed = static_cast<double>(static_cast<guint64>(now) - start_time) / G_USEC_PER_SEC;
+  const double rate = static_cast<double>(bytes) / elapsed;
+  // Static deltas tell their size, otherwise assume that the objects left are like the ones fetched.
+  const guint64 delta_size = ostree_async_progress_get_uint64(progress, "total-delta-part-size");
+  double left = 0;
+  if (delta_size > 0 && rate > 0) {
+    const guint64 delta_fetched = ostree_async_progress_get_uint64(progress, "fetched-delta-part-size");
+    left = static_cast<double>(delta_size > delta_fetched ? delta_size - delta_fetched : 0) / rate;
+  } else if (fetched > 0) {
+    left = elapsed * (requested > fetched ? requested - fetched : 0) / fetched;
+  }
+  LOG_INFO << "ostree-pull: Receiving objects: " << percent << "% at " << static_cast<uint64_t>(rate / 1024)
+           << " KiB/s, " << ostree_async_progress_get_uint(progress, "outstanding-fetches") << " outstanding requests, "
+           << static_cast<uint64_t>(left) << " s left";
+}
+
 static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data) {
   auto *mt = static_cast<PullMetaStruct *>(data);
-  if (mt->token != nullptr && !mt->token->canContinue()) {
-    g_cancellable_cancel(mt->cancellable.get());
-  }
 
   g_autofree char *status = ostree_async_progress_get_status(progress);
   guint scanning = ostree_async_progress_get_uint(progress, "scanning");
@@ -36,6 +133,14 @@ static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data)
   guint outstanding_writes = ostree_async_progress_get_uint(progress, "outstanding-writes");
   guint n_scanned_metadata = ostree_async_progress_get_uint(progress, "scanned-metadata");
 
+  if (mt->status_cb) {
+    OstreePullStatus status = mt->previous;
+    status.fetched_bytes += ostree_async_progress_get_uint64(progress, "bytes-transferred");
+    status.fetched_objects += ostree_async_progress_get_uint(progress, "fetched");
+    status.requested_objects += ostree_async_progress_get_uint(progress, "requested");
+    mt->status_cb(status);
+  }
+
   if (status != nullptr && *status != '\0') {
     LOG_INFO << "ostree-pull: " << status;
   } else if (outstanding_fetches != 0) {
@@ -52,7 +157,7 @@ static void aktualizr_progress_cb(OstreeAsyncProgress *progress, gpointer data)
       guint calculated = (fetched * 100) / requested;
       if (calculated != mt->percent_complete) {
         mt->percent_complete = calculated;
-        LOG_INFO << "ostree-pull: Receiving objects: " << calculated << "% ";
+        log_pull_rate(progress, fetched, requested, calculated);
         if (mt->progress_cb) {
           mt->progress_cb(mt->target, "Receiving objects", calculated);
         }
@@ -72,7 +177,8 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
                                              const std::string &ostree_server, const KeyManager &keys,
                                              const Uptane::Target &target, const api::FlowControlToken *token,
                                              OstreeProgressCb progress_cb, const char *alt_remote,
-                                             boost::optional<std::unordered_map<std::string, std::string>> headers) {
+                                             boost::optional<std::unordered_map<std::string, std::string>> headers,
+                                             const OstreePullOptions &pull_options, OstreePullStatusCb status_cb) {
   if (ostree_server.find("://") == std::string::npos) {
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
                                     "Invalid OSTree URI: must contain scheme (e.g., http://)");
@@ -82,14 +188,7 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
     throw std::logic_error("Invalid type of Target, got " + target.type() + ", expected OSTREE");
   }
 
-  const std::string refhash = target.sha256Hash();
-  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
-  const char *const commit_ids[] = {refhash.c_str()};
   GError *error = nullptr;
-  GVariantBuilder builder;
-  GVariant *options;
-  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
-
   GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(sysroot_path);
   GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
   if (error != nullptr) {
@@ -97,9 +196,25 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
     g_error_free(error);
     return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "Could not get OSTree repo");
   }
+  return pullIntoRepo(repo.get(), ostree_server, keys, target, token, std::move(progress_cb), alt_remote,
+                      std::move(headers), pull_options, std::move(status_cb));
+}
+
+data::InstallationResult OstreeManager::pullIntoRepo(
+    OstreeRepo *repo, const std::string &ostree_server, const KeyManager &keys, const Uptane::Target &target,
+    const api::FlowControlToken *token, OstreeProgressCb progress_cb, const char *alt_remote,
+    boost::optional<std::unordered_map<std::string, std::string>> headers, const OstreePullOptions &pull_options,
+    OstreePullStatusCb status_cb) {
+  const std::string refhash = target.sha256Hash();
+  // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
+  const char *const commit_ids[] = {refhash.c_str()};
+  GError *error = nullptr;
+  GVariantBuilder builder;
+  GVariant *options;
+  GObjectUniquePtr<OstreeAsyncProgress> progress = nullptr;
 
   GHashTable *ref_list = nullptr;
-  if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
+  if (ostree_repo_list_commit_objects_starting_with(repo, refhash.c_str(), &ref_list, nullptr, &error) != 0) {
     guint length = g_hash_table_size(ref_list);
     g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
     // should never be greater than 1, but use >= for robustness
@@ -123,7 +238,7 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
       ostree_remote_uri = uri_override;
     }
     // addRemote overwrites any previous ostree remote that was set
-    if (!OstreeManager::addRemote(repo.get(), ostree_remote_uri, keys)) {
+    if (!OstreeManager::addRemote(repo, ostree_remote_uri, keys)) {
       return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
                                       std::string("Error adding a default OSTree remote: ") + remote);
     }
@@ -145,66 +260,232 @@ data::InstallationResult OstreeManager::pull(const boost::filesystem::path &sysr
                           g_variant_new_variant(g_variant_builder_end(&hdr_builder)));
   }
 
+  if (pull_options.static_deltas == "only") {
+    g_variant_builder_add(&builder, "{s@v}", "require-static-deltas",
+                          g_variant_new_variant(g_variant_new_boolean(TRUE)));
+  } else if (pull_options.static_deltas == "never") {
+    g_variant_builder_add(&builder, "{s@v}", "disable-static-deltas",
+                          g_variant_new_variant(g_variant_new_boolean(TRUE)));
+  } else if (pull_options.static_deltas != "prefer") {
+    LOG_WARNING << "Unknown static delta mode " << pull_options.static_deltas << ", using prefer";
+  }
+  g_variant_builder_add(&builder, "{s@v}", "n-network-retries",
+                        g_variant_new_variant(g_variant_new_uint32(pull_options.network_retries)));
+  if (!pull_options.localcache_repos.empty()) {
+    GVariantBuilder cache_builder;
+    g_variant_builder_init(&cache_builder, G_VARIANT_TYPE("as"));
+    for (const auto &cache_repo : pull_options.localcache_repos) {
+      g_variant_builder_add(&cache_builder, "s", cache_repo.c_str());
+    }
+    g_variant_builder_add(&builder, "{s@v}", "localcache-repos",
+                          g_variant_new_variant(g_variant_builder_end(&cache_builder)));
+  }
+
   options = g_variant_builder_end(&builder);
 
-  PullMetaStruct mt(target, token, g_cancellable_new(), std::move(progress_cb));
-  progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
-  if (ostree_repo_pull_with_options(repo.get(), alt_remote == nullptr ? remote : alt_remote, options, progress.get(),
-                                    mt.cancellable.get(), &error) == 0) {
+  const auto started = std::chrono::steady_clock::now();
+  guint fetched = 0;
+  guint64 bytes = 0;
+  while (true) {
+    PullMetaStruct mt(target, token, g_cancellable_new(), progress_cb);
+    mt.status_cb = status_cb;
+    // The objects already fetched are not requested again
+    mt.previous.fetched_bytes = bytes;
+    mt.previous.fetched_objects = fetched;
+    mt.previous.requested_objects = fetched;
+    progress.reset(ostree_async_progress_new_and_connect(aktualizr_progress_cb, &mt));
+    gboolean pulled;
+    {
+      PullWatcher watcher(token, mt.cancellable.get());
+      pulled = ostree_repo_pull_with_options(repo, alt_remote == nullptr ? remote : alt_remote, options,
+                                             progress.get(), mt.cancellable.get(), &error);
+    }
+    ostree_async_progress_finish(progress.get());
+    fetched += ostree_async_progress_get_uint(progress.get(), "fetched");
+    bytes += ostree_async_progress_get_uint64(progress.get(), "bytes-transferred");
+    if (pulled != 0) {
+      break;
+    }
+    // The objects already written are kept, so a resumed pull goes on from them.
+    if (token != nullptr && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED) != 0) {
+      LOG_INFO << "ostree-pull: Paused";
+      if (token->canContinue()) {
+        LOG_INFO << "ostree-pull: Resuming";
+        g_clear_error(&error);
+        continue;
+      }
+    }
     LOG_ERROR << "Error while pulling image: " << error->code << " " << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     g_variant_unref(options);
     return install_res;
   }
-  ostree_async_progress_finish(progress.get());
   g_variant_unref(options);
+  LOG_INFO << "ostree-pull: fetched " << fetched << " objects ("
+           << ostree_async_progress_get_uint(progress.get(), "metadata-fetched-localcache") +
+                  ostree_async_progress_get_uint(progress.get(), "content-fetched-localcache")
+           << " from the local caches), "
+           << ostree_async_progress_get_uint(progress.get(), "fetched-delta-parts") << " of "
+           << ostree_async_progress_get_uint(progress.get(), "total-delta-parts") << " delta parts, "
+           << ostree_async_progress_get_uint(progress.get(), "fetched-delta-fallbacks") << " delta fallbacks, "
+           << bytes << " bytes in "
+           << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+           << " ms";
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "Pulling OSTree image was successful");
 }
 
+bool OstreeManager::mirrorTarget(const Uptane::Target &target, const KeyManager &keys,
+                                 const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) {
+  if (config.ostree_mirror_path.empty() || !target.IsOstree()) {
+    return false;
+  }
+  // A prune would remove the objects of a pull in progress.
+  std::lock_guard<std::mutex> lock(mirror_mutex_);
+  GError *error = nullptr;
+  GObjectUniquePtr<OstreeRepo> repo = LoadMirrorRepo(config.ostree_mirror_path, &error);
+  if (repo == nullptr) {
+    LOG_ERROR << "Could not open the OSTree mirror " << config.ostree_mirror_path << ": " << error->message;
+    g_error_free(error);
+    return false;
+  }
+  const data::InstallationResult result = pullIntoRepo(repo.get(), config.ostree_server, keys, target, token,
+                                                       progress_cb, nullptr, boost::none, pullOptions(config));
+  if (!result.success) {
+    return false;
+  }
+
+  // Only keep the latest commit of each ECU.
+  for (const auto &ecu : target.ecus()) {
+    // Refs only allow some characters
+    std::string serial = ecu.first.ToString();
+    std::replace_if(
+        serial.begin(), serial.end(),
+        [](char c) { return std::isalnum(static_cast<unsigned char>(c)) == 0 && c != '-' && c != '.'; }, '_');
+    const std::string ref = "aktualizr-mirror/" + serial;
+    if (ostree_repo_set_ref_immediate(repo.get(), nullptr, ref.c_str(), target.sha256Hash().c_str(), nullptr,
+                                      &error) == 0) {
+      LOG_ERROR << "Could not set " << ref << " in the OSTree mirror: " << error->message;
+      g_error_free(error);
+      return false;
+    }
+  }
+  gint objects_total = 0;
+  gint objects_pruned = 0;
+  guint64 pruned_size = 0;
+  if (ostree_repo_prune(repo.get(), OSTREE_REPO_PRUNE_FLAGS_REFS_ONLY, 0, &objects_total, &objects_pruned,
+                        &pruned_size, nullptr, &error) == 0) {
+    LOG_WARNING << "Could not prune the OSTree mirror: " << error->message;
+    g_error_free(error);
+  } else if (objects_pruned > 0) {
+    LOG_INFO << "Pruned " << objects_pruned << " objects, " << pruned_size << " bytes, from the OSTree mirror";
+  }
+  return true;
+}
+
+OstreePullOptions OstreeManager::pullOptions(const PackageConfig &pconfig) {
+  OstreePullOptions pull_options;
+  pull_options.static_deltas = pconfig.ostree_static_deltas;
+  pull_options.network_retries = static_cast<unsigned int>(pconfig.ostree_network_retries);
+  if (!pconfig.ostree_localcache_repos.empty()) {
+    boost::split(pull_options.localcache_repos, pconfig.ostree_localcache_repos, boost::is_any_of(", "),
+                 boost::token_compress_on);
+  }
+  return pull_options;
+}
+
 data::InstallationResult OstreeManager::install(const Uptane::Target &target) const {
   const char *opt_osname = nullptr;
   GCancellable *cancellable = nullptr;
   GError *error = nullptr;
-  g_autofree char *revision = nullptr;
 
   if (!config.os.empty()) {
     opt_osname = config.os.c_str();
   }
 
   GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
+  std::string revision;
+  data::InstallationResult resolve_res = resolveRevision(sysroot.get(), target, &revision);
+  if (!resolve_res.isSuccess()) {
+    return resolve_res;
+  }
 
-  if (error != nullptr) {
-    LOG_ERROR << "could not get repo";
-    g_error_free(error);
-    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "could not get repo");
+  GObjectUniquePtr<OstreeDeployment> merge_deployment(ostree_sysroot_get_merge_deployment(sysroot.get(), opt_osname));
+  if (merge_deployment == nullptr) {
+    LOG_ERROR << "No merge deployment";
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "No merge deployment");
   }
 
-  auto origin = StructGuard<GKeyFile>(
-      ostree_sysroot_origin_new_from_refspec(sysroot.get(), target.sha256Hash().c_str()), g_key_file_free);
-  if (ostree_repo_resolve_rev(repo.get(), target.sha256Hash().c_str(), FALSE, &revision, &error) == 0) {
-    LOG_ERROR << error->message;
+  GObjectUniquePtr<OstreeDeployment> new_deployment = takePrestaged(target, merge_deployment.get());
+  if (new_deployment != nullptr) {
+    LOG_INFO << "Using the pre-staged deployment of " << target.sha256Hash();
+  } else {
+    // Would also remove a pre-staged deployment
+    if (ostree_sysroot_prepare_cleanup(sysroot.get(), cancellable, &error) == 0) {
+      LOG_ERROR << error->message;
+      data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
+      g_error_free(error);
+      return install_res;
+    }
+    data::InstallationResult deploy_res =
+        deployTree(sysroot.get(), merge_deployment.get(), target, revision, cancellable, &new_deployment);
+    if (!deploy_res.isSuccess()) {
+      return deploy_res;
+    }
+  }
+
+  if (ostree_sysroot_simple_write_deployment(sysroot.get(), nullptr, new_deployment.get(), merge_deployment.get(),
+                                             OSTREE_SYSROOT_SIMPLE_WRITE_DEPLOYMENT_FLAGS_NONE, cancellable,
+                                             &error) == 0) {
+    LOG_ERROR << "ostree_sysroot_simple_write_deployment:" << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     return install_res;
   }
 
-  GObjectUniquePtr<OstreeDeployment> merge_deployment(ostree_sysroot_get_merge_deployment(sysroot.get(), opt_osname));
-  if (merge_deployment == nullptr) {
-    LOG_ERROR << "No merge deployment";
-    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "No merge deployment");
+  // set reboot flag to be notified later
+  if (bootloader_ != nullptr) {
+    bootloader_->rebootFlagSet();
   }
 
-  if (ostree_sysroot_prepare_cleanup(sysroot.get(), cancellable, &error) == 0) {
+  LOG_INFO << "Performing sync()";
+  sync();
+  return data::InstallationResult(data::ResultCode::Numeric::kNeedCompletion, "Application successful, need reboot");
+}
+
+data::InstallationResult OstreeManager::resolveRevision(OstreeSysroot *sysroot, const Uptane::Target &target,
+                                                        std::string *revision) {
+  GError *error = nullptr;
+  g_autofree char *resolved = nullptr;
+
+  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot, &error);
+  if (error != nullptr) {
+    LOG_ERROR << "could not get repo";
+    g_error_free(error);
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, "could not get repo");
+  }
+
+  if (ostree_repo_resolve_rev(repo.get(), target.sha256Hash().c_str(), FALSE, &resolved, &error) == 0) {
     LOG_ERROR << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     return install_res;
   }
+  *revision = resolved;
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "Revision resolved");
+}
+
+data::InstallationResult OstreeManager::deployTree(OstreeSysroot *sysroot, OstreeDeployment *merge_deployment,
+                                                   const Uptane::Target &target, const std::string &revision,
+                                                   GCancellable *cancellable,
+                                                   GObjectUniquePtr<OstreeDeployment> *new_deployment) const {
+  GError *error = nullptr;
+
+  auto origin = StructGuard<GKeyFile>(ostree_sysroot_origin_new_from_refspec(sysroot, target.sha256Hash().c_str()),
+                                     g_key_file_free);
 
   std::string args_content =
-      std::string(ostree_bootconfig_parser_get(ostree_deployment_get_bootconfig(merge_deployment.get()), "options"));
+      std::string(ostree_bootconfig_parser_get(ostree_deployment_get_bootconfig(merge_deployment), "options"));
   std::vector<std::string> args_vector;
   // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
   boost::split(args_vector, args_content, boost::is_any_of(" "));
@@ -219,32 +500,83 @@ data::InstallationResult OstreeManager::install(const Uptane::Target &target) co
   auto *kargs_strv = const_cast<char **>(&kargs_strv_vector[0]);
 
   OstreeDeployment *new_deployment_raw = nullptr;
-  if (ostree_sysroot_deploy_tree(sysroot.get(), opt_osname, revision, origin.get(), merge_deployment.get(), kargs_strv,
-                                 &new_deployment_raw, cancellable, &error) == 0) {
+  if (ostree_sysroot_deploy_tree(sysroot, config.os.empty() ? nullptr : config.os.c_str(), revision.c_str(),
+                                 origin.get(), merge_deployment, kargs_strv, &new_deployment_raw, cancellable,
+                                 &error) == 0) {
     LOG_ERROR << "ostree_sysroot_deploy_tree: " << error->message;
     data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
     g_error_free(error);
     return install_res;
   }
-  GObjectUniquePtr<OstreeDeployment> new_deployment = GObjectUniquePtr<OstreeDeployment>(new_deployment_raw);
+  new_deployment->reset(new_deployment_raw);
+  return data::InstallationResult(data::ResultCode::Numeric::kOk, "Deployment successful");
+}
 
-  if (ostree_sysroot_simple_write_deployment(sysroot.get(), nullptr, new_deployment.get(), merge_deployment.get(),
-                                             OSTREE_SYSROOT_SIMPLE_WRITE_DEPLOYMENT_FLAGS_NONE, cancellable,
-                                             &error) == 0) {
-    LOG_ERROR << "ostree_sysroot_simple_write_deployment:" << error->message;
-    data::InstallationResult install_res(data::ResultCode::Numeric::kInstallFailed, error->message);
-    g_error_free(error);
-    return install_res;
+void OstreeManager::prestage(const Uptane::Target &target) {
+  if (!config.ostree_prestage) {
+    return;
   }
-
-  // set reboot flag to be notified later
-  if (bootloader_ != nullptr) {
-    bootloader_->rebootFlagSet();
+  if (prestage_thread_.joinable()) {
+    prestage_thread_.join();
+  }
+  {
+    std::lock_guard<std::mutex> lock(prestage_mutex_);
+    prestaging_ = true;
+    prestaged_.reset();
+    prestaged_merge_.reset();
   }
+  prestage_thread_ = std::thread([this, target]() { runPrestage(target); });
+}
 
-  LOG_INFO << "Performing sync()";
-  sync();
-  return data::InstallationResult(data::ResultCode::Numeric::kNeedCompletion, "Application successful, need reboot");
+void OstreeManager::runPrestage(const Uptane::Target &target) {
+  const BackgroundScheduling::Thread background(true);
+  // The checkout itself can't be held back once started
+  LoadAdmission::admit(LoadAdmission::Work::kCheckout);
+  const auto started = std::chrono::steady_clock::now();
+  GObjectUniquePtr<OstreeDeployment> merge_deployment;
+  GObjectUniquePtr<OstreeDeployment> new_deployment;
+  try {
+    GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
+    merge_deployment.reset(
+        ostree_sysroot_get_merge_deployment(sysroot.get(), config.os.empty() ? nullptr : config.os.c_str()));
+    std::string revision;
+    if (merge_deployment != nullptr && resolveRevision(sysroot.get(), target, &revision).isSuccess()) {
+      if (!deployTree(sysroot.get(), merge_deployment.get(), target, revision, prestage_cancellable_.get(),
+                      &new_deployment)
+               .isSuccess()) {
+        new_deployment.reset();
+      }
+    }
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Failed to pre-stage " << target.sha256Hash() << ": " << e.what();
+  }
+  if (new_deployment != nullptr) {
+    LOG_INFO << "Pre-staged the deployment of " << target.sha256Hash() << " in "
+             << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - started).count()
+             << " s";
+  }
+  {
+    std::lock_guard<std::mutex> lock(prestage_mutex_);
+    prestaged_ = std::move(new_deployment);
+    prestaged_merge_ = std::move(merge_deployment);
+    prestaged_revision_ = target.sha256Hash();
+    prestaging_ = false;
+  }
+  prestage_cv_.notify_all();
+}
+
+GObjectUniquePtr<OstreeDeployment> OstreeManager::takePrestaged(const Uptane::Target &target,
+                                                                OstreeDeployment *merge_deployment) const {
+  std::unique_lock<std::mutex> lock(prestage_mutex_);
+  prestage_cv_.wait(lock, [this]() { return !prestaging_; });
+  GObjectUniquePtr<OstreeDeployment> deployment = std::move(prestaged_);
+  GObjectUniquePtr<OstreeDeployment> prestaged_merge = std::move(prestaged_merge_);
+  // The configuration merged into it must still be the current one.
+  if (deployment == nullptr || target.sha256Hash() != prestaged_revision_ ||
+      ostree_deployment_equal(prestaged_merge.get(), merge_deployment) == 0) {
+    return nullptr;
+  }
+  return deployment;
 }
 
 void OstreeManager::completeInstall() const {
@@ -281,8 +613,8 @@ OstreeManager::OstreeManager(const PackageConfig &pconfig, const BootloaderConfi
                              Bootloader *bootloader)
     : PackageManagerInterface(pconfig, BootloaderConfig(), storage, http),
       bootloader_(bootloader == nullptr ? new Bootloader(bconfig, *storage) : bootloader) {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
-  if (sysroot_smart == nullptr) {
+  sysroot_ = OstreeManager::LoadSysroot(config.sysroot);
+  if (sysroot_ == nullptr) {
     throw std::runtime_error("Could not find OSTree sysroot at: " + config.sysroot.string());
   }
 
@@ -293,7 +625,13 @@ OstreeManager::OstreeManager(const PackageConfig &pconfig, const BootloaderConfi
   }
 }
 
-OstreeManager::~OstreeManager() { bootloader_.reset(nullptr); }
+OstreeManager::~OstreeManager() {
+  g_cancellable_cancel(prestage_cancellable_.get());
+  if (prestage_thread_.joinable()) {
+    prestage_thread_.join();
+  }
+  bootloader_.reset(nullptr);
+}
 
 bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &fetcher, const KeyManager &keys,
                                 const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) {
@@ -302,7 +640,12 @@ bool OstreeManager::fetchTarget(const Uptane::Target &target, Uptane::Fetcher &f
     // while the target is aimed for a Secondary ECU that is configured with another/non-OSTree package manager
     return PackageManagerInterface::fetchTarget(target, fetcher, keys, progress_cb, token);
   }
-  return OstreeManager::pull(config.sysroot, config.ostree_server, keys, target, token, progress_cb).success;
+  const data::InstallationResult result = OstreeManager::pull(config.sysroot, config.ostree_server, keys, target, token,
+                                                              progress_cb, nullptr, boost::none, pullOptions(config));
+  if (result.isSuccess()) {
+    prestage(target);
+  }
+  return result.isSuccess();
 }
 
 TargetStatus OstreeManager::verifyTarget(const Uptane::Target &target) const {
@@ -318,16 +661,19 @@ TargetStatus OstreeManager::verifyTargetInternal(const Uptane::Target &target) c
   const std::string refhash = target.sha256Hash();
   GError *error = nullptr;
 
-  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.sysroot);
-  GObjectUniquePtr<OstreeRepo> repo = LoadRepo(sysroot.get(), &error);
-  if (error != nullptr) {
+  std::unique_lock<std::mutex> lock;
+  lockSysroot(&lock);
+  OstreeRepo *repo = sysrootRepo(&error);
+  if (repo == nullptr) {
     LOG_ERROR << "Could not get OSTree repo";
-    g_error_free(error);
+    if (error != nullptr) {
+      g_error_free(error);
+    }
     return TargetStatus::kNotFound;
   }
 
   GHashTable *ref_list = nullptr;
-  if (ostree_repo_list_commit_objects_starting_with(repo.get(), refhash.c_str(), &ref_list, nullptr, &error) != 0) {
+  if (ostree_repo_list_commit_objects_starting_with(repo, refhash.c_str(), &ref_list, nullptr, &error) != 0) {
     guint length = g_hash_table_size(ref_list);
     g_hash_table_destroy(ref_list);  // OSTree creates the table with destroy notifiers, so no memory leaks expected
     // should never be greater than 1, but use >= for robustness
@@ -345,6 +691,16 @@ TargetStatus OstreeManager::verifyTargetInternal(const Uptane::Target &target) c
 }
 
 Json::Value OstreeManager::getInstalledPackages() const {
+  std::lock_guard<std::mutex> guard(packages_mutex_);
+  struct stat st {};
+  std::string stamp;
+  if (stat(config.packages_file.c_str(), &st) == 0) {
+    stamp = std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" + std::to_string(st.st_mtim.tv_sec) +
+            "." + std::to_string(st.st_mtim.tv_nsec);
+  }
+  if (!stamp.empty() && stamp == packages_stamp_) {
+    return packages_;
+  }
   std::string packages_str = Utils::readFile(config.packages_file);
   std::vector<std::string> package_lines;
   // NOLINTNEXTLINE(clang-analyzer-cplusplus.NewDeleteLeaks)
@@ -363,16 +719,19 @@ Json::Value OstreeManager::getInstalledPackages() const {
     package["version"] = it->substr(pos + 1);
     packages.append(package);
   }
+  packages_stamp_ = stamp;
+  packages_ = packages;
   return packages;
 }
 
 std::string OstreeManager::getCurrentHash() const {
   OstreeDeployment *deployment = nullptr;
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::unique_lock<std::mutex> lock;
+  OstreeSysroot *sysroot = lockSysroot(&lock);
   if (config.booted == BootedType::kBooted) {
-    deployment = ostree_sysroot_get_booted_deployment(sysroot_smart.get());
+    deployment = ostree_sysroot_get_booted_deployment(sysroot);
   } else {
-    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+    g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot);
     if (deployments != nullptr && deployments->len > 0) {
       // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
       deployment = static_cast<OstreeDeployment *>(deployments->pdata[0]);
@@ -429,13 +788,14 @@ Uptane::Target OstreeManager::getCurrent() const {
 
 // used for bootloader rollback
 bool OstreeManager::imageUpdated() {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::unique_lock<std::mutex> lock;
+  OstreeSysroot *sysroot = lockSysroot(&lock);
 
   // image updated if no pending deployment in the list of deployments
-  GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+  GPtrArray *deployments = ostree_sysroot_get_deployments(sysroot);
 
   OstreeDeployment *pending_deployment = nullptr;
-  ostree_sysroot_query_deployments_for(sysroot_smart.get(), nullptr, &pending_deployment, nullptr);
+  ostree_sysroot_query_deployments_for(sysroot, nullptr, &pending_deployment, nullptr);
 
   bool pending_found = false;
   for (guint i = 0; i < deployments->len; i++) {
@@ -451,12 +811,13 @@ bool OstreeManager::imageUpdated() {
 }
 
 GObjectUniquePtr<OstreeDeployment> OstreeManager::getStagedDeployment() const {
-  GObjectUniquePtr<OstreeSysroot> sysroot_smart = OstreeManager::LoadSysroot(config.sysroot);
+  std::unique_lock<std::mutex> lock;
+  OstreeSysroot *sysroot = lockSysroot(&lock);
 
   GPtrArray *deployments = nullptr;
   OstreeDeployment *res = nullptr;
 
-  deployments = ostree_sysroot_get_deployments(sysroot_smart.get());
+  deployments = ostree_sysroot_get_deployments(sysroot);
 
   if (deployments->len > 0) {
     // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
@@ -469,6 +830,34 @@ GObjectUniquePtr<OstreeDeployment> OstreeManager::getStagedDeployment() const {
   return GObjectUniquePtr<OstreeDeployment>(res);
 }
 
+OstreeSysroot *OstreeManager::lockSysroot(std::unique_lock<std::mutex> *lock) const {
+  *lock = std::unique_lock<std::mutex>(sysroot_mutex_);
+  if (sysroot_ != nullptr) {
+    gboolean changed = FALSE;
+    GError *error = nullptr;
+    // Only looks at the time the deployments were last changed
+    if (ostree_sysroot_load_if_changed(sysroot_.get(), &changed, nullptr, &error) == 0) {
+      LOG_WARNING << "Could not reload the sysroot at " << config.sysroot.string() << ": " << error->message;
+      g_error_free(error);
+      sysroot_.reset();
+    } else if (changed != FALSE) {
+      repo_.reset();
+    }
+  }
+  if (sysroot_ == nullptr) {
+    repo_.reset();
+    sysroot_ = LoadSysroot(config.sysroot);
+  }
+  return sysroot_.get();
+}
+
+OstreeRepo *OstreeManager::sysrootRepo(GError **error) const {
+  if (repo_ == nullptr) {
+    repo_ = LoadRepo(sysroot_.get(), error);
+  }
+  return repo_.get();
+}
+
 GObjectUniquePtr<OstreeSysroot> OstreeManager::LoadSysroot(const boost::filesystem::path &path) {
   GObjectUniquePtr<OstreeSysroot> sysroot = nullptr;
 
@@ -500,6 +889,16 @@ GObjectUniquePtr<OstreeRepo> OstreeManager::LoadRepo(OstreeSysroot *sysroot, GEr
   return GObjectUniquePtr<OstreeRepo>(repo);
 }
 
+GObjectUniquePtr<OstreeRepo> OstreeManager::LoadMirrorRepo(const boost::filesystem::path &path, GError **error) {
+  GObjectUniquePtr<GFile> file(g_file_new_for_path(path.c_str()));
+  GObjectUniquePtr<OstreeRepo> repo(ostree_repo_new(file.get()));
+  // An archive repo can be served by any static web server.
+  if (ostree_repo_create(repo.get(), OSTREE_REPO_MODE_ARCHIVE_Z2, nullptr, error) == 0) {
+    return nullptr;
+  }
+  return repo;
+}
+
 bool OstreeManager::addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys) {
   GCancellable *cancellable = nullptr;
   GError *error = nullptr;
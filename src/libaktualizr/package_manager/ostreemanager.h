@@ -2,9 +2,13 @@
 #define OSTREE_H_
 
 #include <boost/optional/optional.hpp>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <glib/gi18n.h>
 #include <ostree.h>
@@ -25,6 +29,14 @@ template <typename T>
 using GObjectUniquePtr = std::unique_ptr<T, GObjectFinalizer<T>>;
 using OstreeProgressCb = std::function<void(const Uptane::Target &, const std::string &, unsigned int)>;
 
+// The objects and bytes fetched by a pull so far
+struct OstreePullStatus {
+  uint64_t fetched_bytes{0};
+  uint32_t fetched_objects{0};
+  uint32_t requested_objects{0};
+};
+using OstreePullStatusCb = std::function<void(const OstreePullStatus &)>;
+
 struct PullMetaStruct {
   PullMetaStruct(Uptane::Target target_in, const api::FlowControlToken *token_in, GCancellable *cancellable_in,
                  OstreeProgressCb progress_cb_in)
@@ -37,6 +49,19 @@ struct PullMetaStruct {
   const api::FlowControlToken *token;
   GObjectUniquePtr<GCancellable> cancellable;
   OstreeProgressCb progress_cb;
+  OstreePullStatusCb status_cb;
+  // What the previous rounds of a paused pull fetched
+  OstreePullStatus previous;
+};
+
+// Tuning of the libostree pull engine, see the ostree_* options of PackageConfig
+struct OstreePullOptions {
+  // "prefer" (a static delta if the server has one), "only" or "never"
+  std::string static_deltas{"prefer"};
+  // Retries of a failed request on a network error
+  unsigned int network_retries{5};
+  // Local repos looked up for the objects before they are fetched
+  std::vector<std::string> localcache_repos;
 };
 
 class OstreeManager : public PackageManagerInterface {
@@ -61,19 +86,72 @@ class OstreeManager : public PackageManagerInterface {
   bool fetchTarget(const Uptane::Target &target, Uptane::Fetcher &fetcher, const KeyManager &keys,
                    const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) override;
   TargetStatus verifyTarget(const Uptane::Target &target) const override;
+  bool mirrorTarget(const Uptane::Target &target, const KeyManager &keys, const FetcherProgressCb &progress_cb,
+                    const api::FlowControlToken *token) override;
+
+  /**
+   * Check out target as a new deployment on a background thread, at a low CPU
+   * and I/O priority, so that install() only has to write the boot entry.
+   * Does nothing unless ostree_prestage is set.
+   */
+  void prestage(const Uptane::Target &target);
 
   GObjectUniquePtr<OstreeDeployment> getStagedDeployment() const;
   static GObjectUniquePtr<OstreeSysroot> LoadSysroot(const boost::filesystem::path &path);
   static GObjectUniquePtr<OstreeRepo> LoadRepo(OstreeSysroot *sysroot, GError **error);
+  // Open the archive repo at path, created if needed
+  static GObjectUniquePtr<OstreeRepo> LoadMirrorRepo(const boost::filesystem::path &path, GError **error);
   static bool addRemote(OstreeRepo *repo, const std::string &url, const KeyManager &keys);
   static data::InstallationResult pull(
       const boost::filesystem::path &sysroot_path, const std::string &ostree_server, const KeyManager &keys,
       const Uptane::Target &target, const api::FlowControlToken *token = nullptr,
       OstreeProgressCb progress_cb = nullptr, const char *alt_remote = nullptr,
-      boost::optional<std::unordered_map<std::string, std::string>> headers = boost::none);
+      boost::optional<std::unordered_map<std::string, std::string>> headers = boost::none,
+      const OstreePullOptions &pull_options = OstreePullOptions(), OstreePullStatusCb status_cb = nullptr);
+  static OstreePullOptions pullOptions(const PackageConfig &pconfig);
 
  private:
   TargetStatus verifyTargetInternal(const Uptane::Target &target) const;
+  // The sysroot of config.sysroot, valid while *lock is held. It is loaded
+  // once, and again only when its deployments have changed since. Writes to
+  // the sysroot go through a sysroot of their own.
+  OstreeSysroot *lockSysroot(std::unique_lock<std::mutex> *lock) const;
+  // The repo of the sysroot, with the lock of lockSysroot() held
+  OstreeRepo *sysrootRepo(GError **error) const;
+  static data::InstallationResult pullIntoRepo(
+      OstreeRepo *repo, const std::string &ostree_server, const KeyManager &keys, const Uptane::Target &target,
+      const api::FlowControlToken *token, OstreeProgressCb progress_cb, const char *alt_remote,
+      boost::optional<std::unordered_map<std::string, std::string>> headers, const OstreePullOptions &pull_options,
+      OstreePullStatusCb status_cb = nullptr);
+
+  static data::InstallationResult resolveRevision(OstreeSysroot *sysroot, const Uptane::Target &target,
+                                                  std::string *revision);
+  data::InstallationResult deployTree(OstreeSysroot *sysroot, OstreeDeployment *merge_deployment,
+                                      const Uptane::Target &target, const std::string &revision,
+                                      GCancellable *cancellable,
+                                      GObjectUniquePtr<OstreeDeployment> *new_deployment) const;
+  void runPrestage(const Uptane::Target &target);
+  // Wait for the pre-staging, and take its deployment if it is the one of target
+  GObjectUniquePtr<OstreeDeployment> takePrestaged(const Uptane::Target &target,
+                                                   OstreeDeployment *merge_deployment) const;
+
+  std::mutex mirror_mutex_;
+  mutable std::mutex sysroot_mutex_;
+  mutable GObjectUniquePtr<OstreeSysroot> sysroot_;
+  mutable GObjectUniquePtr<OstreeRepo> repo_;
+  // The packages of packages_file, read again when the file has changed
+  mutable std::mutex packages_mutex_;
+  mutable std::string packages_stamp_;
+  mutable Json::Value packages_;
+  GObjectUniquePtr<GCancellable> prestage_cancellable_{g_cancellable_new()};
+  std::thread prestage_thread_;
+  mutable std::mutex prestage_mutex_;
+  mutable std::condition_variable prestage_cv_;
+  // Guarded by prestage_mutex_
+  mutable bool prestaging_{false};
+  mutable GObjectUniquePtr<OstreeDeployment> prestaged_;
+  mutable GObjectUniquePtr<OstreeDeployment> prestaged_merge_;
+  mutable std::string prestaged_revision_;
 
   std::unique_ptr<Bootloader> bootloader_;
 };
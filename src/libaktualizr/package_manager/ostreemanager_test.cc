@@ -1,10 +1,16 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <boost/filesystem.hpp>
+#include <boost/property_tree/ini_parser.hpp>
 
 #include "libaktualizr/config.h"
 #include "package_manager/ostreemanager.h"
@@ -91,6 +97,160 @@ TEST(OstreeManager, InstallBadUri) {
   EXPECT_EQ(result.description, "Refspec 'hash' not found");
 }
 
+static Config prestageConfig(const TemporaryDirectory &temp_dir) {
+  // A copy, as the tests write deployments
+  const boost::filesystem::path sysroot = temp_dir / "sysroot";
+  EXPECT_EQ(system((std::string("cp -r ") + test_sysroot.string() + " " + sysroot.string()).c_str()), 0);
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.os = "dummy-os";
+  config.pacman.sysroot = sysroot;
+  config.pacman.booted = BootedType::kStaged;
+  config.pacman.ostree_prestage = true;
+  config.storage.path = temp_dir.Path();
+  config.bootloader.reboot_sentinel_dir = temp_dir.Path();
+  return config;
+}
+
+/* Check out a downloaded commit in the background, and install that deployment. */
+TEST(OstreeManager, PrestageInstall) {
+  TemporaryDirectory temp_dir;
+  Config config = prestageConfig(temp_dir);
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  const Uptane::Target target = ostree.getCurrent();
+  const boost::filesystem::path prestaged =
+      config.pacman.sysroot / "ostree/deploy/dummy-os/deploy" / (target.sha256Hash() + ".1");
+
+  ostree.prestage(target);
+  // Checked out before the installation is asked for
+  for (int i = 0; i < 600 && !boost::filesystem::exists(prestaged); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  EXPECT_TRUE(boost::filesystem::exists(prestaged));
+
+  data::InstallationResult result = ostree.install(target);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kNeedCompletion);
+  EXPECT_TRUE(boost::filesystem::exists(prestaged));
+
+  GObjectUniquePtr<OstreeSysroot> sysroot = OstreeManager::LoadSysroot(config.pacman.sysroot);
+  g_autoptr(GPtrArray) deployments = ostree_sysroot_get_deployments(sysroot.get());
+  ASSERT_EQ(deployments->len, 2U);
+  auto *deployment = static_cast<OstreeDeployment *>(g_ptr_array_index(deployments, 0));
+  EXPECT_EQ(ostree_deployment_get_csum(deployment), target.sha256Hash());
+  EXPECT_EQ(ostree_deployment_get_deployserial(deployment), 1);
+}
+
+/* Deploy as before when the pre-staged Target is not the one installed. */
+TEST(OstreeManager, PrestageOtherTarget) {
+  TemporaryDirectory temp_dir;
+  Config config = prestageConfig(temp_dir);
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  const Uptane::Target current = ostree.getCurrent();
+
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "hash";
+  target_json["length"] = 0;
+  Uptane::Target target("branch-name-hash", target_json);
+
+  // Fails in the background
+  ostree.prestage(target);
+  data::InstallationResult result = ostree.install(target);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kInstallFailed);
+  EXPECT_EQ(result.description, "Refspec 'hash' not found");
+
+  ostree.prestage(target);
+  result = ostree.install(current);
+  EXPECT_EQ(result.result_code.num_code, data::ResultCode::Numeric::kNeedCompletion);
+  EXPECT_TRUE(boost::filesystem::exists(config.pacman.sysroot / "ostree/deploy/dummy-os/deploy" /
+                                        (current.sha256Hash() + ".1")));
+}
+
+/* Don't check out anything in the background unless configured to. */
+TEST(OstreeManager, PrestageDisabled) {
+  TemporaryDirectory temp_dir;
+  Config config = prestageConfig(temp_dir);
+  config.pacman.ostree_prestage = false;
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  const Uptane::Target target = ostree.getCurrent();
+
+  ostree.prestage(target);
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.sysroot / "ostree/deploy/dummy-os/deploy" /
+                                         (target.sha256Hash() + ".1")));
+}
+
+static Uptane::Target secondaryTarget(const std::string &hash) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = hash;
+  target_json["length"] = 0;
+  target_json["custom"]["targetFormat"] = "OSTREE";
+  target_json["custom"]["ecuIdentifiers"]["secondary/1"]["hardwareId"] = "secondary_hw";
+  return Uptane::Target("secondary-image", target_json);
+}
+
+/* Pull the commits of the Secondaries into an archive repo, with a ref for each of them. */
+TEST(OstreeManager, MirrorTarget) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.booted = BootedType::kStaged;
+  // Serves the commit deployed in the test sysroot
+  config.pacman.ostree_server = "file://" + (test_sysroot / "ostree/repo").string();
+  config.pacman.ostree_mirror_path = temp_dir / "mirror";
+  config.storage.path = temp_dir.Path();
+
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+  keys.loadKeys();
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  const std::string hash = ostree.getCurrentHash();
+
+  EXPECT_TRUE(ostree.mirrorTarget(secondaryTarget(hash), keys, nullptr, nullptr));
+  // Already there, only the refs are set
+  EXPECT_TRUE(ostree.mirrorTarget(secondaryTarget(hash), keys, nullptr, nullptr));
+  EXPECT_FALSE(ostree.mirrorTarget(secondaryTarget(std::string(64, '0')), keys, nullptr, nullptr));
+
+  GError *error = nullptr;
+  GObjectUniquePtr<OstreeRepo> repo = OstreeManager::LoadMirrorRepo(config.pacman.ostree_mirror_path, &error);
+  ASSERT_NE(repo, nullptr);
+  EXPECT_EQ(ostree_repo_get_mode(repo.get()), OSTREE_REPO_MODE_ARCHIVE_Z2);
+  g_autofree char *rev = nullptr;
+  EXPECT_TRUE(ostree_repo_resolve_rev(repo.get(), "aktualizr-mirror/secondary_1", FALSE, &rev, &error));
+  EXPECT_EQ(rev, hash);
+}
+
+/* Leave the Targets to the Secondaries without a mirror, or if they are not OSTree commits. */
+TEST(OstreeManager, MirrorTargetDisabled) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_OSTREE;
+  config.pacman.sysroot = test_sysroot;
+  config.pacman.booted = BootedType::kStaged;
+  config.pacman.ostree_server = "file://" + (test_sysroot / "ostree/repo").string();
+  config.storage.path = temp_dir.Path();
+
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  KeyManager keys(storage, config.keymanagerConfig());
+  keys.loadKeys();
+  {
+    OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+    EXPECT_FALSE(ostree.mirrorTarget(secondaryTarget(ostree.getCurrentHash()), keys, nullptr, nullptr));
+  }
+
+  config.pacman.ostree_mirror_path = temp_dir / "mirror";
+  OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr);
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = "dd7bd1c37a3226e520b8d6939c30991b1c08772d5dab62b381c3a63541dc629a";
+  target_json["length"] = 100;
+  target_json["custom"]["ecuIdentifiers"]["secondary1"]["hardwareId"] = "secondary_hw";
+  EXPECT_FALSE(ostree.mirrorTarget(Uptane::Target("firmware.bin", target_json), keys, nullptr, nullptr));
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.ostree_mirror_path));
+}
+
 /* Abort if the OSTree sysroot is invalid. */
 TEST(OstreeManager, BadSysroot) {
   TemporaryDirectory temp_dir;
@@ -102,6 +262,26 @@ TEST(OstreeManager, BadSysroot) {
   EXPECT_THROW(OstreeManager ostree(config.pacman, config.bootloader, storage, nullptr), std::runtime_error);
 }
 
+/* Take the options of the pulls from the configuration. */
+TEST(OstreeManager, PullOptionsFromConfig) {
+  PackageConfig pconfig;
+  OstreePullOptions pull_options = OstreeManager::pullOptions(pconfig);
+  EXPECT_EQ(pull_options.static_deltas, "prefer");
+  EXPECT_EQ(pull_options.network_retries, 5U);
+  EXPECT_TRUE(pull_options.localcache_repos.empty());
+
+  std::stringstream toml("ostree_static_deltas = \"only\"\nostree_network_retries = 2\n"
+                         "ostree_localcache_repos = \"/media/usb/repo, /var/cache/repo\"\n");
+  boost::property_tree::ptree pt;
+  boost::property_tree::ini_parser::read_ini(toml, pt);
+  pconfig.updateFromPropertyTree(pt);
+  EXPECT_TRUE(pconfig.extra.empty());
+  pull_options = OstreeManager::pullOptions(pconfig);
+  EXPECT_EQ(pull_options.static_deltas, "only");
+  EXPECT_EQ(pull_options.network_retries, 2U);
+  EXPECT_EQ(pull_options.localcache_repos, (std::vector<std::string>{"/media/usb/repo", "/var/cache/repo"}));
+}
+
 /* Parse a provided list of installed packages. */
 TEST(OstreeManager, ParseInstalledPackages) {
   TemporaryDirectory temp_dir;
@@ -130,6 +310,13 @@ TEST(OstreeManager, ParseInstalledPackages) {
   EXPECT_EQ(packages[1]["version"].asString(), "2.0");
   EXPECT_EQ(packages[2]["name"].asString(), "bash");
   EXPECT_EQ(packages[2]["version"].asString(), "1.1");
+
+  // The list is read again once the file has changed.
+  EXPECT_EQ(ostree.getInstalledPackages(), packages);
+  Utils::writeFile(packages_file, std::string("vim 1.1\n"));
+  packages = ostree.getInstalledPackages();
+  ASSERT_EQ(packages.size(), 1);
+  EXPECT_EQ(packages[0]["version"].asString(), "1.1");
 }
 
 /**
@@ -154,6 +341,9 @@ TEST(OstreeManager, GetCurrentTarget) {
   // This is a slightly circular test, but OstreeManager::getCurrentHash()
   // fetches the hash straight from libostree.
   EXPECT_EQ(dut.getCurrentHash(), current_target.sha256Hash()) << "hash should match";
+  // From the sysroot loaded before
+  EXPECT_EQ(dut.getCurrentHash(), current_target.sha256Hash());
+  EXPECT_NE(dut.getStagedDeployment(), nullptr);
 }
 
 /* Communicate with a remote OSTree server without credentials. */
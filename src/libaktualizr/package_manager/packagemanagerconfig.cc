@@ -11,12 +11,54 @@ void PackageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
       CopyFromConfig(sysroot, cp.first, pt);
     } else if (cp.first == "ostree_server") {
       CopyFromConfig(ostree_server, cp.first, pt);
+    } else if (cp.first == "ostree_static_deltas") {
+      CopyFromConfig(ostree_static_deltas, cp.first, pt);
+    } else if (cp.first == "ostree_network_retries") {
+      CopyFromConfig(ostree_network_retries, cp.first, pt);
+    } else if (cp.first == "ostree_localcache_repos") {
+      CopyFromConfig(ostree_localcache_repos, cp.first, pt);
+    } else if (cp.first == "ostree_mirror_path") {
+      CopyFromConfig(ostree_mirror_path, cp.first, pt);
+    } else if (cp.first == "ostree_mirror_url") {
+      CopyFromConfig(ostree_mirror_url, cp.first, pt);
+    } else if (cp.first == "ostree_prestage") {
+      CopyFromConfig(ostree_prestage, cp.first, pt);
     } else if (cp.first == "images_path") {
       CopyFromConfig(images_path, cp.first, pt);
+    } else if (cp.first == "images_cache_size") {
+      CopyFromConfig(images_cache_size, cp.first, pt);
+    } else if (cp.first == "images_gc") {
+      CopyFromConfig(images_gc, cp.first, pt);
+    } else if (cp.first == "images_gc_keep") {
+      CopyFromConfig(images_gc_keep, cp.first, pt);
     } else if (cp.first == "packages_file") {
       CopyFromConfig(packages_file, cp.first, pt);
+    } else if (cp.first == "download_segments") {
+      CopyFromConfig(download_segments, cp.first, pt);
+    } else if (cp.first == "download_buffers") {
+      CopyFromConfig(download_buffers, cp.first, pt);
+    } else if (cp.first == "hash_checkpoint_interval") {
+      CopyFromConfig(hash_checkpoint_interval, cp.first, pt);
+    } else if (cp.first == "io_uring_queue_depth") {
+      CopyFromConfig(io_uring_queue_depth, cp.first, pt);
+    } else if (cp.first == "peer_cache_url") {
+      CopyFromConfig(peer_cache_url, cp.first, pt);
+    } else if (cp.first == "peer_server_port") {
+      CopyFromConfig(peer_server_port, cp.first, pt);
     } else if (cp.first == "fake_need_reboot") {
       CopyFromConfig(fake_need_reboot, cp.first, pt);
+    } else if (cp.first == "fake_fetch_time") {
+      CopyFromConfig(fake_fetch_time, cp.first, pt);
+    } else if (cp.first == "fake_fetch_time_per_mib") {
+      CopyFromConfig(fake_fetch_time_per_mib, cp.first, pt);
+    } else if (cp.first == "fake_install_time") {
+      CopyFromConfig(fake_install_time, cp.first, pt);
+    } else if (cp.first == "fake_install_time_per_mib") {
+      CopyFromConfig(fake_install_time_per_mib, cp.first, pt);
+    } else if (cp.first == "fake_finalize_time") {
+      CopyFromConfig(fake_finalize_time, cp.first, pt);
+    } else if (cp.first == "fake_time_seed") {
+      CopyFromConfig(fake_time_seed, cp.first, pt);
     } else if (cp.first == "booted") {
       CopyFromConfig(booted, cp.first, pt);
     } else {
@@ -30,9 +72,30 @@ void PackageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, os, "os");
   writeOption(out_stream, sysroot, "sysroot");
   writeOption(out_stream, ostree_server, "ostree_server");
+  writeOption(out_stream, ostree_static_deltas, "ostree_static_deltas");
+  writeOption(out_stream, ostree_network_retries, "ostree_network_retries");
+  writeOption(out_stream, ostree_localcache_repos, "ostree_localcache_repos");
+  writeOption(out_stream, ostree_mirror_path, "ostree_mirror_path");
+  writeOption(out_stream, ostree_mirror_url, "ostree_mirror_url");
+  writeOption(out_stream, ostree_prestage, "ostree_prestage");
   writeOption(out_stream, images_path, "images_path");
+  writeOption(out_stream, images_cache_size, "images_cache_size");
+  writeOption(out_stream, images_gc, "images_gc");
+  writeOption(out_stream, images_gc_keep, "images_gc_keep");
   writeOption(out_stream, packages_file, "packages_file");
+  writeOption(out_stream, download_segments, "download_segments");
+  writeOption(out_stream, download_buffers, "download_buffers");
+  writeOption(out_stream, hash_checkpoint_interval, "hash_checkpoint_interval");
+  writeOption(out_stream, io_uring_queue_depth, "io_uring_queue_depth");
+  writeOption(out_stream, peer_cache_url, "peer_cache_url");
+  writeOption(out_stream, peer_server_port, "peer_server_port");
   writeOption(out_stream, fake_need_reboot, "fake_need_reboot");
+  writeOption(out_stream, fake_fetch_time, "fake_fetch_time");
+  writeOption(out_stream, fake_fetch_time_per_mib, "fake_fetch_time_per_mib");
+  writeOption(out_stream, fake_install_time, "fake_install_time");
+  writeOption(out_stream, fake_install_time_per_mib, "fake_install_time_per_mib");
+  writeOption(out_stream, fake_finalize_time, "fake_finalize_time");
+  writeOption(out_stream, fake_time_seed, "fake_time_seed");
   writeOption(out_stream, booted, "booted");
 
   // note that this is imperfect as it will not print default values deduced
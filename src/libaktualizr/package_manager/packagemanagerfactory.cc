@@ -3,6 +3,12 @@
 #include <map>
 
 #include "logging/logging.h"
+#ifdef BUILD_MINIMAL
+#include "package_manager/packagemanagerfake.h"
+#ifdef BUILD_OSTREE
+#include "package_manager/ostreemanager.h"
+#endif
+#endif
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 static std::map<std::string, PackageManagerBuilder> *registered_pkgms_;
@@ -25,6 +31,19 @@ bool PackageManagerFactory::registerPackageManager(const char *name, PackageMana
 std::shared_ptr<PackageManagerInterface> PackageManagerFactory::makePackageManager(
     const PackageConfig &pconfig, const BootloaderConfig &bconfig, const std::shared_ptr<INvStorage> &storage,
     const std::shared_ptr<HttpInterface> &http) {
+#ifdef BUILD_MINIMAL
+  if (pconfig.type == PACKAGE_MANAGER_NONE) {
+    return std::make_shared<PackageManagerFake>(pconfig, bconfig, storage, http);
+  }
+#ifdef BUILD_OSTREE
+  if (pconfig.type == PACKAGE_MANAGER_OSTREE) {
+    return std::make_shared<OstreeManager>(pconfig, bconfig, storage, http);
+  }
+#endif
+  if (registered_pkgms_ == nullptr) {
+    throw std::runtime_error(std::string("Unsupported package manager: ") + pconfig.type);
+  }
+#endif
   for (const auto &b : *registered_pkgms_) {
     if (b.first == pconfig.type) {
       PackageManagerInterface *pkgm = b.second(pconfig, bconfig, storage, http);
@@ -1,13 +1,44 @@
 #include "libaktualizr/packagemanagerfactory.h"
 
+#include <stdexcept>
+#include <thread>
+
 #include "logging/logging.h"
 #include "packagemanagerfake.h"
 #include "storage/invstorage.h"
 #include "utilities/fault_injection.h"
+#include "utilities/flow_control.h"
 
 // NOLINTNEXTLINE(cppcoreguidelines-avoid-non-const-global-variables)
 AUTO_REGISTER_PACKAGE_MANAGER(PACKAGE_MANAGER_NONE, PackageManagerFake);
 
+namespace {
+
+boost::optional<TimeDistribution> parseTime(const std::string& description, const std::string& option) {
+  if (description.empty()) {
+    return boost::none;
+  }
+  try {
+    return TimeDistribution::parse(description);
+  } catch (const std::invalid_argument& e) {
+    throw std::invalid_argument(std::string(e.what()) + " in " + option);
+  }
+}
+
+}  // namespace
+
+PackageManagerFake::PackageManagerFake(const PackageConfig& pconfig, const BootloaderConfig& bconfig,
+                                       const std::shared_ptr<INvStorage>& storage,
+                                       const std::shared_ptr<HttpInterface>& http)
+    : PackageManagerInterface(pconfig, bconfig, storage, http),
+      bootloader_{new Bootloader(bconfig, *storage_)},
+      fetch_time_{parseTime(pconfig.fake_fetch_time, "fake_fetch_time"),
+                  parseTime(pconfig.fake_fetch_time_per_mib, "fake_fetch_time_per_mib")},
+      install_time_{parseTime(pconfig.fake_install_time, "fake_install_time"),
+                    parseTime(pconfig.fake_install_time_per_mib, "fake_install_time_per_mib")},
+      finalize_time_{parseTime(pconfig.fake_finalize_time, "fake_finalize_time"), boost::none},
+      generator_{pconfig.fake_time_seed != 0 ? pconfig.fake_time_seed : std::random_device()()} {}
+
 Json::Value PackageManagerFake::getInstalledPackages() const {
   Json::Value packages(Json::arrayValue);
   Json::Value package;
@@ -29,7 +60,7 @@ Uptane::Target PackageManagerFake::getCurrent() const {
 }
 
 data::InstallationResult PackageManagerFake::install(const Uptane::Target& target) const {
-  (void)target;
+  std::this_thread::sleep_for(sampleTime(install_time_, target.length()));
 
   // fault injection: only enabled with FIU_ENABLE defined
   if (fiu_fail("fake_package_install") != 0) {
@@ -69,6 +100,7 @@ data::InstallationResult PackageManagerFake::finalizeInstall(const Uptane::Targe
   if (!pending_version) {
     throw std::runtime_error("No pending update, nothing to finalize");
   }
+  std::this_thread::sleep_for(sampleTime(finalize_time_, target.length()));
 
   data::InstallationResult install_res;
 
@@ -120,5 +152,32 @@ bool PackageManagerFake::fetchTarget(const Uptane::Target& target, Uptane::Fetch
     return false;
   }
 
-  return PackageManagerInterface::fetchTarget(target, fetcher, keys, progress_cb, token);
+  const auto start = std::chrono::steady_clock::now();
+  if (!PackageManagerInterface::fetchTarget(target, fetcher, keys, progress_cb, token)) {
+    return false;
+  }
+  const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+      sampleTime(fetch_time_, target.length()) - (std::chrono::steady_clock::now() - start));
+  if (left.count() > 0) {
+    if (token != nullptr) {
+      token->sleepFor(left);
+      return !token->hasAborted();
+    }
+    std::this_thread::sleep_for(left);
+  }
+  return true;
+}
+
+std::chrono::microseconds PackageManagerFake::sampleTime(const StepTime& step, uint64_t size) const {
+  std::lock_guard<std::mutex> lock(generator_mutex_);
+  std::chrono::microseconds time{0};
+  if (step.fixed) {
+    time += step.fixed->sample(generator_);
+  }
+  if (step.per_mib) {
+    const double mib = static_cast<double>(size) / (1U << 20U);
+    const auto per_mib = static_cast<double>(step.per_mib->sample(generator_).count());
+    time += std::chrono::microseconds(static_cast<int64_t>(per_mib * mib));
+  }
+  return time;
 }
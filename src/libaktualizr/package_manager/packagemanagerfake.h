@@ -1,18 +1,32 @@
 #ifndef PACKAGEMANAGERFAKE_H_
 #define PACKAGEMANAGERFAKE_H_
 
+#include <chrono>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <string>
 
+#include <boost/optional.hpp>
+
 #include "libaktualizr/packagemanagerinterface.h"
 
 #include "bootloader/bootloader.h"
-
+#include "utilities/time_distribution.h"
+
+/**
+ * Package manager that only stores the binary Targets, for tests and
+ * simulations. Its fetch, install and finalize steps take no time unless the
+ * fake_*_time options of PackageConfig model how long they take: each step
+ * then takes a random duration plus a random duration for each MiB of the
+ * Target. A fetch takes at least its modelled duration, on top of which the
+ * network is not counted.
+ */
 class PackageManagerFake : public PackageManagerInterface {
  public:
+  /** @throw std::invalid_argument if a fake_*_time option is invalid */
   PackageManagerFake(const PackageConfig &pconfig, const BootloaderConfig &bconfig,
-                     const std::shared_ptr<INvStorage> &storage, const std::shared_ptr<HttpInterface> &http)
-      : PackageManagerInterface(pconfig, bconfig, storage, http), bootloader_{new Bootloader(bconfig, *storage_)} {}
+                     const std::shared_ptr<INvStorage> &storage, const std::shared_ptr<HttpInterface> &http);
   ~PackageManagerFake() override = default;
   PackageManagerFake(const PackageManagerFake &) = delete;
   PackageManagerFake(PackageManagerFake &&) = delete;
@@ -31,7 +45,19 @@ class PackageManagerFake : public PackageManagerInterface {
                    const FetcherProgressCb &progress_cb, const api::FlowControlToken *token) override;
 
  private:
+  struct StepTime {
+    boost::optional<TimeDistribution> fixed;
+    boost::optional<TimeDistribution> per_mib;
+  };
+
+  std::chrono::microseconds sampleTime(const StepTime &step, uint64_t size) const;
+
   std::unique_ptr<Bootloader> bootloader_;
+  StepTime fetch_time_;
+  StepTime install_time_;
+  StepTime finalize_time_;
+  mutable std::mutex generator_mutex_;
+  mutable std::mt19937_64 generator_;
 };
 
 #endif  // PACKAGEMANAGERFAKE_H_
@@ -1,9 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
@@ -104,6 +109,44 @@ TEST(PackageManagerFake, ListRemove) {
                                         "A81C31AC62620B9215A14FF00544CB07A55B765594F3AB3BE77E70923AE27CF1"));
 }
 
+/* Collect the image files that are neither installed, pending nor among the most recently used. */
+TEST(PackageManagerFake, CollectTargetFiles) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.images_gc = true;
+  config.pacman.images_gc_keep = 1;
+  config.storage.path = temp_dir.Path();
+
+  auto storage = INvStorage::newStorage(config.storage);
+  PackageManagerFake pacman(config.pacman, config.bootloader, storage, nullptr);
+
+  std::vector<Uptane::Target> targets;
+  for (const char* name : {"current", "old", "pending", "recent"}) {
+    const std::string content = std::string("content of ") + name;
+    targets.emplace_back(name, Uptane::EcuMap{}, std::vector<Hash>{Hash::generate(Hash::Type::kSha256, content)},
+                         content.size());
+    ASSERT_TRUE(pacman.importTarget(targets.back(), content.data(), content.size(), nullptr, nullptr));
+  }
+  storage->savePrimaryInstalledVersion(targets[0], InstalledVersionUpdateMode::kCurrent, "");
+  storage->savePrimaryInstalledVersion(targets[2], InstalledVersionUpdateMode::kPending, "");
+
+  pacman.collectTargetFiles();
+  EXPECT_EQ(pacman.verifyTarget(targets[0]), TargetStatus::kGood);
+  EXPECT_EQ(pacman.verifyTarget(targets[1]), TargetStatus::kNotFound);
+  EXPECT_EQ(pacman.verifyTarget(targets[2]), TargetStatus::kGood);
+  EXPECT_EQ(pacman.verifyTarget(targets[3]), TargetStatus::kGood);
+
+  // Over the budget, the most recently used ones go too, but not the wanted ones.
+  config.pacman.images_cache_size = 1;
+  PackageManagerFake budgeted(config.pacman, config.bootloader, storage, nullptr);
+  budgeted.collectTargetFiles({targets[0]});
+  EXPECT_EQ(budgeted.verifyTarget(targets[0]), TargetStatus::kGood);
+  EXPECT_EQ(budgeted.verifyTarget(targets[2]), TargetStatus::kGood);
+  EXPECT_EQ(budgeted.verifyTarget(targets[3]), TargetStatus::kNotFound);
+}
+
 /*
  * Verify a stored target.
  * Verify that a target is unavailable.
@@ -159,6 +202,305 @@ TEST(PackageManagerFake, Verify) {
   EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
 }
 
+class HttpStaging : public HttpFake {
+ public:
+  HttpStaging(const boost::filesystem::path& test_dir_in, std::string content)
+      : HttpFake(test_dir_in), content_(std::move(content)) {}
+  HttpResponse download(const std::string& url, curl_write_callback write_cb, curl_xferinfo_callback progress_cb,
+                        void* userp, curl_off_t from) override {
+    (void)url;
+    (void)progress_cb;
+    offsets.push_back(from);
+    for (const auto& entry : boost::filesystem::directory_iterator(test_dir / "images")) {
+      files_during_download.push_back(entry.path().filename().string());
+    }
+    const size_t length = fail_after > 0 ? fail_after : std::string::npos;
+    const std::string data = content_.substr(static_cast<size_t>(from), length);
+    write_cb(const_cast<char*>(data.data()), 1, data.size(), userp);
+    if (fail_after > 0) {
+      fail_after = 0;
+      return HttpResponse("", 0, CURLE_RECV_ERROR, "connection lost");
+    }
+    return HttpResponse("", 200, CURLE_OK, "");
+  }
+
+  std::vector<std::string> files_during_download;
+  std::vector<curl_off_t> offsets;
+  // Fail the next download after this many bytes
+  size_t fail_after{0};
+
+ private:
+  std::string content_;
+};
+
+/* Downloads are written to a staging file that is renamed once verified. */
+TEST(PackageManagerFake, DownloadStaging) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "staged content";
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  MultiPartSHA256Hasher hasher;
+  hasher.update(reinterpret_cast<const uint8_t*>(content.data()), content.size());
+  const std::string hash = hasher.getHexDigest();
+  Uptane::Target target("some-pkg", primary_ecu, {Hash(Hash::Type::kSha256, hash)}, content.size());
+  EXPECT_TRUE(fakepm.checkDiskSpaceForTargets({target}));
+
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(http->files_during_download, std::vector<std::string>{hash + ".part"});
+  EXPECT_TRUE(boost::filesystem::exists(config.pacman.images_path / hash));
+  EXPECT_FALSE(boost::filesystem::exists(config.pacman.images_path / (hash + ".part")));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
+
+  // Nothing is left to download of it, unlike of a target that can't fit.
+  Uptane::Target huge("huge-pkg", primary_ecu, {Hash(Hash::Type::kSha256, "00")}, static_cast<uint64_t>(1) << 60);
+  EXPECT_TRUE(fakepm.checkDiskSpaceForTargets({target}));
+  EXPECT_FALSE(fakepm.checkDiskSpaceForTargets({target, huge}));
+}
+
+/* An interrupted download continues hashing from the last saved hash state. */
+TEST(PackageManagerFake, DownloadHashCheckpoint) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.hash_checkpoint_interval = 4;
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "checkpointed content";
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const Hash hash = Hash::generate(Hash::Type::kSha256, content);
+  Uptane::Target target("some-pkg", primary_ecu, {hash}, content.size());
+
+  http->fail_after = 10;
+  EXPECT_FALSE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  const auto staging_path = config.pacman.images_path / (hash.HashString() + ".part");
+  const auto state_path = staging_path.string() + ".hashstate";
+  EXPECT_EQ(boost::filesystem::file_size(staging_path), 10);
+  EXPECT_EQ(Utils::parseJSONFile(state_path)["length"].asUInt64(), 10);
+
+  // Only the bytes after the saved state are hashed again, so a change
+  // before it goes unnoticed; it shows that the saved state is used.
+  {
+    std::fstream file(staging_path.string(), std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(0);
+    file.put('C');
+  }
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(http->offsets, (std::vector<curl_off_t>{0, 10}));
+  EXPECT_FALSE(boost::filesystem::exists(state_path));
+  EXPECT_TRUE(boost::filesystem::exists(config.pacman.images_path / hash.HashString()));
+
+  // Without a usable state the whole file is hashed.
+  fakepm.removeTargetFile(target);
+  http->fail_after = 10;
+  EXPECT_FALSE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  Utils::writeFile(state_path, std::string("{\"hash\": \"sha256\", \"length\": 10, \"state\": \"00\"}"));
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
+}
+
+/* Through io_uring, downloads are written and resumed, and stored targets hashed again, the same. */
+TEST(PackageManagerFake, DownloadIoUring) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.io_uring_queue_depth = 2;
+  config.pacman.hash_checkpoint_interval = 0;
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  std::string content;
+  while (content.size() < 1024 * 1024) {
+    content += Utils::randomUuid();
+  }
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  Uptane::Target target("some-pkg", primary_ecu, {Hash::generate(Hash::Type::kSha256, content)}, content.size());
+  http->fail_after = 300000;
+  EXPECT_FALSE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(http->offsets, (std::vector<curl_off_t>{0, 300000}));
+  EXPECT_EQ(Utils::readFile(fakepm.checkTargetFile(target)->second), content);
+
+  // Not verified before by this one
+  PackageManagerFake other(config.pacman, config.bootloader, storage, http);
+  EXPECT_EQ(other.verifyTarget(target), TargetStatus::kGood);
+  {
+    std::fstream file(other.checkTargetFile(target)->second, std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(700000);
+    file.put('!');
+  }
+  PackageManagerFake corrupted(config.pacman, config.bootloader, storage, http);
+  EXPECT_EQ(corrupted.verifyTarget(target), TargetStatus::kHashMismatch);
+}
+
+/* The download tee is given the data once and in order, also across a resumed download. */
+TEST(PackageManagerFake, DownloadTee) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "content given to the tee";
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  Uptane::Target target("some-pkg", primary_ecu, {Hash::generate(Hash::Type::kSha256, content)}, content.size());
+
+  std::string teed;
+  fakepm.setDownloadTee(target, [&teed](const char* data, size_t size) { teed.append(data, size); });
+  http->fail_after = 10;
+  EXPECT_FALSE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(teed, content.substr(0, 10));
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(teed, content);
+
+  // Nothing is given of a download that continues after what the tee got.
+  fakepm.clearDownloadTee(target);
+  fakepm.removeTargetFile(target);
+  http->fail_after = 10;
+  EXPECT_FALSE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  teed.clear();
+  fakepm.setDownloadTee(target, [&teed](const char* data, size_t size) { teed.append(data, size); });
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_TRUE(teed.empty());
+}
+
+/* A streamed target is given to the stream with the verdict of its hashes, and not stored. */
+TEST(PackageManagerFake, StreamTarget) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "content given to the application";
+  boost::filesystem::create_directories(config.pacman.images_path);
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  Uptane::Target target("some-pkg", primary_ecu, {Hash::generate(Hash::Type::kSha256, content)}, content.size());
+  std::string streamed;
+  std::vector<bool> verdicts;
+  TargetStream stream;
+  stream.data = [&streamed](const char* data, size_t size) {
+    streamed.append(data, size);
+    return true;
+  };
+  stream.done = [&verdicts](bool verified) { verdicts.push_back(verified); };
+
+  EXPECT_TRUE(fakepm.streamTarget(target, uptane_fetcher, stream, nullptr, nullptr));
+  EXPECT_EQ(streamed, content);
+  EXPECT_EQ(verdicts, std::vector<bool>{true});
+  EXPECT_FALSE(fakepm.checkTargetFile(target));
+  EXPECT_TRUE(boost::filesystem::is_empty(config.pacman.images_path));
+
+  Uptane::Target bad("bad-pkg", primary_ecu, {Hash(Hash::Type::kSha256, std::string(64, '0'))}, content.size());
+  streamed.clear();
+  EXPECT_FALSE(fakepm.streamTarget(bad, uptane_fetcher, stream, nullptr, nullptr));
+  EXPECT_EQ(streamed, content);
+  EXPECT_EQ(verdicts, (std::vector<bool>{true, false}));
+
+  // Without another mirror to go on from, a lost connection ends the stream.
+  streamed.clear();
+  http->fail_after = 10;
+  EXPECT_FALSE(fakepm.streamTarget(target, uptane_fetcher, stream, nullptr, nullptr));
+  EXPECT_EQ(streamed, content.substr(0, 10));
+  EXPECT_EQ(verdicts, (std::vector<bool>{true, false, false}));
+}
+
+/* All the hashes of a target are checked, from a single pass over the data. */
+TEST(PackageManagerFake, DownloadAllHashes) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "content with two hashes";
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const Hash sha256 = Hash::generate(Hash::Type::kSha256, content);
+  const Hash sha512 = Hash::generate(Hash::Type::kSha512, content);
+  Uptane::Target bad("bad-pkg", primary_ecu, {sha256, Hash(Hash::Type::kSha512, "00")}, content.size());
+  EXPECT_FALSE(fakepm.fetchTarget(bad, uptane_fetcher, keys, nullptr, nullptr));
+
+  Uptane::Target target("some-pkg", primary_ecu, {sha256, sha512}, content.size());
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
+  // A verified file that has changed is checked again.
+  Utils::writeFile(config.pacman.images_path / sha256.HashString(), std::string(content.size(), 'x'));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kHashMismatch);
+}
+
+/* The file of a target is always hashed again before it is installed, even if
+ * its content was replaced in place, with the same size and modification time. */
+TEST(PackageManagerFake, VerifyReplacedContent) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.storage.path = temp_dir.Path();
+  config.uptane.repo_server = "https://tlsserver.com";
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+  const std::string content = "content to replace";
+  auto http = std::make_shared<HttpStaging>(temp_dir.Path(), content);
+  Uptane::Fetcher uptane_fetcher(config, http);
+  KeyManager keys(storage, config.keymanagerConfig());
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, http);
+
+  Uptane::EcuMap primary_ecu{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}};
+  const Hash hash = Hash::generate(Hash::Type::kSha256, content);
+  Uptane::Target target("some-pkg", primary_ecu, {hash}, content.size());
+  EXPECT_TRUE(fakepm.fetchTarget(target, uptane_fetcher, keys, nullptr, nullptr));
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kGood);
+
+  const auto path = config.pacman.images_path / hash.HashString();
+  const auto mtime = boost::filesystem::last_write_time(path);
+  {
+    std::fstream file(path.string(), std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(0);
+    file << std::string(content.size(), 'x');
+  }
+  boost::filesystem::last_write_time(path, mtime);
+  EXPECT_EQ(boost::filesystem::file_size(path), content.size());
+  EXPECT_EQ(fakepm.verifyTarget(target), TargetStatus::kHashMismatch);
+}
+
 TEST(PackageManagerFake, FinalizeAfterReboot) {
   TemporaryDirectory temp_dir;
   Config config;
@@ -184,6 +526,40 @@ TEST(PackageManagerFake, FinalizeAfterReboot) {
   EXPECT_EQ(result.result_code, data::ResultCode::Numeric::kOk);
 }
 
+/* The steps take the time modelled for them, part of it for each MiB of the
+ * Target. */
+TEST(PackageManagerFake, ModelledTimes) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.pacman.images_path = temp_dir.Path() / "images";
+  config.pacman.fake_install_time = "0.1";
+  config.pacman.fake_install_time_per_mib = "uniform:0.1:0.2";
+  config.pacman.fake_finalize_time = "fixed:0.2";
+  config.pacman.fake_time_seed = 1;
+  config.storage.path = temp_dir.Path();
+  std::shared_ptr<INvStorage> storage = INvStorage::newStorage(config.storage);
+
+  PackageManagerFake fakepm(config.pacman, config.bootloader, storage, nullptr);
+
+  Uptane::EcuMap primary_ecu;
+  Uptane::Target target("pkg", primary_ecu, {Hash(Hash::Type::kSha256, "hash")}, 2U << 20U);
+  auto start = std::chrono::steady_clock::now();
+  auto result = fakepm.install(target);
+  EXPECT_EQ(result.result_code, data::ResultCode::Numeric::kOk);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(300));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+  storage->savePrimaryInstalledVersion(target, InstalledVersionUpdateMode::kPending, "");
+
+  start = std::chrono::steady_clock::now();
+  result = fakepm.finalizeInstall(target);
+  EXPECT_EQ(result.result_code, data::ResultCode::Numeric::kOk);
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+
+  config.pacman.fake_fetch_time = "normal:1:2";
+  EXPECT_THROW(PackageManagerFake(config.pacman, config.bootloader, storage, nullptr), std::invalid_argument);
+}
+
 #ifdef FIU_ENABLE
 
 #include "utilities/fault_injection.h"
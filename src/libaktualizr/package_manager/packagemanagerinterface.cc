@@ -1,49 +1,174 @@
 #include "libaktualizr/packagemanagerinterface.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
+#include <boost/algorithm/hex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
+#include <algorithm>
+#include <cctype>
 #include <chrono>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <set>
 
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "http/httpclient.h"
+#include "http/mirror_set.h"
 #include "logging/logging.h"
+#include "package_manager/delta.h"
+#include "package_manager/peer_server.h"
+#include "package_manager/pipelined_writer.h"
+#include "package_manager/segmented_download.h"
+#include "package_manager/target_chunks.h"
+#include "package_manager/target_file_metrics.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
 #include "uptane/fetcher.h"
 #include "utilities/apiqueue.h"
+#include "utilities/io_uring.h"
+#include "utilities/load_admission.h"
+#include "utilities/progress_aggregator.h"
+#include "utilities/utils.h"
+
+// All the hashes computed for a Target, one of each supported type, have to
+// match its metadata.
+static bool matchHashes(const Uptane::Target& target, const std::vector<Hash>& hashes) {
+  return !hashes.empty() &&
+         std::all_of(hashes.begin(), hashes.end(), [&target](const Hash& hash) { return target.MatchHash(hash); });
+}
 
 struct DownloadMetaStruct {
  public:
-  DownloadMetaStruct(Uptane::Target target_in, FetcherProgressCb progress_cb_in, const api::FlowControlToken* token_in)
+  DownloadMetaStruct(Uptane::Target target_in, FetcherProgressCb progress_cb_in, const api::FlowControlToken* token_in,
+                     MultiPartHasher::Backend backend = MultiPartHasher::Backend::kOpenSsl)
       : hash_type{target_in.hashes()[0].type()},
         target{std::move(target_in)},
         token{token_in},
         progress_cb{std::move(progress_cb_in)},
-        time_lastreport{std::chrono::steady_clock::now()} {}
+        time_lastreport{std::chrono::steady_clock::now()},
+        hasher_{target.hashes(), backend} {}
   uintmax_t downloaded_length{0};
   unsigned int last_progress{0};
+  ProgressAggregator::Transfer* transfer{nullptr};
   std::ofstream fhandle;
   const Hash::Type hash_type;
-  MultiPartHasher& hasher() {
-    switch (hash_type) {
-      case Hash::Type::kSha256:
-        return sha256_hasher;
-      case Hash::Type::kSha512:
-        return sha512_hasher;
-      default:
-        throw std::runtime_error("Unknown hash algorithm");
+  // Computes all the hashes of the target in one pass
+  MultiPartCompositeHasher& hasher() {
+    if (hasher_.empty()) {
+      throw std::runtime_error("Unknown hash algorithm");
     }
+    return hasher_;
   }
+  bool matchesTarget() { return matchHashes(target, hasher().getHashes()); }
   Uptane::Target target;
   const api::FlowControlToken* token;
   FetcherProgressCb progress_cb;
   // each LogProgressInterval msec log dowload progress for big files
   std::chrono::time_point<std::chrono::steady_clock> time_lastreport;
 
+  // The hash state is saved to checkpoint_path every checkpoint_interval
+  // bytes, so that a resumed download doesn't have to hash the whole file
+  // again.
+  boost::filesystem::path checkpoint_path;
+  uint64_t checkpoint_interval{0};
+  uint64_t hashed_length{0};
+  uint64_t checkpoint_length{0};
+  std::function<void(const char*, size_t, uint64_t)> tee;
+  // Checks the chunks of the data against the chunk hashes of the target
+  std::unique_ptr<ChunkVerifier> chunk_verifier;
+  // Writes the data instead of fhandle, which then only created the file
+  std::unique_ptr<UringFileWriter> uring;
+
+  void startCheckpoints(boost::filesystem::path path, uint64_t interval) {
+    checkpoint_path = std::move(path);
+    checkpoint_interval = interval;
+    hashed_length = downloaded_length;
+    checkpoint_length = downloaded_length;
+  }
+  // Check the chunks from downloaded_length on, if the target has chunk hashes
+  void startChunks(const TargetChunks& chunks) {
+    if (!chunks.empty()) {
+      chunk_verifier = std_::make_unique<ChunkVerifier>(chunks, downloaded_length);
+    }
+  }
+  void saveCheckpoint() {
+    // The file has to contain everything the state was computed from.
+    if (uring) {
+      uring->flush();
+    } else {
+      fhandle.flush();
+    }
+    Json::Value checkpoint;
+    checkpoint["hash"] = Hash::TypeString(hash_type);
+    checkpoint["length"] = Json::UInt64(hashed_length);
+    checkpoint["state"] = boost::algorithm::hex(hasher().getState());
+    try {
+      Utils::writeFile(checkpoint_path, Utils::jsonToCanonicalStr(checkpoint));
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Unable to save the hash state of " << target.filename() << ": " << e.what();
+    }
+    checkpoint_length = hashed_length;
+  }
+  // Write and hash downloaded data
+  void store(const char* data, size_t size) {
+    if (uring) {
+      uring->write(reinterpret_cast<const uint8_t*>(data), size);
+    } else {
+      fhandle.write(data, static_cast<std::streamsize>(size));
+    }
+    recordTargetFileWrite(size);
+    hasher().update(reinterpret_cast<const unsigned char*>(data), size);
+    if (chunk_verifier) {
+      chunk_verifier->update(data, size);
+    }
+    if (tee) {
+      tee(data, size, hashed_length);
+    }
+    hashed_length += size;
+    if (checkpoint_interval > 0 && fileGood() && hashed_length - checkpoint_length >= checkpoint_interval) {
+      saveCheckpoint();
+    }
+  }
+
+  // Move disk writes and hashing to a separate thread
+  void startWriter(size_t depth) {
+    writer = std_::make_unique<PipelinedWriter>(depth, [this](const char* data, size_t size) {
+      store(data, size);
+      if (!fileGood()) {
+        throw std::runtime_error("Can't write to the file of target " + target.filename());
+      }
+    });
+  }
+  bool fileGood() const { return uring ? uring->good() : fhandle.good(); }
+  // Write the file from downloaded_length on through io_uring, if enabled and supported
+  void startUring(const std::string& path, uint64_t queue_depth) {
+    if (queue_depth > 0) {
+      uring = UringFileWriter::open(path, downloaded_length, static_cast<unsigned>(queue_depth));
+    }
+  }
+  // Make sure that all downloaded data is in the file and the hasher
+  void flush() {
+    if (writer) {
+      writer->flush();
+    }
+    if (uring && !uring->flush()) {
+      throw std::runtime_error("Can't write to the file of target " + target.filename() + ": " +
+                               std::strerror(uring->error()));
+    }
+  }
+
  private:
-  MultiPartSHA256Hasher sha256_hasher;
-  MultiPartSHA512Hasher sha512_hasher;
+  MultiPartCompositeHasher hasher_;
+
+ public:
+  // Declared last, so that its thread is stopped before the file and hashers
+  // go away.
+  std::unique_ptr<PipelinedWriter> writer;
 };
 
 static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* userp) {
@@ -55,8 +180,13 @@ static size_t DownloadHandler(char* contents, size_t size, size_t nmemb, void* u
     return downloaded + 1;  // curl will abort if return unexpected size;
   }
 
-  ds->fhandle.write(contents, static_cast<std::streamsize>(downloaded));
-  ds->hasher().update(reinterpret_cast<const unsigned char*>(contents), downloaded);
+  if (ds->writer) {
+    if (!ds->writer->write(contents, downloaded)) {
+      return 0;  // the writer failed, abort the transfer
+    }
+  } else {
+    ds->store(contents, downloaded);
+  }
   ds->downloaded_length += downloaded;
   return downloaded;
 }
@@ -69,6 +199,9 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   (void)ultotal;
   (void)ulnow;
   auto* ds = static_cast<DownloadMetaStruct*>(clientp);
+  if (ds->transfer != nullptr) {
+    ds->transfer->update(ds->downloaded_length);
+  }
 
   uint64_t expected = ds->target.length();
   auto progress = static_cast<unsigned int>((ds->downloaded_length * 100) / expected);
@@ -78,7 +211,8 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
     // OTA-4864:Improve binary file download progress logging. Report each XX sec report event that notify user
     auto now = std::chrono::steady_clock::now();
     auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now - ds->time_lastreport);
-    if (milliseconds.count() > LogProgressInterval) {
+    // The progress of all the downloads together is logged instead, if reported
+    if (ds->transfer == nullptr && milliseconds.count() > LogProgressInterval) {
       LOG_INFO << "Download progress for file " << ds->target.filename() << ": " << progress << "%";
       ds->time_lastreport = now;
     }
@@ -89,15 +223,211 @@ static int ProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow,
   return 0;
 }
 
+// Left free on the disk by downloads
+static constexpr uint64_t kReservedDiskSpace = 1 << 20;
+// A peer cache that could not be reached is left alone for that long.
+static constexpr std::chrono::minutes kPeerCacheRetryDelay{10};
+// Longest wait for the peer cache to tell whether it has a target
+static constexpr std::chrono::seconds kPeerCacheProbeTimeout{3};
+
+static size_t DiscardHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  (void)contents;
+  (void)userp;
+  return size * nmemb;
+}
+
+static int ProbeProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  const auto* deadline = static_cast<std::chrono::steady_clock::time_point*>(clientp);
+  return std::chrono::steady_clock::now() > *deadline ? 1 : 0;
+}
+
+// Data of a chunk range, written to the file as it comes
+struct ChunkRange {
+  int fd;
+  uint64_t offset;
+  uint64_t end;
+  ChunkVerifier verifier;
+  const api::FlowControlToken* token;
+};
+
+static size_t ChunkRangeHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  auto* range = static_cast<ChunkRange*>(userp);
+  const size_t downloaded = size * nmemb;
+  if (range->offset + downloaded > range->end) {
+    return downloaded + 1;  // curl will abort if return unexpected size;
+  }
+  size_t written = 0;
+  while (written < downloaded) {
+    const ssize_t res =
+        pwrite(range->fd, contents + written, downloaded - written, static_cast<off_t>(range->offset + written));
+    if (res < 0 && errno == EINTR) {
+      continue;
+    }
+    if (res <= 0) {
+      return 0;
+    }
+    written += static_cast<size_t>(res);
+  }
+  recordTargetFileWrite(downloaded);
+  range->verifier.update(contents, downloaded);
+  range->offset += downloaded;
+  return downloaded;
+}
+
+static int ChunkRangeProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                     curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  const auto* range = static_cast<ChunkRange*>(clientp);
+  return (range->token != nullptr && range->token->hasAborted()) ? 1 : 0;
+}
+
+// Download the given chunks of a target again, over what the file has.
+// Returns false if one of them still doesn't match its hash.
+static bool refetchChunks(HttpInterface& http, const TargetChunks& chunks, const std::vector<size_t>& bad,
+                          const std::string& path, const std::string& url, const api::FlowControlToken* token) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    LOG_WARNING << "Can't open " << path << ": " << std::strerror(errno);
+    return false;
+  }
+  bool result = true;
+  for (const auto& r : chunks.ranges(bad)) {
+    ChunkRange range{fd, r.first, r.second + 1, ChunkVerifier(chunks, r.first), token};
+    const auto from = static_cast<curl_off_t>(r.first);
+    const auto to = static_cast<curl_off_t>(r.second);
+    const HttpResponse response =
+        http.downloadRange(url, ChunkRangeHandler, ChunkRangeProgressHandler, &range, from, to);
+    if (!response.isOk() || response.http_status_code != 206 || range.offset != range.end ||
+        !range.verifier.bad().empty()) {
+      LOG_WARNING << "Download of range " << r.first << "-" << r.second << " of " << url
+                  << " failed: " << (response.isOk() ? std::string("data doesn't match") : response.getStatusStr());
+      result = false;
+      break;
+    }
+  }
+  if (result && fsync(fd) != 0) {
+    result = false;
+  }
+  close(fd);
+  return result;
+}
+
+static boost::filesystem::path stagingPath(const boost::filesystem::path& path) { return path.string() + ".part"; }
+
+static boost::filesystem::path hashStatePath(const boost::filesystem::path& path) {
+  return path.string() + ".hashstate";
+}
+
+static void removeDownloadState(const boost::filesystem::path& path) {
+  boost::filesystem::remove(SegmentedDownload::statePath(path));
+  boost::filesystem::remove(hashStatePath(path));
+}
+
+// Reserve the blocks of a file up front, so that it isn't fragmented by many
+// small writes. The size of the file stays that of the data written, which
+// tells how much of it was downloaded.
+// Returns false if there is no room for the file.
+static bool preallocate(const std::string& path, const uint64_t length) {
+  const int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return true;
+  }
+  bool room = true;
+  if (length > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(length)) != 0 && errno != EOPNOTSUPP) {
+    const int error = errno;
+    LOG_DEBUG << "Unable to preallocate " << path << ": " << std::strerror(error);
+    room = error != ENOSPC;
+    // A failed fallocate can keep the blocks it got, up to all of the free space.
+    struct stat st {};
+    if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size) != 0) {
+      LOG_WARNING << "Unable to release the space reserved for " << path << ": " << std::strerror(errno);
+    }
+  }
+  close(fd);
+  return room;
+}
+
+// Changes whenever the file is written to or replaced.
+static std::string fileFingerprint(const std::string& path) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    return "";
+  }
+  return std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino) + ":" + std::to_string(st.st_size) + ":" +
+         std::to_string(st.st_mtim.tv_sec) + "." + std::to_string(st.st_mtim.tv_nsec) + ":" +
+         std::to_string(st.st_ctim.tv_sec) + "." + std::to_string(st.st_ctim.tv_nsec);
+}
+
+// Hash a file from offset on, read through io_uring; false if that isn't enabled or supported.
+static bool hashWithUring(MultiPartHasher& hasher, const std::string& path, uint64_t offset, uint64_t queue_depth) {
+  if (queue_depth == 0) {
+    return false;
+  }
+  auto reader = UringFileReader::open(path, offset, static_cast<unsigned>(queue_depth));
+  if (reader == nullptr) {
+    return false;
+  }
+  std::vector<uint8_t> buf(IoUring::kBlockSize);
+  for (;;) {
+    const ssize_t read = reader->read(buf.data(), buf.size());
+    if (read < 0) {
+      LOG_WARNING << "Failed to read " << path << ": " << std::strerror(errno);
+    }
+    if (read <= 0) {
+      return true;
+    }
+    recordTargetFileRead(static_cast<uint64_t>(read));
+    hasher.update(buf.data(), static_cast<uint64_t>(read));
+    LoadAdmission::admit(LoadAdmission::Work::kHashing);
+  }
+}
+
 static void restoreHasherState(MultiPartHasher& hasher, std::ifstream data) {
   static constexpr size_t buf_len = 1024;
   std::array<uint8_t, buf_len> buf{};
   do {
     data.read(reinterpret_cast<char*>(buf.data()), buf.size());
+    recordTargetFileRead(static_cast<uint64_t>(data.gcount()));
     hasher.update(buf.data(), static_cast<uint64_t>(data.gcount()));
+    LoadAdmission::admit(LoadAdmission::Work::kHashing);
   } while (data.gcount() != 0);
 }
 
+// Continue from the hash state saved while the file was downloaded, and only
+// hash what was written after it.
+static void resumeHasherState(DownloadMetaStruct& ds, const std::string& path, uint64_t queue_depth) {
+  uint64_t offset = 0;
+  const auto checkpoint_path = hashStatePath(path);
+  if (boost::filesystem::exists(checkpoint_path)) {
+    try {
+      const Json::Value checkpoint = Utils::parseJSONFile(checkpoint_path);
+      const uint64_t length = checkpoint["length"].asUInt64();
+      std::string state;
+      boost::algorithm::unhex(checkpoint["state"].asString(), std::back_inserter(state));
+      if (checkpoint["hash"].asString() == Hash::TypeString(ds.hash_type) &&
+          length <= boost::filesystem::file_size(path) && ds.hasher().setState(state)) {
+        LOG_DEBUG << "Continuing the hash of " << path << " from byte " << length;
+        offset = length;
+      }
+    } catch (const std::exception& e) {
+      LOG_WARNING << "Unable to read the hash state of " << path << ": " << e.what();
+    }
+  }
+  if (!hashWithUring(ds.hasher(), path, offset, queue_depth)) {
+    std::ifstream data(path, std::ios::binary);
+    data.seekg(static_cast<std::streamoff>(offset));
+    ::restoreHasherState(ds.hasher(), std::move(data));
+  }
+}
+
 bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher,
                                           const KeyManager& keys, const FetcherProgressCb& progress_cb,
                                           const api::FlowControlToken* token) {
@@ -107,85 +437,507 @@ bool PackageManagerInterface::fetchTarget(const Uptane::Target& target, Uptane::
     if (target.hashes().empty()) {
       throw Uptane::Exception("image", "No hash defined for the target");
     }
-    TargetStatus exists = PackageManagerInterface::verifyTarget(target);
+    const auto file_mutex = targetFileMutex(targetFileName(target));
+    std::lock_guard<std::mutex> file_guard(*file_mutex);
+    TargetStatus exists = checkStoredTarget(target);
     if (exists == TargetStatus::kGood) {
       LOG_INFO << "Image already downloaded; skipping download";
+      // It may have been completely written but not renamed yet.
+      commitTargetFile(target);
+      // Mark it as recently used
+      storage_->storeTargetFilename(target.filename(), storage_->getTargetFilename(target.filename()));
+      return true;
+    }
+    if (exists != TargetStatus::kIncomplete && reuseTargetFile(target)) {
       return true;
     }
-    std::unique_ptr<DownloadMetaStruct> ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+    evictTargetFiles(targetFileName(target), target.length());
+    std::unique_ptr<ProgressAggregator::Transfer> transfer;
+    if (progress_aggregator_) {
+      transfer = progress_aggregator_->start(target.length());
+    }
+    const TargetChunks chunks = TargetChunks::fromTarget(target);
+    // Only the state of the libsodium hashers can be saved for the checkpoints.
+    const auto hash_backend =
+        config.hash_checkpoint_interval > 0 ? MultiPartHasher::Backend::kSodium : MultiPartHasher::Backend::kOpenSsl;
+    std::unique_ptr<DownloadMetaStruct> ds =
+        std_::make_unique<DownloadMetaStruct>(target, progress_cb, token, hash_backend);
+    ds->transfer = transfer.get();
     if (target.length() == 0) {
       LOG_INFO << "Skipping download of target with length 0";
       ds->fhandle = createTargetFile(target);
+      if (transfer) {
+        transfer->complete();
+      }
       return true;
     }
+
+    // The mirrors of the Image repository also serve the targets without a URI of their own.
+    const std::shared_ptr<MirrorSet> repo_mirrors = fetcher.getRepoMirrors();
+    std::shared_ptr<MirrorSet> mirrors = repo_mirrors;
+    std::string target_path = "/targets/" + Utils::urlEncode(target.filename());
+    if (!target.uri().empty()) {
+      mirrors = std::make_shared<MirrorSet>(target.uri());
+      target_path.clear();
+    }
+    const std::vector<size_t> mirror_order = mirrors->ranked();
+    size_t mirror = 0;
+    std::string target_url = mirrors->url(mirror_order[mirror]) + target_path;
+
+    // With the chunk hashes of the target, only the chunks of a file that
+    // doesn't match are downloaded again. Most of them have to be good, or
+    // it isn't the file they describe.
+    auto repair_chunks = [&](const std::vector<size_t>& bad) {
+      if (bad.empty() || 2 * bad.size() > chunks.count()) {
+        return false;
+      }
+      const std::string url = mirrors->url(mirror_order[mirror]) + target_path;
+      LOG_INFO << bad.size() << " of " << chunks.count() << " chunks of " << target.filename()
+               << " don't match, downloading them again from " << url;
+      return refetchChunks(*http_, chunks, bad, checkTargetFile(target)->second, url, token) &&
+             PackageManagerInterface::verifyTarget(target) == TargetStatus::kGood;
+    };
+    if (exists == TargetStatus::kHashMismatch && !chunks.empty() &&
+        repair_chunks(chunks.badChunks(checkTargetFile(target)->second))) {
+      commitTargetFile(target);
+      if (transfer) {
+        transfer->complete();
+      }
+      return true;
+    }
+
+    if (exists != TargetStatus::kIncomplete &&
+        fetchDelta(target, repo_mirrors->url(repo_mirrors->ranked()[0]), progress_cb, token)) {
+      if (transfer) {
+        transfer->complete();
+      }
+      return true;
+    }
+
+    std::unique_ptr<SegmentedDownload> segmented;
+    std::string peer_url;
+    auto target_file = checkTargetFile(target);
+    if (exists == TargetStatus::kIncomplete && SegmentedDownload::hasState(target_file->second)) {
+      segmented = std_::make_unique<SegmentedDownload>(target, target_file->second, http_, target_url, progress_cb,
+                                                       token);
+      if (!segmented->restore()) {
+        LOG_WARNING << "Unable to continue segmented download of " << target.filename() << ", starting over";
+        segmented->clearState();
+        segmented.reset();
+        exists = TargetStatus::kNotFound;
+      }
+    } else {
+      // The peer cache serves a single stream, and a tee takes one.
+      peer_url = peerCacheUrl(target);
+      if (peer_url.empty() && !downloadTee(target) && exists != TargetStatus::kIncomplete &&
+          config.download_segments > 1 && target.length() >= 2 * SegmentedDownload::kMinSegmentSize) {
+        if (!checkAvailableDiskSpace(target.length())) {
+          throw std::runtime_error("Insufficient disk space available to download target");
+        }
+        createStagingFile(target).close();
+        target_file = checkTargetFile(target);
+        segmented = std_::make_unique<SegmentedDownload>(target, target_file->second, http_, target_url, progress_cb,
+                                                         token);
+        segmented->init(config.download_segments);
+      }
+    }
+    if (segmented) {
+      segmented->setTransfer(transfer.get());
+      if (segmented->run()) {
+        segmented->clearState();
+        if (!matchHashes(target, segmented->hashes()) &&
+            (chunks.empty() || !repair_chunks(chunks.badChunks(target_file->second)))) {
+          removeTargetFile(target);
+          throw Uptane::TargetHashMismatch(target.filename());
+        }
+        commitTargetFile(target);
+        if (transfer) {
+          transfer->complete();
+        }
+        return true;
+      }
+      LOG_WARNING << "The image server doesn't support byte range requests,"
+                     " download the image as a single stream: "
+                  << target_url;
+      segmented->clearState();
+      segmented.reset();
+      exists = TargetStatus::kNotFound;
+    }
+
+    if (exists == TargetStatus::kIncomplete) {
+      ds->downloaded_length = checkTargetFile(target)->first;
+      if (transfer) {
+        transfer->resumeAt(ds->downloaded_length);
+      }
+    }
+    const uint64_t required_bytes = target.length() - ds->downloaded_length;
+    if (!checkAvailableDiskSpace(required_bytes)) {
+      throw std::runtime_error("Insufficient disk space available to download target");
+    }
+
     if (exists == TargetStatus::kIncomplete) {
       LOG_INFO << "Continuing incomplete download of file " << target.filename();
-      auto target_check = checkTargetFile(target);
-      ds->downloaded_length = target_check->first;
-      ::restoreHasherState(ds->hasher(), openTargetFile(target));
+      const std::string path = checkTargetFile(target)->second;
+      if (!preallocate(path, target.length())) {
+        throw std::runtime_error("Insufficient disk space available to download target");
+      }
+      ::resumeHasherState(*ds, path, config.io_uring_queue_depth);
       ds->fhandle = appendTargetFile(target);
     } else {
       // If the target was found, but is oversized or the hash doesn't match,
       // just start over.
       LOG_DEBUG << "Initiating download of file " << target.filename();
-      ds->fhandle = createTargetFile(target);
+      ds->fhandle = createStagingFile(target);
     }
-
-    const uint64_t required_bytes = target.length() - ds->downloaded_length;
-    if (!checkAvailableDiskSpace(required_bytes)) {
-      throw std::runtime_error("Insufficient disk space available to download target");
+    ds->startCheckpoints(hashStatePath(checkTargetFile(target)->second), config.hash_checkpoint_interval);
+    ds->startChunks(chunks);
+    ds->startUring(checkTargetFile(target)->second, config.io_uring_queue_depth);
+    ds->tee = downloadTee(target);
+    if (config.download_buffers > 0) {
+      ds->startWriter(config.download_buffers);
     }
 
-    std::string target_url = target.uri();
-    if (target_url.empty()) {
-      target_url = fetcher.getRepoServer() + "/targets/" + Utils::urlEncode(target.filename());
+    // Start over from an empty file
+    auto restart = [&]() {
+      ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token, hash_backend);
+      ds->transfer = transfer.get();
+      ds->fhandle = createStagingFile(target);
+      ds->startCheckpoints(hashStatePath(checkTargetFile(target)->second), config.hash_checkpoint_interval);
+      ds->startChunks(chunks);
+      ds->startUring(checkTargetFile(target)->second, config.io_uring_queue_depth);
+      ds->tee = downloadTee(target);
+      if (config.download_buffers > 0) {
+        ds->startWriter(config.download_buffers);
+      }
+    };
+    bool from_peer = !peer_url.empty();
+    // The file has data from the peer cache, which is downloaded again from
+    // the servers if it doesn't match.
+    bool peer_data = from_peer;
+    if (from_peer) {
+      LOG_INFO << "Downloading " << target.filename() << " from the peer cache " << peer_url;
+      target_url = peer_url;
     }
 
     HttpResponse response;
     for (;;) {
-      response = http_->download(target_url, DownloadHandler, ProgressHandler, ds.get(),
-                                 static_cast<curl_off_t>(ds->downloaded_length));
-
-      if (response.curl_code == CURLE_RANGE_ERROR) {
-        LOG_WARNING << "The image server doesn't support byte range requests,"
-                       " try to download the image from the beginning: "
-                    << target_url;
-        ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
-        ds->fhandle = createTargetFile(target);
-        continue;
-      }
+      for (;;) {
+        const auto start = std::chrono::steady_clock::now();
+        const uint64_t offset = ds->downloaded_length;
+        response = http_->download(target_url, DownloadHandler, ProgressHandler, ds.get(),
+                                   static_cast<curl_off_t>(ds->downloaded_length));
+
+        if (response.curl_code == CURLE_RANGE_ERROR) {
+          LOG_WARNING << "The image server doesn't support byte range requests,"
+                         " try to download the image from the beginning: "
+                      << target_url;
+          restart();
+          continue;
+        }
 
-      if (!response.wasInterrupted()) {
+        if (!response.wasInterrupted()) {
+          if (from_peer) {
+            if (response.isOk()) {
+              break;
+            }
+            from_peer = false;
+            target_url = mirrors->url(mirror_order[mirror]) + target_path;
+            LOG_WARNING << "Download of " << target.filename() << " from the peer cache failed: "
+                        << response.getStatusStr() << ", continuing from " << target_url;
+            // Only what came before a network failure is the beginning of the target.
+            if (response.curl_code == CURLE_OK || response.curl_code == CURLE_WRITE_ERROR) {
+              restart();
+              peer_data = false;
+            }
+            continue;
+          }
+          if (response.isOk()) {
+            mirrors->recordSuccess(mirror_order[mirror], ds->downloaded_length - offset,
+                                   std::chrono::steady_clock::now() - start);
+            break;
+          }
+          mirrors->recordFailure(mirror_order[mirror]);
+          // Only a network failure moves the download: the body of an error
+          // response is in the file already, and an oversized target or a
+          // failed write is the same from any mirror.
+          if (response.curl_code == CURLE_OK || response.curl_code == CURLE_WRITE_ERROR ||
+              mirror + 1 >= mirror_order.size()) {
+            break;
+          }
+          target_url = mirrors->url(mirror_order[++mirror]) + target_path;
+          LOG_WARNING << "Download of " << target.filename() << " failed: " << response.getStatusStr()
+                      << ", continuing from " << target_url << " at byte " << ds->downloaded_length;
+          continue;
+        }
+        ds->flush();
+        ds->fhandle.close();
+        // sleep if paused or abort the download
+        if (!token->canContinue()) {
+          throw Uptane::Exception("image", "Download of a target was aborted");
+        }
+        ds->fhandle = appendTargetFile(target);
+      }
+      LOG_TRACE << "Download status: " << response.getStatusStr() << std::endl;
+      // Report a failure of the writer rather than the resulting curl error.
+      ds->flush();
+      if (ds->writer) {
+        const auto stats = ds->writer->stats();
+        LOG_DEBUG << "Download writer for " << target.filename() << " processed " << stats.buffers << " buffers, "
+                  << "stalled " << stats.stalls << " times for " << stats.stall_time.count() << " ms";
+      }
+      if (!response.isOk()) {
+        if (response.curl_code == CURLE_WRITE_ERROR) {
+          throw Uptane::OversizedTarget(target.filename());
+        }
+        throw Uptane::Exception("image", "Could not download file, error: " + response.error_message);
+      }
+      if (ds->matchesTarget()) {
         break;
       }
       ds->fhandle.close();
-      // sleep if paused or abort the download
-      if (!token->canContinue()) {
-        throw Uptane::Exception("image", "Download of a target was aborted");
+      if (ds->chunk_verifier) {
+        // The chunks checked during the download aren't read again.
+        std::vector<size_t> bad = ds->chunk_verifier->bad();
+        const std::vector<size_t> unchecked =
+            chunks.badChunks(checkTargetFile(target)->second, ds->chunk_verifier->unchecked());
+        bad.insert(bad.end(), unchecked.begin(), unchecked.end());
+        if (repair_chunks(bad)) {
+          break;
+        }
       }
-      ds->fhandle = appendTargetFile(target);
+      if (!peer_data) {
+        removeTargetFile(target);
+        throw Uptane::TargetHashMismatch(target.filename());
+      }
+      from_peer = false;
+      peer_data = false;
+      target_url = mirrors->url(mirror_order[mirror]) + target_path;
+      LOG_WARNING << "The data of " << target.filename() << " from the peer cache doesn't match its hashes,"
+                  << " downloading it again from " << target_url;
+      restart();
+    }
+    ds->fhandle.close();
+    commitTargetFile(target);
+    if (transfer) {
+      transfer->complete();
+    }
+    result = true;
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Error while downloading a target: " << e.what();
+  }
+  return result;
+}
+
+bool PackageManagerInterface::importTarget(const Uptane::Target& target, const char* data, const uint64_t size,
+                                           const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) {
+  static constexpr uint64_t kImportChunkSize = 1024 * 1024;
+  bool result = false;
+  try {
+    if (target.IsOstree()) {
+      throw Uptane::Exception("image", "OSTree targets can't be imported");
+    }
+    if (target.hashes().empty()) {
+      throw Uptane::Exception("image", "No hash defined for the target");
+    }
+    if (size != target.length()) {
+      throw Uptane::Exception("image", "The length of the data doesn't match the target");
+    }
+    const auto file_mutex = targetFileMutex(targetFileName(target));
+    std::lock_guard<std::mutex> file_guard(*file_mutex);
+    if (checkStoredTarget(target) == TargetStatus::kGood) {
+      LOG_INFO << "Image already stored; skipping import";
+      commitTargetFile(target);
+      storage_->storeTargetFilename(target.filename(), storage_->getTargetFilename(target.filename()));
+      return true;
     }
-    LOG_TRACE << "Download status: " << response.getStatusStr() << std::endl;
-    if (!response.isOk()) {
-      if (response.curl_code == CURLE_WRITE_ERROR) {
-        throw Uptane::OversizedTarget(target.filename());
+    evictTargetFiles(targetFileName(target), target.length());
+    if (!checkAvailableDiskSpace(target.length())) {
+      throw std::runtime_error("Insufficient disk space available to import target");
+    }
+    std::unique_ptr<ProgressAggregator::Transfer> transfer;
+    if (progress_aggregator_) {
+      transfer = progress_aggregator_->start(target.length());
+    }
+    auto ds = std_::make_unique<DownloadMetaStruct>(target, progress_cb, token);
+    ds->transfer = transfer.get();
+    LOG_DEBUG << "Importing file " << target.filename();
+    ds->fhandle = createStagingFile(target);
+    ds->startUring(checkTargetFile(target)->second, config.io_uring_queue_depth);
+    ds->tee = downloadTee(target);
+    if (config.download_buffers > 0) {
+      ds->startWriter(config.download_buffers);
+    }
+    while (ds->downloaded_length < size) {
+      const auto chunk = static_cast<size_t>(std::min(kImportChunkSize, size - ds->downloaded_length));
+      if (ds->writer) {
+        if (!ds->writer->write(data + ds->downloaded_length, chunk)) {
+          break;
+        }
+      } else {
+        ds->store(data + ds->downloaded_length, chunk);
+        if (!ds->fileGood()) {
+          throw std::runtime_error("Can't write to the file of target " + target.filename());
+        }
+      }
+      ds->downloaded_length += chunk;
+      if (ProgressHandler(ds.get(), 0, 0, 0, 0) != 0 || (token != nullptr && !token->canContinue())) {
+        throw Uptane::Exception("image", "Import of a target was aborted");
       }
-      throw Uptane::Exception("image", "Could not download file, error: " + response.error_message);
     }
-    if (!target.MatchHash(Hash(ds->hash_type, ds->hasher().getHexDigest()))) {
+    // Reports a failure of the writer
+    ds->flush();
+    if (!ds->matchesTarget()) {
       ds->fhandle.close();
       removeTargetFile(target);
       throw Uptane::TargetHashMismatch(target.filename());
     }
     ds->fhandle.close();
+    commitTargetFile(target);
+    if (transfer) {
+      transfer->complete();
+    }
     result = true;
   } catch (const std::exception& e) {
-    LOG_WARNING << "Error while downloading a target: " << e.what();
+    LOG_WARNING << "Error while importing a target: " << e.what();
   }
   return result;
 }
 
+// State of a download into a TargetStream
+struct StreamMetaStruct {
+  StreamMetaStruct(const Uptane::Target& target_in, const TargetStream& stream_in, FetcherProgressCb progress_cb_in,
+                   const api::FlowControlToken* token_in)
+      : target{target_in},
+        stream{stream_in},
+        progress_cb{std::move(progress_cb_in)},
+        token{token_in},
+        hasher{target_in.hashes()} {}
+  const Uptane::Target& target;
+  const TargetStream& stream;
+  FetcherProgressCb progress_cb;
+  const api::FlowControlToken* token;
+  ProgressAggregator::Transfer* transfer{nullptr};
+  MultiPartCompositeHasher hasher;
+  uint64_t length{0};
+  unsigned int last_progress{0};
+};
+
+static size_t StreamHandler(char* contents, size_t size, size_t nmemb, void* userp) {
+  auto* ss = static_cast<StreamMetaStruct*>(userp);
+  const size_t received = size * nmemb;
+  if (ss->length + received > ss->target.length()) {
+    return received + 1;  // curl will abort if return unexpected size;
+  }
+  if (!ss->stream.data(contents, received)) {
+    return 0;
+  }
+  ss->hasher.update(reinterpret_cast<const unsigned char*>(contents), received);
+  ss->length += received;
+  return received;
+}
+
+static int StreamProgressHandler(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                 curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto* ss = static_cast<StreamMetaStruct*>(clientp);
+  if (ss->transfer != nullptr) {
+    ss->transfer->update(ss->length);
+  }
+  auto progress = static_cast<unsigned int>((ss->length * 100) / ss->target.length());
+  if (ss->progress_cb && progress > ss->last_progress) {
+    ss->last_progress = progress;
+    ss->progress_cb(ss->target, "Downloading", progress);
+  }
+  if (ss->token != nullptr && ss->token->hasAborted()) {
+    return 1;
+  }
+  return 0;
+}
+
+bool PackageManagerInterface::streamTarget(const Uptane::Target& target, Uptane::Fetcher& fetcher,
+                                           const TargetStream& stream, const FetcherProgressCb& progress_cb,
+                                           const api::FlowControlToken* token) {
+  bool verified = false;
+  try {
+    if (target.IsOstree()) {
+      throw Uptane::Exception("image", "OSTree targets can't be streamed");
+    }
+    if (target.hashes().empty()) {
+      throw Uptane::Exception("image", "No hash defined for the target");
+    }
+    std::unique_ptr<ProgressAggregator::Transfer> transfer;
+    if (progress_aggregator_) {
+      transfer = progress_aggregator_->start(target.length());
+    }
+    StreamMetaStruct ss(target, stream, progress_cb, token);
+    ss.transfer = transfer.get();
+
+    std::shared_ptr<MirrorSet> mirrors = fetcher.getRepoMirrors();
+    std::string target_path = "/targets/" + Utils::urlEncode(target.filename());
+    if (!target.uri().empty()) {
+      mirrors = std::make_shared<MirrorSet>(target.uri());
+      target_path.clear();
+    }
+    const std::vector<size_t> mirror_order = mirrors->ranked();
+    size_t mirror = 0;
+    LOG_DEBUG << "Streaming target " << target.filename() << " to the application";
+    while (ss.length < target.length()) {
+      const auto start = std::chrono::steady_clock::now();
+      const uint64_t offset = ss.length;
+      const HttpResponse response =
+          http_->download(mirrors->url(mirror_order[mirror]) + target_path, StreamHandler, StreamProgressHandler, &ss,
+                          static_cast<curl_off_t>(offset));
+      if (response.wasInterrupted()) {
+        // sleep if paused or abort the download
+        if (!token->canContinue()) {
+          throw Uptane::Exception("image", "Download of a target was aborted");
+        }
+        continue;
+      }
+      if (response.isOk()) {
+        mirrors->recordSuccess(mirror_order[mirror], ss.length - offset, std::chrono::steady_clock::now() - start);
+        break;
+      }
+      mirrors->recordFailure(mirror_order[mirror]);
+      // The data given to the stream can't be taken back, so only a network
+      // failure goes on, from another mirror.
+      if (response.curl_code == CURLE_OK || response.curl_code == CURLE_WRITE_ERROR ||
+          response.curl_code == CURLE_RANGE_ERROR || mirror + 1 >= mirror_order.size()) {
+        throw Uptane::Exception("image", "Could not download file, error: " + response.getStatusStr());
+      }
+      ++mirror;
+      LOG_WARNING << "Download of " << target.filename() << " failed: " << response.getStatusStr()
+                  << ", continuing from " << mirrors->url(mirror_order[mirror]) + target_path << " at byte "
+                  << ss.length;
+    }
+    if (ss.length != target.length() || !matchHashes(target, ss.hasher.getHashes())) {
+      throw Uptane::TargetHashMismatch(target.filename());
+    }
+    if (transfer) {
+      transfer->complete();
+    }
+    verified = true;
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Error while streaming a target: " << e.what();
+  }
+  if (stream.done) {
+    stream.done(verified);
+  }
+  return verified;
+}
+
 TargetStatus PackageManagerInterface::verifyTarget(const Uptane::Target& target) const {
+  return verifyTargetFile(target, false);
+}
+
+TargetStatus PackageManagerInterface::checkStoredTarget(const Uptane::Target& target) const {
+  return verifyTargetFile(target, true);
+}
+
+TargetStatus PackageManagerInterface::verifyTargetFile(const Uptane::Target& target, bool trust_verified) const {
   auto target_exists = checkTargetFile(target);
   if (!target_exists) {
     LOG_DEBUG << "File " << target.filename() << " with expected hash not found in the database.";
@@ -196,31 +948,79 @@ TargetStatus PackageManagerInterface::verifyTarget(const Uptane::Target& target)
   } else if (target_exists->first > target.length()) {
     LOG_DEBUG << "File " << target.filename() << " was found in the database, but is oversized.";
     return TargetStatus::kOversized;
+  } else if (SegmentedDownload::hasState(target_exists->second)) {
+    LOG_DEBUG << "File " << target.filename() << " was found in the database, but some segments are incomplete.";
+    return TargetStatus::kIncomplete;
   }
 
-  // Even if the file exists and the length matches, recheck the hash.
+  // Even if the file exists and the length matches, recheck the hash. The
+  // fingerprint of the file can be kept while its content is replaced, so an
+  // earlier check is only trusted where asked to.
+  if (trust_verified && isVerifiedFile(target, target_exists->second)) {
+    return TargetStatus::kGood;
+  }
   DownloadMetaStruct ds(target, nullptr, nullptr);
   ds.downloaded_length = target_exists->first;
-  ::restoreHasherState(ds.hasher(), openTargetFile(target));
-  if (!target.MatchHash(Hash(ds.hash_type, ds.hasher().getHexDigest()))) {
+  if (!hashWithUring(ds.hasher(), target_exists->second, 0, config.io_uring_queue_depth)) {
+    ::restoreHasherState(ds.hasher(), openTargetFile(target));
+  }
+  const std::vector<Hash> hashes = ds.hasher().getHashes();
+  if (!matchHashes(target, hashes)) {
     LOG_ERROR << "Target exists with expected length, but hash does not match metadata! " << target;
     return TargetStatus::kHashMismatch;
   }
+  recordVerifiedFile(target_exists->second, hashes);
 
   return TargetStatus::kGood;
 }
 
-bool PackageManagerInterface::checkAvailableDiskSpace(const uint64_t required_bytes) const {
+void PackageManagerInterface::recordVerifiedFile(const std::string& path, const std::vector<Hash>& hashes) const {
+  std::lock_guard<std::mutex> guard(verified_files_mutex_);
+  verified_files_[path] = {fileFingerprint(path), hashes};
+}
+
+bool PackageManagerInterface::isVerifiedFile(const Uptane::Target& target, const std::string& path) const {
+  std::lock_guard<std::mutex> guard(verified_files_mutex_);
+  const auto it = verified_files_.find(path);
+  if (it == verified_files_.end() || it->second.first.empty() || it->second.first != fileFingerprint(path)) {
+    return false;
+  }
+  // Every hash of the target that can be checked has to be among the verified ones.
+  const auto& verified = it->second.second;
+  bool checked = false;
+  for (const auto& hash : target.hashes()) {
+    if (hash.type() != Hash::Type::kSha256 && hash.type() != Hash::Type::kSha512) {
+      continue;
+    }
+    if (std::find(verified.begin(), verified.end(), hash) == verified.end()) {
+      return false;
+    }
+    checked = true;
+  }
+  return checked;
+}
+
+uint64_t PackageManagerInterface::availableDiskSpace() const {
+  // The images directory is only created along with the first file in it.
+  boost::filesystem::path path = config.images_path;
+  boost::system::error_code error;
+  while (path.has_parent_path() && !boost::filesystem::exists(path, error)) {
+    path = path.parent_path();
+  }
   struct statvfs stvfsbuf {};
-  const int stat_res = statvfs(config.images_path.c_str(), &stvfsbuf);
+  const int stat_res = statvfs(path.c_str(), &stvfsbuf);
   if (stat_res < 0) {
     LOG_WARNING << "Unable to read filesystem statistics: error code " << stat_res;
-    return true;
+    return std::numeric_limits<uint64_t>::max();
   }
-  const uint64_t available_bytes = (static_cast<uint64_t>(stvfsbuf.f_bsize) * stvfsbuf.f_bavail);
-  const uint64_t reserved_bytes = 1 << 20;
+  return static_cast<uint64_t>(stvfsbuf.f_bsize) * stvfsbuf.f_bavail;
+}
 
-  if (required_bytes + reserved_bytes < available_bytes) {
+bool PackageManagerInterface::checkAvailableDiskSpace(const uint64_t required_bytes) const {
+  const uint64_t available_bytes = availableDiskSpace();
+  const uint64_t reserved_bytes = kReservedDiskSpace;
+
+  if (available_bytes == std::numeric_limits<uint64_t>::max() || required_bytes + reserved_bytes < available_bytes) {
     return true;
   } else {
     LOG_ERROR << "Insufficient disk space available to download target! Required: " << required_bytes
@@ -229,6 +1029,20 @@ bool PackageManagerInterface::checkAvailableDiskSpace(const uint64_t required_by
   }
 }
 
+bool PackageManagerInterface::checkDiskSpaceForTargets(const std::vector<Uptane::Target>& targets) const {
+  uint64_t required_bytes = 0;
+  std::set<std::string> files;
+  for (const auto& target : targets) {
+    // Targets with the same content share a file.
+    if (target.IsOstree() || target.hashes().empty() || !files.insert(targetFileName(target)).second) {
+      continue;
+    }
+    const auto file = checkTargetFile(target);
+    required_bytes += target.length() - (file ? std::min<uint64_t>(file->first, target.length()) : 0);
+  }
+  return required_bytes == 0 || checkAvailableDiskSpace(required_bytes);
+}
+
 boost::optional<std::pair<uintmax_t, std::string>> PackageManagerInterface::checkTargetFile(
     const Uptane::Target& target) const {
   std::string filename = storage_->getTargetFilename(target.filename());
@@ -237,6 +1051,10 @@ boost::optional<std::pair<uintmax_t, std::string>> PackageManagerInterface::chec
     if (boost::filesystem::exists(path)) {
       return {{boost::filesystem::file_size(path), path.string()}};
     }
+    path = stagingPath(path);
+    if (boost::filesystem::exists(path)) {
+      return {{boost::filesystem::file_size(path), path.string()}};
+    }
   }
   return boost::none;
 }
@@ -250,11 +1068,25 @@ std::ifstream PackageManagerInterface::openTargetFile(const Uptane::Target& targ
   if (!stream.good()) {
     throw std::runtime_error("Can't open file " + file->second);
   }
+  recordTargetFileOpen();
   return stream;
 }
 
+int PackageManagerInterface::openTargetFd(const Uptane::Target& target) const {
+  auto file = checkTargetFile(target);
+  if (!file) {
+    throw std::runtime_error("File doesn't exist for target " + target.filename());
+  }
+  const int fd = open(file->second.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Can't open file " + file->second + ": " + std::strerror(errno));
+  }
+  recordTargetFileOpen();
+  return fd;
+}
+
 std::ofstream PackageManagerInterface::createTargetFile(const Uptane::Target& target) {
-  std::string filename = target.hashes()[0].HashString();
+  std::string filename = targetFileName(target);
   std::string filepath = (config.images_path / filename).string();
   boost::filesystem::create_directories(config.images_path);
   std::ofstream stream(filepath, std::ios::binary | std::ios::ate);
@@ -265,6 +1097,47 @@ std::ofstream PackageManagerInterface::createTargetFile(const Uptane::Target& ta
   return stream;
 }
 
+std::ofstream PackageManagerInterface::createStagingFile(const Uptane::Target& target) {
+  const std::string filename = targetFileName(target);
+  const auto path = config.images_path / filename;
+  // What is left under the name of the target doesn't match it.
+  boost::filesystem::remove(path);
+  removeDownloadState(path);
+  removeDownloadState(stagingPath(path));
+  boost::filesystem::create_directories(config.images_path);
+  const std::string staging_path = stagingPath(path).string();
+  std::ofstream stream(staging_path, std::ios::binary | std::ios::trunc);
+  if (!stream.good()) {
+    throw std::runtime_error("Can't write to file " + staging_path);
+  }
+  if (!preallocate(staging_path, target.length())) {
+    stream.close();
+    boost::filesystem::remove(staging_path);
+    throw std::runtime_error("Insufficient disk space available for target " + target.filename());
+  }
+  storage_->storeTargetFilename(target.filename(), filename);
+  return stream;
+}
+
+void PackageManagerInterface::commitTargetFile(const Uptane::Target& target) {
+  const auto path = config.images_path / storage_->getTargetFilename(target.filename());
+  const auto staging_path = stagingPath(path);
+  boost::filesystem::remove(hashStatePath(path));
+  boost::filesystem::remove(hashStatePath(staging_path));
+  if (!boost::filesystem::exists(staging_path)) {
+    return;
+  }
+  // Make sure the content is on disk before it shows up under the final name.
+  const int fd = open(staging_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd >= 0) {
+    fsync(fd);
+    close(fd);
+  }
+  boost::filesystem::rename(staging_path, path);
+  // Only called once the content was verified
+  recordVerifiedFile(path.string(), target.hashes());
+}
+
 std::ofstream PackageManagerInterface::appendTargetFile(const Uptane::Target& target) {
   auto file = checkTargetFile(target);
   if (!file) {
@@ -282,8 +1155,12 @@ void PackageManagerInterface::removeTargetFile(const Uptane::Target& target) {
   if (!file) {
     throw std::runtime_error("File doesn't exist for target " + target.filename());
   }
-  boost::filesystem::remove(file->second);
   storage_->deleteTargetInfo(target.filename());
+  // The file may still be used by Targets with the same content.
+  if (storage_->getTargetNamesByFilename(boost::filesystem::path(file->second).filename().string()).empty()) {
+    boost::filesystem::remove(file->second);
+    removeDownloadState(file->second);
+  }
 }
 
 std::vector<Uptane::Target> PackageManagerInterface::getTargetFiles() {
@@ -295,3 +1172,365 @@ std::vector<Uptane::Target> PackageManagerInterface::getTargetFiles() {
   }
   return v;
 }
+
+// The upper case hash string, as in the names of the files downloaded before.
+std::string PackageManagerInterface::targetFileName(const Uptane::Target& target) {
+  for (const auto& hash : target.hashes()) {
+    if (hash.type() == Hash::Type::kSha256) {
+      return hash.HashString();
+    }
+  }
+  return target.hashes()[0].HashString();
+}
+
+boost::optional<Uptane::Target> PackageManagerInterface::findStoredTarget(const std::string& sha256) const {
+  auto is_hex = [](char c) { return std::isxdigit(static_cast<unsigned char>(c)) != 0; };
+  if (sha256.size() != 64 || !std::all_of(sha256.begin(), sha256.end(), is_hex)) {
+    return boost::none;
+  }
+  const std::string filename = boost::algorithm::to_upper_copy(sha256);
+  const auto path = config.images_path / filename;
+  boost::system::error_code error;
+  const uintmax_t size = boost::filesystem::file_size(path, error);
+  if (error || SegmentedDownload::hasState(path)) {
+    return boost::none;
+  }
+  for (const auto& name : storage_->getTargetNamesByFilename(filename)) {
+    Uptane::Target target(name, Uptane::EcuMap{}, {Hash(Hash::Type::kSha256, sha256)}, size);
+    // Hashed when it was stored, and only again if the file has changed since
+    if (checkStoredTarget(target) == TargetStatus::kGood) {
+      return target;
+    }
+  }
+  return boost::none;
+}
+
+std::string PackageManagerInterface::peerCacheUrl(const Uptane::Target& target) {
+  if (config.peer_cache_url.empty()) {
+    return "";
+  }
+  const auto hash = std::find_if(target.hashes().begin(), target.hashes().end(),
+                                 [](const Hash& h) { return h.type() == Hash::Type::kSha256; });
+  if (hash == target.hashes().end()) {
+    return "";
+  }
+  const auto now = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> guard(peer_cache_mutex_);
+    if (now < peer_cache_retry_) {
+      return "";
+    }
+  }
+  const std::string url =
+      config.peer_cache_url + PeerServer::kTargetsPath + boost::algorithm::to_lower_copy(hash->HashString());
+  // Ask for the first byte, which doesn't leave an error page in the file if
+  // the cache doesn't have the target.
+  auto deadline = now + kPeerCacheProbeTimeout;
+  const HttpResponse response = http_->downloadRange(url, DiscardHandler, ProbeProgressHandler, &deadline, 0, 0);
+  if (response.curl_code == CURLE_OK && response.http_status_code == 206) {
+    return url;
+  }
+  if (response.curl_code != CURLE_OK) {
+    LOG_INFO << "Peer cache " << config.peer_cache_url << " is not available: " << response.getStatusStr();
+    std::lock_guard<std::mutex> guard(peer_cache_mutex_);
+    peer_cache_retry_ = now + kPeerCacheRetryDelay;
+  } else {
+    LOG_DEBUG << "Peer cache doesn't have " << target.filename() << ": HTTP " << response.http_status_code;
+  }
+  return "";
+}
+
+// Use a file downloaded for another Target with the same content.
+bool PackageManagerInterface::reuseTargetFile(const Uptane::Target& target) {
+  if (target.length() == 0) {
+    return false;
+  }
+  const std::string filename = targetFileName(target);
+  const auto path = config.images_path / filename;
+  if (!boost::filesystem::exists(path) || boost::filesystem::file_size(path) != target.length() ||
+      SegmentedDownload::hasState(path)) {
+    return false;
+  }
+  if (!isVerifiedFile(target, path.string())) {
+    DownloadMetaStruct ds(target, nullptr, nullptr);
+    ::restoreHasherState(ds.hasher(), std::ifstream(path.string(), std::ios::binary));
+    const std::vector<Hash> hashes = ds.hasher().getHashes();
+    if (!matchHashes(target, hashes)) {
+      return false;
+    }
+    recordVerifiedFile(path.string(), hashes);
+  }
+  storage_->storeTargetFilename(target.filename(), filename);
+  LOG_INFO << "Image with the same content as " << target.filename() << " already downloaded; skipping download";
+  return true;
+}
+
+// Build the Target from a base image available locally and a patch, falling
+// back to a full download if that fails.
+bool PackageManagerInterface::fetchDelta(const Uptane::Target& target, const std::string& repo_server,
+                                         const FetcherProgressCb& progress_cb, const api::FlowControlToken* token) {
+  for (const auto& delta : TargetDelta::fromTarget(target)) {
+    // The images are stored under their upper case hash.
+    const boost::filesystem::path base_name = boost::algorithm::to_upper_copy(delta.from);
+    const auto base_path = (config.images_path / base_name).lexically_normal();
+    if (base_path.lexically_relative(config.images_path) != base_name) {
+      LOG_WARNING << "Ignoring the delta of " << target.filename() << " from outside of the images directory";
+      continue;
+    }
+    if (!boost::filesystem::exists(base_path)) {
+      continue;
+    }
+    const auto patch_path = config.images_path / (delta.patch.hashes()[0].HashString() + ".bsdiff");
+    try {
+      if (!checkAvailableDiskSpace(delta.patch.length() + target.length())) {
+        return false;
+      }
+      std::string patch_url = delta.uri;
+      if (patch_url.empty()) {
+        patch_url = repo_server + "/targets/" + Utils::urlEncode(delta.patch.filename());
+      }
+      LOG_INFO << "Downloading " << target.filename() << " as a patch of " << delta.patch.length()
+               << " bytes against image " << delta.from;
+
+      // Report the progress of the patch as the progress of the Target.
+      FetcherProgressCb patch_progress_cb;
+      if (progress_cb) {
+        patch_progress_cb = [&target, &progress_cb](const Uptane::Target& patch, const std::string& description,
+                                                    unsigned int progress) {
+          (void)patch;
+          progress_cb(target, description, progress);
+        };
+      }
+      DownloadMetaStruct ds(delta.patch, patch_progress_cb, token);
+      ds.fhandle.open(patch_path.string(), std::ios::binary | std::ios::trunc);
+      if (!ds.fhandle.good()) {
+        throw std::runtime_error("Can't write to file " + patch_path.string());
+      }
+      HttpResponse response;
+      for (;;) {
+        response = http_->download(patch_url, DownloadHandler, ProgressHandler, &ds,
+                                   static_cast<curl_off_t>(ds.downloaded_length));
+        if (!response.wasInterrupted()) {
+          break;
+        }
+        ds.fhandle.close();
+        // sleep if paused or abort the download
+        if (token == nullptr || !token->canContinue()) {
+          throw Uptane::Exception("image", "Download of a target was aborted");
+        }
+        ds.fhandle.open(patch_path.string(), std::ios::binary | std::ios::app);
+      }
+      ds.fhandle.close();
+      if (!response.isOk()) {
+        throw Uptane::Exception("image", "Could not download patch, error: " + response.error_message);
+      }
+      if (!ds.matchesTarget()) {
+        throw Uptane::TargetHashMismatch(delta.patch.filename());
+      }
+
+      DownloadMetaStruct result(target, nullptr, nullptr);
+      result.fhandle = createStagingFile(target);
+      applyBsdiff(base_path, patch_path, target.length(), [&result](const char* data, size_t size) {
+        result.fhandle.write(data, static_cast<std::streamsize>(size));
+        recordTargetFileWrite(size);
+        result.hasher().update(reinterpret_cast<const unsigned char*>(data), size);
+      });
+      result.fhandle.close();
+      boost::filesystem::remove(patch_path);
+      if (!result.fhandle.good() || !result.matchesTarget()) {
+        removeTargetFile(target);
+        throw Uptane::TargetHashMismatch(target.filename());
+      }
+      commitTargetFile(target);
+      return true;
+    } catch (const std::exception& e) {
+      boost::filesystem::remove(patch_path);
+      if (token != nullptr && token->hasAborted()) {
+        throw;
+      }
+      LOG_WARNING << "Unable to apply patch to " << target.filename() << ", downloading the full image: " << e.what();
+      return false;
+    }
+  }
+  return false;
+}
+
+// Make room for `required` bytes within the images_cache_size budget by
+// removing the least recently used files.
+void PackageManagerInterface::evictTargetFiles(const std::string& keep, const uint64_t required) {
+  if (config.images_cache_size == 0) {
+    return;
+  }
+  const auto installed = installedTargetFiles();
+  std::vector<std::pair<std::string, uintmax_t>> files;
+  uint64_t total = required;
+  for (const auto& filename : storage_->getTargetFilenamesByUsage()) {
+    auto path = config.images_path / filename;
+    if (!boost::filesystem::exists(path)) {
+      path = stagingPath(path);
+    }
+    if (filename == keep || !boost::filesystem::exists(path)) {
+      continue;
+    }
+    const uintmax_t size = boost::filesystem::file_size(path);
+    total += size;
+    // Still takes up the space, but has to stay
+    if (installed.count(filename) == 0) {
+      files.emplace_back(filename, size);
+    }
+  }
+
+  for (const auto& file : files) {
+    if (total <= config.images_cache_size) {
+      break;
+    }
+    if (removeUnusedFile(file.first)) {
+      LOG_INFO << "Removed least recently used image file " << file.first << " (" << file.second
+               << " bytes) to stay within the images cache size";
+      total -= file.second;
+    }
+  }
+}
+
+bool PackageManagerInterface::removeUnusedFile(const std::string& filename) {
+  // Downloads can't start while the lock is held.
+  std::lock_guard<std::mutex> guard(target_files_mutex_);
+  const auto it = target_file_locks_.find(filename);
+  if (it != target_file_locks_.end() && !it->second.expired()) {
+    // Being downloaded
+    return false;
+  }
+  if (installedTargetFiles().count(filename) != 0) {
+    return false;
+  }
+  const auto path = config.images_path / filename;
+  for (const auto& file_path : {path, stagingPath(path)}) {
+    boost::filesystem::remove(file_path);
+    removeDownloadState(file_path);
+  }
+  for (const auto& name : storage_->getTargetNamesByFilename(filename)) {
+    storage_->deleteTargetInfo(name);
+  }
+  return true;
+}
+
+std::set<std::string> PackageManagerInterface::installedTargetFiles() const {
+  std::set<std::string> files;
+  EcuSerials serials;
+  storage_->loadEcuSerials(&serials);
+  // The empty serial is the Primary's, also before the ECUs are registered.
+  std::vector<std::string> ecus{""};
+  for (const auto& serial : serials) {
+    ecus.push_back(serial.first.ToString());
+  }
+  for (const auto& ecu : ecus) {
+    boost::optional<Uptane::Target> current;
+    boost::optional<Uptane::Target> pending;
+    storage_->loadInstalledVersions(ecu, &current, &pending);
+    for (const auto& installed : {current, pending}) {
+      if (installed && !installed->hashes().empty()) {
+        files.insert(targetFileName(*installed));
+      }
+    }
+  }
+  return files;
+}
+
+void PackageManagerInterface::collectTargetFiles(const std::vector<Uptane::Target>& wanted) {
+  if (!config.images_gc) {
+    return;
+  }
+  std::lock_guard<std::mutex> gc_guard(gc_mutex_);
+  std::set<std::string> keep;
+  uint64_t required = 0;
+  for (const auto& target : wanted) {
+    if (target.IsOstree() || target.hashes().empty() || !keep.insert(targetFileName(target)).second) {
+      continue;
+    }
+    const auto file = checkTargetFile(target);
+    required += target.length() - (file ? std::min<uint64_t>(file->first, target.length()) : 0);
+  }
+  const auto installed = installedTargetFiles();
+  keep.insert(installed.begin(), installed.end());
+
+  // Least recently used first
+  std::vector<std::pair<std::string, uintmax_t>> files;
+  uint64_t total = 0;
+  for (const auto& filename : storage_->getTargetFilenamesByUsage()) {
+    auto path = config.images_path / filename;
+    if (!boost::filesystem::exists(path)) {
+      path = stagingPath(path);
+    }
+    boost::system::error_code error;
+    uintmax_t size = boost::filesystem::file_size(path, error);
+    if (error) {
+      size = 0;
+    }
+    total += size;
+    if (keep.count(filename) == 0) {
+      files.emplace_back(filename, size);
+    }
+  }
+  const size_t recent = files.size() - std::min<size_t>(files.size(), config.images_gc_keep);
+  uint64_t removed = 0;
+  for (size_t i = 0; i < files.size(); ++i) {
+    const bool over_budget = config.images_cache_size > 0 && total + required > config.images_cache_size;
+    const bool short_of_space = required > 0 && required + kReservedDiskSpace >= availableDiskSpace();
+    if (i >= recent && !over_budget && !short_of_space) {
+      break;
+    }
+    if (removeUnusedFile(files[i].first)) {
+      LOG_DEBUG << "Removed unused image file " << files[i].first << " (" << files[i].second << " bytes)";
+      total -= files[i].second;
+      removed += files[i].second;
+    }
+  }
+  if (removed > 0) {
+    LOG_INFO << "Removed " << removed << " bytes of unused image files";
+  }
+}
+
+void PackageManagerInterface::setDownloadTee(const Uptane::Target& target, DownloadTee tee) {
+  auto given = std::make_shared<uint64_t>(0);
+  std::lock_guard<std::mutex> guard(download_tees_mutex_);
+  download_tees_[target.filename()] = [tee, given](const char* data, size_t size, uint64_t offset) {
+    if (offset > *given || offset + size <= *given) {
+      return;
+    }
+    const auto skip = static_cast<size_t>(*given - offset);
+    tee(data + skip, size - skip);
+    *given += size - skip;
+  };
+}
+
+void PackageManagerInterface::clearDownloadTee(const Uptane::Target& target) {
+  std::lock_guard<std::mutex> guard(download_tees_mutex_);
+  download_tees_.erase(target.filename());
+}
+
+void PackageManagerInterface::setProgressAggregator(std::shared_ptr<ProgressAggregator> aggregator) {
+  progress_aggregator_ = std::move(aggregator);
+}
+
+std::function<void(const char*, size_t, uint64_t)> PackageManagerInterface::downloadTee(const Uptane::Target& target) {
+  std::lock_guard<std::mutex> guard(download_tees_mutex_);
+  const auto tee = download_tees_.find(target.filename());
+  return tee == download_tees_.end() ? nullptr : tee->second;
+}
+
+std::shared_ptr<std::mutex> PackageManagerInterface::targetFileMutex(const std::string& filename) {
+  std::lock_guard<std::mutex> guard(target_files_mutex_);
+  for (auto it = target_file_locks_.begin(); it != target_file_locks_.end();) {
+    if (it->second.expired()) {
+      it = target_file_locks_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  auto file_mutex = target_file_locks_[filename].lock();
+  if (!file_mutex) {
+    file_mutex = std::make_shared<std::mutex>();
+    target_file_locks_[filename] = file_mutex;
+  }
+  return file_mutex;
+}
@@ -0,0 +1,271 @@
+#include "package_manager/peer_server.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <system_error>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/optional.hpp>
+
+#include "libaktualizr/packagemanagerinterface.h"
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/utils.h"
+
+namespace {
+
+constexpr size_t kMaxRequestSize = 8192;
+constexpr size_t kChunkSize = 64 * 1024;
+
+bool sendAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    // Not sendfile(), which would raise SIGPIPE when the peer goes away
+    const ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      return false;
+    }
+    data += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
+
+bool sendAll(int fd, const std::string &data) { return sendAll(fd, data.data(), data.size()); }
+
+std::string emptyResponse(const std::string &status, const std::string &headers = "") {
+  return "HTTP/1.1 " + status + "\r\n" + headers + "Content-Length: 0\r\nConnection: close\r\n\r\n";
+}
+
+// The first and last byte of a "bytes=first-last" range of a body of size
+// bytes, the whole body if there is no range or one that can't be parsed.
+// Returns false if the range is out of the body.
+bool parseRange(const std::string &request, uint64_t size, uint64_t *first, uint64_t *last) {
+  *first = 0;
+  *last = size - 1;
+  std::istringstream lines(request);
+  std::string line;
+  while (std::getline(lines, line)) {
+    const auto colon = line.find(':');
+    if (colon == std::string::npos || !boost::iequals(boost::trim_copy(line.substr(0, colon)), "range")) {
+      continue;
+    }
+    const std::string value = boost::trim_copy(line.substr(colon + 1));
+    const auto dash = value.find('-');
+    if (!boost::starts_with(value, "bytes=") || dash == std::string::npos || value.find(',') != std::string::npos) {
+      return true;
+    }
+    const std::string from = value.substr(6, dash - 6);
+    const std::string to = value.substr(dash + 1);
+    try {
+      if (from.empty()) {
+        // The last bytes
+        const uint64_t suffix = std::stoull(to);
+        if (suffix == 0) {
+          return false;
+        }
+        *first = size - std::min(suffix, size);
+      } else {
+        *first = std::stoull(from);
+        if (!to.empty()) {
+          *last = std::min<uint64_t>(std::stoull(to), size - 1);
+        }
+      }
+    } catch (const std::exception &) {
+      *first = 0;
+      *last = size - 1;
+      return true;
+    }
+    return *first <= *last;
+  }
+  return true;
+}
+
+}  // namespace
+
+PeerServer::PeerServer(std::shared_ptr<PackageManagerInterface> package_manager, uint16_t port)
+    : package_manager_{std::move(package_manager)} {
+  try {
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd_ == -1) {
+      throw std::system_error(errno, std::system_category(), "socket");
+    }
+    const int reuse = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(port);                // NOLINT(readability-isolate-declaration)
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);  // NOLINT(readability-isolate-declaration)
+    if (bind(listen_fd_, reinterpret_cast<const sockaddr *>(&sa), sizeof(sa)) == -1 ||
+        listen(listen_fd_, SOMAXCONN) == -1) {
+      throw std::system_error(errno, std::system_category(), "bind");
+    }
+    stop_fd_ = eventfd(0, EFD_CLOEXEC);
+    if (stop_fd_ == -1) {
+      throw std::system_error(errno, std::system_category(), "eventfd");
+    }
+    port_ = static_cast<uint16_t>(Utils::ipPort(Utils::ipGetSockaddr(listen_fd_)));
+    LOG_INFO << "Serving the stored targets to peers on port " << port_;
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Could not serve the stored targets to peers on port " << port << ": " << e.what();
+    for (int *fd : {&listen_fd_, &stop_fd_}) {
+      if (*fd != -1) {
+        close(*fd);
+        *fd = -1;
+      }
+    }
+    return;
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+PeerServer::~PeerServer() {
+  if (thread_.joinable()) {
+    const uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+      LOG_ERROR << "Could not stop the peer server: " << std::strerror(errno);
+    }
+    thread_.join();
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (const int fd : connections_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    cv_.wait(lock, [this] { return connections_.empty(); });
+  }
+  if (stop_fd_ != -1) {
+    close(stop_fd_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+}
+
+void PeerServer::run() {
+  for (;;) {
+    std::array<pollfd, 2> fds{pollfd{stop_fd_, POLLIN, 0}, pollfd{listen_fd_, POLLIN, 0}};
+    const int res = poll(fds.data(), fds.size(), -1);
+    if (res == -1 && errno != EINTR) {
+      LOG_ERROR << "The peer server failed: " << std::strerror(errno);
+      break;
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      break;
+    }
+    if ((fds[1].revents & POLLIN) == 0) {
+      continue;
+    }
+    const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd == -1) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (connections_.size() >= kMaxConnections) {
+        LOG_DEBUG << "Turning a peer away, already serving " << connections_.size() << " of them";
+        timeval send_timeout{1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+        sendAll(fd, emptyResponse("503 Service Unavailable", "Retry-After: 10\r\n"));
+        close(fd);
+        continue;
+      }
+      connections_.insert(fd);
+    }
+    // A transfer takes as long as the peer does, so not on the io pool
+    pool_.submit([this, fd]() {
+      {
+        const BackgroundScheduling::Thread background;
+        serve(fd);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      close(fd);
+      connections_.erase(fd);
+      cv_.notify_all();
+    });
+  }
+}
+
+void PeerServer::serve(int fd) const {
+  timeval receive_timeout{5, 0};
+  timeval send_timeout{30, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+  std::string request;
+  std::array<char, 1024> buf{};
+  while (request.size() < kMaxRequestSize && request.find("\r\n\r\n") == std::string::npos) {
+    const ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0) {
+      return;
+    }
+    request.append(buf.data(), static_cast<size_t>(n));
+  }
+
+  std::istringstream request_line(request.substr(0, request.find("\r\n")));
+  std::string method;
+  std::string path;
+  request_line >> method >> path;
+  if (method != "GET" && method != "HEAD") {
+    sendAll(fd, emptyResponse("405 Method Not Allowed", "Allow: GET, HEAD\r\n"));
+    return;
+  }
+  boost::optional<Uptane::Target> target;
+  if (boost::starts_with(path, kTargetsPath)) {
+    target = package_manager_->findStoredTarget(path.substr(std::strlen(kTargetsPath)));
+  }
+  int file = -1;
+  if (target) {
+    try {
+      file = package_manager_->openTargetFd(*target);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not serve " << target->filename() << " to a peer: " << e.what();
+    }
+  }
+  struct stat st {};
+  if (file == -1 || fstat(file, &st) != 0 || st.st_size <= 0) {
+    if (file != -1) {
+      close(file);
+    }
+    sendAll(fd, emptyResponse("404 Not Found"));
+    return;
+  }
+
+  const auto size = static_cast<uint64_t>(st.st_size);
+  uint64_t first = 0;
+  uint64_t last = 0;
+  if (!parseRange(request, size, &first, &last)) {
+    close(file);
+    sendAll(fd, emptyResponse("416 Range Not Satisfiable", "Content-Range: bytes */" + std::to_string(size) + "\r\n"));
+    return;
+  }
+  const bool partial = first != 0 || last != size - 1;
+  std::string headers = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+  headers += "Content-Type: application/octet-stream\r\nAccept-Ranges: bytes\r\n";
+  if (partial) {
+    headers += "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" +
+               std::to_string(size) + "\r\n";
+  }
+  headers += "Content-Length: " + std::to_string(last - first + 1) + "\r\nConnection: close\r\n\r\n";
+  if (sendAll(fd, headers) && method == "GET") {
+    LOG_DEBUG << "Serving " << target->filename() << " to a peer from byte " << first;
+    std::vector<char> chunk(kChunkSize);
+    for (uint64_t offset = first; offset <= last;) {
+      const ssize_t n = pread(file, chunk.data(), std::min<uint64_t>(chunk.size(), last - offset + 1),
+                              static_cast<off_t>(offset));
+      if (n <= 0 || !sendAll(fd, chunk.data(), static_cast<size_t>(n))) {
+        break;
+      }
+      offset += static_cast<uint64_t>(n);
+    }
+  }
+  close(file);
+}
@@ -0,0 +1,64 @@
+#ifndef PEER_SERVER_H_
+#define PEER_SERVER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+
+#include "utilities/executor.h"
+
+class PackageManagerInterface;
+
+/**
+ * Serves the stored targets to the other devices of the local network, which
+ * download them from it before the servers with pacman.peer_cache_url.
+ *
+ * A target is served on /targets/sha256/<hash>, by the SHA-256 hash of its
+ * content, with support for single byte ranges. Only targets that are
+ * completely stored and match the hash are served; the peers verify what
+ * they download against their own metadata all the same.
+ *
+ * Each connection takes a single GET request, answered on a thread of a pool
+ * of kMaxConnections. Further connections are answered with 503 Service
+ * Unavailable right away, upon which the peers download from the servers.
+ */
+class PeerServer {
+ public:
+  static constexpr const char *kTargetsPath = "/targets/sha256/";
+  static constexpr size_t kMaxConnections = 8;
+
+  /** Serve on all interfaces on port, or on any free port with 0. */
+  PeerServer(std::shared_ptr<PackageManagerInterface> package_manager, uint16_t port);
+  /** Stops the transfers in progress. */
+  ~PeerServer();
+  PeerServer(const PeerServer &) = delete;
+  PeerServer(PeerServer &&) = delete;
+  PeerServer &operator=(const PeerServer &) = delete;
+  PeerServer &operator=(PeerServer &&) = delete;
+
+  /** The port the targets are served on, 0 if they are not. */
+  uint16_t port() const { return port_; }
+
+ private:
+  void run();
+  void serve(int fd) const;
+
+  std::shared_ptr<PackageManagerInterface> package_manager_;
+  int listen_fd_{-1};
+  int stop_fd_{-1};
+  uint16_t port_{0};
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  // Connections being served
+  std::set<int> connections_;
+  std::thread thread_;
+  // Destroyed first, while the tasks can still use the rest
+  ThreadPool pool_{"peer", kMaxConnections};
+};
+
+#endif  // PEER_SERVER_H_
@@ -0,0 +1,169 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "crypto/crypto.h"
+#include "crypto/keymanager.h"
+#include "http/httpclient.h"
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "package_manager/packagemanagerfake.h"
+#include "package_manager/peer_server.h"
+#include "storage/sqlstorage.h"
+#include "uptane/fetcher.h"
+#include "utilities/utils.h"
+
+static Uptane::Target makeTarget(const std::string& name, const std::string& content) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Crypto::sha256digestHex(content);
+  target_json["length"] = content.size();
+  return Uptane::Target(name, target_json);
+}
+
+static size_t appendBody(char* data, size_t size, size_t nmemb, void* userp) {
+  static_cast<std::string*>(userp)->append(data, size * nmemb);
+  return size * nmemb;
+}
+
+static int noProgress(void* clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+  (void)clientp;
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  return 0;
+}
+
+static void progress_cb(const Uptane::Target& target, const std::string& description, unsigned int progress) {
+  (void)target;
+  (void)description;
+  (void)progress;
+}
+
+// A device that stores its targets in dir
+struct Device {
+  explicit Device(const TemporaryDirectory& dir) {
+    config.storage.path = dir.Path();
+    config.pacman.images_path = dir.Path() / "images";
+    config.uptane.repo_server = "http://127.0.0.1:1";
+  }
+  void start() {
+    storage = std::make_shared<SQLStorage>(config.storage, false);
+    http = std::make_shared<HttpClient>();
+    pacman = std::make_shared<PackageManagerFake>(config.pacman, config.bootloader, storage, http);
+  }
+
+  Config config;
+  std::shared_ptr<INvStorage> storage;
+  std::shared_ptr<HttpClient> http;
+  std::shared_ptr<PackageManagerFake> pacman;
+};
+
+/* The stored targets are served by hash, whole or by range, and only those. */
+TEST(PeerServer, Serve) {
+  TemporaryDirectory temp_dir;
+  Device device(temp_dir);
+  device.start();
+  const std::string content = Utils::randomUuid() + Utils::randomUuid();
+  const Uptane::Target target = makeTarget("peer_file", content);
+  ASSERT_TRUE(device.pacman->importTarget(target, content.data(), content.size(), progress_cb, nullptr));
+
+  PeerServer server(device.pacman, 0);
+  ASSERT_NE(server.port(), 0);
+  const std::string base = "http://127.0.0.1:" + std::to_string(server.port()) + PeerServer::kTargetsPath;
+  const std::string url = base + target.sha256Hash();
+
+  HttpResponse response = device.http->get(url, HttpInterface::kNoLimit);
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, content);
+
+  std::string body;
+  response = device.http->downloadRange(url, appendBody, noProgress, &body, 4, 9);
+  EXPECT_EQ(response.http_status_code, 206);
+  EXPECT_EQ(body, content.substr(4, 6));
+
+  body.clear();
+  response = device.http->downloadRange(url, appendBody, noProgress, &body, static_cast<curl_off_t>(content.size()),
+                                        static_cast<curl_off_t>(content.size() + 10));
+  EXPECT_EQ(response.http_status_code, 416);
+
+  response = device.http->get(base + Crypto::sha256digestHex("missing"), HttpInterface::kNoLimit);
+  EXPECT_EQ(response.http_status_code, 404);
+  response = device.http->get(base + "../sql.db", HttpInterface::kNoLimit);
+  EXPECT_EQ(response.http_status_code, 404);
+}
+
+/* Beyond kMaxConnections at once, the peers are turned away until one is done. */
+TEST(PeerServer, MaxConnections) {
+  TemporaryDirectory temp_dir;
+  Device device(temp_dir);
+  device.start();
+  const std::string content = Utils::randomUuid();
+  const Uptane::Target target = makeTarget("peer_file", content);
+  ASSERT_TRUE(device.pacman->importTarget(target, content.data(), content.size(), progress_cb, nullptr));
+  PeerServer server(device.pacman, 0);
+  ASSERT_NE(server.port(), 0);
+  const std::string url =
+      "http://127.0.0.1:" + std::to_string(server.port()) + PeerServer::kTargetsPath + target.sha256Hash();
+
+  // Connections that never send their request
+  std::vector<std::unique_ptr<ConnectionSocket>> idle;
+  for (size_t i = 0; i < PeerServer::kMaxConnections; ++i) {
+    idle.push_back(std_::make_unique<ConnectionSocket>("127.0.0.1", server.port()));
+    ASSERT_EQ(idle.back()->connect(), 0);
+  }
+  // Only answered once the server accepted all of them
+  HttpResponse response;
+  for (int attempt = 0; attempt < 100 && response.http_status_code != 503; ++attempt) {
+    response = device.http->get(url, HttpInterface::kNoLimit);
+  }
+  EXPECT_EQ(response.http_status_code, 503);
+
+  idle.pop_back();
+  response = HttpResponse();
+  for (int attempt = 0; attempt < 100 && response.http_status_code != 200; ++attempt) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    response = device.http->get(url, HttpInterface::kNoLimit);
+  }
+  EXPECT_EQ(response.http_status_code, 200);
+  EXPECT_EQ(response.body, content);
+}
+
+/* A device downloads a target from a peer that has it, without the server. */
+TEST(PeerServer, FetchFromPeer) {
+  TemporaryDirectory peer_dir;
+  Device peer(peer_dir);
+  peer.start();
+  const std::string content = Utils::randomUuid();
+  const Uptane::Target target = makeTarget("peer_file", content);
+  ASSERT_TRUE(peer.pacman->importTarget(target, content.data(), content.size(), progress_cb, nullptr));
+  PeerServer server(peer.pacman, 0);
+  ASSERT_NE(server.port(), 0);
+
+  TemporaryDirectory temp_dir;
+  Device device(temp_dir);
+  device.config.pacman.peer_cache_url = "http://127.0.0.1:" + std::to_string(server.port());
+  device.start();
+  KeyManager keys(device.storage, device.config.keymanagerConfig());
+  Uptane::Fetcher fetcher(device.config, device.http);
+
+  EXPECT_TRUE(device.pacman->fetchTarget(target, fetcher, keys, progress_cb, nullptr));
+  EXPECT_EQ(device.pacman->verifyTarget(target), TargetStatus::kGood);
+
+  // Not served by the peer and the server is unreachable
+  const Uptane::Target other = makeTarget("other_file", Utils::randomUuid());
+  EXPECT_FALSE(device.pacman->fetchTarget(other, fetcher, keys, progress_cb, nullptr));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,111 @@
+#include "package_manager/pipelined_writer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+
+PipelinedWriter::PipelinedWriter(size_t depth, Sink sink) : sink_{std::move(sink)}, ring_(std::max<size_t>(depth, 1)) {
+  for (auto &buffer : ring_) {
+    buffer.reserve(kBufferSize);
+  }
+  thread_ = std::thread(&PipelinedWriter::run, this);
+}
+
+PipelinedWriter::~PipelinedWriter() {
+  try {
+    flush();
+  } catch (const std::exception &e) {
+    LOG_ERROR << "Writing downloaded data failed: " << e.what();
+  }
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stop_ = true;
+  }
+  data_cv_.notify_one();
+  thread_.join();
+}
+
+bool PipelinedWriter::write(const char *data, size_t size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (size > 0) {
+    if (!error_.empty()) {
+      return false;
+    }
+    if (count_ == ring_.size()) {
+      ++stats_.stalls;
+      const auto start = std::chrono::steady_clock::now();
+      space_cv_.wait(lock, [this] { return count_ < ring_.size() || !error_.empty(); });
+      stats_.stall_time +=
+          std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+      continue;
+    }
+    // The buffer being filled is not visible to the writer thread, so it can
+    // be filled without holding the lock.
+    auto &buffer = ring_[(head_ + count_) % ring_.size()];
+    lock.unlock();
+    const size_t len = std::min(size, kBufferSize - buffer.size());
+    buffer.insert(buffer.end(), data, data + len);
+    data += len;
+    size -= len;
+    lock.lock();
+    if (buffer.size() == kBufferSize) {
+      commit();
+    }
+  }
+  return error_.empty();
+}
+
+// Must be called with mutex_ held.
+void PipelinedWriter::commit() {
+  ++count_;
+  data_cv_.notify_one();
+}
+
+void PipelinedWriter::flush() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (count_ < ring_.size() && !ring_[(head_ + count_) % ring_.size()].empty()) {
+    commit();
+  }
+  space_cv_.wait(lock, [this] { return count_ == 0; });
+  if (!error_.empty()) {
+    throw std::runtime_error(error_);
+  }
+}
+
+PipelinedWriter::Stats PipelinedWriter::stats() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return stats_;
+}
+
+void PipelinedWriter::run() {
+  const BackgroundScheduling::Thread background;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    data_cv_.wait(lock, [this] { return count_ > 0 || stop_; });
+    if (count_ == 0) {
+      return;
+    }
+    auto &buffer = ring_[head_];
+    const bool failed = !error_.empty();
+    lock.unlock();
+    std::string error;
+    if (!failed) {
+      try {
+        sink_(buffer.data(), buffer.size());
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+    }
+    buffer.clear();
+    lock.lock();
+    if (!error.empty()) {
+      error_ = error;
+    }
+    head_ = (head_ + 1) % ring_.size();
+    --count_;
+    ++stats_.buffers;
+    space_cv_.notify_all();
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef PIPELINED_WRITER_H_
+#define PIPELINED_WRITER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Bounded ring of buffers between a producer (typically a curl write
+ * callback) and a sink that runs on a dedicated thread (typically writing to
+ * disk and hashing).
+ *
+ * The producer only copies data into the ring and is blocked when the ring is
+ * full, so a slow sink still limits the overall speed, but short write
+ * latency spikes no longer stall network reads.
+ */
+class PipelinedWriter {
+ public:
+  // Called on the writer thread; may throw to report an error.
+  using Sink = std::function<void(const char *data, size_t size)>;
+
+  struct Stats {
+    // Buffers handed over to the sink
+    uint64_t buffers{0};
+    // Times the producer had to wait for a free buffer, and for how long
+    uint64_t stalls{0};
+    std::chrono::milliseconds stall_time{0};
+  };
+
+  PipelinedWriter(size_t depth, Sink sink);
+  ~PipelinedWriter();
+  PipelinedWriter(const PipelinedWriter &) = delete;
+  PipelinedWriter(PipelinedWriter &&) = delete;
+  PipelinedWriter &operator=(const PipelinedWriter &) = delete;
+  PipelinedWriter &operator=(PipelinedWriter &&) = delete;
+
+  /**
+   * Queue data for the sink.
+   * @return false if the sink has failed, the data is dropped then.
+   */
+  bool write(const char *data, size_t size);
+  /**
+   * Wait until the sink has processed all queued data.
+   * @throw std::runtime_error if the sink failed.
+   */
+  void flush();
+  Stats stats() const;
+
+  static constexpr size_t kBufferSize = 64 * 1024;
+
+ private:
+  void commit();
+  void run();
+
+  Sink sink_;
+  std::vector<std::vector<char>> ring_;
+  // ring_[head_] is the oldest buffer waiting for the sink, followed by
+  // count_ - 1 others. ring_[(head_ + count_) % size] is being filled.
+  size_t head_{0};
+  size_t count_{0};
+  bool stop_{false};
+  std::string error_;
+  Stats stats_;
+  mutable std::mutex mutex_;
+  std::condition_variable data_cv_;
+  std::condition_variable space_cv_;
+  std::thread thread_;
+};
+
+#endif  // PIPELINED_WRITER_H_
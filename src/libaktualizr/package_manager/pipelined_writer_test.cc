@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "logging/logging.h"
+#include "package_manager/pipelined_writer.h"
+
+/* Data reaches the sink complete and in order, however it is split. */
+TEST(PipelinedWriter, Order) {
+  std::string in;
+  for (int i = 0; i < 300000; ++i) {
+    in += static_cast<char>('a' + i % 26);
+  }
+  std::string out;
+  {
+    PipelinedWriter writer(3, [&out](const char* data, size_t size) { out.append(data, size); });
+    size_t pos = 0;
+    size_t chunk = 1;
+    while (pos < in.size()) {
+      const size_t len = std::min(chunk, in.size() - pos);
+      EXPECT_TRUE(writer.write(in.data() + pos, len));
+      pos += len;
+      chunk = (chunk * 7) % 20000 + 1;
+    }
+    writer.flush();
+    EXPECT_EQ(out, in);
+    EXPECT_GE(writer.stats().buffers, in.size() / PipelinedWriter::kBufferSize);
+  }
+  EXPECT_EQ(out, in);
+}
+
+/* The producer waits, and the wait is counted, when the sink is slower. */
+TEST(PipelinedWriter, Backpressure) {
+  PipelinedWriter writer(1, [](const char* data, size_t size) {
+    (void)data;
+    (void)size;
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  });
+  const std::string buffer(PipelinedWriter::kBufferSize, '@');
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(writer.write(buffer.data(), buffer.size()));
+  }
+  writer.flush();
+  const auto stats = writer.stats();
+  EXPECT_EQ(stats.buffers, 4);
+  EXPECT_GT(stats.stalls, 0);
+}
+
+/* A failing sink makes further writes fail and is reported by flush(). */
+TEST(PipelinedWriter, SinkFailure) {
+  PipelinedWriter writer(2, [](const char* data, size_t size) {
+    (void)data;
+    (void)size;
+    throw std::runtime_error("disk full");
+  });
+  const std::string buffer(PipelinedWriter::kBufferSize, '@');
+  EXPECT_TRUE(writer.write(buffer.data(), buffer.size()));
+  EXPECT_THROW(writer.flush(), std::runtime_error);
+  EXPECT_FALSE(writer.write(buffer.data(), buffer.size()));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
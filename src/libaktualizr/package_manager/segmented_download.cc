@@ -0,0 +1,379 @@
+#include "package_manager/segmented_download.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cassert>
+#include <cstring>
+#include <future>
+
+#include <boost/filesystem.hpp>
+
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+#include "package_manager/target_file_metrics.h"
+#include "uptane/exceptions.h"
+#include "utilities/executor.h"
+#include "utilities/flow_control.h"
+#include "utilities/utils.h"
+
+SegmentedDownload::SegmentedDownload(Uptane::Target target, boost::filesystem::path file,
+                                     std::shared_ptr<HttpInterface> http, std::string url,
+                                     FetcherProgressCb progress_cb, const api::FlowControlToken *token)
+    : target_{std::move(target)},
+      file_{std::move(file)},
+      http_{std::move(http)},
+      url_{std::move(url)},
+      progress_cb_{std::move(progress_cb)},
+      token_{token},
+      hasher_{std_::make_unique<MultiPartCompositeHasher>(target_.hashes())} {}
+
+SegmentedDownload::~SegmentedDownload() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+boost::filesystem::path SegmentedDownload::statePath(const boost::filesystem::path &file) {
+  return file.string() + ".segments";
+}
+
+bool SegmentedDownload::hasState(const boost::filesystem::path &file) {
+  return boost::filesystem::exists(statePath(file));
+}
+
+void SegmentedDownload::openFile() {
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+  fd_ = open(file_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+  if (fd_ < 0) {
+    throw std::runtime_error("Can't open file " + file_.string() + ": " + std::strerror(errno));
+  }
+}
+
+void SegmentedDownload::init(uint64_t segments) {
+  const uint64_t length = target_.length();
+  const uint64_t count = std::max<uint64_t>(1, std::min<uint64_t>(segments, length / kMinSegmentSize));
+  const uint64_t segment_size = length / count;
+
+  segments_.clear();
+  for (uint64_t i = 0; i < count; ++i) {
+    Segment segment;
+    segment.from = i * segment_size;
+    segment.to = (i == count - 1) ? length - 1 : (i + 1) * segment_size - 1;
+    segments_.push_back(segment);
+  }
+  downloaded_ = 0;
+
+  openFile();
+  if (ftruncate(fd_, 0) != 0 || posix_fallocate(fd_, 0, static_cast<off_t>(length)) != 0) {
+    // Some filesystems do not support preallocation, a sparse file will do.
+    if (ftruncate(fd_, static_cast<off_t>(length)) != 0) {
+      throw std::runtime_error("Can't allocate file " + file_.string() + ": " + std::strerror(errno));
+    }
+  }
+  LOG_DEBUG << "Downloading " << target_.filename() << " in " << segments_.size() << " segments";
+  saveState();
+}
+
+bool SegmentedDownload::restore() {
+  try {
+    const Json::Value state = Utils::parseJSONFile(statePath(file_));
+    if (state["length"].asUInt64() != target_.length() || !state["segments"].isArray() ||
+        boost::filesystem::file_size(file_) != target_.length()) {
+      return false;
+    }
+    std::vector<Segment> segments;
+    uint64_t next = 0;
+    uint64_t downloaded = 0;
+    for (const auto &s : state["segments"]) {
+      Segment segment;
+      segment.from = s["from"].asUInt64();
+      segment.to = s["to"].asUInt64();
+      segment.done = s["done"].asUInt64();
+      if (segment.from != next || segment.to < segment.from || segment.done > segment.size()) {
+        return false;
+      }
+      next = segment.to + 1;
+      downloaded += segment.done;
+      segments.push_back(segment);
+    }
+    if (next != target_.length()) {
+      return false;
+    }
+    segments_ = std::move(segments);
+    downloaded_ = downloaded;
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Unable to read segmented download state of " << target_.filename() << ": " << e.what();
+    return false;
+  }
+  openFile();
+  LOG_INFO << "Continuing segmented download of " << target_.filename() << " (" << downloaded_ << " of "
+           << target_.length() << " bytes)";
+  return true;
+}
+
+void SegmentedDownload::saveState() {
+  Json::Value state;
+  {
+    std::lock_guard<std::mutex> guard(state_mutex_);
+    state["length"] = Json::UInt64(target_.length());
+    state["segments"] = Json::arrayValue;
+    for (const auto &segment : segments_) {
+      Json::Value s;
+      s["from"] = Json::UInt64(segment.from);
+      s["to"] = Json::UInt64(segment.to);
+      s["done"] = Json::UInt64(segment.done);
+      state["segments"].append(s);
+    }
+  }
+  // All writers persist the state; make sure they don't interleave.
+  std::lock_guard<std::mutex> guard(state_file_mutex_);
+  try {
+    Utils::writeFile(statePath(file_), Utils::jsonToCanonicalStr(state));
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Unable to save segmented download state of " << target_.filename() << ": " << e.what();
+  }
+}
+
+void SegmentedDownload::clearState() { boost::filesystem::remove(statePath(file_)); }
+
+size_t SegmentedDownload::writeHandler(char *contents, size_t size, size_t nmemb, void *userp) {
+  assert(userp);
+  auto *ctx = static_cast<SegmentContext *>(userp);
+  return ctx->download->write(ctx->index, contents, size * nmemb);
+}
+
+int SegmentedDownload::progressHandler(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                                       curl_off_t ulnow) {
+  (void)dltotal;
+  (void)dlnow;
+  (void)ultotal;
+  (void)ulnow;
+  auto *ctx = static_cast<SegmentContext *>(clientp);
+  return ctx->download->progress();
+}
+
+size_t SegmentedDownload::write(size_t index, const char *data, size_t size) {
+  uint64_t offset;
+  {
+    std::lock_guard<std::mutex> guard(state_mutex_);
+    Segment &segment = segments_[index];
+    if (segment.done + size > segment.size()) {
+      // The server sent more than the requested range, most likely because it
+      // ignored the Range header.
+      return size + 1;  // curl will abort if return unexpected size;
+    }
+    offset = segment.from + segment.done;
+  }
+
+  size_t written = 0;
+  while (written < size) {
+    const ssize_t res = pwrite(fd_, data + written, size - written, static_cast<off_t>(offset + written));
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG_ERROR << "Can't write to file " << file_ << ": " << std::strerror(errno);
+      return 0;
+    }
+    written += static_cast<size_t>(res);
+  }
+  recordTargetFileWrite(size);
+
+  {
+    std::lock_guard<std::mutex> guard(state_mutex_);
+    segments_[index].done += size;
+    downloaded_ += size;
+  }
+
+  // Only one thread hashes at a time; if another one is busy, it will pick up
+  // this data as well, or the final pass in run() will.
+  std::unique_lock<std::mutex> hash_lock(hash_mutex_, std::try_to_lock);
+  if (hash_lock.owns_lock()) {
+    hashAvailable();
+  }
+  return size;
+}
+
+int SegmentedDownload::progress() {
+  if (cancelled_ || (token_ != nullptr && token_->hasAborted())) {
+    return 1;
+  }
+  unsigned int progress;
+  {
+    std::lock_guard<std::mutex> guard(state_mutex_);
+    progress = static_cast<unsigned int>((downloaded_ * 100) / target_.length());
+    // Under the lock, so that the transfer doesn't go back
+    if (transfer_ != nullptr) {
+      transfer_->update(downloaded_);
+    }
+  }
+  {
+    std::lock_guard<std::mutex> guard(progress_mutex_);
+    if (progress <= last_progress_) {
+      return 0;
+    }
+    last_progress_ = progress;
+    if (progress_cb_) {
+      progress_cb_(target_, "Downloading", progress);
+    }
+  }
+  // Checkpoint the ranges at every percent, so that a crash loses little data.
+  saveState();
+  return 0;
+}
+
+// Must be called with hash_mutex_ held (or from a single thread).
+void SegmentedDownload::hashAvailable() {
+  static constexpr size_t buf_len = 64 * 1024;
+  std::array<uint8_t, buf_len> buf{};
+  for (;;) {
+    uint64_t available = 0;
+    {
+      std::lock_guard<std::mutex> guard(state_mutex_);
+      for (const auto &segment : segments_) {
+        if (hashed_ >= segment.from && hashed_ <= segment.to) {
+          available = segment.from + segment.done - hashed_;
+          break;
+        }
+      }
+    }
+    if (available == 0) {
+      return;
+    }
+    while (available > 0) {
+      const auto len = static_cast<size_t>(std::min<uint64_t>(available, buf.size()));
+      const ssize_t res = pread(fd_, buf.data(), len, static_cast<off_t>(hashed_));
+      if (res <= 0) {
+        if (res < 0 && errno == EINTR) {
+          continue;
+        }
+        LOG_ERROR << "Can't read file " << file_ << ": " << std::strerror(errno);
+        return;
+      }
+      recordTargetFileRead(static_cast<uint64_t>(res));
+      hasher_->update(buf.data(), static_cast<uint64_t>(res));
+      hashed_ += static_cast<uint64_t>(res);
+      available -= static_cast<uint64_t>(res);
+    }
+  }
+}
+
+SegmentedDownload::SegmentResult SegmentedDownload::fetchSegment(size_t index) {
+  SegmentContext ctx{this, index};
+  for (;;) {
+    uint64_t from;
+    uint64_t to;
+    {
+      std::lock_guard<std::mutex> guard(state_mutex_);
+      const Segment &segment = segments_[index];
+      if (segment.complete()) {
+        return SegmentResult::kSuccess;
+      }
+      from = segment.from + segment.done;
+      to = segment.to;
+    }
+
+    HttpResponse response = http_->downloadRange(url_, writeHandler, progressHandler, &ctx,
+                                                 static_cast<curl_off_t>(from), static_cast<curl_off_t>(to));
+    if (response.wasInterrupted()) {
+      if (cancelled_) {
+        return SegmentResult::kFailed;
+      }
+      saveState();
+      // sleep if paused or abort the download
+      if (token_ == nullptr || !token_->canContinue()) {
+        cancelled_ = true;
+        return SegmentResult::kAborted;
+      }
+      continue;
+    }
+
+    if (response.curl_code == CURLE_NOT_BUILT_IN || response.curl_code == CURLE_RANGE_ERROR ||
+        (response.isOk() && response.http_status_code != 206) ||
+        (response.curl_code == CURLE_WRITE_ERROR && (response.http_status_code == 200))) {
+      cancelled_ = true;
+      return SegmentResult::kRangesUnsupported;
+    }
+    if (!response.isOk()) {
+      LOG_ERROR << "Download of range " << from << "-" << to << " of " << target_.filename()
+                << " failed: " << response.getStatusStr();
+      {
+        std::lock_guard<std::mutex> guard(state_mutex_);
+        error_ = response.error_message;
+      }
+      cancelled_ = true;
+      return SegmentResult::kFailed;
+    }
+
+    std::lock_guard<std::mutex> guard(state_mutex_);
+    if (segments_[index].from + segments_[index].done == from) {
+      // No progress at all: don't spin on a misbehaving server.
+      error_ = "empty response for range request";
+      cancelled_ = true;
+      return SegmentResult::kFailed;
+    }
+  }
+}
+
+bool SegmentedDownload::run() {
+  hasher_->reset();
+  hashed_ = 0;
+  last_progress_ = static_cast<unsigned int>((downloaded_ * 100) / target_.length());
+  if (transfer_ != nullptr) {
+    transfer_->resumeAt(downloaded_);
+  }
+  cancelled_ = false;
+  // Hash what is already there, e.g. when resuming.
+  {
+    std::lock_guard<std::mutex> guard(hash_mutex_);
+    hashAvailable();
+  }
+
+  std::vector<std::future<SegmentResult>> workers;
+  for (size_t i = 0; i < segments_.size(); ++i) {
+    if (!segments_[i].complete()) {
+      workers.push_back(Executor::io().submit([this, i]() { return fetchSegment(i); }));
+    }
+  }
+  bool aborted = false;
+  bool failed = false;
+  bool unsupported = false;
+  for (auto &worker : workers) {
+    switch (worker.get()) {
+      case SegmentResult::kAborted:
+        aborted = true;
+        break;
+      case SegmentResult::kFailed:
+        failed = true;
+        break;
+      case SegmentResult::kRangesUnsupported:
+        unsupported = true;
+        break;
+      case SegmentResult::kSuccess:
+      default:
+        break;
+    }
+  }
+  saveState();
+
+  if (unsupported) {
+    return false;
+  }
+  if (aborted) {
+    throw Uptane::Exception("image", "Download of a target was aborted");
+  }
+  if (failed) {
+    throw Uptane::Exception("image", "Could not download file, error: " + error_);
+  }
+
+  std::lock_guard<std::mutex> guard(hash_mutex_);
+  hashAvailable();
+  if (hashed_ != target_.length()) {
+    throw Uptane::Exception("image", "Could not hash downloaded file " + file_.string());
+  }
+  return true;
+}
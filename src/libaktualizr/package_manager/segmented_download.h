@@ -0,0 +1,125 @@
+#ifndef SEGMENTED_DOWNLOAD_H_
+#define SEGMENTED_DOWNLOAD_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "crypto/crypto.h"
+#include "libaktualizr/packagemanagerinterface.h"
+#include "libaktualizr/types.h"
+#include "utilities/progress_aggregator.h"
+
+class HttpInterface;
+
+namespace api {
+class FlowControlToken;
+}
+
+/**
+ * Download of a single Target split into several byte ranges that are fetched
+ * in parallel into a preallocated file.
+ *
+ * The Target hash is computed over the file in order, as soon as the
+ * beginning of each range is available, so that no second pass over the whole
+ * file is needed once the last range completes. The progress of each range is
+ * saved next to the file, which allows an interrupted download to be resumed
+ * range by range.
+ */
+class SegmentedDownload {
+ public:
+  SegmentedDownload(Uptane::Target target, boost::filesystem::path file, std::shared_ptr<HttpInterface> http,
+                    std::string url, FetcherProgressCb progress_cb, const api::FlowControlToken *token);
+  ~SegmentedDownload();
+  SegmentedDownload(const SegmentedDownload &) = delete;
+  SegmentedDownload(SegmentedDownload &&) = delete;
+  SegmentedDownload &operator=(const SegmentedDownload &) = delete;
+  SegmentedDownload &operator=(SegmentedDownload &&) = delete;
+
+  /**
+   * Start a new download of the Target split into at most `segments` ranges.
+   * The file is (re)created and preallocated to the Target length.
+   */
+  void init(uint64_t segments);
+  /**
+   * Continue a download from the range state saved next to the file.
+   * @return false if there is no usable saved state.
+   */
+  bool restore();
+
+  /**
+   * Fetch all remaining ranges.
+   * @return false if the server does not honour range requests, in which case
+   *         the caller should fall back to a plain download.
+   * @throw Uptane::Exception if the download failed or was aborted.
+   */
+  bool run();
+  /** Report the progress to transfer too, which must outlive the download. */
+  void setTransfer(ProgressAggregator::Transfer *transfer) { transfer_ = transfer; }
+
+  /** Hashes of the complete file, one of each supported type of the target.
+   * Only valid after run() returned true. */
+  std::vector<Hash> hashes() const { return hasher_->getHashes(); }
+  /** Forget the saved range state, e.g. when the download completed. */
+  void clearState();
+
+  static boost::filesystem::path statePath(const boost::filesystem::path &file);
+  static bool hasState(const boost::filesystem::path &file);
+
+  static constexpr uint64_t kMinSegmentSize = 1024 * 1024;
+
+ private:
+  struct Segment {
+    uint64_t from{0};
+    uint64_t to{0};  // inclusive
+    uint64_t done{0};
+    uint64_t size() const { return to - from + 1; }
+    bool complete() const { return done == size(); }
+  };
+  struct SegmentContext {
+    SegmentedDownload *download;
+    size_t index;
+  };
+  enum class SegmentResult { kSuccess, kRangesUnsupported, kFailed, kAborted };
+
+  static size_t writeHandler(char *contents, size_t size, size_t nmemb, void *userp);
+  static int progressHandler(void *clientp, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal,
+                             curl_off_t ulnow);
+
+  SegmentResult fetchSegment(size_t index);
+  size_t write(size_t index, const char *data, size_t size);
+  int progress();
+  void openFile();
+  void hashAvailable();
+  void saveState();
+
+  Uptane::Target target_;
+  boost::filesystem::path file_;
+  std::shared_ptr<HttpInterface> http_;
+  std::string url_;
+  FetcherProgressCb progress_cb_;
+  const api::FlowControlToken *token_;
+  ProgressAggregator::Transfer *transfer_{nullptr};
+  std::unique_ptr<MultiPartCompositeHasher> hasher_;
+
+  int fd_{-1};
+  std::vector<Segment> segments_;
+  std::atomic<bool> cancelled_{false};
+  // Protects segments_ and downloaded_
+  std::mutex state_mutex_;
+  uint64_t downloaded_{0};
+  // Protects hashed_ and the hasher
+  std::mutex hash_mutex_;
+  uint64_t hashed_{0};
+  // Protects last_progress_ and keeps progress reports in order
+  std::mutex progress_mutex_;
+  unsigned int last_progress_{0};
+  std::mutex state_file_mutex_;
+  std::string error_;
+};
+
+#endif  // SEGMENTED_DOWNLOAD_H_
@@ -0,0 +1,139 @@
+#include "package_manager/target_chunks.h"
+
+#include <array>
+#include <cctype>
+#include <fstream>
+
+#include <boost/algorithm/string.hpp>
+
+TargetChunks TargetChunks::fromTarget(const Uptane::Target &target) {
+  TargetChunks chunks;
+  const Json::Value custom = target.custom_data();
+  if (!custom.isObject() || !custom["chunks"].isObject() || target.length() == 0) {
+    return chunks;
+  }
+  const Json::Value &c = custom["chunks"];
+  if (!c["size"].isUInt64() || c["size"].asUInt64() == 0 || !c["sha256"].isArray()) {
+    return chunks;
+  }
+  const uint64_t size = c["size"].asUInt64();
+  const uint64_t count = target.length() / size + (target.length() % size != 0 ? 1 : 0);
+  if (c["sha256"].size() != count) {
+    return chunks;
+  }
+  auto is_hex = [](char ch) { return std::isxdigit(static_cast<unsigned char>(ch)) != 0; };
+  std::vector<std::string> hashes;
+  hashes.reserve(count);
+  for (const auto &h : c["sha256"]) {
+    const std::string hash = h.isString() ? h.asString() : "";
+    if (hash.size() != 64 || !std::all_of(hash.begin(), hash.end(), is_hex)) {
+      return chunks;
+    }
+    hashes.push_back(boost::algorithm::to_upper_copy(hash));
+  }
+  chunks.size_ = size;
+  chunks.length_ = target.length();
+  chunks.hashes_ = std::move(hashes);
+  return chunks;
+}
+
+bool TargetChunks::matches(size_t index, const std::string &sha256_hex) const {
+  return index < hashes_.size() && boost::algorithm::iequals(hashes_[index], sha256_hex);
+}
+
+std::vector<size_t> TargetChunks::badChunks(const boost::filesystem::path &file,
+                                            const std::vector<size_t> &chunks) const {
+  std::vector<size_t> bad;
+  std::ifstream in(file.string(), std::ios::binary);
+  auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+  std::array<char, 64 * 1024> buf{};
+  for (const size_t index : chunks) {
+    in.clear();
+    if (index >= count() || !in.seekg(static_cast<std::streamoff>(offset(index)))) {
+      bad.push_back(index);
+      continue;
+    }
+    hasher->reset();
+    uint64_t remaining = length(index);
+    while (remaining > 0 && in.good()) {
+      const auto len = static_cast<std::streamsize>(std::min<uint64_t>(remaining, buf.size()));
+      in.read(buf.data(), len);
+      hasher->update(reinterpret_cast<const unsigned char *>(buf.data()), static_cast<uint64_t>(in.gcount()));
+      remaining -= static_cast<uint64_t>(in.gcount());
+    }
+    if (remaining > 0 || !matches(index, hasher->getHexDigest())) {
+      bad.push_back(index);
+    }
+  }
+  return bad;
+}
+
+std::vector<size_t> TargetChunks::badChunks(const boost::filesystem::path &file) const {
+  std::vector<size_t> all(count());
+  for (size_t i = 0; i < all.size(); ++i) {
+    all[i] = i;
+  }
+  return badChunks(file, all);
+}
+
+std::vector<std::pair<uint64_t, uint64_t>> TargetChunks::ranges(const std::vector<size_t> &chunks) const {
+  std::vector<size_t> sorted(chunks);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+  std::vector<std::pair<uint64_t, uint64_t>> result;
+  for (const size_t index : sorted) {
+    if (index >= count()) {
+      continue;
+    }
+    const uint64_t from = offset(index);
+    const uint64_t to = from + length(index) - 1;
+    if (!result.empty() && result.back().second + 1 == from) {
+      result.back().second = to;
+    } else {
+      result.emplace_back(from, to);
+    }
+  }
+  return result;
+}
+
+ChunkVerifier::ChunkVerifier(const TargetChunks &chunks, uint64_t offset)
+    : chunks_{chunks},
+      offset_{offset},
+      first_{static_cast<size_t>(offset / chunks.chunkSize() + (offset % chunks.chunkSize() != 0 ? 1 : 0))},
+      hasher_{MultiPartHasher::create(Hash::Type::kSha256)},
+      checked_(chunks.count(), false) {}
+
+void ChunkVerifier::update(const char *data, size_t size) {
+  while (size > 0) {
+    const auto index = static_cast<size_t>(offset_ / chunks_.chunkSize());
+    if (index >= chunks_.count()) {
+      // Beyond the Target, which fails the download anyway
+      return;
+    }
+    const uint64_t end = chunks_.offset(index) + chunks_.length(index);
+    const auto len = static_cast<size_t>(std::min<uint64_t>(size, end - offset_));
+    if (index >= first_) {
+      hasher_->update(reinterpret_cast<const unsigned char *>(data), len);
+    }
+    offset_ += len;
+    data += len;
+    size -= len;
+    if (offset_ == end && index >= first_) {
+      checked_[index] = true;
+      if (!chunks_.matches(index, hasher_->getHexDigest())) {
+        bad_.push_back(index);
+      }
+      hasher_->reset();
+    }
+  }
+}
+
+std::vector<size_t> ChunkVerifier::unchecked() const {
+  std::vector<size_t> result;
+  for (size_t i = 0; i < checked_.size(); ++i) {
+    if (!checked_[i]) {
+      result.push_back(i);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,86 @@
+#ifndef PACKAGE_MANAGER_TARGET_CHUNKS_H_
+#define PACKAGE_MANAGER_TARGET_CHUNKS_H_
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "libaktualizr/types.h"
+
+/**
+ * The hashes of the fixed-size chunks of a Target, as listed in the custom
+ * metadata of the Target:
+ *
+ *     "custom": {
+ *       "chunks": {
+ *         "size": <length of a chunk, the last one may be shorter>,
+ *         "sha256": ["<sha256 of chunk 0>", "<sha256 of chunk 1>", ...]
+ *       }
+ *     }
+ *
+ * They come with the signed metadata of the Target, so that a chunk that
+ * matches its hash is what the repository published. They only tell which
+ * parts of a file that doesn't match the hashes of the Target have to be
+ * downloaded again: the file is still verified against the hashes of the
+ * Target once they were.
+ */
+class TargetChunks {
+ public:
+  /** Empty if the Target has no chunk hashes, or they don't cover its length. */
+  static TargetChunks fromTarget(const Uptane::Target &target);
+
+  bool empty() const { return hashes_.empty(); }
+  size_t count() const { return hashes_.size(); }
+  uint64_t chunkSize() const { return size_; }
+  uint64_t offset(size_t index) const { return index * size_; }
+  uint64_t length(size_t index) const { return std::min(size_, length_ - offset(index)); }
+  bool matches(size_t index, const std::string &sha256_hex) const;
+
+  /**
+   * Hash the given chunks of a file.
+   * @return those that don't match, including the ones that are not entirely
+   *         in the file.
+   */
+  std::vector<size_t> badChunks(const boost::filesystem::path &file, const std::vector<size_t> &chunks) const;
+  /** All the chunks of the file that don't match. */
+  std::vector<size_t> badChunks(const boost::filesystem::path &file) const;
+  /** The inclusive byte ranges of the chunks, adjacent ones merged. */
+  std::vector<std::pair<uint64_t, uint64_t>> ranges(const std::vector<size_t> &chunks) const;
+
+ private:
+  uint64_t size_{0};
+  uint64_t length_{0};
+  // Upper case hex
+  std::vector<std::string> hashes_;
+};
+
+/**
+ * Checks the chunks of a Target against their hashes as the data streams by,
+ * starting at any offset. Chunks of which only a part was given are left
+ * unchecked.
+ */
+class ChunkVerifier {
+ public:
+  ChunkVerifier(const TargetChunks &chunks, uint64_t offset);
+
+  void update(const char *data, size_t size);
+  /** The chunks that didn't match their hash. */
+  const std::vector<size_t> &bad() const { return bad_; }
+  /** The chunks that were not checked, either way. */
+  std::vector<size_t> unchecked() const;
+
+ private:
+  const TargetChunks &chunks_;
+  uint64_t offset_;
+  // The first chunk given from its beginning
+  size_t first_;
+  MultiPartHasher::Ptr hasher_;
+  std::vector<bool> checked_;
+  std::vector<size_t> bad_;
+};
+
+#endif  // PACKAGE_MANAGER_TARGET_CHUNKS_H_
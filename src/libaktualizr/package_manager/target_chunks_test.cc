@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "crypto/crypto.h"
+#include "package_manager/target_chunks.h"
+#include "utilities/utils.h"
+
+static std::string content() {
+  std::string data(2500, '\0');
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * 7 % 251);
+  }
+  return data;
+}
+
+static Json::Value targetJson(const std::string &data, uint64_t chunk_size) {
+  Json::Value target_json;
+  target_json["hashes"]["sha256"] = Crypto::sha256digestHex(data);
+  target_json["length"] = Json::UInt64(data.size());
+  target_json["custom"]["chunks"]["size"] = Json::UInt64(chunk_size);
+  for (uint64_t offset = 0; offset < data.size(); offset += chunk_size) {
+    target_json["custom"]["chunks"]["sha256"].append(Crypto::sha256digestHex(data.substr(offset, chunk_size)));
+  }
+  return target_json;
+}
+
+/* Only chunk hashes that cover the whole Target are used. */
+TEST(TargetChunks, FromTarget) {
+  const std::string data = content();
+  Json::Value target_json = targetJson(data, 1000);
+  const auto chunks = TargetChunks::fromTarget(Uptane::Target("target.bin", target_json));
+  ASSERT_EQ(chunks.count(), 3);
+  EXPECT_EQ(chunks.offset(2), 2000);
+  EXPECT_EQ(chunks.length(1), 1000);
+  EXPECT_EQ(chunks.length(2), 500);
+  EXPECT_TRUE(chunks.matches(0, Crypto::sha256digestHex(data.substr(0, 1000))));
+  EXPECT_FALSE(chunks.matches(1, Crypto::sha256digestHex(data.substr(0, 1000))));
+
+  Json::Value missing = target_json;
+  missing["custom"]["chunks"]["sha256"].resize(2);
+  EXPECT_TRUE(TargetChunks::fromTarget(Uptane::Target("target.bin", missing)).empty());
+  Json::Value invalid = target_json;
+  invalid["custom"]["chunks"]["sha256"][1] = "abc";
+  EXPECT_TRUE(TargetChunks::fromTarget(Uptane::Target("target.bin", invalid)).empty());
+  Json::Value zero = target_json;
+  zero["custom"]["chunks"]["size"] = 0;
+  EXPECT_TRUE(TargetChunks::fromTarget(Uptane::Target("target.bin", zero)).empty());
+  target_json["custom"].removeMember("chunks");
+  EXPECT_TRUE(TargetChunks::fromTarget(Uptane::Target("target.bin", target_json)).empty());
+}
+
+/* The chunks that don't match are found in a file, and adjacent ones make a single range. */
+TEST(TargetChunks, BadChunks) {
+  std::string data = content();
+  const auto chunks = TargetChunks::fromTarget(Uptane::Target("target.bin", targetJson(data, 500)));
+  ASSERT_EQ(chunks.count(), 5);
+
+  TemporaryFile file("target");
+  file.PutContents(data);
+  EXPECT_TRUE(chunks.badChunks(file.Path()).empty());
+
+  data[600] ^= 1;
+  data[1400] ^= 1;
+  file.PutContents(data.substr(0, 2200));
+  EXPECT_EQ(chunks.badChunks(file.Path()), (std::vector<size_t>{1, 2, 4}));
+  EXPECT_EQ(chunks.badChunks(file.Path(), {0, 2}), std::vector<size_t>{2});
+
+  const std::vector<std::pair<uint64_t, uint64_t>> ranges{{500, 1499}, {2000, 2499}};
+  EXPECT_EQ(chunks.ranges({4, 2, 1}), ranges);
+}
+
+/* Streamed data is checked chunk by chunk, from any offset on. */
+TEST(TargetChunks, Verifier) {
+  std::string data = content();
+  const auto chunks = TargetChunks::fromTarget(Uptane::Target("target.bin", targetJson(data, 500)));
+  data[1700] ^= 1;
+
+  ChunkVerifier verifier(chunks, 0);
+  for (size_t offset = 0; offset < data.size(); offset += 300) {
+    verifier.update(&data[offset], std::min<size_t>(300, data.size() - offset));
+  }
+  EXPECT_EQ(verifier.bad(), std::vector<size_t>{3});
+  EXPECT_TRUE(verifier.unchecked().empty());
+
+  // Resumed in the middle of a chunk, which is left unchecked
+  ChunkVerifier resumed(chunks, 700);
+  resumed.update(&data[700], 1000);
+  EXPECT_TRUE(resumed.bad().empty());
+  EXPECT_EQ(resumed.unchecked(), (std::vector<size_t>{0, 1, 3, 4}));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,37 @@
+#ifndef PACKAGE_MANAGER_TARGET_FILE_METRICS_H_
+#define PACKAGE_MANAGER_TARGET_FILE_METRICS_H_
+
+#include <cstdint>
+
+#include "utilities/metrics.h"
+
+// The reads and writes of the files of the targets by the package manager,
+// and the files opened for others to read
+
+inline MetricCounter& targetFileOperationsMetric(const char* operation) {
+  return Metrics::instance().counter("aktualizr_target_file_operations_total",
+                                     "Reads, writes and opens of the files of the targets", {{"operation", operation}});
+}
+
+inline void recordTargetFileRead(uint64_t bytes) {
+  static MetricCounter& reads = targetFileOperationsMetric("read");
+  static MetricCounter& read_bytes =
+      Metrics::instance().counter("aktualizr_target_file_read_bytes_total", "Bytes read from the files of the targets");
+  reads.add();
+  read_bytes.add(bytes);
+}
+
+inline void recordTargetFileWrite(uint64_t bytes) {
+  static MetricCounter& writes = targetFileOperationsMetric("write");
+  static MetricCounter& written_bytes = Metrics::instance().counter("aktualizr_target_file_written_bytes_total",
+                                                                    "Bytes written to the files of the targets");
+  writes.add();
+  written_bytes.add(bytes);
+}
+
+inline void recordTargetFileOpen() {
+  static MetricCounter& opens = targetFileOperationsMetric("open");
+  opens.add();
+}
+
+#endif  // PACKAGE_MANAGER_TARGET_FILE_METRICS_H_
@@ -1,59 +1,194 @@
+#include <algorithm>
 #include <chrono>
 #include <fstream>
 
 #include <sodium.h>
 
 #include "libaktualizr/aktualizr.h"
+#include "http/http_recorder.h"
+#include "http/link_policy.h"
+#include "http/network_cache.h"
 #include "libaktualizr/events.h"
+#include "primary/device_data_scheduler.h"
+#include "primary/io_accounting.h"
+#include "primary/poll_scheduler.h"
 #include "primary/sotauptaneclient.h"
+#include "primary/update_notifier.h"
+#include "utilities/allocation_accounting.h"
 #include "utilities/apiqueue.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/executor.h"
+#include "utilities/metrics.h"
 #include "utilities/timer.h"
 
 using std::shared_ptr;
 
+// Reporting and read-only commands run beside the long transfers, but only
+// once provisioned: until then, every command may provision the device.
+static api::CommandQueue::Priority queryPriority(const SotaUptaneClient &client) {
+  return client.isProvisioned() ? api::CommandQueue::Priority::kHigh : api::CommandQueue::Priority::kNormal;
+}
+
+static std::shared_ptr<HttpInterface> newHttp(const NetworkConfig &config) {
+  auto http = std::make_shared<HttpClient>(config);
+  if (config.record_file.empty()) {
+    return http;
+  }
+  return std::make_shared<HttpRecorder>(http, config.record_file);
+}
+
 Aktualizr::Aktualizr(const Config &config)
-    : Aktualizr(config, INvStorage::newStorage(config.storage), std::make_shared<HttpClient>()) {}
+    : Aktualizr(config, INvStorage::newStorage(config.storage), newHttp(config.network)) {}
 
 Aktualizr::Aktualizr(Config config, std::shared_ptr<INvStorage> storage_in,
                      const std::shared_ptr<HttpInterface> &http_in)
-    : config_{std::move(config)}, sig_{new event::Channel()}, api_queue_{new api::CommandQueue()} {
+    : config_{std::move(config)}, http_{http_in}, sig_{new event::Channel()}, api_queue_{new api::CommandQueue()} {
   if (sodium_init() == -1) {  // Note that sodium_init doesn't require a matching 'sodium_deinit'
     throw std::runtime_error("Unable to initialize libsodium");
   }
 
   storage_ = std::move(storage_in);
   storage_->importData(config_.import);
+  if (config_.network.persist_sessions) {
+    // Before the first request, and without keeping the storage alive
+    auto cache = NetworkCache::global();
+    storage_->visitNetworkCache([&cache](const std::string &name, const std::string &value, int64_t expires) {
+      cache->restore(name, value, expires);
+    });
+    std::weak_ptr<INvStorage> storage = storage_;
+    cache->persistTo(
+        [storage](const std::string &name, const std::string &value, int64_t expires) {
+          if (auto s = storage.lock()) {
+            s->storeNetworkCacheEntry(name, value, expires);
+          }
+        },
+        std::chrono::seconds(config_.network.dns_cache_ttl_sec));
+  }
+
+  if (config_.network.link_aware) {
+    auto link_policy = LinkPolicy::global();
+    link_policy->configure(config_.network);
+    // The deferred download starts as soon as the link allows it
+    link_listener_ = link_policy->subscribe([this](LinkPolicy::Mode mode) {
+      if (mode == LinkPolicy::Mode::kMetadataOnly || !download_deferred_) {
+        return;
+      }
+      {
+        std::lock_guard<std::mutex> g(exit_cond_.m);
+        exit_cond_.wake = true;
+      }
+      exit_cond_.cv.notify_all();
+    });
+  }
 
   uptane_client_ = std::make_shared<SotaUptaneClient>(config_, storage_, http_in, sig_, api_queue_->FlowControlToken());
 }
 
-Aktualizr::~Aktualizr() { api_queue_.reset(nullptr); }
+Aktualizr::~Aktualizr() {
+  if (link_listener_ >= 0) {
+    LinkPolicy::global()->unsubscribe(link_listener_);
+  }
+  // Stop RunForever(), which refers to this
+  Shutdown();
+  {
+    std::unique_lock<std::mutex> l(exit_cond_.m);
+    exit_cond_.cv.wait(l, [this] { return !exit_cond_.running; });
+  }
+  api_queue_.reset(nullptr);
+}
 
 void Aktualizr::Initialize() {
+  const Timer timer;
   uptane_client_->initialize();
+  LOG_DEBUG << "Initialized the Uptane client in " << timer;
   api_queue_->run();
+  const auto &telemetry = config_.telemetry;
+  if (!metrics_exporter_ && (!telemetry.metrics_file.empty() || telemetry.metrics_port != 0)) {
+    metrics_exporter_ = std_::make_unique<MetricsExporter>(
+        telemetry.metrics_file, std::chrono::seconds(telemetry.metrics_interval_sec),
+        telemetry.metrics_port != 0 ? static_cast<int>(telemetry.metrics_port) : -1);
+  }
+  if (!allocation_reporter_ && telemetry.heap_report_interval_sec != 0) {
+    allocation_reporter_ =
+        std_::make_unique<AllocationReporter>(std::chrono::seconds(telemetry.heap_report_interval_sec));
+  }
 }
 
 bool Aktualizr::UptaneCycle() {
-  result::UpdateCheck update_result = CheckUpdates().get();
+  const IoTotals start = IoTotals::current();
+  const bool result = runUptaneCycle();
+  uptane_client_->reportCycleIo(IoTotals::current() - start);
+  return result;
+}
+
+bool Aktualizr::runUptaneCycle() {
+  cycle_failed_ = false;
+  api::FlowControlToken *token = api_queue_->FlowControlToken();
+  const auto &uptane = config_.uptane;
+  const api::DeadlineScope cycle_deadline(token, std::chrono::seconds(uptane.cycle_budget_sec));
+  // Runs a phase of the cycle within its budget, and tells whether it ran out of time
+  bool out_of_time = false;
+  const auto within = [token, &out_of_time](uint64_t budget_sec, const auto &phase) {
+    const api::DeadlineScope phase_deadline(token, std::chrono::seconds(budget_sec));
+    auto result = phase().get();
+    out_of_time = token->deadlineExpired();
+    return result;
+  };
+  // What was cancelled is done again, or goes on from where it stopped, in the
+  // next cycle, which doesn't need to back off.
+  const auto defer = [](const char *phase) {
+    LOG_INFO << "Out of time for " << phase << ", leaving it to the next cycle";
+    return true;
+  };
+
+  result::UpdateCheck update_result = within(uptane.check_budget_sec, [this] { return CheckUpdates(); });
+  if (out_of_time && update_result.status == result::UpdateStatus::kError) {
+    return defer("the update check");
+  }
   if (update_result.updates.empty()) {
     if (update_result.status == result::UpdateStatus::kError) {
+      cycle_failed_ = true;
       // If the metadata verification failed, inform the backend immediately.
       SendManifest().get();
     }
     return true;
   }
+  campaign_pending_ = false;
 
-  result::Download download_result = Download(update_result.updates).get();
+  // Held back until a cheaper link, without counting as a failure
+  const auto held_back = [this] {
+    if (!config_.network.link_aware || LinkPolicy::global()->mode() != LinkPolicy::Mode::kMetadataOnly) {
+      return false;
+    }
+    download_deferred_ = true;
+    LOG_INFO << "Downloads are held back on this network link, the update is downloaded on a cheaper one";
+    return true;
+  };
+  if (held_back()) {
+    return true;
+  }
+  download_deferred_ = false;
+  result::Download download_result =
+      within(uptane.download_budget_sec, [this, &update_result] { return Download(update_result.updates); });
+  if (out_of_time && download_result.status != result::DownloadStatus::kSuccess) {
+    return defer("the download");
+  }
+  if (download_result.status != result::DownloadStatus::kSuccess && held_back()) {
+    return true;
+  }
   if (download_result.status != result::DownloadStatus::kSuccess || download_result.updates.empty()) {
     if (download_result.status != result::DownloadStatus::kNothingToDownload) {
+      cycle_failed_ = true;
       // If the download failed, inform the backend immediately.
       SendManifest().get();
     }
     return true;
   }
 
-  Install(download_result.updates).get();
+  within(uptane.install_budget_sec, [this, &download_result] { return Install(download_result.updates); });
+  if (out_of_time) {
+    LOG_INFO << "Out of time for the installation, the cancelled transfers to the Secondaries go on in the next cycle";
+  }
 
   if (uptane_client_->isInstallCompletionRequired()) {
     // If there are some pending updates then effectively either reboot (OSTree) or aktualizr restart (fake pack mngr)
@@ -72,34 +207,177 @@ bool Aktualizr::UptaneCycle() {
 }
 
 std::future<void> Aktualizr::RunForever() {
-  std::future<void> future = std::async(std::launch::async, [this]() {
+  {
+    std::lock_guard<std::mutex> g(exit_cond_.m);
+    exit_cond_.running = true;
+  }
+  std::future<void> future = Executor::blocking().submit([this]() {
+    // Tells the destructor when the loop is over, however it ends
+    struct Running {
+      explicit Running(Aktualizr *aktualizr) : aktualizr_{aktualizr} {}
+      ~Running() {
+        {
+          std::lock_guard<std::mutex> g(aktualizr_->exit_cond_.m);
+          aktualizr_->exit_cond_.running = false;
+        }
+        aktualizr_->exit_cond_.cv.notify_all();
+      }
+      Running(const Running &) = delete;
+      Running(Running &&) = delete;
+      Running &operator=(const Running &) = delete;
+      Running &operator=(Running &&) = delete;
+      Aktualizr *aktualizr_;
+    } running(this);
+    // Declared before the lock, as its callback takes it
+    std::unique_ptr<UpdateNotifier> notifier;
     std::unique_lock<std::mutex> l(exit_cond_.m);
     bool have_sent_device_data = false;
+    PollScheduler scheduler(config_.uptane);
+    DeviceDataScheduler device_data(config_.telemetry);
+    auto send_device_data = [this, &notifier, &have_sent_device_data]() {
+      // Can throw SotaUptaneClient::ProvisioningFailed
+      SendDeviceData().get();
+      have_sent_device_data = true;
+      if (!config_.uptane.notification_url.empty()) {
+        notifier = std::make_unique<UpdateNotifier>(http_, config_.uptane.notification_url, [this]() {
+          {
+            std::lock_guard<std::mutex> g(exit_cond_.m);
+            exit_cond_.wake = true;
+          }
+          exit_cond_.cv.notify_all();
+        });
+      }
+    };
     while (true) {
+      auto outcome = PollScheduler::Outcome::kOk;
       try {
-        if (!have_sent_device_data) {
-          // Can throw SotaUptaneClient::ProvisioningFailed
-          SendDeviceData().get();
-          have_sent_device_data = true;
+        if (!have_sent_device_data && !config_.uptane.defer_device_data) {
+          send_device_data();
         }
 
         if (!UptaneCycle()) {
           break;
         }
+        // When deferred, the device data follow the first update check, which
+        // sends the manifest with the result of an installation finalized at boot.
+        if (!have_sent_device_data) {
+          send_device_data();
+        }
+        if (cycle_failed_) {
+          outcome = PollScheduler::Outcome::kError;
+        } else if (campaign_pending_) {
+          outcome = PollScheduler::Outcome::kPending;
+        }
       } catch (SotaUptaneClient::ProvisioningFailed &e) {
         LOG_DEBUG << "Not provisioned yet:" << e.what();
+        outcome = PollScheduler::Outcome::kError;
       }
 
-      if (exit_cond_.cv.wait_for(l, std::chrono::seconds(config_.uptane.polling_sec),
-                                 [this] { return exit_cond_.flag; })) {
+      const auto server_delay = uptane_client_->serverRetryAfter();
+      const auto expiry_delay = metadataExpiryDelay();
+      const auto delay = scheduler.next(outcome, server_delay, expiry_delay);
+      LOG_DEBUG << "Next update check in " << delay.count() << " ms"
+                << (scheduler.failures() > 0 ? " after " + std::to_string(scheduler.failures()) + " failures" : "");
+      uptane_client_->reportNextPoll(delay);
+      // Only a device that is up to date with the server waits for a change
+      // of the Director Targets metadata.
+      std::chrono::milliseconds heartbeat{0};
+      if (outcome == PollScheduler::Outcome::kOk && have_sent_device_data && server_delay.count() == 0) {
+        heartbeat = std::chrono::seconds(config_.uptane.polling_heartbeat_sec);
+      }
+      if (!waitForUptaneCycle(l, delay, heartbeat, have_sent_device_data ? &device_data : nullptr)) {
         break;
       }
     }
+    l.unlock();
+    notifier.reset();
     uptane_client_->completeInstall();
   });
   return future;
 }
 
+bool Aktualizr::waitForUptaneCycle(std::unique_lock<std::mutex> &lock, std::chrono::milliseconds delay,
+                                   std::chrono::milliseconds heartbeat, DeviceDataScheduler *device_data) {
+  const auto cycle_at = std::chrono::steady_clock::now() + delay;
+  auto heartbeat_at = std::chrono::steady_clock::time_point::max();
+  if (heartbeat.count() > 0) {
+    heartbeat_at = std::chrono::steady_clock::now() + heartbeat;
+  }
+  while (true) {
+    if (device_data != nullptr) {
+      reportDeviceData(*device_data);
+    }
+    auto wake_at = std::min(cycle_at, heartbeat_at);
+    if (device_data != nullptr) {
+      wake_at = std::min(wake_at, device_data->nextDue());
+    }
+    exit_cond_.cv.wait_until(lock, wake_at, [this] { return exit_cond_.flag || exit_cond_.wake; });
+    if (exit_cond_.flag) {
+      return false;
+    }
+    if (exit_cond_.wake) {
+      exit_cond_.wake = false;
+      LOG_INFO << "Checking for updates as announced by the server";
+      return true;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= cycle_at) {
+      return true;
+    }
+    // Woken up for the device data
+    if (now < heartbeat_at) {
+      continue;
+    }
+    heartbeat_at = now + heartbeat;
+    std::function<bool()> task([this] { return uptane_client_->directorTargetsChanged(); });
+    bool changed = true;
+    try {
+      changed = api_queue_->enqueue(std::move(task), api::CommandQueue::Priority::kNormal, "CheckDirectorTargets")
+                    .get();
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not check the Director Targets metadata: " << e.what();
+    }
+    if (changed) {
+      LOG_INFO << "Checking for updates as the Director Targets metadata may have changed";
+      return true;
+    }
+  }
+}
+
+void Aktualizr::reportDeviceData(DeviceDataScheduler &device_data) {
+  device_data.installsCompleted(uptane_client_->installsCompleted());
+  std::vector<DeviceDataKind> kinds = device_data.takeDue(std::chrono::steady_clock::now());
+  if (kinds.empty()) {
+    return;
+  }
+  std::function<void()> task([this, kinds] { uptane_client_->reportDeviceData(kinds); });
+  try {
+    api_queue_->enqueue(std::move(task), queryPriority(*uptane_client_), "ReportDeviceData").get();
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not report the device data: " << e.what();
+  }
+}
+
+std::chrono::milliseconds Aktualizr::metadataExpiryDelay() {
+  std::function<TimeStamp()> task([this] { return uptane_client_->nextMetadataExpiry(); });
+  TimeStamp expiry;
+  try {
+    expiry = api_queue_->enqueue(std::move(task), api::CommandQueue::Priority::kNormal, "NextMetadataExpiry").get();
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not get the expiry of the Uptane metadata: " << e.what();
+  }
+  if (!expiry.IsValid()) {
+    return std::chrono::milliseconds::zero();
+  }
+  // Metadata expires once its expiry time is in the past.
+  const int64_t seconds = expiry.ToEpoch() - TimeStamp::Now().ToEpoch() + 1;
+  if (seconds <= 0) {
+    return std::chrono::milliseconds::zero();
+  }
+  LOG_DEBUG << "The Uptane metadata expires at " << expiry;
+  return std::chrono::seconds(seconds);
+}
+
 void Aktualizr::Shutdown() {
   {
     std::lock_guard<std::mutex> g(exit_cond_.m);
@@ -124,8 +402,17 @@ std::vector<SecondaryInfo> Aktualizr::GetSecondaries() const {
 }
 
 std::future<result::CampaignCheck> Aktualizr::CampaignCheck() {
-  std::function<result::CampaignCheck()> task([this] { return uptane_client_->campaignCheck(); });
-  return api_queue_->enqueue(std::move(task));
+  std::function<result::CampaignCheck()> task([this] {
+    auto result = uptane_client_->campaignCheck();
+    // The updates of campaigns that don't need to be accepted are on their way.
+    for (const auto &c : result.campaigns) {
+      if (c.autoAccept) {
+        campaign_pending_ = true;
+      }
+    }
+    return result;
+  });
+  return api_queue_->enqueue(std::move(task), queryPriority(*uptane_client_), "CampaignCheck");
 }
 
 std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, campaign::Cmd cmd) {
@@ -133,6 +420,7 @@ std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, cam
     switch (cmd) {
       case campaign::Cmd::Accept:
         uptane_client_->campaignAccept(campaign_id);
+        campaign_pending_ = true;
         break;
       case campaign::Cmd::Decline:
         uptane_client_->campaignDecline(campaign_id);
@@ -148,13 +436,33 @@ std::future<void> Aktualizr::CampaignControl(const std::string &campaign_id, cam
 }
 
 void Aktualizr::SetCustomHardwareInfo(Json::Value hwinfo) { uptane_client_->setCustomHardwareInfo(std::move(hwinfo)); }
+
+void Aktualizr::SetTargetConsumer(const std::string &type, TargetConsumer consumer) {
+  uptane_client_->setTargetConsumer(type, std::move(consumer));
+}
+
+void Aktualizr::SetLinkType(LinkType link) {
+  if (!config_.network.link_aware) {
+    LOG_WARNING << "The network link is ignored without network.link_aware";
+    return;
+  }
+  LinkPolicy::global()->setLink(link);
+}
+
+Json::Value Aktualizr::GetMetrics() { return Metrics::instance().json(); }
+
 std::future<void> Aktualizr::SendDeviceData() {
   std::function<void()> task([this] { uptane_client_->sendDeviceData(); });
-  return api_queue_->enqueue(std::move(task));
+  return api_queue_->enqueue(std::move(task), queryPriority(*uptane_client_), "SendDeviceData");
 }
 
 std::future<result::UpdateCheck> Aktualizr::CheckUpdates() {
   std::function<result::UpdateCheck()> task([this] { return uptane_client_->fetchMeta(); });
+  return api_queue_->enqueue(std::move(task), api::CommandQueue::Priority::kNormal, "CheckUpdates");
+}
+
+std::future<result::UpdateCheck> Aktualizr::CheckUpdatesFromBundle(const boost::filesystem::path &bundle) {
+  std::function<result::UpdateCheck()> task([this, bundle] { return uptane_client_->checkUpdatesFromBundle(bundle); });
   return api_queue_->enqueue(std::move(task));
 }
 
@@ -164,7 +472,11 @@ std::future<result::Download> Aktualizr::Download(const std::vector<Uptane::Targ
 }
 
 std::future<result::Install> Aktualizr::Install(const std::vector<Uptane::Target> &updates) {
-  std::function<result::Install()> task([this, updates] { return uptane_client_->uptaneInstall(updates); });
+  std::function<result::Install()> task([this, updates] {
+    // The user waits for the installation, and the background work it needs
+    const BackgroundScheduling::Boost boost;
+    return uptane_client_->uptaneInstall(updates);
+  });
   return api_queue_->enqueue(std::move(task));
 }
 
@@ -174,7 +486,9 @@ bool Aktualizr::SetInstallationRawReport(const std::string &custom_raw_report) {
 
 std::future<bool> Aktualizr::SendManifest(const Json::Value &custom) {
   std::function<bool()> task([this, custom]() { return uptane_client_->putManifest(custom); });
-  return api_queue_->enqueue(std::move(task));
+  // Only the manifests without custom data are the same
+  return api_queue_->enqueue(std::move(task), api::CommandQueue::Priority::kNormal,
+                             custom.isNull() ? "SendManifest" : "");
 }
 
 result::Pause Aktualizr::Pause() {
@@ -231,3 +545,7 @@ void Aktualizr::DeleteStoredTarget(const Uptane::Target &target) { uptane_client
 std::ifstream Aktualizr::OpenStoredTarget(const Uptane::Target &target) {
   return uptane_client_->openStoredTarget(target);
 }
+
+int Aktualizr::OpenStoredTargetFd(const Uptane::Target &target) {
+  return uptane_client_->openStoredTargetFd(target);
+}
@@ -1,8 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
 #include <future>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
@@ -1178,6 +1183,62 @@ TEST(Aktualizr, AutoRebootAfterUpdate) {
   }
 }
 
+/*
+ * Initialize -> UptaneCycle -> updates downloaded and installed for Primary
+ * -> reboot emulated -> Initialize with deferred device data -> RunForever
+ *
+ * Checks actions:
+ *
+ * - [x] Send the device data after the first update check when deferred
+ */
+TEST(Aktualizr, DeferDeviceData) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakePutCounter>(temp_dir.Path(), fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.pacman.fake_need_reboot = true;
+  conf.uptane.force_install_completion = true;
+  conf.uptane.polling_sec = 0;
+
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+    aktualizr.Initialize();
+    auto aktualizr_cycle_thread = aktualizr.RunForever();
+    EXPECT_EQ(aktualizr_cycle_thread.wait_for(std::chrono::seconds(20)), std::future_status::ready);
+  }
+
+  conf.uptane.defer_device_data = true;
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    std::mutex m;
+    std::vector<std::string> events;
+    std::promise<void> device_data_sent;
+    aktualizr.SetSignalHandler([&](const std::shared_ptr<event::BaseEvent>& event) {
+      std::lock_guard<std::mutex> lock(m);
+      events.push_back(event->variant);
+      if (event->variant == "SendDeviceDataComplete") {
+        device_data_sent.set_value();
+      }
+    });
+
+    const unsigned int manifest_sends = http->manifest_sends;
+    aktualizr.Initialize();
+    // The finalized installation is reported right away
+    EXPECT_EQ(http->manifest_sends, manifest_sends + 1);
+    auto aktualizr_cycle_thread = aktualizr.RunForever();
+    EXPECT_EQ(device_data_sent.get_future().wait_for(std::chrono::seconds(20)), std::future_status::ready);
+    aktualizr.Shutdown();
+    aktualizr_cycle_thread.get();
+
+    std::lock_guard<std::mutex> lock(m);
+    ASSERT_GE(events.size(), 2U);
+    EXPECT_EQ(events[0], "UpdateCheckComplete");
+    EXPECT_EQ(events[1], "SendDeviceDataComplete");
+  }
+}
+
 /*
  * Initialize -> UptaneCycle -> updates downloaded and installed for Secondaries
  * without changing the Primary.
@@ -1429,6 +1490,79 @@ TEST(Aktualizr, DownloadWithUpdates) {
   verifyNothingInstalled(aktualizr.uptane_client()->AssembleManifest());
 }
 
+// Holds each download until another one runs beside it
+class HttpConcurrentDownloads : public HttpFake {
+ public:
+  HttpConcurrentDownloads(const boost::filesystem::path& test_dir_in, const std::string& flavor,
+                          const boost::filesystem::path& meta_dir_in)
+      : HttpFake(test_dir_in, flavor, meta_dir_in) {}
+
+  std::future<HttpResponse> downloadAsync(const std::string& url, curl_write_callback write_cb,
+                                          curl_xferinfo_callback progress_cb, void* userp, curl_off_t from,
+                                          CurlHandler* easyp) override {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      peak_ = std::max(peak_, ++running_);
+      cv_.notify_all();
+      cv_.wait_for(lock, std::chrono::seconds(20), [this]() { return peak_ >= 2; });
+    }
+    auto response = HttpFake::downloadAsync(url, write_cb, progress_cb, userp, from, easyp);
+    response.wait();
+    std::lock_guard<std::mutex> guard(mutex_);
+    --running_;
+    return response;
+  }
+
+  int peak() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return peak_;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  int running_{0};
+  int peak_{0};
+};
+
+/*
+ * Download several targets in parallel and report the aggregate throughput.
+ */
+TEST(Aktualizr, DownloadWithUpdatesParallel) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpConcurrentDownloads>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.max_parallel_downloads = 4;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::atomic<size_t> targets_complete{0};
+  auto f_cb = [&targets_complete](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->isTypeOf<event::DownloadTargetComplete>()) {
+      const auto download_event = dynamic_cast<event::DownloadTargetComplete*>(event.get());
+      EXPECT_TRUE(download_event->success);
+      ++targets_complete;
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2u);
+  result::Download result = aktualizr.Download(update_result.updates).get();
+  EXPECT_EQ(result.status, result::DownloadStatus::kSuccess);
+  ASSERT_EQ(result.updates.size(), 2u);
+  // The order of the requested targets is preserved.
+  EXPECT_EQ(result.updates[0].filename(), update_result.updates[0].filename());
+  EXPECT_EQ(result.updates[1].filename(), update_result.updates[1].filename());
+  EXPECT_EQ(targets_complete, 2u);
+  EXPECT_EQ(result.downloaded_bytes, update_result.updates[0].length() + update_result.updates[1].length());
+  EXPECT_GE(result.throughput(), 0.);
+  // Both were downloaded at the same time
+  EXPECT_EQ(http->peak(), 2);
+}
+
 class HttpDownloadFailure : public HttpFake {
  public:
   using Responses = std::vector<std::pair<std::string, HttpResponse>>;
@@ -1580,6 +1714,44 @@ TEST(Aktualizr, DownloadListRemove) {
   EXPECT_EQ(targets.size(), 0);
 }
 
+/* Prefetch the targets of an update before Download(), and remove them again when a campaign is declined. */
+TEST(Aktualizr, Prefetch) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.prefetch = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2);
+
+  auto prefetched = [&aktualizr, &update_result]() {
+    for (const auto& target : update_result.updates) {
+      try {
+        aktualizr.OpenStoredTarget(target).close();
+      } catch (const std::exception&) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (int i = 0; i < 200 && !prefetched(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  EXPECT_TRUE(prefetched());
+
+  aktualizr.CampaignControl("c2eb7e8d-8aa0-429d-883f-5ed8fdb2a493", campaign::Cmd::Decline).get();
+  EXPECT_EQ(aktualizr.GetStoredTargets().size(), 0);
+
+  // Downloaded again for the update
+  result::Download download_result = aktualizr.Download(update_result.updates).get();
+  EXPECT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  EXPECT_TRUE(prefetched());
+}
+
 /*
  * Automatically remove old targets during installation cycles.
  * Get log of installation.
@@ -1869,6 +2041,7 @@ TEST(Aktualizr, InstallWithUpdates) {
       << "Primary firmware is present in storage before the download";
   EXPECT_THROW(aktualizr.OpenStoredTarget(secondary_target).get(), std::runtime_error)
       << "Secondary firmware is present in storage before the download";
+  EXPECT_THROW(aktualizr.OpenStoredTargetFd(primary_target), std::runtime_error);
 
   result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
   aktualizr.Download(update_result.updates).get();
@@ -1876,6 +2049,11 @@ TEST(Aktualizr, InstallWithUpdates) {
       << "Primary firmware is not present in storage after the download";
   EXPECT_NO_THROW(aktualizr.OpenStoredTarget(secondary_target))
       << "Secondary firmware is not present in storage after the download";
+  const int primary_fd = aktualizr.OpenStoredTargetFd(primary_target);
+  ASSERT_GE(primary_fd, 0);
+  std::string primary_data(60, '\0');
+  EXPECT_EQ(read(primary_fd, &primary_data[0], primary_data.size()), 59);
+  close(primary_fd);
 
   // After updates have been downloaded, try to install them.
   aktualizr.Install(update_result.updates);
@@ -1886,6 +2064,55 @@ TEST(Aktualizr, InstallWithUpdates) {
   }
 }
 
+/*
+ * Initialize -> CheckUpdates -> Download -> an image changes on disk ->
+ * Install -> nothing is installed.
+ *
+ * The image is restored -> Install -> updates installed.
+ */
+TEST(Aktualizr, InstallVerifiesAllTargets) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  ASSERT_EQ(update_result.updates.size(), 2);
+  result::Download download_result = aktualizr.Download(update_result.updates).get();
+  ASSERT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+
+  // The image of the Secondary keeps its length, but not its content.
+  const auto secondary_image =
+      conf.pacman.images_path / "1BBB15AA921FFFFD5079567D630F43298DBE5E7CBC1B14E0CCDD6718FDE28E47";
+  const std::string secondary_content = Utils::readFile(secondary_image);
+  Utils::writeFile(secondary_image, std::string(secondary_content.size(), 'x'));
+
+  result::Install install_result = aktualizr.Install(update_result.updates).get();
+  EXPECT_FALSE(install_result.dev_report.success);
+  EXPECT_EQ(install_result.dev_report.result_code.num_code, data::ResultCode::Numeric::kInternalError);
+  EXPECT_TRUE(install_result.ecu_reports.empty());
+  data::InstallationResult dev_installation_res;
+  std::string report;
+  std::string correlation_id;
+  ASSERT_TRUE(storage->loadDeviceInstallationResult(&dev_installation_res, &report, &correlation_id));
+  EXPECT_EQ(report, "Downloaded target is invalid");
+  // Not even the Primary, whose image is fine
+  boost::optional<Uptane::Target> current_version;
+  boost::optional<Uptane::Target> pending_version;
+  ASSERT_TRUE(storage->loadInstalledVersions("CA:FE:A6:D2:84:9D", &current_version, &pending_version));
+  EXPECT_FALSE(!!current_version);
+  EXPECT_FALSE(!!pending_version);
+
+  Utils::writeFile(secondary_image, secondary_content);
+  install_result = aktualizr.Install(update_result.updates).get();
+  ASSERT_EQ(install_result.ecu_reports.size(), 2);
+  EXPECT_EQ(install_result.ecu_reports[0].install_res.result_code.num_code, data::ResultCode::Numeric::kOk);
+  EXPECT_EQ(install_result.ecu_reports[1].install_res.result_code.num_code, data::ResultCode::Numeric::kOk);
+}
+
 /**
  * Verifies reporting of update download progress
  *
@@ -2384,6 +2611,73 @@ TEST(Aktualizr, CustomHwInfo) {
   aktualizr.SendDeviceData().get();
 }
 
+/*
+ * The metrics of an update are given by the API and written to the metrics
+ * file when aktualizr stops.
+ */
+TEST(Aktualizr, Metrics) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.telemetry.metrics_file = temp_dir / "metrics.prom";
+  {
+    auto storage = INvStorage::newStorage(conf.storage);
+    UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+    aktualizr.Initialize();
+    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    ASSERT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+    aktualizr.Download(update_result.updates).get();
+
+    const Json::Value metrics = Aktualizr::GetMetrics();
+    EXPECT_EQ(metrics["aktualizr_sqlite_duration_seconds"]["type"].asString(), "histogram");
+    uint64_t statements = 0;
+    for (const auto& series : metrics["aktualizr_sqlite_duration_seconds"]["series"]) {
+      statements += series["count"].asUInt64();
+    }
+    EXPECT_GT(statements, 0);
+    uint64_t hashed = 0;
+    for (const auto& series : metrics["aktualizr_hash_bytes_total"]["series"]) {
+      hashed += series["value"].asUInt64();
+    }
+    EXPECT_GT(hashed, 0);
+    EXPECT_EQ(metrics["aktualizr_command_queue_depth"]["type"].asString(), "gauge");
+  }
+  const std::string dump = Utils::readFile(conf.telemetry.metrics_file);
+  EXPECT_NE(dump.find("# TYPE aktualizr_sqlite_duration_seconds histogram\n"), std::string::npos);
+  EXPECT_NE(dump.find("aktualizr_command_queue_depth{priority=\"normal\"} 0\n"), std::string::npos);
+}
+
+/*
+ * Each update cycle reports the storage, HTTP and target file I/O it made.
+ */
+TEST(Aktualizr, CycleIo) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "hasupdates", fake_meta_dir);
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.telemetry.report_cycle_io = true;
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  std::vector<Json::Value> reports;
+  auto f_cb = [&reports](const std::shared_ptr<event::BaseEvent>& event) {
+    if (event->isTypeOf<event::UptaneCycleIo>()) {
+      reports.push_back(dynamic_cast<event::UptaneCycleIo*>(event.get())->io);
+    }
+  };
+  boost::signals2::connection conn = aktualizr.SetSignalHandler(f_cb);
+  aktualizr.Initialize();
+  aktualizr.UptaneCycle();
+  aktualizr.UptaneCycle();
+
+  ASSERT_EQ(reports.size(), 2);
+  // The first cycle downloads the update
+  EXPECT_GT(reports[0]["storage"]["calls"].asUInt64(), 0);
+  EXPECT_GT(reports[0]["storage"]["written_bytes"].asUInt64(), 0);
+  EXPECT_GT(reports[0]["files"]["written_bytes"].asUInt64(), 0);
+  EXPECT_GT(reports[1]["storage"]["calls"].asUInt64(), 0);
+  EXPECT_GE(reports[0]["storage"]["seconds"].asDouble(), 0);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,81 @@
+#include "primary/device_data_collector.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <utility>
+
+#include "logging/logging.h"
+
+// Niceness of the collections, inherited by the processes they run
+static constexpr int kCollectorNiceness = 10;
+
+DeviceDataCollector::DeviceDataCollector(std::string name, std::function<Json::Value()> collect,
+                                         std::chrono::seconds ttl)
+    : name_{std::move(name)}, collect_{std::move(collect)}, ttl_{ttl} {}
+
+DeviceDataCollector::~DeviceDataCollector() {
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void DeviceDataCollector::refresh() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  startLocked();
+}
+
+Json::Value DeviceDataCollector::get(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  startLocked();
+  if (timeout.count() > 0) {
+    collected_cv_.wait_for(lock, timeout, [this]() { return !running_; });
+  }
+  return have_value_ ? value_ : Json::Value();
+}
+
+void DeviceDataCollector::invalidate() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  valid_ = false;
+}
+
+void DeviceDataCollector::startLocked() {
+  if (running_) {
+    return;
+  }
+  if (valid_ && (ttl_.count() == 0 || std::chrono::steady_clock::now() - collected_ < ttl_)) {
+    return;
+  }
+  // The previous collection has ended, only its thread is left.
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+  running_ = true;
+  thread_ = std::thread([this]() { run(); });
+}
+
+void DeviceDataCollector::run() {
+  // Only lowers the priority of this thread on Linux, where threads have their own niceness.
+  if (setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), kCollectorNiceness) != 0) {
+    LOG_DEBUG << "Could not lower the priority of the " << name_ << " collection";
+  }
+  const auto started = std::chrono::steady_clock::now();
+  Json::Value value;
+  try {
+    value = collect_();
+  } catch (const std::exception& e) {
+    LOG_WARNING << "Failed to collect " << name_ << ": " << e.what();
+  }
+  LOG_DEBUG << "Collected " << name_ << " in "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count()
+            << " ms";
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    value_ = std::move(value);
+    have_value_ = true;
+    valid_ = true;
+    running_ = false;
+    collected_ = std::chrono::steady_clock::now();
+  }
+  collected_cv_.notify_all();
+}
@@ -0,0 +1,66 @@
+#ifndef DEVICE_DATA_COLLECTOR_H_
+#define DEVICE_DATA_COLLECTOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "json/json.h"
+
+/**
+ * Collects a piece of device data, such as the hardware information from
+ * lshw, on a background thread at a low CPU priority, and caches the result.
+ *
+ * Readers get the cached result right away, or wait for it at most as long
+ * as they choose. An expired or invalidated result is still returned while
+ * a new one is collected.
+ */
+class DeviceDataCollector {
+ public:
+  /**
+   * @param name what is collected, for the logs
+   * @param collect the collection, run on a thread of its own
+   * @param ttl how long a result is used, 0 for ever
+   */
+  DeviceDataCollector(std::string name, std::function<Json::Value()> collect,
+                      std::chrono::seconds ttl = std::chrono::seconds::zero());
+  /** Waits for a collection in progress, as it can't be interrupted. */
+  ~DeviceDataCollector();
+  DeviceDataCollector(const DeviceDataCollector&) = delete;
+  DeviceDataCollector(DeviceDataCollector&&) = delete;
+  DeviceDataCollector& operator=(const DeviceDataCollector&) = delete;
+  DeviceDataCollector& operator=(DeviceDataCollector&&) = delete;
+
+  /** Start a collection unless a valid result is cached or one is in progress. */
+  void refresh();
+  /**
+   * Get the cached result, starting a collection if needed.
+   * @param timeout how long to wait for a collection in progress
+   * @return the result, or null if none was collected yet
+   */
+  Json::Value get(std::chrono::milliseconds timeout = std::chrono::milliseconds::zero());
+  /** Collect again on the next refresh() or get(). */
+  void invalidate();
+
+ private:
+  // Needs mutex_
+  void startLocked();
+  void run();
+
+  const std::string name_;
+  const std::function<Json::Value()> collect_;
+  const std::chrono::seconds ttl_;
+  std::mutex mutex_;
+  std::condition_variable collected_cv_;
+  Json::Value value_;
+  bool have_value_{false};
+  bool valid_{false};
+  bool running_{false};
+  std::chrono::steady_clock::time_point collected_;
+  std::thread thread_;
+};
+
+#endif  // DEVICE_DATA_COLLECTOR_H_
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+
+#include "primary/device_data_collector.h"
+
+/* The collection runs in the background and its result is cached. */
+TEST(DeviceDataCollector, Cache) {
+  std::atomic<int> calls{0};
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future();
+  DeviceDataCollector collector("test data", [&calls, released]() {
+    released.wait();
+    return Json::Value(++calls);
+  });
+
+  // Doesn't wait for the collection
+  EXPECT_TRUE(collector.get().isNull());
+  EXPECT_TRUE(collector.get(std::chrono::milliseconds(10)).isNull());
+  release.set_value();
+  EXPECT_EQ(collector.get(std::chrono::seconds(10)), 1);
+  EXPECT_EQ(collector.get(), 1);
+  EXPECT_EQ(calls, 1);
+
+  // An invalidated result is still used while it is collected again
+  collector.invalidate();
+  EXPECT_EQ(collector.get(), 1);
+  EXPECT_EQ(collector.get(std::chrono::seconds(10)), 2);
+  EXPECT_EQ(calls, 2);
+}
+
+/* An expired result is collected again. */
+TEST(DeviceDataCollector, Ttl) {
+  std::atomic<int> calls{0};
+  DeviceDataCollector collector("test data", [&calls]() { return Json::Value(++calls); }, std::chrono::seconds(1));
+  EXPECT_EQ(collector.get(std::chrono::seconds(10)), 1);
+  EXPECT_EQ(collector.get(std::chrono::seconds(10)), 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+  EXPECT_EQ(collector.get(std::chrono::seconds(10)), 2);
+}
+
+/* A failed collection gives null. */
+TEST(DeviceDataCollector, Failure) {
+  DeviceDataCollector collector("test data", []() -> Json::Value { throw std::runtime_error("lshw not found"); });
+  EXPECT_TRUE(collector.get(std::chrono::seconds(10)).isNull());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
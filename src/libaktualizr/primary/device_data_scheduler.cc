@@ -0,0 +1,43 @@
+#include "primary/device_data_scheduler.h"
+
+#include <algorithm>
+
+namespace {
+
+size_t index(DeviceDataKind kind) { return static_cast<size_t>(kind); }
+
+}  // namespace
+
+DeviceDataScheduler::DeviceDataScheduler(const TelemetryConfig &config, Clock::time_point now) {
+  intervals_[index(DeviceDataKind::kHardwareInfo)] = std::chrono::seconds(config.report_hardware_interval_sec);
+  intervals_[index(DeviceDataKind::kInstalledPackages)] = std::chrono::seconds(config.report_packages_interval_sec);
+  intervals_[index(DeviceDataKind::kNetworkInfo)] =
+      config.report_network ? std::chrono::seconds(config.report_network_interval_sec) : std::chrono::seconds(0);
+  for (size_t i = 0; i < kKinds; ++i) {
+    due_[i] = intervals_[i].count() > 0 ? now + intervals_[i] : Clock::time_point::max();
+  }
+}
+
+void DeviceDataScheduler::trigger(DeviceDataKind kind) { due_[index(kind)] = Clock::time_point::min(); }
+
+void DeviceDataScheduler::installsCompleted(uint64_t count) {
+  if (count != installs_) {
+    installs_ = count;
+    trigger(DeviceDataKind::kInstalledPackages);
+  }
+}
+
+std::vector<DeviceDataKind> DeviceDataScheduler::takeDue(Clock::time_point now) {
+  std::vector<DeviceDataKind> due;
+  for (size_t i = 0; i < kKinds; ++i) {
+    if (due_[i] <= now) {
+      due.push_back(static_cast<DeviceDataKind>(i));
+      due_[i] = intervals_[i].count() > 0 ? now + intervals_[i] : Clock::time_point::max();
+    }
+  }
+  return due;
+}
+
+DeviceDataScheduler::Clock::time_point DeviceDataScheduler::nextDue() const {
+  return *std::min_element(due_.begin(), due_.end());
+}
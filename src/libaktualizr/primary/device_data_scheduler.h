@@ -0,0 +1,51 @@
+#ifndef DEVICE_DATA_SCHEDULER_H_
+#define DEVICE_DATA_SCHEDULER_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "libaktualizr/config.h"
+
+/** The kinds of device data that are reported again while running. */
+enum class DeviceDataKind { kHardwareInfo = 0, kInstalledPackages, kNetworkInfo };
+
+/**
+ * When each kind of device data is reported again, once all of them were
+ * reported at startup: after the interval of its kind in TelemetryConfig, or
+ * right away when something that changes it happened, such as an
+ * installation for the installed packages. Either way, the data is only sent
+ * to the server if it has changed.
+ *
+ * A kind without an interval is only reported on its triggers, and on the
+ * occasions it always was: the network information with each update check,
+ * the hardware information until it was reported once.
+ */
+class DeviceDataScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit DeviceDataScheduler(const TelemetryConfig &config, Clock::time_point now = Clock::now());
+
+  /** Report this kind at the next chance. */
+  void trigger(DeviceDataKind kind);
+  /**
+   * Trigger the installed packages when the count of completed installations
+   * has changed since the last call.
+   */
+  void installsCompleted(uint64_t count);
+  /** The kinds due at now, which are scheduled again from now on. */
+  std::vector<DeviceDataKind> takeDue(Clock::time_point now);
+  /** When the next kind is due, time_point::max() if none is. */
+  Clock::time_point nextDue() const;
+
+ private:
+  static constexpr size_t kKinds = 3;
+
+  std::array<std::chrono::seconds, kKinds> intervals_{};
+  std::array<Clock::time_point, kKinds> due_{};
+  uint64_t installs_{0};
+};
+
+#endif  // DEVICE_DATA_SCHEDULER_H_
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <vector>
+
+#include "primary/device_data_scheduler.h"
+
+using Kinds = std::vector<DeviceDataKind>;
+
+/* Each kind is due after its own interval, counted again from the report. */
+TEST(DeviceDataScheduler, Intervals) {
+  TelemetryConfig config;
+  config.report_network_interval_sec = 60;
+  config.report_packages_interval_sec = 3600;
+  const auto start = DeviceDataScheduler::Clock::time_point() + std::chrono::hours(1);
+  DeviceDataScheduler scheduler(config, start);
+
+  EXPECT_EQ(scheduler.nextDue(), start + std::chrono::seconds(60));
+  EXPECT_TRUE(scheduler.takeDue(start + std::chrono::seconds(59)).empty());
+  EXPECT_EQ(scheduler.takeDue(start + std::chrono::seconds(61)), Kinds{DeviceDataKind::kNetworkInfo});
+  EXPECT_EQ(scheduler.nextDue(), start + std::chrono::seconds(121));
+  EXPECT_EQ(scheduler.takeDue(start + std::chrono::seconds(3600)),
+            (Kinds{DeviceDataKind::kInstalledPackages, DeviceDataKind::kNetworkInfo}));
+}
+
+/* A kind without an interval is only due on its triggers, the installed
+ * packages after an installation. */
+TEST(DeviceDataScheduler, Triggers) {
+  TelemetryConfig config;
+  const auto start = DeviceDataScheduler::Clock::time_point() + std::chrono::hours(1);
+  DeviceDataScheduler scheduler(config, start);
+  EXPECT_EQ(scheduler.nextDue(), DeviceDataScheduler::Clock::time_point::max());
+
+  scheduler.installsCompleted(0);
+  EXPECT_TRUE(scheduler.takeDue(start).empty());
+  scheduler.installsCompleted(1);
+  EXPECT_LE(scheduler.nextDue(), start);
+  EXPECT_EQ(scheduler.takeDue(start), Kinds{DeviceDataKind::kInstalledPackages});
+  scheduler.installsCompleted(1);
+  EXPECT_TRUE(scheduler.takeDue(start + std::chrono::hours(24)).empty());
+
+  scheduler.trigger(DeviceDataKind::kHardwareInfo);
+  EXPECT_EQ(scheduler.takeDue(start), Kinds{DeviceDataKind::kHardwareInfo});
+  EXPECT_EQ(scheduler.nextDue(), DeviceDataScheduler::Clock::time_point::max());
+}
+
+/* The network information is not scheduled when it is not reported at all. */
+TEST(DeviceDataScheduler, NetworkDisabled) {
+  TelemetryConfig config;
+  config.report_network = false;
+  config.report_network_interval_sec = 60;
+  DeviceDataScheduler scheduler(config);
+  EXPECT_EQ(scheduler.nextDue(), DeviceDataScheduler::Clock::time_point::max());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,80 @@
+#include "primary/event_dispatcher.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "logging/logging.h"
+#include "utilities/allocation_accounting.h"
+
+EventDispatcher::EventDispatcher(std::shared_ptr<event::Channel> channel, size_t capacity)
+    : channel_{std::move(channel)}, capacity_{std::max<size_t>(capacity, 1)}, thread_{[this]() { run(); }} {}
+
+EventDispatcher::~EventDispatcher() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopping_ = true;
+  }
+  queued_cv_.notify_all();
+  thread_.join();
+  if (dropped_ > 0 || coalesced_ > 0) {
+    LOG_INFO << "Event queue was full: " << dropped_ << " progress reports dropped, " << coalesced_ << " coalesced";
+  }
+}
+
+void EventDispatcher::dispatch(std::shared_ptr<event::BaseEvent> event) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (queue_.size() >= capacity_) {
+    if (event->isTypeOf<event::DownloadProgressReport>() &&
+        !event::DownloadProgressReport::isDownloadCompleted(static_cast<event::DownloadProgressReport&>(*event))) {
+      if (coalesce(event)) {
+        ++coalesced_;
+      } else {
+        ++dropped_;
+      }
+      return;
+    }
+    // A handler sending an event can't wait for itself to make room.
+    if (std::this_thread::get_id() != thread_.get_id()) {
+      room_cv_.wait(lock, [this]() { return queue_.size() < capacity_; });
+    }
+  }
+  queue_.push_back(std::move(event));
+  queued_cv_.notify_one();
+}
+
+bool EventDispatcher::coalesce(const std::shared_ptr<event::BaseEvent>& event) {
+  const auto& report = static_cast<const event::DownloadProgressReport&>(*event);
+  for (auto it = queue_.rbegin(); it != queue_.rend(); ++it) {
+    if (!(*it)->isTypeOf<event::DownloadProgressReport>()) {
+      continue;
+    }
+    const auto& queued = static_cast<const event::DownloadProgressReport&>(**it);
+    if (queued.target.filename() == report.target.filename() &&
+        !event::DownloadProgressReport::isDownloadCompleted(queued)) {
+      *it = event;
+      return true;
+    }
+  }
+  return false;
+}
+
+void EventDispatcher::run() {
+  const AllocationAccounting::Scope accounting(AllocationTag::kEvents);
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      break;
+    }
+    auto event = std::move(queue_.front());
+    queue_.pop_front();
+    room_cv_.notify_all();
+    lock.unlock();
+    try {
+      (*channel_)(std::move(event));
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Event handler failed: " << e.what();
+    }
+    lock.lock();
+  }
+}
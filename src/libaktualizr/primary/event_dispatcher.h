@@ -0,0 +1,57 @@
+#ifndef EVENT_DISPATCHER_H_
+#define EVENT_DISPATCHER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "libaktualizr/events.h"
+
+/**
+ * Delivers the events to the handlers of a channel on its own thread, so that
+ * slow handlers don't hold up the downloads and installations.
+ *
+ * The events are delivered in order through a bounded queue. When it is full,
+ * a new progress report replaces a queued report for the same target, or is
+ * dropped if there is none; other events wait for room in the queue, so that
+ * none of them is lost.
+ */
+class EventDispatcher {
+ public:
+  EventDispatcher(std::shared_ptr<event::Channel> channel, size_t capacity);
+  /** Deliver the queued events and stop the thread. */
+  ~EventDispatcher();
+  EventDispatcher(const EventDispatcher&) = delete;
+  EventDispatcher(EventDispatcher&&) = delete;
+  EventDispatcher& operator=(const EventDispatcher&) = delete;
+  EventDispatcher& operator=(EventDispatcher&&) = delete;
+
+  void dispatch(std::shared_ptr<event::BaseEvent> event);
+
+  /** Progress reports dropped because the queue was full */
+  uint64_t dropped() const { return dropped_; }
+  /** Progress reports that replaced a queued one because the queue was full */
+  uint64_t coalesced() const { return coalesced_; }
+
+ private:
+  void run();
+  // Replace a queued progress report for the same target; needs mutex_
+  bool coalesce(const std::shared_ptr<event::BaseEvent>& event);
+
+  std::shared_ptr<event::Channel> channel_;
+  const size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable room_cv_;
+  std::deque<std::shared_ptr<event::BaseEvent>> queue_;
+  bool stopping_{false};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> coalesced_{0};
+  std::thread thread_;
+};
+
+#endif  // EVENT_DISPATCHER_H_
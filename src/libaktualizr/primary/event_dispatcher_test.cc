@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "primary/event_dispatcher.h"
+
+/* Records the events, the first one only once it is released. */
+class Recorder {
+ public:
+  explicit Recorder(event::Channel &channel) {
+    channel.connect([this](const std::shared_ptr<event::BaseEvent> &event) {
+      if (first_) {
+        first_ = false;
+        started_.set_value();
+        release_future_.wait();
+      }
+      std::string name = event->variant;
+      if (event->isTypeOf<event::DownloadProgressReport>()) {
+        const auto &report = dynamic_cast<const event::DownloadProgressReport &>(*event);
+        name += " " + report.target.filename() + " " + std::to_string(report.progress);
+      }
+      std::lock_guard<std::mutex> guard(mutex_);
+      events_.push_back(name);
+    });
+  }
+
+  void waitStarted() { started_.get_future().wait(); }
+  void release() { release_.set_value(); }
+  std::vector<std::string> events() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return events_;
+  }
+
+ private:
+  bool first_{true};
+  std::promise<void> started_;
+  std::promise<void> release_;
+  std::shared_future<void> release_future_{release_.get_future()};
+  std::mutex mutex_;
+  std::vector<std::string> events_;
+};
+
+static std::shared_ptr<event::BaseEvent> progress(const std::string &filename, unsigned int progress) {
+  return std::make_shared<event::DownloadProgressReport>(
+      Uptane::Target(filename, Uptane::EcuMap{}, std::vector<Hash>{}, 0), "", progress);
+}
+
+/* The events are delivered in order, on another thread. */
+TEST(EventDispatcher, Order) {
+  auto channel = std::make_shared<event::Channel>();
+  Recorder recorder(*channel);
+  {
+    EventDispatcher dispatcher(channel, 10);
+    dispatcher.dispatch(std::make_shared<event::SendDeviceDataComplete>());
+    recorder.waitStarted();
+    dispatcher.dispatch(progress("a", 10));
+    dispatcher.dispatch(std::make_shared<event::PutManifestComplete>(true));
+    // Didn't wait for the handler
+    EXPECT_TRUE(recorder.events().empty());
+    recorder.release();
+  }
+  EXPECT_EQ(recorder.events(), (std::vector<std::string>{"SendDeviceDataComplete", "DownloadProgressReport a 10",
+                                                          "PutManifestComplete"}));
+}
+
+/* When the queue is full, progress reports replace queued ones for the same target or are dropped. */
+TEST(EventDispatcher, Coalesce) {
+  auto channel = std::make_shared<event::Channel>();
+  Recorder recorder(*channel);
+  {
+    EventDispatcher dispatcher(channel, 1);
+    dispatcher.dispatch(std::make_shared<event::SendDeviceDataComplete>());
+    recorder.waitStarted();
+    dispatcher.dispatch(progress("a", 10));
+    dispatcher.dispatch(progress("a", 20));
+    dispatcher.dispatch(progress("b", 10));
+    EXPECT_EQ(dispatcher.coalesced(), 1U);
+    EXPECT_EQ(dispatcher.dropped(), 1U);
+
+    // Other events wait for room in the queue
+    auto put = std::async(std::launch::async, [&dispatcher]() {
+      dispatcher.dispatch(std::make_shared<event::PutManifestComplete>(true));
+    });
+    EXPECT_EQ(put.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout);
+    recorder.release();
+    put.get();
+  }
+  EXPECT_EQ(recorder.events(), (std::vector<std::string>{"SendDeviceDataComplete", "DownloadProgressReport a 20",
+                                                          "PutManifestComplete"}));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,124 @@
+#include "primary/firmware_fan_out.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/executor.h"
+#include "utilities/flow_control.h"
+#include "utilities/load_admission.h"
+
+FirmwareFanOut::FirmwareFanOut(size_t block_size, size_t depth)
+    : block_size_{std::max<size_t>(block_size, 1)}, depth_{std::max<size_t>(depth, 1)} {}
+
+namespace {
+
+// The blocks read and not yet given to every stream, numbered from `first`
+struct Blocks {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<std::shared_ptr<const std::string>> blocks;
+  uint64_t first{0};
+  bool eof{false};
+  // Next block of each stream, or UINT64_MAX once it stopped accepting data
+  std::vector<uint64_t> next;
+
+  uint64_t end() const { return first + blocks.size(); }
+  // Needs mutex
+  uint64_t slowest() const { return *std::min_element(next.cbegin(), next.cend()); }
+  void dropDelivered() {
+    const uint64_t min = slowest();
+    while (!blocks.empty() && first < min) {
+      blocks.pop_front();
+      ++first;
+    }
+  }
+};
+
+constexpr uint64_t kStopped = UINT64_MAX;
+
+}  // namespace
+
+std::vector<uint64_t> FirmwareFanOut::run(std::istream& image, const std::vector<Stream>& streams,
+                                          const api::FlowControlToken* token) const {
+  std::vector<uint64_t> accepted(streams.size(), 0);
+  if (streams.empty()) {
+    return accepted;
+  }
+  Blocks b;
+  b.next.assign(streams.size(), 0);
+
+  // The streams go on at the pace of the slowest one, so they all have to run at once.
+  std::vector<std::future<void>> workers;
+  workers.reserve(streams.size());
+  for (size_t i = 0; i < streams.size(); ++i) {
+    workers.push_back(Executor::blocking().submit([&b, &streams, &accepted, i]() {
+      const BackgroundScheduling::Thread background;
+      for (;;) {
+        std::shared_ptr<const std::string> block;
+        {
+          std::unique_lock<std::mutex> lock(b.mutex);
+          b.cv.wait(lock, [&b, i]() { return b.next[i] < b.end() || b.eof; });
+          if (b.next[i] >= b.end()) {
+            return;
+          }
+          block = b.blocks[static_cast<size_t>(b.next[i] - b.first)];
+        }
+        bool ok = false;
+        try {
+          ok = streams[i](reinterpret_cast<const uint8_t*>(block->data()), block->size());
+        } catch (const std::exception& e) {
+          LOG_WARNING << "Sending an image to several Secondaries failed for one of them: " << e.what();
+        }
+        std::lock_guard<std::mutex> lock(b.mutex);
+        if (ok) {
+          accepted[i] += block->size();
+          ++b.next[i];
+        } else {
+          b.next[i] = kStopped;
+        }
+        b.dropDelivered();
+        b.cv.notify_all();
+        if (!ok) {
+          return;
+        }
+      }
+    }));
+  }
+
+  for (;;) {
+    if (token != nullptr && !token->canContinue()) {
+      break;
+    }
+    // All the streams go at the pace of the blocks read here
+    LoadAdmission::admit(LoadAdmission::Work::kSecondaryTransfer);
+    auto block = std::make_shared<std::string>(block_size_, '\0');
+    image.read(&(*block)[0], static_cast<std::streamsize>(block->size()));
+    if (image.gcount() <= 0) {
+      break;
+    }
+    block->resize(static_cast<size_t>(image.gcount()));
+    std::unique_lock<std::mutex> lock(b.mutex);
+    b.cv.wait(lock, [this, &b]() { return b.slowest() == kStopped || b.end() - b.slowest() < depth_; });
+    if (b.slowest() == kStopped) {
+      break;
+    }
+    b.blocks.push_back(std::move(block));
+    b.cv.notify_all();
+  }
+  {
+    std::lock_guard<std::mutex> lock(b.mutex);
+    b.eof = true;
+  }
+  b.cv.notify_all();
+  for (auto& worker : workers) {
+    worker.get();
+  }
+  return accepted;
+}
@@ -0,0 +1,48 @@
+#ifndef FIRMWARE_FAN_OUT_H_
+#define FIRMWARE_FAN_OUT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <vector>
+
+namespace api {
+class FlowControlToken;
+}
+
+/**
+ * Sends one image to several Secondaries from a single read of the stored
+ * file, such as identical ECUs installing the same Target.
+ *
+ * The image is read in blocks, and every stream is given them in order on a
+ * thread of its own, so the Secondaries receive the image at the same time.
+ * The reading gets at most a few blocks ahead of the slowest stream still
+ * accepting the data.
+ */
+class FirmwareFanOut {
+ public:
+  // Same as SecondaryInterface::FirmwareStream: returns false once the Secondary stopped accepting the data.
+  using Stream = std::function<bool(const uint8_t* data, size_t size)>;
+
+  /**
+   * @param block_size size of the blocks read from the image
+   * @param depth number of blocks read ahead of the slowest stream
+   */
+  explicit FirmwareFanOut(size_t block_size = 256 * 1024, size_t depth = 8);
+
+  /**
+   * Read the image and give it to all the streams. A stream that returns
+   * false or throws is given no more data.
+   * @param token stops the reading once it is aborted
+   * @return the number of bytes accepted by each stream, in the order of streams
+   */
+  std::vector<uint64_t> run(std::istream& image, const std::vector<Stream>& streams,
+                            const api::FlowControlToken* token = nullptr) const;
+
+ private:
+  size_t block_size_;
+  size_t depth_;
+};
+
+#endif  // FIRMWARE_FAN_OUT_H_
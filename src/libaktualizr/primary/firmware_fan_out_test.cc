@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "primary/firmware_fan_out.h"
+
+static std::string image(size_t size) {
+  std::string data;
+  for (size_t i = 0; i < size; ++i) {
+    data += static_cast<char>('a' + i % 26);
+  }
+  return data;
+}
+
+/* Every stream gets the whole image in order, also when some are slower. */
+TEST(FirmwareFanOut, AllStreams) {
+  const std::string content = image(100000);
+  std::vector<std::string> received(4);
+  std::vector<FirmwareFanOut::Stream> streams;
+  for (size_t i = 0; i < received.size(); ++i) {
+    streams.emplace_back([&received, i](const uint8_t* data, size_t size) {
+      if (i == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      received[i].append(reinterpret_cast<const char*>(data), size);
+      return true;
+    });
+  }
+  std::istringstream in(content);
+  const auto accepted = FirmwareFanOut(1000, 3).run(in, streams);
+  for (size_t i = 0; i < received.size(); ++i) {
+    EXPECT_EQ(accepted[i], content.size());
+    EXPECT_EQ(received[i], content);
+  }
+}
+
+/* A stream that stops or throws doesn't hold up the others. */
+TEST(FirmwareFanOut, StoppedStreams) {
+  const std::string content = image(50000);
+  std::string received;
+  std::vector<FirmwareFanOut::Stream> streams;
+  streams.emplace_back([](const uint8_t*, size_t) { return false; });
+  streams.emplace_back([](const uint8_t*, size_t) -> bool { throw std::runtime_error("broken"); });
+  std::atomic<size_t> partial{0};
+  streams.emplace_back([&partial](const uint8_t*, size_t size) { return (partial += size) < 10000; });
+  streams.emplace_back([&received](const uint8_t* data, size_t size) {
+    received.append(reinterpret_cast<const char*>(data), size);
+    return true;
+  });
+  std::istringstream in(content);
+  const auto accepted = FirmwareFanOut(1000, 2).run(in, streams);
+  EXPECT_EQ(accepted[0], 0);
+  EXPECT_EQ(accepted[1], 0);
+  EXPECT_EQ(accepted[2], 9000);
+  EXPECT_EQ(accepted[3], content.size());
+  EXPECT_EQ(received, content);
+}
+
+/* The image is read at most depth blocks ahead of the slowest stream. */
+TEST(FirmwareFanOut, ReadAhead) {
+  class CountingBuf : public std::stringbuf {
+   public:
+    explicit CountingBuf(const std::string& s) : std::stringbuf(s) {}
+    std::atomic<std::streamsize> read{0};
+
+   protected:
+    std::streamsize xsgetn(char* s, std::streamsize n) override {
+      const auto got = std::stringbuf::xsgetn(s, n);
+      read += got;
+      return got;
+    }
+  };
+  const std::string content = image(20000);
+  CountingBuf buf(content);
+  std::istream in(&buf);
+  std::streamsize max_ahead = 0;
+  size_t slow_received = 0;
+  std::vector<FirmwareFanOut::Stream> streams;
+  streams.emplace_back([&](const uint8_t*, size_t size) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    max_ahead = std::max(max_ahead, buf.read - static_cast<std::streamsize>(slow_received));
+    slow_received += size;
+    return true;
+  });
+  streams.emplace_back([](const uint8_t*, size_t) { return true; });
+  FirmwareFanOut(1000, 2).run(in, streams);
+  EXPECT_EQ(slow_received, content.size());
+  // The blocks waiting, the one being sent and the one read next
+  EXPECT_LE(max_ahead, 4 * 1000);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,112 @@
+#include "libaktualizr/gateway.h"
+
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#include "logging/logging.h"
+#include "utilities/executor.h"
+#include "utilities/utils.h"
+
+Gateway::~Gateway() { Shutdown(); }
+
+Config Gateway::deviceConfig(Config config) {
+  config.network.share_connections = true;
+  config.uptane.share_image_metadata = true;
+  if (config.uptane.persist_signature_cache) {
+    LOG_INFO << "Not keeping the signature verifications in the storage of a device served by a gateway";
+    config.uptane.persist_signature_cache = false;
+  }
+  return config;
+}
+
+std::vector<boost::filesystem::path> Gateway::storagePaths(const Config& config) {
+  return {boost::filesystem::absolute(config.storage.sqldb_path.get(config.storage.path)).lexically_normal(),
+          boost::filesystem::absolute(config.pacman.images_path).lexically_normal()};
+}
+
+void Gateway::checkStorage(const std::vector<boost::filesystem::path>& paths) const {
+  for (const auto& path : paths) {
+    if (used_storage_.count(path) != 0) {
+      throw std::invalid_argument(path.string() + " is used by another device");
+    }
+  }
+}
+
+Aktualizr& Gateway::AddDevice(const Config& config) {
+  const Config device_config = deviceConfig(config);
+  // Before the storage is opened
+  checkStorage(storagePaths(device_config));
+  return AddDevice(std_::make_unique<Aktualizr>(device_config), device_config);
+}
+
+Aktualizr& Gateway::AddDevice(std::unique_ptr<Aktualizr> device, const Config& config) {
+  auto paths = storagePaths(config);
+  checkStorage(paths);
+  used_storage_.insert(paths.begin(), paths.end());
+  storage_paths_.push_back(std::move(paths));
+  devices_.push_back(std::move(device));
+  return *devices_.back();
+}
+
+size_t Gateway::Initialize() {
+  // Each device's initialization mostly waits for the server, so they are all
+  // done at the same time.
+  std::vector<std::future<void>> initialized;
+  initialized.reserve(devices_.size());
+  for (auto& device : devices_) {
+    Aktualizr* aktualizr = device.get();
+    initialized.push_back(Executor::blocking().submit([aktualizr]() { aktualizr->Initialize(); }));
+  }
+  size_t index = 0;
+  for (auto& result : initialized) {
+    try {
+      result.get();
+      ++index;
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Failed to initialize device " << index << " of the gateway, leaving it out: " << e.what();
+      for (const auto& path : storage_paths_[index]) {
+        used_storage_.erase(path);
+      }
+      storage_paths_.erase(storage_paths_.begin() + static_cast<std::ptrdiff_t>(index));
+      devices_.erase(devices_.begin() + static_cast<std::ptrdiff_t>(index));
+    }
+  }
+  LOG_INFO << "Serving " << devices_.size() << " device identities";
+  return devices_.size();
+}
+
+std::future<void> Gateway::RunForever() {
+  auto running = std::make_shared<std::vector<std::future<void>>>();
+  running->reserve(devices_.size());
+  for (auto& device : devices_) {
+    running->push_back(device->RunForever());
+  }
+  return Executor::blocking().submit([running]() {
+    std::exception_ptr first;
+    for (auto& result : *running) {
+      try {
+        result.get();
+      } catch (...) {
+        if (!first) {
+          first = std::current_exception();
+        }
+      }
+    }
+    if (first) {
+      std::rethrow_exception(first);
+    }
+  });
+}
+
+void Gateway::Abort() {
+  for (auto& device : devices_) {
+    device->Abort();
+  }
+}
+
+void Gateway::Shutdown() {
+  for (auto& device : devices_) {
+    device->Shutdown();
+  }
+}
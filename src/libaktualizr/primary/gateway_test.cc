@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/gateway.h"
+
+#include "httpfake.h"
+#include "metafake.h"
+#include "uptane/shared_image_meta.h"
+#include "uptane_test_common.h"
+#include "utilities/utils.h"
+
+boost::filesystem::path fake_meta_dir;
+
+struct TestDevice {
+  TestDevice() : http{std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", fake_meta_dir)} {
+    config = Gateway::deviceConfig(UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server));
+  }
+
+  std::unique_ptr<Aktualizr> make() {
+    return std_::make_unique<UptaneTestCommon::TestAktualizr>(config, INvStorage::newStorage(config.storage), http);
+  }
+
+  TemporaryDirectory temp_dir;
+  std::shared_ptr<HttpFake> http;
+  Config config;
+};
+
+/* The devices of a gateway share the process-wide resources, but not their storage. */
+TEST(Gateway, DeviceConfig) {
+  TestDevice device;
+  device.config.uptane.persist_signature_cache = true;
+  const Config config = Gateway::deviceConfig(device.config);
+  EXPECT_TRUE(config.network.share_connections);
+  EXPECT_TRUE(config.uptane.share_image_metadata);
+  EXPECT_FALSE(config.uptane.persist_signature_cache);
+
+  Gateway gateway;
+  gateway.AddDevice(device.make(), device.config);
+  // Another device with the same database
+  EXPECT_THROW(gateway.AddDevice(device.config), std::invalid_argument);
+  TestDevice other;
+  other.config.pacman.images_path = device.config.pacman.images_path;
+  EXPECT_THROW(gateway.AddDevice(other.make(), other.config), std::invalid_argument);
+  EXPECT_EQ(gateway.Size(), 1);
+}
+
+/* The Image repo Targets metadata verified for a device is used by the others. */
+TEST(Gateway, SharedImageMetadata) {
+  Uptane::SharedImageMeta::instance().clear();
+  std::vector<std::unique_ptr<TestDevice>> devices;
+  Gateway gateway;
+  for (int i = 0; i < 3; ++i) {
+    devices.push_back(std_::make_unique<TestDevice>());
+    gateway.AddDevice(devices.back()->make(), devices.back()->config);
+  }
+  EXPECT_EQ(gateway.Initialize(), 3);
+
+  const uint64_t misses = Uptane::SharedImageMeta::instance().misses();
+  const uint64_t hits = Uptane::SharedImageMeta::instance().hits();
+  for (size_t i = 0; i < gateway.Size(); ++i) {
+    const result::UpdateCheck update_result = gateway.Device(i).CheckUpdates().get();
+    EXPECT_EQ(update_result.status, result::UpdateStatus::kNoUpdatesAvailable);
+  }
+  // Only the first device verified the fetched metadata itself.
+  EXPECT_EQ(Uptane::SharedImageMeta::instance().misses() - misses, 1);
+  EXPECT_GE(Uptane::SharedImageMeta::instance().hits() - hits, 2);
+  Uptane::SharedImageMeta::instance().clear();
+}
+
+/* All the devices run until the gateway is shut down. */
+TEST(Gateway, RunForever) {
+  std::vector<std::unique_ptr<TestDevice>> devices;
+  Gateway gateway;
+  for (int i = 0; i < 2; ++i) {
+    devices.push_back(std_::make_unique<TestDevice>());
+    gateway.AddDevice(devices.back()->make(), devices.back()->config);
+  }
+  EXPECT_EQ(gateway.Initialize(), 2);
+  std::future<void> running = gateway.RunForever();
+  EXPECT_EQ(running.wait_for(std::chrono::milliseconds(500)), std::future_status::timeout);
+  gateway.Shutdown();
+  ASSERT_EQ(running.wait_for(std::chrono::seconds(20)), std::future_status::ready);
+  running.get();
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+
+  TemporaryDirectory tmp_dir;
+  fake_meta_dir = tmp_dir.Path();
+  CreateFakeRepoMetaData(fake_meta_dir);
+
+  return RUN_ALL_TESTS();
+}
+#endif
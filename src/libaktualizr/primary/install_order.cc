@@ -0,0 +1,102 @@
+#include "primary/install_order.h"
+
+#include <algorithm>
+
+#include <boost/algorithm/string.hpp>
+
+#include "logging/logging.h"
+
+InstallOrder::InstallOrder(const std::string &dependencies,
+                           const std::vector<std::pair<std::string, std::string>> &ecus)
+    : dependencies_(ecus.size()), states_(ecus.size(), State::kPending) {
+  auto matches = [](const std::pair<std::string, std::string> &ecu, const std::string &name) {
+    return name == ecu.first || name == ecu.second;
+  };
+  for (const auto &dependency : parse(dependencies)) {
+    for (size_t i = 0; i < ecus.size(); ++i) {
+      if (!matches(ecus[i], dependency.first)) {
+        continue;
+      }
+      for (size_t j = 0; j < ecus.size(); ++j) {
+        if (j != i && matches(ecus[j], dependency.second) &&
+            std::find(dependencies_[i].cbegin(), dependencies_[i].cend(), j) == dependencies_[i].cend()) {
+          dependencies_[i].push_back(j);
+        }
+      }
+    }
+  }
+  if (hasCycle()) {
+    LOG_WARNING << "The Secondary install dependencies form a cycle, they are ignored";
+    for (auto &ecu_dependencies : dependencies_) {
+      ecu_dependencies.clear();
+    }
+  }
+}
+
+std::vector<std::pair<std::string, std::string>> InstallOrder::parse(const std::string &dependencies) {
+  std::vector<std::pair<std::string, std::string>> result;
+  std::vector<std::string> entries;
+  boost::split(entries, dependencies, boost::is_any_of(","));
+  for (auto &entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    const auto colon = entry.find(':');
+    if (colon == std::string::npos || colon == 0 || colon + 1 == entry.size()) {
+      LOG_WARNING << "Ignoring malformed Secondary install dependency: " << entry;
+      continue;
+    }
+    result.emplace_back(boost::trim_copy(entry.substr(0, colon)), boost::trim_copy(entry.substr(colon + 1)));
+  }
+  return result;
+}
+
+bool InstallOrder::hasCycle() const {
+  // Depth-first search, with the installations on the current path marked 1 and the ones done 2
+  std::vector<int> marks(dependencies_.size(), 0);
+  std::vector<std::pair<size_t, size_t>> path;
+  for (size_t start = 0; start < dependencies_.size(); ++start) {
+    if (marks[start] != 0) {
+      continue;
+    }
+    marks[start] = 1;
+    path.emplace_back(start, 0);
+    while (!path.empty()) {
+      auto &top = path.back();
+      if (top.second == dependencies_[top.first].size()) {
+        marks[top.first] = 2;
+        path.pop_back();
+        continue;
+      }
+      const size_t next = dependencies_[top.first][top.second++];
+      if (marks[next] == 1) {
+        return true;
+      }
+      if (marks[next] == 0) {
+        marks[next] = 1;
+        path.emplace_back(next, 0);
+      }
+    }
+  }
+  return false;
+}
+
+int InstallOrder::wait(size_t i) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (const size_t dependency : dependencies_.at(i)) {
+    finished_.wait(lock, [this, dependency]() { return states_[dependency] != State::kPending; });
+    if (states_[dependency] == State::kFailed) {
+      return static_cast<int>(dependency);
+    }
+  }
+  return -1;
+}
+
+void InstallOrder::finish(size_t i, bool success) {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    states_.at(i) = success ? State::kInstalled : State::kFailed;
+  }
+  finished_.notify_all();
+}
@@ -0,0 +1,57 @@
+#ifndef INSTALL_ORDER_H_
+#define INSTALL_ORDER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Orders the installations on the Secondaries of an update, which run on the
+ * threads of their transfers as soon as each transfer is finished. An
+ * installation waits for the installations it depends on; without
+ * dependencies, they are all independent.
+ *
+ * Dependencies are given as "ecu:dependency,ecu:dependency", where each is an
+ * ECU serial or a hardware ID: the ECUs matching the first are installed after
+ * the ECUs matching the second. Dependencies on ECUs not updated are met.
+ */
+class InstallOrder {
+ public:
+  enum class State { kPending, kInstalled, kFailed };
+
+  /**
+   * @param dependencies as "ecu:dependency,ecu:dependency". Malformed entries
+   *        are skipped with a warning, and all of them are ignored if they
+   *        form a cycle among the ECUs updated.
+   * @param ecus serial and hardware ID of each ECU updated, in the order of
+   *        the installations
+   */
+  InstallOrder(const std::string &dependencies, const std::vector<std::pair<std::string, std::string>> &ecus);
+
+  /** Indices of the installations that installation i waits for. */
+  const std::vector<size_t> &dependencies(size_t i) const { return dependencies_.at(i); }
+
+  /**
+   * Block until the installations that installation i depends on are finished.
+   * @return index of one that failed, or -1 if they were all successful
+   */
+  int wait(size_t i);
+  /** Report the end of installation i, including one that could not start. */
+  void finish(size_t i, bool success);
+
+  /** Parse dependencies given as "ecu:dependency,ecu:dependency", without checking them. */
+  static std::vector<std::pair<std::string, std::string>> parse(const std::string &dependencies);
+
+ private:
+  bool hasCycle() const;
+
+  std::vector<std::vector<size_t>> dependencies_;
+  std::mutex mutex_;
+  std::condition_variable finished_;
+  std::vector<State> states_;
+};
+
+#endif  // INSTALL_ORDER_H_
@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "logging/logging.h"
+#include "primary/install_order.h"
+
+namespace {
+
+const std::vector<std::pair<std::string, std::string>> kEcus{
+    {"gateway", "gateway-hw"}, {"brakes-front", "brakes"}, {"brakes-rear", "brakes"}, {"radio", "radio-hw"}};
+
+}  // namespace
+
+/* Without dependencies, no installation waits for another. */
+TEST(InstallOrder, Independent) {
+  InstallOrder order("", kEcus);
+  for (size_t i = 0; i < kEcus.size(); ++i) {
+    EXPECT_TRUE(order.dependencies(i).empty());
+    EXPECT_EQ(order.wait(i), -1);
+  }
+}
+
+/* Dependencies are given by ECU serial or hardware ID, and the malformed ones are skipped. */
+TEST(InstallOrder, Dependencies) {
+  InstallOrder order("brakes:gateway, radio:brakes-rear, radio:unknown, :gateway, radio, gateway:", kEcus);
+  EXPECT_TRUE(order.dependencies(0).empty());
+  EXPECT_EQ(order.dependencies(1), std::vector<size_t>{0});
+  EXPECT_EQ(order.dependencies(2), std::vector<size_t>{0});
+  EXPECT_EQ(order.dependencies(3), std::vector<size_t>{2});
+
+  EXPECT_EQ(InstallOrder::parse(" a : b ,c:d"),
+            (std::vector<std::pair<std::string, std::string>>{{"a", "b"}, {"c", "d"}}));
+}
+
+/* Dependencies that form a cycle are all ignored, as no installation could start. */
+TEST(InstallOrder, Cycle) {
+  InstallOrder order("gateway:radio,brakes-front:gateway,radio:brakes", kEcus);
+  for (size_t i = 0; i < kEcus.size(); ++i) {
+    EXPECT_TRUE(order.dependencies(i).empty());
+  }
+  // Nor does an ECU matching both sides of a dependency depend on itself.
+  EXPECT_TRUE(InstallOrder("gateway:gateway-hw", kEcus).dependencies(0).empty());
+  EXPECT_TRUE(InstallOrder("brakes:brakes", kEcus).dependencies(1).empty());
+}
+
+/* An installation waits for the ones it depends on, and learns that one of them failed. */
+TEST(InstallOrder, Wait) {
+  InstallOrder order("brakes:gateway,radio:brakes-front", kEcus);
+  std::atomic<bool> gateway_installed{false};
+  auto front = std::async(std::launch::async, [&]() {
+    const int failed = order.wait(1);
+    EXPECT_TRUE(gateway_installed);
+    order.finish(1, false);
+    return failed;
+  });
+  auto radio = std::async(std::launch::async, [&]() { return order.wait(3); });
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(radio.wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+  gateway_installed = true;
+  order.finish(0, true);
+  EXPECT_EQ(front.get(), -1);
+  EXPECT_EQ(radio.get(), 1);
+  EXPECT_EQ(order.wait(2), -1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,64 @@
+#include "primary/io_accounting.h"
+
+#include <sstream>
+
+#include "utilities/metrics.h"
+
+IoTotals IoTotals::current() {
+  const Metrics &metrics = Metrics::instance();
+  IoTotals totals;
+  totals.storage_calls = metrics.total("aktualizr_sqlite_duration_seconds");
+  totals.storage_seconds = metrics.sum("aktualizr_sqlite_duration_seconds");
+  totals.storage_read_bytes = metrics.total("aktualizr_sqlite_read_bytes_total");
+  totals.storage_written_bytes = metrics.total("aktualizr_sqlite_written_bytes_total");
+  totals.http_requests = metrics.total("aktualizr_http_request_duration_seconds");
+  totals.http_seconds = metrics.sum("aktualizr_http_request_duration_seconds");
+  totals.http_downloaded_bytes = metrics.total("aktualizr_http_downloaded_bytes_total");
+  totals.http_uploaded_bytes = metrics.total("aktualizr_http_uploaded_bytes_total");
+  totals.file_operations = metrics.total("aktualizr_target_file_operations_total");
+  totals.file_read_bytes = metrics.total("aktualizr_target_file_read_bytes_total");
+  totals.file_written_bytes = metrics.total("aktualizr_target_file_written_bytes_total");
+  return totals;
+}
+
+IoTotals IoTotals::operator-(const IoTotals &other) const {
+  IoTotals diff;
+  diff.storage_calls = storage_calls - other.storage_calls;
+  diff.storage_seconds = storage_seconds - other.storage_seconds;
+  diff.storage_read_bytes = storage_read_bytes - other.storage_read_bytes;
+  diff.storage_written_bytes = storage_written_bytes - other.storage_written_bytes;
+  diff.http_requests = http_requests - other.http_requests;
+  diff.http_seconds = http_seconds - other.http_seconds;
+  diff.http_downloaded_bytes = http_downloaded_bytes - other.http_downloaded_bytes;
+  diff.http_uploaded_bytes = http_uploaded_bytes - other.http_uploaded_bytes;
+  diff.file_operations = file_operations - other.file_operations;
+  diff.file_read_bytes = file_read_bytes - other.file_read_bytes;
+  diff.file_written_bytes = file_written_bytes - other.file_written_bytes;
+  return diff;
+}
+
+Json::Value IoTotals::toJson() const {
+  Json::Value json;
+  json["storage"]["calls"] = Json::UInt64(storage_calls);
+  json["storage"]["seconds"] = storage_seconds;
+  json["storage"]["read_bytes"] = Json::UInt64(storage_read_bytes);
+  json["storage"]["written_bytes"] = Json::UInt64(storage_written_bytes);
+  json["http"]["requests"] = Json::UInt64(http_requests);
+  json["http"]["seconds"] = http_seconds;
+  json["http"]["downloaded_bytes"] = Json::UInt64(http_downloaded_bytes);
+  json["http"]["uploaded_bytes"] = Json::UInt64(http_uploaded_bytes);
+  json["files"]["operations"] = Json::UInt64(file_operations);
+  json["files"]["read_bytes"] = Json::UInt64(file_read_bytes);
+  json["files"]["written_bytes"] = Json::UInt64(file_written_bytes);
+  return json;
+}
+
+std::string IoTotals::toString() const {
+  std::ostringstream out;
+  out << "storage: " << storage_calls << " calls in " << storage_seconds * 1e3 << " ms, " << storage_read_bytes
+      << " bytes read, " << storage_written_bytes << " bytes written; HTTP: " << http_requests << " requests in "
+      << http_seconds * 1e3 << " ms, " << http_downloaded_bytes << " bytes downloaded, " << http_uploaded_bytes
+      << " bytes uploaded; target files: " << file_operations << " operations, " << file_read_bytes
+      << " bytes read, " << file_written_bytes << " bytes written";
+  return out.str();
+}
@@ -0,0 +1,37 @@
+#ifndef IO_ACCOUNTING_H_
+#define IO_ACCOUNTING_H_
+
+#include <cstdint>
+#include <string>
+
+#include "json/json.h"
+
+/**
+ * The storage, HTTP and target file I/O done by the process so far, from its
+ * metrics. The difference of two gives what was done in between, e.g. in an
+ * update cycle, along with whatever else ran at the same time.
+ *
+ * The storage is accounted by SQLite call, where each row of a query is a
+ * call, and by the bytes of the text and blob values read and given.
+ */
+struct IoTotals {
+  uint64_t storage_calls{0};
+  double storage_seconds{0};
+  uint64_t storage_read_bytes{0};
+  uint64_t storage_written_bytes{0};
+  uint64_t http_requests{0};
+  double http_seconds{0};
+  uint64_t http_downloaded_bytes{0};
+  uint64_t http_uploaded_bytes{0};
+  uint64_t file_operations{0};
+  uint64_t file_read_bytes{0};
+  uint64_t file_written_bytes{0};
+
+  static IoTotals current();
+
+  IoTotals operator-(const IoTotals &other) const;
+  Json::Value toJson() const;
+  std::string toString() const;
+};
+
+#endif  // IO_ACCOUNTING_H_
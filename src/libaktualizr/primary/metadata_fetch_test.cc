@@ -1,6 +1,11 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <future>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "httpfake.h"
 #include "libaktualizr/aktualizr.h"
@@ -140,6 +145,118 @@ TEST(Aktualizr, MetadataFetch) {
   EXPECT_EQ(http->image_targets_count, 1);
 }
 
+/*
+ * With prefetch_image_meta, the Image repo metadata that MetadataFetch needs
+ * is fetched along with the Director metadata, with no more requests for it,
+ * except for the Root and Timestamp when the Director reports no new targets.
+ */
+TEST(Aktualizr, MetadataPrefetch) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.prefetch_image_meta = true;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware-małecki.txt", "primary_hw");
+  uptane_repo_.addImage("tests/test_data/firmware_name.txt", "firmware_name.txt", "primary_hw");
+  uptane_repo_.addTarget("firmware-małecki.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.addDelegation(Uptane::Role("role-abc", true), Uptane::Role("targets", false), "abc/*", false,
+                             KeyType::kED25519);
+  uptane_repo_.signTargets();
+
+  // Nothing to prefetch without a stored Image repo Root.
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->image_1root_count, 1);
+  EXPECT_EQ(http->image_2root_count, 1);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+  EXPECT_EQ(http->image_snapshot_count, 1);
+  EXPECT_EQ(http->image_targets_count, 1);
+
+  // The Snapshot has changed, the Targets have not.
+  uptane_repo_.emptyTargets();
+  uptane_repo_.addTarget("firmware_name.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.addDelegation(Uptane::Role("role-def", true), Uptane::Role("role-abc", true), "def/*", false,
+                             KeyType::kED25519);
+  uptane_repo_.signTargets();
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->image_1root_count, 1);
+  EXPECT_EQ(http->image_2root_count, 2);
+  EXPECT_EQ(http->image_timestamp_count, 2);
+  EXPECT_EQ(http->image_snapshot_count, 2);
+  EXPECT_EQ(http->image_targets_count, 1);
+
+  // No new targets: the speculative requests are wasted.
+  uptane_repo_.emptyTargets();
+  uptane_repo_.signTargets();
+
+  update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kNoUpdatesAvailable);
+  EXPECT_EQ(http->image_2root_count, 3);
+  EXPECT_EQ(http->image_timestamp_count, 3);
+  EXPECT_EQ(http->image_snapshot_count, 2);
+  EXPECT_EQ(http->image_targets_count, 1);
+}
+
+/*
+ * Between the update checks of RunForever, the heartbeat only requests the
+ * Director Targets metadata, and starts an update check once it changed.
+ */
+TEST(Aktualizr, DirectorHeartbeat) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFakeMetaCounter>(temp_dir.Path(), meta_dir.Path() / "repo");
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  conf.uptane.polling_sec = 600;
+  conf.uptane.polling_heartbeat_sec = 1;
+
+  UptaneRepo uptane_repo_{meta_dir.PathString(), "", ""};
+  uptane_repo_.generateRepo(KeyType::kED25519);
+  uptane_repo_.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  std::mutex m;
+  std::vector<result::UpdateStatus> checks;
+  std::promise<void> update_found;
+  aktualizr.SetSignalHandler([&](const std::shared_ptr<event::BaseEvent> &event) {
+    if (event->variant == "UpdateCheckComplete") {
+      const auto status = dynamic_cast<event::UpdateCheckComplete *>(event.get())->result.status;
+      std::lock_guard<std::mutex> lock(m);
+      checks.push_back(status);
+      if (status == result::UpdateStatus::kUpdatesAvailable) {
+        update_found.set_value();
+      }
+    }
+  });
+  aktualizr.Initialize();
+  auto aktualizr_cycle_thread = aktualizr.RunForever();
+
+  // A few heartbeats, which find nothing new
+  std::this_thread::sleep_for(std::chrono::milliseconds(3500));
+  uptane_repo_.addTarget("firmware.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  uptane_repo_.signTargets();
+  EXPECT_EQ(update_found.get_future().wait_for(std::chrono::seconds(10)), std::future_status::ready);
+  aktualizr.Shutdown();
+  aktualizr_cycle_thread.get();
+
+  std::lock_guard<std::mutex> lock(m);
+  ASSERT_EQ(checks.size(), 2U);
+  EXPECT_EQ(checks[0], result::UpdateStatus::kNoUpdatesAvailable);
+  EXPECT_EQ(checks[1], result::UpdateStatus::kUpdatesAvailable);
+  // Two update checks and at least three heartbeats
+  EXPECT_GE(http->director_targets_count, 5);
+  EXPECT_EQ(http->image_timestamp_count, 1);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,49 @@
+#include "primary/poll_scheduler.h"
+
+#include <algorithm>
+
+#include "libaktualizr/config.h"
+
+PollScheduler::PollScheduler(std::chrono::seconds interval, std::chrono::seconds pending_interval,
+                             std::chrono::seconds max_backoff, unsigned int jitter_percent,
+                             std::mt19937::result_type seed)
+    : interval_{interval},
+      pending_interval_{pending_interval},
+      max_backoff_{max_backoff},
+      jitter_{std::min(jitter_percent, 100U) / 100.0},
+      random_{seed} {}
+
+PollScheduler::PollScheduler(const UptaneConfig& config)
+    : PollScheduler(std::chrono::seconds(config.polling_sec), std::chrono::seconds(config.polling_pending_sec),
+                    std::chrono::seconds(config.polling_max_backoff_sec),
+                    static_cast<unsigned int>(std::min<uint64_t>(config.polling_jitter_percent, 100U))) {}
+
+std::chrono::milliseconds PollScheduler::next(Outcome outcome, std::chrono::milliseconds server_delay,
+                                              std::chrono::milliseconds expiry_delay) {
+  auto delay = interval_;
+  if (outcome == Outcome::kError) {
+    ++failures_;
+    if (max_backoff_ > interval_) {
+      for (unsigned int i = 0; i < failures_ && delay < max_backoff_; ++i) {
+        delay *= 2;
+      }
+      delay = std::min(delay, max_backoff_);
+    }
+  } else {
+    failures_ = 0;
+    if (outcome == Outcome::kPending && pending_interval_.count() > 0 && pending_interval_ < interval_) {
+      delay = pending_interval_;
+    }
+  }
+
+  if (jitter_ > 0) {
+    std::uniform_real_distribution<double> spread(1.0 - jitter_, 1.0 + jitter_);
+    delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::duration<double, std::milli>(static_cast<double>(delay.count()) * spread(random_)));
+  }
+  // Fetch fresh metadata as soon as the current one expires.
+  if (expiry_delay.count() > 0 && expiry_delay < delay) {
+    delay = expiry_delay;
+  }
+  return std::max(delay, server_delay);
+}
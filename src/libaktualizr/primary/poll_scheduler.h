@@ -0,0 +1,62 @@
+#ifndef POLL_SCHEDULER_H_
+#define POLL_SCHEDULER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+
+struct UptaneConfig;
+
+/**
+ * Computes how long to wait before the next update check of
+ * Aktualizr::RunForever().
+ *
+ * The polling interval is spread randomly, so that devices that started at
+ * the same time don't keep checking at the same time. It doubles after each
+ * failed check up to a maximum, is shorter while a campaign is pending or
+ * when the Uptane metadata expires sooner, and is never shorter than the
+ * server asked for.
+ */
+class PollScheduler {
+ public:
+  enum class Outcome {
+    kOk,
+    // The server could not be reached or returned an error
+    kError,
+    // A campaign is waiting for its update
+    kPending,
+  };
+
+  /**
+   * @param interval polling interval
+   * @param pending_interval polling interval while a campaign is pending, 0 for interval
+   * @param max_backoff longest interval after failures, 0 for no backoff
+   * @param jitter_percent how much the interval is randomly shortened or lengthened
+   */
+  PollScheduler(std::chrono::seconds interval, std::chrono::seconds pending_interval, std::chrono::seconds max_backoff,
+                unsigned int jitter_percent, std::mt19937::result_type seed = std::random_device()());
+  /** Use the polling_* options of the config. */
+  explicit PollScheduler(const UptaneConfig& config);
+
+  /**
+   * @param outcome what the last check resulted in
+   * @param server_delay time the server asked to wait before the next request
+   * @param expiry_delay time until the Uptane metadata expires, 0 if it doesn't
+   * @return the time to wait before the next check
+   */
+  std::chrono::milliseconds next(Outcome outcome,
+                                 std::chrono::milliseconds server_delay = std::chrono::milliseconds::zero(),
+                                 std::chrono::milliseconds expiry_delay = std::chrono::milliseconds::zero());
+
+  unsigned int failures() const { return failures_; }
+
+ private:
+  std::chrono::milliseconds interval_;
+  std::chrono::milliseconds pending_interval_;
+  std::chrono::milliseconds max_backoff_;
+  double jitter_;
+  unsigned int failures_{0};
+  std::mt19937 random_;
+};
+
+#endif  // POLL_SCHEDULER_H_
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <set>
+
+#include "primary/poll_scheduler.h"
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+
+/* Without jitter, the interval is constant while the checks succeed. */
+TEST(PollScheduler, Interval) {
+  PollScheduler scheduler(seconds(10), seconds(0), seconds(0), 0);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk), seconds(10));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk), seconds(10));
+  // No backoff configured
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(10));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kPending), seconds(10));
+}
+
+/* The interval doubles for each failure in a row up to the maximum, and is reset by a success. */
+TEST(PollScheduler, Backoff) {
+  PollScheduler scheduler(seconds(10), seconds(0), seconds(60), 0);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(20));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(40));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(60));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(60));
+  EXPECT_EQ(scheduler.failures(), 4U);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk), seconds(10));
+  EXPECT_EQ(scheduler.failures(), 0U);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kError), seconds(20));
+}
+
+/* A pending campaign shortens the interval, never lengthens it. */
+TEST(PollScheduler, Pending) {
+  PollScheduler scheduler(seconds(10), seconds(2), seconds(0), 0);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kPending), seconds(2));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk), seconds(10));
+
+  PollScheduler longer(seconds(10), seconds(20), seconds(0), 0);
+  EXPECT_EQ(longer.next(PollScheduler::Outcome::kPending), seconds(10));
+}
+
+/* The wait asked by the server is the minimum. */
+TEST(PollScheduler, ServerDelay) {
+  PollScheduler scheduler(seconds(10), seconds(2), seconds(0), 0);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kPending, seconds(30)), seconds(30));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk, seconds(5)), seconds(10));
+}
+
+/* The check comes early when the metadata expires before the interval is over,
+ * but not before the server asked for it. */
+TEST(PollScheduler, ExpiryDelay) {
+  PollScheduler scheduler(seconds(100), seconds(0), seconds(0), 20, 1);
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk, seconds(0), seconds(7)), seconds(7));
+  EXPECT_GE(scheduler.next(PollScheduler::Outcome::kOk, seconds(0), seconds(500)), seconds(80));
+  EXPECT_EQ(scheduler.next(PollScheduler::Outcome::kOk, seconds(30), seconds(7)), seconds(30));
+}
+
+/* The intervals are spread within the jitter, differently for each device. */
+TEST(PollScheduler, Jitter) {
+  PollScheduler scheduler(seconds(100), seconds(0), seconds(0), 20, 1);
+  std::set<milliseconds::rep> delays;
+  for (int i = 0; i < 100; ++i) {
+    const auto delay = scheduler.next(PollScheduler::Outcome::kOk);
+    EXPECT_GE(delay, seconds(80));
+    EXPECT_LE(delay, seconds(120));
+    delays.insert(delay.count());
+  }
+  EXPECT_GT(delays.size(), 50U);
+
+  PollScheduler other(seconds(100), seconds(0), seconds(0), 20, 2);
+  PollScheduler same(seconds(100), seconds(0), seconds(0), 20, 1);
+  const auto first = same.next(PollScheduler::Outcome::kOk);
+  EXPECT_NE(other.next(PollScheduler::Outcome::kOk), first);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
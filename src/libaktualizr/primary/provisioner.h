@@ -1,6 +1,7 @@
 #ifndef INITIALIZER_H_
 #define INITIALIZER_H_
 
+#include <atomic>
 #include <string>
 
 #include "libaktualizr/secondaryinterface.h"
@@ -183,7 +184,8 @@ class Provisioner {
   std::vector<SecondaryInfo> sec_info_;
   EcuSerials new_ecu_serials_;
   bool register_ecus_{false};
-  State current_state_{State::kUnknown};
+  // Read by the commands that run beside the provisioning
+  std::atomic<State> current_state_{State::kUnknown};
   std::string last_error_;
 };
 
@@ -1,6 +1,8 @@
 #include "reportqueue.h"
 
+#include <algorithm>
 #include <chrono>
+#include <map>
 
 #include "http/httpclient.h"
 #include "libaktualizr/config.h"
@@ -14,7 +16,8 @@ ReportQueue::ReportQueue(const Config& config_in, std::shared_ptr<HttpInterface>
       storage(std::move(storage_in)),
       run_pause_s_{run_pause_s},
       event_number_limit_{event_number_limit},
-      cur_event_number_limit_{event_number_limit_} {
+      max_request_size_{config.uptane.report_events_max_request_kb * 1024U},
+      cur_max_request_size_{max_request_size_} {
   if (event_number_limit == 0) {
     throw std::invalid_argument("Event number limit is set to 0 what leads to event accumulation in DB");
   }
@@ -33,14 +36,40 @@ ReportQueue::~ReportQueue() {
   flushQueue();
 }
 
+// How long to wait after an event is enqueued for the others enqueued with it
+static constexpr std::chrono::milliseconds kBatchDelay{100};
+static constexpr std::chrono::seconds kMaxRetryDelay{600};
+
 void ReportQueue::run() {
-  // Check if queue is nonempty. If so, move any reports to the Json array and
-  // try to send it to the server. Clear the Json array only if the send
-  // succeeds.
+  // Send the events stored before, then the events enqueued, shortly after
+  // they are, and sleep while there are none. After a failure, try again
+  // with an exponential backoff, or as soon as another request to the server
+  // succeeded.
   std::unique_lock<std::mutex> lock(m_);
+  const std::chrono::seconds first_retry_delay(run_pause_s_);
+  std::chrono::seconds retry_delay = first_retry_delay;
+  bool pending = true;
   while (!shutdown_) {
-    flushQueue();
-    cv_.wait_for(lock, std::chrono::seconds(run_pause_s_));
+    if (!pending) {
+      cv_.wait(lock, [this]() { return shutdown_ || enqueued_; });
+      cv_.wait_for(lock, kBatchDelay, [this]() { return shutdown_; });
+      if (shutdown_) {
+        break;
+      }
+    }
+    enqueued_ = false;
+    connection_warm_ = false;
+
+    const FlushResult result = flushQueue();
+    if (result == FlushResult::kFailed) {
+      LOG_DEBUG << "Sending report events again in " << retry_delay.count() << " s";
+      cv_.wait_for(lock, retry_delay, [this]() { return shutdown_ || connection_warm_; });
+      retry_delay = std::min(retry_delay * 2, std::max(kMaxRetryDelay, first_retry_delay));
+      pending = true;
+    } else {
+      retry_delay = first_retry_delay;
+      pending = result == FlushResult::kMore;
+    }
   }
 }
 
@@ -48,51 +77,170 @@ void ReportQueue::enqueue(std::unique_ptr<ReportEvent> event) {
   {
     std::lock_guard<std::mutex> lock(m_);
     storage->saveReportEvent(event->toJson());
+    enqueued_ = true;
   }
   cv_.notify_all();
 }
 
-void ReportQueue::flushQueue() {
-  int64_t max_id = 0;
-  Json::Value report_array{Json::arrayValue};
-  storage->loadReportEvents(&report_array, &max_id, cur_event_number_limit_);
+void ReportQueue::connectionWarm() {
+  {
+    std::lock_guard<std::mutex> lock(m_);
+    connection_warm_ = true;
+  }
+  cv_.notify_all();
+}
 
+// A string member of an object member of an event, empty if there is none
+static std::string eventMember(const Json::Value& json, const char* object, const char* key) {
+  const Json::Value& value = json[object];
+  if (!value.isObject() || !value[key].isString()) {
+    return "";
+  }
+  return value[key].asString();
+}
+
+ReportQueue::FlushResult ReportQueue::flushQueue() {
   if (config.tls.server.empty()) {
     // Prevent a lot of unnecessary garbage output in uptane vector tests.
-    LOG_TRACE << "No server specified. Clearing report queue.";
-    report_array.clear();
+    LOG_TRACE << "No server specified. Not sending the report queue.";
+    return FlushResult::kDone;
   }
 
-  if (!report_array.empty()) {
-    HttpResponse response = http->post(config.tls.server + "/events", report_array);
+  // The oldest events, within the limits of a request but at least one. The
+  // body is built from the events as stored, without turning them into a
+  // JSON document again.
+  int64_t max_id = 0;
+  uint64_t size = 2;
+  bool more = false;
+  std::vector<QueuedEvent> events;
+  storage->visitReportEvents([this, &max_id, &size, &more, &events](int64_t id, const std::string& event) {
+    if (!events.empty() &&
+        ((event_number_limit_ > 0 && events.size() >= static_cast<size_t>(event_number_limit_)) ||
+         (cur_max_request_size_ > 0 && size + event.size() + 1 > cur_max_request_size_))) {
+      more = true;
+      return false;
+    }
+    max_id = id;
+    const Json::Value json = Utils::parseJSON(event);
+    if (!json.isObject()) {
+      LOG_ERROR << "Dropping a report event that can't be parsed: " << event;
+      return true;
+    }
+    size += event.size() + 1;
+    std::string group = eventMember(json, "event", "ecu") + "\n" + eventMember(json, "event", "correlationId");
+    events.push_back(QueuedEvent{event, eventMember(json, "eventType", "id"), std::move(group)});
+    return true;
+  });
+  if (events.empty()) {
+    if (max_id > 0) {
+      storage->deleteReportEvents(max_id);
+    }
+    return FlushResult::kDone;
+  }
 
-    bool delete_events{response.isOk()};
-    // 404 implies the server does not support this feature. Nothing we can
-    // do, just move along.
-    if (response.http_status_code == 404) {
-      LOG_DEBUG << "Server does not support event reports. Clearing report queue.";
+  const size_t stored_events = events.size();
+  coalesceEvents(&events);
+  if (events.size() < stored_events) {
+    LOG_DEBUG << "Coalesced " << stored_events << " report events into " << events.size();
+  }
+  std::string body{"["};
+  body.reserve(size);
+  for (const auto& event : events) {
+    if (body.size() > 1) {
+      body += ',';
+    }
+    body += event.json;
+  }
+  body += ']';
+
+  HttpResponse response = http->post(config.tls.server + "/events", "application/json", body);
+
+  bool delete_events{response.isOk()};
+  FlushResult result = response.isOk() ? FlushResult::kDone : FlushResult::kFailed;
+  // 404 implies the server does not support this feature. Nothing we can
+  // do, just move along.
+  if (response.http_status_code == 404) {
+    LOG_DEBUG << "Server does not support event reports. Clearing report queue.";
+    delete_events = true;
+    result = FlushResult::kDone;
+  } else if (response.http_status_code == 413) {
+    if (events.size() > 1) {
+      // if 413 is received to posting of more than one event then try sending a smaller request next time
+      cur_max_request_size_ = body.size() / 2U;
+      LOG_DEBUG << "Got 413 response to request of " << body.size() << " bytes that contains " << events.size()
+                << " events. Will try to send " << cur_max_request_size_ << " bytes.";
+      result = FlushResult::kMore;
+    } else {
+      // An event is too big to be accepted by the server, let's drop it
+      LOG_WARNING << "Dropping a report event " << Utils::parseJSON(events[0].json).get("id", "unknown")
+                  << " since the server `" << config.tls.server << "` cannot digest it (413).";
       delete_events = true;
-    } else if (response.http_status_code == 413) {
-      if (report_array.size() > 1) {
-        // if 413 is received to posting of more than one event then try sending less events next time
-        cur_event_number_limit_ = report_array.size() > 2 ? static_cast<int>(report_array.size() / 2U) : 1;
-        LOG_DEBUG << "Got 413 response to request that contains " << report_array.size() << " events. Will try to send "
-                  << cur_event_number_limit_ << " events.";
-      } else {
-        // An event is too big to be accepted by the server, let's drop it
-        LOG_WARNING << "Dropping a report event " << report_array[0].get("id", "unknown") << " since the server `"
-                    << config.tls.server << "` cannot digest it (413).";
-        delete_events = true;
+      result = FlushResult::kDone;
+    }
+  } else if (!response.isOk()) {
+    LOG_WARNING << "Failed to post update events: " << response.getStatusStr();
+  }
+  if (delete_events) {
+    storage->deleteReportEvents(max_id);
+    cur_max_request_size_ = max_request_size_;
+    if (more) {
+      result = FlushResult::kMore;
+    }
+  }
+  return result;
+}
+
+// Within a batch, of the events about the same ECU and update:
+//  - a download started again before the last one completed is the same download
+//  - a pause when paused, or a resume when running, changes nothing
+//  - a resume followed right away by a pause cancel out
+// The first of the events that say the same is kept, with its time.
+void ReportQueue::coalesceEvents(std::vector<QueuedEvent>* events) {
+  // Indices of the events kept so far, by group
+  std::map<std::string, std::vector<size_t>> groups;
+  std::vector<bool> dropped(events->size(), false);
+  // The last event kept in a group among types, or none
+  auto last_of = [events](const std::vector<size_t>& group, const char* first, const char* second) -> const char* {
+    for (auto it = group.rbegin(); it != group.rend(); ++it) {
+      const std::string& type = (*events)[*it].type;
+      if (type == first || type == second) {
+        return type == first ? first : second;
       }
-    } else if (!response.isOk()) {
-      LOG_WARNING << "Failed to post update events: " << response.getStatusStr();
     }
-    if (delete_events) {
-      report_array.clear();
-      storage->deleteReportEvents(max_id);
-      cur_event_number_limit_ = event_number_limit_;
+    return nullptr;
+  };
+
+  for (size_t k = 0; k < events->size(); ++k) {
+    const QueuedEvent& event = (*events)[k];
+    std::vector<size_t>& group = groups[event.group];
+    if (event.type == "EcuDownloadStarted") {
+      const char* last = last_of(group, "EcuDownloadStarted", "EcuDownloadCompleted");
+      dropped[k] = last != nullptr && event.type == last;
+    } else if (event.type == "DevicePaused" || event.type == "DeviceResumed") {
+      const char* last = last_of(group, "DevicePaused", "DeviceResumed");
+      if (last != nullptr && event.type == last) {
+        dropped[k] = true;
+      } else if (event.type == "DevicePaused" && !group.empty() && (*events)[group.back()].type == "DeviceResumed") {
+        dropped[group.back()] = true;
+        group.pop_back();
+        dropped[k] = true;
+      }
+    }
+    if (!dropped[k]) {
+      group.push_back(k);
+    }
+  }
+
+  size_t kept = 0;
+  for (size_t k = 0; k < events->size(); ++k) {
+    if (!dropped[k]) {
+      if (kept != k) {
+        (*events)[kept] = std::move((*events)[k]);
+      }
+      ++kept;
     }
   }
+  events->resize(kept);
 }
 
 void ReportEvent::setEcu(const Uptane::EcuSerial& ecu) { custom["ecu"] = ecu.ToString(); }
@@ -2,12 +2,15 @@
 #define REPORTQUEUE_H_
 
 #include <json/json.h>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <utility>  // for move
+#include <vector>
 
 #include "libaktualizr/types.h"  // for EcuSerial (ptr only), TimeStamp
 #include "utilities/utils.h"     // for Utils
@@ -95,9 +98,32 @@ class ReportQueue {
   ReportQueue& operator=(ReportQueue&&) = delete;
   void run();
   void enqueue(std::unique_ptr<ReportEvent> event);
+  /**
+   * A request to the server just succeeded: send the stored events now if
+   * they are waiting to be sent again after a failure, while the connection
+   * is up.
+   */
+  void connectionWarm();
 
  private:
-  void flushQueue();
+  enum class FlushResult {
+    // All the stored events were sent, or there were none
+    kDone,
+    // Sent, but more events are stored, or to be sent in smaller requests
+    kMore,
+    kFailed,
+  };
+  // A stored event on its way to the server
+  struct QueuedEvent {
+    std::string json;
+    std::string type;
+    // Events about the same ECU and update, by ECU serial and correlation ID
+    std::string group;
+  };
+
+  FlushResult flushQueue();
+  // Drop the events of a batch that add nothing to the ones before them
+  static void coalesceEvents(std::vector<QueuedEvent>* events);
 
   const Config& config;
   std::shared_ptr<HttpInterface> http;
@@ -106,10 +132,18 @@ class ReportQueue {
   std::mutex m_;
   std::queue<std::unique_ptr<ReportEvent>> report_queue_;
   bool shutdown_{false};
+  // Set by enqueue() and connectionWarm(), cleared by run()
+  bool enqueued_{false};
+  bool connection_warm_{false};
   std::shared_ptr<INvStorage> storage;
+  // First delay before sending events again after a failure, doubled on each
+  // failure up to kMaxRetryDelay
   const int run_pause_s_;
   const int event_number_limit_;
-  int cur_event_number_limit_;
+  // Largest request body, from uptane.report_events_max_request_kb, lowered
+  // to what the server accepts when it rejects a batch as too large
+  const uint64_t max_request_size_;
+  uint64_t cur_max_request_size_;
 };
 
 #endif  // REPORTQUEUE_H_
@@ -4,6 +4,7 @@
 #include <future>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include <json/json.h>
 
@@ -101,6 +102,39 @@ class HttpFakeRq : public HttpFake {
         expected_events_received.set_value(true);
       }
       return HttpResponse("", 200, CURLE_OK, "");
+    } else if (url.find("reportqueue/Coalesce") == 0) {
+      for (const auto &event : data) {
+        types_seen.push_back(event["eventType"]["id"].asString());
+      }
+      events_seen += data.size();
+      if (events_seen == expected_events_) {
+        expected_events_received.set_value(true);
+      }
+      return HttpResponse("", 200, CURLE_OK, "");
+    } else if (url.find("reportqueue/ConnectionWarm") == 0) {
+      if (!failed_) {
+        failed_ = true;
+        first_failure.set_value(true);
+        return HttpResponse("", 503, CURLE_OK, "Service Unavailable");
+      }
+      events_seen += data.size();
+      if (events_seen == expected_events_) {
+        expected_events_received.set_value(true);
+      }
+      return HttpResponse("", 200, CURLE_OK, "");
+    } else if (url.find("reportqueue/RequestSize") == 0) {
+      const size_t size = Utils::jsonToCanonicalStr(data).size();
+      EXPECT_LE(size, 2048);
+      if (size > 1024) {
+        return HttpResponse("", 413, CURLE_OK, "Payload Too Large");
+      }
+      for (const auto &event : data) {
+        EXPECT_EQ(event["event"]["ecu"], "RequestSize" + std::to_string(events_seen++));
+      }
+      if (events_seen == expected_events_) {
+        expected_events_received.set_value(true);
+      }
+      return HttpResponse("", 200, CURLE_OK, "");
     }
     LOG_ERROR << "Unexpected event: " << data;
     return HttpResponse("", 400, CURLE_OK, "");
@@ -112,6 +146,9 @@ class HttpFakeRq : public HttpFake {
   int event_numb_limit_;
   size_t last_request_expected_events_;
   int bad_gateway_counter_{0};
+  std::vector<std::string> types_seen;
+  std::promise<bool> first_failure{};
+  bool failed_{false};
 };
 
 /* Test one event. */
@@ -277,6 +314,86 @@ TEST(ReportQueue, PayloadTooLarge) {
   }
 }
 
+/* Events that repeat the ones before them about the same ECU and update are
+ * not sent. */
+TEST(ReportQueue, Coalesce) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "";
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+  const Uptane::EcuSerial primary("primary");
+  const Uptane::EcuSerial secondary("secondary");
+
+  {
+    auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), 0);
+    ReportQueue report_queue(config, http, sql_storage);
+    report_queue.enqueue(std_::make_unique<EcuDownloadStartedReport>(primary, "update"));
+    report_queue.enqueue(std_::make_unique<EcuDownloadStartedReport>(secondary, "update"));
+    report_queue.enqueue(std_::make_unique<DevicePausedReport>("update"));
+    report_queue.enqueue(std_::make_unique<DeviceResumedReport>("update"));
+    report_queue.enqueue(std_::make_unique<DevicePausedReport>("update"));
+    report_queue.enqueue(std_::make_unique<DevicePausedReport>("update"));
+    report_queue.enqueue(std_::make_unique<DeviceResumedReport>("update"));
+    report_queue.enqueue(std_::make_unique<EcuDownloadStartedReport>(primary, "update"));
+    report_queue.enqueue(std_::make_unique<EcuDownloadCompletedReport>(primary, "update", false));
+    report_queue.enqueue(std_::make_unique<EcuDownloadStartedReport>(primary, "update"));
+    report_queue.enqueue(std_::make_unique<EcuDownloadStartedReport>(primary, "other update"));
+  }
+
+  config.tls.server = "reportqueue/Coalesce";
+  const std::vector<std::string> expected{"EcuDownloadStarted", "EcuDownloadStarted",   "DevicePaused",
+                                          "DeviceResumed",      "EcuDownloadCompleted", "EcuDownloadStarted",
+                                          "EcuDownloadStarted"};
+  auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), expected.size());
+  ReportQueue report_queue(config, http, sql_storage);
+  http->expected_events_received.get_future().wait_for(std::chrono::seconds(20));
+  EXPECT_EQ(http->types_seen, expected);
+}
+
+/* Events are sent in requests within the size limit, smaller ones after the
+ * server rejected one as too large. */
+TEST(ReportQueue, RequestSize) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "";
+  config.uptane.report_events_max_request_kb = 2;
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+
+  const size_t num_events = 100;
+  for (size_t i = 0; i < num_events; ++i) {
+    sql_storage->saveReportEvent(
+        EcuDownloadCompletedReport(Uptane::EcuSerial("RequestSize" + std::to_string(i)), "", true).toJson());
+  }
+
+  config.tls.server = "reportqueue/RequestSize";
+  auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), num_events);
+  ReportQueue report_queue(config, http, sql_storage, 0);
+  http->expected_events_received.get_future().wait_for(std::chrono::seconds(20));
+  EXPECT_EQ(http->events_seen, num_events);
+}
+
+/* Events are sent shortly after they are enqueued, and again right away
+ * after a failure when another request to the server succeeded. */
+TEST(ReportQueue, ConnectionWarm) {
+  TemporaryDirectory temp_dir;
+  Config config;
+  config.storage.path = temp_dir.Path();
+  config.tls.server = "reportqueue/ConnectionWarm";
+  auto sql_storage = std::make_shared<SQLStorage>(config.storage, false);
+  auto http = std::make_shared<HttpFakeRq>(temp_dir.Path(), 1);
+  // Far longer than the test waits
+  ReportQueue report_queue(config, http, sql_storage, 600);
+
+  report_queue.enqueue(std_::make_unique<EcuDownloadCompletedReport>(Uptane::EcuSerial("ConnectionWarm"), "", true));
+  ASSERT_EQ(http->first_failure.get_future().wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  report_queue.connectionWarm();
+  EXPECT_EQ(http->expected_events_received.get_future().wait_for(std::chrono::seconds(5)),
+            std::future_status::ready);
+  EXPECT_EQ(http->events_seen, 1);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
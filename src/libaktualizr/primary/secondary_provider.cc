@@ -5,15 +5,35 @@
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/tuf.h"
+#include "utilities/io_uring.h"
 #include "utilities/utils.h"
 
-bool SecondaryProvider::getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const {
-  if (!getDirectorMetadata(meta_bundle)) {
-    return false;
+std::shared_ptr<const Uptane::MetaBundle> SecondaryProvider::getMetaBundle() const {
+  std::lock_guard<std::mutex> guard(bundle_mutex_);
+  // Taken before loading, so that a write in the meantime loads it again next time
+  const MetaRevision revision = storage_->metaRevision();
+  if (bundle_ && MetaRevision{bundle_storage_, bundle_generation_} == revision) {
+    return bundle_;
   }
-  if (!getImageRepoMetadata(meta_bundle, target)) {
+  bundle_.reset();
+  auto bundle = std::make_shared<Uptane::MetaBundle>();
+  if (!getDirectorMetadata(bundle.get()) || !getImageRepoMetadata(bundle.get(), Uptane::Target::Unknown())) {
+    return nullptr;
+  }
+  bundle_ = std::move(bundle);
+  bundle_storage_ = revision.storage;
+  bundle_generation_ = revision.generation;
+  return bundle_;
+}
+
+bool SecondaryProvider::getMetadata(Uptane::MetaBundle* meta_bundle, const Uptane::Target& target) const {
+  // TODO: Support delegations for Secondaries, which is the purpose of target.
+  (void)target;
+  const auto bundle = getMetaBundle();
+  if (!bundle) {
     return false;
   }
+  meta_bundle->insert(bundle->cbegin(), bundle->cend());
   return true;
 }
 
@@ -87,6 +107,10 @@ std::string SecondaryProvider::getTreehubCredentials() const {
   const std::string treehub_url = config_.pacman.ostree_server;
   std::map<std::string, std::string> archive_map = {
       {"ca.pem", ca}, {"client.pem", cert}, {"pkey.pem", pkey}, {"server.url", treehub_url}};
+  if (!config_.pacman.ostree_mirror_url.empty()) {
+    // Tried first by the Secondaries that know it, the server being the fallback
+    archive_map["mirror.url"] = config_.pacman.ostree_mirror_url;
+  }
 
   try {
     std::stringstream as;
@@ -102,3 +126,20 @@ std::string SecondaryProvider::getTreehubCredentials() const {
 std::ifstream SecondaryProvider::getTargetFileHandle(const Uptane::Target& target) const {
   return package_manager_->openTargetFile(target);
 }
+
+std::string SecondaryProvider::getTargetFilePath(const Uptane::Target& target) const {
+  auto file = package_manager_->checkTargetFile(target);
+  return file ? file->second : std::string();
+}
+
+std::unique_ptr<UringFileReader> SecondaryProvider::getTargetFileReader(const Uptane::Target& target,
+                                                                        uint64_t offset) const {
+  if (config_.pacman.io_uring_queue_depth == 0) {
+    return nullptr;
+  }
+  const std::string path = getTargetFilePath(target);
+  if (path.empty()) {
+    return nullptr;
+  }
+  return UringFileReader::open(path, offset, static_cast<unsigned>(config_.pacman.io_uring_queue_depth));
+}
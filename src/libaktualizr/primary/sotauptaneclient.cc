@@ -1,27 +1,42 @@
 #include "primary/sotauptaneclient.h"
 
-#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
 #include <fstream>
+#include <future>
+#include <iterator>
 #include <memory>
 #include <utility>
 
+#include <boost/algorithm/string.hpp>
+
 #include "crypto/crypto.h"
 #include "crypto/keymanager.h"
 #include "libaktualizr/campaign.h"
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
+#include "primary/firmware_fan_out.h"
+#include "primary/install_order.h"
+#include "primary/transfer_scheduler.h"
 #include "provisioner.h"
 #include "uptane/exceptions.h"
+#include "uptane/image_prefetcher.h"
+#include "uptane/signature_cache.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/load_admission.h"
+#include "utilities/executor.h"
+#include "utilities/json_patch.h"
+#include "utilities/memory_usage.h"
+#include "utilities/metadata_arena.h"
 #include "utilities/utils.h"
 
-static void report_progress_cb(event::Channel *channel, const Uptane::Target &target, const std::string &description,
-                               unsigned int progress) {
-  if (channel == nullptr) {
-    return;
-  }
-  auto event = std::make_shared<event::DownloadProgressReport>(target, description, progress);
-  (*channel)(event);
-}
+// How long sendDeviceData() waits for the hardware information
+static constexpr std::chrono::seconds kHardwareInfoWait{2};
+static constexpr std::chrono::seconds kLogProgressInterval{15};
 
 /**
  * A utility class to compare targets between Image and Director repositories.
@@ -48,9 +63,63 @@ SotaUptaneClient::SotaUptaneClient(Config &config_in, std::shared_ptr<INvStorage
       uptane_fetcher(new Uptane::Fetcher(config, http)),
       events_channel(std::move(events_channel_in)),
       provisioner_(config.provision, storage, http, key_manager_, secondaries),
-      flow_control_(flow_control) {
+      flow_control_(flow_control),
+      tracer_(config.uptane.trace_file),
+      campaigns_(std::chrono::seconds(config.uptane.campaign_cache_ttl_sec)) {
+  // Generating RSA keys can take seconds, overlap it with the secondaries
+  // being set up before initialize().
+  key_manager_->startUptaneKeyGeneration();
+  BackgroundScheduling::configure({config.uptane.background_nice,
+                                   BackgroundScheduling::parseIoClass(config.uptane.background_io_class),
+                                   config.uptane.background_cgroup});
+  LoadAdmission::configure({config.uptane.admission_slow_pressure, config.uptane.admission_pause_pressure,
+                            std::chrono::seconds(config.uptane.admission_max_pause_sec)});
   report_queue = std_::make_unique<ReportQueue>(config, http, storage);
   secondary_provider_ = SecondaryProviderBuilder::Build(config, storage, package_manager_);
+  Uptane::SignatureCache::instance().setCapacity(static_cast<size_t>(config.uptane.signature_cache_size));
+  Uptane::SignatureCache::instance().setStorage(config.uptane.persist_signature_cache ? storage : nullptr);
+  const std::chrono::seconds root_probe_interval(config.uptane.root_probe_interval_sec);
+  director_repo.setRootProbeInterval(root_probe_interval);
+  image_repo.setRootProbeInterval(root_probe_interval);
+  image_repo.setShareMeta(config.uptane.share_image_metadata);
+  if (events_channel && config.uptane.event_queue_size > 0) {
+    event_dispatcher_ =
+        std_::make_unique<EventDispatcher>(events_channel, static_cast<size_t>(config.uptane.event_queue_size));
+  }
+  if (config.uptane.transfer_progress_interval_ms > 0) {
+    const std::chrono::milliseconds interval(config.uptane.transfer_progress_interval_ms);
+    download_progress_ = std::make_shared<ProgressAggregator>(interval, transferProgressReporter("Downloading"));
+    package_manager_->setProgressAggregator(download_progress_);
+    install_progress_ = std_::make_unique<ProgressAggregator>(interval, transferProgressReporter("Installing"));
+  }
+}
+
+SotaUptaneClient::~SotaUptaneClient() {
+  stopPrefetch(false);
+  // The requests refer to the Secondaries
+  for (auto &request : manifest_requests_) {
+    request.second.wait();
+  }
+}
+
+ProgressAggregator::Callback SotaUptaneClient::transferProgressReporter(const std::string &description) {
+  auto last_log = std::make_shared<std::chrono::steady_clock::time_point>();
+  return [this, description, last_log](const ProgressAggregator::Progress &progress) {
+    sendEvent<event::TransferProgressReport>(description, progress.transferred_bytes, progress.total_bytes,
+                                             progress.active_transfers, progress.bytes_per_second,
+                                             progress.eta_seconds);
+    const auto now = std::chrono::steady_clock::now();
+    if (progress.active_transfers == 0 || now - *last_log < kLogProgressInterval) {
+      return;
+    }
+    *last_log = now;
+    LOG_INFO << description << ": " << progress.transferred_bytes << " of " << progress.total_bytes << " bytes of "
+             << progress.active_transfers << " images, at " << static_cast<uint64_t>(progress.bytes_per_second)
+             << " bytes/s"
+             << (progress.eta_seconds >= 0
+                     ? ", " + std::to_string(static_cast<uint64_t>(progress.eta_seconds)) + " s left"
+                     : std::string());
+  };
 }
 
 void SotaUptaneClient::addSecondary(const std::shared_ptr<SecondaryInterface> &sec) {
@@ -63,6 +132,9 @@ void SotaUptaneClient::addSecondary(const std::shared_ptr<SecondaryInterface> &s
 
   secondaries.emplace(serial, sec);
   sec->init(secondary_provider_);
+  sec->setProgressCallback([this](const Uptane::Target &t, const std::string &description, unsigned int progress) {
+    sendEvent<event::DownloadProgressReport>(t, description, progress);
+  });
   provisioner_.SecondariesWereChanged();
 }
 
@@ -144,26 +216,30 @@ void SotaUptaneClient::finalizeAfterReboot() {
     return;
   }
 
-  storage->saveEcuInstallationResult(primary_ecu_serial, install_res);
-
-  if (install_res.success) {
-    storage->saveInstalledVersion(primary_ecu_serial.ToString(), *pending_target, InstalledVersionUpdateMode::kCurrent,
-                                  correlation_id);
+  {
+    // The report queue uses the storage from its own thread, so reports are
+    // only queued once the batch has been committed.
+    const auto batch = storage->startBatch();
+    storage->saveEcuInstallationResult(primary_ecu_serial, install_res);
 
-    report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(primary_ecu_serial, correlation_id, true));
-  } else {
-    // finalize failed, unset pending flag so that the rest of the Uptane process can go forward again
-    storage->saveInstalledVersion(primary_ecu_serial.ToString(), *pending_target, InstalledVersionUpdateMode::kNone,
-                                  correlation_id);
-    report_queue->enqueue(std_::make_unique<EcuInstallationCompletedReport>(primary_ecu_serial, correlation_id, false));
-  }
+    if (install_res.success) {
+      storage->saveInstalledVersion(primary_ecu_serial.ToString(), *pending_target,
+                                    InstalledVersionUpdateMode::kCurrent, correlation_id);
+    } else {
+      // finalize failed, unset pending flag so that the rest of the Uptane process can go forward again
+      storage->saveInstalledVersion(primary_ecu_serial.ToString(), *pending_target, InstalledVersionUpdateMode::kNone,
+                                    correlation_id);
+    }
 
-  director_repo.dropTargets(*storage);  // fix for OTA-2587, listen to backend again after end of install
+    director_repo.dropTargets(*storage);  // fix for OTA-2587, listen to backend again after end of install
 
-  data::InstallationResult ir;
-  std::string raw_report;
-  computeDeviceInstallationResult(&ir, &raw_report);
-  storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
+    data::InstallationResult ir;
+    std::string raw_report;
+    computeDeviceInstallationResult(&ir, &raw_report);
+    storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
+  }
+  report_queue->enqueue(
+      std_::make_unique<EcuInstallationCompletedReport>(primary_ecu_serial, correlation_id, install_res.success));
   putManifestSimple();
 }
 
@@ -198,22 +274,34 @@ data::InstallationResult SotaUptaneClient::PackageInstallSetResult(const Uptane:
 
 /* Hardware info is treated differently than the other device data. The default
  * info (supplied via lshw) is only sent once and never again, even if it
- * changes. (Unfortunately, it can change often due to CPU frequency scaling.)
+ * changes, unless telemetry.report_hardware_interval_sec is set.
+ * (Unfortunately, it can change often due to CPU frequency scaling.)
  * However, users can provide custom info via the API, and that will be sent if
- * it has changed. */
-void SotaUptaneClient::reportHwInfo() {
+ * it has changed.
+ * lshw can take seconds, so it runs in the background from initialize() on;
+ * if it isn't done after waiting, the info is sent by a later update check. */
+void SotaUptaneClient::reportHwInfo(std::chrono::milliseconds wait, bool again) {
   Json::Value hw_info;
   std::string stored_hash;
   storage->loadDeviceDataHash("hardware_info", &stored_hash);
 
   if (custom_hardware_info_.empty()) {
-    if (!stored_hash.empty()) {
+#ifdef BUILD_MINIMAL
+    LOG_TRACE << "Not reporting default hardware information, left out of this build";
+    return;
+#endif
+    if (!stored_hash.empty() && !again) {
       LOG_TRACE << "Not reporting default hardware information because it has already been reported";
       return;
     }
-    hw_info = Utils::getHardwareInfo();
+    if (again) {
+      hardware_info_.invalidate();
+    }
+    hw_info = hardware_info_.get(wait);
     if (hw_info.empty()) {
-      LOG_WARNING << "Unable to fetch hardware information from host system.";
+      if (wait.count() > 0) {
+        LOG_WARNING << "Unable to fetch hardware information from host system.";
+      }
       return;
     }
   } else {
@@ -238,21 +326,59 @@ void SotaUptaneClient::reportHwInfo() {
 
 void SotaUptaneClient::reportInstalledPackages() {
   const Json::Value packages = package_manager_->getInstalledPackages();
-  const Hash new_hash = Hash::generate(Hash::Type::kSha256, Utils::jsonToCanonicalStr(packages));
+  const std::string packages_str = Utils::jsonToCanonicalStr(packages);
+  const Hash new_hash = Hash::generate(Hash::Type::kSha256, packages_str);
   std::string stored_hash;
-  if (!(storage->loadDeviceDataHash("installed_packages", &stored_hash) &&
-        new_hash == Hash(Hash::Type::kSha256, stored_hash))) {
-    LOG_DEBUG << "Reporting installed packages";
-    const HttpResponse response = http->put(config.tls.server + "/core/installed", packages);
-    if (response.isOk()) {
-      storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
-    }
-  } else {
+  if (storage->loadDeviceDataHash("installed_packages", &stored_hash) &&
+      new_hash == Hash(Hash::Type::kSha256, stored_hash)) {
     LOG_TRACE << "Not reporting installed packages because they have not changed";
+    return;
+  }
+
+  const std::string url = config.tls.server + "/core/installed";
+  const bool delta = config.telemetry.report_packages_delta && packages_delta_supported_;
+  std::string last_reported;
+  int64_t deltas = 0;
+  if (delta && storage->loadDeviceDataDocument("installed_packages", &last_reported, &deltas) &&
+      static_cast<uint64_t>(deltas) < config.telemetry.packages_full_report_interval) {
+    const Json::Value last_packages = Utils::parseJSON(last_reported);
+    if (last_packages.isArray()) {
+      const std::string patch = Utils::jsonToCanonicalStr(jsonArrayPatch(last_packages, packages));
+      LOG_DEBUG << "Reporting the changes of the installed packages";
+      const HttpResponse response = http->patch(url, "application/json-patch+json", patch);
+      if (response.isOk()) {
+        storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
+        storage->storeDeviceDataDocument("installed_packages", packages_str, deltas + 1);
+        return;
+      }
+      if (response.curl_code == CURLE_NOT_BUILT_IN ||
+          (response.curl_code == CURLE_OK && (response.http_status_code == 404 || response.http_status_code == 405 ||
+                                              response.http_status_code == 415 || response.http_status_code == 501))) {
+        LOG_INFO << "The server doesn't accept the changes of the installed packages, reporting them in full";
+        packages_delta_supported_ = false;
+      } else if (response.curl_code != CURLE_OK || response.http_status_code >= 500) {
+        // Try again next time
+        LOG_DEBUG << "Failed to report the changes of the installed packages: " << response.getStatusStr();
+        return;
+      }
+      // Otherwise, e.g. when the server lost its copy, the full list is reported.
+    }
+  }
+
+  LOG_DEBUG << "Reporting installed packages";
+  const HttpResponse response = http->put(url, "application/json", packages_str);
+  if (response.isOk()) {
+    storage->storeDeviceDataHash("installed_packages", new_hash.HashString());
+    if (delta) {
+      storage->storeDeviceDataDocument("installed_packages", packages_str, 0);
+    }
   }
 }
 
 void SotaUptaneClient::reportNetworkInfo() {
+#ifdef BUILD_MINIMAL
+  LOG_TRACE << "Not reporting network information, left out of this build";
+#else
   if (!config.telemetry.report_network) {
     LOG_TRACE << "Not reporting network information because telemetry is disabled";
     return;
@@ -277,9 +403,13 @@ void SotaUptaneClient::reportNetworkInfo() {
   } else {
     LOG_TRACE << "Not reporting network information because it has not changed";
   }
+#endif
 }
 
 void SotaUptaneClient::reportAktualizrConfiguration() {
+#ifdef BUILD_MINIMAL
+  LOG_TRACE << "Not reporting libaktualizr configuration, left out of this build";
+#else
   if (!config.telemetry.report_config) {
     LOG_TRACE << "Not reporting libaktualizr configuration because telemetry is disabled";
     return;
@@ -300,6 +430,28 @@ void SotaUptaneClient::reportAktualizrConfiguration() {
   } else {
     LOG_TRACE << "Not reporting libaktualizr configuration because it has not changed";
   }
+#endif
+}
+
+void SotaUptaneClient::requestSecondaryManifests() {
+  for (const auto &sec : secondaries) {
+    // A request that didn't complete in time on a previous call is still used.
+    if (manifest_requests_.count(sec.first) != 0) {
+      continue;
+    }
+    auto secondary = sec.second;
+    auto request = [secondary]() {
+      try {
+        return secondary->getManifest();
+      } catch (const std::exception &ex) {
+        // Not critical; it might just be temporarily offline.
+        LOG_DEBUG << "Failed to get manifest from Secondary with serial " << secondary->getSerial() << ": "
+                  << ex.what();
+      }
+      return Uptane::Manifest();
+    };
+    manifest_requests_.emplace(sec.first, Executor::io().submit(request));
+  }
 }
 
 Json::Value SotaUptaneClient::AssembleManifest() {
@@ -322,14 +474,22 @@ Json::Value SotaUptaneClient::AssembleManifest() {
   }
   version_manifest[primary_ecu_serial.ToString()] = uptane_manifest->sign(primary_manifest, report_counter);
 
+  // The Secondaries are all asked at once. The cached manifest of those that
+  // don't answer in time is sent and listed as stale.
+  requestSecondaryManifests();
+  const auto timeout = std::chrono::seconds(config.uptane.secondary_manifest_timeout_sec);
+  const auto deadline = std::chrono::steady_clock::now() + timeout;
+  Json::Value stale_ecus = Json::arrayValue;
   for (auto it = secondaries.begin(); it != secondaries.end(); it++) {
     const Uptane::EcuSerial &ecu_serial = it->first;
     Uptane::Manifest secmanifest;
-    try {
-      secmanifest = it->second->getManifest();
-    } catch (const std::exception &ex) {
-      // Not critical; it might just be temporarily offline.
-      LOG_DEBUG << "Failed to get manifest from Secondary with serial " << ecu_serial << ": " << ex.what();
+    auto request = manifest_requests_.find(ecu_serial);
+    if (timeout.count() == 0 || request->second.wait_until(deadline) == std::future_status::ready) {
+      secmanifest = request->second.get();
+      manifest_requests_.erase(request);
+    } else {
+      LOG_WARNING << "Secondary " << ecu_serial << " did not send its manifest within "
+                  << config.uptane.secondary_manifest_timeout_sec << " s";
     }
 
     bool from_cache = false;
@@ -356,6 +516,8 @@ Json::Value SotaUptaneClient::AssembleManifest() {
       version_manifest[ecu_serial.ToString()] = secmanifest;
       if (!from_cache) {
         storage->storeCachedEcuManifest(ecu_serial, Utils::jsonToCanonicalStr(secmanifest));
+      } else {
+        stale_ecus.append(ecu_serial.ToString());
       }
     } else {
       // TODO(OTA-4305): send a corresponding event/report in this case
@@ -364,6 +526,9 @@ Json::Value SotaUptaneClient::AssembleManifest() {
     }
   }
   manifest["ecu_version_manifests"] = version_manifest;
+  if (!stale_ecus.empty()) {
+    manifest["stale_ecu_version_manifests"] = stale_ecus;
+  }
 
   // second part: report installation results
   Json::Value installation_report;
@@ -395,6 +560,13 @@ Json::Value SotaUptaneClient::AssembleManifest() {
       installation_report["items"].append(item);
     }
 
+    if (config.uptane.trace_in_report) {
+      Json::Value trace = tracer_.summary(correlation_id);
+      if (!trace.isNull()) {
+        installation_report["trace"] = trace;
+      }
+    }
+
     manifest["installation_report"]["content_type"] = "application/vnd.com.here.otac.installationReport.v1";
     manifest["installation_report"]["report"] = installation_report;
   } else {
@@ -407,6 +579,11 @@ Json::Value SotaUptaneClient::AssembleManifest() {
 bool SotaUptaneClient::hasPendingUpdates() const { return storage->hasPendingInstall(); }
 
 void SotaUptaneClient::initialize() {
+  const bool collect_hardware_info = !storage->loadDeviceDataHash("hardware_info", nullptr);
+  // Unless the device data are deferred, lshw gets a head start on the rest of the initialization.
+  if (collect_hardware_info && !config.uptane.defer_device_data) {
+    hardware_info_.refresh();
+  }
   provisioner_.Prepare();
 
   uptane_manifest = std::make_shared<Uptane::ManifestIssuer>(key_manager_, provisioner_.PrimaryEcuSerial());
@@ -414,6 +591,15 @@ void SotaUptaneClient::initialize() {
   finalizeAfterReboot();
 
   attemptProvision();
+
+  if (collect_hardware_info && config.uptane.defer_device_data) {
+    hardware_info_.refresh();
+  }
+
+  if (config.pacman.peer_server_port != 0 && !peer_server_) {
+    peer_server_ =
+        std_::make_unique<PeerServer>(package_manager_, static_cast<uint16_t>(config.pacman.peer_server_port));
+  }
 }
 
 void SotaUptaneClient::requiresProvision() {
@@ -428,22 +614,30 @@ void SotaUptaneClient::requiresAlreadyProvisioned() {
   }
 }
 
-void SotaUptaneClient::updateDirectorMeta() {
+void SotaUptaneClient::updateDirectorMeta(const Uptane::IMetadataFetcher &fetcher) {
   requiresProvision();
+  TraceSpan span(&tracer_, "updateDirectorMeta");
   try {
-    director_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+    director_repo.updateMeta(*storage, fetcher, flow_control_);
   } catch (const std::exception &e) {
     LOG_ERROR << "Director metadata update failed: " << e.what();
+    span.setError(e.what());
+    // The failure might be due to a rotation of the keys
+    director_repo.requireRootProbe();
     throw;
   }
 }
 
-void SotaUptaneClient::updateImageMeta() {
+void SotaUptaneClient::updateImageMeta(const Uptane::IMetadataFetcher &fetcher) {
   requiresProvision();
+  TraceSpan span(&tracer_, "updateImageMeta");
   try {
-    image_repo.updateMeta(*storage, *uptane_fetcher, flow_control_);
+    image_repo.updateMeta(*storage, fetcher, flow_control_);
   } catch (const std::exception &e) {
     LOG_ERROR << "Failed to update Image repo metadata: " << e.what();
+    span.setError(e.what());
+    // The failure might be due to a rotation of the keys
+    image_repo.requireRootProbe();
     throw;
   }
 }
@@ -540,11 +734,13 @@ void SotaUptaneClient::computeDeviceInstallationResult(data::InstallationResult
 }
 
 void SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count) {
-  const std::vector<Uptane::Target> targets = director_repo.getTargets().targets;
+  const std::vector<Uptane::Target> &targets = director_repo.getTargets().targets;
   const Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
   if (ecus_count != nullptr) {
     *ecus_count = 0;
   }
+  // Installed versions by ECU, loaded once even if the ECU is listed in several targets.
+  std::map<Uptane::EcuSerial, std::pair<bool, boost::optional<Uptane::Target>>> installed_versions;
   for (const Uptane::Target &target : targets) {
     bool is_new = false;
     for (const auto &ecu : target.ecus()) {
@@ -569,8 +765,14 @@ void SotaUptaneClient::getNewTargets(std::vector<Uptane::Target> *new_targets, u
         throw Uptane::BadHardwareId(target.filename());
       }
 
-      boost::optional<Uptane::Target> current_version;
-      if (!storage->loadInstalledVersions(ecu_serial.ToString(), &current_version, nullptr)) {
+      auto installed = installed_versions.find(ecu_serial);
+      if (installed == installed_versions.end()) {
+        boost::optional<Uptane::Target> version;
+        const bool loaded = storage->loadInstalledVersions(ecu_serial.ToString(), &version, nullptr);
+        installed = installed_versions.emplace(ecu_serial, std::make_pair(loaded, std::move(version))).first;
+      }
+      const boost::optional<Uptane::Target> &current_version = installed->second.second;
+      if (!installed->second.first) {
         LOG_WARNING << "Could not load currently installed version for ECU ID: " << ecu_serial;
         break;
       }
@@ -613,39 +815,20 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane:
                                                                    const Uptane::Target &queried_target,
                                                                    const int level, const bool terminating,
                                                                    const bool offline) {
-  TargetCompare target_comp(queried_target);
-  const auto it = std::find_if(cur_targets.targets.cbegin(), cur_targets.targets.cend(), target_comp);
-  if (it != cur_targets.targets.cend()) {
-    return std_::make_unique<Uptane::Target>(*it);
+  // Only a target with the same filename can match.
+  const Uptane::Target *found = cur_targets.findTarget(queried_target.filename());
+  if (found != nullptr && found->MatchTarget(queried_target)) {
+    return std_::make_unique<Uptane::Target>(*found);
   }
 
   if (terminating || level >= Uptane::kDelegationsMaxDepth) {
     return std::unique_ptr<Uptane::Target>(nullptr);
   }
 
-  for (const auto &delegate_name : cur_targets.delegated_role_names_) {
-    Uptane::Role delegate_role = Uptane::Role::Delegation(delegate_name);
-    auto patterns = cur_targets.paths_for_role_.find(delegate_role);
-    if (patterns == cur_targets.paths_for_role_.end()) {
-      continue;
-    }
-
-    bool match = false;
-    for (const auto &pattern : patterns->second) {
-      if (fnmatch(pattern.c_str(), queried_target.filename().c_str(), 0) == 0) {
-        match = true;
-        break;
-      }
-    }
-    if (!match) {
-      continue;
-    }
-
-    // Target name matches one of the patterns
-
-    auto delegation = Uptane::getTrustedDelegation(delegate_role, cur_targets, image_repo, *storage, *uptane_fetcher,
-                                                   offline, flow_control_);
-    if (delegation.isExpired(TimeStamp::Now())) {
+  // Only the delegations whose patterns match the target name are loaded.
+  for (const auto &delegate_role : cur_targets.delegationsFor(queried_target.filename())) {
+    const auto delegation = trustedDelegation(delegate_role, cur_targets, offline);
+    if (delegation->isExpired(TimeStamp::Now())) {
       continue;
     }
 
@@ -655,7 +838,7 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane:
     }
 
     // NOLINTNEXTLINE(misc-no-recursion)
-    auto found_target = findTargetHelper(delegation, queried_target, level + 1, is_terminating->second, offline);
+    auto found_target = findTargetHelper(*delegation, queried_target, level + 1, is_terminating->second, offline);
     if (found_target != nullptr) {
       return found_target;
     }
@@ -664,6 +847,34 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetHelper(const Uptane:
   return std::unique_ptr<Uptane::Target>(nullptr);
 }
 
+std::shared_ptr<const Uptane::Targets> SotaUptaneClient::trustedDelegation(const Uptane::Role &delegate_role,
+                                                                           const Uptane::Targets &parent_targets,
+                                                                           const bool offline) {
+  // Verified delegations are kept until the Image repo Targets metadata is
+  // verified again, so that looking up several targets does not load and
+  // verify the same delegations every time.
+  const auto toplevel_targets = image_repo.getTargets();
+  {
+    std::lock_guard<std::mutex> guard(delegations_mutex_);
+    if (delegations_parent_ != toplevel_targets) {
+      delegations_.clear();
+      delegations_parent_ = toplevel_targets;
+    }
+    const auto it = delegations_.find(delegate_role);
+    if (it != delegations_.end()) {
+      return it->second;
+    }
+  }
+
+  auto delegation = std::make_shared<const Uptane::Targets>(Uptane::getTrustedDelegation(
+      delegate_role, parent_targets, image_repo, *storage, *uptane_fetcher, offline, flow_control_));
+  std::lock_guard<std::mutex> guard(delegations_mutex_);
+  if (delegations_parent_ == toplevel_targets) {
+    delegations_.emplace(delegate_role, delegation);
+  }
+  return delegation;
+}
+
 std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetInDelegationTree(const Uptane::Target &target,
                                                                              const bool offline) {
   auto toplevel_targets = image_repo.getTargets();
@@ -676,9 +887,16 @@ std::unique_ptr<Uptane::Target> SotaUptaneClient::findTargetInDelegationTree(con
 
 result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Target> &targets) {
   requiresAlreadyProvisioned();
+  const BackgroundScheduling::Thread background;
+  const MemoryPhase memory_phase("the download", config.uptane.memory_budget_kb);
+  TraceSpan span(&tracer_, "downloadImages");
+  span.setCorrelationId(director_repo.getCorrelationId());
+  span.setAttribute("targets", std::to_string(targets.size()));
   // Uptane step 4 - download all the images and verify them against the metadata (for OSTree - pull without
   // deploying)
   std::lock_guard<std::mutex> guard(download_mutex);
+  // Continued at full speed from where the prefetch got
+  stopPrefetch(false);
   result::Download result;
   std::vector<Uptane::Target> downloaded_targets;
 
@@ -703,10 +921,59 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     return result;
   }
 
-  for (const auto &target : targets) {
-    auto res = downloadImage(target);
-    if (res.first) {
-      downloaded_targets.push_back(res.second);
+  // Account for all targets at once, rather than finding out after some of
+  // them were downloaded, or when parallel downloads each saw enough space.
+  // The unused images make room first, if they may.
+  try {
+    package_manager_->collectTargetFiles(targets);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not remove the unused image files: " << e.what();
+  }
+  // The targets streamed to the application take no disk space.
+  std::vector<Uptane::Target> stored_targets;
+  std::copy_if(targets.begin(), targets.end(), std::back_inserter(stored_targets),
+               [this](const Uptane::Target &target) { return !targetConsumer(target); });
+  if (!package_manager_->checkDiskSpaceForTargets(stored_targets)) {
+    result = result::Download(downloaded_targets, result::DownloadStatus::kError,
+                              "Insufficient disk space available to download the targets");
+    storeInstallationFailure(data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed,
+                                                      "Insufficient disk space available to download the targets"));
+    sendEvent<event::AllDownloadsComplete>(result);
+    return result;
+  }
+
+  const auto download_start = std::chrono::steady_clock::now();
+  // Each worker picks the next pending target until all of them have been
+  // attempted. Results are kept in the order of the requested targets.
+  std::vector<char> download_success(targets.size(), 0);
+  std::atomic<size_t> next_target{0};
+  auto download_worker = [this, &targets, &download_success, &next_target]() {
+    const BackgroundScheduling::Thread worker_background;
+    for (size_t i = next_target++; i < targets.size(); i = next_target++) {
+      download_success[i] = static_cast<char>(downloadImage(targets[i]).first);
+    }
+  };
+  const auto workers_count =
+      std::min(static_cast<size_t>(std::max<uint64_t>(config.uptane.max_parallel_downloads, 1U)), targets.size());
+  if (workers_count <= 1) {
+    download_worker();
+  } else {
+    LOG_DEBUG << "Downloading " << targets.size() << " targets with " << workers_count << " parallel downloads";
+    std::vector<std::future<void>> workers;
+    workers.reserve(workers_count);
+    for (size_t i = 0; i < workers_count; ++i) {
+      workers.push_back(Executor::io().submit(download_worker));
+    }
+    for (auto &worker : workers) {
+      worker.get();
+    }
+  }
+
+  uint64_t downloaded_bytes = 0;
+  for (size_t i = 0; i < targets.size(); ++i) {
+    if (download_success[i] != 0) {
+      downloaded_targets.push_back(targets[i]);
+      downloaded_bytes += targets[i].length();
     }
   }
 
@@ -723,6 +990,11 @@ result::Download SotaUptaneClient::downloadImages(const std::vector<Uptane::Targ
     storeInstallationFailure(
         data::InstallationResult(data::ResultCode::Numeric::kDownloadFailed, "Target download failed."));
   }
+  result.downloaded_bytes = downloaded_bytes;
+  result.duration =
+      std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - download_start);
+  LOG_INFO << "Downloaded " << result.downloaded_bytes << " bytes in " << result.duration.count() << " ms ("
+           << static_cast<uint64_t>(result.throughput()) << " bytes/s)";
 
   sendEvent<event::AllDownloadsComplete>(result);
   return result;
@@ -738,6 +1010,64 @@ void SotaUptaneClient::reportResume() {
   report_queue->enqueue(std_::make_unique<DeviceResumedReport>(correlation_id));
 }
 
+DownloadTee SotaUptaneClient::streamToSecondaries(const Uptane::Target &target) {
+  auto streams = std::make_shared<std::vector<std::pair<Uptane::EcuSerial, SecondaryInterface::FirmwareStream>>>();
+  for (const auto &ecu : target.ecus()) {
+    const auto sec = secondaries.find(ecu.first);
+    if (sec == secondaries.end()) {
+      continue;
+    }
+    try {
+      auto stream = sec->second->streamFirmware(target);
+      if (stream) {
+        streams->emplace_back(ecu.first, std::move(stream));
+      }
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Unable to stream " << target.filename() << " to Secondary " << ecu.first << ": " << e.what();
+    }
+  }
+  if (streams->empty()) {
+    return DownloadTee();
+  }
+
+  // A Secondary that stops accepting the stream is sent the rest of its image
+  // during the installation.
+  return [streams](const char *data, size_t size) {
+    for (auto &stream : *streams) {
+      if (!stream.second) {
+        continue;
+      }
+      try {
+        if (stream.second(reinterpret_cast<const uint8_t *>(data), size)) {
+          continue;
+        }
+      } catch (const std::exception &e) {
+        LOG_WARNING << "Streaming to Secondary " << stream.first << " failed: " << e.what();
+      }
+      stream.second = nullptr;
+    }
+  };
+}
+
+void SotaUptaneClient::setTargetConsumer(const std::string &type, TargetConsumer consumer) {
+  std::lock_guard<std::mutex> guard(target_consumers_mutex_);
+  if (consumer) {
+    target_consumers_[type] = std::move(consumer);
+  } else {
+    target_consumers_.erase(type);
+  }
+}
+
+TargetConsumer SotaUptaneClient::targetConsumer(const Uptane::Target &target) {
+  // The Secondaries and the package manager need the stored file.
+  if (target.IsOstree() || target.ecus().size() != 1 || !target.IsForEcu(primaryEcuSerial())) {
+    return TargetConsumer();
+  }
+  std::lock_guard<std::mutex> guard(target_consumers_mutex_);
+  const auto consumer = target_consumers_.find(target.type());
+  return consumer == target_consumers_.end() ? TargetConsumer() : consumer->second;
+}
+
 std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Target &target) {
   auto correlation_id = director_repo.getCorrelationId();
   // send an event for all ECUs that are touched by this target
@@ -754,27 +1084,60 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
     KeyManager keys(storage, config.keymanagerConfig());
     keys.loadKeys();
     auto prog_cb = [this](const Uptane::Target &t, const std::string &description, unsigned int progress) {
-      report_progress_cb(events_channel.get(), t, description, progress);
+      sendEvent<event::DownloadProgressReport>(t, description, progress);
     };
 
     const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
 
-    if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
+    const TargetConsumer consumer = targetConsumer(target);
+    const TargetStream stream = consumer ? consumer(target) : TargetStream();
+    if (stream.data) {
+      // Not retried, as the consumer has taken the data already.
+      success = package_manager_->streamTarget(target, *uptane_fetcher, stream, prog_cb, flow_control_);
+      if (!success) {
+        throw Uptane::TargetHashMismatch(target.filename());
+      }
+    } else if (target.IsForEcu(primary_ecu_serial) || !target.IsOstree()) {
       const int max_tries = 3;
       int tries = 0;
       std::chrono::milliseconds wait(500);
 
-      for (; tries < max_tries; tries++) {
-        success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, prog_cb, flow_control_);
-        // Skip trying to fetch the 'target' if control flow token transaction
-        // was set to the 'abort' or 'pause' state, see the CommandQueue and FlowControlToken.
-        if (success || (flow_control_ != nullptr && flow_control_->hasAborted())) {
-          break;
-        } else if (tries < max_tries - 1) {
-          std::this_thread::sleep_for(wait);
-          wait *= 2;
+      DownloadTee tee;
+      if (config.uptane.secondary_cut_through) {
+        tee = streamToSecondaries(target);
+      }
+      if (tee) {
+        package_manager_->setDownloadTee(target, tee);
+      }
+      const char *bundle_data = nullptr;
+      uint64_t bundle_size = 0;
+      if (offline_bundle_ != nullptr && offline_bundle_->target(target.filename(), &bundle_data, &bundle_size)) {
+        // Nothing to retry, the data is at hand
+        success = package_manager_->importTarget(target, bundle_data, bundle_size, prog_cb, flow_control_);
+        tries = 1;
+      } else {
+        for (; tries < max_tries; tries++) {
+          success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, prog_cb, flow_control_);
+          // Skip trying to fetch the 'target' if control flow token transaction
+          // was set to the 'abort' or 'pause' state, see the CommandQueue and FlowControlToken.
+          if (success || (flow_control_ != nullptr && flow_control_->hasAborted())) {
+            break;
+          } else if (tries < max_tries - 1) {
+            // An abort during the wait is not held up until its end
+            if (flow_control_ != nullptr) {
+              if (!flow_control_->sleepFor(wait)) {
+                break;
+              }
+            } else {
+              std::this_thread::sleep_for(wait);
+            }
+            wait *= 2;
+          }
         }
       }
+      if (tee) {
+        package_manager_->clearDownloadTee(target);
+      }
       if (!success) {
         LOG_ERROR << "Download unsuccessful after " << tries << " attempts.";
         // TODO: Throw more meaningful exceptions. Failure can be caused by more
@@ -783,11 +1146,17 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
         throw Uptane::TargetHashMismatch(target.filename());
       }
     } else {
-      // we emulate successful download in case of the Secondary OSTree update
+      // The Secondary fetches the OSTree commit itself, from the mirror of
+      // the Primary if there is one, so the download always succeeds here.
+      if (!config.pacman.ostree_mirror_path.empty() &&
+          !package_manager_->mirrorTarget(target, keys, prog_cb, flow_control_)) {
+        LOG_WARNING << "Could not mirror " << target.filename() << ", the Secondary will fetch it from the server";
+      }
       success = true;
     }
   } catch (const std::exception &e) {
     LOG_ERROR << "Error downloading image: " << e.what();
+    std::lock_guard<std::mutex> guard(last_exception_mutex_);
     last_exception = std::current_exception();
   }
 
@@ -801,8 +1170,127 @@ std::pair<bool, Uptane::Target> SotaUptaneClient::downloadImage(const Uptane::Ta
   return {success, target};
 }
 
-void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count) {
-  updateDirectorMeta();
+void SotaUptaneClient::prefetchImages(const std::vector<Uptane::Target> &targets) {
+  std::vector<Uptane::Target> binaries;
+  std::copy_if(targets.begin(), targets.end(), std::back_inserter(binaries),
+               [](const Uptane::Target &target) { return !target.IsOstree(); });
+  {
+    std::lock_guard<std::mutex> guard(prefetch_mutex_);
+    const auto same = [](const Uptane::Target &a, const Uptane::Target &b) { return a.MatchTarget(b); };
+    if (prefetch_thread_.joinable() &&
+        std::equal(binaries.begin(), binaries.end(), prefetch_targets_.begin(), prefetch_targets_.end(), same)) {
+      return;
+    }
+  }
+  stopPrefetch(false);
+  if (binaries.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> guard(prefetch_mutex_);
+  if (!prefetch_shaper_) {
+    NetworkConfig network = config.network;
+    network.bandwidth_share = config.uptane.prefetch_bandwidth_share;
+    prefetch_shaper_ = std::make_shared<BandwidthShaper>(network);
+  }
+  prefetch_targets_ = binaries;
+  prefetch_token_ = std_::make_unique<api::FlowControlToken>();
+  prefetch_thread_ =
+      std::thread([this, binaries, token = prefetch_token_.get()]() { runPrefetch(binaries, token); });
+}
+
+void SotaUptaneClient::runPrefetch(const std::vector<Uptane::Target> &targets, const api::FlowControlToken *token) {
+  const BackgroundScheduling::Thread background(true);
+  const auto no_progress = [](const Uptane::Target &t, const std::string &description, unsigned int progress) {
+    (void)t;
+    (void)description;
+    (void)progress;
+  };
+  try {
+    KeyManager keys(storage, config.keymanagerConfig());
+    keys.loadKeys();
+    for (const auto &target : targets) {
+      if (token->hasAborted()) {
+        break;
+      }
+      // Streamed to the application only when downloaded for the update
+      if (targetConsumer(target) || package_manager_->verifyTarget(target) == TargetStatus::kGood) {
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> guard(prefetch_mutex_);
+        prefetched_.push_back(target);
+      }
+      // The data is held back in the callbacks of the transfer, which the
+      // event loop runs for all the transfers.
+      if (!config.network.event_loop) {
+        package_manager_->setDownloadTee(target, [shaper = prefetch_shaper_](const char *data, size_t size) {
+          (void)data;
+          shaper->throttle(size, CURL_SOCKET_BAD);
+        });
+      }
+      LOG_INFO << "Prefetching " << target.filename();
+      const bool success = package_manager_->fetchTarget(target, *uptane_fetcher, keys, no_progress, token);
+      package_manager_->clearDownloadTee(target);
+      if (success) {
+        LOG_INFO << "Prefetched " << target.filename();
+      } else if (!token->hasAborted()) {
+        LOG_WARNING << "Could not prefetch " << target.filename() << ", it is downloaded with the update";
+      }
+    }
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Prefetch failed: " << e.what();
+  }
+}
+
+void SotaUptaneClient::stopPrefetch(bool discard) {
+  std::thread thread;
+  {
+    std::lock_guard<std::mutex> guard(prefetch_mutex_);
+    if (prefetch_token_) {
+      prefetch_token_->setAbort();
+    }
+    thread = std::move(prefetch_thread_);
+  }
+  if (thread.joinable()) {
+    thread.join();
+  }
+  std::vector<Uptane::Target> prefetched;
+  {
+    std::lock_guard<std::mutex> guard(prefetch_mutex_);
+    prefetch_token_.reset();
+    prefetch_targets_.clear();
+    prefetched.swap(prefetched_);
+  }
+  // Within its budget, the cache drops them when it needs the space.
+  if (!discard || config.pacman.images_cache_size > 0) {
+    return;
+  }
+  for (const auto &target : prefetched) {
+    try {
+      if (package_manager_->checkTargetFile(target)) {
+        LOG_INFO << "Removing the prefetched " << target.filename();
+        package_manager_->removeTargetFile(target);
+      }
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not remove the prefetched " << target.filename() << ": " << e.what();
+    }
+  }
+}
+
+void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count,
+                                       const Uptane::IMetadataFetcher *fetcher) {
+  // What is only needed while the metadata is parsed and verified is kept
+  // apart from the rest of the heap and released at the end of the refresh.
+  const MetadataArena::Scope arena;
+  const AllocationAccounting::Scope accounting(AllocationTag::kMetadata);
+  const Uptane::IMetadataFetcher &source = (fetcher != nullptr) ? *fetcher : *uptane_fetcher;
+  // A Director update usually comes with new Image repo metadata, which is
+  // then already on its way once the Director metadata is verified.
+  std::unique_ptr<Uptane::ImagePrefetcher> image_prefetcher;
+  if (config.uptane.prefetch_image_meta && provisioner_.CurrentState() == Provisioner::State::kOk) {
+    image_prefetcher = std_::make_unique<Uptane::ImagePrefetcher>(source, *storage, image_repo.rootProbeDue());
+  }
+  updateDirectorMeta(source);
   if (flow_control_ != nullptr && flow_control_->hasAborted()) {
     return;
   }
@@ -818,7 +1306,12 @@ void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, uns
 
   if (!tmp_targets.empty()) {
     LOG_INFO << "New updates found in Director metadata. Checking Image repo metadata...";
-    updateImageMeta();
+    if (image_prefetcher) {
+      updateImageMeta(*image_prefetcher);
+      LOG_DEBUG << image_prefetcher->served() << " Image repo metadata requests were served from the prefetch";
+    } else {
+      updateImageMeta(source);
+    }
   }
 
   if (targets != nullptr) {
@@ -829,7 +1322,33 @@ void SotaUptaneClient::uptaneIteration(std::vector<Uptane::Target> *targets, uns
   }
 }
 
+bool SotaUptaneClient::directorTargetsChanged() {
+  std::string stored;
+  if (!isProvisioned() ||
+      !storage->loadNonRoot(&stored, Uptane::RepositoryType::Director(), Uptane::Role::Targets())) {
+    return true;
+  }
+  Uptane::MetaValidators validators;
+  storage->loadMetaValidators(&validators.etag, &validators.last_modified, Uptane::RepositoryType::Director(),
+                              Uptane::Role::Targets());
+  std::string remote;
+  try {
+    if (!uptane_fetcher->fetchLatestRoleIfModified(&remote, Uptane::kMaxDirectorTargetsSize,
+                                                   Uptane::RepositoryType::Director(), Uptane::Role::Targets(),
+                                                   &validators, flow_control_)) {
+      return false;
+    }
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Could not check the Director Targets metadata: " << e.what();
+    return true;
+  }
+  // Without validators, the server sends the metadata every time: only a new version is a change.
+  return remote != stored && Uptane::extractVersionUntrusted(remote) != Uptane::extractVersionUntrusted(stored);
+}
+
 void SotaUptaneClient::uptaneOfflineIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count) {
+  const MetadataArena::Scope arena;
+  const AllocationAccounting::Scope accounting(AllocationTag::kMetadata);
   checkDirectorMetaOffline();
 
   std::vector<Uptane::Target> tmp_targets;
@@ -856,19 +1375,47 @@ void SotaUptaneClient::uptaneOfflineIteration(std::vector<Uptane::Target> *targe
 
 void SotaUptaneClient::sendDeviceData() {
   requiresProvision();
+  const MemoryPhase memory_phase("the device data report", config.uptane.memory_budget_kb);
 
-  reportHwInfo();
+  reportHwInfo(kHardwareInfoWait);
   reportInstalledPackages();
   reportNetworkInfo();
   reportAktualizrConfiguration();
   sendEvent<event::SendDeviceDataComplete>();
 }
 
+void SotaUptaneClient::reportDeviceData(const std::vector<DeviceDataKind> &kinds) {
+  requiresProvision();
+  for (const auto kind : kinds) {
+    switch (kind) {
+      case DeviceDataKind::kHardwareInfo:
+        reportHwInfo(kHardwareInfoWait, true);
+        break;
+      case DeviceDataKind::kInstalledPackages: {
+        // Listing the packages can take a while with some package managers.
+        const BackgroundScheduling::Thread background;
+        reportInstalledPackages();
+        break;
+      }
+      case DeviceDataKind::kNetworkInfo:
+        reportNetworkInfo();
+        break;
+      default:
+        LOG_WARNING << "Unknown kind of device data: " << static_cast<int>(kind);
+        break;
+    }
+  }
+}
+
 result::UpdateCheck SotaUptaneClient::fetchMeta() {
   requiresProvision();
+  const MemoryPhase memory_phase("the update check", config.uptane.memory_budget_kb);
+  TraceSpan span(&tracer_, "fetchMeta");
 
   result::UpdateCheck result;
+  offline_bundle_.reset();
 
+  reportHwInfo(std::chrono::milliseconds::zero());
   reportNetworkInfo();
 
   if (hasPendingUpdates()) {
@@ -890,18 +1437,63 @@ result::UpdateCheck SotaUptaneClient::fetchMeta() {
     LOG_ERROR << "Error sending manifest!";
   }
   result = checkUpdates();
+  span.setCorrelationId(director_repo.getCorrelationId());
+  sendEvent<event::UpdateCheckComplete>(result);
+
+  return result;
+}
+
+result::UpdateCheck SotaUptaneClient::checkUpdatesFromBundle(const boost::filesystem::path &bundle) {
+  requiresAlreadyProvisioned();
+  const MemoryPhase memory_phase("the update check", config.uptane.memory_budget_kb);
+  TraceSpan span(&tracer_, "checkUpdatesFromBundle");
+
+  result::UpdateCheck result;
+  offline_bundle_.reset();
+
+  if (hasPendingUpdates()) {
+    LOG_INFO << "The current update is pending. Check if pending ECUs has been already updated";
+    checkAndUpdatePendingSecondaries();
+  }
+
+  if (hasPendingUpdates()) {
+    LOG_INFO << "An update is pending. Skipping check for update until installation is complete.";
+    return result::UpdateCheck({}, 0, result::UpdateStatus::kError, Json::nullValue,
+                               "There are pending updates, no new updates are checked");
+  }
+
+  std::shared_ptr<const Uptane::OfflineBundle> opened;
+  try {
+    opened = std::make_shared<const Uptane::OfflineBundle>(bundle);
+  } catch (const std::exception &e) {
+    last_exception = std::current_exception();
+    LOG_ERROR << e.what();
+    result = result::UpdateCheck({}, 0, result::UpdateStatus::kError, Json::nullValue,
+                                 "Could not open the offline bundle.");
+    sendEvent<event::UpdateCheckComplete>(result);
+    return result;
+  }
+
+  // The bundle may hold new Roots, whenever the last check was.
+  director_repo.requireRootProbe();
+  image_repo.requireRootProbe();
+  result = checkUpdates(opened.get());
+  if (result.status == result::UpdateStatus::kUpdatesAvailable) {
+    offline_bundle_ = std::move(opened);
+  }
+  span.setCorrelationId(director_repo.getCorrelationId());
   sendEvent<event::UpdateCheckComplete>(result);
 
   return result;
 }
 
-result::UpdateCheck SotaUptaneClient::checkUpdates() {
+result::UpdateCheck SotaUptaneClient::checkUpdates(const Uptane::IMetadataFetcher *fetcher) {
   result::UpdateCheck result;
 
   std::vector<Uptane::Target> updates;
   unsigned int ecus_count = 0;
   try {
-    uptaneIteration(&updates, &ecus_count);
+    uptaneIteration(&updates, &ecus_count, fetcher);
   } catch (const std::exception &e) {
     last_exception = std::current_exception();
     result = result::UpdateCheck({}, 0, result::UpdateStatus::kError, Json::nullValue, "Could not update metadata.");
@@ -951,6 +1543,10 @@ result::UpdateCheck SotaUptaneClient::checkUpdates() {
 
   result = result::UpdateCheck(updates, ecus_count, result::UpdateStatus::kUpdatesAvailable,
                                Utils::parseJSON(director_targets), "");
+  // The targets of an offline bundle are at hand already.
+  if (config.uptane.prefetch && fetcher == nullptr) {
+    prefetchImages(updates);
+  }
   if (updates.size() == 1) {
     LOG_INFO << "1 new update found in both Director and Image repo metadata.";
   } else {
@@ -1009,7 +1605,10 @@ result::UpdateStatus SotaUptaneClient::checkUpdatesOffline(const std::vector<Upt
 
 result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target> &updates) {
   requiresAlreadyProvisioned();
+  const MemoryPhase memory_phase("the installation", config.uptane.memory_budget_kb);
   auto correlation_id = director_repo.getCorrelationId();
+  TraceSpan span(&tracer_, "uptaneInstall");
+  span.setCorrelationId(correlation_id);
 
   // put most of the logic in a lambda so that we can take care of common
   // post-operations
@@ -1040,18 +1639,9 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 
     Uptane::EcuSerial primary_ecu_serial = primaryEcuSerial();
     // Recheck the downloaded update hashes.
-    for (const auto &update : updates) {
-      if (update.IsForEcu(primary_ecu_serial) || !update.IsOstree()) {
-        // download binary images for any target, for both Primary and Secondary
-        // download an OSTree revision just for Primary, Secondary will do it by itself
-        // Primary cannot verify downloaded OSTree targets for Secondaries,
-        // Downloading of Secondary's OSTree repo revision to the Primary's can fail
-        // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
-        if (package_manager_->verifyTarget(update) != TargetStatus::kGood) {
-          result.dev_report = {false, data::ResultCode::Numeric::kInternalError, ""};
-          return std::make_tuple(result, "Downloaded target is invalid");
-        }
-      }
+    if (!verifyDownloadedTargets(updates, primary_ecu_serial)) {
+      result.dev_report = {false, data::ResultCode::Numeric::kInternalError, ""};
+      return std::make_tuple(result, "Downloaded target is invalid");
     }
 
     // wait some time for Secondaries to come up
@@ -1087,7 +1677,14 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
       // notify the bootloader before installation happens, because installation is not atomic and
       //   a false notification doesn't hurt when rollbacks are implemented
       package_manager_->updateNotify();
-      install_res = PackageInstallSetResult(primary_update, correlation_id);
+      {
+        TraceSpan install_span(&tracer_, "install");
+        install_span.setAttribute("ecu", primary_ecu_serial.ToString());
+        install_res = PackageInstallSetResult(primary_update, correlation_id);
+        if (!install_res.isSuccess() && !install_res.needCompletion()) {
+          install_span.setError(install_res.result_code.ToString());
+        }
+      }
       if (install_res.result_code.num_code == data::ResultCode::Numeric::kNeedCompletion) {
         // update needs a reboot, send distinct EcuInstallationApplied event
         report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(primary_ecu_serial, correlation_id));
@@ -1118,15 +1715,33 @@ result::Install SotaUptaneClient::uptaneInstall(const std::vector<Uptane::Target
 
   storage->storeDeviceInstallationResult(r.dev_report, raw_report, correlation_id);
 
+  ++installs_completed_;
   sendEvent<event::AllInstallsComplete>(r);
 
+  if (config.pacman.images_gc) {
+    // The images replaced by the installation are collected off the update path
+    Executor::blocking().submit([package_manager = package_manager_]() {
+      const BackgroundScheduling::Thread background;
+      try {
+        package_manager->collectTargetFiles();
+      } catch (const std::exception &e) {
+        LOG_WARNING << "Could not remove the unused image files: " << e.what();
+      }
+    });
+  }
+
   return r;
 }
 
 result::CampaignCheck SotaUptaneClient::campaignCheck() {
   requiresProvision();
 
-  auto campaigns = campaign::Campaign::fetchAvailableCampaigns(*http, config.tls.server);
+#ifdef BUILD_MINIMAL
+  // Campaigns are left out of this build.
+  const std::vector<campaign::Campaign> campaigns;
+#else
+  auto campaigns = campaigns_.fetch(*http, config.tls.server);
+#endif
   for (const auto &c : campaigns) {
     LOG_INFO << "Campaign: " << c.name;
     LOG_INFO << "Campaign id: " << c.id;
@@ -1142,6 +1757,7 @@ result::CampaignCheck SotaUptaneClient::campaignCheck() {
 void SotaUptaneClient::campaignAccept(const std::string &campaign_id) {
   requiresAlreadyProvisioned();
 
+  campaigns_.invalidate();
   sendEvent<event::CampaignAcceptComplete>();
   report_queue->enqueue(std_::make_unique<CampaignAcceptedReport>(campaign_id));
 }
@@ -1149,6 +1765,8 @@ void SotaUptaneClient::campaignAccept(const std::string &campaign_id) {
 void SotaUptaneClient::campaignDecline(const std::string &campaign_id) {
   requiresAlreadyProvisioned();
 
+  campaigns_.invalidate();
+  stopPrefetch(true);
   sendEvent<event::CampaignDeclineComplete>();
   report_queue->enqueue(std_::make_unique<CampaignDeclinedReport>(campaign_id));
 }
@@ -1156,10 +1774,22 @@ void SotaUptaneClient::campaignDecline(const std::string &campaign_id) {
 void SotaUptaneClient::campaignPostpone(const std::string &campaign_id) {
   requiresAlreadyProvisioned();
 
+  campaigns_.invalidate();
   sendEvent<event::CampaignPostponeComplete>();
   report_queue->enqueue(std_::make_unique<CampaignPostponedReport>(campaign_id));
 }
 
+void SotaUptaneClient::reportNextPoll(std::chrono::milliseconds delay) {
+  sendEvent<event::PollScheduled>(std::chrono::system_clock::now() + delay, delay);
+}
+
+void SotaUptaneClient::reportCycleIo(const IoTotals &io) {
+  LOG_DEBUG << "Uptane cycle I/O: " << io.toString();
+  if (config.telemetry.report_cycle_io) {
+    sendEvent<event::UptaneCycleIo>(io.toJson());
+  }
+}
+
 bool SotaUptaneClient::isInstallCompletionRequired() {
   std::vector<std::pair<Uptane::EcuSerial, Hash>> pending_ecus;
   storage->getPendingEcus(&pending_ecus);
@@ -1178,6 +1808,17 @@ void SotaUptaneClient::completeInstall() {
   }
 }
 
+std::string SotaUptaneClient::manifestDigest(const Json::Value &manifest) {
+  // The signatures and report counters change every time.
+  Json::Value content = manifest;
+  for (auto &ecu_manifest : content["ecu_version_manifests"]) {
+    Json::Value ecu_content = ecu_manifest["signed"];
+    ecu_content.removeMember("report_counter");
+    ecu_manifest = ecu_content;
+  }
+  return Crypto::sha256digestHex(Utils::jsonToCanonicalStr(content));
+}
+
 bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
   // does not send event, so it can be used as a subset of other steps
   if (hasPendingUpdates()) {
@@ -1187,11 +1828,20 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
     return false;
   }
 
+  TraceSpan span(&tracer_, "putManifest");
+  span.setCorrelationId(director_repo.getCorrelationId());
   static bool connected = true;
   auto manifest = AssembleManifest();
   if (!custom.empty()) {
     manifest["custom"] = custom;
   }
+  const std::string digest = manifestDigest(manifest);
+  const auto now = std::chrono::steady_clock::now();
+  if (config.uptane.unchanged_manifest_interval_sec > 0 && digest == last_manifest_digest_ &&
+      now - last_manifest_put_ < std::chrono::seconds(config.uptane.unchanged_manifest_interval_sec)) {
+    LOG_DEBUG << "The manifest has not changed since it was sent, skipping manifest upload";
+    return true;
+  }
   auto signed_manifest = uptane_manifest->sign(manifest);
   HttpResponse response = http->put(config.uptane.director_server + "/manifest", signed_manifest);
   if (response.isOk()) {
@@ -1199,11 +1849,16 @@ bool SotaUptaneClient::putManifestSimple(const Json::Value &custom) {
       LOG_INFO << "Connectivity is restored.";
     }
     connected = true;
+    report_queue->connectionWarm();
     storage->clearInstallationResults();
+    last_manifest_digest_ = digest;
+    last_manifest_put_ = now;
 
     return true;
   } else {
     connected = false;
+    last_manifest_digest_.clear();
+    span.setError(response.getStatusStr());
   }
 
   LOG_WARNING << "Put manifest request failed: " << response.getStatusStr();
@@ -1218,6 +1873,54 @@ bool SotaUptaneClient::putManifest(const Json::Value &custom) {
   return success;
 }
 
+bool SotaUptaneClient::verifyDownloadedTargets(const std::vector<Uptane::Target> &updates,
+                                               const Uptane::EcuSerial &primary_ecu_serial) {
+  // download binary images for any target, for both Primary and Secondary
+  // download an OSTree revision just for Primary, Secondary will do it by itself
+  // Primary cannot verify downloaded OSTree targets for Secondaries,
+  // Downloading of Secondary's OSTree repo revision to the Primary's can fail
+  // if they differ signficantly as OSTree has a certain cap/limit of the diff it pulls
+  std::vector<const Uptane::Target *> to_verify;
+  for (const auto &update : updates) {
+    if (update.IsForEcu(primary_ecu_serial) || !update.IsOstree()) {
+      to_verify.push_back(&update);
+    }
+  }
+  if (to_verify.size() <= 1) {
+    return std::all_of(to_verify.begin(), to_verify.end(), [this](const Uptane::Target *target) {
+      return package_manager_->verifyTarget(*target) == TargetStatus::kGood;
+    });
+  }
+
+  // Each image is hashed again right before it is installed, so they are
+  // checked at the same time. The tasks refer to the updates, all of them are
+  // waited for before returning.
+  LOG_DEBUG << "Verifying " << to_verify.size() << " downloaded targets in parallel";
+  std::vector<std::future<TargetStatus>> statuses;
+  statuses.reserve(to_verify.size());
+  for (const auto *target : to_verify) {
+    statuses.push_back(Executor::cpu().submit(
+        [package_manager = package_manager_, target]() { return package_manager->verifyTarget(*target); }));
+  }
+  bool all_good = true;
+  std::exception_ptr error;
+  for (auto &status : statuses) {
+    try {
+      if (status.get() != TargetStatus::kGood) {
+        all_good = false;
+      }
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return all_good;
+}
+
 bool SotaUptaneClient::waitSecondariesReachable(const std::vector<Uptane::Target> &updates) {
   std::map<Uptane::EcuSerial, SecondaryInterface *> targeted_secondaries;
   const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
@@ -1242,26 +1945,39 @@ bool SotaUptaneClient::waitSecondariesReachable(const std::vector<Uptane::Target
 
   LOG_INFO << "Waiting for Secondaries to connect to start installation...";
 
-  auto deadline = std::chrono::system_clock::now() + std::chrono::seconds(config.uptane.secondary_preinstall_wait_sec);
-  while (std::chrono::system_clock::now() <= deadline) {
+  // Ping all the Secondaries at once, first shortly after each other, so that
+  // Secondaries that just rebooted don't delay the installation much.
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(config.uptane.secondary_preinstall_wait_sec);
+  constexpr std::chrono::milliseconds max_interval{1000};
+  std::chrono::milliseconds interval{100};
+  while (true) {
+    std::map<Uptane::EcuSerial, std::future<bool>> pings;
+    for (const auto &sec : targeted_secondaries) {
+      pings.emplace(sec.first, Executor::io().submit([&sec]() {
+        try {
+          return sec.second->ping();
+        } catch (const std::exception &ex) {
+          LOG_DEBUG << "Failed to ping Secondary with serial " << sec.first << ": " << ex.what();
+          return false;
+        }
+      }));
+    }
+    for (auto &ping : pings) {
+      if (ping.second.get()) {
+        targeted_secondaries.erase(ping.first);
+      }
+    }
     if (targeted_secondaries.empty()) {
       return true;
     }
 
-    for (auto sec_it = targeted_secondaries.begin(); sec_it != targeted_secondaries.end();) {
-      bool connected = false;
-      try {
-        connected = sec_it->second->ping();
-      } catch (const std::exception &ex) {
-        LOG_DEBUG << "Failed to ping Secondary with serial " << sec_it->first << ": " << ex.what();
-      }
-      if (connected) {
-        sec_it = targeted_secondaries.erase(sec_it);
-      } else {
-        sec_it++;
-      }
+    const auto now = std::chrono::steady_clock::now();
+    if (now >= deadline) {
+      break;
     }
-    std::this_thread::sleep_for(std::chrono::seconds(1));
+    std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(interval, deadline - now));
+    interval = std::min(interval * 2, max_interval);
   }
 
   for (const auto &sec : targeted_secondaries) {
@@ -1306,6 +2022,7 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
 
   // Only send intermediate Roots that would otherwise be skipped. The latest
   // will be sent with the complete set of the latest metadata.
+  std::vector<std::string> roots;
   for (int version_to_send = sec_root_version + 1; version_to_send < last_root_version; version_to_send++) {
     std::string root;
     if (!storage->loadRoot(&root, repo, Uptane::Version(version_to_send))) {
@@ -1321,74 +2038,106 @@ data::InstallationResult SotaUptaneClient::rotateSecondaryRoot(Uptane::Repositor
                     ", skipping to the next Secondary"};
       }
     }
-    try {
-      auto result = secondary.putRoot(root, repo == Uptane::RepositoryType::Director());
-      if (!result.isSuccess()) {
-        // Old (pre 2024-07-XX) versions would assume that if sec_root_version
-        // is 0, either the Secondary doesn't have Root metadata or doesn't
-        // support the Root version request and skip sending any root metadata.
-        // Unfortunatately this cause TOR-3452 where an expired root metadata
-        // would cause updates to fail. Instead assume that '0' could mean 'I
-        // don't have any root versions yet'. If we send  version 1 and it is
-        // rejected, then assume we are in the case that the code originally was
-        // defending against: the secondary can't rotate root, and treat this
-        // as a success. The previous code would have returned success in this
-        // case anyway.
-        if (version_to_send == 1) {
-          LOG_WARNING
-              << "Sending root.1.json to a secondary failed. Assuming it doesn't allow root rotation and continuing.";
-          return {data::ResultCode::Numeric::kOk, ""};
-        }
-        LOG_ERROR << "Sending Root metadata to Secondary with serial " << secondary.getSerial()
-                  << " failed: " << result.result_code << " " << result.description;
-        return result;
+    roots.push_back(std::move(root));
+  }
+  if (roots.empty()) {
+    return {data::ResultCode::Numeric::kOk, ""};
+  }
+
+  // All in one request when the Secondary supports it
+  try {
+    size_t stored = 0;
+    auto result = secondary.putRootChain(roots, repo == Uptane::RepositoryType::Director(), &stored);
+    if (!result.isSuccess()) {
+      // Old (pre 2024-07-XX) versions would assume that if sec_root_version
+      // is 0, either the Secondary doesn't have Root metadata or doesn't
+      // support the Root version request and skip sending any root metadata.
+      // Unfortunatately this cause TOR-3452 where an expired root metadata
+      // would cause updates to fail. Instead assume that '0' could mean 'I
+      // don't have any root versions yet'. If we send  version 1 and it is
+      // rejected, then assume we are in the case that the code originally was
+      // defending against: the secondary can't rotate root, and treat this
+      // as a success. The previous code would have returned success in this
+      // case anyway.
+      if (sec_root_version == 0 && stored == 0) {
+        LOG_WARNING
+            << "Sending root.1.json to a secondary failed. Assuming it doesn't allow root rotation and continuing.";
+        return {data::ResultCode::Numeric::kOk, ""};
       }
-    } catch (const std::exception &ex) {
-      return {data::ResultCode::Numeric::kInternalError, ex.what()};
+      LOG_ERROR << "Sending Root metadata to Secondary with serial " << secondary.getSerial()
+                << " failed: " << result.result_code << " " << result.description;
+      return result;
     }
+  } catch (const std::exception &ex) {
+    return {data::ResultCode::Numeric::kInternalError, ex.what()};
   }
   return {data::ResultCode::Numeric::kOk, ""};
 }
 
-// TODO: the function blocks until it updates all the Secondaries. Consider non-blocking operation.
+data::InstallationResult SotaUptaneClient::sendMetadata(SecondaryInterface &secondary, const Uptane::Target &target) {
+  /* Root rotation if necessary */
+  data::InstallationResult result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), secondary);
+  if (!result.isSuccess()) {
+    return result;
+  }
+  result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), secondary);
+  if (!result.isSuccess()) {
+    return result;
+  }
+  try {
+    return secondary.putMetadata(target);
+  } catch (const std::exception &ex) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
+}
+
+// The metadata is sent to all the Secondaries at the same time, within the
+// limits of the Secondary transfers, and to each of them one Target after the
+// other. The function blocks until it updates all of them.
 void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                                           std::string *raw_installation_report) {
-  data::InstallationResult final_result{data::ResultCode::Numeric::kOk, ""};
-  std::string result_code_err_str;
+  TraceSpan span(&tracer_, "sendMetadataToEcus");
+  struct Sending {
+    const Uptane::Target *target;
+    Uptane::EcuSerial serial;
+    Uptane::HardwareIdentifier hw_id;
+    data::InstallationResult result;
+  };
+  std::vector<Sending> sendings;
   for (const auto &target : targets) {
     for (const auto &ecu : target.ecus()) {
-      const Uptane::EcuSerial ecu_serial = ecu.first;
-      const Uptane::HardwareIdentifier hw_id = ecu.second;
-      auto sec = secondaries.find(ecu_serial);
-      if (sec == secondaries.end()) {
-        continue;
+      if (secondaries.find(ecu.first) != secondaries.end()) {
+        sendings.push_back({&target, ecu.first, ecu.second, {data::ResultCode::Numeric::kOk, ""}});
       }
+    }
+  }
 
-      data::InstallationResult local_result{data::ResultCode::Numeric::kOk, ""};
-      do {
-        /* Root rotation if necessary */
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Director(), *(sec->second));
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        local_result = rotateSecondaryRoot(Uptane::RepositoryType::Image(), *(sec->second));
-        if (!local_result.isSuccess()) {
-          final_result = local_result;
-          break;
-        }
-        try {
-          local_result = sec->second->putMetadata(target);
-        } catch (const std::exception &ex) {
-          local_result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
-        }
-      } while (false);
-      if (!local_result.isSuccess()) {
-        LOG_ERROR << "Sending metadata to " << sec->first << " failed: " << local_result.result_code << " "
-                  << local_result.description;
-        const std::string ecu_code_str = hw_id.ToString() + ":" + local_result.result_code.ToString();
-        result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
+  std::map<Uptane::EcuSerial, std::vector<Sending *>> by_secondary;
+  for (auto &sending : sendings) {
+    by_secondary[sending.serial].push_back(&sending);
+  }
+  std::vector<TransferScheduler::Transfer> transfers;
+  for (const auto &ecu_sendings : by_secondary) {
+    SecondaryInterface &secondary = *secondaries.at(ecu_sendings.first);
+    TransferScheduler::Transfer transfer;
+    transfer.type = secondary.Type();
+    transfer.send = [this, &secondary, &ecu_sendings]() {
+      for (Sending *sending : ecu_sendings.second) {
+        sending->result = sendMetadata(secondary, *sending->target);
       }
+    };
+    transfers.push_back(std::move(transfer));
+  }
+  TransferScheduler(config.uptane).run(transfers);
+
+  data::InstallationResult final_result{data::ResultCode::Numeric::kOk, ""};
+  std::string result_code_err_str;
+  for (const auto &sending : sendings) {
+    if (!sending.result.isSuccess()) {
+      LOG_ERROR << "Sending metadata to " << sending.serial << " failed: " << sending.result.result_code << " "
+                << sending.result.description;
+      const std::string ecu_code_str = sending.hw_id.ToString() + ":" + sending.result.result_code.ToString();
+      result_code_err_str += (!result_code_err_str.empty() ? "|" : "") + ecu_code_str;
     }
   }
 
@@ -1407,41 +2156,125 @@ void SotaUptaneClient::sendMetadataToEcus(const std::vector<Uptane::Target> &tar
   }
 }
 
-std::future<data::InstallationResult> SotaUptaneClient::sendFirmwareAsync(SecondaryInterface &secondary,
-                                                                          const Uptane::Target &target) {
-  auto f = [this, &secondary, target]() {
-    auto correlation_id = director_repo.getCorrelationId();
+data::InstallationResult SotaUptaneClient::sendFirmware(SecondaryInterface &secondary, const Uptane::Target &target,
+                                                        std::unique_ptr<ProgressAggregator::Transfer> *progress) {
+  auto correlation_id = director_repo.getCorrelationId();
 
-    sendEvent<event::InstallStarted>(secondary.getSerial());
-    report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(secondary.getSerial(), correlation_id));
+  sendEvent<event::InstallStarted>(secondary.getSerial());
+  report_queue->enqueue(std_::make_unique<EcuInstallationStartedReport>(secondary.getSerial(), correlation_id));
 
-    data::InstallationResult result;
-    try {
-      result = secondary.sendFirmware(target, flow_control_);
-      if (result.isSuccess()) {
-        result = secondary.install(target, flow_control_);
-      }
-    } catch (const std::exception &ex) {
-      result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  // Secondaries don't report the progress of a transfer, so each counts as
+  // a whole when it is installed
+  if (install_progress_) {
+    *progress = install_progress_->start(target.length());
+  }
+  try {
+    return secondary.sendFirmware(target, flow_control_);
+  } catch (const std::exception &ex) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
+}
+
+data::InstallationResult SotaUptaneClient::installFirmware(SecondaryInterface &secondary, const Uptane::Target &target,
+                                                           data::InstallationResult result,
+                                                           ProgressAggregator::Transfer *progress) {
+  auto correlation_id = director_repo.getCorrelationId();
+  try {
+    if (result.isSuccess()) {
+      result = secondary.install(target, flow_control_);
+    }
+    if (progress != nullptr && result.isSuccess()) {
+      progress->complete();
     }
+  } catch (const std::exception &ex) {
+    result = data::InstallationResult(data::ResultCode::Numeric::kInternalError, ex.what());
+  }
 
-    if (result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
-      report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(secondary.getSerial(), correlation_id));
-    } else {
-      report_queue->enqueue(
-          std_::make_unique<EcuInstallationCompletedReport>(secondary.getSerial(), correlation_id, result.isSuccess()));
+  if (result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
+    report_queue->enqueue(std_::make_unique<EcuInstallationAppliedReport>(secondary.getSerial(), correlation_id));
+  } else {
+    report_queue->enqueue(
+        std_::make_unique<EcuInstallationCompletedReport>(secondary.getSerial(), correlation_id, result.isSuccess()));
+  }
+
+  sendEvent<event::InstallTargetComplete>(secondary.getSerial(), result.isSuccess());
+  return result;
+}
+
+void SotaUptaneClient::fanOutImages(const std::vector<Uptane::Target> &targets) {
+  const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
+  // The Secondaries of each image, which may be given in several Targets
+  std::map<std::string, std::pair<const Uptane::Target *, std::vector<Uptane::EcuSerial>>> images;
+  for (const auto &target : targets) {
+    auto &image = images[target.filename() + ":" + target.sha256Hash()];
+    image.first = &target;
+    for (const auto &ecu : target.ecus()) {
+      if (ecu.first != primary_ecu_serial && secondaries.count(ecu.first) != 0 &&
+          std::find(image.second.cbegin(), image.second.cend(), ecu.first) == image.second.cend()) {
+        image.second.push_back(ecu.first);
+      }
     }
+  }
 
-    sendEvent<event::InstallTargetComplete>(secondary.getSerial(), result.isSuccess());
-    return result;
-  };
+  for (const auto &image : images) {
+    const Uptane::Target &target = *image.second.first;
+    if (image.second.second.size() < 2 || target.IsOstree()) {
+      continue;
+    }
+    std::vector<Uptane::EcuSerial> serials;
+    std::vector<FirmwareFanOut::Stream> streams;
+    for (const auto &serial : image.second.second) {
+      try {
+        auto stream = secondaries.at(serial)->streamFirmware(target);
+        if (stream) {
+          serials.push_back(serial);
+          streams.push_back(std::move(stream));
+        }
+      } catch (const std::exception &e) {
+        LOG_WARNING << "Unable to send " << target.filename() << " to Secondary " << serial << ": " << e.what();
+      }
+    }
+    if (streams.size() < 2) {
+      continue;
+    }
 
-  return std::async(std::launch::async, f);
+    LOG_INFO << "Sending " << target.filename() << " to " << streams.size() << " Secondaries at the same time";
+    std::vector<uint64_t> accepted;
+    try {
+      auto image_reader = package_manager_->openTargetFile(target);
+      accepted = FirmwareFanOut().run(image_reader, streams, flow_control_);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Unable to read " << target.filename() << ": " << e.what();
+      continue;
+    }
+    // Their own transfers send them the rest.
+    for (size_t i = 0; i < serials.size(); ++i) {
+      if (accepted[i] < target.length()) {
+        LOG_INFO << "Secondary " << serials[i] << " accepted " << accepted[i] << " bytes of " << target.length();
+      }
+    }
+  }
 }
 
 std::vector<result::Install::EcuReport> SotaUptaneClient::sendImagesToEcus(const std::vector<Uptane::Target> &targets) {
+  TraceSpan span(&tracer_, "sendImagesToEcus");
   std::vector<result::Install::EcuReport> reports;
-  std::vector<std::pair<result::Install::EcuReport, std::future<data::InstallationResult>>> firmwareFutures;
+  std::vector<result::Install::EcuReport> firmware_reports;
+  std::vector<TransferScheduler::Transfer> transfers;
+  // Serial and hardware ID of each, for the install dependencies
+  std::vector<std::pair<std::string, std::string>> ecus;
+
+  std::vector<std::string> critical_ecus;
+  boost::split(critical_ecus, config.uptane.critical_ecus, boost::is_any_of(", "), boost::token_compress_on);
+  auto is_critical = [&critical_ecus](const Uptane::EcuSerial &serial, const Uptane::HardwareIdentifier &hw_id) {
+    return std::find_if(critical_ecus.cbegin(), critical_ecus.cend(), [&serial, &hw_id](const std::string &ecu) {
+             return !ecu.empty() && (ecu == serial.ToString() || ecu == hw_id.ToString());
+           }) != critical_ecus.cend();
+  };
+
+  if (config.uptane.secondary_fan_out) {
+    fanOutImages(targets);
+  }
 
   const Uptane::EcuSerial &primary_ecu_serial = primaryEcuSerial();
   // target images should already have been downloaded to metadata_path/targets/
@@ -1459,25 +2292,114 @@ std::vector<result::Install::EcuReport> SotaUptaneClient::sendImagesToEcus(const
         continue;
       }
 
-      SecondaryInterface &sec = *f->second;
-      firmwareFutures.emplace_back(result::Install::EcuReport(*targets_it, ecu_serial, data::InstallationResult()),
-                                   sendFirmwareAsync(sec, *targets_it));
+      firmware_reports.emplace_back(*targets_it, ecu_serial, data::InstallationResult());
+      ecus.emplace_back(ecu_serial.ToString(), ecus_it->second.ToString());
+      TransferScheduler::Transfer transfer;
+      transfer.type = f->second->Type();
+      transfer.size = targets_it->length();
+      transfer.critical = is_critical(ecu_serial, ecus_it->second);
+      transfers.push_back(std::move(transfer));
+    }
+  }
+  // Each installation starts as soon as its transfer is finished and the
+  // installations it depends on are, on a thread of its own so that the next
+  // transfer can start.
+  InstallOrder install_order(config.uptane.secondary_install_dependencies, ecus);
+  std::vector<std::unique_ptr<ProgressAggregator::Transfer>> progress(transfers.size());
+  std::vector<std::future<void>> installs(transfers.size());
+  auto install = [this, &firmware_reports, &progress, &install_order, &span](size_t i, data::InstallationResult sent) {
+    result::Install::EcuReport &report = firmware_reports[i];
+    bool success = false;
+    try {
+      if (sent.isSuccess()) {
+        const int failed = install_order.wait(i);
+        if (failed >= 0) {
+          sent = data::InstallationResult(data::ResultCode::Numeric::kInstallFailed,
+                                          "Not installed, as the installation on Secondary " +
+                                              firmware_reports[static_cast<size_t>(failed)].serial.ToString() +
+                                              " it depends on failed");
+        }
+      }
+      TraceSpan install_span(span, "install");
+      install_span.setAttribute("ecu", report.serial.ToString());
+      report.install_res = installFirmware(*secondaries.at(report.serial), report.update, sent, progress[i].get());
+      success = report.install_res.isSuccess() || report.install_res.needCompletion();
+      if (!success) {
+        install_span.setError(report.install_res.result_code.ToString());
+      }
+    } catch (...) {
+      install_order.finish(i, false);
+      throw;
+    }
+    install_order.finish(i, success);
+  };
+  // The reports don't move any more, the transfers can refer to them.
+  for (size_t i = 0; i < transfers.size(); ++i) {
+    transfers[i].send = [this, i, &firmware_reports, &progress, &installs, &install_order, &install, &span]() {
+      // On the thread of the transfer
+      result::Install::EcuReport &report = firmware_reports[i];
+      data::InstallationResult sent;
+      try {
+        TraceSpan transfer_span(span, "transfer");
+        transfer_span.setAttribute("ecu", report.serial.ToString());
+        sent = sendFirmware(*secondaries.at(report.serial), report.update, &progress[i]);
+        if (!sent.isSuccess()) {
+          transfer_span.setError(sent.result_code.ToString());
+        }
+      } catch (...) {
+        install_order.finish(i, false);
+        throw;
+      }
+      installs[i] = Executor::blocking().submit([&install, i, sent]() {
+        const BackgroundScheduling::Thread background;
+        install(i, sent);
+      });
+    };
+  }
+
+  // Wait for all Secondaries before writing their results in one batch, as the
+  // sending threads use the storage as well.
+  std::vector<TransferScheduler::Timing> timings;
+  std::exception_ptr error;
+  try {
+    timings = TransferScheduler(config.uptane).run(transfers);
+  } catch (...) {
+    error = std::current_exception();
+  }
+  // The installations refer to the reports
+  for (auto &running : installs) {
+    try {
+      if (running.valid()) {
+        running.get();
+      }
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
     }
   }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  for (size_t i = 0; i < timings.size(); ++i) {
+    LOG_INFO << "Firmware for Secondary " << firmware_reports[i].serial << " was queued for "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(timings[i].queued).count() << " ms and sent in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(timings[i].sending).count() << " ms";
+  }
 
-  for (auto &f : firmwareFutures) {
-    data::InstallationResult fut_result = f.second.get();
+  const auto batch = storage->startBatch();
+  for (const auto &report : firmware_reports) {
+    const data::InstallationResult &install_res = report.install_res;
 
-    if (fut_result.isSuccess() || fut_result.result_code == data::ResultCode::Numeric::kNeedCompletion) {
+    if (install_res.isSuccess() || install_res.result_code == data::ResultCode::Numeric::kNeedCompletion) {
       auto update_mode =
-          fut_result.isSuccess() ? InstalledVersionUpdateMode::kCurrent : InstalledVersionUpdateMode::kPending;
-      storage->saveInstalledVersion(f.first.serial.ToString(), f.first.update, update_mode,
+          install_res.isSuccess() ? InstalledVersionUpdateMode::kCurrent : InstalledVersionUpdateMode::kPending;
+      storage->saveInstalledVersion(report.serial.ToString(), report.update, update_mode,
                                     director_repo.getCorrelationId());
     }
 
-    f.first.install_res = fut_result;
-    storage->saveEcuInstallationResult(f.first.serial, f.first.install_res);
-    reports.push_back(f.first);
+    storage->saveEcuInstallationResult(report.serial, report.install_res);
+    reports.push_back(report);
   }
   return reports;
 }
@@ -1524,18 +2446,20 @@ void SotaUptaneClient::checkAndUpdatePendingSecondaries() {
       boost::optional<Uptane::Target> pending_version;
       Uptane::CorrelationId correlation_id;
       if (storage->loadInstalledVersions(pending_ecu.first.ToString(), nullptr, &pending_version, &correlation_id)) {
-        storage->saveEcuInstallationResult(pending_ecu.first,
-                                           data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
-        storage->saveInstalledVersion(pending_ecu.first.ToString(), *pending_version,
-                                      InstalledVersionUpdateMode::kCurrent, correlation_id);
-
+        {
+          const auto batch = storage->startBatch();
+          storage->saveEcuInstallationResult(pending_ecu.first,
+                                             data::InstallationResult(data::ResultCode::Numeric::kOk, ""));
+          storage->saveInstalledVersion(pending_ecu.first.ToString(), *pending_version,
+                                        InstalledVersionUpdateMode::kCurrent, correlation_id);
+
+          data::InstallationResult ir;
+          std::string raw_report;
+          computeDeviceInstallationResult(&ir, &raw_report);
+          storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
+        }
         report_queue->enqueue(
             std_::make_unique<EcuInstallationCompletedReport>(pending_ecu.first, correlation_id, true));
-
-        data::InstallationResult ir;
-        std::string raw_report;
-        computeDeviceInstallationResult(&ir, &raw_report);
-        storage->storeDeviceInstallationResult(ir, raw_report, correlation_id);
       }
     } else {
       LOG_DEBUG << "The pending update for ECU " << pending_ecu.first << " has not been installed ("
@@ -1570,3 +2494,19 @@ std::ifstream SotaUptaneClient::openStoredTarget(const Uptane::Target &target) {
     throw std::runtime_error("Failed to open Target");
   }
 }
+
+int SotaUptaneClient::openStoredTargetFd(const Uptane::Target &target) {
+  if (package_manager_->verifyTarget(target) != TargetStatus::kGood) {
+    throw std::runtime_error("Failed to open Target");
+  }
+  const int fd = package_manager_->openTargetFd(target);
+  // Target files are named after their content and only replaced by renaming
+  // a complete file over them, so the file opened has the verified content,
+  // unless it was removed in between and a partial download took its place.
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || static_cast<uint64_t>(st.st_size) != target.length()) {
+    close(fd);
+    throw std::runtime_error("Failed to open Target");
+  }
+  return fd;
+}
@@ -1,9 +1,13 @@
 #ifndef SOTA_UPTANE_CLIENT_H_
 #define SOTA_UPTANE_CLIENT_H_
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -20,7 +24,14 @@
 #include "libaktualizr/secondaryinterface.h"
 
 #include "bootloader/bootloader.h"
+#include "campaign/campaign_cache.h"
+#include "http/bandwidth_shaper.h"
 #include "http/httpclient.h"
+#include "package_manager/peer_server.h"
+#include "primary/device_data_collector.h"
+#include "primary/device_data_scheduler.h"
+#include "primary/event_dispatcher.h"
+#include "primary/io_accounting.h"
 #include "primary/secondary_provider_builder.h"
 #include "provisioner.h"
 #include "reportqueue.h"
@@ -30,8 +41,13 @@
 #include "uptane/imagerepository.h"
 #include "uptane/iterator.h"
 #include "uptane/manifest.h"
+#include "uptane/offline_bundle.h"
 #include "uptane/tuf.h"
+#include "utilities/allocation_accounting.h"
 #include "utilities/flow_control.h"
+#include "utilities/progress_aggregator.h"
+#include "utilities/tracing.h"
+#include "utilities/utils.h"
 
 class SotaUptaneClient {
  public:
@@ -57,7 +73,12 @@ class SotaUptaneClient {
                    std::shared_ptr<event::Channel> events_channel_in, const api::FlowControlToken *flow_control);
 
   SotaUptaneClient(Config &config_in, const std::shared_ptr<INvStorage> &storage_in)
-      : SotaUptaneClient(config_in, storage_in, std::make_shared<HttpClient>(), nullptr, nullptr) {}
+      : SotaUptaneClient(config_in, storage_in, std::make_shared<HttpClient>(config_in.network), nullptr, nullptr) {}
+  ~SotaUptaneClient();
+  SotaUptaneClient(const SotaUptaneClient &) = delete;
+  SotaUptaneClient(SotaUptaneClient &&) = delete;
+  SotaUptaneClient &operator=(const SotaUptaneClient &) = delete;
+  SotaUptaneClient &operator=(SotaUptaneClient &&) = delete;
 
   void initialize();
   void addSecondary(const std::shared_ptr<SecondaryInterface> &sec);
@@ -73,10 +94,25 @@ class SotaUptaneClient {
 
   /** See Aktualizr::SetCustomHardwareInfo(Json::Value) */
   void setCustomHardwareInfo(Json::Value hwinfo) { custom_hardware_info_ = std::move(hwinfo); }
+  /** See Aktualizr::SetTargetConsumer() */
+  void setTargetConsumer(const std::string &type, TargetConsumer consumer);
   void reportPause();
   void reportResume();
   void sendDeviceData();
+  /** Report the device data of these kinds again, where they have changed. */
+  void reportDeviceData(const std::vector<DeviceDataKind> &kinds);
+  /** The number of installations that completed since the start. */
+  uint64_t installsCompleted() const { return installs_completed_; }
   result::UpdateCheck fetchMeta();
+  /**
+   * Check with a single conditional request whether the Director has new
+   * Targets metadata, without verifying or storing anything.
+   * @return false if it is unchanged; true if it changed or could not be
+   *         checked, so that a full update check should follow
+   */
+  bool directorTargetsChanged();
+  /** See Aktualizr::CheckUpdatesFromBundle() */
+  result::UpdateCheck checkUpdatesFromBundle(const boost::filesystem::path &bundle);
   bool putManifest(const Json::Value &custom = Json::nullValue);
   result::Install uptaneInstall(const std::vector<Uptane::Target> &updates);
   result::CampaignCheck campaignCheck();
@@ -84,11 +120,21 @@ class SotaUptaneClient {
   void campaignDecline(const std::string &campaign_id);
   void campaignPostpone(const std::string &campaign_id);
   bool hasPendingUpdates() const;
+  bool isProvisioned() const { return provisioner_.CurrentState() == Provisioner::State::kOk; }
+  /** Time left before the server accepts requests again, see HttpInterface::retryAfter() */
+  std::chrono::milliseconds serverRetryAfter() const { return http->retryAfter(); }
+  void reportNextPoll(std::chrono::milliseconds delay);
+  /** When the first of the verified Uptane metadata expires, invalid if none was verified */
+  TimeStamp nextMetadataExpiry() const {
+    return TimeStamp::Earliest(director_repo.nextExpiry(), image_repo.nextExpiry());
+  }
+  void reportCycleIo(const IoTotals &io);
   bool isInstallCompletionRequired();
   void completeInstall();
   std::vector<Uptane::Target> getStoredTargets() const { return package_manager_->getTargetFiles(); }
   void deleteStoredTarget(const Uptane::Target &target) { package_manager_->removeTargetFile(target); }
   std::ifstream openStoredTarget(const Uptane::Target &target);
+  int openStoredTargetFd(const Uptane::Target &target);
 
  private:
   FRIEND_TEST(Aktualizr, FullNoUpdates);
@@ -105,12 +151,15 @@ class SotaUptaneClient {
   FRIEND_TEST(Aktualizr, DownloadNonOstreeBin);
   FRIEND_TEST(Uptane, AssembleManifestGood);
   FRIEND_TEST(Uptane, AssembleManifestBad);
+  FRIEND_TEST(Uptane, AssembleManifestTimeout);
   FRIEND_TEST(Uptane, InstallFakeGood);
   FRIEND_TEST(Uptane, restoreVerify);
   FRIEND_TEST(Uptane, PutManifest);
+  FRIEND_TEST(Uptane, PutManifestUnchanged);
   FRIEND_TEST(Uptane, offlineIteration);
   FRIEND_TEST(Uptane, IgnoreUnknownUpdate);
   FRIEND_TEST(Uptane, kRejectAllTest);
+  FRIEND_TEST(Uptane, WaitSecondariesReachable);
   FRIEND_TEST(UptaneCI, ProvisionAndPutManifest);
   FRIEND_TEST(UptaneCI, CheckKeys);
   FRIEND_TEST(UptaneKey, Check);  // Note hacky name
@@ -123,6 +172,8 @@ class SotaUptaneClient {
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationAfterInstallationAndBeforeReboot);
   FRIEND_TEST(MetadataExpirationTest, MetadataExpirationBeforeInstallation);
   FRIEND_TEST(Delegation, IterateAll);
+  FRIEND_TEST(Delegation, IterateAhead);
+  FRIEND_TEST(Delegation, PruneStored);
 
   /**
    * This operation requires that the device is provisioned.
@@ -140,9 +191,24 @@ class SotaUptaneClient {
 
   data::InstallationResult PackageInstall(const Uptane::Target &target);
   std::pair<bool, Uptane::Target> downloadImage(const Uptane::Target &target);
-  void uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count);
+  void requestSecondaryManifests();
+  // Digest of what a manifest reports, without what changes on every manifest
+  static std::string manifestDigest(const Json::Value &manifest);
+  // Start streaming target to its Secondaries that support it, empty if none does
+  DownloadTee streamToSecondaries(const Uptane::Target &target);
+  // The consumer of the application for a binary target of the Primary alone, if any
+  TargetConsumer targetConsumer(const Uptane::Target &target);
+  // Start downloading the binary targets in the background, with uptane.prefetch
+  void prefetchImages(const std::vector<Uptane::Target> &targets);
+  void runPrefetch(const std::vector<Uptane::Target> &targets, const api::FlowControlToken *token);
+  // Stop the prefetch in progress and wait for it. With discard, what it
+  // downloaded is removed, unless the image cache keeps it within its budget.
+  void stopPrefetch(bool discard);
+  // The metadata is fetched from the server, unless fetcher is given.
+  void uptaneIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count,
+                       const Uptane::IMetadataFetcher *fetcher = nullptr);
   void uptaneOfflineIteration(std::vector<Uptane::Target> *targets, unsigned int *ecus_count);
-  result::UpdateCheck checkUpdates();
+  result::UpdateCheck checkUpdates(const Uptane::IMetadataFetcher *fetcher = nullptr);
   result::UpdateStatus checkUpdatesOffline(const std::vector<Uptane::Target> &targets);
   Json::Value AssembleManifest();
   std::exception_ptr getLastException() const { return last_exception; }
@@ -153,26 +219,38 @@ class SotaUptaneClient {
   data::InstallationResult PackageInstallSetResult(const Uptane::Target &target,
                                                    const Uptane::CorrelationId &correlation_id);
   void finalizeAfterReboot();
-  // Part of sendDeviceData()
-  void reportHwInfo();
+  // Part of sendDeviceData(). The default hardware information is only
+  // reported once, unless again, when it is collected again.
+  void reportHwInfo(std::chrono::milliseconds wait, bool again = false);
   // Part of sendDeviceData()
   void reportInstalledPackages();
   // Called by sendDeviceData() and fetchMeta()
   void reportNetworkInfo();
   // Part of sendDeviceData()
   void reportAktualizrConfiguration();
+  // Recheck the downloaded images of the updates, all at once, before installing them
+  bool verifyDownloadedTargets(const std::vector<Uptane::Target> &updates, const Uptane::EcuSerial &primary_ecu_serial);
   bool waitSecondariesReachable(const std::vector<Uptane::Target> &updates);
   void storeInstallationFailure(const data::InstallationResult &result);
   data::InstallationResult rotateSecondaryRoot(Uptane::RepositoryType repo, SecondaryInterface &secondary);
+  // Rotate the Roots of a Secondary and send it the metadata of a Target
+  data::InstallationResult sendMetadata(SecondaryInterface &secondary, const Uptane::Target &target);
   void sendMetadataToEcus(const std::vector<Uptane::Target> &targets, data::InstallationResult *result,
                           std::string *raw_installation_report);
-  std::future<data::InstallationResult> sendFirmwareAsync(SecondaryInterface &secondary, const Uptane::Target &target);
+  // Send a Target to a Secondary, counted in *progress until it is installed
+  data::InstallationResult sendFirmware(SecondaryInterface &secondary, const Uptane::Target &target,
+                                        std::unique_ptr<ProgressAggregator::Transfer> *progress);
+  // Install a Target on a Secondary if sending it was successful, and report the result
+  data::InstallationResult installFirmware(SecondaryInterface &secondary, const Uptane::Target &target,
+                                           data::InstallationResult result, ProgressAggregator::Transfer *progress);
   std::vector<result::Install::EcuReport> sendImagesToEcus(const std::vector<Uptane::Target> &targets);
+  // Send each image needed by several Secondaries to all of them from a single read, before their own transfers
+  void fanOutImages(const std::vector<Uptane::Target> &targets);
 
   bool putManifestSimple(const Json::Value &custom = Json::nullValue);
   void getNewTargets(std::vector<Uptane::Target> *new_targets, unsigned int *ecus_count = nullptr);
-  void updateDirectorMeta();
-  void updateImageMeta();
+  void updateDirectorMeta(const Uptane::IMetadataFetcher &fetcher);
+  void updateImageMeta(const Uptane::IMetadataFetcher &fetcher);
   void checkDirectorMetaOffline();
   void checkImageMetaOffline();
 
@@ -181,17 +259,30 @@ class SotaUptaneClient {
   std::unique_ptr<Uptane::Target> findTargetHelper(const Uptane::Targets &cur_targets,
                                                    const Uptane::Target &queried_target, int level, bool terminating,
                                                    bool offline);
+  std::shared_ptr<const Uptane::Targets> trustedDelegation(const Uptane::Role &delegate_role,
+                                                           const Uptane::Targets &parent_targets, bool offline);
   Uptane::LazyTargetsList allTargets() const;
   void checkAndUpdatePendingSecondaries();
   Uptane::EcuSerial primaryEcuSerial() { return provisioner_.PrimaryEcuSerial(); }
   boost::optional<Uptane::HardwareIdentifier> getEcuHwId(const Uptane::EcuSerial &serial);
 
+  // Sends TransferProgressReport events, and logs the progress now and then
+  ProgressAggregator::Callback transferProgressReporter(const std::string &description);
+
   template <class T, class... Args>
   void sendEvent(Args &&...args) {
+    const AllocationAccounting::Scope accounting(AllocationTag::kEvents);
     std::shared_ptr<event::BaseEvent> event = std::make_shared<T>(std::forward<Args>(args)...);
+    if (event_dispatcher_) {
+      event_dispatcher_->dispatch(std::move(event));
+      return;
+    }
+    // Parallel downloads emit events from several threads; keep handlers serialized.
+    std::lock_guard<std::recursive_mutex> guard(events_mutex_);
     if (events_channel) {
       (*events_channel)(std::move(event));
-    } else if (!event->isTypeOf<event::DownloadProgressReport>()) {
+    } else if (!event->isTypeOf<event::DownloadProgressReport>() &&
+               !event->isTypeOf<event::TransferProgressReport>()) {
       LOG_INFO << "got " << event->variant << " event";
     }
   }
@@ -205,16 +296,64 @@ class SotaUptaneClient {
   std::shared_ptr<PackageManagerInterface> package_manager_;
   std::shared_ptr<KeyManager> key_manager_;
   std::shared_ptr<Uptane::Fetcher> uptane_fetcher;
+  // Bundle of the last update check, if it was offline, to take the targets
+  // from. Set and used by the commands of the API queue, which run one at a
+  // time.
+  std::shared_ptr<const Uptane::OfflineBundle> offline_bundle_;
   std::unique_ptr<ReportQueue> report_queue;
   std::shared_ptr<SecondaryProvider> secondary_provider_;
   std::shared_ptr<event::Channel> events_channel;
   std::exception_ptr last_exception;
   // ecu_serial => secondary*
   std::map<Uptane::EcuSerial, SecondaryInterface::Ptr> secondaries;
+  // Manifests being requested from the Secondaries, kept across calls of
+  // AssembleManifest() for the Secondaries that didn't answer in time
+  std::map<Uptane::EcuSerial, std::future<Uptane::Manifest>> manifest_requests_;
+  // Digest of the last manifest accepted by the Director, and when it was sent
+  std::string last_manifest_digest_;
+  std::chrono::steady_clock::time_point last_manifest_put_;
+#ifdef BUILD_MINIMAL
+  // Only the custom hardware information is reported.
+  DeviceDataCollector hardware_info_{"hardware information", []() { return Json::Value(); }};
+#else
+  DeviceDataCollector hardware_info_{"hardware information", &Utils::getHardwareInfo};
+#endif
+  // Cleared when the server doesn't accept the changes of the installed packages
+  std::atomic<bool> packages_delta_supported_{true};
+  std::atomic<uint64_t> installs_completed_{0};
   std::mutex download_mutex;
+  std::mutex last_exception_mutex_;
+  std::recursive_mutex events_mutex_;
+  // Delegations verified for the Image repo Targets metadata in delegations_parent_
+  std::mutex delegations_mutex_;
+  std::shared_ptr<const Uptane::Targets> delegations_parent_;
+  std::map<Uptane::Role, std::shared_ptr<const Uptane::Targets>> delegations_;
   Provisioner provisioner_;
   Json::Value custom_hardware_info_{Json::nullValue};
+  // Target type => consumer streamed its targets instead of storing them
+  std::mutex target_consumers_mutex_;
+  std::map<std::string, TargetConsumer> target_consumers_;
   const api::FlowControlToken *flow_control_;
+  Tracer tracer_;
+  // Last list of campaigns, validated with the server after
+  // uptane.campaign_cache_ttl_sec and when a campaign is acted upon
+  campaign::CampaignCache campaigns_;
+  // Progress of all the downloads, and of the installations on Secondaries,
+  // if uptane.transfer_progress_interval_ms is set
+  std::shared_ptr<ProgressAggregator> download_progress_;
+  std::unique_ptr<ProgressAggregator> install_progress_;
+  // Serves the stored targets to peers, with pacman.peer_server_port
+  std::unique_ptr<PeerServer> peer_server_;
+  // Background download of the targets of the last update check, with uptane.prefetch
+  std::mutex prefetch_mutex_;
+  std::thread prefetch_thread_;
+  std::unique_ptr<api::FlowControlToken> prefetch_token_;
+  std::shared_ptr<BandwidthShaper> prefetch_shaper_;
+  // The targets of the prefetch, and those of them it started to download
+  std::vector<Uptane::Target> prefetch_targets_;
+  std::vector<Uptane::Target> prefetched_;
+  // Declared last so that the queued events are delivered first on destruction
+  std::unique_ptr<EventDispatcher> event_dispatcher_;
 };
 
 #endif  // SOTA_UPTANE_CLIENT_H_
@@ -0,0 +1,140 @@
+#include "primary/transfer_scheduler.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <list>
+#include <mutex>
+#include <numeric>
+#include <utility>
+
+#include <boost/algorithm/string.hpp>
+
+#include "libaktualizr/config.h"
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/executor.h"
+#include "utilities/load_admission.h"
+
+TransferScheduler::TransferScheduler(size_t max_parallel, std::map<std::string, size_t> type_limits,
+                                     bool largest_first)
+    : max_parallel_{max_parallel}, type_limits_{std::move(type_limits)}, largest_first_{largest_first} {}
+
+TransferScheduler::TransferScheduler(const UptaneConfig& config)
+    : TransferScheduler(static_cast<size_t>(config.max_parallel_secondary_transfers),
+                        parseTypeLimits(config.secondary_transfer_limits),
+                        config.secondary_transfer_order == "largest_first") {
+  if (config.secondary_transfer_order != "largest_first" && config.secondary_transfer_order != "director") {
+    LOG_WARNING << "Unknown secondary_transfer_order " << config.secondary_transfer_order
+                << ", the order of the Director is used";
+  }
+}
+
+std::map<std::string, size_t> TransferScheduler::parseTypeLimits(const std::string& limits) {
+  std::map<std::string, size_t> result;
+  std::vector<std::string> entries;
+  boost::split(entries, limits, boost::is_any_of(","));
+  for (auto& entry : entries) {
+    boost::trim(entry);
+    if (entry.empty()) {
+      continue;
+    }
+    const auto colon = entry.rfind(':');
+    try {
+      if (colon == std::string::npos || colon == 0) {
+        throw std::invalid_argument("no type");
+      }
+      result[boost::trim_copy(entry.substr(0, colon))] = std::stoul(entry.substr(colon + 1));
+    } catch (const std::exception&) {
+      LOG_WARNING << "Ignoring malformed Secondary transfer limit: " << entry;
+    }
+  }
+  return result;
+}
+
+std::vector<TransferScheduler::Timing> TransferScheduler::run(const std::vector<Transfer>& transfers) const {
+  using Clock = std::chrono::steady_clock;
+
+  // Indices of the transfers not started yet, in the order they should start
+  std::vector<size_t> order(transfers.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(), [this, &transfers](size_t a, size_t b) {
+    if (transfers[a].critical != transfers[b].critical) {
+      return transfers[a].critical;
+    }
+    return largest_first_ && transfers[a].size > transfers[b].size;
+  });
+  std::list<size_t> pending(order.begin(), order.end());
+
+  std::mutex mutex;
+  std::condition_variable finished;
+  size_t active = 0;
+  std::map<std::string, size_t> active_per_type;
+  std::vector<Timing> timings(transfers.size());
+  std::vector<std::future<void>> workers;
+  workers.reserve(transfers.size());
+  const auto queued_at = Clock::now();
+
+  auto has_room = [this, &active_per_type](const std::string& type) {
+    const auto limit = type_limits_.find(type);
+    return limit == type_limits_.end() || limit->second == 0 || active_per_type[type] < limit->second;
+  };
+
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!pending.empty()) {
+    auto next = pending.end();
+    if (max_parallel_ == 0 || active < max_parallel_) {
+      next = std::find_if(pending.begin(), pending.end(),
+                          [&transfers, &has_room](size_t i) { return has_room(transfers[i].type); });
+    }
+    if (next == pending.end()) {
+      finished.wait(lock);
+      continue;
+    }
+
+    const size_t i = *next;
+    pending.erase(next);
+    ++active;
+    ++active_per_type[transfers[i].type];
+    timings[i].queued = Clock::now() - queued_at;
+    // The blocking pool never runs a task on the calling thread, which holds the lock here.
+    workers.push_back(Executor::blocking().submit([&, i]() {
+      const BackgroundScheduling::Thread background;
+      LoadAdmission::admit(LoadAdmission::Work::kSecondaryTransfer);
+      const auto started_at = Clock::now();
+      std::exception_ptr error;
+      try {
+        transfers[i].send();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        timings[i].sending = Clock::now() - started_at;
+        --active;
+        --active_per_type[transfers[i].type];
+      }
+      finished.notify_one();
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }));
+  }
+  lock.unlock();
+
+  std::exception_ptr error;
+  for (auto& worker : workers) {
+    try {
+      worker.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return timings;
+}
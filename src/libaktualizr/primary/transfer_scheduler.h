@@ -0,0 +1,61 @@
+#ifndef TRANSFER_SCHEDULER_H_
+#define TRANSFER_SCHEDULER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+struct UptaneConfig;
+
+/**
+ * Runs the firmware transfers to the Secondaries on their own threads, with a
+ * limit on the number of transfers at the same time, overall and per type of
+ * Secondary.
+ *
+ * Transfers to critical ECUs start first, the others in the order they were
+ * given or largest first. A transfer that has to wait for a busy type lets
+ * the next ones of other types start.
+ */
+class TransferScheduler {
+ public:
+  struct Transfer {
+    // Type of the Secondary, as given by SecondaryInterface::Type()
+    std::string type;
+    uint64_t size{0};
+    bool critical{false};
+    std::function<void()> send;
+  };
+
+  struct Timing {
+    std::chrono::steady_clock::duration queued{};
+    std::chrono::steady_clock::duration sending{};
+  };
+
+  /**
+   * @param max_parallel maximum number of transfers at the same time, 0 for no limit
+   * @param type_limits maximum number of transfers at the same time per Secondary type
+   */
+  TransferScheduler(size_t max_parallel, std::map<std::string, size_t> type_limits, bool largest_first);
+  /** Use the secondary_transfer_* options of the config. */
+  explicit TransferScheduler(const UptaneConfig& config);
+
+  /**
+   * Run all the transfers and wait for them to finish. An exception thrown by
+   * a transfer is thrown again once they are all finished.
+   * @return how long each transfer was queued and sending, in the order of transfers
+   */
+  std::vector<Timing> run(const std::vector<Transfer>& transfers) const;
+
+  /** Parse limits given as "type:limit,type:limit". Malformed entries are skipped with a warning. */
+  static std::map<std::string, size_t> parseTypeLimits(const std::string& limits);
+
+ private:
+  size_t max_parallel_;
+  std::map<std::string, size_t> type_limits_;
+  bool largest_first_;
+};
+
+#endif  // TRANSFER_SCHEDULER_H_
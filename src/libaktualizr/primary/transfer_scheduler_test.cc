@@ -0,0 +1,142 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "primary/transfer_scheduler.h"
+
+namespace {
+
+// Counts the transfers running at the same time, overall and per type.
+class Tracker {
+ public:
+  std::function<void()> transfer(const std::string &type) {
+    return [this, type]() {
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        max_active_ = std::max(max_active_, ++active_);
+        max_active_per_type_[type] = std::max(max_active_per_type_[type], ++active_per_type_[type]);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      std::lock_guard<std::mutex> guard(mutex_);
+      --active_;
+      --active_per_type_[type];
+    };
+  }
+
+  size_t max_active() const { return max_active_; }
+  size_t max_active(const std::string &type) { return max_active_per_type_[type]; }
+
+ private:
+  std::mutex mutex_;
+  size_t active_{0};
+  size_t max_active_{0};
+  std::map<std::string, size_t> active_per_type_;
+  std::map<std::string, size_t> max_active_per_type_;
+};
+
+}  // namespace
+
+/* No more transfers run at the same time than allowed, overall and per type. */
+TEST(TransferScheduler, Limits) {
+  Tracker tracker;
+  std::vector<TransferScheduler::Transfer> transfers;
+  for (int i = 0; i < 6; ++i) {
+    transfers.push_back({"IP", 1, false, tracker.transfer("IP")});
+    transfers.push_back({"virtual", 1, false, tracker.transfer("virtual")});
+  }
+
+  const auto timings = TransferScheduler(3, {{"IP", 1}}, false).run(transfers);
+  EXPECT_EQ(tracker.max_active(), 3U);
+  EXPECT_EQ(tracker.max_active("IP"), 1U);
+  EXPECT_EQ(tracker.max_active("virtual"), 2U);
+  ASSERT_EQ(timings.size(), transfers.size());
+  for (const auto &timing : timings) {
+    EXPECT_GE(timing.sending, std::chrono::milliseconds(20));
+  }
+  // The last IP transfer waits for the five others.
+  EXPECT_GE(timings[10].queued, std::chrono::milliseconds(100));
+
+  Tracker unlimited;
+  transfers.clear();
+  for (int i = 0; i < 4; ++i) {
+    transfers.push_back({"IP", 1, false, unlimited.transfer("IP")});
+  }
+  TransferScheduler(0, {{"IP", 0}}, false).run(transfers);
+  EXPECT_EQ(unlimited.max_active(), 4U);
+}
+
+/* Critical ECUs come first, then the largest images if requested, otherwise the given order. */
+TEST(TransferScheduler, Order) {
+  std::vector<int> started;
+  auto transfer = [&started](int id) { return [&started, id]() { started.push_back(id); }; };
+  const std::vector<TransferScheduler::Transfer> transfers{{"IP", 10, false, transfer(0)},
+                                                           {"IP", 30, false, transfer(1)},
+                                                           {"IP", 20, true, transfer(2)},
+                                                           {"IP", 40, false, transfer(3)},
+                                                           {"IP", 5, true, transfer(4)}};
+
+  TransferScheduler(1, {}, false).run(transfers);
+  EXPECT_EQ(started, std::vector<int>({2, 4, 0, 1, 3}));
+
+  started.clear();
+  TransferScheduler(1, {}, true).run(transfers);
+  EXPECT_EQ(started, std::vector<int>({2, 4, 3, 1, 0}));
+}
+
+/* A transfer waiting for its type lets the transfers of other types start. */
+TEST(TransferScheduler, BusyType) {
+  std::mutex mutex;
+  std::vector<std::string> started;
+  auto transfer = [&](const std::string &name) {
+    return [&, name]() {
+      {
+        std::lock_guard<std::mutex> guard(mutex);
+        started.push_back(name);
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    };
+  };
+  const std::vector<TransferScheduler::Transfer> transfers{
+      {"IP", 1, false, transfer("ip1")}, {"IP", 1, false, transfer("ip2")}, {"virtual", 1, false, transfer("v1")}};
+
+  TransferScheduler(2, {{"IP", 1}}, false).run(transfers);
+  ASSERT_EQ(started.size(), 3U);
+  EXPECT_EQ(started[2], "ip2");
+}
+
+/* An exception of a transfer is thrown once all the transfers are done. */
+TEST(TransferScheduler, Exception) {
+  std::atomic<int> done{0};
+  const std::vector<TransferScheduler::Transfer> transfers{
+      {"IP", 1, false, []() { throw std::runtime_error("failed"); }},
+      {"IP", 1, false,
+       [&done]() {
+         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+         ++done;
+       }}};
+  EXPECT_THROW(TransferScheduler(0, {}, false).run(transfers), std::runtime_error);
+  EXPECT_EQ(done, 1);
+}
+
+TEST(TransferScheduler, ParseTypeLimits) {
+  const std::map<std::string, size_t> expected{{"IP", 2}, {"virtual", 8}};
+  EXPECT_EQ(TransferScheduler::parseTypeLimits("IP:2, virtual : 8"), expected);
+  EXPECT_EQ(TransferScheduler::parseTypeLimits("IP:2,:3,bad,x:y,virtual:8,"), expected);
+  EXPECT_TRUE(TransferScheduler::parseTypeLimits("").empty());
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,66 @@
+#include "primary/update_notifier.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "http/httpinterface.h"
+#include "logging/logging.h"
+
+UpdateNotifier::UpdateNotifier(std::shared_ptr<HttpInterface> http, std::string url, std::function<void()> notify,
+                               std::chrono::milliseconds retry_delay, std::chrono::milliseconds max_retry_delay)
+    : http_{std::move(http)},
+      url_{std::move(url)},
+      notify_{std::move(notify)},
+      retry_delay_{retry_delay},
+      max_retry_delay_{max_retry_delay},
+      thread_{[this]() { run(); }} {}
+
+UpdateNotifier::~UpdateNotifier() { stop(); }
+
+void UpdateNotifier::stop() {
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    stopped_ = true;
+  }
+  token_.setAbort();
+  stopped_cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool UpdateNotifier::waitFor(std::chrono::steady_clock::duration duration) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return stopped_cv_.wait_for(lock, duration, [this]() { return stopped_; });
+}
+
+void UpdateNotifier::run() {
+  LOG_INFO << "Waiting for update notifications from " << url_;
+  auto delay = retry_delay_;
+  while (!token_.hasAborted()) {
+    const auto started = std::chrono::steady_clock::now();
+    const HttpResponse response = http_->get(url_, kMaxNotificationSize, &token_);
+    if (token_.hasAborted()) {
+      break;
+    }
+    if (response.isOk()) {
+      delay = retry_delay_;
+      if (response.http_status_code == 200) {
+        LOG_DEBUG << "Update notification received";
+        notify_();
+      }
+      // A server that answers right away isn't asked more often than this.
+      if (waitFor(retry_delay_ - (std::chrono::steady_clock::now() - started))) {
+        break;
+      }
+      continue;
+    }
+
+    LOG_WARNING << "Update notification request failed: " << response.getStatusStr() << ", retrying in "
+                << std::chrono::duration_cast<std::chrono::seconds>(delay).count() << " s";
+    if (waitFor(delay)) {
+      break;
+    }
+    delay = std::min(delay * 2, max_retry_delay_);
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef UPDATE_NOTIFIER_H_
+#define UPDATE_NOTIFIER_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "utilities/flow_control.h"
+
+class HttpInterface;
+
+/**
+ * Waits on its own thread for the server to announce new updates, so that
+ * RunForever() can check for them right away instead of at the next poll.
+ *
+ * The notification URL is requested with a long-poll GET: the server keeps
+ * the request open until something changed for the device, then answers with
+ * the status 200. Any other successful status, e.g. 204 once the server gave
+ * up waiting, just starts a new request. Requests are at least retry_delay
+ * apart, and after an error the delay doubles for each error in a row.
+ */
+class UpdateNotifier {
+ public:
+  UpdateNotifier(std::shared_ptr<HttpInterface> http, std::string url, std::function<void()> notify,
+                 std::chrono::milliseconds retry_delay = std::chrono::seconds(10),
+                 std::chrono::milliseconds max_retry_delay = std::chrono::minutes(10));
+  ~UpdateNotifier();
+  UpdateNotifier(const UpdateNotifier&) = delete;
+  UpdateNotifier(UpdateNotifier&&) = delete;
+  UpdateNotifier& operator=(const UpdateNotifier&) = delete;
+  UpdateNotifier& operator=(UpdateNotifier&&) = delete;
+
+  /** Abort the pending request and wait for the thread to end. */
+  void stop();
+
+  static constexpr int64_t kMaxNotificationSize = 64L * 1024;
+
+ private:
+  void run();
+  // Return true if stopped in the meantime
+  bool waitFor(std::chrono::steady_clock::duration duration);
+
+  std::shared_ptr<HttpInterface> http_;
+  const std::string url_;
+  const std::function<void()> notify_;
+  const std::chrono::milliseconds retry_delay_;
+  const std::chrono::milliseconds max_retry_delay_;
+  // Aborts the pending request
+  api::FlowControlToken token_;
+  std::mutex mutex_;
+  std::condition_variable stopped_cv_;
+  bool stopped_{false};
+  std::thread thread_;
+};
+
+#endif  // UPDATE_NOTIFIER_H_
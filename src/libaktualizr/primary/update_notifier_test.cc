@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "httpfake.h"
+#include "primary/update_notifier.h"
+#include "utilities/utils.h"
+
+/* Answers with the given statuses, then keeps the request open until it is aborted. */
+class HttpFakeNotification : public HttpFake {
+ public:
+  HttpFakeNotification(const boost::filesystem::path &test_dir_in, std::deque<long> statuses)  // NOLINT
+      : HttpFake(test_dir_in), statuses_{std::move(statuses)}, repeat_{false} {}
+
+  HttpResponse get(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control) override {
+    (void)maxsize;
+    EXPECT_EQ(url, "https://notify.example.com/device");
+    ++requests;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (!statuses_.empty()) {
+        const long status = statuses_.front();  // NOLINT(google-runtime-int)
+        if (!repeat_) {
+          statuses_.pop_front();
+        }
+        return HttpResponse("", status, CURLE_OK, "");
+      }
+    }
+    while (flow_control == nullptr || !flow_control->hasAborted()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return HttpResponse("", 0, CURLE_ABORTED_BY_CALLBACK, "Aborted");
+  }
+
+  void repeat() { repeat_ = true; }
+
+  std::atomic<int> requests{0};
+
+ private:
+  std::mutex mutex_;
+  std::deque<long> statuses_;  // NOLINT(google-runtime-int)
+  std::atomic<bool> repeat_;
+};
+
+class NotifyCounter {
+ public:
+  void operator()() {
+    std::lock_guard<std::mutex> guard(m);
+    ++count;
+    cv.notify_all();
+  }
+  bool waitFor(int expected) {
+    std::unique_lock<std::mutex> lock(m);
+    return cv.wait_for(lock, std::chrono::seconds(10), [this, expected]() { return count >= expected; });
+  }
+
+  std::mutex m;
+  std::condition_variable cv;
+  int count{0};
+};
+
+/* Each answer with the status 200 is a notification, other successful answers just start a new request. */
+TEST(UpdateNotifier, Notify) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeNotification>(temp_dir.Path(), std::deque<long>{200, 204, 200});  // NOLINT
+  NotifyCounter counter;
+  UpdateNotifier notifier(http, "https://notify.example.com/device", [&counter]() { counter(); },
+                          std::chrono::milliseconds(1));
+  EXPECT_TRUE(counter.waitFor(2));
+  while (http->requests < 4) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  // The open request is aborted
+  const auto started = std::chrono::steady_clock::now();
+  notifier.stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+  EXPECT_EQ(counter.count, 2);
+}
+
+/* Stopping doesn't wait for the delay after an error. */
+TEST(UpdateNotifier, StopAfterError) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeNotification>(temp_dir.Path(), std::deque<long>{500});  // NOLINT
+  NotifyCounter counter;
+  UpdateNotifier notifier(http, "https://notify.example.com/device", [&counter]() { counter(); },
+                          std::chrono::hours(1), std::chrono::hours(1));
+  while (http->requests < 1) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  const auto started = std::chrono::steady_clock::now();
+  notifier.stop();
+  EXPECT_LT(std::chrono::steady_clock::now() - started, std::chrono::seconds(5));
+  EXPECT_EQ(http->requests, 1);
+  EXPECT_EQ(counter.count, 0);
+}
+
+/* A server that answers right away isn't flooded with requests. */
+TEST(UpdateNotifier, RequestInterval) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFakeNotification>(temp_dir.Path(), std::deque<long>{204});  // NOLINT
+  http->repeat();
+  NotifyCounter counter;
+  UpdateNotifier notifier(http, "https://notify.example.com/device", [&counter]() { counter(); },
+                          std::chrono::milliseconds(100));
+  std::this_thread::sleep_for(std::chrono::milliseconds(350));
+  notifier.stop();
+  EXPECT_GE(http->requests, 1);
+  EXPECT_LE(http->requests, 5);
+  EXPECT_EQ(counter.count, 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
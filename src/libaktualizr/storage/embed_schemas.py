@@ -16,23 +16,27 @@ def escape_string(sql):
     return sql.translate(str.maketrans({'"':  r'\"', '\n':  '\\n'}))
 
 
-def apend_migration(migration_path, header_file):
+def apend_migration(migration_path, header_file, skip=False):
     migration_file = open(migration_path, 'r')
     header_file.write("\"")
     migration_content = migration_file.read()
-    header_file.write(escape_string(migration_content))
+    if not skip:
+        header_file.write(escape_string(migration_content))
 
 
 if __name__ == '__main__':
-    if len(sys.argv) != 4:
+    if len(sys.argv) not in (4, 5):
         print("\nIncorrect arguments")
-        print("Usage:\n {} {} {} {}\n".format(sys.argv[0], "folder_with_schemas",
-                                              "generated_file_path", "name_prefix"))
+        print("Usage:\n {} {} {} {} [{}]\n".format(sys.argv[0], "folder_with_schemas",
+                                                   "generated_file_path", "name_prefix", "oldest_migrated_version"))
         sys.exit(-1)
 
     sql_folder = sys.argv[1]
     schemas_header = sys.argv[2]
     prefix = sys.argv[3]
+    # A database older than this version can't be migrated: the migrations to
+    # the versions up to it are left out, empty. 0 keeps them all.
+    oldest_version = int(sys.argv[4]) if len(sys.argv) == 5 else 0
     migration_folder = os.path.join(sql_folder, 'migration')
     rollback_folder = os.path.join(sql_folder, 'rollback')
     migration_list = sorted(os.listdir(migration_folder))
@@ -43,7 +47,8 @@ if __name__ == '__main__':
         out_text.write(heading_text)
         out_text.write("extern const std::vector<std::string> {}_schema_migrations = {{".format(prefix))
         for migration in migration_list[:-1]:
-            apend_migration(os.path.join(migration_folder, migration), out_text)
+            version = int(migration.split(".")[1])
+            apend_migration(os.path.join(migration_folder, migration), out_text, 0 < version <= oldest_version)
             out_text.write("\",\n")
         apend_migration(os.path.join(migration_folder, migration_list[-1]), out_text)
         out_text.write("\"\n};\n")
@@ -1,15 +1,59 @@
 #include "invstorage.h"
 
+#include <sys/stat.h>
 #include <unistd.h>
 #include <boost/filesystem.hpp>
+#include <sstream>
 
 #include "crypto/crypto.h"
 #include "fsstorage_read.h"
 #include "logging/logging.h"
 #include "sqlstorage.h"
 #include "uptane/exceptions.h"
+#include "utilities/timer.h"
 #include "utilities/utils.h"
 
+namespace {
+
+// Identifies the version of a file and the stored content it matched, empty if the file can't be found.
+std::string importFingerprint(const boost::filesystem::path& path, const std::string& content) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    return "";
+  }
+  std::ostringstream fingerprint;
+  fingerprint << st.st_dev << ':' << st.st_ino << ':' << st.st_size << ':' << st.st_mtim.tv_sec << '.'
+              << st.st_mtim.tv_nsec << ':' << st.st_ctim.tv_sec << '.' << st.st_ctim.tv_nsec << ':'
+              << Crypto::sha256digestHex(content);
+  return fingerprint.str();
+}
+
+}  // namespace
+
+bool INvStorage::importedFileChanged(const boost::filesystem::path& path, const std::string& stored_content,
+                                     std::string* content) {
+  const std::string fingerprint = importFingerprint(path, stored_content);
+  std::string recorded;
+  if (!fingerprint.empty() && loadImportFingerprint(path.string(), &recorded) && recorded == fingerprint) {
+    return false;
+  }
+  *content = Utils::readFile(path.string());
+  if (*content != stored_content) {
+    return true;
+  }
+  if (!fingerprint.empty()) {
+    storeImportFingerprint(path.string(), fingerprint);
+  }
+  return false;
+}
+
+void INvStorage::recordImportedFile(const boost::filesystem::path& path, const std::string& content) {
+  const std::string fingerprint = importFingerprint(path, content);
+  if (!fingerprint.empty()) {
+    storeImportFingerprint(path.string(), fingerprint);
+  }
+}
+
 void INvStorage::importUpdateSimple(const boost::filesystem::path& base_path, store_data_t store_func,
                                     load_data_t load_func, const utils::BasedPath& imported_data_path,
                                     const std::string& data_name) {
@@ -19,10 +63,7 @@ void INvStorage::importUpdateSimple(const boost::filesystem::path& base_path, st
   if (!(this->*load_func)(&prev_content)) {
     update = true;
   } else if (!imported_data_path.empty()) {
-    content = Utils::readFile(imported_data_path.get(base_path).string());
-    if (Crypto::sha256digest(content) != Crypto::sha256digest(prev_content)) {
-      update = true;
-    }
+    update = importedFileChanged(imported_data_path.get(base_path), prev_content, &content);
   }
 
   if (update && !imported_data_path.empty()) {
@@ -35,6 +76,7 @@ void INvStorage::importUpdateSimple(const boost::filesystem::path& base_path, st
       content = Utils::readFile(abs_path.string());
     }
     (this->*store_func)(content);
+    recordImportedFile(abs_path, content);
     LOG_DEBUG << "Successfully imported " << data_name << " from " << abs_path;
   }
 }
@@ -47,10 +89,7 @@ void INvStorage::importUpdateCertificate(const boost::filesystem::path& base_pat
   if (!loadTlsCert(&prev_content)) {
     update = true;
   } else if (!imported_data_path.empty()) {
-    content = Utils::readFile(imported_data_path.get(base_path).string());
-    if (Crypto::sha256digest(content) != Crypto::sha256digest(prev_content)) {
-      update = true;
-    }
+    update = importedFileChanged(imported_data_path.get(base_path), prev_content, &content);
   }
 
   if (update && !imported_data_path.empty()) {
@@ -74,6 +113,7 @@ void INvStorage::importUpdateCertificate(const boost::filesystem::path& base_pat
     }
 
     storeTlsCert(content);
+    recordImportedFile(abs_path, content);
     LOG_DEBUG << "Successfully imported client certificate from " << abs_path;
   }
 }
@@ -149,6 +189,7 @@ void INvStorage::importInitialRootFile(const boost::filesystem::path& root_path,
 }
 
 void INvStorage::importData(const ImportConfig& import_config) {
+  const Timer timer;
   importPrimaryKeys(import_config.base_path, import_config.uptane_public_key_path,
                     import_config.uptane_private_key_path);
   importUpdateCertificate(import_config.base_path, import_config.tls_clientcert_path);
@@ -158,6 +199,7 @@ void INvStorage::importData(const ImportConfig& import_config) {
                      import_config.tls_pkey_path, "client TLS key");
   importInstalledVersions(import_config.base_path);
   importInitialRoot(import_config.base_path);
+  LOG_DEBUG << "Imported data from " << import_config.base_path << " in " << timer;
 }
 
 std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config, const bool readonly) {
@@ -191,6 +233,13 @@ std::shared_ptr<INvStorage> INvStorage::newStorage(const StorageConfig& config,
       }
       return std::make_shared<SQLStorage>(config, readonly);
     }
+    case StorageType::kMemory:
+      if (config.memory_snapshot_interval > 0) {
+        LOG_INFO << "Use memory storage with snapshots in " << config.sqldb_path.get(config.path);
+      } else {
+        LOG_INFO << "Use memory storage";
+      }
+      return std::make_shared<SQLStorage>(config, readonly);
     case StorageType::kFileSystem:
     default:
       throw std::runtime_error("FSStorage has been removed in recent versions of aktualizr, please use SQLStorage");
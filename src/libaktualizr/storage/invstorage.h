@@ -1,6 +1,8 @@
 #ifndef INVSTORAGE_H_
 #define INVSTORAGE_H_
 
+#include <cstdint>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
@@ -36,6 +38,41 @@ struct MisconfiguredEcu {
 
 enum class InstalledVersionUpdateMode { kNone, kCurrent, kPending };
 
+// Identifies a state of the stored Root and non-Root metadata. It changes with
+// every write of them through any storage object of the process, so that
+// whatever was verified from one state can be reused for as long as the
+// revision stays the same. Delegations are not covered.
+struct MetaRevision {
+  uint64_t storage{0};  // 0 is never used by a storage
+  uint64_t generation{0};
+  bool operator==(const MetaRevision& other) const {
+    return storage == other.storage && generation == other.generation;
+  }
+  bool operator!=(const MetaRevision& other) const { return !(*this == other); }
+};
+
+/**
+ * Writes grouped into one transaction, committed when the batch is destroyed.
+ * See INvStorage::startBatch().
+ */
+class StorageBatch {
+ public:
+  StorageBatch() = default;
+  explicit StorageBatch(std::function<void()> commit) : commit_(std::move(commit)) {}
+  ~StorageBatch() {
+    if (commit_) {
+      commit_();
+    }
+  }
+  StorageBatch(const StorageBatch&) = delete;
+  StorageBatch& operator=(const StorageBatch&) = delete;
+  StorageBatch(StorageBatch&& other) noexcept : commit_(std::move(other.commit_)) { other.commit_ = nullptr; }
+  StorageBatch& operator=(StorageBatch&&) = delete;
+
+ private:
+  std::function<void()> commit_;
+};
+
 // Functions loading/storing multiple pieces of data are supposed to do so
 // atomically as far as implementation makes it possible.
 //
@@ -80,11 +117,22 @@ class INvStorage {
   virtual bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const = 0;
   virtual void clearNonRootMeta(Uptane::RepositoryType repo) = 0;
   virtual void clearMetadata() = 0;
+  // ETag and Last-Modified of the stored non-Root metadata, for conditional fetches
+  virtual void storeMetaValidators(const std::string& etag, const std::string& last_modified,
+                                   Uptane::RepositoryType repo, Uptane::Role role) = 0;
+  virtual bool loadMetaValidators(std::string* etag, std::string* last_modified, Uptane::RepositoryType repo,
+                                  Uptane::Role role) const = 0;
   virtual void storeDelegation(const std::string& data, Uptane::Role role) = 0;
   virtual bool loadDelegation(std::string* data, Uptane::Role role) const = 0;
   virtual bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const = 0;
   virtual void deleteDelegation(Uptane::Role role) = 0;
   virtual void clearDelegations() = 0;
+  virtual MetaRevision metaRevision() const = 0;
+  // Digests of successfully verified signatures, see Uptane::SignatureCache.
+  // Only the max_entries most recently stored ones are kept.
+  virtual void storeVerifiedSignature(const std::string& digest, size_t max_entries) = 0;
+  virtual bool loadVerifiedSignature(const std::string& digest) const = 0;
+  virtual void clearVerifiedSignatures() = 0;
 
   virtual void storeDeviceId(const std::string& device_id) = 0;
   virtual bool loadDeviceId(std::string* device_id) const = 0;
@@ -137,18 +185,49 @@ class INvStorage {
 
   virtual void saveReportEvent(const Json::Value& json_value) = 0;
   virtual bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const = 0;
+  // Pass the report events to visit, oldest first, in their stored JSON form, until it returns false
+  virtual void visitReportEvents(const std::function<bool(int64_t id, const std::string& event)>& visit) const = 0;
   virtual void deleteReportEvents(int64_t id_max) = 0;
 
   virtual void storeDeviceDataHash(const std::string& data_type, const std::string& hash) = 0;
   virtual bool loadDeviceDataHash(const std::string& data_type, std::string* hash) const = 0;
+  // Last reported document of a data type, and the number of delta reports sent since it was reported in full
+  virtual void storeDeviceDataDocument(const std::string& data_type, const std::string& document, int64_t deltas) = 0;
+  virtual bool loadDeviceDataDocument(const std::string& data_type, std::string* document, int64_t* deltas) const = 0;
   virtual void clearDeviceData() = 0;
 
+  // Fingerprint of an imported file as last found to match the stored data, see importedFileChanged()
+  virtual void storeImportFingerprint(const std::string& path, const std::string& fingerprint) = 0;
+  virtual bool loadImportFingerprint(const std::string& path, std::string* fingerprint) const = 0;
+
+  // TLS sessions and DNS results kept across restarts, see NetworkCache; expired entries are dropped
+  virtual void storeNetworkCacheEntry(const std::string& name, const std::string& value, int64_t expires) = 0;
+  virtual void visitNetworkCache(
+      const std::function<void(const std::string& name, const std::string& value, int64_t expires)>& visit) const = 0;
+
   // Downloaded files info API
   virtual void storeTargetFilename(const std::string& targetname, const std::string& filename) const = 0;
   virtual std::string getTargetFilename(const std::string& targetname) const = 0;
   virtual std::vector<std::string> getAllTargetNames() const = 0;
+  virtual std::vector<std::string> getTargetNamesByFilename(const std::string& filename) const = 0;
+  // Distinct filenames, least recently stored first
+  virtual std::vector<std::string> getTargetFilenamesByUsage() const = 0;
   virtual void deleteTargetInfo(const std::string& targetname) const = 0;
 
+  /**
+   * Group the writes made until the returned batch is destroyed into one
+   * commit, to save the cost of syncing each of them to storage.
+   *
+   * Each write stays atomic as without a batch, but none of them is durable
+   * before the batch ends: after a crash, either all or none of the writes of
+   * the batch are found. A batch is always committed, also when it ends with
+   * an exception, so that failing part way through keeps what was written.
+   * Reads within the batch see its writes. Other threads using the storage
+   * wait until the batch ends, so don't wait for them while holding one.
+   * Batches can be nested. Storages without transactions write right away.
+   */
+  virtual StorageBatch startBatch() { return StorageBatch(); }
+
   // Special constructors and utilities
   static std::shared_ptr<INvStorage> newStorage(const StorageConfig& config, bool readonly = false);
   static void FSSToSQLS(FSStorageRead& fs_storage, SQLStorage& sql_storage);
@@ -185,6 +264,14 @@ class INvStorage {
   void importUpdateCertificate(const boost::filesystem::path& base_path, const utils::BasedPath& imported_data_path);
   void importPrimaryKeys(const boost::filesystem::path& base_path, const utils::BasedPath& import_pubkey_path,
                          const utils::BasedPath& import_privkey_path);
+  /**
+   * Whether a file to import differs from the stored content. The file is
+   * only read, into `content`, if it changed since it was last found to
+   * match, going by its size, times and inode.
+   */
+  bool importedFileChanged(const boost::filesystem::path& path, const std::string& stored_content,
+                           std::string* content);
+  void recordImportedFile(const boost::filesystem::path& path, const std::string& content);
 
   /**
    * Import initial image and director root.json from the filesystem.
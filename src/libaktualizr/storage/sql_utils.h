@@ -6,6 +6,8 @@
 #include <mutex>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+#include <utility>
 
 #include <boost/filesystem/path.hpp>
 #include <boost/optional.hpp>
@@ -13,6 +15,27 @@
 #include <sqlite3.h>
 
 #include "logging/logging.h"
+#include "utilities/allocation_accounting.h"
+#include "utilities/metrics.h"
+
+// The SQLite calls that run the statements, each step separately
+inline MetricHistogram& sqliteDurationMetric(const std::string& call) {
+  return Metrics::instance().histogram("aktualizr_sqlite_duration_seconds", "Duration of the SQLite statements",
+                                       {{"call", call}});
+}
+
+// Bytes of the text and blob columns read, and of the text and blob parameters
+// given to the statements
+inline MetricCounter& sqliteReadBytesMetric() {
+  static MetricCounter& bytes =
+      Metrics::instance().counter("aktualizr_sqlite_read_bytes_total", "Bytes read from the SQLite database");
+  return bytes;
+}
+inline MetricCounter& sqliteWrittenBytesMetric() {
+  static MetricCounter& bytes =
+      Metrics::instance().counter("aktualizr_sqlite_written_bytes_total", "Bytes given to the SQLite statements");
+  return bytes;
+}
 
 // Unique ownership SQLite3 statement creation
 
@@ -31,14 +54,60 @@ class SQLInternalException : public SQLException {
   explicit SQLInternalException(const std::string& what = "SQL internal error") : SQLException(what) {}
 };
 
+// Compiled statements of a connection that are not in use, by SQL text. Only
+// used with the connection it belongs to, and thus by one thread at a time.
+class SQLiteStatementCache {
+ public:
+  SQLiteStatementCache() = default;
+  SQLiteStatementCache(const SQLiteStatementCache&) = delete;
+  SQLiteStatementCache& operator=(const SQLiteStatementCache&) = delete;
+  ~SQLiteStatementCache() {
+    for (auto& it : idle_) {
+      sqlite3_finalize(it.second);
+    }
+  }
+
+  // Take out a statement for the SQL text, if one was compiled before.
+  sqlite3_stmt* take(const std::string& sql) {
+    auto it = idle_.find(sql);
+    if (it == idle_.end()) {
+      return nullptr;
+    }
+    sqlite3_stmt* statement = it->second;
+    idle_.erase(it);
+    return statement;
+  }
+
+  // Keep a statement that is no longer in use.
+  void give(const std::string& sql, sqlite3_stmt* statement) {
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+    auto res = idle_.emplace(sql, statement);
+    if (!res.second) {
+      // The same statement was in use twice at the same time; one is enough.
+      sqlite3_finalize(statement);
+    }
+  }
+
+ private:
+  std::unordered_map<std::string, sqlite3_stmt*> idle_;
+};
+
 class SQLiteStatement {
  public:
   template <typename... Types>
   SQLiteStatement(sqlite3* db, const std::string& zSql, const Types&... args)
-      : db_(db), stmt_(nullptr, sqlite3_finalize), bind_cnt_(1) {
-    sqlite3_stmt* statement;
+      : SQLiteStatement(db, std::shared_ptr<SQLiteStatementCache>(), zSql, args...) {}
 
-    if (sqlite3_prepare_v2(db_, zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
+  // Reuse a statement compiled before from the cache, and give it back to it
+  // when done instead of finalizing it.
+  template <typename... Types>
+  SQLiteStatement(sqlite3* db, std::shared_ptr<SQLiteStatementCache> cache, const std::string& zSql,
+                  const Types&... args)
+      : db_(db), stmt_(nullptr, Releaser{cache, zSql}), bind_cnt_(1) {
+    sqlite3_stmt* statement = (cache != nullptr) ? cache->take(zSql) : nullptr;
+
+    if (statement == nullptr && sqlite3_prepare_v2(db_, zSql.c_str(), -1, &statement, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Could not prepare statement: " << sqlite3_errmsg(db_);
       throw SQLInternalException(std::string("Could not prepare statement: ") + sqlite3_errmsg(db_));
     }
@@ -48,23 +117,31 @@ class SQLiteStatement {
   }
 
   inline sqlite3_stmt* get() const { return stmt_.get(); }
-  inline int step() const { return sqlite3_step(stmt_.get()); }
+  inline int step() const {
+    static MetricHistogram& duration = sqliteDurationMetric("step");
+    const MetricTimer timer(duration);
+    return sqlite3_step(stmt_.get());
+  }
 
   // get results
   inline boost::optional<std::string> get_result_col_blob(int iCol) {
+    const AllocationAccounting::Scope accounting(AllocationTag::kStorage);
     const auto* b = reinterpret_cast<const char*>(sqlite3_column_blob(stmt_.get(), iCol));
     if (b == nullptr) {
       return boost::none;
     }
     auto length = static_cast<size_t>(sqlite3_column_bytes(stmt_.get(), iCol));
+    sqliteReadBytesMetric().add(length);
     return std::string(b, length);
   }
 
   inline boost::optional<std::string> get_result_col_str(int iCol) {
+    const AllocationAccounting::Scope accounting(AllocationTag::kStorage);
     const auto* b = reinterpret_cast<const char*>(sqlite3_column_text(stmt_.get(), iCol));
     if (b == nullptr) {
       return boost::none;
     }
+    sqliteReadBytesMetric().add(static_cast<uint64_t>(sqlite3_column_bytes(stmt_.get(), iCol)));
     return std::string(b);
   }
 
@@ -88,6 +165,7 @@ class SQLiteStatement {
   void bindArgument(const std::string& v) {
     owned_data_.push_back(v);
     const std::string& oe = owned_data_.back();
+    sqliteWrittenBytesMetric().add(oe.size());
 
     if (sqlite3_bind_text(stmt_.get(), bind_cnt_, oe.c_str(), -1, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Could not bind: " << sqlite3_errmsg(db_);
@@ -100,6 +178,7 @@ class SQLiteStatement {
   void bindArgument(const SQLBlob& blob) {
     owned_data_.emplace_back(blob.content);
     const std::string& oe = owned_data_.back();
+    sqliteWrittenBytesMetric().add(oe.size());
 
     if (sqlite3_bind_blob(stmt_.get(), bind_cnt_, oe.c_str(), static_cast<int>(oe.size()), SQLITE_STATIC) !=
         SQLITE_OK) {
@@ -118,25 +197,39 @@ class SQLiteStatement {
     bindArguments(args...);
   }
 
+  struct Releaser {
+    std::shared_ptr<SQLiteStatementCache> cache;
+    std::string sql;
+    void operator()(sqlite3_stmt* statement) const {
+      if (cache != nullptr) {
+        cache->give(sql, statement);
+      } else {
+        sqlite3_finalize(statement);
+      }
+    }
+  };
+
   sqlite3* db_;
-  std::unique_ptr<sqlite3_stmt, int (*)(sqlite3_stmt*)> stmt_;
-  int bind_cnt_;  // NOLINT
   // copies of data that need to persist for the object duration
   // (avoid vector because of resizing issues)
+  // Declared before stmt_, so that they outlive the bindings.
   std::list<std::string> owned_data_;
+  std::unique_ptr<sqlite3_stmt, Releaser> stmt_;
+  int bind_cnt_;  // NOLINT
 };
 
-// Unique ownership SQLite3 connection
+// SQLite3 connection, either owned by the guard or kept open by someone else
+// and used exclusively while the guard exists
 const extern std::mutex sql_mutex;
 class SQLite3Guard {
  public:
   sqlite3* get() { return handle_.get(); }
   int get_rc() const { return rc_; }
 
-  explicit SQLite3Guard(const char* path, bool readonly, std::shared_ptr<std::mutex> mutex = nullptr)
-      : handle_(nullptr, sqlite3_close), rc_(0), m_(std::move(mutex)) {
+  explicit SQLite3Guard(const char* path, bool readonly, std::shared_ptr<std::recursive_mutex> mutex = nullptr)
+      : m_(std::move(mutex)), rc_(0) {
     if (m_) {
-      m_->lock();
+      lock_ = std::unique_lock<std::recursive_mutex>(*m_);
     }
     if (sqlite3_threadsafe() == 0) {
       throw SQLInternalException("sqlite3 has been compiled without multitheading support");
@@ -151,16 +244,34 @@ class SQLite3Guard {
     /* retry operations for 2 seconds before returning SQLITE_BUSY */
     sqlite3_busy_timeout(h, 2000);
 
-    handle_.reset(h);
+    // close_v2 waits for statements that are still around to be finalized.
+    handle_.reset(h, sqlite3_close_v2);
   }
 
   explicit SQLite3Guard(const boost::filesystem::path& path, bool readonly = false,
-                        std::shared_ptr<std::mutex> mutex = nullptr)
+                        std::shared_ptr<std::recursive_mutex> mutex = nullptr)
       : SQLite3Guard(path.c_str(), readonly, std::move(mutex)) {}
-  SQLite3Guard(SQLite3Guard&& guard) noexcept : handle_(std::move(guard.handle_)), rc_(guard.rc_) {}
+  /**
+   * Use a connection that stays open after the guard is gone, with `lock`
+   * held on the mutex that serializes its use. Statements are compiled once
+   * and kept in `statements`.
+   */
+  SQLite3Guard(std::shared_ptr<sqlite3> handle, std::shared_ptr<SQLiteStatementCache> statements,
+               std::unique_lock<std::recursive_mutex> lock)
+      : lock_(std::move(lock)), handle_(std::move(handle)), rc_(SQLITE_OK), statements_(std::move(statements)) {}
+  SQLite3Guard(SQLite3Guard&& guard) noexcept
+      : m_(std::move(guard.m_)),
+        lock_(std::move(guard.lock_)),
+        handle_(std::move(guard.handle_)),
+        rc_(guard.rc_),
+        statements_(std::move(guard.statements_)),
+        transactions_(guard.transactions_) {
+    guard.transactions_ = 0;
+  }
   ~SQLite3Guard() {
-    if (m_) {
-      m_->unlock();
+    // The connection may stay open, so drop what was not committed here.
+    for (; handle_ && transactions_ > 0; --transactions_) {
+      exec("ROLLBACK TO guard; RELEASE guard;", nullptr, nullptr);
     }
   }
   SQLite3Guard(const SQLite3Guard& guard) = delete;
@@ -168,6 +279,8 @@ class SQLite3Guard {
   SQLite3Guard& operator=(SQLite3Guard&&) = delete;
 
   int exec(const char* sql, int (*callback)(void*, int, char**, char**), void* cb_arg) {
+    static MetricHistogram& duration = sqliteDurationMetric("exec");
+    const MetricTimer timer(duration);
     return sqlite3_exec(handle_.get(), sql, callback, cb_arg, nullptr);
   }
 
@@ -177,46 +290,58 @@ class SQLite3Guard {
 
   template <typename... Types>
   SQLiteStatement prepareStatement(const std::string& zSql, const Types&... args) {
-    return SQLiteStatement(handle_.get(), zSql, args...);
+    const AllocationAccounting::Scope accounting(AllocationTag::kStorage);
+    return SQLiteStatement(handle_.get(), statements_, zSql, args...);
   }
 
+  // The connection, to keep it open after the guard is gone.
+  std::shared_ptr<sqlite3> handle() const { return handle_; }
+
   std::string errmsg() const { return sqlite3_errmsg(handle_.get()); }
 
   // Transaction handling
   //
   // A transactional series of db operations should be realized between calls of
   // `beginTranscation()` and `commitTransaction()`. If no commit is done before
-  // the destruction of the `SQLite3Guard` (and thus the SQLite connection) or
-  // if `rollbackTransaction()` is called explicitely, the changes will be
-  // rolled back
+  // the destruction of the `SQLite3Guard` or if `rollbackTransaction()` is
+  // called explicitely, the changes will be rolled back.
+  //
+  // Transactions are savepoints, so that they can be nested in a transaction
+  // that is already open on the connection, such as a storage batch. They are
+  // then only committed with the enclosing one.
 
   void beginTransaction() {
-    // Note: transaction cannot be nested and this will fail if another
-    // transaction was open on the same connection
-    if (exec("BEGIN TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    if (exec("SAVEPOINT guard;", nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't begin transaction: " << errmsg();
       throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
     }
+    ++transactions_;
   }
 
   void commitTransaction() {
-    if (exec("COMMIT TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    if (exec("RELEASE guard;", nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't commit transaction: " << errmsg();
-      throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
+      throw SQLInternalException(std::string("Can't commit transaction: ") + errmsg());
     }
+    --transactions_;
   }
 
   void rollbackTransaction() {
-    if (exec("ROLLBACK TRANSACTION;", nullptr, nullptr) != SQLITE_OK) {
+    if (exec("ROLLBACK TO guard; RELEASE guard;", nullptr, nullptr) != SQLITE_OK) {
       LOG_ERROR << "Can't rollback transaction: " << errmsg();
-      throw SQLInternalException(std::string("Can't begin transaction: ") + errmsg());
+      throw SQLInternalException(std::string("Can't rollback transaction: ") + errmsg());
     }
+    --transactions_;
   }
 
  private:
-  std::unique_ptr<sqlite3, int (*)(sqlite3*)> handle_;
+  std::shared_ptr<std::recursive_mutex> m_ = nullptr;
+  // Declared first, to be released after the connection is done with.
+  std::unique_lock<std::recursive_mutex> lock_;
+  std::shared_ptr<sqlite3> handle_;
   int rc_;
-  std::shared_ptr<std::mutex> m_ = nullptr;
+  std::shared_ptr<SQLiteStatementCache> statements_;
+  int transactions_{0};  // open savepoints
 };
 
 #endif  // SQL_UTILS_H_
@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include "storage/sql_utils.h"
 #include "utilities/utils.h"
 
@@ -16,6 +20,75 @@ TEST(sql_utils, PrepareRvalue) {
   EXPECT_EQ(statement.step(), SQLITE_DONE);
 }
 
+/* A connection kept open reuses its statements and drops uncommitted changes like a closed one. */
+TEST(sql_utils, SharedConnection) {
+  TemporaryDirectory temp_dir;
+  std::recursive_mutex mutex;
+  const auto statements = std::make_shared<SQLiteStatementCache>();
+  std::shared_ptr<sqlite3> handle;
+  {
+    SQLite3Guard db(temp_dir.Path() / "test.db");
+    ASSERT_EQ(db.get_rc(), SQLITE_OK);
+    handle = db.handle();
+  }
+
+  {
+    SQLite3Guard db(handle, statements, std::unique_lock<std::recursive_mutex>(mutex));
+    db.exec("CREATE TABLE example(ex1 TEXT, ex2 INTEGER);", NULL, NULL);
+    for (int i = 0; i < 3; ++i) {
+      auto statement =
+          db.prepareStatement<std::string, int>("INSERT INTO example VALUES (?,?);", "row" + std::to_string(i), i);
+      EXPECT_EQ(statement.step(), SQLITE_DONE);
+    }
+    // The same statement in use twice at the same time
+    auto first = db.prepareStatement("SELECT ex1 FROM example ORDER BY ex2;");
+    auto second = db.prepareStatement("SELECT ex1 FROM example ORDER BY ex2;");
+    ASSERT_EQ(first.step(), SQLITE_ROW);
+    ASSERT_EQ(second.step(), SQLITE_ROW);
+    ASSERT_EQ(second.step(), SQLITE_ROW);
+    EXPECT_EQ(first.get_result_col_str(0).value(), "row0");
+    EXPECT_EQ(second.get_result_col_str(0).value(), "row1");
+  }
+
+  {
+    SQLite3Guard db(handle, statements, std::unique_lock<std::recursive_mutex>(mutex));
+    db.beginTransaction();
+    EXPECT_EQ(db.exec("DELETE FROM example;", NULL, NULL), SQLITE_OK);
+  }
+
+  EXPECT_NE(sqlite3_get_autocommit(handle.get()), 0);
+
+  {
+    SQLite3Guard db(handle, statements, std::unique_lock<std::recursive_mutex>(mutex));
+    auto statement = db.prepareStatement("SELECT COUNT(*) FROM example;");
+    ASSERT_EQ(statement.step(), SQLITE_ROW);
+    EXPECT_EQ(statement.get_result_col_int(0), 3);
+  }
+}
+
+/* Transactions nest in one that is already open, and are only committed with it. */
+TEST(sql_utils, NestedTransaction) {
+  TemporaryDirectory temp_dir;
+  SQLite3Guard db(temp_dir.Path() / "test.db");
+  db.exec("CREATE TABLE example(ex1 INTEGER);", NULL, NULL);
+
+  db.beginTransaction();
+  db.beginTransaction();
+  EXPECT_EQ(db.exec("INSERT INTO example VALUES (1);", NULL, NULL), SQLITE_OK);
+  db.commitTransaction();
+  db.beginTransaction();
+  EXPECT_EQ(db.exec("INSERT INTO example VALUES (2);", NULL, NULL), SQLITE_OK);
+  db.rollbackTransaction();
+  EXPECT_EQ(sqlite3_get_autocommit(db.get()), 0);
+  db.commitTransaction();
+  EXPECT_NE(sqlite3_get_autocommit(db.get()), 0);
+
+  auto statement = db.prepareStatement("SELECT ex1 FROM example;");
+  ASSERT_EQ(statement.step(), SQLITE_ROW);
+  EXPECT_EQ(statement.get_result_col_int(0), 1);
+  EXPECT_EQ(statement.step(), SQLITE_DONE);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
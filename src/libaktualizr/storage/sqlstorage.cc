@@ -1,16 +1,122 @@
 #include "sqlstorage.h"
 
 #include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <ctime>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <string>
 #include <utility>
 
+#include <boost/filesystem.hpp>
+
 #include "logging/logging.h"
 #include "sql_utils.h"
 #include "utilities/utils.h"
 
+namespace {
+std::atomic<uint64_t> storage_ids{0};
+// Shared by all storages, as several of them can be opened on the same database.
+std::atomic<uint64_t> meta_generation{0};
+
+// Bumps the metadata generation once the write is done, however it ends, so
+// that nothing verified from the previous content can be taken as current.
+class MetaWriteGuard {
+ public:
+  MetaWriteGuard() = default;
+  ~MetaWriteGuard() { ++meta_generation; }
+  MetaWriteGuard(const MetaWriteGuard&) = delete;
+  MetaWriteGuard(MetaWriteGuard&&) = delete;
+  MetaWriteGuard& operator=(const MetaWriteGuard&) = delete;
+  MetaWriteGuard& operator=(MetaWriteGuard&&) = delete;
+};
+
+// Encodings of the blobs in the meta and delegations tables
+constexpr int64_t kEncodingPlain = 0;
+constexpr int64_t kEncodingDeflate = 1;
+
+// Compress in the zlib format. Returns false if that would not save space.
+bool deflateBlob(const std::string& in, std::string* out) {
+  auto size = compressBound(static_cast<uLong>(in.size()));
+  out->resize(size);
+  if (compress2(reinterpret_cast<Bytef*>(&(*out)[0]), &size, reinterpret_cast<const Bytef*>(in.data()),
+                static_cast<uLong>(in.size()), Z_DEFAULT_COMPRESSION) != Z_OK ||
+      size >= in.size()) {
+    return false;
+  }
+  out->resize(size);
+  return true;
+}
+
+bool inflateBlob(const std::string& in, std::string* out) {
+  z_stream stream{};
+  if (inflateInit(&stream) != Z_OK) {
+    return false;
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  stream.avail_in = static_cast<uInt>(in.size());
+  std::string result;
+  result.reserve(in.size() * 4);
+  std::array<char, 64 * 1024> chunk{};
+  int res;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(chunk.data());
+    stream.avail_out = static_cast<uInt>(chunk.size());
+    res = inflate(&stream, Z_NO_FLUSH);
+    if (res != Z_OK && res != Z_STREAM_END) {
+      break;
+    }
+    result.append(chunk.data(), chunk.size() - stream.avail_out);
+  } while (res != Z_STREAM_END);
+  inflateEnd(&stream);
+  if (res != Z_STREAM_END) {
+    return false;
+  }
+  *out = std::move(result);
+  return true;
+}
+
+// Get metadata back as it was passed to be stored.
+bool decodeMeta(const boost::optional<std::string>& blob, const int64_t encoding, std::string* data) {
+  if (encoding == kEncodingPlain) {
+    *data = blob ? *blob : std::string();
+    return true;
+  }
+  if (encoding == kEncodingDeflate) {
+    return blob && inflateBlob(*blob, data);
+  }
+  return false;
+}
+
+// The tables of the database of report events and device data, the same as
+// in the main one
+const std::string kEventsSchema =
+    "CREATE TABLE version(version INTEGER);\n"
+    "INSERT INTO version(rowid,version) VALUES(1,1);\n"
+    "CREATE TABLE report_events(id INTEGER PRIMARY KEY, json_string TEXT NOT NULL);\n"
+    "CREATE TABLE device_data(data_type TEXT PRIMARY KEY, hash TEXT NOT NULL);\n"
+    "CREATE TABLE device_data_documents(data_type TEXT PRIMARY KEY, document TEXT NOT NULL, "
+    "deltas INTEGER NOT NULL DEFAULT 0);\n";
+constexpr int kEventsSchemaVersion = 1;
+}  // namespace
+
+// Report events and device data, which are written often, in a database of
+// their own so that their writes don't hold up the ones of the update.
+class SQLEventsDatabase : public SQLStorageBase {
+ public:
+  SQLEventsDatabase(const boost::filesystem::path& path, bool readonly, bool write_ahead_log)
+      : SQLStorageBase(path, readonly, {"", kEventsSchema}, {}, kEventsSchema, kEventsSchemaVersion, write_ahead_log,
+                       false, std::chrono::seconds::zero(), false) {}
+
+  SQLite3Guard connection(Durability durability) const { return dbConnection(durability); }
+  SQLite3Guard readConnection() const { return dbReadConnection(); }
+  void releasePages(SQLite3Guard& db) const { releaseFreePages(db); }
+};
+
 // Find metadata with version set to -1 (e.g. after migration) and assign proper version to it.
 void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role) {
   SQLite3Guard db = dbConnection();
@@ -61,14 +167,78 @@ void SQLStorage::cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Rol
 SQLStorage::SQLStorage(const StorageConfig& config, bool readonly)
     : SQLStorageBase(config.sqldb_path.get(config.path), readonly, libaktualizr_schema_migrations,
                      libaktualizr_schema_rollback_migrations, libaktualizr_current_schema,
-                     libaktualizr_current_schema_version),
-      INvStorage(config) {
+                     libaktualizr_current_schema_version, config.write_ahead_log, config.type == StorageType::kMemory,
+                     std::chrono::seconds(config.memory_snapshot_interval)),
+      INvStorage(config),
+      storage_id_{++storage_ids} {
   try {
     cleanMetaVersion(Uptane::RepositoryType::Director(), Uptane::Role::Root());
     cleanMetaVersion(Uptane::RepositoryType::Image(), Uptane::Role::Root());
   } catch (...) {
     LOG_ERROR << "SQLite database metadata version migration failed";
   }
+
+  if (!config.sqldb_events_path.empty() && !in_memory_) {
+    const boost::filesystem::path events_path = config.sqldb_events_path.get(config.path);
+    // A reader has nothing to read before the first writer
+    if (!readonly || boost::filesystem::exists(events_path)) {
+      events_db_ = std_::make_unique<SQLEventsDatabase>(events_path, readonly, config.write_ahead_log);
+      if (!readonly) {
+        moveReportEvents();
+      }
+    }
+  }
+}
+
+SQLStorage::~SQLStorage() = default;
+
+SQLite3Guard SQLStorage::eventsConnection(const Durability durability) const {
+  return events_db_ ? events_db_->connection(durability) : dbConnection(durability);
+}
+
+SQLite3Guard SQLStorage::eventsReadConnection() const {
+  return events_db_ ? events_db_->readConnection() : dbReadConnection();
+}
+
+void SQLStorage::releaseEventsFreePages(SQLite3Guard& db) const {
+  if (events_db_) {
+    events_db_->releasePages(db);
+  } else {
+    releaseFreePages(db);
+  }
+}
+
+void SQLStorage::moveReportEvents() {
+  std::vector<std::string> events;
+  {
+    SQLite3Guard db = dbConnection();
+    auto statement = db.prepareStatement("SELECT json_string FROM report_events ORDER BY id;");
+    for (int result = statement.step(); result == SQLITE_ROW; result = statement.step()) {
+      events.push_back(statement.get_result_col_str(0).value_or(""));
+    }
+  }
+  if (events.empty()) {
+    return;
+  }
+  {
+    SQLite3Guard db = events_db_->connection(Durability::kCritical);
+    db.beginTransaction();
+    for (const auto& event : events) {
+      auto statement = db.prepareStatement<std::string>(
+          "INSERT INTO report_events SELECT MAX(id) + 1, ? FROM report_events", event);
+      if (statement.step() != SQLITE_DONE) {
+        LOG_ERROR << "Failed to move report events: " << db.errmsg();
+        return;
+      }
+    }
+    db.commitTransaction();
+  }
+  SQLite3Guard db = dbConnection();
+  if (db.exec("DELETE FROM report_events;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear moved report events: " << db.errmsg();
+    return;
+  }
+  LOG_INFO << "Moved " << events.size() << " report events to their own database";
 }
 
 void SQLStorage::storePrimaryKeys(const std::string& public_key, const std::string& private_key) {
@@ -87,7 +257,7 @@ bool SQLStorage::loadPrimaryKeys(std::string* public_key, std::string* private_k
 }
 
 bool SQLStorage::loadPrimaryPublic(std::string* public_key) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT public FROM primary_keys LIMIT 1;");
 
@@ -113,7 +283,7 @@ bool SQLStorage::loadPrimaryPublic(std::string* public_key) const {
 }
 
 bool SQLStorage::loadPrimaryPrivate(std::string* private_key) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT private FROM primary_keys LIMIT 1;");
 
@@ -210,7 +380,7 @@ void SQLStorage::saveSecondaryData(const Uptane::EcuSerial& ecu_serial, const st
 }
 
 bool SQLStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, SecondaryInfo* secondary) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   SecondaryInfo new_sec{};
 
@@ -253,7 +423,7 @@ bool SQLStorage::loadSecondaryInfo(const Uptane::EcuSerial& ecu_serial, Secondar
 }
 
 bool SQLStorage::loadSecondariesInfo(std::vector<SecondaryInfo>* secondaries) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::vector<SecondaryInfo> new_secs;
 
@@ -382,7 +552,7 @@ void SQLStorage::storeTlsPkey(const std::string& pkey) {
 }
 
 bool SQLStorage::loadTlsCreds(std::string* ca, std::string* cert, std::string* pkey) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT ca_cert, client_cert, client_pkey FROM tls_creds LIMIT 1;");
 
@@ -429,7 +599,7 @@ void SQLStorage::clearTlsCreds() {
 }
 
 bool SQLStorage::loadTlsCa(std::string* ca) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT ca_cert FROM tls_creds LIMIT 1;");
 
@@ -455,7 +625,7 @@ bool SQLStorage::loadTlsCa(std::string* ca) const {
 }
 
 bool SQLStorage::loadTlsCert(std::string* cert) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT client_cert FROM tls_creds LIMIT 1;");
 
@@ -481,7 +651,7 @@ bool SQLStorage::loadTlsCert(std::string* cert) const {
 }
 
 bool SQLStorage::loadTlsPkey(std::string* pkey) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT client_pkey FROM tls_creds LIMIT 1;");
 
@@ -507,6 +677,7 @@ bool SQLStorage::loadTlsPkey(std::string* pkey) const {
 }
 
 void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo, Uptane::Version version) {
+  MetaWriteGuard meta_write;
   SQLite3Guard db = dbConnection();
 
   db.beginTransaction();
@@ -520,9 +691,11 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
     return;
   }
 
-  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);",
-                                                                   SQLBlob(data), static_cast<int>(repo),
-                                                                   Uptane::Role::Root().ToInt(), version.version());
+  // Root metadata is small and is kept as it is, so that older versions can
+  // still use it after a rollback of the database.
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int>(
+      "INSERT INTO meta(meta, repo, meta_type, version) VALUES (?, ?, ?, ?);", SQLBlob(data), static_cast<int>(repo),
+      Uptane::Role::Root().ToInt(), version.version());
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store Root metadata: " << db.errmsg();
@@ -533,6 +706,7 @@ void SQLStorage::storeRoot(const std::string& data, Uptane::RepositoryType repo,
 }
 
 void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType repo, const Uptane::Role role) {
+  MetaWriteGuard meta_write;
   SQLite3Guard db = dbConnection();
 
   db.beginTransaction();
@@ -545,9 +719,12 @@ void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType re
     return;
   }
 
-  auto ins_statement =
-      db.prepareStatement<SQLBlob, int, int, int>("INSERT INTO meta VALUES (?, ?, ?, ?);", SQLBlob(data),
-                                                  static_cast<int>(repo), role.ToInt(), Uptane::Version().version());
+  std::string compressed;
+  const bool compress = config_.compress_metadata && deflateBlob(data, &compressed);
+  auto ins_statement = db.prepareStatement<SQLBlob, int, int, int, int>(
+      "INSERT INTO meta(meta, repo, meta_type, version, encoding) VALUES (?, ?, ?, ?, ?);",
+      SQLBlob(compress ? compressed : data), static_cast<int>(repo), role.ToInt(), Uptane::Version().version(),
+      static_cast<int>(compress ? kEncodingDeflate : kEncodingPlain));
 
   if (ins_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to add " << role << "metadata: " << db.errmsg();
@@ -558,7 +735,7 @@ void SQLStorage::storeNonRoot(const std::string& data, Uptane::RepositoryType re
 }
 
 bool SQLStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Version version) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   // version < 0 => latest metadata requested
   if (version.version() < 0) {
@@ -607,11 +784,11 @@ bool SQLStorage::loadRoot(std::string* data, Uptane::RepositoryType repo, Uptane
 }
 
 bool SQLStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, const Uptane::Role role) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement<int, int>(
-      "SELECT meta FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;", static_cast<int>(repo),
-      role.ToInt());
+      "SELECT meta, encoding FROM meta WHERE (repo=? AND meta_type=?) ORDER BY version DESC LIMIT 1;",
+      static_cast<int>(repo), role.ToInt());
   int result = statement.step();
 
   if (result == SQLITE_DONE) {
@@ -621,14 +798,16 @@ bool SQLStorage::loadNonRoot(std::string* data, Uptane::RepositoryType repo, con
     LOG_ERROR << "Failed to get " << role << " metadata: " << db.errmsg();
     return false;
   }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
+  if (data != nullptr && !decodeMeta(statement.get_result_col_blob(0), statement.get_result_col_int(1), data)) {
+    LOG_ERROR << "Failed to decode stored " << role << " metadata";
+    return false;
   }
 
   return true;
 }
 
 void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
+  MetaWriteGuard meta_write;
   SQLite3Guard db = dbConnection();
 
   auto del_statement =
@@ -637,22 +816,79 @@ void SQLStorage::clearNonRootMeta(Uptane::RepositoryType repo) {
   if (del_statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
   }
+
+  // The validators are meaningless without the metadata they belong to.
+  auto del_validators =
+      db.prepareStatement<int>("DELETE FROM meta_validators WHERE repo=?;", static_cast<int>(repo));
+  if (del_validators.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to clear metadata validators: " << db.errmsg();
+  }
 }
 
 void SQLStorage::clearMetadata() {
+  MetaWriteGuard meta_write;
   SQLite3Guard db = dbConnection();
 
   if (db.exec("DELETE FROM meta;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear metadata: " << db.errmsg();
     return;
   }
+
+  if (db.exec("DELETE FROM meta_validators;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear metadata validators: " << db.errmsg();
+    return;
+  }
+}
+
+void SQLStorage::storeMetaValidators(const std::string& etag, const std::string& last_modified,
+                                     Uptane::RepositoryType repo, const Uptane::Role role) {
+  SQLite3Guard db = dbConnection(Durability::kBestEffort);
+
+  auto statement = db.prepareStatement<int, int, std::string, std::string>(
+      "INSERT OR REPLACE INTO meta_validators(repo, meta_type, etag, last_modified) VALUES (?, ?, ?, ?);",
+      static_cast<int>(repo), role.ToInt(), etag, last_modified);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store " << role << " metadata validators: " << db.errmsg();
+    throw SQLException("Failed to store " + role.ToString() + " metadata validators: " + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadMetaValidators(std::string* etag, std::string* last_modified, Uptane::RepositoryType repo,
+                                    const Uptane::Role role) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement<int, int>(
+      "SELECT etag, last_modified FROM meta_validators WHERE (repo=? AND meta_type=?) LIMIT 1;",
+      static_cast<int>(repo), role.ToInt());
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << role << " metadata validators not found in database";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get " << role << " metadata validators: " << db.errmsg();
+    return false;
+  }
+
+  if (etag != nullptr) {
+    *etag = statement.get_result_col_str(0).value();
+  }
+  if (last_modified != nullptr) {
+    *last_modified = statement.get_result_col_str(1).value();
+  }
+
+  return true;
 }
 
 void SQLStorage::storeDelegation(const std::string& data, const Uptane::Role role) {
   SQLite3Guard db = dbConnection();
 
-  auto statement = db.prepareStatement<SQLBlob, std::string>("INSERT OR REPLACE INTO delegations VALUES (?, ?);",
-                                                             SQLBlob(data), role.ToString());
+  std::string compressed;
+  const bool compress = config_.compress_metadata && deflateBlob(data, &compressed);
+  auto statement = db.prepareStatement<SQLBlob, std::string, int>(
+      "INSERT OR REPLACE INTO delegations(meta, role_name, encoding) VALUES (?, ?, ?);",
+      SQLBlob(compress ? compressed : data), role.ToString(),
+      static_cast<int>(compress ? kEncodingDeflate : kEncodingPlain));
   if (statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store delegation metadata: " << db.errmsg();
     return;
@@ -660,10 +896,10 @@ void SQLStorage::storeDelegation(const std::string& data, const Uptane::Role rol
 }
 
 bool SQLStorage::loadDelegation(std::string* data, const Uptane::Role role) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
-  auto statement =
-      db.prepareStatement<std::string>("SELECT meta FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT meta, encoding FROM delegations WHERE role_name=? LIMIT 1;", role.ToString());
   int result = statement.step();
 
   if (result == SQLITE_DONE) {
@@ -673,8 +909,9 @@ bool SQLStorage::loadDelegation(std::string* data, const Uptane::Role role) cons
     LOG_ERROR << "Failed to get delegations metadata: " << db.errmsg();
     return false;
   }
-  if (data != nullptr) {
-    *data = std::string(reinterpret_cast<const char*>(sqlite3_column_blob(statement.get(), 0)));
+  if (data != nullptr && !decodeMeta(statement.get_result_col_blob(0), statement.get_result_col_int(1), data)) {
+    LOG_ERROR << "Failed to decode stored delegations metadata";
+    return false;
   }
 
   return true;
@@ -684,9 +921,9 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
   bool result = false;
 
   try {
-    SQLite3Guard db = dbConnection();
+    SQLite3Guard db = dbReadConnection();
 
-    auto statement = db.prepareStatement("SELECT meta, role_name FROM delegations;");
+    auto statement = db.prepareStatement("SELECT meta, role_name, encoding FROM delegations;");
     auto statement_state = statement.step();
 
     if (statement_state == SQLITE_DONE) {
@@ -698,8 +935,12 @@ bool SQLStorage::loadAllDelegations(std::vector<std::pair<Uptane::Role, std::str
     }
 
     do {
-      data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()),
-                        statement.get_result_col_blob(0).value());
+      std::string meta;
+      if (!decodeMeta(statement.get_result_col_blob(0), statement.get_result_col_int(2), &meta)) {
+        LOG_ERROR << "Failed to decode stored delegations metadata";
+        return false;
+      }
+      data.emplace_back(Uptane::Role::Delegation(statement.get_result_col_str(1).value()), std::move(meta));
     } while ((statement_state = statement.step()) == SQLITE_ROW);
 
     if (statement_state != SQLITE_DONE) {
@@ -730,6 +971,57 @@ void SQLStorage::clearDelegations() {
   }
 }
 
+MetaRevision SQLStorage::metaRevision() const { return MetaRevision{storage_id_, meta_generation.load()}; }
+
+void SQLStorage::storeVerifiedSignature(const std::string& digest, const size_t max_entries) {
+  SQLite3Guard db = dbConnection(Durability::kBestEffort);
+
+  db.beginTransaction();
+
+  // Replacing the row moves it to the end of the rowid order.
+  auto statement =
+      db.prepareStatement<std::string>("INSERT OR REPLACE INTO verified_signatures(digest) VALUES (?);", digest);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store verified signature: " << db.errmsg();
+    return;
+  }
+
+  auto trim_statement = db.prepareStatement<int64_t>(
+      "DELETE FROM verified_signatures WHERE rowid NOT IN "
+      "(SELECT rowid FROM verified_signatures ORDER BY rowid DESC LIMIT ?);",
+      static_cast<int64_t>(max_entries));
+  if (trim_statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to trim verified signatures: " << db.errmsg();
+    return;
+  }
+
+  db.commitTransaction();
+}
+
+bool SQLStorage::loadVerifiedSignature(const std::string& digest) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement =
+      db.prepareStatement<std::string>("SELECT 1 FROM verified_signatures WHERE digest = ? LIMIT 1;", digest);
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get verified signature: " << db.errmsg();
+    return false;
+  }
+
+  return true;
+}
+
+void SQLStorage::clearVerifiedSignatures() {
+  SQLite3Guard db = dbConnection();
+
+  if (db.exec("DELETE FROM verified_signatures;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear verified signatures: " << db.errmsg();
+  }
+}
+
 void SQLStorage::storeDeviceId(const std::string& device_id) {
   SQLite3Guard db = dbConnection();
 
@@ -742,7 +1034,7 @@ void SQLStorage::storeDeviceId(const std::string& device_id) {
 }
 
 bool SQLStorage::loadDeviceId(std::string* device_id) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT device_id FROM device_info LIMIT 1;");
 
@@ -800,7 +1092,7 @@ void SQLStorage::storeEcuRegistered() {
 }
 
 bool SQLStorage::loadEcuRegistered() const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT is_registered FROM device_info LIMIT 1;");
 
@@ -838,7 +1130,7 @@ void SQLStorage::storeNeedReboot() {
 }
 
 bool SQLStorage::loadNeedReboot(bool* need_reboot) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT flag FROM need_reboot LIMIT 1;");
 
@@ -918,7 +1210,7 @@ void SQLStorage::storeEcuSerials(const EcuSerials& serials) {
 }
 
 bool SQLStorage::loadEcuSerials(EcuSerials* serials) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   // order by auto-incremented Primary key so that the ECU order is kept constant
   auto statement = db.prepareStatement("SELECT serial, hardware_id FROM ecus ORDER BY id;");
@@ -978,7 +1270,7 @@ void SQLStorage::storeCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, con
 }
 
 bool SQLStorage::loadCachedEcuManifest(const Uptane::EcuSerial& ecu_serial, std::string* manifest) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::string stmanifest;
 
@@ -1015,7 +1307,7 @@ void SQLStorage::saveMisconfiguredEcu(const MisconfiguredEcu& ecu) {
 }
 
 bool SQLStorage::loadMisconfiguredEcus(std::vector<MisconfiguredEcu>* ecus) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT serial, hardware_id, state FROM misconfigured_ecus;");
   int statement_state;
@@ -1101,7 +1393,9 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
   if (update_mode == InstalledVersionUpdateMode::kCurrent) {
     // unset 'current' and 'pending' on all versions for this ecu
     auto statement = db.prepareStatement<std::string>(
-        "UPDATE installed_versions SET is_current = 0, is_pending = 0 WHERE ecu_serial = ?", ecu_serial_real);
+        "UPDATE installed_versions SET is_current = 0, is_pending = 0 WHERE ecu_serial = ? AND (is_current = 1 OR "
+        "is_pending = 1)",
+        ecu_serial_real);
     if (statement.step() != SQLITE_DONE) {
       LOG_ERROR << "Failed to save installed versions: " << db.errmsg();
       return;
@@ -1109,7 +1403,7 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
   } else if (update_mode == InstalledVersionUpdateMode::kPending) {
     // unset 'pending' on all versions for this ecu
     auto statement = db.prepareStatement<std::string>(
-        "UPDATE installed_versions SET is_pending = 0 WHERE ecu_serial = ?", ecu_serial_real);
+        "UPDATE installed_versions SET is_pending = 0 WHERE ecu_serial = ? AND is_pending = 1", ecu_serial_real);
     if (statement.step() != SQLITE_DONE) {
       LOG_ERROR << "Failed to save installed versions: " << db.errmsg();
       return;
@@ -1143,6 +1437,18 @@ void SQLStorage::saveInstalledVersion(const std::string& ecu_serial, const Uptan
       LOG_ERROR << "Failed to save installed versions: " << db.errmsg();
       return;
     }
+
+    if (config_.installation_log_max_count > 0) {
+      // Only the entries older than the last ones kept are looked at.
+      auto trim = db.prepareStatement<std::string, std::string, int64_t>(
+          "DELETE FROM installed_versions WHERE ecu_serial = ? AND is_current = 0 AND is_pending = 0 AND id < (SELECT "
+          "id FROM installed_versions WHERE ecu_serial = ? ORDER BY id DESC LIMIT 1 OFFSET ?);",
+          ecu_serial_real, ecu_serial_real, static_cast<int64_t>(config_.installation_log_max_count - 1));
+      if (trim.step() != SQLITE_DONE) {
+        LOG_ERROR << "Failed to drop old installed versions: " << db.errmsg();
+        return;
+      }
+    }
   }
 
   db.commitTransaction();
@@ -1177,7 +1483,7 @@ static void loadEcuMap(SQLite3Guard& db, std::string& ecu_serial, Uptane::EcuMap
 
 bool SQLStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<Uptane::Target>* log,
                                      bool only_installed) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::string ecu_serial_real = ecu_serial;
   Uptane::EcuMap ecu_map;
@@ -1257,7 +1563,7 @@ bool SQLStorage::loadInstallationLog(const std::string& ecu_serial, std::vector<
 bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::optional<Uptane::Target>* current_version,
                                        boost::optional<Uptane::Target>* pending_version,
                                        Uptane::CorrelationId* correlation_id) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::string ecu_serial_real = ecu_serial;
   Uptane::EcuMap ecu_map;
@@ -1343,7 +1649,7 @@ bool SQLStorage::loadInstalledVersions(const std::string& ecu_serial, boost::opt
 }
 
 bool SQLStorage::hasPendingInstall() {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement("SELECT count(*) FROM installed_versions where is_pending = 1");
   if (statement.step() != SQLITE_ROW) {
@@ -1406,7 +1712,7 @@ void SQLStorage::saveEcuInstallationResult(const Uptane::EcuSerial& ecu_serial,
 
 bool SQLStorage::loadEcuInstallationResults(
     std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>>* results) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>> ecu_res;
 
@@ -1472,7 +1778,7 @@ bool SQLStorage::storeDeviceInstallationRawReport(const std::string& raw_report)
 
 bool SQLStorage::loadDeviceInstallationResult(data::InstallationResult* result, std::string* raw_report,
                                               std::string* correlation_id) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   data::InstallationResult dev_res;
   std::string raw_report_res;
@@ -1517,7 +1823,7 @@ bool SQLStorage::loadDeviceInstallationResult(data::InstallationResult* result,
 }
 
 void SQLStorage::saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, const int64_t counter) {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbConnection(Durability::kBestEffort);
 
   auto statement = db.prepareStatement<std::string, int64_t>(
       "INSERT OR REPLACE INTO ecu_report_counter (ecu_serial, counter) VALUES "
@@ -1530,7 +1836,7 @@ void SQLStorage::saveEcuReportCounter(const Uptane::EcuSerial& ecu_serial, const
 }
 
 bool SQLStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   std::vector<std::pair<Uptane::EcuSerial, int64_t>> ecu_cnt;
 
@@ -1569,18 +1875,80 @@ bool SQLStorage::loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, i
 
 void SQLStorage::saveReportEvent(const Json::Value& json_value) {
   std::string json_string = Utils::jsonToCanonicalStr(json_value);
-  SQLite3Guard db = dbConnection();
-  auto statement = db.prepareStatement<std::string>(
-      "INSERT INTO report_events SELECT MAX(id) + 1, ? FROM report_events", json_string);
+  SQLite3Guard db = eventsConnection(Durability::kBestEffort);
+  {
+    auto statement = db.prepareStatement<std::string>(
+        "INSERT INTO report_events SELECT MAX(id) + 1, ? FROM report_events", json_string);
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Failed to save report event: " << db.errmsg();
+      return;
+    }
+  }
+  if (report_events_size_ >= 0) {
+    report_events_size_ += static_cast<int64_t>(json_string.size());
+  }
+  trimReportEvents(db);
+}
+
+// Events are only ever deleted from the oldest, so their ids are consecutive
+// and the limits cost about as much as the events dropped.
+void SQLStorage::trimReportEvents(SQLite3Guard& db) {
+  const auto max_count = static_cast<int64_t>(config_.report_events_max_count);
+  const auto max_size = static_cast<int64_t>(config_.report_events_max_size);
+  if (max_count <= 0 && max_size <= 0) {
+    return;
+  }
+
+  int64_t last_dropped = 0;
+  if (max_count > 0) {
+    auto statement = db.prepareStatement<int64_t>("SELECT MAX(id) - ? FROM report_events;", max_count);
+    if (statement.step() == SQLITE_ROW) {
+      last_dropped = statement.get_result_col_int(0);
+    }
+  }
+
+  if (max_size > 0) {
+    if (report_events_size_ < 0) {
+      auto statement =
+          db.prepareStatement("SELECT COALESCE(SUM(LENGTH(CAST(json_string AS BLOB))), 0) FROM report_events;");
+      if (statement.step() != SQLITE_ROW) {
+        LOG_ERROR << "Failed to get the size of report events: " << db.errmsg();
+        return;
+      }
+      report_events_size_ = statement.get_result_col_int(0);
+    }
+    int64_t size = report_events_size_;
+    auto statement =
+        db.prepareStatement("SELECT id, LENGTH(CAST(json_string AS BLOB)) FROM report_events ORDER BY id;");
+    for (int result = statement.step(); result == SQLITE_ROW; result = statement.step()) {
+      const int64_t id = statement.get_result_col_int(0);
+      if (id > last_dropped && size <= max_size) {
+        break;
+      }
+      last_dropped = std::max(last_dropped, id);
+      size -= statement.get_result_col_int(1);
+    }
+    report_events_size_ = size;
+  }
+
+  if (last_dropped <= 0) {
+    return;
+  }
+  auto statement = db.prepareStatement<int64_t>("DELETE FROM report_events WHERE id <= ?;", last_dropped);
   if (statement.step() != SQLITE_DONE) {
-    LOG_ERROR << "Failed to save report event: " << db.errmsg();
+    LOG_ERROR << "Failed to drop report events: " << db.errmsg();
+    report_events_size_ = -1;
     return;
   }
+  const int dropped = sqlite3_changes(db.get());
+  if (dropped > 0) {
+    LOG_WARNING << "Dropped the " << dropped << " oldest report events that could not be sent";
+  }
 }
 
 bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const {
-  SQLite3Guard db = dbConnection();
-  auto statement = db.prepareStatement<int>("SELECT id, json_string FROM report_events LIMIT ?;", limit);
+  SQLite3Guard db = eventsReadConnection();
+  auto statement = db.prepareStatement<int>("SELECT id, json_string FROM report_events ORDER BY id LIMIT ?;", limit);
   int statement_result = statement.step();
   if (statement_result != SQLITE_DONE && statement_result != SQLITE_ROW) {
     LOG_ERROR << "Failed to get report events: " << db.errmsg();
@@ -1612,13 +1980,38 @@ bool SQLStorage::loadReportEvents(Json::Value* report_array, int64_t* id_max, in
   return true;
 }
 
+void SQLStorage::visitReportEvents(const std::function<bool(int64_t id, const std::string& event)>& visit) const {
+  SQLite3Guard db = eventsReadConnection();
+  auto statement = db.prepareStatement("SELECT id, json_string FROM report_events ORDER BY id;");
+  int statement_result = statement.step();
+  for (; statement_result == SQLITE_ROW; statement_result = statement.step()) {
+    const boost::optional<std::string> event = statement.get_result_col_str(1);
+    if (!visit(statement.get_result_col_int(0), event ? *event : std::string())) {
+      return;
+    }
+  }
+  if (statement_result != SQLITE_DONE) {
+    LOG_ERROR << "Failed to get report events: " << db.errmsg();
+  }
+}
+
 void SQLStorage::deleteReportEvents(int64_t id_max) {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = eventsConnection(Durability::kBestEffort);
 
-  auto statement = db.prepareStatement<int64_t>("DELETE FROM report_events WHERE id <= ?;", id_max);
-  if (statement.step() != SQLITE_DONE) {
-    LOG_ERROR << "Failed to clear report events: " << db.errmsg();
+  if (report_events_size_ >= 0) {
+    auto statement = db.prepareStatement<int64_t>(
+        "SELECT COALESCE(SUM(LENGTH(CAST(json_string AS BLOB))), 0) FROM report_events WHERE id <= ?;", id_max);
+    report_events_size_ = statement.step() == SQLITE_ROW ? report_events_size_ - statement.get_result_col_int(0) : -1;
+  }
+  {
+    auto statement = db.prepareStatement<int64_t>("DELETE FROM report_events WHERE id <= ?;", id_max);
+    if (statement.step() != SQLITE_DONE) {
+      LOG_ERROR << "Failed to clear report events: " << db.errmsg();
+      report_events_size_ = -1;
+      return;
+    }
   }
+  releaseEventsFreePages(db);
 }
 
 void SQLStorage::clearInstallationResults() {
@@ -1640,7 +2033,7 @@ void SQLStorage::clearInstallationResults() {
 }
 
 void SQLStorage::storeDeviceDataHash(const std::string& data_type, const std::string& hash) {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = eventsConnection(Durability::kBestEffort);
 
   auto statement = db.prepareStatement<std::string, std::string>(
       "INSERT OR REPLACE INTO device_data(data_type,hash) VALUES (?,?);", data_type, hash);
@@ -1651,7 +2044,7 @@ void SQLStorage::storeDeviceDataHash(const std::string& data_type, const std::st
 }
 
 bool SQLStorage::loadDeviceDataHash(const std::string& data_type, std::string* hash) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = eventsReadConnection();
 
   auto statement =
       db.prepareStatement<std::string>("SELECT hash FROM device_data WHERE data_type = ? LIMIT 1;", data_type);
@@ -1672,19 +2065,118 @@ bool SQLStorage::loadDeviceDataHash(const std::string& data_type, std::string* h
   return true;
 }
 
+void SQLStorage::storeDeviceDataDocument(const std::string& data_type, const std::string& document, int64_t deltas) {
+  SQLite3Guard db = eventsConnection(Durability::kBestEffort);
+
+  auto statement = db.prepareStatement<std::string, std::string, int64_t>(
+      "INSERT OR REPLACE INTO device_data_documents(data_type,document,deltas) VALUES (?,?,?);", data_type, document,
+      deltas);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_ERROR << "Failed to store " << data_type << " document: " << db.errmsg();
+    throw SQLException("Failed to store " + data_type + " document: " + db.errmsg());
+  }
+}
+
+bool SQLStorage::loadDeviceDataDocument(const std::string& data_type, std::string* document, int64_t* deltas) const {
+  SQLite3Guard db = eventsReadConnection();
+
+  auto statement = db.prepareStatement<std::string>(
+      "SELECT document, deltas FROM device_data_documents WHERE data_type = ? LIMIT 1;", data_type);
+
+  int result = statement.step();
+  if (result == SQLITE_DONE) {
+    LOG_TRACE << data_type << " document not found in database";
+    return false;
+  } else if (result != SQLITE_ROW) {
+    LOG_ERROR << "Failed to get " << data_type << " document: " << db.errmsg();
+    return false;
+  }
+
+  if (document != nullptr) {
+    *document = statement.get_result_col_str(0).value();
+  }
+  if (deltas != nullptr) {
+    *deltas = statement.get_result_col_int(1);
+  }
+
+  return true;
+}
+
 void SQLStorage::clearDeviceData() {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = eventsConnection();
 
   if (db.exec("DELETE FROM device_data;", nullptr, nullptr) != SQLITE_OK) {
     LOG_ERROR << "Failed to clear device data: " << db.errmsg();
     return;
   }
+  if (db.exec("DELETE FROM device_data_documents;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_ERROR << "Failed to clear device data documents: " << db.errmsg();
+    return;
+  }
+}
+
+void SQLStorage::storeImportFingerprint(const std::string& path, const std::string& fingerprint) {
+  SQLite3Guard db = dbConnection(Durability::kBestEffort);
+
+  auto statement = db.prepareStatement<std::string, std::string>(
+      "INSERT OR REPLACE INTO import_fingerprints(path,fingerprint) VALUES (?,?);", path, fingerprint);
+  if (statement.step() != SQLITE_DONE) {
+    // Only costs reading the file again on the next import
+    LOG_WARNING << "Failed to store the fingerprint of " << path << ": " << db.errmsg();
+  }
+}
+
+bool SQLStorage::loadImportFingerprint(const std::string& path, std::string* fingerprint) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement =
+      db.prepareStatement<std::string>("SELECT fingerprint FROM import_fingerprints WHERE path = ? LIMIT 1;", path);
+  if (statement.step() != SQLITE_ROW) {
+    return false;
+  }
+  if (fingerprint != nullptr) {
+    *fingerprint = statement.get_result_col_str(0).value();
+  }
+  return true;
+}
+
+void SQLStorage::storeNetworkCacheEntry(const std::string& name, const std::string& value, int64_t expires) {
+  SQLite3Guard db = eventsConnection(Durability::kBestEffort);
+
+  auto statement = db.prepareStatement<std::string, SQLBlob, int64_t>(
+      "INSERT OR REPLACE INTO network_cache(name,value,expires) VALUES (?,?,?);", name, SQLBlob(value), expires);
+  if (statement.step() != SQLITE_DONE) {
+    LOG_WARNING << "Failed to store network cache entry: " << db.errmsg();
+    return;
+  }
+  auto expired = db.prepareStatement<int64_t>("DELETE FROM network_cache WHERE expires <= ?;",
+                                              static_cast<int64_t>(std::time(nullptr)));
+  if (expired.step() != SQLITE_DONE) {
+    LOG_WARNING << "Failed to delete expired network cache entries: " << db.errmsg();
+  }
+}
+
+void SQLStorage::visitNetworkCache(
+    const std::function<void(const std::string& name, const std::string& value, int64_t expires)>& visit) const {
+  SQLite3Guard db = eventsReadConnection();
+  auto statement = db.prepareStatement<int64_t>("SELECT name, value, expires FROM network_cache WHERE expires > ?;",
+                                                static_cast<int64_t>(std::time(nullptr)));
+  int statement_result = statement.step();
+  for (; statement_result == SQLITE_ROW; statement_result = statement.step()) {
+    const boost::optional<std::string> value = statement.get_result_col_blob(1);
+    visit(statement.get_result_col_str(0).value(), value ? *value : std::string(), statement.get_result_col_int(2));
+  }
+  if (statement_result != SQLITE_DONE) {
+    LOG_ERROR << "Failed to get network cache entries: " << db.errmsg();
+  }
 }
 
 void SQLStorage::storeTargetFilename(const std::string& targetname, const std::string& filename) const {
   SQLite3Guard db = dbConnection();
   auto statement = db.prepareStatement<std::string, std::string>(
-      "INSERT OR REPLACE INTO target_images (targetname, filename) VALUES (?, ?);", targetname, filename);
+      "INSERT OR REPLACE INTO target_images (targetname, filename, last_used) VALUES (?, ?, (SELECT "
+      "IFNULL(MAX(last_used), 0) + 1 FROM target_images));",
+      targetname, filename);
 
   if (statement.step() != SQLITE_DONE) {
     LOG_ERROR << "Failed to store Target filename: " << db.errmsg();
@@ -1693,7 +2185,7 @@ void SQLStorage::storeTargetFilename(const std::string& targetname, const std::s
 }
 
 std::string SQLStorage::getTargetFilename(const std::string& targetname) const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement =
       db.prepareStatement<std::string>("SELECT filename FROM target_images WHERE targetname = ?;", targetname);
@@ -1709,7 +2201,7 @@ std::string SQLStorage::getTargetFilename(const std::string& targetname) const {
 }
 
 std::vector<std::string> SQLStorage::getAllTargetNames() const {
-  SQLite3Guard db = dbConnection();
+  SQLite3Guard db = dbReadConnection();
 
   auto statement = db.prepareStatement<>("SELECT targetname FROM target_images;");
 
@@ -1727,6 +2219,45 @@ std::vector<std::string> SQLStorage::getAllTargetNames() const {
   return names;
 }
 
+std::vector<std::string> SQLStorage::getTargetNamesByFilename(const std::string& filename) const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement = db.prepareStatement<std::string>("SELECT targetname FROM target_images WHERE filename = ?;", filename);
+
+  std::vector<std::string> names;
+
+  int result = statement.step();
+  while (result != SQLITE_DONE) {
+    if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get Target names: " << db.errmsg();
+      throw SQLException(std::string("Failed to get Target names: ") + db.errmsg());
+    }
+    names.push_back(statement.get_result_col_str(0).value());
+    result = statement.step();
+  }
+  return names;
+}
+
+std::vector<std::string> SQLStorage::getTargetFilenamesByUsage() const {
+  SQLite3Guard db = dbReadConnection();
+
+  auto statement =
+      db.prepareStatement<>("SELECT filename FROM target_images GROUP BY filename ORDER BY MAX(last_used);");
+
+  std::vector<std::string> filenames;
+
+  int result = statement.step();
+  while (result != SQLITE_DONE) {
+    if (result != SQLITE_ROW) {
+      LOG_ERROR << "Failed to get Target filenames: " << db.errmsg();
+      throw SQLException(std::string("Failed to get Target filenames: ") + db.errmsg());
+    }
+    filenames.push_back(statement.get_result_col_str(0).value());
+    result = statement.step();
+  }
+  return filenames;
+}
+
 void SQLStorage::deleteTargetInfo(const std::string& targetname) const {
   SQLite3Guard db = dbConnection();
 
@@ -14,12 +14,13 @@ extern const std::string libaktualizr_current_schema;
 extern const int libaktualizr_current_schema_version;
 
 class SQLTargetRHandle;
+class SQLEventsDatabase;
 class SQLStorage : public SQLStorageBase, public INvStorage {
  public:
   friend class SQLTargetWHandle;
   friend class SQLTargetRHandle;
   explicit SQLStorage(const StorageConfig& config, bool readonly);
-  ~SQLStorage() override = default;
+  ~SQLStorage() override;
   SQLStorage(const SQLStorage&) = delete;
   SQLStorage(SQLStorage&&) = delete;
   SQLStorage& operator=(const SQLStorage&) = delete;
@@ -52,11 +53,20 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   bool loadNonRoot(std::string* data, Uptane::RepositoryType repo, Uptane::Role role) const override;
   void clearNonRootMeta(Uptane::RepositoryType repo) override;
   void clearMetadata() override;
+  void storeMetaValidators(const std::string& etag, const std::string& last_modified, Uptane::RepositoryType repo,
+                           Uptane::Role role) override;
+  bool loadMetaValidators(std::string* etag, std::string* last_modified, Uptane::RepositoryType repo,
+                          Uptane::Role role) const override;
   void storeDelegation(const std::string& data, Uptane::Role role) override;
   bool loadDelegation(std::string* data, Uptane::Role role) const override;
   bool loadAllDelegations(std::vector<std::pair<Uptane::Role, std::string>>& data) const override;
   void deleteDelegation(Uptane::Role role) override;
   void clearDelegations() override;
+  MetaRevision metaRevision() const override;
+  StorageBatch startBatch() override { return StorageBatch(beginBatch()); }
+  void storeVerifiedSignature(const std::string& digest, size_t max_entries) override;
+  bool loadVerifiedSignature(const std::string& digest) const override;
+  void clearVerifiedSignatures() override;
 
   void storeDeviceId(const std::string& device_id) override;
   bool loadDeviceId(std::string* device_id) const override;
@@ -99,22 +109,47 @@ class SQLStorage : public SQLStorageBase, public INvStorage {
   bool loadEcuReportCounter(std::vector<std::pair<Uptane::EcuSerial, int64_t>>* results) const override;
   void saveReportEvent(const Json::Value& json_value) override;
   bool loadReportEvents(Json::Value* report_array, int64_t* id_max, int limit) const override;
+  void visitReportEvents(const std::function<bool(int64_t id, const std::string& event)>& visit) const override;
   void deleteReportEvents(int64_t id_max) override;
   void clearInstallationResults() override;
 
   void storeDeviceDataHash(const std::string& data_type, const std::string& hash) override;
   bool loadDeviceDataHash(const std::string& data_type, std::string* hash) const override;
+  void storeDeviceDataDocument(const std::string& data_type, const std::string& document, int64_t deltas) override;
+  bool loadDeviceDataDocument(const std::string& data_type, std::string* document, int64_t* deltas) const override;
   void clearDeviceData() override;
+  void storeImportFingerprint(const std::string& path, const std::string& fingerprint) override;
+  bool loadImportFingerprint(const std::string& path, std::string* fingerprint) const override;
+  void storeNetworkCacheEntry(const std::string& name, const std::string& value, int64_t expires) override;
+  void visitNetworkCache(const std::function<void(const std::string& name, const std::string& value, int64_t expires)>&
+                             visit) const override;
 
   void storeTargetFilename(const std::string& targetname, const std::string& filename) const override;
   std::string getTargetFilename(const std::string& targetname) const override;
   std::vector<std::string> getAllTargetNames() const override;
+  std::vector<std::string> getTargetNamesByFilename(const std::string& filename) const override;
+  std::vector<std::string> getTargetFilenamesByUsage() const override;
   void deleteTargetInfo(const std::string& targetname) const override;
 
-  StorageType type() override { return StorageType::kSqlite; };
+  StorageType type() override { return in_memory_ ? StorageType::kMemory : StorageType::kSqlite; };
 
  private:
   void cleanMetaVersion(Uptane::RepositoryType repo, const Uptane::Role& role);
+  void trimReportEvents(SQLite3Guard& db);
+  // Connections to the database of report events and device data
+  SQLite3Guard eventsConnection(Durability durability = Durability::kCritical) const;
+  SQLite3Guard eventsReadConnection() const;
+  void releaseEventsFreePages(SQLite3Guard& db) const;
+  // Move the report events left in the main database to the one of their own
+  void moveReportEvents();
+
+  // Only if report events and device data are kept apart
+  std::unique_ptr<SQLEventsDatabase> events_db_;
+
+  // Bytes of the stored report events, or -1 until needed for the size limit
+  int64_t report_events_size_{-1};
+
+  const uint64_t storage_id_;
 };
 
 #endif  // SQLSTORAGE_H_
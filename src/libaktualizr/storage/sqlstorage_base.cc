@@ -3,10 +3,31 @@
 
 #include <sys/stat.h>
 #include <boost/filesystem.hpp>
+#include <cstdio>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <utility>
 
+#include "utilities/background_scheduling.h"
+#include "utilities/load_admission.h"
+#include "utilities/timer.h"
 #include "utilities/utils.h"
 
+namespace {
+
+// Copy all of a database to another connection, which errmsg() of `to` reports on.
+bool copyDatabase(SQLite3Guard& from, SQLite3Guard& to) {
+  sqlite3_backup* backup = sqlite3_backup_init(to.get(), "main", from.get(), "main");
+  if (backup == nullptr) {
+    return false;
+  }
+  const int rc = sqlite3_backup_step(backup, -1);
+  return sqlite3_backup_finish(backup) == SQLITE_OK && rc == SQLITE_DONE;
+}
+
+}  // namespace
+
 boost::filesystem::path SQLStorageBase::dbPath() const { return sqldb_path_; }
 
 StorageLock::StorageLock(boost::filesystem::path path) : lock_path(std::move(path)) {
@@ -33,64 +54,322 @@ StorageLock::~StorageLock() {
 SQLStorageBase::SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly,
                                std::vector<std::string> schema_migrations,
                                std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                               int current_schema_version)
+                               int current_schema_version, bool write_ahead_log, bool in_memory,
+                               std::chrono::seconds snapshot_interval, bool lock_storage)
     : sqldb_path_(std::move(sqldb_path)),
       readonly_(readonly),
-      mutex_(new std::mutex()),
+      mutex_(new std::recursive_mutex()),
       schema_migrations_(std::move(schema_migrations)),
       schema_rollback_migrations_(std::move(schema_rollback_migrations)),
       current_schema_(std::move(current_schema)),
-      current_schema_version_(current_schema_version) {
-  boost::filesystem::path db_parent_path = dbPath().parent_path();
-  if (!boost::filesystem::is_directory(db_parent_path)) {
-    Utils::createDirectories(db_parent_path, S_IRWXU);
-  } else {
-    struct stat st {};
-    if (stat(db_parent_path.c_str(), &st) < 0) {
-      throw StorageException(std::string("Could not check storage directory permissions: ") + std::strerror(errno));
-    }
-    if ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
-      throw StorageException(
-          "Storage directory has unsafe permissions (it should not be readable or writeable by group nor others)");
-    }
-    if ((st.st_mode & (S_IRGRP | S_IROTH)) != 0) {
-      // Remove read permissions for group and others
-      if (chmod(db_parent_path.c_str(), S_IRWXU) < 0) {
+      current_schema_version_(current_schema_version),
+      write_ahead_log_(write_ahead_log),
+      in_memory_(in_memory),
+      snapshot_interval_(snapshot_interval) {
+  const Timer timer;
+  // Without snapshots, an in-memory database never touches the file system.
+  if (usesFile()) {
+    boost::filesystem::path db_parent_path = dbPath().parent_path();
+    if (!boost::filesystem::is_directory(db_parent_path)) {
+      Utils::createDirectories(db_parent_path, S_IRWXU);
+    } else {
+      struct stat st {};
+      if (stat(db_parent_path.c_str(), &st) < 0) {
+        throw StorageException(std::string("Could not check storage directory permissions: ") + std::strerror(errno));
+      }
+      if ((st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
         throw StorageException(
             "Storage directory has unsafe permissions (it should not be readable or writeable by group nor others)");
       }
+      if ((st.st_mode & (S_IRGRP | S_IROTH)) != 0) {
+        // Remove read permissions for group and others
+        if (chmod(db_parent_path.c_str(), S_IRWXU) < 0) {
+          throw StorageException(
+              "Storage directory has unsafe permissions (it should not be readable or writeable by group nor others)");
+        }
+      }
     }
-  }
 
-  if (!readonly) {
-    try {
-      lock = StorageLock(db_parent_path / "storage.lock");
-    } catch (StorageLock::locked_exception& e) {
-      LOG_WARNING << "\033[31m"
-                  << "Storage in " << db_parent_path
-                  << " is already in use, running several instances concurrently may result in data corruption!"
-                  << "\033[0m";
+    // The lock of the directory is shared by all the databases of a storage.
+    if (!readonly && lock_storage) {
+      try {
+        lock = StorageLock(db_parent_path / "storage.lock");
+      } catch (StorageLock::locked_exception& e) {
+        LOG_WARNING << "\033[31m"
+                    << "Storage in " << db_parent_path
+                    << " is already in use, running several instances concurrently may result in data corruption!"
+                    << "\033[0m";
+      }
     }
   }
 
   if (!dbMigrate()) {
     throw StorageException("SQLite database migration failed");
   }
+  LOG_DEBUG << "Opened database " << (in_memory_ ? "in memory" : dbPath().string()) << " in " << timer;
+
+  if (in_memory_ && !readonly_ && snapshot_interval_.count() > 0) {
+    snapshot_thread_ = std::thread(&SQLStorageBase::runSnapshots, this);
+  }
+}
+
+SQLStorageBase::~SQLStorageBase() {
+  if (!snapshot_thread_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(snapshot_mutex_);
+    shutdown_ = true;
+  }
+  snapshot_cv_.notify_all();
+  snapshot_thread_.join();
+  try {
+    snapshot();
+  } catch (const std::exception& e) {
+    LOG_ERROR << "Can't write database snapshot: " << e.what();
+  }
 }
 
-SQLite3Guard SQLStorageBase::dbConnection() const {
-  SQLite3Guard db(dbPath(), readonly_, mutex_);
-  if (db.get_rc() != SQLITE_OK) {
-    throw SQLInternalException(std::string("Can't open database: ") + db.errmsg());
+SQLite3Guard SQLStorageBase::dbConnection(const Durability durability) const {
+  std::unique_lock<std::recursive_mutex> guard(*mutex_);
+  // Opening the database and compiling the statements costs more than most
+  // queries, so keep the connection open. Retry on the next call if it fails.
+  if (!db_handle_) {
+    // An in-memory database is still filled from a read-only snapshot.
+    SQLite3Guard db(in_memory_ ? boost::filesystem::path(":memory:") : dbPath(), readonly_ && !in_memory_);
+    if (db.get_rc() != SQLITE_OK) {
+      throw SQLInternalException(std::string("Can't open database: ") + db.errmsg());
+    }
+    if (in_memory_) {
+      loadSnapshot(db);
+    }
+    // Only takes effect for a new database, and has to come before the
+    // journal mode for that.
+    if (!readonly_ && db.exec("PRAGMA auto_vacuum=INCREMENTAL;", nullptr, nullptr) != SQLITE_OK) {
+      LOG_WARNING << "Can't enable incremental vacuum: " << db.errmsg();
+    }
+    wal_active_ = !in_memory_ && setJournalMode(db);
+    db_durability_ = Durability::kCritical;
+    db_handle_ = db.handle();
+    db_statements_ = std::make_shared<SQLiteStatementCache>();
+  }
+
+  SQLite3Guard db(db_handle_, db_statements_, std::move(guard));
+  // NORMAL is only safe from corruption in WAL mode.
+  // The synchronous mode can't change within a batch, which is critical.
+  if (wal_active_ && durability != db_durability_ && sqlite3_get_autocommit(db.get()) != 0) {
+    const char *pragma =
+        (durability == Durability::kBestEffort) ? "PRAGMA synchronous=NORMAL;" : "PRAGMA synchronous=FULL;";
+    if (db.exec(pragma, nullptr, nullptr) == SQLITE_OK) {
+      db_durability_ = durability;
+    } else {
+      LOG_WARNING << "Can't change the synchronous mode of the database: " << db.errmsg();
+    }
   }
   return db;
 }
 
+SQLite3Guard SQLStorageBase::dbReadConnection() const {
+  if (in_memory_ || !wal_active_) {
+    return dbConnection();
+  }
+  {
+    // Only fails if another thread uses the connection.
+    std::unique_lock<std::recursive_mutex> guard(*mutex_, std::try_to_lock);
+    if (guard.owns_lock() && db_handle_ && sqlite3_get_autocommit(db_handle_.get()) == 0) {
+      return SQLite3Guard(db_handle_, db_statements_, std::move(guard));
+    }
+  }
+
+  std::lock_guard<std::mutex> readers_guard(readers_mutex_);
+  // A reader this thread already uses is taken again.
+  for (const auto &reader : readers_) {
+    std::unique_lock<std::recursive_mutex> reader_lock(reader->mutex, std::try_to_lock);
+    if (reader_lock.owns_lock()) {
+      return readerConnection(*reader, std::move(reader_lock));
+    }
+  }
+  if (readers_.size() < kMaxReaders) {
+    readers_.push_back(std_::make_unique<Reader>());
+    return readerConnection(*readers_.back(), std::unique_lock<std::recursive_mutex>(readers_.back()->mutex));
+  }
+  return dbConnection();
+}
+
+SQLite3Guard SQLStorageBase::readerConnection(Reader &reader, std::unique_lock<std::recursive_mutex> reader_lock) const {
+  int moved = 0;
+  if (reader.handle && sqlite3_file_control(reader.handle.get(), "main", SQLITE_FCNTL_HAS_MOVED, &moved) == SQLITE_OK &&
+      moved != 0) {
+    reader.statements.reset();
+    reader.handle.reset();
+  }
+  if (!reader.handle) {
+    SQLite3Guard db(dbPath(), true);
+    if (db.get_rc() != SQLITE_OK) {
+      throw SQLInternalException(std::string("Can't open database: ") + db.errmsg());
+    }
+    reader.handle = db.handle();
+    reader.statements = std::make_shared<SQLiteStatementCache>();
+  }
+  return SQLite3Guard(reader.handle, reader.statements, std::move(reader_lock));
+}
+
+std::function<void()> SQLStorageBase::beginBatch() {
+  // Keep other threads out, so that their writes don't end up in the batch.
+  auto batch_lock = std::make_shared<std::unique_lock<std::recursive_mutex>>(*mutex_);
+  {
+    SQLite3Guard db = dbConnection(Durability::kCritical);
+    if (db.exec("SAVEPOINT batch;", nullptr, nullptr) != SQLITE_OK) {
+      LOG_ERROR << "Can't begin storage batch: " << db.errmsg();
+      throw SQLInternalException(std::string("Can't begin storage batch: ") + db.errmsg());
+    }
+  }
+  return [this, batch_lock]() {
+    SQLite3Guard db = dbConnection();
+    if (db.exec("RELEASE batch;", nullptr, nullptr) != SQLITE_OK) {
+      LOG_ERROR << "Can't commit storage batch: " << db.errmsg();
+    }
+  };
+}
+
+bool SQLStorageBase::setJournalMode(SQLite3Guard &db) const {
+  if (readonly_) {
+    // Whatever the writer chose
+    return false;
+  }
+  // The journal mode is stored in the database, so also switch back from WAL.
+  const std::string mode = write_ahead_log_ ? "wal" : "delete";
+  boost::optional<std::string> result;
+  {
+    auto statement = db.prepareStatement("PRAGMA journal_mode=" + mode + ";");
+    if (statement.step() == SQLITE_ROW) {
+      result = statement.get_result_col_str(0);
+    }
+  }
+  if (result != mode) {
+    LOG_WARNING << "Can't set the journal mode of the database to " << mode << ": " << db.errmsg();
+    return result == std::string("wal");
+  }
+  if (write_ahead_log_ && db.exec("PRAGMA synchronous=FULL;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_WARNING << "Can't set the synchronous mode of the database: " << db.errmsg();
+    return false;
+  }
+  return write_ahead_log_;
+}
+
+void SQLStorageBase::reopenIfMoved() const {
+  if (in_memory_) {
+    return;
+  }
+  std::lock_guard<std::recursive_mutex> guard(*mutex_);
+  int moved = 0;
+  if (db_handle_ && sqlite3_file_control(db_handle_.get(), "main", SQLITE_FCNTL_HAS_MOVED, &moved) == SQLITE_OK &&
+      moved != 0) {
+    LOG_DEBUG << "Database file was replaced, reopening it";
+    db_statements_.reset();
+    db_handle_.reset();
+  }
+}
+
+void SQLStorageBase::loadSnapshot(SQLite3Guard& db) const {
+  if (snapshot_interval_.count() == 0 || !boost::filesystem::exists(dbPath())) {
+    return;
+  }
+  SQLite3Guard file(dbPath(), true);
+  if (file.get_rc() != SQLITE_OK || !copyDatabase(file, db)) {
+    throw SQLInternalException(std::string("Can't load database snapshot: ") + db.errmsg());
+  }
+  LOG_DEBUG << "Loaded database snapshot " << dbPath();
+  snapshot_changes_ = sqlite3_total_changes(db.get());
+}
+
+void SQLStorageBase::snapshot() {
+  if (!in_memory_ || readonly_ || snapshot_interval_.count() == 0) {
+    return;
+  }
+  SQLite3Guard db = dbConnection();
+  // Other threads are kept out of the connection meanwhile, so the snapshot
+  // only misses a batch of this thread which has not been committed yet.
+  if (sqlite3_get_autocommit(db.get()) == 0) {
+    return;
+  }
+  const int changes = sqlite3_total_changes(db.get());
+  if (changes == snapshot_changes_) {
+    return;
+  }
+
+  // Replace the file at once, so that a crash leaves the previous snapshot.
+  const boost::filesystem::path tmp_path = dbPath().string() + ".tmp";
+  boost::system::error_code ec;
+  boost::filesystem::remove(tmp_path, ec);
+  {
+    SQLite3Guard file(tmp_path);
+    if (file.get_rc() != SQLITE_OK || !copyDatabase(db, file)) {
+      LOG_ERROR << "Can't write database snapshot: " << file.errmsg();
+      return;
+    }
+  }
+  if (std::rename(tmp_path.c_str(), dbPath().c_str()) != 0) {
+    LOG_ERROR << "Can't write database snapshot: " << std::strerror(errno);
+    return;
+  }
+  snapshot_changes_ = changes;
+}
+
+void SQLStorageBase::runSnapshots() {
+  std::unique_lock<std::mutex> guard(snapshot_mutex_);
+  while (!snapshot_cv_.wait_for(guard, snapshot_interval_, [this] { return shutdown_; })) {
+    guard.unlock();
+    try {
+      snapshot();
+    } catch (const std::exception& e) {
+      LOG_ERROR << "Can't write database snapshot: " << e.what();
+    }
+    guard.lock();
+  }
+}
+
+void SQLStorageBase::releaseFreePages(SQLite3Guard &db) const {
+  // Don't bother for less than about a megabyte.
+  static constexpr int64_t kMinFreePages = 256;
+  if (readonly_) {
+    return;
+  }
+  auto pragma = [&db](const char *query) -> int64_t {
+    auto statement = db.prepareStatement(query);
+    return statement.step() == SQLITE_ROW ? statement.get_result_col_int(0) : -1;
+  };
+  const int64_t free_pages = pragma("PRAGMA freelist_count;");
+  if (free_pages < kMinFreePages || free_pages * 4 < pragma("PRAGMA page_count;")) {
+    return;
+  }
+  const BackgroundScheduling::Thread background;
+  LoadAdmission::admit(LoadAdmission::Work::kStorageMaintenance);
+
+  // New databases use incremental vacuum (2).
+  if (pragma("PRAGMA auto_vacuum;") == 2) {
+    if (db.exec("PRAGMA incremental_vacuum;", nullptr, nullptr) != SQLITE_OK) {
+      LOG_WARNING << "Can't release free pages of the database: " << db.errmsg();
+    }
+    return;
+  }
+  // Older databases are rebuilt once to switch to incremental vacuum, which
+  // can't be done within a transaction.
+  if (sqlite3_get_autocommit(db.get()) == 0) {
+    return;
+  }
+  LOG_INFO << "Rebuilding the database to release " << free_pages << " free pages";
+  if (db.exec("PRAGMA auto_vacuum=INCREMENTAL; VACUUM;", nullptr, nullptr) != SQLITE_OK) {
+    LOG_WARNING << "Can't rebuild the database: " << db.errmsg();
+  }
+}
+
 std::string SQLStorageBase::getTableSchemaFromDb(const std::string& tablename) {
+  reopenIfMoved();
   SQLite3Guard db = dbConnection();
 
   auto statement = db.prepareStatement<std::string>(
-      "SELECT sql FROM sqlite_master WHERE type='table' AND tbl_name=? LIMIT 1;", tablename);
+      "SELECT sql FROM sqlite_master WHERE type IN ('table', 'index') AND name=? LIMIT 1;", tablename);
 
   if (statement.step() != SQLITE_ROW) {
     LOG_ERROR << "Can't get schema of " << tablename << ": " << db.errmsg();
@@ -148,6 +427,10 @@ bool SQLStorageBase::dbMigrateForward(int version_from, int version_to) {
   }
 
   for (int32_t k = version_from + 1; k <= version_to; k++) {
+    if (schema_migrations_.at(static_cast<size_t>(k)).empty()) {
+      LOG_ERROR << "Can't migrate DB from version " << (k - 1) << ": the migration was left out of this build";
+      return false;
+    }
     auto result_code = db.exec(schema_migrations_.at(static_cast<size_t>(k)), nullptr, nullptr);
     if (result_code != SQLITE_OK) {
       LOG_ERROR << "Can't migrate DB from version " << (k - 1) << " to version " << k << ": " << db.errmsg();
@@ -198,6 +481,17 @@ bool SQLStorageBase::dbMigrateBackward(int version_from, int version_to) {
 }
 
 bool SQLStorageBase::dbMigrate() {
+  // The version in the header of the database tells whether the schema is up
+  // to date without reading any table.
+  reopenIfMoved();
+  {
+    SQLite3Guard db = dbConnection();
+    auto statement = db.prepareStatement("PRAGMA user_version;");
+    if (statement.step() == SQLITE_ROW && statement.get_result_col_int(0) == current_schema_version_) {
+      return true;
+    }
+  }
+
   DbVersion schema_version = getVersion();
 
   if (schema_version == DbVersion::kInvalid) {
@@ -207,6 +501,9 @@ bool SQLStorageBase::dbMigrate() {
 
   auto schema_num_version = static_cast<int32_t>(schema_version);
   if (schema_num_version == current_schema_version_) {
+    if (!readonly_) {
+      setUserVersion();
+    }
     return true;
   }
 
@@ -236,16 +533,30 @@ bool SQLStorageBase::dbMigrate() {
     }
 
     db.commitTransaction();
+    setUserVersion();
   } else if (schema_num_version > current_schema_version_) {
-    dbMigrateBackward(schema_num_version);
+    if (dbMigrateBackward(schema_num_version)) {
+      setUserVersion();
+    }
   } else {
-    dbMigrateForward(schema_num_version);
+    if (dbMigrateForward(schema_num_version)) {
+      setUserVersion();
+    }
   }
 
   return true;
 }
 
+void SQLStorageBase::setUserVersion() {
+  SQLite3Guard db = dbConnection();
+  if (db.exec("PRAGMA user_version = " + std::to_string(current_schema_version_) + ";", nullptr, nullptr) !=
+      SQLITE_OK) {
+    LOG_WARNING << "Can't set the schema version in the database header: " << db.errmsg();
+  }
+}
+
 DbVersion SQLStorageBase::getVersion() {
+  reopenIfMoved();
   SQLite3Guard db = dbConnection();
 
   try {
@@ -1,6 +1,15 @@
 #ifndef SQLSTORAGE_BASE_H_
 #define SQLSTORAGE_BASE_H_
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include <boost/filesystem/path.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 #include <boost/interprocess/sync/scoped_lock.hpp>
@@ -34,28 +43,112 @@ class SQLStorageBase {
  public:
   explicit SQLStorageBase(boost::filesystem::path sqldb_path, bool readonly, std::vector<std::string> schema_migrations,
                           std::vector<std::string> schema_rollback_migrations, std::string current_schema,
-                          int current_schema_version);
+                          int current_schema_version, bool write_ahead_log = false, bool in_memory = false,
+                          std::chrono::seconds snapshot_interval = std::chrono::seconds::zero(),
+                          bool lock_storage = true);
+  virtual ~SQLStorageBase();
+  SQLStorageBase(const SQLStorageBase &) = delete;
+  SQLStorageBase(SQLStorageBase &&) = delete;
+  SQLStorageBase &operator=(const SQLStorageBase &) = delete;
+  SQLStorageBase &operator=(SQLStorageBase &&) = delete;
   std::string getTableSchemaFromDb(const std::string &tablename);
   bool dbMigrateForward(int version_from, int version_to = 0);
   bool dbMigrateBackward(int version_from, int version_to = 0);
   bool dbMigrate();
   DbVersion getVersion();  // non-negative integer on success or -1 on error
   boost::filesystem::path dbPath() const;
+  /**
+   * Write an in-memory database with snapshots to its file, if it changed
+   * since the last snapshot. This is done periodically and on destruction.
+   */
+  void snapshot();
 
  protected:
   boost::filesystem::path sqldb_path_;
   bool readonly_{false};
 
   StorageLock lock;
-  std::shared_ptr<std::mutex> mutex_;
+  std::shared_ptr<std::recursive_mutex> mutex_;
 
   const std::vector<std::string> schema_migrations_;
   std::vector<std::string> schema_rollback_migrations_;
   const std::string current_schema_;
   const int current_schema_version_;
+  const bool write_ahead_log_;
+  // The database only lives in memory, and is optionally snapshotted to its file
+  const bool in_memory_;
+  const std::chrono::seconds snapshot_interval_;
+
+  /**
+   * How much a write may be lost on power failure. With write-ahead logging,
+   * best-effort writes are only synced to storage at the next checkpoint or
+   * critical write; the database itself stays consistent either way. Without
+   * it, every write is synced.
+   */
+  enum class Durability { kCritical, kBestEffort };
+
+  /**
+   * Open a transaction that all writes are part of until the returned
+   * function is called to commit it. Other threads can't use the connection
+   * meanwhile.
+   */
+  std::function<void()> beginBatch();
 
-  SQLite3Guard dbConnection() const;
+  /** Exclusive use of the connection to the database, which stays open. */
+  SQLite3Guard dbConnection(Durability durability = Durability::kCritical) const;
+  /**
+   * A connection to only read from. In WAL mode, that is one of up to
+   * kMaxReaders read-only connections, which don't wait for the writes of
+   * other threads and see the database as of the last commit. A thread with
+   * a transaction or batch open reads from its own connection instead, to
+   * see its writes. Otherwise, the same as dbConnection().
+   */
+  SQLite3Guard dbReadConnection() const;
   bool dbInsertBackMigrations(SQLite3Guard &db, int version_latest);
+  // Record in the database header that the schema is at the current version.
+  void setUserVersion();
+  /**
+   * Give the free pages of the database back to the file system once they are
+   * a large part of it, for example after a long backlog of report events has
+   * been sent.
+   */
+  void releaseFreePages(SQLite3Guard &db) const;
+
+ private:
+  static constexpr size_t kMaxReaders = 4;
+  struct Reader {
+    std::recursive_mutex mutex;
+    // Declared in this order so that the statements are finalized first.
+    std::shared_ptr<sqlite3> handle;
+    std::shared_ptr<SQLiteStatementCache> statements;
+  };
+  // Open or reopen the connection of a reader, whose mutex is held by lock
+  SQLite3Guard readerConnection(Reader &reader, std::unique_lock<std::recursive_mutex> reader_lock) const;
+
+  // The open connection would keep using a database file that was removed or
+  // replaced, which tests and tools do before checking the schema.
+  void reopenIfMoved() const;
+  // Set the journal mode of a new connection; returns whether the database is in WAL mode.
+  bool setJournalMode(SQLite3Guard &db) const;
+  bool usesFile() const { return !in_memory_ || snapshot_interval_.count() > 0; }
+  void loadSnapshot(SQLite3Guard &db) const;
+  void runSnapshots();
+
+  // Declared in this order so that the statements are finalized first.
+  mutable std::shared_ptr<sqlite3> db_handle_;
+  mutable std::shared_ptr<SQLiteStatementCache> db_statements_;
+  // The database is in WAL mode, and the synchronous setting of the connection
+  mutable std::atomic<bool> wal_active_{false};
+  mutable Durability db_durability_{Durability::kCritical};
+  mutable std::mutex readers_mutex_;
+  mutable std::vector<std::unique_ptr<Reader>> readers_;
+
+  // Changes of the in-memory database at the last snapshot
+  mutable int snapshot_changes_{-1};
+  std::thread snapshot_thread_;
+  std::mutex snapshot_mutex_;
+  std::condition_variable snapshot_cv_;
+  bool shutdown_{false};
 };
 
 #endif  // SQLSTORAGE_BASE_H_
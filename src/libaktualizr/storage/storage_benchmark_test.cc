@@ -0,0 +1,302 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "libaktualizr/config.h"
+#include "libaktualizr/types.h"
+#include "logging/logging.h"
+#include "storage/invstorage.h"
+#include "utilities/utils.h"
+
+/*
+ * Micro-benchmarks of the storage operations with realistic payloads; run with
+ * --gtest_also_run_disabled_tests.
+ *
+ * The storage is created under TMPDIR, so point it at tmpfs or at a directory
+ * on the block device to measure. Warm runs repeat an operation on an open
+ * storage; cold runs reopen the storage and drop the database files from the
+ * page cache before each operation. Every result is printed and recorded as a
+ * test property in nanoseconds per operation, so that --gtest_output=json:FILE
+ * (or xml:FILE) gives machine-readable results to compare between releases.
+ */
+
+namespace {
+
+constexpr int kEcus = 50;
+constexpr int kReportEvents = 10000;
+
+// Targets metadata of about `size` bytes
+std::string targetsMetadata(size_t size, int version = 1) {
+  Json::Value json;
+  json["signatures"] = Json::Value(Json::arrayValue);
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = version;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  Json::Value& targets = json["signed"]["targets"];
+  std::string result;
+  for (int i = 0; result.size() < size;) {
+    for (int j = 0; j < 100; ++j, ++i) {
+      Json::Value& target = targets["firmware-" + std::to_string(i) + ".bin"];
+      target["length"] = 1048576 + i;
+      target["hashes"]["sha256"] = std::string(64, 'a');
+      target["hashes"]["sha512"] = std::string(128, 'b');
+      target["custom"]["hardwareIds"][0] = "hardware-" + std::to_string(i % kEcus);
+      target["custom"]["version"] = std::to_string(i);
+    }
+    result = Utils::jsonToCanonicalStr(json);
+  }
+  return result;
+}
+
+Uptane::EcuSerial ecuSerial(int i) { return Uptane::EcuSerial("ecu-serial-" + std::to_string(i)); }
+
+Uptane::Target ecuTarget(int ecu, int version) {
+  Uptane::EcuMap ecus{{ecuSerial(ecu), Uptane::HardwareIdentifier("hardware-" + std::to_string(ecu))}};
+  const std::string name = "firmware-" + std::to_string(ecu) + "-" + std::to_string(version) + ".bin";
+  return Uptane::Target(name, ecus, {Hash(Hash::Type::kSha256, std::string(63, 'a') + std::to_string(version % 10))},
+                        1048576, "corr-id");
+}
+
+Json::Value reportEvent(int i) {
+  Json::Value event;
+  event["id"] = "a90d1e3e-d6b5-4b3c-9ac2-" + std::to_string(100000000000 + i);
+  event["deviceTime"] = "2020-10-27T10:00:00Z";
+  event["eventType"]["id"] = "EcuDownloadCompleted";
+  event["eventType"]["version"] = 0;
+  event["event"]["correlationId"] = "urn:here-ota:campaign:a90d1e3e-d6b5-4b3c-9ac2-aa7a9c8d1f0e";
+  event["event"]["ecu"] = ecuSerial(i % kEcus).ToString();
+  event["event"]["success"] = true;
+  return event;
+}
+
+}  // namespace
+
+class StorageBenchmark : public ::testing::Test {
+ protected:
+  StorageBenchmark() {
+    config_.path = temp_dir_.Path();
+    storage_ = INvStorage::newStorage(config_);
+  }
+
+  // Time `op` repeated on the open storage, after one untimed run.
+  void warm(const std::string& name, int iterations, const std::function<void(INvStorage&)>& op) {
+    op(*storage_);
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+      op(*storage_);
+    }
+    report(name + "_warm", std::chrono::steady_clock::now() - start, iterations);
+  }
+
+  // Time `op` as the first operation on a reopened storage whose files are not cached.
+  void cold(const std::string& name, int iterations, const std::function<void(INvStorage&)>& op) {
+    std::chrono::steady_clock::duration elapsed{};
+    for (int i = 0; i < iterations; ++i) {
+      storage_.reset();
+      storage_ = INvStorage::newStorage(config_);
+      dropPageCache();
+      const auto start = std::chrono::steady_clock::now();
+      op(*storage_);
+      elapsed += std::chrono::steady_clock::now() - start;
+    }
+    report(name + "_cold", elapsed, iterations);
+  }
+
+  void both(const std::string& name, int iterations, const std::function<void(INvStorage&)>& op) {
+    warm(name, iterations, op);
+    cold(name, std::max(1, iterations / 10), op);
+  }
+
+  INvStorage& storage() { return *storage_; }
+
+ private:
+  void report(const std::string& name, std::chrono::steady_clock::duration elapsed, int iterations) {
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / iterations;
+    RecordProperty(name + "_ns", std::to_string(ns));
+    std::cout << name << ": " << ns << " ns\n";
+  }
+
+  void dropPageCache() const {
+    const boost::filesystem::path db = config_.sqldb_path.get(config_.path);
+    for (const auto& file : {db.string(), db.string() + "-wal"}) {
+      const int fd = open(file.c_str(), O_RDONLY);
+      if (fd >= 0) {
+        EXPECT_EQ(posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED), 0);
+        close(fd);
+      }
+    }
+  }
+
+  TemporaryDirectory temp_dir_;
+  StorageConfig config_;
+  std::shared_ptr<INvStorage> storage_;
+};
+
+/* Uptane metadata, with Image repo Targets metadata of 1 MB. */
+TEST_F(StorageBenchmark, DISABLED_Metadata) {
+  const std::string root = R"({"signed": {"_type": "Root", "version": 1}, "signatures": []})";
+  const std::string targets = targetsMetadata(1024 * 1024);
+  storage().storeRoot(root, Uptane::RepositoryType::Image(), Uptane::Version(1));
+
+  warm("store_root", 100,
+       [&](INvStorage& s) { s.storeRoot(root, Uptane::RepositoryType::Image(), Uptane::Version(1)); });
+  both("load_root", 100, [](INvStorage& s) {
+    std::string data;
+    EXPECT_TRUE(s.loadLatestRoot(&data, Uptane::RepositoryType::Image()));
+  });
+  warm("store_image_targets_1mb", 20,
+       [&](INvStorage& s) { s.storeNonRoot(targets, Uptane::RepositoryType::Image(), Uptane::Role::Targets()); });
+  both("load_image_targets_1mb", 20, [](INvStorage& s) {
+    std::string data;
+    EXPECT_TRUE(s.loadNonRoot(&data, Uptane::RepositoryType::Image(), Uptane::Role::Targets()));
+  });
+  both("meta_revision", 1000, [](INvStorage& s) { s.metaRevision(); });
+}
+
+/* Delegated Targets metadata of 1 MB each. */
+TEST_F(StorageBenchmark, DISABLED_Delegations) {
+  const int delegations = 8;
+  for (int i = 0; i < delegations; ++i) {
+    storage().storeDelegation(targetsMetadata(1024 * 1024, i), Uptane::Role::Delegation("role-" + std::to_string(i)));
+  }
+  const std::string delegation = targetsMetadata(1024 * 1024);
+
+  warm("store_delegation_1mb", 20,
+       [&](INvStorage& s) { s.storeDelegation(delegation, Uptane::Role::Delegation("role-0")); });
+  both("load_delegation_1mb", 20, [](INvStorage& s) {
+    std::string data;
+    EXPECT_TRUE(s.loadDelegation(&data, Uptane::Role::Delegation("role-1")));
+  });
+  both("load_all_delegations_8x1mb", 5, [](INvStorage& s) {
+    std::vector<std::pair<Uptane::Role, std::string>> data;
+    EXPECT_TRUE(s.loadAllDelegations(data));
+  });
+}
+
+/* A backlog of report events, as after a long time offline. */
+TEST_F(StorageBenchmark, DISABLED_ReportEvents) {
+  int saved = 0;
+  warm("save_report_event", kReportEvents - 1, [&](INvStorage& s) { s.saveReportEvent(reportEvent(saved++)); });
+  both("load_10k_report_events", 10, [](INvStorage& s) {
+    Json::Value events{Json::arrayValue};
+    int64_t max_id = 0;
+    EXPECT_TRUE(s.loadReportEvents(&events, &max_id, -1));
+  });
+  both("load_100_report_events", 100, [](INvStorage& s) {
+    Json::Value events{Json::arrayValue};
+    int64_t max_id = 0;
+    EXPECT_TRUE(s.loadReportEvents(&events, &max_id, 100));
+  });
+
+  const auto start = std::chrono::steady_clock::now();
+  Json::Value events{Json::arrayValue};
+  int64_t max_id = 0;
+  EXPECT_TRUE(storage().loadReportEvents(&events, &max_id, -1));
+  storage().deleteReportEvents(max_id);
+  const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  RecordProperty("flush_10k_report_events_ns", std::to_string(ns.count()));
+  std::cout << "flush_10k_report_events: " << ns.count() << " ns\n";
+}
+
+/* The ECUs of a vehicle with 50 ECUs and some installation history. */
+TEST_F(StorageBenchmark, DISABLED_Ecus) {
+  EcuSerials serials;
+  for (int i = 0; i < kEcus; ++i) {
+    serials.emplace_back(ecuSerial(i), Uptane::HardwareIdentifier("hardware-" + std::to_string(i)));
+  }
+  warm("store_50_ecu_serials", 20, [&](INvStorage& s) { s.storeEcuSerials(serials); });
+  both("load_50_ecu_serials", 100, [](INvStorage& s) {
+    EcuSerials loaded;
+    EXPECT_TRUE(s.loadEcuSerials(&loaded));
+  });
+
+  int version = 0;
+  warm("save_installed_version", 20 * kEcus, [&](INvStorage& s) {
+    const int ecu = version % kEcus;
+    s.saveInstalledVersion(ecuSerial(ecu).ToString(), ecuTarget(ecu, version / kEcus),
+                           InstalledVersionUpdateMode::kCurrent, "corr-id");
+    ++version;
+  });
+  both("load_installed_versions_50_ecus", 20, [](INvStorage& s) {
+    for (int i = 0; i < kEcus; ++i) {
+      boost::optional<Uptane::Target> current;
+      boost::optional<Uptane::Target> pending;
+      EXPECT_TRUE(s.loadInstalledVersions(ecuSerial(i).ToString(), &current, &pending));
+    }
+  });
+  both("load_installation_log", 100, [](INvStorage& s) {
+    std::vector<Uptane::Target> log;
+    EXPECT_TRUE(s.loadInstallationLog(ecuSerial(0).ToString(), &log, true));
+  });
+  both("has_pending_install", 1000, [](INvStorage& s) { EXPECT_FALSE(s.hasPendingInstall()); });
+
+  const data::InstallationResult result(data::ResultCode::Numeric::kOk, "Installed");
+  warm("save_ecu_installation_results_50_ecus", 20, [&](INvStorage& s) {
+    for (int i = 0; i < kEcus; ++i) {
+      s.saveEcuInstallationResult(ecuSerial(i), result);
+    }
+  });
+  both("load_ecu_installation_results_50_ecus", 100, [](INvStorage& s) {
+    std::vector<std::pair<Uptane::EcuSerial, data::InstallationResult>> results;
+    EXPECT_TRUE(s.loadEcuInstallationResults(&results));
+  });
+
+  int64_t counter = 0;
+  warm("save_ecu_report_counter", 1000, [&](INvStorage& s) { s.saveEcuReportCounter(ecuSerial(0), ++counter); });
+  storage().saveSecondaryInfo(ecuSerial(1), "IP", PublicKey("key", KeyType::kED25519));
+  const std::string manifest = Utils::jsonToCanonicalStr(reportEvent(0));
+  warm("store_cached_ecu_manifest", 1000, [&](INvStorage& s) { s.storeCachedEcuManifest(ecuSerial(1), manifest); });
+  both("load_cached_ecu_manifest", 1000, [](INvStorage& s) {
+    std::string data;
+    EXPECT_TRUE(s.loadCachedEcuManifest(ecuSerial(1), &data));
+  });
+}
+
+/* Device credentials and state, read at every start. */
+TEST_F(StorageBenchmark, DISABLED_Device) {
+  const std::string pem(2048, 'p');
+  warm("store_tls_creds", 100, [&](INvStorage& s) { s.storeTlsCreds(pem, pem, pem); });
+  both("load_tls_creds", 1000, [](INvStorage& s) {
+    std::string ca;
+    std::string cert;
+    std::string pkey;
+    EXPECT_TRUE(s.loadTlsCreds(&ca, &cert, &pkey));
+  });
+  warm("store_primary_keys", 100, [&](INvStorage& s) { s.storePrimaryKeys(pem, pem); });
+  both("load_primary_keys", 1000, [](INvStorage& s) {
+    std::string pub;
+    std::string priv;
+    EXPECT_TRUE(s.loadPrimaryKeys(&pub, &priv));
+  });
+  warm("store_device_id", 100, [](INvStorage& s) { s.storeDeviceId("device-id"); });
+  both("load_device_id", 1000, [](INvStorage& s) {
+    std::string id;
+    EXPECT_TRUE(s.loadDeviceId(&id));
+  });
+  warm("store_device_data_hash", 1000, [](INvStorage& s) { s.storeDeviceDataHash("hw_info", std::string(64, 'h')); });
+  both("load_device_data_hash", 1000, [](INvStorage& s) {
+    std::string hash;
+    EXPECT_TRUE(s.loadDeviceDataHash("hw_info", &hash));
+  });
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::warning);
+  return RUN_ALL_TESTS();
+}
+#endif
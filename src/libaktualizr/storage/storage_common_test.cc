@@ -416,6 +416,45 @@ TEST(StorageCommon, LoadStoreInstalledVersions) {
   }
 }
 
+/* Only the latest entries of the installation log are kept, besides the current and pending versions. */
+TEST(StorageCommon, InstallationLogRetention) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  config.installation_log_max_count = 2;
+  SQLStorage storage(config, false);
+  storage.storeEcuSerials({{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")},
+                           {Uptane::EcuSerial("secondary"), Uptane::HardwareIdentifier("secondary_hw")}});
+
+  auto target = [](int i) {
+    return Uptane::Target{"update" + std::to_string(i) + ".bin",
+                          Uptane::EcuMap{{Uptane::EcuSerial("primary"), Uptane::HardwareIdentifier("primary_hw")}},
+                          {Hash{Hash::Type::kSha256, "256" + std::to_string(i)}},
+                          static_cast<uint64_t>(i)};
+  };
+  storage.saveInstalledVersion("secondary", target(0), InstalledVersionUpdateMode::kCurrent, "");
+  storage.saveInstalledVersion("primary", target(1), InstalledVersionUpdateMode::kCurrent, "");
+  for (int i = 2; i <= 4; ++i) {
+    storage.saveInstalledVersion("primary", target(i), InstalledVersionUpdateMode::kPending, "");
+  }
+
+  std::vector<Uptane::Target> log;
+  EXPECT_TRUE(storage.loadInstallationLog("primary", &log, false));
+  ASSERT_EQ(log.size(), 3);
+  EXPECT_EQ(log[0].filename(), "update1.bin");
+  EXPECT_EQ(log[1].filename(), "update3.bin");
+  EXPECT_EQ(log[2].filename(), "update4.bin");
+
+  boost::optional<Uptane::Target> current;
+  boost::optional<Uptane::Target> pending;
+  EXPECT_TRUE(storage.loadInstalledVersions("primary", &current, &pending, nullptr));
+  EXPECT_EQ(current->filename(), "update1.bin");
+  EXPECT_EQ(pending->filename(), "update4.bin");
+  // Other ECUs keep their own entries
+  EXPECT_TRUE(storage.loadInstallationLog("secondary", &log, false));
+  EXPECT_EQ(log.size(), 1);
+}
+
 /*
  * Load and store an ECU installation result in an SQL database.
  * Load and store a device installation result in an SQL database.
@@ -645,6 +684,47 @@ TEST(StorageImport, ImportData) {
   EXPECT_EQ(tls_pkey, tls_pkey_in3);
 }
 
+/* Imported files are only read again when they or the stored data changed. */
+TEST(StorageImport, ImportFingerprint) {
+  TemporaryDirectory temp_dir;
+  std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
+  fs::create_directories(temp_dir / "import");
+
+  ImportConfig import_config;
+  import_config.base_path = temp_dir.Path() / "import";
+  import_config.tls_cacert_path = utils::BasedPath("ca");
+  const fs::path ca_path = import_config.tls_cacert_path.get(import_config.base_path);
+  Utils::writeFile(ca_path, std::string("tls_cacert_1"));
+
+  storage->importData(import_config);
+  std::string tls_ca;
+  EXPECT_TRUE(storage->loadTlsCa(&tls_ca));
+  EXPECT_EQ(tls_ca, "tls_cacert_1");
+  std::string fingerprint;
+  EXPECT_TRUE(storage->loadImportFingerprint(ca_path.string(), &fingerprint));
+  // Not part of the state of the device data reports
+  EXPECT_FALSE(storage->loadDeviceDataHash("import:" + ca_path.string(), nullptr));
+  storage->clearDeviceData();
+
+  // Nothing changed
+  storage->importData(import_config);
+  std::string fingerprint2;
+  EXPECT_TRUE(storage->loadImportFingerprint(ca_path.string(), &fingerprint2));
+  EXPECT_EQ(fingerprint2, fingerprint);
+
+  // The file changed
+  Utils::writeFile(ca_path, std::string("tls_cacert_2"));
+  storage->importData(import_config);
+  EXPECT_TRUE(storage->loadTlsCa(&tls_ca));
+  EXPECT_EQ(tls_ca, "tls_cacert_2");
+
+  // The stored data changed
+  storage->storeTlsCa("tls_cacert_3");
+  storage->importData(import_config);
+  EXPECT_TRUE(storage->loadTlsCa(&tls_ca));
+  EXPECT_EQ(tls_ca, "tls_cacert_2");
+}
+
 TEST(StorageImport, ImportInitialRoot) {
   TemporaryDirectory temp_dir;
   std::unique_ptr<INvStorage> storage = Storage(temp_dir.Path());
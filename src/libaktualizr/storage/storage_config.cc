@@ -5,6 +5,13 @@ void StorageConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt
   CopyFromConfig(type, "type", pt);
   CopyFromConfig(path, "path", pt);
   CopyFromConfig(sqldb_path, "sqldb_path", pt);
+  CopyFromConfig(compress_metadata, "compress_metadata", pt);
+  CopyFromConfig(write_ahead_log, "write_ahead_log", pt);
+  CopyFromConfig(sqldb_events_path, "sqldb_events_path", pt);
+  CopyFromConfig(report_events_max_count, "report_events_max_count", pt);
+  CopyFromConfig(report_events_max_size, "report_events_max_size", pt);
+  CopyFromConfig(installation_log_max_count, "installation_log_max_count", pt);
+  CopyFromConfig(memory_snapshot_interval, "memory_snapshot_interval", pt);
   CopyFromConfig(uptane_metadata_path, "uptane_metadata_path", pt);
   CopyFromConfig(uptane_private_key_path, "uptane_private_key_path", pt);
   CopyFromConfig(uptane_public_key_path, "uptane_public_key_path", pt);
@@ -17,6 +24,13 @@ void StorageConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, type, "type");
   writeOption(out_stream, path, "path");
   writeOption(out_stream, sqldb_path.get(""), "sqldb_path");
+  writeOption(out_stream, compress_metadata, "compress_metadata");
+  writeOption(out_stream, write_ahead_log, "write_ahead_log");
+  writeOption(out_stream, sqldb_events_path.get(""), "sqldb_events_path");
+  writeOption(out_stream, report_events_max_count, "report_events_max_count");
+  writeOption(out_stream, report_events_max_size, "report_events_max_size");
+  writeOption(out_stream, installation_log_max_count, "installation_log_max_count");
+  writeOption(out_stream, memory_snapshot_interval, "memory_snapshot_interval");
   writeOption(out_stream, uptane_metadata_path.get(""), "uptane_metadata_path");
   writeOption(out_stream, uptane_private_key_path.get(""), "uptane_private_key_path");
   writeOption(out_stream, uptane_public_key_path.get(""), "uptane_public_key_path");
@@ -5,9 +5,29 @@
 void TelemetryConfig::updateFromPropertyTree(const boost::property_tree::ptree& pt) {
   CopyFromConfig(report_network, "report_network", pt);
   CopyFromConfig(report_config, "report_config", pt);
+  CopyFromConfig(report_packages_delta, "report_packages_delta", pt);
+  CopyFromConfig(packages_full_report_interval, "packages_full_report_interval", pt);
+  CopyFromConfig(report_hardware_interval_sec, "report_hardware_interval_sec", pt);
+  CopyFromConfig(report_packages_interval_sec, "report_packages_interval_sec", pt);
+  CopyFromConfig(report_network_interval_sec, "report_network_interval_sec", pt);
+  CopyFromConfig(metrics_file, "metrics_file", pt);
+  CopyFromConfig(metrics_interval_sec, "metrics_interval_sec", pt);
+  CopyFromConfig(metrics_port, "metrics_port", pt);
+  CopyFromConfig(report_cycle_io, "report_cycle_io", pt);
+  CopyFromConfig(heap_report_interval_sec, "heap_report_interval_sec", pt);
 }
 
 void TelemetryConfig::writeToStream(std::ostream& out_stream) const {
   writeOption(out_stream, report_network, "report_network");
   writeOption(out_stream, report_config, "report_config");
+  writeOption(out_stream, report_packages_delta, "report_packages_delta");
+  writeOption(out_stream, packages_full_report_interval, "packages_full_report_interval");
+  writeOption(out_stream, report_hardware_interval_sec, "report_hardware_interval_sec");
+  writeOption(out_stream, report_packages_interval_sec, "report_packages_interval_sec");
+  writeOption(out_stream, report_network_interval_sec, "report_network_interval_sec");
+  writeOption(out_stream, metrics_file, "metrics_file");
+  writeOption(out_stream, metrics_interval_sec, "metrics_interval_sec");
+  writeOption(out_stream, metrics_port, "metrics_port");
+  writeOption(out_stream, report_cycle_io, "report_cycle_io");
+  writeOption(out_stream, heap_report_interval_sec, "heap_report_interval_sec");
 }
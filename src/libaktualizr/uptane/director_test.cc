@@ -1,8 +1,17 @@
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <string>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
 #include "directorrepository.h"
+#include "fetcher.h"
 #include "logging/logging.h"
+#include "storage/sqlstorage.h"
 #include "test_utils.h"
+#include "uptane/exceptions.h"
 #include "utilities/utils.h"
 
 boost::filesystem::path uptane_generator_path;
@@ -48,6 +57,175 @@ TEST(Director, EmptyTargets) {
   EXPECT_TRUE(director.latest_targets.targets.empty());
 }
 
+class CountingStorage : public SQLStorage {
+ public:
+  explicit CountingStorage(const StorageConfig& config) : SQLStorage(config, false) {}
+  bool loadNonRoot(std::string* data, RepositoryType repo, Role role) const override {
+    ++loads;
+    return SQLStorage::loadNonRoot(data, repo, role);
+  }
+  mutable int loads{0};
+};
+
+/*
+ * Stored metadata is only loaded and verified again by checkMetaOffline() once
+ * something was stored.
+ */
+TEST(Director, OfflineCache) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  CountingStorage storage(config);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  storage.storeRoot(Utils::readFile(meta_dir.Path() / "repo/director/root.json"), RepositoryType::Director(),
+                    Version(1));
+  storage.storeNonRoot(Utils::readFile(meta_dir.Path() / "repo/director/targets.json"), RepositoryType::Director(),
+                       Role::Targets());
+
+  DirectorRepository director;
+  EXPECT_NO_THROW(director.checkMetaOffline(storage));
+  EXPECT_NO_THROW(director.checkMetaOffline(storage));
+  EXPECT_EQ(storage.loads, 1);
+  EXPECT_TRUE(director.getTargets().targets.empty());
+
+  uptane_gen.run({"image", "--path", meta_dir.PathString(), "--filename", "tests/test_data/firmware.txt",
+                  "--targetname", "firmware.txt", "--hwid", "primary_hw"});
+  uptane_gen.run({"addtarget", "--path", meta_dir.PathString(), "--targetname", "firmware.txt", "--hwid", "primary_hw",
+                  "--serial", "CA:FE:A6:D2:84:9D"});
+  uptane_gen.run({"signtargets", "--path", meta_dir.PathString()});
+  storage.storeNonRoot(Utils::readFile(meta_dir.Path() / "repo/director/targets.json"), RepositoryType::Director(),
+                       Role::Targets());
+
+  EXPECT_NO_THROW(director.checkMetaOffline(storage));
+  EXPECT_EQ(storage.loads, 2);
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  // Also reloaded after the state was replaced by other means.
+  director.dropTargets(storage);
+  EXPECT_THROW(director.checkMetaOffline(storage), Uptane::SecurityException);
+  EXPECT_EQ(storage.loads, 3);
+}
+
+class FileFetcher : public IMetadataFetcher {
+ public:
+  explicit FileFetcher(boost::filesystem::path dir) : dir_(std::move(dir)) {}
+  void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Role& role, Version version,
+                 const api::FlowControlToken* flow_control) const override {
+    (void)maxsize;
+    (void)flow_control;
+    if (role == Role::Root()) {
+      ++root_requests;
+    }
+    ++role_requests;
+    const boost::filesystem::path path = dir_ / version.RoleFileName(role);
+    if (!boost::filesystem::exists(path)) {
+      throw MetadataFetchFailure(repo, role.ToString());
+    }
+    *result = Utils::readFile(path);
+  }
+  bool fetchBundle(MetaFiles* result, RepositoryType repo, const MetaVersions& versions,
+                   const api::FlowControlToken* flow_control) const override {
+    (void)repo;
+    (void)flow_control;
+    if (!bundle) {
+      return false;
+    }
+    ++bundle_requests;
+    result->clear();
+    for (int version = versions.at("root") + 1;; ++version) {
+      const std::string name = Version(version).RoleFileName(Role::Root());
+      if (!boost::filesystem::exists(dir_ / name)) {
+        break;
+      }
+      (*result)[name] = Utils::readFile(dir_ / name);
+    }
+    const std::string targets = Utils::readFile(dir_ / "targets.json");
+    if (extractVersionUntrusted(targets) > versions.at("targets")) {
+      (*result)["targets.json"] = targets;
+    }
+    return true;
+  }
+  bool bundle{false};
+  mutable int root_requests{0};
+  mutable int role_requests{0};
+  mutable int bundle_requests{0};
+
+ private:
+  boost::filesystem::path dir_;
+};
+
+/*
+ * The next Root version is only requested once per probe interval, unless a
+ * check is required.
+ */
+TEST(Director, RootProbeInterval) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  FileFetcher fetcher(meta_dir.Path() / "repo/director");
+
+  // 1.root.json, then 2.root.json on every update by default
+  DirectorRepository director;
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.root_requests, 2);
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.root_requests, 3);
+
+  director.setRootProbeInterval(std::chrono::hours(1));
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.root_requests, 3);
+
+  director.requireRootProbe();
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.root_requests, 4);
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.root_requests, 4);
+}
+
+/*
+ * With a bundle, only what it leaves out is requested on its own, and an empty
+ * bundle means that nothing has changed.
+ */
+TEST(Director, MetadataBundle) {
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+
+  Process uptane_gen(uptane_generator_path.string());
+  uptane_gen.run({"generate", "--path", meta_dir.PathString(), "--correlationid", "cid1"});
+  FileFetcher fetcher(meta_dir.Path() / "repo/director");
+  fetcher.bundle = true;
+
+  // 2.root.json can't be known to be missing before any Root is stored.
+  DirectorRepository director;
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.bundle_requests, 1);
+  EXPECT_EQ(fetcher.role_requests, 1);
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.bundle_requests, 2);
+  EXPECT_EQ(fetcher.role_requests, 1);
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+
+  // Without a bundle, every role is requested.
+  fetcher.bundle = false;
+  EXPECT_NO_THROW(director.updateMeta(storage, fetcher, nullptr));
+  EXPECT_EQ(fetcher.bundle_requests, 2);
+  EXPECT_EQ(fetcher.role_requests, 3);
+  EXPECT_EQ(director.getTargets().targets.size(), 1);
+}
+
 }  // namespace Uptane
 
 #ifndef __NO_MAIN__
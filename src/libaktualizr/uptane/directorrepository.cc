@@ -48,6 +48,7 @@ bool DirectorRepository::usePreviousTargets() const {
 }
 
 void DirectorRepository::verifyTargets(const std::string& targets_raw) {
+  invalidateVerified();
   try {
     // Verify the signature:
     latest_targets = Targets(RepositoryType::Director(), Role::Targets(), Utils::parseJSON(targets_raw),
@@ -63,6 +64,15 @@ void DirectorRepository::verifyTargets(const std::string& targets_raw) {
 }
 
 void DirectorRepository::checkMetaOffline(INvStorage& storage) {
+  if (verifiedFromStorage(storage)) {
+    if (rootExpired()) {
+      throw Uptane::ExpiredMetadata(RepositoryType::Director(), Role::ROOT);
+    }
+    checkTargetsExpired();
+    return;
+  }
+
+  const MetaRevision revision = storage.metaRevision();
   resetMeta();
   // Load Director Root Metadata
   {
@@ -92,6 +102,8 @@ void DirectorRepository::checkMetaOffline(INvStorage& storage) {
 
     targetsSanityCheck();
   }
+
+  setVerifiedRevision(revision);
 }
 
 void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
@@ -102,7 +114,12 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
   // reset Director repo to initial state before starting Uptane iteration
   resetMeta();
 
-  updateRoot(storage, fetcher, RepositoryType::Director());
+  // Get all the metadata that has changed at once, if the server can send it.
+  const BundleFetcher bundle_fetcher(
+      fetcher, RepositoryType::Director(),
+      storedVersions(storage, RepositoryType::Director(), {Role::Root(), Role::Targets()}), flow_control);
+
+  updateRoot(storage, bundle_fetcher, RepositoryType::Director());
 
   // Not supported: 3. Download and check the Timestamp metadata file from the Director repository, following the
   // procedure in Section 5.4.4.4. Not supported: 4. Download and check the Snapshot metadata file from the Director
@@ -111,9 +128,10 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
   // Update Director Targets Metadata
   {
     std::string director_targets;
+    MetaValidators validators;
 
-    fetcher.fetchLatestRole(&director_targets, kMaxDirectorTargetsSize, RepositoryType::Director(), Role::Targets(),
-                            flow_control);
+    const bool modified = fetchLatestIfModified(storage, bundle_fetcher, RepositoryType::Director(), Role::Targets(),
+                                                kMaxDirectorTargetsSize, &director_targets, &validators, flow_control);
     int remote_version = extractVersionUntrusted(director_targets);
 
     int local_version;
@@ -138,6 +156,11 @@ void DirectorRepository::updateMeta(INvStorage& storage, const IMetadataFetcher&
       throw Uptane::SecurityException(RepositoryType::Director(), "Rollback attempt");
     } else if (local_version < remote_version && !usePreviousTargets()) {
       storage.storeNonRoot(director_targets, RepositoryType::Director(), Role::Targets());
+      director_targets_stored = director_targets;
+    }
+    // Only remember the validators if they describe what is stored.
+    if (modified && director_targets_stored == director_targets) {
+      storeValidators(storage, RepositoryType::Director(), Role::Targets(), validators);
     }
 
     checkTargetsExpired();
@@ -22,6 +22,7 @@ class DirectorRepository : public RepositoryCommon {
   }
   Uptane::CorrelationId getCorrelationId() const { return correlation_id_; }
   void checkMetaOffline(INvStorage& storage) override;
+  TimeStamp nextExpiry() const override { return TimeStamp::Earliest(root.expiry(), latest_targets.expiry()); }
   void dropTargets(INvStorage& storage);
 
   void updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
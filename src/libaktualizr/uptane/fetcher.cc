@@ -1,24 +1,174 @@
 #include "fetcher.h"
 
+#include <utility>
+
+#include "logging/logging.h"
 #include "uptane/exceptions.h"
 
 namespace Uptane {
 
-void Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
-                        Version version, const api::FlowControlToken* flow_control) const {
-  std::string url = (repo == RepositoryType::Director()) ? director_server : repo_server;
+std::shared_ptr<MirrorSet> Fetcher::mirrors(RepositoryType repo) const {
+  return (repo == RepositoryType::Director()) ? director_mirrors : repo_mirrors;
+}
+
+std::string Fetcher::rolePath(const Uptane::Role& role, Version version) {
+  std::string path;
   if (role.IsDelegation()) {
-    url += "/delegations";
+    path += "/delegations";
   }
-  url += "/" + version.RoleFileName(role);
-  HttpResponse response = http->get(url, maxsize, flow_control);
+  path += "/" + version.RoleFileName(role);
+  return path;
+}
+
+int64_t Fetcher::limit(int64_t maxsize) const {
+  if (max_size > 0 && (maxsize <= 0 || maxsize > max_size)) {
+    return max_size;
+  }
+  return maxsize;
+}
+
+void Fetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                        Version version, const api::FlowControlToken* flow_control) const {
+  HttpResponse response = mirrors(repo)->fetch(
+      [http = http, path = rolePath(role, version), size = limit(maxsize)](
+          const std::string& base, const api::FlowControlToken* token) { return http->get(base + path, size, token); },
+      flow_control);
   if (flow_control != nullptr && flow_control->hasAborted()) {
     throw Uptane::LocallyAborted(repo);
   }
   if (!response.isOk()) {
     throw Uptane::MetadataFetchFailure(repo, role.ToString());
   }
-  *result = response.body;
+  *result = std::move(response.body);
+}
+
+bool Fetcher::fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo,
+                                        const Uptane::Role& role, MetaValidators* validators,
+                                        const api::FlowControlToken* flow_control) const {
+  HttpResponse response = mirrors(repo)->fetch(
+      [http = http, path = rolePath(role, Version()), size = limit(maxsize), local = *validators](
+          const std::string& base, const api::FlowControlToken* token) {
+        return http->getConditional(base + path, size, token, local.etag, local.last_modified);
+      },
+      flow_control);
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    throw Uptane::LocallyAborted(repo);
+  }
+  if (response.notModified() && !validators->empty()) {
+    LOG_DEBUG << repo << " " << role << " metadata is unchanged";
+    return false;
+  }
+  if (!response.isOk() || response.notModified()) {
+    throw Uptane::MetadataFetchFailure(repo, role.ToString());
+  }
+  validators->etag = response.etag;
+  validators->last_modified = response.last_modified;
+  *result = std::move(response.body);
+  return true;
+}
+
+bool Fetcher::fetchBundle(MetaFiles* result, RepositoryType repo, const MetaVersions& versions,
+                          const api::FlowControlToken* flow_control) const {
+  if (!bundle) {
+    return false;
+  }
+  std::string path = "/bundle.json";
+  char separator = '?';
+  for (const auto& it : versions) {
+    path += separator + it.first + "=" + std::to_string(it.second);
+    separator = '&';
+  }
+  HttpResponse response = mirrors(repo)->fetch(
+      [http = http, path, size = limit(kMaxMetaBundleSize)](const std::string& base,
+                                                            const api::FlowControlToken* token) {
+        return http->get(base + path, size, token);
+      },
+      flow_control);
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    throw Uptane::LocallyAborted(repo);
+  }
+  if (!response.isOk()) {
+    throw Uptane::MetadataFetchFailure(repo, "bundle");
+  }
+  const Json::Value json = response.getJson();
+  if (!json.isObject()) {
+    throw Uptane::MetadataFetchFailure(repo, "bundle");
+  }
+  result->clear();
+  for (auto it = json.begin(); it != json.end(); ++it) {
+    if (!it->isString()) {
+      throw Uptane::MetadataFetchFailure(repo, "bundle");
+    }
+    (*result)[it.name()] = it->asString();
+  }
+  return true;
+}
+
+BundleFetcher::BundleFetcher(const IMetadataFetcher& fetcher, RepositoryType repo, MetaVersions versions,
+                             const api::FlowControlToken* flow_control)
+    : fetcher_(fetcher), repo_(repo), versions_(std::move(versions)) {
+  try {
+    have_bundle_ = fetcher_.fetchBundle(&bundle_, repo_, versions_, flow_control);
+  } catch (const Uptane::MetadataFetchFailure& e) {
+    LOG_INFO << "Fetching the " << repo_ << " metadata one role at a time: " << e.what();
+  }
+}
+
+int BundleFetcher::sentVersion(RepositoryType repo, const Uptane::Role& role) const {
+  if (!have_bundle_ || !(repo == repo_) || role.IsDelegation()) {
+    return -1;
+  }
+  if (new_root_ && role != Role::Root()) {
+    // The stored metadata has been dropped, so whatever was left out of the
+    // bundle has to be fetched.
+    return 0;
+  }
+  const auto it = versions_.find(role.ToString());
+  return it == versions_.end() ? -1 : it->second;
+}
+
+bool BundleFetcher::fromBundle(std::string* result, int64_t maxsize, const Uptane::Role& role, Version version) const {
+  const auto it = bundle_.find(version.RoleFileName(role));
+  if (it == bundle_.end()) {
+    return false;
+  }
+  // Enforce the same limits as for the separate requests.
+  if (maxsize > 0 && static_cast<int64_t>(it->second.size()) > maxsize) {
+    throw Uptane::MetadataFetchFailure(repo_, role.ToString());
+  }
+  *result = it->second;
+  return true;
+}
+
+void BundleFetcher::fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                              Version version, const api::FlowControlToken* flow_control) const {
+  const int sent = sentVersion(repo, role);
+  if (sent >= 0 && fromBundle(result, maxsize, role, version)) {
+    if (role == Role::Root() && version.version() > sent) {
+      new_root_ = true;
+    }
+    return;
+  }
+  // The bundle holds all the Root versions after the one we have.
+  if (sent > 0 && role == Role::Root() && version.version() > sent) {
+    throw Uptane::MetadataFetchFailure(repo, version.RoleFileName(role));
+  }
+  fetcher_.fetchRole(result, maxsize, repo, role, version, flow_control);
+}
+
+bool BundleFetcher::fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo,
+                                              const Uptane::Role& role, MetaValidators* validators,
+                                              const api::FlowControlToken* flow_control) const {
+  const int sent = sentVersion(repo, role);
+  if (sent >= 0 && fromBundle(result, maxsize, role, Version())) {
+    *validators = MetaValidators();
+    return true;
+  }
+  if (sent > 0) {
+    LOG_DEBUG << repo << " " << role << " metadata is unchanged";
+    return false;
+  }
+  return fetcher_.fetchLatestRoleIfModified(result, maxsize, repo, role, validators, flow_control);
 }
 
 }  // namespace Uptane
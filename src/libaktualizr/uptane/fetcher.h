@@ -1,7 +1,11 @@
 #ifndef UPTANE_FETCHER_H_
 #define UPTANE_FETCHER_H_
 
+#include <map>
+#include <string>
+
 #include "http/httpinterface.h"
+#include "http/mirror_set.h"
 #include "libaktualizr/config.h"
 #include "tuf.h"
 #include "utilities/flow_control.h"
@@ -13,6 +17,29 @@ constexpr int64_t kMaxDirectorTargetsSize = 64L * 1024;
 constexpr int64_t kMaxTimestampSize = 64L * 1024;
 constexpr int64_t kMaxSnapshotSize = 64L * 1024;
 constexpr int64_t kMaxImageTargetsSize = 8L * 1024 * 1024;
+constexpr int64_t kMaxMetaBundleSize = kMaxImageTargetsSize + 1L * 1024 * 1024;
+
+/**
+ * HTTP cache validators of a metadata file, as sent by the server along with
+ * it. Used to ask the server to only send the file again if it has changed.
+ */
+struct MetaValidators {
+  std::string etag;
+  std::string last_modified;
+  bool empty() const { return etag.empty() && last_modified.empty(); }
+};
+
+/**
+ * Versions of the metadata of a repository that the client has, by role name
+ * ("root", "timestamp", ...). 0 means that the role is not stored.
+ */
+using MetaVersions = std::map<std::string, int>;
+
+/**
+ * Metadata sent by the server in one response, by file name as in
+ * Version::RoleFileName() ("2.root.json", "timestamp.json", ...).
+ */
+using MetaFiles = std::map<std::string, std::string>;
 
 class IMetadataFetcher {
  public:
@@ -47,6 +74,46 @@ class IMetadataFetcher {
     fetchRole(result, maxsize, repo, role, Version(), flow_control);
   }
 
+  /**
+   * Fetch the latest version of a role, unless the server reports that it
+   * hasn't changed since the response that carried the given validators.
+   *
+   * Fetchers that don't support conditional requests always fetch the role.
+   * @param validators Validators of the local copy, replaced by the ones of
+   *                   the new response when the role is fetched
+   * @return false if the role is unchanged, in which case result is untouched
+   * @throws Uptane::MetadataFetchFailure If fetching metadata fails (e.g. network error)
+   * @throws Uptane::LocallyAborted If the caller aborts with flow_control->hasAborted()
+   */
+  virtual bool fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo,
+                                         const Uptane::Role& role, MetaValidators* validators,
+                                         const api::FlowControlToken* flow_control) const {
+    fetchLatestRole(result, maxsize, repo, role, flow_control);
+    *validators = MetaValidators();
+    return true;
+  }
+
+  /**
+   * Fetch, in one request, the metadata of a repository that is newer than
+   * the given versions: all versions of Root after the given one and the
+   * latest version of each other role that has changed.
+   *
+   * The metadata is not verified; it is used in place of the responses to
+   * the requests for each role. See BundleFetcher.
+   * @return false if the fetcher doesn't fetch bundles, in which case the
+   *         roles are fetched one by one
+   * @throws Uptane::MetadataFetchFailure If fetching the bundle fails
+   * @throws Uptane::LocallyAborted If the caller aborts with flow_control->hasAborted()
+   */
+  virtual bool fetchBundle(MetaFiles* result, RepositoryType repo, const MetaVersions& versions,
+                           const api::FlowControlToken* flow_control) const {
+    (void)result;
+    (void)repo;
+    (void)versions;
+    (void)flow_control;
+    return false;
+  }
+
  protected:
   IMetadataFetcher() = default;
   IMetadataFetcher(IMetadataFetcher&&) = default;
@@ -55,20 +122,81 @@ class IMetadataFetcher {
 class Fetcher : public IMetadataFetcher {
  public:
   Fetcher(const Config& config_in, std::shared_ptr<HttpInterface> http_in)
-      : Fetcher(config_in.uptane.repo_server, config_in.uptane.director_server, std::move(http_in)) {}
+      : http(std::move(http_in)),
+        repo_server(config_in.uptane.repo_server),
+        director_server(config_in.uptane.director_server),
+        repo_mirrors(std::make_shared<MirrorSet>(repo_server, config_in.uptane.repo_mirrors)),
+        director_mirrors(std::make_shared<MirrorSet>(director_server, config_in.uptane.director_mirrors)),
+        bundle(config_in.uptane.metadata_bundle),
+        max_size(static_cast<int64_t>(config_in.uptane.max_metadata_size_kb) * 1024) {}
   Fetcher(std::string repo_server_in, std::string director_server_in, std::shared_ptr<HttpInterface> http_in)
       : http(std::move(http_in)),
         repo_server(std::move(repo_server_in)),
-        director_server(std::move(director_server_in)) {}
+        director_server(std::move(director_server_in)),
+        repo_mirrors(std::make_shared<MirrorSet>(repo_server)),
+        director_mirrors(std::make_shared<MirrorSet>(director_server)) {}
   void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role, Version version,
                  const api::FlowControlToken* flow_control) const override;
+  bool fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                                 MetaValidators* validators, const api::FlowControlToken* flow_control) const override;
+  bool fetchBundle(MetaFiles* result, RepositoryType repo, const MetaVersions& versions,
+                   const api::FlowControlToken* flow_control) const override;
 
   std::string getRepoServer() const { return repo_server; }
+  /** The Image repository server and its mirrors, which also serve the targets. */
+  std::shared_ptr<MirrorSet> getRepoMirrors() const { return repo_mirrors; }
 
  private:
+  std::shared_ptr<MirrorSet> mirrors(RepositoryType repo) const;
+  static std::string rolePath(const Uptane::Role& role, Version version);
+  // The given limit, lowered to max_size if that is set.
+  int64_t limit(int64_t maxsize) const;
+
   std::shared_ptr<HttpInterface> http;
   std::string repo_server;
   std::string director_server;
+  std::shared_ptr<MirrorSet> repo_mirrors;
+  std::shared_ptr<MirrorSet> director_mirrors;
+  bool bundle{false};
+  // Limit to the size of any response; 0 for none
+  int64_t max_size{0};
+};
+
+/**
+ * Serve the requests for the roles of a repository from a bundle fetched
+ * once when constructed, and pass all other requests on to another fetcher.
+ *
+ * The repositories request and verify the metadata in the same order as
+ * without a bundle. A role that is left out of the bundle although its
+ * version was given is unchanged; this is reported as such to conditional
+ * requests, and a missing Root version ends the search for a new Root. Once a
+ * new Root is served, the other stored metadata is gone and this no longer
+ * holds.
+ * Other roles that are not in the bundle, and all roles if the bundle could
+ * not be fetched, are fetched one by one.
+ */
+class BundleFetcher : public IMetadataFetcher {
+ public:
+  BundleFetcher(const IMetadataFetcher& fetcher, RepositoryType repo, MetaVersions versions,
+                const api::FlowControlToken* flow_control);
+  void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role, Version version,
+                 const api::FlowControlToken* flow_control) const override;
+  bool fetchLatestRoleIfModified(std::string* result, int64_t maxsize, RepositoryType repo, const Uptane::Role& role,
+                                 MetaValidators* validators, const api::FlowControlToken* flow_control) const override;
+
+ private:
+  // Version of the role sent with the bundle request, or -1 if the bundle doesn't cover the role.
+  int sentVersion(RepositoryType repo, const Uptane::Role& role) const;
+  // Get the role from the bundle, checking its size.
+  bool fromBundle(std::string* result, int64_t maxsize, const Uptane::Role& role, Version version) const;
+
+  const IMetadataFetcher& fetcher_;
+  RepositoryType repo_;
+  MetaVersions versions_;
+  MetaFiles bundle_;
+  bool have_bundle_{false};
+  // A new Root was served, after which the other stored metadata is dropped.
+  mutable bool new_root_{false};
 };
 
 }  // namespace Uptane
@@ -0,0 +1,89 @@
+#include "uptane/image_hash_cache.h"
+
+#include <sys/stat.h>
+#include <array>
+#include <fstream>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+
+namespace Uptane {
+
+bool ImageHashCache::Identity::operator==(const Identity &other) const {
+  return device == other.device && inode == other.inode && size == other.size &&
+         modified.tv_sec == other.modified.tv_sec && modified.tv_nsec == other.modified.tv_nsec &&
+         changed.tv_sec == other.changed.tv_sec && changed.tv_nsec == other.changed.tv_nsec;
+}
+
+bool ImageHashCache::identify(const boost::filesystem::path &path, Identity *identity) {
+  struct stat st {};
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  identity->device = st.st_dev;
+  identity->inode = st.st_ino;
+  identity->size = static_cast<uint64_t>(st.st_size);
+  identity->modified = st.st_mtim;
+  identity->changed = st.st_ctim;
+  return true;
+}
+
+bool ImageHashCache::get(const boost::filesystem::path &path, std::string *hash, uint64_t *length) const {
+  Identity identity;
+  if (!identify(path, &identity)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (path == path_ && identity == identity_) {
+    *hash = hash_;
+    *length = length_;
+    return true;
+  }
+
+  LOG_DEBUG << "Hashing the image " << path;
+  std::ifstream file(path.c_str(), std::ios::binary);
+  if (!file.good()) {
+    return false;
+  }
+  auto hasher = MultiPartHasher::create(Hash::Type::kSha256);
+  std::array<char, 64 * 1024> buf{};
+  uint64_t read = 0;
+  while (file.read(buf.data(), buf.size()) || file.gcount() > 0) {
+    hasher->update(reinterpret_cast<const unsigned char *>(buf.data()), static_cast<uint64_t>(file.gcount()));
+    read += static_cast<uint64_t>(file.gcount());
+  }
+  if (file.bad()) {
+    return false;
+  }
+
+  // Modified while being read: hashed again next time.
+  Identity after;
+  if (identify(path, &after) && after == identity) {
+    path_ = path;
+    identity_ = identity;
+  } else {
+    path_.clear();
+  }
+  hash_ = boost::algorithm::to_lower_copy(hasher->getHexDigest());
+  length_ = read;
+  *hash = hash_;
+  *length = length_;
+  return true;
+}
+
+void ImageHashCache::set(const boost::filesystem::path &path, const std::string &hash, uint64_t length) {
+  Identity identity;
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (!identify(path, &identity) || identity.size != length) {
+    path_.clear();
+    return;
+  }
+  path_ = path;
+  identity_ = identity;
+  hash_ = boost::algorithm::to_lower_copy(hash);
+  length_ = length;
+}
+
+}  // namespace Uptane
@@ -0,0 +1,57 @@
+#ifndef UPTANE_IMAGE_HASH_CACHE_H_
+#define UPTANE_IMAGE_HASH_CACHE_H_
+
+#include <sys/types.h>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+namespace Uptane {
+
+/**
+ * Hash and length of an installed image, for the manifests of a Secondary,
+ * kept along with the identity of the file they are of: its device, inode,
+ * size and modification and change times. The file is only read again when
+ * it was replaced or modified since, so that reporting a large image doesn't
+ * read all of it on every manifest.
+ */
+class ImageHashCache {
+ public:
+  /**
+   * The lower-case hex SHA-256 of the file, as
+   * ManifestIssuer::generateVersionHashStr() of its content, and its length.
+   * @return false if the file can't be read
+   */
+  bool get(const boost::filesystem::path &path, std::string *hash, uint64_t *length) const;
+  /**
+   * Record the hash of the file as it is now, known without reading it, such
+   * as after it was verified when installed.
+   */
+  void set(const boost::filesystem::path &path, const std::string &hash, uint64_t length);
+
+ private:
+  struct Identity {
+    dev_t device{0};
+    ino_t inode{0};
+    uint64_t size{0};
+    timespec modified{};
+    timespec changed{};
+
+    bool operator==(const Identity &other) const;
+  };
+
+  static bool identify(const boost::filesystem::path &path, Identity *identity);
+
+  mutable std::mutex mutex_;
+  mutable boost::filesystem::path path_;
+  mutable Identity identity_;
+  mutable std::string hash_;
+  mutable uint64_t length_{0};
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_IMAGE_HASH_CACHE_H_
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include <string>
+
+#include "uptane/image_hash_cache.h"
+#include "uptane/manifest.h"
+#include "utilities/utils.h"
+
+/* The hash of a file is that of its content, computed again once the file changed. */
+TEST(ImageHashCache, Get) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path image = temp_dir / "image";
+  Uptane::ImageHashCache cache;
+  std::string hash;
+  uint64_t length = 0;
+  EXPECT_FALSE(cache.get(image, &hash, &length));
+
+  Utils::writeFile(image, std::string("first image"));
+  ASSERT_TRUE(cache.get(image, &hash, &length));
+  EXPECT_EQ(hash, Uptane::ManifestIssuer::generateVersionHashStr("first image"));
+  EXPECT_EQ(length, 11);
+
+  // Same size, but rewritten
+  const std::time_t written = boost::filesystem::last_write_time(image);
+  Utils::writeFile(image, std::string("other image"));
+  boost::filesystem::last_write_time(image, written + 10);
+  ASSERT_TRUE(cache.get(image, &hash, &length));
+  EXPECT_EQ(hash, Uptane::ManifestIssuer::generateVersionHashStr("other image"));
+
+  // Replaced
+  Utils::writeFile(temp_dir / "new", std::string());
+  boost::filesystem::rename(temp_dir / "new", image);
+  ASSERT_TRUE(cache.get(image, &hash, &length));
+  EXPECT_EQ(hash, Uptane::ManifestIssuer::generateVersionHashStr(""));
+  EXPECT_EQ(length, 0);
+}
+
+/* A recorded hash is returned without reading the file, as long as it is unchanged. */
+TEST(ImageHashCache, Set) {
+  TemporaryDirectory temp_dir;
+  const boost::filesystem::path image = temp_dir / "image";
+  Utils::writeFile(image, std::string("image"));
+  Uptane::ImageHashCache cache;
+  cache.set(image, "ABCDEF", 5);
+
+  std::string hash;
+  uint64_t length = 0;
+  ASSERT_TRUE(cache.get(image, &hash, &length));
+  EXPECT_EQ(hash, "abcdef");
+  EXPECT_EQ(length, 5);
+
+  // Not recorded for a file of another length
+  cache.set(image, "ABCDEF", 6);
+  ASSERT_TRUE(cache.get(image, &hash, &length));
+  EXPECT_EQ(hash, Uptane::ManifestIssuer::generateVersionHashStr("image"));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
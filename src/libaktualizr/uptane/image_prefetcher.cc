@@ -0,0 +1,186 @@
+#include "uptane/image_prefetcher.h"
+
+#include "logging/logging.h"
+#include "storage/invstorage.h"
+#include "uptane/exceptions.h"
+#include "utilities/executor.h"
+#include "utilities/utils.h"
+
+namespace Uptane {
+
+namespace {
+
+// Version of a role listed in the "meta" of a Timestamp or Snapshot, or -1
+int listedVersion(const std::string &meta, const std::string &file_name) {
+  try {
+    const Json::Value version = Utils::parseJSON(meta)["signed"]["meta"][file_name]["version"];
+    return version.isIntegral() ? version.asInt() : -1;
+  } catch (const std::exception &) {
+    return -1;
+  }
+}
+
+}  // namespace
+
+ImagePrefetcher::ImagePrefetcher(const IMetadataFetcher &fetcher, INvStorage &storage, bool probe_root)
+    : fetcher_{fetcher}, probe_root_{probe_root} {
+  const RepositoryType repo = RepositoryType::Image();
+  std::string stored;
+  stored_versions_["root"] = storage.loadLatestRoot(&stored, repo) ? std::max(extractVersionUntrusted(stored), 0) : 0;
+  if (storage.loadNonRoot(&stored_timestamp_, repo, Role::Timestamp())) {
+    // As sent by RepositoryCommon::fetchLatestIfModified()
+    storage.loadMetaValidators(&timestamp_.sent_validators.etag, &timestamp_.sent_validators.last_modified, repo,
+                               Role::Timestamp());
+  }
+  stored_versions_["timestamp"] = std::max(extractVersionUntrusted(stored_timestamp_), 0);
+  if (storage.loadNonRoot(&stored_snapshot_, repo, Role::Snapshot())) {
+    snapshot_version_ = std::max(extractVersionUntrusted(stored_snapshot_), 0);
+  }
+  stored_versions_["snapshot"] = snapshot_version_;
+  if (storage.loadNonRoot(&stored, repo, Role::Targets())) {
+    targets_version_ = std::max(extractVersionUntrusted(stored), 0);
+  }
+  stored_versions_["targets"] = targets_version_;
+
+  done_ = Executor::io().submit([this]() { prefetch(); });
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+  cancel_.setAbort();
+  done_.wait();
+}
+
+void ImagePrefetcher::prefetch() {
+  const RepositoryType repo = RepositoryType::Image();
+  try {
+    if (fetcher_.fetchBundle(&bundle_, repo, stored_versions_, &cancel_)) {
+      bundle_state_ = BundleState::kFetched;
+      return;
+    }
+  } catch (const Uptane::MetadataFetchFailure &) {
+    bundle_state_ = BundleState::kFailed;
+  } catch (const std::exception &) {
+    return;
+  }
+
+  // Without a stored Root, the first one is fetched before anything else.
+  if (stored_versions_["root"] == 0) {
+    return;
+  }
+  if (probe_root_) {
+    prefetchRole(&root_, Role::Root(), Version(stored_versions_["root"] + 1), kMaxRootSize);
+  }
+
+  timestamp_.validators = timestamp_.sent_validators;
+  try {
+    timestamp_.modified = fetcher_.fetchLatestRoleIfModified(&timestamp_.body, kMaxTimestampSize, repo,
+                                                             Role::Timestamp(), &timestamp_.validators, &cancel_);
+    timestamp_.state = Response::State::kFetched;
+  } catch (const Uptane::MetadataFetchFailure &) {
+    timestamp_.state = Response::State::kFailed;
+    return;
+  } catch (const std::exception &) {
+    return;
+  }
+
+  // The versions of the next roles are only known from the metadata before them.
+  const std::string &timestamp = timestamp_.modified ? timestamp_.body : stored_timestamp_;
+  const int snapshot_version = listedVersion(timestamp, "snapshot.json");
+  std::string snapshot = stored_snapshot_;
+  if (snapshot_version != snapshot_version_) {
+    prefetchRole(&snapshot_, Role::Snapshot(), Version(), kMaxSnapshotSize);
+    if (snapshot_.state != Response::State::kFetched) {
+      return;
+    }
+    snapshot = snapshot_.body;
+  }
+  if (listedVersion(snapshot, "targets.json") != targets_version_) {
+    prefetchRole(&targets_, Role::Targets(), Version(), kMaxImageTargetsSize);
+  }
+}
+
+void ImagePrefetcher::prefetchRole(Response *response, const Role &role, Version version, int64_t maxsize) {
+  try {
+    fetcher_.fetchRole(&response->body, maxsize, RepositoryType::Image(), role, version, &cancel_);
+    response->state = Response::State::kFetched;
+  } catch (const Uptane::MetadataFetchFailure &) {
+    response->state = Response::State::kFailed;
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Prefetch of the Image repo " << role << " metadata stopped: " << e.what();
+  }
+}
+
+bool ImagePrefetcher::take(Response *response, int64_t maxsize) const {
+  done_.wait();
+  if (response->state == Response::State::kNone ||
+      (maxsize > 0 && static_cast<int64_t>(response->body.size()) > maxsize)) {
+    return false;
+  }
+  ++served_;
+  return true;
+}
+
+void ImagePrefetcher::fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role,
+                                Version version, const api::FlowControlToken *flow_control) const {
+  Response *response = nullptr;
+  if (repo == RepositoryType::Image() && !role.IsDelegation()) {
+    if (role == Role::Root() && version.version() == stored_versions_.at("root") + 1) {
+      response = &root_;
+    } else if (role == Role::Snapshot() && version == Version()) {
+      response = &snapshot_;
+    } else if (role == Role::Targets() && version == Version()) {
+      response = &targets_;
+    }
+  }
+  if (response != nullptr && take(response, maxsize)) {
+    const Response taken = std::move(*response);
+    *response = Response();
+    if (taken.state == Response::State::kFailed) {
+      throw Uptane::MetadataFetchFailure(repo, role.ToString());
+    }
+    *result = taken.body;
+    return;
+  }
+  fetcher_.fetchRole(result, maxsize, repo, role, version, flow_control);
+}
+
+bool ImagePrefetcher::fetchLatestRoleIfModified(std::string *result, int64_t maxsize, RepositoryType repo,
+                                                const Uptane::Role &role, MetaValidators *validators,
+                                                const api::FlowControlToken *flow_control) const {
+  if (repo == RepositoryType::Image() && role == Role::Timestamp() &&
+      validators->etag == timestamp_.sent_validators.etag &&
+      validators->last_modified == timestamp_.sent_validators.last_modified && take(&timestamp_, maxsize)) {
+    const Response taken = std::move(timestamp_);
+    timestamp_ = Response();
+    if (taken.state == Response::State::kFailed) {
+      throw Uptane::MetadataFetchFailure(repo, role.ToString());
+    }
+    if (taken.modified) {
+      *result = taken.body;
+      *validators = taken.validators;
+    }
+    return taken.modified;
+  }
+  return fetcher_.fetchLatestRoleIfModified(result, maxsize, repo, role, validators, flow_control);
+}
+
+bool ImagePrefetcher::fetchBundle(MetaFiles *result, RepositoryType repo, const MetaVersions &versions,
+                                  const api::FlowControlToken *flow_control) const {
+  if (repo == RepositoryType::Image() && versions == stored_versions_) {
+    done_.wait();
+    const BundleState state = bundle_state_;
+    bundle_state_ = BundleState::kUnsupported;
+    if (state == BundleState::kFetched) {
+      ++served_;
+      *result = std::move(bundle_);
+      return true;
+    }
+    if (state == BundleState::kFailed) {
+      ++served_;
+      throw Uptane::MetadataFetchFailure(repo, "bundle");
+    }
+  }
+  return fetcher_.fetchBundle(result, repo, versions, flow_control);
+}
+
+}  // namespace Uptane
@@ -0,0 +1,95 @@
+#ifndef UPTANE_IMAGE_PREFETCHER_H_
+#define UPTANE_IMAGE_PREFETCHER_H_
+
+#include <future>
+#include <string>
+
+#include "uptane/fetcher.h"
+#include "utilities/flow_control.h"
+
+class INvStorage;
+
+namespace Uptane {
+
+/**
+ * Fetch the Image repo metadata in the background, while the Director
+ * metadata is fetched and verified, and serve the requests of the Image repo
+ * update from it afterwards. The metadata is still verified in the usual
+ * order, Director first, as the Image repo requests and verifies it as
+ * without the prefetch.
+ *
+ * What is fetched is guessed from the stored metadata and from the versions
+ * listed in what was prefetched, which are not verified at that point: the
+ * bundle if the fetcher supports it, else the next Root version, the
+ * Timestamp, and the Snapshot and Targets if they have changed according to
+ * the Timestamp and Snapshot. Each response serves one matching request; the
+ * other requests are passed on to the fetcher. The prefetch is abandoned when
+ * the object is destroyed, e.g. when the Director has no updates.
+ */
+class ImagePrefetcher : public IMetadataFetcher {
+ public:
+  /**
+   * Start the prefetch. The storage is only read here, on the calling thread.
+   * @param probe_root whether the Image repo is going to look for a new Root version
+   */
+  ImagePrefetcher(const IMetadataFetcher &fetcher, INvStorage &storage, bool probe_root);
+  ~ImagePrefetcher() override;
+  ImagePrefetcher(const ImagePrefetcher &) = delete;
+  ImagePrefetcher(ImagePrefetcher &&) = delete;
+  ImagePrefetcher &operator=(const ImagePrefetcher &) = delete;
+  ImagePrefetcher &operator=(ImagePrefetcher &&) = delete;
+
+  void fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role, Version version,
+                 const api::FlowControlToken *flow_control) const override;
+  bool fetchLatestRoleIfModified(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role,
+                                 MetaValidators *validators, const api::FlowControlToken *flow_control) const override;
+  bool fetchBundle(MetaFiles *result, RepositoryType repo, const MetaVersions &versions,
+                   const api::FlowControlToken *flow_control) const override;
+
+  /** Requests served from the prefetch so far. */
+  int served() const { return served_; }
+
+ private:
+  // A prefetched response, served once
+  struct Response {
+    enum class State { kNone, kFetched, kFailed };
+    State state{State::kNone};
+    std::string body;
+    // For conditional requests: the validators sent and received, and whether the role was modified
+    MetaValidators sent_validators;
+    MetaValidators validators;
+    bool modified{true};
+  };
+
+  void prefetch();
+  // Fetch a role into a response, recording a failure of the server
+  void prefetchRole(Response *response, const Role &role, Version version, int64_t maxsize);
+  // Wait for the prefetch, and take the response if it matches
+  bool take(Response *response, int64_t maxsize) const;
+
+  const IMetadataFetcher &fetcher_;
+  // Aborts the requests of the prefetch when destroyed
+  api::FlowControlToken cancel_;
+
+  // What is stored so far, read by the constructor
+  MetaVersions stored_versions_;
+  bool probe_root_;
+  std::string stored_timestamp_;
+  std::string stored_snapshot_;
+  int snapshot_version_{0};
+  int targets_version_{0};
+
+  mutable std::future<void> done_;
+  enum class BundleState { kUnsupported, kFetched, kFailed };
+  mutable BundleState bundle_state_{BundleState::kUnsupported};
+  mutable MetaFiles bundle_;
+  mutable Response root_;
+  mutable Response timestamp_;
+  mutable Response snapshot_;
+  mutable Response targets_;
+  mutable int served_{0};
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_IMAGE_PREFETCHER_H_
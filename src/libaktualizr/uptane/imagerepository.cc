@@ -1,10 +1,14 @@
 #include "imagerepository.h"
 
+#include <utility>
+
 #include "crypto/crypto.h"
 #include "fetcher.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
+#include "uptane/parsed_targets.h"
+#include "uptane/shared_image_meta.h"
 
 namespace Uptane {
 
@@ -13,9 +17,12 @@ void ImageRepository::resetMeta() {
   targets.reset();
   snapshot = Snapshot();
   timestamp = TimestampMeta();
+  delegations_pruned_ = false;
+  changed_since_pruning_.clear();
 }
 
 void ImageRepository::verifyTimestamp(const std::string& timestamp_raw) {
+  invalidateVerified();
   try {
     // Verify the signature:
     timestamp =
@@ -55,6 +62,7 @@ void ImageRepository::fetchSnapshot(INvStorage& storage, const IMetadataFetcher&
 }
 
 void ImageRepository::verifySnapshot(const std::string& snapshot_raw, bool prefetch) {
+  invalidateVerified();
   const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(snapshot_raw));
   bool hash_exists = false;
   for (const auto& it : timestamp.snapshot_hashes()) {
@@ -89,7 +97,13 @@ void ImageRepository::verifySnapshot(const std::string& snapshot_raw, bool prefe
 
   try {
     // Verify the signature:
-    snapshot = Snapshot(RepositoryType::Image(), Utils::parseJSON(snapshot_raw), std::make_shared<MetaWithKeys>(root));
+    Snapshot verified(RepositoryType::Image(), Utils::parseJSON(snapshot_raw), std::make_shared<MetaWithKeys>(root));
+    if (delegations_pruned_) {
+      for (const auto& role : verified.changed_roles(snapshot)) {
+        changed_since_pruning_.insert(role);
+      }
+    }
+    snapshot = std::move(verified);
   } catch (const Exception& e) {
     LOG_ERROR << "Signature verification for Snapshot metadata failed";
     throw;
@@ -118,9 +132,9 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 
   fetcher.fetchLatestRole(&image_targets, targets_size, RepositoryType::Image(), targets_role, flow_control);
 
-  const int remote_version = extractVersionUntrusted(image_targets);
-
   verifyTargets(image_targets, false);
+  // Only known once verified, but not parsing the metadata a second time matters for large target lists.
+  const int remote_version = targets->version();
 
   if (local_version > remote_version) {
     throw Uptane::SecurityException(RepositoryType::Image(), "Rollback attempt");
@@ -130,35 +144,75 @@ void ImageRepository::fetchTargets(INvStorage& storage, const IMetadataFetcher&
 }
 
 void ImageRepository::verifyRoleHashes(const std::string& role_data, const Uptane::Role& role, bool prefetch) const {
-  const std::string canonical = Utils::jsonToCanonicalStr(Utils::parseJSON(role_data));
+  checkRoleHashes(Utils::jsonToCanonicalStr(Utils::parseJSON(role_data)), role, prefetch);
+}
+
+void ImageRepository::checkRoleHashes(const std::string& canonical, const Uptane::Role& role, bool prefetch) const {
+  checkRoleDigests(
+      [&canonical](Hash::Type hash_type) {
+        return hash_type == Hash::Type::kSha256 ? Crypto::sha256digestHex(canonical)
+                                                : Crypto::sha512digestHex(canonical);
+      },
+      role, prefetch);
+}
+
+void ImageRepository::checkRoleDigests(const std::function<std::string(Hash::Type)>& digest,
+                                       const Uptane::Role& role, bool prefetch) const {
   // Hashes are not required in snapshot metadata. If present, however, we may as well check them.
   // This provides no security benefit, but may help with fault detection.
   for (const auto& it : snapshot.role_hashes(role)) {
-    switch (it.type()) {
-      case Hash::Type::kSha256:
-        if (Hash(Hash::Type::kSha256, Crypto::sha256digestHex(canonical)) != it) {
-          // If prefetch is true, it means we're checking a local copy of the metadata.
-          // Failures in that case just indicate we need to refresh it from the server, so
-          // we only actually log the error if the metadata comes directly from the server.
-          if (!prefetch) {
-            LOG_ERROR << "Hash verification for " << role << " metadata failed";
-          }
-          throw Uptane::SecurityException(RepositoryType::Image(),
-                                          "Snapshot hash mismatch for " + role.ToString() + " metadata");
-        }
-        break;
-      case Hash::Type::kSha512:
-        if (Hash(Hash::Type::kSha512, Crypto::sha512digestHex(canonical)) != it) {
-          if (!prefetch) {
-            LOG_ERROR << "Hash verification for " << role << " metadata failed";
-          }
-          throw Uptane::SecurityException(RepositoryType::Image(),
-                                          "Snapshot hash mismatch for " + role.ToString() + " metadata");
-        }
-        break;
-      default:
-        break;
+    if (it.type() != Hash::Type::kSha256 && it.type() != Hash::Type::kSha512) {
+      continue;
+    }
+    if (Hash(it.type(), digest(it.type())) != it) {
+      // If prefetch is true, it means we're checking a local copy of the metadata.
+      // Failures in that case just indicate we need to refresh it from the server, so
+      // we only actually log the error if the metadata comes directly from the server.
+      if (!prefetch) {
+        LOG_ERROR << "Hash verification for " << role << " metadata failed";
+      }
+      throw Uptane::SecurityException(RepositoryType::Image(),
+                                      "Snapshot hash mismatch for " + role.ToString() + " metadata");
+    }
+  }
+}
+
+void ImageRepository::pruneDelegations(INvStorage& storage) {
+  std::vector<std::pair<Role, std::string>> stored;
+  if (delegations_pruned_) {
+    for (const auto& role : changed_since_pruning_) {
+      std::string data;
+      if (role.IsDelegation() && storage.loadDelegation(&data, role)) {
+        stored.emplace_back(role, std::move(data));
+      }
     }
+  } else if (!storage.loadAllDelegations(stored)) {
+    return;
+  }
+  delegations_pruned_ = true;
+  changed_since_pruning_.clear();
+  size_t pruned = 0;
+  for (const auto& delegation : stored) {
+    const Role& role = delegation.first;
+    const int version = snapshot.role_version(role);
+    const int stored_version = extractVersionUntrusted(delegation.second);
+    // A newer stored version is kept, to be reported as a rollback attempt when the role is used.
+    bool current = version >= 0 && stored_version >= version;
+    if (current && stored_version == version && !snapshot.role_hashes(role).empty()) {
+      try {
+        verifyRoleHashes(delegation.second, role, true);
+      } catch (const Uptane::SecurityException&) {
+        current = false;
+      }
+    }
+    if (!current) {
+      LOG_DEBUG << "Deleting the stored " << role << " metadata, changed in the Image repo Snapshot metadata";
+      storage.deleteDelegation(role);
+      ++pruned;
+    }
+  }
+  if (!stored.empty()) {
+    LOG_DEBUG << "Kept " << (stored.size() - pruned) << " of " << stored.size() << " stored delegations";
   }
 }
 
@@ -166,16 +220,65 @@ int ImageRepository::getRoleVersion(const Uptane::Role& role) const { return sna
 
 int64_t ImageRepository::getRoleSize(const Uptane::Role& role) const { return snapshot.role_size(role); }
 
+TimeStamp ImageRepository::nextExpiry() const {
+  TimeStamp next = TimeStamp::Earliest(root.expiry(), TimeStamp::Earliest(timestamp.expiry(), snapshot.expiry()));
+  if (targets) {
+    next = TimeStamp::Earliest(next, targets->expiry());
+  }
+  return next;
+}
+
 void ImageRepository::verifyTargets(const std::string& targets_raw, bool prefetch) {
+  invalidateVerified();
   try {
-    verifyRoleHashes(targets_raw, Uptane::Role::Targets(), prefetch);
-
-    auto targets_json = Utils::parseJSON(targets_raw);
+    std::string shared_key;
+    std::shared_ptr<const SharedImageMeta::Entry> shared;
+    if (share_meta_ && !rootDigest().empty()) {
+      shared_key = SharedImageMeta::key(rootDigest(), targets_raw);
+      shared = SharedImageMeta::instance().find(shared_key);
+    }
+    if (shared) {
+      checkRoleDigests(
+          [&shared](Hash::Type hash_type) {
+            return hash_type == Hash::Type::kSha256 ? shared->canonical_sha256 : shared->canonical_sha512;
+          },
+          Uptane::Role::Targets(), prefetch);
+      targets = shared->targets;
+    } else {
+      auto signer = std::make_shared<MetaWithKeys>(root);
+      // The target list can be large, so avoid holding a document of all of it
+      // along with the Target objects when the layout allows it.
+      ParsedTargets parsed;
+      std::string canonical;
+      std::shared_ptr<Uptane::Targets> verified;
+      if (ParsedTargets::parse(targets_raw, &parsed)) {
+        checkRoleHashes(parsed.canonical, Uptane::Role::Targets(), prefetch);
+        if (!shared_key.empty()) {
+          canonical = parsed.canonical;
+        }
 
-    // Verify the signature:
-    auto signer = std::make_shared<MetaWithKeys>(root);
-    targets = std::make_shared<Uptane::Targets>(
-        Targets(RepositoryType::Image(), Uptane::Role::Targets(), targets_json, signer));
+        // Verify the signature:
+        verified = std::make_shared<Uptane::Targets>(RepositoryType::Image(), Uptane::Role::Targets(),
+                                                     std::move(parsed), signer);
+      } else {
+        auto targets_json = Utils::parseJSON(targets_raw);
+        canonical = Utils::jsonToCanonicalStr(targets_json);
+        checkRoleHashes(canonical, Uptane::Role::Targets(), prefetch);
+
+        // Verify the signature:
+        verified = std::make_shared<Uptane::Targets>(
+            Targets(RepositoryType::Image(), Uptane::Role::Targets(), targets_json, signer));
+      }
+      targets = verified;
+
+      if (!shared_key.empty()) {
+        auto entry = std::make_shared<SharedImageMeta::Entry>();
+        entry->targets = verified;
+        entry->canonical_sha256 = Crypto::sha256digestHex(canonical);
+        entry->canonical_sha512 = Crypto::sha512digestHex(canonical);
+        SharedImageMeta::instance().insert(shared_key, std::move(entry));
+      }
+    }
 
     if (targets->version() != snapshot.role_version(Uptane::Role::Targets())) {
       throw Uptane::VersionMismatch(RepositoryType::Image(), Uptane::Role::TARGETS);
@@ -218,13 +321,22 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
                                  const api::FlowControlToken* flow_control) {
   resetMeta();
 
-  updateRoot(storage, fetcher, RepositoryType::Image());
+  // Get all the metadata that has changed at once, if the server can send it.
+  const BundleFetcher bundle_fetcher(
+      fetcher, RepositoryType::Image(),
+      storedVersions(storage, RepositoryType::Image(),
+                     {Role::Root(), Role::Timestamp(), Role::Snapshot(), Role::Targets()}),
+      flow_control);
+
+  updateRoot(storage, bundle_fetcher, RepositoryType::Image());
 
   // Update Image repo Timestamp metadata
   {
     std::string image_timestamp;
+    MetaValidators validators;
 
-    fetcher.fetchLatestRole(&image_timestamp, kMaxTimestampSize, RepositoryType::Image(), Role::Timestamp());
+    const bool modified = fetchLatestIfModified(storage, bundle_fetcher, RepositoryType::Image(), Role::Timestamp(),
+                                                kMaxTimestampSize, &image_timestamp, &validators, nullptr);
     int remote_version = extractVersionUntrusted(image_timestamp);
 
     int local_version;
@@ -246,6 +358,9 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
       // correctly.
       storage.storeNonRoot(image_timestamp, RepositoryType::Image(), Role::Timestamp());
     }
+    if (modified) {
+      storeValidators(storage, RepositoryType::Image(), Role::Timestamp(), validators);
+    }
 
     checkTimestampExpired();
   }
@@ -273,12 +388,22 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
 
     // If we don't, attempt to fetch the latest.
     if (fetch_snapshot) {
-      fetchSnapshot(storage, fetcher, local_version, flow_control);
+      fetchSnapshot(storage, bundle_fetcher, local_version, flow_control);
+      pruneDelegations(storage);
     }
 
     checkSnapshotExpired();
   }
 
+  // The Snapshot lists the current Root version. If we didn't look for a new
+  // Root and it has changed, start over, this time looking for it.
+  if (rootProbeSkipped() && snapshot.role_version(Role::Root()) > rootVersion()) {
+    LOG_INFO << "Image repo Snapshot metadata lists a new Root version, updating the Root metadata";
+    requireRootProbe();
+    updateMeta(storage, fetcher, flow_control);
+    return;
+  }
+
   // Update Image repo Targets metadata
   {
     // First check if we already have the latest version according to the
@@ -302,7 +427,7 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
 
     // If we don't, attempt to fetch the latest.
     if (fetch_targets) {
-      fetchTargets(storage, fetcher, local_version, flow_control);
+      fetchTargets(storage, bundle_fetcher, local_version, flow_control);
     }
 
     checkTargetsExpired();
@@ -310,6 +435,17 @@ void ImageRepository::updateMeta(INvStorage& storage, const IMetadataFetcher& fe
 }
 
 void ImageRepository::checkMetaOffline(INvStorage& storage) {
+  if (verifiedFromStorage(storage)) {
+    if (rootExpired()) {
+      throw Uptane::ExpiredMetadata(RepositoryType::Image(), Role::Root().ToString());
+    }
+    checkTimestampExpired();
+    checkSnapshotExpired();
+    checkTargetsExpired();
+    return;
+  }
+
+  const MetaRevision revision = storage.metaRevision();
   resetMeta();
   // Load Image repo Root metadata
   {
@@ -362,6 +498,8 @@ void ImageRepository::checkMetaOffline(INvStorage& storage) {
 
     checkTargetsExpired();
   }
+
+  setVerifiedRevision(revision);
 }
 
 }  // namespace Uptane
@@ -1,7 +1,9 @@
 #ifndef IMAGE_REPOSITORY_H_
 #define IMAGE_REPOSITORY_H_
 
+#include <functional>
 #include <memory>
+#include <set>
 #include <string>
 
 #include "uptanerepository.h"
@@ -30,7 +32,14 @@ class ImageRepository : public RepositoryCommon {
   int getRoleVersion(const Uptane::Role& role) const;
   int64_t getRoleSize(const Uptane::Role& role) const;
 
+  /**
+   * Take the verified Targets metadata from the cache shared by the clients
+   * of the process, and add it there, see SharedImageMeta.
+   */
+  void setShareMeta(bool share) { share_meta_ = share; }
+
   void checkMetaOffline(INvStorage& storage) override;
+  TimeStamp nextExpiry() const override;
   void updateMeta(INvStorage& storage, const IMetadataFetcher& fetcher,
                   const api::FlowControlToken* flow_control) override;
 
@@ -43,10 +52,24 @@ class ImageRepository : public RepositoryCommon {
   void fetchTargets(INvStorage& storage, const IMetadataFetcher& fetcher, int local_version,
                     const api::FlowControlToken* flow_control);
   void checkTargetsExpired();
-
-  std::shared_ptr<Uptane::Targets> targets;
+  void checkRoleHashes(const std::string& canonical, const Uptane::Role& role, bool prefetch) const;
+  // The same with the digests of the canonical form, as given by digest
+  void checkRoleDigests(const std::function<std::string(Hash::Type)>& digest, const Uptane::Role& role,
+                        bool prefetch) const;
+  // Delete the stored delegations that the Snapshot metadata no longer lists
+  // in the same version and with the same hashes, so that only those are
+  // fetched again. After the first time, only the delegations whose entries
+  // have changed since the last time are loaded.
+  void pruneDelegations(INvStorage& storage);
+
+  std::shared_ptr<const Uptane::Targets> targets;
   Uptane::TimestampMeta timestamp;
   Uptane::Snapshot snapshot;
+  // Once the stored delegations were pruned, the roles that the Snapshot
+  // metadata verified since list differently
+  bool delegations_pruned_{false};
+  std::set<Uptane::Role> changed_since_pruning_;
+  bool share_meta_{false};
 };
 
 }  // namespace Uptane
@@ -3,6 +3,7 @@
 #include "libaktualizr/types.h"
 #include "storage/invstorage.h"
 #include "uptane/exceptions.h"
+#include "utilities/executor.h"
 
 namespace Uptane {
 
@@ -60,13 +61,61 @@ Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_ta
   return *delegation;
 }
 
+DelegationPrefetcher::~DelegationPrefetcher() {
+  for (const auto &pending : pending_) {
+    pending.second.wait();
+  }
+}
+
+void DelegationPrefetcher::prefetch(const Role &role) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  if (pending_.size() >= max_pending_ || pending_.count(role) != 0) {
+    return;
+  }
+  auto fetcher = fetcher_;
+  const auto *flow_control = flow_control_;
+  pending_.emplace(role, Executor::io()
+                             .submit([fetcher, flow_control, role]() {
+                               std::string result;
+                               fetcher->fetchLatestRole(&result, kMaxImageTargetsSize, RepositoryType::Image(), role,
+                                                        flow_control);
+                               return result;
+                             })
+                             .share());
+}
+
+bool DelegationPrefetcher::isPending(const Role &role) const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return pending_.count(role) != 0;
+}
+
+void DelegationPrefetcher::fetchRole(std::string *result, const int64_t maxsize, const RepositoryType repo,
+                                     const Uptane::Role &role, const Version version,
+                                     const api::FlowControlToken *flow_control) const {
+  std::shared_future<std::string> prefetched;
+  if (repo == RepositoryType::Image() && version == Version() && maxsize == kMaxImageTargetsSize) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    const auto it = pending_.find(role);
+    if (it != pending_.end()) {
+      prefetched = it->second;
+      pending_.erase(it);
+    }
+  }
+  if (!prefetched.valid()) {
+    fetcher_->fetchRole(result, maxsize, repo, role, version, flow_control);
+    return;
+  }
+  // Rethrows the error of the fetch, if any
+  *result = prefetched.get();
+}
+
 LazyTargetsList::DelegationIterator::DelegationIterator(const ImageRepository &repo,
                                                         std::shared_ptr<INvStorage> storage,
                                                         std::shared_ptr<Fetcher> fetcher,
                                                         const api::FlowControlToken *flow_control, bool is_end)
     : repo_{repo},
       storage_{std::move(storage)},
-      fetcher_{std::move(fetcher)},
+      fetcher_{std::make_shared<DelegationPrefetcher>(std::move(fetcher), flow_control, kDelegationsPrefetch)},
       flow_control_{flow_control},
       is_end_{is_end} {
   tree_ = std::make_shared<DelegatedTargetTreeNode>();
@@ -104,6 +153,23 @@ void LazyTargetsList::DelegationIterator::renewTargetsData() {
   }
 }
 
+void LazyTargetsList::DelegationIterator::prefetchChildren() {
+  // The children about to be visited, in iteration order. Those already
+  // stored in their current version would not be fetched.
+  for (auto idx = children_idx_; idx < tree_node_->children.size() && idx < children_idx_ + kDelegationsPrefetch;
+       ++idx) {
+    const Role &role = tree_node_->children[idx]->role;
+    if (fetcher_->isPending(role)) {
+      continue;
+    }
+    std::string stored;
+    if (storage_->loadDelegation(&stored, role) && extractVersionUntrusted(stored) >= repo_.getRoleVersion(role)) {
+      continue;
+    }
+    fetcher_->prefetch(role);
+  }
+}
+
 bool LazyTargetsList::DelegationIterator::operator==(const LazyTargetsList::DelegationIterator &other) const {
   if (is_end_ && other.is_end_) {
     return true;
@@ -168,6 +234,7 @@ LazyTargetsList::DelegationIterator LazyTargetsList::DelegationIterator::operato
   }
 
   if (children_idx_ < tree_node_->children.size()) {
+    prefetchChildren();
     auto *new_tree_node = tree_node_->children[children_idx_].get();
     target_idx_ = 0;
     children_idx_ = 0;
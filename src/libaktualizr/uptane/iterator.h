@@ -1,16 +1,60 @@
 #ifndef AKTUALIZR_UPTANE_ITERATOR_H_
 #define AKTUALIZR_UPTANE_ITERATOR_H_
 
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
 #include "fetcher.h"
 #include "imagerepository.h"
 #include "utilities/flow_control.h"
 
 namespace Uptane {
 
+// Number of delegations fetched ahead while iterating over the delegation tree
+constexpr size_t kDelegationsPrefetch = 4;
+
 Targets getTrustedDelegation(const Role &delegate_role, const Targets &parent_targets,
                              const ImageRepository &image_repo, INvStorage &storage, IMetadataFetcher &fetcher,
                              bool offline, const api::FlowControlToken *flow_control);
 
+/**
+ * Fetches Image repo delegations in the background ahead of their use, and
+ * hands them out in place of the wrapped fetcher. Nothing is verified or
+ * stored here; getTrustedDelegation() does that, as usual, once the
+ * delegation is actually needed. Other requests go to the wrapped fetcher.
+ */
+class DelegationPrefetcher : public IMetadataFetcher {
+ public:
+  DelegationPrefetcher(std::shared_ptr<IMetadataFetcher> fetcher, const api::FlowControlToken *flow_control,
+                       size_t max_pending)
+      : fetcher_{std::move(fetcher)}, flow_control_{flow_control}, max_pending_{max_pending} {}
+  DelegationPrefetcher(const DelegationPrefetcher &) = delete;
+  DelegationPrefetcher &operator=(const DelegationPrefetcher &) = delete;
+  DelegationPrefetcher(DelegationPrefetcher &&) = delete;
+  DelegationPrefetcher &operator=(DelegationPrefetcher &&) = delete;
+  // Waits for the fetches still going on
+  ~DelegationPrefetcher() override;
+
+  /**
+   * Start fetching the latest version of a delegation, unless it is already
+   * being fetched or max_pending fetches have not been used yet.
+   */
+  void prefetch(const Role &role);
+  bool isPending(const Role &role) const;
+  void fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role, Version version,
+                 const api::FlowControlToken *flow_control) const override;
+
+ private:
+  std::shared_ptr<IMetadataFetcher> fetcher_;
+  const api::FlowControlToken *flow_control_;
+  const size_t max_pending_;
+  mutable std::mutex mutex_;
+  mutable std::map<Role, std::shared_future<std::string>> pending_;
+};
+
 class LazyTargetsList {
  public:
   struct DelegatedTargetTreeNode {
@@ -38,12 +82,13 @@ class LazyTargetsList {
 
    private:
     void renewTargetsData();
+    void prefetchChildren();
 
     std::shared_ptr<DelegatedTargetTreeNode> tree_;
     DelegatedTargetTreeNode *tree_node_;
     const ImageRepository &repo_;
     std::shared_ptr<INvStorage> storage_;
-    std::shared_ptr<Fetcher> fetcher_;
+    std::shared_ptr<DelegationPrefetcher> fetcher_;
     const api::FlowControlToken *flow_control_;
     std::shared_ptr<const Targets> cur_targets_;
     std::vector<Targets>::size_type target_idx_{0};
@@ -1,9 +1,14 @@
 #include "uptane/tuf.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <boost/algorithm/string/case_conv.hpp>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
+#include "uptane/signature_cache.h"
 #include "utilities/utils.h"
 
 using Uptane::MetaWithKeys;
@@ -61,7 +66,13 @@ void Uptane::MetaWithKeys::ParseRole(const RepositoryType repo, const Json::Valu
 
 void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const Role &role,
                                               const Json::Value &signed_object) {
-  const Uptane::Role type(signed_object["signed"]["_type"].asString());
+  MetaWithKeys::VerifySigned(repo, role, signed_object["signed"]["_type"].asString(),
+                             Utils::jsonToCanonicalStr(signed_object["signed"]), signed_object["signatures"]);
+}
+
+void Uptane::MetaWithKeys::VerifySigned(const RepositoryType repo, const Role &role, const std::string &signed_type,
+                                        const std::string &canonical, const Json::Value &signatures) {
+  const Uptane::Role type(signed_type);
   if (role.IsDelegation()) {
     if (type != Uptane::Role::Targets()) {
       LOG_ERROR << "Delegated role " << role << " has an invalid type: " << type;
@@ -73,12 +84,11 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
                             "Metadata type " + type.ToString() + " does not match expected role " + role.ToString());
   }
 
-  const std::string canonical = Utils::jsonToCanonicalStr(signed_object["signed"]);
-  // NOLINTNEXTLINE(performance-unnecessary-copy-initialization)
-  const Json::Value signatures = signed_object["signatures"];
-  int valid_signatures = 0;
+  const std::string canonical_digest = Crypto::sha256digestHex(canonical);
 
   std::set<std::string> used_keyids;
+  // Signatures by keys of the role, to be verified
+  std::vector<std::pair<KeyId, std::string>> candidates;
   for (auto sig = signatures.begin(); sig != signatures.end(); ++sig) {
     const std::string keyid = (*sig)["keyid"].asString();
     if (used_keyids.count(keyid) != 0) {
@@ -102,17 +112,38 @@ void Uptane::MetaWithKeys::UnpackSignedObject(const RepositoryType repo, const R
       LOG_WARNING << "KeyId " << keyid << " is not valid to sign for this role (" << role << ").";
       continue;
     }
-    const std::string signature = (*sig)["sig"].asString();
-    if (keys_[keyid].VerifySignature(signature, canonical)) {
-      valid_signatures++;
-    } else {
-      LOG_WARNING << "Signature was present but invalid: " << signature << " with KeyId: " << keyid;
-    }
+    candidates.emplace_back(keyid, (*sig)["sig"].asString());
   }
   const int64_t threshold = thresholds_for_role_[role];
   if (threshold < kMinSignatures || kMaxSignatures < threshold) {
     throw IllegalThreshold(repo, "Invalid signature threshold");
   }
+
+  // Verify the signatures in batches of as many as are still needed, and at
+  // least a few, until the threshold is either met or out of reach.
+  int64_t valid_signatures = 0;
+  size_t next = 0;
+  while (valid_signatures < threshold &&
+         static_cast<int64_t>(candidates.size() - next) >= threshold - valid_signatures) {
+    const size_t count = std::min(candidates.size() - next,
+                                  std::max(static_cast<size_t>(threshold - valid_signatures),
+                                           static_cast<size_t>(kMaxVerifyThreads)));
+    std::vector<SignatureCache::Check> batch;
+    for (size_t i = next; i < next + count; ++i) {
+      const auto &keyid = candidates[i].first;
+      batch.push_back({keyid, &keys_.at(keyid), candidates[i].second});
+    }
+    const std::vector<bool> valid = SignatureCache::instance().verifyBatch(batch, canonical, canonical_digest);
+    for (size_t j = 0; j < count; ++j) {
+      if (valid[j]) {
+        ++valid_signatures;
+      } else {
+        LOG_WARNING << "Signature was present but invalid: " << batch[j].signature << " with KeyId: " << batch[j].keyid;
+      }
+    }
+    next += count;
+  }
+
   // One signature and it is bad: throw bad key ID.
   // Multiple signatures but not enough good ones to pass threshold: throw unmet threshold.
   if (signatures.size() == 1 && valid_signatures == 0) {
@@ -0,0 +1,190 @@
+#include "uptane/offline_bundle.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include "logging/logging.h"
+#include "uptane/exceptions.h"
+#include "utilities/utils.h"
+
+namespace Uptane {
+
+static constexpr std::array<char, 8> kMagic{'A', 'K', 'B', 'U', 'N', 'D', 'L', 'E'};
+
+static uint32_t readUint32(const char *p) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(p);
+  return (static_cast<uint32_t>(bytes[0]) << 24U) | (static_cast<uint32_t>(bytes[1]) << 16U) |
+         (static_cast<uint32_t>(bytes[2]) << 8U) | static_cast<uint32_t>(bytes[3]);
+}
+
+static void appendUint32(std::string *out, uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    *out += static_cast<char>((value >> static_cast<uint32_t>(shift)) & 0xFFU);
+  }
+}
+
+// File name of a role in the index, as under the URL of the repository.
+static std::string entryName(const Role &role, Version version) {
+  return (role.IsDelegation() ? "delegations/" : "") + version.RoleFileName(role);
+}
+
+OfflineBundle::OfflineBundle(const boost::filesystem::path &path) : path_{path.string()} {
+  const int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Unable to open the offline bundle " + path_ + ": " + std::strerror(errno));
+  }
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(kHeaderSize)) {
+    close(fd);
+    throw std::runtime_error("Invalid offline bundle " + path_ + ": too short");
+  }
+  size_ = static_cast<size_t>(st.st_size);
+  void *map = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping holds the file
+  close(fd);
+  if (map == MAP_FAILED) {
+    throw std::runtime_error("Unable to map the offline bundle " + path_ + ": " + std::strerror(errno));
+  }
+  map_ = static_cast<const char *>(map);
+
+  try {
+    if (std::memcmp(map_, kMagic.data(), kMagic.size()) != 0) {
+      throw std::runtime_error("not an offline bundle");
+    }
+    const uint32_t format = readUint32(map_ + 8);
+    if (format != kFormatVersion) {
+      throw std::runtime_error("unsupported format version " + std::to_string(format));
+    }
+    const uint32_t index_size = readUint32(map_ + 12);
+    if (index_size > kMaxIndexSize || index_size > size_ - kHeaderSize) {
+      throw std::runtime_error("the index is too large");
+    }
+    data_ = map_ + kHeaderSize + index_size;
+    data_size_ = size_ - kHeaderSize - index_size;
+
+    const Json::Value index = Utils::parseJSON(std::string(map_ + kHeaderSize, index_size));
+    if (!index.isObject()) {
+      throw std::runtime_error("the index is not a JSON object");
+    }
+    director_ = readEntries(index["director"]);
+    image_ = readEntries(index["image"]);
+    targets_ = readEntries(index["targets"]);
+  } catch (const std::exception &e) {
+    munmap(const_cast<char *>(map_), size_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+    throw std::runtime_error("Invalid offline bundle " + path_ + ": " + e.what());
+  }
+  LOG_DEBUG << "Opened the offline bundle " << path_ << " with " << director_.size() << " Director and "
+            << image_.size() << " Image repo metadata files and " << targets_.size() << " targets";
+}
+
+OfflineBundle::~OfflineBundle() {
+  munmap(const_cast<char *>(map_), size_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+}
+
+OfflineBundle::Entries OfflineBundle::readEntries(const Json::Value &section) const {
+  Entries entries;
+  if (section.isNull()) {
+    return entries;
+  }
+  if (!section.isObject()) {
+    throw std::runtime_error("a section of the index is not a JSON object");
+  }
+  for (auto it = section.begin(); it != section.end(); ++it) {
+    const Json::Value &offset = (*it)["offset"];
+    const Json::Value &length = (*it)["length"];
+    if (!offset.isUInt64() || !length.isUInt64() || offset.asUInt64() > data_size_ ||
+        length.asUInt64() > data_size_ - offset.asUInt64()) {
+      throw std::runtime_error("the entry of " + it.name() + " is outside of the bundle");
+    }
+    entries[it.name()] = Entry{offset.asUInt64(), length.asUInt64()};
+  }
+  return entries;
+}
+
+void OfflineBundle::write(const boost::filesystem::path &path, const MetaFiles &director, const MetaFiles &image,
+                          const std::map<std::string, boost::filesystem::path> &targets) {
+  Json::Value index(Json::objectValue);
+  uint64_t offset = 0;
+  auto add = [&index, &offset](const char *section, const std::string &name, uint64_t length) {
+    index[section][name]["offset"] = Json::UInt64(offset);
+    index[section][name]["length"] = Json::UInt64(length);
+    offset += length;
+  };
+  for (const auto &file : director) {
+    add("director", file.first, file.second.size());
+  }
+  for (const auto &file : image) {
+    add("image", file.first, file.second.size());
+  }
+  for (const auto &target : targets) {
+    add("targets", target.first, boost::filesystem::file_size(target.second));
+  }
+
+  const std::string index_str = Utils::jsonToCanonicalStr(index);
+  std::string header(kMagic.data(), kMagic.size());
+  appendUint32(&header, kFormatVersion);
+  appendUint32(&header, static_cast<uint32_t>(index_str.size()));
+
+  std::ofstream out(path.string(), std::ios::binary | std::ios::trunc);
+  out << header << index_str;
+  for (const auto &file : director) {
+    out << file.second;
+  }
+  for (const auto &file : image) {
+    out << file.second;
+  }
+  for (const auto &target : targets) {
+    std::ifstream in(target.second.string(), std::ios::binary);
+    if (!in.good()) {
+      throw std::runtime_error("Unable to read the target file " + target.second.string());
+    }
+    // Inserting an empty stream is a failure
+    if (in.peek() != std::ifstream::traits_type::eof()) {
+      out << in.rdbuf();
+    }
+  }
+  out.close();
+  if (out.fail()) {
+    throw std::runtime_error("Unable to write the offline bundle " + path.string());
+  }
+}
+
+void OfflineBundle::fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role,
+                              Version version, const api::FlowControlToken *flow_control) const {
+  if (flow_control != nullptr && flow_control->hasAborted()) {
+    throw Uptane::LocallyAborted(repo);
+  }
+  const Entries &entries = (repo == RepositoryType::Director()) ? director_ : image_;
+  const auto it = entries.find(entryName(role, version));
+  // Enforce the same limits as for the metadata from the server.
+  if (it == entries.end() || (maxsize > 0 && it->second.length > static_cast<uint64_t>(maxsize))) {
+    throw Uptane::MetadataFetchFailure(repo, role.ToString());
+  }
+  result->assign(data_ + it->second.offset, it->second.length);
+}
+
+bool OfflineBundle::target(const std::string &filename, const char **data, uint64_t *size) const {
+  const auto it = targets_.find(filename);
+  if (it == targets_.end()) {
+    return false;
+  }
+  *data = data_ + it->second.offset;
+  *size = it->second.length;
+  // The target is read once, from start to end.
+  const auto page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+  const auto start = reinterpret_cast<uintptr_t>(*data) & ~(page - 1);
+  if (*size > 0) {
+    madvise(reinterpret_cast<void *>(start), reinterpret_cast<uintptr_t>(*data) + *size - start,  // NOLINT
+            MADV_SEQUENTIAL);
+  }
+  return true;
+}
+
+}  // namespace Uptane
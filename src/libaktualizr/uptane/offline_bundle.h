@@ -0,0 +1,104 @@
+#ifndef UPTANE_OFFLINE_BUNDLE_H_
+#define UPTANE_OFFLINE_BUNDLE_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "uptane/fetcher.h"
+
+namespace Uptane {
+
+/**
+ * A single file holding the metadata of both repositories and the target
+ * files of an update, for updates from a USB drive or in a workshop, without
+ * a connection to the server.
+ *
+ * Layout, with integers in big-endian order:
+ *
+ *     0   8 bytes   "AKBUNDLE"
+ *     8   4 bytes   format version, kFormatVersion
+ *     12  4 bytes   size N of the index
+ *     16  N bytes   index, a JSON object
+ *     16 + N        data
+ *
+ * The index gives the place of each file within the data, as its offset from
+ * the start of the data and its length:
+ *
+ *     {"director": {"1.root.json": {"offset": 0, "length": 1034}, "targets.json": {...}},
+ *      "image": {"1.root.json": {...}, "timestamp.json": {...}, "delegations/role.json": {...}},
+ *      "targets": {"firmware.bin": {...}}}
+ *
+ * The metadata files are named as on the server: by Version::RoleFileName(),
+ * under "delegations/" for delegated roles. The targets are named by their
+ * file name in the Targets metadata.
+ *
+ * The file is mapped into memory rather than read, so that the metadata is
+ * served without copying the whole bundle and the targets are streamed from
+ * the page cache. Nothing in it is trusted: the metadata is verified by the
+ * repositories as if it came from the server, and the targets against their
+ * metadata while they are stored.
+ */
+class OfflineBundle : public IMetadataFetcher {
+ public:
+  static constexpr uint32_t kFormatVersion = 1;
+
+  /**
+   * Open and map a bundle.
+   * @throws std::runtime_error if the file can't be read or is not a valid bundle
+   */
+  explicit OfflineBundle(const boost::filesystem::path &path);
+  ~OfflineBundle() override;
+  OfflineBundle(const OfflineBundle &) = delete;
+  OfflineBundle(OfflineBundle &&) = delete;
+  OfflineBundle &operator=(const OfflineBundle &) = delete;
+  OfflineBundle &operator=(OfflineBundle &&) = delete;
+
+  /**
+   * Write a bundle.
+   * @param director Director metadata, by file name as in the index
+   * @param image Image repo metadata, by file name as in the index
+   * @param targets The files of the targets, by target file name
+   */
+  static void write(const boost::filesystem::path &path, const MetaFiles &director, const MetaFiles &image,
+                    const std::map<std::string, boost::filesystem::path> &targets);
+
+  void fetchRole(std::string *result, int64_t maxsize, RepositoryType repo, const Uptane::Role &role, Version version,
+                 const api::FlowControlToken *flow_control) const override;
+
+  bool hasTarget(const std::string &filename) const { return targets_.count(filename) != 0; }
+  /**
+   * The content of a target, mapped for as long as the bundle is open.
+   * @return false if the bundle doesn't hold the target
+   */
+  bool target(const std::string &filename, const char **data, uint64_t *size) const;
+
+ private:
+  struct Entry {
+    uint64_t offset;
+    uint64_t length;
+  };
+  using Entries = std::map<std::string, Entry>;
+
+  static constexpr size_t kHeaderSize = 16;
+  static constexpr uint32_t kMaxIndexSize = 16 * 1024 * 1024;
+
+  // Read one section of the index, checking that its entries are within the data.
+  Entries readEntries(const Json::Value &section) const;
+
+  const std::string path_;
+  const char *map_{nullptr};
+  size_t size_{0};
+  // Start of the data within the map
+  const char *data_{nullptr};
+  uint64_t data_size_{0};
+  Entries director_;
+  Entries image_;
+  Entries targets_;
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_OFFLINE_BUNDLE_H_
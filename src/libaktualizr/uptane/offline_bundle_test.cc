@@ -0,0 +1,124 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+
+#include "httpfake.h"
+#include "libaktualizr/aktualizr.h"
+#include "uptane/exceptions.h"
+#include "uptane/offline_bundle.h"
+#include "uptane_repo.h"
+#include "uptane_test_common.h"
+#include "utilities/utils.h"
+
+/* The metadata and the targets of a bundle are read back as written. */
+TEST(OfflineBundle, RoundTrip) {
+  TemporaryDirectory temp_dir;
+  const Uptane::MetaFiles director{{"1.root.json", "director root"}, {"targets.json", "director targets"}};
+  const Uptane::MetaFiles image{{"1.root.json", "image root 1"},
+                                {"2.root.json", "image root 2"},
+                                {"timestamp.json", "timestamp"},
+                                {"delegations/role-abc.json", "delegation"}};
+  Utils::writeFile(temp_dir / "firmware.bin", std::string("firmware data"));
+  Utils::writeFile(temp_dir / "empty.bin", std::string());
+  Uptane::OfflineBundle::write(temp_dir / "update.bundle", director, image,
+                               {{"firmware.bin", temp_dir / "firmware.bin"}, {"empty.bin", temp_dir / "empty.bin"}});
+
+  const Uptane::OfflineBundle bundle(temp_dir / "update.bundle");
+  const Uptane::IMetadataFetcher &fetcher = bundle;
+  std::string meta;
+  fetcher.fetchRole(&meta, 0, Uptane::RepositoryType::Director(), Uptane::Role::Root(), Uptane::Version(1));
+  EXPECT_EQ(meta, "director root");
+  fetcher.fetchLatestRole(&meta, 0, Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  EXPECT_EQ(meta, "director targets");
+  fetcher.fetchRole(&meta, 0, Uptane::RepositoryType::Image(), Uptane::Role::Root(), Uptane::Version(2));
+  EXPECT_EQ(meta, "image root 2");
+  fetcher.fetchLatestRole(&meta, 0, Uptane::RepositoryType::Image(), Uptane::Role("role-abc", true));
+  EXPECT_EQ(meta, "delegation");
+  EXPECT_THROW(
+      fetcher.fetchRole(&meta, 0, Uptane::RepositoryType::Image(), Uptane::Role::Root(), Uptane::Version(3)),
+      Uptane::MetadataFetchFailure);
+  EXPECT_THROW(fetcher.fetchLatestRole(&meta, 0, Uptane::RepositoryType::Director(), Uptane::Role::Timestamp()),
+               Uptane::MetadataFetchFailure);
+  // The size limits are those of the metadata from the server
+  EXPECT_THROW(fetcher.fetchLatestRole(&meta, 5, Uptane::RepositoryType::Image(), Uptane::Role::Timestamp()),
+               Uptane::MetadataFetchFailure);
+
+  const char *data = nullptr;
+  uint64_t size = 0;
+  ASSERT_TRUE(bundle.target("firmware.bin", &data, &size));
+  EXPECT_EQ(std::string(data, size), "firmware data");
+  ASSERT_TRUE(bundle.target("empty.bin", &data, &size));
+  EXPECT_EQ(size, 0);
+  EXPECT_TRUE(bundle.hasTarget("firmware.bin"));
+  EXPECT_FALSE(bundle.hasTarget("other.bin"));
+  EXPECT_FALSE(bundle.target("other.bin", &data, &size));
+}
+
+/* Files that are not valid bundles are rejected when opened. */
+TEST(OfflineBundle, Invalid) {
+  TemporaryDirectory temp_dir;
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "missing.bundle"), std::runtime_error);
+
+  Utils::writeFile(temp_dir / "short.bundle", std::string("AKBUNDLE"));
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "short.bundle"), std::runtime_error);
+
+  Utils::writeFile(temp_dir / "other.bundle", std::string("NOTABUNDLE, just some other file"));
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "other.bundle"), std::runtime_error);
+
+  // An entry past the end of the file
+  const std::string index = R"({"targets":{"a":{"length":10,"offset":0}}})";
+  std::string header("AKBUNDLE\0\0\0\1\0\0\0", 15);
+  header += static_cast<char>(index.size());
+  Utils::writeFile(temp_dir / "truncated.bundle", header + index + "short");
+  EXPECT_THROW(Uptane::OfflineBundle(temp_dir / "truncated.bundle"), std::runtime_error);
+  Utils::writeFile(temp_dir / "complete.bundle", header + index + "0123456789");
+  EXPECT_NO_THROW(Uptane::OfflineBundle(temp_dir / "complete.bundle"));
+}
+
+/*
+ * Check for updates and download them from a bundle, with a server that has
+ * no metadata or targets: the metadata is verified and stored, and the
+ * targets are taken from the bundle.
+ */
+TEST(OfflineBundle, Update) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  TemporaryDirectory repo_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "", meta_dir.Path());
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  UptaneRepo repo{repo_dir.PathString(), "", "id0"};
+  repo.generateRepo(KeyType::kED25519);
+  repo.addImage("tests/test_data/firmware.txt", "firmware.txt", "primary_hw");
+  repo.addTarget("firmware.txt", "primary_hw", "CA:FE:A6:D2:84:9D");
+  repo.signTargets();
+  repo.writeOfflineBundle(temp_dir / "update.bundle");
+
+  EXPECT_EQ(aktualizr.CheckUpdates().get().status, result::UpdateStatus::kError);
+  EXPECT_EQ(aktualizr.CheckUpdatesFromBundle(temp_dir / "missing.bundle").get().status,
+            result::UpdateStatus::kError);
+
+  const result::UpdateCheck update_result = aktualizr.CheckUpdatesFromBundle(temp_dir / "update.bundle").get();
+  ASSERT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+  ASSERT_EQ(update_result.updates.size(), 1);
+  EXPECT_EQ(update_result.updates[0].filename(), "firmware.txt");
+
+  const result::Download download_result = aktualizr.Download(update_result.updates).get();
+  ASSERT_EQ(download_result.status, result::DownloadStatus::kSuccess);
+  auto stored = aktualizr.OpenStoredTarget(download_result.updates[0]);
+  std::string content((std::istreambuf_iterator<char>(stored)), std::istreambuf_iterator<char>());
+  EXPECT_EQ(content, Utils::readFile("tests/test_data/firmware.txt"));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
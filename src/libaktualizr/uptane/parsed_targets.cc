@@ -0,0 +1,246 @@
+#include "uptane/parsed_targets.h"
+
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <utility>
+
+#include "utilities/canonical_json.h"
+#include "utilities/json_parser.h"
+#include "utilities/metadata_arena.h"
+
+namespace {
+
+using Span = std::pair<const char *, const char *>;
+// The members only last as long as the parsing, so they are kept in the arena
+// of the metadata refresh.
+using Members = std::pmr::map<std::pmr::string, Span>;
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+
+const char *skipSpace(const char *p, const char *end) {
+  while (p < end && isSpace(*p)) {
+    ++p;
+  }
+  return p;
+}
+
+// p is at the opening quote; returns the position after the closing one.
+const char *skipString(const char *p, const char *end) {
+  for (++p; p < end; ++p) {
+    if (*p == '\\') {
+      ++p;
+    } else if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return nullptr;
+}
+
+// Find the end of the value at p. Only the nesting is tracked, the value
+// itself is checked by jsoncpp when it is parsed.
+const char *skipValue(const char *p, const char *end) {
+  if (p >= end) {
+    return nullptr;
+  }
+  if (*p == '"') {
+    return skipString(p, end);
+  }
+  if (*p == '{' || *p == '[') {
+    int depth = 0;
+    while (p < end) {
+      if (*p == '"') {
+        p = skipString(p, end);
+        if (p == nullptr) {
+          return nullptr;
+        }
+        continue;
+      }
+      if (*p == '/') {
+        // Comments are left to jsoncpp.
+        return nullptr;
+      }
+      if (*p == '{' || *p == '[') {
+        ++depth;
+      } else if ((*p == '}' || *p == ']') && --depth == 0) {
+        return p + 1;
+      }
+      ++p;
+    }
+    return nullptr;
+  }
+  const char *start = p;
+  while (p < end && !isSpace(*p) && *p != ',' && *p != '}' && *p != ']' && *p != '/') {
+    ++p;
+  }
+  return p == start ? nullptr : p;
+}
+
+class Splitter {
+ public:
+  bool parse(const Span &span, Json::Value *value) { return parser_.parse(span.first, span.second, value); }
+
+  // Split the object spanning `span` into its members. Later duplicates
+  // replace earlier ones, as in jsoncpp.
+  bool split(const Span &span, Members *members) {
+    const char *end = span.second;
+    const char *p = skipSpace(span.first, end);
+    if (p >= end || *p != '{') {
+      return false;
+    }
+    p = skipSpace(p + 1, end);
+    if (p < end && *p == '}') {
+      return true;
+    }
+    while (p < end) {
+      if (*p != '"') {
+        return false;
+      }
+      const char *key_end = skipString(p, end);
+      if (key_end == nullptr) {
+        return false;
+      }
+      std::pmr::string key{members->get_allocator()};
+      if (!decodeKey(Span{p, key_end}, &key)) {
+        return false;
+      }
+      p = skipSpace(key_end, end);
+      if (p >= end || *p != ':') {
+        return false;
+      }
+      p = skipSpace(p + 1, end);
+      const char *value_end = skipValue(p, end);
+      if (value_end == nullptr) {
+        return false;
+      }
+      (*members)[std::move(key)] = Span{p, value_end};
+      p = skipSpace(value_end, end);
+      if (p < end && *p == '}') {
+        return true;
+      }
+      if (p >= end || *p != ',') {
+        return false;
+      }
+      p = skipSpace(p + 1, end);
+    }
+    return false;
+  }
+
+ private:
+  bool decodeKey(const Span &span, std::pmr::string *key) {
+    for (const char *c = span.first + 1; c < span.second - 1; ++c) {
+      if (*c == '\\' || static_cast<unsigned char>(*c) < 0x20) {
+        Json::Value decoded;
+        if (!parse(span, &decoded) || !decoded.isString()) {
+          return false;
+        }
+        const char *begin = nullptr;
+        const char *end = nullptr;
+        decoded.getString(&begin, &end);
+        key->assign(begin, end);
+        return true;
+      }
+    }
+    key->assign(span.first + 1, span.second - 1);
+    return true;
+  }
+
+  JsonParser parser_;
+};
+
+}  // namespace
+
+namespace Uptane {
+
+bool ParsedTargets::parse(const std::string &raw, ParsedTargets *result) {
+  const Span whole{raw.data(), raw.data() + raw.size()};
+  if (!raw.empty() && static_cast<unsigned char>(raw[0]) == 0xEF) {
+    // Byte order mark
+    return false;
+  }
+  Splitter splitter;
+  std::pmr::memory_resource *arena = MetadataArena::resource();
+  Members top{arena};
+  Members signed_members{arena};
+  Members target_members{arena};
+  if (!splitter.split(whole, &top) || top.count("signed") == 0 ||
+      !splitter.split(top["signed"], &signed_members) || signed_members.count("targets") == 0 ||
+      !splitter.split(signed_members["targets"], &target_members)) {
+    return false;
+  }
+
+  CanonicalJsonWriter writer;
+  ParsedTargets parsed;
+  std::string &out = parsed.canonical;
+  out.reserve(raw.size());
+  auto write_member = [&](bool &first, const std::pmr::string &name) {
+    if (!first) {
+      out += ',';
+    }
+    first = false;
+    writer.appendString(name, &out);
+    out += ':';
+  };
+
+  // Members are written in the order of the maps, which is the canonical one.
+  out += '{';
+  bool first_top = true;
+  for (const auto &member : top) {
+    write_member(first_top, member.first);
+    if (member.first != "signed") {
+      Json::Value &value = parsed.json[std::string(member.first)];
+      if (!splitter.parse(member.second, &value)) {
+        return false;
+      }
+      writer.append(value, &out);
+      continue;
+    }
+
+    parsed.signed_begin = out.size();
+    out += '{';
+    bool first_signed = true;
+    for (const auto &signed_member : signed_members) {
+      write_member(first_signed, signed_member.first);
+      if (signed_member.first != "targets") {
+        Json::Value &value = parsed.json["signed"][std::string(signed_member.first)];
+        if (!splitter.parse(signed_member.second, &value)) {
+          return false;
+        }
+        writer.append(value, &out);
+        continue;
+      }
+
+      parsed.json["signed"]["targets"] = Json::Value(Json::objectValue);
+      parsed.targets.reserve(target_members.size());
+      out += '{';
+      bool first_target = true;
+      for (const auto &target_member : target_members) {
+        write_member(first_target, target_member.first);
+        Json::Value value;
+        if (!splitter.parse(target_member.second, &value)) {
+          return false;
+        }
+        writer.append(value, &out);
+        // The custom object is only kept as text, for the few targets it is used for
+        Members fields{arena};
+        std::string custom;
+        if (value.isMember("custom") && splitter.split(target_member.second, &fields) && fields.count("custom") != 0) {
+          custom.assign(fields["custom"].first, fields["custom"].second);
+          parsed.targets.emplace_back(std::string(target_member.first), value, std::move(custom));
+        } else {
+          parsed.targets.emplace_back(std::string(target_member.first), value);
+        }
+      }
+      out += '}';
+    }
+    out += '}';
+    parsed.signed_length = out.size() - parsed.signed_begin;
+  }
+  out += '}';
+
+  *result = std::move(parsed);
+  return true;
+}
+
+}  // namespace Uptane
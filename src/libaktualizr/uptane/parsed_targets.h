@@ -0,0 +1,45 @@
+#ifndef UPTANE_PARSED_TARGETS_H_
+#define UPTANE_PARSED_TARGETS_H_
+
+#include <string>
+#include <vector>
+
+#include <json/json.h>
+
+#include "libaktualizr/types.h"
+
+namespace Uptane {
+
+/**
+ * Targets metadata parsed one target at a time, without ever building a
+ * document of the whole target list.
+ *
+ * The raw metadata is only scanned for the boundaries of the members of the
+ * top-level object, of "signed" and of "signed"."targets". Each of these is
+ * then parsed on its own with jsoncpp, written to the canonical form of the
+ * whole metadata, and, for the targets, turned into a Target and dropped. The
+ * Targets keep their custom object as its raw text, parsed again only if it is
+ * used. The memory needed besides the raw and canonical text is thus about that
+ * of the Target objects.
+ */
+struct ParsedTargets {
+  // Canonical form of the whole metadata, for the hashes listed in Snapshot
+  std::string canonical;
+  // Position of the canonical form of "signed" within it, for the signatures
+  size_t signed_begin{0};
+  size_t signed_length{0};
+  // The metadata without the target list
+  Json::Value json;
+  std::vector<Target> targets;
+
+  /**
+   * @return false if the metadata is not laid out as expected (for example
+   * "signed" or "targets" are not objects, or there are comments); it should
+   * then be parsed as a whole to get the usual behaviour and errors.
+   */
+  static bool parse(const std::string &raw, ParsedTargets *result);
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_PARSED_TARGETS_H_
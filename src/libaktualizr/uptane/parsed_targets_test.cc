@@ -0,0 +1,116 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+
+#include <json/json.h>
+
+#include "uptane/exceptions.h"
+#include "uptane/parsed_targets.h"
+#include "uptane/tuf.h"
+#include "utilities/metadata_arena.h"
+#include "utilities/utils.h"
+
+static void expectSameAsDocument(const std::string &raw) {
+  Uptane::ParsedTargets parsed;
+  ASSERT_TRUE(Uptane::ParsedTargets::parse(raw, &parsed)) << raw;
+
+  const Json::Value json = Utils::parseJSON(raw);
+  EXPECT_EQ(parsed.canonical, Utils::jsonToCanonicalStr(json));
+  EXPECT_EQ(parsed.canonical.substr(parsed.signed_begin, parsed.signed_length),
+            Utils::jsonToCanonicalStr(json["signed"]));
+
+  const auto names = json["signed"]["targets"].getMemberNames();
+  ASSERT_EQ(parsed.targets.size(), names.size());
+  for (size_t i = 0; i < names.size(); ++i) {
+    EXPECT_EQ(parsed.targets[i].filename(), names[i]);
+    EXPECT_EQ(parsed.targets[i].length(), json["signed"]["targets"][names[i]]["length"].asUInt64());
+    EXPECT_EQ(parsed.targets[i].custom_data(), json["signed"]["targets"][names[i]]["custom"]);
+  }
+
+  Json::Value without_targets = json;
+  without_targets["signed"]["targets"] = Json::Value(Json::objectValue);
+  EXPECT_EQ(parsed.json, without_targets);
+}
+
+/* The canonical form and targets are the same as from a document of the whole metadata. */
+TEST(ParsedTargets, SameAsDocument) {
+  expectSameAsDocument(Utils::readFile("tests/tuf/sample1/targets.json"));
+  expectSameAsDocument(R"({"signed": {"targets": {}}, "signatures": []})");
+  // Escapes, duplicate members (the last one wins), nesting inside strings
+  expectSameAsDocument(R"( {
+    "signed" : {
+      "targets" : {
+        "bé" : {"length": 1500, "hashes": {"sha256": "ab"}},
+        "a" : {"length": 1, "custom": {"x": [1, {"y": "}]\"["}]}},
+        "a" : {"length": 2},
+        "\u0001c" : {}
+      },
+      "_type" : "Targets", "version" : 3, "expires" : "2038-01-19T03:14:06Z", "version" : 4
+    },
+    "signatures" : [{"keyid": "k", "sig": "s", "method": "rsassa-pss-sha256"}],
+    "zz" : null
+  })");
+}
+
+/* Within a metadata refresh, the members are kept in its arena, and nothing of the result refers to it. */
+TEST(ParsedTargets, InArena) {
+  const std::string raw = Utils::readFile("tests/tuf/sample1/targets.json");
+  Uptane::ParsedTargets parsed;
+  {
+    MetadataArena::Scope scope;
+    ASSERT_TRUE(Uptane::ParsedTargets::parse(raw, &parsed));
+    EXPECT_GT(MetadataArena::allocatedBytes(), 0);
+  }
+  Uptane::ParsedTargets expected;
+  ASSERT_TRUE(Uptane::ParsedTargets::parse(raw, &expected));
+  EXPECT_EQ(parsed.canonical, expected.canonical);
+  EXPECT_EQ(parsed.json, expected.json);
+  ASSERT_EQ(parsed.targets.size(), expected.targets.size());
+  for (size_t i = 0; i < parsed.targets.size(); ++i) {
+    EXPECT_EQ(parsed.targets[i].filename(), expected.targets[i].filename());
+  }
+}
+
+/* Layouts that are not handled are left to the document parser. */
+TEST(ParsedTargets, Unhandled) {
+  Uptane::ParsedTargets parsed;
+  EXPECT_FALSE(Uptane::ParsedTargets::parse("", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse("\xEF\xBB\xBF{\"signed\": {\"targets\": {}}}", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {"targets": {} /* comment */}})", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {"targets": []}})", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {}})", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {"targets": {"a": {"b": [1, 2}}}})", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {"targets": {"a": tru}}})", &parsed));
+  EXPECT_FALSE(Uptane::ParsedTargets::parse(R"({"signed": {"targets": {"a": 1,}}})", &parsed));
+}
+
+/* Targets built from parsed metadata are verified like those built from a document. */
+TEST(ParsedTargets, Verify) {
+  const Json::Value root_json = Utils::parseJSONFile("tests/tuf/sample1/root.json");
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  const auto root = std::make_shared<Uptane::Root>(Uptane::RepositoryType::Image(), root_json, accept_all);
+  const std::string raw = Utils::readFile("tests/tuf/sample1/targets.json");
+
+  Uptane::ParsedTargets parsed;
+  ASSERT_TRUE(Uptane::ParsedTargets::parse(raw, &parsed));
+  const Uptane::Targets targets(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), std::move(parsed), root);
+  const Uptane::Targets expected(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), Utils::parseJSON(raw),
+                                 root);
+  EXPECT_EQ(targets, expected);
+  EXPECT_EQ(targets.signature(), expected.signature());
+
+  Json::Value tampered = Utils::parseJSON(raw);
+  tampered["signed"]["version"] = tampered["signed"]["version"].asInt() + 1;
+  ASSERT_TRUE(Uptane::ParsedTargets::parse(Utils::jsonToCanonicalStr(tampered), &parsed));
+  EXPECT_THROW(Uptane::Targets(Uptane::RepositoryType::Image(), Uptane::Role::Targets(), std::move(parsed), root),
+               Uptane::BadKeyId);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
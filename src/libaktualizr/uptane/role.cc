@@ -12,32 +12,47 @@ const std::string Role::SNAPSHOT = "snapshot";
 const std::string Role::TARGETS = "targets";
 const std::string Role::TIMESTAMP = "timestamp";
 
-Role::Role(const std::string &role_name, const bool delegation) {
+Role::Role(RoleEnum role) : role_(role) {
+  // Interned once, as the standard roles are used all the time
+  static const std::string *const root = internIdentifier("root");
+  static const std::string *const snapshot = internIdentifier("snapshot");
+  static const std::string *const targets = internIdentifier("targets");
+  static const std::string *const timestamp = internIdentifier("timestamp");
+  static const std::string *const invalid = internIdentifier("invalidrole");
+  if (role_ == RoleEnum::kRoot) {
+    name_ = root;
+  } else if (role_ == RoleEnum::kSnapshot) {
+    name_ = snapshot;
+  } else if (role_ == RoleEnum::kTargets) {
+    name_ = targets;
+  } else if (role_ == RoleEnum::kTimestamp) {
+    name_ = timestamp;
+  } else {
+    role_ = RoleEnum::kInvalidRole;
+    name_ = invalid;
+  }
+}
+
+Role::Role(const std::string &role_name, const bool delegation) : Role(RoleEnum::kInvalidRole) {
   std::string role_name_lower;
   std::transform(role_name.begin(), role_name.end(), std::back_inserter(role_name_lower), ::tolower);
-  name_ = role_name_lower;
   if (delegation) {
-    if (IsReserved(name_)) {
+    if (IsReserved(role_name_lower)) {
       throw Uptane::Exception("", "Delegated role name " + role_name + " is reserved.");
     }
     role_ = RoleEnum::kDelegation;
-    name_ = role_name;
+    name_ = internIdentifier(role_name);
   } else if (role_name_lower == ROOT) {
-    role_ = RoleEnum::kRoot;
+    *this = Root();
   } else if (role_name_lower == SNAPSHOT) {
-    role_ = RoleEnum::kSnapshot;
+    *this = Snapshot();
   } else if (role_name_lower == TARGETS) {
-    role_ = RoleEnum::kTargets;
+    *this = Targets();
   } else if (role_name_lower == TIMESTAMP) {
-    role_ = RoleEnum::kTimestamp;
-  } else {
-    role_ = RoleEnum::kInvalidRole;
-    name_ = "invalidrole";
+    *this = Timestamp();
   }
 }
 
-std::string Role::ToString() const { return name_; }
-
 std::ostream &Uptane::operator<<(std::ostream &os, const Role &role) {
   os << role.ToString();
   return os;
@@ -37,3 +37,16 @@ void Uptane::Root::UnpackSignedObject(const RepositoryType repo, const Role &rol
 
   Uptane::MetaWithKeys::UnpackSignedObject(repo, role, signed_object);
 }
+
+void Uptane::Root::VerifySigned(const RepositoryType repo, const Role &role, const std::string &signed_type,
+                                const std::string &canonical, const Json::Value &signatures) {
+  if (policy_ == Policy::kAcceptAll) {
+    return;
+  }
+  if (policy_ == Policy::kRejectAll) {
+    throw SecurityException(repo, "Root policy is Policy::kRejectAll");
+  }
+  assert(policy_ == Policy::kCheck);
+
+  Uptane::MetaWithKeys::VerifySigned(repo, role, signed_type, canonical, signatures);
+}
@@ -1,5 +1,9 @@
 #include "secondary_metadata.h"
 
+#include <set>
+
+#include "crypto/crypto.h"
+
 namespace Uptane {
 
 SecondaryMetadata::SecondaryMetadata(MetaBundle meta_bundle_in) : meta_bundle_(std::move(meta_bundle_in)) {
@@ -24,6 +28,20 @@ void SecondaryMetadata::fetchRole(std::string* result, int64_t maxsize, Reposito
   getRoleMetadata(result, repo, role, version);
 }
 
+std::string SecondaryMetadata::digest() const {
+  // The bundle is unordered
+  std::set<std::string> roles;
+  for (const auto& meta : meta_bundle_) {
+    roles.insert(meta.first.first.ToString() + "/" + meta.first.second.ToString() + ":" +
+                 Crypto::sha256digestHex(meta.second));
+  }
+  std::string all;
+  for (const auto& role : roles) {
+    all += role + "\n";
+  }
+  return Crypto::sha256digestHex(all);
+}
+
 void SecondaryMetadata::getRoleMetadata(std::string* result, const RepositoryType& repo, const Role& role,
                                         Version version) const {
   if (role == Role::Root() && version != Version()) {
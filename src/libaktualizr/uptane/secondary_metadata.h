@@ -13,6 +13,12 @@ class SecondaryMetadata : public IMetadataFetcher {
   void fetchRole(std::string* result, int64_t maxsize, RepositoryType repo, const Role& role, Version version,
                  const api::FlowControlToken* flow_control) const override;
 
+  /**
+   * Digest of all the roles of the bundle, with their repository and name,
+   * to tell whether two bundles hold the same metadata.
+   */
+  std::string digest() const;
+
  protected:
   virtual void getRoleMetadata(std::string* result, const RepositoryType& repo, const Role& role,
                                Version version) const;
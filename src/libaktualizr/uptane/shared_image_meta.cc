@@ -0,0 +1,59 @@
+#include "uptane/shared_image_meta.h"
+
+#include "crypto/crypto.h"
+
+namespace Uptane {
+
+SharedImageMeta &SharedImageMeta::instance() {
+  static SharedImageMeta cache;
+  return cache;
+}
+
+std::string SharedImageMeta::key(const std::string &root_digest, const std::string &targets_raw) {
+  // The Root digest is of a known length, hence the two can't be confused.
+  return root_digest + Crypto::sha256digestHex(targets_raw);
+}
+
+std::shared_ptr<const SharedImageMeta::Entry> SharedImageMeta::find(const std::string &key) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto it = lru_.begin(); it != lru_.end(); ++it) {
+    if (it->first == key) {
+      lru_.splice(lru_.begin(), lru_, it);
+      ++hits_;
+      return lru_.front().second;
+    }
+  }
+  ++misses_;
+  return nullptr;
+}
+
+void SharedImageMeta::insert(const std::string &key, std::shared_ptr<const Entry> entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  for (auto it = lru_.begin(); it != lru_.end(); ++it) {
+    if (it->first == key) {
+      lru_.erase(it);
+      break;
+    }
+  }
+  lru_.emplace_front(key, std::move(entry));
+  if (lru_.size() > kCapacity) {
+    lru_.pop_back();
+  }
+}
+
+void SharedImageMeta::clear() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  lru_.clear();
+}
+
+uint64_t SharedImageMeta::hits() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+uint64_t SharedImageMeta::misses() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+}  // namespace Uptane
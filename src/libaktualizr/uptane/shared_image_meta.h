@@ -0,0 +1,62 @@
+#ifndef UPTANE_SHARED_IMAGE_META_H_
+#define UPTANE_SHARED_IMAGE_META_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace Uptane {
+
+class Targets;
+
+/**
+ * Verified Image repo Targets metadata shared by all the clients of the
+ * process. When one process serves many device identities, they all use the
+ * same Image repo: its Targets metadata, which can be large, is then parsed
+ * and verified once and held in memory once, however many devices use it.
+ *
+ * Entries are keyed by a digest of the trusted Root metadata and of the raw
+ * Targets metadata, so that a client only gets an entry if it trusts the same
+ * Root and got the very same bytes. The checks that depend on the state of
+ * each client, against its Snapshot metadata and for expiry, are still done by
+ * each of them. Only the kCapacity most recently used entries are kept, which
+ * covers the devices not all being at the same version of the metadata.
+ */
+class SharedImageMeta {
+ public:
+  static constexpr size_t kCapacity = 4;
+
+  struct Entry {
+    std::shared_ptr<const Targets> targets;
+    // Of the canonical form of the metadata, for the hashes listed in Snapshot
+    std::string canonical_sha256;
+    std::string canonical_sha512;
+  };
+
+  static SharedImageMeta &instance();
+
+  static std::string key(const std::string &root_digest, const std::string &targets_raw);
+  /** nullptr if there is no entry for the key */
+  std::shared_ptr<const Entry> find(const std::string &key);
+  void insert(const std::string &key, std::shared_ptr<const Entry> entry);
+  void clear();
+
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+ private:
+  SharedImageMeta() = default;
+
+  mutable std::mutex mutex_;
+  // Most recently used first
+  std::list<std::pair<std::string, std::shared_ptr<const Entry>>> lru_;
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_SHARED_IMAGE_META_H_
@@ -0,0 +1,145 @@
+#include "uptane/signature_cache.h"
+
+#include "crypto/crypto.h"
+#include "storage/invstorage.h"
+#include "utilities/load_admission.h"
+
+namespace Uptane {
+
+SignatureCache &SignatureCache::instance() {
+  static SignatureCache cache;
+  return cache;
+}
+
+bool SignatureCache::verify(const std::string &keyid, const PublicKey &key, const std::string &signature,
+                            const std::string &message, const std::string &message_digest) {
+  return verifyBatch({Check{keyid, &key, signature}}, message, message_digest)[0];
+}
+
+std::vector<bool> SignatureCache::verifyBatch(const std::vector<Check> &checks, const std::string &message,
+                                              const std::string &message_digest) {
+  size_t capacity;
+  std::shared_ptr<INvStorage> storage;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    capacity = capacity_;
+    storage = storage_.lock();
+  }
+
+  std::vector<bool> valid(checks.size(), false);
+  std::vector<std::string> entries(checks.size());
+  // Signatures not found in the cache
+  std::vector<size_t> pending;
+  std::vector<PublicKey::SignedMessage> batch;
+  for (size_t i = 0; i < checks.size(); ++i) {
+    const Check &check = checks[i];
+    if (capacity != 0) {
+      entries[i] = entryKey(check.keyid, *check.key, check.signature, message_digest);
+      bool found;
+      {
+        std::lock_guard<std::mutex> guard(mutex_);
+        found = lookup(entries[i]);
+      }
+      if (!found && storage && storage->loadVerifiedSignature(entries[i])) {
+        std::lock_guard<std::mutex> guard(mutex_);
+        insert(entries[i]);
+        found = true;
+      }
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (found) {
+        ++hits_;
+        valid[i] = true;
+        continue;
+      }
+      ++misses_;
+    }
+    pending.push_back(i);
+    batch.push_back({check.key, check.signature, &message});
+  }
+  if (pending.empty()) {
+    return valid;
+  }
+
+  LoadAdmission::admit(LoadAdmission::Work::kVerification);
+  const std::vector<bool> batch_valid = PublicKey::VerifySignatures(batch);
+  for (size_t j = 0; j < pending.size(); ++j) {
+    if (!batch_valid[j]) {
+      continue;
+    }
+    const size_t i = pending[j];
+    valid[i] = true;
+    if (capacity == 0) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      insert(entries[i]);
+    }
+    if (storage) {
+      storage->storeVerifiedSignature(entries[i], capacity);
+    }
+  }
+  return valid;
+}
+
+void SignatureCache::setCapacity(size_t capacity) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  capacity_ = capacity;
+  while (lru_.size() > capacity_) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+void SignatureCache::setStorage(const std::shared_ptr<INvStorage> &storage) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  storage_ = storage;
+}
+
+void SignatureCache::clear() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  lru_.clear();
+  entries_.clear();
+}
+
+uint64_t SignatureCache::hits() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return hits_;
+}
+
+uint64_t SignatureCache::misses() const {
+  std::lock_guard<std::mutex> guard(mutex_);
+  return misses_;
+}
+
+std::string SignatureCache::entryKey(const std::string &keyid, const PublicKey &key, const std::string &signature,
+                                     const std::string &message_digest) {
+  // Every field but the last is of a known format or length-prefixed, so
+  // that different fields can't produce the same key.
+  return Crypto::sha256digestHex(std::to_string(keyid.size()) + ":" + keyid + std::to_string(key.Value().size()) +
+                                 ":" + key.Value() + std::to_string(static_cast<int>(key.Type())) + ":" +
+                                 std::to_string(signature.size()) + ":" + signature + message_digest);
+}
+
+bool SignatureCache::lookup(const std::string &entry) {
+  auto it = entries_.find(entry);
+  if (it == entries_.end()) {
+    return false;
+  }
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return true;
+}
+
+void SignatureCache::insert(const std::string &entry) {
+  if (capacity_ == 0 || lookup(entry)) {
+    return;
+  }
+  lru_.push_front(entry);
+  entries_[entry] = lru_.begin();
+  if (lru_.size() > capacity_) {
+    entries_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+}  // namespace Uptane
@@ -0,0 +1,90 @@
+#ifndef UPTANE_SIGNATURE_CACHE_H_
+#define UPTANE_SIGNATURE_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "libaktualizr/types.h"
+
+class INvStorage;
+
+namespace Uptane {
+
+/**
+ * Bounded cache of successful signature verifications, shared by all the
+ * metadata verified in the process.
+ *
+ * Entries are keyed by a digest of the key ID, the public key, the signature
+ * and the digest of the signed canonical bytes, so that a change to any of them
+ * forces a full verification. Failed verifications are never cached. The least
+ * recently used entries are dropped once the capacity is reached.
+ */
+class SignatureCache {
+ public:
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  static SignatureCache &instance();
+
+  /**
+   * Verify the signature of a message, unless the same signature was already
+   * found valid for the same key and message.
+   * @param message_digest sha256 of the message, as computed by Crypto::sha256digestHex
+   */
+  bool verify(const std::string &keyid, const PublicKey &key, const std::string &signature,
+              const std::string &message, const std::string &message_digest);
+
+  /** A signature to check with verifyBatch() */
+  struct Check {
+    std::string keyid;
+    const PublicKey *key;
+    std::string signature;
+  };
+  /**
+   * Verify a set of signatures of the same message, those not found valid
+   * before all together with PublicKey::VerifySignatures(). The result tells
+   * for each of them, in the same order, whether it is valid.
+   */
+  std::vector<bool> verifyBatch(const std::vector<Check> &checks, const std::string &message,
+                                const std::string &message_digest);
+
+  /** Maximum number of entries in memory and in storage; 0 disables the cache. */
+  void setCapacity(size_t capacity);
+  /**
+   * Also keep the entries in storage, so that unchanged metadata is not
+   * verified again after a restart. This trusts the storage with the
+   * verification results, so it should only be used if it is protected as
+   * well as the verification keys. Pass nullptr to stop using it.
+   */
+  void setStorage(const std::shared_ptr<INvStorage> &storage);
+  /** Drop the entries in memory. */
+  void clear();
+
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+ private:
+  SignatureCache() = default;
+
+  static std::string entryKey(const std::string &keyid, const PublicKey &key, const std::string &signature,
+                              const std::string &message_digest);
+  bool lookup(const std::string &entry);
+  void insert(const std::string &entry);
+
+  mutable std::mutex mutex_;
+  size_t capacity_{kDefaultCapacity};
+  // Most recently used first
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, std::list<std::string>::iterator> entries_;
+  std::weak_ptr<INvStorage> storage_;
+  uint64_t hits_{0};
+  uint64_t misses_{0};
+};
+
+}  // namespace Uptane
+
+#endif  // UPTANE_SIGNATURE_CACHE_H_
@@ -0,0 +1,140 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "storage/sqlstorage.h"
+#include "uptane/exceptions.h"
+#include "uptane/signature_cache.h"
+#include "uptane/tuf.h"
+#include "utilities/utils.h"
+
+static void verifyRoot(const Json::Value &json) {
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  Uptane::Root(Uptane::RepositoryType::Director(), json, accept_all);
+}
+
+class SignatureCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    cache.clear();
+    cache.setCapacity(Uptane::SignatureCache::kDefaultCapacity);
+    cache.setStorage(nullptr);
+  }
+  void TearDown() override { SetUp(); }
+
+  Uptane::SignatureCache &cache{Uptane::SignatureCache::instance()};
+  Json::Value root_json{Utils::parseJSONFile("tests/tuf/sample1/root.json")};
+};
+
+/* Signatures are only verified once. */
+TEST_F(SignatureCacheTest, Hit) {
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_EQ(cache.hits(), hits);
+  EXPECT_EQ(cache.misses(), misses + 1);
+
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_EQ(cache.hits(), hits + 1);
+  EXPECT_EQ(cache.misses(), misses + 1);
+}
+
+/* Any change of the signed data forces a full verification. */
+TEST_F(SignatureCacheTest, ChangedData) {
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+
+  Json::Value modified = root_json;
+  modified["signed"]["version"] = modified["signed"]["version"].asInt() + 1;
+  EXPECT_THROW(verifyRoot(modified), Uptane::BadKeyId);
+  EXPECT_EQ(cache.hits(), hits);
+  EXPECT_EQ(cache.misses(), misses + 1);
+
+  // Failures are not cached.
+  EXPECT_THROW(verifyRoot(modified), Uptane::BadKeyId);
+  EXPECT_EQ(cache.misses(), misses + 2);
+}
+
+/* In a batch, signatures found valid before are not verified again and bad ones are told apart. */
+TEST_F(SignatureCacheTest, Batch) {
+  const std::string keyid = root_json["signatures"][0]["keyid"].asString();
+  const std::string signature = root_json["signatures"][0]["sig"].asString();
+  const PublicKey key(root_json["signed"]["keys"][keyid]);
+  const std::string message = Utils::jsonToCanonicalStr(root_json["signed"]);
+  const std::string digest = Crypto::sha256digestHex(message);
+  const std::string bad_signature = Utils::toBase64("bad");
+
+  EXPECT_TRUE(cache.verify(keyid, key, signature, message, digest));
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+  const std::vector<bool> valid =
+      cache.verifyBatch({{keyid, &key, bad_signature}, {keyid, &key, signature}, {"other", &key, signature}}, message,
+                        digest);
+  EXPECT_EQ(valid, std::vector<bool>({false, true, true}));
+  EXPECT_EQ(cache.hits(), hits + 1);
+  EXPECT_EQ(cache.misses(), misses + 2);
+}
+
+/* Verifications kept in storage survive the cache being emptied. */
+TEST_F(SignatureCacheTest, Persist) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  auto storage = std::make_shared<SQLStorage>(config, false);
+  cache.setStorage(storage);
+
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  cache.clear();
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_EQ(cache.hits(), hits + 1);
+  EXPECT_EQ(cache.misses(), misses);
+
+  storage->clearVerifiedSignatures();
+  cache.clear();
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_EQ(cache.misses(), misses + 1);
+}
+
+/* Only the most recent entries are kept in storage. */
+TEST_F(SignatureCacheTest, StorageLimit) {
+  TemporaryDirectory temp_dir;
+  StorageConfig config;
+  config.path = temp_dir.Path();
+  SQLStorage storage(config, false);
+
+  storage.storeVerifiedSignature("a", 2);
+  storage.storeVerifiedSignature("b", 2);
+  storage.storeVerifiedSignature("a", 2);
+  storage.storeVerifiedSignature("c", 2);
+  EXPECT_TRUE(storage.loadVerifiedSignature("a"));
+  EXPECT_FALSE(storage.loadVerifiedSignature("b"));
+  EXPECT_TRUE(storage.loadVerifiedSignature("c"));
+}
+
+/* A capacity of 0 disables the cache. */
+TEST_F(SignatureCacheTest, Disabled) {
+  cache.setCapacity(0);
+  const uint64_t hits = cache.hits();
+  const uint64_t misses = cache.misses();
+
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_NO_THROW(verifyRoot(root_json));
+  EXPECT_EQ(cache.hits(), hits);
+  EXPECT_EQ(cache.misses(), misses);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,6 +1,9 @@
 #include "uptane/tuf.h"
 
+#include <fnmatch.h>
+#include <algorithm>
 #include <ctime>
+#include <memory>
 #include <ostream>
 #include <sstream>
 
@@ -11,6 +14,8 @@
 #include "libaktualizr/types.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
+#include "uptane/parsed_targets.h"
+#include "utilities/utils.h"
 
 using Uptane::Target;
 
@@ -29,109 +34,159 @@ std::ostream &Uptane::operator<<(std::ostream &os, const Version &v) {
 }
 
 std::string Hash::encodeVector(const std::vector<Hash> &hashes) {
-  std::stringstream hs;
-
+  std::string encoded;
   for (auto it = hashes.cbegin(); it != hashes.cend(); it++) {
-    hs << it->TypeString() << ":" << it->HashString();
-    if (std::next(it) != hashes.cend()) {
-      hs << ";";
+    if (it != hashes.cbegin()) {
+      encoded += ';';
     }
+    encoded += it->TypeString();
+    encoded += ':';
+    encoded += it->HashString();
   }
-
-  return hs.str();
+  return encoded;
 }
 
+// "type:hash;type:hash", parsed in place
 std::vector<Hash> Hash::decodeVector(std::string hashes_str) {
   std::vector<Hash> hash_v;
 
-  std::string cs = std::move(hashes_str);
-  while (!cs.empty()) {
-    size_t scp = cs.find(';');
-    std::string hash_token = cs.substr(0, scp);
-    if (scp == std::string::npos) {
-      cs = "";
-    } else {
-      cs = cs.substr(scp + 1);
+  size_t pos = 0;
+  while (pos < hashes_str.size()) {
+    size_t end = hashes_str.find(';', pos);
+    if (end == std::string::npos) {
+      end = hashes_str.size();
     }
-    if (hash_token.empty()) {
+    if (end == pos) {
       break;
     }
 
-    size_t cp = hash_token.find(':');
-    std::string hash_type_str = hash_token.substr(0, cp);
-    if (cp == std::string::npos) {
+    const size_t cp = hashes_str.find(':', pos);
+    if (cp == std::string::npos || cp > end) {
       break;
     }
-    std::string hash_value_str = hash_token.substr(cp + 1);
-
-    if (!hash_value_str.empty()) {
-      Hash h{hash_type_str, hash_value_str};
+    if (cp + 1 < end) {
+      Hash h{typeFromString(&hashes_str[pos], cp - pos), &hashes_str[cp + 1], end - cp - 1};
       if (h.type() != Hash::Type::kUnknownAlgorithm) {
         hash_v.push_back(std::move(h));
       }
     }
+    pos = end + 1;
   }
 
   return hash_v;
 }
 
-Target::Target(std::string filename, const Json::Value &content) : filename_(std::move(filename)) {
+Target::Target(std::string filename, const Json::Value &content) : Target(std::move(filename), content, "") {
+  if (content.isMember("custom")) {
+    mutableData().custom = LazyCustom(content["custom"]);
+  }
+}
+
+Target::Target(std::string filename, const Json::Value &content, std::string custom_json)
+    : data_{std::make_shared<Data>()} {
+  Data &data = mutableData();
+  data.filename = std::move(filename);
   if (content.isMember("custom")) {
-    updateCustom(content["custom"]);
+    extractCustom(content["custom"]);
+    data.custom = LazyCustom(std::move(custom_json));
   }
 
-  length_ = content["length"].asUInt64();
+  data.length = content["length"].asUInt64();
 
   const auto &hashes = content["hashes"];
   for (auto i = hashes.begin(); i != hashes.end(); ++i) {
     Hash h(i.key().asString(), (*i).asString());
     if (h.HaveAlgorithm()) {
-      hashes_.push_back(h);
+      data.hashes.push_back(h);
     }
   }
   // sort hashes so that higher priority hash algorithm goes first
-  std::sort(hashes_.begin(), hashes_.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
+  std::sort(data.hashes.begin(), data.hashes.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
+}
+
+Target::Data &Target::mutableData() {
+  // Only this Target can get to data it alone holds, so it can't be shared in the meantime
+  if (data_.use_count() > 1) {
+    data_ = std::make_shared<Data>(*data_);
+  }
+  // The data is always created non-const, and only shared as const
+  return const_cast<Data &>(*data_);  // NOLINT(cppcoreguidelines-pro-type-const-cast)
+}
+
+Target::LazyCustom::LazyCustom(const LazyCustom &other)
+    : json_{other.json_}, parsed_{std::atomic_load(&other.parsed_)} {}
+
+Target::LazyCustom &Target::LazyCustom::operator=(const LazyCustom &other) {
+  if (this != &other) {
+    json_ = other.json_;
+    parsed_ = std::atomic_load(&other.parsed_);
+  }
+  return *this;
+}
+
+const Json::Value &Target::LazyCustom::get() const {
+  std::shared_ptr<const Json::Value> parsed = std::atomic_load(&parsed_);
+  if (parsed) {
+    return *parsed;
+  }
+  if (json_.empty()) {
+    static const Json::Value none;
+    return none;
+  }
+  auto value = std::make_shared<const Json::Value>(Utils::parseJSON(json_));
+  // Whichever thread parsed it first, the value is the same, and the one set stays
+  std::shared_ptr<const Json::Value> expected;
+  if (std::atomic_compare_exchange_strong(&parsed_, &expected, value)) {
+    return *value;
+  }
+  return *expected;
 }
 
 void Target::updateCustom(const Json::Value &custom) {
-  custom_ = custom;
+  mutableData().custom = LazyCustom(custom);
+  extractCustom(custom);
+}
 
+void Target::extractCustom(const Json::Value &custom) {
+  Data &data = mutableData();
   // Image repo provides an array of hardware IDs.
-  if (custom_.isMember("hardwareIds")) {
-    Json::Value hwids = custom_["hardwareIds"];
+  if (custom.isMember("hardwareIds")) {
+    const Json::Value &hwids = custom["hardwareIds"];
     for (auto i = hwids.begin(); i != hwids.end(); ++i) {
-      hwids_.emplace_back((*i).asString());
+      data.hwids.emplace_back((*i).asString());
     }
   }
 
   // Director provides a map of ECU serials to hardware IDs.
-  Json::Value ecus = custom_["ecuIdentifiers"];
+  const Json::Value &ecus = custom["ecuIdentifiers"];
   for (auto i = ecus.begin(); i != ecus.end(); ++i) {
-    ecus_.insert({EcuSerial(i.key().asString()), HardwareIdentifier((*i)["hardwareId"].asString())});
+    data.ecus.insert({EcuSerial(i.key().asString()), HardwareIdentifier((*i)["hardwareId"].asString())});
   }
 
-  if (custom_.isMember("targetFormat")) {
-    type_ = custom_["targetFormat"].asString();
+  if (custom.isMember("targetFormat")) {
+    data.type = custom["targetFormat"].asString();
   }
 
-  if (custom_.isMember("uri")) {
-    std::string custom_uri = custom_["uri"].asString();
+  if (custom.isMember("uri")) {
+    std::string custom_uri = custom["uri"].asString();
     // Ignore this exact URL for backwards compatibility with old defaults that inserted it.
     if (custom_uri != "https://example.com/") {
-      uri_ = std::move(custom_uri);
+      data.uri = std::move(custom_uri);
     }
   }
 }
 
 // Internal use only.
 Target::Target(std::string filename, EcuMap ecus, std::vector<Hash> hashes, uint64_t length, std::string type)
-    : filename_(std::move(filename)),
-      type_(std::move(type)),
-      ecus_(std::move(ecus)),
-      hashes_(std::move(hashes)),
-      length_(length) {
+    : data_{std::make_shared<Data>()} {
+  Data &data = mutableData();
+  data.filename = std::move(filename);
+  data.type = std::move(type);
+  data.ecus = std::move(ecus);
+  data.hashes = std::move(hashes);
+  data.length = length;
   // sort hashes so that higher priority hash algorithm goes first
-  std::sort(hashes_.begin(), hashes_.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
+  std::sort(data.hashes.begin(), data.hashes.end(), [](const Hash &l, const Hash &r) { return l.type() < r.type(); });
 }
 
 Target Target::Unknown() {
@@ -140,18 +195,18 @@ Target Target::Unknown() {
   t_json["length"] = 0;
   Uptane::Target target{"unknown", t_json};
 
-  target.valid = false;
+  target.mutableData().valid = false;
 
   return target;
 }
 
 bool Target::MatchHash(const Hash &hash) const {
-  return (std::find(hashes_.begin(), hashes_.end(), hash) != hashes_.end());
+  return (std::find(data_->hashes.begin(), data_->hashes.end(), hash) != data_->hashes.end());
 }
 
 std::string Target::hashString(Hash::Type type) const {
   std::vector<Hash>::const_iterator it;
-  for (it = hashes_.begin(); it != hashes_.end(); it++) {
+  for (it = data_->hashes.begin(); it != data_->hashes.end(); it++) {
     if (it->type() == type) {
       return boost::algorithm::to_lower_copy(it->HashString());
     }
@@ -165,7 +220,7 @@ std::string Target::sha512Hash() const { return hashString(Hash::Type::kSha512);
 
 std::string Target::custom_version() const {
   try {
-    return custom_["version"].asString();
+    return custom_data()["version"].asString();
   } catch (const std::exception &ex) {
     LOG_ERROR << "Unable to parse custom version: " << ex.what();
     return "";
@@ -174,10 +229,10 @@ std::string Target::custom_version() const {
 
 bool Target::IsOstree() const {
   // NOLINTNEXTLINE(bugprone-branch-clone)
-  if (type_ == "OSTREE") {
+  if (data_->type == "OSTREE") {
     // Modern servers explicitly specify the type of the target
     return true;
-  } else if (type_.empty() && length() == 0) {
+  } else if (data_->type.empty() && length() == 0) {
     // Older servers don't specify the type of the target. Assume that it is
     // an OSTree target if the length is zero.
     return true;
@@ -195,10 +250,10 @@ bool Target::MatchTarget(const Target &t2) const {
   // uri_ is not matched. If the Director provides it, we use that. If not, but
   // the Image repository does, use that. Otherwise, leave it empty and use the
   // default.
-  if (filename_ != t2.filename_) {
+  if (data_->filename != t2.data_->filename) {
     return false;
   }
-  if (length_ != t2.length_) {
+  if (data_->length != t2.data_->length) {
     return false;
   }
 
@@ -207,15 +262,17 @@ bool Target::MatchTarget(const Target &t2) const {
   // empty) and a Target from the Image repo (HWID vector populated,
   // ECU->HWID map empty). Figure out which Target has the map, and then for
   // every item in the map, make sure it's in the other Target's HWID vector.
-  if (hwids_ != t2.hwids_ || ecus_ != t2.ecus_) {
+  if (data_->hwids != t2.data_->hwids || data_->ecus != t2.data_->ecus) {
     std::shared_ptr<EcuMap> ecu_map;                               // Director
     std::shared_ptr<std::vector<HardwareIdentifier>> hwid_vector;  // Image repo
-    if (!hwids_.empty() && ecus_.empty() && t2.hwids_.empty() && !t2.ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(t2.ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(hwids_);
-    } else if (!t2.hwids_.empty() && t2.ecus_.empty() && hwids_.empty() && !ecus_.empty()) {
-      ecu_map = std::make_shared<EcuMap>(ecus_);
-      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(t2.hwids_);
+    const Data &d1 = *data_;
+    const Data &d2 = *t2.data_;
+    if (!d1.hwids.empty() && d1.ecus.empty() && d2.hwids.empty() && !d2.ecus.empty()) {
+      ecu_map = std::make_shared<EcuMap>(d2.ecus);
+      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(d1.hwids);
+    } else if (!d2.hwids.empty() && d2.ecus.empty() && d1.hwids.empty() && !d1.ecus.empty()) {
+      ecu_map = std::make_shared<EcuMap>(d1.ecus);
+      hwid_vector = std::make_shared<std::vector<HardwareIdentifier>>(d2.hwids);
     } else {
       return false;
     }
@@ -231,8 +288,8 @@ bool Target::MatchTarget(const Target &t2) const {
   // - all hashes of the same type should match
   // - at least one pair of hashes should match
   bool oneMatchingHash = false;
-  for (const Hash &hash : hashes_) {
-    for (const Hash &hash2 : t2.hashes_) {
+  for (const Hash &hash : data_->hashes) {
+    for (const Hash &hash2 : t2.data_->hashes) {
       if (hash.type() == hash2.type() && !(hash == hash2)) {
         return false;
       }
@@ -246,40 +303,40 @@ bool Target::MatchTarget(const Target &t2) const {
 
 Json::Value Target::toDebugJson() const {
   Json::Value res;
-  for (const auto &ecu : ecus_) {
+  for (const auto &ecu : data_->ecus) {
     res["custom"]["ecuIdentifiers"][ecu.first.ToString()]["hardwareId"] = ecu.second.ToString();
   }
-  if (!hwids_.empty()) {
+  if (!data_->hwids.empty()) {
     Json::Value hwids;
-    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(hwids_.size()); ++i) {
-      hwids[i] = hwids_[i].ToString();
+    for (Json::Value::ArrayIndex i = 0; i < static_cast<Json::Value::ArrayIndex>(data_->hwids.size()); ++i) {
+      hwids[i] = data_->hwids[i].ToString();
     }
     res["custom"]["hardwareIds"] = hwids;
   }
-  res["custom"]["targetFormat"] = type_;
+  res["custom"]["targetFormat"] = data_->type;
 
-  for (const auto &hash : hashes_) {
+  for (const auto &hash : data_->hashes) {
     res["hashes"][hash.TypeString()] = hash.HashString();
   }
-  res["length"] = Json::Value(static_cast<Json::Value::Int64>(length_));
+  res["length"] = Json::Value(static_cast<Json::Value::Int64>(data_->length));
   return res;
 }
 
 std::ostream &Uptane::operator<<(std::ostream &os, const Target &t) {
-  os << "Target(" << t.filename_;
+  os << "Target(" << t.data_->filename;
   os << " ecu_identifiers: (";
-  for (const auto &ecu : t.ecus_) {
+  for (const auto &ecu : t.data_->ecus) {
     os << ecu.first << " (hw_id: " << ecu.second << "), ";
   }
   os << ")"
      << " hw_ids: (";
-  for (const auto &hwid : t.hwids_) {
+  for (const auto &hwid : t.data_->hwids) {
     os << hwid << ", ";
   }
   os << ")"
      << " length:" << t.length();
   os << " hashes: (";
-  for (const auto &hash : t.hashes_) {
+  for (const auto &hash : t.data_->hashes) {
     os << hash << ", ";
   }
   os << "))";
@@ -335,29 +392,143 @@ std::string Uptane::BaseMeta::signature() const {
   return signs[0]["sig"].asString();
 }
 
+Uptane::TargetIndex &Uptane::TargetIndex::operator=(const TargetIndex & /*unused*/) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  data_ = nullptr;
+  size_ = 0;
+  by_filename_.clear();
+  by_hash_.clear();
+  return *this;
+}
+
+const Target *Uptane::TargetIndex::byFilename(const std::vector<Target> &targets, const std::string &filename) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  update(targets);
+  const auto it = by_filename_.find(filename);
+  if (it == by_filename_.end() || targets[it->second].filename() != filename) {
+    return nullptr;
+  }
+  return &targets[it->second];
+}
+
+std::vector<const Target *> Uptane::TargetIndex::byHash(const std::vector<Target> &targets, const Hash &hash,
+                                                        const uint64_t length) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  update(targets);
+  std::vector<const Target *> result;
+  const auto range = by_hash_.equal_range(hashKey(hash, length));
+  for (auto it = range.first; it != range.second; ++it) {
+    const Target &target = targets[it->second];
+    const auto &hashes = target.hashes();
+    if (target.length() == length && std::find(hashes.cbegin(), hashes.cend(), hash) != hashes.cend()) {
+      result.push_back(&target);
+    }
+  }
+  return result;
+}
+
+std::string Uptane::TargetIndex::hashKey(const Hash &hash, const uint64_t length) {
+  return hash.TypeString() + ":" + hash.HashString() + ":" + std::to_string(length);
+}
+
+void Uptane::TargetIndex::update(const std::vector<Target> &targets) {
+  if (targets.data() == data_ && targets.size() == size_) {
+    return;
+  }
+  by_filename_.clear();
+  by_hash_.clear();
+  by_filename_.reserve(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    // Filenames are keys of the metadata; should there be duplicates, the first one wins as with a linear search.
+    by_filename_.emplace(targets[i].filename(), i);
+    for (const auto &hash : targets[i].hashes()) {
+      by_hash_.emplace(hashKey(hash, targets[i].length()), i);
+    }
+  }
+  data_ = targets.data();
+  size_ = targets.size();
+}
+
+Uptane::DelegationIndex &Uptane::DelegationIndex::operator=(const DelegationIndex & /*unused*/) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  data_ = nullptr;
+  size_ = 0;
+  by_prefix_.clear();
+  return *this;
+}
+
+std::vector<Uptane::Role> Uptane::DelegationIndex::rolesFor(const std::vector<std::string> &role_names,
+                                                            const std::map<Role, std::vector<std::string>> &paths,
+                                                            const std::string &filename) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  update(role_names, paths);
+  // A pattern can only match the names that start with its literal start.
+  std::vector<size_t> matching;
+  const std::string_view name(filename);
+  for (size_t len = 0; len <= name.size(); ++len) {
+    const auto it = by_prefix_.find(name.substr(0, len));
+    if (it == by_prefix_.end()) {
+      continue;
+    }
+    for (const auto &pattern : it->second) {
+      if (fnmatch(pattern.second.c_str(), filename.c_str(), 0) == 0) {
+        matching.push_back(pattern.first);
+      }
+    }
+  }
+  std::sort(matching.begin(), matching.end());
+  matching.erase(std::unique(matching.begin(), matching.end()), matching.end());
+  std::vector<Role> result;
+  result.reserve(matching.size());
+  for (const size_t idx : matching) {
+    result.push_back(Role::Delegation(role_names[idx]));
+  }
+  return result;
+}
+
+void Uptane::DelegationIndex::update(const std::vector<std::string> &role_names,
+                                     const std::map<Role, std::vector<std::string>> &paths) {
+  if (role_names.data() == data_ && role_names.size() == size_) {
+    return;
+  }
+  by_prefix_.clear();
+  for (size_t i = 0; i < role_names.size(); ++i) {
+    const auto role_paths = paths.find(Role::Delegation(role_names[i]));
+    if (role_paths == paths.end()) {
+      continue;
+    }
+    for (const auto &pattern : role_paths->second) {
+      const std::string prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+      by_prefix_[prefix].emplace_back(i, pattern);
+    }
+  }
+  data_ = role_names.data();
+  size_ = role_names.size();
+}
+
 void Uptane::Targets::init(const Json::Value &json) {
   if (!json.isObject() || json["signed"]["_type"] != "Targets") {
     throw Uptane::InvalidMetadata("invalid targets.json");
   }
 
-  const Json::Value target_list = json["signed"]["targets"];
+  const Json::Value &target_list = json["signed"]["targets"];
+  targets.reserve(targets.size() + target_list.size());
   for (auto t_it = target_list.begin(); t_it != target_list.end(); t_it++) {
-    Target t(t_it.key().asString(), *t_it);
-    targets.push_back(t);
+    targets.emplace_back(t_it.key().asString(), *t_it);
   }
 
   if (json["signed"]["delegations"].isObject()) {
-    const Json::Value key_list = json["signed"]["delegations"]["keys"];
+    const Json::Value &key_list = json["signed"]["delegations"]["keys"];
     ParseKeys(Uptane::RepositoryType::Image(), key_list);
 
-    const Json::Value role_list = json["signed"]["delegations"]["roles"];
+    const Json::Value &role_list = json["signed"]["delegations"]["roles"];
     for (auto it = role_list.begin(); it != role_list.end(); it++) {
       const std::string role_name = (*it)["name"].asString();
       const Role role = Role::Delegation(role_name);
       delegated_role_names_.push_back(role_name);
       ParseRole(Uptane::RepositoryType::Image(), it, role, name_);
 
-      const Json::Value paths_list = (*it)["paths"];
+      const Json::Value &paths_list = (*it)["paths"];
       std::vector<std::string> paths;
       for (auto p_it = paths_list.begin(); p_it != paths_list.end(); p_it++) {
         paths.emplace_back((*p_it).asString());
@@ -383,6 +554,27 @@ Uptane::Targets::Targets(RepositoryType repo, const Role &role, const Json::Valu
   init(json);
 }
 
+Uptane::Targets::Targets(RepositoryType repo, const Role &role, ParsedTargets &&parsed,
+                         const std::shared_ptr<MetaWithKeys> &signer)
+    : MetaWithKeys(verifyParsed(repo, role, parsed, signer)), name_(role.ToString()) {
+  init(parsed.json);
+  targets = std::move(parsed.targets);
+}
+
+const Json::Value &Uptane::Targets::verifyParsed(RepositoryType repo, const Role &role, ParsedTargets &parsed,
+                                                 const std::shared_ptr<MetaWithKeys> &signer) {
+  if (!parsed.json.isObject() || !parsed.json.isMember("signed")) {
+    throw Uptane::InvalidMetadata("invalid metadata json");
+  }
+  // The canonical form is not needed anymore, cut it down to the signed part
+  // in place rather than copying it.
+  std::string &canonical = parsed.canonical;
+  canonical.erase(parsed.signed_begin + parsed.signed_length);
+  canonical.erase(0, parsed.signed_begin);
+  signer->VerifySigned(repo, role, parsed.json["signed"]["_type"].asString(), canonical, parsed.json["signatures"]);
+  return parsed.json;
+}
+
 void Uptane::TimestampMeta::init(const Json::Value &json) {
   Json::Value hashes_list = json["signed"]["meta"]["snapshot.json"]["hashes"];
   Json::Value meta_size = json["signed"]["meta"]["snapshot.json"]["length"];
@@ -483,6 +675,22 @@ int Uptane::Snapshot::role_version(const Uptane::Role &role) const {
   }
 };
 
+std::vector<Uptane::Role> Uptane::Snapshot::changed_roles(const Snapshot &other) const {
+  std::set<Uptane::Role> changed;
+  auto compare = [&changed](const Snapshot &a, const Snapshot &b) {
+    for (const auto &it : a.role_version_) {
+      const Uptane::Role &role = it.first;
+      if (b.role_version(role) != it.second || b.role_size(role) != a.role_size(role) ||
+          b.role_hashes(role) != a.role_hashes(role) || b.role_version_.count(role) == 0) {
+        changed.insert(role);
+      }
+    }
+  };
+  compare(*this, other);
+  compare(other, *this);
+  return std::vector<Uptane::Role>(changed.begin(), changed.end());
+}
+
 int Uptane::extractVersionUntrusted(const std::string &meta) {
   auto version_json = Utils::parseJSON(meta)["signed"]["version"];
   if (!version_json.isIntegral()) {
@@ -7,8 +7,11 @@
 
 #include <functional>
 #include <map>
+#include <mutex>
 #include <ostream>
 #include <set>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "libaktualizr/types.h"
@@ -80,12 +83,19 @@ class Role {
   }
 
   explicit Role(const std::string &role_name, bool delegation = false);
-  std::string ToString() const;
+  const std::string &ToString() const { return *name_; }
   int ToInt() const { return static_cast<int>(role_); }
   bool IsDelegation() const { return role_ == RoleEnum::kDelegation; }
+  // The names are interned, so equal names are at the same address
   bool operator==(const Role &other) const { return name_ == other.name_; }
   bool operator!=(const Role &other) const { return !(*this == other); }
-  bool operator<(const Role &other) const { return name_ < other.name_; }
+  bool operator<(const Role &other) const {
+    // The standard roles are in the order of their names
+    if (isStandard() && other.isStandard()) {
+      return role_ < other.role_;
+    }
+    return name_ != other.name_ && *name_ < *other.name_;
+  }
 
   friend std::ostream &operator<<(std::ostream &os, const Role &role);
 
@@ -94,23 +104,11 @@ class Role {
    *  Delegations are special and handled differently. */
   enum class RoleEnum { kRoot = 0, kSnapshot = 1, kTargets = 2, kTimestamp = 3, kDelegation = 4, kInvalidRole = -1 };
 
-  explicit Role(RoleEnum role) : role_(role) {
-    if (role_ == RoleEnum::kRoot) {
-      name_ = ROOT;
-    } else if (role_ == RoleEnum::kSnapshot) {
-      name_ = SNAPSHOT;
-    } else if (role_ == RoleEnum::kTargets) {
-      name_ = TARGETS;
-    } else if (role_ == RoleEnum::kTimestamp) {
-      name_ = TIMESTAMP;
-    } else {
-      role_ = RoleEnum::kInvalidRole;
-      name_ = "invalidrole";
-    }
-  }
+  explicit Role(RoleEnum role);
+  bool isStandard() const { return role_ >= RoleEnum::kRoot && role_ <= RoleEnum::kTimestamp; }
 
   RoleEnum role_;
-  std::string name_;
+  const std::string *name_;
 };
 
 std::ostream &operator<<(std::ostream &os, const Role &role);
@@ -138,6 +136,7 @@ std::ostream &operator<<(std::ostream &os, const Version &v);
 
 /* Metadata objects */
 class MetaWithKeys;
+struct ParsedTargets;
 class BaseMeta {
  public:
   BaseMeta() = default;
@@ -146,7 +145,6 @@ class BaseMeta {
   int version() const { return version_; }
   TimeStamp expiry() const { return expiry_; }
   bool isExpired(const TimeStamp &now) const { return expiry_.IsExpiredAt(now); }
-  Json::Value original() const { return original_object_; }
   /**
    * Get the first signature of a given meta.
    *
@@ -206,6 +204,15 @@ class MetaWithKeys : public BaseMeta {
    * @return
    */
   virtual void UnpackSignedObject(RepositoryType repo, const Role &role, const Json::Value &signed_object);
+  /**
+   * Perform the checks of UnpackSignedObject() on the canonical form of the
+   * 'signed' part of a signed object.
+   * @param signed_type - The "_type" of the 'signed' part
+   * @param canonical - Canonical form of the 'signed' part
+   * @param signatures - The 'signatures' part
+   */
+  virtual void VerifySigned(RepositoryType repo, const Role &role, const std::string &signed_type,
+                            const std::string &canonical, const Json::Value &signatures);
 
   bool operator==(const MetaWithKeys &rhs) const {
     return version_ == rhs.version_ && expiry_ == rhs.expiry_ && keys_ == rhs.keys_ &&
@@ -219,6 +226,8 @@ class MetaWithKeys : public BaseMeta {
 
   static const int64_t kMinSignatures = 1;
   static const int64_t kMaxSignatures = 1000;
+  // Signatures of one object verified together
+  static const int kMaxVerifyThreads = 4;
 
   std::map<KeyId, PublicKey> keys_;
   std::set<std::pair<Role, KeyId>> keys_for_role_;
@@ -255,6 +264,8 @@ class Root : public MetaWithKeys {
    * @return
    */
   void UnpackSignedObject(RepositoryType repo, const Role &role, const Json::Value &signed_object) override;
+  void VerifySigned(RepositoryType repo, const Role &role, const std::string &signed_type,
+                    const std::string &canonical, const Json::Value &signatures) override;
 
   bool operator==(const Root &rhs) const {
     return version_ == rhs.version_ && expiry_ == rhs.expiry_ && keys_ == rhs.keys_ &&
@@ -278,11 +289,67 @@ static bool MatchTargetVector(const std::vector<Uptane::Target> &v1, const std::
   return true;
 }
 
+/**
+ * Index of a vector of targets by filename and by hash and length, built on
+ * first use and rebuilt if the vector has been reallocated or resized since.
+ * Copies start out empty.
+ */
+class TargetIndex {
+ public:
+  TargetIndex() = default;
+  TargetIndex(const TargetIndex & /*unused*/) {}
+  TargetIndex &operator=(const TargetIndex & /*unused*/);
+
+  const Target *byFilename(const std::vector<Target> &targets, const std::string &filename);
+  std::vector<const Target *> byHash(const std::vector<Target> &targets, const Hash &hash, uint64_t length);
+
+ private:
+  static std::string hashKey(const Hash &hash, uint64_t length);
+  void update(const std::vector<Target> &targets);
+
+  std::mutex mutex_;
+  const Target *data_{nullptr};
+  size_t size_{0};
+  std::unordered_map<std::string, size_t> by_filename_;
+  std::unordered_multimap<std::string, size_t> by_hash_;
+};
+
+/**
+ * Index of the delegated roles of a Targets metadata by the literal start of
+ * their path patterns, so that only the patterns that share it with a target
+ * are matched. Built on first use and rebuilt if the roles have changed since.
+ * Copies start out empty.
+ */
+class DelegationIndex {
+ public:
+  DelegationIndex() = default;
+  DelegationIndex(const DelegationIndex & /*unused*/) {}
+  DelegationIndex &operator=(const DelegationIndex & /*unused*/);
+
+  /** The roles with a path pattern that matches filename, in the order of the metadata. */
+  std::vector<Role> rolesFor(const std::vector<std::string> &role_names,
+                             const std::map<Role, std::vector<std::string>> &paths, const std::string &filename);
+
+ private:
+  void update(const std::vector<std::string> &role_names, const std::map<Role, std::vector<std::string>> &paths);
+
+  std::mutex mutex_;
+  const std::string *data_{nullptr};
+  size_t size_{0};
+  // Index of the role and pattern, by the start of the pattern up to its
+  // first wildcard
+  std::map<std::string, std::vector<std::pair<size_t, std::string>>, std::less<>> by_prefix_;
+};
+
 // Also used for delegated targets.
 class Targets : public MetaWithKeys {
  public:
   explicit Targets(const Json::Value &json);
   Targets(RepositoryType repo, const Role &role, const Json::Value &json, const std::shared_ptr<MetaWithKeys> &signer);
+  /**
+   * Verify and take over metadata parsed with ParsedTargets::parse().
+   */
+  Targets(RepositoryType repo, const Role &role, ParsedTargets &&parsed, const std::shared_ptr<MetaWithKeys> &signer);
   Targets() = default;
 
   bool operator==(const Targets &rhs) const {
@@ -323,6 +390,25 @@ class Targets : public MetaWithKeys {
     return result;
   }
 
+  /**
+   * Find a target of this metadata by filename.
+   * @return the target, or nullptr if there is none
+   */
+  const Target *findTarget(const std::string &filename) const { return index_.byFilename(targets, filename); }
+  /**
+   * Find the targets of this metadata with the given hash and length.
+   */
+  std::vector<const Target *> findTargets(const Hash &hash, uint64_t length) const {
+    return index_.byHash(targets, hash, length);
+  }
+  /**
+   * The delegated roles with a path pattern that matches filename, in the
+   * order of the metadata.
+   */
+  std::vector<Role> delegationsFor(const std::string &filename) const {
+    return delegation_index_.rolesFor(delegated_role_names_, paths_for_role_, filename);
+  }
+
   std::vector<Uptane::Target> targets;
   std::vector<std::string> delegated_role_names_;
   std::map<Role, std::vector<std::string>> paths_for_role_;
@@ -330,9 +416,13 @@ class Targets : public MetaWithKeys {
 
  private:
   void init(const Json::Value &json);
+  static const Json::Value &verifyParsed(RepositoryType repo, const Role &role, ParsedTargets &parsed,
+                                         const std::shared_ptr<MetaWithKeys> &signer);
 
   std::string name_;
   std::string correlation_id_;  // custom non-tuf
+  mutable TargetIndex index_;
+  mutable DelegationIndex delegation_index_;
 };
 
 class TimestampMeta : public BaseMeta {
@@ -360,6 +450,8 @@ class Snapshot : public BaseMeta {
   std::vector<Hash> role_hashes(const Uptane::Role &role) const;
   int64_t role_size(const Uptane::Role &role) const;
   int role_version(const Uptane::Role &role) const;
+  /** The roles listed differently in other, or only in one of them. */
+  std::vector<Uptane::Role> changed_roles(const Snapshot &other) const;
   bool operator==(const Snapshot &rhs) const {
     return version_ == rhs.version() && expiry_ == rhs.expiry() && role_size_ == rhs.role_size_ &&
            role_version_ == rhs.role_version_ && role_hashes_ == rhs.role_hashes_;
@@ -387,13 +479,15 @@ int extractVersionUntrusted(const std::string &meta);  // returns negative numbe
 namespace std {
 template <>
 struct hash<Uptane::HardwareIdentifier> {
-  size_t operator()(const Uptane::HardwareIdentifier &hwid) const { return std::hash<std::string>()(hwid.hwid_); }
+  size_t operator()(const Uptane::HardwareIdentifier &hwid) const {
+    return std::hash<const std::string *>()(hwid.hwid_);
+  }
 };
 
 template <>
 struct hash<Uptane::EcuSerial> {
   size_t operator()(const Uptane::EcuSerial &ecu_serial) const {
-    return std::hash<std::string>()(ecu_serial.ecu_serial_);
+    return std::hash<const std::string *>()(ecu_serial.ecu_serial_);
   }
 };
 }  // namespace std
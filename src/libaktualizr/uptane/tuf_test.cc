@@ -1,10 +1,13 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <map>
+#include <thread>
 #include <vector>
 
 #include <json/json.h>
 
+#include "crypto/crypto.h"
 #include "logging/logging.h"
 #include "uptane/exceptions.h"
 #include "uptane/tuf.h"
@@ -60,6 +63,49 @@ TEST(Root, RootJsonRsassaPssSha256) {
   EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), initial_root, root));
 }
 
+/*
+ * Check the signature threshold of a Root signed by many keys, some of the
+ * signatures being invalid.
+ */
+TEST(Root, ThresholdOfMany) {
+  const int num_keys = 6;
+  std::vector<std::pair<PublicKey, std::string>> keys;
+  Json::Value root_json;
+  root_json["signed"]["_type"] = "Root";
+  root_json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  root_json["signed"]["version"] = 1;
+  root_json["signed"]["roles"]["root"]["threshold"] = 3;
+  for (int i = 0; i < num_keys; ++i) {
+    std::string public_key;
+    std::string private_key;
+    ASSERT_TRUE(Crypto::generateRSAKeyPair(KeyType::kRSA2048, &public_key, &private_key));
+    keys.emplace_back(PublicKey(public_key, KeyType::kRSA2048), private_key);
+    root_json["signed"]["keys"][keys.back().first.KeyId()] = keys.back().first.ToUptane();
+    root_json["signed"]["roles"]["root"]["keyids"].append(keys.back().first.KeyId());
+  }
+  const std::string canonical = Utils::jsonToCanonicalStr(root_json["signed"]);
+  for (const auto &key : keys) {
+    Json::Value signature;
+    signature["keyid"] = key.first.KeyId();
+    signature["method"] = "rsassa-pss";
+    signature["sig"] = Utils::toBase64(Crypto::RSAPSSSign(nullptr, key.second, canonical));
+    root_json["signatures"].append(signature);
+  }
+
+  Uptane::Root accept_all(Uptane::Root::Policy::kAcceptAll);
+  EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), root_json, accept_all));
+
+  // Three valid signatures are left.
+  for (Json::ArrayIndex i = 0; i < 3; ++i) {
+    root_json["signatures"][i * 2]["sig"] = root_json["signatures"][i * 2 + 1]["sig"];
+  }
+  EXPECT_NO_THROW(Uptane::Root(Uptane::RepositoryType::Director(), root_json, accept_all));
+
+  // Two valid signatures are left.
+  root_json["signatures"][1]["sig"] = root_json["signatures"][3]["sig"];
+  EXPECT_THROW(Uptane::Root(Uptane::RepositoryType::Director(), root_json, accept_all), Uptane::UnmetThreshold);
+}
+
 /* Validate TUF roles. */
 TEST(Role, ValidateRoles) {
   Uptane::Role root = Uptane::Role::Root();
@@ -83,6 +129,24 @@ TEST(Role, ValidateRoles) {
   EXPECT_EQ(timestamp.IsDelegation(), false);
 }
 
+/* Roles compare and sort by their name, also between standard roles and delegations. */
+TEST(Role, Compare) {
+  EXPECT_EQ(Uptane::Role("Targets"), Uptane::Role::Targets());
+  EXPECT_EQ(Uptane::Role::Targets().ToString(), "targets");
+  EXPECT_EQ(Uptane::Role::Delegation("abc"), Uptane::Role::Delegation("abc"));
+  EXPECT_NE(Uptane::Role::Delegation("abc"), Uptane::Role::Delegation("abd"));
+  EXPECT_EQ(Uptane::Role("whatever"), Uptane::Role::InvalidRole());
+
+  std::vector<Uptane::Role> roles{Uptane::Role::Timestamp(), Uptane::Role::Delegation("snapshots"),
+                                  Uptane::Role::Targets(), Uptane::Role::Delegation("abc"), Uptane::Role::Root(),
+                                  Uptane::Role::Snapshot()};
+  std::sort(roles.begin(), roles.end());
+  std::vector<std::string> names;
+  std::transform(roles.cbegin(), roles.cend(), std::back_inserter(names),
+                 [](const Uptane::Role &role) { return role.ToString(); });
+  EXPECT_EQ(names, (std::vector<std::string>{"abc", "root", "snapshot", "snapshots", "targets", "timestamp"}));
+}
+
 /* Delegated roles have custom names. */
 TEST(Role, ValidDelegationName) {
   Uptane::Role delegated = Uptane::Role::Delegation("whatever");
@@ -283,6 +347,154 @@ TEST(Target, HashMismatch) {
   EXPECT_FALSE(target2.MatchTarget(target1));
 }
 
+/* Copies of a Target share its data until one of them is changed. */
+TEST(Target, CopyOnWrite) {
+  Uptane::EcuMap ecu_map{{Uptane::EcuSerial("serial"), Uptane::HardwareIdentifier("fake-test")}};
+  Uptane::Target target("abc", generateDirectorTarget("hash_good", 739, ecu_map));
+  Uptane::Target copy = target;
+  EXPECT_EQ(&copy.filename(), &target.filename());
+  EXPECT_EQ(&copy.custom_data(), &target.custom_data());
+
+  copy.setUri("https://example.com/abc");
+  copy.InsertEcu({Uptane::EcuSerial("serial2"), Uptane::HardwareIdentifier("fake-test")});
+  EXPECT_EQ(copy.uri(), "https://example.com/abc");
+  EXPECT_EQ(copy.ecus().size(), 2);
+  EXPECT_EQ(target.uri(), "");
+  EXPECT_EQ(target.ecus().size(), 1);
+  EXPECT_EQ(copy.filename(), "abc");
+
+  // A Target moved from is a copy
+  Uptane::Target moved = std::move(target);
+  EXPECT_EQ(target.filename(), "abc");  // NOLINT(bugprone-use-after-move, hicpp-invalid-access-moved)
+  EXPECT_EQ(&moved.filename(), &target.filename());  // NOLINT(bugprone-use-after-move, hicpp-invalid-access-moved)
+}
+
+/* The custom object kept as text is only parsed when it is used, once for all
+ * the copies, and the fields it is matched on are there from the start. */
+TEST(Target, LazyCustom) {
+  const std::string custom = R"({"hardwareIds": ["hw1", "hw2"], "targetFormat": "BINARY",
+                                 "uri": "https://example.com/t", "version": "1.2"})";
+  Json::Value content;
+  content["length"] = 12;
+  content["hashes"]["sha256"] = "abcd";
+  content["custom"] = Utils::parseJSON(custom);
+  const Uptane::Target target("t", content, custom);
+  EXPECT_EQ(target.hardwareIds().size(), 2);
+  EXPECT_EQ(target.type(), "BINARY");
+  EXPECT_EQ(target.uri(), "https://example.com/t");
+  EXPECT_TRUE(target.MatchTarget(Uptane::Target("t", content)));
+
+  const Uptane::Target copy = target;
+  std::vector<const Json::Value *> parsed(4);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < parsed.size(); ++i) {
+    threads.emplace_back([&, i]() { parsed[i] = &((i % 2 == 0) ? target : copy).custom_data(); });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  for (const Json::Value *value : parsed) {
+    EXPECT_EQ(value, &target.custom_data());
+  }
+  EXPECT_EQ(target.custom_data(), content["custom"]);
+  EXPECT_EQ(copy.custom_version(), "1.2");
+}
+
+/* Targets are found by filename and by hash and length, also after the list changed. */
+TEST(Targets, FindTarget) {
+  const std::vector<Uptane::HardwareIdentifier> hardwareIds{Uptane::HardwareIdentifier("fake-test")};
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["targets"]["abc"] = generateImageTarget("abcd", 10, hardwareIds);
+  json["signed"]["targets"]["def"] = generateImageTarget("ef01", 20, hardwareIds);
+  json["signed"]["targets"]["same"] = generateImageTarget("abcd", 10, hardwareIds);
+  Uptane::Targets targets(json);
+
+  ASSERT_NE(targets.findTarget("def"), nullptr);
+  EXPECT_EQ(targets.findTarget("def")->length(), 20);
+  EXPECT_EQ(targets.findTarget("missing"), nullptr);
+
+  const Hash hash(Hash::Type::kSha256, "abcd");
+  EXPECT_EQ(targets.findTargets(hash, 10).size(), 2);
+  EXPECT_TRUE(targets.findTargets(hash, 11).empty());
+  EXPECT_TRUE(targets.findTargets(Hash(Hash::Type::kSha512, "abcd"), 10).empty());
+
+  const Uptane::Targets copy(targets);
+  ASSERT_NE(copy.findTarget("abc"), nullptr);
+  EXPECT_EQ(copy.findTarget("abc"), &copy.targets[0]);
+
+  targets.targets.emplace_back("ghi", generateImageTarget("ef01", 20, hardwareIds));
+  ASSERT_NE(targets.findTarget("ghi"), nullptr);
+  EXPECT_EQ(targets.findTargets(Hash(Hash::Type::kSha256, "ef01"), 20).size(), 2);
+  targets.clear();
+  EXPECT_EQ(targets.findTarget("abc"), nullptr);
+}
+
+/* Only the delegated roles with a matching path pattern are given, in the order of the metadata. */
+TEST(Targets, DelegationsFor) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["delegations"]["keys"] = Json::objectValue;
+  const std::vector<std::pair<std::string, std::vector<std::string>>> roles{
+      {"prefix", {"ab*"}}, {"exact", {"abc"}}, {"other", {"x*", "[xy]bc"}}, {"suffix", {"*c"}}, {"none", {}}};
+  for (const auto &role : roles) {
+    Json::Value role_json;
+    role_json["name"] = role.first;
+    role_json["threshold"] = 1;
+    role_json["terminating"] = false;
+    role_json["paths"] = Json::arrayValue;
+    for (const auto &path : role.second) {
+      role_json["paths"].append(path);
+    }
+    json["signed"]["delegations"]["roles"].append(role_json);
+  }
+  const Uptane::Targets targets(json);
+
+  const std::vector<Uptane::Role> abc{Uptane::Role::Delegation("prefix"), Uptane::Role::Delegation("exact"),
+                                      Uptane::Role::Delegation("suffix")};
+  EXPECT_EQ(targets.delegationsFor("abc"), abc);
+  const std::vector<Uptane::Role> ybc{Uptane::Role::Delegation("other"), Uptane::Role::Delegation("suffix")};
+  EXPECT_EQ(targets.delegationsFor("ybc"), ybc);
+  EXPECT_EQ(targets.delegationsFor("abd"), std::vector<Uptane::Role>{Uptane::Role::Delegation("prefix")});
+  EXPECT_TRUE(targets.delegationsFor("zzz").empty());
+
+  const Uptane::Targets copy(targets);
+  EXPECT_EQ(copy.delegationsFor("abc"), abc);
+}
+
+/* The roles whose Snapshot entries differ are found. */
+TEST(Snapshot, ChangedRoles) {
+  Json::Value json;
+  json["signed"]["_type"] = "Snapshot";
+  json["signed"]["version"] = 1;
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["meta"]["targets.json"]["version"] = 1;
+  json["signed"]["meta"]["same.json"]["version"] = 1;
+  json["signed"]["meta"]["newer.json"]["version"] = 1;
+  json["signed"]["meta"]["rehashed.json"]["version"] = 1;
+  json["signed"]["meta"]["rehashed.json"]["hashes"]["sha256"] = "abcd";
+  json["signed"]["meta"]["removed.json"]["version"] = 1;
+  const Uptane::Snapshot before(json);
+
+  json["signed"]["meta"]["newer.json"]["version"] = 2;
+  json["signed"]["meta"]["rehashed.json"]["hashes"]["sha256"] = "ef01";
+  json["signed"]["meta"].removeMember("removed.json");
+  json["signed"]["meta"]["added.json"]["version"] = 1;
+  const Uptane::Snapshot after(json);
+
+  std::vector<std::string> changed;
+  for (const auto &role : after.changed_roles(before)) {
+    changed.push_back(role.ToString());
+  }
+  std::sort(changed.begin(), changed.end());
+  EXPECT_EQ(changed, (std::vector<std::string>{"added", "newer", "rehashed", "removed"}));
+  EXPECT_TRUE(after.changed_roles(after).empty());
+}
+
 /* RepositoryType roundtrips via a string, and has the name we expect */
 TEST(RepositoryType, StringRoundTrip) {
   auto d = Uptane::RepositoryType::Director();
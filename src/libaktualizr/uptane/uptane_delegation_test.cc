@@ -10,6 +10,7 @@
 #include "libaktualizr/events.h"
 
 #include "httpfake.h"
+#include "uptane_repo.h"
 #include "uptane_test_common.h"
 
 boost::filesystem::path uptane_generator_path;
@@ -237,6 +238,80 @@ TEST(Delegation, IterateAll) {
   EXPECT_TRUE(expected_target_names.empty());
 }
 
+/* Delegations fetched ahead of the iteration are only stored once they are
+ * reached and verified. */
+TEST(Delegation, IterateAhead) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_nested(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegation>(temp_dir.Path());
+
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+
+  aktualizr.Initialize();
+  result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+  EXPECT_EQ(update_result.status, result::UpdateStatus::kUpdatesAvailable);
+
+  // Entering role-abc starts fetching its siblings role-bcd and role-def.
+  bool found = false;
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    if (target.filename() == "abc/target0") {
+      found = true;
+      break;
+    }
+  }
+  EXPECT_TRUE(found);
+
+  std::string meta;
+  EXPECT_TRUE(storage->loadDelegation(&meta, Uptane::Role::Delegation("role-abc")));
+  EXPECT_FALSE(storage->loadDelegation(&meta, Uptane::Role::Delegation("role-bcd")));
+  EXPECT_FALSE(storage->loadDelegation(&meta, Uptane::Role::Delegation("role-def")));
+
+  // The complete iteration still visits everything in order.
+  std::vector<std::string> target_names;
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    target_names.push_back(target.filename());
+  }
+  EXPECT_EQ(target_names.size(), 10U);
+  EXPECT_TRUE(storage->loadDelegation(&meta, Uptane::Role::Delegation("role-def")));
+}
+
+/* Stored delegations are kept while the Snapshot metadata lists them
+ * unchanged, and deleted once it doesn't list them anymore. */
+TEST(Delegation, PruneStored) {
+  TemporaryDirectory temp_dir;
+  auto delegation_path = temp_dir.Path() / "delegation_test";
+  delegation_basic(delegation_path, false);
+  auto http = std::make_shared<HttpFakeDelegation>(temp_dir.Path());
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  auto storage = INvStorage::newStorage(conf.storage);
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+
+  EXPECT_EQ(aktualizr.CheckUpdates().get().status, result::UpdateStatus::kUpdatesAvailable);
+  size_t targets = 0;
+  for (auto& target : aktualizr.uptane_client()->allTargets()) {
+    (void)target;
+    ++targets;
+  }
+  EXPECT_EQ(targets, 2);
+  std::string meta;
+  ASSERT_TRUE(storage->loadDelegation(&meta, Uptane::Role::Delegation("new-role")));
+
+  // A new Snapshot that lists the delegation unchanged
+  UptaneRepo repo{delegation_path, "", ""};
+  repo.refresh(Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  EXPECT_EQ(aktualizr.CheckUpdates().get().status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_TRUE(storage->loadDelegation(&meta, Uptane::Role::Delegation("new-role")));
+
+  delegation_basic(delegation_path, true);
+  EXPECT_EQ(aktualizr.CheckUpdates().get().status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_FALSE(storage->loadDelegation(&meta, Uptane::Role::Delegation("new-role")));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -4,10 +4,15 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <boost/filesystem.hpp>
@@ -19,6 +24,7 @@
 #include "libaktualizr/secondaryinterface.h"
 #include "primary/provisioner.h"
 #include "primary/provisioner_test_utils.h"
+#include "primary/secondary_provider_builder.h"
 #include "primary/sotauptaneclient.h"
 #include "storage/fsstorage_read.h"
 #include "storage/invstorage.h"
@@ -204,6 +210,92 @@ TEST(Uptane, AssembleManifestBad) {
   EXPECT_FALSE(manifest["secondary_ecu_serial"]["signed"].isMember("custom"));
 }
 
+// Answers the manifest requests only while not held
+class SlowSecondary : public Primary::VirtualSecondary {
+ public:
+  explicit SlowSecondary(Primary::VirtualSecondaryConfig sconfig_in) : VirtualSecondary(std::move(sconfig_in)) {}
+  Uptane::Manifest getManifest() const override {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return !held_; });
+    }
+    Uptane::Manifest manifest = VirtualSecondary::getManifest();
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      ++answered_;
+    }
+    cv_.notify_all();
+    return manifest;
+  }
+  void hold(bool held) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      held_ = held;
+    }
+    cv_.notify_all();
+  }
+  int answered() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return answered_;
+  }
+  bool waitAnswered(int count) const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return cv_.wait_for(lock, std::chrono::seconds(60), [this, count]() { return answered_ >= count; });
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  mutable std::condition_variable cv_;
+  bool held_{false};
+  mutable int answered_{0};
+};
+
+/* The cached manifest of a Secondary that doesn't answer in time is sent as stale. */
+TEST(Uptane, AssembleManifestTimeout) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config = config_common();
+  config.storage.path = temp_dir.Path();
+  boost::filesystem::copy_file("tests/test_data/cred.zip", (temp_dir / "cred.zip").string());
+  config.provision.provision_path = temp_dir / "cred.zip";
+  config.provision.mode = ProvisionMode::kSharedCred;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.uptane.secondary_manifest_timeout_sec = 1;
+  config.provision.primary_ecu_serial = "testecuserial";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  Primary::VirtualSecondaryConfig ecu_config =
+      UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hardware");
+  boost::filesystem::copy_file("tests/test_data/firmware.txt", ecu_config.firmware_path);
+  boost::filesystem::copy_file("tests/test_data/firmware_name.txt", ecu_config.target_name_path);
+  config.uptane.secondary_config_file = "";
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  auto secondary = std::make_shared<SlowSecondary>(ecu_config);
+  sota_client->addSecondary(secondary);
+  EXPECT_NO_THROW(sota_client->initialize());
+
+  Json::Value manifest = sota_client->AssembleManifest();
+  EXPECT_EQ(manifest["ecu_version_manifests"].size(), 2);
+  EXPECT_FALSE(manifest.isMember("stale_ecu_version_manifests"));
+
+  const int answered = secondary->answered();
+  secondary->hold(true);
+  manifest = sota_client->AssembleManifest();
+  secondary->hold(false);
+  EXPECT_EQ(manifest["ecu_version_manifests"]["secondary_ecu_serial"]["signed"]["ecu_serial"].asString(),
+            "secondary_ecu_serial");
+  ASSERT_EQ(manifest["stale_ecu_version_manifests"].size(), 1);
+  EXPECT_EQ(manifest["stale_ecu_version_manifests"][0].asString(), "secondary_ecu_serial");
+
+  // The request still running is used once it is answered.
+  ASSERT_TRUE(secondary->waitAnswered(answered + 1));
+  manifest = sota_client->AssembleManifest();
+  EXPECT_EQ(manifest["ecu_version_manifests"].size(), 2);
+  EXPECT_FALSE(manifest.isMember("stale_ecu_version_manifests"));
+}
+
 /* Get manifest from Primary.
  * Get manifest from Secondaries.
  * Send manifest to the server. */
@@ -245,6 +337,42 @@ TEST(Uptane, PutManifest) {
             "test-package");
 }
 
+/* A manifest that reports the same as the last one sent is not sent again. */
+TEST(Uptane, PutManifestUnchanged) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config = config_common();
+  config.storage.path = temp_dir.Path();
+  boost::filesystem::copy_file("tests/test_data/cred.zip", (temp_dir / "cred.zip").string());
+  config.provision.provision_path = temp_dir / "cred.zip";
+  config.provision.mode = ProvisionMode::kSharedCred;
+  config.uptane.director_server = http->tls_server + "/director";
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.uptane.unchanged_manifest_interval_sec = 3600;
+  config.provision.primary_ecu_serial = "testecuserial";
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  Primary::VirtualSecondaryConfig sec_config =
+      UptaneTestCommon::addDefaultSecondary(config, temp_dir, "secondary_ecu_serial", "secondary_hardware");
+  boost::filesystem::copy_file("tests/test_data/firmware.txt", sec_config.firmware_path);
+  boost::filesystem::copy_file("tests/test_data/firmware_name.txt", sec_config.target_name_path);
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto sota_client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  EXPECT_NO_THROW(sota_client->initialize());
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_EQ(http->last_manifest["signed"]["ecu_version_manifests"].size(), 2u);
+
+  // Only the report counters and signatures have changed.
+  http->last_manifest = Json::nullValue;
+  EXPECT_TRUE(sota_client->putManifestSimple());
+  EXPECT_TRUE(http->last_manifest.isNull());
+
+  Json::Value custom;
+  custom["key"] = "value";
+  EXPECT_TRUE(sota_client->putManifestSimple(custom));
+  EXPECT_EQ(http->last_manifest["signed"]["custom"]["key"].asString(), "value");
+}
+
 class HttpPutManifestFail : public HttpFake {
  public:
   HttpPutManifestFail(const boost::filesystem::path &test_dir_in, std::string flavor = "")
@@ -311,6 +439,72 @@ TEST(Uptane, FetchMetaFail) {
   EXPECT_EQ(result.status, result::UpdateStatus::kNoUpdatesAvailable);
 }
 
+class HttpConditionalGet : public HttpFake {
+ public:
+  HttpConditionalGet(const boost::filesystem::path &test_dir_in, const std::string &flavor)
+      : HttpFake(test_dir_in, flavor) {}
+  HttpResponse getConditional(const std::string &url, int64_t maxsize, const api::FlowControlToken *flow_control,
+                              const std::string &etag, const std::string &last_modified) override {
+    (void)last_modified;
+    HttpResponse response = get(url, maxsize, flow_control);
+    if (!response.isOk()) {
+      return response;
+    }
+    const std::string current_etag = "\"" + Crypto::sha256digestHex(response.body) + "\"";
+    if (etag == current_etag) {
+      ++not_modified;
+      return HttpResponse("", 304, CURLE_OK, "");
+    }
+    response.etag = current_etag;
+    return response;
+  }
+
+  unsigned int not_modified{0};
+};
+
+/*
+ * Verify that unchanged Director Targets and Image repo Timestamp metadata
+ * are not downloaded again, but taken from storage.
+ */
+TEST(Uptane, FetchMetaNotModified) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpConditionalGet>(temp_dir.Path(), "hasupdates");
+
+  Config conf("tests/config/basic.toml");
+  conf.provision.primary_ecu_serial = "CA:FE:A6:D2:84:9D";
+  conf.provision.primary_ecu_hardware_id = "primary_hw";
+  conf.uptane.director_server = http->tls_server + "/director";
+  conf.uptane.repo_server = http->tls_server + "/repo";
+  conf.storage.path = temp_dir.Path();
+  conf.tls.server = http->tls_server;
+
+  auto storage = INvStorage::newStorage(conf.storage);
+  auto up = std_::make_unique<UptaneTestCommon::TestUptaneClient>(conf, storage, http);
+
+  EXPECT_NO_THROW(up->initialize());
+  result::UpdateCheck result = up->fetchMeta();
+  EXPECT_EQ(result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->not_modified, 0);
+
+  std::string etag;
+  EXPECT_TRUE(storage->loadMetaValidators(&etag, nullptr, Uptane::RepositoryType::Director(),
+                                          Uptane::Role::Targets()));
+  EXPECT_FALSE(etag.empty());
+
+  result = up->fetchMeta();
+  EXPECT_EQ(result.status, result::UpdateStatus::kUpdatesAvailable);
+  // Director Targets and Image repo Timestamp
+  EXPECT_EQ(http->not_modified, 2);
+
+  // Without the metadata, the validators must not be used.
+  storage->clearNonRootMeta(Uptane::RepositoryType::Director());
+  EXPECT_FALSE(storage->loadMetaValidators(nullptr, nullptr, Uptane::RepositoryType::Director(),
+                                           Uptane::Role::Targets()));
+  result = up->fetchMeta();
+  EXPECT_EQ(result.status, result::UpdateStatus::kUpdatesAvailable);
+  EXPECT_EQ(http->not_modified, 3);
+}
+
 unsigned int num_events_InstallTarget = 0;
 unsigned int num_events_AllInstalls = 0;
 void process_events_Install(const std::shared_ptr<event::BaseEvent> &event) {
@@ -609,6 +803,80 @@ class SecondaryInterfaceMock : public SecondaryInterface {
 
 MATCHER_P(matchMeta, meta_bundle, "") { return (arg == meta_bundle); }
 
+// Answers the pings once it has been up for a while, if ever
+class LateSecondaryMock : public SecondaryInterfaceMock {
+ public:
+  LateSecondaryMock(Primary::VirtualSecondaryConfig &sconfig_in, std::chrono::steady_clock::duration up_after)
+      : SecondaryInterfaceMock(sconfig_in), up_at_{std::chrono::steady_clock::now() + up_after} {}
+  bool ping() const override {
+    ++pings_;
+    if (std::chrono::steady_clock::now() < up_at_) {
+      return false;
+    }
+    found_at_ = std::chrono::steady_clock::now();
+    return true;
+  }
+
+  std::chrono::steady_clock::time_point up_at_;
+  mutable std::atomic<int> pings_{0};
+  mutable std::chrono::steady_clock::time_point found_at_;
+};
+
+/*
+ * The Secondaries are pinged until they answer or the wait is over: one that
+ * comes up late is found soon after, while one that never answers makes the
+ * wait fail at its end.
+ */
+TEST(Uptane, WaitSecondariesReachable) {
+  TemporaryDirectory temp_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path());
+  Config config = config_common();
+  config.uptane.director_server = http->tls_server + "/director";
+  config.uptane.repo_server = http->tls_server + "/repo";
+  config.tls.server = http->tls_server;
+  config.provision.primary_ecu_serial = "testecuserial";
+  config.storage.path = temp_dir.Path();
+  config.pacman.type = PACKAGE_MANAGER_NONE;
+  config.uptane.secondary_preinstall_wait_sec = 2;
+
+  Primary::VirtualSecondaryConfig late_config;
+  late_config.ecu_serial = "late_serial";
+  late_config.ecu_hardware_id = "secondary_hw";
+  auto late = std::make_shared<LateSecondaryMock>(late_config, std::chrono::milliseconds(300));
+  Primary::VirtualSecondaryConfig never_config;
+  never_config.ecu_serial = "never_serial";
+  never_config.ecu_hardware_id = "secondary_hw";
+  auto never = std::make_shared<LateSecondaryMock>(never_config, std::chrono::hours(1));
+
+  auto storage = INvStorage::newStorage(config.storage);
+  auto client = std_::make_unique<UptaneTestCommon::TestUptaneClient>(config, storage, http);
+  client->addSecondary(late);
+  client->addSecondary(never);
+  EXPECT_NO_THROW(client->initialize());
+
+  const Hash hash(Hash::Type::kSha256, std::string(64, '0'));
+  const Uptane::Target to_late("late", {{late->getSerial(), late->getHwId()}}, {hash}, 1);
+  const Uptane::Target to_both("both", {{late->getSerial(), late->getHwId()}, {never->getSerial(), never->getHwId()}},
+                               {hash}, 1);
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(client->waitSecondariesReachable({to_both}));
+  const auto waited = std::chrono::steady_clock::now() - start;
+  EXPECT_GE(waited, std::chrono::seconds(2));
+  EXPECT_LT(waited, std::chrono::seconds(10));
+  // The late one is found on the first ping after it came up, and not pinged again
+  EXPECT_LT(late->found_at_ - late->up_at_, std::chrono::milliseconds(1500));
+  EXPECT_LT(late->pings_, never->pings_);
+  EXPECT_GE(never->pings_, 3);
+
+  // Found without waiting for the end
+  config.uptane.secondary_preinstall_wait_sec = 60;
+  late->up_at_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(300);
+  start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(client->waitSecondariesReachable({to_late}));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(30));
+}
+
 /*
  * Send metadata to Secondary ECUs
  * Send EcuInstallationStartedReport to server for Secondaries
@@ -742,7 +1010,7 @@ class HttpFakeProv : public HttpFake {
       config.writeToStream(conf_ss);
       EXPECT_EQ(data, conf_ss.str());
       EXPECT_EQ(content_type, "application/toml");
-    } else {
+    } else if (url.find("/events") == std::string::npos) {
       EXPECT_EQ(0, 1) << "Unexpected post to URL: " << url;
     }
     return HttpFake::post(url, content_type, data);
@@ -1221,6 +1489,42 @@ TEST(Uptane, InstalledVersionImport) {
 }
 
 /* Store a list of installed package versions. */
+/*
+ * The metadata sent to the Secondaries is loaded once, and again when it changes.
+ */
+TEST(Uptane, SharedMetaBundle) {
+  TemporaryDirectory temp_dir;
+  Config config = config_common();
+  config.storage.path = temp_dir.Path();
+  auto storage = INvStorage::newStorage(config.storage);
+  auto package_manager = PackageManagerFactory::makePackageManager(config.pacman, config.bootloader, storage, nullptr);
+  auto provider = SecondaryProviderBuilder::Build(config, storage, package_manager);
+  EXPECT_EQ(provider->getMetaBundle(), nullptr);
+
+  storage->storeRoot("director root", Uptane::RepositoryType::Director(), Uptane::Version(1));
+  storage->storeNonRoot("director targets", Uptane::RepositoryType::Director(), Uptane::Role::Targets());
+  storage->storeRoot("image root", Uptane::RepositoryType::Image(), Uptane::Version(1));
+  storage->storeNonRoot("image timestamp", Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+  storage->storeNonRoot("image snapshot", Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  storage->storeNonRoot("image targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  const auto bundle = provider->getMetaBundle();
+  ASSERT_NE(bundle, nullptr);
+  EXPECT_EQ(bundle->size(), 6);
+  EXPECT_EQ(provider->getMetaBundle(), bundle);
+  Uptane::MetaBundle copy;
+  ASSERT_TRUE(provider->getMetadata(&copy, Uptane::Target::Unknown()));
+  EXPECT_EQ(copy, *bundle);
+
+  storage->storeNonRoot("new image targets", Uptane::RepositoryType::Image(), Uptane::Role::Targets());
+  const auto updated = provider->getMetaBundle();
+  ASSERT_NE(updated, nullptr);
+  EXPECT_NE(updated, bundle);
+  EXPECT_EQ(Uptane::getMetaFromBundle(*updated, Uptane::RepositoryType::Image(), Uptane::Role::Targets()),
+            "new image targets");
+  EXPECT_EQ(Uptane::getMetaFromBundle(*bundle, Uptane::RepositoryType::Image(), Uptane::Role::Targets()),
+            "image targets");
+}
+
 TEST(Uptane, SaveAndLoadVersion) {
   TemporaryDirectory temp_dir;
   Config config = config_common();
@@ -1,7 +1,10 @@
 #include "uptane/uptanerepository.h"
 
+#include <algorithm>
+
 #include <boost/algorithm/string/trim.hpp>
 
+#include "crypto/crypto.h"
 #include "fetcher.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
@@ -11,9 +14,12 @@
 namespace Uptane {
 
 void RepositoryCommon::initRoot(RepositoryType repo_type, const std::string& root_raw) {
+  invalidateVerified();
+  root_digest_.clear();
   try {
     root = Root(type, Utils::parseJSON(root_raw));        // initialization and format check
     root = Root(type, Utils::parseJSON(root_raw), root);  // signature verification against itself
+    root_digest_ = Crypto::sha256digestHex(root_raw);
   } catch (const std::exception& e) {
     LOG_ERROR << "Loading initial " << repo_type << " Root metadata failed: " << e.what();
     throw;
@@ -21,6 +27,7 @@ void RepositoryCommon::initRoot(RepositoryType repo_type, const std::string& roo
 }
 
 void RepositoryCommon::verifyRoot(const std::string& root_raw) {
+  invalidateVerified();
   try {
     int prev_version = rootVersion();
     // 5.4.4.3.2.3. Version N+1 of the Root metadata file MUST have been signed
@@ -28,6 +35,7 @@ void RepositoryCommon::verifyRoot(const std::string& root_raw) {
     // metadata file (version N), and (2) a threshold of keys specified in the
     // new Root metadata file being validated (version N+1).
     root = Root(type, Utils::parseJSON(root_raw), root);  // double signature verification
+    root_digest_ = Crypto::sha256digestHex(root_raw);
     // 5.4.4.3.2.4. The version number of the latest Root metadata file (version
     // N) must be less than or equal to the version number of the new Root
     // metadata file (version N+1). NOTE: we do not accept an equal version
@@ -43,7 +51,11 @@ void RepositoryCommon::verifyRoot(const std::string& root_raw) {
   }
 }
 
-void RepositoryCommon::resetRoot() { root = Root(Root::Policy::kAcceptAll); }
+void RepositoryCommon::resetRoot() {
+  invalidateVerified();
+  root = Root(Root::Policy::kAcceptAll);
+  root_digest_.clear();
+}
 
 void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& fetcher,
                                   const RepositoryType repo_type) {
@@ -59,6 +71,32 @@ void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& f
     }
   }
 
+  const auto now = std::chrono::steady_clock::now();
+  root_probe_skipped_ = !rootProbeDue();
+  if (root_probe_skipped_) {
+    LOG_DEBUG << "Not looking for a new " << repo_type << " Root version, the last check was less than "
+              << root_probe_interval_.count() << " s ago";
+  } else {
+    probeRoot(storage, fetcher, repo_type);
+    last_root_probe_ = now;
+    root_probe_required_ = false;
+  }
+
+  // 5.4.4.3.3. Check that the current (or latest securely attested) time is
+  // lower than the expiration timestamp in the latest Root metadata file.
+  // (Checks for a freeze attack.)
+  if (rootExpired()) {
+    throw Uptane::ExpiredMetadata(repo_type, Role::ROOT);
+  }
+}
+
+bool RepositoryCommon::rootProbeDue() const {
+  return root_probe_required_ || root_probe_interval_.count() == 0 ||
+         std::chrono::steady_clock::now() - last_root_probe_ >= root_probe_interval_;
+}
+
+void RepositoryCommon::probeRoot(INvStorage& storage, const IMetadataFetcher& fetcher,
+                                 const RepositoryType repo_type) {
   // 5.4.4.3.2. Update to the latest Root metadata file.
   for (int version = rootVersion() + 1; version < kMaxRotations; ++version) {
     // 5.4.4.3.2.2. Try downloading a new version N+1 of the Root metadata file.
@@ -76,13 +114,40 @@ void RepositoryCommon::updateRoot(INvStorage& storage, const IMetadataFetcher& f
     storage.storeRoot(root_raw, repo_type, Version(version));
     storage.clearNonRootMeta(repo_type);
   }
+}
 
-  // 5.4.4.3.3. Check that the current (or latest securely attested) time is
-  // lower than the expiration timestamp in the latest Root metadata file.
-  // (Checks for a freeze attack.)
-  if (rootExpired()) {
-    throw Uptane::ExpiredMetadata(repo_type, Role::ROOT);
+bool RepositoryCommon::fetchLatestIfModified(INvStorage& storage, const IMetadataFetcher& fetcher,
+                                             RepositoryType repo_type, const Role& role, int64_t maxsize,
+                                             std::string* result, MetaValidators* validators,
+                                             const api::FlowControlToken* flow_control) {
+  std::string stored;
+  *validators = MetaValidators();
+  if (storage.loadNonRoot(&stored, repo_type, role)) {
+    storage.loadMetaValidators(&validators->etag, &validators->last_modified, repo_type, role);
+  }
+  if (!fetcher.fetchLatestRoleIfModified(result, maxsize, repo_type, role, validators, flow_control)) {
+    *result = stored;
+    return false;
+  }
+  return true;
+}
+
+void RepositoryCommon::storeValidators(INvStorage& storage, RepositoryType repo_type, const Role& role,
+                                       const MetaValidators& validators) {
+  // Also store empty validators, so that stale ones can't match the new metadata.
+  storage.storeMetaValidators(validators.etag, validators.last_modified, repo_type, role);
+}
+
+std::map<std::string, int> RepositoryCommon::storedVersions(INvStorage& storage, RepositoryType repo_type,
+                                                            const std::vector<Role>& roles) {
+  MetaVersions versions;
+  for (const auto& role : roles) {
+    std::string stored;
+    const bool found = (role == Role::Root()) ? storage.loadLatestRoot(&stored, repo_type)
+                                              : storage.loadNonRoot(&stored, repo_type, role);
+    versions[role.ToString()] = found ? std::max(extractVersionUntrusted(stored), 0) : 0;
   }
+  return versions;
 }
 
 }  // namespace Uptane
@@ -1,16 +1,19 @@
 #ifndef UPTANE_REPOSITORY_H_
 #define UPTANE_REPOSITORY_H_
 
+#include <chrono>                // for seconds, steady_clock
 #include <cstdint>               // for int64_t
+#include <map>                   // for map
 #include <string>                // for string
+#include <vector>                // for vector
 #include "libaktualizr/types.h"  // for TimeStamp
+#include "storage/invstorage.h"  // for MetaRevision
 #include "uptane/tuf.h"          // for Root, RepositoryType
 #include "utilities/flow_control.h"
 
-class INvStorage;
-
 namespace Uptane {
 class IMetadataFetcher;
+struct MetaValidators;
 
 class RepositoryCommon {
  public:
@@ -23,7 +26,11 @@ class RepositoryCommon {
   void initRoot(RepositoryType repo_type, const std::string &root_raw);
   void verifyRoot(const std::string &root_raw);
   int rootVersion() const { return root.version(); }
+  /** SHA-256 of the raw trusted Root metadata, empty before one is loaded */
+  const std::string &rootDigest() const { return root_digest_; }
   bool rootExpired() const { return root.isExpired(TimeStamp::Now()); }
+  /** When the first of the verified metadata expires, invalid if none was verified */
+  virtual TimeStamp nextExpiry() const { return root.expiry(); }
 
   /**
    * Load the initial state of the repository from storage.
@@ -37,20 +44,64 @@ class RepositoryCommon {
    *   - When it throws an exception, it changes the state and actually does
    *     perform initialization, therefore violating the Strong Exception
    *     Guarantee.
+   * If nothing was stored since the last successful call, the verified state
+   * is kept as it is and only checked for expiration again.
    * @throws UptaneException if the local metadata is stale (this is not a failure)
    */
   virtual void checkMetaOffline(INvStorage &storage) = 0;
+  /**
+   * Only request the next version of the Root metadata if the previous request
+   * was at least `interval` ago. Not looking for a new Root on every update
+   * deviates from the Uptane standard, so this is off (0) by default.
+   */
+  void setRootProbeInterval(std::chrono::seconds interval) { root_probe_interval_ = interval; }
+  /** Make the next update look for a new Root version, whatever the interval. */
+  void requireRootProbe() { root_probe_required_ = true; }
+  /** The next update is going to look for a new Root version. */
+  bool rootProbeDue() const;
   virtual void updateMeta(INvStorage &storage, const IMetadataFetcher &fetcher,
                           const api::FlowControlToken *flow_control) = 0;
 
  protected:
   void resetRoot();
+  /** The state was verified from the stored metadata and nothing was stored since. */
+  bool verifiedFromStorage(const INvStorage &storage) const { return verified_revision_ == storage.metaRevision(); }
+  /** Record that the state was verified from the stored metadata at `revision`. */
+  void setVerifiedRevision(const MetaRevision &revision) { verified_revision_ = revision; }
+  void invalidateVerified() { verified_revision_ = MetaRevision(); }
   void updateRoot(INvStorage &storage, const IMetadataFetcher &fetcher, RepositoryType repo_type);
+  /** The last updateRoot() did not look for a new Root version. */
+  bool rootProbeSkipped() const { return root_probe_skipped_; }
+  /**
+   * Fetch the latest metadata of a role. If a copy of it is stored along with
+   * its validators, the server is asked to only send it if it has changed.
+   * @param validators Validators of the fetched metadata, to be stored with
+   *                   storeValidators() once the metadata has been stored
+   * @return false if the stored copy is current; result then holds that copy
+   */
+  static bool fetchLatestIfModified(INvStorage &storage, const IMetadataFetcher &fetcher, RepositoryType repo_type,
+                                    const Role &role, int64_t maxsize, std::string *result,
+                                    MetaValidators *validators, const api::FlowControlToken *flow_control);
+  static void storeValidators(INvStorage &storage, RepositoryType repo_type, const Role &role,
+                              const MetaValidators &validators);
+  /** Versions of the stored metadata of the given roles, as MetaVersions to request a bundle with. */
+  static std::map<std::string, int> storedVersions(INvStorage &storage, RepositoryType repo_type,
+                                                   const std::vector<Role> &roles);
 
   static const int64_t kMaxRotations = 1000;
 
   Root root{Root::Policy::kRejectAll};
   RepositoryType type;
+
+ private:
+  void probeRoot(INvStorage &storage, const IMetadataFetcher &fetcher, RepositoryType repo_type);
+
+  std::string root_digest_;
+  MetaRevision verified_revision_;
+  std::chrono::seconds root_probe_interval_{0};
+  std::chrono::steady_clock::time_point last_root_probe_;
+  bool root_probe_required_{true};
+  bool root_probe_skipped_{false};
 };
 }  // namespace Uptane
 
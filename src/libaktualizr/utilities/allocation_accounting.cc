@@ -0,0 +1,253 @@
+#include "utilities/allocation_accounting.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <sstream>
+#include <string>
+
+#include "logging/logging.h"
+#include "utilities/metrics.h"
+
+namespace {
+
+struct Counts {
+  std::atomic<int64_t> live_bytes{0};
+  std::atomic<int64_t> peak_bytes{0};
+  std::atomic<uint64_t> allocations{0};
+};
+
+// Zero-initialized before anything is allocated
+std::array<Counts, AllocationAccounting::kTags> counts;
+
+Counts &countsOf(AllocationTag tag) { return counts.at(static_cast<size_t>(tag)); }
+
+}  // namespace
+
+#ifdef ALLOCATION_ACCOUNTING
+thread_local AllocationTag AllocationAccounting::current_{AllocationTag::kOther};
+
+AllocationTag AllocationAccounting::current() { return current_; }
+#else
+AllocationTag AllocationAccounting::current() { return AllocationTag::kOther; }
+#endif
+
+const char *AllocationAccounting::name(AllocationTag tag) {
+  static const char *const names[] = {"other", "network", "metadata", "storage", "secondary", "events", "logging"};
+  return names[static_cast<size_t>(tag)];
+}
+
+AllocationAccounting::Usage AllocationAccounting::usage(AllocationTag tag) {
+  const Counts &tag_counts = countsOf(tag);
+  Usage result;
+  result.live_bytes = tag_counts.live_bytes.load(std::memory_order_relaxed);
+  result.peak_bytes = tag_counts.peak_bytes.load(std::memory_order_relaxed);
+  result.allocations = tag_counts.allocations.load(std::memory_order_relaxed);
+  return result;
+}
+
+Json::Value AllocationAccounting::json() {
+  Json::Value result(Json::objectValue);
+  for (size_t i = 0; i < kTags; ++i) {
+    const auto tag = static_cast<AllocationTag>(i);
+    const Usage tag_usage = usage(tag);
+    Json::Value &entry = result[name(tag)];
+    entry["live_bytes"] = static_cast<Json::Int64>(tag_usage.live_bytes);
+    entry["peak_bytes"] = static_cast<Json::Int64>(tag_usage.peak_bytes);
+    entry["allocations"] = static_cast<Json::UInt64>(tag_usage.allocations);
+  }
+  return result;
+}
+
+void AllocationAccounting::publish() {
+  auto &metrics = Metrics::instance();
+  for (size_t i = 0; i < kTags; ++i) {
+    const auto tag = static_cast<AllocationTag>(i);
+    const Usage tag_usage = usage(tag);
+    const Metrics::Labels labels{{"subsystem", name(tag)}};
+    metrics.gauge("aktualizr_heap_live_bytes", "Bytes of heap memory in use, by subsystem", labels)
+        .set(tag_usage.live_bytes);
+    metrics.gauge("aktualizr_heap_peak_bytes", "High-water mark of the heap memory in use over the last interval",
+                  labels)
+        .set(tag_usage.peak_bytes);
+    // Counted here rather than by the allocations themselves, which must not allocate
+    MetricCounter &allocations =
+        metrics.counter("aktualizr_heap_allocations_total", "Heap allocations, by subsystem", labels);
+    allocations.add(tag_usage.allocations - allocations.value());
+  }
+}
+
+void AllocationAccounting::resetPeaks() {
+  for (auto &tag_counts : counts) {
+    tag_counts.peak_bytes.store(tag_counts.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+}
+
+void AllocationAccounting::allocated(AllocationTag tag, size_t size) {
+  Counts &tag_counts = countsOf(tag);
+  tag_counts.allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto bytes = static_cast<int64_t>(size);
+  const int64_t live = tag_counts.live_bytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+  int64_t peak = tag_counts.peak_bytes.load(std::memory_order_relaxed);
+  while (live > peak && !tag_counts.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+  }
+}
+
+void AllocationAccounting::freed(AllocationTag tag, size_t size) {
+  countsOf(tag).live_bytes.fetch_sub(static_cast<int64_t>(size), std::memory_order_relaxed);
+}
+
+AllocationReporter::AllocationReporter(std::chrono::seconds interval) : interval_{interval} {
+  if (!AllocationAccounting::enabled()) {
+    LOG_WARNING << "The heap usage of the subsystems is not reported: aktualizr was built without "
+                   "ALLOCATION_ACCOUNTING";
+    return;
+  }
+  thread_ = std::thread([this]() { run(); });
+}
+
+AllocationReporter::~AllocationReporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+void AllocationReporter::report() {
+  AllocationAccounting::publish();
+  std::ostringstream line;
+  line << "Heap high-water marks by subsystem (peak/live bytes, allocations):";
+  for (size_t i = 0; i < AllocationAccounting::kTags; ++i) {
+    const auto tag = static_cast<AllocationTag>(i);
+    const AllocationAccounting::Usage usage = AllocationAccounting::usage(tag);
+    line << " " << AllocationAccounting::name(tag) << " " << usage.peak_bytes << "/" << usage.live_bytes << " ("
+         << usage.allocations << ")";
+  }
+  LOG_INFO << line.str();
+  AllocationAccounting::resetPeaks();
+}
+
+void AllocationReporter::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!cv_.wait_for(lock, interval_, [this]() { return stop_; })) {
+    lock.unlock();
+    report();
+    lock.lock();
+  }
+}
+
+#ifdef ALLOCATION_ACCOUNTING
+
+namespace {
+
+// Stored right before each block, whatever its alignment
+struct alignas(16) BlockHeader {
+  size_t size;
+  uint32_t offset;
+  AllocationTag tag;
+};
+static_assert(sizeof(BlockHeader) == 16, "The header must keep the blocks aligned for any type");
+
+void *countedAlloc(size_t size, size_t alignment) noexcept {
+  const size_t offset = alignment > sizeof(BlockHeader) ? alignment : sizeof(BlockHeader);
+  void *base;
+  if (alignment > alignof(std::max_align_t)) {
+    // aligned_alloc wants a multiple of the alignment
+    base = aligned_alloc(alignment, (offset + size + alignment - 1) / alignment * alignment);
+  } else {
+    base = malloc(offset + size);
+  }
+  if (base == nullptr) {
+    return nullptr;
+  }
+  auto *block = static_cast<char *>(base) + offset;
+  auto *header = reinterpret_cast<BlockHeader *>(block) - 1;
+  header->size = size;
+  header->offset = static_cast<uint32_t>(offset);
+  header->tag = AllocationAccounting::current();
+  AllocationAccounting::allocated(header->tag, size);
+  return block;
+}
+
+void countedFree(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  const auto *header = static_cast<BlockHeader *>(ptr) - 1;
+  AllocationAccounting::freed(header->tag, header->size);
+  free(static_cast<char *>(ptr) - header->offset);
+}
+
+void *throwingAlloc(size_t size, size_t alignment) {
+  for (;;) {
+    void *ptr = countedAlloc(size, alignment);
+    if (ptr != nullptr) {
+      return ptr;
+    }
+    std::new_handler handler = std::get_new_handler();
+    if (handler == nullptr) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *nothrowAlloc(size_t size, size_t alignment) noexcept {
+  try {
+    return throwingAlloc(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+constexpr size_t kDefaultAlignment = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+}  // namespace
+
+// NOLINTBEGIN(misc-new-delete-overloads)
+void *operator new(size_t size) { return throwingAlloc(size, kDefaultAlignment); }
+void *operator new[](size_t size) { return throwingAlloc(size, kDefaultAlignment); }
+void *operator new(size_t size, const std::nothrow_t & /*unused*/) noexcept {
+  return nothrowAlloc(size, kDefaultAlignment);
+}
+void *operator new[](size_t size, const std::nothrow_t & /*unused*/) noexcept {
+  return nothrowAlloc(size, kDefaultAlignment);
+}
+void *operator new(size_t size, std::align_val_t alignment) {
+  return throwingAlloc(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return throwingAlloc(size, static_cast<size_t>(alignment));
+}
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t & /*unused*/) noexcept {
+  return nothrowAlloc(size, static_cast<size_t>(alignment));
+}
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t & /*unused*/) noexcept {
+  return nothrowAlloc(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, size_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, size_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, const std::nothrow_t & /*unused*/) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t & /*unused*/) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, std::align_val_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, size_t /*unused*/, std::align_val_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete[](void *ptr, size_t /*unused*/, std::align_val_t /*unused*/) noexcept { countedFree(ptr); }
+void operator delete(void *ptr, std::align_val_t /*unused*/, const std::nothrow_t & /*unused*/) noexcept {
+  countedFree(ptr);
+}
+void operator delete[](void *ptr, std::align_val_t /*unused*/, const std::nothrow_t & /*unused*/) noexcept {
+  countedFree(ptr);
+}
+// NOLINTEND(misc-new-delete-overloads)
+
+#endif  // ALLOCATION_ACCOUNTING
@@ -0,0 +1,109 @@
+#ifndef UTILITIES_ALLOCATION_ACCOUNTING_H_
+#define UTILITIES_ALLOCATION_ACCOUNTING_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "json/json.h"
+
+/** The subsystems the heap memory is counted for. */
+enum class AllocationTag : uint8_t { kOther = 0, kNetwork, kMetadata, kStorage, kSecondary, kEvents, kLogging };
+
+/**
+ * Counts the heap memory of each subsystem, when built with
+ * ALLOCATION_ACCOUNTING: the global operator new and delete are replaced, and
+ * each allocation is counted for the tag of the innermost Scope of its thread
+ * at the time, until it is freed, whichever thread frees it.
+ *
+ * The memory the libraries allocate with malloc directly, as SQLite and curl
+ * do, is not counted. Without ALLOCATION_ACCOUNTING, the scopes do nothing and
+ * all the counts stay at 0.
+ */
+class AllocationAccounting {
+ public:
+  static constexpr size_t kTags = static_cast<size_t>(AllocationTag::kLogging) + 1;
+
+  struct Usage {
+    int64_t live_bytes{0};
+    // High-water mark of live_bytes since the start or the last resetPeaks()
+    int64_t peak_bytes{0};
+    uint64_t allocations{0};
+  };
+
+  /** Counts the allocations of the thread for the tag, from construction to destruction. */
+  class Scope {
+   public:
+#ifdef ALLOCATION_ACCOUNTING
+    explicit Scope(AllocationTag tag) : previous_{current_} { current_ = tag; }
+    ~Scope() { current_ = previous_; }
+#else
+    explicit Scope(AllocationTag tag) { (void)tag; }
+#endif
+    Scope(const Scope &) = delete;
+    Scope(Scope &&) = delete;
+    Scope &operator=(const Scope &) = delete;
+    Scope &operator=(Scope &&) = delete;
+
+#ifdef ALLOCATION_ACCOUNTING
+   private:
+    AllocationTag previous_;
+#endif
+  };
+
+  static constexpr bool enabled() {
+#ifdef ALLOCATION_ACCOUNTING
+    return true;
+#else
+    return false;
+#endif
+  }
+  /** The tag the allocations of this thread are counted for. */
+  static AllocationTag current();
+  static const char *name(AllocationTag tag);
+  static Usage usage(AllocationTag tag);
+  /** The usage of all the tags, by name. */
+  static Json::Value json();
+  /** Copy the counts into the metrics aktualizr_heap_live_bytes, _peak_bytes and _allocations_total. */
+  static void publish();
+  static void resetPeaks();
+
+  // Called by the replaced operators
+  static void allocated(AllocationTag tag, size_t size);
+  static void freed(AllocationTag tag, size_t size);
+
+#ifdef ALLOCATION_ACCOUNTING
+ private:
+  static thread_local AllocationTag current_;
+#endif
+};
+
+/**
+ * Regularly publishes the heap usage of each subsystem to the metrics, and
+ * logs its high-water mark over the interval.
+ */
+class AllocationReporter {
+ public:
+  explicit AllocationReporter(std::chrono::seconds interval);
+  ~AllocationReporter();
+  AllocationReporter(const AllocationReporter &) = delete;
+  AllocationReporter(AllocationReporter &&) = delete;
+  AllocationReporter &operator=(const AllocationReporter &) = delete;
+  AllocationReporter &operator=(AllocationReporter &&) = delete;
+
+  /** Publish the usage and log the high-water marks now, and start new ones. */
+  static void report();
+
+ private:
+  void run();
+
+  const std::chrono::seconds interval_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_{false};
+  std::thread thread_;
+};
+
+#endif  // UTILITIES_ALLOCATION_ACCOUNTING_H_
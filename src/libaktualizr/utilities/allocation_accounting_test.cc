@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utilities/allocation_accounting.h"
+
+/* The scopes nest, and only tag the allocations of their own thread. */
+TEST(AllocationAccounting, Scope) {
+  EXPECT_EQ(AllocationAccounting::current(), AllocationTag::kOther);
+  {
+    const AllocationAccounting::Scope network(AllocationTag::kNetwork);
+    {
+      const AllocationAccounting::Scope storage(AllocationTag::kStorage);
+      if (AllocationAccounting::enabled()) {
+        EXPECT_EQ(AllocationAccounting::current(), AllocationTag::kStorage);
+      }
+    }
+    if (AllocationAccounting::enabled()) {
+      EXPECT_EQ(AllocationAccounting::current(), AllocationTag::kNetwork);
+    }
+    std::thread([]() { EXPECT_EQ(AllocationAccounting::current(), AllocationTag::kOther); }).join();
+  }
+  EXPECT_EQ(AllocationAccounting::current(), AllocationTag::kOther);
+
+  const Json::Value json = AllocationAccounting::json();
+  EXPECT_EQ(json.size(), AllocationAccounting::kTags);
+  EXPECT_TRUE(json["secondary"]["live_bytes"].isInt64());
+}
+
+#ifdef ALLOCATION_ACCOUNTING
+/* An allocation is counted for the tag it was made under until it is freed,
+ * even when freed under another. */
+TEST(AllocationAccounting, Counts) {
+  AllocationAccounting::resetPeaks();
+  const AllocationAccounting::Usage before = AllocationAccounting::usage(AllocationTag::kEvents);
+  std::unique_ptr<std::vector<char>> buffer;
+  {
+    const AllocationAccounting::Scope events(AllocationTag::kEvents);
+    buffer = std::make_unique<std::vector<char>>(1024 * 1024);
+  }
+  const AllocationAccounting::Usage during = AllocationAccounting::usage(AllocationTag::kEvents);
+  EXPECT_GE(during.live_bytes, before.live_bytes + 1024 * 1024);
+  EXPECT_GE(during.peak_bytes, during.live_bytes);
+  EXPECT_EQ(during.allocations, before.allocations + 2);
+
+  {
+    const AllocationAccounting::Scope logging(AllocationTag::kLogging);
+    buffer.reset();
+  }
+  const AllocationAccounting::Usage after = AllocationAccounting::usage(AllocationTag::kEvents);
+  EXPECT_EQ(after.live_bytes, before.live_bytes);
+  EXPECT_EQ(after.peak_bytes, during.peak_bytes);
+  AllocationAccounting::resetPeaks();
+  EXPECT_EQ(AllocationAccounting::usage(AllocationTag::kEvents).peak_bytes, after.live_bytes);
+
+  // Over-aligned blocks too
+  struct alignas(64) Aligned {
+    char data[64];
+  };
+  auto aligned = std::make_unique<Aligned>();
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned.get()) % 64, 0);
+}
+#endif  // ALLOCATION_ACCOUNTING
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
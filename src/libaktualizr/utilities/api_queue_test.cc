@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
 #include <string>
+#include <thread>
 #include "utilities/apiqueue.h"
 
 using std::cout;
@@ -46,6 +48,120 @@ TEST(ApiQueue, Simple) {
   EXPECT_EQ(result.get(), 100);
 }
 
+/* High priority commands don't wait for the normal ones. */
+TEST(ApiQueue, Priority) {
+  api::CommandQueue dut;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future();
+  std::function<void()> slow([released] { released.wait(); });
+  future<void> slow_result = dut.enqueue(std::move(slow));
+  std::function<int()> fast([] { return 1; });
+  future<int> fast_result = dut.enqueue(std::move(fast), api::CommandQueue::Priority::kHigh);
+  dut.run();
+
+  ASSERT_EQ(fast_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(fast_result.get(), 1);
+  EXPECT_EQ(slow_result.wait_for(std::chrono::milliseconds(10)), future_status::timeout);
+  release.set_value();
+  ASSERT_EQ(slow_result.wait_for(std::chrono::seconds(10)), future_status::ready);
+}
+
+/* Identical queued commands run once and share their result. */
+TEST(ApiQueue, Coalesce) {
+  api::CommandQueue dut;
+  std::atomic<int> calls{0};
+  auto enqueue = [&dut, &calls](const std::string& key) {
+    std::function<int()> task([&calls] { return ++calls; });
+    return dut.enqueue(std::move(task), api::CommandQueue::Priority::kNormal, key);
+  };
+  future<int> first = enqueue("check");
+  future<int> second = enqueue("check");
+  future<int> other = enqueue("");
+  dut.run();
+
+  ASSERT_EQ(first.wait_for(std::chrono::seconds(10)), future_status::ready);
+  ASSERT_EQ(second.wait_for(std::chrono::seconds(10)), future_status::ready);
+  EXPECT_EQ(first.get(), 1);
+  EXPECT_EQ(second.get(), 1);
+  EXPECT_EQ(other.get(), 2);
+
+  // Not coalesced with a command that already ran
+  EXPECT_EQ(enqueue("check").get(), 3);
+  const auto stats = dut.stats();
+  EXPECT_EQ(stats.commands, 3U);
+  EXPECT_EQ(stats.coalesced, 1U);
+  EXPECT_GE(stats.max_wait, std::chrono::milliseconds(0));
+}
+
+/* A deadline stops a task like an abort, wakes it up when paused, and is narrowed for a scope only. */
+TEST(ApiQueue, Deadline) {
+  api::FlowControlToken token;
+  const auto now = std::chrono::steady_clock::now();
+  {
+    const api::DeadlineScope scope(&token, std::chrono::milliseconds(50));
+    EXPECT_TRUE(token.canContinue(false));
+    EXPECT_FALSE(token.deadlineExpired());
+    {
+      // A longer budget doesn't extend the deadline
+      const api::DeadlineScope longer(&token, std::chrono::hours(1));
+      EXPECT_LT(token.deadline(), now + std::chrono::seconds(1));
+    }
+    token.setPause(true);
+    EXPECT_FALSE(token.canContinue());
+    EXPECT_GE(std::chrono::steady_clock::now(), now + std::chrono::milliseconds(50));
+    EXPECT_TRUE(token.deadlineExpired());
+    EXPECT_TRUE(token.hasAborted());
+    token.setPause(false);
+  }
+  EXPECT_EQ(token.deadline(), std::chrono::steady_clock::time_point::max());
+  EXPECT_TRUE(token.canContinue(false));
+
+  token.setDeadline(now);
+  token.setAbort();
+  EXPECT_FALSE(token.deadlineExpired());
+  token.reset();
+  EXPECT_TRUE(token.canContinue(false));
+}
+
+/* A paused task goes on as soon as it is resumed, a sleeping one stops as soon
+ * as it is aborted, and the listeners are told of each change until removed. */
+TEST(ApiQueue, FlowControlLatency) {
+  api::FlowControlToken token;
+  std::atomic<int> changes{0};
+  const int listener = token.addListener([&changes]() { ++changes; });
+
+  token.setPause(true);
+  EXPECT_TRUE(token.isPaused());
+  std::atomic<bool> resumed{false};
+  std::thread resume([&token, &resumed]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    resumed = true;
+    token.setPause(false);
+  });
+  // Waits without a timeout, so only the resumption ends it
+  EXPECT_TRUE(token.canContinue());
+  EXPECT_TRUE(resumed);
+  resume.join();
+
+  auto start = std::chrono::steady_clock::now();
+  EXPECT_TRUE(token.sleepFor(std::chrono::milliseconds(20)));
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+  std::thread abort([&token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    token.setAbort();
+  });
+  start = std::chrono::steady_clock::now();
+  EXPECT_FALSE(token.sleepFor(std::chrono::minutes(2)));
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::minutes(1));
+  abort.join();
+  EXPECT_EQ(changes.load(), 3);
+
+  token.removeListener(listener);
+  token.reset();
+  EXPECT_EQ(changes.load(), 3);
+  EXPECT_FALSE(token.isPaused());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
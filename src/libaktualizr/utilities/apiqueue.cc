@@ -1,8 +1,23 @@
 #include "apiqueue.h"
+
+#include <algorithm>
+
 #include "logging/logging.h"
+#include "utilities/metrics.h"
 
 namespace api {
 
+namespace {
+// Commands waiting in the queues of all the CommandQueues, by priority
+MetricGauge& queueDepth(CommandQueue::Priority priority) {
+  static MetricGauge& normal =
+      Metrics::instance().gauge("aktualizr_command_queue_depth", "Commands waiting to run", {{"priority", "normal"}});
+  static MetricGauge& high =
+      Metrics::instance().gauge("aktualizr_command_queue_depth", "Commands waiting to run", {{"priority", "high"}});
+  return priority == CommandQueue::Priority::kHigh ? high : normal;
+}
+}  // namespace
+
 CommandQueue::~CommandQueue() {
   try {
     abort(false);
@@ -15,22 +30,44 @@ CommandQueue::~CommandQueue() {
 
 void CommandQueue::run() {
   std::lock_guard<std::mutex> g(thread_m_);
-  if (!thread_.joinable()) {
-    thread_ = std::thread([this] {
-      Context ctx{.flow_control = &token_};
-      std::unique_lock<std::mutex> lock(m_);
-      for (;;) {
-        cv_.wait(lock, [this] { return (!queue_.empty() && !paused_) || shutdown_; });
-        if (shutdown_) {
-          break;
-        }
-        auto task = std::move(queue_.front());
-        queue_.pop();
-        lock.unlock();
-        task->PerformTask(&ctx);
-        lock.lock();
+  for (const auto priority : {Priority::kNormal, Priority::kHigh}) {
+    auto& thread = threads_[static_cast<size_t>(priority)];
+    if (!thread.joinable()) {
+      thread = std::thread([this, priority] { work(priority); });
+    }
+  }
+}
+
+void CommandQueue::work(Priority priority) {
+  Context ctx{.flow_control = &token_};
+  auto& queue = queues_[static_cast<size_t>(priority)];
+  std::unique_lock<std::mutex> lock(m_);
+  for (;;) {
+    cv_.wait(lock, [this, &queue] { return (!queue.empty() && !paused_) || shutdown_; });
+    if (shutdown_) {
+      break;
+    }
+    Entry entry = std::move(queue.front());
+    queue.pop();
+    queueDepth(priority).add(-1);
+    if (!entry.key.empty()) {
+      auto pending = pending_.find(entry.key);
+      if (pending != pending_.end() && pending->second == entry.task) {
+        pending_.erase(pending);
       }
-    });
+    }
+    const auto wait =
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - entry.queued);
+    ++stats_.commands;
+    stats_.total_wait += wait;
+    stats_.max_wait = std::max(stats_.max_wait, wait);
+    lock.unlock();
+    if (wait > std::chrono::seconds(1)) {
+      LOG_DEBUG << "Command " << (entry.key.empty() ? "" : entry.key + " ") << "waited " << wait.count()
+                << " ms in the queue";
+    }
+    entry.task->PerformTask(&ctx);
+    lock.lock();
   }
 }
 
@@ -56,13 +93,20 @@ void CommandQueue::abort(bool restart_thread) {
       shutdown_ = true;
     }
     cv_.notify_all();
-    if (thread_.joinable()) {
-      thread_.join();
+    for (auto& thread : threads_) {
+      if (thread.joinable()) {
+        thread.join();
+      }
     }
     {
       // Flush the queue and reset to initial state
       std::lock_guard<std::mutex> g(m_);
-      std::queue<ICommand::Ptr>().swap(queue_);
+      for (const auto priority : {Priority::kNormal, Priority::kHigh}) {
+        auto& queue = queues_[static_cast<size_t>(priority)];
+        queueDepth(priority).add(-static_cast<int64_t>(queue.size()));
+        std::queue<Entry>().swap(queue);
+      }
+      pending_.clear();
       token_.reset();
       shutdown_ = false;
     }
@@ -72,12 +116,22 @@ void CommandQueue::abort(bool restart_thread) {
   }
 }
 
-void CommandQueue::enqueue(ICommand::Ptr&& task) {
+void CommandQueue::enqueue(ICommand::Ptr&& task, Priority priority) {
   {
     std::lock_guard<std::mutex> lock(m_);
-    queue_.push(std::move(task));
+    push(std::move(task), priority, "");
   }
   cv_.notify_all();
 }
 
+void CommandQueue::push(ICommand::Ptr&& task, Priority priority, const std::string& key) {
+  queues_[static_cast<size_t>(priority)].push(Entry{std::move(task), key, std::chrono::steady_clock::now()});
+  queueDepth(priority).add(1);
+}
+
+CommandQueue::Stats CommandQueue::stats() const {
+  std::lock_guard<std::mutex> lock(m_);
+  return stats_;
+}
+
 }  // namespace api
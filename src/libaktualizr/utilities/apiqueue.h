@@ -1,14 +1,20 @@
 #ifndef AKTUALIZR_APIQUEUE_H
 #define AKTUALIZR_APIQUEUE_H
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <map>
 #include <mutex>
 #include <queue>
+#include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "utilities/flow_control.h"
 
@@ -37,19 +43,28 @@ class CommandBase : public ICommand {
  public:
   void PerformTask(Context* ctx) override {
     try {
-      result_.set_value(TaskImplementation(ctx));
+      const T result = TaskImplementation(ctx);
+      for (auto& r : results_) {
+        r.set_value(result);
+      }
     } catch (...) {
-      result_.set_exception(std::current_exception());
+      for (auto& r : results_) {
+        r.set_exception(std::current_exception());
+      }
     }
   }
 
-  std::future<T> GetFuture() { return result_.get_future(); }
+  // Can be called several times, as long as the task hasn't started
+  std::future<T> GetFuture() {
+    results_.emplace_back();
+    return results_.back().get_future();
+  }
 
  protected:
   virtual T TaskImplementation(Context*) = 0;
 
  private:
-  std::promise<T> result_;
+  std::vector<std::promise<T>> results_;
 };
 
 template <>
@@ -58,19 +73,27 @@ class CommandBase<void> : public ICommand {
   void PerformTask(Context* ctx) override {
     try {
       TaskImplementation(ctx);
-      result_.set_value();
+      for (auto& r : results_) {
+        r.set_value();
+      }
     } catch (...) {
-      result_.set_exception(std::current_exception());
+      for (auto& r : results_) {
+        r.set_exception(std::current_exception());
+      }
     }
   }
 
-  std::future<void> GetFuture() { return result_.get_future(); }
+  // Can be called several times, as long as the task hasn't started
+  std::future<void> GetFuture() {
+    results_.emplace_back();
+    return results_.back().get_future();
+  }
 
  protected:
   virtual void TaskImplementation(Context*) = 0;
 
  private:
-  std::promise<void> result_;
+  std::vector<std::promise<void>> results_;
 };
 
 template <class T>
@@ -98,6 +121,23 @@ class CommandFlowControl : public CommandBase<T> {
 
 class CommandQueue {
  public:
+  enum class Priority {
+    // Run one after the other, in the order they were queued
+    kNormal,
+    // Cheap commands that don't change the Uptane state: run in order on a
+    // worker of their own, beside the normal ones
+    kHigh,
+  };
+
+  struct Stats {
+    uint64_t commands{0};
+    // Commands that joined an identical queued command
+    uint64_t coalesced{0};
+    // Time the commands waited in the queue before they started
+    std::chrono::milliseconds total_wait{0};
+    std::chrono::milliseconds max_wait{0};
+  };
+
   CommandQueue() = default;
   ~CommandQueue();
   // Non-copyable Non-movable
@@ -115,32 +155,73 @@ class CommandQueue {
   void abort(bool restart_thread = true);
 
   const api::FlowControlToken* FlowControlToken() const { return &token_; }
+  // For the deadlines of the commands, which all the running ones share
+  api::FlowControlToken* FlowControlToken() { return &token_; }
 
+  /**
+   * Queue a command. If a command with the same non-empty key is still queued,
+   * no new command is queued and the future gives the result of that one.
+   */
   template <class R>
-  std::future<R> enqueue(std::function<R()>&& function) {
-    auto task = std::make_shared<Command<R>>(std::move(function));
-    enqueue(task);
-    return task->GetFuture();
+  std::future<R> enqueue(std::function<R()>&& function, Priority priority = Priority::kNormal,
+                         const std::string& key = "") {
+    return enqueueCommand<R, Command<R>>(std::move(function), priority, key);
   }
 
   template <class R>
-  std::future<R> enqueue(std::function<R(const api::FlowControlToken*)>&& function) {
-    auto task = std::make_shared<CommandFlowControl<R>>(std::move(function));
-    enqueue(task);
-    return task->GetFuture();
+  std::future<R> enqueue(std::function<R(const api::FlowControlToken*)>&& function,
+                         Priority priority = Priority::kNormal, const std::string& key = "") {
+    return enqueueCommand<R, CommandFlowControl<R>>(std::move(function), priority, key);
   }
 
-  void enqueue(ICommand::Ptr&& task);
+  void enqueue(ICommand::Ptr&& task, Priority priority = Priority::kNormal);
+
+  Stats stats() const;
 
  private:
+  struct Entry {
+    ICommand::Ptr task;
+    std::string key;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  template <class R, class C, class F>
+  std::future<R> enqueueCommand(F&& function, Priority priority, const std::string& key) {
+    std::future<R> future;
+    {
+      std::lock_guard<std::mutex> lock(m_);
+      auto pending = key.empty() ? pending_.end() : pending_.find(key);
+      auto queued = pending != pending_.end() ? std::dynamic_pointer_cast<CommandBase<R>>(pending->second) : nullptr;
+      if (queued) {
+        ++stats_.coalesced;
+        return queued->GetFuture();
+      }
+      auto task = std::make_shared<C>(std::forward<F>(function));
+      future = task->GetFuture();
+      if (!key.empty()) {
+        pending_[key] = task;
+      }
+      push(std::move(task), priority, key);
+    }
+    cv_.notify_all();
+    return future;
+  }
+
+  // Needs m_
+  void push(ICommand::Ptr&& task, Priority priority, const std::string& key);
+  void work(Priority priority);
+
   std::atomic_bool shutdown_{false};
   std::atomic_bool paused_{false};
 
-  std::thread thread_;
+  std::array<std::thread, 2> threads_;
   std::mutex thread_m_;
 
-  std::queue<ICommand::Ptr> queue_;
-  std::mutex m_;
+  std::array<std::queue<Entry>, 2> queues_;
+  // Queued commands that can be coalesced, by key
+  std::map<std::string, ICommand::Ptr> pending_;
+  Stats stats_;
+  mutable std::mutex m_;
   std::condition_variable cv_;
   class api::FlowControlToken token_;
 };
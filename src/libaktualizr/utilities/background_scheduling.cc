@@ -0,0 +1,202 @@
+#include "utilities/background_scheduling.h"
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <mutex>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+#include "logging/logging.h"
+
+namespace {
+
+constexpr int kLowestNice = 19;
+constexpr int kIoprioWhoProcess = 1;
+constexpr int kIoprioClassShift = 13;
+constexpr int kIoprioBestEffortLowest = (2 << kIoprioClassShift) | 7;
+constexpr int kIoprioIdle = 3 << kIoprioClassShift;
+
+// A thread doing background work, and how it was scheduled before
+struct Entry {
+  int depth{0};
+  bool lowest{false};
+  int nice{0};
+  int ioprio{0};
+  // Of cgroup v2, relative to its mount point; empty if unknown
+  std::string cgroup;
+};
+
+struct State {
+  std::mutex mutex;
+  BackgroundScheduling::Class background;
+  std::map<pid_t, Entry> threads;
+  int boosts{0};
+};
+
+State &state() {
+  static State instance;
+  return instance;
+}
+
+pid_t currentTid() { return static_cast<pid_t>(syscall(SYS_gettid)); }
+
+void setNice(pid_t tid, int nice) {
+  if (setpriority(PRIO_PROCESS, static_cast<id_t>(tid), nice) != 0) {
+    LOG_DEBUG << "Could not set the nice level of thread " << tid << " to " << nice << ": " << std::strerror(errno);
+  }
+}
+
+void setIoprio(pid_t tid, int ioprio) {
+  if (syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, ioprio) != 0) {
+    LOG_DEBUG << "Could not set the I/O priority of thread " << tid << ": " << std::strerror(errno);
+  }
+}
+
+void moveToCgroup(pid_t tid, const boost::filesystem::path &cgroup) {
+  // cgroup v2, whose threaded cgroups take single threads, else v1
+  for (const char *file : {"cgroup.threads", "tasks"}) {
+    if (!boost::filesystem::exists(cgroup / file)) {
+      continue;
+    }
+    std::ofstream out((cgroup / file).string());
+    out << tid << std::endl;
+    if (out.good()) {
+      return;
+    }
+  }
+  LOG_DEBUG << "Could not move thread " << tid << " to cgroup " << cgroup;
+}
+
+std::string currentCgroup(pid_t tid) {
+  std::ifstream in("/proc/self/task/" + std::to_string(tid) + "/cgroup");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (boost::starts_with(line, "0::")) {
+      return line.substr(3);
+    }
+  }
+  return "";
+}
+
+void lower(const BackgroundScheduling::Class &background, pid_t tid, const Entry &entry) {
+  const int nice = entry.lowest ? kLowestNice : background.nice;
+  if (nice > entry.nice) {
+    setNice(tid, nice);
+  }
+  auto io_class = entry.lowest ? BackgroundScheduling::IoClass::kIdle : background.io_class;
+  if (io_class == BackgroundScheduling::IoClass::kIdle) {
+    setIoprio(tid, kIoprioIdle);
+  } else if (io_class == BackgroundScheduling::IoClass::kBestEffort) {
+    setIoprio(tid, kIoprioBestEffortLowest);
+  }
+  if (!background.cgroup.empty()) {
+    moveToCgroup(tid, background.cgroup);
+  }
+}
+
+void restore(const BackgroundScheduling::Class &background, pid_t tid, const Entry &entry) {
+  setNice(tid, entry.nice);
+  setIoprio(tid, entry.ioprio);
+  if (!background.cgroup.empty() && !entry.cgroup.empty()) {
+    moveToCgroup(tid, boost::filesystem::path("/sys/fs/cgroup") / entry.cgroup);
+  }
+}
+
+}  // namespace
+
+BackgroundScheduling::IoClass BackgroundScheduling::parseIoClass(const std::string &io_class) {
+  if (io_class == "best-effort") {
+    return IoClass::kBestEffort;
+  }
+  if (io_class == "idle") {
+    return IoClass::kIdle;
+  }
+  if (!io_class.empty()) {
+    LOG_WARNING << "Unknown I/O scheduling class " << io_class << ", leaving it unchanged";
+  }
+  return IoClass::kUnchanged;
+}
+
+void BackgroundScheduling::configure(const Class &background) {
+  std::lock_guard<std::mutex> lock(state().mutex);
+  state().background = background;
+}
+
+BackgroundScheduling::Thread::Thread(bool lowest) : tid_{currentTid()} {
+  State &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  Entry &entry = s.threads[tid_];
+  if (entry.depth++ > 0) {
+    return;
+  }
+  const bool configured = s.background.nice != 0 || s.background.io_class != IoClass::kUnchanged ||
+                          !s.background.cgroup.empty();
+  if (!lowest && !configured) {
+    s.threads.erase(tid_);
+    tid_ = 0;
+    return;
+  }
+  entry.lowest = lowest;
+  errno = 0;
+  entry.nice = getpriority(PRIO_PROCESS, static_cast<id_t>(tid_));
+  if (errno != 0) {
+    entry.nice = 0;
+  }
+  const auto ioprio = syscall(SYS_ioprio_get, kIoprioWhoProcess, tid_);
+  entry.ioprio = ioprio > 0 ? static_cast<int>(ioprio) : 0;
+  if (!s.background.cgroup.empty()) {
+    entry.cgroup = currentCgroup(tid_);
+  }
+  if (s.boosts == 0) {
+    lower(s.background, tid_, entry);
+  }
+}
+
+BackgroundScheduling::Thread::~Thread() {
+  if (tid_ == 0) {
+    return;
+  }
+  State &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  const auto it = s.threads.find(tid_);
+  if (it == s.threads.end() || --it->second.depth > 0) {
+    return;
+  }
+  if (s.boosts == 0) {
+    restore(s.background, tid_, it->second);
+  }
+  s.threads.erase(it);
+}
+
+bool BackgroundScheduling::boosted() {
+  State &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  return s.boosts > 0;
+}
+
+BackgroundScheduling::Boost::Boost() {
+  State &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (s.boosts++ > 0) {
+    return;
+  }
+  for (const auto &thread : s.threads) {
+    restore(s.background, thread.first, thread.second);
+  }
+}
+
+BackgroundScheduling::Boost::~Boost() {
+  State &s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (--s.boosts > 0) {
+    return;
+  }
+  for (const auto &thread : s.threads) {
+    lower(s.background, thread.first, thread.second);
+  }
+}
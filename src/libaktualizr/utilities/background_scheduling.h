@@ -0,0 +1,66 @@
+#ifndef UTILITIES_BACKGROUND_SCHEDULING_H_
+#define UTILITIES_BACKGROUND_SCHEDULING_H_
+
+#include <sys/types.h>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * Scheduling of the threads that do background work, such as downloads,
+ * hashing, OSTree checkouts, transfers to the Secondaries and storage
+ * maintenance, so that they leave the CPU and the disk to the rest of the
+ * system: a nice level, an I/O scheduling class and a cgroup.
+ *
+ * While the user waits for the work, e.g. during an installation they
+ * started, the background threads run at the priority they had before
+ * instead. Raising the priority of a thread again needs CAP_SYS_NICE, without
+ * which it keeps the lower one.
+ */
+class BackgroundScheduling {
+ public:
+  enum class IoClass { kUnchanged, kBestEffort, kIdle };
+
+  struct Class {
+    // Nice level; 0 leaves it
+    int nice{0};
+    IoClass io_class{IoClass::kUnchanged};
+    // Directory of a cgroup the threads are moved to; empty leaves them in theirs
+    boost::filesystem::path cgroup;
+  };
+
+  /** "best-effort" or "idle"; anything else leaves the I/O class unchanged. */
+  static IoClass parseIoClass(const std::string &io_class);
+  /** Applies to the threads that start background work from now on. */
+  static void configure(const Class &background);
+  /** Whether a Boost exists, i.e. the user waits for the background work. */
+  static bool boosted();
+
+  /** The calling thread does background work while it exists. */
+  class Thread {
+   public:
+    /** With lowest, at the lowest priority and I/O class, whatever the configured class. */
+    explicit Thread(bool lowest = false);
+    ~Thread();
+    Thread(const Thread &) = delete;
+    Thread(Thread &&) = delete;
+    Thread &operator=(const Thread &) = delete;
+    Thread &operator=(Thread &&) = delete;
+
+   private:
+    pid_t tid_;
+  };
+
+  /** The background threads run at their normal priority while one exists. */
+  class Boost {
+   public:
+    Boost();
+    ~Boost();
+    Boost(const Boost &) = delete;
+    Boost(Boost &&) = delete;
+    Boost &operator=(const Boost &) = delete;
+    Boost &operator=(Boost &&) = delete;
+  };
+};
+
+#endif  // UTILITIES_BACKGROUND_SCHEDULING_H_
@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <functional>
+#include <thread>
+
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+
+static int niceLevel() {
+  return getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)));
+}
+
+static int ioClass() { return static_cast<int>(syscall(SYS_ioprio_get, 1, syscall(SYS_gettid)) >> 13); }
+
+// Changes of the scheduling of a thread last as long as the thread.
+static void onNewThread(const std::function<void()> &test) { std::thread(test).join(); }
+
+/* Threads are only rescheduled with a class configured, or when asked for the lowest priority. */
+TEST(BackgroundScheduling, Class) {
+  BackgroundScheduling::configure(BackgroundScheduling::Class{});
+  onNewThread([]() {
+    const int nice = niceLevel();
+    {
+      BackgroundScheduling::Thread background;
+      EXPECT_EQ(niceLevel(), nice);
+    }
+    BackgroundScheduling::Thread lowest(true);
+    EXPECT_EQ(niceLevel(), 19);
+    EXPECT_EQ(ioClass(), 3);
+  });
+
+  BackgroundScheduling::configure(
+      BackgroundScheduling::Class{5, BackgroundScheduling::parseIoClass("best-effort"), boost::filesystem::path()});
+  onNewThread([]() {
+    BackgroundScheduling::Thread background;
+    EXPECT_EQ(niceLevel(), 5);
+    EXPECT_EQ(ioClass(), 2);
+    {
+      // Nested work leaves it as it is.
+      BackgroundScheduling::Thread nested;
+      EXPECT_EQ(niceLevel(), 5);
+    }
+    EXPECT_EQ(niceLevel(), 5);
+  });
+  BackgroundScheduling::configure(BackgroundScheduling::Class{});
+}
+
+/* The background threads run at their normal priority while boosted. */
+TEST(BackgroundScheduling, Boost) {
+  if (geteuid() != 0) {
+    // Raising a priority again needs CAP_SYS_NICE
+    return;
+  }
+  BackgroundScheduling::configure(
+      BackgroundScheduling::Class{10, BackgroundScheduling::IoClass::kIdle, boost::filesystem::path()});
+  onNewThread([]() {
+    const int nice = niceLevel();
+    {
+      BackgroundScheduling::Thread background;
+      EXPECT_EQ(niceLevel(), 10);
+      {
+        BackgroundScheduling::Boost boost;
+        EXPECT_EQ(niceLevel(), nice);
+        EXPECT_NE(ioClass(), 3);
+      }
+      EXPECT_EQ(niceLevel(), 10);
+      EXPECT_EQ(ioClass(), 3);
+    }
+    EXPECT_EQ(niceLevel(), nice);
+  });
+  BackgroundScheduling::configure(BackgroundScheduling::Class{});
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
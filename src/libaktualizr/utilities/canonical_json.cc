@@ -0,0 +1,135 @@
+#include "utilities/canonical_json.h"
+
+#include <array>
+#include <utility>
+
+namespace {
+
+// Appends the decimal representation of an integer without a temporary string.
+template <typename T>
+void appendInteger(std::string &out, T value) {
+  std::array<char, 24> digits{};
+  auto pos = digits.end();
+  const bool negative = value < 0;
+  do {
+    const auto digit = static_cast<int>(value % 10);
+    *--pos = static_cast<char>('0' + (negative ? -digit : digit));
+    value /= 10;
+  } while (value != 0);
+  if (negative) {
+    *--pos = '-';
+  }
+  out.append(pos, digits.end());
+}
+
+const Json::StreamWriterBuilder &fallbackBuilder() {
+  static const Json::StreamWriterBuilder builder = []() {
+    Json::StreamWriterBuilder b;
+    b["indentation"] = "";
+    return b;
+  }();
+  return builder;
+}
+
+}  // namespace
+
+const std::string &CanonicalJsonWriter::write(const Json::Value &json) {
+  buffer_.clear();
+  writeValue(json);
+  return buffer_;
+}
+
+void CanonicalJsonWriter::append(const Json::Value &json, std::string *out) {
+  std::swap(buffer_, *out);
+  writeValue(json);
+  std::swap(buffer_, *out);
+}
+
+void CanonicalJsonWriter::appendString(std::string_view str, std::string *out) {
+  std::swap(buffer_, *out);
+  writeString(str.data(), str.data() + str.size());
+  std::swap(buffer_, *out);
+}
+
+void CanonicalJsonWriter::writeValue(const Json::Value &json) {
+  switch (json.type()) {
+    case Json::nullValue:
+      buffer_ += "null";
+      break;
+    case Json::booleanValue:
+      buffer_ += json.asBool() ? "true" : "false";
+      break;
+    case Json::intValue:
+      appendInteger(buffer_, json.asLargestInt());
+      break;
+    case Json::uintValue:
+      appendInteger(buffer_, json.asLargestUInt());
+      break;
+    case Json::stringValue: {
+      const char *begin = nullptr;
+      const char *end = nullptr;
+      if (json.getString(&begin, &end)) {
+        writeString(begin, end);
+      } else {
+        buffer_ += "\"\"";
+      }
+      break;
+    }
+    case Json::arrayValue: {
+      buffer_ += '[';
+      const Json::ArrayIndex size = json.size();
+      for (Json::ArrayIndex i = 0; i < size; ++i) {
+        if (i > 0) {
+          buffer_ += ',';
+        }
+        writeValue(json[i]);
+      }
+      buffer_ += ']';
+      break;
+    }
+    case Json::objectValue: {
+      // Members are kept sorted by name, which is the canonical order.
+      buffer_ += '{';
+      bool first = true;
+      for (auto it = json.begin(); it != json.end(); ++it) {
+        if (!first) {
+          buffer_ += ',';
+        }
+        first = false;
+        const char *name_end = nullptr;
+        const char *name = it.memberName(&name_end);
+        writeString(name, name_end);
+        buffer_ += ':';
+        writeValue(*it);
+      }
+      buffer_ += '}';
+      break;
+    }
+    case Json::realValue:
+    default:
+      writeFallback(json);
+      break;
+  }
+}
+
+void CanonicalJsonWriter::writeString(const char *begin, const char *end) {
+  for (const char *c = begin; c != end; ++c) {
+    const auto ch = static_cast<unsigned char>(*c);
+    if (ch < 0x20 || ch >= 0x7F) {
+      writeFallback(Json::Value(begin, end));
+      return;
+    }
+  }
+  buffer_ += '"';
+  for (const char *c = begin; c != end; ++c) {
+    if (*c == '"' || *c == '\\') {
+      buffer_ += '\\';
+    }
+    buffer_ += *c;
+  }
+  buffer_ += '"';
+}
+
+void CanonicalJsonWriter::writeFallback(const Json::Value &json) {
+  buffer_ += Json::writeString(fallbackBuilder(), json);
+}
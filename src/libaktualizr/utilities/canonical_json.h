@@ -0,0 +1,44 @@
+#ifndef UTILITIES_CANONICAL_JSON_H_
+#define UTILITIES_CANONICAL_JSON_H_
+
+#include <string>
+#include <string_view>
+#include <utility>
+
+#include <json/json.h>
+
+/**
+ * Serialize JSON values the way Utils::jsonToCanonicalStr() always has: object
+ * members sorted by name, no whitespace, and the escaping and number format of
+ * jsoncpp.
+ *
+ * The output is appended directly to a buffer that is kept between calls, so
+ * that serializing a large tree costs no allocations once the buffer has grown
+ * to size. Plain ASCII strings and integers are written directly; the rare
+ * values whose format depends on the jsoncpp version (reals, strings with
+ * control or non-ASCII characters) are handed to jsoncpp so that the output is
+ * always identical to it.
+ */
+class CanonicalJsonWriter {
+ public:
+  /**
+   * Serialize a value.
+   * @return the serialized value, valid until the next call
+   */
+  const std::string &write(const Json::Value &json);
+  /** Hand over the buffer with the last serialized value, releasing its memory. */
+  std::string release() { return std::move(buffer_); }
+  /** Append a serialized value to `out`, to build a document piece by piece. */
+  void append(const Json::Value &json, std::string *out);
+  /** Append a serialized string, such as an object member name, to `out`. */
+  void appendString(std::string_view str, std::string *out);
+
+ private:
+  void writeValue(const Json::Value &json);
+  void writeString(const char *begin, const char *end);
+  void writeFallback(const Json::Value &json);
+
+  std::string buffer_;
+};
+
+#endif  // UTILITIES_CANONICAL_JSON_H_
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+
+#include "utilities/canonical_json.h"
+#include "utilities/utils.h"
+
+// What Utils::jsonToCanonicalStr() used to be
+static std::string jsoncppCanonical(const Json::Value &json) {
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+  return Json::writeString(wbuilder, json);
+}
+
+static Json::Value manyTargets(int count) {
+  Json::Value json;
+  json["signed"]["_type"] = "Targets";
+  json["signed"]["expires"] = "2038-01-19T03:14:06Z";
+  json["signed"]["version"] = 42;
+  for (int i = 0; i < count; ++i) {
+    Json::Value target;
+    const std::string digits = std::to_string(i);
+    target["hashes"]["sha256"] = std::string(64 - digits.size(), 'f') + digits;
+    target["length"] = 1000 + i;
+    target["custom"]["hardwareIds"].append("hw-" + std::to_string(i % 10));
+    target["custom"]["targetFormat"] = "BINARY";
+    target["custom"]["version"] = std::to_string(i);
+    json["signed"]["targets"]["firmware-" + std::to_string(i) + ".bin"] = target;
+  }
+  return json;
+}
+
+/* The output is the same as jsoncpp's, including for values that need escaping. */
+TEST(CanonicalJson, SameAsJsoncpp) {
+  CanonicalJsonWriter writer;
+  for (const auto &file : {"tests/tuf/sample1/root.json", "tests/tuf/sample1/targets.json",
+                           "tests/tuf/sample1/snapshot.json", "tests/tuf/rsassa-pss-sha256/root.json"}) {
+    const Json::Value json = Utils::parseJSONFile(file);
+    EXPECT_EQ(writer.write(json), jsoncppCanonical(json)) << file;
+  }
+
+  Json::Value json;
+  json["null"] = Json::Value();
+  json["bool"].append(true);
+  json["bool"].append(false);
+  json["int"].append(0);
+  json["int"].append(-7);
+  json["int"].append(std::numeric_limits<Json::Int64>::min());
+  json["int"].append(std::numeric_limits<Json::Int64>::max());
+  json["int"].append(std::numeric_limits<Json::UInt64>::max());
+  json["real"].append(0.1);
+  json["real"].append(-0.0);
+  json["real"].append(1e300);
+  json["real"].append(3.0);
+  json["string"].append("plain / text");
+  json["string"].append("\"quoted\" \\ back");
+  json["string"].append("tab\tnew\nline\x01\x7f");
+  json["string"].append(std::string("nul\0byte", 8));
+  json["string"].append("unicode \xc3\xa9 \xf0\x9f\x98\x80");
+  json["string"].append("");
+  json["empty"]["array"] = Json::Value(Json::arrayValue);
+  json["empty"]["object"] = Json::Value(Json::objectValue);
+  json["keys"]["b"] = 1;
+  json["keys"]["a"] = 2;
+  json["keys"]["A"] = 3;
+  json["keys"]["\xc3\xa9"] = 4;
+  json["keys"]["with \"quote\""] = 5;
+  json["keys"][""] = 6;
+  EXPECT_EQ(writer.write(json), jsoncppCanonical(json));
+  EXPECT_EQ(Utils::jsonToCanonicalStr(json), jsoncppCanonical(json));
+
+  const Json::Value targets = manyTargets(100);
+  EXPECT_EQ(writer.write(targets), jsoncppCanonical(targets));
+  EXPECT_EQ(Utils::jsonToCanonicalStr(targets), jsoncppCanonical(targets));
+}
+
+/* Micro-benchmark against jsoncpp; run with --gtest_also_run_disabled_tests. */
+TEST(CanonicalJson, DISABLED_Benchmark) {
+  const Json::Value json = manyTargets(20000);
+  const int iterations = 20;
+
+  auto measure = [&](const std::function<size_t()> &serialize) {
+    const auto start = std::chrono::steady_clock::now();
+    size_t size = 0;
+    for (int i = 0; i < iterations; ++i) {
+      size += serialize();
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GT(size, 0);
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() / iterations;
+  };
+
+  CanonicalJsonWriter writer;
+  const auto writer_us = measure([&]() { return writer.write(json).size(); });
+  const auto jsoncpp_us = measure([&]() { return jsoncppCanonical(json).size(); });
+  std::cout << "Serializing " << jsoncppCanonical(json).size() << " bytes: CanonicalJsonWriter " << writer_us
+            << " us, jsoncpp " << jsoncpp_us << " us\n";
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,187 @@
+#include "utilities/command.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <thread>
+
+#include "utilities/flow_control.h"
+
+extern char **environ;  // NOLINT(readability-redundant-declaration)
+
+namespace {
+
+// How often the token is checked while the program runs quietly
+constexpr std::chrono::milliseconds kCancelCheckInterval{100};
+
+class SpawnSetup {
+ public:
+  SpawnSetup() {
+    posix_spawn_file_actions_init(&actions_);
+    posix_spawnattr_init(&attr_);
+  }
+  ~SpawnSetup() {
+    posix_spawn_file_actions_destroy(&actions_);
+    posix_spawnattr_destroy(&attr_);
+  }
+  SpawnSetup(const SpawnSetup &) = delete;
+  SpawnSetup(SpawnSetup &&) = delete;
+  SpawnSetup &operator=(const SpawnSetup &) = delete;
+  SpawnSetup &operator=(SpawnSetup &&) = delete;
+
+  posix_spawn_file_actions_t actions_{};
+  posix_spawnattr_t attr_{};
+};
+
+}  // namespace
+
+CommandResult runCommand(const std::vector<std::string> &args, std::string *output, const CommandOptions &options) {
+  CommandResult result;
+  if (args.empty()) {
+    result.error = "no program to run";
+    return result;
+  }
+
+  std::array<int, 2> pipe_fds{};
+  if (pipe2(pipe_fds.data(), O_CLOEXEC) != 0) {
+    result.error = std::string("pipe2() failed: ") + std::strerror(errno);
+    return result;
+  }
+  const int read_fd = pipe_fds[0];
+  const int write_fd = pipe_fds[1];
+
+  SpawnSetup setup;
+  if (!options.inherit_stdin) {
+    posix_spawn_file_actions_addopen(&setup.actions_, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  }
+  posix_spawn_file_actions_adddup2(&setup.actions_, write_fd, STDOUT_FILENO);
+  if (options.include_stderr) {
+    posix_spawn_file_actions_adddup2(&setup.actions_, write_fd, STDERR_FILENO);
+  }
+  // The signals we block or ignore are not the program's business.
+  sigset_t no_signals;
+  sigemptyset(&no_signals);
+  sigset_t default_signals;
+  sigemptyset(&default_signals);
+  sigaddset(&default_signals, SIGPIPE);
+  sigaddset(&default_signals, SIGINT);
+  sigaddset(&default_signals, SIGTERM);
+  posix_spawnattr_setsigmask(&setup.attr_, &no_signals);
+  posix_spawnattr_setsigdefault(&setup.attr_, &default_signals);
+  posix_spawnattr_setpgroup(&setup.attr_, 0);
+  posix_spawnattr_setflags(&setup.attr_, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+
+  std::vector<char *> argv;
+  argv.reserve(args.size() + 1);
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  pid_t pid = -1;
+  const int spawn_err = posix_spawnp(&pid, argv[0], &setup.actions_, &setup.attr_, argv.data(), environ);
+  close(write_fd);
+  if (spawn_err != 0) {
+    close(read_fd);
+    result.error = "could not run " + args[0] + ": " + std::strerror(spawn_err);
+    return result;
+  }
+
+  const auto deadline = options.timeout.count() > 0 ? std::chrono::steady_clock::now() + options.timeout
+                                                    : std::chrono::steady_clock::time_point::max();
+  auto stopped = [&options, &deadline, &result]() {
+    if (options.token != nullptr && options.token->hasAborted()) {
+      result.status = CommandResult::Status::kCancelled;
+      return true;
+    }
+    if (std::chrono::steady_clock::now() >= deadline) {
+      result.status = CommandResult::Status::kTimedOut;
+      return true;
+    }
+    return false;
+  };
+  auto wait_time = [&deadline]() {
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+    return std::max(std::chrono::milliseconds(0), std::min(left, kCancelCheckInterval));
+  };
+
+  bool killed = false;
+  std::array<char, 4096> buffer{};
+  bool open = true;
+  while (open) {
+    if (stopped()) {
+      killed = true;
+      break;
+    }
+    pollfd pfd{read_fd, POLLIN, 0};
+    const int ready = poll(&pfd, 1, static_cast<int>(wait_time().count()));
+    if (ready < 0 && errno != EINTR) {
+      break;
+    }
+    if (ready <= 0) {
+      continue;
+    }
+    const ssize_t count = read(read_fd, buffer.data(), buffer.size());
+    if (count < 0) {
+      if (errno != EINTR && errno != EAGAIN) {
+        break;
+      }
+      continue;
+    }
+    if (count == 0) {
+      open = false;
+      continue;
+    }
+    const auto size = static_cast<size_t>(count);
+    if (options.on_output) {
+      options.on_output(buffer.data(), size);
+    }
+    if (output != nullptr) {
+      const size_t kept = std::min(size, options.max_output - std::min(options.max_output, output->size()));
+      output->append(buffer.data(), kept);
+      result.output_truncated = result.output_truncated || kept < size;
+    }
+  }
+  close(read_fd);
+
+  // The program may go on after closing its output.
+  int wstatus = 0;
+  while (!killed) {
+    const pid_t waited = waitpid(pid, &wstatus, WNOHANG);
+    if (waited == pid) {
+      break;
+    }
+    if (waited < 0 && errno != EINTR) {
+      result.error = std::string("waitpid() failed: ") + std::strerror(errno);
+      return result;
+    }
+    if (stopped()) {
+      killed = true;
+      break;
+    }
+    std::this_thread::sleep_for(std::min(wait_time(), std::chrono::milliseconds(10)));
+  }
+  if (killed) {
+    kill(-pid, SIGKILL);
+    while (waitpid(pid, &wstatus, 0) < 0 && errno == EINTR) {
+    }
+    return result;
+  }
+
+  if (WIFEXITED(wstatus)) {
+    result.status = CommandResult::Status::kExited;
+    result.exit_code = WEXITSTATUS(wstatus);
+  } else if (WIFSIGNALED(wstatus)) {
+    result.status = CommandResult::Status::kSignaled;
+    result.exit_code = 128 + WTERMSIG(wstatus);
+  }
+  return result;
+}
@@ -0,0 +1,65 @@
+#ifndef UTILITIES_COMMAND_H_
+#define UTILITIES_COMMAND_H_
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace api {
+class FlowControlToken;
+}
+
+struct CommandOptions {
+  // The program is killed once it has run for this long, 0 for no limit
+  std::chrono::milliseconds timeout{0};
+  // Output kept beyond this many bytes is dropped, but still read
+  size_t max_output{1024 * 1024};
+  // Capture the standard error with the standard output, else it is inherited
+  bool include_stderr{false};
+  // Give the program our standard input, else /dev/null
+  bool inherit_stdin{false};
+  // Called with each chunk of the output as it is read, truncated or not
+  std::function<void(const char *data, size_t size)> on_output;
+  // The program is killed once the token is aborted
+  const api::FlowControlToken *token{nullptr};
+};
+
+struct CommandResult {
+  enum class Status {
+    kExited,
+    // Killed by a signal other than ours
+    kSignaled,
+    kSpawnFailed,
+    kTimedOut,
+    kCancelled,
+  };
+
+  Status status{Status::kSpawnFailed};
+  // The exit status, 128 + the signal if killed by one, -1 otherwise
+  int exit_code{-1};
+  bool output_truncated{false};
+  // Why the program could not be spawned
+  std::string error;
+
+  bool ok() const { return status == Status::kExited && exit_code == 0; }
+};
+
+/**
+ * Run a program, looked up in PATH, with its arguments and no shell in
+ * between. It is started with posix_spawn(), which doesn't copy the page
+ * tables of the caller the way the fork() of popen() does, so it stays cheap
+ * and doesn't fail for lack of memory when the caller is large.
+ *
+ * The program gets /dev/null as its standard input, unless inherit_stdin is set,
+ * and its own process group,
+ * which is killed as a whole on timeout or cancellation. The output is read as
+ * it comes, whether or not it is kept.
+ *
+ * @param output where the output is appended, may be null
+ */
+CommandResult runCommand(const std::vector<std::string> &args, std::string *output,
+                         const CommandOptions &options = CommandOptions());
+
+#endif  // UTILITIES_COMMAND_H_
@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "utilities/command.h"
+#include "utilities/flow_control.h"
+
+/* The arguments go to the program as they are, without a shell to split or
+ * expand them, and its exit status comes back. */
+TEST(Command, Arguments) {
+  std::string output;
+  auto result = runCommand({"echo", "a  b", "$HOME;", "*"}, &output);
+  EXPECT_TRUE(result.ok());
+  EXPECT_EQ(output, "a  b $HOME; *\n");
+
+  result = runCommand({"sh", "-c", "exit 3"}, nullptr);
+  EXPECT_EQ(result.status, CommandResult::Status::kExited);
+  EXPECT_EQ(result.exit_code, 3);
+  EXPECT_FALSE(result.ok());
+
+  result = runCommand({"sh", "-c", "kill -9 $$"}, nullptr);
+  EXPECT_EQ(result.status, CommandResult::Status::kSignaled);
+  EXPECT_EQ(result.exit_code, 128 + 9);
+}
+
+/* A program that is not there is reported as such. */
+TEST(Command, SpawnFailed) {
+  auto result = runCommand({"/nonexistent/program"}, nullptr);
+  EXPECT_EQ(result.status, CommandResult::Status::kSpawnFailed);
+  EXPECT_FALSE(result.error.empty());
+
+  result = runCommand({}, nullptr);
+  EXPECT_EQ(result.status, CommandResult::Status::kSpawnFailed);
+}
+
+/* The standard error is only captured when asked for. */
+TEST(Command, Stderr) {
+  std::string output;
+  runCommand({"sh", "-c", "echo out; echo err >&2"}, &output);
+  EXPECT_EQ(output, "out\n");
+
+  output.clear();
+  CommandOptions options;
+  options.include_stderr = true;
+  runCommand({"sh", "-c", "echo out; echo err >&2"}, &output, options);
+  EXPECT_EQ(output, "out\nerr\n");
+}
+
+/* The output is kept up to the limit, but all of it is streamed, and the
+ * program runs to the end. */
+TEST(Command, Output) {
+  std::string output;
+  size_t streamed = 0;
+  CommandOptions options;
+  options.max_output = 1000;
+  options.on_output = [&streamed](const char * /*data*/, size_t size) { streamed += size; };
+  const auto result = runCommand({"head", "-c", "100000", "/dev/zero"}, &output, options);
+  EXPECT_TRUE(result.ok());
+  EXPECT_TRUE(result.output_truncated);
+  EXPECT_EQ(output.size(), 1000);
+  EXPECT_EQ(streamed, 100000);
+}
+
+/* The standard input is /dev/null, unless the caller's is passed on. */
+TEST(Command, Stdin) {
+  std::string output;
+  auto result = runCommand({"sh", "-c", "readlink /proc/self/fd/0"}, &output);
+  EXPECT_TRUE(result.ok());
+  EXPECT_EQ(output, "/dev/null\n");
+
+  std::string own_stdin;
+  own_stdin.resize(4096);
+  const ssize_t size = readlink("/proc/self/fd/0", &own_stdin[0], own_stdin.size());
+  ASSERT_GT(size, 0);
+  own_stdin.resize(static_cast<size_t>(size));
+  CommandOptions options;
+  options.inherit_stdin = true;
+  output.clear();
+  result = runCommand({"sh", "-c", "readlink /proc/self/fd/0"}, &output, options);
+  EXPECT_TRUE(result.ok());
+  EXPECT_EQ(output, own_stdin + "\n");
+}
+
+/* A program that runs over its timeout is killed with the programs it
+ * started, even when it doesn't write anything. */
+TEST(Command, Timeout) {
+  CommandOptions options;
+  options.timeout = std::chrono::milliseconds(200);
+  const auto start = std::chrono::steady_clock::now();
+  auto result = runCommand({"sh", "-c", "sleep 10; echo late"}, nullptr, options);
+  EXPECT_EQ(result.status, CommandResult::Status::kTimedOut);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+  // Closing its output doesn't get it past the timeout.
+  result = runCommand({"sh", "-c", "exec >&-; sleep 10"}, nullptr, options);
+  EXPECT_EQ(result.status, CommandResult::Status::kTimedOut);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(10));
+}
+
+/* A program is killed soon after its token is aborted. */
+TEST(Command, Cancel) {
+  api::FlowControlToken token;
+  CommandOptions options;
+  options.token = &token;
+  std::thread aborter([&token]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    token.setAbort();
+  });
+  const auto start = std::chrono::steady_clock::now();
+  const auto result = runCommand({"sleep", "10"}, nullptr, options);
+  aborter.join();
+  EXPECT_EQ(result.status, CommandResult::Status::kCancelled);
+  EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -69,6 +69,8 @@ inline void CopyFromConfig(StorageType& dest, const std::string& option_name, co
     std::string storage_type{StripQuotesFromStrings(value.get())};
     if (storage_type == "sqlite") {
       dest = StorageType::kSqlite;
+    } else if (storage_type == "memory") {
+      dest = StorageType::kMemory;
     } else {
       dest = StorageType::kFileSystem;
     }
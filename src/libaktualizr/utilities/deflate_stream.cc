@@ -0,0 +1,77 @@
+#include "utilities/deflate_stream.h"
+
+#include <array>
+#include <limits>
+#include <stdexcept>
+
+// Negative window bits for raw deflate, without the zlib header and trailer
+static constexpr int kWindowBits = -15;
+
+DeflateStream::DeflateStream(int level) {
+  if (deflateInit2(&stream_, level, Z_DEFLATED, kWindowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Could not initialize deflate");
+  }
+}
+
+DeflateStream::~DeflateStream() { deflateEnd(&stream_); }
+
+std::string DeflateStream::compress(const uint8_t* data, size_t size) {
+  if (size > std::numeric_limits<uInt>::max()) {
+    throw std::runtime_error("Piece too large to compress");
+  }
+  std::string out;
+  // Enough for the whole piece and the flush marker, zlib is called again if not
+  out.resize(deflateBound(&stream_, static_cast<uLong>(size)) + 16);
+  stream_.next_in = const_cast<Bytef*>(data);
+  stream_.avail_in = static_cast<uInt>(size);
+  size_t used = 0;
+  for (;;) {
+    stream_.next_out = reinterpret_cast<Bytef*>(&out[used]);
+    stream_.avail_out = static_cast<uInt>(out.size() - used);
+    const int res = deflate(&stream_, Z_SYNC_FLUSH);
+    if (res != Z_OK && res != Z_BUF_ERROR) {
+      throw std::runtime_error("deflate failed");
+    }
+    used = out.size() - stream_.avail_out;
+    if (stream_.avail_out != 0) {
+      break;
+    }
+    out.resize(out.size() * 2);
+  }
+  out.resize(used);
+  return out;
+}
+
+InflateStream::InflateStream() {
+  if (inflateInit2(&stream_, kWindowBits) != Z_OK) {
+    throw std::runtime_error("Could not initialize inflate");
+  }
+}
+
+InflateStream::~InflateStream() { inflateEnd(&stream_); }
+
+bool InflateStream::decompress(const uint8_t* data, size_t size, const Sink& sink) {
+  if (size > std::numeric_limits<uInt>::max()) {
+    return false;
+  }
+  std::array<uint8_t, 64 * 1024> buf{};
+  stream_.next_in = const_cast<Bytef*>(data);
+  stream_.avail_in = static_cast<uInt>(size);
+  do {
+    stream_.next_out = buf.data();
+    stream_.avail_out = static_cast<uInt>(buf.size());
+    const int res = inflate(&stream_, Z_SYNC_FLUSH);
+    // Z_BUF_ERROR only means there was nothing left to do
+    if (res != Z_OK && res != Z_BUF_ERROR && res != Z_STREAM_END) {
+      return false;
+    }
+    const size_t produced = buf.size() - stream_.avail_out;
+    if (produced > 0 && !sink(buf.data(), produced)) {
+      return false;
+    }
+    if (res == Z_STREAM_END && stream_.avail_in != 0) {
+      return false;
+    }
+  } while (stream_.avail_in != 0 || stream_.avail_out == 0);
+  return true;
+}
@@ -0,0 +1,56 @@
+#ifndef UTILITIES_DEFLATE_STREAM_H_
+#define UTILITIES_DEFLATE_STREAM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <zlib.h>
+
+/**
+ * Compress a stream of data with raw deflate, piece by piece, such as the
+ * chunks of an upload. Every piece is flushed, so the receiver can decompress
+ * it as soon as it arrives, while the compression history carries over from
+ * one piece to the next.
+ */
+class DeflateStream {
+ public:
+  /** @param level the zlib compression level, the fastest by default */
+  explicit DeflateStream(int level = 1);
+  ~DeflateStream();
+  DeflateStream(const DeflateStream&) = delete;
+  DeflateStream(DeflateStream&&) = delete;
+  DeflateStream& operator=(const DeflateStream&) = delete;
+  DeflateStream& operator=(DeflateStream&&) = delete;
+
+  /** Compress the next piece, throws std::runtime_error if zlib fails. */
+  std::string compress(const uint8_t* data, size_t size);
+
+ private:
+  z_stream stream_{};
+};
+
+/** Decompress the pieces made by DeflateStream, in the same order. */
+class InflateStream {
+ public:
+  using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+  InflateStream();
+  ~InflateStream();
+  InflateStream(const InflateStream&) = delete;
+  InflateStream(InflateStream&&) = delete;
+  InflateStream& operator=(const InflateStream&) = delete;
+  InflateStream& operator=(InflateStream&&) = delete;
+
+  /**
+   * Decompress the next piece and pass the result to sink, in one or more calls.
+   * @return false if the data is corrupt or sink returned false
+   */
+  bool decompress(const uint8_t* data, size_t size, const Sink& sink);
+
+ private:
+  z_stream stream_{};
+};
+
+#endif  // UTILITIES_DEFLATE_STREAM_H_
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include "utilities/deflate_stream.h"
+
+static std::string inflateAll(InflateStream& inflater, const std::string& in) {
+  std::string out;
+  EXPECT_TRUE(inflater.decompress(reinterpret_cast<const uint8_t*>(in.data()), in.size(),
+                                  [&out](const uint8_t* data, size_t size) {
+                                    out.append(reinterpret_cast<const char*>(data), size);
+                                    return true;
+                                  }));
+  return out;
+}
+
+/* Every piece decompresses on its own, in order, to what was compressed. */
+TEST(DeflateStream, RoundTrip) {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> letter('a', 'h');
+  DeflateStream deflater;
+  InflateStream inflater;
+  for (size_t size : {0U, 1U, 1000U, 300000U, 17U}) {
+    std::string piece;
+    for (size_t i = 0; i < size; ++i) {
+      piece += static_cast<char>(letter(random));
+    }
+    const std::string compressed = deflater.compress(reinterpret_cast<const uint8_t*>(piece.data()), piece.size());
+    EXPECT_EQ(inflateAll(inflater, compressed), piece);
+  }
+}
+
+/* Repeated data shrinks, also across the pieces. */
+TEST(DeflateStream, Ratio) {
+  const std::string piece(512 * 1024, '\xff');
+  DeflateStream deflater;
+  InflateStream inflater;
+  size_t compressed_size = 0;
+  for (int i = 0; i < 4; ++i) {
+    const std::string compressed = deflater.compress(reinterpret_cast<const uint8_t*>(piece.data()), piece.size());
+    compressed_size += compressed.size();
+    EXPECT_EQ(inflateAll(inflater, compressed), piece);
+  }
+  EXPECT_LT(compressed_size * 100, piece.size() * 4);
+}
+
+/* Corrupt data and a sink that gives up fail the decompression. */
+TEST(DeflateStream, Failures) {
+  const std::string garbage(100, '\xff');
+  InflateStream inflater;
+  EXPECT_FALSE(inflater.decompress(reinterpret_cast<const uint8_t*>(garbage.data()), garbage.size(),
+                                   [](const uint8_t*, size_t) { return true; }));
+
+  const std::string piece(1000, 'a');
+  DeflateStream deflater;
+  const std::string compressed = deflater.compress(reinterpret_cast<const uint8_t*>(piece.data()), piece.size());
+  InflateStream inflater2;
+  EXPECT_FALSE(inflater2.decompress(reinterpret_cast<const uint8_t*>(compressed.data()), compressed.size(),
+                                    [](const uint8_t*, size_t) { return false; }));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,53 +1,63 @@
 #include "utilities/dequeue_buffer.h"
 
-#include <cassert>
-#include <cstring>
+#include <algorithm>
 #include <stdexcept>
 
+DequeueBuffer::DequeueBuffer(size_t max_size)
+    : max_size_{std::max<size_t>(max_size, 1)}, buffer_(std::min(kInitialSize, max_size_)) {}
+
 char* DequeueBuffer::Head() {
-  assert(sentinel_ == kSentinel);
-  return buffer_.data();
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  return buffer_.data() + head_;
 }
 
-size_t DequeueBuffer::Size() const {
-  assert(sentinel_ == kSentinel);
-  return written_bytes_;
-}
+size_t DequeueBuffer::Size() const { return tail_ - head_; }
 
 void DequeueBuffer::Consume(size_t bytes) {
-  assert(sentinel_ == kSentinel);
-  // It would be possible to have a smarter algorithm here that
-  // only shuffles bytes down when Tail() is called and we are getting
-  // close to the end of the buffer, or when the buffer is nearly empty
-  // the memmove operation is cheap. This isn't performance critical code.
-  if (written_bytes_ < bytes) {
+  if (Size() < bytes) {
     throw std::logic_error("Attempt to DequeueBuffer::Consume() more bytes than are valid");
   }
-  // Shuffle up the buffer
-  auto* next_unconsumed_byte = buffer_.begin() + bytes;
-  auto* end_of_written_area = buffer_.begin() + written_bytes_;
-  std::copy(next_unconsumed_byte, end_of_written_area, buffer_.begin());
-  written_bytes_ -= bytes;
+  head_ += bytes;
+  // Nothing to move when the whole contents have been consumed, as after most messages
+  if (head_ == tail_) {
+    head_ = tail_ = 0;
+  }
 }
 
 char* DequeueBuffer::Tail() {
-  assert(sentinel_ == kSentinel);
+  MakeRoom();
   // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
-  return buffer_.data() + written_bytes_;
+  return buffer_.data() + tail_;
 }
 
 size_t DequeueBuffer::TailSpace() {
-  assert(sentinel_ == kSentinel);
-  return buffer_.size() - written_bytes_;
+  MakeRoom();
+  return buffer_.size() - tail_;
 }
 
 void DequeueBuffer::HaveEnqueued(size_t bytes) {
-  // Assert first. If we have corrupted memory, there is
-  // no amount of exception handling that will save us. Abort rather
-  // than risk a security hole
-  assert(sentinel_ == kSentinel);
-  if (buffer_.size() < written_bytes_ + bytes) {
+  if (buffer_.size() < tail_ + bytes) {
     throw std::logic_error("Wrote bytes beyond the end of the buffer");
   }
-  written_bytes_ += bytes;
+  tail_ += bytes;
+}
+
+void DequeueBuffer::MakeRoom() {
+  if (tail_ < buffer_.size()) {
+    return;
+  }
+  // Moving a few bytes is cheaper than a larger buffer for the rest of the connection
+  if (head_ > 0 && (Size() <= buffer_.size() / 2 || buffer_.size() == max_size_)) {
+    std::copy(buffer_.begin() + static_cast<std::ptrdiff_t>(head_), buffer_.end(), buffer_.begin());
+    tail_ -= head_;
+    head_ = 0;
+    return;
+  }
+  if (buffer_.size() < max_size_) {
+    std::vector<char> grown(std::min(buffer_.size() * 2, max_size_));
+    std::copy(buffer_.begin() + static_cast<std::ptrdiff_t>(head_), buffer_.end(), grown.begin());
+    buffer_.swap(grown);
+    tail_ -= head_;
+    head_ = 0;
+  }
 }
@@ -1,15 +1,26 @@
 #ifndef UPTANE_DEQUEUE_BUFFER_H_
 #define UPTANE_DEQUEUE_BUFFER_H_
 
-#include <array>
 #include <cstddef>
+#include <vector>
 
 /**
  * A dequeue based on a contiguous buffer in memory. Used for buffering
  * data between recv() and ber_decode()
+ *
+ * The buffer starts small and grows when it is full, up to a maximum size
+ * which is the largest message it can hold. Consumed bytes are only moved
+ * out of the way when the tail runs out of space, so that a message arriving
+ * in many parts isn't moved again after each of them.
  */
 class DequeueBuffer {
  public:
+  static constexpr size_t kInitialSize = 4096;
+  // Above the largest chunks that the image uploads negotiate, of 1 MiB
+  static constexpr size_t kDefaultMaxSize = 2 * 1024 * 1024;
+
+  explicit DequeueBuffer(size_t max_size = kDefaultMaxSize);
+
   /**
    * A pointer to the first element that has not been Consumed().
    */
@@ -33,6 +44,8 @@ class DequeueBuffer {
 
   /**
    * The number of bytes beyond Tail() that are allocated and may be written to.
+   * Room is made if there is none, by moving the valid bytes to the front or
+   * growing the buffer, so 0 means that MaxSize() bytes are valid.
    */
   size_t TailSpace();
 
@@ -42,16 +55,21 @@ class DequeueBuffer {
    */
   void HaveEnqueued(size_t bytes);
 
+  /** The size allocated so far */
+  size_t Capacity() const { return buffer_.size(); }
+  size_t MaxSize() const { return max_size_; }
+
  private:
-  static constexpr int kSentinel = 1337161494;
+  // If the tail is at the end of the buffer, move the valid bytes to the front or grow it
+  void MakeRoom();
 
+  size_t max_size_;
   /**
-   * buffer_[0..written_bytes_] contains to contents of this dequeue
+   * buffer_[head_..tail_] contains to contents of this dequeue
    */
-  size_t written_bytes_{0};
-  std::array<char, 4096> buffer_{};  // Zero initialise as a security pesimisation
-  // NOLINTNEXTLINE (should be just for clang-diagnostic-unused-private-field but it won't work)
-  int sentinel_{kSentinel};  // Sentinel to check for writers overflowing buffer_
+  size_t head_{0};
+  size_t tail_{0};
+  std::vector<char> buffer_;  // Zero initialise as a security pesimisation
 };
 
 #endif  // UPTANE_DEQUEUE_BUFFER_H_
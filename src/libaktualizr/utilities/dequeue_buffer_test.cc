@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <stdexcept>
 #include <string>
 #include "utilities/dequeue_buffer.h"
 
@@ -20,6 +22,53 @@ TEST(DequeueBuffer, Simple) {
   EXPECT_EQ(std::string(dut.Head(), dut.Size()), "lo world");
 }
 
+/* The buffer grows when a message doesn't fit, up to its maximum size. */
+TEST(DequeueBuffer, Grows) {
+  DequeueBuffer dut(3 * DequeueBuffer::kInitialSize);
+  EXPECT_EQ(dut.Capacity(), DequeueBuffer::kInitialSize);
+
+  const std::string message(2 * DequeueBuffer::kInitialSize + 100, 'x');
+  size_t pos = 0;
+  while (pos < message.size()) {
+    const size_t part = std::min(dut.TailSpace(), message.size() - pos);
+    ASSERT_GT(part, 0);
+    std::copy_n(&message[pos], part, dut.Tail());
+    dut.HaveEnqueued(part);
+    pos += part;
+  }
+  EXPECT_EQ(dut.Capacity(), 3 * DequeueBuffer::kInitialSize);
+  EXPECT_EQ(std::string(dut.Head(), dut.Size()), message);
+
+  // Full at the maximum size
+  dut.HaveEnqueued(dut.TailSpace());
+  EXPECT_EQ(dut.TailSpace(), 0);
+  EXPECT_THROW(dut.HaveEnqueued(1), std::logic_error);
+  EXPECT_EQ(dut.Capacity(), dut.MaxSize());
+
+  // Room is made at the front again once bytes are consumed
+  dut.Consume(10);
+  EXPECT_EQ(dut.TailSpace(), 10);
+  EXPECT_EQ(std::string(dut.Head(), message.size() - 10), message.substr(10));
+}
+
+/* The bytes left after a Consume() stay where they are until the tail needs the room. */
+TEST(DequeueBuffer, ConsumeInPlace) {
+  DequeueBuffer dut;
+  const size_t space = dut.TailSpace();
+  dut.HaveEnqueued(space);
+  const char *head = dut.Head();
+  dut.Consume(1);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  EXPECT_EQ(dut.Head(), head + 1);
+  EXPECT_THROW(dut.Consume(space), std::logic_error);
+
+  // Consuming everything starts from the front without moving anything
+  dut.Consume(space - 1);
+  EXPECT_EQ(dut.Size(), 0);
+  EXPECT_EQ(dut.Head(), head);
+  EXPECT_EQ(dut.TailSpace(), space);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
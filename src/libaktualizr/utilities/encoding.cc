@@ -0,0 +1,389 @@
+#include "utilities/encoding.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/archive/iterators/dataflow_exception.hpp>
+#include <boost/throw_exception.hpp>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ENCODING_SSSE3 1
+#include <immintrin.h>
+#endif
+
+namespace encoding {
+
+namespace {
+
+const char kBase64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+const char kHexUpper[] = "0123456789ABCDEF";
+const char kHexLower[] = "0123456789abcdef";
+
+// Values of the base64 characters, '=' decoding as 'A' like in the Boost codec
+constexpr uint8_t kSpace = 0x80;
+constexpr uint8_t kInvalid = 0xFF;
+
+struct Base64Table {
+  std::array<uint8_t, 256> values{};
+
+  Base64Table() {
+    values.fill(kInvalid);
+    for (uint8_t i = 0; i < 64; ++i) {
+      values[static_cast<uint8_t>(kBase64Chars[i])] = i;
+    }
+    values['='] = 0;
+    for (const char c : {' ', '\t', '\n', '\v', '\f', '\r'}) {
+      values[static_cast<uint8_t>(c)] = kSpace;
+    }
+  }
+};
+
+const Base64Table &base64Table() {
+  static const Base64Table table;
+  return table;
+}
+
+struct HexTable {
+  std::array<int8_t, 256> values{};
+
+  HexTable() {
+    values.fill(-1);
+    for (int8_t i = 0; i < 16; ++i) {
+      values[static_cast<uint8_t>(kHexUpper[i])] = i;
+      values[static_cast<uint8_t>(kHexLower[i])] = i;
+    }
+  }
+};
+
+const HexTable &hexTable() {
+  static const HexTable table;
+  return table;
+}
+
+[[noreturn]] void invalidBase64() {
+  throw boost::archive::iterators::dataflow_exception(
+      boost::archive::iterators::dataflow_exception::invalid_base64_character);
+}
+
+// Encode size bytes, the last group padded
+void encodeBase64(const uint8_t *in, size_t size, char *out) {
+  size_t i = 0;
+  for (; i + 3 <= size; i += 3) {
+    const uint32_t group = static_cast<uint32_t>(in[i]) << 16U | static_cast<uint32_t>(in[i + 1]) << 8U | in[i + 2];
+    *out++ = kBase64Chars[group >> 18U];
+    *out++ = kBase64Chars[(group >> 12U) & 0x3FU];
+    *out++ = kBase64Chars[(group >> 6U) & 0x3FU];
+    *out++ = kBase64Chars[group & 0x3FU];
+  }
+  if (i < size) {
+    const bool two = i + 1 < size;
+    const uint32_t group = static_cast<uint32_t>(in[i]) << 16U | (two ? static_cast<uint32_t>(in[i + 1]) << 8U : 0U);
+    *out++ = kBase64Chars[group >> 18U];
+    *out++ = kBase64Chars[(group >> 12U) & 0x3FU];
+    *out++ = two ? kBase64Chars[(group >> 6U) & 0x3FU] : '=';
+    *out = '=';
+  }
+}
+
+// Decode from a group boundary to the end, return the end of the output
+char *decodeBase64(const char *in, size_t size, char *out) {
+  const auto &values = base64Table().values;
+  uint32_t bits = 0;
+  unsigned bit_count = 0;
+  size_t chars = 0;
+  size_t i = 0;
+  while (i < size) {
+    // Four characters at a time between whitespace
+    if (bit_count == 0 && i + 4 <= size) {
+      const uint32_t a = values[static_cast<uint8_t>(in[i])];
+      const uint32_t b = values[static_cast<uint8_t>(in[i + 1])];
+      const uint32_t c = values[static_cast<uint8_t>(in[i + 2])];
+      const uint32_t d = values[static_cast<uint8_t>(in[i + 3])];
+      if (((a | b | c | d) & kSpace) == 0) {
+        const uint32_t group = a << 18U | b << 12U | c << 6U | d;
+        *out++ = static_cast<char>(group >> 16U);
+        *out++ = static_cast<char>((group >> 8U) & 0xFFU);
+        *out++ = static_cast<char>(group & 0xFFU);
+        i += 4;
+        chars += 4;
+        continue;
+      }
+    }
+    const uint8_t value = values[static_cast<uint8_t>(in[i++])];
+    if (value == kSpace) {
+      continue;
+    }
+    if (value == kInvalid) {
+      invalidBase64();
+    }
+    bits = (bits << 6U) | value;
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      *out++ = static_cast<char>((bits >> bit_count) & 0xFFU);
+      bits &= (1U << bit_count) - 1;
+    }
+    ++chars;
+  }
+  // Boost reads beyond the last character then
+  if (chars % 4 == 1) {
+    invalidBase64();
+  }
+  return out;
+}
+
+void encodeHex(const uint8_t *in, size_t size, char *out, bool lower_case) {
+  const char *digits = lower_case ? kHexLower : kHexUpper;
+  for (size_t i = 0; i < size; ++i) {
+    *out++ = digits[in[i] >> 4U];
+    *out++ = digits[in[i] & 0xFU];
+  }
+}
+
+void decodeHex(const char *in, size_t size, char *out) {
+  const auto &values = hexTable().values;
+  for (size_t i = 0; i < size; i += 2) {
+    const int8_t high = values[static_cast<uint8_t>(in[i])];
+    if (high < 0) {
+      BOOST_THROW_EXCEPTION(boost::algorithm::non_hex_input() << boost::algorithm::bad_char(in[i]));
+    }
+    if (i + 1 == size) {
+      BOOST_THROW_EXCEPTION(boost::algorithm::not_enough_input());
+    }
+    const int8_t low = values[static_cast<uint8_t>(in[i + 1])];
+    if (low < 0) {
+      BOOST_THROW_EXCEPTION(boost::algorithm::non_hex_input() << boost::algorithm::bad_char(in[i + 1]));
+    }
+    *out++ = static_cast<char>(high << 4 | low);
+  }
+}
+
+#ifdef ENCODING_SSSE3
+
+bool haveSsse3() {
+  static const bool supported = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") != 0;
+  }();
+  return supported;
+}
+
+// 12 bytes at a time into 16 characters, as long as 16 bytes can be read; return the bytes encoded
+__attribute__((target("ssse3"))) size_t encodeBase64Ssse3(const uint8_t *in, size_t size, char *out) {
+  const __m128i shuffle = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+  // Indices 52 and above to 1-12, 26-51 to 0 and 0-25 to 13, then the offset to the character
+  const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 12) {
+    __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    // Each 32-bit lane holds the 3 bytes of a group, and the 4 indices are shifted out of them
+    data = _mm_shuffle_epi8(data, shuffle);
+    const __m128i ac = _mm_mulhi_epu16(_mm_and_si128(data, _mm_set1_epi32(0x0FC0FC00)), _mm_set1_epi32(0x04000040));
+    const __m128i bd = _mm_mullo_epi16(_mm_and_si128(data, _mm_set1_epi32(0x003F03F0)), _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(ac, bd);
+
+    __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+    const __m128i chars = _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), chars);
+    out += 16;
+  }
+  return i;
+}
+
+// 16 characters at a time into 12 bytes, up to the first one that is not in
+// the alphabet; return the characters decoded. Writes 16 bytes out each time.
+__attribute__((target("ssse3"))) size_t decodeBase64Ssse3(const char *in, size_t size, char *out) {
+  // Bits of the character classes by low and high nibble, which have none in common for valid characters
+  const __m128i lut_low = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B,
+                                        0x1B, 0x1B, 0x1A);
+  const __m128i lut_high = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                         0x10, 0x10, 0x10, 0x10);
+  // From the character to its value, by high nibble, with '/' at 1
+  const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i mask_2f = _mm_set1_epi8(0x2F);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i high_nibbles = _mm_and_si128(_mm_srli_epi32(chars, 4), mask_2f);
+    const __m128i low = _mm_shuffle_epi8(lut_low, _mm_and_si128(chars, mask_2f));
+    const __m128i high = _mm_shuffle_epi8(lut_high, high_nibbles);
+    const __m128i valid = _mm_cmpeq_epi8(_mm_and_si128(low, high), _mm_setzero_si128());
+    if (_mm_movemask_epi8(valid) != 0xFFFF) {
+      break;
+    }
+    const __m128i slash = _mm_cmpeq_epi8(chars, mask_2f);
+    chars = _mm_add_epi8(chars, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(slash, high_nibbles)));
+
+    // 6-bit values into 12-bit pairs, then into the 24 bits of each group
+    const __m128i pairs = _mm_maddubs_epi16(chars, _mm_set1_epi32(0x01400140));
+    const __m128i groups = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_shuffle_epi8(groups, pack));
+    out += 12;
+  }
+  return i;
+}
+
+// 16 bytes at a time into 32 characters; return the bytes encoded
+__attribute__((target("ssse3"))) size_t encodeHexSsse3(const uint8_t *in, size_t size, char *out, bool lower_case) {
+  const __m128i digits = _mm_loadu_si128(reinterpret_cast<const __m128i *>(lower_case ? kHexLower : kHexUpper));
+  const __m128i mask = _mm_set1_epi8(0x0F);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(data, 4), mask));
+    const __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(data, mask));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), _mm_unpacklo_epi8(high, low));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16), _mm_unpackhi_epi8(high, low));
+    out += 32;
+  }
+  return i;
+}
+
+// The values of 16 hex digits, or false if one isn't
+__attribute__((target("ssse3"))) bool hexValues(__m128i chars, __m128i *values) {
+  const __m128i digit = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+  const __m128i letter = _mm_sub_epi8(_mm_or_si128(chars, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+  const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+  if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+    return false;
+  }
+  *values = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                         _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+  return true;
+}
+
+// 32 characters at a time into 16 bytes, up to the first that isn't a hex digit; return the characters decoded
+__attribute__((target("ssse3"))) size_t decodeHexSsse3(const char *in, size_t size, char *out) {
+  // High nibble times 16 plus low nibble, for each pair
+  const __m128i weights = _mm_set1_epi16(0x0110);
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m128i first;
+    __m128i second;
+    if (!hexValues(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i)), &first) ||
+        !hexValues(_mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i + 16)), &second)) {
+      break;
+    }
+    const __m128i bytes = _mm_packus_epi16(_mm_maddubs_epi16(first, weights), _mm_maddubs_epi16(second, weights));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out), bytes);
+    out += 16;
+  }
+  return i;
+}
+
+#endif  // ENCODING_SSSE3
+
+size_t base64Size(size_t size) { return (size + 2) / 3 * 4; }
+
+// Boost treats every '=' as an 'A' and removes as many bytes from the end
+std::string finishBase64(std::string &&result, const char *end, size_t padding) {
+  const auto size = static_cast<size_t>(end - result.data());
+  if (padding > size) {
+    invalidBase64();
+  }
+  result.resize(size - padding);
+  return std::move(result);
+}
+
+}  // namespace
+
+bool vectorized() {
+#ifdef ENCODING_SSSE3
+  return haveSsse3();
+#else
+  return false;
+#endif
+}
+
+std::string toBase64(const std::string &data) {
+  std::string result(base64Size(data.size()), '\0');
+  const auto *in = reinterpret_cast<const uint8_t *>(data.data());
+  size_t done = 0;
+#ifdef ENCODING_SSSE3
+  if (haveSsse3()) {
+    done = encodeBase64Ssse3(in, data.size(), &result[0]);
+  }
+#endif
+  encodeBase64(in + done, data.size() - done, &result[done / 3 * 4]);
+  return result;
+}
+
+std::string fromBase64(const std::string &base64) {
+  // Slack for the 16-byte stores
+  std::string result(base64.size() / 4 * 3 + 16, '\0');
+  char *out = &result[0];
+  size_t done = 0;
+#ifdef ENCODING_SSSE3
+  if (haveSsse3()) {
+    done = decodeBase64Ssse3(base64.data(), base64.size(), out);
+    out += done / 4 * 3;
+  }
+#endif
+  const char *end = decodeBase64(base64.data() + done, base64.size() - done, out);
+  return finishBase64(std::move(result), end, static_cast<size_t>(std::count(base64.begin(), base64.end(), '=')));
+}
+
+std::string toHex(const std::string &data, bool lower_case) {
+  std::string result(2 * data.size(), '\0');
+  const auto *in = reinterpret_cast<const uint8_t *>(data.data());
+  size_t done = 0;
+#ifdef ENCODING_SSSE3
+  if (haveSsse3()) {
+    done = encodeHexSsse3(in, data.size(), &result[0], lower_case);
+  }
+#endif
+  encodeHex(in + done, data.size() - done, &result[2 * done], lower_case);
+  return result;
+}
+
+std::string fromHex(const std::string &hex) {
+  std::string result(hex.size() / 2 + 16, '\0');
+  size_t done = 0;
+#ifdef ENCODING_SSSE3
+  if (haveSsse3()) {
+    done = decodeHexSsse3(hex.data(), hex.size(), &result[0]);
+  }
+#endif
+  decodeHex(hex.data() + done, hex.size() - done, &result[done / 2]);
+  result.resize(hex.size() / 2);
+  return result;
+}
+
+namespace scalar {
+
+std::string toBase64(const std::string &data) {
+  std::string result(base64Size(data.size()), '\0');
+  encodeBase64(reinterpret_cast<const uint8_t *>(data.data()), data.size(), &result[0]);
+  return result;
+}
+
+std::string fromBase64(const std::string &base64) {
+  std::string result(base64.size() / 4 * 3 + 3, '\0');
+  const char *end = decodeBase64(base64.data(), base64.size(), &result[0]);
+  return finishBase64(std::move(result), end, static_cast<size_t>(std::count(base64.begin(), base64.end(), '=')));
+}
+
+std::string toHex(const std::string &data, bool lower_case) {
+  std::string result(2 * data.size(), '\0');
+  encodeHex(reinterpret_cast<const uint8_t *>(data.data()), data.size(), &result[0], lower_case);
+  return result;
+}
+
+std::string fromHex(const std::string &hex) {
+  std::string result(hex.size() / 2 + 1, '\0');
+  decodeHex(hex.data(), hex.size(), &result[0]);
+  result.resize(hex.size() / 2);
+  return result;
+}
+
+}  // namespace scalar
+
+}  // namespace encoding
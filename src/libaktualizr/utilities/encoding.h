@@ -0,0 +1,41 @@
+#ifndef UTILITIES_ENCODING_H_
+#define UTILITIES_ENCODING_H_
+
+#include <string>
+
+/**
+ * Base64 and hex codecs. They use SSSE3 on the x86 CPUs that have it, with a
+ * scalar fallback everywhere else that gives the same output, and the same
+ * exceptions on invalid input, as the Boost codecs they replace:
+ * boost::archive::iterators::dataflow_exception for base64 and
+ * boost::algorithm::hex_decode_error for hex.
+ *
+ * Utils::toBase64() and the like are the interface for the rest of the code.
+ */
+namespace encoding {
+
+std::string toBase64(const std::string &data);
+/**
+ * Whitespace is skipped, like Boost does, and '=' is padding wherever it is.
+ * Unpadded input is decoded as far as it goes.
+ */
+std::string fromBase64(const std::string &base64);
+/** Upper case, as boost::algorithm::hex() */
+std::string toHex(const std::string &data, bool lower_case = false);
+/** Either case */
+std::string fromHex(const std::string &hex);
+
+/** Whether the vectorized versions are used on this CPU */
+bool vectorized();
+
+// The scalar versions, for the tests and benchmarks
+namespace scalar {
+std::string toBase64(const std::string &data);
+std::string fromBase64(const std::string &base64);
+std::string toHex(const std::string &data, bool lower_case = false);
+std::string fromHex(const std::string &hex);
+}  // namespace scalar
+
+}  // namespace encoding
+
+#endif  // UTILITIES_ENCODING_H_
@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+
+#include <boost/algorithm/hex.hpp>
+#include <boost/archive/iterators/dataflow_exception.hpp>
+
+#include "utilities/encoding.h"
+
+namespace {
+
+std::string randomBytes(std::mt19937 &generator, size_t size) {
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::string data(size, '\0');
+  for (auto &c : data) {
+    c = static_cast<char>(byte(generator));
+  }
+  return data;
+}
+
+}  // namespace
+
+/* The vectorized codecs give the same output as the scalar ones, for all the sizes around the block sizes. */
+TEST(Encoding, SameAsScalar) {
+  std::mt19937 generator(1);
+  for (size_t size = 0; size < 300; ++size) {
+    const std::string data = randomBytes(generator, size);
+
+    const std::string base64 = encoding::toBase64(data);
+    EXPECT_EQ(base64, encoding::scalar::toBase64(data)) << size;
+    EXPECT_EQ(encoding::fromBase64(base64), data) << size;
+    EXPECT_EQ(encoding::scalar::fromBase64(base64), data) << size;
+
+    for (const bool lower_case : {false, true}) {
+      const std::string hex = encoding::toHex(data, lower_case);
+      EXPECT_EQ(hex, encoding::scalar::toHex(data, lower_case)) << size;
+      EXPECT_EQ(encoding::fromHex(hex), data) << size;
+      EXPECT_EQ(encoding::scalar::fromHex(hex), data) << size;
+    }
+  }
+}
+
+/* The output is the one of Boost, hex in upper case unless asked otherwise. */
+TEST(Encoding, Known) {
+  EXPECT_EQ(encoding::toBase64("hello"), "aGVsbG8=");
+  EXPECT_EQ(encoding::toBase64("hello world, hello world"), "aGVsbG8gd29ybGQsIGhlbGxvIHdvcmxk");
+  EXPECT_EQ(encoding::fromBase64("aGVsbG8gd29y\nbGQsIGhl bGxvIHdvcmxk"), "hello world, hello world");
+  EXPECT_EQ(encoding::toHex("\x01\xab\xff"), "01ABFF");
+  EXPECT_EQ(encoding::toHex("\x01\xab\xff", true), "01abff");
+  EXPECT_EQ(encoding::fromHex("01abFF"), "\x01\xab\xff");
+  const std::string data(100, '\x5a');
+  EXPECT_EQ(encoding::toHex(data), boost::algorithm::hex(data));
+}
+
+/* Invalid input throws the exceptions of Boost, wherever the invalid character is. */
+TEST(Encoding, Invalid) {
+  const std::string valid_base64 = encoding::toBase64(std::string(64, 'a'));
+  const std::string valid_hex = encoding::toHex(std::string(64, 'a'));
+  for (size_t pos = 0; pos < valid_base64.size(); pos += 7) {
+    std::string invalid = valid_base64;
+    invalid[pos] = '*';
+    EXPECT_THROW(encoding::fromBase64(invalid), boost::archive::iterators::dataflow_exception) << pos;
+    EXPECT_THROW(encoding::scalar::fromBase64(invalid), boost::archive::iterators::dataflow_exception) << pos;
+  }
+  for (size_t pos = 0; pos < valid_hex.size(); pos += 7) {
+    std::string invalid = valid_hex;
+    invalid[pos] = 'g';
+    EXPECT_THROW(encoding::fromHex(invalid), boost::algorithm::non_hex_input) << pos;
+    EXPECT_THROW(encoding::scalar::fromHex(invalid), boost::algorithm::non_hex_input) << pos;
+  }
+  EXPECT_THROW(encoding::fromBase64("aGVsbG8=="), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(encoding::fromBase64("CQ==="), boost::archive::iterators::dataflow_exception);
+  EXPECT_THROW(encoding::fromHex("abc"), boost::algorithm::not_enough_input);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,137 @@
+#include "utilities/executor.h"
+
+#include <algorithm>
+
+#include "utilities/metrics.h"
+
+// The pool the current thread belongs to, if any
+static thread_local const ThreadPool *current_pool = nullptr;
+
+ThreadPool::ThreadPool(std::string name, size_t max_threads)
+    : name_{std::move(name)},
+      max_threads_{max_threads},
+      threads_gauge_{Metrics::instance().gauge("aktualizr_executor_threads", "Threads of the pool", {{"pool", name_}})},
+      active_gauge_{Metrics::instance().gauge("aktualizr_executor_active_tasks", "Tasks running", {{"pool", name_}})},
+      queued_gauge_{Metrics::instance().gauge("aktualizr_executor_queued_tasks", "Tasks waiting for a thread",
+                                              {{"pool", name_}})},
+      tasks_counter_{Metrics::instance().counter("aktualizr_executor_tasks_total", "Tasks run", {{"pool", name_}})},
+      wait_histogram_{Metrics::instance().histogram("aktualizr_executor_queue_wait_seconds",
+                                                    "Time from the submission of a task to its start",
+                                                    {{"pool", name_}})} {}
+
+ThreadPool::~ThreadPool() {
+  std::map<std::thread::id, std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+    threads.swap(threads_);
+  }
+  cv_.notify_all();
+  for (auto &thread : threads) {
+    thread.second.join();
+  }
+}
+
+size_t ThreadPool::maxThreads() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return max_threads_;
+}
+
+void ThreadPool::setMaxThreads(size_t max_threads) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  max_threads_ = max_threads;
+}
+
+void ThreadPool::post(std::function<void()> run) {
+  Task task{std::move(run), clock::now()};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    reap();
+    // Every task in the queue has an idle thread waiting for it or a thread
+    // started for it, except for the ones that wait for the limit.
+    if (queue_.size() < idle_) {
+      queue_.push_back(std::move(task));
+      queued_gauge_.set(static_cast<int64_t>(queue_.size()));
+      cv_.notify_one();
+      return;
+    }
+    if (max_threads_ == 0 || threads_.size() < max_threads_) {
+      queue_.push_back(std::move(task));
+      queued_gauge_.set(static_cast<int64_t>(queue_.size()));
+      std::thread thread([this]() { work(); });
+      const auto id = thread.get_id();
+      threads_.emplace(id, std::move(thread));
+      threads_gauge_.set(static_cast<int64_t>(threads_.size()));
+      return;
+    }
+    if (current_pool != this) {
+      queue_.push_back(std::move(task));
+      queued_gauge_.set(static_cast<int64_t>(queue_.size()));
+      return;
+    }
+  }
+  runTask(task);
+}
+
+void ThreadPool::work() {
+  current_pool = this;
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    if (queue_.empty()) {
+      if (stopping_) {
+        break;
+      }
+      ++idle_;
+      const bool woken = cv_.wait_for(lock, kIdleTimeout, [this]() { return !queue_.empty() || stopping_; });
+      --idle_;
+      if (!woken) {
+        break;
+      }
+      continue;
+    }
+    const Task task = std::move(queue_.front());
+    queue_.pop_front();
+    queued_gauge_.set(static_cast<int64_t>(queue_.size()));
+    lock.unlock();
+    runTask(task);
+    lock.lock();
+  }
+  stopped_.push_back(std::this_thread::get_id());
+  threads_gauge_.set(static_cast<int64_t>(threads_.size() - std::min(stopped_.size(), threads_.size())));
+}
+
+void ThreadPool::runTask(const Task &task) {
+  wait_histogram_.record(static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - task.queued_at).count()));
+  active_gauge_.add(1);
+  // A packaged task, which keeps the exceptions for the future
+  task.run();
+  active_gauge_.add(-1);
+  tasks_counter_.add();
+}
+
+void ThreadPool::reap() {
+  for (const auto &id : stopped_) {
+    auto it = threads_.find(id);
+    if (it != threads_.end()) {
+      it->second.join();
+      threads_.erase(it);
+    }
+  }
+  stopped_.clear();
+}
+
+ThreadPool &Executor::io() {
+  static ThreadPool pool("io", kIoThreads);
+  return pool;
+}
+
+ThreadPool &Executor::cpu() {
+  static ThreadPool pool("cpu", std::max(std::thread::hardware_concurrency(), 1U));
+  return pool;
+}
+
+ThreadPool &Executor::blocking() {
+  static ThreadPool pool("blocking", 0);
+  return pool;
+}
@@ -0,0 +1,109 @@
+#ifndef UTILITIES_EXECUTOR_H_
+#define UTILITIES_EXECUTOR_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class MetricCounter;
+class MetricGauge;
+class MetricHistogram;
+
+/**
+ * A pool of threads that run tasks, at most max_threads of them at once (0
+ * for no limit); the others wait in order. Threads are started as the tasks
+ * need them and stop after kIdleTimeout without any.
+ *
+ * A task submitted from a thread of the pool while all of its threads are
+ * busy runs right away on that thread instead, so that tasks that wait for
+ * the tasks they submitted can't take up the whole pool and never finish.
+ *
+ * Unlike the ones of std::async, the futures of the tasks don't wait for them
+ * when they are destroyed, so anything a task refers to must outlive it.
+ */
+class ThreadPool {
+ public:
+  static constexpr std::chrono::seconds kIdleTimeout{30};
+
+  ThreadPool(std::string name, size_t max_threads);
+  /** Waits for all the tasks, including the ones not started yet. */
+  ~ThreadPool();
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool(ThreadPool &&) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ThreadPool &operator=(ThreadPool &&) = delete;
+
+  /** Run task() on the pool; the future has its result or exception. */
+  template <typename F>
+  std::future<typename std::result_of<F()>::type> submit(F task) {
+    using Result = typename std::result_of<F()>::type;
+    auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+    auto future = packaged->get_future();
+    post([packaged]() { (*packaged)(); });
+    return future;
+  }
+
+  const std::string &name() const { return name_; }
+  size_t maxThreads() const;
+  /** Applies to the tasks started from now on. */
+  void setMaxThreads(size_t max_threads);
+
+ private:
+  using clock = std::chrono::steady_clock;
+  struct Task {
+    std::function<void()> run;
+    clock::time_point queued_at;
+  };
+
+  void post(std::function<void()> run);
+  void work();
+  void runTask(const Task &task);
+  // Join the threads that stopped. Called with the lock held.
+  void reap();
+
+  const std::string name_;
+  mutable std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Task> queue_;
+  size_t max_threads_;
+  size_t idle_{0};
+  bool stopping_{false};
+  std::map<std::thread::id, std::thread> threads_;
+  std::vector<std::thread::id> stopped_;
+
+  MetricGauge &threads_gauge_;
+  MetricGauge &active_gauge_;
+  MetricGauge &queued_gauge_;
+  MetricCounter &tasks_counter_;
+  MetricHistogram &wait_histogram_;
+};
+
+/**
+ * The thread pools of the process, by the kind of work of their tasks.
+ */
+class Executor {
+ public:
+  /** Requests to the servers and the Secondaries, at most kIoThreads at once. */
+  static ThreadPool &io();
+  /** Hashing, signing and verification, at most one task per CPU. */
+  static ThreadPool &cpu();
+  /**
+   * Tasks that run for long or that have to run at the same time as each
+   * other, e.g. because they wait for each other; without limit.
+   */
+  static ThreadPool &blocking();
+
+  static constexpr size_t kIoThreads = 16;
+};
+
+#endif  // UTILITIES_EXECUTOR_H_
@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "utilities/executor.h"
+#include "utilities/metrics.h"
+
+/* No more tasks than the limit run at once, and they all run. */
+TEST(Executor, Limit) {
+  ThreadPool pool("test-limit", 3);
+  std::mutex mutex;
+  std::condition_variable cv;
+  int running = 0;
+  int peak = 0;
+  std::vector<std::future<void>> tasks;
+  for (int i = 0; i < 30; ++i) {
+    tasks.push_back(pool.submit([&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      peak = std::max(peak, ++running);
+      cv.notify_all();
+      // The first tasks wait until the pool is full, the others run at once
+      cv.wait_for(lock, std::chrono::seconds(60), [&peak]() { return peak >= 3; });
+      --running;
+    }));
+  }
+  for (auto &task : tasks) {
+    task.get();
+  }
+  EXPECT_EQ(peak, 3);
+  EXPECT_EQ(running, 0);
+}
+
+/* The results and the exceptions of the tasks go to their futures, and the pool has its metrics. */
+TEST(Executor, Results) {
+  ThreadPool pool("test-results", 2);
+  EXPECT_EQ(pool.submit([]() { return 42; }).get(), 42);
+  auto failed = pool.submit([]() -> int { throw std::runtime_error("failed"); });
+  EXPECT_THROW(failed.get(), std::runtime_error);
+  EXPECT_NE(Metrics::instance().prometheus().find("aktualizr_executor_tasks_total{pool=\"test-results\"}"),
+            std::string::npos);
+}
+
+/* Tasks that wait for the tasks they submit don't block a full pool. */
+TEST(Executor, Nested) {
+  ThreadPool pool("test-nested", 2);
+  std::vector<std::future<int>> outer;
+  for (int i = 0; i < 8; ++i) {
+    outer.push_back(pool.submit([&pool, i]() {
+      std::vector<std::future<int>> inner;
+      for (int j = 0; j < 4; ++j) {
+        inner.push_back(pool.submit([i, j]() {
+          std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          return i * 4 + j;
+        }));
+      }
+      int sum = 0;
+      for (auto &task : inner) {
+        sum += task.get();
+      }
+      return sum;
+    }));
+  }
+  int total = 0;
+  for (auto &task : outer) {
+    total += task.get();
+  }
+  EXPECT_EQ(total, 31 * 32 / 2);
+}
+
+/* The tasks that have to run together all get a thread of the unlimited pool. */
+TEST(Executor, Unlimited) {
+  ThreadPool pool("test-unlimited", 0);
+  constexpr int kTasks = 20;
+  std::mutex mutex;
+  std::condition_variable cv;
+  int arrived = 0;
+  std::vector<std::future<void>> tasks;
+  for (int i = 0; i < kTasks; ++i) {
+    tasks.push_back(pool.submit([&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      ++arrived;
+      cv.notify_all();
+      cv.wait(lock, [&arrived]() { return arrived == kTasks; });
+    }));
+  }
+  for (auto &task : tasks) {
+    EXPECT_EQ(task.wait_for(std::chrono::seconds(60)), std::future_status::ready);
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -1,5 +1,6 @@
 #include "utilities/flow_control.h"
 
+#include <algorithm>
 #include <cassert>
 
 namespace api {
@@ -8,41 +9,58 @@ bool FlowControlToken::IsValid() const { return sentinel_ == SENTINEL; }
 
 bool FlowControlToken::setPause(bool set_paused) {
   assert(IsValid());
-  {
-    std::lock_guard<std::mutex> lock(m_);
-    if (set_paused && state_ == State::kRunning) {
-      state_ = State::kPaused;
-    } else if (!set_paused && state_ == State::kPaused) {
-      state_ = State::kRunning;
-    } else {
-      return false;
-    }
+  State expected = set_paused ? State::kRunning : State::kPaused;
+  if (!state_.compare_exchange_strong(expected, set_paused ? State::kPaused : State::kRunning)) {
+    return false;
   }
-  cv_.notify_all();
+  notify();
   return true;
 }
 
 bool FlowControlToken::setAbort() {
   assert(IsValid());
-
-  {
-    std::lock_guard<std::mutex> g(m_);
-    if (state_ == State::kAborted) {
-      return false;
-    }
-    state_ = State::kAborted;
+  if (state_.exchange(State::kAborted) == State::kAborted) {
+    return false;
   }
-  cv_.notify_all();
+  notify();
   return true;
 }
 
+bool FlowControlToken::beforeDeadline() const {
+  const Rep deadline = deadline_.load();
+  return deadline == kNoDeadline || std::chrono::steady_clock::now().time_since_epoch().count() < deadline;
+}
+
 bool FlowControlToken::canContinue(bool blocking) const {
   assert(IsValid());
+  if (blocking && state_.load() == State::kPaused) {
+    std::unique_lock<std::mutex> lk(m_);
+    // Waiting until time_point::max() overflows. A new deadline wakes the task
+    // up to wait until that one.
+    while (state_.load() == State::kPaused) {
+      const Rep deadline = deadline_.load();
+      if (deadline == kNoDeadline) {
+        cv_.wait(lk);
+        continue;
+      }
+      const std::chrono::steady_clock::time_point until{std::chrono::steady_clock::duration(deadline)};
+      if (cv_.wait_until(lk, until) == std::cv_status::timeout && deadline_.load() == deadline) {
+        break;
+      }
+    }
+  }
+  return state_.load() == State::kRunning && beforeDeadline();
+}
+
+bool FlowControlToken::sleepFor(std::chrono::milliseconds duration) const {
+  assert(IsValid());
+  const auto until = std::chrono::steady_clock::now() + duration;
   std::unique_lock<std::mutex> lk(m_);
-  if (blocking) {
-    cv_.wait(lk, [this] { return state_ != State::kPaused; });
+  while (canContinue(false) && std::chrono::steady_clock::now() < until) {
+    // Woken up by a change, the deadline is looked at again
+    cv_.wait_until(lk, std::min(until, deadline()));
   }
-  return state_ == State::kRunning;
+  return canContinue(false);
 }
 
 bool FlowControlToken::hasAborted() const {
@@ -50,10 +68,72 @@ bool FlowControlToken::hasAborted() const {
   return !canContinue(false);
 }
 
-void FlowControlToken::reset() {
+bool FlowControlToken::isPaused() const {
+  assert(IsValid());
+  return state_.load() == State::kPaused && beforeDeadline();
+}
+
+int FlowControlToken::addListener(Listener listener) const {
+  assert(IsValid());
+  std::lock_guard<std::mutex> g(listeners_mutex_);
+  const int id = next_listener_++;
+  listeners_.emplace(id, std::move(listener));
+  return id;
+}
+
+void FlowControlToken::removeListener(int id) const {
   assert(IsValid());
+  std::lock_guard<std::mutex> g(listeners_mutex_);
+  listeners_.erase(id);
+}
 
-  std::lock_guard<std::mutex> g(m_);
+void FlowControlToken::notify() {
+  {
+    // A paused task is either waiting already, or sees the new state before
+    // it waits.
+    std::lock_guard<std::mutex> g(m_);
+  }
+  cv_.notify_all();
+  std::lock_guard<std::mutex> g(listeners_mutex_);
+  for (const auto &listener : listeners_) {
+    listener.second();
+  }
+}
+
+void FlowControlToken::setDeadline(std::chrono::steady_clock::time_point deadline) {
+  assert(IsValid());
+  deadline_ = deadline.time_since_epoch().count();
+  // The paused tasks wait until the new deadline
+  notify();
+}
+
+std::chrono::steady_clock::time_point FlowControlToken::deadline() const {
+  assert(IsValid());
+  return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(deadline_.load()));
+}
+
+bool FlowControlToken::deadlineExpired() const {
+  assert(IsValid());
+  return state_.load() != State::kAborted && !beforeDeadline();
+}
+
+void FlowControlToken::reset() {
+  assert(IsValid());
   state_ = State::kRunning;
+  deadline_ = kNoDeadline;
+  notify();
+}
+
+DeadlineScope::DeadlineScope(FlowControlToken* token, std::chrono::milliseconds budget)
+    : token_{token}, previous_{token != nullptr ? token->deadline() : std::chrono::steady_clock::time_point::max()} {
+  if (token_ != nullptr && budget.count() > 0) {
+    token_->setDeadline(std::min(previous_, std::chrono::steady_clock::now() + budget));
+  }
+}
+
+DeadlineScope::~DeadlineScope() {
+  if (token_ != nullptr) {
+    token_->setDeadline(previous_);
+  }
 }
 }  // namespace api
\ No newline at end of file
@@ -1,7 +1,12 @@
 #ifndef AKTUALIZR_FLOW_CONTROL_H
 #define AKTUALIZR_FLOW_CONTROL_H
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <mutex>
 
 namespace api {
@@ -9,6 +14,12 @@ namespace api {
 ///
 /// Provides a thread-safe way to pause and terminate task execution.
 /// A task must call canContinue() method to check the current state.
+/// A task with a deadline is aborted once it has passed.
+///
+/// The state is kept in atomics, so that the checks of the controlled thread
+/// never take a lock. Only a paused task waiting to go on does, and it is
+/// woken up as soon as the state changes. Tasks that can't wait on the token,
+/// like event loops, are told of the changes by a listener.
 ///
 class FlowControlToken {
  public:
@@ -46,25 +57,95 @@ class FlowControlToken {
   ///
   bool canContinue(bool blocking = true) const;
 
+  ///
+  /// Called by the controlled thread to sleep, between retries for instance.
+  /// Returns early as soon as the task is paused, aborted or past its deadline.
+  /// @return the same as `canContinue(false)`
+  ///
+  bool sleepFor(std::chrono::milliseconds duration) const;
+
   ///
   /// \return true if the operation has aborted and we should stop trying to make progress and start aborting
   bool hasAborted() const;
 
+  ///
+  /// \return true if the task is paused, and neither aborted nor past its deadline
+  bool isPaused() const;
+
+  using Listener = std::function<void()>;
+  ///
+  /// Called by the controlled thread to be told of each change of the state
+  /// or deadline. The listener is called on the controlling thread, and must
+  /// neither block nor add or remove listeners. The passing of the deadline
+  /// is no change.
+  /// @return the id to remove the listener with
+  ///
+  int addListener(Listener listener) const;
+
+  ///
+  /// Once this returns, the listener is not called anymore.
+  ///
+  void removeListener(int id) const;
+
+  ///
+  /// Called by the controlling thread to abort the task at the given time,
+  /// unless it is done by then. A paused task is woken up at the deadline.
+  /// `time_point::max()` removes the deadline.
+  ///
+  void setDeadline(std::chrono::steady_clock::time_point deadline);
+  std::chrono::steady_clock::time_point deadline() const;
+
+  ///
+  /// \return true if the task was stopped by its deadline rather than aborted
+  bool deadlineExpired() const;
+
   ////
-  //// Sets token to the initial state
+  //// Sets token to the initial state, without a deadline
   ////
   void reset();
 
  private:
-  static const uint32_t SENTINEL = 0xced53470;
-  const uint32_t sentinel_{SENTINEL};
   enum class State {
     kRunning,  // transitions: ->Paused, ->Aborted
     kPaused,   // transitions: ->Running, ->Aborted
     kAborted   // transitions: none
-  } state_{State::kRunning};
+  };
+  using Rep = std::chrono::steady_clock::rep;
+  static constexpr Rep kNoDeadline = std::chrono::steady_clock::time_point::max().time_since_epoch().count();
+
+  bool beforeDeadline() const;
+  // Wake up the paused tasks and tell the listeners
+  void notify();
+
+  static const uint32_t SENTINEL = 0xced53470;
+  const uint32_t sentinel_{SENTINEL};
+  std::atomic<State> state_{State::kRunning};
+  std::atomic<Rep> deadline_{kNoDeadline};
+  // Only for the paused tasks to wait on
   mutable std::mutex m_;
   mutable std::condition_variable cv_;
+  mutable std::mutex listeners_mutex_;
+  mutable std::map<int, Listener> listeners_;
+  mutable int next_listener_{0};
+};
+
+///
+/// Narrows the deadline of a token to a budget for a part of a task, and puts
+/// the previous deadline back at the end of the scope. A zero budget leaves the
+/// deadline as it is.
+///
+class DeadlineScope {
+ public:
+  DeadlineScope(FlowControlToken* token, std::chrono::milliseconds budget);
+  ~DeadlineScope();
+  DeadlineScope(const DeadlineScope&) = delete;
+  DeadlineScope& operator=(const DeadlineScope&) = delete;
+  DeadlineScope(DeadlineScope&&) = delete;
+  DeadlineScope& operator=(DeadlineScope&&) = delete;
+
+ private:
+  FlowControlToken* token_;
+  std::chrono::steady_clock::time_point previous_;
 };
 
 }  // namespace api
@@ -0,0 +1,469 @@
+#include "utilities/io_uring.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "logging/logging.h"
+
+namespace {
+
+// Alignment of the buffers, which also suits direct I/O
+constexpr size_t kAlignment = 4096;
+
+int ioUringSetup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+  return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+  return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T *ringField(void *ring, uint32_t offset) {
+  return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+}
+
+// IORING_OP_READ and IORING_OP_WRITE came with the probe, in 5.6.
+bool supportsReadWrite(int fd) {
+  std::vector<char> probe_buffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+  auto *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.data());
+  if (ioUringRegister(fd, IORING_REGISTER_PROBE, probe, 256) != 0) {
+    return false;
+  }
+  for (const auto op : {IORING_OP_READ, IORING_OP_WRITE}) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-constant-array-index)
+    if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::unique_ptr<uint8_t, decltype(&free)> allocateBlocks(size_t count) {
+  void *data = nullptr;
+  if (posix_memalign(&data, kAlignment, count * IoUring::kBlockSize) != 0) {
+    throw std::bad_alloc();
+  }
+  return {static_cast<uint8_t *>(data), &free};
+}
+
+std::vector<iovec> blockBuffers(uint8_t *data, size_t count) {
+  std::vector<iovec> buffers(count);
+  for (size_t i = 0; i < count; ++i) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    buffers[i] = {data + i * IoUring::kBlockSize, IoUring::kBlockSize};
+  }
+  return buffers;
+}
+
+// A request that failed but can be tried again as it is
+bool transient(int result) { return result == -EINTR || result == -EAGAIN; }
+
+}  // namespace
+
+std::unique_ptr<IoUring> IoUring::create(unsigned queue_depth) {
+  std::unique_ptr<IoUring> ring(new IoUring());
+  io_uring_params params{};
+  ring->fd_ = ioUringSetup(std::max(queue_depth, 1U), &params);
+  if (ring->fd_ < 0) {
+    LOG_DEBUG << "io_uring is not available: " << std::strerror(errno);
+    return nullptr;
+  }
+  if (!supportsReadWrite(ring->fd_)) {
+    LOG_DEBUG << "io_uring doesn't support plain reads and writes";
+    return nullptr;
+  }
+  ring->depth_ = params.sq_entries;
+
+  ring->sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_ring_size_ = std::max(ring->sq_ring_size_, ring->cq_ring_size_);
+  }
+  void *sq_ring = mmap(nullptr, ring->sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_,
+                       IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    LOG_DEBUG << "Could not map the io_uring submission queue: " << std::strerror(errno);
+    return nullptr;
+  }
+  ring->sq_ring_ = sq_ring;
+  if (single_mmap) {
+    ring->cq_ring_ = ring->sq_ring_;
+  } else {
+    void *cq_ring = mmap(nullptr, ring->cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_,
+                         IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) {
+      LOG_DEBUG << "Could not map the io_uring completion queue: " << std::strerror(errno);
+      return nullptr;
+    }
+    ring->cq_ring_ = cq_ring;
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void *sqes =
+      mmap(nullptr, ring->sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    LOG_DEBUG << "Could not map the io_uring submission entries: " << std::strerror(errno);
+    return nullptr;
+  }
+  ring->sqes_ = sqes;
+
+  ring->sq_tail_ = ringField<unsigned>(ring->sq_ring_, params.sq_off.tail);
+  ring->sq_mask_ = ringField<unsigned>(ring->sq_ring_, params.sq_off.ring_mask);
+  ring->sq_array_ = ringField<unsigned>(ring->sq_ring_, params.sq_off.array);
+  ring->cq_head_ = ringField<unsigned>(ring->cq_ring_, params.cq_off.head);
+  ring->cq_tail_ = ringField<unsigned>(ring->cq_ring_, params.cq_off.tail);
+  ring->cq_mask_ = ringField<unsigned>(ring->cq_ring_, params.cq_off.ring_mask);
+  ring->cqes_ = ringField<void>(ring->cq_ring_, params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  // The kernel would otherwise go on with them after the buffers are gone.
+  while (in_flight_ > queued_ && complete([](uint64_t, int) {})) {
+  }
+  if (sqes_ != nullptr) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) {
+    munmap(sq_ring_, sq_ring_size_);
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+bool IoUring::registerBuffers(const std::vector<iovec> &buffers) {
+  if (ioUringRegister(fd_, IORING_REGISTER_BUFFERS, buffers.data(), static_cast<unsigned>(buffers.size())) != 0) {
+    LOG_DEBUG << "Could not register the io_uring buffers: " << std::strerror(errno);
+    return false;
+  }
+  registered_ = buffers;
+  return true;
+}
+
+int IoUring::registeredBuffer(const uint8_t *data, size_t size) const {
+  for (size_t i = 0; i < registered_.size(); ++i) {
+    const auto *base = static_cast<const uint8_t *>(registered_[i].iov_base);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    if (data >= base && data + size <= base + registered_[i].iov_len) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+void IoUring::queue(bool write, int fd, const uint8_t *data, size_t size, uint64_t offset, uint64_t tag) {
+  if (in_flight_ >= depth_) {
+    throw std::logic_error("More io_uring requests than the queue depth");
+  }
+  const unsigned tail = *sq_tail_;
+  const unsigned index = tail & *sq_mask_;
+  auto *sqe = static_cast<io_uring_sqe *>(sqes_) + index;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  std::memset(sqe, 0, sizeof(*sqe));
+  const int buffer = registeredBuffer(data, size);
+  if (buffer >= 0) {
+    sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+    sqe->buf_index = static_cast<uint16_t>(buffer);
+  } else {
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+  }
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uintptr_t>(data);
+  sqe->len = static_cast<uint32_t>(size);
+  sqe->off = offset;
+  sqe->user_data = tag;
+  sq_array_[index] = index;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  ++queued_;
+  ++in_flight_;
+}
+
+bool IoUring::submit() {
+  while (queued_ > 0) {
+    const int submitted = ioUringEnter(fd_, queued_, 0, 0);
+    if (submitted < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // The kernel hasn't taken them, so they are forgotten.
+      const int error = errno;
+      __atomic_store_n(sq_tail_, *sq_tail_ - queued_, __ATOMIC_RELEASE);
+      in_flight_ -= queued_;
+      queued_ = 0;
+      errno = error;
+      return false;
+    }
+    queued_ -= static_cast<unsigned>(submitted);
+  }
+  return true;
+}
+
+bool IoUring::complete(const std::function<void(uint64_t tag, int result)> &done) {
+  for (;;) {
+    unsigned head = *cq_head_;
+    const unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    if (head != tail) {
+      while (head != tail) {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+        const io_uring_cqe cqe = static_cast<const io_uring_cqe *>(cqes_)[head & *cq_mask_];
+        __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+        --in_flight_;
+        done(cqe.user_data, cqe.res);
+      }
+      return true;
+    }
+    if (ioUringEnter(fd_, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      return false;
+    }
+  }
+}
+
+bool IoUring::writeAll(int fd, const uint8_t *data, size_t size, uint64_t offset) {
+  struct Block {
+    const uint8_t *data;
+    size_t size;
+    uint64_t offset;
+  };
+  std::vector<Block> blocks;
+  for (size_t start = 0; start < size; start += kBlockSize) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    blocks.push_back({data + start, std::min(kBlockSize, size - start), offset + start});
+  }
+  size_t next = 0;
+  int error = 0;
+  const auto done = [this, fd, &blocks, &error](uint64_t tag, int result) {
+    Block &block = blocks[tag];
+    if (result < 0 && !transient(result)) {
+      error = -result;
+    } else if (result == 0) {
+      error = EIO;
+    }
+    if (result > 0) {
+      // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+      block.data += result;
+      block.size -= static_cast<size_t>(result);
+      block.offset += static_cast<uint64_t>(result);
+    }
+    if (error == 0 && block.size > 0) {
+      queue(true, fd, block.data, block.size, block.offset, tag);
+    }
+  };
+  while (in_flight_ > 0 || (error == 0 && next < blocks.size())) {
+    while (error == 0 && next < blocks.size() && in_flight_ < depth_) {
+      queue(true, fd, blocks[next].data, blocks[next].size, blocks[next].offset, next);
+      ++next;
+    }
+    if (!submit() && error == 0) {
+      error = errno;
+    }
+    if (in_flight_ > 0 && !complete(done)) {
+      error = errno;
+      break;
+    }
+  }
+  if (error != 0) {
+    errno = error;
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<UringFileReader> UringFileReader::open(const std::string &path, uint64_t offset,
+                                                       unsigned queue_depth) {
+  auto ring = IoUring::create(queue_depth);
+  if (ring == nullptr) {
+    return nullptr;
+  }
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  std::unique_ptr<UringFileReader> reader(new UringFileReader(fd, std::move(ring)));
+  for (size_t i = 0; i < reader->blocks_.size(); ++i) {
+    reader->readBlock(i, offset + i * IoUring::kBlockSize);
+  }
+  reader->next_offset_ = offset + reader->blocks_.size() * IoUring::kBlockSize;
+  if (!reader->ring_->submit()) {
+    reader->error_ = errno;
+  }
+  return reader;
+}
+
+UringFileReader::UringFileReader(int fd, std::unique_ptr<IoUring> ring)
+    : fd_{fd}, buffer_{allocateBlocks(ring->queueDepth())}, blocks_(ring->queueDepth()), ring_{std::move(ring)} {
+  ring_->registerBuffers(blockBuffers(buffer_.get(), blocks_.size()));
+}
+
+UringFileReader::~UringFileReader() {
+  ring_.reset();
+  close(fd_);
+}
+
+void UringFileReader::readBlock(size_t index, uint64_t offset) {
+  Block &block = blocks_[index];
+  block.offset = offset;
+  block.filled = 0;
+  block.reading = true;
+  ring_->queue(false, fd_, blockData(index), IoUring::kBlockSize, offset, index);
+}
+
+void UringFileReader::completed(uint64_t tag, int result) {
+  Block &block = blocks_[tag];
+  if (result > 0) {
+    block.filled += static_cast<size_t>(result);
+  } else if (result < 0 && !transient(result)) {
+    error_ = -result;
+  }
+  // Until the end of the file, which a read of nothing tells
+  if (error_ == 0 && result != 0 && block.filled < IoUring::kBlockSize) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    ring_->queue(false, fd_, blockData(tag) + block.filled, IoUring::kBlockSize - block.filled,
+                 block.offset + block.filled, tag);
+  } else {
+    block.reading = false;
+  }
+}
+
+ssize_t UringFileReader::read(uint8_t *data, size_t size) {
+  Block &block = blocks_[head_];
+  while (error_ == 0 && block.reading) {
+    if (!ring_->complete([this](uint64_t tag, int result) { completed(tag, result); }) || !ring_->submit()) {
+      error_ = errno;
+    }
+  }
+  if (error_ != 0) {
+    errno = error_;
+    return -1;
+  }
+  const size_t copied = std::min(size, block.filled - head_pos_);
+  // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  std::copy_n(blockData(head_) + head_pos_, copied, data);
+  head_pos_ += copied;
+  if (head_pos_ == IoUring::kBlockSize) {
+    // Read the block after the last one into this one
+    readBlock(head_, next_offset_);
+    next_offset_ += IoUring::kBlockSize;
+    if (!ring_->submit()) {
+      error_ = errno;
+    }
+    head_ = (head_ + 1) % blocks_.size();
+    head_pos_ = 0;
+  }
+  return static_cast<ssize_t>(copied);
+}
+
+std::unique_ptr<UringFileWriter> UringFileWriter::open(const std::string &path, uint64_t offset,
+                                                       unsigned queue_depth) {
+  auto ring = IoUring::create(queue_depth);
+  if (ring == nullptr) {
+    return nullptr;
+  }
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+  if (fd < 0) {
+    return nullptr;
+  }
+  return std::unique_ptr<UringFileWriter>(new UringFileWriter(fd, offset, std::move(ring)));
+}
+
+UringFileWriter::UringFileWriter(int fd, uint64_t offset, std::unique_ptr<IoUring> ring)
+    : fd_{fd},
+      buffer_{allocateBlocks(ring->queueDepth())},
+      blocks_(ring->queueDepth()),
+      ring_{std::move(ring)},
+      offset_{offset} {
+  ring_->registerBuffers(blockBuffers(buffer_.get(), blocks_.size()));
+}
+
+UringFileWriter::~UringFileWriter() {
+  flush();
+  ring_.reset();
+  close(fd_);
+}
+
+void UringFileWriter::writeBlock(size_t index) {
+  Block &block = blocks_[index];
+  block.offset = offset_;
+  block.size = filled_;
+  block.written = 0;
+  block.writing = true;
+  ring_->queue(true, fd_, blockData(index), block.size, block.offset, index);
+  if (!ring_->submit()) {
+    error_ = errno;
+    block.writing = false;
+  }
+  offset_ += filled_;
+  filled_ = 0;
+  current_ = (current_ + 1) % blocks_.size();
+}
+
+void UringFileWriter::completed(uint64_t tag, int result) {
+  Block &block = blocks_[tag];
+  if (result < 0 && !transient(result)) {
+    error_ = -result;
+  } else if (result == 0) {
+    error_ = EIO;
+  } else if (result > 0) {
+    block.written += static_cast<size_t>(result);
+  }
+  if (error_ == 0 && block.written < block.size) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    ring_->queue(true, fd_, blockData(tag) + block.written, block.size - block.written, block.offset + block.written,
+                 tag);
+  } else {
+    block.writing = false;
+  }
+}
+
+bool UringFileWriter::write(const uint8_t *data, size_t size) {
+  const auto done = [this](uint64_t tag, int result) { completed(tag, result); };
+  while (error_ == 0 && size > 0) {
+    while (error_ == 0 && blocks_[current_].writing) {
+      if (!ring_->complete(done) || !ring_->submit()) {
+        error_ = errno;
+      }
+    }
+    if (error_ != 0) {
+      break;
+    }
+    const size_t copied = std::min(size, IoUring::kBlockSize - filled_);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    std::copy_n(data, copied, blockData(current_) + filled_);
+    filled_ += copied;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+    data += copied;
+    size -= copied;
+    if (filled_ == IoUring::kBlockSize) {
+      writeBlock(current_);
+    }
+  }
+  return error_ == 0;
+}
+
+bool UringFileWriter::flush() {
+  if (error_ == 0 && filled_ > 0) {
+    writeBlock(current_);
+  }
+  while (ring_->inFlight() > 0) {
+    if (!ring_->complete([this](uint64_t tag, int result) { completed(tag, result); }) || !ring_->submit()) {
+      error_ = errno;
+      break;
+    }
+  }
+  return error_ == 0;
+}
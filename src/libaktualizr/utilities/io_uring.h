@@ -0,0 +1,166 @@
+#ifndef UTILITIES_IO_URING_H_
+#define UTILITIES_IO_URING_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * A minimal io_uring for large sequential file reads and writes: up to queue
+ * depth requests are in flight at once, so that a single thread keeps the
+ * storage busy while it waits for few system calls. The ring is set up with
+ * the raw system calls, without liburing, and is only used by one thread at a
+ * time.
+ */
+class IoUring {
+ public:
+  /** Size of the requests that reads and writes are split into */
+  static constexpr size_t kBlockSize = 256 * 1024;
+
+  /** A ring of queue_depth entries, nullptr where the kernel doesn't provide io_uring (before 5.6). */
+  static std::unique_ptr<IoUring> create(unsigned queue_depth);
+  /** Waits for the requests in flight. */
+  ~IoUring();
+  IoUring(const IoUring &) = delete;
+  IoUring(IoUring &&) = delete;
+  IoUring &operator=(const IoUring &) = delete;
+  IoUring &operator=(IoUring &&) = delete;
+
+  unsigned queueDepth() const { return depth_; }
+  unsigned inFlight() const { return in_flight_; }
+
+  /**
+   * Register buffers, which the kernel then maps once instead of for each
+   * request on them.
+   * @return false if it can't, e.g. over RLIMIT_MEMLOCK; they are used unregistered then
+   */
+  bool registerBuffers(const std::vector<iovec> &buffers);
+  /** Write all of size bytes at offset, queue depth blocks at a time. Sets errno on failure. */
+  bool writeAll(int fd, const uint8_t *data, size_t size, uint64_t offset);
+
+  /** Queue a read into or a write from data for submit(), with no more than queue depth in flight. */
+  void queue(bool write, int fd, const uint8_t *data, size_t size, uint64_t offset, uint64_t tag);
+  /** Hand the queued requests to the kernel. Sets errno on failure, with nothing queued any more. */
+  bool submit();
+  /**
+   * Wait for requests to complete, and call done with the tag of each one
+   * and its result: the bytes read or written, or -errno.
+   */
+  bool complete(const std::function<void(uint64_t tag, int result)> &done);
+
+ private:
+  IoUring() = default;
+  int registeredBuffer(const uint8_t *data, size_t size) const;
+
+  int fd_{-1};
+  unsigned depth_{0};
+  unsigned queued_{0};
+  unsigned in_flight_{0};
+  void *sq_ring_{nullptr};
+  size_t sq_ring_size_{0};
+  void *cq_ring_{nullptr};
+  size_t cq_ring_size_{0};
+  void *sqes_{nullptr};
+  size_t sqes_size_{0};
+  unsigned *sq_tail_{nullptr};
+  unsigned *sq_mask_{nullptr};
+  unsigned *sq_array_{nullptr};
+  unsigned *cq_head_{nullptr};
+  unsigned *cq_tail_{nullptr};
+  unsigned *cq_mask_{nullptr};
+  void *cqes_{nullptr};
+  std::vector<iovec> registered_;
+};
+
+/** Reads a file from an offset to its end, with the next blocks being read meanwhile. */
+class UringFileReader {
+ public:
+  /** nullptr if the file can't be opened or io_uring is not available. */
+  static std::unique_ptr<UringFileReader> open(const std::string &path, uint64_t offset, unsigned queue_depth);
+  ~UringFileReader();
+  UringFileReader(const UringFileReader &) = delete;
+  UringFileReader(UringFileReader &&) = delete;
+  UringFileReader &operator=(const UringFileReader &) = delete;
+  UringFileReader &operator=(UringFileReader &&) = delete;
+
+  /** Read up to size bytes; 0 at the end of the file, -1 with errno set on failure. */
+  ssize_t read(uint8_t *data, size_t size);
+
+ private:
+  struct Block {
+    uint64_t offset{0};
+    size_t filled{0};
+    bool reading{false};
+  };
+
+  UringFileReader(int fd, std::unique_ptr<IoUring> ring);
+  void readBlock(size_t index, uint64_t offset);
+  void completed(uint64_t tag, int result);
+  uint8_t *blockData(size_t index) const {
+    return buffer_.get() + index * IoUring::kBlockSize;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+
+  int fd_;
+  // Declared before the ring, which is gone by the time it is freed
+  std::unique_ptr<uint8_t, decltype(&free)> buffer_{nullptr, &free};
+  std::vector<Block> blocks_;
+  std::unique_ptr<IoUring> ring_;
+  // blocks_[head_] has the data that comes next, from head_pos_ on
+  size_t head_{0};
+  size_t head_pos_{0};
+  uint64_t next_offset_{0};
+  int error_{0};
+};
+
+/** Writes consecutive data to a file from an offset, the blocks filled being written meanwhile. */
+class UringFileWriter {
+ public:
+  /** nullptr if the file can't be opened or io_uring is not available. */
+  static std::unique_ptr<UringFileWriter> open(const std::string &path, uint64_t offset, unsigned queue_depth);
+  /** Writes the data added so far. */
+  ~UringFileWriter();
+  UringFileWriter(const UringFileWriter &) = delete;
+  UringFileWriter(UringFileWriter &&) = delete;
+  UringFileWriter &operator=(const UringFileWriter &) = delete;
+  UringFileWriter &operator=(UringFileWriter &&) = delete;
+
+  /** Add data to write. Only waits for the storage when all the blocks are in flight. */
+  bool write(const uint8_t *data, size_t size);
+  /** Write the data added so far, and wait for it. */
+  bool flush();
+  bool good() const { return error_ == 0; }
+  /** errno of the first failure, 0 if none */
+  int error() const { return error_; }
+
+ private:
+  struct Block {
+    uint64_t offset{0};
+    size_t size{0};
+    size_t written{0};
+    bool writing{false};
+  };
+
+  UringFileWriter(int fd, uint64_t offset, std::unique_ptr<IoUring> ring);
+  void writeBlock(size_t index);
+  void completed(uint64_t tag, int result);
+  uint8_t *blockData(size_t index) const {
+    return buffer_.get() + index * IoUring::kBlockSize;  // NOLINT(cppcoreguidelines-pro-bounds-pointer-arithmetic)
+  }
+
+  int fd_;
+  std::unique_ptr<uint8_t, decltype(&free)> buffer_{nullptr, &free};
+  std::vector<Block> blocks_;
+  std::unique_ptr<IoUring> ring_;
+  // blocks_[current_] is being filled, with data for offset_ on
+  size_t current_{0};
+  size_t filled_{0};
+  uint64_t offset_;
+  int error_{0};
+};
+
+#endif  // UTILITIES_IO_URING_H_
@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "logging/logging.h"
+#include "utilities/io_uring.h"
+#include "utilities/utils.h"
+
+static std::vector<uint8_t> randomData(size_t size) {
+  std::mt19937 gen(static_cast<std::mt19937::result_type>(size));
+  std::uniform_int_distribution<int> byte(0, 255);
+  std::vector<uint8_t> data(size);
+  for (auto &b : data) {
+    b = static_cast<uint8_t>(byte(gen));
+  }
+  return data;
+}
+
+static std::vector<uint8_t> readFile(const boost::filesystem::path &path) {
+  std::ifstream in(path.string(), std::ios::binary);
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static bool available() {
+  if (IoUring::create(4) == nullptr) {
+    LOG_WARNING << "io_uring is not available, skipping the test";
+    return false;
+  }
+  return true;
+}
+
+/* The data written in pieces of any size ends up in the file, after what is kept. */
+TEST(IoUring, Write) {
+  if (!available()) {
+    return;
+  }
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "file";
+  Utils::writeFile(path, std::string("kept"));
+  const auto data = randomData(3 * IoUring::kBlockSize * 4 + 1234);
+  {
+    auto writer = UringFileWriter::open(path.string(), 4, 3);
+    ASSERT_NE(writer, nullptr);
+    for (size_t offset = 0; offset < data.size(); offset += 7777) {
+      ASSERT_TRUE(writer->write(data.data() + offset, std::min<size_t>(7777, data.size() - offset)));
+      if (offset == 7777 * 50) {
+        ASSERT_TRUE(writer->flush());
+      }
+    }
+  }
+  auto expected = std::vector<uint8_t>{'k', 'e', 'p', 't'};
+  expected.insert(expected.end(), data.begin(), data.end());
+  EXPECT_EQ(readFile(path), expected);
+
+  // A whole buffer at once
+  const int fd = open(path.c_str(), O_WRONLY | O_TRUNC | O_CLOEXEC);
+  ASSERT_GE(fd, 0);
+  auto ring = IoUring::create(2);
+  ASSERT_TRUE(ring->writeAll(fd, data.data(), data.size(), 0));
+  close(fd);
+  EXPECT_EQ(readFile(path), data);
+}
+
+/* A file is read from an offset to its end, in pieces of any size. */
+TEST(IoUring, Read) {
+  if (!available()) {
+    return;
+  }
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "file";
+  const auto data = randomData(5 * IoUring::kBlockSize + 99);
+  {
+    std::ofstream out(path.string(), std::ios::binary);
+    out.write(reinterpret_cast<const char *>(data.data()), static_cast<std::streamsize>(data.size()));
+  }
+  for (const uint64_t offset : {uint64_t{0}, uint64_t{12345}, static_cast<uint64_t>(data.size())}) {
+    auto reader = UringFileReader::open(path.string(), offset, 2);
+    ASSERT_NE(reader, nullptr);
+    std::vector<uint8_t> read;
+    std::vector<uint8_t> buf(100000);
+    for (;;) {
+      const ssize_t n = reader->read(buf.data(), buf.size());
+      ASSERT_GE(n, 0);
+      if (n == 0) {
+        break;
+      }
+      read.insert(read.end(), buf.begin(), buf.begin() + n);
+    }
+    EXPECT_EQ(read, std::vector<uint8_t>(data.begin() + static_cast<std::ptrdiff_t>(offset), data.end()));
+  }
+  EXPECT_EQ(UringFileReader::open((temp_dir / "missing").string(), 0, 2), nullptr);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  logger_init();
+  logger_set_threshold(boost::log::trivial::trace);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,264 @@
+#include "utilities/json_parser.h"
+
+#include <cstdint>
+#include <limits>
+
+namespace {
+
+// Deeper documents are left to jsoncpp, which rejects those nested deeper
+// than its stack limit of 1000.
+constexpr int kMaxDepth = 512;
+
+class DirectParser {
+ public:
+  DirectParser(const char *begin, const char *end) : p_{begin}, end_{end} {}
+
+  bool parseDocument(Json::Value *value) {
+    // A byte order mark is skipped by some versions of jsoncpp only.
+    if (p_ < end_ && static_cast<unsigned char>(*p_) == 0xEF) {
+      return false;
+    }
+    skipSpace();
+    if (!parseValue(value, 0)) {
+      return false;
+    }
+    skipSpace();
+    return p_ == end_;
+  }
+
+ private:
+  void skipSpace() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      ++p_;
+    }
+  }
+
+  bool parseValue(Json::Value *value, int depth) {
+    if (p_ >= end_) {
+      return false;
+    }
+    switch (*p_) {
+      case '{':
+        return parseObject(value, depth + 1);
+      case '[':
+        return parseArray(value, depth + 1);
+      case '"':
+        return parseString(value);
+      case 't':
+        return parseLiteral("true", Json::Value(true), value);
+      case 'f':
+        return parseLiteral("false", Json::Value(false), value);
+      case 'n':
+        return parseLiteral("null", Json::Value(), value);
+      default:
+        return parseNumber(value);
+    }
+  }
+
+  bool parseObject(Json::Value *value, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    *value = Json::Value(Json::objectValue);
+    ++p_;
+    skipSpace();
+    if (p_ < end_ && *p_ == '}') {
+      ++p_;
+      return true;
+    }
+    for (;;) {
+      const char *key_begin = nullptr;
+      const char *key_end = nullptr;
+      if (p_ >= end_ || *p_ != '"' || !scanString(&key_begin, &key_end)) {
+        return false;
+      }
+      // Later duplicates replace earlier ones, as in jsoncpp.
+      Json::Value *member = value->demand(key_begin, key_end);
+      skipSpace();
+      if (p_ >= end_ || *p_ != ':') {
+        return false;
+      }
+      ++p_;
+      skipSpace();
+      if (!parseValue(member, depth)) {
+        return false;
+      }
+      skipSpace();
+      if (p_ < end_ && *p_ == '}') {
+        ++p_;
+        return true;
+      }
+      if (p_ >= end_ || *p_ != ',') {
+        return false;
+      }
+      ++p_;
+      skipSpace();
+    }
+  }
+
+  bool parseArray(Json::Value *value, int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    *value = Json::Value(Json::arrayValue);
+    ++p_;
+    skipSpace();
+    if (p_ < end_ && *p_ == ']') {
+      ++p_;
+      return true;
+    }
+    for (Json::ArrayIndex index = 0;; ++index) {
+      if (!parseValue(&(*value)[index], depth)) {
+        return false;
+      }
+      skipSpace();
+      if (p_ < end_ && *p_ == ']') {
+        ++p_;
+        return true;
+      }
+      if (p_ >= end_ || *p_ != ',') {
+        return false;
+      }
+      ++p_;
+      skipSpace();
+    }
+  }
+
+  bool parseString(Json::Value *value) {
+    const char *begin = nullptr;
+    const char *end = nullptr;
+    if (!scanString(&begin, &end)) {
+      return false;
+    }
+    *value = Json::Value(begin, end);
+    return true;
+  }
+
+  // p_ is at the opening quote. The content is given in place if it has no
+  // escapes, decoded in buffer_ otherwise, until the next string.
+  bool scanString(const char **begin, const char **end) {
+    const char *start = ++p_;
+    while (p_ < end_ && *p_ != '"' && *p_ != '\\') {
+      ++p_;
+    }
+    if (p_ >= end_) {
+      return false;
+    }
+    if (*p_ == '"') {
+      *begin = start;
+      *end = p_++;
+      return true;
+    }
+    buffer_.assign(start, p_);
+    while (p_ < end_) {
+      const char c = *p_++;
+      if (c == '"') {
+        *begin = buffer_.data();
+        *end = buffer_.data() + buffer_.size();
+        return true;
+      }
+      if (c != '\\') {
+        buffer_.push_back(c);
+        continue;
+      }
+      if (p_ >= end_) {
+        return false;
+      }
+      switch (*p_++) {
+        case '"':
+          buffer_.push_back('"');
+          break;
+        case '\\':
+          buffer_.push_back('\\');
+          break;
+        case '/':
+          buffer_.push_back('/');
+          break;
+        case 'b':
+          buffer_.push_back('\b');
+          break;
+        case 'f':
+          buffer_.push_back('\f');
+          break;
+        case 'n':
+          buffer_.push_back('\n');
+          break;
+        case 'r':
+          buffer_.push_back('\r');
+          break;
+        case 't':
+          buffer_.push_back('\t');
+          break;
+        default:
+          // \u escapes, with their surrogate pairs, are left to jsoncpp.
+          return false;
+      }
+    }
+    return false;
+  }
+
+  bool parseLiteral(const std::string &literal, Json::Value literal_value, Json::Value *value) {
+    if (static_cast<size_t>(end_ - p_) < literal.size() || literal.compare(0, literal.size(), p_, literal.size()) != 0) {
+      return false;
+    }
+    p_ += literal.size();
+    *value = std::move(literal_value);
+    return true;
+  }
+
+  // Integers are typed as jsoncpp types them: negative ones and those up to
+  // the largest Int64 as Int64, larger ones as UInt64. Those out of range are
+  // reals for jsoncpp, and left to it with the other reals.
+  bool parseNumber(Json::Value *value) {
+    const bool negative = *p_ == '-';
+    if (negative) {
+      ++p_;
+    }
+    const uint64_t limit = negative ? static_cast<uint64_t>(std::numeric_limits<int64_t>::max()) + 1
+                                    : std::numeric_limits<uint64_t>::max();
+    const char *digits = p_;
+    uint64_t magnitude = 0;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      const auto digit = static_cast<uint64_t>(*p_ - '0');
+      if (magnitude > (limit - digit) / 10) {
+        return false;
+      }
+      magnitude = magnitude * 10 + digit;
+      ++p_;
+    }
+    if (p_ == digits || (*digits == '0' && p_ - digits > 1) ||
+        (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E'))) {
+      return false;
+    }
+    if (negative) {
+      *value = Json::Value(magnitude == limit ? std::numeric_limits<Json::Int64>::min()
+                                              : -static_cast<Json::Int64>(magnitude));
+    } else if (magnitude <= static_cast<uint64_t>(std::numeric_limits<Json::Int64>::max())) {
+      *value = Json::Value(static_cast<Json::Int64>(magnitude));
+    } else {
+      *value = Json::Value(static_cast<Json::UInt64>(magnitude));
+    }
+    return true;
+  }
+
+  const char *p_;
+  const char *const end_;
+  std::string buffer_;
+};
+
+}  // namespace
+
+bool JsonParser::parse(const char *begin, const char *end, Json::Value *value) {
+  if (backend_ == Backend::kDirect && parseDirect(begin, end, value)) {
+    return true;
+  }
+  if (!reader_) {
+    reader_.reset(Json::CharReaderBuilder().newCharReader());
+  }
+  *value = Json::Value();
+  return reader_->parse(begin, end, value, nullptr);
+}
+
+bool JsonParser::parseDirect(const char *begin, const char *end, Json::Value *value) {
+  return DirectParser(begin, end).parseDocument(value);
+}
@@ -0,0 +1,52 @@
+#ifndef UTILITIES_JSON_PARSER_H_
+#define UTILITIES_JSON_PARSER_H_
+
+#include <memory>
+#include <string>
+
+#include <json/json.h>
+
+/**
+ * Parse JSON documents into Json::Value the way Utils::parseJSON() always
+ * has, with the default settings of Json::CharReaderBuilder, through one of
+ * several backends that give the same values.
+ *
+ * The direct backend builds the values in a single pass over the document,
+ * without jsoncpp's token stack, copies of the strings or stream of the
+ * numbers. It only takes plain JSON: documents with comments, reals, \u
+ * escapes, leading zeros, trailing commas, a byte order mark, anything after
+ * the root value or any error are handed to jsoncpp, so that the result, and
+ * whether it is valid, is always the same as jsoncpp's.
+ */
+class JsonParser {
+ public:
+  enum class Backend {
+    // Json::CharReader
+    kJsoncpp,
+    // The direct parse, with jsoncpp for what it doesn't take
+    kDirect,
+  };
+
+  explicit JsonParser(Backend backend = Backend::kDirect) : backend_{backend} {}
+
+  /**
+   * Parse the document in [begin, end).
+   * @return whether it is valid; value has what jsoncpp parsed of it otherwise
+   */
+  bool parse(const char *begin, const char *end, Json::Value *value);
+  bool parse(const std::string &document, Json::Value *value) {
+    return parse(document.data(), document.data() + document.size(), value);
+  }
+
+  /**
+   * Parse with the direct backend alone.
+   * @return false if the document is left to jsoncpp, with value unspecified
+   */
+  static bool parseDirect(const char *begin, const char *end, Json::Value *value);
+
+ private:
+  Backend backend_;
+  std::unique_ptr<Json::CharReader> reader_;
+};
+
+#endif  // UTILITIES_JSON_PARSER_H_
@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utilities/json_parser.h"
+#include "utilities/utils.h"
+
+static void expectSameAsJsoncpp(const std::string &document) {
+  Json::Value expected;
+  Json::Value parsed;
+  const bool expected_valid = JsonParser(JsonParser::Backend::kJsoncpp).parse(document, &expected);
+  const bool valid = JsonParser(JsonParser::Backend::kDirect).parse(document, &parsed);
+  EXPECT_EQ(valid, expected_valid) << document;
+  // Also compares the types, so that 1 is not taken for 1u.
+  EXPECT_EQ(parsed, expected) << document;
+  if (valid) {
+    EXPECT_EQ(parsed.toStyledString(), expected.toStyledString()) << document;
+  }
+}
+
+static std::string randomDocument(std::mt19937 &gen, int depth) {
+  static const std::vector<std::string> kStrings = {
+      "", "a", "target", "with space", "esc\\\"aped", "tab\\t", "slash\\/", "uni\\u00e9", "\xc3\xa9"};
+  static const std::vector<std::string> kNumbers = {
+      "0", "-0", "1", "-1", "42", "2147483647", "2147483648", "-2147483649", "4294967296", "9223372036854775807",
+      "9223372036854775808", "-9223372036854775808", "18446744073709551615", "18446744073709551616", "1.5", "1e3"};
+  std::uniform_int_distribution<int> kind(0, depth > 0 ? 6 : 4);
+  auto pick = [&gen](const std::vector<std::string> &from) {
+    return from[std::uniform_int_distribution<size_t>(0, from.size() - 1)(gen)];
+  };
+  switch (kind(gen)) {
+    case 0:
+      return "\"" + pick(kStrings) + "\"";
+    case 1:
+      return pick(kNumbers);
+    case 2:
+      return "true";
+    case 3:
+      return "false";
+    case 4:
+      return "null";
+    case 5: {
+      std::string array = "[";
+      const int count = std::uniform_int_distribution<int>(0, 4)(gen);
+      for (int i = 0; i < count; ++i) {
+        array += (i != 0 ? ", " : " ") + randomDocument(gen, depth - 1);
+      }
+      return array + "]";
+    }
+    default: {
+      std::string object = "{";
+      const int count = std::uniform_int_distribution<int>(0, 4)(gen);
+      for (int i = 0; i < count; ++i) {
+        object += (i != 0 ? ",\n" : "\n") + std::string("\"") + pick(kStrings) + "\": " + randomDocument(gen, depth - 1);
+      }
+      return object + "}";
+    }
+  }
+}
+
+/* The metadata is parsed by the direct backend alone, to the same values as
+ * jsoncpp. */
+TEST(JsonParser, Metadata) {
+  for (const auto &file : {"tests/tuf/sample1/root.json", "tests/tuf/sample1/targets.json",
+                           "tests/tuf/sample1/snapshot.json", "tests/tuf/sample1/timestamp.json"}) {
+    const std::string document = Utils::readFile(file);
+    Json::Value parsed;
+    EXPECT_TRUE(JsonParser::parseDirect(document.data(), document.data() + document.size(), &parsed)) << file;
+    expectSameAsJsoncpp(document);
+  }
+}
+
+/* Values at the edges of what the direct backend takes are the same as
+ * jsoncpp's, whichever backend ends up parsing them. */
+TEST(JsonParser, EdgeCases) {
+  const std::vector<std::string> documents = {
+      // Numbers
+      "0", "-0", "7", "-7", "2147483647", "2147483648", "-2147483648", "-2147483649", "4294967295", "4294967296",
+      "9223372036854775807", "9223372036854775808", "-9223372036854775808", "-9223372036854775809",
+      "18446744073709551615", "18446744073709551616", "99999999999999999999999", "007", "-01", "1.0", "1e2", "-1E-2",
+      "-", "+1", "1x", "[1,-]",
+      // Strings
+      "\"\"", "\"plain\"", R"("\"\\\/\b\f\n\r\t")", R"("Aé😀")", R"("\x")", "\"unterminated",
+      "\"a\\", std::string("\"nul\0byte\"", 10), "\"\xc3\xa9\xe2\x82\xac\"",
+      // Literals
+      "true", "false", "null", "tru", "nul", "True",
+      // Structure
+      "{}", "[]", " { } ", "\t\r\n[\n]\n", R"({"a":1,"a":2})", R"({"a":{"b":[1,{"c":null}]}})", R"([1,2,])",
+      R"({"a":1,})", R"({"a" 1})", R"({a:1})", R"({"a":1 "b":2})", "[1 2]", "{", "[", "]", "}", "", "   ",
+      // Extensions and extra content
+      "// comment\n{}", "/* comment */ [1]", "{} // comment", "\xef\xbb\xbf{}", "{} {}", "{} x", "1 2", "'a'"};
+  for (const auto &document : documents) {
+    expectSameAsJsoncpp(document);
+  }
+}
+
+/* Nesting deeper than the direct backend takes is left to jsoncpp, which
+ * throws beyond its own limit. */
+TEST(JsonParser, Depth) {
+  for (const int depth : {1, 100, 512, 513, 999}) {
+    expectSameAsJsoncpp(std::string(static_cast<size_t>(depth), '[') + std::string(static_cast<size_t>(depth), ']'));
+    std::string objects;
+    for (int i = 0; i < depth; ++i) {
+      objects += "{\"a\":";
+    }
+    expectSameAsJsoncpp(objects + "0" + std::string(static_cast<size_t>(depth), '}'));
+  }
+  const std::string too_deep = std::string(2000, '[') + std::string(2000, ']');
+  Json::Value parsed;
+  EXPECT_THROW(JsonParser(JsonParser::Backend::kJsoncpp).parse(too_deep, &parsed), std::exception);
+  EXPECT_THROW(JsonParser(JsonParser::Backend::kDirect).parse(too_deep, &parsed), std::exception);
+}
+
+/* Random documents, and truncations of them, parse to the same values as with
+ * jsoncpp. */
+TEST(JsonParser, Random) {
+  std::mt19937 gen(42);
+  for (int i = 0; i < 500; ++i) {
+    const std::string document = randomDocument(gen, 5);
+    expectSameAsJsoncpp(document);
+    expectSameAsJsoncpp(document.substr(0, std::uniform_int_distribution<size_t>(0, document.size())(gen)));
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
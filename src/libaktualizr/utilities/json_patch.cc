@@ -0,0 +1,83 @@
+#include "utilities/json_patch.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "utilities/canonical_json.h"
+
+namespace {
+
+Json::Value operation(const char *op, Json::ArrayIndex index, const Json::Value *value) {
+  Json::Value result;
+  result["op"] = op;
+  result["path"] = "/" + std::to_string(index);
+  if (value != nullptr) {
+    result["value"] = *value;
+  }
+  return result;
+}
+
+}  // namespace
+
+Json::Value jsonArrayPatch(const Json::Value &from, const Json::Value &to) {
+  CanonicalJsonWriter writer;
+  std::vector<std::string> from_keys;
+  std::vector<std::string> to_keys;
+  // How many times each element is left in the rest of each array
+  std::map<std::string, int> from_left;
+  std::map<std::string, int> to_left;
+  for (const auto &v : from) {
+    from_keys.push_back(writer.write(v));
+    ++from_left[from_keys.back()];
+  }
+  for (const auto &v : to) {
+    to_keys.push_back(writer.write(v));
+    ++to_left[to_keys.back()];
+  }
+
+  // The patched array is always the first j elements of `to` followed by the
+  // elements of `from` from i on; k is the position of `from[i]` in it.
+  Json::Value patch(Json::arrayValue);
+  Json::ArrayIndex i = 0;
+  Json::ArrayIndex j = 0;
+  Json::ArrayIndex k = 0;
+  while (i < from.size() && j < to.size()) {
+    const std::string &old_key = from_keys[i];
+    const std::string &new_key = to_keys[j];
+    if (old_key == new_key) {
+      --from_left[old_key];
+      --to_left[new_key];
+      ++i;
+      ++j;
+      ++k;
+      continue;
+    }
+    const bool old_kept = to_left[old_key] > 0;
+    const bool new_existed = from_left[new_key] > 0;
+    if (!old_kept && new_existed) {
+      patch.append(operation("remove", k, nullptr));
+      --from_left[old_key];
+      ++i;
+    } else if (old_kept && !new_existed) {
+      patch.append(operation("add", k, &to[j]));
+      --to_left[new_key];
+      ++j;
+      ++k;
+    } else {
+      patch.append(operation("replace", k, &to[j]));
+      --from_left[old_key];
+      --to_left[new_key];
+      ++i;
+      ++j;
+      ++k;
+    }
+  }
+  for (; i < from.size(); ++i) {
+    patch.append(operation("remove", k, nullptr));
+  }
+  for (; j < to.size(); ++j) {
+    patch.append(operation("add", k++, &to[j]));
+  }
+  return patch;
+}
@@ -0,0 +1,17 @@
+#ifndef UTILITIES_JSON_PATCH_H_
+#define UTILITIES_JSON_PATCH_H_
+
+#include <json/json.h>
+
+/**
+ * Compute a JSON Patch (RFC 6902) that turns the array `from` into the array
+ * `to`, with "add", "remove" and "replace" operations on its elements.
+ *
+ * The arrays are walked side by side, so lists that keep their order, such as
+ * the installed packages, give a patch the size of the changes: an element
+ * that changed in place is replaced, elements that were added or removed are
+ * added or removed. Moved elements are removed and added again.
+ */
+Json::Value jsonArrayPatch(const Json::Value &from, const Json::Value &to);
+
+#endif  // UTILITIES_JSON_PATCH_H_
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+#include "utilities/json_patch.h"
+
+// Apply the operations of jsonArrayPatch() as a server would.
+static Json::Value apply(const Json::Value &from, const Json::Value &patch) {
+  std::vector<Json::Value> result(from.begin(), from.end());
+  for (const auto &op : patch) {
+    const auto index = static_cast<size_t>(std::stoul(op["path"].asString().substr(1)));
+    const std::string name = op["op"].asString();
+    if (name == "add") {
+      EXPECT_LE(index, result.size());
+      result.insert(result.begin() + static_cast<std::ptrdiff_t>(index), op["value"]);
+    } else {
+      EXPECT_LT(index, result.size());
+      if (name == "remove") {
+        result.erase(result.begin() + static_cast<std::ptrdiff_t>(index));
+      } else {
+        EXPECT_EQ(name, "replace");
+        result[index] = op["value"];
+      }
+    }
+  }
+  Json::Value array(Json::arrayValue);
+  for (const auto &v : result) {
+    array.append(v);
+  }
+  return array;
+}
+
+static Json::Value package(const std::string &name, const std::string &version) {
+  Json::Value p;
+  p["name"] = name;
+  p["version"] = version;
+  return p;
+}
+
+/* An upgraded package is replaced, added and removed ones are added and removed. */
+TEST(JsonPatch, Packages) {
+  Json::Value from(Json::arrayValue);
+  for (int i = 0; i < 1000; ++i) {
+    from.append(package("package" + std::to_string(i), "1.0"));
+  }
+  Json::Value to = from;
+  to[10] = package("package10", "1.1");
+  Json::Value removed;
+  to.removeIndex(500, &removed);
+  to.append(package("new", "2.0"));
+
+  const Json::Value patch = jsonArrayPatch(from, to);
+  ASSERT_EQ(patch.size(), 3U);
+  EXPECT_EQ(patch[0]["op"], "replace");
+  EXPECT_EQ(patch[0]["path"], "/10");
+  EXPECT_EQ(patch[1]["op"], "remove");
+  EXPECT_EQ(patch[1]["path"], "/500");
+  EXPECT_EQ(patch[2]["op"], "add");
+  EXPECT_EQ(patch[2]["path"], "/999");
+  EXPECT_EQ(apply(from, patch), to);
+
+  EXPECT_EQ(jsonArrayPatch(from, from).size(), 0U);
+}
+
+/* Whatever the changes, the patch gives the new array. */
+TEST(JsonPatch, Random) {
+  std::mt19937 random(1);
+  std::uniform_int_distribution<int> element(0, 9);
+  std::uniform_int_distribution<int> size(0, 20);
+  for (int n = 0; n < 1000; ++n) {
+    Json::Value from(Json::arrayValue);
+    Json::Value to(Json::arrayValue);
+    for (int i = size(random); i > 0; --i) {
+      from.append(element(random));
+    }
+    for (int i = size(random); i > 0; --i) {
+      to.append(element(random));
+    }
+    EXPECT_EQ(apply(from, jsonArrayPatch(from, to)), to);
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,188 @@
+#include "utilities/load_admission.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include "logging/logging.h"
+#include "utilities/background_scheduling.h"
+#include "utilities/metrics.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// PSI averages are updated every 2 s
+constexpr std::chrono::seconds kSampleInterval{1};
+// At the pause threshold, the work sleeps this many times as long as it worked
+constexpr double kMaxSlowdown = 4.0;
+// The time since the previous admit() of the thread counts as no more than this much work
+constexpr std::chrono::seconds kMaxWorked{1};
+
+struct State {
+  std::atomic<bool> enabled{false};
+  std::atomic<double> slow{0};
+  std::atomic<double> pause{0};
+  std::atomic<int64_t> max_pause_sec{0};
+  std::atomic<double> pressure{-1};
+  std::mutex sample_mutex;
+  Clock::time_point sampled;
+};
+
+State &state() {
+  static State instance;
+  return instance;
+}
+
+thread_local Clock::time_point last_admit;
+
+void setPressureMetric(const char *resource, double value) {
+  Metrics::instance()
+      .gauge("aktualizr_system_pressure_percent",
+             "Share of the last 10 s in which some tasks waited for the resource, from PSI", {{"resource", resource}})
+      .set(static_cast<int64_t>(std::lround(value)));
+}
+
+// The latest pressure, sampled again by whichever thread finds it too old
+double samplePressure(State &s) {
+  std::unique_lock<std::mutex> lock(s.sample_mutex, std::try_to_lock);
+  const auto now = Clock::now();
+  if (lock.owns_lock() && now - s.sampled >= kSampleInterval) {
+    s.sampled = now;
+    const LoadAdmission::Pressure pressure = LoadAdmission::Pressure::current();
+    s.pressure.store(pressure.highest(), std::memory_order_relaxed);
+    setPressureMetric("cpu", pressure.cpu);
+    setPressureMetric("io", pressure.io);
+  }
+  return s.pressure.load(std::memory_order_relaxed);
+}
+
+std::string readFile(const char *path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+}  // namespace
+
+LoadAdmission::Pressure LoadAdmission::Pressure::current() {
+  Pressure pressure;
+  pressure.cpu = parse(readFile("/proc/pressure/cpu"));
+  pressure.io = parse(readFile("/proc/pressure/io"));
+  return pressure;
+}
+
+double LoadAdmission::Pressure::parse(const std::string &contents) {
+  // some avg10=1.23 avg60=0.50 avg300=0.10 total=12345
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream fields(line);
+    std::string kind;
+    std::string field;
+    if (!(fields >> kind) || kind != "some") {
+      continue;
+    }
+    while (fields >> field) {
+      if (field.compare(0, 6, "avg10=") == 0) {
+        try {
+          return std::stod(field.substr(6));
+        } catch (const std::exception &) {
+          return -1;
+        }
+      }
+    }
+  }
+  return -1;
+}
+
+void LoadAdmission::configure(const Thresholds &thresholds) {
+  State &s = state();
+  s.slow.store(thresholds.slow);
+  s.pause.store(thresholds.pause);
+  s.max_pause_sec.store(thresholds.max_pause.count());
+  bool enabled = thresholds.slow > 0;
+  if (enabled && Pressure::current().highest() < 0) {
+    LOG_INFO << "The update work is not held back under load: the kernel doesn't report the pressure (PSI)";
+    enabled = false;
+  }
+  s.enabled.store(enabled);
+}
+
+void LoadAdmission::admit(Work work) {
+  State &s = state();
+  if (!s.enabled.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const auto start = Clock::now();
+  // Nothing is known of the work done before the first call of the thread
+  const auto worked = last_admit == Clock::time_point()
+                          ? std::chrono::microseconds(0)
+                          : std::chrono::duration_cast<std::chrono::microseconds>(start - last_admit);
+  last_admit = start;
+  Thresholds thresholds;
+  thresholds.slow = s.slow.load(std::memory_order_relaxed);
+  thresholds.pause = s.pause.load(std::memory_order_relaxed);
+  thresholds.max_pause = std::chrono::seconds(s.max_pause_sec.load(std::memory_order_relaxed));
+  double pressure = samplePressure(s);
+  if (pressure < thresholds.slow || BackgroundScheduling::boosted()) {
+    return;
+  }
+
+  const Metrics::Labels labels{{"work", name(work)}};
+  if (thresholds.pause > 0 && pressure >= thresholds.pause) {
+    Metrics::instance()
+        .counter("aktualizr_admission_pauses_total", "Pauses of the update work while the system was under pressure",
+                 labels)
+        .add();
+    LOG_DEBUG << "Pausing the " << name(work) << " while the system is under pressure (" << pressure << "%)";
+    const auto deadline = start + thresholds.max_pause;
+    for (auto now = start; now < deadline && pressure >= thresholds.slow; now = Clock::now()) {
+      std::this_thread::sleep_for(std::min<Clock::duration>(kSampleInterval, deadline - now));
+      pressure = samplePressure(s);
+    }
+  } else {
+    std::this_thread::sleep_for(slowdown(thresholds, pressure, worked));
+  }
+  last_admit = Clock::now();
+  const auto delay = std::chrono::duration_cast<std::chrono::microseconds>(last_admit - start);
+  Metrics::instance()
+      .histogram("aktualizr_admission_delay_seconds", "Time the update work was held back by the system pressure",
+                 labels)
+      .record(static_cast<uint64_t>(delay.count()));
+}
+
+std::chrono::microseconds LoadAdmission::slowdown(const Thresholds &thresholds, double pressure,
+                                                  std::chrono::microseconds worked) {
+  if (thresholds.slow <= 0 || pressure < thresholds.slow) {
+    return std::chrono::microseconds(0);
+  }
+  const double ceiling = thresholds.pause > thresholds.slow ? thresholds.pause : 100.0;
+  const double fraction =
+      ceiling > thresholds.slow ? std::min(1.0, (pressure - thresholds.slow) / (ceiling - thresholds.slow)) : 1.0;
+  const auto capped = std::min<std::chrono::microseconds>(worked, kMaxWorked);
+  return std::chrono::microseconds(
+      static_cast<int64_t>(static_cast<double>(capped.count()) * kMaxSlowdown * fraction));
+}
+
+const char *LoadAdmission::name(Work work) {
+  switch (work) {
+    case Work::kHashing:
+      return "hashing";
+    case Work::kVerification:
+      return "verification";
+    case Work::kSecondaryTransfer:
+      return "secondary_transfer";
+    case Work::kStorageMaintenance:
+      return "storage_maintenance";
+    case Work::kCheckout:
+      return "checkout";
+    default:
+      return "other";
+  }
+}
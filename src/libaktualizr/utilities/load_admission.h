@@ -0,0 +1,58 @@
+#ifndef UTILITIES_LOAD_ADMISSION_H_
+#define UTILITIES_LOAD_ADMISSION_H_
+
+#include <chrono>
+#include <string>
+
+/**
+ * Holds back the CPU- and I/O-heavy update work while the rest of the system
+ * is under load, as reported by the Pressure Stall Information of Linux in
+ * /proc/pressure/cpu and /proc/pressure/io: the share of the last 10 s in
+ * which some tasks were waiting for the CPU or for I/O, whichever is higher.
+ *
+ * The work calls admit() between its parts. Below the slow threshold, it goes
+ * on at once. Above it, it is slowed down by sleeping in proportion to the
+ * time it worked since the previous call, the more so the higher the
+ * pressure. At the pause threshold, it waits until the pressure is below the
+ * slow threshold again, or for at most max_pause, so that it can't be held up
+ * for ever. While the user waits for the work (see BackgroundScheduling::Boost),
+ * it is never held back.
+ *
+ * Without PSI, e.g. with kernels before 4.20 or without CONFIG_PSI, nothing
+ * is ever held back.
+ */
+class LoadAdmission {
+ public:
+  enum class Work { kHashing, kVerification, kSecondaryTransfer, kStorageMaintenance, kCheckout };
+
+  struct Thresholds {
+    // Pressure in %, from which the work is slowed down; 0 disables the admission control
+    double slow{0};
+    // Pressure in %, from which the work is paused; 0 never pauses it
+    double pause{0};
+    std::chrono::seconds max_pause{60};
+  };
+
+  struct Pressure {
+    // The "some" avg10 of the CPU and of the I/O, in %; -1 where it is not known
+    double cpu{-1};
+    double io{-1};
+
+    static Pressure current();
+    /** The "some" avg10 of the contents of a file of /proc/pressure; -1 if there is none. */
+    static double parse(const std::string &contents);
+    double highest() const { return cpu > io ? cpu : io; }
+  };
+
+  /** Applies to the work admitted from now on. */
+  static void configure(const Thresholds &thresholds);
+  /** Hold back the calling thread if the system is under pressure, before the next part of the work. */
+  static void admit(Work work);
+
+  /** The time to sleep after working for `worked` under a pressure between the slow and pause thresholds. */
+  static std::chrono::microseconds slowdown(const Thresholds &thresholds, double pressure,
+                                            std::chrono::microseconds worked);
+  static const char *name(Work work);
+};
+
+#endif  // UTILITIES_LOAD_ADMISSION_H_
@@ -0,0 +1,61 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+
+#include "utilities/load_admission.h"
+#include "utilities/metrics.h"
+
+TEST(LoadAdmission, ParsePressure) {
+  const std::string cpu =
+      "some avg10=12.50 avg60=3.00 avg300=0.80 total=123456\n"
+      "full avg10=1.00 avg60=0.00 avg300=0.00 total=1234\n";
+  EXPECT_DOUBLE_EQ(LoadAdmission::Pressure::parse(cpu), 12.5);
+  EXPECT_DOUBLE_EQ(LoadAdmission::Pressure::parse("full avg10=1.00 avg60=0.00\n"), -1);
+  EXPECT_DOUBLE_EQ(LoadAdmission::Pressure::parse(""), -1);
+  EXPECT_DOUBLE_EQ(LoadAdmission::Pressure::parse("some avg10=x\n"), -1);
+
+  LoadAdmission::Pressure pressure;
+  pressure.cpu = 5;
+  pressure.io = 40;
+  EXPECT_DOUBLE_EQ(pressure.highest(), 40);
+}
+
+/* The higher the pressure above the slow threshold, the longer the work sleeps. */
+TEST(LoadAdmission, Slowdown) {
+  LoadAdmission::Thresholds thresholds;
+  thresholds.slow = 20;
+  thresholds.pause = 60;
+  const std::chrono::microseconds worked{10000};
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 10, worked).count(), 0);
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 20, worked).count(), 0);
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 40, worked).count(), 20000);
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 60, worked).count(), 40000);
+  // A long time since the previous part counts as a second
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 60, std::chrono::minutes(1)), std::chrono::seconds(4));
+
+  // Without a pause threshold, up to 100%
+  thresholds.pause = 0;
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 60, worked).count(), 20000);
+
+  // Disabled
+  thresholds.slow = 0;
+  EXPECT_EQ(LoadAdmission::slowdown(thresholds, 90, worked).count(), 0);
+}
+
+/* Without a threshold, the work is never held back. */
+TEST(LoadAdmission, Disabled) {
+  LoadAdmission::configure(LoadAdmission::Thresholds());
+  for (int i = 0; i < 1000; ++i) {
+    LoadAdmission::admit(LoadAdmission::Work::kHashing);
+  }
+  // Any work that went past the pressure check is recorded as delayed.
+  EXPECT_EQ(Metrics::instance().prometheus().find("aktualizr_admission_delay_seconds"), std::string::npos);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,70 @@
+#include "utilities/memory_usage.h"
+
+#include <fstream>
+#include <sstream>
+#include <utility>
+
+#include "logging/logging.h"
+
+MemoryUsage MemoryUsage::current() {
+  std::ifstream file("/proc/self/status");
+  std::stringstream status;
+  status << file.rdbuf();
+  return parse(status.str());
+}
+
+MemoryUsage MemoryUsage::parse(const std::string &status) {
+  MemoryUsage usage;
+  std::istringstream lines(status);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    int64_t kb = -1;
+    if (!(fields >> name >> kb)) {
+      continue;
+    }
+    if (name == "VmRSS:") {
+      usage.rss_kb = kb;
+    } else if (name == "VmHWM:") {
+      usage.peak_kb = kb;
+    }
+  }
+  return usage;
+}
+
+bool MemoryUsage::resetPeak() {
+  // Supported since Linux 4.0
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.flush();
+  return clear_refs.good();
+}
+
+MemoryPhase::MemoryPhase(std::string name, uint64_t budget_kb) : name_{std::move(name)}, budget_kb_{budget_kb} {
+  if (budget_kb_ == 0) {
+    return;
+  }
+  if (!MemoryUsage::resetPeak()) {
+    LOG_DEBUG << "Can't reset the memory high-water mark, the one of " << name_ << " includes the earlier usage";
+  }
+  start_ = MemoryUsage::current();
+}
+
+MemoryPhase::~MemoryPhase() {
+  if (budget_kb_ == 0) {
+    return;
+  }
+  const MemoryUsage end = MemoryUsage::current();
+  if (end.peak_kb < 0) {
+    return;
+  }
+  const auto peak_kb = static_cast<uint64_t>(end.peak_kb);
+  if (peak_kb > budget_kb_) {
+    LOG_WARNING << "Memory high-water mark of " << name_ << ": " << peak_kb << " kB, over the budget of " << budget_kb_
+                << " kB (" << start_.rss_kb << " kB at the start, " << end.rss_kb << " kB at the end)";
+  } else {
+    LOG_INFO << "Memory high-water mark of " << name_ << ": " << peak_kb << " kB of " << budget_kb_ << " kB ("
+             << start_.rss_kb << " kB at the start, " << end.rss_kb << " kB at the end)";
+  }
+}
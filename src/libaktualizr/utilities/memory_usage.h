@@ -0,0 +1,46 @@
+#ifndef UTILITIES_MEMORY_USAGE_H_
+#define UTILITIES_MEMORY_USAGE_H_
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Resident memory of the process, in kB, as reported by Linux in
+ * /proc/self/status. -1 where it is not known.
+ */
+struct MemoryUsage {
+  int64_t rss_kb{-1};
+  // High-water mark of rss_kb since the start or the last resetPeak()
+  int64_t peak_kb{-1};
+
+  static MemoryUsage current();
+  // Parse the contents of /proc/<pid>/status.
+  static MemoryUsage parse(const std::string &status);
+  // Start a new high-water mark from the current usage; false if the kernel doesn't support it.
+  static bool resetPeak();
+};
+
+/**
+ * Measure the high-water mark of the resident memory during a phase of the
+ * client, such as an update check or an installation, from construction to
+ * destruction, and log it. A warning is logged when it exceeds the budget.
+ *
+ * The mark is the one of the whole process, so it includes whatever runs at
+ * the same time. Does nothing when the budget is 0.
+ */
+class MemoryPhase {
+ public:
+  MemoryPhase(std::string name, uint64_t budget_kb);
+  ~MemoryPhase();
+  MemoryPhase(const MemoryPhase &) = delete;
+  MemoryPhase(MemoryPhase &&) = delete;
+  MemoryPhase &operator=(const MemoryPhase &) = delete;
+  MemoryPhase &operator=(MemoryPhase &&) = delete;
+
+ private:
+  const std::string name_;
+  const uint64_t budget_kb_;
+  MemoryUsage start_;
+};
+
+#endif  // UTILITIES_MEMORY_USAGE_H_
@@ -0,0 +1,43 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "utilities/memory_usage.h"
+
+TEST(MemoryUsage, Parse) {
+  const std::string status =
+      "Name:\taktualizr\n"
+      "VmPeak:\t  300000 kB\n"
+      "VmHWM:\t   20480 kB\n"
+      "VmRSS:\t   10240 kB\n"
+      "Threads:\t4\n";
+  const MemoryUsage usage = MemoryUsage::parse(status);
+  EXPECT_EQ(usage.rss_kb, 10240);
+  EXPECT_EQ(usage.peak_kb, 20480);
+
+  EXPECT_EQ(MemoryUsage::parse("Name:\ttest\n").rss_kb, -1);
+}
+
+/* The high-water mark follows the memory that is touched, and can be reset. */
+TEST(MemoryUsage, Peak) {
+  const MemoryUsage before = MemoryUsage::current();
+  ASSERT_GT(before.rss_kb, 0);
+  ASSERT_GE(before.peak_kb, before.rss_kb);
+  {
+    // Touch every page, so that they are resident
+    std::vector<char> buffer(64 * 1024 * 1024, 1);
+    EXPECT_GE(MemoryUsage::current().peak_kb, before.rss_kb + 60 * 1024);
+  }
+  if (MemoryUsage::resetPeak()) {
+    const MemoryUsage after = MemoryUsage::current();
+    EXPECT_LT(after.peak_kb, after.rss_kb + 60 * 1024);
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,57 @@
+#include "utilities/metadata_arena.h"
+
+#include <memory>
+
+#include "logging/logging.h"
+
+namespace {
+
+// Count the bytes of the blocks of the arena.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  uint64_t allocated{0};
+
+ private:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    void *block = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    allocated += bytes;
+    return block;
+  }
+  void do_deallocate(void *block, size_t bytes, size_t alignment) override {
+    std::pmr::new_delete_resource()->deallocate(block, bytes, alignment);
+  }
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override { return this == &other; }
+};
+
+struct Arena {
+  explicit Arena(size_t initial_size) : blocks{initial_size, &upstream} {}
+
+  CountingResource upstream;
+  std::pmr::monotonic_buffer_resource blocks;
+};
+
+thread_local std::unique_ptr<Arena> current_arena;
+
+}  // namespace
+
+MetadataArena::Scope::Scope() : outermost_{current_arena == nullptr} {
+  if (outermost_) {
+    current_arena = std::make_unique<Arena>(kInitialBlockSize);
+  }
+}
+
+MetadataArena::Scope::~Scope() {
+  if (outermost_) {
+    LOG_TRACE << "Metadata arena used " << current_arena->upstream.allocated << " bytes";
+    current_arena.reset();
+  }
+}
+
+std::pmr::memory_resource *MetadataArena::resource() {
+  if (current_arena == nullptr) {
+    return std::pmr::get_default_resource();
+  }
+  return &current_arena->blocks;
+}
+
+uint64_t MetadataArena::allocatedBytes() { return current_arena == nullptr ? 0 : current_arena->upstream.allocated; }
@@ -0,0 +1,47 @@
+#ifndef UTILITIES_METADATA_ARENA_H_
+#define UTILITIES_METADATA_ARENA_H_
+
+#include <cstdint>
+#include <memory_resource>
+
+/**
+ * Memory for the short-lived objects of a metadata refresh, such as the
+ * members of a Targets document while it is parsed, taken from a few large
+ * blocks and given back all at once when the refresh is over. Many small
+ * allocations that come and go with each update check otherwise fragment the
+ * heap of a long-running process.
+ *
+ * Only what is dropped before the end of the refresh belongs there: the
+ * memory is not reused while the scope lasts, and whatever is kept, such as
+ * the verified metadata, must be allocated normally.
+ */
+class MetadataArena {
+ public:
+  /**
+   * The arena of the current thread, from construction to destruction. A
+   * scope within another uses the arena of the outermost one.
+   */
+  class Scope {
+   public:
+    Scope();
+    ~Scope();
+    Scope(const Scope &) = delete;
+    Scope(Scope &&) = delete;
+    Scope &operator=(const Scope &) = delete;
+    Scope &operator=(Scope &&) = delete;
+
+   private:
+    bool outermost_;
+  };
+
+  /** The arena of the current scope, or the default heap outside of any. */
+  static std::pmr::memory_resource *resource();
+  /** Bytes taken from the heap by the arena of the current scope so far. */
+  static uint64_t allocatedBytes();
+
+ private:
+  // Size of the first block; each next one is larger.
+  static constexpr size_t kInitialBlockSize = 64 * 1024;
+};
+
+#endif  // UTILITIES_METADATA_ARENA_H_
@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory_resource>
+#include <string>
+
+#include "utilities/metadata_arena.h"
+
+/* Outside of a scope, allocations go to the heap as usual. */
+TEST(MetadataArena, NoScope) {
+  EXPECT_EQ(MetadataArena::resource(), std::pmr::get_default_resource());
+  EXPECT_EQ(MetadataArena::allocatedBytes(), 0);
+}
+
+/* A scope takes its memory in blocks, and nested scopes share the outermost arena. */
+TEST(MetadataArena, Scope) {
+  {
+    MetadataArena::Scope scope;
+    std::pmr::memory_resource *arena = MetadataArena::resource();
+    EXPECT_NE(arena, std::pmr::get_default_resource());
+
+    std::pmr::map<std::pmr::string, int> members{arena};
+    for (int k = 0; k < 1000; ++k) {
+      members[std::pmr::string("a member name longer than a short string " + std::to_string(k), arena)] = k;
+    }
+    const uint64_t allocated = MetadataArena::allocatedBytes();
+    EXPECT_GT(allocated, 0);
+    {
+      MetadataArena::Scope nested;
+      EXPECT_EQ(MetadataArena::resource(), arena);
+      EXPECT_EQ(MetadataArena::allocatedBytes(), allocated);
+    }
+    EXPECT_EQ(MetadataArena::resource(), arena);
+    EXPECT_EQ(members.size(), 1000);
+  }
+  EXPECT_EQ(MetadataArena::resource(), std::pmr::get_default_resource());
+  EXPECT_EQ(MetadataArena::allocatedBytes(), 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
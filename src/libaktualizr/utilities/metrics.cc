@@ -0,0 +1,419 @@
+#include "utilities/metrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+namespace {
+// Values are known to 1/2^kSubBucketBits
+constexpr unsigned kSubBucketBits = 3;
+constexpr uint64_t kSubBuckets = 1U << kSubBucketBits;
+// Values below this have a bucket each
+constexpr uint64_t kLinear = 2 * kSubBuckets;
+
+unsigned highestBit(uint64_t value) { return 63U - static_cast<unsigned>(__builtin_clzll(value)); }
+
+const char *typeName(int type) {
+  static const char *const names[] = {"counter", "gauge", "histogram"};
+  return names[type];
+}
+
+std::string format(double value) {
+  std::ostringstream out;
+  out << std::setprecision(12) << value;
+  return out.str();
+}
+
+std::string escapeLabel(const std::string &value) {
+  std::string escaped;
+  for (const char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return escaped;
+}
+
+std::string renderLabels(const Metrics::Labels &labels, const std::string &extra = "") {
+  std::string rendered;
+  for (const auto &label : labels) {
+    rendered += (rendered.empty() ? "" : ",") + label.first + "=\"" + escapeLabel(label.second) + "\"";
+  }
+  if (!extra.empty()) {
+    rendered += (rendered.empty() ? "" : ",") + extra;
+  }
+  return rendered.empty() ? "" : "{" + rendered + "}";
+}
+}  // namespace
+
+size_t MetricHistogram::bucket(uint64_t value) {
+  if (value < kLinear) {
+    return static_cast<size_t>(value);
+  }
+  const unsigned msb = highestBit(value);
+  return static_cast<size_t>(kLinear + (msb - kSubBucketBits - 1) * kSubBuckets +
+                             ((value >> (msb - kSubBucketBits)) & (kSubBuckets - 1)));
+}
+
+uint64_t MetricHistogram::bucketLowest(size_t bucket) {
+  if (bucket < kLinear) {
+    return bucket;
+  }
+  const uint64_t k = bucket - kLinear;
+  const auto shift = static_cast<unsigned>(k / kSubBuckets + 1);
+  return (kSubBuckets + k % kSubBuckets) << shift;
+}
+
+uint64_t MetricHistogram::bucketHighest(size_t bucket) {
+  if (bucket < kLinear) {
+    return bucket;
+  }
+  const auto shift = static_cast<unsigned>((bucket - kLinear) / kSubBuckets + 1);
+  // Wraps around to the highest value for the last bucket
+  return bucketLowest(bucket) + (uint64_t{1} << shift) - 1;
+}
+
+void MetricHistogram::record(uint64_t value) {
+  buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t MetricHistogram::quantile(double q) const {
+  // The buckets rather than count_, which can be ahead of them
+  uint64_t total = 0;
+  for (const auto &b : buckets_) {
+    total += b.load(std::memory_order_relaxed);
+  }
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::min(std::max(q, 0.0), 1.0) *
+                                                                           static_cast<double>(total))));
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen >= rank) {
+      // The middle of the bucket
+      return bucketLowest(i) + (bucketHighest(i) - bucketLowest(i)) / 2;
+    }
+  }
+  return bucketHighest(kBuckets - 1);
+}
+
+uint64_t MetricHistogram::countBelowPowerOfTwo(unsigned exponent) const {
+  // 2^exponent is the lowest value of a bucket
+  const size_t end = exponent >= 64 ? kBuckets : bucket(uint64_t{1} << exponent);
+  uint64_t below = 0;
+  for (size_t i = 0; i < end; ++i) {
+    below += buckets_[i].load(std::memory_order_relaxed);
+  }
+  return below;
+}
+
+Metrics &Metrics::instance() {
+  static Metrics metrics;
+  return metrics;
+}
+
+Metrics::Series &Metrics::series(const std::string &name, const std::string &help, Labels labels, Type type,
+                                 double scale) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto family = families_.find(name);
+  if (family == families_.end()) {
+    family = families_.emplace(name, Family{type, help, scale, {}}).first;
+  } else if (family->second.type != type) {
+    throw std::invalid_argument("Metric " + name + " already has another type");
+  }
+  auto &series = family->second.series;
+  std::string key = renderLabels(labels);
+  if (series.size() >= kMaxSeries && series.count(key) == 0) {
+    for (auto &label : labels) {
+      label.second = "other";
+    }
+    key = renderLabels(labels);
+  }
+  auto it = series.find(key);
+  if (it == series.end()) {
+    Series s;
+    s.labels = std::move(labels);
+    if (type == Type::kCounter) {
+      s.counter = std_::make_unique<MetricCounter>();
+    } else if (type == Type::kGauge) {
+      s.gauge = std_::make_unique<MetricGauge>();
+    } else {
+      s.histogram = std_::make_unique<MetricHistogram>();
+    }
+    it = series.emplace(std::move(key), std::move(s)).first;
+  }
+  return it->second;
+}
+
+MetricCounter &Metrics::counter(const std::string &name, const std::string &help, const Labels &labels) {
+  return *series(name, help, labels, Type::kCounter, 1.0).counter;
+}
+
+MetricGauge &Metrics::gauge(const std::string &name, const std::string &help, const Labels &labels) {
+  return *series(name, help, labels, Type::kGauge, 1.0).gauge;
+}
+
+MetricHistogram &Metrics::histogram(const std::string &name, const std::string &help, const Labels &labels,
+                                    double scale) {
+  return *series(name, help, labels, Type::kHistogram, scale).histogram;
+}
+
+uint64_t Metrics::total(const std::string &name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto family = families_.find(name);
+  if (family == families_.end()) {
+    return 0;
+  }
+  uint64_t total = 0;
+  for (const auto &series : family->second.series) {
+    if (series.second.counter) {
+      total += series.second.counter->value();
+    } else if (series.second.histogram) {
+      total += series.second.histogram->count();
+    }
+  }
+  return total;
+}
+
+double Metrics::sum(const std::string &name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto family = families_.find(name);
+  if (family == families_.end() || family->second.type != Type::kHistogram) {
+    return 0;
+  }
+  uint64_t sum = 0;
+  for (const auto &series : family->second.series) {
+    sum += series.second.histogram->sum();
+  }
+  return static_cast<double>(sum) * family->second.scale;
+}
+
+std::string Metrics::prometheus() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ostringstream out;
+  for (const auto &family : families_) {
+    const std::string &name = family.first;
+    const Family &f = family.second;
+    out << "# HELP " << name << " " << f.help << "\n";
+    out << "# TYPE " << name << " " << typeName(static_cast<int>(f.type)) << "\n";
+    if (f.type != Type::kHistogram) {
+      for (const auto &series : f.series) {
+        out << name << series.first << " "
+            << (f.type == Type::kCounter ? std::to_string(series.second.counter->value())
+                                         : std::to_string(series.second.gauge->value()))
+            << "\n";
+      }
+      continue;
+    }
+
+    // The same power-of-two bounds for all the series, up to the highest value
+    // of any. A bound counts the values below it rather than up to it, which is
+    // one unit of the recorded values, well below the precision of the buckets.
+    unsigned top = 0;
+    for (const auto &series : f.series) {
+      const auto &h = *series.second.histogram;
+      while (top < 64 && h.countBelowPowerOfTwo(top) < h.count()) {
+        ++top;
+      }
+    }
+    for (const auto &series : f.series) {
+      const auto &h = *series.second.histogram;
+      const uint64_t count = h.count();
+      for (unsigned exponent = 0; exponent <= top; ++exponent) {
+        const std::string le = "le=\"" + format(std::ldexp(f.scale, static_cast<int>(exponent))) + "\"";
+        out << name << "_bucket" << renderLabels(series.second.labels, le) << " "
+            << std::min(h.countBelowPowerOfTwo(exponent), count) << "\n";
+      }
+      out << name << "_bucket" << renderLabels(series.second.labels, "le=\"+Inf\"") << " " << count << "\n";
+      out << name << "_sum" << series.first << " " << format(static_cast<double>(h.sum()) * f.scale) << "\n";
+      out << name << "_count" << series.first << " " << count << "\n";
+    }
+  }
+  return out.str();
+}
+
+Json::Value Metrics::json() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Json::Value json(Json::objectValue);
+  for (const auto &family : families_) {
+    const Family &f = family.second;
+    Json::Value &metric = json[family.first];
+    metric["type"] = typeName(static_cast<int>(f.type));
+    metric["help"] = f.help;
+    metric["series"] = Json::arrayValue;
+    for (const auto &series : f.series) {
+      Json::Value s;
+      s["labels"] = Json::objectValue;
+      for (const auto &label : series.second.labels) {
+        s["labels"][label.first] = label.second;
+      }
+      if (f.type == Type::kCounter) {
+        s["value"] = Json::UInt64(series.second.counter->value());
+      } else if (f.type == Type::kGauge) {
+        s["value"] = Json::Int64(series.second.gauge->value());
+      } else {
+        const auto &h = *series.second.histogram;
+        s["count"] = Json::UInt64(h.count());
+        s["sum"] = static_cast<double>(h.sum()) * f.scale;
+        for (const auto &q : {std::make_pair("p50", 0.5), std::make_pair("p90", 0.9), std::make_pair("p99", 0.99),
+                              std::make_pair("max", 1.0)}) {
+          s[q.first] = static_cast<double>(h.quantile(q.second)) * f.scale;
+        }
+      }
+      metric["series"].append(s);
+    }
+  }
+  return json;
+}
+
+MetricsExporter::MetricsExporter(boost::filesystem::path file, std::chrono::seconds interval, int port)
+    : file_{std::move(file)}, interval_{std::max(interval, std::chrono::seconds(1))} {
+  if (port >= 0) {
+    try {
+      listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (listen_fd_ == -1) {
+        throw std::system_error(errno, std::system_category(), "socket");
+      }
+      const int reuse = 1;
+      setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+      sockaddr_in sa{};
+      sa.sin_family = AF_INET;
+      sa.sin_port = htons(static_cast<uint16_t>(port));  // NOLINT(readability-isolate-declaration)
+      sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);       // NOLINT(readability-isolate-declaration)
+      if (bind(listen_fd_, reinterpret_cast<const sockaddr *>(&sa), sizeof(sa)) == -1 ||
+          listen(listen_fd_, SOMAXCONN) == -1) {
+        throw std::system_error(errno, std::system_category(), "bind");
+      }
+      port_ = static_cast<uint16_t>(Utils::ipPort(Utils::ipGetSockaddr(listen_fd_)));
+      LOG_INFO << "Serving the metrics on 127.0.0.1:" << port_;
+    } catch (const std::exception &e) {
+      LOG_ERROR << "Could not serve the metrics on port " << port << ": " << e.what();
+      if (listen_fd_ != -1) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+      }
+    }
+  }
+  if (file_.empty() && listen_fd_ == -1) {
+    return;
+  }
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  if (stop_fd_ == -1) {
+    throw std::system_error(errno, std::system_category(), "eventfd");
+  }
+  thread_ = std::thread([this] { run(); });
+}
+
+MetricsExporter::~MetricsExporter() {
+  if (thread_.joinable()) {
+    const uint64_t one = 1;
+    if (write(stop_fd_, &one, sizeof(one)) != sizeof(one)) {
+      LOG_ERROR << "Could not stop the metrics exporter: " << std::strerror(errno);
+    }
+    thread_.join();
+  }
+  if (stop_fd_ != -1) {
+    close(stop_fd_);
+  }
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+  }
+}
+
+void MetricsExporter::run() {
+  auto next_dump = std::chrono::steady_clock::now();
+  for (;;) {
+    int timeout = -1;
+    if (!file_.empty()) {
+      const auto now = std::chrono::steady_clock::now();
+      if (now >= next_dump) {
+        dump();
+        next_dump = now + interval_;
+      }
+      timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(next_dump - now).count());
+    }
+    std::array<pollfd, 2> fds{pollfd{stop_fd_, POLLIN, 0}, pollfd{listen_fd_, POLLIN, 0}};
+    const int res = poll(fds.data(), fds.size(), timeout);
+    if (res == -1 && errno != EINTR) {
+      LOG_ERROR << "The metrics exporter failed: " << std::strerror(errno);
+      break;
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      break;
+    }
+    if ((fds[1].revents & POLLIN) != 0) {
+      serve();
+    }
+  }
+  // The latest values for whoever reads the file after we stop
+  if (!file_.empty()) {
+    dump();
+  }
+}
+
+void MetricsExporter::dump() const {
+  try {
+    Utils::writeFile(file_, Metrics::instance().prometheus());
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not write the metrics to " << file_ << ": " << e.what();
+  }
+}
+
+void MetricsExporter::serve() const {
+  const int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+  if (fd == -1) {
+    return;
+  }
+  // Whatever the request is, the answer is the same: read it up to its end
+  // so that the client doesn't get a reset, but don't let it hold us up.
+  timeval timeout{1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  std::array<char, 1024> buf{};
+  while (request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos) {
+    const ssize_t n = recv(fd, buf.data(), buf.size(), 0);
+    if (n <= 0) {
+      break;
+    }
+    request.append(buf.data(), static_cast<size_t>(n));
+  }
+
+  const std::string body = Metrics::instance().prometheus();
+  const std::string response =
+      "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) +
+      "\r\nConnection: close\r\n\r\n" + body;
+  size_t sent = 0;
+  while (sent < response.size()) {
+    const ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+    if (n <= 0) {
+      break;
+    }
+    sent += static_cast<size_t>(n);
+  }
+  close(fd);
+}
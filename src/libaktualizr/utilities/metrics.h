@@ -0,0 +1,175 @@
+#ifndef UTILITIES_METRICS_H_
+#define UTILITIES_METRICS_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+class MetricCounter {
+ public:
+  void add(uint64_t value = 1) { value_.fetch_add(value, std::memory_order_relaxed); }
+  uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint64_t> value_{0};
+};
+
+class MetricGauge {
+ public:
+  void set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+  void add(int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_{0};
+};
+
+/**
+ * A histogram of integer values, in the manner of HdrHistogram: the values
+ * below 16 have a bucket each, and every power of two above is split into 8
+ * buckets, so that any value is known to 12.5% whatever its magnitude, with a
+ * fixed 4 KiB of counters and no lock.
+ */
+class MetricHistogram {
+ public:
+  static constexpr size_t kBuckets = 16 + 60 * 8;
+
+  void record(uint64_t value);
+  uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  /** An estimate of the quantile q (0 to 1) of the values; 0 when there are none. */
+  uint64_t quantile(double q) const;
+  /** Number of the values below 2^exponent. */
+  uint64_t countBelowPowerOfTwo(unsigned exponent) const;
+
+  static size_t bucket(uint64_t value);
+  static uint64_t bucketLowest(size_t bucket);
+  static uint64_t bucketHighest(size_t bucket);
+
+ private:
+  std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<uint64_t> sum_{0};
+};
+
+/**
+ * Records the time from construction to destruction, in microseconds, into a
+ * histogram.
+ */
+class MetricTimer {
+ public:
+  explicit MetricTimer(MetricHistogram &histogram)
+      : histogram_{histogram}, start_{std::chrono::steady_clock::now()} {}
+  ~MetricTimer() {
+    histogram_.record(static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_).count()));
+  }
+  MetricTimer(const MetricTimer &) = delete;
+  MetricTimer(MetricTimer &&) = delete;
+  MetricTimer &operator=(const MetricTimer &) = delete;
+  MetricTimer &operator=(MetricTimer &&) = delete;
+
+ private:
+  MetricHistogram &histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/**
+ * The metrics of the process, by name and labels. The returned metrics live
+ * as long as the process, so that the hot paths can look them up once and
+ * keep a reference.
+ *
+ * A metric has at most kMaxSeries combinations of label values; the values of
+ * the ones after that are replaced by "other", so that labels such as HTTP
+ * endpoints can't grow without bound.
+ */
+class Metrics {
+ public:
+  using Labels = std::vector<std::pair<std::string, std::string>>;
+  static constexpr size_t kMaxSeries = 64;
+
+  static Metrics &instance();
+
+  MetricCounter &counter(const std::string &name, const std::string &help, const Labels &labels = {});
+  MetricGauge &gauge(const std::string &name, const std::string &help, const Labels &labels = {});
+  /** Values are exported multiplied by scale, e.g. 1e-6 for microseconds recorded as seconds. */
+  MetricHistogram &histogram(const std::string &name, const std::string &help, const Labels &labels = {},
+                             double scale = 1e-6);
+
+  /**
+   * The sum over all the series of a metric of the values of a counter, or of
+   * the number of values recorded in a histogram; 0 for an unknown metric.
+   */
+  uint64_t total(const std::string &name) const;
+  /** The sum over all the series of a histogram of the values recorded, scaled; 0 for an unknown metric. */
+  double sum(const std::string &name) const;
+
+  /** The Prometheus text exposition format (version 0.0.4). */
+  std::string prometheus() const;
+  /** The value of the counters and gauges, and the count, sum and quantiles of the histograms. */
+  Json::Value json() const;
+
+ private:
+  enum class Type { kCounter, kGauge, kHistogram };
+  struct Series {
+    Labels labels;
+    std::unique_ptr<MetricCounter> counter;
+    std::unique_ptr<MetricGauge> gauge;
+    std::unique_ptr<MetricHistogram> histogram;
+  };
+  struct Family {
+    Type type;
+    std::string help;
+    double scale{1.0};
+    std::map<std::string, Series> series;
+  };
+
+  Series &series(const std::string &name, const std::string &help, Labels labels, Type type, double scale);
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Family> families_;
+};
+
+/**
+ * Regularly writes the metrics to a file in the Prometheus text format, and
+ * serves them on a TCP port of the loopback interface, to any request. Either
+ * is disabled with an empty path or a negative port; port 0 is any free one.
+ */
+class MetricsExporter {
+ public:
+  MetricsExporter(boost::filesystem::path file, std::chrono::seconds interval, int port);
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter(MetricsExporter &&) = delete;
+  MetricsExporter &operator=(const MetricsExporter &) = delete;
+  MetricsExporter &operator=(MetricsExporter &&) = delete;
+
+  /** The port the metrics are served on, 0 when they are not. */
+  uint16_t port() const { return port_; }
+
+ private:
+  void run();
+  void dump() const;
+  void serve() const;
+
+  const boost::filesystem::path file_;
+  const std::chrono::seconds interval_;
+  int listen_fd_{-1};
+  int stop_fd_{-1};
+  uint16_t port_{0};
+  std::thread thread_;
+};
+
+#endif  // UTILITIES_METRICS_H_
@@ -0,0 +1,143 @@
+#include <gtest/gtest.h>
+
+#include <array>
+#include <thread>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include "utilities/metrics.h"
+#include "utilities/utils.h"
+
+/* Every value falls in a bucket that holds it, and the buckets are contiguous. */
+TEST(Metrics, HistogramBuckets) {
+  for (size_t b = 0; b + 1 < MetricHistogram::kBuckets; ++b) {
+    EXPECT_EQ(MetricHistogram::bucketHighest(b) + 1, MetricHistogram::bucketLowest(b + 1));
+  }
+  EXPECT_EQ(MetricHistogram::bucketHighest(MetricHistogram::kBuckets - 1), UINT64_MAX);
+  for (const uint64_t value : {0UL, 15UL, 16UL, 17UL, 1000UL, 123456789UL, UINT64_MAX}) {
+    const size_t b = MetricHistogram::bucket(value);
+    ASSERT_LT(b, MetricHistogram::kBuckets);
+    EXPECT_LE(MetricHistogram::bucketLowest(b), value);
+    EXPECT_GE(MetricHistogram::bucketHighest(b), value);
+  }
+  // No more than 1/8 off
+  const size_t b = MetricHistogram::bucket(1000000);
+  EXPECT_LE(MetricHistogram::bucketHighest(b) - MetricHistogram::bucketLowest(b), 1000000 / 8);
+}
+
+TEST(Metrics, HistogramQuantiles) {
+  MetricHistogram histogram;
+  EXPECT_EQ(histogram.quantile(0.5), 0);
+  for (uint64_t value = 1; value <= 1000; ++value) {
+    histogram.record(value);
+  }
+  EXPECT_EQ(histogram.count(), 1000);
+  EXPECT_EQ(histogram.sum(), 500500);
+  EXPECT_NEAR(static_cast<double>(histogram.quantile(0.5)), 500, 500 / 8.);
+  EXPECT_NEAR(static_cast<double>(histogram.quantile(0.99)), 990, 990 / 8.);
+  EXPECT_NEAR(static_cast<double>(histogram.quantile(1.0)), 1000, 1000 / 8.);
+  EXPECT_EQ(histogram.countBelowPowerOfTwo(4), 15);
+  EXPECT_EQ(histogram.countBelowPowerOfTwo(10), 1000);
+}
+
+/* The same name and labels give the same metric, and the number of series is bounded. */
+TEST(Metrics, Registry) {
+  Metrics &metrics = Metrics::instance();
+  MetricCounter &counter = metrics.counter("test_requests_total", "Requests", {{"endpoint", "/a"}});
+  counter.add();
+  metrics.counter("test_requests_total", "Requests", {{"endpoint", "/a"}}).add(2);
+  EXPECT_EQ(counter.value(), 3);
+  EXPECT_THROW(metrics.gauge("test_requests_total", "Requests"), std::invalid_argument);
+
+  for (size_t i = 0; i < 2 * Metrics::kMaxSeries; ++i) {
+    metrics.counter("test_endpoints_total", "Endpoints", {{"endpoint", "/" + std::to_string(i)}}).add();
+  }
+  const Json::Value json = metrics.json();
+  ASSERT_EQ(json["test_endpoints_total"]["series"].size(), Metrics::kMaxSeries + 1);
+  EXPECT_EQ(metrics.counter("test_endpoints_total", "Endpoints", {{"endpoint", "other"}}).value(),
+            Metrics::kMaxSeries);
+  EXPECT_EQ(json["test_requests_total"]["type"].asString(), "counter");
+  EXPECT_EQ(json["test_requests_total"]["series"][0]["labels"]["endpoint"].asString(), "/a");
+  EXPECT_EQ(json["test_requests_total"]["series"][0]["value"].asUInt64(), 3);
+}
+
+/* The totals of a metric are summed over its series. */
+TEST(Metrics, Totals) {
+  Metrics &metrics = Metrics::instance();
+  metrics.counter("test_totals_total", "Totals", {{"kind", "a"}}).add(2);
+  metrics.counter("test_totals_total", "Totals", {{"kind", "b"}}).add(3);
+  EXPECT_EQ(metrics.total("test_totals_total"), 5);
+  metrics.histogram("test_totals_seconds", "Totals", {{"kind", "a"}}).record(1000);
+  metrics.histogram("test_totals_seconds", "Totals", {{"kind", "b"}}).record(500);
+  EXPECT_EQ(metrics.total("test_totals_seconds"), 2);
+  EXPECT_DOUBLE_EQ(metrics.sum("test_totals_seconds"), 1500e-6);
+  EXPECT_EQ(metrics.total("test_unknown_total"), 0);
+  EXPECT_EQ(metrics.sum("test_totals_total"), 0);
+}
+
+TEST(Metrics, Prometheus) {
+  Metrics &metrics = Metrics::instance();
+  metrics.gauge("test_depth", "Depth", {{"queue", "a\"b"}}).set(-2);
+  MetricHistogram &histogram = metrics.histogram("test_latency_seconds", "Latency", {{"endpoint", "/x"}});
+  histogram.record(3);
+  histogram.record(1500000);
+
+  const std::string text = metrics.prometheus();
+  EXPECT_NE(text.find("# TYPE test_depth gauge\ntest_depth{queue=\"a\\\"b\"} -2\n"), std::string::npos);
+  EXPECT_NE(text.find("# HELP test_latency_seconds Latency\n# TYPE test_latency_seconds histogram\n"),
+            std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_bucket{endpoint=\"/x\",le=\"1e-06\"} 0\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_bucket{endpoint=\"/x\",le=\"4e-06\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_bucket{endpoint=\"/x\",le=\"1.048576\"} 1\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_bucket{endpoint=\"/x\",le=\"2.097152\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_bucket{endpoint=\"/x\",le=\"+Inf\"} 2\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_sum{endpoint=\"/x\"} 1.500003\n"), std::string::npos);
+  EXPECT_NE(text.find("test_latency_seconds_count{endpoint=\"/x\"} 2\n"), std::string::npos);
+}
+
+/* The metrics are written to the file and served on the port. */
+TEST(Metrics, Exporter) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "metrics.prom";
+  Metrics::instance().counter("test_exported_total", "Exported").add(7);
+  {
+    MetricsExporter exporter(path, std::chrono::seconds(60), 0);
+    ASSERT_NE(exporter.port(), 0);
+
+    const int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_NE(fd, -1);
+    sockaddr_in sa{};
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(exporter.port());
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(connect(fd, reinterpret_cast<const sockaddr *>(&sa), sizeof(sa)), 0);
+    const std::string request = "GET /metrics HTTP/1.0\r\n\r\n";
+    ASSERT_EQ(write(fd, request.data(), request.size()), static_cast<ssize_t>(request.size()));
+    std::string response;
+    std::array<char, 4096> buf{};
+    ssize_t n;
+    while ((n = read(fd, buf.data(), buf.size())) > 0) {
+      response.append(buf.data(), static_cast<size_t>(n));
+    }
+    close(fd);
+    EXPECT_EQ(response.rfind("HTTP/1.0 200 OK\r\n", 0), 0);
+    EXPECT_NE(response.find("\r\n\r\n# HELP "), std::string::npos);
+    EXPECT_NE(response.find("test_exported_total 7\n"), std::string::npos);
+  }
+  ASSERT_TRUE(boost::filesystem::exists(path));
+  EXPECT_NE(Utils::readFile(path).find("test_exported_total 7\n"), std::string::npos);
+
+  MetricsExporter disabled("", std::chrono::seconds(60), -1);
+  EXPECT_EQ(disabled.port(), 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
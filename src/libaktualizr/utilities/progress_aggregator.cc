@@ -0,0 +1,104 @@
+#include "utilities/progress_aggregator.h"
+
+#include <utility>
+
+ProgressAggregator::Transfer::~Transfer() {
+  std::lock_guard<std::mutex> guard(aggregator_.mutex_);
+  aggregator_.finish(*this);
+}
+
+void ProgressAggregator::Transfer::update(uint64_t transferred_bytes) {
+  std::lock_guard<std::mutex> guard(aggregator_.mutex_);
+  if (transferred_bytes == transferred_bytes_) {
+    return;
+  }
+  const auto delta = static_cast<int64_t>(transferred_bytes - transferred_bytes_);
+  transferred_bytes_ = transferred_bytes;
+  aggregator_.add(delta, true);
+}
+
+void ProgressAggregator::Transfer::resumeAt(uint64_t transferred_bytes) {
+  std::lock_guard<std::mutex> guard(aggregator_.mutex_);
+  const auto delta = static_cast<int64_t>(transferred_bytes - transferred_bytes_);
+  transferred_bytes_ = transferred_bytes;
+  aggregator_.add(delta, false);
+}
+
+void ProgressAggregator::Transfer::complete() {
+  std::lock_guard<std::mutex> guard(aggregator_.mutex_);
+  complete_ = true;
+}
+
+ProgressAggregator::ProgressAggregator(clock::duration interval, Callback callback,
+                                       std::function<clock::time_point()> now)
+    : interval_{interval}, callback_{std::move(callback)}, now_{std::move(now)} {}
+
+std::unique_ptr<ProgressAggregator::Transfer> ProgressAggregator::start(uint64_t total_bytes) {
+  std::unique_ptr<Transfer> transfer(new Transfer(*this, total_bytes));
+  std::lock_guard<std::mutex> guard(mutex_);
+  const bool first = active_transfers_ == 0;
+  if (first) {
+    transferred_bytes_ = 0;
+    total_bytes_ = 0;
+    counted_bytes_ = 0;
+    rate_start_bytes_ = 0;
+    rate_start_ = now_();
+    bytes_per_second_ = 0;
+    has_rate_ = false;
+  }
+  total_bytes_ += total_bytes;
+  ++active_transfers_;
+  report(first);
+  return transfer;
+}
+
+void ProgressAggregator::add(int64_t transferred_bytes, bool counted) {
+  transferred_bytes_ = static_cast<uint64_t>(static_cast<int64_t>(transferred_bytes_) + transferred_bytes);
+  // A transfer that starts over doesn't take back from the rate
+  if (counted && transferred_bytes > 0) {
+    counted_bytes_ += static_cast<uint64_t>(transferred_bytes);
+  }
+  report(false);
+}
+
+void ProgressAggregator::finish(const Transfer &transfer) {
+  if (transfer.complete_) {
+    transferred_bytes_ += transfer.total_bytes_ - transfer.transferred_bytes_;
+  } else {
+    transferred_bytes_ -= transfer.transferred_bytes_;
+    total_bytes_ -= transfer.total_bytes_;
+  }
+  --active_transfers_;
+  report(active_transfers_ == 0);
+}
+
+void ProgressAggregator::report(bool force) {
+  const clock::time_point now = now_();
+  const clock::duration rate_elapsed = now - rate_start_;
+  if (rate_elapsed >= interval_ && rate_elapsed > clock::duration::zero()) {
+    const double rate =
+        static_cast<double>(counted_bytes_ - rate_start_bytes_) / std::chrono::duration<double>(rate_elapsed).count();
+    bytes_per_second_ = has_rate_ ? bytes_per_second_ + kRateSmoothing * (rate - bytes_per_second_) : rate;
+    has_rate_ = true;
+    rate_start_ = now;
+    rate_start_bytes_ = counted_bytes_;
+  }
+  if (!force && now - last_report_ < interval_) {
+    return;
+  }
+  last_report_ = now;
+
+  Progress progress;
+  progress.transferred_bytes = transferred_bytes_;
+  progress.total_bytes = total_bytes_;
+  progress.active_transfers = active_transfers_;
+  progress.bytes_per_second = bytes_per_second_;
+  if (transferred_bytes_ >= total_bytes_) {
+    progress.eta_seconds = 0;
+  } else if (bytes_per_second_ > 0) {
+    progress.eta_seconds = static_cast<double>(total_bytes_ - transferred_bytes_) / bytes_per_second_;
+  }
+  if (callback_) {
+    callback_(progress);
+  }
+}
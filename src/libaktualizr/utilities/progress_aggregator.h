@@ -0,0 +1,98 @@
+#ifndef UTILITIES_PROGRESS_AGGREGATOR_H_
+#define UTILITIES_PROGRESS_AGGREGATOR_H_
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/**
+ * Combine the progress of the transfers going on at the same time, such as
+ * parallel downloads, into a single report given at most once per interval,
+ * with the rate of the whole and the time left at that rate.
+ *
+ * A batch starts with the first transfer and ends when there are none left;
+ * both are reported right away, whatever the interval. The callback is called
+ * with the aggregator locked, so it must not start or update transfers.
+ */
+class ProgressAggregator {
+ public:
+  using clock = std::chrono::steady_clock;
+
+  struct Progress {
+    uint64_t transferred_bytes{0};
+    uint64_t total_bytes{0};
+    size_t active_transfers{0};
+    double bytes_per_second{0};
+    // Seconds until the batch is done at that rate, negative when unknown
+    double eta_seconds{-1};
+  };
+  using Callback = std::function<void(const Progress &)>;
+
+  /** A transfer of the batch, which leaves it when destroyed. */
+  class Transfer {
+   public:
+    ~Transfer();
+    Transfer(const Transfer &) = delete;
+    Transfer(Transfer &&) = delete;
+    Transfer &operator=(const Transfer &) = delete;
+    Transfer &operator=(Transfer &&) = delete;
+
+    /** The bytes of the transfer done so far, which may go back when it starts over. */
+    void update(uint64_t transferred_bytes);
+    /** The bytes that were already there, e.g. of a download continued, which don't count in the rate. */
+    void resumeAt(uint64_t transferred_bytes);
+    /** Count the whole transfer as done when it leaves; otherwise it is taken out of the batch. */
+    void complete();
+
+   private:
+    friend class ProgressAggregator;
+    Transfer(ProgressAggregator &aggregator, uint64_t total_bytes)
+        : aggregator_{aggregator}, total_bytes_{total_bytes} {}
+
+    ProgressAggregator &aggregator_;
+    const uint64_t total_bytes_;
+    // Protected by the mutex of the aggregator
+    uint64_t transferred_bytes_{0};
+    bool complete_{false};
+  };
+
+  ProgressAggregator(clock::duration interval, Callback callback, std::function<clock::time_point()> now = clock::now);
+  ~ProgressAggregator() = default;
+  ProgressAggregator(const ProgressAggregator &) = delete;
+  ProgressAggregator(ProgressAggregator &&) = delete;
+  ProgressAggregator &operator=(const ProgressAggregator &) = delete;
+  ProgressAggregator &operator=(ProgressAggregator &&) = delete;
+
+  /** Must not outlive the aggregator. */
+  std::unique_ptr<Transfer> start(uint64_t total_bytes);
+
+ private:
+  // Weight of the rate of the last interval in the reported rate
+  static constexpr double kRateSmoothing = 0.3;
+
+  // Need mutex_
+  void add(int64_t transferred_bytes, bool counted);
+  void finish(const Transfer &transfer);
+  void report(bool force);
+
+  const clock::duration interval_;
+  const Callback callback_;
+  const std::function<clock::time_point()> now_;
+  std::mutex mutex_;
+  uint64_t transferred_bytes_{0};
+  uint64_t total_bytes_{0};
+  size_t active_transfers_{0};
+  // Bytes transferred in the batch, without those already there when the
+  // transfers started
+  uint64_t counted_bytes_{0};
+  // Start of the interval the rate is measured over
+  clock::time_point rate_start_;
+  uint64_t rate_start_bytes_{0};
+  clock::time_point last_report_;
+  double bytes_per_second_{0};
+  bool has_rate_{false};
+};
+
+#endif  // UTILITIES_PROGRESS_AGGREGATOR_H_
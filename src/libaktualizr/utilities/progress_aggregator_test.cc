@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "utilities/progress_aggregator.h"
+
+using std::chrono::milliseconds;
+
+class ProgressAggregatorTest : public ::testing::Test {
+ protected:
+  ProgressAggregatorTest()
+      : aggregator_{milliseconds(1000), [this](const ProgressAggregator::Progress &p) { reports_.push_back(p); },
+                    [this]() { return now_; }} {}
+
+  ProgressAggregator::clock::time_point now_{ProgressAggregator::clock::now()};
+  std::vector<ProgressAggregator::Progress> reports_;
+  ProgressAggregator aggregator_;
+};
+
+/* The start and the end of a batch are reported right away. */
+TEST_F(ProgressAggregatorTest, ReportsStartAndEnd) {
+  {
+    auto transfer = aggregator_.start(1000);
+    ASSERT_EQ(reports_.size(), 1);
+    EXPECT_EQ(reports_[0].transferred_bytes, 0);
+    EXPECT_EQ(reports_[0].total_bytes, 1000);
+    EXPECT_EQ(reports_[0].active_transfers, 1);
+    EXPECT_LT(reports_[0].eta_seconds, 0);
+    transfer->update(1000);
+    transfer->complete();
+  }
+  ASSERT_EQ(reports_.size(), 2);
+  EXPECT_EQ(reports_[1].transferred_bytes, 1000);
+  EXPECT_EQ(reports_[1].active_transfers, 0);
+  EXPECT_EQ(reports_[1].eta_seconds, 0);
+}
+
+/* Updates in between are reported at most once per interval. */
+TEST_F(ProgressAggregatorTest, Throttles) {
+  auto transfer = aggregator_.start(100000);
+  for (uint64_t k = 1; k <= 100; ++k) {
+    now_ += milliseconds(100);
+    transfer->update(k * 100);
+  }
+  // 10 seconds of updates, along with the start
+  EXPECT_EQ(reports_.size(), 11);
+}
+
+/* The transfers going on together are combined, with their total rate. */
+TEST_F(ProgressAggregatorTest, CombinesTransfers) {
+  auto first = aggregator_.start(10000);
+  auto second = aggregator_.start(30000);
+  EXPECT_EQ(reports_.size(), 1);
+  for (uint64_t k = 1; k <= 5; ++k) {
+    now_ += milliseconds(500);
+    first->update(k * 1000);
+    now_ += milliseconds(500);
+    second->update(k * 1000);
+  }
+  const auto &last = reports_.back();
+  EXPECT_EQ(last.transferred_bytes, 10000);
+  EXPECT_EQ(last.total_bytes, 40000);
+  EXPECT_EQ(last.active_transfers, 2);
+  EXPECT_DOUBLE_EQ(last.bytes_per_second, 2000);
+  EXPECT_DOUBLE_EQ(last.eta_seconds, 15);
+}
+
+/* A transfer that fails leaves the batch, and one that is resumed doesn't add the bytes it had to the rate. */
+TEST_F(ProgressAggregatorTest, FailedAndResumedTransfers) {
+  auto resumed = aggregator_.start(10000);
+  resumed->resumeAt(8000);
+  {
+    auto failed = aggregator_.start(5000);
+    now_ += milliseconds(1000);
+    failed->update(2000);
+    EXPECT_DOUBLE_EQ(reports_.back().bytes_per_second, 2000);
+  }
+  now_ += milliseconds(1000);
+  resumed->update(9000);
+  const auto &last = reports_.back();
+  EXPECT_EQ(last.transferred_bytes, 9000);
+  EXPECT_EQ(last.total_bytes, 10000);
+  EXPECT_EQ(last.active_transfers, 1);
+  EXPECT_DOUBLE_EQ(last.bytes_per_second, 2000 + 0.3 * (1000 - 2000));
+}
+
+/* Each batch starts afresh. */
+TEST_F(ProgressAggregatorTest, NewBatch) {
+  {
+    auto transfer = aggregator_.start(1000);
+    now_ += milliseconds(1000);
+    transfer->update(1000);
+    transfer->complete();
+  }
+  reports_.clear();
+  auto transfer = aggregator_.start(500);
+  ASSERT_EQ(reports_.size(), 1);
+  EXPECT_EQ(reports_[0].transferred_bytes, 0);
+  EXPECT_EQ(reports_[0].total_bytes, 500);
+  EXPECT_EQ(reports_[0].bytes_per_second, 0);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
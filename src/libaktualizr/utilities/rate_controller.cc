@@ -0,0 +1,112 @@
+#include "utilities/rate_controller.h"
+
+#include <algorithm>  // min, nth_element
+#include <cassert>
+#include <vector>
+
+#include "logging/logging.h"
+
+const RateController::clock::duration RateController::kMaxSleepTime = std::chrono::seconds(30);
+
+const RateController::clock::duration RateController::kInitialSleepTime = std::chrono::seconds(1);
+
+const RateController::clock::duration RateController::kStateLogInterval = std::chrono::seconds(10);
+
+RateController::RateController(const int concurrency_cap, const clock::duration latency_target)
+    : concurrency_cap_(concurrency_cap), latency_target_(latency_target) {
+  CheckInvariants();
+}
+
+void RateController::RequestCompleted(const clock::time_point start_time, const clock::time_point end_time,
+                                      const bool succeeded) {
+  RequestCompleted(start_time, end_time, succeeded ? Outcome::kSuccess : Outcome::kFailure);
+}
+
+void RateController::RequestCompleted(const clock::time_point start_time, const clock::time_point end_time,
+                                      const Outcome outcome, const clock::duration retry_after) {
+  if (outcome == Outcome::kSuccess) {
+    latencies_.push_back(end_time - start_time);
+    if (latencies_.size() > kLatencySamples) {
+      latencies_.pop_front();
+    }
+  }
+  const bool retry_later = outcome == Outcome::kOverload && retry_after > clock::duration(0);
+  if (retry_later) {
+    // Whichever request brings it, the server has said when to come back.
+    resume_time_ = std::max(resume_time_, end_time + std::min(retry_after, kMaxSleepTime));
+  }
+
+  if (last_concurrency_update_ < start_time) {
+    const int prev_concurrency = max_concurrency_;
+    last_concurrency_update_ = end_time;
+    if (outcome == Outcome::kSuccess) {
+      if (OverLatencyTarget()) {
+        max_concurrency_ = std::max(max_concurrency_ - std::max(max_concurrency_ / 4, 1), 1);
+      } else {
+        max_concurrency_ = std::min(max_concurrency_ + 1, concurrency_cap_);
+      }
+      sleep_time_ = clock::duration(0);
+    } else if (retry_later) {
+      // Not a sign of a broken server, so no sleeping towards kMaxSleepTime
+      max_concurrency_ = std::max(max_concurrency_ / 2, 1);
+    } else {
+      if (max_concurrency_ >= 2) {
+        max_concurrency_ = max_concurrency_ / 2;
+      } else {
+        sleep_time_ = std::max(sleep_time_ * 2, kInitialSleepTime);
+      }
+    }
+    if (prev_concurrency != max_concurrency_) {
+      LOG_DEBUG << "Concurrency limit is now: " << max_concurrency_;
+    }
+  }
+
+  if (end_time - last_state_log_ >= kStateLogInterval) {
+    last_state_log_ = end_time;
+    LOG_DEBUG << "Rate controller: concurrency " << max_concurrency_ << " of " << concurrency_cap_ << ", p95 latency "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(LatencyP95()).count() << " ms, sleep "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(sleep_time_).count() << " ms, resuming in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     std::max(resume_time_ - end_time, clock::duration(0)))
+                     .count()
+              << " ms";
+  }
+  CheckInvariants();
+}
+
+RateController::clock::duration RateController::LatencyP95() const {
+  if (latencies_.size() < kMinLatencySamples) {
+    return clock::duration(0);
+  }
+  std::vector<clock::duration> sorted(latencies_.begin(), latencies_.end());
+  const auto p95 = sorted.begin() + static_cast<std::ptrdiff_t>(sorted.size() * 95 / 100);
+  std::nth_element(sorted.begin(), p95, sorted.end());
+  return *p95;
+}
+
+bool RateController::OverLatencyTarget() const {
+  return latency_target_ > clock::duration(0) && LatencyP95() > latency_target_;
+}
+
+int RateController::MaxConcurrency() const {
+  CheckInvariants();
+  return max_concurrency_;
+}
+
+RateController::clock::duration RateController::GetSleepTime() const {
+  CheckInvariants();
+  return sleep_time_;
+}
+
+bool RateController::ServerHasFailed() const {
+  CheckInvariants();
+  return sleep_time_ > kMaxSleepTime;
+}
+
+// These assert()'s are compiled out in Release builds, which triggers a clang-tidy warning
+// NOLINTNEXTLINE(readability-convert-member-functions-to-static)
+void RateController::CheckInvariants() const {
+  assert((sleep_time_ == clock::duration(0)) || (max_concurrency_ == 1));
+  assert(0 < max_concurrency_);
+  assert(max_concurrency_ <= concurrency_cap_);
+}
@@ -1,22 +1,40 @@
-#ifndef SOTA_CLIENT_TOOLS_RATE_CONTROLLER_H_
-#define SOTA_CLIENT_TOOLS_RATE_CONTROLLER_H_
+#ifndef UTILITIES_RATE_CONTROLLER_H_
+#define UTILITIES_RATE_CONTROLLER_H_
 
 #include <chrono>
+#include <cstddef>
+#include <deque>
 
 /**
  * Control the rate of outgoing requests.
- * This receives signals from the network layer when a request finishes of the form (start time, end time, success).
+ * This receives signals from the network layer when a request finishes of the form (start time, end time, outcome).
  * It generates controls for the network layer in the form of:
  *    MaxConcurrency - The current estimate of the number of parallel requests that can be opened
  *    Sleep() - The number of seconds to sleep before sending the next request. 0.0 if MaxConcurrency is > 1
+ *    ResumeTime() - When the server asked with Retry-After to start requests again
  *    Failed() - A boolean indicating that the server is broken, and to report an error up to the user.
  * The congestion control is loosely based on the original TCP AIMD scheme. Better performance might be available by
  * Stealing ideas from the later TCP conjection control algorithms
+ *
+ * With a latency target, the concurrency also goes down gently while the p95 latency of the recent successful
+ * requests is over it, before the queueing in the server turns into errors.
  */
 class RateController {
  public:
   using clock = std::chrono::steady_clock;
-  explicit RateController(int concurrency_cap = 30);
+  /** How a request ended, as far as the load on the server is concerned */
+  enum class Outcome {
+    kSuccess,
+    /** A transport or server error: the server or the network may be broken */
+    kFailure,
+    /** A 429 or 503: the server is up but wants fewer requests */
+    kOverload,
+  };
+
+  /**
+   * @param latency_target p95 latency of the requests to keep under, 0 for none
+   */
+  explicit RateController(int concurrency_cap = 30, clock::duration latency_target = clock::duration(0));
   ~RateController() = default;
   RateController(const RateController&) = delete;
   RateController(RateController&&) = delete;
@@ -24,11 +42,22 @@ class RateController {
   RateController operator=(RateController&&) = delete;
 
   void RequestCompleted(clock::time_point start_time, clock::time_point end_time, bool succeeded);
+  /**
+   * @param retry_after from the Retry-After header of an overload response, 0 without one
+   */
+  void RequestCompleted(clock::time_point start_time, clock::time_point end_time, Outcome outcome,
+                        clock::duration retry_after = clock::duration(0));
 
   int MaxConcurrency() const;
 
   clock::duration GetSleepTime() const;
 
+  /** No request should start before this time. */
+  clock::time_point ResumeTime() const { return resume_time_; }
+
+  /** Of the recent successful requests, 0 before there are enough of them */
+  clock::duration LatencyP95() const;
+
   bool ServerHasFailed() const;
 
  private:
@@ -44,7 +73,15 @@ class RateController {
    */
   static const clock::duration kInitialSleepTime;
 
+  /** The latencies of the successful requests the p95 is taken from */
+  static constexpr size_t kLatencySamples = 64;
+  static constexpr size_t kMinLatencySamples = 8;
+
+  /** How often the state is logged, for tuning */
+  static const clock::duration kStateLogInterval;
+
   const int concurrency_cap_;
+  const clock::duration latency_target_;
   /**
    * After making a change to the system, we wait a full round-trip time to
    * see any effects of the change. This is the last time that an change was
@@ -54,8 +91,12 @@ class RateController {
   clock::time_point last_concurrency_update_;
   int max_concurrency_{1};
   clock::duration sleep_time_{0};
+  clock::time_point resume_time_;
+  std::deque<clock::duration> latencies_;
+  clock::time_point last_state_log_;
 
+  bool OverLatencyTarget() const;
   void CheckInvariants() const;
 };
 
-#endif  // SOTA_CLIENT_TOOLS_RATE_CONTROLLER_H_
+#endif  // UTILITIES_RATE_CONTROLLER_H_
@@ -1,6 +1,6 @@
 #include <gtest/gtest.h>
 
-#include "rate_controller.h"
+#include "utilities/rate_controller.h"
 
 /* Initial rate controller status is good. */
 TEST(initial, initially_ok) {
@@ -48,6 +48,47 @@ TEST(control, good_results_improve_concurrency) {
   EXPECT_GT(dut.MaxConcurrency(), initial_concurrency);
 }
 
+/* Rate controller waits as asked by an overloaded server, without taking it as broken. */
+TEST(control, overload_honours_retry_after) {
+  RateController dut;
+  RateController::clock::time_point t = RateController::clock::now();
+  RateController::clock::duration interval = std::chrono::seconds(2);
+  for (int i = 0; i < 100; i++) {
+    dut.RequestCompleted(t, t + interval, RateController::Outcome::kOverload, std::chrono::seconds(5));
+    t += interval;
+  }
+  EXPECT_FALSE(dut.ServerHasFailed());
+  EXPECT_EQ(dut.MaxConcurrency(), 1);
+  EXPECT_EQ(dut.ResumeTime(), t + std::chrono::seconds(5));
+
+  // Without Retry-After, as any other error
+  for (int i = 0; i < 30; i++) {
+    dut.RequestCompleted(t, t + interval, RateController::Outcome::kOverload);
+    t += interval;
+  }
+  EXPECT_TRUE(dut.ServerHasFailed());
+}
+
+/* Rate controller lowers concurrency while the p95 latency is over the target. */
+TEST(control, latency_target) {
+  RateController dut(30, std::chrono::milliseconds(500));
+  RateController::clock::time_point t = RateController::clock::now();
+  for (int i = 0; i < 20; i++) {
+    dut.RequestCompleted(t, t + std::chrono::milliseconds(100), true);
+    t += std::chrono::milliseconds(100);
+  }
+  const int fast_concurrency = dut.MaxConcurrency();
+  EXPECT_GT(fast_concurrency, 10);
+  EXPECT_EQ(dut.LatencyP95(), std::chrono::milliseconds(100));
+
+  for (int i = 0; i < 20; i++) {
+    dut.RequestCompleted(t, t + std::chrono::seconds(1), true);
+    t += std::chrono::seconds(1);
+  }
+  EXPECT_LT(dut.MaxConcurrency(), fast_concurrency);
+  EXPECT_FALSE(dut.ServerHasFailed());
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
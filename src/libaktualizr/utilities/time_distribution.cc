@@ -0,0 +1,45 @@
+#include "utilities/time_distribution.h"
+
+#include <stdexcept>
+#include <vector>
+
+#include <boost/algorithm/string.hpp>
+
+TimeDistribution TimeDistribution::parse(const std::string &description) {
+  std::vector<std::string> fields;
+  boost::split(fields, description, boost::is_any_of(":"));
+  std::vector<double> values;
+  try {
+    for (size_t i = (fields.size() == 1 ? 0 : 1); i < fields.size(); ++i) {
+      size_t end = 0;
+      values.push_back(std::stod(fields[i], &end));
+      if (end != fields[i].size() || values.back() < 0) {
+        throw std::invalid_argument(fields[i]);
+      }
+    }
+  } catch (const std::exception &) {
+    throw std::invalid_argument("Invalid time distribution: " + description);
+  }
+  if (fields.size() == 1 || (fields[0] == "fixed" && values.size() == 1)) {
+    return TimeDistribution(Kind::kFixed, values[0], 0);
+  }
+  if (fields[0] == "uniform" && values.size() == 2 && values[0] <= values[1]) {
+    return TimeDistribution(Kind::kUniform, values[0], values[1]);
+  }
+  if (fields[0] == "exponential" && values.size() == 1 && values[0] > 0) {
+    return TimeDistribution(Kind::kExponential, values[0], 0);
+  }
+  throw std::invalid_argument("Invalid time distribution: " + description);
+}
+
+std::chrono::microseconds TimeDistribution::sample(std::mt19937_64 &generator) const {
+  double seconds = first_;
+  if (kind_ == Kind::kUniform) {
+    seconds = std::uniform_real_distribution<double>(first_, second_)(generator);
+  } else if (kind_ == Kind::kExponential) {
+    seconds = std::exponential_distribution<double>(1 / first_)(generator);
+  }
+  return std::chrono::microseconds(static_cast<int64_t>(seconds * 1e6));
+}
+
+double TimeDistribution::mean() const { return kind_ == Kind::kUniform ? (first_ + second_) / 2 : first_; }
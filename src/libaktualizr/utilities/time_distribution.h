@@ -0,0 +1,31 @@
+#ifndef UTILITIES_TIME_DISTRIBUTION_H_
+#define UTILITIES_TIME_DISTRIBUTION_H_
+
+#include <chrono>
+#include <random>
+#include <string>
+
+/**
+ * A random distribution of durations, written as "fixed:S", "uniform:MIN:MAX"
+ * or "exponential:MEAN", in seconds. A plain number is a fixed duration.
+ */
+class TimeDistribution {
+ public:
+  /** @throw std::invalid_argument if the description is not one of the above */
+  static TimeDistribution parse(const std::string &description);
+
+  std::chrono::microseconds sample(std::mt19937_64 &generator) const;
+  /** The mean, in seconds */
+  double mean() const;
+
+ private:
+  enum class Kind { kFixed, kUniform, kExponential };
+
+  TimeDistribution(Kind kind, double first, double second) : kind_{kind}, first_{first}, second_{second} {}
+
+  Kind kind_;
+  double first_;
+  double second_;
+};
+
+#endif  // UTILITIES_TIME_DISTRIBUTION_H_
@@ -0,0 +1,37 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <random>
+#include <stdexcept>
+
+#include "utilities/time_distribution.h"
+
+/* Durations are drawn from the distribution described. */
+TEST(TimeDistribution, Sample) {
+  std::mt19937_64 generator(1);
+  EXPECT_EQ(TimeDistribution::parse("2.5").sample(generator), std::chrono::microseconds(2500000));
+  EXPECT_EQ(TimeDistribution::parse("fixed:1").sample(generator), std::chrono::seconds(1));
+
+  const auto uniform = TimeDistribution::parse("uniform:1:3");
+  EXPECT_DOUBLE_EQ(uniform.mean(), 2);
+  const auto exponential = TimeDistribution::parse("exponential:2");
+  std::chrono::microseconds total{0};
+  for (int i = 0; i < 10000; ++i) {
+    const auto sample = uniform.sample(generator);
+    EXPECT_GE(sample, std::chrono::seconds(1));
+    EXPECT_LE(sample, std::chrono::seconds(3));
+    total += exponential.sample(generator);
+  }
+  EXPECT_NEAR(std::chrono::duration<double>(total).count() / 10000, 2, 0.1);
+
+  for (const auto &invalid : {"", "-1", "fixed", "uniform:3:1", "exponential:0", "normal:1:2", "fixed:1s"}) {
+    EXPECT_THROW(TimeDistribution::parse(invalid), std::invalid_argument) << invalid;
+  }
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
@@ -0,0 +1,237 @@
+#include "utilities/tracing.h"
+
+#include <algorithm>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+struct TraceData {
+  struct Span {
+    std::string name;
+    std::string id;
+    std::string parent_id;
+    std::chrono::system_clock::time_point start;
+    std::chrono::system_clock::time_point end;
+    std::vector<std::pair<std::string, std::string>> attributes;
+    bool failed{false};
+    std::string error;
+  };
+
+  std::mutex mutex;
+  std::string random_id;
+  std::string correlation_id;
+  std::vector<Span> spans;
+  bool finished{false};
+};
+
+namespace {
+// The innermost span of the thread
+thread_local TraceSpan *current_span = nullptr;
+
+std::string randomHex(size_t size) {
+  std::string hex = Utils::randomUuid();
+  hex.erase(std::remove(hex.begin(), hex.end(), '-'), hex.end());
+  return hex.substr(0, size);
+}
+
+std::string unixNano(std::chrono::system_clock::time_point time) {
+  return std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+Json::Value stringAttribute(const std::string &key, const std::string &value) {
+  Json::Value attribute;
+  attribute["key"] = key;
+  attribute["value"]["stringValue"] = value;
+  return attribute;
+}
+}  // namespace
+
+Tracer::Tracer(boost::filesystem::path output) : enabled_{!output.empty()}, output_{std::move(output)} {}
+
+std::string Tracer::traceId(const std::string &correlation_id) {
+  // Two 64-bit FNV-1a hashes, so that the ID is the same on every run
+  uint64_t hashes[2]{14695981039346656037ULL, 14695981039346656037ULL ^ 0x5bd1e9955bd1e995ULL};
+  for (auto &hash : hashes) {
+    for (const char c : correlation_id) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+    }
+  }
+  std::ostringstream id;
+  id << std::hex << std::setfill('0') << std::setw(16) << hashes[0] << std::setw(16) << hashes[1];
+  return id.str();
+}
+
+Json::Value Tracer::summary(const std::string &correlation_id) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (correlation_id.empty() || correlation_id != summary_correlation_id_) {
+    return Json::nullValue;
+  }
+  return summary_;
+}
+
+void Tracer::finish(const TraceData &trace) {
+  const std::string trace_id = trace.correlation_id.empty() ? trace.random_id : traceId(trace.correlation_id);
+  Json::Value spans(Json::arrayValue);
+  Json::Value summary(Json::arrayValue);
+  for (const auto &span : trace.spans) {
+    Json::Value json;
+    json["traceId"] = trace_id;
+    json["spanId"] = span.id;
+    if (!span.parent_id.empty()) {
+      json["parentSpanId"] = span.parent_id;
+    }
+    json["name"] = span.name;
+    json["kind"] = 1;  // SPAN_KIND_INTERNAL
+    json["startTimeUnixNano"] = unixNano(span.start);
+    json["endTimeUnixNano"] = unixNano(span.end);
+    json["attributes"] = Json::arrayValue;
+    if (!trace.correlation_id.empty()) {
+      json["attributes"].append(stringAttribute("correlation_id", trace.correlation_id));
+    }
+    Json::Value phase;
+    phase["name"] = span.name;
+    phase["duration_ms"] =
+        Json::Int64(std::chrono::duration_cast<std::chrono::milliseconds>(span.end - span.start).count());
+    for (const auto &attribute : span.attributes) {
+      json["attributes"].append(stringAttribute(attribute.first, attribute.second));
+      phase[attribute.first] = attribute.second;
+    }
+    json["status"]["code"] = span.failed ? 2 : 1;  // STATUS_CODE_ERROR or STATUS_CODE_OK
+    if (span.failed) {
+      json["status"]["message"] = span.error;
+      phase["error"] = span.error;
+    }
+    spans.append(json);
+    summary.append(phase);
+  }
+
+  Json::Value resource_spans;
+  resource_spans["resource"]["attributes"].append(stringAttribute("service.name", "aktualizr"));
+  resource_spans["scopeSpans"][0]["scope"]["name"] = "aktualizr";
+  resource_spans["scopeSpans"][0]["spans"] = spans;
+  Json::Value line;
+  line["resourceSpans"].append(resource_spans);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::ofstream file(output_.string(), std::ios::app);
+  file << Utils::jsonToCanonicalStr(line) << "\n";
+  if (!file.good()) {
+    LOG_WARNING << "Could not write the trace to " << output_;
+  }
+  if (!trace.correlation_id.empty()) {
+    if (trace.correlation_id != summary_correlation_id_) {
+      summary_correlation_id_ = trace.correlation_id;
+      summary_ = Json::arrayValue;
+    }
+    for (const auto &phase : summary) {
+      summary_.append(phase);
+    }
+  }
+}
+
+TraceSpan::TraceSpan(Tracer *tracer, const char *name) {
+  if (tracer == nullptr || !tracer->enabled()) {
+    return;
+  }
+  tracer_ = tracer;
+  std::string parent_id;
+  if (current_span != nullptr && current_span->tracer_ == tracer) {
+    trace_ = current_span->trace_;
+    std::lock_guard<std::mutex> lock(trace_->mutex);
+    parent_id = trace_->spans[current_span->index_].id;
+  } else {
+    trace_ = std::make_shared<TraceData>();
+    trace_->random_id = randomHex(32);
+  }
+  start(name, std::move(parent_id));
+}
+
+TraceSpan::TraceSpan(const TraceSpan &parent, const char *name) {
+  if (!parent.trace_) {
+    return;
+  }
+  tracer_ = parent.tracer_;
+  trace_ = parent.trace_;
+  std::string parent_id;
+  {
+    std::lock_guard<std::mutex> lock(trace_->mutex);
+    parent_id = trace_->spans[parent.index_].id;
+  }
+  start(name, std::move(parent_id));
+}
+
+void TraceSpan::start(const char *name, std::string parent_id) {
+  TraceData::Span span;
+  span.name = name;
+  span.id = randomHex(16);
+  span.parent_id = std::move(parent_id);
+  span.start = std::chrono::system_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(trace_->mutex);
+    index_ = trace_->spans.size();
+    trace_->spans.push_back(std::move(span));
+  }
+  exceptions_ = std::uncaught_exceptions();
+  previous_ = current_span;
+  current_span = this;
+}
+
+TraceSpan::~TraceSpan() {
+  if (!trace_) {
+    return;
+  }
+  if (current_span == this) {
+    current_span = previous_;
+  }
+  const bool failed = std::uncaught_exceptions() > exceptions_;
+  std::lock_guard<std::mutex> lock(trace_->mutex);
+  if (trace_->finished) {
+    // A child that outlived the root
+    return;
+  }
+  auto &span = trace_->spans[index_];
+  span.end = std::chrono::system_clock::now();
+  if (failed && !span.failed) {
+    span.failed = true;
+    span.error = "exception";
+  }
+  if (index_ == 0) {
+    trace_->finished = true;
+    try {
+      tracer_->finish(*trace_);
+    } catch (const std::exception &e) {
+      LOG_WARNING << "Could not export a trace: " << e.what();
+    }
+  }
+}
+
+void TraceSpan::setAttribute(const char *key, const std::string &value) {
+  if (!trace_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(trace_->mutex);
+  trace_->spans[index_].attributes.emplace_back(key, value);
+}
+
+void TraceSpan::setCorrelationId(const std::string &correlation_id) {
+  if (!trace_ || correlation_id.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(trace_->mutex);
+  if (trace_->correlation_id.empty()) {
+    trace_->correlation_id = correlation_id;
+  }
+}
+
+void TraceSpan::setError(const std::string &message) {
+  if (!trace_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(trace_->mutex);
+  trace_->spans[index_].failed = true;
+  trace_->spans[index_].error = message;
+}
@@ -0,0 +1,86 @@
+#ifndef UTILITIES_TRACING_H_
+#define UTILITIES_TRACING_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+
+struct TraceData;
+
+/**
+ * Collects the spans of the phases of the client and appends each trace, once
+ * its root span ends, to a file as a line of OpenTelemetry (OTLP/JSON)
+ * ResourceSpans, for a collector to pick up.
+ *
+ * The spans of a trace belong to the update of a correlation ID when one is
+ * set, which gives them all the trace ID derived from it: the update check,
+ * download and installation of an update are separate traces sharing an ID.
+ *
+ * A default-constructed Tracer is disabled, and its spans cost a pointer test.
+ */
+class Tracer {
+ public:
+  Tracer() = default;
+  explicit Tracer(boost::filesystem::path output);
+  ~Tracer() = default;
+  Tracer(const Tracer &) = delete;
+  Tracer(Tracer &&) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+  Tracer &operator=(Tracer &&) = delete;
+
+  bool enabled() const { return enabled_; }
+  /**
+   * The durations of the spans of the traces with this correlation ID that
+   * ended so far, for the installation report; null when there are none.
+   * Only the summary of the latest correlation ID is kept.
+   */
+  Json::Value summary(const std::string &correlation_id) const;
+  static std::string traceId(const std::string &correlation_id);
+
+ private:
+  friend class TraceSpan;
+  void finish(const TraceData &trace);
+
+  bool enabled_{false};
+  boost::filesystem::path output_;
+  mutable std::mutex mutex_;
+  std::string summary_correlation_id_;
+  Json::Value summary_;
+};
+
+/**
+ * A span from construction to destruction. It is a child of the innermost
+ * span of the same thread, or of an explicit parent for work done on other
+ * threads, and the root of a new trace otherwise. A span ended by an
+ * exception has an error status.
+ */
+class TraceSpan {
+ public:
+  TraceSpan(Tracer *tracer, const char *name);
+  TraceSpan(const TraceSpan &parent, const char *name);
+  ~TraceSpan();
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan(TraceSpan &&) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+  TraceSpan &operator=(TraceSpan &&) = delete;
+
+  void setAttribute(const char *key, const std::string &value);
+  /** Ties the trace to an update, unless it already is; ignored when empty. */
+  void setCorrelationId(const std::string &correlation_id);
+  void setError(const std::string &message);
+
+ private:
+  void start(const char *name, std::string parent_id);
+
+  Tracer *tracer_{nullptr};
+  std::shared_ptr<TraceData> trace_;
+  TraceSpan *previous_{nullptr};
+  size_t index_{0};
+  int exceptions_{0};
+};
+
+#endif  // UTILITIES_TRACING_H_
@@ -0,0 +1,135 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <boost/filesystem.hpp>
+
+#include "utilities/tracing.h"
+#include "utilities/utils.h"
+
+namespace {
+std::vector<Json::Value> readTraces(const boost::filesystem::path &path) {
+  std::vector<Json::Value> traces;
+  std::istringstream lines(Utils::readFile(path));
+  std::string line;
+  while (std::getline(lines, line)) {
+    traces.push_back(Utils::parseJSON(line)["resourceSpans"][0]["scopeSpans"][0]["spans"]);
+  }
+  return traces;
+}
+
+std::string attribute(const Json::Value &span, const std::string &key) {
+  for (const auto &a : span["attributes"]) {
+    if (a["key"].asString() == key) {
+      return a["value"]["stringValue"].asString();
+    }
+  }
+  return "";
+}
+}  // namespace
+
+/* A disabled tracer writes nothing. */
+TEST(Tracing, Disabled) {
+  Tracer tracer;
+  EXPECT_FALSE(tracer.enabled());
+  TraceSpan span(&tracer, "phase");
+  span.setCorrelationId("id");
+  span.setAttribute("key", "value");
+  TraceSpan child(span, "child");
+  TraceSpan no_tracer(nullptr, "phase");
+  EXPECT_TRUE(tracer.summary("id").isNull());
+}
+
+/* Spans nest on the same thread and under an explicit parent on other threads,
+ * and a trace is written when its root span ends. */
+TEST(Tracing, Nesting) {
+  TemporaryDirectory temp_dir;
+  const auto path = temp_dir / "trace.json";
+  Tracer tracer(path);
+  ASSERT_TRUE(tracer.enabled());
+  {
+    TraceSpan root(&tracer, "uptaneInstall");
+    {
+      TraceSpan child(&tracer, "sendImagesToEcus");
+      std::thread thread([&child]() {
+        TraceSpan install(child, "install");
+        install.setAttribute("ecu", "secondary");
+        install.setError("kInstallFailed");
+      });
+      thread.join();
+    }
+    EXPECT_TRUE(readTraces(path).empty());
+    root.setCorrelationId("urn:here-ota:campaign:1");
+    root.setCorrelationId("ignored");
+  }
+  {
+    TraceSpan other(&tracer, "putManifest");
+  }
+
+  const auto traces = readTraces(path);
+  ASSERT_EQ(traces.size(), 2);
+  const Json::Value &spans = traces[0];
+  ASSERT_EQ(spans.size(), 3);
+  EXPECT_EQ(spans[0]["name"].asString(), "uptaneInstall");
+  EXPECT_FALSE(spans[0].isMember("parentSpanId"));
+  EXPECT_EQ(spans[1]["name"].asString(), "sendImagesToEcus");
+  EXPECT_EQ(spans[1]["parentSpanId"], spans[0]["spanId"]);
+  EXPECT_EQ(spans[2]["name"].asString(), "install");
+  EXPECT_EQ(spans[2]["parentSpanId"], spans[1]["spanId"]);
+  EXPECT_EQ(attribute(spans[2], "ecu"), "secondary");
+  EXPECT_EQ(spans[2]["status"]["code"].asInt(), 2);
+  EXPECT_EQ(spans[0]["status"]["code"].asInt(), 1);
+  for (const auto &span : spans) {
+    EXPECT_EQ(span["traceId"].asString(), Tracer::traceId("urn:here-ota:campaign:1"));
+    EXPECT_EQ(attribute(span, "correlation_id"), "urn:here-ota:campaign:1");
+    EXPECT_EQ(span["spanId"].asString().size(), 16);
+    EXPECT_LE(std::stoull(span["startTimeUnixNano"].asString()), std::stoull(span["endTimeUnixNano"].asString()));
+  }
+  EXPECT_EQ(Tracer::traceId("urn:here-ota:campaign:1").size(), 32);
+
+  ASSERT_EQ(traces[1].size(), 1);
+  EXPECT_NE(traces[1][0]["traceId"], spans[0]["traceId"]);
+  EXPECT_EQ(traces[1][0]["traceId"].asString().size(), 32);
+}
+
+/* A span ended by an exception fails, and the summary of an update has the
+ * phases of all its traces. */
+TEST(Tracing, Summary) {
+  TemporaryDirectory temp_dir;
+  Tracer tracer(temp_dir / "trace.json");
+  {
+    TraceSpan download(&tracer, "downloadImages");
+    download.setCorrelationId("update-1");
+  }
+  try {
+    TraceSpan install(&tracer, "uptaneInstall");
+    install.setCorrelationId("update-1");
+    throw std::runtime_error("failure");
+  } catch (const std::runtime_error &) {
+  }
+
+  const Json::Value summary = tracer.summary("update-1");
+  ASSERT_EQ(summary.size(), 2);
+  EXPECT_EQ(summary[0]["name"].asString(), "downloadImages");
+  EXPECT_GE(summary[0]["duration_ms"].asInt64(), 0);
+  EXPECT_FALSE(summary[0].isMember("error"));
+  EXPECT_EQ(summary[1]["name"].asString(), "uptaneInstall");
+  EXPECT_TRUE(summary[1].isMember("error"));
+  EXPECT_TRUE(tracer.summary("update-0").isNull());
+
+  {
+    TraceSpan check(&tracer, "fetchMeta");
+    check.setCorrelationId("update-2");
+  }
+  EXPECT_TRUE(tracer.summary("update-1").isNull());
+  EXPECT_EQ(tracer.summary("update-2").size(), 1);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
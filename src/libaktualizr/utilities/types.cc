@@ -1,6 +1,8 @@
 #include <array>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
+#include <unordered_set>
 #include <utility>
 
 #include "libaktualizr/types.h"
@@ -15,6 +17,9 @@ std::ostream &operator<<(std::ostream &os, const StorageType stype) {
     case StorageType::kSqlite:
       stype_str = "sqlite";
       break;
+    case StorageType::kMemory:
+      stype_str = "memory";
+      break;
     default:
       stype_str = "unknown";
       break;
@@ -23,6 +28,15 @@ std::ostream &operator<<(std::ostream &os, const StorageType stype) {
   return os;
 }
 
+const std::string *Uptane::internIdentifier(const std::string &value) {
+  // Never destroyed, for identifiers used until the very end. The elements of
+  // an unordered_set stay where they are when it grows.
+  static auto *identifiers = new std::unordered_set<std::string>();
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> guard(mutex);
+  return &*identifiers->insert(value).first;
+}
+
 std::ostream &Uptane::operator<<(std::ostream &os, const HardwareIdentifier &hwid) {
   os << hwid.ToString();
   return os;
@@ -59,7 +73,56 @@ std::string TimeToString(struct tm time) {
   return std::string(formatted.data());
 }
 
-TimeStamp TimeStamp::Now() { return TimeStamp(CurrentTime()); }
+namespace {
+
+// Days from 1970-01-01 to the given date of the proleptic Gregorian calendar
+int64_t daysFromCivil(int64_t year, int64_t month, int64_t day) {
+  year -= month <= 2 ? 1 : 0;
+  const int64_t era = (year >= 0 ? year : year - 399) / 400;
+  const int64_t year_of_era = year - era * 400;
+  const int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+  return era * 146097 + day_of_era - 719468;
+}
+
+// Parse the `YYYY-MM-DDTHH:MM:SSZ` form of RFC 3339 that TUF uses.
+bool parseRfc3339(const std::string &rfc3339, int64_t *epoch) {
+  if (rfc3339.length() != 20 || rfc3339[4] != '-' || rfc3339[7] != '-' || rfc3339[10] != 'T' ||
+      rfc3339[13] != ':' || rfc3339[16] != ':' || rfc3339[19] != 'Z') {
+    return false;
+  }
+  bool digits = true;
+  auto field = [&rfc3339, &digits](size_t pos, size_t len) {
+    int64_t value = 0;
+    for (size_t i = pos; i < pos + len; ++i) {
+      if (rfc3339[i] < '0' || rfc3339[i] > '9') {
+        digits = false;
+        return value;
+      }
+      value = value * 10 + (rfc3339[i] - '0');
+    }
+    return value;
+  };
+  const int64_t year = field(0, 4);
+  const int64_t month = field(5, 2);
+  const int64_t day = field(8, 2);
+  const int64_t hour = field(11, 2);
+  const int64_t minute = field(14, 2);
+  const int64_t second = field(17, 2);
+  // A leap second counts as the first second of the next minute.
+  if (!digits || month < 1 || month > 12 || day < 1 || day > 31 || hour > 23 || minute > 59 || second > 60) {
+    return false;
+  }
+  *epoch = daysFromCivil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+  return true;
+}
+
+}  // namespace
+
+TimeStamp TimeStamp::Now() {
+  struct tm now = CurrentTime();
+  return TimeStamp(TimeToString(now), static_cast<int64_t>(timegm(&now)));
+}
 
 struct tm TimeStamp::CurrentTime() {
   time_t raw_time;
@@ -71,14 +134,24 @@ struct tm TimeStamp::CurrentTime() {
 }
 
 TimeStamp::TimeStamp(std::string rfc3339) {
-  if (rfc3339.length() != 20 || rfc3339[19] != 'Z') {
+  if (!parseRfc3339(rfc3339, &epoch_)) {
     throw TimeStamp::InvalidTimeStamp();
   }
-  time_ = rfc3339;
+  time_ = std::move(rfc3339);
 }
 
 TimeStamp::TimeStamp(struct tm time) : TimeStamp(TimeToString(time)) {}
 
+TimeStamp TimeStamp::Earliest(const TimeStamp &a, const TimeStamp &b) {
+  if (!a.IsValid()) {
+    return b;
+  }
+  if (!b.IsValid()) {
+    return a;
+  }
+  return b < a ? b : a;
+}
+
 bool TimeStamp::IsValid() const { return time_.length() != 0; }
 
 bool TimeStamp::IsExpiredAt(const TimeStamp &now) const {
@@ -91,7 +164,7 @@ bool TimeStamp::IsExpiredAt(const TimeStamp &now) const {
   return *this < now;
 }
 
-bool TimeStamp::operator<(const TimeStamp &other) const { return IsValid() && other.IsValid() && time_ < other.time_; }
+bool TimeStamp::operator<(const TimeStamp &other) const { return IsValid() && other.IsValid() && epoch_ < other.epoch_; }
 
 bool TimeStamp::operator>(const TimeStamp &other) const { return (other < *this); }
 
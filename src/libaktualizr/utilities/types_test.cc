@@ -19,7 +19,35 @@ TEST(Types, TimeStampParsing) {
 }
 
 /* Throw an exception if an Uptane timestamp is invalid. */
-TEST(Types, TimeStampParsingInvalid) { EXPECT_THROW(TimeStamp("2038-01-19T0"), TimeStamp::InvalidTimeStamp); }
+TEST(Types, TimeStampParsingInvalid) {
+  EXPECT_THROW(TimeStamp("2038-01-19T0"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-19 03:14:06Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-13-19T03:14:06Z"), TimeStamp::InvalidTimeStamp);
+  EXPECT_THROW(TimeStamp("2038-01-19T03:1x:06Z"), TimeStamp::InvalidTimeStamp);
+}
+
+/* Timestamps are converted to seconds since the epoch, which they are compared by. */
+TEST(Types, TimeStampEpoch) {
+  EXPECT_EQ(TimeStamp("1970-01-01T00:00:00Z").ToEpoch(), 0);
+  EXPECT_EQ(TimeStamp("2000-02-29T12:34:56Z").ToEpoch(), 951827696);
+  EXPECT_EQ(TimeStamp("2038-01-19T03:14:08Z").ToEpoch(), 2147483648);
+  EXPECT_EQ(TimeStamp("2100-03-01T00:00:00Z").ToEpoch(), 4107542400);
+  EXPECT_EQ(TimeStamp().ToEpoch(), 0);
+
+  const TimeStamp t_now = TimeStamp::Now();
+  EXPECT_EQ(TimeStamp(t_now.ToString()).ToEpoch(), t_now.ToEpoch());
+}
+
+/* The earliest of two timestamps ignores an invalid one. */
+TEST(Types, TimeStampEarliest) {
+  const TimeStamp t_old("2038-01-19T02:00:00Z");
+  const TimeStamp t_new("2038-01-19T03:14:06Z");
+  EXPECT_EQ(TimeStamp::Earliest(t_old, t_new), t_old);
+  EXPECT_EQ(TimeStamp::Earliest(t_new, t_old), t_old);
+  EXPECT_EQ(TimeStamp::Earliest(TimeStamp(), t_new), t_new);
+  EXPECT_EQ(TimeStamp::Earliest(t_old, TimeStamp()), t_old);
+  EXPECT_FALSE(TimeStamp::Earliest(TimeStamp(), TimeStamp()).IsValid());
+}
 
 /* Get current time. */
 TEST(Types, TimeStampNow) {
@@ -48,6 +76,21 @@ TEST(Types, ResultCode) {
   EXPECT_EQ(data::ResultCode::fromRepr("OK"), data::ResultCode(data::ResultCode::Numeric::kUnknown, "OK"));
 }
 
+/* Equal identifiers share one string and still sort by their value. */
+TEST(Types, InternedIdentifiers) {
+  const Uptane::EcuSerial serial("ecu-b");
+  const Uptane::EcuSerial same(std::string("ecu-") + "b");
+  EXPECT_EQ(serial, same);
+  EXPECT_EQ(&serial.ToString(), &same.ToString());
+  EXPECT_LT(Uptane::EcuSerial("ecu-a"), serial);
+  EXPECT_FALSE(serial < same);
+
+  const Uptane::HardwareIdentifier hw_id("hw-b");
+  EXPECT_EQ(&hw_id.ToString(), &Uptane::HardwareIdentifier("hw-b").ToString());
+  EXPECT_NE(hw_id, Uptane::HardwareIdentifier("hw-a"));
+  EXPECT_LT(Uptane::HardwareIdentifier("hw-a"), hw_id);
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -2,11 +2,13 @@
 
 #include <algorithm>
 #include <array>
+#include <cstddef>
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <random>
 #include <sstream>
 #include <stdexcept>
@@ -18,20 +20,26 @@
 #include <fcntl.h>
 #include <glob.h>
 #include <ifaddrs.h>
+#include <linux/fs.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <boost/algorithm/string.hpp>
-#include <boost/archive/iterators/base64_from_binary.hpp>
-#include <boost/archive/iterators/binary_from_base64.hpp>
-#include <boost/archive/iterators/remove_whitespace.hpp>
-#include <boost/archive/iterators/transform_width.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
 #include "aktualizr_version.h"
+#include "canonical_json.h"
+#include "command.h"
+#include "encoding.h"
+#include "json_parser.h"
 #include "logging/logging.h"
 
 static const std::array<const char *, 132> adverbs = {
@@ -182,27 +190,13 @@ static const std::array<const char *, 128> names = {"Allerlei",
                                                     "Zwetschkenroester",
                                                     "Zwiebelkuchen"};
 
-using base64_text = boost::archive::iterators::base64_from_binary<
-    boost::archive::iterators::transform_width<std::string::const_iterator, 6, 8> >;
+std::string Utils::fromBase64(const std::string &base64_string) { return encoding::fromBase64(base64_string); }
 
-using base64_to_bin = boost::archive::iterators::transform_width<
-    boost::archive::iterators::binary_from_base64<
-        boost::archive::iterators::remove_whitespace<std::string::const_iterator> >,
-    8, 6>;
+std::string Utils::toBase64(const std::string &tob64) { return encoding::toBase64(tob64); }
 
-std::string Utils::fromBase64(std::string base64_string) {
-  std::ptrdiff_t paddingChars = std::count(base64_string.begin(), base64_string.end(), '=');
-  std::replace(base64_string.begin(), base64_string.end(), '=', 'A');
-  std::string result(base64_to_bin(base64_string.begin()), base64_to_bin(base64_string.end()));
-  result.erase(result.end() - paddingChars, result.end());
-  return result;
-}
+std::string Utils::toHex(const std::string &data, bool lower_case) { return encoding::toHex(data, lower_case); }
 
-std::string Utils::toBase64(const std::string &tob64) {
-  std::string b64sig(base64_text(tob64.begin()), base64_text(tob64.end()));
-  b64sig.append((3 - tob64.length() % 3) % 3, '=');
-  return b64sig;
-}
+std::string Utils::fromHex(const std::string &hex) { return encoding::fromHex(hex); }
 
 // Strip leading and trailing quotes
 std::string Utils::stripQuotes(const std::string &value) {
@@ -242,9 +236,9 @@ std::string Utils::extractField(const std::string &in, unsigned int field_id) {
 }
 
 Json::Value Utils::parseJSON(const std::string &json_str) {
-  std::istringstream strs(json_str);
+  // Parse in place rather than through a stream, which would copy the input.
   Json::Value json_value;
-  parseFromStream(Json::CharReaderBuilder(), strs, &json_value, nullptr);
+  JsonParser().parse(json_str, &json_value);
   return json_value;
 }
 
@@ -350,22 +344,31 @@ std::string Utils::jsonToStr(const Json::Value &json) {
 }
 
 std::string Utils::jsonToCanonicalStr(const Json::Value &json) {
-  static Json::StreamWriterBuilder wbuilder = []() {
-    Json::StreamWriterBuilder w;
-    wbuilder["indentation"] = "";
-    return w;
-  }();
-  return Json::writeString(wbuilder, json);
+  // Buffers of up to this size are kept for the next call
+  static constexpr size_t kKeptBufferSize = 64 * 1024;
+  thread_local CanonicalJsonWriter writer;
+  const std::string &result = writer.write(json);
+  if (result.capacity() > kKeptBufferSize) {
+    return writer.release();
+  }
+  return result;
 }
 
 Json::Value Utils::getHardwareInfo() {
   std::string result;
-  const int exit_code = shell("lshw -json", &result);
+  CommandOptions options;
+  options.timeout = std::chrono::minutes(2);
+  options.max_output = 16 * 1024 * 1024;
+  const CommandResult lshw = runCommand({"lshw", "-json"}, &result, options);
 
-  if (exit_code != 0) {
+  if (!lshw.ok()) {
     LOG_WARNING << "Could not execute lshw (is it installed?).";
     return Json::Value();
   }
+  if (lshw.output_truncated) {
+    LOG_WARNING << "The output of lshw is too large.";
+    return Json::Value();
+  }
   const Json::Value parsed = Utils::parseJSON(result);
   return (parsed.isArray()) ? parsed[0] : parsed;
 }
@@ -456,6 +459,81 @@ std::string Utils::randomUuid() {
 
 // Note that this doesn't work with broken symlinks.
 // NOLINTNEXTLINE(misc-no-recursion)
+// Copy what is left of in to out with a copy in the kernel. Returns false if
+// it isn't supported for these files, in which case nothing more was copied.
+static bool copyInKernel(int in, int out, bool use_sendfile) {
+  static constexpr size_t chunk = 1U << 30U;
+  for (;;) {
+    const ssize_t copied = use_sendfile ? sendfile(out, in, nullptr, chunk)
+                                        : copy_file_range(in, nullptr, out, nullptr, chunk, 0);
+    if (copied == 0) {
+      return true;
+    }
+    if (copied < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      if (errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF) {
+        return false;
+      }
+      throw std::runtime_error(std::string("Error copying file: ") + std::strerror(errno));
+    }
+  }
+}
+
+void Utils::copyFile(const boost::filesystem::path &from, const boost::filesystem::path &to) {
+  const int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    throw std::runtime_error("Error opening file " + from.string() + ": " + std::strerror(errno));
+  }
+  struct stat st {};
+  if (fstat(in, &st) != 0) {
+    const int err = errno;
+    close(in);
+    throw std::runtime_error("Error reading file " + from.string() + ": " + std::strerror(err));
+  }
+  const int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 07777U);
+  if (out < 0) {
+    const int err = errno;
+    close(in);
+    throw std::runtime_error("Error opening file " + to.string() + ": " + std::strerror(err));
+  }
+
+  try {
+    bool done = false;
+#ifdef FICLONE
+    done = ioctl(out, FICLONE, in) == 0;
+#endif
+    done = done || copyInKernel(in, out, false) || copyInKernel(in, out, true);
+    std::array<char, 64 * 1024> buf{};
+    while (!done) {
+      const ssize_t n = read(in, buf.data(), buf.size());
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        throw std::runtime_error(std::string("Error reading file: ") + std::strerror(errno));
+      }
+      done = n == 0;
+      for (ssize_t written = 0; written < n;) {
+        const ssize_t w = write(out, buf.data() + written, static_cast<size_t>(n - written));
+        if (w < 0 && errno != EINTR) {
+          throw std::runtime_error(std::string("Error writing file: ") + std::strerror(errno));
+        }
+        written += std::max<ssize_t>(w, 0);
+      }
+    }
+  } catch (const std::exception &e) {
+    close(in);
+    close(out);
+    throw std::runtime_error("Error copying " + from.string() + " to " + to.string() + ": " + e.what());
+  }
+  close(in);
+  if (close(out) != 0) {
+    throw std::runtime_error("Error writing file " + to.string() + ": " + std::strerror(errno));
+  }
+}
+
 void Utils::copyDir(const boost::filesystem::path &from, const boost::filesystem::path &to) {
   boost::filesystem::remove_all(to);
 
@@ -466,12 +544,13 @@ void Utils::copyDir(const boost::filesystem::path &from, const boost::filesystem
     if (boost::filesystem::is_directory(it->path())) {
       copyDir(it->path(), to / it->path().filename());
     } else {
-      boost::filesystem::copy_file(it->path(), to / it->path().filename());
+      copyFile(it->path(), to / it->path().filename());
     }
   }
 }
 
-std::string Utils::readFileFromArchive(std::istream &as, const std::string &filename, const bool trim) {
+std::map<std::string, std::string> Utils::readFilesFromArchive(std::istream &as,
+                                                              const std::set<std::string> &filenames) {
   StructGuardInt<struct archive> a(archive_read_new(), archive_read_free);
   if (a == nullptr) {
     LOG_ERROR << "archive error: could not initialize archive object";
@@ -486,15 +565,17 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
     throw std::runtime_error("archive error");
   }
 
-  bool found = false;
-  std::stringstream out_stream;
+  std::map<std::string, std::string> files;
   struct archive_entry *entry;
-  while (archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
-    if (filename != archive_entry_pathname(entry)) {
+  // Stop at the last of the files, instead of going through the rest of the archive
+  while (files.size() < filenames.size() && archive_read_next_header(a.get(), &entry) == ARCHIVE_OK) {
+    const std::string pathname = archive_entry_pathname(entry);
+    if (filenames.count(pathname) == 0 || files.count(pathname) != 0) {
       archive_read_data_skip(a.get());
       continue;
     }
 
+    std::string content;
     const char *buff;
     size_t size;
     int64_t offset;
@@ -502,14 +583,14 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
     for (;;) {
       r = archive_read_data_block(a.get(), reinterpret_cast<const void **>(&buff), &size, &offset);
       if (r == ARCHIVE_EOF) {
-        found = true;
+        files.emplace(pathname, std::move(content));
         break;
       } else if (r != ARCHIVE_OK) {
         LOG_ERROR << "archive error: " << archive_error_string(a.get());
         break;
       }
       if (size > 0 && buff != nullptr) {
-        out_stream.write(buff, static_cast<ssize_t>(size));
+        content.append(buff, size);
       }
     }
   }
@@ -518,12 +599,16 @@ std::string Utils::readFileFromArchive(std::istream &as, const std::string &file
   if (r != ARCHIVE_OK) {
     LOG_ERROR << "archive error: " << archive_error_string(a.get());
   }
+  return files;
+}
 
-  if (!found) {
+std::string Utils::readFileFromArchive(std::istream &as, const std::string &filename, const bool trim) {
+  auto files = readFilesFromArchive(as, {filename});
+  if (files.empty()) {
     throw std::runtime_error("could not extract " + filename + " from archive");
   }
 
-  std::string result = out_stream.str();
+  std::string result = std::move(files.begin()->second);
   if (trim) {
     boost::trim_if(result, boost::is_any_of(" \t\r\n"));
   }
@@ -724,23 +809,16 @@ int Utils::ipPort(const sockaddr_storage &saddr) {
 }
 
 int Utils::shell(const std::string &command, std::string *output, bool include_stderr) {
-  std::array<char, 128> buffer{};
-  std::string full_command(command);
-  if (include_stderr) {
-    full_command += " 2>&1";
-  }
-  FILE *pipe = popen(full_command.c_str(), "r");
-  if (pipe == nullptr) {
-    *output = "popen() failed!";
-    return -1;
-  }
-  while (feof(pipe) == 0) {
-    if (fgets(buffer.data(), buffer.size(), pipe) != nullptr) {
-      *output += buffer.data();
-    }
+  // All of the output, with the standard input of the caller, as popen() did
+  CommandOptions options;
+  options.max_output = std::numeric_limits<size_t>::max();
+  options.include_stderr = include_stderr;
+  options.inherit_stdin = true;
+  const CommandResult result = runCommand({"/bin/sh", "-c", command}, output, options);
+  if (result.status == CommandResult::Status::kSpawnFailed && output != nullptr) {
+    *output = result.error;
   }
-  int exitcode = pclose(pipe);
-  return WEXITSTATUS(exitcode);
+  return result.exit_code;
 }
 
 boost::filesystem::path Utils::absolutePath(const boost::filesystem::path &root, const boost::filesystem::path &file) {
@@ -927,17 +1005,38 @@ boost::filesystem::path TemporaryDirectory::operator/(const boost::filesystem::p
 
 std::string TemporaryDirectory::PathString() const { return Path().string(); }
 
-Socket::Socket() {
-  socket_fd_ = socket(AF_INET, SOCK_STREAM, 0);
-  if (-1 == socket_fd_) {
-    throw std::system_error(errno, std::system_category(), "socket");
+bool Utils::isUnixSocketAddress(const std::string &address) { return boost::starts_with(address, kUnixSocketPrefix); }
+
+// The address of the Unix domain socket at path
+static socklen_t unixSockaddr(const std::string &path, sockaddr_storage *saddr) {
+  auto *sa = reinterpret_cast<sockaddr_un *>(saddr);
+  if (path.empty() || path.size() >= sizeof(sa->sun_path)) {
+    throw std::invalid_argument("Invalid Unix domain socket path: " + path);
   }
+  memset(saddr, 0, sizeof(*saddr));
+  sa->sun_family = AF_UNIX;
+  std::copy(path.begin(), path.end(), &sa->sun_path[0]);
+  return static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + path.size() + 1);
 }
 
+Socket::Socket() : socket_fd_(newSocket(AF_INET)) {}
+
 Socket::~Socket() { ::close(socket_fd_); }
 
+int Socket::newSocket(int domain) {
+  const int fd = socket(domain, SOCK_STREAM, 0);
+  if (-1 == fd) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  return fd;
+}
+
 std::string Socket::ToString() const {
   auto saddr = Utils::ipGetSockaddr(socket_fd_);
+  if (saddr.ss_family == AF_UNIX) {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-bounds-array-to-pointer-decay)
+    return std::string(kUnixSocketPrefix) + reinterpret_cast<const sockaddr_un *>(&saddr)->sun_path;
+  }
   return Utils::ipDisplayName(saddr) + ":" + std::to_string(Utils::ipPort(saddr));
 }
 
@@ -969,14 +1068,41 @@ ListenSocket::ListenSocket(in_port_t port) : _port(port) {
   }
 }
 
+ListenSocket::ListenSocket(const boost::filesystem::path &path) : Socket(newSocket(AF_UNIX)), _port(0) {
+  sockaddr_storage sa{};
+  const socklen_t len = unixSockaddr(path.string(), &sa);
+  // Left by an earlier instance, which can't still be listening on it once we are started
+  struct stat st {};
+  if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+    ::unlink(path.c_str());
+  }
+  if (-1 == ::bind(socket_fd_, reinterpret_cast<const sockaddr *>(&sa), len)) {
+    throw std::system_error(errno, std::system_category(), "socket");
+  }
+  path_ = path;
+}
+
+ListenSocket::~ListenSocket() {
+  if (!path_.empty()) {
+    ::unlink(path_.c_str());
+  }
+}
+
 ConnectionSocket::ConnectionSocket(const std::string &ip, in_port_t port, in_port_t bind_port)
-    : remote_sock_address_{} {
-  memset(&remote_sock_address_, 0, sizeof(remote_sock_address_));
-  remote_sock_address_.sin_family = AF_INET;
-  if (-1 == inet_pton(AF_INET, ip.c_str(), &(remote_sock_address_.sin_addr))) {
+    : Socket(newSocket(Utils::isUnixSocketAddress(ip) ? AF_UNIX : AF_INET)),
+      remote_sock_address_{},
+      remote_sock_address_len_{sizeof(sockaddr_in)} {
+  if (Utils::isUnixSocketAddress(ip)) {
+    remote_sock_address_len_ =
+        unixSockaddr(ip.substr(std::char_traits<char>::length(kUnixSocketPrefix)), &remote_sock_address_);
+    return;
+  }
+  auto *sa = reinterpret_cast<sockaddr_in *>(&remote_sock_address_);
+  sa->sin_family = AF_INET;
+  if (-1 == inet_pton(AF_INET, ip.c_str(), &(sa->sin_addr))) {
     throw std::system_error(errno, std::system_category(), "socket");
   }
-  remote_sock_address_.sin_port = htons(port);  // NOLINT(readability-isolate-declaration)
+  sa->sin_port = htons(port);  // NOLINT(readability-isolate-declaration)
 
   if (bind_port > 0) {
     bind(bind_port);
@@ -987,7 +1113,42 @@ ConnectionSocket::~ConnectionSocket() { ::shutdown(socket_fd_, SHUT_RDWR); }
 
 int ConnectionSocket::connect() {
   return ::connect(socket_fd_, reinterpret_cast<const struct sockaddr *>(&remote_sock_address_),
-                   sizeof(remote_sock_address_));
+                   remote_sock_address_len_);
+}
+
+int ConnectionSocket::connect(std::chrono::milliseconds timeout) {
+  const int flags = fcntl(socket_fd_, F_GETFL);
+  if (flags == -1 || fcntl(socket_fd_, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return -1;
+  }
+  int res = connect();
+  if (res != 0 && errno == EINPROGRESS) {
+    pollfd pfd{socket_fd_, POLLOUT, 0};
+    res = poll(&pfd, 1, static_cast<int>(timeout.count()));
+    if (res == 0) {
+      errno = ETIMEDOUT;
+      res = -1;
+    } else if (res > 0) {
+      int error = 0;
+      socklen_t len = sizeof(error);
+      res = getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &error, &len);
+      if (res == 0 && error != 0) {
+        errno = error;
+        res = -1;
+      }
+    }
+  }
+  const int connect_errno = errno;
+  fcntl(socket_fd_, F_SETFL, flags);
+  if (res == 0) {
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(timeout.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((timeout.count() % 1000) * 1000);
+    setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(socket_fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+  errno = connect_errno;
+  return res;
 }
 
 CurlEasyWrapper::CurlEasyWrapper() {
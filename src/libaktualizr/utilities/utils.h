@@ -2,17 +2,25 @@
 #define UTILS_H_
 
 #include <boost/filesystem/path.hpp>
+#include <chrono>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 
 #include <curl/curl.h>
 #include <netinet/in.h>
+#include <sys/socket.h>
 
 #include "json/json.h"
 
 struct Utils {
-  static std::string fromBase64(std::string base64_string);
+  // Vectorized where the CPU allows, see utilities/encoding.h
+  static std::string fromBase64(const std::string &base64_string);
   static std::string toBase64(const std::string &tob64);
+  // Upper case unless lower_case, as boost::algorithm::hex()
+  static std::string toHex(const std::string &data, bool lower_case = false);
+  static std::string fromHex(const std::string &hex);
   static std::string stripQuotes(const std::string &value);
   static std::string addQuotes(const std::string &value);
   static std::string extractField(const std::string &in, unsigned int field_id);
@@ -28,8 +36,21 @@ struct Utils {
                         bool create_directories = true);
   static void writeFile(const boost::filesystem::path &filename, const Json::Value &content,
                         bool create_directories = true);
+  /**
+   * Copy a file, creating or replacing the destination with the permissions of
+   * the source. Shares the data with a reflink where the filesystem supports
+   * it, else copies it in the kernel with copy_file_range() or sendfile(), and
+   * only then through user space.
+   */
+  static void copyFile(const boost::filesystem::path &from, const boost::filesystem::path &to);
   static void copyDir(const boost::filesystem::path &from, const boost::filesystem::path &to);
   static std::string readFileFromArchive(std::istream &as, const std::string &filename, bool trim = false);
+  /**
+   * Read the files out of an archive in one pass, up to the last of them.
+   * @return the content of each of the files found, by name
+   */
+  static std::map<std::string, std::string> readFilesFromArchive(std::istream &as,
+                                                                 const std::set<std::string> &filenames);
   static void writeArchive(const std::map<std::string, std::string> &entries, std::ostream &as);
   static void removeFileFromArchive(const boost::filesystem::path &archive_path, const std::string &filename);
   static Json::Value getHardwareInfo();
@@ -39,6 +60,10 @@ struct Utils {
   static sockaddr_storage ipGetSockaddr(int fd);
   static std::string ipDisplayName(const sockaddr_storage &saddr);
   static int ipPort(const sockaddr_storage &saddr);
+  // Whether a socket address is the path of a Unix domain socket, "unix:<path>"
+  static bool isUnixSocketAddress(const std::string &address);
+  // Run a command line with /bin/sh, see runCommand() in utilities/command.h for
+  // programs that don't need a shell. -1 if the shell could not be run.
   static int shell(const std::string &command, std::string *output, bool include_stderr = false);
   static boost::filesystem::path absolutePath(const boost::filesystem::path &root, const boost::filesystem::path &file);
   static void createDirectories(const boost::filesystem::path &path, mode_t mode);
@@ -106,6 +131,9 @@ using StructGuard = std::unique_ptr<T, void (*)(T *)>;
 template <typename T>
 using StructGuardInt = std::unique_ptr<T, int (*)(T *)>;
 
+// Prefix of the socket addresses that are the paths of Unix domain sockets
+static constexpr const char *kUnixSocketPrefix = "unix:";
+
 class Socket {
  public:
   Socket();
@@ -117,9 +145,12 @@ class Socket {
   Socket &operator=(Socket &&) = delete;
 
   int &operator*() { return socket_fd_; }
+  // The local address, "unix:<path>" for a Unix domain socket
   std::string ToString() const;
 
  protected:
+  // A new stream socket of the domain
+  static int newSocket(int domain);
   void bind(in_port_t port, bool reuse = true) const;
 
   int socket_fd_;
@@ -127,6 +158,7 @@ class Socket {
 
 class ConnectionSocket : public Socket {
  public:
+  // ip can also be the path of a Unix domain socket, "unix:<path>", with no port
   ConnectionSocket(const std::string &ip, in_port_t port, in_port_t bind_port = 0);
   ~ConnectionSocket() override;
   ConnectionSocket(const ConnectionSocket &guard) = delete;
@@ -135,18 +167,32 @@ class ConnectionSocket : public Socket {
   ConnectionSocket &operator=(ConnectionSocket &&) = delete;
 
   int connect();
+  // Gives up after the timeout, which then also applies to each send and
+  // receive on the connection. Returns -1 and sets errno on failure, like connect().
+  int connect(std::chrono::milliseconds timeout);
 
  private:
-  struct sockaddr_in remote_sock_address_;
+  struct sockaddr_storage remote_sock_address_;
+  socklen_t remote_sock_address_len_;
 };
 
 class ListenSocket : public Socket {
  public:
   explicit ListenSocket(in_port_t port);
+  // On a Unix domain socket at path, replacing a socket left there
+  explicit ListenSocket(const boost::filesystem::path &path);
+  ~ListenSocket() override;
+  ListenSocket(const ListenSocket &guard) = delete;
+  ListenSocket(ListenSocket &&) = delete;
+  ListenSocket &operator=(const ListenSocket &guard) = delete;
+  ListenSocket &operator=(ListenSocket &&) = delete;
+
+  // 0 on a Unix domain socket
   in_port_t port() const { return _port; }
 
  private:
   in_port_t _port;
+  boost::filesystem::path path_;
 };
 
 // wrapper for curl handles
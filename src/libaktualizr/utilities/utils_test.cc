@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <fstream>
 #include <map>
@@ -189,6 +190,17 @@ TEST(Utils, ArchiveWrite) {
   }
 }
 
+/* Read several files out of an archive in one pass. */
+TEST(Utils, ArchiveReadMany) {
+  std::stringstream as;
+  Utils::writeArchive({{"ca.pem", "CA"}, {"client.pem", "CERT"}, {"server.url", "URL"}}, as);
+
+  const auto files = Utils::readFilesFromArchive(as, {"server.url", "ca.pem", "bogus_filename"});
+  EXPECT_EQ(files.size(), 2);
+  EXPECT_EQ(files.at("ca.pem"), "CA");
+  EXPECT_EQ(files.at("server.url"), "URL");
+}
+
 /* Remove credentials from a provided archive. */
 TEST(Utils, ArchiveRemoveFile) {
   const boost::filesystem::path old_path = "tests/test_data/credentials.zip";
@@ -283,6 +295,31 @@ TEST(Utils, copyDir) {
   EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to/1/2/baz"), "baz");
 }
 
+TEST(Utils, copyFile) {
+  TemporaryDirectory temp_dir;
+
+  std::string content(3 * 1024 * 1024 + 17, 'a');
+  for (size_t k = 0; k < content.size(); k += 4096) {
+    content[k] = static_cast<char>('a' + (k / 4096) % 26);
+  }
+  Utils::writeFile(temp_dir.Path() / "from", content);
+  boost::filesystem::permissions(temp_dir.Path() / "from", boost::filesystem::owner_read);
+  Utils::writeFile(temp_dir.Path() / "to", std::string("longer content that is replaced"));
+
+  Utils::copyFile(temp_dir.Path() / "from", temp_dir.Path() / "to");
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to"), content);
+  Utils::copyFile(temp_dir.Path() / "from", temp_dir.Path() / "new");
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / "new"), content);
+  EXPECT_EQ(boost::filesystem::status(temp_dir.Path() / "new").permissions(), boost::filesystem::owner_read);
+
+  Utils::writeFile(temp_dir.Path() / "empty", std::string());
+  Utils::copyFile(temp_dir.Path() / "empty", temp_dir.Path() / "to");
+  EXPECT_EQ(Utils::readFile(temp_dir.Path() / "to"), "");
+
+  EXPECT_THROW(Utils::copyFile(temp_dir.Path() / "missing", temp_dir.Path() / "to"), std::runtime_error);
+  EXPECT_THROW(Utils::copyFile(temp_dir.Path() / "from", temp_dir.Path() / "missing/to"), std::runtime_error);
+}
+
 TEST(Utils, writeFileWithoutDirAutoCreation) {
   TemporaryDirectory temp_dir;
 
@@ -342,6 +379,12 @@ TEST(Utils, shell) {
 
   statuscode = Utils::shell("ls /nonexistentdir123", &out);
   EXPECT_NE(statuscode, 0);
+
+  // The output isn't truncated
+  out.clear();
+  statuscode = Utils::shell("head -c 3000000 /dev/zero", &out);
+  EXPECT_EQ(statuscode, 0);
+  EXPECT_EQ(out.size(), 3000000);
 }
 
 TEST(Utils, createSecureDirectory) {
@@ -396,6 +439,52 @@ TEST(Utils, TrimNewline) {
   EXPECT_EQ(output, input);
 }
 
+/* The timeout of a connection also applies to its receives. */
+TEST(Utils, ConnectionSocketTimeout) {
+  ListenSocket listening(0);
+  ASSERT_EQ(::listen(*listening, 1), 0);
+  ConnectionSocket connection("127.0.0.1", listening.port());
+  ASSERT_EQ(connection.connect(std::chrono::milliseconds(100)), 0);
+  char c = 0;
+  EXPECT_EQ(recv(*connection, &c, 1, 0), -1);
+  EXPECT_TRUE(errno == EAGAIN || errno == EWOULDBLOCK);
+
+  // Bound but not listening
+  ListenSocket closed(0);
+  ConnectionSocket refused("127.0.0.1", closed.port());
+  EXPECT_EQ(refused.connect(std::chrono::milliseconds(100)), -1);
+  EXPECT_EQ(errno, ECONNREFUSED);
+}
+
+/* A Unix domain socket is connected to with its path, and removed when the
+ * listening socket is closed. */
+TEST(Utils, UnixSocket) {
+  TemporaryDirectory dir;
+  const auto path = dir / "socket";
+  {
+    ListenSocket listening(path);
+    ASSERT_EQ(::listen(*listening, 1), 0);
+    EXPECT_EQ(listening.ToString(), kUnixSocketPrefix + path.string());
+    EXPECT_EQ(listening.port(), 0);
+    ConnectionSocket connection(kUnixSocketPrefix + path.string(), 0);
+    ASSERT_EQ(connection.connect(std::chrono::milliseconds(100)), 0);
+    Socket accepted(::accept(*listening, nullptr, nullptr));
+    ASSERT_EQ(send(*connection, "x", 1, 0), 1);
+    char c = 0;
+    EXPECT_EQ(recv(*accepted, &c, 1, 0), 1);
+    EXPECT_EQ(c, 'x');
+  }
+  EXPECT_FALSE(boost::filesystem::exists(path));
+
+  // A socket left behind by a previous instance is replaced.
+  ListenSocket first(path);
+  ListenSocket second(path);
+  ASSERT_EQ(::listen(*second, 1), 0);
+  EXPECT_EQ(ConnectionSocket(kUnixSocketPrefix + path.string(), 0).connect(), 0);
+
+  EXPECT_FALSE(Utils::isUnixSocketAddress("127.0.0.1"));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
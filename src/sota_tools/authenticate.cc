@@ -1,26 +1,61 @@
 #include "authenticate.h"
 
+#include <memory>
+
 #include "logging/logging.h"
 #include "oauth2.h"
+#include "token_cache.h"
 
 using std::string;
 
-int authenticate(const string &cacerts, const ServerCredentials &creds, TreehubServer &treehub) {
+int authenticate(const string &cacerts, const ServerCredentials &creds, TreehubServer &treehub,
+                 const boost::filesystem::path &token_cache_dir) {
   switch (creds.GetMethod()) {
     case AuthMethod::kBasic: {
       treehub.SetAuthBasic(creds.GetAuthUser(), creds.GetAuthPassword());
       break;
     }
     case AuthMethod::kOauth2: {
-      OAuth2 oauth2(creds.GetAuthServer(), creds.GetClientId(), creds.GetClientSecret(), creds.GetScope(), cacerts);
+      auto oauth2 = std::make_shared<OAuth2>(creds.GetAuthServer(), creds.GetClientId(), creds.GetClientSecret(),
+                                             creds.GetScope(), cacerts);
+      std::shared_ptr<TokenCache> cache;
+      if (!token_cache_dir.empty()) {
+        cache = std::make_shared<TokenCache>(token_cache_dir, TokenCache::CredentialsId(creds));
+      }
+      // Get a new token, cached if the server said when it expires
+      auto get_token = [oauth2, cache]() {
+        if (oauth2->Authenticate() != AuthenticationResult::kSuccess) {
+          return false;
+        }
+        if (cache) {
+          if (oauth2->expires_in().count() > 0) {
+            cache->Put(oauth2->token(), oauth2->expires_in());
+          } else {
+            cache->Remove();
+          }
+        }
+        return true;
+      };
 
       if (!creds.GetClientId().empty()) {
-        if (oauth2.Authenticate() != AuthenticationResult::kSuccess) {
-          LOG_FATAL << "Authentication with oauth2 failed";
-          return EXIT_FAILURE;
+        const std::string cached_token = cache ? cache->Get() : "";
+        if (!cached_token.empty()) {
+          LOG_INFO << "Using cached oauth2 authentication token";
+          treehub.SetToken(cached_token);
+        } else {
+          if (!get_token()) {
+            LOG_FATAL << "Authentication with oauth2 failed";
+            return EXIT_FAILURE;
+          }
+          LOG_INFO << "Using oauth2 authentication token";
+          treehub.SetToken(oauth2->token());
         }
-        LOG_INFO << "Using oauth2 authentication token";
-        treehub.SetToken(oauth2.token());
+        treehub.SetTokenRefresher([oauth2, cache, get_token]() -> std::string {
+          if (cache) {
+            cache->Remove();
+          }
+          return get_token() ? oauth2->token() : "";
+        });
 
       } else {
         LOG_INFO << "Skipping Authentication";
@@ -3,10 +3,19 @@
 
 #include <string>
 
+#include <boost/filesystem/path.hpp>
+
 #include "server_credentials.h"
 #include "treehub_server.h"
 
-int authenticate(const std::string &cacerts, const ServerCredentials &creds, TreehubServer &treehub);
+/**
+ * Set up treehub with the credentials. With a token_cache_dir, an OAuth2 token
+ * is taken from the TokenCache there while it is valid, and a new one is put
+ * there when it is got from the server, including when treehub rejects the
+ * cached one.
+ */
+int authenticate(const std::string &cacerts, const ServerCredentials &creds, TreehubServer &treehub,
+                 const boost::filesystem::path &token_cache_dir = "");
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
 #endif  // SOTA_CLIENT_TOOLS_AUTHENTICATE_H_
@@ -8,9 +8,9 @@
 #include "logging/logging.h"
 #include "ostree_http_repo.h"
 #include "ostree_object.h"
-#include "rate_controller.h"
 #include "request_pool.h"
 #include "treehub_server.h"
+#include "utilities/rate_controller.h"
 #include "utilities/utils.h"
 
 // helper function to download data to a string
@@ -38,7 +38,10 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
 
   treehub.InjectIntoCurl("objects/" + ref.substr(0, 2) + "/" + ref.substr(2) + ".commit", curl.get());
 
-  CURLcode result = curl_easy_perform(curl.get());
+  CURLcode result;
+  do {
+    result = curl_easy_perform(curl.get());
+  } while (result == CURLE_OK && treehub.RetryWithNewToken(curl.get()));
   if (result != CURLE_OK) {
     LOG_FATAL << "Error connecting to treehub: " << result << ": " << curl_easy_strerror(result);
     return EXIT_FAILURE;
@@ -63,8 +66,9 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
   }
 
   if (mode == RunMode::kWalkTree) {
-    // Walk the entire tree and check for all objects.
-    OSTreeHttpRepo dest_repo(&treehub, tree_dir);
+    // Walk the entire tree and check for all objects. The objects of a
+    // directory are fetched together, as many at once as the queries.
+    OSTreeHttpRepo dest_repo(&treehub, tree_dir, max_curl_requests);
     OSTreeHash hash = OSTreeHash::Parse(ref);
     OSTreeObject::ptr input_object = dest_repo.GetObject(hash, type);
 
@@ -81,11 +85,18 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
       request_pool.Loop();
     } while (!request_pool.is_idle() && !request_pool.is_stopped());
 
-    if (input_object->is_on_server() == PresenceOnServer::kObjectPresent) {
-      LOG_INFO << "Dry run. No objects uploaded.";
-    } else {
-      LOG_ERROR << "One or more errors while pushing";
+    LOG_INFO << "Checked " << dest_repo.object_count() << " objects with " << request_pool.head_requests_made()
+             << " HEAD requests and " << request_pool.batch_requests_made() << " batch requests";
+    const auto &missing = request_pool.missing_objects();
+    if (!missing.empty()) {
+      LOG_FATAL << missing.size() << " objects of OSTree ref " << ref << " are missing in treehub";
+      return EXIT_FAILURE;
     }
+    if (request_pool.is_stopped() || input_object->is_on_server() != PresenceOnServer::kObjectPresent) {
+      LOG_FATAL << "One or more errors while walking the tree of OSTree ref " << ref;
+      return EXIT_FAILURE;
+    }
+    LOG_INFO << "All the objects of OSTree ref " << ref << " are found on treehub";
   }
 
   // If we have a commit object, check if the ref is present in targets.json.
@@ -98,7 +109,10 @@ int CheckRefValid(TreehubServer &treehub, const std::string &ref, RunMode mode,
     std::string targets_str;
     curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEFUNCTION, writeString);
     curlEasySetoptWrapper(curl.get(), CURLOPT_WRITEDATA, static_cast<void *>(&targets_str));
-    result = curl_easy_perform(curl.get());
+    do {
+      targets_str.clear();
+      result = curl_easy_perform(curl.get());
+    } while (result == CURLE_OK && treehub.RetryWithNewToken(curl.get()));
 
     if (result != CURLE_OK) {
       LOG_FATAL << "Error connecting to TUF repo: " << result << ": " << curl_easy_strerror(result);
@@ -1,14 +1,18 @@
 #include "deploy.h"
 
+#include <memory>
+
 #include <boost/filesystem.hpp>
 #include <boost/intrusive_ptr.hpp>
 
 #include "authenticate.h"
 #include "logging/logging.h"
+#include "object_scanner.h"
 #include "ostree_object.h"
-#include "rate_controller.h"
 #include "request_pool.h"
 #include "treehub_server.h"
+#include "utilities/memory_usage.h"
+#include "utilities/rate_controller.h"
 #include "utilities/utils.h"
 
 bool CheckPoolState(const OSTreeObject::ptr &root_object, const RequestPool &request_pool) {
@@ -24,7 +28,9 @@ bool CheckPoolState(const OSTreeObject::ptr &root_object, const RequestPool &req
 }
 
 bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server, const OSTreeHash &ostree_commit,
-                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload) {
+                     const RunMode mode, const int max_curl_requests, const bool fsck_on_upload,
+                     const unsigned int scan_threads, PresenceCache *presence_cache, const int max_connections,
+                     const uintmax_t upload_chunk_size, const std::chrono::milliseconds latency_target) {
   assert(max_curl_requests > 0);
 
   OSTreeObject::ptr root_object;
@@ -35,7 +41,19 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     return false;
   }
 
-  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload);
+  // Only a local repo has the children on disk before they are requested.
+  std::unique_ptr<ObjectScanner> scanner;
+  if (scan_threads > 0) {
+    scanner = std_::make_unique<ObjectScanner>(src_repo->root(), scan_threads, src_repo->IsLocal());
+    scanner->Parse(ostree_commit, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+  }
+  RequestPool request_pool(push_server, max_curl_requests, mode, fsck_on_upload, scanner.get(), presence_cache,
+                           max_connections, upload_chunk_size, latency_target);
+  if (request_pool.KnownPresent(ostree_commit, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT)) {
+    LOG_INFO << "OSTree commit " << ostree_commit << " is already on the server according to "
+             << presence_cache->path();
+    return true;
+  }
 
   // Add commit object to the queue.
   request_pool.AddQuery(root_object);
@@ -52,14 +70,34 @@ bool UploadToTreehub(const OSTreeRepo::ptr &src_repo, TreehubServer &push_server
     if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
       LOG_INFO << "Upload to Treehub complete after " << request_pool.head_requests_made() << " HEAD requests and "
                << request_pool.put_requests_made() << " PUT requests.";
+      if (request_pool.batch_requests_made() > 0) {
+        LOG_INFO << request_pool.batched_queries() << " objects were checked in " << request_pool.batch_requests_made()
+                 << " batch requests, saving " << request_pool.batched_queries() - request_pool.batch_requests_made()
+                 << " HEAD requests.";
+      }
       LOG_INFO << "Total size of uploaded objects: " << request_pool.total_object_size() << " bytes.";
+      LOG_INFO << "The requests were made on " << request_pool.connections_made() << " connections.";
     } else {
       LOG_INFO << "Dry run. No objects uploaded.";
+      if (mode == RunMode::kWalkTree) {
+        LOG_INFO << request_pool.missing_objects().size() << " objects of the tree are missing on the server.";
+      }
     }
   } else {
     LOG_ERROR << "One or more errors while pushing";
   }
 
+  if (presence_cache != nullptr) {
+    LOG_INFO << presence_cache->hits() << " objects were skipped as known to be on the server.";
+    presence_cache->Save();
+  }
+
+  const MemoryUsage memory = MemoryUsage::current();
+  if (memory.peak_kb >= 0) {
+    LOG_INFO << "Memory high-water mark: " << memory.peak_kb << " kB, for " << src_repo->object_count()
+             << " objects read from the repo (" << sizeof(OSTreeObject) << " bytes each when idle).";
+  }
+
   return root_object->is_on_server() == PresenceOnServer::kObjectPresent;
 }
 
@@ -107,11 +145,14 @@ bool OfflineSignRepo(const ServerCredentials &push_credentials, const std::strin
   return true;
 }
 
-bool PushRootRef(const TreehubServer &push_server, const OSTreeRef &ref) {
+bool PushRootRef(TreehubServer &push_server, const OSTreeRef &ref) {
   CurlEasyWrapper easy_handle;
   curlEasySetoptWrapper(easy_handle.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
   ref.PushRef(push_server, easy_handle.get());
-  CURLcode err = curl_easy_perform(easy_handle.get());
+  CURLcode err;
+  do {
+    err = curl_easy_perform(easy_handle.get());
+  } while (err == CURLE_OK && push_server.RetryWithNewToken(easy_handle.get()));
   if (err != 0U) {
     LOG_ERROR << "Error pushing root ref: " << curl_easy_strerror(err);
     return false;
@@ -1,11 +1,13 @@
 #ifndef SOTA_CLIENT_TOOLS_DEPLOY_H_
 #define SOTA_CLIENT_TOOLS_DEPLOY_H_
 
+#include <chrono>
 #include <string>
 
 #include "garage_common.h"
 #include "ostree_ref.h"
 #include "ostree_repo.h"
+#include "presence_cache.h"
 #include "server_credentials.h"
 
 /*
@@ -26,9 +28,23 @@ bool CheckPoolState(const OSTreeObject::ptr& root_object, const RequestPool& req
  * \param mode
  * \param max_curl_requests
  * \param fsck_on_upload Validate objects on disk before uploading them
+ * \param scan_threads Number of threads parsing and validating the objects
+ *                     ahead of the requests, none to do it between them
+ * \param presence_cache Optional, the objects known to be on push_server,
+ *                       updated and saved
+ * \param max_connections Most connections to push_server, which the
+ *                        requests share with HTTP/2, 0 for no limit
+ * \param upload_chunk_size Objects larger than this are uploaded in chunks
+ *                          of this size, which the server must support, 0
+ *                          for none
+ * \param latency_target The p95 latency of the requests to keep under by
+ *                       making fewer of them at once, 0 for none
  */
 bool UploadToTreehub(const OSTreeRepo::ptr& src_repo, TreehubServer& push_server, const OSTreeHash& ostree_commit,
-                     RunMode mode, int max_curl_requests, bool fsck_on_upload);
+                     RunMode mode, int max_curl_requests, bool fsck_on_upload, unsigned int scan_threads = 0,
+                     PresenceCache* presence_cache = nullptr, int max_connections = 0,
+                     uintmax_t upload_chunk_size = 0,
+                     std::chrono::milliseconds latency_target = std::chrono::milliseconds(0));
 
 /**
  * Use the garage-sign tool and the Image repo targets.json keys in credentials.zip
@@ -40,6 +56,6 @@ bool OfflineSignRepo(const ServerCredentials& push_credentials, const std::strin
 /**
  * Update the ref on Treehub to the new commit.
  */
-bool PushRootRef(const TreehubServer& push_server, const OSTreeRef& ref);
+bool PushRootRef(TreehubServer& push_server, const OSTreeRef& ref);
 
 #endif
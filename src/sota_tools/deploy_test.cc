@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <unistd.h>
+
 #include <boost/process.hpp>
 
 #include "authenticate.h"
@@ -9,6 +14,7 @@
 #include "ostree_dir_repo.h"
 #include "ostree_http_repo.h"
 #include "ostree_ref.h"
+#include "request_pool.h"
 #include "test_utils.h"
 
 std::string port = "2443";
@@ -43,6 +49,165 @@ TEST(deploy, UploadToTreehub) {
   EXPECT_EQ(result, 0) << "Diff between the source repo refs and the destination repos refs is nonzero.";
 }
 
+/* Check the presence of the objects in batches when the server supports it,
+ * and one by one otherwise. */
+TEST(deploy, BatchPresence) {
+  for (const bool batch : {true, false}) {
+    // A repo of its own, as its objects remember what is on the server
+    OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>("tests/sota_tools/bigger_repo");
+    const OSTreeHash hash = src_repo->GetRef("master").GetHash();
+    // The server already has all the objects.
+    TemporaryDirectory server_dir;
+    Utils::copyDir("tests/sota_tools/bigger_repo", server_dir.Path());
+    const std::string server_port = TestUtils::getFreePort();
+    std::vector<std::string> server_args{"-p", server_port, "-d", server_dir.PathString()};
+    if (batch) {
+      server_args.emplace_back("--batch-presence");
+    }
+    boost::process::child server_process("tests/sota_tools/treehub_server.py", boost::process::args(server_args));
+    TestUtils::waitForServer("http://localhost:" + server_port + "/");
+
+    TreehubServer push_server;
+    push_server.root_url("http://localhost:" + server_port);
+    // Walk the tree to query every object.
+    RequestPool request_pool(push_server, 30, RunMode::kWalkTree, false);
+    auto root_object = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+    request_pool.AddQuery(root_object);
+    do {
+      request_pool.Loop();
+    } while (CheckPoolState(root_object, request_pool));
+
+    EXPECT_EQ(root_object->is_on_server(), PresenceOnServer::kObjectPresent);
+    EXPECT_EQ(request_pool.put_requests_made(), 0);
+    if (batch) {
+      // Only for the commit and the objects left alone in the queue
+      EXPECT_GT(request_pool.batch_requests_made(), 0);
+      EXPECT_LT(request_pool.head_requests_made() + request_pool.batch_requests_made(),
+                request_pool.batched_queries());
+    } else {
+      // The probe, then each object
+      EXPECT_EQ(request_pool.batch_requests_made(), 1);
+      EXPECT_GT(request_pool.head_requests_made(), request_pool.batched_queries());
+    }
+  }
+}
+
+/* The requests share the connections to the server rather than opening one
+ * each, and no more of them are opened than allowed. The test server only
+ * speaks HTTP/1.1, on which the requests wait for their turn; with HTTP/2
+ * they are multiplexed. */
+TEST(deploy, SharedConnections) {
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>("tests/sota_tools/bigger_repo");
+  const OSTreeHash hash = src_repo->GetRef("master").GetHash();
+
+  TemporaryDirectory server_dir;
+  Utils::copyDir("tests/sota_tools/bigger_repo", server_dir.Path());
+  const std::string server_port = TestUtils::getFreePort();
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), server_port,
+                                       std::string("-d"), server_dir.PathString(), std::string("--keep-alive"));
+  TestUtils::waitForServer("http://localhost:" + server_port + "/");
+
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + server_port);
+  RequestPool request_pool(push_server, 30, RunMode::kWalkTree, false, nullptr, nullptr, 1);
+  auto root_object = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+  request_pool.AddQuery(root_object);
+  do {
+    request_pool.Loop();
+  } while (CheckPoolState(root_object, request_pool));
+
+  EXPECT_EQ(root_object->is_on_server(), PresenceOnServer::kObjectPresent);
+  EXPECT_GT(request_pool.head_requests_made(), 10);
+  EXPECT_EQ(request_pool.connections_made(), 1);
+}
+
+/* The pool waits on sockets whose descriptors do not fit in an fd_set, as in
+ * a process that already holds many files open. */
+TEST(deploy, HighDescriptors) {
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>("tests/sota_tools/bigger_repo");
+  const OSTreeHash hash = src_repo->GetRef("master").GetHash();
+
+  TemporaryDirectory server_dir;
+  Utils::copyDir("tests/sota_tools/bigger_repo", server_dir.Path());
+  const std::string server_port = TestUtils::getFreePort();
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), server_port,
+                                       std::string("-d"), server_dir.PathString());
+  TestUtils::waitForServer("http://localhost:" + server_port + "/");
+
+  struct rlimit limit {};
+  ASSERT_EQ(getrlimit(RLIMIT_NOFILE, &limit), 0);
+  const rlim_t wanted = 2 * FD_SETSIZE;
+  ASSERT_GE(limit.rlim_max, wanted);
+  const struct rlimit old_limit = limit;
+  if (limit.rlim_cur < wanted) {
+    limit.rlim_cur = wanted;
+    ASSERT_EQ(setrlimit(RLIMIT_NOFILE, &limit), 0);
+  }
+  std::vector<int> fillers;
+  do {
+    const int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    ASSERT_GE(fd, 0);
+    fillers.push_back(fd);
+  } while (fillers.back() < FD_SETSIZE);
+
+  TreehubServer push_server;
+  push_server.root_url("http://localhost:" + server_port);
+  RequestPool request_pool(push_server, 30, RunMode::kWalkTree, false);
+  auto root_object = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+  request_pool.AddQuery(root_object);
+  do {
+    request_pool.Loop();
+  } while (CheckPoolState(root_object, request_pool));
+
+  for (const int fd : fillers) {
+    close(fd);
+  }
+  setrlimit(RLIMIT_NOFILE, &old_limit);
+
+  EXPECT_FALSE(request_pool.is_stopped());
+  EXPECT_EQ(root_object->is_on_server(), PresenceOnServer::kObjectPresent);
+  EXPECT_GT(request_pool.head_requests_made(), 10);
+}
+
+/* Report the objects missing on the server when walking the tree, from a
+ * local repo or from the server itself. */
+TEST(deploy, WalkTreeMissing) {
+  TemporaryDirectory server_dir;
+  Utils::copyDir("tests/sota_tools/bigger_repo", server_dir.Path());
+  boost::filesystem::path removed;
+  for (boost::filesystem::recursive_directory_iterator it(server_dir.Path() / "objects"), end; it != end; ++it) {
+    if (it->path().extension() == ".filez") {
+      removed = it->path();
+      break;
+    }
+  }
+  ASSERT_FALSE(removed.empty());
+  boost::filesystem::remove(removed);
+  const std::string missing = removed.parent_path().filename().string() + "/" + removed.filename().string();
+
+  const std::string server_port = TestUtils::getFreePort();
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), server_port,
+                                       std::string("-d"), server_dir.PathString());
+  TestUtils::waitForServer("http://localhost:" + server_port + "/");
+  TreehubServer server;
+  server.root_url("http://localhost:" + server_port);
+
+  OSTreeRepo::ptr local_repo = std::make_shared<OSTreeDirRepo>("tests/sota_tools/bigger_repo");
+  OSTreeRepo::ptr http_repo = std::make_shared<OSTreeHttpRepo>(&server, "", 4);
+  const OSTreeHash hash = local_repo->GetRef("master").GetHash();
+  for (const auto &src_repo : {local_repo, http_repo}) {
+    RequestPool request_pool(server, 30, RunMode::kWalkTree, false);
+    auto root_object = src_repo->GetObject(hash, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+    request_pool.AddQuery(root_object);
+    do {
+      request_pool.Loop();
+    } while (CheckPoolState(root_object, request_pool));
+
+    EXPECT_FALSE(request_pool.is_stopped());
+    EXPECT_EQ(request_pool.missing_objects(), std::vector<std::string>{missing});
+  }
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -27,6 +27,7 @@ int main(int argc, char **argv) {
   int max_curl_requests;
   RunMode mode = RunMode::kDefault;
   boost::filesystem::path tree_dir;
+  boost::filesystem::path token_cache_dir;
   po::options_description desc("garage-check command line options");
   // clang-format off
   desc.add_options()
@@ -40,7 +41,8 @@ int main(int argc, char **argv) {
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests (only relevant with --walk-tree)")
     ("walk-tree,w", "walk entire tree and check presence of all objects")
-    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)");
+    ("tree-dir,t", po::value<boost::filesystem::path>(&tree_dir), "directory to which to write the tree (only used with --walk-tree)")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache_dir), "directory of a cache of the OAuth2 tokens, reused by later runs with the same credentials until they are about to expire");
   // clang-format on
 
   po::variables_map vm;
@@ -90,7 +92,7 @@ int main(int argc, char **argv) {
     }
 
     TreehubServer treehub;
-    if (authenticate(cacerts, ServerCredentials(credentials_path), treehub) != EXIT_SUCCESS) {
+    if (authenticate(cacerts, ServerCredentials(credentials_path), treehub, token_cache_dir) != EXIT_SUCCESS) {
       LOG_FATAL << "Authentication failed";
       return EXIT_FAILURE;
     }
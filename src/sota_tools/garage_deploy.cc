@@ -1,5 +1,7 @@
 #include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -11,6 +13,7 @@
 #include "garage_tools_version.h"
 #include "logging/logging.h"
 #include "ostree_http_repo.h"
+#include "presence_cache.h"
 
 namespace po = boost::program_options;
 
@@ -26,6 +29,14 @@ int main(int argc, char **argv) {
   std::string hardwareids;
   std::string cacerts;
   int max_curl_requests;
+  int max_fetches;
+  int max_connections;
+  uintmax_t upload_chunk_size;
+  int64_t latency_target;
+  unsigned int scan_threads;
+  boost::filesystem::path object_cache_dir;
+  int64_t object_cache_ttl;
+  boost::filesystem::path token_cache_dir;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-deploy command line options");
   // clang-format off
@@ -42,6 +53,16 @@ int main(int argc, char **argv) {
     ("hardwareids,h", po::value<std::string>(&hardwareids)->required(), "list of hardware ids")
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
+    ("fetch-jobs", po::value<int>(&max_fetches)->default_value(30), "maximum number of objects fetched at once from the source server, 0 for one at a time")
+    ("connections", po::value<int>(&max_connections)->default_value(0), "maximum number of connections to the server, which the requests share with HTTP/2, 0 for no limit")
+    ("upload-chunk-size", po::value<uintmax_t>(&upload_chunk_size)->default_value(0), "upload objects larger than this many bytes in chunks of that size, which the server must accept with a Content-Range header, 0 for whole objects")
+    ("latency-target", po::value<int64_t>(&latency_target)->default_value(0), "milliseconds the requests should take at most, for 95% of them, by making fewer at once; uploads count too, 0 for no target")
+    ("scan-jobs", po::value<unsigned int>(&scan_threads)->default_value(std::thread::hardware_concurrency()), "number of threads parsing and validating objects ahead of the requests, 0 for none")
+    ("object-cache", po::value<boost::filesystem::path>(&object_cache_dir), "directory of a cache of the objects known to be on the server, skipped with their tree in later uploads")
+    ("object-cache-ttl", po::value<int64_t>(&object_cache_ttl)->default_value(0), "seconds an object stays in the object cache, 0 for ever")
+    ("verify-object-cache", "query the objects in the object cache again, and correct it")
+    ("ignore-object-cache", "neither use nor update the object cache")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache_dir), "directory of a cache of the OAuth2 tokens, reused by later runs with the same credentials until they are about to expire")
     ("dry-run,n", "check arguments and authenticate but don't upload")
     ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
   // clang-format on
@@ -96,28 +117,57 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  if (max_fetches < 0) {
+    LOG_FATAL << "--fetch-jobs must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (latency_target < 0) {
+    LOG_FATAL << "--latency-target must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (max_connections < 0) {
+    LOG_FATAL << "--connections must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (object_cache_ttl < 0) {
+    LOG_FATAL << "--object-cache-ttl must not be negative";
+    return EXIT_FAILURE;
+  }
+
   ServerCredentials fetch_credentials(fetch_cred);
   TreehubServer fetch_server;
-  if (authenticate(cacerts, fetch_credentials, fetch_server) != EXIT_SUCCESS) {
+  if (authenticate(cacerts, fetch_credentials, fetch_server, token_cache_dir) != EXIT_SUCCESS) {
     LOG_FATAL << "Authentication with fetch server failed";
     return EXIT_FAILURE;
   }
 
   ServerCredentials push_credentials(push_cred);
   TreehubServer push_server;
-  if (authenticate(cacerts, push_credentials, push_server) != EXIT_SUCCESS) {
+  if (authenticate(cacerts, push_credentials, push_server, token_cache_dir) != EXIT_SUCCESS) {
     LOG_FATAL << "Authentication with push server failed";
     return EXIT_FAILURE;
   }
 
-  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server);
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&fetch_server, "", max_fetches);
   try {
     OSTreeHash commit(OSTreeHash::Parse(ostree_commit));
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    // Since the fetches happen on a single thread in OSTreeHttpRepo, there
-    // isn't much reason to upload in parallel, but why hold the system back if
-    // the fetching is faster than the uploading?
-    if (!UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck)) {
+    std::unique_ptr<PresenceCache> presence_cache;
+    if (!object_cache_dir.empty() && vm.count("ignore-object-cache") == 0) {
+      const auto cache_mode =
+          vm.count("verify-object-cache") != 0 ? PresenceCache::Mode::kVerify : PresenceCache::Mode::kUse;
+      presence_cache = std_::make_unique<PresenceCache>(object_cache_dir,
+                                                        PresenceCache::RepoId(push_server.root_url(), push_credentials),
+                                                        std::chrono::seconds(object_cache_ttl), cache_mode);
+    }
+    // The fetches of OSTreeHttpRepo are bounded by --fetch-jobs, and the
+    // uploads by --jobs, so neither side holds the other back.
+    if (!UploadToTreehub(src_repo, push_server, commit, mode, max_curl_requests, fsck, scan_threads,
+                         presence_cache.get(), max_connections, upload_chunk_size,
+                         std::chrono::milliseconds(latency_target))) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
@@ -1,4 +1,7 @@
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
 
 #include <boost/filesystem.hpp>
 #include <boost/program_options.hpp>
@@ -10,6 +13,8 @@
 #include "logging/logging.h"
 #include "ostree_dir_repo.h"
 #include "ostree_repo.h"
+#include "presence_cache.h"
+#include "static_delta.h"
 #include "utilities/xml2json.h"
 
 namespace po = boost::program_options;
@@ -23,6 +28,14 @@ int main(int argc, char **argv) {
   std::string cacerts;
   boost::filesystem::path manifest_path;
   int max_curl_requests;
+  int max_connections;
+  uintmax_t upload_chunk_size;
+  int64_t latency_target;
+  unsigned int scan_threads;
+  boost::filesystem::path object_cache_dir;
+  int64_t object_cache_ttl;
+  boost::filesystem::path token_cache_dir;
+  std::string delta_from;
   RunMode mode = RunMode::kDefault;
   po::options_description desc("garage-push command line options");
   // clang-format off
@@ -38,6 +51,17 @@ int main(int argc, char **argv) {
     ("cacert", po::value<std::string>(&cacerts), "override path to CA root certificates, in the same format as curl --cacert")
     ("repo-manifest", po::value<boost::filesystem::path>(&manifest_path), "manifest describing repository branches used in the image, to be sent as attached metadata")
     ("jobs", po::value<int>(&max_curl_requests)->default_value(30), "maximum number of parallel requests")
+    ("connections", po::value<int>(&max_connections)->default_value(0), "maximum number of connections to the server, which the requests share with HTTP/2, 0 for no limit")
+    ("upload-chunk-size", po::value<uintmax_t>(&upload_chunk_size)->default_value(0), "upload objects larger than this many bytes in chunks of that size, which the server must accept with a Content-Range header, 0 for whole objects")
+    ("latency-target", po::value<int64_t>(&latency_target)->default_value(0), "milliseconds the requests should take at most, for 95% of them, by making fewer at once; uploads count too, 0 for no target")
+    ("scan-jobs", po::value<unsigned int>(&scan_threads)->default_value(std::thread::hardware_concurrency()), "number of threads parsing and validating objects ahead of the requests, 0 for none")
+    ("object-cache", po::value<boost::filesystem::path>(&object_cache_dir), "directory of a cache of the objects known to be on the server, skipped with their tree in later uploads")
+    ("object-cache-ttl", po::value<int64_t>(&object_cache_ttl)->default_value(0), "seconds an object stays in the object cache, 0 for ever")
+    ("verify-object-cache", "query the objects in the object cache again, and correct it")
+    ("ignore-object-cache", "neither use nor update the object cache")
+    ("token-cache", po::value<boost::filesystem::path>(&token_cache_dir), "directory of a cache of the OAuth2 tokens, reused by later runs with the same credentials until they are about to expire")
+    ("delta-from", po::value<std::string>(&delta_from), "also upload a static delta to the commit from this ref or commit refhash, which must be in the repo with its whole tree")
+    ("delta-from-server", "also upload a static delta to the commit from the one the ref points to on the server, if the repo has its whole tree")
     ("dry-run,n", "check arguments and authenticate but don't upload")
     ("walk-tree,w", "walk entire tree and upload all missing objects")
     ("disable-integrity-checks", "Don't validate the checksums of objects before uploading them");
@@ -108,6 +132,26 @@ int main(int argc, char **argv) {
     return EXIT_FAILURE;
   }
 
+  if (latency_target < 0) {
+    LOG_FATAL << "--latency-target must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (max_connections < 0) {
+    LOG_FATAL << "--connections must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (object_cache_ttl < 0) {
+    LOG_FATAL << "--object-cache-ttl must not be negative";
+    return EXIT_FAILURE;
+  }
+
+  if (!delta_from.empty() && vm.count("delta-from-server") != 0) {
+    LOG_FATAL << "--delta-from and --delta-from-server are mutually exclusive";
+    return EXIT_FAILURE;
+  }
+
   OSTreeRepo::ptr src_repo = std::make_shared<OSTreeDirRepo>(repo_path);
   if (!src_repo->LooksValid()) {
     LOG_FATAL << "The OSTree src repository does not appear to contain a valid OSTree repository";
@@ -130,18 +174,75 @@ int main(int argc, char **argv) {
       is_ref = false;
     }
 
+    std::unique_ptr<OSTreeHash> delta_base;
+    if (!delta_from.empty()) {
+      OSTreeRef delta_ref = src_repo->GetRef(delta_from);
+      try {
+        delta_base = std_::make_unique<OSTreeHash>(delta_ref.IsValid() ? delta_ref.GetHash()
+                                                                       : OSTreeHash::Parse(delta_from));
+      } catch (const OSTreeCommitParseError &e) {
+        LOG_FATAL << "Ref or commit refhash " << delta_from << " was not found in repository " << repo_path.string();
+        return EXIT_FAILURE;
+      }
+    } else if (vm.count("delta-from-server") != 0 && !is_ref) {
+      LOG_FATAL << "--delta-from-server needs a ref, not a commit refhash";
+      return EXIT_FAILURE;
+    }
+
     ServerCredentials push_credentials(credentials_path);
     TreehubServer push_server;
-    if (authenticate(cacerts, push_credentials, push_server) != EXIT_SUCCESS) {
+    if (authenticate(cacerts, push_credentials, push_server, token_cache_dir) != EXIT_SUCCESS) {
       LOG_FATAL << "Authentication with push server failed";
       return EXIT_FAILURE;
     }
     bool fsck = vm.count("disable-integrity-checks") == 0;
-    if (!UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck)) {
+    std::unique_ptr<PresenceCache> presence_cache;
+    if (!object_cache_dir.empty() && vm.count("ignore-object-cache") == 0) {
+      const auto cache_mode =
+          vm.count("verify-object-cache") != 0 ? PresenceCache::Mode::kVerify : PresenceCache::Mode::kUse;
+      presence_cache = std_::make_unique<PresenceCache>(object_cache_dir,
+                                                        PresenceCache::RepoId(push_server.root_url(), push_credentials),
+                                                        std::chrono::seconds(object_cache_ttl), cache_mode);
+    }
+    if (vm.count("delta-from-server") != 0) {
+      // Devices are likely to have the commit the ref points to now. A delta
+      // from it can't be generated if the repo doesn't have it, and the push
+      // goes on without one.
+      OSTreeRef server_ref(push_server, ref);
+      try {
+        if (server_ref.IsValid()) {
+          auto base = server_ref.GetHash();
+          auto base_path = OSTreeRepo::GetPathForHash(base, OstreeObjectType::OSTREE_OBJECT_TYPE_COMMIT);
+          if (!boost::filesystem::is_regular_file(repo_path / "objects" / base_path)) {
+            LOG_WARNING << "Commit " << base << " of ref " << ref
+                        << " on the server is not in the repo, no static delta is uploaded";
+          } else if (base.string() != commit->string()) {
+            delta_base = std_::make_unique<OSTreeHash>(base);
+          }
+        } else {
+          LOG_WARNING << "Ref " << ref << " is not on the server yet, no static delta is uploaded";
+        }
+      } catch (const OSTreeCommitParseError &e) {
+        LOG_WARNING << "Ref " << ref << " on the server is not a commit refhash, no static delta is uploaded";
+      }
+    }
+    if (!UploadToTreehub(src_repo, push_server, *commit, mode, max_curl_requests, fsck, scan_threads,
+                         presence_cache.get(), max_connections, upload_chunk_size,
+                         std::chrono::milliseconds(latency_target))) {
       LOG_FATAL << "Upload to treehub failed";
       return EXIT_FAILURE;
     }
 
+    // Before the ref, so that a device which sees the new commit can use the
+    // delta to it.
+    if (delta_base) {
+      StaticDelta delta(*delta_base, *commit);
+      if (!delta.Generate(repo_path) || !delta.Upload(push_server, mode)) {
+        LOG_FATAL << "Upload of the static delta to treehub failed";
+        return EXIT_FAILURE;
+      }
+    }
+
     if (mode != RunMode::kDryRun) {
       if (is_ref) {
         if (!PushRootRef(push_server, ostree_ref)) {
@@ -170,7 +271,10 @@ int main(int argc, char **argv) {
           push_server.InjectIntoCurl("manifests/" + commit->string(), curl);
           curlEasySetoptWrapper(curl, CURLOPT_CUSTOMREQUEST, "PUT");
           curlEasySetoptWrapper(curl, CURLOPT_POSTFIELDS, manifest_json_str.c_str());
-          CURLcode rc = curl_easy_perform(curl);
+          CURLcode rc;
+          do {
+            rc = curl_easy_perform(curl);
+          } while (rc == CURLE_OK && push_server.RetryWithNewToken(curl));
 
           if (rc != CURLE_OK) {
             LOG_ERROR << "Error pushing repo manifest to Treehub";
@@ -75,10 +75,12 @@ AuthenticationResult OAuth2::Authenticate() {
     try {
       read_json(body, pt);
       token_ = pt.get("access_token", "");
+      expires_in_ = std::chrono::seconds(pt.get<int64_t>("expires_in", 0));
       LOG_TRACE << "Got OAuth2 access token:" << token_;
       return AuthenticationResult::kSuccess;
     } catch (const json_parser_error &e) {
       token_ = "";
+      expires_in_ = std::chrono::seconds(0);
       return AuthenticationResult::kFailure;
     }
   } else {
@@ -1,6 +1,7 @@
 #ifndef SOTA_CLIENT_TOOLS_OAUTH2_H_
 #define SOTA_CLIENT_TOOLS_OAUTH2_H_
 
+#include <chrono>
 #include <string>
 #include <utility>
 
@@ -24,6 +25,8 @@ class OAuth2 {
   AuthenticationResult Authenticate();
 
   std::string token() const { return token_; }
+  /** How long the token is valid for, 0 if the server didn't say */
+  std::chrono::seconds expires_in() const { return expires_in_; }
 
  private:
   const std::string server_;
@@ -32,6 +35,7 @@ class OAuth2 {
   const std::string scope_;
   const std::string ca_certs_;
   std::string token_;
+  std::chrono::seconds expires_in_{0};
 };
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
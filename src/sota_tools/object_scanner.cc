@@ -0,0 +1,129 @@
+#include "object_scanner.h"
+
+#include <exception>
+
+#include "logging/logging.h"
+#include "ostree_repo.h"
+
+ObjectScanner::ObjectScanner(boost::filesystem::path repo_root, const unsigned int threads, const bool discover)
+    : repo_root_(std::move(repo_root)), discover_(discover) {
+  for (unsigned int i = 0; i < threads; ++i) {
+    threads_.emplace_back([this]() { Run(); });
+  }
+}
+
+ObjectScanner::~ObjectScanner() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  queued_cv_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void ObjectScanner::Parse(const OSTreeHash &hash, const OstreeObjectType type) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  QueueLocked(hash, type, Kind::kParse);
+}
+
+bool ObjectScanner::TakeChildren(const OSTreeHash &hash, OSTreeObject::Children *children) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Task *task = WaitLocked(lock, Key(hash, Kind::kParse));
+  // A failed parsing is reported by the caller trying again.
+  if (task == nullptr || !task->ok) {
+    return false;
+  }
+  *children = std::move(task->children);
+  task->children.clear();
+  return true;
+}
+
+void ObjectScanner::Fsck(const OSTreeHash &hash, const OstreeObjectType type) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  QueueLocked(hash, type, Kind::kFsck);
+}
+
+bool ObjectScanner::TakeFsck(const OSTreeHash &hash, bool *ok) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Task *task = WaitLocked(lock, Key(hash, Kind::kFsck));
+  if (task == nullptr) {
+    return false;
+  }
+  *ok = task->ok;
+  return true;
+}
+
+void ObjectScanner::QueueLocked(const OSTreeHash &hash, const OstreeObjectType type, const Kind kind) {
+  const Key key(hash, kind);
+  Task task;
+  task.type = type;
+  if (tasks_.emplace(key, std::move(task)).second) {
+    queue_.push_back(key);
+    queued_cv_.notify_one();
+  }
+}
+
+ObjectScanner::Task *ObjectScanner::WaitLocked(std::unique_lock<std::mutex> &lock, const Key &key) {
+  auto it = tasks_.find(key);
+  if (it == tasks_.end()) {
+    return nullptr;
+  }
+  Task &task = it->second;
+  done_cv_.wait(lock, [&task]() { return task.state != State::kRunning; });
+  const bool done = task.state == State::kDone;
+  // A queued task is skipped by the threads from now on.
+  task.state = State::kTaken;
+  return done ? &task : nullptr;
+}
+
+void ObjectScanner::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queued_cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    const Key key = queue_.front();
+    queue_.pop_front();
+    // Entries are never removed, and this thread owns the task while it runs.
+    Task &task = tasks_.find(key)->second;
+    if (task.state != State::kQueued) {
+      continue;
+    }
+    task.state = State::kRunning;
+    const OstreeObjectType type = task.type;
+    lock.unlock();
+
+    bool ok = true;
+    OSTreeObject::Children children;
+    if (key.second == Kind::kParse) {
+      try {
+        children = OSTreeObject::ParseChildren(repo_root_ / "objects" / OSTreeRepo::GetPathForHash(key.first, type),
+                                               type);
+      } catch (const std::exception &e) {
+        // Left to the RequestPool, which reports it
+        LOG_DEBUG << "Could not parse " << OSTreeRepo::GetPathForHash(key.first, type) << ": " << e.what();
+        ok = false;
+      }
+    } else {
+      ok = OSTreeObject::FsckObject(repo_root_, key.first, type);
+    }
+
+    lock.lock();
+    if (discover_ && ok) {
+      for (const auto &child : children) {
+        if (child.second == OSTREE_OBJECT_TYPE_DIR_TREE) {
+          QueueLocked(child.first, child.second, Kind::kParse);
+        }
+      }
+    }
+    task.ok = ok;
+    task.children = std::move(children);
+    task.state = State::kDone;
+    done_cv_.notify_all();
+  }
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
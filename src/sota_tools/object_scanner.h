@@ -0,0 +1,89 @@
+#ifndef SOTA_CLIENT_TOOLS_OBJECT_SCANNER_H_
+#define SOTA_CLIENT_TOOLS_OBJECT_SCANNER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+#include "ostree_object.h"
+
+/**
+ * Does the local work on the objects of a repo on a pool of threads, ahead of
+ * the requests of a RequestPool: parsing commits and dirtrees for their
+ * children, and checking the integrity of the objects to upload.
+ *
+ * With discovery, parsing a dirtree queues the parsing of the dirtrees it
+ * refers to, so that the whole tree is parsed in parallel while the first
+ * requests are made. Only use it with repos that have all their objects on
+ * disk.
+ *
+ * The results are taken on the thread of the RequestPool. A task that hasn't
+ * started when its result is taken is left to that thread.
+ */
+class ObjectScanner {
+ public:
+  ObjectScanner(boost::filesystem::path repo_root, unsigned int threads, bool discover);
+  ~ObjectScanner();
+  ObjectScanner(const ObjectScanner&) = delete;
+  ObjectScanner(ObjectScanner&&) = delete;
+  ObjectScanner& operator=(const ObjectScanner&) = delete;
+  ObjectScanner& operator=(ObjectScanner&&) = delete;
+
+  /** Queue the parsing of a commit or dirtree, unless it was queued before. */
+  void Parse(const OSTreeHash& hash, OstreeObjectType type);
+  /**
+   * Take the children of an object, waiting for its parsing if it is in
+   * progress.
+   * @return false if the object is not parsed, which is then up to the caller
+   */
+  bool TakeChildren(const OSTreeHash& hash, OSTreeObject::Children* children);
+
+  /** Queue the integrity check of an object, unless it was queued before. */
+  void Fsck(const OSTreeHash& hash, OstreeObjectType type);
+  /**
+   * Take the result of the check of an object, waiting for it if it is in
+   * progress.
+   * @return false if the object is not checked, which is then up to the caller
+   */
+  bool TakeFsck(const OSTreeHash& hash, bool* ok);
+
+ private:
+  enum class Kind { kParse, kFsck };
+  enum class State { kQueued, kRunning, kDone, kTaken };
+  using Key = std::pair<OSTreeHash, Kind>;
+  struct Task {
+    OstreeObjectType type;
+    State state{State::kQueued};
+    // Whether the parsing succeeded, or the object is intact
+    bool ok{false};
+    OSTreeObject::Children children;
+  };
+
+  void Run();
+  // Needs mutex_
+  void QueueLocked(const OSTreeHash& hash, OstreeObjectType type, Kind kind);
+  // Needs mutex_, passed as lock. Marks the task taken.
+  Task* WaitLocked(std::unique_lock<std::mutex>& lock, const Key& key);
+
+  const boost::filesystem::path repo_root_;
+  const bool discover_;
+  std::mutex mutex_;
+  std::condition_variable queued_cv_;
+  std::condition_variable done_cv_;
+  // Guarded by mutex_
+  std::map<Key, Task> tasks_;
+  std::deque<Key> queue_;
+  bool stop_{false};
+  std::vector<std::thread> threads_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_OBJECT_SCANNER_H_
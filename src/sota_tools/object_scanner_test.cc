@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "object_scanner.h"
+#include "ostree_dir_repo.h"
+#include "ostree_repo.h"
+
+static const boost::filesystem::path kRepo{"tests/sota_tools/bigger_repo"};
+
+static std::string ChildrenString(const OSTreeObject::Children& children) {
+  std::string res;
+  for (const auto& child : children) {
+    res += OSTreeRepo::GetPathForHash(child.first, child.second).string() + "\n";
+  }
+  return res;
+}
+
+/* The children parsed ahead are those parsed in place, and the dirtrees of a
+ * local repo are found by the scanner. */
+TEST(ObjectScanner, Parse) {
+  OSTreeDirRepo repo(kRepo);
+  const OSTreeHash commit = repo.GetRef("master").GetHash();
+
+  ObjectScanner scanner(kRepo, 4, true);
+  scanner.Parse(commit, OSTREE_OBJECT_TYPE_COMMIT);
+  // Leave the threads the time to go through the whole tree.
+  std::this_thread::sleep_for(std::chrono::seconds(1));
+
+  std::vector<std::pair<OSTreeHash, OstreeObjectType>> pending{{commit, OSTREE_OBJECT_TYPE_COMMIT}};
+  int taken = 0;
+  while (!pending.empty()) {
+    const auto object = pending.back();
+    pending.pop_back();
+    const auto expected =
+        OSTreeObject::ParseChildren(kRepo / "objects" / OSTreeRepo::GetPathForHash(object.first, object.second),
+                                    object.second);
+    OSTreeObject::Children children;
+    if (scanner.TakeChildren(object.first, &children)) {
+      EXPECT_EQ(ChildrenString(children), ChildrenString(expected));
+      ++taken;
+    }
+    // Only once
+    EXPECT_FALSE(scanner.TakeChildren(object.first, &children));
+    for (const auto& child : expected) {
+      if (child.second == OSTREE_OBJECT_TYPE_DIR_TREE) {
+        pending.push_back(child);
+      }
+    }
+  }
+  EXPECT_GT(taken, 1);
+}
+
+/* Nothing is found without discovery, or for objects never queued. */
+TEST(ObjectScanner, NoDiscovery) {
+  OSTreeDirRepo repo(kRepo);
+  const OSTreeHash commit = repo.GetRef("master").GetHash();
+
+  ObjectScanner scanner(kRepo, 2, false);
+  scanner.Parse(commit, OSTREE_OBJECT_TYPE_COMMIT);
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  OSTreeObject::Children children;
+  ASSERT_TRUE(scanner.TakeChildren(commit, &children));
+  ASSERT_EQ(children.size(), 2U);
+  OSTreeObject::Children grandchildren;
+  EXPECT_FALSE(scanner.TakeChildren(children[0].first, &grandchildren));
+}
+
+TEST(ObjectScanner, Fsck) {
+  const boost::filesystem::path corrupt_repo{"tests/sota_tools/corrupt-repo"};
+  const auto good = OSTreeHash::Parse("2ee758031340b51db1c0229bddd8f64bca4b131728d2bfb20c0c8671b1259a38");
+  const auto corrupt = OSTreeHash::Parse("4145b1a9bade30efb28ff921f7a555ff82ba7d3b7b83b968084436167912fa83");
+
+  ObjectScanner scanner(corrupt_repo, 2, false);
+  scanner.Fsck(good, OSTREE_OBJECT_TYPE_FILE);
+  scanner.Fsck(corrupt, OSTREE_OBJECT_TYPE_FILE);
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+  bool ok = false;
+  ASSERT_TRUE(scanner.TakeFsck(good, &ok));
+  EXPECT_TRUE(ok);
+  ASSERT_TRUE(scanner.TakeFsck(corrupt, &ok));
+  EXPECT_FALSE(ok);
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
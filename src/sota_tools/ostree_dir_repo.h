@@ -19,6 +19,7 @@ class OSTreeDirRepo : public OSTreeRepo {
   bool LooksValid() const override;
   OSTreeRef GetRef(const std::string& refname) const override;
   boost::filesystem::path root() const override { return root_; }
+  bool IsLocal() const override { return true; }
 
  private:
   bool FetchObject(const boost::filesystem::path& path) const override;
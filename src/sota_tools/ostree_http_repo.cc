@@ -2,12 +2,38 @@
 
 #include <fcntl.h>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 #include <boost/property_tree/ini_parser.hpp>
 
 namespace pt = boost::property_tree;
 
+OSTreeHttpRepo::OSTreeHttpRepo(TreehubServer *server, boost::filesystem::path root_in, const int max_fetches)
+    : server_(server), root_(std::move(root_in)), max_fetches_(max_fetches) {
+  if (root_.empty()) {
+    root_ = root_tmp_.Path();
+  }
+  curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_WRITEFUNCTION, &OSTreeHttpRepo::curl_handle_write);
+  curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_FAILONERROR, true);
+  if (max_fetches_ > 0) {
+    fetch_thread_ = std::thread(&OSTreeHttpRepo::RunFetches, this);
+  }
+}
+
+OSTreeHttpRepo::~OSTreeHttpRepo() {
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    fetch_stop_ = true;
+  }
+  fetch_cv_.notify_all();
+  if (fetch_thread_.joinable()) {
+    fetch_thread_.join();
+  }
+}
+
 bool OSTreeHttpRepo::LooksValid() const {
   if (FetchObject("config")) {
     pt::ptree config;
@@ -33,7 +59,146 @@ bool OSTreeHttpRepo::LooksValid() const {
 
 OSTreeRef OSTreeHttpRepo::GetRef(const std::string &refname) const { return OSTreeRef(*server_, refname); }
 
+void OSTreeHttpRepo::Prefetch(const OSTreeObject::Children &objects) const {
+  if (max_fetches_ == 0) {
+    return;
+  }
+  // The token can't be changed under the requests of the fetch thread.
+  server_->SetTokenRefresher(nullptr);
+  {
+    std::lock_guard<std::mutex> lock(fetch_mutex_);
+    for (const auto &object : objects) {
+      if (ObjectTable.count(object.first) != 0) {
+        continue;
+      }
+      boost::filesystem::path path("objects");
+      path /= GetPathForHash(object.first, object.second);
+      if (fetches_.emplace(path.string(), FetchState::kQueued).second) {
+        fetch_queue_.push_back(path.string());
+      }
+    }
+  }
+  fetch_cv_.notify_all();
+}
+
+void OSTreeHttpRepo::RunFetches() {
+  struct Fetch {
+    std::string path;
+    int fd;
+  };
+  CURLM *multi = curl_multi_init();
+  if (multi == nullptr) {
+    LOG_ERROR << "Could not initialize curl multi handle, objects are fetched one by one";
+  }
+  std::map<CURL *, Fetch> running;
+
+  std::unique_lock<std::mutex> lock(fetch_mutex_);
+  while (!fetch_stop_) {
+    fetch_cv_.wait(lock, [this, &running]() { return fetch_stop_ || !fetch_queue_.empty() || !running.empty(); });
+    if (fetch_stop_) {
+      break;
+    }
+    while (static_cast<int>(running.size()) < max_fetches_ && !fetch_queue_.empty()) {
+      const std::string path = fetch_queue_.front();
+      fetch_queue_.pop_front();
+      const std::string filename = (root_ / path).string();
+      boost::system::error_code ec;
+      boost::filesystem::create_directories((root_ / path).parent_path(), ec);
+      const int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR | S_IRGRP | S_IROTH);
+      CURL *handle = (multi != nullptr && fd != -1) ? curl_easy_init() : nullptr;
+      if (handle == nullptr) {
+        // Left to FetchObject(), which reports the error
+        if (fd != -1) {
+          close(fd);
+        }
+        fetches_[path] = FetchState::kFailed;
+        fetch_cv_.notify_all();
+        continue;
+      }
+      fetches_[path] = FetchState::kFetching;
+      Fetch &fetch = running[handle] = Fetch{path, fd};
+      curl_easy_setopt(handle, CURLOPT_VERBOSE, get_curlopt_verbose());
+      curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &OSTreeHttpRepo::curl_handle_write);
+      curl_easy_setopt(handle, CURLOPT_WRITEDATA, &fetch.fd);
+      curl_easy_setopt(handle, CURLOPT_FAILONERROR, 1L);
+      try {
+        server_->InjectIntoCurl(path, handle);
+      } catch (const std::exception &e) {
+        LOG_DEBUG << "Prefetching " << path << " failed: " << e.what();
+        close(fd);
+        curl_easy_cleanup(handle);
+        running.erase(handle);
+        fetches_[path] = FetchState::kFailed;
+        fetch_cv_.notify_all();
+        continue;
+      }
+      curl_multi_add_handle(multi, handle);
+    }
+    lock.unlock();
+
+    std::vector<std::pair<std::string, bool>> done;
+    if (!running.empty()) {
+      int running_handles = 0;
+      curl_multi_perform(multi, &running_handles);
+      int msgs_in_queue = 0;
+      while (CURLMsg *msg = curl_multi_info_read(multi, &msgs_in_queue)) {
+        if (msg->msg != CURLMSG_DONE) {
+          continue;
+        }
+        auto fetch = running.find(msg->easy_handle);
+        close(fetch->second.fd);
+        const bool ok = msg->data.result == CURLE_OK;
+        if (!ok) {
+          LOG_DEBUG << "Prefetching " << fetch->second.path << " failed: " << curl_easy_strerror(msg->data.result);
+          remove((root_ / fetch->second.path).c_str());
+        }
+        done.emplace_back(fetch->second.path, ok);
+        curl_multi_remove_handle(multi, msg->easy_handle);
+        curl_easy_cleanup(msg->easy_handle);
+        running.erase(fetch);
+      }
+      if (!running.empty()) {
+        curl_multi_wait(multi, nullptr, 0, 100, nullptr);
+      }
+    }
+
+    lock.lock();
+    for (const auto &fetch : done) {
+      fetches_[fetch.first] = fetch.second ? FetchState::kDone : FetchState::kFailed;
+    }
+    if (!done.empty()) {
+      fetch_cv_.notify_all();
+    }
+  }
+  lock.unlock();
+
+  for (auto &fetch : running) {
+    curl_multi_remove_handle(multi, fetch.first);
+    curl_easy_cleanup(fetch.first);
+    close(fetch.second.fd);
+  }
+  if (multi != nullptr) {
+    curl_multi_cleanup(multi);
+  }
+}
+
 bool OSTreeHttpRepo::FetchObject(const boost::filesystem::path &path) const {
+  if (max_fetches_ > 0) {
+    std::unique_lock<std::mutex> lock(fetch_mutex_);
+    auto fetch = fetches_.find(path.string());
+    if (fetch != fetches_.end()) {
+      fetch_cv_.wait(lock, [&fetch]() {
+        return fetch->second == FetchState::kDone || fetch->second == FetchState::kFailed;
+      });
+      const bool fetched = fetch->second == FetchState::kDone;
+      fetches_.erase(fetch);
+      if (fetched) {
+        return true;
+      }
+      // Fetched again below, with the error reported
+    }
+  }
+
   CURLcode err = CURLE_OK;
   server_->InjectIntoCurl(path.string(), easy_handle_.get());
   boost::filesystem::create_directories((root_ / path).parent_path());
@@ -44,7 +209,9 @@ bool OSTreeHttpRepo::FetchObject(const boost::filesystem::path &path) const {
     return false;
   }
   curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_WRITEDATA, &fp);
-  err = curl_easy_perform(easy_handle_.get());
+  do {
+    err = curl_easy_perform(easy_handle_.get());
+  } while (err == CURLE_HTTP_RETURNED_ERROR && server_->RetryWithNewToken(easy_handle_.get()));
   close(fp);
 
   if (err == CURLE_HTTP_RETURNED_ERROR) {
@@ -1,6 +1,13 @@
 #ifndef SOTA_CLIENT_TOOLS_OSTREE_HTTP_REPO_H_
 #define SOTA_CLIENT_TOOLS_OSTREE_HTTP_REPO_H_
 
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
 #include <boost/filesystem/path.hpp>
 
 #include "logging/logging.h"
@@ -11,28 +18,43 @@
 
 class OSTreeHttpRepo : public OSTreeRepo {
  public:
-  explicit OSTreeHttpRepo(TreehubServer* server, boost::filesystem::path root_in = "")
-      : server_(server), root_(std::move(root_in)) {
-    if (root_.empty()) {
-      root_ = root_tmp_.Path();
-    }
-    curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
-    curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_WRITEFUNCTION, &OSTreeHttpRepo::curl_handle_write);
-    curlEasySetoptWrapper(easy_handle_.get(), CURLOPT_FAILONERROR, true);
-  }
+  /**
+   * @param max_fetches how many objects to fetch at once ahead of GetObject(),
+   *                    0 for fetching them one by one when requested
+   */
+  explicit OSTreeHttpRepo(TreehubServer* server, boost::filesystem::path root_in = "", int max_fetches = 0);
+  ~OSTreeHttpRepo() override;
+  OSTreeHttpRepo(const OSTreeHttpRepo&) = delete;
+  OSTreeHttpRepo(OSTreeHttpRepo&&) = delete;
+  OSTreeHttpRepo& operator=(const OSTreeHttpRepo&) = delete;
+  OSTreeHttpRepo& operator=(OSTreeHttpRepo&&) = delete;
 
   bool LooksValid() const override;
   OSTreeRef GetRef(const std::string& refname) const override;
   boost::filesystem::path root() const override { return root_; }
+  void Prefetch(const OSTreeObject::Children& objects) const override;
 
  private:
+  enum class FetchState { kQueued, kFetching, kDone, kFailed };
+
   bool FetchObject(const boost::filesystem::path& path) const override;
+  /** Fetch the queued objects, up to max_fetches_ at once, until stopped. */
+  void RunFetches();
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
 
   TreehubServer* server_;
   boost::filesystem::path root_;
   const TemporaryDirectory root_tmp_;
   mutable CurlEasyWrapper easy_handle_;
+
+  const int max_fetches_;
+  mutable std::mutex fetch_mutex_;
+  mutable std::condition_variable fetch_cv_;
+  // Object path -> state, until taken by FetchObject()
+  mutable std::map<std::string, FetchState> fetches_;
+  mutable std::deque<std::string> fetch_queue_;
+  bool fetch_stop_{false};
+  std::thread fetch_thread_;
 };
 
 // vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -108,6 +108,44 @@ TEST(http_repo, bad_connection) {
   EXPECT_EQ(result, 0) << "Diff between source and destination repos is nonzero.";
 }
 
+/* Fetch the objects ahead, several at once.
+ *
+ * The source server drops every other request, so that some objects are
+ * fetched again when requested. */
+TEST(http_repo, prefetch) {
+  TemporaryDirectory src_dir, dst_dir;
+  std::string sp = TestUtils::getFreePort();
+
+  boost::process::child server_process("tests/sota_tools/treehub_server.py", std::string("-p"), sp, std::string("-d"),
+                                       src_dir.PathString(), std::string("-f2"), std::string("--create"));
+  TestUtils::waitForServer("http://localhost:" + sp + "/");
+
+  TreehubServer server;
+  server.root_url("http://localhost:" + sp);
+  OSTreeRepo::ptr src_repo = std::make_shared<OSTreeHttpRepo>(&server, "", 4);
+
+  std::string dp = TestUtils::getFreePort();
+  Json::Value auth;
+  auth["ostree"]["server"] = std::string("https://localhost:") + dp;
+  Utils::writeFile(dst_dir.Path() / "auth.json", auth);
+  boost::process::child deploy_server_process("tests/sota_tools/treehub_server.py", std::string("-p"), dp,
+                                              std::string("-d"), dst_dir.PathString(), std::string("--tls"));
+  TestUtils::waitForServer("https://localhost:" + dp + "/");
+
+  boost::filesystem::path filepath = (dst_dir.Path() / "auth.json").string();
+  boost::filesystem::path cert_path = "tests/fake_http_server/server.crt";
+
+  auto hash = OSTreeHash::Parse("b9ac1e45f9227df8ee191b6e51e09417bd36c6ebbeff999431e3073ac50f0563");
+  TreehubServer push_server;
+  EXPECT_EQ(authenticate(cert_path.string(), ServerCredentials(filepath), push_server), EXIT_SUCCESS);
+  EXPECT_TRUE(UploadToTreehub(src_repo, push_server, hash, RunMode::kDefault, 4, false));
+
+  std::string diff("diff -r ");
+  std::string src_path((src_dir.Path() / "objects").string() + " ");
+  std::string dst_path((dst_dir.Path() / "objects").string() + " ");
+  EXPECT_EQ(system((diff + src_path + dst_path).c_str()), 0) << "Diff between source and destination repos is nonzero.";
+}
+
 TEST(http_repo, root) {
   TreehubServer server;
   server.root_url("http://localhost:" + port);
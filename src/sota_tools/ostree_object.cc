@@ -4,11 +4,13 @@
 #include <ostree.h>
 #include <sys/stat.h>
 #include <boost/filesystem.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <iostream>
 
 #include "logging/logging.h"
+#include "object_scanner.h"
 #include "ostree_repo.h"
 #include "request_pool.h"
 #include "utilities/utils.h"
@@ -21,8 +23,7 @@ OSTreeObject::OSTreeObject(const OSTreeRepo &repo, OSTreeHash hash, OstreeObject
       repo_(repo),
       refcount_(0),
       is_on_server_(PresenceOnServer::kObjectStateUnknown),
-      curl_handle_(nullptr),
-      fd_(nullptr) {
+      curl_handle_(nullptr) {
   auto file_path = PathOnDisk();
   if (!boost::filesystem::is_regular_file(file_path)) {
     throw std::runtime_error(file_path.native() + " is not a valid OSTree object.");
@@ -36,6 +37,12 @@ OSTreeObject::~OSTreeObject() {
   }
 }
 
+OSTreeObject::Request::~Request() {
+  if (fd != nullptr) {
+    fclose(fd);
+  }
+}
+
 void OSTreeObject::AddParent(OSTreeObject *parent, std::list<OSTreeObject::ptr>::iterator parent_it) {
   parentref par;
 
@@ -58,6 +65,8 @@ void OSTreeObject::NotifyParents(RequestPool &pool) {
       pool.AddUpload(parent.first);
     }
   }
+  // Not needed any more, with many objects to go
+  parents_.clear();
 }
 
 void OSTreeObject::AppendChild(const OSTreeObject::ptr &child) {
@@ -72,27 +81,25 @@ void OSTreeObject::AppendChild(const OSTreeObject::ptr &child) {
   child->AddParent(this, last);
 }
 
-// Can throw OSTreeObjectMissing if the repo is corrupt
-void OSTreeObject::PopulateChildren() {
+OSTreeObject::Children OSTreeObject::ParseChildren(const boost::filesystem::path &path, const OstreeObjectType type) {
   const GVariantType *content_type;
   bool is_commit;
 
-  if (type_ == OSTREE_OBJECT_TYPE_COMMIT) {
+  if (type == OSTREE_OBJECT_TYPE_COMMIT) {
     content_type = OSTREE_COMMIT_GVARIANT_FORMAT;
     is_commit = true;
-  } else if (type_ == OSTREE_OBJECT_TYPE_DIR_TREE) {
+  } else if (type == OSTREE_OBJECT_TYPE_DIR_TREE) {
     content_type = OSTREE_TREE_GVARIANT_FORMAT;
     is_commit = false;
   } else {
-    return;
+    return {};
   }
 
   GError *gerror = nullptr;
-  auto file_path = PathOnDisk();
-  GMappedFile *mfile = g_mapped_file_new(file_path.c_str(), FALSE, &gerror);
+  GMappedFile *mfile = g_mapped_file_new(path.c_str(), FALSE, &gerror);
 
   if (mfile == nullptr) {
-    throw std::runtime_error("Failed to map metadata file " + file_path.native());
+    throw std::runtime_error("Failed to map metadata file " + path.native());
   }
 
   GVariant *contents =
@@ -100,6 +107,7 @@ void OSTreeObject::PopulateChildren() {
                               reinterpret_cast<GDestroyNotify>(g_mapped_file_unref), mfile);
   g_variant_ref_sink(contents);
 
+  Children children;
   if (is_commit) {
     // * - ay - Root tree contents
     GVariant *content_csum_variant = nullptr;
@@ -108,14 +116,14 @@ void OSTreeObject::PopulateChildren() {
     gsize n_elts;
     const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
     assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
+    children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE);
 
     // * - ay - Root tree metadata
     GVariant *meta_csum_variant = nullptr;
     g_variant_get_child(contents, 7, "@ay", &meta_csum_variant);
     csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
     assert(n_elts == 32);
-    AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
+    children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META);
 
     g_variant_unref(meta_csum_variant);
     g_variant_unref(content_csum_variant);
@@ -128,6 +136,7 @@ void OSTreeObject::PopulateChildren() {
 
     gsize nfiles = g_variant_n_children(files_variant);
     gsize ndirs = g_variant_n_children(dirs_variant);
+    children.reserve(nfiles + 2 * ndirs);
 
     // * - a(say) - array of (filename, checksum) for files
     for (gsize i = 0; i < nfiles; i++) {
@@ -138,7 +147,7 @@ void OSTreeObject::PopulateChildren() {
       gsize n_elts;
       const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_FILE));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_FILE);
 
       g_variant_unref(csum_variant);
     }
@@ -153,12 +162,12 @@ void OSTreeObject::PopulateChildren() {
       // First the .dirtree:
       const auto *csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(content_csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_TREE);
 
       // Then the .dirmeta:
       csum = static_cast<const uint8_t *>(g_variant_get_fixed_array(meta_csum_variant, &n_elts, 1));
       assert(n_elts == 32);
-      AppendChild(repo_.GetObject(csum, OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META));
+      children.emplace_back(OSTreeHash(csum), OstreeObjectType::OSTREE_OBJECT_TYPE_DIR_META);
 
       g_variant_unref(meta_csum_variant);
       g_variant_unref(content_csum_variant);
@@ -168,6 +177,45 @@ void OSTreeObject::PopulateChildren() {
     g_variant_unref(files_variant);
   }
   g_variant_unref(contents);
+  return children;
+}
+
+// Can throw OSTreeObjectMissing if the repo is corrupt
+void OSTreeObject::PopulateChildren(RequestPool &pool) {
+  if (type_ != OSTREE_OBJECT_TYPE_COMMIT && type_ != OSTREE_OBJECT_TYPE_DIR_TREE) {
+    return;
+  }
+  ObjectScanner *scanner = pool.scanner();
+  Children children;
+  if (scanner == nullptr || !scanner->TakeChildren(hash_, &children)) {
+    children = ParseChildren(PathOnDisk(), type_);
+  }
+  // Not even fetched from an OSTreeHttpRepo
+  children.erase(std::remove_if(children.begin(), children.end(),
+                                [&pool](const Children::value_type &child) {
+                                  return pool.KnownPresent(child.first, child.second);
+                                }),
+                 children.end());
+  repo_.Prefetch(children);
+  for (const auto &child : children) {
+    OSTreeObject::ptr object;
+    try {
+      object = repo_.GetObject(child.first, child.second);
+    } catch (const OSTreeObjectMissing &error) {
+      // When walking the tree of the server itself, what it doesn't have
+      // can't be fetched from it.
+      if (pool.run_mode() != RunMode::kWalkTree || repo_.IsLocal()) {
+        throw;
+      }
+      pool.AddMissing(child.first, child.second);
+      continue;
+    }
+    AppendChild(object);
+    if (scanner != nullptr && child.second == OSTREE_OBJECT_TYPE_DIR_TREE) {
+      // Ready by the time the child turns out to be missing on the server
+      scanner->Parse(child.first, child.second);
+    }
+  }
 }
 
 void OSTreeObject::QueryChildren(RequestPool &pool) {
@@ -209,7 +257,7 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
-  http_response_.str("");                                      // Empty the response buffer
+  request_ = std_::make_unique<Request>();
 
   const CURLMcode err = curl_multi_add_handle(curl_multi_handle, curl_handle_);
   if (err != 0) {
@@ -219,9 +267,12 @@ void OSTreeObject::MakeTestRequest(const TreehubServer &push_target, CURLM *curl
   request_start_time_ = std::chrono::steady_clock::now();
 }
 
-void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode) {
+void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle, const RunMode mode,
+                          const uintmax_t chunk_size) {
   if (mode == RunMode::kDefault || mode == RunMode::kPushTree) {
-    LOG_INFO << "Uploading " << *this;
+    if (upload_offset_ == 0) {
+      LOG_INFO << "Uploading " << *this;
+    }
   } else {
     LOG_INFO << "Would upload " << *this;
     is_on_server_ = PresenceOnServer::kObjectPresent;
@@ -240,20 +291,41 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
   curlEasySetoptWrapper(curl_handle_, CURLOPT_USERAGENT, Utils::getUserAgent());
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &OSTreeObject::curl_handle_write);
   curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
-  http_response_.str("");  // Empty the response buffer
+  request_ = std_::make_unique<Request>();
 
   struct stat file_info {};
   auto file_path = PathOnDisk();
-  fd_ = fopen(file_path.c_str(), "rb");
-  if (fd_ == nullptr) {
+  request_->fd = fopen(file_path.c_str(), "rb");
+  if (request_->fd == nullptr) {
     throw std::runtime_error("could not open file to be uploaded");
   } else {
     if (stat(file_path.c_str(), &file_info) < 0) {
       throw std::runtime_error("Could not get file information");
     }
   }
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, fd_);
-  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, file_info.st_size);
+  const auto total_size = static_cast<uintmax_t>(file_info.st_size);
+  if (chunk_size > 0 && total_size > chunk_size) {
+    request_->chunk_size = std::min(chunk_size, total_size - upload_offset_);
+    request_->chunk_left = request_->chunk_size;
+    if (fseeko(request_->fd, static_cast<off_t>(upload_offset_), SEEK_SET) != 0) {
+      throw std::runtime_error("Could not seek in file to be uploaded");
+    }
+    request_->range_header_contents = "Content-Range: bytes " + std::to_string(upload_offset_) + "-" +
+                                      std::to_string(upload_offset_ + request_->chunk_size - 1) + "/" +
+                                      std::to_string(total_size);
+    request_->range_header.data = const_cast<char *>(request_->range_header_contents.c_str());
+    request_->range_header.next = push_target.headers();
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_HTTPHEADER, &request_->range_header);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READFUNCTION, &OSTreeObject::curl_handle_read);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, this);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(request_->chunk_size));
+    LOG_DEBUG << "Uploading " << request_->range_header_contents << " of " << *this;
+  } else {
+    upload_offset_ = 0;
+    request_->chunk_size = total_size;
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_READDATA, request_->fd);
+    curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, file_info.st_size);
+  }
   curlEasySetoptWrapper(curl_handle_, CURLOPT_POST, 1);
 
   curlEasySetoptWrapper(curl_handle_, CURLOPT_PRIVATE, this);  // Used by ostree_object_from_curl
@@ -268,7 +340,7 @@ void OSTreeObject::Upload(TreehubServer &push_target, CURLM *curl_multi_handle,
 
 void OSTreeObject::CheckChildren(RequestPool &pool, const long rescode) {  // NOLINT(google-runtime-int)
   try {
-    PopulateChildren();
+    PopulateChildren(pool);
     LOG_TRACE << "Children of " << *this << ": " << children_.size();
     if (children_ready()) {
       if (rescode != 200) {
@@ -287,15 +359,19 @@ void OSTreeObject::PresenceError(RequestPool &pool, const int64_t rescode) {
   is_on_server_ = PresenceOnServer::kObjectStateUnknown;
   LOG_WARNING << "OSTree query reported an error code: " << rescode << " retrying...";
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << request_->http_response.str();
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddQuery(this);
 }
 
 void OSTreeObject::UploadError(RequestPool &pool, const int64_t rescode) {
   LOG_WARNING << "OSTree upload reported an error code:" << rescode << " retrying...";
+  if (rescode == 416) {
+    // The server lost the chunks it had accepted.
+    upload_offset_ = 0;
+  }
   LOG_DEBUG << "Http response code:" << rescode;
-  LOG_DEBUG << http_response_.str();
+  LOG_DEBUG << request_->http_response.str();
   is_on_server_ = PresenceOnServer::kObjectMissing;
   last_operation_result_ = ServerResponse::kTemporaryFailure;
   pool.AddUpload(this);
@@ -316,18 +392,9 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
     if (url == nullptr || strstr(url, OSTreeRepo::GetPathForHash(hash_, type_).c_str()) == nullptr) {
       PresenceError(pool, rescode);
     } else if (rescode == 200) {
-      LOG_INFO << "Already present: " << *this;
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
-        CheckChildren(pool, rescode);
-      } else {
-        NotifyParents(pool);
-      }
+      PresenceKnown(pool, true);
     } else if (rescode == 404) {
-      is_on_server_ = PresenceOnServer::kObjectMissing;
-      last_operation_result_ = ServerResponse::kOk;
-      CheckChildren(pool, rescode);
+      PresenceKnown(pool, false);
     } else {
       PresenceError(pool, rescode);
     }
@@ -338,20 +405,22 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
     // NOLINTNEXTLINE(bugprone-branch-clone)
     if (url == nullptr || strstr(url, Url().c_str()) == nullptr) {
       UploadError(pool, rescode);
+    } else if (rescode == 202 && upload_offset_ + request_->chunk_size < GetSize()) {
+      LOG_TRACE << "OSTree upload of a chunk successful";
+      upload_offset_ += request_->chunk_size;
+      is_on_server_ = PresenceOnServer::kObjectMissing;
+      last_operation_result_ = ServerResponse::kOk;
+      pool.AddUpload(this);
     } else if (rescode == 204) {
       LOG_TRACE << "OSTree upload successful";
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      NotifyParents(pool);
+      upload_offset_ = 0;
+      UploadDone(pool);
     } else if (rescode == 409) {
       LOG_DEBUG << "OSTree upload reported a 409 Conflict, possibly due to concurrent uploads";
-      is_on_server_ = PresenceOnServer::kObjectPresent;
-      last_operation_result_ = ServerResponse::kOk;
-      NotifyParents(pool);
+      UploadDone(pool);
     } else {
       UploadError(pool, rescode);
     }
-    fclose(fd_);
   } else {
     LOG_ERROR << "Unknown operation: " << static_cast<int>(current_operation_);
     assert(0);
@@ -359,14 +428,60 @@ void OSTreeObject::CurlDone(CURLM *curl_multi_handle, RequestPool &pool) {
   curl_multi_remove_handle(curl_multi_handle, curl_handle_);
   curl_easy_cleanup(curl_handle_);
   curl_handle_ = nullptr;
+  request_.reset();
+}
+
+void OSTreeObject::UploadDone(RequestPool &pool) {
+  is_on_server_ = PresenceOnServer::kObjectPresent;
+  last_operation_result_ = ServerResponse::kOk;
+  if (pool.presence_cache() != nullptr) {
+    pool.presence_cache()->Present(hash_, type_);
+  }
+  NotifyParents(pool);
+}
+
+void OSTreeObject::PresenceKnown(RequestPool &pool, const bool present) {
+  last_operation_result_ = ServerResponse::kOk;
+  PresenceCache *cache = pool.presence_cache();
+  if (cache != nullptr) {
+    if (present) {
+      cache->Present(hash_, type_);
+    } else {
+      cache->Missing(hash_, type_);
+    }
+  }
+  if (present) {
+    LOG_INFO << "Already present: " << *this;
+    is_on_server_ = PresenceOnServer::kObjectPresent;
+    if (pool.run_mode() == RunMode::kWalkTree || pool.run_mode() == RunMode::kPushTree) {
+      CheckChildren(pool, 200);
+    } else {
+      NotifyParents(pool);
+    }
+  } else {
+    is_on_server_ = PresenceOnServer::kObjectMissing;
+    if (pool.run_mode() == RunMode::kWalkTree) {
+      pool.AddMissing(hash_, type_);
+    }
+    CheckChildren(pool, 404);
+  }
 }
 
 size_t OSTreeObject::curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
   auto *that = static_cast<OSTreeObject *>(userp);
-  that->http_response_.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(size * nmemb));
+  that->request_->http_response.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(size * nmemb));
   return size * nmemb;
 }
 
+size_t OSTreeObject::curl_handle_read(char *buffer, size_t size, size_t nitems, void *userp) {
+  auto *that = static_cast<OSTreeObject *>(userp);
+  Request &request = *that->request_;
+  const size_t read =
+      fread(buffer, 1, static_cast<size_t>(std::min<uintmax_t>(size * nitems, request.chunk_left)), request.fd);
+  request.chunk_left -= read;
+  return read;
+}
+
 OSTreeObject::ptr ostree_object_from_curl(CURL *curlhandle) {
   void *p;
   curl_easy_getinfo(curlhandle, CURLINFO_PRIVATE, &p);
@@ -375,8 +490,11 @@ OSTreeObject::ptr ostree_object_from_curl(CURL *curlhandle) {
   return boost::intrusive_ptr<OSTreeObject>(h);
 }
 
-bool OSTreeObject::Fsck() const {
-  GFile *repo_path_file = g_file_new_for_path(repo_.root().c_str());  // Never fails
+bool OSTreeObject::Fsck() const { return FsckObject(repo_.root(), hash_, type_); }
+
+bool OSTreeObject::FsckObject(const boost::filesystem::path &repo_root, const OSTreeHash &hash,
+                              const OstreeObjectType type) {
+  GFile *repo_path_file = g_file_new_for_path(repo_root.c_str());  // Never fails
   OstreeRepo *repo = ostree_repo_new(repo_path_file);
   GError *err = nullptr;
   auto ok = ostree_repo_open(repo, nullptr, &err);
@@ -392,13 +510,13 @@ bool OSTreeObject::Fsck() const {
     return false;
   }
 
-  ok = ostree_repo_fsck_object(repo, type_, hash_.string().c_str(), nullptr, &err);
+  ok = ostree_repo_fsck_object(repo, type, hash.string().c_str(), nullptr, &err);
 
   g_object_unref(repo_path_file);
   g_object_unref(repo);
 
   if (ok == FALSE) {
-    LOG_WARNING << "Object " << *this << " is corrupt";
+    LOG_WARNING << "Object " << OSTreeRepo::GetPathForHash(hash, type).native() << " is corrupt";
     if (err != nullptr) {
       LOG_WARNING << "err:" << err->message;
       g_error_free(err);
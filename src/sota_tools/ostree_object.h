@@ -3,7 +3,11 @@
 
 #include <chrono>
 #include <iostream>
+#include <list>
+#include <memory>
 #include <sstream>
+#include <utility>
+#include <vector>
 
 #include <curl/curl.h>
 #include <boost/filesystem/path.hpp>
@@ -38,6 +42,7 @@ enum class ServerResponse {
 class OSTreeObject {
  public:
   using ptr = boost::intrusive_ptr<OSTreeObject>;
+  using Children = std::vector<std::pair<OSTreeHash, OstreeObjectType>>;
   OSTreeObject(const OSTreeRepo& repo, OSTreeHash hash, OstreeObjectType object_type);
   OSTreeObject(const OSTreeObject&) = delete;
   OSTreeObject(OSTreeObject&&) = delete;
@@ -54,12 +59,18 @@ class OSTreeObject {
    * present there. */
   void MakeTestRequest(const TreehubServer& push_target, CURLM* curl_multi_handle);
 
-  /* Upload this object to the destination server. */
-  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode);
+  /* Upload this object to the destination server, or its next chunk when it
+   * is larger than a non-zero chunk_size. Each chunk is sent with a
+   * Content-Range header, and accepted with a 202 until the last one. After
+   * an error, the upload goes on from the chunk that failed. */
+  void Upload(TreehubServer& push_target, CURLM* curl_multi_handle, RunMode mode, uintmax_t chunk_size = 0);
 
   /* Process a completed curl transaction (presence check or upload). */
   void CurlDone(CURLM* curl_multi_handle, RequestPool& pool);
 
+  /* Process the result of a presence check, made by this object or in a batch. */
+  void PresenceKnown(RequestPool& pool, bool present);
+
   uintmax_t GetSize() const;
 
   PresenceOnServer is_on_server() const { return is_on_server_; }
@@ -68,9 +79,21 @@ class OSTreeObject {
   void LaunchNotify() { is_on_server_ = PresenceOnServer::kObjectInProgress; }
   std::chrono::steady_clock::time_point RequestStartTime() const { return request_start_time_; }
   ServerResponse LastOperationResult() const { return last_operation_result_; }
+  /* Bytes accepted by the server in earlier chunks */
+  uintmax_t upload_offset() const { return upload_offset_; }
+
+  const OSTreeHash& hash() const { return hash_; }
+  OstreeObjectType type() const { return type_; }
 
   bool Fsck() const;
 
+  /* Check the integrity of an object of the repo at repo_root. Thread-safe. */
+  static bool FsckObject(const boost::filesystem::path& repo_root, const OSTreeHash& hash, OstreeObjectType type);
+
+  /* The children of a commit or dirtree object in the file at path, in the
+   * order they are uploaded in. Thread-safe. */
+  static Children ParseChildren(const boost::filesystem::path& path, OstreeObjectType type);
+
  private:
   using childiter = std::list<OSTreeObject::ptr>::iterator;
   using parentref = std::pair<OSTreeObject*, childiter>;
@@ -85,8 +108,10 @@ class OSTreeObject {
    * of children and add this object as the parent of the new child. */
   void AppendChild(const OSTreeObject::ptr& child);
 
-  /* Parse this object for children. */
-  void PopulateChildren();
+  /* Parse this object for children, or take them from the scanner of the
+   * pool. Children known to be on the server are left out, and those a
+   * remote repo can't fetch when walking the tree are reported missing. */
+  void PopulateChildren(RequestPool& pool);
 
   /* Add queries to the queue for any children whose presence on the server is
    * unknown. */
@@ -104,7 +129,11 @@ class OSTreeObject {
   /* Handle an error from an upload. */
   void UploadError(RequestPool& pool, int64_t rescode);
 
+  /* The server has this object after an upload. */
+  void UploadDone(RequestPool& pool);
+
   static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
+  static size_t curl_handle_read(char* buffer, size_t size, size_t nitems, void* userp);
 
   /** Full path on disk to this object */
   boost::filesystem::path PathOnDisk() const;
@@ -127,9 +156,29 @@ class OSTreeObject {
   PresenceOnServer is_on_server_;
   CurrentOp current_operation_{};
 
-  std::stringstream http_response_;
+  /* What a request needs while it is in flight, and only meanwhile */
+  struct Request {
+    Request() = default;
+    ~Request();
+    Request(const Request&) = delete;
+    Request(Request&&) = delete;
+    Request& operator=(const Request&) = delete;
+    Request& operator=(Request&&) = delete;
+
+    std::stringstream http_response;
+    FILE* fd{nullptr};
+    // Of the chunk being uploaded
+    uintmax_t chunk_size{0};
+    uintmax_t chunk_left{0};
+    struct curl_slist range_header {};
+    // Don't modify range_header_contents without updating the pointer in
+    // range_header
+    std::string range_header_contents;
+  };
+
   CURL* curl_handle_;
-  FILE* fd_;
+  std::unique_ptr<Request> request_;
+  uintmax_t upload_offset_{0};
   std::list<parentref> parents_;
   std::list<OSTreeObject::ptr> children_;
 
@@ -31,7 +31,7 @@ OSTreeRef::OSTreeRef(const OSTreeRepo &repo, const string &ref_name) : ref_name_
   }
 }
 
-OSTreeRef::OSTreeRef(const TreehubServer &serve_repo, string ref_name)
+OSTreeRef::OSTreeRef(TreehubServer &serve_repo, string ref_name)
     : is_valid(true), ref_name_(std::move(ref_name)) {
   CurlEasyWrapper curl_handle;
   serve_repo.InjectIntoCurl(Url(), curl_handle.get());
@@ -39,7 +39,11 @@ OSTreeRef::OSTreeRef(const TreehubServer &serve_repo, string ref_name)
   curlEasySetoptWrapper(curl_handle.get(), CURLOPT_WRITEDATA, this);
   curlEasySetoptWrapper(curl_handle.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
   curlEasySetoptWrapper(curl_handle.get(), CURLOPT_FAILONERROR, true);
-  CURLcode rc = curl_easy_perform(curl_handle.get());
+  CURLcode rc;
+  do {
+    http_response_.str("");
+    rc = curl_easy_perform(curl_handle.get());
+  } while (rc == CURLE_HTTP_RETURNED_ERROR && serve_repo.RetryWithNewToken(curl_handle.get()));
   if (rc != CURLE_OK) {
     is_valid = false;
   }
@@ -12,7 +12,7 @@
 class OSTreeRef {
  public:
   OSTreeRef(const OSTreeRepo& repo, const std::string& ref_name);
-  OSTreeRef(const TreehubServer& serve_repo, std::string ref_name);
+  OSTreeRef(TreehubServer& serve_repo, std::string ref_name);
 
   void PushRef(const TreehubServer& push_target, CURL* curl_handle) const;
 
@@ -30,6 +30,13 @@ class OSTreeRepo {
   virtual bool LooksValid() const = 0;
   virtual boost::filesystem::path root() const = 0;
   virtual OSTreeRef GetRef(const std::string& refname) const = 0;
+  /** Whether all the objects are on disk, with nothing fetched on demand. */
+  virtual bool IsLocal() const { return false; }
+  /**
+   * Start getting objects that are about to be requested with GetObject(), for
+   * the repos fetching them on demand.
+   */
+  virtual void Prefetch(const OSTreeObject::Children& objects) const { (void)objects; }
 
   OSTreeObject::ptr GetObject(OSTreeHash hash, OstreeObjectType type) const;
   // NOLINTNEXTLINE(modernize-avoid-c-arrays, cppcoreguidelines-avoid-c-arrays, hicpp-avoid-c-arrays)
@@ -37,6 +44,9 @@ class OSTreeRepo {
 
   static boost::filesystem::path GetPathForHash(OSTreeHash hash, OstreeObjectType type);
 
+  /** The number of objects read from the repo so far. */
+  size_t object_count() const { return ObjectTable.size(); }
+
  protected:
   /**
    * Look for an object with a given path, downloading it if necessary and
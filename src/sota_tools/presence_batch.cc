@@ -0,0 +1,79 @@
+#include "presence_batch.h"
+
+#include <cassert>
+#include <stdexcept>
+#include <utility>
+
+#include "logging/logging.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
+
+PresenceBatch::PresenceBatch(std::vector<OSTreeObject::ptr> objects) : objects_(std::move(objects)) {
+  for (const auto &object : objects_) {
+    request_body_ += OSTreeRepo::GetPathForHash(object->hash(), object->type()).string() + "\n";
+  }
+}
+
+PresenceBatch::~PresenceBatch() {
+  if (curl_handle_ != nullptr) {
+    curl_easy_cleanup(curl_handle_);
+    curl_handle_ = nullptr;
+  }
+}
+
+void PresenceBatch::Launch(TreehubServer &push_target, CURLM *curl_multi_handle) {
+  assert(!curl_handle_);
+  curl_handle_ = curl_easy_init();
+  if (curl_handle_ == nullptr) {
+    throw std::runtime_error("Could not initialize curl handle");
+  }
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_VERBOSE, get_curlopt_verbose());
+  // The same as for the uploads, which share the header.
+  push_target.SetContentType("Content-Type: application/octet-stream");
+  push_target.InjectIntoCurl("objects/presence", curl_handle_);
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEFUNCTION, &PresenceBatch::curl_handle_write);
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_WRITEDATA, this);
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDS, request_body_.c_str());
+  curlEasySetoptWrapper(curl_handle_, CURLOPT_POSTFIELDSIZE, static_cast<long>(request_body_.size()));  // NOLINT
+  http_response_.str("");
+
+  const CURLMcode err = curl_multi_add_handle(curl_multi_handle, curl_handle_);
+  if (err != 0) {
+    LOG_ERROR << "curl_multi_add_handle error:" << curl_multi_strerror(err);
+    return;
+  }
+  request_start_time_ = std::chrono::steady_clock::now();
+}
+
+void PresenceBatch::Done(CURLM *curl_multi_handle) {
+  curl_multi_remove_handle(curl_multi_handle, curl_handle_);
+  curl_easy_cleanup(curl_handle_);
+  curl_handle_ = nullptr;
+}
+
+long PresenceBatch::ResponseCode() const {  // NOLINT(google-runtime-int)
+  long rescode = 0;                         // NOLINT(google-runtime-int)
+  curl_easy_getinfo(curl_handle_, CURLINFO_RESPONSE_CODE, &rescode);
+  return rescode;
+}
+
+std::set<std::string> PresenceBatch::Present() const {
+  std::set<std::string> present;
+  std::istringstream response(http_response_.str());
+  std::string line;
+  while (std::getline(response, line)) {
+    if (!line.empty()) {
+      present.insert(line);
+    }
+  }
+  return present;
+}
+
+size_t PresenceBatch::curl_handle_write(void *buffer, size_t size, size_t nmemb, void *userp) {
+  auto *that = static_cast<PresenceBatch *>(userp);
+  that->http_response_.write(static_cast<const char *>(buffer), static_cast<std::streamsize>(size * nmemb));
+  return size * nmemb;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,55 @@
+#ifndef SOTA_CLIENT_TOOLS_PRESENCE_BATCH_H_
+#define SOTA_CLIENT_TOOLS_PRESENCE_BATCH_H_
+
+#include <chrono>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <curl/curl.h>
+
+#include "ostree_object.h"
+#include "treehub_server.h"
+
+/**
+ * A single request checking which of many objects are present on the server,
+ * in place of a HEAD request for each of them.
+ *
+ * The paths of the objects, such as "ab/cdef...dirtree", are POSTed to
+ * objects/presence one per line, and the server answers with those it has,
+ * one per line.
+ */
+class PresenceBatch {
+ public:
+  explicit PresenceBatch(std::vector<OSTreeObject::ptr> objects);
+  ~PresenceBatch();
+  PresenceBatch(const PresenceBatch&) = delete;
+  PresenceBatch(PresenceBatch&&) = delete;
+  PresenceBatch& operator=(const PresenceBatch&) = delete;
+  PresenceBatch& operator=(PresenceBatch&&) = delete;
+
+  void Launch(TreehubServer& push_target, CURLM* curl_multi_handle);
+  /* Release the curl handle of a completed request. */
+  void Done(CURLM* curl_multi_handle);
+
+  CURL* curl_handle() const { return curl_handle_; }
+  const std::vector<OSTreeObject::ptr>& objects() const { return objects_; }
+  std::chrono::steady_clock::time_point RequestStartTime() const { return request_start_time_; }
+  /* The HTTP response code, once the request is completed */
+  long ResponseCode() const;  // NOLINT(google-runtime-int)
+  /* The paths of the objects the server reported, as sent */
+  std::set<std::string> Present() const;
+
+ private:
+  static size_t curl_handle_write(void* buffer, size_t size, size_t nmemb, void* userp);
+
+  const std::vector<OSTreeObject::ptr> objects_;
+  std::string request_body_;
+  std::stringstream http_response_;
+  CURL* curl_handle_{nullptr};
+  std::chrono::steady_clock::time_point request_start_time_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_PRESENCE_BATCH_H_
@@ -0,0 +1,102 @@
+#include "presence_cache.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
+
+static int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+PresenceCache::PresenceCache(const boost::filesystem::path &dir, const std::string &repo_id,
+                             const std::chrono::seconds ttl, const Mode mode)
+    : path_(dir / Crypto::sha256digestHex(repo_id)), ttl_(ttl), mode_(mode) {
+  present_ = Load();
+  LOG_DEBUG << "Loaded " << present_.size() << " objects known to be on the server from " << path_;
+}
+
+std::string PresenceCache::RepoId(const std::string &root_url, const ServerCredentials &credentials) {
+  return root_url + "\n" + credentials.GetRepoUrl() + "\n" + credentials.GetClientId() + "\n" +
+         credentials.GetAuthUser() + "\n" + credentials.GetScope();
+}
+
+bool PresenceCache::IsPresent(const OSTreeHash &hash, const OstreeObjectType type) const {
+  if (mode_ != Mode::kUse || present_.count(OSTreeRepo::GetPathForHash(hash, type).string()) == 0) {
+    return false;
+  }
+  hits_++;
+  return true;
+}
+
+void PresenceCache::Present(const OSTreeHash &hash, const OstreeObjectType type) {
+  const std::string object = OSTreeRepo::GetPathForHash(hash, type).string();
+  present_[object] = seen_[object] = Now();
+  missing_.erase(object);
+}
+
+void PresenceCache::Missing(const OSTreeHash &hash, const OstreeObjectType type) {
+  const std::string object = OSTreeRepo::GetPathForHash(hash, type).string();
+  seen_.erase(object);
+  if (present_.erase(object) != 0) {
+    LOG_WARNING << "Object " << object << " was in the cache but is not on the server";
+  }
+  missing_.insert(object);
+}
+
+void PresenceCache::Save() const {
+  auto objects = Load();
+  for (const auto &object : missing_) {
+    objects.erase(object);
+  }
+  for (const auto &object : seen_) {
+    auto &seen = objects[object.first];
+    seen = std::max(seen, object.second);
+  }
+
+  std::stringstream content;
+  for (const auto &object : objects) {
+    content << object.second << " " << object.first << "\n";
+  }
+  // Replaced at once, for the pushes reading it at the same time
+  const boost::filesystem::path tmp_path = path_.string() + "." + boost::filesystem::unique_path().string();
+  try {
+    Utils::writeFile(tmp_path, content.str());
+    boost::filesystem::rename(tmp_path, path_);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not write the object cache " << path_ << ": " << e.what();
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp_path, ec);
+  }
+}
+
+std::map<std::string, int64_t> PresenceCache::Load() const {
+  std::map<std::string, int64_t> objects;
+  std::ifstream file(path_.string());
+  if (!file) {
+    return objects;
+  }
+  const int64_t oldest = ttl_.count() > 0 ? Now() - ttl_.count() : 0;
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream entry(line);
+    int64_t seen;
+    std::string object;
+    if (!(entry >> seen >> object)) {
+      LOG_DEBUG << "Ignoring line of the object cache " << path_ << ": " << line;
+      continue;
+    }
+    if (seen >= oldest) {
+      objects[object] = seen;
+    }
+  }
+  return objects;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,77 @@
+#ifndef SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
+#define SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+#include "server_credentials.h"
+
+/**
+ * The objects known to be on a Treehub server, kept on disk from one push to
+ * the next.
+ *
+ * There is one file per server and repo, in a directory shared by all of
+ * them, with a line per object: the time it was last seen on the server and
+ * its path. A dirtree on the server always has its whole tree there, since
+ * the children are uploaded first, so its subtree is skipped with it.
+ */
+class PresenceCache {
+ public:
+  enum class Mode {
+    /** Skip the objects in the cache */
+    kUse,
+    /** Query the objects in the cache again, and correct it */
+    kVerify,
+  };
+
+  /**
+   * @param dir where the cache files are
+   * @param repo_id identifies the Treehub repo, see RepoId()
+   * @param ttl how long an object is known to be on the server, 0 for ever
+   */
+  PresenceCache(const boost::filesystem::path& dir, const std::string& repo_id, std::chrono::seconds ttl, Mode mode);
+
+  /**
+   * The identity of the repo at root_url pushed to with credentials. Treehub
+   * picks the repo of an account from the credentials, not from the URL.
+   */
+  static std::string RepoId(const std::string& root_url, const ServerCredentials& credentials);
+
+  /** Whether the object can be skipped as being on the server */
+  bool IsPresent(const OSTreeHash& hash, OstreeObjectType type) const;
+  /** The server has the object. */
+  void Present(const OSTreeHash& hash, OstreeObjectType type);
+  /** The server doesn't have the object. */
+  void Missing(const OSTreeHash& hash, OstreeObjectType type);
+  /**
+   * Write the cache, along with the objects written by other pushes to the
+   * same repo meanwhile.
+   */
+  void Save() const;
+
+  int hits() const { return hits_; }
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  std::map<std::string, int64_t> Load() const;
+
+  const boost::filesystem::path path_;
+  const std::chrono::seconds ttl_;
+  const Mode mode_;
+  // Object path -> when it was last known to be on the server, in seconds since the epoch
+  std::map<std::string, int64_t> present_;
+  // Found out by this push, the rest being left to the other pushes
+  std::map<std::string, int64_t> seen_;
+  std::set<std::string> missing_;
+  mutable int hits_{0};
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_PRESENCE_CACHE_H_
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <boost/filesystem.hpp>
+
+#include "presence_cache.h"
+#include "utilities/utils.h"
+
+static const OSTreeHash kHash1 =
+    OSTreeHash::Parse("16ef2f2629dc9263fdf3c0f032563a2d757623bbc11cf99df25c3c3f258dccbe");
+static const OSTreeHash kHash2 =
+    OSTreeHash::Parse("2a28dac42b76c2015ee3c41cc4183bb8b5c790fd21fa5cfa0802c6e11fd0edbe");
+
+/* The objects found on the server are known in the next pushes to it, and only to it. */
+TEST(PresenceCache, SaveAndLoad) {
+  TemporaryDirectory dir;
+  {
+    PresenceCache cache(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+    EXPECT_FALSE(cache.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+    cache.Present(kHash1, OSTREE_OBJECT_TYPE_COMMIT);
+    cache.Save();
+  }
+
+  PresenceCache cache(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+  EXPECT_TRUE(cache.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+  EXPECT_FALSE(cache.IsPresent(kHash1, OSTREE_OBJECT_TYPE_DIR_TREE));
+  EXPECT_FALSE(cache.IsPresent(kHash2, OSTREE_OBJECT_TYPE_COMMIT));
+  EXPECT_EQ(cache.hits(), 1);
+
+  PresenceCache other_repo(dir.Path(), "other repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+  EXPECT_FALSE(other_repo.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+}
+
+/* Objects reported missing are dropped, and those of concurrent pushes kept. */
+TEST(PresenceCache, Merge) {
+  TemporaryDirectory dir;
+  {
+    PresenceCache cache(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+    cache.Present(kHash1, OSTREE_OBJECT_TYPE_COMMIT);
+    cache.Save();
+  }
+
+  PresenceCache first(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kVerify);
+  PresenceCache second(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+  // Queried again when verifying
+  EXPECT_FALSE(first.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+  first.Missing(kHash1, OSTREE_OBJECT_TYPE_COMMIT);
+  second.Present(kHash2, OSTREE_OBJECT_TYPE_FILE);
+  first.Save();
+  second.Save();
+
+  PresenceCache cache(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+  EXPECT_FALSE(cache.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+  EXPECT_TRUE(cache.IsPresent(kHash2, OSTREE_OBJECT_TYPE_FILE));
+}
+
+/* Objects last seen before the TTL are dropped. */
+TEST(PresenceCache, Ttl) {
+  TemporaryDirectory dir;
+  {
+    PresenceCache cache(dir.Path(), "repo", std::chrono::seconds(0), PresenceCache::Mode::kUse);
+    cache.Present(kHash1, OSTREE_OBJECT_TYPE_COMMIT);
+    cache.Save();
+  }
+  // Seen ten hours ago
+  const std::string content = Utils::readFile(boost::filesystem::directory_iterator(dir.Path())->path());
+  const auto seen = std::stoll(content) - 36000;
+  Utils::writeFile(boost::filesystem::directory_iterator(dir.Path())->path(),
+                   std::to_string(seen) + content.substr(content.find(' ')));
+
+  PresenceCache day(dir.Path(), "repo", std::chrono::hours(24), PresenceCache::Mode::kUse);
+  EXPECT_TRUE(day.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+  PresenceCache hour(dir.Path(), "repo", std::chrono::hours(1), PresenceCache::Mode::kUse);
+  EXPECT_FALSE(hour.IsPresent(kHash1, OSTREE_OBJECT_TYPE_COMMIT));
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -1,22 +1,57 @@
 #include "request_pool.h"
 
-#include <algorithm>  // min
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <algorithm>  // find_if, min
+#include <array>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
 #include <exception>
 #include <thread>
 
 #include "logging/logging.h"
+#include "ostree_repo.h"
+#include "utilities/utils.h"
+
+// Most objects checked in a single request, when the server supports it
+static constexpr size_t kPresenceBatchSize = 500;
+// Objects from this size on are uploaded early, see NextUpload()
+static constexpr uintmax_t kLargeObjectSize = 1024 * 1024;
 
-RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload)
-    : rate_controller_(max_curl_requests),
+RequestPool::RequestPool(TreehubServer& server, const int max_curl_requests, const RunMode mode, bool fsck_on_upload,
+                         ObjectScanner* scanner, PresenceCache* presence_cache, const int max_connections,
+                         const uintmax_t upload_chunk_size, const std::chrono::milliseconds latency_target)
+    : rate_controller_(max_curl_requests, latency_target),
       running_requests_(0),
       server_(server),
       mode_(mode),
       fsck_on_upload_(fsck_on_upload),
+      scanner_(scanner),
+      presence_cache_(presence_cache),
+      upload_chunk_size_(upload_chunk_size),
       stopped_(false) {
   curl_global_init(CURL_GLOBAL_DEFAULT);
   multi_ = curl_multi_init();
-  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_HTTP1 | CURLPIPE_MULTIPLEX);
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0) {
+    throw std::runtime_error(std::string("epoll_create1 failed with error: ") + std::strerror(errno));
+  }
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, SocketCallback);
+  curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, TimerCallback);
+  curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+  // The concurrent requests, tuned by rate_controller_, are streams sharing
+  // the connections where the server speaks HTTP/2. libcurl has dropped
+  // HTTP/1.1 pipelining.
+  curl_multi_setopt(multi_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+#if LIBCURL_VERSION_NUM >= 0x074300
+  curl_multi_setopt(multi_, CURLMOPT_MAX_CONCURRENT_STREAMS, static_cast<long>(max_curl_requests));  // NOLINT
+#endif
+  if (max_connections > 0) {
+    curl_multi_setopt(multi_, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(max_connections));  // NOLINT
+  }
 }
 
 RequestPool::~RequestPool() {
@@ -30,6 +65,7 @@ RequestPool::~RequestPool() {
     LOG_INFO << "...done";
 
     curl_multi_cleanup(multi_);
+    close(epoll_fd_);
     curl_global_cleanup();
   } catch (std::exception& ex) {
     LOG_ERROR << "Exception in RequestPool dtor: " << ex.what();
@@ -48,36 +84,89 @@ void RequestPool::AddQuery(const OSTreeObject::ptr& request) {
 void RequestPool::AddUpload(const OSTreeObject::ptr& request) {
   request->LaunchNotify();
   if (!stopped_) {
-    upload_queue_.push_back(request);
+    const uintmax_t size = request->GetSize();
+    if (size >= kLargeObjectSize) {
+      large_upload_queue_.emplace(size, request);
+    } else {
+      upload_queue_.push_back(request);
+    }
+    if (fsck_on_upload_ && scanner_ != nullptr) {
+      scanner_->Fsck(request->hash(), request->type());
+    }
+  }
+}
+
+bool RequestPool::KnownPresent(const OSTreeHash& hash, const OstreeObjectType type) const {
+  if (presence_cache_ == nullptr || mode_ == RunMode::kWalkTree || mode_ == RunMode::kPushTree) {
+    return false;
+  }
+  return presence_cache_->IsPresent(hash, type);
+}
+
+void RequestPool::AddMissing(const OSTreeHash& hash, const OstreeObjectType type) {
+  const std::string object = OSTreeRepo::GetPathForHash(hash, type).string();
+  LOG_WARNING << "Missing on the server: " << object;
+  missing_objects_.push_back(object);
+}
+
+OSTreeObject::ptr RequestPool::NextUpload() {
+  // The large objects start as early as possible, largest first, so that they
+  // don't make the end of the push wait for them. They alternate with the
+  // small ones to keep the requests flowing while they upload.
+  OSTreeObject::ptr next;
+  if (!large_upload_queue_.empty() && (upload_queue_.empty() || !last_upload_large_)) {
+    next = large_upload_queue_.begin()->second;
+    large_upload_queue_.erase(large_upload_queue_.begin());
+    last_upload_large_ = true;
+  } else {
+    next = upload_queue_.front();
+    upload_queue_.pop_front();
+    last_upload_large_ = false;
   }
+  return next;
 }
 
 void RequestPool::LoopLaunch() {
-  while (running_requests_ < rate_controller_.MaxConcurrency() && (!query_queue_.empty() || !upload_queue_.empty())) {
+  if (RateController::clock::now() < rate_controller_.ResumeTime()) {
+    return;
+  }
+  while (running_requests_ < rate_controller_.MaxConcurrency() && (!query_queue_.empty() || HasUploads())) {
     OSTreeObject::ptr cur;
 
-    // Queries first, uploads second
-    if (query_queue_.empty()) {
+    // Queries first, uploads second. While a first batch finds out whether the
+    // server supports them, the queries wait for it.
+    if (query_queue_.empty() || batch_support_ == BatchSupport::kProbing) {
+      if (!HasUploads()) {
+        break;
+      }
       // Uploads
-      cur = upload_queue_.front();
-      upload_queue_.pop_front();
+      cur = NextUpload();
       // Check object's integrity before uploading them, but after we know they
-      // are not present on the server
-      if (fsck_on_upload_) {
-        if (!cur->Fsck()) {
+      // are not present on the server. Once is enough for the chunks.
+      const bool resumed = cur->upload_offset() > 0;
+      if (fsck_on_upload_ && !resumed) {
+        bool ok = false;
+        if (scanner_ == nullptr || !scanner_->TakeFsck(cur->hash(), &ok)) {
+          ok = cur->Fsck();
+        }
+        if (!ok) {
           LOG_ERROR << "Local object " << cur << " is corrupt. Aborting upload.";
           Abort();
           continue;
         }
       }
-      cur->Upload(server_, multi_, mode_);
+      cur->Upload(server_, multi_, mode_, upload_chunk_size_);
       put_requests_made_++;
-      total_object_size_ += cur->GetSize();
+      if (!resumed) {
+        total_object_size_ += cur->GetSize();
+      }
       if (mode_ == RunMode::kDryRun || mode_ == RunMode::kWalkTree) {
         // Don't send an actual upload message, just skip to the part where we
         // acknowledge that the object has been uploaded.
         cur->NotifyParents(*this);
       }
+    } else if (batch_support_ != BatchSupport::kUnsupported && query_queue_.size() > 1) {
+      LaunchBatch();
     } else {
       // Queries
       cur = query_queue_.front();
@@ -90,63 +179,141 @@ void RequestPool::LoopLaunch() {
   }
 }
 
-void RequestPool::LoopListen() {
-  // For more information about the timeout logic, read these:
-  // https://curl.haxx.se/libcurl/c/curl_multi_timeout.html
-  // https://curl.haxx.se/libcurl/c/curl_multi_fdset.html
-  CURLMcode mc;
-  // Poll for IO
-  fd_set fdread;
-  fd_set fdwrite;
-  fd_set fdexcept;
-  int maxfd = 0;
-  FD_ZERO(&fdread);    // NOLINT(readability-isolate-declaration)
-  FD_ZERO(&fdwrite);   // NOLINT(readability-isolate-declaration)
-  FD_ZERO(&fdexcept);  // NOLINT(readability-isolate-declaration)
-  long timeoutms = 0;  // NOLINT(google-runtime-int)
-  mc = curl_multi_timeout(multi_, &timeoutms);
-  if (mc != CURLM_OK) {
-    throw std::runtime_error("curl_multi_timeout failed with error");
-  }
-  // If timeoutms is 0, "it means you should proceed immediately without waiting
-  // for anything".
-  if (timeoutms != 0) {
-    mc = curl_multi_fdset(multi_, &fdread, &fdwrite, &fdexcept, &maxfd);
-    if (mc != CURLM_OK) {
-      throw std::runtime_error("curl_multi_fdset failed with error");
+void RequestPool::LaunchBatch() {
+  std::vector<OSTreeObject::ptr> objects;
+  while (!query_queue_.empty() && objects.size() < kPresenceBatchSize) {
+    objects.push_back(query_queue_.front());
+    query_queue_.pop_front();
+  }
+  batched_queries_ += static_cast<int>(objects.size());
+  batches_.push_back(std_::make_unique<PresenceBatch>(std::move(objects)));
+  batches_.back()->Launch(server_, multi_);
+  batch_requests_made_++;
+  if (batch_support_ == BatchSupport::kUnknown) {
+    batch_support_ = BatchSupport::kProbing;
+  }
+}
+
+bool RequestPool::BatchDone(PresenceBatch& batch) {
+  const auto rescode = batch.ResponseCode();
+  if (rescode == 200) {
+    batch_support_ = BatchSupport::kSupported;
+    const auto present = batch.Present();
+    for (const auto& object : batch.objects()) {
+      object->PresenceKnown(*this,
+                            present.count(OSTreeRepo::GetPathForHash(object->hash(), object->type()).string()) != 0);
     }
+    return true;
+  }
 
-    struct timeval timeout {};
-    if (maxfd != -1) {
-      // "Wait for activities no longer than the set timeout."
-      if (timeoutms == -1) {
-        // "You must not wait too long (more than a few seconds perhaps)".
-        timeout.tv_sec = 3;
-        timeout.tv_usec = 0;
-      } else {
-        timeout.tv_sec = timeoutms / 1000;
-        timeout.tv_usec = 1000 * (timeoutms % 1000);
-      }
-      if (select(maxfd + 1, &fdread, &fdwrite, &fdexcept, &timeout) < 0) {
-        throw std::runtime_error(std::string("select failed with error: ") + std::strerror(errno));
-      }
-    } else if (timeoutms > 0) {
-      // If maxfd == -1, then wait the lesser of timeoutms and 100 ms.
-      long nofd_timeoutms = std::min(timeoutms, static_cast<long>(100));  // NOLINT(google-runtime-int)
-      LOG_DEBUG << "Waiting " << nofd_timeoutms << " ms for curl";
-      timeout.tv_sec = 0;
-      timeout.tv_usec = 1000 * (nofd_timeoutms % 1000);
-      if (select(0, nullptr, nullptr, nullptr, &timeout) < 0) {
-        throw std::runtime_error(std::string("select failed with error: ") + std::strerror(errno));
-      }
+  const bool unsupported = rescode == 400 || rescode == 404 || rescode == 405 || rescode == 501;
+  if (unsupported && batch_support_ != BatchSupport::kSupported) {
+    LOG_INFO << "The server does not check the presence of objects in batches, querying them one by one";
+    batch_support_ = BatchSupport::kUnsupported;
+  } else {
+    LOG_WARNING << "Batch presence check reported an error code: " << rescode << " retrying...";
+    if (batch_support_ == BatchSupport::kProbing) {
+      batch_support_ = BatchSupport::kUnknown;
+    }
+  }
+  for (const auto& object : batch.objects()) {
+    AddQuery(object);
+  }
+  return batch_support_ == BatchSupport::kUnsupported;
+}
+
+int RequestPool::SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp) {
+  (void)easy;
+  auto* pool = static_cast<RequestPool*>(userp);
+  if (what == CURL_POLL_REMOVE) {
+    // The socket may already be closed, which removed it from the set
+    epoll_ctl(pool->epoll_fd_, EPOLL_CTL_DEL, s, nullptr);
+    if (socketp != nullptr) {
+      pool->sockets_--;
     }
+    return 0;
   }
+  struct epoll_event event {};
+  event.events = ((what & CURL_POLL_IN) != 0 ? EPOLLIN : 0U) | ((what & CURL_POLL_OUT) != 0 ? EPOLLOUT : 0U);
+  event.data.fd = s;
+  // A socket that is new to curl has no pointer assigned yet
+  int rc = -1;
+  if (socketp == nullptr) {
+    curl_multi_assign(pool->multi_, s, pool);
+    pool->sockets_++;
+    rc = epoll_ctl(pool->epoll_fd_, EPOLL_CTL_ADD, s, &event);
+  }
+  if (rc != 0 && (socketp != nullptr || errno == EEXIST)) {
+    rc = epoll_ctl(pool->epoll_fd_, EPOLL_CTL_MOD, s, &event);
+  }
+  if (rc != 0) {
+    LOG_ERROR << "Can't watch the socket of a request: " << std::strerror(errno);
+    return -1;
+  }
+  return 0;
+}
 
-  // Ask curl to handle IO
-  mc = curl_multi_perform(multi_, &running_requests_);
-  if (mc != CURLM_OK) {
-    throw std::runtime_error("curl_multi failed with error");
+int RequestPool::TimerCallback(CURLM* multi, long timeout_ms, void* userp) {  // NOLINT(google-runtime-int)
+  (void)multi;
+  auto* pool = static_cast<RequestPool*>(userp);
+  pool->timer_set_ = timeout_ms >= 0;
+  pool->timer_expiry_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(timeout_ms, 0L));
+  return 0;
+}
+
+void RequestPool::WaitForEvents() {
+  // For more information about the event logic, read these:
+  // https://curl.se/libcurl/c/curl_multi_socket_action.html
+  // https://curl.se/libcurl/c/CURLMOPT_TIMERFUNCTION.html
+  int wait_ms = -1;
+  if (timer_set_) {
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(timer_expiry_ -
+                                                                            std::chrono::steady_clock::now());
+    wait_ms = static_cast<int>(std::max<int64_t>(left.count(), 0));
+  }
+  if (sockets_ == 0) {
+    // Without sockets, wait the lesser of the timer and 100 ms, and not at all
+    // without either
+    wait_ms = wait_ms < 0 ? 0 : std::min(wait_ms, 100);
+  } else if (wait_ms < 0 || wait_ms > 3000) {
+    // "You must not wait too long (more than a few seconds perhaps)".
+    wait_ms = 3000;
+  }
+
+  std::array<struct epoll_event, 64> events{};
+  int ready = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), wait_ms);
+  if (ready < 0) {
+    if (errno != EINTR) {
+      throw std::runtime_error(std::string("epoll_wait failed with error: ") + std::strerror(errno));
+    }
+    ready = 0;
   }
+  for (int i = 0; i < ready; ++i) {
+    const auto& event = events.at(static_cast<size_t>(i));
+    const int mask = ((event.events & EPOLLIN) != 0 ? CURL_CSELECT_IN : 0) |
+                     ((event.events & EPOLLOUT) != 0 ? CURL_CSELECT_OUT : 0) |
+                     ((event.events & (EPOLLERR | EPOLLHUP)) != 0 ? CURL_CSELECT_ERR : 0);
+    if (curl_multi_socket_action(multi_, event.data.fd, mask, &running_requests_) != CURLM_OK) {
+      throw std::runtime_error("curl_multi_socket_action failed with error");
+    }
+  }
+  // The requests whose time has come, and the actual count of the requests
+  // when nothing happened, such as when none were added
+  const bool expired = timer_set_ && std::chrono::steady_clock::now() >= timer_expiry_;
+  if (ready == 0 || expired) {
+    // The timer fires once
+    if (expired) {
+      timer_set_ = false;
+    }
+    if (curl_multi_socket_action(multi_, CURL_SOCKET_TIMEOUT, 0, &running_requests_) != CURLM_OK) {
+      throw std::runtime_error("curl_multi_socket_action failed with error");
+    }
+  }
+}
+
+void RequestPool::LoopListen() {
+  // Ask curl to handle IO
+  WaitForEvents();
   assert(running_requests_ >= 0);
 
   // Deal with any completed requests
@@ -154,12 +321,51 @@ void RequestPool::LoopListen() {
   do {
     CURLMsg* msg = curl_multi_info_read(multi_, &msgs_in_queue);
     if ((msg != nullptr) && msg->msg == CURLMSG_DONE) {
-      OSTreeObject::ptr completed_object = ostree_object_from_curl(msg->easy_handle);
-      completed_object->CurlDone(multi_, *this);
-      auto start_time = completed_object->RequestStartTime();
+      long connects = 0;  // NOLINT(google-runtime-int)
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_NUM_CONNECTS, &connects);
+      connections_made_ += static_cast<int>(connects);
+      long rescode = 0;  // NOLINT(google-runtime-int)
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_RESPONSE_CODE, &rescode);
+      RateController::clock::duration retry_after{0};
+#if LIBCURL_VERSION_NUM >= 0x074200
+      curl_off_t retry_after_s = 0;
+      if (curl_easy_getinfo(msg->easy_handle, CURLINFO_RETRY_AFTER, &retry_after_s) == CURLE_OK && retry_after_s > 0) {
+        retry_after = std::chrono::seconds(retry_after_s);
+      }
+#endif
+      // Rejected for its token, the request is retried with a new one like
+      // after any other error.
+      const bool new_token = server_.RetryWithNewToken(rescode);
+      RateController::clock::time_point start_time;
+      bool server_responded_ok;
+      auto batch = std::find_if(batches_.begin(), batches_.end(), [msg](const std::unique_ptr<PresenceBatch>& b) {
+        return b->curl_handle() == msg->easy_handle;
+      });
+      if (batch != batches_.end()) {
+        std::unique_ptr<PresenceBatch> completed_batch = std::move(*batch);
+        batches_.erase(batch);
+        server_responded_ok = BatchDone(*completed_batch);
+        completed_batch->Done(multi_);
+        start_time = completed_batch->RequestStartTime();
+      } else {
+        OSTreeObject::ptr completed_object = ostree_object_from_curl(msg->easy_handle);
+        completed_object->CurlDone(multi_, *this);
+        start_time = completed_object->RequestStartTime();
+        server_responded_ok = completed_object->LastOperationResult() == ServerResponse::kOk;
+      }
       auto end_time = RateController::clock::now();
-      bool server_responded_ok = completed_object->LastOperationResult() == ServerResponse::kOk;
-      rate_controller_.RequestCompleted(start_time, end_time, server_responded_ok);
+      RateController::Outcome outcome = RateController::Outcome::kSuccess;
+      if (!server_responded_ok && !new_token) {
+        // The server is alive and wants fewer requests.
+        const bool overload = rescode == 429 || rescode == 503;
+        outcome = overload ? RateController::Outcome::kOverload : RateController::Outcome::kFailure;
+        if (overload && retry_after > RateController::clock::duration(0)) {
+          LOG_DEBUG << "The server asked to wait "
+                    << std::chrono::duration_cast<std::chrono::seconds>(retry_after).count()
+                    << " seconds before the next request";
+        }
+      }
+      rate_controller_.RequestCompleted(start_time, end_time, outcome, retry_after);
 
       if (rate_controller_.ServerHasFailed()) {
         Abort();
@@ -176,6 +382,11 @@ void RequestPool::LoopListen() {
 }
 
 void RequestPool::Loop() {
+  // Nothing to listen to while the server wants no requests
+  const auto now = RateController::clock::now();
+  if (running_requests_ == 0 && now < rate_controller_.ResumeTime()) {
+    std::this_thread::sleep_for(rate_controller_.ResumeTime() - now);
+  }
   LoopLaunch();
   LoopListen();
 }
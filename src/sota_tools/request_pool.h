@@ -1,17 +1,40 @@
 #ifndef SOTA_CLIENT_TOOLS_REQUEST_POOL_H_
 #define SOTA_CLIENT_TOOLS_REQUEST_POOL_H_
 
+#include <chrono>
+#include <functional>
 #include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <curl/curl.h>
 
 #include "garage_common.h"
+#include "object_scanner.h"
 #include "ostree_object.h"
-#include "rate_controller.h"
+#include "presence_batch.h"
+#include "presence_cache.h"
+#include "utilities/rate_controller.h"
 
 class RequestPool {
  public:
-  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload);
+  /**
+   * @param scanner optional, does the parsing and integrity checks of the
+   *                objects in advance
+   * @param presence_cache optional, the objects known to be on the server
+   * @param max_connections most connections to the server, 0 for no limit.
+   *                        The requests are multiplexed on them with HTTP/2,
+   *                        and only wait for one another with HTTP/1.1.
+   * @param upload_chunk_size objects larger than this are uploaded in chunks
+   *                          of this size, 0 for none
+   * @param latency_target p95 latency of the requests kept under by the rate
+   *                       controller, 0 for none
+   */
+  RequestPool(TreehubServer& server, int max_curl_requests, RunMode mode, bool fsck_on_upload,
+              ObjectScanner* scanner = nullptr, PresenceCache* presence_cache = nullptr, int max_connections = 0,
+              uintmax_t upload_chunk_size = 0, std::chrono::milliseconds latency_target = std::chrono::milliseconds(0));
   ~RequestPool();
   // Non-Copyable, Non-Movable
   RequestPool(const RequestPool&) = delete;
@@ -25,10 +48,22 @@ class RequestPool {
     stopped_ = true;
     query_queue_.clear();
     upload_queue_.clear();
+    large_upload_queue_.clear();
   };
-  bool is_idle() const { return query_queue_.empty() && upload_queue_.empty() && running_requests_ == 0; }
+  bool is_idle() const {
+    return query_queue_.empty() && upload_queue_.empty() && large_upload_queue_.empty() && running_requests_ == 0;
+  }
   bool is_stopped() const { return stopped_; }
   RunMode run_mode() const { return mode_; }
+  ObjectScanner* scanner() const { return scanner_; }
+  PresenceCache* presence_cache() const { return presence_cache_; }
+  /**
+   * Whether the cache has the object on the server, so that it is skipped
+   * with its whole tree. Never when walking the tree.
+   */
+  bool KnownPresent(const OSTreeHash& hash, OstreeObjectType type) const;
+  /** Record an object found missing on the server when walking the tree. */
+  void AddMissing(const OSTreeHash& hash, OstreeObjectType type);
 
   /**
    * One iteration of request-listen loop, launches multiple requests, then
@@ -41,23 +76,64 @@ class RequestPool {
    */
   int put_requests_made() const { return put_requests_made_; }
   int head_requests_made() const { return head_requests_made_; }
+  /** The presence checks made in batches, and the objects checked in them */
+  int batch_requests_made() const { return batch_requests_made_; }
+  int batched_queries() const { return batched_queries_; }
   uintmax_t total_object_size() const { return total_object_size_; }
+  /** The connections opened for the requests */
+  int connections_made() const { return connections_made_; }
+  /** The paths of the objects found missing on the server when walking the tree */
+  const std::vector<std::string>& missing_objects() const { return missing_objects_; }
 
  private:
   void LoopLaunch();  // launches multiple requests from the queues
   void LoopListen();  // listens to the result of launched requests
+  // Wait for the sockets of the requests or their timer, and hand what
+  // happened to curl
+  void WaitForEvents();
+  // The curl callbacks that keep epoll_fd_ and the timer in step with the
+  // requests
+  static int SocketCallback(CURL* easy, curl_socket_t s, int what, void* userp, void* socketp);
+  static int TimerCallback(CURLM* multi, long timeout_ms, void* userp);  // NOLINT(google-runtime-int)
+  void LaunchBatch();
+  bool HasUploads() const { return !upload_queue_.empty() || !large_upload_queue_.empty(); }
+  OSTreeObject::ptr NextUpload();
+  // Returns whether the server handled the request
+  bool BatchDone(PresenceBatch& batch);
+
+  // Whether the server can check the presence of objects in batches, first
+  // found out with a single batch
+  enum class BatchSupport { kUnknown, kProbing, kSupported, kUnsupported };
 
   RateController rate_controller_;
   int running_requests_;
   int head_requests_made_{0};
   int put_requests_made_{0};
+  int batch_requests_made_{0};
+  int batched_queries_{0};
   uintmax_t total_object_size_{0};
+  int connections_made_{0};
+  std::vector<std::string> missing_objects_;
   TreehubServer& server_;
   CURLM* multi_;
+  // The sockets of the requests, watched with epoll so that a wakeup costs
+  // the sockets that are ready, not all of them, and their number has no limit
+  int epoll_fd_{-1};
+  int sockets_{0};
+  bool timer_set_{false};
+  std::chrono::steady_clock::time_point timer_expiry_;
   std::list<OSTreeObject::ptr> query_queue_;
   std::list<OSTreeObject::ptr> upload_queue_;
+  // Largest first, see NextUpload()
+  std::multimap<uintmax_t, OSTreeObject::ptr, std::greater<uintmax_t>> large_upload_queue_;
+  bool last_upload_large_{false};
+  std::list<std::unique_ptr<PresenceBatch>> batches_;
+  BatchSupport batch_support_{BatchSupport::kUnknown};
   RunMode mode_;
   bool fsck_on_upload_;
+  ObjectScanner* scanner_;
+  PresenceCache* presence_cache_;
+  uintmax_t upload_chunk_size_;
   bool stopped_;
 };
 // vim: set tabstop=2 shiftwidth=2 expandtab:
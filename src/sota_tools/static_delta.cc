@@ -0,0 +1,145 @@
+#include "static_delta.h"
+
+#include <glib.h>
+#include <ostree.h>
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "logging/logging.h"
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+// The name libostree gives the superblock when it writes the delta outside of
+// the repo; the parts are named by their index next to it.
+const char *const kSuperblock = "superblock";
+
+// Base64 without the padding, and with '_' for '/', as in
+// ostree_checksum_to_bytes_v()'s "modified base64".
+std::string ModifiedBase64(const OSTreeHash &hash) {
+  std::string b64 = Utils::toBase64(Utils::fromHex(hash.string()));
+  while (!b64.empty() && b64.back() == '=') {
+    b64.pop_back();
+  }
+  std::replace(b64.begin(), b64.end(), '/', '_');
+  return b64;
+}
+
+size_t DiscardResponse(void * /*buffer*/, size_t size, size_t nmemb, void * /*userp*/) { return size * nmemb; }
+
+}  // namespace
+
+std::string StaticDelta::RelativePath(const OSTreeHash &from, const OSTreeHash &to) {
+  const std::string from_b64 = ModifiedBase64(from);
+  return "deltas/" + from_b64.substr(0, 2) + "/" + from_b64.substr(2) + "-" + ModifiedBase64(to);
+}
+
+bool StaticDelta::Generate(const fs::path &repo_root) {
+  GFile *repo_path_file = g_file_new_for_path(repo_root.c_str());  // Never fails
+  OstreeRepo *repo = ostree_repo_new(repo_path_file);
+  GError *err = nullptr;
+  auto ok = ostree_repo_open(repo, nullptr, &err);
+
+  if (ok == FALSE) {
+    LOG_ERROR << "ostree_repo_open failed";
+    if (err != nullptr) {
+      LOG_ERROR << "err:" << err->message;
+      g_error_free(err);
+    }
+    g_object_unref(repo_path_file);
+    g_object_unref(repo);
+    return false;
+  }
+
+  LOG_INFO << "Generating static delta from " << from_ << " to " << to_;
+  const std::string superblock = (dir_ / kSuperblock).string();
+  GVariantBuilder params_builder;
+  g_variant_builder_init(&params_builder, G_VARIANT_TYPE("a{sv}"));
+  g_variant_builder_add(&params_builder, "{sv}", "filename", g_variant_new_bytestring(superblock.c_str()));
+  GVariant *params = g_variant_ref_sink(g_variant_builder_end(&params_builder));
+
+  ok = ostree_repo_static_delta_generate(repo, OSTREE_STATIC_DELTA_GENERATE_OPT_MAJOR, from_.string().c_str(),
+                                         to_.string().c_str(), nullptr, params, nullptr, &err);
+
+  g_variant_unref(params);
+  g_object_unref(repo_path_file);
+  g_object_unref(repo);
+
+  if (ok == FALSE) {
+    LOG_ERROR << "Could not generate static delta from " << from_ << " to " << to_;
+    if (err != nullptr) {
+      LOG_ERROR << "err:" << err->message;
+      g_error_free(err);
+    }
+    return false;
+  }
+  generated_ = true;
+  return true;
+}
+
+bool StaticDelta::Upload(TreehubServer &push_server, const RunMode mode) const {
+  if (!generated_) {
+    LOG_ERROR << "Static delta from " << from_ << " to " << to_ << " was not generated";
+    return false;
+  }
+  std::vector<fs::path> parts;
+  for (const auto &entry : fs::directory_iterator(dir_.Path())) {
+    if (entry.path().filename() != kSuperblock) {
+      parts.push_back(entry.path());
+    }
+  }
+  std::sort(parts.begin(), parts.end());
+  for (const auto &part : parts) {
+    if (!UploadFile(push_server, part, mode)) {
+      return false;
+    }
+  }
+  return UploadFile(push_server, dir_ / kSuperblock, mode);
+}
+
+bool StaticDelta::UploadFile(TreehubServer &push_server, const fs::path &file, const RunMode mode) const {
+  const std::string url = RelativePath(from_, to_) + "/" + file.filename().string();
+  if (mode != RunMode::kDefault && mode != RunMode::kPushTree) {
+    LOG_INFO << "Would upload " << url;
+    return true;
+  }
+  LOG_INFO << "Uploading " << url;
+  std::unique_ptr<FILE, int (*)(FILE *)> fd(fopen(file.c_str(), "rb"), fclose);
+  if (fd == nullptr) {
+    LOG_ERROR << "Could not open " << file;
+    return false;
+  }
+
+  CurlEasyWrapper easy_handle;
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_VERBOSE, get_curlopt_verbose());
+  push_server.SetContentType("Content-Type: application/octet-stream");
+  push_server.InjectIntoCurl(url, easy_handle.get());
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_USERAGENT, Utils::getUserAgent());
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_WRITEFUNCTION, &DiscardResponse);
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_READDATA, fd.get());
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(fs::file_size(file)));
+  curlEasySetoptWrapper(easy_handle.get(), CURLOPT_POST, 1);
+  CURLcode err;
+  do {
+    rewind(fd.get());
+    err = curl_easy_perform(easy_handle.get());
+  } while (err == CURLE_OK && push_server.RetryWithNewToken(easy_handle.get()));
+  if (err != CURLE_OK) {
+    LOG_ERROR << "Error uploading " << url << ": " << curl_easy_strerror(err);
+    return false;
+  }
+  long rescode;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(easy_handle.get(), CURLINFO_RESPONSE_CODE, &rescode);
+  if (rescode < 200 || rescode >= 400) {
+    LOG_ERROR << "Error uploading " << url << ", got " << rescode << " HTTP response";
+    return false;
+  }
+  return true;
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
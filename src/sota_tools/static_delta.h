@@ -0,0 +1,56 @@
+#ifndef SOTA_CLIENT_TOOLS_STATIC_DELTA_H_
+#define SOTA_CLIENT_TOOLS_STATIC_DELTA_H_
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "garage_common.h"
+#include "ostree_hash.h"
+#include "treehub_server.h"
+#include "utilities/utils.h"
+
+/**
+ * An OSTree static delta from one commit to another, generated from a local
+ * repo and uploaded to Treehub next to the objects.
+ *
+ * A device that has the base commit can then pull the new one as the few
+ * parts of the delta, instead of one request per object it is missing.
+ * libostree writes the delta to a temporary directory, which is removed with
+ * the StaticDelta.
+ */
+class StaticDelta {
+ public:
+  StaticDelta(const OSTreeHash& from, const OSTreeHash& to) : from_(from), to_(to) {}
+
+  /**
+   * Where the delta is in a repo, relative to its root, as libostree looks
+   * for it: deltas/ and the modified base64 of the two commits.
+   */
+  static std::string RelativePath(const OSTreeHash& from, const OSTreeHash& to);
+
+  /**
+   * Generate the delta from the commits in the repo, which must have the
+   * whole tree of both.
+   * @return false if libostree could not generate it
+   */
+  bool Generate(const boost::filesystem::path& repo_root);
+
+  /**
+   * Upload the parts of the delta, then its superblock, so that a device
+   * never finds a superblock without its parts.
+   * @return false if any of them could not be uploaded
+   */
+  bool Upload(TreehubServer& push_server, RunMode mode) const;
+
+ private:
+  bool UploadFile(TreehubServer& push_server, const boost::filesystem::path& file, RunMode mode) const;
+
+  const OSTreeHash from_;
+  const OSTreeHash to_;
+  TemporaryDirectory dir_{"static-delta"};
+  bool generated_{false};
+};
+
+#endif  // SOTA_CLIENT_TOOLS_STATIC_DELTA_H_
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,23 @@
+#include <gtest/gtest.h>
+
+#include "ostree_hash.h"
+#include "static_delta.h"
+
+/* The delta is where libostree looks for it: deltas/, then the first two
+ * characters of the modified base64 of the base commit, and the rest of both,
+ * with '_' for '/' and no padding. */
+TEST(StaticDelta, RelativePath) {
+  const auto from = OSTreeHash::Parse("16ef2f2629dc9263fdf3c0f032563a2d757623bbc11cf99df25c3c3f258dccbe");
+  const auto to = OSTreeHash::Parse("b9ac1e45f9227df8ee191b6e51e09417bd36c6ebbeff999431e3073ac50f0563");
+  EXPECT_EQ(StaticDelta::RelativePath(from, to),
+            "deltas/Fu/8vJinckmP988DwMlY6LXV2I7vBHPmd8lw8PyWNzL4-uaweRfkiffjuGRtuUeCUF702xuu+_5mUMeMHOsUPBWM");
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
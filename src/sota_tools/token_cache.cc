@@ -0,0 +1,95 @@
+#include "token_cache.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+
+#include "crypto/crypto.h"
+#include "logging/logging.h"
+#include "utilities/utils.h"
+
+constexpr std::chrono::seconds TokenCache::kExpiryMargin;
+
+static int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+TokenCache::TokenCache(const boost::filesystem::path &dir, const std::string &credentials_id)
+    : path_(dir / Crypto::sha256digestHex(credentials_id)) {}
+
+std::string TokenCache::CredentialsId(const ServerCredentials &credentials) {
+  // The secret is part of it so that new credentials of the same client don't
+  // get the tokens of the old ones.
+  return credentials.GetAuthServer() + "\n" + credentials.GetClientId() + "\n" + credentials.GetClientSecret() + "\n" +
+         credentials.GetScope();
+}
+
+std::string TokenCache::Get() const {
+  struct stat st {};
+  if (stat(path_.c_str(), &st) != 0) {
+    return "";
+  }
+  if (st.st_uid != getuid() || (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+    LOG_WARNING << "Ignoring the token cache " << path_ << ", which is not private to the user";
+    return "";
+  }
+
+  Json::Value entry;
+  try {
+    entry = Utils::parseJSONFile(path_);
+  } catch (const std::exception &e) {
+    LOG_DEBUG << "Could not read the token cache " << path_ << ": " << e.what();
+    return "";
+  }
+  if (!entry.isObject() || !entry["access_token"].isString() || !entry["expires_at"].isInt64()) {
+    LOG_DEBUG << "Ignoring the malformed token cache " << path_;
+    return "";
+  }
+  const int64_t remaining = entry["expires_at"].asInt64() - Now();
+  if (remaining < kExpiryMargin.count()) {
+    LOG_DEBUG << "The cached token has expired or is about to";
+    return "";
+  }
+  LOG_DEBUG << "Using the cached token, valid for " << remaining << " more seconds";
+  return entry["access_token"].asString();
+}
+
+void TokenCache::Put(const std::string &token, const std::chrono::seconds expires_in) const {
+  Json::Value entry;
+  entry["access_token"] = token;
+  entry["expires_at"] = static_cast<Json::Int64>(Now() + expires_in.count());
+  const std::string content = Utils::jsonToStr(entry);
+
+  // Replaced at once, for the runs reading it at the same time
+  const boost::filesystem::path tmp_path = path_.string() + "." + boost::filesystem::unique_path().string();
+  try {
+    boost::filesystem::create_directories(path_.parent_path());
+    const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      throw std::runtime_error(std::strerror(errno));
+    }
+    const ssize_t written = write(fd, content.c_str(), content.size());
+    close(fd);
+    if (written < 0 || static_cast<size_t>(written) != content.size()) {
+      throw std::runtime_error("short write");
+    }
+    boost::filesystem::rename(tmp_path, path_);
+  } catch (const std::exception &e) {
+    LOG_WARNING << "Could not write the token cache " << path_ << ": " << e.what();
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp_path, ec);
+  }
+}
+
+void TokenCache::Remove() const {
+  boost::system::error_code ec;
+  boost::filesystem::remove(path_, ec);
+}
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
@@ -0,0 +1,48 @@
+#ifndef SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
+#define SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "server_credentials.h"
+
+/**
+ * OAuth2 access tokens kept on disk from one run of the tools to the next, so
+ * that each run doesn't have to get one from the auth server.
+ *
+ * There is one file per set of credentials, in a directory shared by all of
+ * them, with the token and the time it expires. The files are only readable
+ * by their owner; those that are not are ignored.
+ */
+class TokenCache {
+ public:
+  /** A cached token is only used if it is still valid for this long. */
+  static constexpr std::chrono::seconds kExpiryMargin{60};
+
+  /**
+   * @param dir where the cache files are
+   * @param credentials_id identifies the credentials, see CredentialsId()
+   */
+  TokenCache(const boost::filesystem::path& dir, const std::string& credentials_id);
+
+  /** The identity of the OAuth2 credentials the tokens are got with */
+  static std::string CredentialsId(const ServerCredentials& credentials);
+
+  /** The cached token, or an empty one if there is none that is still valid for kExpiryMargin. */
+  std::string Get() const;
+  /** Cache the token, which expires in expires_in. */
+  void Put(const std::string& token, std::chrono::seconds expires_in) const;
+  /** Drop the cached token, e.g. when the server rejects it. */
+  void Remove() const;
+
+  const boost::filesystem::path& path() const { return path_; }
+
+ private:
+  const boost::filesystem::path path_;
+};
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
+#endif  // SOTA_CLIENT_TOOLS_TOKEN_CACHE_H_
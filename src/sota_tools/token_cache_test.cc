@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#include "token_cache.h"
+#include "utilities/utils.h"
+
+/* A token is reused with the same credentials, and only with them. */
+TEST(TokenCache, PutAndGet) {
+  TemporaryDirectory dir;
+  {
+    TokenCache cache(dir.Path(), "credentials");
+    EXPECT_EQ(cache.Get(), "");
+    cache.Put("token", std::chrono::seconds(3600));
+    EXPECT_EQ(cache.Get(), "token");
+  }
+
+  TokenCache cache(dir.Path(), "credentials");
+  EXPECT_EQ(cache.Get(), "token");
+  struct stat st {};
+  ASSERT_EQ(stat(cache.path().c_str(), &st), 0);
+  EXPECT_EQ(st.st_mode & 0777, S_IRUSR | S_IWUSR);
+
+  TokenCache other_credentials(dir.Path(), "other credentials");
+  EXPECT_EQ(other_credentials.Get(), "");
+
+  cache.Remove();
+  EXPECT_EQ(cache.Get(), "");
+}
+
+/* A token that expires within the margin is not used. */
+TEST(TokenCache, Expiry) {
+  TemporaryDirectory dir;
+  TokenCache cache(dir.Path(), "credentials");
+  cache.Put("token", TokenCache::kExpiryMargin - std::chrono::seconds(1));
+  EXPECT_EQ(cache.Get(), "");
+  cache.Put("token", TokenCache::kExpiryMargin + std::chrono::seconds(10));
+  EXPECT_EQ(cache.Get(), "token");
+}
+
+/* Files that others can read, and malformed ones, are ignored. */
+TEST(TokenCache, Ignored) {
+  TemporaryDirectory dir;
+  TokenCache cache(dir.Path(), "credentials");
+  cache.Put("token", std::chrono::seconds(3600));
+  ASSERT_EQ(chmod(cache.path().c_str(), S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH), 0);
+  EXPECT_EQ(cache.Get(), "");
+
+  Utils::writeFile(cache.path(), std::string("not json"));
+  ASSERT_EQ(chmod(cache.path().c_str(), S_IRUSR | S_IWUSR), 0);
+  EXPECT_EQ(cache.Get(), "");
+
+  Utils::writeFile(cache.path(), std::string(R"({"access_token": "token"})"));
+  EXPECT_EQ(cache.Get(), "");
+}
+
+#ifndef __NO_MAIN__
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+#endif
+
+// vim: set tabstop=2 shiftwidth=2 expandtab:
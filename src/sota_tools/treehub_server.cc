@@ -5,6 +5,8 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include "logging/logging.h"
+
 using std::string;
 
 TreehubServer::TreehubServer() {
@@ -47,6 +49,33 @@ void TreehubServer::SetAuthBasic(const std::string& username, const std::string&
   password_ = password;
 }
 
+void TreehubServer::SetTokenRefresher(std::function<std::string()> refresher) {
+  token_refresher_ = std::move(refresher);
+}
+
+bool TreehubServer::RetryWithNewToken(CURL* curl_handle) {
+  long rescode = 0;  // NOLINT(google-runtime-int)
+  curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &rescode);
+  return RetryWithNewToken(rescode);
+}
+
+bool TreehubServer::RetryWithNewToken(const long rescode) {  // NOLINT(google-runtime-int)
+  if (rescode != 401 || method_ != AuthMethod::kOauth2 || !token_refresher_) {
+    return false;
+  }
+  // Dropped first: a new token that is rejected too is not refreshed again.
+  auto refresher = std::move(token_refresher_);
+  token_refresher_ = nullptr;
+  LOG_INFO << "The server rejected the OAuth2 token, getting a new one";
+  const std::string token = refresher();
+  if (token.empty()) {
+    LOG_ERROR << "Could not get a new OAuth2 token";
+    return false;
+  }
+  SetToken(token);
+  return true;
+}
+
 // Note that this method creates a reference from curl_handle to this.  Keep
 // this TreehubServer object alive until the curl request has been completed
 void TreehubServer::InjectIntoCurl(const string& url_suffix, CURL* curl_handle, const bool tufrepo) const {
@@ -64,6 +93,11 @@ void TreehubServer::InjectIntoCurl(const string& url_suffix, CURL* curl_handle,
   curlEasySetoptWrapper(curl_handle, CURLOPT_URL, (url + url_suffix).c_str());
 
   curlEasySetoptWrapper(curl_handle, CURLOPT_HTTPHEADER, &auth_header_);
+  // HTTP/2 where the server supports it, waiting for a connection to multiplex
+  // the request on rather than opening another one. Without HTTP/2 in libcurl,
+  // the requests are made with HTTP/1.1.
+  curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+  curlEasySetoptWrapper(curl_handle, CURLOPT_PIPEWAIT, 1L);
   // If we need authentication but don't have an OAuth2 token or TLS
   // credentials, fall back to legacy username/password.
   if (method_ == AuthMethod::kBasic) {
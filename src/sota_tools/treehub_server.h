@@ -1,6 +1,7 @@
 #ifndef SOTA_CLIENT_TOOLS_TREEHUB_SERVER_H_
 #define SOTA_CLIENT_TOOLS_TREEHUB_SERVER_H_
 
+#include <functional>
 #include <string>
 
 #include <curl/curl.h>
@@ -15,8 +16,25 @@ class TreehubServer {
   void SetContentType(const std::string &content_type);
   void SetCerts(const std::string &client_p12);
   void SetAuthBasic(const std::string &username, const std::string &password);
+  /**
+   * Set how to get a new OAuth2 token when the server rejects the one set with
+   * SetToken(), e.g. because it was cached and has been revoked. refresher
+   * gives the new token, or an empty one if it couldn't get any.
+   */
+  void SetTokenRefresher(std::function<std::string()> refresher);
+  /**
+   * Whether the request just made with curl_handle was rejected with a 401
+   * and a new token has been set, so that it should be sent again. The token
+   * is refreshed once per run at most; since the headers of all the requests
+   * change with it, it must be called from the thread that makes them.
+   */
+  bool RetryWithNewToken(CURL *curl_handle);
+  /** RetryWithNewToken() for a request that got the HTTP status rescode */
+  bool RetryWithNewToken(long rescode);  // NOLINT(google-runtime-int)
 
   void InjectIntoCurl(const std::string &url_suffix, CURL *curl_handle, bool tufrepo = false) const;
+  /** The headers set by InjectIntoCurl, for a request to add its own in front */
+  struct curl_slist *headers() { return &auth_header_; }
 
   void ca_certs(const std::string &cacerts) { ca_certs_ = cacerts; }
   void root_url(const std::string &_root_url);
@@ -32,6 +50,7 @@ class TreehubServer {
   std::string root_cert_;
   TemporaryFile client_p12_path_;
   AuthMethod method_{AuthMethod::kNone};
+  std::function<std::string()> token_refresher_;
   struct curl_slist auth_header_ {};
   // Don't modify auth_header_contents_ without updating the pointer in
   // auth_header_
@@ -61,6 +61,49 @@ TEST(treehub_server, basic_auth) {
   }
 }
 
+/* A token rejected by the server is refreshed once, and sent with the requests made from then on. */
+TEST(treehub_server, token_refresh) {
+  TreehubServer server;
+  server.root_url(std::string("http://127.0.0.1:") + port);
+  server.SetToken("old_token");
+  int refreshes = 0;
+  server.SetTokenRefresher([&refreshes]() {
+    ++refreshes;
+    return std::string("new_token");
+  });
+
+  EXPECT_FALSE(server.RetryWithNewToken(200));
+  EXPECT_FALSE(server.RetryWithNewToken(403));
+  EXPECT_EQ(refreshes, 0);
+  EXPECT_TRUE(server.RetryWithNewToken(401));
+  EXPECT_EQ(refreshes, 1);
+  // The new token is not refreshed again.
+  EXPECT_FALSE(server.RetryWithNewToken(401));
+  EXPECT_EQ(refreshes, 1);
+
+  CurlEasyWrapper curl_handle;
+  server.InjectIntoCurl("/", curl_handle.get());
+  std::string response;
+  curlEasySetoptWrapper(curl_handle.get(), CURLOPT_WRITEFUNCTION, writeString);
+  curlEasySetoptWrapper(curl_handle.get(), CURLOPT_WRITEDATA, static_cast<void *>(&response));
+  curl_easy_perform(curl_handle.get());
+  EXPECT_EQ(Utils::parseJSON(response)["Authorization"], "Bearer new_token");
+}
+
+/* Without a new token, the request is not sent again. */
+TEST(treehub_server, token_refresh_failure) {
+  TreehubServer server;
+  server.SetToken("old_token");
+  EXPECT_FALSE(server.RetryWithNewToken(401));
+  server.SetTokenRefresher([]() { return std::string(); });
+  EXPECT_FALSE(server.RetryWithNewToken(401));
+
+  TreehubServer basic_server;
+  basic_server.SetAuthBasic("login", "password");
+  basic_server.SetTokenRefresher([]() { return std::string("new_token"); });
+  EXPECT_FALSE(basic_server.RetryWithNewToken(401));
+}
+
 #ifndef __NO_MAIN__
 int main(int argc, char **argv) {
   ::testing::InitGoogleTest(&argc, argv);
@@ -31,8 +31,8 @@ void DirectorRepo::addTarget(const std::string &target_name, const Json::Value &
   }
   director_targets["targets"][target_name]["custom"].removeMember("version");
   director_targets["version"] = (Utils::parseJSONFile(current)["signed"]["version"].asUInt()) + 1;
+  // Only signed by signTargets()
   Utils::writeFile(staging, Utils::jsonToCanonicalStr(director_targets));
-  updateRepo();
 }
 
 void DirectorRepo::revokeTargets(const std::vector<std::string> &targets_to_remove) {
@@ -49,7 +49,7 @@ void DirectorRepo::revokeTargets(const std::vector<std::string> &targets_to_remo
   targets_unsigned["version"] = (targets_unsigned["version"].asUInt()) + 1;
   Utils::writeFile(path_ / DirectorRepo::dir / "targets.json",
                    Utils::jsonToCanonicalStr(signTuf(Uptane::Role::Targets(), targets_unsigned)));
-  updateRepo();
+  updateRepo({Uptane::Role::Targets()});
 }
 
 void DirectorRepo::signTargets() {
@@ -69,7 +69,7 @@ void DirectorRepo::signTargets() {
   Utils::writeFile(path_ / DirectorRepo::dir / "targets.json",
                    Utils::jsonToCanonicalStr(signTuf(Uptane::Role::Targets(), targets_unsigned)));
   boost::filesystem::remove(path_ / DirectorRepo::dir / "staging/targets.json");
-  updateRepo();
+  updateRepo({Uptane::Role::Targets()});
 }
 
 void DirectorRepo::emptyTargets() {
@@ -1,5 +1,14 @@
 #include "image_repo.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <thread>
+
+#include <boost/algorithm/string/case_conv.hpp>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
@@ -7,50 +16,126 @@
 
 void ImageRepo::addImage(const std::string &name, Json::Value &target, const std::string &hardware_id,
                          const Delegation &delegation) {
+  // TODO: support multiple hardware IDs.
+  target["custom"]["hardwareIds"][0] = hardware_id;
+  addImages({{name, target}}, delegation);
+}
+
+void ImageRepo::addImages(const std::vector<std::pair<std::string, Json::Value>> &new_targets,
+                          const Delegation &delegation) {
   boost::filesystem::path repo_dir(path_ / ImageRepo::dir);
 
   boost::filesystem::path targets_path =
       delegation ? ((repo_dir / "delegations") / delegation.name).string() + ".json" : repo_dir / "targets.json";
   Json::Value targets = Utils::parseJSONFile(targets_path)["signed"];
-  // TODO: support multiple hardware IDs.
-  target["custom"]["hardwareIds"][0] = hardware_id;
-  targets["targets"][name] = target;
+  for (const auto &target : new_targets) {
+    targets["targets"][target.first] = target.second;
+  }
   targets["version"] = (targets["version"].asUInt()) + 1;
 
   auto role = delegation ? Uptane::Role(delegation.name, true) : Uptane::Role::Targets();
   std::string signed_targets = Utils::jsonToCanonicalStr(signTuf(role, targets));
   Utils::writeFile(targets_path, signed_targets);
-  updateRepo();
+  updateRepo({role});
 }
 
 void ImageRepo::addBinaryImage(const boost::filesystem::path &image_path, const boost::filesystem::path &targetname,
                                const std::string &hardware_id, const std::string &url, const int32_t custom_version,
                                const Delegation &delegation, const Json::Value &custom) {
-  boost::filesystem::path repo_dir(path_ / ImageRepo::dir);
-  boost::filesystem::path targets_path = repo_dir / "targets";
+  const BinaryImage image{image_path, targetname, hardware_id, url, custom_version, custom};
+  boost::filesystem::create_directories((path_ / ImageRepo::dir / "targets" / targetname).parent_path());
+  Json::Value target = copyBinaryImage(image);
+  addImage(targetname.string(), target, hardware_id, delegation);
+}
 
-  auto targetname_dir = targetname.parent_path();
-  boost::filesystem::create_directories(targets_path / targetname_dir);
-  boost::filesystem::copy_file(image_path, targets_path / targetname_dir / targetname.filename(),
-                               boost::filesystem::copy_option::overwrite_if_exists);
+void ImageRepo::addBinaryImages(const std::vector<BinaryImage> &images, const Delegation &delegation,
+                                unsigned int threads) {
+  if (threads == 0) {
+    threads = std::max(std::thread::hardware_concurrency(), 1U);
+  }
+  // Not concurrently with the copies
+  for (const auto &image : images) {
+    boost::filesystem::create_directories((path_ / ImageRepo::dir / "targets" / image.targetname).parent_path());
+  }
 
-  std::string image = Utils::readFile(image_path);
+  std::vector<std::pair<std::string, Json::Value>> targets(images.size());
+  std::atomic<size_t> next{0};
+  auto worker = [&]() {
+    try {
+      for (size_t i = next++; i < images.size(); i = next++) {
+        targets[i].first = images[i].targetname.string();
+        targets[i].second = copyBinaryImage(images[i]);
+        // TODO: support multiple hardware IDs.
+        targets[i].second["custom"]["hardwareIds"][0] = images[i].hardware_id;
+      }
+    } catch (...) {
+      // The other threads stop too
+      next = images.size();
+      throw;
+    }
+  };
+  std::vector<std::future<void>> workers;
+  for (unsigned int i = 1; i < std::min(threads, static_cast<unsigned int>(images.size())); ++i) {
+    workers.push_back(std::async(std::launch::async, worker));
+  }
+  std::exception_ptr error;
+  try {
+    worker();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  for (auto &w : workers) {
+    try {
+      w.get();
+    } catch (...) {
+      error = std::current_exception();
+    }
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  addImages(targets, delegation);
+}
+
+Json::Value ImageRepo::copyBinaryImage(const BinaryImage &image) const {
+  const boost::filesystem::path target_path = path_ / ImageRepo::dir / "targets" / image.targetname;
+  boost::filesystem::copy_file(image.image_path, target_path, boost::filesystem::copy_option::overwrite_if_exists);
+
+  // Streamed, rather than holding the whole image in memory on each thread
+  std::ifstream file(image.image_path.string(), std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open image " + image.image_path.string());
+  }
+  auto sha256 = MultiPartHasher::create(Hash::Type::kSha256);
+  auto sha512 = MultiPartHasher::create(Hash::Type::kSha512);
+  std::array<char, 64 * 1024> buffer{};
+  uint64_t length = 0;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    const auto read = static_cast<uint64_t>(file.gcount());
+    sha256->update(reinterpret_cast<const unsigned char *>(buffer.data()), read);
+    sha512->update(reinterpret_cast<const unsigned char *>(buffer.data()), read);
+    length += read;
+  }
+  if (file.bad()) {
+    throw std::runtime_error("Could not read image " + image.image_path.string());
+  }
 
   Json::Value target;
-  target["length"] = Json::UInt64(image.size());
-  target["hashes"]["sha256"] = Crypto::sha256digestHex(image);
-  target["hashes"]["sha512"] = Crypto::sha512digestHex(image);
-  target["custom"] = custom;
+  target["length"] = Json::UInt64(length);
+  target["hashes"]["sha256"] = boost::algorithm::to_lower_copy(sha256->getHexDigest());
+  target["hashes"]["sha512"] = boost::algorithm::to_lower_copy(sha512->getHexDigest());
+  target["custom"] = image.custom;
   if (!target["custom"].isMember("targetFormat")) {
     target["custom"]["targetFormat"] = "BINARY";
   }
-  if (!url.empty()) {
-    target["custom"]["uri"] = url;
+  if (!image.url.empty()) {
+    target["custom"]["uri"] = image.url;
   }
-  if (custom_version != 0) {
-    target["custom"]["version"] = custom_version;
+  if (image.custom_version != 0) {
+    target["custom"]["version"] = image.custom_version;
   }
-  addImage(targetname.string(), target, hardware_id, delegation);
+  return target;
 }
 
 void ImageRepo::addCustomImage(const std::string &name, const Hash &hash, const uint64_t length,
@@ -122,7 +207,7 @@ void ImageRepo::addDelegation(const Uptane::Role &name, const Uptane::Role &pare
 
   std::string signed_parent = Utils::jsonToCanonicalStr(signTuf(parent_role, parent_notsigned));
   Utils::writeFile(parent_path, signed_parent);
-  updateRepo();
+  updateRepo({parent_role, name});
 }
 
 // NOLINTNEXTLINE(misc-no-recursion)
@@ -1,18 +1,40 @@
 #ifndef IMAGE_REPO_H_
 #define IMAGE_REPO_H_
 
+#include <utility>
+#include <vector>
+
 #include "repo.h"
 
 class ImageRepo : public Repo {
  public:
+  /** An image for addBinaryImages(), with the arguments of addBinaryImage() */
+  struct BinaryImage {
+    boost::filesystem::path image_path;
+    boost::filesystem::path targetname;
+    std::string hardware_id;
+    std::string url;
+    int32_t custom_version{0};
+    Json::Value custom;
+  };
+
   ImageRepo(boost::filesystem::path path, const std::string &expires, std::string correlation_id)
       : Repo(Uptane::RepositoryType::Image(), std::move(path), expires, std::move(correlation_id)) {}
   void addBinaryImage(const boost::filesystem::path &image_path, const boost::filesystem::path &targetname,
                       const std::string &hardware_id, const std::string &url = "", int32_t custom_version = 0,
                       const Delegation &delegation = {}, const Json::Value &custom = {});
+  /**
+   * Add many images at once: they are copied and hashed on `threads` threads
+   * (0 for one per CPU), and the targets metadata, snapshot and timestamp are
+   * signed once for all of them.
+   */
+  void addBinaryImages(const std::vector<BinaryImage> &images, const Delegation &delegation = {},
+                       unsigned int threads = 0);
   void addCustomImage(const std::string &name, const Hash &hash, uint64_t length, const std::string &hardware_id,
                       const std::string &url = "", int32_t custom_version = 0, const Delegation &delegation = {},
                       const Json::Value &custom = {});
+  /** Add targets already described, signing the targets metadata, snapshot and timestamp once. */
+  void addImages(const std::vector<std::pair<std::string, Json::Value>> &targets, const Delegation &delegation);
   void addDelegation(const Uptane::Role &name, const Uptane::Role &parent_role, const std::string &path,
                      bool terminating, KeyType key_type);
   void revokeDelegation(const Uptane::Role &name);
@@ -25,6 +47,8 @@ class ImageRepo : public Repo {
  private:
   void addImage(const std::string &name, Json::Value &target, const std::string &hardware_id,
                 const Delegation &delegation = {});
+  /** Copy the image into the repo and describe it, without signing anything. Thread-safe. */
+  Json::Value copyBinaryImage(const BinaryImage &image) const;
   void removeDelegationRecursive(const Uptane::Role &name, const Uptane::Role &parent_name);
 };
 
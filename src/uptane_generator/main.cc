@@ -4,9 +4,12 @@
 #include <istream>
 #include <iterator>
 #include <ostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include "logging/logging.h"
+#include "synthetic_repo.h"
 #include "uptane_repo.h"
 #include "utilities/aktualizr_version.h"
 #include "utilities/utils.h"
@@ -32,6 +35,28 @@ void check_info_options(const po::options_description &description, const po::va
   }
 }
 
+// The options of the image and images commands that go in the custom metadata of the targets
+void parse_image_options(const po::variables_map &vm, std::string *url, int32_t *custom_version,
+                         Json::Value *custom) {
+  if (vm.count("url") != 0) {
+    *url = vm["url"].as<std::string>();
+  }
+  if (vm.count("customversion") != 0) {
+    *custom_version = vm["customversion"].as<int32_t>();
+  }
+  if (vm.count("targetcustom") > 0 && vm.count("targetformat") > 0) {
+    std::cerr << "--targetcustom and --targetformat cannot be used together";
+    exit(EXIT_FAILURE);
+  }
+  if (vm.count("targetcustom") > 0) {
+    std::ifstream custom_file(vm["targetcustom"].as<boost::filesystem::path>().c_str());
+    custom_file >> *custom;
+  } else if (vm.count("targetformat") > 0) {
+    *custom = Json::Value();
+    (*custom)["targetFormat"] = vm["targetformat"].as<std::string>();
+  }
+}
+
 int main(int argc, char **argv) {
   po::options_description desc("uptane-generator command line options");
   // clang-format off
@@ -39,9 +64,11 @@ int main(int argc, char **argv) {
     ("help,h", "print usage")
     ("version,v", "Current uptane-generator version")
     ("command", po::value<std::string>(), "generate: \tgenerate a new repository\n"
+                                          "synthetic: \tgenerate a new repository filled with the targets, delegations, ECUs and Root rotations described by the JSON parameters in --filename, for benchmarks\n"
                                           "adddelegation: \tadd a delegated role to the Image repo metadata\n"
                                           "revokedelegation: \tremove delegated role from the Image repo metadata and all signed targets of this role\n"
                                           "image: \tadd a target to the Image repo metadata\n"
+                                          "images: \tadd the targets listed in --filename, one image path and optional target name per line, to the Image repo metadata\n"
                                           "addtarget: \tprepare Director Targets metadata for a given device\n"
                                           "signtargets: \tsign the staged Director Targets metadata\n"
                                           "emptytargets: \tclear the staged Director Targets metadata\n"
@@ -49,9 +76,10 @@ int main(int argc, char **argv) {
                                           "sign: \tsign arbitrary metadata with repo keys\n"
                                           "addcampaigns: \tgenerate campaigns json\n"
                                           "refresh: \trefresh a metadata object (bump the version)\n"
-                                          "rotate: \trotate a Root metadata key")
+                                          "rotate: \trotate a Root metadata key\n"
+                                          "bundle: \twrite the metadata and the images of the signed Director Targets to the offline bundle --filename")
     ("path", po::value<boost::filesystem::path>(), "path to the repository")
-    ("filename", po::value<boost::filesystem::path>(), "path to the image")
+    ("filename", po::value<boost::filesystem::path>(), "path to the image, to the list of images for 'images', to the parameters for 'synthetic', or to the bundle written by 'bundle'")
     ("hwid", po::value<std::string>(), "target hardware identifier")
     ("targetformat", po::value<std::string>(), "format of target for 'image' command")
     ("targetcustom", po::value<boost::filesystem::path>(), "path to custom JSON for 'image' command")
@@ -70,7 +98,8 @@ int main(int argc, char **argv) {
     ("dparent", po::value<std::string>()->default_value("targets"), "delegated role parent name")
     ("dpattern", po::value<std::string>(), "delegated file path pattern")
     ("url", po::value<std::string>(), "custom download URL")
-    ("customversion", po::value<int32_t>(), "custom version");
+    ("customversion", po::value<int32_t>(), "custom version")
+    ("jobs", po::value<unsigned int>()->default_value(0), "threads hashing the images of the 'images' command, 0 for one per CPU");
   // clang-format on
 
   po::positional_options_description positionalOptions;
@@ -108,6 +137,16 @@ int main(int argc, char **argv) {
         KeyType key_type = parseKeyType(vm);
         repo.generateRepo(key_type);
         std::cout << "Uptane metadata repos generated at " << repo_dir << std::endl;
+      } else if (command == "synthetic") {
+        if (vm.count("filename") == 0) {
+          std::cerr << "synthetic command requires --filename\n";
+          exit(EXIT_FAILURE);
+        }
+        const auto params =
+            SyntheticRepoParams::fromJson(Utils::parseJSONFile(vm["filename"].as<boost::filesystem::path>()));
+        generateSyntheticRepo(repo_dir, expiration_time, params);
+        std::cout << "Synthetic Uptane metadata repos with " << params.targets << " targets and " << params.ecus
+                  << " ECUs generated at " << repo_dir << std::endl;
       } else if (command == "image") {
         if (vm.count("targetname") == 0 && vm.count("filename") == 0) {
           std::cerr << "image command requires --targetname or --filename\n";
@@ -131,25 +170,9 @@ int main(int argc, char **argv) {
           std::cout << "Added a target " << targetname << " to a delegated role " << dname << std::endl;
         }
         std::string url;
-        if (vm.count("url") != 0) {
-          url = vm["url"].as<std::string>();
-        }
         int32_t custom_version{0};
-        if (vm.count("customversion") != 0) {
-          custom_version = vm["customversion"].as<int32_t>();
-        }
         Json::Value custom;
-        if (vm.count("targetcustom") > 0 && vm.count("targetformat") > 0) {
-          std::cerr << "--targetcustom and --targetformat cannot be used together";
-          exit(EXIT_FAILURE);
-        }
-        if (vm.count("targetcustom") > 0) {
-          std::ifstream custom_file(vm["targetcustom"].as<boost::filesystem::path>().c_str());
-          custom_file >> custom;
-        } else if (vm.count("targetformat") > 0) {
-          custom = Json::Value();
-          custom["targetFormat"] = vm["targetformat"].as<std::string>();
-        }
+        parse_image_options(vm, &url, &custom_version, &custom);
         if (vm.count("filename") > 0) {
           repo.addImage(vm["filename"].as<boost::filesystem::path>(), targetname, hwid, url, custom_version, delegation,
                         custom);
@@ -170,6 +193,47 @@ int main(int argc, char **argv) {
                               delegation, custom);
           std::cout << "Added a custom image target " << targetname.string() << std::endl;
         }
+      } else if (command == "images") {
+        if (vm.count("filename") == 0 || vm.count("hwid") == 0) {
+          std::cerr << "images command requires --filename and --hwid\n";
+          exit(EXIT_FAILURE);
+        }
+        ImageRepo::BinaryImage options;
+        options.hardware_id = vm["hwid"].as<std::string>();
+        parse_image_options(vm, &options.url, &options.custom_version, &options.custom);
+        Delegation delegation;
+        if (vm.count("dname") != 0) {
+          delegation = Delegation(repo_dir, dname);
+        }
+
+        // One image per line: its path, and optionally its target name
+        const auto list_path = vm["filename"].as<boost::filesystem::path>();
+        std::ifstream list(list_path.c_str());
+        if (!list) {
+          std::cerr << "Could not open the list of images " << list_path << "\n";
+          exit(EXIT_FAILURE);
+        }
+        std::vector<ImageRepo::BinaryImage> images;
+        std::string line;
+        while (std::getline(list, line)) {
+          std::istringstream fields(line);
+          std::string image_path;
+          std::string targetname;
+          if (!(fields >> image_path)) {
+            continue;
+          }
+          fields >> targetname;
+          ImageRepo::BinaryImage image = options;
+          image.image_path = image_path;
+          image.targetname = targetname.empty() ? boost::filesystem::path(image_path) : targetname;
+          if (delegation && !delegation.isMatched(image.targetname)) {
+            std::cerr << "Image path " << image.targetname << " doesn't match delegation!\n";
+            exit(EXIT_FAILURE);
+          }
+          images.push_back(std::move(image));
+        }
+        repo.addImages(images, delegation, vm["jobs"].as<unsigned int>());
+        std::cout << "Added " << images.size() << " targets to the Image repo metadata" << std::endl;
       } else if (command == "addtarget") {
         if (vm.count("targetname") == 0 || vm.count("hwid") == 0 || vm.count("serial") == 0) {
           std::cerr << "addtarget command requires --targetname, --hwid, and --serial\n";
@@ -244,6 +308,14 @@ int main(int argc, char **argv) {
         }
         repo.refresh(Uptane::RepositoryType(vm["repotype"].as<std::string>()),
                      Uptane::Role(vm["keyname"].as<std::string>()));
+      } else if (command == "bundle") {
+        if (vm.count("filename") == 0) {
+          std::cerr << "bundle command requires --filename\n";
+          exit(EXIT_FAILURE);
+        }
+        const auto bundle = vm["filename"].as<boost::filesystem::path>();
+        repo.writeOfflineBundle(bundle);
+        std::cout << "Wrote the offline bundle " << bundle.string() << std::endl;
       } else if (command == "rotate") {
         if (vm.count("repotype") == 0) {
           std::cerr << "refresh command requires --repotype\n";
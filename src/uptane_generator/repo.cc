@@ -1,8 +1,10 @@
 #include "repo.h"
 
+#include <sys/stat.h>
 #include <array>
 #include <boost/filesystem.hpp>
 #include <ctime>
+#include <mutex>
 #include <regex>
 
 #include "crypto/crypto.h"
@@ -24,20 +26,27 @@ Repo::Repo(Uptane::RepositoryType repo_type, boost::filesystem::path path, const
   }
 }
 
-// NOLINTNEXTLINE(misc-no-recursion)
-void Repo::addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &role) {
+Json::Value Repo::addRoleToSnapshot(Json::Value *snapshot, const Uptane::Role &role) {
   boost::filesystem::path repo_dir = repo_dir_;
   if (role.IsDelegation()) {
     repo_dir = repo_dir / "delegations";
   }
   std::string role_file_name = role.ToString() + ".json";
 
-  Json::Value role_json = Utils::parseJSONFile(repo_dir / role_file_name)["signed"];
   std::string signed_role = Utils::readFile(repo_dir / role_file_name);
+  Json::Value role_json = Utils::parseJSON(signed_role)["signed"];
+
+  Json::Value &meta = (*snapshot)["meta"][role_file_name];
+  meta = Json::objectValue;
+  meta["version"] = role_json["version"].asUInt();
+  meta["length"] = signed_role.size();
+  meta["hashes"]["sha256"] = Crypto::sha256digestHex(signed_role);
+  return role_json;
+}
 
-  (*snapshot)["meta"][role_file_name]["version"] = role_json["version"].asUInt();
-  (*snapshot)["meta"][role_file_name]["length"] = signed_role.size();
-  (*snapshot)["meta"][role_file_name]["hashes"]["sha256"] = Crypto::sha256digestHex(signed_role);
+// NOLINTNEXTLINE(misc-no-recursion)
+void Repo::addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &role) {
+  Json::Value role_json = addRoleToSnapshot(snapshot, role);
 
   if (role_json["delegations"].isObject()) {
     auto delegations_list = role_json["delegations"]["roles"];
@@ -48,27 +57,44 @@ void Repo::addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &ro
   }
 }
 
-void Repo::updateRepo() {
+void Repo::updateRepo(const std::vector<Uptane::Role> &changed) {
   const Json::Value old_snapshot = Utils::parseJSONFile(repo_dir_ / "snapshot.json")["signed"];
   Json::Value snapshot;
   snapshot["_type"] = "Snapshot";
   snapshot["expires"] = old_snapshot["expires"];
   snapshot["version"] = (old_snapshot["version"].asUInt()) + 1;
 
-  const Json::Value root = Utils::parseJSONFile(repo_dir_ / "root.json")["signed"];
-  snapshot["meta"]["root.json"]["version"] = root["version"].asUInt();
-
-  addDelegationToSnapshot(&snapshot, Uptane::Role::Targets());
+  bool root_changed = changed.empty();
+  if (changed.empty()) {
+    addDelegationToSnapshot(&snapshot, Uptane::Role::Targets());
+  } else {
+    snapshot["meta"] = old_snapshot["meta"];
+    for (const auto &role : changed) {
+      if (role == Uptane::Role::Root()) {
+        root_changed = true;
+      } else {
+        addRoleToSnapshot(&snapshot, role);
+      }
+    }
+  }
+  if (root_changed) {
+    const Json::Value root = Utils::parseJSONFile(repo_dir_ / "root.json")["signed"];
+    snapshot["meta"]["root.json"] = Json::objectValue;
+    snapshot["meta"]["root.json"]["version"] = root["version"].asUInt();
+  }
 
   const std::string signed_snapshot = Utils::jsonToCanonicalStr(signTuf(Uptane::Role::Snapshot(), snapshot));
   Utils::writeFile(repo_dir_ / "snapshot.json", signed_snapshot);
+  updateTimestamp(signed_snapshot, snapshot["version"].asUInt());
+}
 
+void Repo::updateTimestamp(const std::string &signed_snapshot, const unsigned int snapshot_version) {
   Json::Value timestamp = Utils::parseJSONFile(repo_dir_ / "timestamp.json")["signed"];
   timestamp["version"] = (timestamp["version"].asUInt()) + 1;
   timestamp["meta"]["snapshot.json"]["hashes"]["sha256"] = Crypto::sha256digestHex(signed_snapshot);
   timestamp["meta"]["snapshot.json"]["hashes"]["sha512"] = Crypto::sha512digestHex(signed_snapshot);
   timestamp["meta"]["snapshot.json"]["length"] = static_cast<Json::UInt>(signed_snapshot.length());
-  timestamp["meta"]["snapshot.json"]["version"] = snapshot["version"].asUInt();
+  timestamp["meta"]["snapshot.json"]["version"] = snapshot_version;
   Utils::writeFile(repo_dir_ / "timestamp.json",
                    Utils::jsonToCanonicalStr(signTuf(Uptane::Role::Timestamp(), timestamp)));
 }
@@ -272,20 +298,54 @@ Json::Value Repo::getTarget(const std::string &target_name) {
   return {};
 }
 
+namespace {
+// The keys read by all the repos of the process, by key directory, with the
+// private key file they were read from. The files are replaced as a whole
+// when the keys are rotated, by this process or another.
+struct CachedKeyPair {
+  struct stat private_key_file {};
+  KeyPair key_pair;
+};
+std::mutex key_cache_mutex;
+std::map<std::string, CachedKeyPair> key_cache;
+
+bool sameFile(const struct stat &a, const struct stat &b) {
+  return a.st_dev == b.st_dev && a.st_ino == b.st_ino && a.st_size == b.st_size &&
+         a.st_mtim.tv_sec == b.st_mtim.tv_sec && a.st_mtim.tv_nsec == b.st_mtim.tv_nsec;
+}
+}  // namespace
+
+KeyPair Repo::readKeyPair(const boost::filesystem::path &key_dir) {
+  struct stat private_key_file {};
+  const bool cacheable = stat((key_dir / "private.key").c_str(), &private_key_file) == 0;
+  std::lock_guard<std::mutex> lock(key_cache_mutex);
+  if (cacheable) {
+    const auto cached = key_cache.find(key_dir.string());
+    if (cached != key_cache.end() && sameFile(cached->second.private_key_file, private_key_file)) {
+      return cached->second.key_pair;
+    }
+  }
+
+  std::string public_key_string = Utils::readFile(key_dir / "public.key");
+  std::istringstream key_type_str(Utils::readFile(key_dir / "key_type"));
+  KeyType key_type;
+  key_type_str >> key_type;
+  std::string private_key_string(Utils::readFile(key_dir / "private.key"));
+  KeyPair key_pair(PublicKey(public_key_string, key_type), private_key_string);
+  if (cacheable) {
+    key_cache[key_dir.string()] = CachedKeyPair{private_key_file, key_pair};
+  }
+  return key_pair;
+}
+
 void Repo::readKeys() {
   auto keys_path = path_ / "keys" / repo_type_.ToString();
   if (!boost::filesystem::exists(keys_path)) {
     return;
   }
   for (auto &p : boost::filesystem::directory_iterator(keys_path)) {
-    std::string public_key_string = Utils::readFile(p / "public.key");
-    std::istringstream key_type_str(Utils::readFile(p / "key_type"));
-    KeyType key_type;
-    key_type_str >> key_type;
-    std::string private_key_string(Utils::readFile(p / "private.key"));
     auto name = p.path().filename().string();
-    keys_[Uptane::Role(name, !Uptane::Role::IsReserved(name))] =
-        KeyPair(PublicKey(public_key_string, key_type), private_key_string);
+    keys_[Uptane::Role(name, !Uptane::Role::IsReserved(name))] = readKeyPair(p.path());
   }
 }
 
@@ -335,7 +395,15 @@ void Repo::refresh(const Uptane::Role &role, const TimeStamp &expiry) {
     Utils::writeFile(repo_dir_ / root_name.str(), signed_meta);
   }
 
-  updateRepo();
+  // Nothing refers to the Timestamp, and the Snapshot is only in the Timestamp.
+  if (role == Uptane::Role::Timestamp()) {
+    return;
+  }
+  if (role == Uptane::Role::Snapshot()) {
+    updateTimestamp(signed_meta, version);
+    return;
+  }
+  updateRepo({role});
 }
 
 void Repo::rotate(const Uptane::Role &role, KeyType key_type) {
@@ -379,7 +447,7 @@ void Repo::rotate(const Uptane::Role &role, KeyType key_type) {
   root_name << version << ".root.json";
   Utils::writeFile(repo_dir_ / root_name.str(), signed_meta);
 
-  updateRepo();
+  updateRepo({role});
 }
 
 Delegation::Delegation(const boost::filesystem::path &repo_path, std::string delegation_name)
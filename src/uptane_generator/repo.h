@@ -5,6 +5,7 @@
 #include <boost/filesystem/path.hpp>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "json/json.h"
 #include "libaktualizr/types.h"
@@ -49,7 +50,14 @@ class Repo {
   void generateKeyPair(KeyType key_type, const Uptane::Role &key_name);
   static std::string getExpirationTime(const std::string &expires);
   void readKeys();
-  void updateRepo();
+  /**
+   * Sign a new Snapshot and Timestamp after the given roles were rewritten,
+   * the other roles being taken as they are in the current Snapshot. Without
+   * any, the whole delegation tree is read again, as needed once roles are
+   * removed from it.
+   */
+  void updateRepo(const std::vector<Uptane::Role> &changed = {});
+  void updateTimestamp(const std::string &signed_snapshot, unsigned int snapshot_version);
   Uptane::RepositoryType repo_type_;
   boost::filesystem::path path_;
   boost::filesystem::path repo_dir_;
@@ -59,6 +67,8 @@ class Repo {
 
  private:
   void addDelegationToSnapshot(Json::Value *snapshot, const Uptane::Role &role);
+  Json::Value addRoleToSnapshot(Json::Value *snapshot, const Uptane::Role &role);
+  static KeyPair readKeyPair(const boost::filesystem::path &key_dir);
   static Json::Value signTuf(const KeyPair &key, const Json::Value &json);
 };
 
@@ -9,6 +9,7 @@
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
 #include "test_utils.h"
+#include "synthetic_repo.h"
 #include "uptane/exceptions.h"
 #include "uptane_repo.h"
 
@@ -140,6 +141,43 @@ TEST(uptane_generator, add_image) {
   check_repo(temp_dir);
 }
 
+/*
+ * Add many images to the Image repo at once, with a single new version of the metadata.
+ */
+TEST(uptane_generator, add_images) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  const Json::Value before = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "targets.json")["signed"];
+
+  std::vector<ImageRepo::BinaryImage> images;
+  for (int i = 0; i < 20; ++i) {
+    const std::string content = "image " + std::to_string(i) + std::string(static_cast<size_t>(i) * 10000, 'x');
+    Utils::writeFile(temp_dir / ("image" + std::to_string(i)), content);
+    ImageRepo::BinaryImage image;
+    image.image_path = temp_dir / ("image" + std::to_string(i));
+    image.targetname = "images/image" + std::to_string(i);
+    image.hardware_id = "test-hw";
+    images.push_back(image);
+  }
+  repo.addImages(images, {}, 4);
+
+  const Json::Value targets = Utils::parseJSONFile(temp_dir.Path() / ImageRepo::dir / "targets.json")["signed"];
+  EXPECT_EQ(targets["version"].asUInt(), before["version"].asUInt() + 1);
+  EXPECT_EQ(targets["targets"].size(), images.size());
+  for (const auto &image : images) {
+    const std::string content = Utils::readFile(image.image_path);
+    const Json::Value target = targets["targets"][image.targetname.string()];
+    EXPECT_EQ(target["length"].asUInt64(), content.size());
+    EXPECT_EQ(target["hashes"]["sha256"].asString(), Crypto::sha256digestHex(content));
+    EXPECT_EQ(target["hashes"]["sha512"].asString(), Crypto::sha512digestHex(content));
+    EXPECT_EQ(target["custom"]["hardwareIds"][0].asString(), "test-hw");
+    EXPECT_EQ(target["custom"]["targetFormat"].asString(), "BINARY");
+    EXPECT_EQ(Utils::readFile(temp_dir.Path() / ImageRepo::dir / "targets" / image.targetname), content);
+  }
+  check_repo(temp_dir);
+}
+
 /*
  * Copy an image to the Director repo.
  */
@@ -376,6 +414,57 @@ TEST(uptane_generator, delegation_revoke) {
   EXPECT_EQ(director_targets.targets.size(), 0);
 }
 
+/*
+ * Generate the same synthetic repo twice from the same seed.
+ */
+TEST(uptane_generator, synthetic) {
+  Json::Value params_json;
+  params_json["seed"] = 3;
+  params_json["key_type"] = "ED25519";
+  params_json["targets"] = 20;
+  params_json["delegation_depth"] = 2;
+  params_json["delegation_width"] = 2;
+  params_json["hardware_ids"] = 3;
+  params_json["ecus"] = 5;
+  params_json["root_rotations"] = 2;
+  params_json["custom_size"] = 100;
+  const auto params = SyntheticRepoParams::fromJson(params_json);
+
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory other_dir;
+  generateSyntheticRepo(temp_dir.Path(), "", params);
+  generateSyntheticRepo(other_dir.Path(), "", params);
+  check_repo(temp_dir);
+  check_repo(other_dir);
+
+  const auto signed_part = [](const TemporaryDirectory &dir, const std::string &file) {
+    return Utils::parseJSONFile(dir.Path() / file)["signed"];
+  };
+  // The targets go round the roles of the bottom level
+  const std::vector<std::pair<std::string, std::string>> roles{{"d0-0", "synthetic/d0/d0-0/target-0"},
+                                                               {"d0-1", "synthetic/d0/d0-1/target-1"},
+                                                               {"d1-0", "synthetic/d1/d1-0/target-2"},
+                                                               {"d1-1", "synthetic/d1/d1-1/target-3"}};
+  for (const auto &role : roles) {
+    const auto file = std::string(ImageRepo::dir) + "/delegations/" + role.first + ".json";
+    const auto targets = signed_part(temp_dir, file)["targets"];
+    EXPECT_EQ(targets.size(), 5);
+    EXPECT_TRUE(targets.isMember(role.second));
+    EXPECT_EQ(targets, signed_part(other_dir, file)["targets"]);
+  }
+  EXPECT_EQ(signed_part(temp_dir, std::string(ImageRepo::dir) + "/delegations/d0.json")["targets"].size(), 0);
+
+  const auto director_file = std::string(DirectorRepo::dir) + "/targets.json";
+  const auto director_targets = signed_part(temp_dir, director_file)["targets"];
+  EXPECT_EQ(director_targets.size(), 5);
+  EXPECT_EQ(director_targets, signed_part(other_dir, director_file)["targets"]);
+  EXPECT_EQ((*director_targets.begin())["custom"]["synthetic"].asString().size(), 100);
+
+  EXPECT_EQ(signed_part(temp_dir, std::string(DirectorRepo::dir) + "/root.json")["version"].asUInt(), 3);
+  EXPECT_EQ(signed_part(temp_dir, std::string(ImageRepo::dir) + "/root.json")["version"].asUInt(), 3);
+  EXPECT_TRUE(boost::filesystem::exists(temp_dir.Path() / ImageRepo::dir / "2.root.json"));
+}
+
 /*
  * Sign arbitrary metadata.
  */
@@ -621,6 +710,47 @@ TEST(uptane_generator, refreshImageTargets) {
   check_repo(temp_dir);
 }
 
+/*
+ * The Snapshot updated with only the changed roles describes the whole delegation tree.
+ */
+TEST(uptane_generator, delegation_snapshot) {
+  TemporaryDirectory temp_dir;
+  UptaneRepo repo(temp_dir.Path(), "", "");
+  repo.generateRepo(key_type);
+  repo.addDelegation(Uptane::Role("first", true), Uptane::Role::Targets(), "first/*", false, key_type);
+  repo.addDelegation(Uptane::Role("second", true), Uptane::Role::Targets(), "second/*", false, key_type);
+  repo.addDelegation(Uptane::Role("nested", true), Uptane::Role("first", true), "first/nested/*", false, key_type);
+  Hash hash(Hash::Type::kSha256, "8ab755c16de6ee9b6224169b36cbf0f2a545f859be385501ad82cdccc240d0a6");
+  repo.addCustomImage("first/nested/image", hash, 123, "test-hw", "", 0, Delegation(temp_dir.Path(), "nested"));
+  repo.addCustomImage("second/image", hash, 123, "test-hw", "", 0, Delegation(temp_dir.Path(), "second"));
+
+  const auto check_snapshot = [&temp_dir](const std::vector<std::string> &roles) {
+    const auto repo_dir = temp_dir.Path() / ImageRepo::dir;
+    const Json::Value snapshot = Utils::parseJSONFile(repo_dir / "snapshot.json")["signed"];
+    EXPECT_EQ(snapshot["meta"].size(), roles.size() + 1);
+    for (const auto &role : roles) {
+      const auto role_dir = role == "targets" ? repo_dir : repo_dir / "delegations";
+      const std::string signed_role = Utils::readFile(role_dir / (role + ".json"));
+      const Json::Value meta = snapshot["meta"][role + ".json"];
+      EXPECT_EQ(meta["version"].asUInt(), Utils::parseJSON(signed_role)["signed"]["version"].asUInt());
+      EXPECT_EQ(meta["length"].asUInt(), signed_role.size());
+      EXPECT_EQ(meta["hashes"]["sha256"].asString(), Crypto::sha256digestHex(signed_role));
+    }
+  };
+  check_snapshot({"targets", "first", "second", "nested"});
+  check_repo(temp_dir);
+
+  repo.refresh(Uptane::RepositoryType::Image(), Uptane::Role::Timestamp());
+  checkVersions(temp_dir, 1, 1, 1, 1, 1, 7, 6, 3);
+  repo.refresh(Uptane::RepositoryType::Image(), Uptane::Role::Snapshot());
+  checkVersions(temp_dir, 1, 1, 1, 1, 1, 8, 7, 3);
+  check_repo(temp_dir);
+
+  repo.revokeDelegation(Uptane::Role("nested", true));
+  check_snapshot({"targets", "first", "second"});
+  check_repo(temp_dir);
+}
+
 void test_rotation(const Uptane::RepositoryType repo_type) {
   TemporaryDirectory temp_dir;
 
@@ -0,0 +1,148 @@
+#include "synthetic_repo.h"
+
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "director_repo.h"
+#include "image_repo.h"
+
+namespace {
+unsigned int readCount(const Json::Value &json, const std::string &name, const unsigned int default_value) {
+  if (!json.isMember(name)) {
+    return default_value;
+  }
+  if (!json[name].isUInt()) {
+    throw std::runtime_error("Synthetic repo parameter " + name + " must be a non-negative integer");
+  }
+  return json[name].asUInt();
+}
+
+// Random values from the raw output of the generator, which unlike the
+// standard distributions is the same with every standard library.
+class Random {
+ public:
+  explicit Random(uint64_t seed) : engine_(seed) {}
+  uint64_t below(uint64_t bound) { return engine_() % bound; }
+  std::string hex(size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string result;
+    result.reserve(size);
+    while (result.size() < size) {
+      uint64_t value = engine_();
+      for (int i = 0; i < 16 && result.size() < size; ++i, value >>= 4) {
+        result += digits[value & 0xf];
+      }
+    }
+    return result;
+  }
+
+ private:
+  std::mt19937_64 engine_;
+};
+}  // namespace
+
+SyntheticRepoParams SyntheticRepoParams::fromJson(const Json::Value &json) {
+  if (!json.isObject()) {
+    throw std::runtime_error("The synthetic repo parameters must be a JSON object");
+  }
+  SyntheticRepoParams params;
+  if (json.isMember("seed")) {
+    if (!json["seed"].isUInt64()) {
+      throw std::runtime_error("Synthetic repo parameter seed must be a non-negative integer");
+    }
+    params.seed = json["seed"].asUInt64();
+  }
+  if (json.isMember("key_type")) {
+    std::istringstream key_type_str(json["key_type"].asString());
+    key_type_str >> params.key_type;
+    if (params.key_type == KeyType::kUnknown) {
+      throw std::runtime_error("Unknown key type " + json["key_type"].asString());
+    }
+  }
+  params.targets = readCount(json, "targets", params.targets);
+  params.delegation_depth = readCount(json, "delegation_depth", params.delegation_depth);
+  params.delegation_width = readCount(json, "delegation_width", params.delegation_width);
+  params.hardware_ids = readCount(json, "hardware_ids", params.hardware_ids);
+  params.ecus = readCount(json, "ecus", params.ecus);
+  params.root_rotations = readCount(json, "root_rotations", params.root_rotations);
+  params.custom_size = readCount(json, "custom_size", params.custom_size);
+  if (params.delegation_width == 0 || params.hardware_ids == 0) {
+    throw std::runtime_error("Synthetic repo parameters delegation_width and hardware_ids must be positive");
+  }
+  if (params.ecus > params.targets) {
+    throw std::runtime_error("A synthetic repo needs at least as many targets as ECUs");
+  }
+  return params;
+}
+
+void generateSyntheticRepo(const boost::filesystem::path &path, const std::string &expires,
+                           const SyntheticRepoParams &params) {
+  Random random(params.seed);
+  DirectorRepo director_repo(path, expires, "");
+  ImageRepo image_repo(path, expires, "");
+  director_repo.generateRepo(params.key_type);
+  image_repo.generateRepo(params.key_type);
+
+  // The delegation tree, level by level, with the path prefix of each role.
+  // The targets are all in the roles of the bottom level.
+  std::vector<std::pair<Uptane::Role, std::string>> level{{Uptane::Role::Targets(), "synthetic/"}};
+  for (unsigned int depth = 0; depth < params.delegation_depth; ++depth) {
+    std::vector<std::pair<Uptane::Role, std::string>> next_level;
+    for (const auto &parent : level) {
+      for (unsigned int i = 0; i < params.delegation_width; ++i) {
+        const std::string name =
+            (parent.first == Uptane::Role::Targets() ? "d" : parent.first.ToString() + "-") + std::to_string(i);
+        const std::string prefix = parent.second + name + "/";
+        image_repo.addDelegation(Uptane::Role(name, true), parent.first, prefix + "*", false, params.key_type);
+        next_level.emplace_back(Uptane::Role(name, true), prefix);
+      }
+    }
+    level = std::move(next_level);
+  }
+
+  std::vector<std::vector<std::pair<std::string, Json::Value>>> role_targets(level.size());
+  for (unsigned int i = 0; i < params.targets; ++i) {
+    const size_t role = i % level.size();
+    Json::Value target;
+    target["length"] = Json::UInt64(1024 + random.below(uint64_t{1} << 30));
+    target["hashes"]["sha256"] = random.hex(64);
+    target["custom"]["targetFormat"] = "BINARY";
+    target["custom"]["version"] = i + 1;
+    target["custom"]["hardwareIds"][0] = "synthetic-hw-" + std::to_string(random.below(params.hardware_ids));
+    if (params.custom_size != 0) {
+      target["custom"]["synthetic"] = random.hex(params.custom_size);
+    }
+    role_targets[role].emplace_back(level[role].second + "target-" + std::to_string(i), std::move(target));
+  }
+  for (size_t role = 0; role < level.size(); ++role) {
+    Delegation delegation;
+    if (level[role].first != Uptane::Role::Targets()) {
+      delegation.name = level[role].first.ToString();
+      delegation.pattern = level[role].second + "*";
+    }
+    image_repo.addImages(role_targets[role], delegation);
+  }
+
+  // A distinct target for each ECU, which can only appear once in the Director Targets
+  std::set<unsigned int> installed;
+  for (unsigned int ecu = 0; ecu < params.ecus; ++ecu) {
+    unsigned int i = static_cast<unsigned int>(random.below(params.targets));
+    while (installed.count(i) != 0) {
+      i = (i + 1) % params.targets;
+    }
+    installed.insert(i);
+    const auto &target = role_targets[i % level.size()][i / level.size()];
+    director_repo.addTarget(target.first, target.second, target.second["custom"]["hardwareIds"][0].asString(),
+                            "synthetic-ecu-" + std::to_string(ecu));
+  }
+  director_repo.signTargets();
+
+  for (unsigned int rotation = 0; rotation < params.root_rotations; ++rotation) {
+    director_repo.rotate(Uptane::Role::Root(), params.key_type);
+    image_repo.rotate(Uptane::Role::Root(), params.key_type);
+  }
+}
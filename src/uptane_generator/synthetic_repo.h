@@ -0,0 +1,51 @@
+#ifndef SYNTHETIC_REPO_H_
+#define SYNTHETIC_REPO_H_
+
+#include <cstdint>
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+#include "json/json.h"
+#include "libaktualizr/types.h"
+
+/**
+ * The shape of a synthetic repository, to benchmark the metadata handling of
+ * the client against fleets larger than those of the tests.
+ *
+ * Read from a JSON object with the names of the fields below, all optional,
+ * for instance {"seed": 7, "targets": 50000, "delegation_depth": 3,
+ * "delegation_width": 8, "ecus": 30, "root_rotations": 50}.
+ */
+struct SyntheticRepoParams {
+  /** The same seed gives the same targets, delegations and Director targets */
+  uint64_t seed{0};
+  /** Of all the keys, delegations included */
+  KeyType key_type{KeyType::kED25519};
+  /** Targets of the Image repo, spread over the delegations at the bottom of the tree */
+  unsigned int targets{1000};
+  /** Levels of delegations under the top-level Targets, 0 for none */
+  unsigned int delegation_depth{0};
+  /** Delegations of each role above the bottom level */
+  unsigned int delegation_width{1};
+  /** Distinct hardware IDs of the targets and ECUs */
+  unsigned int hardware_ids{1};
+  /** ECUs in the Director Targets, each with a target of its hardware ID */
+  unsigned int ecus{1};
+  /** Root rotations of both repos, each adding a version to the Root chain */
+  unsigned int root_rotations{0};
+  /** Size of the random string in the custom metadata of each target */
+  unsigned int custom_size{0};
+
+  static SyntheticRepoParams fromJson(const Json::Value &json);
+};
+
+/**
+ * Generate Director and Image repos at path, as generateRepo() does, and fill
+ * them as params say. The keys, hence the key IDs and signatures, differ from
+ * one run to the next; the rest of the metadata only depends on params.
+ */
+void generateSyntheticRepo(const boost::filesystem::path &path, const std::string &expires,
+                           const SyntheticRepoParams &params);
+
+#endif  // SYNTHETIC_REPO_H_
@@ -1,9 +1,12 @@
 
 #include "uptane_repo.h"
 
+#include "uptane/offline_bundle.h"
+#include "utilities/utils.h"
+
 UptaneRepo::UptaneRepo(const boost::filesystem::path &path, const std::string &expires,
                        const std::string &correlation_id)
-    : director_repo_(path, expires, correlation_id), image_repo_(path, expires, correlation_id) {}
+    : path_(path), director_repo_(path, expires, correlation_id), image_repo_(path, expires, correlation_id) {}
 
 void UptaneRepo::generateRepo(KeyType key_type) {
   director_repo_.generateRepo(key_type);
@@ -34,6 +37,10 @@ void UptaneRepo::addImage(const boost::filesystem::path &image_path, const boost
                           const Delegation &delegation, const Json::Value &custom) {
   image_repo_.addBinaryImage(image_path, targetname, hardware_id, url, custom_version, delegation, custom);
 }
+void UptaneRepo::addImages(const std::vector<ImageRepo::BinaryImage> &images, const Delegation &delegation,
+                           const unsigned int threads) {
+  image_repo_.addBinaryImages(images, delegation, threads);
+}
 void UptaneRepo::addCustomImage(const std::string &name, const Hash &hash, uint64_t length,
                                 const std::string &hardware_id, const std::string &url, const int32_t custom_version,
                                 const Delegation &delegation, const Json::Value &custom) {
@@ -60,3 +67,36 @@ void UptaneRepo::rotate(Uptane::RepositoryType repo_type, const Uptane::Role &ro
     image_repo_.rotate(role, key_type);
   }
 }
+
+// The metadata files of a repository, named as under its URL.
+static Uptane::MetaFiles readMetaFiles(const boost::filesystem::path &repo_dir) {
+  Uptane::MetaFiles files;
+  for (const std::string subdir : {"", "delegations"}) {
+    const auto dir = repo_dir / subdir;
+    if (!boost::filesystem::is_directory(dir)) {
+      continue;
+    }
+    for (const auto &entry : boost::filesystem::directory_iterator(dir)) {
+      if (boost::filesystem::is_regular_file(entry) && entry.path().extension() == ".json") {
+        const std::string name = entry.path().filename().string();
+        files[subdir.empty() ? name : subdir + "/" + name] = Utils::readFile(entry.path());
+      }
+    }
+  }
+  return files;
+}
+
+void UptaneRepo::writeOfflineBundle(const boost::filesystem::path &bundle) const {
+  const auto director_dir = path_ / DirectorRepo::dir;
+  const auto image_dir = path_ / ImageRepo::dir;
+  std::map<std::string, boost::filesystem::path> targets;
+  const Json::Value director_targets = Utils::parseJSONFile(director_dir / "targets.json")["signed"]["targets"];
+  for (auto it = director_targets.begin(); it != director_targets.end(); ++it) {
+    const auto image = image_dir / "targets" / it.name();
+    // Targets added without an image can't be bundled.
+    if (boost::filesystem::is_regular_file(image)) {
+      targets[it.name()] = image;
+    }
+  }
+  Uptane::OfflineBundle::write(bundle, readMetaFiles(director_dir), readMetaFiles(image_dir), targets);
+}
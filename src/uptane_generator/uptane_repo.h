@@ -13,6 +13,8 @@ class UptaneRepo {
   void addImage(const boost::filesystem::path &image_path, const boost::filesystem::path &targetname,
                 const std::string &hardware_id, const std::string &url = "", int32_t custom_version = 0,
                 const Delegation &delegation = {}, const Json::Value &custom = {});
+  void addImages(const std::vector<ImageRepo::BinaryImage> &images, const Delegation &delegation = {},
+                 unsigned int threads = 0);
   void addCustomImage(const std::string &name, const Hash &hash, uint64_t length, const std::string &hardware_id,
                       const std::string &url = "", int32_t custom_version = 0, const Delegation &delegation = {},
                       const Json::Value &custom = {});
@@ -25,8 +27,12 @@ class UptaneRepo {
   void generateCampaigns();
   void refresh(Uptane::RepositoryType repo_type, const Uptane::Role &role, const TimeStamp &expiry = TimeStamp());
   void rotate(Uptane::RepositoryType repo_type, const Uptane::Role &role, KeyType key_type = KeyType::kRSA2048);
+  // Write the metadata of both repositories and the images of the signed
+  // Director Targets to an offline bundle, see Uptane::OfflineBundle.
+  void writeOfflineBundle(const boost::filesystem::path &bundle) const;
 
  private:
+  boost::filesystem::path path_;
   DirectorRepo director_repo_;
   ImageRepo image_repo_;
 };
@@ -0,0 +1,52 @@
+#include "keypool.h"
+
+#include <future>
+#include <stdexcept>
+
+#include "crypto/crypto.h"
+#include "utilities/executor.h"
+
+namespace Primary {
+
+KeyPool& KeyPool::instance() {
+  static KeyPool pool;
+  return pool;
+}
+
+void KeyPool::generate(KeyType key_type, size_t count) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<KeyPair>& keys = keys_[key_type];
+  if (keys.size() >= count) {
+    return;
+  }
+
+  std::vector<std::future<KeyPair>> generated;
+  generated.reserve(count - keys.size());
+  for (size_t i = keys.size(); i < count; ++i) {
+    generated.push_back(Executor::cpu().submit([key_type]() {
+      KeyPair key_pair;
+      if (!Crypto::generateKeyPair(key_type, &key_pair.first, &key_pair.second)) {
+        throw std::runtime_error("Unable to generate a key pair for the key pool");
+      }
+      return key_pair;
+    }));
+  }
+  keys.reserve(count);
+  for (auto& key_pair : generated) {
+    keys.push_back(key_pair.get());
+  }
+}
+
+KeyPool::KeyPair KeyPool::get(KeyType key_type, size_t index) {
+  generate(key_type, index + 1);
+  std::lock_guard<std::mutex> lock(mutex_);
+  return keys_[key_type][index];
+}
+
+size_t KeyPool::size(KeyType key_type) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto found = keys_.find(key_type);
+  return found == keys_.end() ? 0 : found->second.size();
+}
+
+}  // namespace Primary
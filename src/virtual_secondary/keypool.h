@@ -0,0 +1,40 @@
+#ifndef PRIMARY_KEYPOOL_H_
+#define PRIMARY_KEYPOOL_H_
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libaktualizr/types.h"
+
+namespace Primary {
+
+/**
+ * Key pairs generated once per process and handed out by index, so that
+ * hundreds of virtual Secondaries don't each have to generate a key of their
+ * own. ECUs given the same index share the key pair, and so the key ID.
+ */
+class KeyPool {
+ public:
+  using KeyPair = std::pair<std::string, std::string>;  // public key, private key
+
+  static KeyPool& instance();
+
+  /** Generate the key pairs of key_type up to count, on the CPU threads. */
+  void generate(KeyType key_type, size_t count);
+  /** The key pair of key_type at index, generated first if needed. */
+  KeyPair get(KeyType key_type, size_t index);
+  size_t size(KeyType key_type) const;
+
+ private:
+  KeyPool() = default;
+
+  mutable std::mutex mutex_;
+  std::map<KeyType, std::vector<KeyPair>> keys_;
+};
+
+}  // namespace Primary
+
+#endif  // PRIMARY_KEYPOOL_H_
@@ -2,11 +2,13 @@
 
 #include <sys/stat.h>
 #include <unistd.h>
+#include <tuple>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
+#include "keypool.h"
 #include "logging/logging.h"
 #include "storage/invstorage.h"
 #include "uptane/directorrepository.h"
@@ -17,42 +19,55 @@
 
 namespace Primary {
 
-ManagedSecondary::ManagedSecondary(Primary::ManagedSecondaryConfig sconfig_in) : sconfig(std::move(sconfig_in)) {
-  struct stat stat_buf {};
-  if (!boost::filesystem::is_directory(sconfig.metadata_path)) {
-    Utils::createDirectories(sconfig.metadata_path, S_IRWXU);
-  }
-  if (stat(sconfig.metadata_path.c_str(), &stat_buf) < 0) {
-    throw std::runtime_error(std::string("Could not check metadata directory permissions: ") + std::strerror(errno));
-  }
-  if ((stat_buf.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
-    throw std::runtime_error("Secondary metadata directory has unsafe permissions");
-  }
+ManagedSecondary::ManagedSecondary(Primary::ManagedSecondaryConfig sconfig_in)
+    : sconfig(std::move(sconfig_in)), firmware_hash_(std_::make_unique<Uptane::ImageHashCache>()) {
+  if (!sconfig.in_memory) {
+    struct stat stat_buf {};
+    if (!boost::filesystem::is_directory(sconfig.metadata_path)) {
+      Utils::createDirectories(sconfig.metadata_path, S_IRWXU);
+    }
+    if (stat(sconfig.metadata_path.c_str(), &stat_buf) < 0) {
+      throw std::runtime_error(std::string("Could not check metadata directory permissions: ") + std::strerror(errno));
+    }
+    if ((stat_buf.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+      throw std::runtime_error("Secondary metadata directory has unsafe permissions");
+    }
 
-  if (!boost::filesystem::is_directory(sconfig.full_client_dir)) {
-    Utils::createDirectories(sconfig.full_client_dir, S_IRWXU);
-  }
-  if (stat(sconfig.full_client_dir.c_str(), &stat_buf) < 0) {
-    throw std::runtime_error(std::string("Could not check Secondary storage directory permissions: ") +
-                             std::strerror(errno));
-  }
-  if ((stat_buf.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
-    throw std::runtime_error("Secondary storage directory has unsafe permissions");
+    if (!boost::filesystem::is_directory(sconfig.full_client_dir)) {
+      Utils::createDirectories(sconfig.full_client_dir, S_IRWXU);
+    }
+    if (stat(sconfig.full_client_dir.c_str(), &stat_buf) < 0) {
+      throw std::runtime_error(std::string("Could not check Secondary storage directory permissions: ") +
+                               std::strerror(errno));
+    }
+    if ((stat_buf.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+      throw std::runtime_error("Secondary storage directory has unsafe permissions");
+    }
   }
 
   std::string public_key_string;
-  bool did_load_keys = loadKeys(&public_key_string, &private_key);
-  if (!did_load_keys) {
+  if (sconfig.key_pool_index >= 0) {
+    std::tie(public_key_string, private_key) =
+        KeyPool::instance().get(sconfig.key_type, static_cast<size_t>(sconfig.key_pool_index));
+  } else if (sconfig.in_memory || !loadKeys(&public_key_string, &private_key)) {
     bool generated_keys_ok = Crypto::generateKeyPair(sconfig.key_type, &public_key_string, &private_key);
     if (!generated_keys_ok) {
       LOG_ERROR << "Could not generate RSA keys for secondary " << ManagedSecondary::getSerial() << "@"
                 << sconfig.ecu_hardware_id;
       throw std::runtime_error("Unable to generate secondary RSA keys");
     }
-    storeKeys(public_key_string, private_key);
+    if (!sconfig.in_memory) {
+      storeKeys(public_key_string, private_key);
+    }
   }
   public_key_ = PublicKey(public_key_string, sconfig.key_type);
+  if (Crypto::IsRsaKeyType(sconfig.key_type)) {
+    signing_key_ = Crypto::parsePrivateKey(private_key);
+  }
 
+  if (sconfig.in_memory) {
+    storage_config_.type = StorageType::kMemory;
+  }
   storage_config_.path = sconfig.full_client_dir;
   storage_ = INvStorage::newStorage(storage_config_);
 
@@ -178,11 +193,21 @@ data::InstallationResult ManagedSecondary::install(const Uptane::Target &target,
   }
 
   // TODO: check that the target is actually valid.
-  auto str = secondary_provider_->getTargetFileHandle(target);
-  std::ofstream out_file(sconfig.firmware_path.string(), std::ios::binary);
-  out_file << str.rdbuf();
-  str.close();
-  out_file.close();
+  const std::string target_path = secondary_provider_->getTargetFilePath(target);
+  if (target_path.empty()) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInternalError,
+                                    "File doesn't exist for target " + target.filename());
+  }
+  if (sconfig.in_memory) {
+    // The Primary has checked the file against the target already
+    installed_image_ = target.getTargetImageInfo();
+    return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
+  }
+  try {
+    Utils::copyFile(target_path, sconfig.firmware_path);
+  } catch (const std::exception &e) {
+    return data::InstallationResult(data::ResultCode::Numeric::kInstallFailed, e.what());
+  }
 
   Utils::writeFile(sconfig.target_name_path, target.filename());
   return data::InstallationResult(data::ResultCode::Numeric::kOk, "");
@@ -202,7 +227,9 @@ Uptane::Manifest ManagedSecondary::getManifest() const {
 
   Json::Value signed_ecu_version;
 
-  std::string b64sig = Utils::toBase64(Crypto::RSAPSSSign(nullptr, private_key, Utils::jsonToCanonicalStr(manifest)));
+  const std::string canonical = Utils::jsonToCanonicalStr(manifest);
+  std::string b64sig = Utils::toBase64(signing_key_ != nullptr ? Crypto::RSAPSSSign(signing_key_.get(), canonical)
+                                                               : Crypto::RSAPSSSign(nullptr, private_key, canonical));
   Json::Value signature;
   signature["method"] = "rsassa-pss";
   signature["sig"] = b64sig;
@@ -216,17 +243,24 @@ Uptane::Manifest ManagedSecondary::getManifest() const {
 }
 
 bool ManagedSecondary::getFirmwareInfo(Uptane::InstalledImageInfo &firmware_info) const {
-  std::string content;
-
-  if (!boost::filesystem::exists(sconfig.target_name_path) || !boost::filesystem::exists(sconfig.firmware_path)) {
+  if (sconfig.in_memory) {
+    if (installed_image_.name.empty()) {
+      firmware_info.name = std::string("noimage");
+      firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
+      firmware_info.len = 0;
+    } else {
+      firmware_info = installed_image_;
+    }
+    return true;
+  }
+  if (!boost::filesystem::exists(sconfig.target_name_path) ||
+      !firmware_hash_->get(sconfig.firmware_path, &firmware_info.hash, &firmware_info.len)) {
     firmware_info.name = std::string("noimage");
-    content = "";
+    firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr("");
+    firmware_info.len = 0;
   } else {
     firmware_info.name = Utils::readFile(sconfig.target_name_path.string());
-    content = Utils::readFile(sconfig.firmware_path.string());
   }
-  firmware_info.hash = Uptane::ManifestIssuer::generateVersionHashStr(content);
-  firmware_info.len = content.size();
 
   return true;
 }
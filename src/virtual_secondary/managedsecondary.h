@@ -2,15 +2,18 @@
 #define PRIMARY_MANAGEDSECONDARY_H_
 
 #include <future>
+#include <memory>
 #include <string>
 #include <vector>
 
+#include <openssl/ossl_typ.h>
 #include <boost/filesystem/path.hpp>
 #include "json/json.h"
 
 #include "libaktualizr/secondaryinterface.h"
 #include "libaktualizr/types.h"
 #include "primary/secondary_config.h"
+#include "uptane/image_hash_cache.h"
 #include "uptane/secondary_metadata.h"
 
 namespace Uptane {
@@ -36,6 +39,10 @@ class ManagedSecondaryConfig : public SecondaryConfig {
   boost::filesystem::path target_name_path;
   boost::filesystem::path metadata_path;
   KeyType key_type{KeyType::kRSA2048};
+  // Keep the metadata, firmware and keys in memory only; the paths above are not used
+  bool in_memory{false};
+  // Take the key pair at this index of the process-wide KeyPool instead of a key of its own
+  int key_pool_index{-1};
 };
 
 // ManagedSecondary is an abstraction over virtual and other types of legacy
@@ -93,8 +100,14 @@ class ManagedSecondary : public SecondaryInterface {
   std::unique_ptr<Uptane::ImageRepository> image_repo_;
   PublicKey public_key_;
   std::string private_key;
+  // private_key parsed once, to sign the manifests
+  std::shared_ptr<EVP_PKEY> signing_key_;
   StorageConfig storage_config_;
   std::shared_ptr<INvStorage> storage_;
+  // Hash of the firmware, read again only when the file changed
+  std::unique_ptr<Uptane::ImageHashCache> firmware_hash_;
+  // The installed firmware when in memory
+  Uptane::InstalledImageInfo installed_image_;
 };
 
 }  // namespace Primary
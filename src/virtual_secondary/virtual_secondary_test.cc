@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include "httpfake.h"
+#include "keypool.h"
 #include "libaktualizr/secondaryinterface.h"
 #include "uptane_repo.h"
 #include "uptane_test_common.h"
@@ -124,6 +125,74 @@ TEST_F(VirtualSecondaryTest, GeneratesPublicKey) {
   EXPECT_EQ(old_priv_key, new_priv_key);
 }
 
+/* The key pool generates each key pair once and hands it out by index. */
+TEST(VirtualSecondary, KeyPool) {
+  auto &pool = Primary::KeyPool::instance();
+  pool.generate(KeyType::kRSA2048, 2);
+  EXPECT_GE(pool.size(KeyType::kRSA2048), 2);
+  const auto first = pool.get(KeyType::kRSA2048, 0);
+  EXPECT_EQ(pool.get(KeyType::kRSA2048, 0), first);
+  EXPECT_NE(pool.get(KeyType::kRSA2048, 1), first);
+  EXPECT_FALSE(first.first.empty());
+  EXPECT_FALSE(first.second.empty());
+}
+
+/*
+ * Generated Secondaries keep everything in memory, take their keys from the
+ * pool and survive a round trip through the config file.
+ */
+TEST(VirtualSecondary, ScaleMode) {
+  TemporaryDirectory temp_dir;
+  const auto configs = Primary::VirtualSecondaryConfig::generate(200, "scale_serial", "scale_hw", 4);
+  ASSERT_EQ(configs.size(), 200);
+  EXPECT_GE(Primary::KeyPool::instance().size(KeyType::kRSA2048), 4);
+
+  const boost::filesystem::path config_file = temp_dir / "virtual_secondary_conf.json";
+  Primary::VirtualSecondaryConfig::dumpAll(configs, config_file);
+  const auto parsed = Primary::VirtualSecondaryConfig::create_from_file(config_file);
+  ASSERT_EQ(parsed.size(), 200);
+  EXPECT_EQ(parsed[199].ecu_serial, "scale_serial199");
+  EXPECT_EQ(parsed[199].ecu_hardware_id, "scale_hw");
+  EXPECT_TRUE(parsed[199].in_memory);
+  EXPECT_EQ(parsed[199].key_pool_index, 3);
+
+  std::vector<std::unique_ptr<Primary::VirtualSecondary>> secondaries;
+  for (const auto &config : parsed) {
+    secondaries.push_back(std_::make_unique<Primary::VirtualSecondary>(config));
+  }
+  EXPECT_EQ(secondaries[1]->getPublicKey(), secondaries[5]->getPublicKey());
+  EXPECT_NE(secondaries[0]->getPublicKey(), secondaries[1]->getPublicKey());
+  const Json::Value manifest = secondaries[0]->getManifest();
+  EXPECT_EQ(manifest["signed"]["ecu_serial"].asString(), "scale_serial0");
+  EXPECT_EQ(manifest["signed"]["installed_image"]["filepath"].asString(), "noimage");
+  EXPECT_EQ(manifest["signatures"][0]["keyid"].asString(), secondaries[0]->getPublicKey().KeyId());
+
+  // Nothing but the config file on disk
+  EXPECT_EQ(std::distance(boost::filesystem::directory_iterator(temp_dir.Path()),
+                          boost::filesystem::directory_iterator()),
+            1);
+}
+
+/* A Primary registers and reports on a hundred in-memory Secondaries. */
+TEST(VirtualSecondary, ScalePrimary) {
+  TemporaryDirectory temp_dir;
+  TemporaryDirectory meta_dir;
+  auto http = std::make_shared<HttpFake>(temp_dir.Path(), "noupdates", meta_dir.Path());
+  Config conf = UptaneTestCommon::makeTestConfig(temp_dir, http->tls_server);
+  UptaneTestCommon::addScaleSecondaries(conf, temp_dir, 100, "scale_hw", 8);
+  auto storage = INvStorage::newStorage(conf.storage);
+
+  UptaneTestCommon::TestAktualizr aktualizr(conf, storage, http);
+  aktualizr.Initialize();
+  EcuSerials serials;
+  ASSERT_TRUE(storage->loadEcuSerials(&serials));
+  EXPECT_EQ(serials.size(), 101);
+
+  aktualizr.uptane_client()->putManifest();
+  EXPECT_EQ(http->last_manifest["signed"]["ecu_version_manifests"].size(), 101);
+  EXPECT_TRUE(http->last_manifest["signed"]["ecu_version_manifests"].isMember("scale_serial99"));
+}
+
 #ifdef FIU_ENABLE
 
 #include "utilities/fault_injection.h"
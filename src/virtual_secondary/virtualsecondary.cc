@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <fstream>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/filesystem.hpp>
 
 #include "crypto/crypto.h"
+#include "keypool.h"
 #include "utilities/fault_injection.h"
 #include "utilities/utils.h"
 #include "virtualsecondary.h"
@@ -20,6 +22,10 @@ VirtualSecondaryConfig::VirtualSecondaryConfig(const Json::Value& json_config) :
   firmware_path = json_config["firmware_path"].asString();
   target_name_path = json_config["target_name_path"].asString();
   metadata_path = json_config["metadata_path"].asString();
+  in_memory = json_config["in_memory"].asBool();
+  if (json_config.isMember("key_pool_index")) {
+    key_pool_index = json_config["key_pool_index"].asInt();
+  }
 }
 
 std::vector<VirtualSecondaryConfig> VirtualSecondaryConfig::create_from_file(
@@ -38,7 +44,22 @@ std::vector<VirtualSecondaryConfig> VirtualSecondaryConfig::create_from_file(
   return sec_configs;
 }
 
-void VirtualSecondaryConfig::dump(const boost::filesystem::path& file_full_path) const {
+namespace {
+
+void writeConfigFile(const Json::Value& root, const boost::filesystem::path& file_full_path) {
+  Json::StreamWriterBuilder json_bwriter;
+  json_bwriter["indentation"] = "\t";
+  std::unique_ptr<Json::StreamWriter> const json_writer(json_bwriter.newStreamWriter());
+
+  boost::filesystem::create_directories(file_full_path.parent_path());
+  std::ofstream json_file(file_full_path.string());
+  json_writer->write(root, &json_file);
+  json_file.close();
+}
+
+}  // namespace
+
+Json::Value VirtualSecondaryConfig::toJson() const {
   Json::Value json_config;
 
   json_config["partial_verifying"] = partial_verifying;
@@ -50,22 +71,50 @@ void VirtualSecondaryConfig::dump(const boost::filesystem::path& file_full_path)
   json_config["firmware_path"] = firmware_path.string();
   json_config["target_name_path"] = target_name_path.string();
   json_config["metadata_path"] = metadata_path.string();
+  if (in_memory) {
+    json_config["in_memory"] = true;
+  }
+  if (key_pool_index >= 0) {
+    json_config["key_pool_index"] = key_pool_index;
+  }
+  return json_config;
+}
 
+void VirtualSecondaryConfig::dump(const boost::filesystem::path& file_full_path) const {
   Json::Value root;
   // Append to the config file if it already exists.
   if (boost::filesystem::exists(file_full_path)) {
     root = Utils::parseJSONFile(file_full_path);
   }
-  root[Type].append(json_config);
+  root[Type].append(toJson());
+  writeConfigFile(root, file_full_path);
+}
 
-  Json::StreamWriterBuilder json_bwriter;
-  json_bwriter["indentation"] = "\t";
-  std::unique_ptr<Json::StreamWriter> const json_writer(json_bwriter.newStreamWriter());
+std::vector<VirtualSecondaryConfig> VirtualSecondaryConfig::generate(size_t count, const std::string& serial_prefix,
+                                                                     const std::string& hardware_id,
+                                                                     size_t key_pool_size) {
+  std::vector<VirtualSecondaryConfig> configs(count);
+  for (size_t i = 0; i < count; ++i) {
+    configs[i].ecu_serial = serial_prefix + std::to_string(i);
+    configs[i].ecu_hardware_id = hardware_id;
+    configs[i].in_memory = true;
+    configs[i].key_pool_index = static_cast<int>(key_pool_size == 0 ? i : i % key_pool_size);
+  }
+  // Generate the keys in parallel up front rather than one by one as the Secondaries start
+  if (count > 0) {
+    KeyPool::instance().generate(configs[0].key_type, key_pool_size == 0 ? count : std::min(count, key_pool_size));
+  }
+  return configs;
+}
 
-  boost::filesystem::create_directories(file_full_path.parent_path());
-  std::ofstream json_file(file_full_path.string());
-  json_writer->write(root, &json_file);
-  json_file.close();
+void VirtualSecondaryConfig::dumpAll(const std::vector<VirtualSecondaryConfig>& configs,
+                                     const boost::filesystem::path& file_full_path) {
+  Json::Value root;
+  root[Type] = Json::Value(Json::arrayValue);
+  for (const auto& config : configs) {
+    root[Type].append(config.toJson());
+  }
+  writeConfigFile(root, file_full_path);
 }
 
 VirtualSecondary::VirtualSecondary(Primary::VirtualSecondaryConfig sconfig_in)
@@ -17,6 +17,19 @@ class VirtualSecondaryConfig : public ManagedSecondaryConfig {
 
   static std::vector<VirtualSecondaryConfig> create_from_file(const boost::filesystem::path& file_full_path);
   void dump(const boost::filesystem::path& file_full_path) const;
+  Json::Value toJson() const;
+
+  /**
+   * Configurations for count in-memory Secondaries, to profile a Primary with
+   * many ECUs. The serials are serial_prefix followed by the index, and the
+   * keys come from the KeyPool, each ECU a key of its own if key_pool_size is
+   * 0 or else shared round-robin between that many key pairs.
+   */
+  static std::vector<VirtualSecondaryConfig> generate(size_t count, const std::string& serial_prefix,
+                                                      const std::string& hardware_id, size_t key_pool_size = 0);
+  /** Write the configurations to a new Secondary config file, in one go. */
+  static void dumpAll(const std::vector<VirtualSecondaryConfig>& configs,
+                      const boost::filesystem::path& file_full_path);
 };
 
 class VirtualSecondary : public ManagedSecondary {
@@ -1,18 +1,99 @@
-#include <boost/filesystem.hpp>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
 
+#include "http/http_replay.h"
 #include "libaktualizr/aktualizr.h"
 #include "libaktualizr/config.h"
 #include "logging/logging.h"
 #include "storage/sqlstorage.h"
+#include "utilities/time_distribution.h"
+#include "utilities/utils.h"
+
+/*
+ * Provision a device, then update it and finalize the update after a "reboot",
+ * against a server with fake package management.
+ *
+ * With --cycles and --devices, the update is timed as a benchmark: each of the
+ * devices runs the cycles one after the other, all devices at the same time,
+ * each cycle on a fresh storage. The percentiles of the time of each phase,
+ * the CPU time, the peak RSS and the bytes transferred are then printed, and
+ * written as JSON to the --report file.
+ *
+ * The HTTP traffic of a cycle can be recorded with --record, and then played
+ * back with --replay instead of the server, e.g. to profile the client
+ * without the noise of the network.
+ */
+
+namespace po = boost::program_options;
+
+namespace {
+
+enum Phase { kInitialize = 0, kCheck, kDownload, kInstall, kFinalize, kCycle, kPhases };
+const std::array<const char *, kPhases> kPhaseNames{"initialize", "check", "download", "install", "finalize", "cycle"};
 
-int updateOneCycle(const boost::filesystem::path &storage_dir, const std::string &server) {
+// Seconds taken by each phase of a cycle, negative for the phases that did not run
+using PhaseTimes = std::array<double, kPhases>;
+
+class PhaseTimer {
+ public:
+  PhaseTimer(PhaseTimes *times, Phase phase) : times_{times}, phase_{phase} {}
+  ~PhaseTimer() {
+    (*times_)[phase_] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer(PhaseTimer &&) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(PhaseTimer &&) = delete;
+
+ private:
+  PhaseTimes *times_;
+  Phase phase_;
+  std::chrono::steady_clock::time_point start_{std::chrono::steady_clock::now()};
+};
+
+struct CycleOptions {
+  PackageConfig pacman;
+  boost::filesystem::path record_file;
+  // Answer the requests with this recorded traffic instead of the server
+  boost::filesystem::path replay_file;
+  HttpReplay::Timing replay_timing{HttpReplay::Timing::kRecorded};
+};
+
+class ReplayAktualizr : public Aktualizr {
+ public:
+  ReplayAktualizr(const Config &config, const std::shared_ptr<HttpInterface> &http)
+      : Aktualizr(config, INvStorage::newStorage(config.storage), http) {}
+};
+
+std::unique_ptr<Aktualizr> newAktualizr(const Config &conf, const std::shared_ptr<HttpReplay> &replay) {
+  if (replay) {
+    return std_::make_unique<ReplayAktualizr>(conf, replay);
+  }
+  return std_::make_unique<Aktualizr>(conf);
+}
+
+int updateOneCycle(const boost::filesystem::path &storage_dir, const std::string &server, const std::string &device_id,
+                   const CycleOptions &options, PhaseTimes *times) {
   Config conf;
+  conf.pacman = options.pacman;
   conf.pacman.type = PACKAGE_MANAGER_NONE;
   conf.pacman.fake_need_reboot = true;
-  conf.provision.device_id = "device_id";
+  conf.provision.device_id = device_id;
   conf.provision.ecu_registration_endpoint = server + "/director/ecus";
   conf.tls.server = server;
   conf.uptane.director_server = server + "/director";
@@ -24,27 +105,49 @@ int updateOneCycle(const boost::filesystem::path &storage_dir, const std::string
   conf.provision.primary_ecu_hardware_id = "primary_hw";
   conf.storage.path = storage_dir;
   conf.bootloader.reboot_sentinel_dir = storage_dir;
+  conf.network.record_file = options.record_file;
   conf.postUpdateValues();
-  logger_set_threshold(boost::log::trivial::debug);
 
+  std::shared_ptr<HttpReplay> replay;
+  if (!options.replay_file.empty()) {
+    replay = std::make_shared<HttpReplay>(options.replay_file, options.replay_timing);
+  }
+
+  times->fill(-1);
+  PhaseTimer cycle_timer(times, kCycle);
   {
-    Aktualizr aktualizr(conf);
+    auto aktualizr = newAktualizr(conf, replay);
 
-    aktualizr.Initialize();
+    {
+      PhaseTimer timer(times, kInitialize);
+      aktualizr->Initialize();
+    }
 
-    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    result::UpdateCheck update_result;
+    {
+      PhaseTimer timer(times, kCheck);
+      update_result = aktualizr->CheckUpdates().get();
+    }
     if (update_result.status != result::UpdateStatus::kUpdatesAvailable) {
       LOG_ERROR << "no update available";
       return 0;
     }
 
-    result::Download download_result = aktualizr.Download(update_result.updates).get();
+    result::Download download_result;
+    {
+      PhaseTimer timer(times, kDownload);
+      download_result = aktualizr->Download(update_result.updates).get();
+    }
     if (download_result.status != result::DownloadStatus::kSuccess) {
       LOG_ERROR << "download failed";
       return 1;
     }
 
-    result::Install install_result = aktualizr.Install(update_result.updates).get();
+    result::Install install_result;
+    {
+      PhaseTimer timer(times, kInstall);
+      install_result = aktualizr->Install(update_result.updates).get();
+    }
     if (install_result.ecu_reports.size() != 1) {
       LOG_ERROR << "install failed";
       return 1;
@@ -58,11 +161,12 @@ int updateOneCycle(const boost::filesystem::path &storage_dir, const std::string
   boost::filesystem::remove(conf.bootloader.reboot_sentinel_dir / conf.bootloader.reboot_sentinel_name);
 
   {
-    Aktualizr aktualizr(conf);
+    PhaseTimer timer(times, kFinalize);
+    auto aktualizr = newAktualizr(conf, replay);
 
-    aktualizr.Initialize();
+    aktualizr->Initialize();
 
-    result::UpdateCheck update_result = aktualizr.CheckUpdates().get();
+    result::UpdateCheck update_result = aktualizr->CheckUpdates().get();
     if (update_result.status != result::UpdateStatus::kNoUpdatesAvailable) {
       LOG_ERROR << "finalize failed";
       return 1;
@@ -72,16 +176,215 @@ int updateOneCycle(const boost::filesystem::path &storage_dir, const std::string
   return 0;
 }
 
+// The value at quantile q of sorted values, by the nearest rank
+double quantile(const std::vector<double> &sorted, double q) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  const auto rank = static_cast<size_t>(std::ceil(q * static_cast<double>(sorted.size())));
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+uint64_t counterValue(const Json::Value &metrics, const std::string &name) {
+  uint64_t total = 0;
+  for (const auto &series : metrics[name]["series"]) {
+    total += series["value"].asUInt64();
+  }
+  return total;
+}
+
+Json::Value report(const std::vector<PhaseTimes> &cycles, unsigned int failures,
+                   std::chrono::steady_clock::duration elapsed) {
+  Json::Value result;
+  result["cycles"] = static_cast<Json::UInt64>(cycles.size());
+  result["failures"] = failures;
+  result["wall_seconds"] = std::chrono::duration<double>(elapsed).count();
+  for (size_t phase = 0; phase < kPhases; ++phase) {
+    std::vector<double> times;
+    for (const auto &cycle : cycles) {
+      if (cycle[phase] >= 0) {
+        times.push_back(cycle[phase]);
+      }
+    }
+    std::sort(times.begin(), times.end());
+    Json::Value &summary = result["phases"][kPhaseNames[phase]];
+    summary["count"] = static_cast<Json::UInt64>(times.size());
+    summary["p50_seconds"] = quantile(times, 0.5);
+    summary["p95_seconds"] = quantile(times, 0.95);
+    summary["p99_seconds"] = quantile(times, 0.99);
+    summary["max_seconds"] = quantile(times, 1.0);
+  }
+
+  rusage usage{};
+  getrusage(RUSAGE_SELF, &usage);
+  const auto seconds = [](const timeval &tv) {
+    return static_cast<double>(tv.tv_sec) + static_cast<double>(tv.tv_usec) / 1e6;
+  };
+  result["cpu_user_seconds"] = seconds(usage.ru_utime);
+  result["cpu_system_seconds"] = seconds(usage.ru_stime);
+  result["peak_rss_kib"] = static_cast<Json::Int64>(usage.ru_maxrss);
+
+  const Json::Value metrics = Aktualizr::GetMetrics();
+  result["downloaded_bytes"] =
+      static_cast<Json::UInt64>(counterValue(metrics, "aktualizr_http_downloaded_bytes_total"));
+  result["uploaded_bytes"] = static_cast<Json::UInt64>(counterValue(metrics, "aktualizr_http_uploaded_bytes_total"));
+  Json::UInt64 requests = 0;
+  for (const auto &series : metrics["aktualizr_http_request_duration_seconds"]["series"]) {
+    requests += series["count"].asUInt64();
+  }
+  result["http_requests"] = requests;
+  Json::UInt64 statements = 0;
+  for (const auto &series : metrics["aktualizr_sqlite_duration_seconds"]["series"]) {
+    statements += series["count"].asUInt64();
+  }
+  result["sqlite_statements"] = statements;
+  result["sqlite_statements_per_cycle"] =
+      cycles.empty() ? 0. : static_cast<double>(statements) / static_cast<double>(cycles.size());
+  return result;
+}
+
+void printReport(const Json::Value &result) {
+  std::cout << result["cycles"].asUInt64() << " cycles, " << result["failures"].asUInt() << " failed, in "
+            << result["wall_seconds"].asDouble() << " s\n";
+  std::cout << std::left << std::setw(12) << "phase" << std::right << std::setw(8) << "count" << std::setw(12)
+            << "p50 ms" << std::setw(12) << "p95 ms" << std::setw(12) << "p99 ms" << "\n";
+  std::cout << std::fixed << std::setprecision(1);
+  for (const char *name : kPhaseNames) {
+    const Json::Value &summary = result["phases"][name];
+    std::cout << std::left << std::setw(12) << name << std::right << std::setw(8) << summary["count"].asUInt64()
+              << std::setw(12) << summary["p50_seconds"].asDouble() * 1e3 << std::setw(12)
+              << summary["p95_seconds"].asDouble() * 1e3 << std::setw(12) << summary["p99_seconds"].asDouble() * 1e3
+              << "\n";
+  }
+  std::cout << std::defaultfloat;
+  std::cout << "CPU time: " << result["cpu_user_seconds"].asDouble() << " s user, "
+            << result["cpu_system_seconds"].asDouble() << " s system\n";
+  std::cout << "Peak RSS: " << result["peak_rss_kib"].asInt64() << " KiB\n";
+  std::cout << "Transferred: " << result["downloaded_bytes"].asUInt64() << " bytes down, "
+            << result["uploaded_bytes"].asUInt64() << " bytes up, in " << result["http_requests"].asUInt64()
+            << " requests\n";
+  std::cout << "SQLite: " << result["sqlite_statements_per_cycle"].asDouble() << " statements per cycle\n";
+}
+
+}  // namespace
+
 int main(int argc, char **argv) {
   logger_init();
 
-  if (argc != 3) {
+  po::options_description desc("aktualizr-cycle-simple command line options");
+  // clang-format off
+  desc.add_options()
+    ("help,h", "print usage")
+    ("storage-dir", po::value<boost::filesystem::path>(), "path to the storage directory")
+    ("server", po::value<std::string>(), "url of the Uptane server")
+    ("cycles,n", po::value<unsigned int>()->default_value(1), "update cycles run by each device")
+    ("devices,j", po::value<unsigned int>()->default_value(1), "devices updated at the same time")
+    ("loglevel", po::value<int>()->default_value(1), "log level 0-5 (trace, debug, info, warning, error, fatal)")
+    ("fetch-time", po::value<std::string>(), "least time a download takes, as S, fixed:S, uniform:MIN:MAX or exponential:MEAN in seconds")
+    ("fetch-time-per-mib", po::value<std::string>(), "least time a download takes for each MiB of the target")
+    ("install-time", po::value<std::string>(), "time an installation takes")
+    ("install-time-per-mib", po::value<std::string>(), "time an installation takes for each MiB of the target")
+    ("finalize-time", po::value<std::string>(), "time the finalization after the reboot takes")
+    ("record", po::value<boost::filesystem::path>(), "append the HTTP traffic to this file, with one device and cycle only")
+    ("replay", po::value<boost::filesystem::path>(), "answer the requests of each cycle with the traffic recorded with --record against the same server url, instead of the server")
+    ("replay-fast", "with --replay, answer the requests at once instead of taking the recorded times")
+    ("report", po::value<boost::filesystem::path>(), "write the measurements to this file, as JSON");
+  // clang-format on
+  po::positional_options_description positional;
+  positional.add("storage-dir", 1);
+  positional.add("server", 1);
+
+  po::variables_map vm;
+  try {
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(positional).run(), vm);
+    po::notify(vm);
+  } catch (const po::error &e) {
+    std::cerr << "Error: " << e.what() << "\n" << desc;
+    return EXIT_FAILURE;
+  }
+  if (vm.count("help") != 0) {
+    std::cout << desc;
+    return EXIT_SUCCESS;
+  }
+  if (vm.count("storage-dir") == 0 || vm.count("server") == 0) {
     std::cerr << "Error: " << argv[0] << " requires the path to the storage directory "
               << "and url of uptane server\n";
     return EXIT_FAILURE;
   }
-  boost::filesystem::path storage_dir = argv[1];
-  std::string server = argv[2];
+  const boost::filesystem::path storage_dir = vm["storage-dir"].as<boost::filesystem::path>();
+  const std::string server = vm["server"].as<std::string>();
+  const unsigned int cycles = std::max(1U, vm["cycles"].as<unsigned int>());
+  const unsigned int devices = std::max(1U, vm["devices"].as<unsigned int>());
+  logger_set_threshold(static_cast<boost::log::trivial::severity_level>(vm["loglevel"].as<int>()));
+  CycleOptions options;
+  PackageConfig &pacman = options.pacman;
+  for (const auto &option : {std::make_pair("fetch-time", &pacman.fake_fetch_time),
+                             std::make_pair("fetch-time-per-mib", &pacman.fake_fetch_time_per_mib),
+                             std::make_pair("install-time", &pacman.fake_install_time),
+                             std::make_pair("install-time-per-mib", &pacman.fake_install_time_per_mib),
+                             std::make_pair("finalize-time", &pacman.fake_finalize_time)}) {
+    if (vm.count(option.first) != 0) {
+      *option.second = vm[option.first].as<std::string>();
+      try {
+        TimeDistribution::parse(*option.second);
+      } catch (const std::invalid_argument &e) {
+        std::cerr << "Error: " << e.what() << " in --" << option.first << "\n";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  if (vm.count("record") != 0) {
+    if (vm.count("replay") != 0 || cycles != 1 || devices != 1) {
+      std::cerr << "Error: --record only records one cycle of one device, against the server\n";
+      return EXIT_FAILURE;
+    }
+    options.record_file = vm["record"].as<boost::filesystem::path>();
+  }
+  if (vm.count("replay") != 0) {
+    options.replay_file = vm["replay"].as<boost::filesystem::path>();
+    if (vm.count("replay-fast") != 0) {
+      options.replay_timing = HttpReplay::Timing::kNone;
+    }
+  }
+
+  if (cycles == 1 && devices == 1 && vm.count("report") == 0) {
+    PhaseTimes times{};
+    return updateOneCycle(storage_dir, server, "device_id", options, &times);
+  }
 
-  return updateOneCycle(storage_dir, server);
+  std::mutex mutex;
+  std::vector<PhaseTimes> results;
+  unsigned int failures = 0;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned int device = 0; device < devices; ++device) {
+    threads.emplace_back([&, device]() {
+      const std::string device_id = "device_id-" + std::to_string(device);
+      for (unsigned int cycle = 0; cycle < cycles; ++cycle) {
+        const boost::filesystem::path dir = storage_dir / (device_id + "-" + std::to_string(cycle));
+        boost::filesystem::remove_all(dir);
+        PhaseTimes times{};
+        const int res = updateOneCycle(dir, server, device_id, options, &times);
+        std::lock_guard<std::mutex> lock(mutex);
+        results.push_back(times);
+        if (res != 0) {
+          // Kept to look into
+          ++failures;
+        } else {
+          boost::filesystem::remove_all(dir);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  const Json::Value result = report(results, failures, std::chrono::steady_clock::now() - start);
+  printReport(result);
+  if (vm.count("report") != 0) {
+    Utils::writeFile(vm["report"].as<boost::filesystem::path>(), Utils::jsonToStr(result) + "\n");
+  }
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
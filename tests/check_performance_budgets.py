@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import re
+import subprocess
+import sys
+import tempfile
+
+from os import path
+
+
+"""
+Run the benchmarks named in a budgets file and fail if any of their results
+is out of its budget.
+
+The budgets file holds, for one platform, the longest time of each
+micro-benchmark of aktualizr_benchmarks ("micro_benchmarks"), and the
+limits of the results of the update cycle benchmark ("update_cycle") and of
+the Secondary transfer benchmark ("secondary_transfer"), given by their path
+in the JSON report, e.g. "phases.cycle.p95_seconds". Each of these is only
+run if it has budgets. With --write-budgets, the results are written as a
+new budgets file instead, with some headroom, to start the budgets of a
+platform from.
+"""
+
+BUDGETS_FORMAT = 1
+
+
+def lookup(report, key):
+    value = report
+    for part in key.split('.'):
+        if not isinstance(value, dict) or part not in value:
+            return None
+        value = value[part]
+    return value
+
+
+def check_limits(suite, report, limits, failures):
+    for key, limit in limits.get('max', {}).items():
+        value = lookup(report, key)
+        if value is None:
+            failures.append(f'{suite}: no result for {key}')
+        elif value > limit:
+            failures.append(f'{suite}: {key} is {value:.4g}, over the budget of {limit:.4g}')
+    for key, limit in limits.get('min', {}).items():
+        value = lookup(report, key)
+        if value is None:
+            failures.append(f'{suite}: no result for {key}')
+        elif value < limit:
+            failures.append(f'{suite}: {key} is {value:.4g}, under the budget of {limit:.4g}')
+
+
+def with_headroom(report, limits, headroom):
+    result = {k: v for k, v in limits.items() if k not in ('max', 'min')}
+    for bound, factor in (('max', headroom), ('min', 1 / headroom)):
+        values = {key: lookup(report, key) for key in limits.get(bound, {})}
+        if values:
+            result[bound] = {key: round(value * factor, 6) for key, value in values.items() if value is not None}
+    return result
+
+
+def run_micro_benchmarks(benchmarks, names, work_dir):
+    """The real time in microseconds of each of the named micro-benchmarks"""
+    out = path.join(work_dir, 'micro.json')
+    name_filter = '^(' + '|'.join(re.escape(name) for name in names) + ')$'
+    subprocess.run([benchmarks, f'--benchmark_filter={name_filter}', f'--benchmark_out={out}',
+                    '--benchmark_out_format=json'], check=True)
+    with open(out) as f:
+        results = json.load(f)
+    to_us = {'ns': 1e-3, 'us': 1, 'ms': 1e3, 's': 1e6}
+    times = {}
+    for benchmark in results['benchmarks']:
+        if benchmark.get('run_type', 'iteration') == 'iteration' and 'error_occurred' not in benchmark:
+            times[benchmark['name']] = benchmark['real_time'] * to_us[benchmark['time_unit']]
+    return times
+
+
+def run_update_cycle(args, suite, work_dir):
+    out = path.join(work_dir, 'cycle.json')
+    subprocess.run([path.join(path.dirname(path.abspath(__file__)), 'run_cycle_benchmark.py'),
+                    '--uptane-gen', args.uptane_gen, '--akt-test', args.akt_test, '--akt-srcdir', args.akt_srcdir,
+                    '--report', out, *suite.get('args', [])], check=True)
+    with open(out) as f:
+        return json.load(f)
+
+
+def run_secondary_transfer(args, suite, work_dir):
+    out = path.join(work_dir, 'transfer.json')
+    subprocess.run([args.secondary_transfer, '--report', out, *suite.get('args', [])], check=True)
+    with open(out) as f:
+        return json.load(f)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Check the benchmarks against the performance budgets of a platform')
+    parser.add_argument('--budgets', required=True, help='budgets file of the platform')
+    parser.add_argument('--benchmarks', help='path to aktualizr_benchmarks')
+    parser.add_argument('--secondary-transfer', help='path to aktualizr-secondary-transfer-benchmark')
+    parser.add_argument('--uptane-gen', help='path to uptane-generator executable')
+    parser.add_argument('--akt-test', help='path to aktualizr-cycle-simple')
+    parser.add_argument('--akt-srcdir', default='.', help='path to the aktualizr source directory')
+    parser.add_argument('--write-budgets', help='write the results to this budgets file instead of checking them')
+    parser.add_argument('--headroom', type=float, default=1.5,
+                        help='factor between the results and the budgets written with --write-budgets')
+    args = parser.parse_args()
+
+    with open(args.budgets) as f:
+        budgets = json.load(f)
+    if budgets.get('format') != BUDGETS_FORMAT:
+        print(f'Unsupported budgets format {budgets.get("format")}, expected {BUDGETS_FORMAT}')
+        return 1
+
+    failures = []
+    new_budgets = dict(budgets)
+    with tempfile.TemporaryDirectory() as work_dir:
+        micro = budgets.get('micro_benchmarks')
+        if micro:
+            if args.benchmarks is None:
+                parser.error('--benchmarks is needed for the micro-benchmark budgets')
+            times = run_micro_benchmarks(args.benchmarks, micro['max_us'].keys(), work_dir)
+            check_limits('micro_benchmarks', times, {'max': micro['max_us']}, failures)
+            new_budgets['micro_benchmarks'] = {'max_us': with_headroom(times, {'max': micro['max_us']},
+                                                                       args.headroom).get('max', {})}
+
+        cycle = budgets.get('update_cycle')
+        if cycle:
+            if args.uptane_gen is None or args.akt_test is None:
+                parser.error('--uptane-gen and --akt-test are needed for the update cycle budgets')
+            report = run_update_cycle(args, cycle, work_dir)
+            check_limits('update_cycle', report, cycle, failures)
+            new_budgets['update_cycle'] = with_headroom(report, cycle, args.headroom)
+
+        transfer = budgets.get('secondary_transfer')
+        if transfer:
+            if args.secondary_transfer is None:
+                parser.error('--secondary-transfer is needed for the Secondary transfer budgets')
+            report = run_secondary_transfer(args, transfer, work_dir)
+            check_limits('secondary_transfer', report, transfer, failures)
+            new_budgets['secondary_transfer'] = with_headroom(report, transfer, args.headroom)
+
+    if args.write_budgets is not None:
+        with open(args.write_budgets, 'w') as f:
+            json.dump(new_budgets, f, indent=2)
+            f.write('\n')
+        return 0
+
+    for failure in failures:
+        print(f'Over budget: {failure}')
+    if failures:
+        return 1
+    print(f'All results are within the budgets of {budgets.get("platform", args.budgets)}')
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -2,12 +2,15 @@
 
 import argparse
 import contextlib
+import gzip
 import multiprocessing
 import logging
 import os
 import sys
 import socket
 import socketserver
+import threading
+import time
 
 from http.server import SimpleHTTPRequestHandler, HTTPServer
 from os import path
@@ -18,29 +21,61 @@ logger = logging.getLogger("fake_test_server")
 
 
 class FailInjector:
+    # Every other request for a resource fails, so that concurrent requests
+    # for other ones don't make its retries fail too
     def __init__(self):
-        self.last_fails = False
+        self.last_fails = set()
+        self.lock = threading.Lock()
 
     def fail(self, http_handler):
-        if self.last_fails:
-            self.last_fails = False
-            return False
-        else:
-            http_handler.send_response(503)
-            http_handler.end_headers()
-            http_handler.wfile.write(b"Internal server error")
-            self.last_fails = True
-            return True
+        key = (http_handler.command, http_handler.path)
+        with self.lock:
+            if key in self.last_fails:
+                self.last_fails.remove(key)
+                return False
+            self.last_fails.add(key)
+        http_handler.send_response(503)
+        http_handler.end_headers()
+        http_handler.wfile.write(b"Internal server error")
+        return True
 
 
 class Handler(SimpleHTTPRequestHandler):
+    def setup(self):
+        super().setup()
+        with self.server.connections_lock:
+            self.server.connections += 1
+
+    def parse_request(self):
+        # Only /keep_alive/ keeps the connection open, its responses say how long they are
+        self.protocol_version = 'HTTP/1.0'
+        if not super().parse_request():
+            return False
+        if self.path.startswith('/keep_alive/') and self.request_version == 'HTTP/1.1':
+            self.protocol_version = 'HTTP/1.1'
+            self.close_connection = self.headers.get('Connection', '').lower() == 'close'
+        return True
+
     def _serve_simple(self, uri):
+        bandwidth = self.server.bandwidth
+        start = time.monotonic()
+        sent = 0
         with open(uri, 'rb') as source:
             while True:
-                data = source.read(1024)
+                data = source.read(1024 if bandwidth is None else 16384)
                 if not data:
                     break
                 self.wfile.write(data)
+                sent += len(data)
+                if bandwidth is not None:
+                    # as if the link carried `bandwidth` bytes per second
+                    delay = start + sent / bandwidth - time.monotonic()
+                    if delay > 0:
+                        sleep(delay)
+
+    def _delay(self):
+        if self.server.latency:
+            sleep(self.server.latency)
 
     def serve_meta(self, uri):
         if self.server.meta_path is None:
@@ -61,6 +96,7 @@ class Handler(SimpleHTTPRequestHandler):
         self._serve_simple(self.server.target_path + filename)
 
     def do_GET(self):
+        self._delay()
         if self.path.startswith("/director/") and self.path.endswith(".json"):
             role = self.path[len("/director/"):]
             self.serve_meta("/repo/director/" + role)
@@ -92,10 +128,17 @@ class Handler(SimpleHTTPRequestHandler):
             response_size = 100 * chunk_size
             if "Range" in self.headers:
                 r = self.headers["Range"]
-                r_from = int(r.split("=")[1].split("-")[0])
+                r_from, r_to = r.split("=")[1].split("-")
+                r_from = int(r_from)
+                r_to = min(int(r_to), response_size - 1) if r_to else response_size - 1
+                if r_from >= response_size:
+                    self.send_response(416)
+                    self.send_header('Content-Range', 'bytes */%d' % response_size)
+                    self.end_headers()
+                    return
                 self.send_response(206)
-                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, response_size-1, response_size))
-                response_size = response_size - r_from
+                self.send_header('Content-Range', 'bytes %d-%d/%d' % (r_from, r_to, response_size))
+                response_size = r_to - r_from + 1
             else:
                 self.send_response(200)
             self.send_header('Content-Type', 'application/json')
@@ -116,8 +159,30 @@ class Handler(SimpleHTTPRequestHandler):
             for i in range(5):
                 self.wfile.write(b'aa')
                 sleep(1)
+        elif self.path == '/compressed':
+            data = b'{"data": "%b"}' % (b'@' * 10000)
+            self.send_response(200)
+            if 'gzip' in self.headers.get('accept-encoding', ''):
+                data = gzip.compress(data)
+                self.send_header('Content-Encoding', 'gzip')
+            self.send_header('Content-Length', len(data))
+            self.end_headers()
+            self.wfile.write(data)
         elif self.path == '/campaigner/campaigns':
             self.serve_meta("/campaigns.json")
+        elif self.path.startswith('/keep_alive/'):
+            data = b'{"path": "%b"}' % bytes(self.path, "utf8")
+            self.send_response(200)
+            self.send_header('Content-Length', len(data))
+            self.end_headers()
+            self.wfile.write(data)
+        elif self.path == '/connections':
+            # Accepted so far, including this one
+            with self.server.connections_lock:
+                data = b'{"connections": %d}' % self.server.connections
+            self.send_response(200)
+            self.end_headers()
+            self.wfile.write(data)
         elif self.path == '/user_agent':
             user_agent = self.headers.get('user-agent')
             self.send_response(200)
@@ -131,6 +196,7 @@ class Handler(SimpleHTTPRequestHandler):
             self.wfile.write(b'{"path": "%b"}' % bytes(self.path, "utf8"))
 
     def do_POST(self):
+        self._delay()
         if self.server.fail_injector is not None and self.server.fail_injector.fail(self):
             return
 
@@ -171,15 +237,23 @@ class Handler(SimpleHTTPRequestHandler):
             self.send_response(200)
             self.end_headers()
             length = int(self.headers.get('content-length'))
-            result = b'{"data": %b, "path": "%b"}'%(self.rfile.read(length), bytes(self.path, "utf8"))
+            data = self.rfile.read(length)
+            if self.headers.get('content-encoding') == 'gzip':
+                data = gzip.decompress(data)
+            result = b'{"data": %b, "path": "%b"}'%(data, bytes(self.path, "utf8"))
             self.wfile.write(result)
 
     def do_PUT(self):
         self.do_POST()
 
+    def log_message(self, format, *args):
+        if not self.server.quiet:
+            super().log_message(format, *args)
+
 
 class FakeTestServer(socketserver.ThreadingMixIn, HTTPServer):
-    def __init__(self, addr, meta_path, target_path, srcdir=None, fail_injector=None):
+    def __init__(self, addr, meta_path, target_path, srcdir=None, fail_injector=None, latency=0,
+                 bandwidth=None, quiet=False):
         super(HTTPServer, self).__init__(server_address=addr, RequestHandlerClass=Handler)
         self.meta_path = meta_path
         if target_path is not None:
@@ -190,6 +264,12 @@ class FakeTestServer(socketserver.ThreadingMixIn, HTTPServer):
             self.target_path = None
         self.fail_injector = fail_injector
         self.srcdir = srcdir if srcdir is not None else os.getcwd()
+        # seconds before each response, and bytes per second of the served files
+        self.latency = latency
+        self.bandwidth = bandwidth
+        self.quiet = quiet
+        self.connections = 0
+        self.connections_lock = threading.Lock()
 
     def server_bind(self):
         self.socket.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
@@ -198,11 +278,12 @@ class FakeTestServer(socketserver.ThreadingMixIn, HTTPServer):
 
 class FakeTestServerBackground:
 
-    def __init__(self, meta_path, target_path=None, srcdir=None, port=0):
+    def __init__(self, meta_path, target_path=None, srcdir=None, port=0, latency=0, bandwidth=None):
         if srcdir is None:
             srcdir = os.getcwd()
         self._httpd = FakeTestServer(addr=('', port), meta_path=meta_path,
-                                     target_path=target_path, srcdir=srcdir)
+                                     target_path=target_path, srcdir=srcdir,
+                                     latency=latency, bandwidth=bandwidth)
         self._server_process = self.__class__.Process(target=self._httpd.serve_forever)
         self.base_url = 'http://localhost:{}'.format(self.port)
 
@@ -235,11 +316,17 @@ def main():
     parser.add_argument('-m', '--meta', help='meta directory', default=None)
     parser.add_argument('-f', '--fail', help='enable intermittent failure', action='store_true')
     parser.add_argument('-s', '--srcdir', help='path to the aktualizr source directory')
+    parser.add_argument('-l', '--latency', type=float, default=0,
+                        help='seconds to wait before each response')
+    parser.add_argument('-b', '--bandwidth', type=float, default=None,
+                        help='bytes per second to serve the metadata and targets at')
+    parser.add_argument('-q', '--quiet', action='store_true', help='do not log the requests')
     args = parser.parse_args()
 
     httpd = FakeTestServer(('', args.port), meta_path=args.meta,
                            target_path=args.targets, srcdir=args.srcdir,
-                           fail_injector=FailInjector() if args.fail else None)
+                           fail_injector=FailInjector() if args.fail else None,
+                           latency=args.latency, bandwidth=args.bandwidth, quiet=args.quiet)
     try:
         httpd.serve_forever()
     except KeyboardInterrupt:
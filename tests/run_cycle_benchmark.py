@@ -0,0 +1,138 @@
+#!/usr/bin/env python3
+
+import argparse
+import contextlib
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+from os import path
+from subprocess import run
+
+from fake_http_server.fake_test_server import FakeTestServerBackground
+
+
+"""
+Time the update cycles of a fleet of devices with aktualizr-cycle-simple,
+against the fake test server with the given latency and bandwidth and an
+Image repository with the given number of targets. The steps of the fake
+package manager take no time unless modelled with --install-time and the
+like.
+
+The timings of each phase, the CPU time, the peak RSS and the bytes
+transferred are printed and, with --report, written as JSON. With
+--baseline, the run fails if a phase is slower than in the baseline report
+by more than --tolerance, to catch performance regressions.
+"""
+
+
+@contextlib.contextmanager
+def uptane_repo(uptane_gen, targets, target_size):
+    with tempfile.TemporaryDirectory() as repo_path:
+        arepo = [uptane_gen, '--keytype', 'ed25519']
+        run([*arepo, 'generate', '--path', repo_path], check=True)
+        images_path = path.join(repo_path, 'images')
+        os.makedirs(images_path)
+        # the update, along with other targets that only make the metadata larger
+        images = []
+        for k in range(targets):
+            name = 'firmware.bin' if k == 0 else f'other-{k}.bin'
+            image = path.join(images_path, name)
+            with open(image, 'wb') as f:
+                f.write(os.urandom(target_size if k == 0 else 64))
+            images.append(f'{image} {name}\n')
+        images_list = path.join(repo_path, 'images.txt')
+        with open(images_list, 'w') as f:
+            f.writelines(images)
+        run([*arepo, 'images', '--path', repo_path, '--filename', images_list, '--hwid', 'primary_hw'],
+            check=True)
+        run([*arepo, 'addtarget', '--path', repo_path, '--targetname', 'firmware.bin',
+             '--hwid', 'primary_hw', '--serial', 'CA:FE:A6:D2:84:9D'], check=True)
+        run([*arepo, 'signtargets', '--path', repo_path], check=True)
+        yield repo_path
+
+
+def regressions(report, baseline, tolerance):
+    found = []
+    for phase, summary in report['phases'].items():
+        base = baseline['phases'].get(phase)
+        if base is None or base['count'] == 0 or summary['count'] == 0:
+            continue
+        if summary['p95_seconds'] > base['p95_seconds'] * (1 + tolerance):
+            found.append(f'{phase}: p95 of {summary["p95_seconds"]:.3f} s instead of {base["p95_seconds"]:.3f} s')
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the update cycle')
+    parser.add_argument('-n', '--cycles', type=int, default=10,
+                        help='update cycles run by each device')
+    parser.add_argument('-j', '--devices', type=int, default=1,
+                        help='devices updated at the same time')
+    parser.add_argument('--latency', type=float, default=0,
+                        help='seconds the server waits before each response')
+    parser.add_argument('--bandwidth', type=float, default=None,
+                        help='bytes per second the server serves the metadata and targets at')
+    parser.add_argument('--targets', type=int, default=1,
+                        help='number of targets in the Image repository')
+    parser.add_argument('--target-size', type=int, default=1 << 20,
+                        help='size in bytes of the target to install')
+    for step in ['fetch', 'install', 'finalize']:
+        parser.add_argument(f'--{step}-time',
+                            help=f'time the {step} step of the fake package manager takes, '
+                                 'as S, fixed:S, uniform:MIN:MAX or exponential:MEAN in seconds')
+    for step in ['fetch', 'install']:
+        parser.add_argument(f'--{step}-time-per-mib',
+                            help=f'time the {step} step takes for each MiB of the target')
+    parser.add_argument('--report', help='write the report to this file, as JSON')
+    parser.add_argument('--baseline', help='report of a previous run to compare with')
+    parser.add_argument('--tolerance', type=float, default=0.2,
+                        help='slowdown of the 95th percentile of a phase over the baseline that fails the run')
+    parser.add_argument('--akt-srcdir', help='path to the aktualizr source directory')
+    parser.add_argument('--uptane-gen', required=True, help='path to uptane-generator executable')
+    parser.add_argument('--akt-test', required=True, help='path to aktualizr-cycle-simple')
+    args = parser.parse_args()
+
+    srcdir = path.abspath(args.akt_srcdir) if args.akt_srcdir is not None else os.getcwd()
+
+    with uptane_repo(args.uptane_gen, max(1, args.targets), args.target_size) as repo_dir, \
+            FakeTestServerBackground(repo_dir, srcdir=srcdir, latency=args.latency,
+                                     bandwidth=args.bandwidth) as uptane_server, \
+            tempfile.TemporaryDirectory() as storage_dir:
+
+        server = f'http://localhost:{uptane_server.port}'
+        report_path = path.join(storage_dir, 'report.json')
+        model = []
+        for option in ['fetch_time', 'fetch_time_per_mib', 'install_time', 'install_time_per_mib', 'finalize_time']:
+            value = getattr(args, option)
+            if value is not None:
+                model += ['--' + option.replace('_', '-'), value]
+        cp = run([path.abspath(args.akt_test), storage_dir, server, '--cycles', str(args.cycles),
+                  '--devices', str(args.devices), '--loglevel', '3', '--report', report_path, *model],
+                 cwd=srcdir)
+        if not path.exists(report_path):
+            print('aktualizr-cycle-simple did not write a report')
+            return 1
+        with open(report_path) as f:
+            report = json.load(f)
+
+    if args.report is not None:
+        with open(args.report, 'w') as f:
+            json.dump(report, f, indent=2)
+
+    if args.baseline is not None:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        found = regressions(report, baseline, args.tolerance)
+        for r in found:
+            print(f'Regression in {r}')
+        if found:
+            return 1
+
+    return cp.returncode
+
+
+if __name__ == '__main__':
+    sys.exit(main())
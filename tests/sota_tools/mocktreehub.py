@@ -20,6 +20,14 @@ class TreehubServer(BaseHTTPRequestHandler):
         obj = self._ostree_object()
         if self.path == '/token':
             self._respond({'access_token': "dummytoken123"})
+        elif obj and self.headers['Content-Range'] and hasattr(self._ostree_repo, 'upload_chunk'):
+            # "bytes <first>-<last>/<total>"
+            first_last, total = self.headers['Content-Range'].split(' ')[1].split('/')
+            first, last = first_last.split('-')
+            body = self.rfile.read(int(self.headers['Content-Length']))
+            code = self._ostree_repo.upload_chunk(obj, int(first), int(last), int(total), body)
+            self.send_response_only(code)
+            self.end_headers()
         elif obj:
             code = self._ostree_repo.upload(obj)
             self.send_response_only(code)
@@ -0,0 +1,94 @@
+#! /usr/bin/env python3
+
+from mocktreehub import TreehubServer, TemporaryCredentials
+from socketserver import ThreadingTCPServer
+import os
+import subprocess
+import threading
+
+import sys
+
+repo = 'bigger_repo'
+chunk_size = 100
+
+
+class OstreeRepo(object):
+    """
+    Put the chunks of the large objects together, failing every 5th of them
+    """
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.chunks = 0
+        self.objects = {}
+        self.restarted = False
+
+    def upload(self, name):
+        return 204
+
+    def upload_chunk(self, name, first, last, total, body):
+        with self.lock:
+            self.chunks += 1
+            data = self.objects.setdefault(name, bytearray())
+            if first == 0 and len(data) > 0:
+                print("Upload of %s restarted after %d bytes" % (name, len(data)))
+                self.restarted = True
+                data.clear()
+            if first != len(data) or last - first + 1 != len(body) or last - first + 1 > chunk_size:
+                print("Unexpected chunk %d-%d/%d of %s" % (first, last, total, name))
+                return 416
+            if self.chunks % 5 == 0:
+                return 500
+            data.extend(body)
+            print("Uploaded %d-%d/%d of %s" % (first, last, total, name))
+            return 204 if len(data) == total else 202
+
+    def query(self, name):
+        return 404
+
+
+def main():
+    ostree_repo = OstreeRepo()
+
+    def handler(*args):
+        TreehubServer(ostree_repo, *args)
+
+    httpd = ThreadingTCPServer(('localhost', 0), handler)
+    address, port = httpd.socket.getsockname()
+    print("Serving at port", port)
+    t = threading.Thread(target=httpd.serve_forever)
+    t.setDaemon(True)
+    t.start()
+
+    target = sys.argv[1]
+
+    with TemporaryCredentials(port) as creds:
+        dut = subprocess.Popen(args=[target, '--credentials', creds.path(), '--ref', 'master',
+                                     '--repo', repo, '--upload-chunk-size', str(chunk_size)])
+        try:
+            exitcode = dut.wait(60)
+            if exitcode != 0:
+                print("garage-push failed")
+                sys.exit(1)
+        except subprocess.TimeoutExpired:
+            print("garage-push hung")
+            sys.exit(1)
+
+    if ostree_repo.restarted:
+        print("A failed chunk restarted the upload of its object")
+        sys.exit(1)
+    objects_dir = os.path.join(repo, 'objects')
+    for prefix in os.listdir(objects_dir):
+        for name in os.listdir(os.path.join(objects_dir, prefix)):
+            with open(os.path.join(objects_dir, prefix, name), 'rb') as f:
+                content = f.read()
+            if len(content) <= chunk_size:
+                continue
+            uploaded = ostree_repo.objects.get(prefix + '/' + name)
+            if uploaded != content:
+                print("%s/%s was not uploaded in chunks as it is" % (prefix, name))
+                sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
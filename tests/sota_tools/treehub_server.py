@@ -10,7 +10,7 @@ import sys
 import time
 import hashlib
 from contextlib import ExitStack
-from http.server import BaseHTTPRequestHandler, HTTPServer
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
 from random import seed, randrange
 from pathlib import Path
 from tempfile import TemporaryDirectory
@@ -19,6 +19,12 @@ from tempfile import TemporaryDirectory
 class TreehubServerHandler(BaseHTTPRequestHandler):
     made_requests = 0
 
+    def send_response_only(self, code, message=None, length=0):
+        super().send_response_only(code, message)
+        if args.keep_alive:
+            # The connection stays open, so the end of the response has to be known
+            self.send_header('Content-Length', str(length))
+
     def do_HEAD(self):
         if self.drop_check():
             print("Dropping HEAD request %s" % self.path)
@@ -40,7 +46,7 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
         if os.path.exists(path):
             if args.sleep and args.sleep > 0.0:
                 time.sleep(args.sleep)
-            self.send_response_only(200)
+            self.send_response_only(200, length=os.path.getsize(path))
             self.end_headers()
             with open(path, 'rb') as source:
                 while True:
@@ -82,6 +88,9 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
         elif ctype == 'application/octet-stream':
             length = int(self.headers['content-length'])
             body = self.rfile.read(length)
+            if self.path == '/objects/presence':
+                self.check_presence(body)
+                return
             full_path = os.path.join(repo_path, self.path[1:])
             os.system("mkdir -p %s" % os.path.dirname(full_path))
             with open(full_path, "wb") as f:
@@ -93,6 +102,19 @@ class TreehubServerHandler(BaseHTTPRequestHandler):
         self.send_response_only(400)
         self.end_headers()
 
+    def check_presence(self, body):
+        if not args.batch_presence:
+            self.send_response_only(404)
+            self.end_headers()
+            return
+        objects = [line for line in body.decode('ascii').split('\n') if line]
+        print("Processing presence check of %d objects" % len(objects))
+        present = [obj for obj in objects if os.path.exists(os.path.join(repo_path, 'objects', obj))]
+        response = ''.join(obj + '\n' for obj in present).encode('ascii')
+        self.send_response_only(200, length=len(response))
+        self.end_headers()
+        self.wfile.write(response)
+
     def drop_check(self):
         self.__class__.made_requests += 1
         if args.fail and args.fail > 0:
@@ -167,7 +189,13 @@ if __name__ == "__main__":
                         help='sleep for n.n seconds for every GET request')
     parser.add_argument('-t', '--tls', action='store_true',
                         help='require TLS from clients')
+    parser.add_argument('-b', '--batch-presence', action='store_true',
+                        help='check the presence of objects in batches')
+    parser.add_argument('-k', '--keep-alive', action='store_true',
+                        help='keep the connections open with HTTP/1.1')
     args = parser.parse_args()
+    if args.keep_alive:
+        TreehubServerHandler.protocol_version = 'HTTP/1.1'
 
     signal.signal(signal.SIGTERM, sig_handler)
     try:
@@ -178,7 +206,7 @@ if __name__ == "__main__":
                 repo_path = stack.enter_context(TemporaryDirectory(prefix='treehub-'))
             if args.create:
                 create_repo(repo_path, args.system)
-            httpd = HTTPServer(('', args.port), TreehubServerHandler)
+            httpd = ThreadingHTTPServer(('', args.port), TreehubServerHandler)
             if args.tls:
                 httpd.socket = ssl.wrap_socket(httpd.socket,
                                                certfile='tests/fake_http_server/server.crt',
@@ -95,6 +95,17 @@ struct UptaneTestCommon {
     return ecu_config;
   }
 
+  // count in-memory Secondaries with pooled keys, written to a new Secondary config file
+  static std::vector<Primary::VirtualSecondaryConfig> addScaleSecondaries(Config& config,
+                                                                          const TemporaryDirectory& temp_dir,
+                                                                          size_t count, const std::string& hw_id,
+                                                                          size_t key_pool_size = 0) {
+    auto ecu_configs = Primary::VirtualSecondaryConfig::generate(count, "scale_serial", hw_id, key_pool_size);
+    config.uptane.secondary_config_file = temp_dir / "virtual_secondary_conf.json";
+    Primary::VirtualSecondaryConfig::dumpAll(ecu_configs, config.uptane.secondary_config_file);
+    return ecu_configs;
+  }
+
   static Primary::VirtualSecondaryConfig altVirtualConfiguration(const boost::filesystem::path& client_dir) {
     const boost::filesystem::path sec_dir = client_dir / boost::filesystem::unique_path();
     Utils::createDirectories(sec_dir, S_IRWXU);